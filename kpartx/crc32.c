@@ -62,31 +62,261 @@ uint32_t attribute((pure)) crc32_le(uint32_t crc, unsigned char const *p, size_t
 }
 #else				/* Table-based approach */
 
-static uint32_t *crc32table_le;
+/*
+ * With 8 bits at a time, 8 tables are used to process 8 bytes per
+ * iteration ("slicing-by-8"). crc32table_le[k][i] is the CRC of byte i
+ * followed by k zero bytes.
+ */
+#if CRC_LE_BITS == 8
+#define CRC_LE_TABLES 8
+#else
+#define CRC_LE_TABLES 1
+#endif
+
+static uint32_t (*crc32table_le)[1 << CRC_LE_BITS];
+static uint32_t (*crc32_le_fn)(uint32_t crc, unsigned char const *p,
+			       size_t len);
+
+static uint32_t attribute((pure))
+crc32_le_generic(uint32_t crc, unsigned char const *p, size_t len)
+{
+# if CRC_LE_BITS == 8
+	uint32_t a, b;
+
+	while (len >= 8) {
+		a = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+		b = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+		crc = crc32table_le[7][a & 255] ^
+			crc32table_le[6][(a >> 8) & 255] ^
+			crc32table_le[5][(a >> 16) & 255] ^
+			crc32table_le[4][a >> 24] ^
+			crc32table_le[3][b & 255] ^
+			crc32table_le[2][(b >> 8) & 255] ^
+			crc32table_le[1][(b >> 16) & 255] ^
+			crc32table_le[0][b >> 24];
+		p += 8;
+		len -= 8;
+	}
+# endif
+	while (len--) {
+# if CRC_LE_BITS == 8
+		crc = (crc >> 8) ^ crc32table_le[0][(crc ^ *p++) & 255];
+# elif CRC_LE_BITS == 4
+		crc ^= *p++;
+		crc = (crc >> 4) ^ crc32table_le[0][crc & 15];
+		crc = (crc >> 4) ^ crc32table_le[0][crc & 15];
+# elif CRC_LE_BITS == 2
+		crc ^= *p++;
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+		crc = (crc >> 2) ^ crc32table_le[0][crc & 3];
+# endif
+	}
+	return crc;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_CRC32_CLMUL 1
+
+/*
+ * CRC32 by folding with carry-less multiplication, see Intel's "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ * The SSE4.2 crc32 instruction computes CRC32C (Castagnoli), which is a
+ * different polynomial, and can't be used here.
+ * Requires len >= 64 and len % 16 == 0.
+ */
+static uint32_t attribute((pure, target("sse4.1,pclmul")))
+crc32_le_clmul(uint32_t crc, unsigned char const *p, size_t len)
+{
+	/* x^(4*128+32) mod P, x^(4*128-32) mod P, bit-reflected */
+	static const uint64_t attribute((aligned(16))) k1k2[] = {
+		0x0154442bd4, 0x01c6e41596
+	};
+	/* the same for 128 bits */
+	static const uint64_t attribute((aligned(16))) k3k4[] = {
+		0x01751997d0, 0x00ccaa009e
+	};
+	static const uint64_t attribute((aligned(16))) k5k0[] = {
+		0x0163cd6124, 0x0000000000
+	};
+	/* P and mu = x^64 / P, for the Barrett reduction */
+	static const uint64_t attribute((aligned(16))) poly[] = {
+		0x01db710641, 0x01f7011641
+	};
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	p += 64;
+	len -= 64;
+
+	/* Fold 512 bits at a time */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		p += 64;
+		len -= 64;
+	}
+
+	/* Fold into 128 bits */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Fold the remaining 128-bit blocks */
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)p);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		p += 16;
+		len -= 16;
+	}
+
+	/* Fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t attribute((pure))
+crc32_le_x86(uint32_t crc, unsigned char const *p, size_t len)
+{
+	size_t n;
+
+	if (len < 64)
+		return crc32_le_generic(crc, p, len);
+	n = len & ~(size_t)15;
+	crc = crc32_le_clmul(crc, p, n);
+	return crc32_le_generic(crc, p + n, len - n);
+}
+
+static void crc32_le_select(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") &&
+	    __builtin_cpu_supports("sse4.1"))
+		crc32_le_fn = crc32_le_x86;
+}
+
+#elif defined(__aarch64__) && defined(__GNUC__) && __GNUC__ >= 6
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+
+/* The ARMv8 CRC32 instructions use the CRC32 (not CRC32C) polynomial */
+static uint32_t attribute((pure, target("+crc")))
+crc32_le_armv8(uint32_t crc, unsigned char const *p, size_t len)
+{
+	uint64_t v;
+
+	while (len && ((uintptr_t)p & 7)) {
+		crc = __crc32b(crc, *p++);
+		len--;
+	}
+	while (len >= 8) {
+		v = *(const uint64_t *)p;
+		crc = __crc32d(crc, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = __crc32b(crc, *p++);
+	return crc;
+}
+
+static void crc32_le_select(void)
+{
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		crc32_le_fn = crc32_le_armv8;
+}
+
+#else
+static void crc32_le_select(void)
+{
+}
+#endif
+
 /**
  * crc32init_le() - allocate and initialize LE table data
  *
  * crc is the crc of the byte i; other entries are filled in based on the
  * fact that crctable[i^j] = crctable[i] ^ crctable[j].
  *
+ * Also selects the fastest implementation for this CPU.
  */
 static int
 crc32init_le(void)
 {
-	unsigned i, j;
+	unsigned i, j, k;
 	uint32_t crc = 1;
 
 	crc32table_le =
-		malloc((1 << CRC_LE_BITS) * sizeof(uint32_t));
+		malloc(CRC_LE_TABLES * (1 << CRC_LE_BITS) * sizeof(uint32_t));
 	if (!crc32table_le)
 		return 1;
-	crc32table_le[0] = 0;
+	crc32table_le[0][0] = 0;
 
 	for (i = 1 << (CRC_LE_BITS - 1); i; i >>= 1) {
 		crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
 		for (j = 0; j < 1 << CRC_LE_BITS; j += 2 * i)
-			crc32table_le[i + j] = crc ^ crc32table_le[j];
+			crc32table_le[0][i + j] = crc ^ crc32table_le[0][j];
 	}
+	for (k = 1; k < CRC_LE_TABLES; k++)
+		for (i = 0; i < 1 << CRC_LE_BITS; i++) {
+			crc = crc32table_le[k - 1][i];
+			crc32table_le[k][i] = (crc >> 8) ^
+				crc32table_le[0][crc & 255];
+		}
+
+	crc32_le_fn = crc32_le_generic;
+	crc32_le_select();
 	return 0;
 }
 
@@ -98,6 +328,7 @@ crc32cleanup_le(void)
 {
 	if (crc32table_le) free(crc32table_le);
 	crc32table_le = NULL;
+	crc32_le_fn = NULL;
 }
 
 /**
@@ -110,22 +341,7 @@ crc32cleanup_le(void)
  */
 uint32_t attribute((pure)) crc32_le(uint32_t crc, unsigned char const *p, size_t len)
 {
-	while (len--) {
-# if CRC_LE_BITS == 8
-		crc = (crc >> 8) ^ crc32table_le[(crc ^ *p++) & 255];
-# elif CRC_LE_BITS == 4
-		crc ^= *p++;
-		crc = (crc >> 4) ^ crc32table_le[crc & 15];
-		crc = (crc >> 4) ^ crc32table_le[crc & 15];
-# elif CRC_LE_BITS == 2
-		crc ^= *p++;
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-# endif
-	}
-	return crc;
+	return crc32_le_fn(crc, p, len);
 }
 #endif
 
@@ -55,6 +55,29 @@ out:
 	return r;
 }
 
+#ifdef LIBDM_API_COOKIE
+/* In batch mode, all tasks share one cookie, see dm_batch_begin() */
+static int batch_mode;
+static uint32_t batch_cookie;
+#endif
+
+void dm_batch_begin(void)
+{
+#ifdef LIBDM_API_COOKIE
+	batch_mode = 1;
+#endif
+}
+
+void dm_batch_end(void)
+{
+#ifdef LIBDM_API_COOKIE
+	if (batch_cookie)
+		dm_udev_wait(batch_cookie);
+	batch_cookie = 0;
+	batch_mode = 0;
+#endif
+}
+
 int dm_simplecmd(int task, const char *name, int no_flush, uint16_t udev_flags)
 {
 	int r = 0;
@@ -62,6 +85,7 @@ int dm_simplecmd(int task, const char *name, int no_flush, uint16_t udev_flags)
 			      task == DM_DEVICE_REMOVE);
 #ifdef LIBDM_API_COOKIE
 	uint32_t cookie = 0;
+	uint32_t *cookiep = batch_mode ? &batch_cookie : &cookie;
 #endif
 	struct dm_task *dmt;
 
@@ -80,12 +104,12 @@ int dm_simplecmd(int task, const char *name, int no_flush, uint16_t udev_flags)
 #ifdef LIBDM_API_COOKIE
 	if (!udev_sync)
 		udev_flags |= DM_UDEV_DISABLE_LIBRARY_FALLBACK;
-	if (udev_wait_flag && !dm_task_set_cookie(dmt, &cookie, udev_flags))
+	if (udev_wait_flag && !dm_task_set_cookie(dmt, cookiep, udev_flags))
 		goto out;
 #endif
 	r = dm_task_run(dmt);
 #ifdef LIBDM_API_COOKIE
-	if (udev_wait_flag)
+	if (udev_wait_flag && !batch_mode)
 			dm_udev_wait(cookie);
 #endif
 out:
@@ -138,6 +162,7 @@ int dm_addmap(int task, const char *name, const char *target,
 	char *prefixed_uuid = NULL;
 #ifdef LIBDM_API_COOKIE
 	uint32_t cookie = 0;
+	uint32_t *cookiep = batch_mode ? &batch_cookie : &cookie;
 	uint16_t udev_flags = 0;
 #endif
 
@@ -174,12 +199,12 @@ int dm_addmap(int task, const char *name, const char *target,
 	if (!udev_sync)
 		udev_flags = DM_UDEV_DISABLE_LIBRARY_FALLBACK;
 	if (task == DM_DEVICE_CREATE &&
-	    !dm_task_set_cookie(dmt, &cookie, udev_flags))
+	    !dm_task_set_cookie(dmt, cookiep, udev_flags))
 		goto addout;
 #endif
 	r = dm_task_run (dmt);
 #ifdef LIBDM_API_COOKIE
-	if (task == DM_DEVICE_CREATE)
+	if (task == DM_DEVICE_CREATE && !batch_mode)
 			dm_udev_wait(cookie);
 #endif
 addout:
@@ -416,6 +441,49 @@ out:
 	return r;
 }
 
+/*
+ * Returns 1 if the active table of name consists of a single target with
+ * the given type, size and parameters, and the read-only state matches.
+ * Reloading such a map would only suspend and resume it.
+ */
+int dm_table_unchanged(const char *name, const char *target,
+		       const char *params, uint64_t size, int ro)
+{
+	int r = 0;
+	struct dm_task *dmt;
+	struct dm_info info;
+	uint64_t start, length;
+	char *target_type = NULL;
+	char *tparams = NULL;
+	void *next;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_TABLE)))
+		return 0;
+
+	if (!dm_task_set_name(dmt, name))
+		goto out;
+	dm_task_no_open_count(dmt);
+
+	if (!dm_task_run(dmt) || !dm_task_get_info(dmt, &info) ||
+	    !info.exists)
+		goto out;
+
+	/* Don't skip the reload if the map isn't in a clean state */
+	if (info.suspended || info.inactive_table)
+		goto out;
+
+	next = dm_get_next_target(dmt, NULL, &start, &length,
+				  &target_type, &tparams);
+	if (next == NULL && start == 0 && length == size &&
+	    target_type && !strcmp(target_type, target) &&
+	    tparams && !strcmp(tparams, params) &&
+	    !info.read_only == !ro)
+		r = 1;
+out:
+	dm_task_destroy(dmt);
+	return r;
+}
+
 static int
 dm_get_opencount (const char * mapname)
 {
@@ -10,9 +10,17 @@
 extern int udev_sync;
 
 int dm_prereq (char *, uint32_t, uint32_t, uint32_t);
+/*
+ * Between dm_batch_begin() and dm_batch_end(), dm_simplecmd() and
+ * dm_addmap() don't wait for udev. dm_batch_end() waits for all of them.
+ */
+void dm_batch_begin(void);
+void dm_batch_end(void);
 int dm_simplecmd (int, const char *, int, uint16_t);
 int dm_addmap (int, const char *, const char *, const char *, uint64_t,
 	       int, const char *, int, mode_t, uid_t, gid_t);
+int dm_table_unchanged(const char *name, const char *target,
+		       const char *params, uint64_t size, int ro);
 char * dm_mapname(int major, int minor);
 dev_t dm_get_first_dep(char *devname);
 char * dm_mapuuid(const char *mapname);
@@ -207,9 +207,7 @@ read_lba(int fd, uint64_t lba, void *buffer, size_t bytes)
 	uint64_t lastlba;
 	ssize_t bytesread;
 
-	if (lseek(fd, offset, SEEK_SET) < 0)
-		return 0;
-	bytesread = read(fd, buffer, bytes);
+	bytesread = read_cached(fd, offset, buffer, bytes);
 
 	lastlba = last_lba(fd);
 	if (!lastlba)
@@ -32,18 +32,16 @@
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <libdevmapper.h>
 
 #include "devmapper.h"
-#include "crc32.h"
 #include "lopart.h"
 #include "kpartx.h"
 #include "version.h"
 
 #define SIZE(a) (sizeof(a)/sizeof((a)[0]))
 
-#define MAXTYPES	64
-#define MAXSLICES	256
 #define DM_TARGET	"linear"
 #define LO_NAME_SIZE    64
 #define PARTNAME_SIZE	128
@@ -53,44 +51,9 @@ struct slice slices[MAXSLICES];
 
 enum action { LIST, ADD, DELETE, UPDATE };
 
-struct pt {
-	char *type;
-	ptreader *fn;
-} pts[MAXTYPES];
-
-int ptct = 0;
 int udev_sync = 1;
 
-static void
-addpts(char *t, ptreader f)
-{
-	if (ptct >= MAXTYPES) {
-		fprintf(stderr, "addpts: too many types\n");
-		exit(1);
-	}
-	pts[ptct].type = t;
-	pts[ptct].fn = f;
-	ptct++;
-}
-
-static void
-initpts(void)
-{
-	addpts("gpt", read_gpt_pt);
-	addpts("dos", read_dos_pt);
-	addpts("bsd", read_bsd_pt);
-	addpts("solaris", read_solaris_pt);
-	addpts("unixware", read_unixware_pt);
-	addpts("dasd", read_dasd_pt);
-	addpts("mac", read_mac_pt);
-	addpts("sun", read_sun_pt);
-	addpts("ps3", read_ps3_pt);
-}
-
-static char short_opts[] = "rladfgvp:t:snu";
-
-/* Used in gpt.c */
-int force_gpt=0;
+static char short_opts[] = "rladfgvp:t:snub";
 
 int force_devmap=0;
 
@@ -99,6 +62,8 @@ usage(void) {
 	printf(VERSION_STRING);
 	printf("Usage:\n");
 	printf("  kpartx [-a|-d|-u|-l] [-r] [-p] [-f] [-g] [-s|-n] [-v] wholedisk\n");
+	printf("  kpartx -b [-a|-d|-u|-l] [-r] [-p] [-f] [-g] [-s|-n] [-v] wholedisk...\n");
+	printf("\t-b batch mode: handle all given block devices\n");
 	printf("\t-a add partition devmappings\n");
 	printf("\t-r devmappings will be readonly\n");
 	printf("\t-d del partition devmappings\n");
@@ -226,30 +191,438 @@ xmalloc (size_t size) {
 	return t;
 }
 
+static void
+list_slices(struct slice *sp, int n, const char *mapname, const char *delim,
+	    const char *device)
+{
+	int j, c, d, m;
+
+	for (j = 0, c = 0, m = 0; j < n; j++) {
+		if (sp[j].size == 0)
+			continue;
+		if (sp[j].container > 0) {
+			c++;
+			continue;
+		}
+
+		sp[j].minor = m++;
+
+		printf("%s%s%d : 0 %" PRIu64 " %s %" PRIu64"\n",
+		       mapname, delim, j+1,
+		       sp[j].size, device,
+		       sp[j].start);
+	}
+	/* Loop to resolve contained slices */
+	d = c;
+	while (c) {
+		for (j = 0; j < n; j++) {
+			uint64_t start;
+			int k = sp[j].container - 1;
+
+			if (sp[j].size == 0)
+				continue;
+			if (sp[j].minor > 0)
+				continue;
+			if (sp[j].container == 0)
+				continue;
+			sp[j].minor = m++;
+
+			start = sp[j].start - sp[k].start;
+			printf("%s%s%d : 0 %" PRIu64 " /dev/dm-%d %" PRIu64 "\n",
+			       mapname, delim, j+1,
+			       sp[j].size,
+			       sp[k].minor, start);
+			c--;
+		}
+		/* Terminate loop if nothing more to resolve */
+		if (d == c)
+			break;
+	}
+}
+
+/*
+ * ADD and UPDATE: create or reload the partition maps for the n slices
+ * in sp. UPDATE also removes maps of partitions that no longer exist.
+ * Returns the number of failures.
+ */
+static int
+add_slices(struct slice *sp, int n, enum action what, char *mapname,
+	   const char *delim, char *uuid, const struct stat *buf, int ro,
+	   int verbose)
+{
+	char partname[PARTNAME_SIZE], params[PARTNAME_SIZE + 16];
+	int j, c, d, op, r = 0;
+
+	memset(&partname, 0, sizeof(partname));
+	/* ADD and UPDATE share the same code that adds new partitions. */
+	for (j = 0, c = 0; j < n; j++) {
+		char *part_uuid, *reason;
+
+		if (sp[j].size == 0)
+			continue;
+
+		/* Skip all contained slices */
+		if (sp[j].container > 0) {
+			c++;
+			continue;
+		}
+
+		if (safe_sprintf(params, "%d:%d %" PRIu64 ,
+				 major(buf->st_rdev), minor(buf->st_rdev), sp[j].start)) {
+			fprintf(stderr, "params too small\n");
+			exit(1);
+		}
+
+		op = (dm_find_part(mapname, delim, j + 1, uuid,
+				   partname, sizeof(partname),
+				   &part_uuid, verbose) ?
+		      DM_DEVICE_RELOAD : DM_DEVICE_CREATE);
+
+		if (part_uuid && uuid) {
+			if (check_uuid(uuid, part_uuid, &reason) != 0) {
+				fprintf(stderr, "%s is already in use, and %s\n", partname, reason);
+				r++;
+				free(part_uuid);
+				continue;
+			}
+			free(part_uuid);
+		}
+
+		if (op == DM_DEVICE_RELOAD &&
+		    dm_table_unchanged(partname, DM_TARGET, params,
+				       sp[j].size, ro)) {
+			if (verbose)
+				printf("map %s unchanged\n", partname);
+			dm_devn(partname, &sp[j].major, &sp[j].minor);
+			continue;
+		}
+
+		if (!dm_addmap(op, partname, DM_TARGET, params,
+			       sp[j].size, ro, uuid, j+1,
+			       buf->st_mode & 0777, buf->st_uid,
+			       buf->st_gid)) {
+			fprintf(stderr, "create/reload failed on %s\n",
+				partname);
+			r++;
+			continue;
+		}
+		if (op == DM_DEVICE_RELOAD &&
+		    !dm_simplecmd(DM_DEVICE_RESUME, partname,
+				  1, MPATH_UDEV_RELOAD_FLAG)) {
+			fprintf(stderr, "resume failed on %s\n",
+				partname);
+			r++;
+			continue;
+		}
+
+		dm_devn(partname, &sp[j].major,
+			&sp[j].minor);
+
+		if (verbose)
+			printf("add map %s (%d:%d): 0 %" PRIu64 " %s %s\n",
+			       partname, sp[j].major,
+			       sp[j].minor, sp[j].size,
+			       DM_TARGET, params);
+	}
+	/* Loop to resolve contained slices */
+	d = c;
+	while (c) {
+		for (j = 0; j < n; j++) {
+			char *part_uuid, *reason;
+			int k = sp[j].container - 1;
+
+			if (sp[j].size == 0)
+				continue;
+
+			/* Skip all existing slices */
+			if (sp[j].minor > 0)
+				continue;
+
+			/* Skip all simple slices */
+			if (sp[j].container == 0)
+				continue;
+
+			/* Check container slice */
+			if (sp[k].size == 0)
+				fprintf(stderr, "Invalid slice %d\n",
+					k);
+
+			if (safe_sprintf(params, "%d:%d %" PRIu64,
+					 major(buf->st_rdev), minor(buf->st_rdev),
+					 sp[j].start)) {
+				fprintf(stderr, "params too small\n");
+				exit(1);
+			}
+
+			op = (dm_find_part(mapname, delim, j + 1, uuid,
+					   partname,
+					   sizeof(partname),
+					   &part_uuid, verbose) ?
+			      DM_DEVICE_RELOAD : DM_DEVICE_CREATE);
+
+			if (part_uuid && uuid) {
+				if (check_uuid(uuid, part_uuid, &reason) != 0) {
+					fprintf(stderr, "%s is already in use, and %s\n", partname, reason);
+					free(part_uuid);
+					continue;
+				}
+				free(part_uuid);
+			}
+
+			if (op == DM_DEVICE_RELOAD &&
+			    dm_table_unchanged(partname, DM_TARGET, params,
+					       sp[j].size, ro)) {
+				if (verbose)
+					printf("map %s unchanged\n",
+					       partname);
+				dm_devn(partname, &sp[j].major,
+					&sp[j].minor);
+				c--;
+				continue;
+			}
+
+			dm_addmap(op, partname, DM_TARGET, params,
+				  sp[j].size, ro, uuid, j+1,
+				  buf->st_mode & 0777,
+				  buf->st_uid, buf->st_gid);
+
+			if (op == DM_DEVICE_RELOAD)
+				dm_simplecmd(DM_DEVICE_RESUME,
+					     partname, 1,
+					     MPATH_UDEV_RELOAD_FLAG);
+			dm_devn(partname, &sp[j].major,
+				&sp[j].minor);
+
+			if (verbose)
+				printf("add map %s (%d:%d): 0 %" PRIu64 " %s %s\n",
+				       partname, sp[j].major, sp[j].minor, sp[j].size,
+				       DM_TARGET, params);
+			c--;
+		}
+		/* Terminate loop */
+		if (d == c)
+			break;
+	}
+
+	if (what == ADD) {
+		/* Skip code that removes devmappings for deleted partitions */
+		return r;
+	}
+
+	for (j = MAXSLICES-1; j >= 0; j--) {
+		char *part_uuid, *reason;
+		if (sp[j].size ||
+		    !dm_find_part(mapname, delim, j + 1, uuid,
+				  partname, sizeof(partname),
+				  &part_uuid, verbose))
+			continue;
+
+		if (part_uuid && uuid) {
+			if (check_uuid(uuid, part_uuid, &reason) != 0) {
+				fprintf(stderr, "%s is %s. Not removing\n", partname, reason);
+				free(part_uuid);
+				continue;
+			}
+			free(part_uuid);
+		}
+
+		if (!dm_simplecmd(DM_DEVICE_REMOVE,
+				  partname, 1, 0)) {
+			fprintf(stderr, "failed to remove %s",
+				partname);
+			r++;
+			continue;
+		}
+		if (verbose)
+			printf("del devmap : %s\n", partname);
+	}
+	return r;
+}
+
+/* Number of devices whose partition tables are read at once in batch mode */
+#define SCAN_THREADS	16
+
+struct batch_dev {
+	char *device;
+	struct stat buf;
+	int n;
+	int r;
+	struct slice slices[MAXSLICES];
+};
+
+struct batch_scan {
+	struct batch_dev *devs;
+	int ndevs;
+	const char *type;
+	pthread_mutex_t lock;
+	int next;
+};
+
+static void
+scan_device(struct batch_dev *dp, const char *type)
+{
+	int fd;
+
+	fd = open(dp->device, O_RDONLY | O_DIRECT);
+	if (fd == -1) {
+		perror(dp->device);
+		dp->r = 1;
+		return;
+	}
+	dp->n = read_ptable(fd, type, dp->slices, MAXSLICES);
+	close(fd);
+}
+
+static void *
+scan_thread(void *arg)
+{
+	struct batch_scan *bs = arg;
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&bs->lock);
+		i = bs->next++;
+		pthread_mutex_unlock(&bs->lock);
+		if (i >= bs->ndevs)
+			break;
+		if (!bs->devs[i].r)
+			scan_device(&bs->devs[i], bs->type);
+	}
+	return NULL;
+}
+
+/* Read the partition tables of all devices in parallel */
+static void
+scan_devices(struct batch_dev *devs, int ndevs, const char *type)
+{
+	struct batch_scan bs = {
+		.devs = devs,
+		.ndevs = ndevs,
+		.type = type,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.next = 0,
+	};
+	pthread_t threads[SCAN_THREADS - 1];
+	int i, nthreads;
+
+	for (nthreads = 0; nthreads < SCAN_THREADS - 1 &&
+		     nthreads < ndevs - 1; nthreads++)
+		if (pthread_create(&threads[nthreads], NULL, scan_thread, &bs))
+			break;
+	scan_thread(&bs);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/*
+ * Batch mode: handle all devices in one process. The partition tables
+ * are read in parallel, and the device-mapper tasks for all devices
+ * share one udev cookie, so that udev is waited for only once.
+ */
+static int
+batch_main(char **devices, int ndevs, enum action what, const char *type,
+	   const char *delim, int ro, int verbose)
+{
+	struct batch_dev *devs;
+	char delimbuf[DELIM_SIZE];
+	char *mapname, *dmname, *uuid, *dmuuid;
+	const char *dl;
+	int i, failed = 0;
+
+	devs = calloc(ndevs, sizeof(*devs));
+	if (!devs) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < ndevs; i++) {
+		devs[i].device = devices[i];
+		if (stat(devices[i], &devs[i].buf)) {
+			printf("failed to stat() %s\n", devices[i]);
+			devs[i].r = 1;
+		} else if (!S_ISBLK(devs[i].buf.st_mode)) {
+			fprintf(stderr, "invalid device: %s\n", devices[i]);
+			devs[i].r = 1;
+		}
+	}
+
+	if (what != DELETE)
+		scan_devices(devs, ndevs, type);
+
+	dm_batch_begin();
+	for (i = 0; i < ndevs; i++) {
+		struct batch_dev *dp = &devs[i];
+
+		if (dp->r || (what != DELETE && dp->n <= 0))
+			continue;
+
+		dmuuid = NULL;
+		dmname = dm_mapname(major(dp->buf.st_rdev),
+				    minor(dp->buf.st_rdev));
+		if (dmname)
+			dmuuid = dm_mapuuid(dmname);
+		uuid = dmuuid;
+		if (!uuid && !(what == DELETE && force_devmap))
+			uuid = nondm_create_uuid(dp->buf.st_rdev);
+		mapname = dmname ? dmname :
+			dp->device + find_devname_offset(dp->device);
+		dl = delim;
+		if (dl == NULL) {
+			memset(delimbuf, 0, sizeof(delimbuf));
+			set_delimiter(mapname, delimbuf);
+			dl = delimbuf;
+		}
+
+		switch (what) {
+		case LIST:
+			list_slices(dp->slices, dp->n, mapname, dl,
+				    dp->device);
+			break;
+		case ADD:
+		case UPDATE:
+			dp->r = add_slices(dp->slices, dp->n, what, mapname, dl,
+					   uuid, &dp->buf, ro, verbose);
+			break;
+		case DELETE:
+			dp->r = dm_remove_partmaps(mapname, uuid,
+						   dp->buf.st_rdev, verbose);
+			break;
+		}
+		free(dmuuid);
+		free(dmname);
+	}
+	dm_batch_end();
+
+	for (i = 0; i < ndevs; i++) {
+		if (devs[i].r) {
+			fprintf(stderr, "%s: failed\n", devs[i].device);
+			failed++;
+		} else if (verbose)
+			printf("%s: %d slices\n", devs[i].device,
+			       devs[i].n > 0 ? devs[i].n : 0);
+	}
+	if (verbose || failed)
+		printf("%d of %d devices failed\n", failed, ndevs);
+	free(devs);
+	return failed ? 1 : 0;
+}
+
 int
 main(int argc, char **argv){
-	int i, j, m, n, op, off, arg, c, d, ro=0;
+	int i, n, off, arg, ro=0;
 	int fd = -1;
-	struct slice all;
-	struct pt *ptp;
 	enum action what = LIST;
 	char *type, *diskdevice, *device, *progname;
 	int verbose = 0;
-	char partname[PARTNAME_SIZE], params[PARTNAME_SIZE + 16];
 	char * loopdev = NULL;
 	char * delim = NULL;
 	char *uuid = NULL;
 	char *mapname = NULL;
 	int hotplug = 0;
 	int loopcreated = 0;
+	int batch = 0;
 	struct stat buf;
 
-	initpts();
-	init_crc32();
-
 	type = device = diskdevice = NULL;
-	memset(&all, 0, sizeof(all));
-	memset(&partname, 0, sizeof(partname));
 
 	/* Check whether hotplug mode. */
 	progname = strrchr(argv[0], '/');
@@ -311,6 +684,9 @@ main(int argc, char **argv){
 		case 'u':
 			what = UPDATE;
 			break;
+		case 'b':
+			batch = 1;
+			break;
 		default:
 			usage();
 			exit(1);
@@ -328,6 +704,17 @@ main(int argc, char **argv){
 		exit(1);
 	}
 
+	if (batch && !hotplug) {
+		if (optind >= argc) {
+			usage();
+			exit(1);
+		}
+		i = batch_main(argv + optind, argc - optind, what, type, delim,
+			       ro, verbose);
+		dm_lib_exit();
+		return i;
+	}
+
 	if (hotplug) {
 		/* already got [disk]device */
 	} else if (optind == argc-2) {
@@ -430,247 +817,27 @@ main(int argc, char **argv){
 		goto end;
 	}
 
-	for (i = 0; i < ptct; i++) {
-		ptp = &pts[i];
-
-		if (type && strcmp(type, ptp->type))
-			continue;
-
-		/* here we get partitions */
-		n = ptp->fn(fd, all, slices, SIZE(slices));
-
-#ifdef DEBUG
-		if (n >= 0)
-			printf("%s: %d slices\n", ptp->type, n);
-#endif
-
-		if (n > 0) {
-			close(fd);
-			fd = -1;
-		}
-		else
-			continue;
-
-		switch(what) {
-		case LIST:
-			for (j = 0, c = 0, m = 0; j < n; j++) {
-				if (slices[j].size == 0)
-					continue;
-				if (slices[j].container > 0) {
-					c++;
-					continue;
-				}
-
-				slices[j].minor = m++;
-
-				printf("%s%s%d : 0 %" PRIu64 " %s %" PRIu64"\n",
-				       mapname, delim, j+1,
-				       slices[j].size, device,
-				       slices[j].start);
-			}
-			/* Loop to resolve contained slices */
-			d = c;
-			while (c) {
-				for (j = 0; j < n; j++) {
-					uint64_t start;
-					int k = slices[j].container - 1;
-
-					if (slices[j].size == 0)
-						continue;
-					if (slices[j].minor > 0)
-						continue;
-					if (slices[j].container == 0)
-						continue;
-					slices[j].minor = m++;
-
-					start = slices[j].start - slices[k].start;
-					printf("%s%s%d : 0 %" PRIu64 " /dev/dm-%d %" PRIu64 "\n",
-					       mapname, delim, j+1,
-					       slices[j].size,
-					       slices[k].minor, start);
-					c--;
-				}
-				/* Terminate loop if nothing more to resolve */
-				if (d == c)
-					break;
-			}
-
-			break;
-
-		case ADD:
-		case UPDATE:
-			/* ADD and UPDATE share the same code that adds new partitions. */
-			for (j = 0, c = 0; j < n; j++) {
-				char *part_uuid, *reason;
-
-				if (slices[j].size == 0)
-					continue;
-
-				/* Skip all contained slices */
-				if (slices[j].container > 0) {
-					c++;
-					continue;
-				}
-
-				if (safe_sprintf(params, "%d:%d %" PRIu64 ,
-						 major(buf.st_rdev), minor(buf.st_rdev), slices[j].start)) {
-					fprintf(stderr, "params too small\n");
-					exit(1);
-				}
-
-				op = (dm_find_part(mapname, delim, j + 1, uuid,
-						   partname, sizeof(partname),
-						   &part_uuid, verbose) ?
-				      DM_DEVICE_RELOAD : DM_DEVICE_CREATE);
-
-				if (part_uuid && uuid) {
-					if (check_uuid(uuid, part_uuid, &reason) != 0) {
-						fprintf(stderr, "%s is already in use, and %s\n", partname, reason);
-						r++;
-						free(part_uuid);
-						continue;
-					}
-					free(part_uuid);
-				}
-
-				if (!dm_addmap(op, partname, DM_TARGET, params,
-					       slices[j].size, ro, uuid, j+1,
-					       buf.st_mode & 0777, buf.st_uid,
-					       buf.st_gid)) {
-					fprintf(stderr, "create/reload failed on %s\n",
-						partname);
-					r++;
-					continue;
-				}
-				if (op == DM_DEVICE_RELOAD &&
-				    !dm_simplecmd(DM_DEVICE_RESUME, partname,
-						  1, MPATH_UDEV_RELOAD_FLAG)) {
-					fprintf(stderr, "resume failed on %s\n",
-						partname);
-					r++;
-					continue;
-				}
-
-				dm_devn(partname, &slices[j].major,
-					&slices[j].minor);
-
-				if (verbose)
-					printf("add map %s (%d:%d): 0 %" PRIu64 " %s %s\n",
-					       partname, slices[j].major,
-					       slices[j].minor, slices[j].size,
-					       DM_TARGET, params);
-			}
-			/* Loop to resolve contained slices */
-			d = c;
-			while (c) {
-				for (j = 0; j < n; j++) {
-					char *part_uuid, *reason;
-					int k = slices[j].container - 1;
-
-					if (slices[j].size == 0)
-						continue;
-
-					/* Skip all existing slices */
-					if (slices[j].minor > 0)
-						continue;
-
-					/* Skip all simple slices */
-					if (slices[j].container == 0)
-						continue;
-
-					/* Check container slice */
-					if (slices[k].size == 0)
-						fprintf(stderr, "Invalid slice %d\n",
-							k);
-
-					if (safe_sprintf(params, "%d:%d %" PRIu64,
-							 major(buf.st_rdev), minor(buf.st_rdev),
-							 slices[j].start)) {
-						fprintf(stderr, "params too small\n");
-						exit(1);
-					}
-
-					op = (dm_find_part(mapname, delim, j + 1, uuid,
-							   partname,
-							   sizeof(partname),
-							   &part_uuid, verbose) ?
-					      DM_DEVICE_RELOAD : DM_DEVICE_CREATE);
-
-					if (part_uuid && uuid) {
-						if (check_uuid(uuid, part_uuid, &reason) != 0) {
-							fprintf(stderr, "%s is already in use, and %s\n", partname, reason);
-							free(part_uuid);
-							continue;
-						}
-						free(part_uuid);
-					}
-
-					dm_addmap(op, partname, DM_TARGET, params,
-						  slices[j].size, ro, uuid, j+1,
-						  buf.st_mode & 0777,
-						  buf.st_uid, buf.st_gid);
-
-					if (op == DM_DEVICE_RELOAD)
-						dm_simplecmd(DM_DEVICE_RESUME,
-							     partname, 1,
-							     MPATH_UDEV_RELOAD_FLAG);
-					dm_devn(partname, &slices[j].major,
-						&slices[j].minor);
-
-					if (verbose)
-						printf("add map %s (%d:%d): 0 %" PRIu64 " %s %s\n",
-						       partname, slices[j].major, slices[j].minor, slices[j].size,
-						       DM_TARGET, params);
-					c--;
-				}
-				/* Terminate loop */
-				if (d == c)
-					break;
-			}
-
-			if (what == ADD) {
-				/* Skip code that removes devmappings for deleted partitions */
-				break;
-			}
-
-			for (j = MAXSLICES-1; j >= 0; j--) {
-				char *part_uuid, *reason;
-				if (slices[j].size ||
-				    !dm_find_part(mapname, delim, j + 1, uuid,
-						  partname, sizeof(partname),
-						  &part_uuid, verbose))
-					continue;
-
-				if (part_uuid && uuid) {
-					if (check_uuid(uuid, part_uuid, &reason) != 0) {
-						fprintf(stderr, "%s is %s. Not removing\n", partname, reason);
-						free(part_uuid);
-						continue;
-					}
-					free(part_uuid);
-				}
-
-				if (!dm_simplecmd(DM_DEVICE_REMOVE,
-						  partname, 1, 0)) {
-					fprintf(stderr, "failed to remove %s",
-						partname);
-					r++;
-					continue;
-				}
-				if (verbose)
-					printf("del devmap : %s\n", partname);
-			}
+	/* here we get partitions */
+	n = read_ptable(fd, type, slices, SIZE(slices));
+	close(fd);
 
-		default:
-			break;
+	switch(what) {
+	case LIST:
+		if (n > 0)
+			list_slices(slices, n, mapname, delim, device);
+		break;
 
-		}
+	case ADD:
+	case UPDATE:
 		if (n > 0)
-			break;
+			r += add_slices(slices, n, what, mapname, delim, uuid,
+					&buf, ro, verbose);
+		break;
+
+	default:
+		break;
 	}
 	if (what == LIST && loopcreated) {
-		if (fd != -1)
-			close(fd);
 		if (del_loop(device)) {
 			if (verbose)
 				fprintf(stderr, "can't del loop : %s\n",
@@ -686,101 +853,3 @@ end:
 
 	return r;
 }
-
-/*
- * sseek: seek to specified sector
- */
-
-static int
-sseek(int fd, unsigned int secnr, int secsz) {
-	off64_t in, out;
-	in = ((off64_t) secnr * secsz);
-	out = 1;
-
-	if ((out = lseek64(fd, in, SEEK_SET)) != in)
-	{
-		fprintf(stderr, "llseek error\n");
-		return -1;
-	}
-	return 0;
-}
-
-int
-aligned_malloc(void **mem_p, size_t align, size_t *size_p)
-{
-	static size_t pgsize = 0;
-	size_t size;
-	int err;
-
-	if (!mem_p || !align || (size_p && !*size_p))
-		return EINVAL;
-
-	if (!pgsize)
-		pgsize = getpagesize();
-
-	if (size_p)
-		size = ((*size_p + align - 1) / align) * align;
-	else
-		size = pgsize;
-
-	err = posix_memalign(mem_p, pgsize, size);
-	if (!err && size_p)
-		*size_p = size;
-	return err;
-}
-
-/* always in sector size blocks */
-static
-struct block {
-	unsigned int secnr;
-	char *block;
-	struct block *next;
-} *blockhead;
-
-/* blknr is always in 512 byte blocks */
-char *
-getblock (int fd, unsigned int blknr) {
-	int secsz = get_sector_size(fd);
-	unsigned int blks_per_sec = secsz / 512;
-	unsigned int secnr = blknr / blks_per_sec;
-	unsigned int blk_off = (blknr % blks_per_sec) * 512;
-	struct block *bp;
-
-	for (bp = blockhead; bp; bp = bp->next)
-
-		if (bp->secnr == secnr)
-			return bp->block + blk_off;
-
-	if (sseek(fd, secnr, secsz))
-		return NULL;
-
-	bp = xmalloc(sizeof(struct block));
-	bp->secnr = secnr;
-	bp->next = blockhead;
-	blockhead = bp;
-	if (aligned_malloc((void **)&bp->block, secsz, NULL)) {
-		fprintf(stderr, "aligned_malloc failed\n");
-		exit(1);
-	}
-
-	if (read(fd, bp->block, secsz) != secsz) {
-		fprintf(stderr, "read error, sector %d\n", secnr);
-		blockhead = bp->next;
-		free(bp->block);
-		free(bp);
-		return NULL;
-	}
-
-	return bp->block + blk_off;
-}
-
-int
-get_sector_size(int filedes)
-{
-	int rc, sector_size = 512;
-
-	rc = ioctl(filedes, BLKSSZGET, &sector_size);
-	if (rc)
-		sector_size = 512;
-	return sector_size;
-}
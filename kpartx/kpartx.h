@@ -4,6 +4,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "ptable.h"
 
 /*
  * For each partition type there is a routine that takes
@@ -36,17 +39,6 @@
 int
 get_sector_size(int filedes);
 
-/*
- * units: 512 byte sectors
- */
-struct slice {
-	uint64_t start;
-	uint64_t size;
-	int container;
-	unsigned int major;
-	unsigned int minor;
-};
-
 typedef int (ptreader)(int fd, struct slice all, struct slice *sp,
 		       unsigned int ns);
 
@@ -64,6 +56,8 @@ extern ptreader read_ps3_pt;
 
 int aligned_malloc(void **mem_p, size_t align, size_t *size_p);
 char *getblock(int fd, unsigned int secnr);
+ssize_t read_cached(int fd, uint64_t offset, void *buf, size_t bytes);
+void drop_cached(int fd);
 
 static inline unsigned int
 four2int(unsigned char *p) {
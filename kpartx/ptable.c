@@ -0,0 +1,247 @@
+/*
+ * Partition table reading for kpartx and multipathd
+ *
+ * Copyrights of kpartx.c apply
+ * Copyright (c) 2004, 2005 Christophe Varoqui
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <pthread.h>
+
+#include "crc32.h"
+#include "kpartx.h"
+
+/* Used in gpt.c */
+int force_gpt = 0;
+
+/*
+ * dasd.c needs the dm helpers of kpartx, and is only linked into kpartx
+ * itself. Programs linking libkpartx.a without it don't read DASD labels.
+ */
+extern ptreader read_dasd_pt __attribute__((weak));
+
+static const struct pt {
+	const char *type;
+	ptreader *fn;
+} pts[] = {
+	{ "gpt", read_gpt_pt },
+	{ "dos", read_dos_pt },
+	{ "bsd", read_bsd_pt },
+	{ "solaris", read_solaris_pt },
+	{ "unixware", read_unixware_pt },
+	{ "dasd", read_dasd_pt },
+	{ "mac", read_mac_pt },
+	{ "sun", read_sun_pt },
+	{ "ps3", read_ps3_pt },
+};
+
+static pthread_once_t ptable_once = PTHREAD_ONCE_INIT;
+
+static void
+init_ptable(void)
+{
+	init_crc32();
+}
+
+int
+read_ptable(int fd, const char *type, struct slice *sp, unsigned int ns)
+{
+	struct slice all;
+	unsigned int i;
+	int n = -1;
+
+	pthread_once(&ptable_once, init_ptable);
+	memset(&all, 0, sizeof(all));
+	for (i = 0; i < sizeof(pts) / sizeof(pts[0]); i++) {
+		if (!pts[i].fn || (type && strcmp(type, pts[i].type)))
+			continue;
+		n = pts[i].fn(fd, all, sp, ns);
+#ifdef DEBUG
+		if (n >= 0)
+			printf("%s: %d slices\n", pts[i].type, n);
+#endif
+		if (n > 0)
+			break;
+	}
+	drop_cached(fd);
+	return n;
+}
+
+int
+aligned_malloc(void **mem_p, size_t align, size_t *size_p)
+{
+	static size_t pgsize = 0;
+	size_t size;
+	int err;
+
+	if (!mem_p || !align || (size_p && !*size_p))
+		return EINVAL;
+
+	if (!pgsize)
+		pgsize = getpagesize();
+
+	if (size_p)
+		size = ((*size_p + align - 1) / align) * align;
+	else
+		size = pgsize;
+
+	err = posix_memalign(mem_p, pgsize, size);
+	if (!err && size_p)
+		*size_p = size;
+	return err;
+}
+
+/*
+ * The device is read in aligned chunks, so that parsers walking many
+ * sectors don't need a read for every one of them. The chunk at the end
+ * of the device may be short. Chunks are looked up by file descriptor,
+ * so that batch mode can scan several devices at once.
+ */
+#define CHUNK_SIZE (64 * 1024)
+#define CHUNK_HASH_SIZE 256
+
+static struct chunk {
+	int fd;
+	uint64_t nr;
+	size_t len;
+	char *data;
+	struct chunk *next;
+} *chunk_hash[CHUNK_HASH_SIZE];
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct chunk **
+chunk_head (int fd, uint64_t nr) {
+	return &chunk_hash[(nr + fd * 31) % CHUNK_HASH_SIZE];
+}
+
+static struct chunk *
+find_chunk (int fd, uint64_t nr) {
+	struct chunk *cp;
+
+	pthread_mutex_lock(&chunk_lock);
+	for (cp = *chunk_head(fd, nr); cp; cp = cp->next)
+		if (cp->fd == fd && cp->nr == nr)
+			break;
+	pthread_mutex_unlock(&chunk_lock);
+	return cp;
+}
+
+/* Chunks are only added by the thread reading from fd */
+static struct chunk *
+get_chunk (int fd, uint64_t nr) {
+	struct chunk **head;
+	struct chunk *cp;
+	size_t size = CHUNK_SIZE;
+	ssize_t len;
+
+	cp = find_chunk(fd, nr);
+	if (cp)
+		return cp;
+
+	cp = malloc(sizeof(struct chunk));
+	if (!cp)
+		return NULL;
+	if (aligned_malloc((void **)&cp->data, get_sector_size(fd), &size)) {
+		free(cp);
+		return NULL;
+	}
+	len = pread(fd, cp->data, CHUNK_SIZE, (off_t)nr * CHUNK_SIZE);
+	if (len <= 0) {
+		free(cp->data);
+		free(cp);
+		return NULL;
+	}
+	cp->fd = fd;
+	cp->nr = nr;
+	cp->len = len;
+	pthread_mutex_lock(&chunk_lock);
+	head = chunk_head(fd, nr);
+	cp->next = *head;
+	*head = cp;
+	pthread_mutex_unlock(&chunk_lock);
+	return cp;
+}
+
+/* Free the cached chunks of fd, before closing it */
+void
+drop_cached (int fd) {
+	struct chunk **pp, *cp;
+	int i;
+
+	pthread_mutex_lock(&chunk_lock);
+	for (i = 0; i < CHUNK_HASH_SIZE; i++) {
+		pp = &chunk_hash[i];
+		while ((cp = *pp)) {
+			if (cp->fd != fd) {
+				pp = &cp->next;
+				continue;
+			}
+			*pp = cp->next;
+			free(cp->data);
+			free(cp);
+		}
+	}
+	pthread_mutex_unlock(&chunk_lock);
+}
+
+/*
+ * Read bytes at offset through the chunk cache.
+ * Returns the number of bytes read, which is less than bytes at the
+ * end of the device or on error.
+ */
+ssize_t
+read_cached (int fd, uint64_t offset, void *buf, size_t bytes) {
+	size_t done = 0, coff, n;
+	struct chunk *cp;
+
+	while (done < bytes) {
+		cp = get_chunk(fd, (offset + done) / CHUNK_SIZE);
+		coff = (offset + done) % CHUNK_SIZE;
+		if (!cp || cp->len <= coff)
+			break;
+		n = cp->len - coff;
+		if (n > bytes - done)
+			n = bytes - done;
+		memcpy((char *)buf + done, cp->data + coff, n);
+		done += n;
+		if (cp->len < CHUNK_SIZE)
+			break;
+	}
+	return done;
+}
+
+/* blknr is always in 512 byte blocks */
+char *
+getblock (int fd, unsigned int blknr) {
+	int secsz = get_sector_size(fd);
+	unsigned int blks_per_sec = secsz / 512;
+	unsigned int secnr = blknr / blks_per_sec;
+	uint64_t offset = (uint64_t)secnr * secsz;
+	unsigned int blk_off = (blknr % blks_per_sec) * 512;
+	size_t coff = offset % CHUNK_SIZE;
+	struct chunk *cp;
+
+	cp = get_chunk(fd, offset / CHUNK_SIZE);
+	if (!cp || cp->len < coff + secsz) {
+		fprintf(stderr, "read error, sector %d\n", secnr);
+		return NULL;
+	}
+	return cp->data + coff + blk_off;
+}
+
+int
+get_sector_size(int filedes)
+{
+	int rc, sector_size = 512;
+
+	rc = ioctl(filedes, BLKSSZGET, &sector_size);
+	if (rc)
+		sector_size = 512;
+	return sector_size;
+}
@@ -0,0 +1,33 @@
+#ifndef _PTABLE_H
+#define _PTABLE_H
+
+#include <stdint.h>
+
+/*
+ * The partition table readers of kpartx, which are linked into multipathd
+ * as libkpartx.a, too. Unlike kpartx.h, this header can be included
+ * together with the libmultipath headers.
+ */
+
+#define MAXSLICES	256
+
+/*
+ * units: 512 byte sectors
+ */
+struct slice {
+	uint64_t start;
+	uint64_t size;
+	int container;
+	unsigned int major;
+	unsigned int minor;
+};
+
+/*
+ * Read the partition table of fd with the reader for type, or, if type is
+ * NULL, with each reader in turn until one finds slices. Returns the
+ * number of entries in sp, or 0 or -1 if no partition table was found.
+ * The chunks of fd cached while reading are dropped before returning.
+ */
+int read_ptable(int fd, const char *type, struct slice *sp, unsigned int ns);
+
+#endif /* _PTABLE_H */
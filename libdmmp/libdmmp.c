@@ -19,6 +19,7 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/time.h>
@@ -42,9 +43,15 @@
  */
 
 #define _DMMP_IPC_SHOW_JSON_CMD			"show maps json"
+#define _DMMP_IPC_SHOW_MAP_JSON_CMD		"show map %s json"
+#define _DMMP_IPC_SHOW_SINCE_JSON_CMD		"show maps since %" PRIu64 " json"
 #define _DMMP_JSON_MAJOR_KEY			"major_version"
 #define _DMMP_JSON_MAJOR_VERSION		0
 #define _DMMP_JSON_MAPS_KEY			"maps"
+#define _DMMP_JSON_MAP_KEY			"map"
+#define _DMMP_JSON_GENERATION_KEY		"generation"
+#define _DMMP_JSON_COMPLETE_KEY			"complete"
+#define _DMMP_JSON_REMOVED_KEY			"removed"
 #define _ERRNO_STR_BUFF_SIZE			256
 #define _IPC_MAX_CMD_LEN			512
 /* ^ Was _MAX_CMD_LEN in ./libmultipath/uxsock.h */
@@ -57,6 +64,9 @@ struct dmmp_context {
 	int log_priority;
 	void *userdata;
 	unsigned int tmo;
+	int persistent_ipc;
+	/* connection kept open if persistent_ipc is set, or -1 */
+	int ipc_fd;
 	char last_err_msg[_LAST_ERR_MSG_BUFF_SIZE];
 };
 
@@ -69,10 +79,18 @@ struct dmmp_context {
  * Need to free `*output` string manually.
  */
 static int _process_cmd(struct dmmp_context *ctx, int fd, const char *cmd,
-			char **output);
+			char **output, bool *resent);
 
 static int _ipc_connect(struct dmmp_context *ctx, int *fd);
 
+/*
+ * Connect (or reuse the persistent connection), run the command and
+ * disconnect unless the connection should be kept.
+ * Need to free `*output` string manually.
+ */
+static int _ipc_cmd(struct dmmp_context *ctx, const char *cmd,
+		    char **output);
+
 _dmmp_getter_func_gen(dmmp_context_log_priority_get,
 		      struct dmmp_context, ctx, log_priority,
 		      int);
@@ -83,6 +101,9 @@ _dmmp_getter_func_gen(dmmp_context_userdata_get, struct dmmp_context, ctx,
 _dmmp_getter_func_gen(dmmp_context_timeout_get, struct dmmp_context, ctx, tmo,
 		      unsigned int);
 
+_dmmp_getter_func_gen(dmmp_context_persistent_ipc_get, struct dmmp_context,
+		      ctx, persistent_ipc, int);
+
 _dmmp_getter_func_gen(dmmp_last_error_msg, struct dmmp_context, ctx,
 		      last_err_msg, const char *);
 
@@ -118,6 +139,8 @@ struct dmmp_context *dmmp_context_new(void)
 	ctx->log_priority = DMMP_LOG_PRIORITY_DEFAULT;
 	ctx->userdata = NULL;
 	ctx->tmo = _DEFAULT_UXSOCK_TIMEOUT;
+	ctx->persistent_ipc = 0;
+	ctx->ipc_fd = -1;
 	memset(ctx->last_err_msg, 0, _LAST_ERR_MSG_BUFF_SIZE);
 
 	return ctx;
@@ -125,6 +148,8 @@ struct dmmp_context *dmmp_context_new(void)
 
 void dmmp_context_free(struct dmmp_context *ctx)
 {
+	if (ctx != NULL && ctx->ipc_fd >= 0)
+		mpath_disconnect(ctx->ipc_fd);
 	free(ctx);
 }
 
@@ -140,6 +165,16 @@ void dmmp_context_timeout_set(struct dmmp_context *ctx, unsigned int tmo)
 	ctx->tmo = tmo;
 }
 
+void dmmp_context_persistent_ipc_set(struct dmmp_context *ctx, int enable)
+{
+	assert(ctx != NULL);
+	ctx->persistent_ipc = enable ? 1 : 0;
+	if (!ctx->persistent_ipc && ctx->ipc_fd >= 0) {
+		mpath_disconnect(ctx->ipc_fd);
+		ctx->ipc_fd = -1;
+	}
+}
+
 void dmmp_context_log_func_set
 	(struct dmmp_context *ctx,
 	 void (*log_func)(struct dmmp_context *ctx, int priority,
@@ -156,35 +191,19 @@ void dmmp_context_userdata_set(struct dmmp_context *ctx, void *userdata)
 	ctx->userdata = userdata;
 }
 
-int dmmp_mpath_array_get(struct dmmp_context *ctx,
-			 struct dmmp_mpath ***dmmp_mps, uint32_t *dmmp_mp_count)
+/*
+ * Parse the JSON output of multipathd and check its major version.
+ * Need to free `*j_obj` via json_object_put() manually.
+ */
+static int _json_parse(struct dmmp_context *ctx, const char *j_str,
+		       json_object **j_obj)
 {
-	struct dmmp_mpath *dmmp_mp = NULL;
 	int rc = DMMP_OK;
-	char *j_str = NULL;
-	json_object *j_obj = NULL;
-	json_object *j_obj_map = NULL;
 	enum json_tokener_error j_err = json_tokener_success;
 	json_tokener *j_token = NULL;
-	struct array_list *ar_maps = NULL;
-	uint32_t i = 0;
 	int cur_json_major_version = -1;
-	int ar_maps_len = -1;
-	int ipc_fd = -1;
-
-	assert(ctx != NULL);
-	assert(dmmp_mps != NULL);
-	assert(dmmp_mp_count != NULL);
 
-	*dmmp_mps = NULL;
-	*dmmp_mp_count = 0;
-
-	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
-
-	_good(_process_cmd(ctx, ipc_fd, _DMMP_IPC_SHOW_JSON_CMD, &j_str),
-	      rc, out);
-
-	_debug(ctx, "Got json output from multipathd: '%s'", j_str);
+	*j_obj = NULL;
 
 	j_token = json_tokener_new();
 	if (j_token == NULL) {
@@ -192,9 +211,9 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 		_error(ctx, "BUG: json_tokener_new() retuned NULL");
 		goto out;
 	}
-	j_obj = json_tokener_parse_ex(j_token, j_str, strlen(j_str) + 1);
+	*j_obj = json_tokener_parse_ex(j_token, j_str, strlen(j_str) + 1);
 
-	if (j_obj == NULL) {
+	if (*j_obj == NULL) {
 		rc = DMMP_ERR_IPC_ERROR;
 		j_err = json_tokener_get_error(j_token);
 		_error(ctx, "Failed to parse JSON output from multipathd IPC: "
@@ -202,7 +221,7 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 		goto out;
 	}
 
-	_json_obj_get_value(ctx, j_obj, cur_json_major_version,
+	_json_obj_get_value(ctx, *j_obj, cur_json_major_version,
 			    _DMMP_JSON_MAJOR_KEY, json_type_int,
 			    json_object_get_int, rc, out);
 
@@ -216,6 +235,31 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 	_debug(ctx, "multipathd JSON major version(%d) check pass",
 	       _DMMP_JSON_MAJOR_VERSION);
 
+out:
+	if (j_token != NULL)
+		json_tokener_free(j_token);
+	if (rc != DMMP_OK && *j_obj != NULL) {
+		json_object_put(*j_obj);
+		*j_obj = NULL;
+	}
+	return rc;
+}
+
+/*
+ * Convert the "maps" array of the JSON output into a 'struct dmmp_mpath'
+ * pointer array.
+ */
+static int _json_maps_get(struct dmmp_context *ctx, json_object *j_obj,
+			  struct dmmp_mpath ***dmmp_mps,
+			  uint32_t *dmmp_mp_count)
+{
+	struct dmmp_mpath *dmmp_mp = NULL;
+	int rc = DMMP_OK;
+	json_object *j_obj_map = NULL;
+	struct array_list *ar_maps = NULL;
+	uint32_t i = 0;
+	int ar_maps_len = -1;
+
 	_json_obj_get_value(ctx, j_obj, ar_maps, _DMMP_JSON_MAPS_KEY,
 			    json_type_array, json_object_get_array, rc, out);
 
@@ -258,11 +302,181 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 	}
 
 out:
-	if (ipc_fd >= 0)
-		mpath_disconnect(ipc_fd);
+	return rc;
+}
+
+int dmmp_mpath_array_get(struct dmmp_context *ctx,
+			 struct dmmp_mpath ***dmmp_mps, uint32_t *dmmp_mp_count)
+{
+	int rc = DMMP_OK;
+	char *j_str = NULL;
+	json_object *j_obj = NULL;
+
+	assert(ctx != NULL);
+	assert(dmmp_mps != NULL);
+	assert(dmmp_mp_count != NULL);
+
+	*dmmp_mps = NULL;
+	*dmmp_mp_count = 0;
+
+	_good(_ipc_cmd(ctx, _DMMP_IPC_SHOW_JSON_CMD, &j_str), rc, out);
+
+	_debug(ctx, "Got json output from multipathd: '%s'", j_str);
+
+	_good(_json_parse(ctx, j_str, &j_obj), rc, out);
+	_good(_json_maps_get(ctx, j_obj, dmmp_mps, dmmp_mp_count), rc, out);
+
+out:
+	free(j_str);
+	if (j_obj != NULL)
+		json_object_put(j_obj);
+
+	if (rc != DMMP_OK) {
+		dmmp_mpath_array_free(*dmmp_mps, *dmmp_mp_count);
+		*dmmp_mps = NULL;
+		*dmmp_mp_count = 0;
+	}
+
+	return rc;
+}
+
+int dmmp_mpath_get(struct dmmp_context *ctx, const char *mpath_name,
+		   struct dmmp_mpath **dmmp_mp)
+{
+	int rc = DMMP_OK;
+	char cmd[_IPC_MAX_CMD_LEN];
+	char *j_str = NULL;
+	json_object *j_obj = NULL;
+	json_object *j_obj_map = NULL;
+
+	assert(ctx != NULL);
+	assert(mpath_name != NULL);
+	assert(dmmp_mp != NULL);
+
+	*dmmp_mp = NULL;
+
+	snprintf(cmd, _IPC_MAX_CMD_LEN, _DMMP_IPC_SHOW_MAP_JSON_CMD,
+		 mpath_name);
+	if (strlen(cmd) == _IPC_MAX_CMD_LEN - 1 ||
+	    strchr(mpath_name, ' ') != NULL) {
+		rc = DMMP_ERR_INVALID_ARGUMENT;
+		_error(ctx, "Invalid mpath name %s", mpath_name);
+		goto out;
+	}
+
+	_good(_ipc_cmd(ctx, cmd, &j_str), rc, out);
+
+	/* _ipc_cmd() already make sure j_str is not NULL */
+	if (strncmp(j_str, "fail", strlen("fail")) == 0) {
+		rc = DMMP_ERR_MPATH_NOT_FOUND;
+		_error(ctx, "Specified mpath %s not found", mpath_name);
+		goto out;
+	}
+
+	_debug(ctx, "Got json output from multipathd: '%s'", j_str);
+
+	_good(_json_parse(ctx, j_str, &j_obj), rc, out);
+	_json_obj_get_value(ctx, j_obj, j_obj_map, _DMMP_JSON_MAP_KEY,
+			    json_type_object, (json_object *), rc, out);
+
+	*dmmp_mp = _dmmp_mpath_new();
+	_dmmp_alloc_null_check(ctx, *dmmp_mp, rc, out);
+	rc = _dmmp_mpath_update(ctx, *dmmp_mp, j_obj_map);
+	/* _dmmp_mpath_update() frees dmmp_mp on failure */
+	if (rc != DMMP_OK)
+		*dmmp_mp = NULL;
+
+out:
+	free(j_str);
+	if (j_obj != NULL)
+		json_object_put(j_obj);
+	return rc;
+}
+
+int dmmp_mpath_array_get_changed(struct dmmp_context *ctx,
+				 uint64_t *generation,
+				 struct dmmp_mpath ***dmmp_mps,
+				 uint32_t *dmmp_mp_count,
+				 char ***removed_wwids,
+				 uint32_t *removed_count, int *complete)
+{
+	int rc = DMMP_OK;
+	char cmd[_IPC_MAX_CMD_LEN];
+	char *j_str = NULL;
+	json_object *j_obj = NULL;
+	struct array_list *ar_removed = NULL;
+	json_object *j_obj_wwid = NULL;
+	int ar_removed_len = -1;
+	int64_t cur_generation = 0;
+	uint32_t i = 0;
+
+	assert(ctx != NULL);
+	assert(generation != NULL);
+	assert(dmmp_mps != NULL);
+	assert(dmmp_mp_count != NULL);
+	assert(removed_wwids != NULL);
+	assert(removed_count != NULL);
+	assert(complete != NULL);
+
+	*dmmp_mps = NULL;
+	*dmmp_mp_count = 0;
+	*removed_wwids = NULL;
+	*removed_count = 0;
+	*complete = 0;
+
+	snprintf(cmd, _IPC_MAX_CMD_LEN, _DMMP_IPC_SHOW_SINCE_JSON_CMD,
+		 *generation);
+	_good(_ipc_cmd(ctx, cmd, &j_str), rc, out);
+
+	if (strncmp(j_str, "fail", strlen("fail")) == 0) {
+		rc = DMMP_ERR_INCOMPATIBLE;
+		_error(ctx, "multipathd does not support '%s'", cmd);
+		goto out;
+	}
+
+	_debug(ctx, "Got json output from multipathd: '%s'", j_str);
+
+	_good(_json_parse(ctx, j_str, &j_obj), rc, out);
+	_json_obj_get_value(ctx, j_obj, cur_generation,
+			    _DMMP_JSON_GENERATION_KEY, json_type_int,
+			    json_object_get_int64, rc, out);
+	_json_obj_get_value(ctx, j_obj, *complete, _DMMP_JSON_COMPLETE_KEY,
+			    json_type_boolean, json_object_get_boolean, rc, out);
+	_json_obj_get_value(ctx, j_obj, ar_removed, _DMMP_JSON_REMOVED_KEY,
+			    json_type_array, json_object_get_array, rc, out);
+
+	ar_removed_len = array_list_length(ar_removed);
+	if (ar_removed_len < 0) {
+		rc = DMMP_ERR_BUG;
+		_error(ctx, "BUG: Got negative length for ar_removed");
+		goto out;
+	} else if (ar_removed_len > 0) {
+		*removed_wwids = (char **)
+			calloc(ar_removed_len, sizeof(char *));
+		_dmmp_alloc_null_check(ctx, *removed_wwids, rc, out);
+		*removed_count = ar_removed_len & UINT32_MAX;
+		for (i = 0; i < *removed_count; ++i) {
+			j_obj_wwid = array_list_get_idx(ar_removed, i);
+			if (j_obj_wwid == NULL ||
+			    json_object_get_type(j_obj_wwid) !=
+			    json_type_string) {
+				rc = DMMP_ERR_IPC_ERROR;
+				_error(ctx, "Invalid JSON output from "
+				       "multipathd IPC: bad removed WWID");
+				goto out;
+			}
+			(*removed_wwids)[i] =
+				strdup(json_object_get_string(j_obj_wwid));
+			_dmmp_alloc_null_check(ctx, (*removed_wwids)[i], rc,
+					       out);
+		}
+	}
+
+	_good(_json_maps_get(ctx, j_obj, dmmp_mps, dmmp_mp_count), rc, out);
+	*generation = (uint64_t) cur_generation;
+
+out:
 	free(j_str);
-	if (j_token != NULL)
-		json_tokener_free(j_token);
 	if (j_obj != NULL)
 		json_object_put(j_obj);
 
@@ -270,13 +484,28 @@ out:
 		dmmp_mpath_array_free(*dmmp_mps, *dmmp_mp_count);
 		*dmmp_mps = NULL;
 		*dmmp_mp_count = 0;
+		dmmp_wwid_array_free(*removed_wwids, *removed_count);
+		*removed_wwids = NULL;
+		*removed_count = 0;
+		*complete = 0;
 	}
 
 	return rc;
 }
 
+void dmmp_wwid_array_free(char **wwids, uint32_t wwid_count)
+{
+	uint32_t i = 0;
+
+	if (wwids == NULL)
+		return;
+	for (; i < wwid_count; ++i)
+		free(wwids[i]);
+	free(wwids);
+}
+
 static int _process_cmd(struct dmmp_context *ctx, int fd, const char *cmd,
-			char **output)
+			char **output, bool *resent)
 {
 	int errno_save = 0;
 	int rc = DMMP_OK;
@@ -292,6 +521,7 @@ static int _process_cmd(struct dmmp_context *ctx, int fd, const char *cmd,
 	assert(cmd != NULL);
 
 	*output = NULL;
+	*resent = false;
 
 	if (clock_gettime(CLOCK_MONOTONIC, &start_ts) != 0) {
 		_error(ctx, "BUG: Failed to get CLOCK_MONOTONIC time "
@@ -328,6 +558,7 @@ invoke:
 	if (flag_check_tmo == true) {
 		free(*output);
 		*output = NULL;
+		*resent = true;
 		if (ctx->tmo == 0) {
 			_debug(ctx, "IPC timeout, but user requested infinite "
 			       "timeout");
@@ -380,6 +611,42 @@ out:
 	return rc;
 }
 
+static int _ipc_cmd(struct dmmp_context *ctx, const char *cmd,
+		    char **output)
+{
+	int rc = DMMP_OK;
+	int ipc_fd = ctx->ipc_fd;
+	bool resent = false;
+
+	ctx->ipc_fd = -1;
+	if (ipc_fd >= 0) {
+		rc = _process_cmd(ctx, ipc_fd, cmd, output, &resent);
+		if (rc != DMMP_ERR_IPC_ERROR)
+			goto out;
+		/* multipathd may have been restarted, try a new connection */
+		_debug(ctx, "Persistent IPC connection failed, reconnecting");
+		mpath_disconnect(ipc_fd);
+		ipc_fd = -1;
+	}
+
+	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
+	rc = _process_cmd(ctx, ipc_fd, cmd, output, &resent);
+
+out:
+	if (ipc_fd < 0)
+		return rc;
+	/*
+	 * After a client side timeout, a late reply may still arrive on the
+	 * connection. Don't keep it, the reply would be taken for the reply
+	 * of the next command.
+	 */
+	if (ctx->persistent_ipc && rc == DMMP_OK && !resent)
+		ctx->ipc_fd = ipc_fd;
+	else
+		mpath_disconnect(ipc_fd);
+	return rc;
+}
+
 static int _ipc_connect(struct dmmp_context *ctx, int *fd)
 {
 	int rc = DMMP_OK;
@@ -416,7 +683,6 @@ int dmmp_flush_mpath(struct dmmp_context *ctx, const char *mpath_name)
 	uint32_t dmmp_mp_count = 0;
 	uint32_t i = 0;
 	bool found = false;
-	int ipc_fd = -1;
 	char cmd[_IPC_MAX_CMD_LEN];
 	char *output = NULL;
 
@@ -430,10 +696,9 @@ int dmmp_flush_mpath(struct dmmp_context *ctx, const char *mpath_name)
 		goto out;
 	}
 
-	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
-	_good(_process_cmd(ctx, ipc_fd, cmd, &output), rc, out);
+	_good(_ipc_cmd(ctx, cmd, &output), rc, out);
 
-	/* _process_cmd() already make sure output is not NULL */
+	/* _ipc_cmd() already make sure output is not NULL */
 
 	if (strncmp(output, "fail", strlen("fail")) == 0) {
 		/* Check whether specified mpath exits */
@@ -463,8 +728,6 @@ int dmmp_flush_mpath(struct dmmp_context *ctx, const char *mpath_name)
 	}
 
 out:
-	if (ipc_fd >= 0)
-		mpath_disconnect(ipc_fd);
 	dmmp_mpath_array_free(dmmp_mps, dmmp_mp_count);
 	free(output);
 	return rc;
@@ -473,18 +736,14 @@ out:
 int dmmp_reconfig(struct dmmp_context *ctx)
 {
 	int rc = DMMP_OK;
-	int ipc_fd = -1;
 	char *output = NULL;
 	char cmd[_IPC_MAX_CMD_LEN];
 
 	snprintf(cmd, _IPC_MAX_CMD_LEN, "%s", "reconfigure");
 
-	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
-	_good(_process_cmd(ctx, ipc_fd, cmd, &output), rc, out);
+	_good(_ipc_cmd(ctx, cmd, &output), rc, out);
 
 out:
-	if (ipc_fd >= 0)
-		mpath_disconnect(ipc_fd);
 	free(output);
 	return rc;
 }
@@ -197,6 +197,42 @@ DMMP_DLL_EXPORT void dmmp_context_timeout_set(struct dmmp_context *ctx,
  */
 DMMP_DLL_EXPORT unsigned int dmmp_context_timeout_get(struct dmmp_context *ctx);
 
+/**
+ * dmmp_context_persistent_ipc_set() - Keep the IPC connection open.
+ *
+ * By default, every query opens a new IPC connection to multipathd daemon
+ * and closes it afterwards. With persistent IPC enabled, the connection is
+ * kept open and reused by later queries on the same context, until
+ * dmmp_context_free() or until persistent IPC is disabled again. If the
+ * daemon has been restarted in the meantime, a new connection is made.
+ * A context with persistent IPC must not be used by several threads at
+ * once.
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * @enable:
+ *	int. 1 to keep the connection, 0 to close it after every query.
+ *
+ * Return:
+ *	void
+ */
+DMMP_DLL_EXPORT void dmmp_context_persistent_ipc_set(struct dmmp_context *ctx,
+						     int enable);
+
+/**
+ * dmmp_context_persistent_ipc_get() - Check whether IPC is persistent.
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	int. 1 if persistent IPC is enabled, 0 otherwise.
+ */
+DMMP_DLL_EXPORT int dmmp_context_persistent_ipc_get(struct dmmp_context *ctx);
+
 /**
  * dmmp_context_log_priority_set() - Set log priority.
  *
@@ -355,6 +391,134 @@ DMMP_DLL_EXPORT int dmmp_mpath_array_get(struct dmmp_context *ctx,
 DMMP_DLL_EXPORT void dmmp_mpath_array_free(struct dmmp_mpath **dmmp_mps,
 					   uint32_t dmmp_mp_count);
 
+/**
+ * dmmp_mpath_get() - Query a single multipath device.
+ *
+ * Query the multipath device with given name, WWID or kernel DEVNAME (like
+ * 'dm-1'). Only this device is transferred from multipathd daemon, which is
+ * much cheaper than dmmp_mpath_array_get() on systems with many multipath
+ * devices. The memory of 'dmmp_mp' should be freed via dmmp_mpath_free().
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @mpath_name:
+ *	const char *. Name, WWID or kernel DEVNAME of the mpath.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @dmmp_mp:
+ *	Output pointer of 'struct dmmp_mpath'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	int. Valid error codes are:
+ *
+ *	* DMMP_OK
+ *
+ *	* DMMP_ERR_BUG
+ *
+ *	* DMMP_ERR_NO_MEMORY
+ *
+ *	* DMMP_ERR_NO_DAEMON
+ *
+ *	* DMMP_ERR_MPATH_NOT_FOUND
+ *
+ *	* DMMP_ERR_INVALID_ARGUMENT
+ *
+ *	Error number could be converted to string by dmmp_strerror().
+ */
+DMMP_DLL_EXPORT int dmmp_mpath_get(struct dmmp_context *ctx,
+				   const char *mpath_name,
+				   struct dmmp_mpath **dmmp_mp);
+
+/**
+ * dmmp_mpath_free() - Free 'struct dmmp_mpath' pointer.
+ *
+ * Free the 'dmmp_mp' pointer generated by dmmp_mpath_get().
+ * If provided 'dmmp_mp' pointer is NULL, do nothing.
+ * Don't use this for members of arrays from dmmp_mpath_array_get().
+ *
+ * @dmmp_mp:
+ *	Pointer of 'struct dmmp_mpath'.
+ *
+ * Return:
+ *	void
+ */
+DMMP_DLL_EXPORT void dmmp_mpath_free(struct dmmp_mpath *dmmp_mp);
+
+/**
+ * dmmp_mpath_array_get_changed() - Query changed multipath devices.
+ *
+ * Query the multipath devices which changed since an earlier query, and
+ * the WWIDs of the multipath devices removed since then. Use 0 as
+ * 'generation' in the first call, and pass the 'generation' value set by
+ * the previous call afterwards.
+ *
+ * If 'complete' is set to 1, multipathd daemon could not tell what changed,
+ * for example because it has been restarted. Then 'dmmp_mps' holds all
+ * existing multipath devices, 'removed_wwids' is empty, and the result of
+ * earlier calls should be discarded.
+ *
+ * The memory of 'dmmp_mps' should be freed via dmmp_mpath_array_free(),
+ * and the memory of 'removed_wwids' via dmmp_wwid_array_free().
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @generation:
+ *	Input and output pointer of uint64_t.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @dmmp_mps:
+ *	Output pointer array of 'struct dmmp_mpath'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @dmmp_mp_count:
+ *	Output pointer of uint32_t. Hold the size of 'dmmp_mps' pointer array.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @removed_wwids:
+ *	Output pointer of string array. WWIDs of removed mpaths.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @removed_count:
+ *	Output pointer of uint32_t. Hold the size of 'removed_wwids' array.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ * @complete:
+ *	Output pointer of int.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	int. Valid error codes are:
+ *
+ *	* DMMP_OK
+ *
+ *	* DMMP_ERR_BUG
+ *
+ *	* DMMP_ERR_NO_MEMORY
+ *
+ *	* DMMP_ERR_NO_DAEMON
+ *
+ *	* DMMP_ERR_INCOMPATIBLE
+ *
+ *	Error number could be converted to string by dmmp_strerror().
+ */
+DMMP_DLL_EXPORT int dmmp_mpath_array_get_changed
+	(struct dmmp_context *ctx, uint64_t *generation,
+	 struct dmmp_mpath ***dmmp_mps, uint32_t *dmmp_mp_count,
+	 char ***removed_wwids, uint32_t *removed_count, int *complete);
+
+/**
+ * dmmp_wwid_array_free() - Free WWID string array.
+ *
+ * Free the 'removed_wwids' array generated by dmmp_mpath_array_get_changed().
+ * If provided 'wwids' pointer is NULL, do nothing.
+ *
+ * @wwids:
+ *	Pointer of string array.
+ * @wwid_count:
+ *	uint32_t, the size of 'wwids' array.
+ *
+ * Return:
+ *	void
+ */
+DMMP_DLL_EXPORT void dmmp_wwid_array_free(char **wwids, uint32_t wwid_count);
+
 /**
  * dmmp_mpath_wwid_get() - Retrieve WWID of certain mpath.
  *
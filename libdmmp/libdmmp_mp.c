@@ -130,6 +130,11 @@ out:
 	return rc;
 }
 
+void dmmp_mpath_free(struct dmmp_mpath *dmmp_mp)
+{
+	_dmmp_mpath_free(dmmp_mp);
+}
+
 void _dmmp_mpath_free(struct dmmp_mpath *dmmp_mp)
 {
 	if (dmmp_mp == NULL)
@@ -115,6 +115,13 @@ int main(void)
 	int rc = EXIT_SUCCESS;
 	const char *old_name = NULL;
 	bool found = false;
+	struct dmmp_mpath *dmmp_mp = NULL;
+	struct dmmp_mpath **changed_mps = NULL;
+	uint32_t changed_count = 0;
+	char **removed_wwids = NULL;
+	uint32_t removed_count = 0;
+	uint64_t generation = 0;
+	int complete = 0;
 
 	ctx = dmmp_context_new();
 	dmmp_context_log_priority_set(ctx, DMMP_LOG_PRIORITY_DEBUG);
@@ -146,6 +153,46 @@ int main(void)
 			goto out;
 	}
 
+	dmmp_context_persistent_ipc_set(ctx, 1);
+	if (dmmp_context_persistent_ipc_get(ctx) != 1)
+		FAIL(rc, out, "dmmp_context_persistent_ipc_set(): Failed to "
+		     "enable persistent IPC\n");
+
+	if (dmmp_mpath_get(ctx, wwid, &dmmp_mp) != DMMP_OK)
+		FAIL(rc, out, "dmmp_mpath_get() failed: %s\n",
+		     dmmp_last_error_msg(ctx));
+	if (strcmp(dmmp_mpath_name_get(dmmp_mp), name) != 0)
+		FAIL(rc, out, "dmmp_mpath_get(): Got mpath %s for %s\n",
+		     dmmp_mpath_name_get(dmmp_mp), wwid);
+	PASS("dmmp_mpath_get(): Got mpath(%s): %s\n", wwid, name);
+	dmmp_mpath_free(dmmp_mp);
+
+	if (dmmp_mpath_array_get_changed(ctx, &generation, &changed_mps,
+					 &changed_count, &removed_wwids,
+					 &removed_count, &complete) != DMMP_OK)
+		FAIL(rc, out, "dmmp_mpath_array_get_changed() failed: %s\n",
+		     dmmp_last_error_msg(ctx));
+	if (complete != 1 || changed_count != dmmp_mp_count)
+		FAIL(rc, out, "dmmp_mpath_array_get_changed(): Got %" PRIu32
+		     " of %" PRIu32 " mpaths, complete %d in first call\n",
+		     changed_count, dmmp_mp_count, complete);
+	dmmp_mpath_array_free(changed_mps, changed_count);
+	dmmp_wwid_array_free(removed_wwids, removed_count);
+
+	if (dmmp_mpath_array_get_changed(ctx, &generation, &changed_mps,
+					 &changed_count, &removed_wwids,
+					 &removed_count, &complete) != DMMP_OK)
+		FAIL(rc, out, "dmmp_mpath_array_get_changed() failed: %s\n",
+		     dmmp_last_error_msg(ctx));
+	if (complete != 0)
+		FAIL(rc, out, "dmmp_mpath_array_get_changed(): Got complete "
+		     "result for generation %" PRIu64 "\n", generation);
+	PASS("dmmp_mpath_array_get_changed(): %" PRIu32 " mpaths changed\n",
+	     changed_count);
+	dmmp_mpath_array_free(changed_mps, changed_count);
+	dmmp_wwid_array_free(removed_wwids, removed_count);
+	dmmp_context_persistent_ipc_set(ctx, 0);
+
 	old_name = strdup(name);
 	if (old_name == NULL)
 		FAIL(rc, out, "strdup(): no memory\n");
@@ -27,6 +27,9 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sched.h>
 
 #include "mpath_cmd.h"
 
@@ -146,18 +149,26 @@ int mpath_disconnect(int fd)
 	return close(fd);
 }
 
-ssize_t mpath_recv_reply_len(int fd, unsigned int timeout)
+static int recv_len(int fd, size_t *len, unsigned int timeout)
 {
-	size_t len;
 	ssize_t ret;
 
-	ret = read_all(fd, &len, sizeof(len), timeout);
+	ret = read_all(fd, len, sizeof(*len), timeout);
 	if (ret < 0)
 		return ret;
-	if (ret != sizeof(len)) {
+	if (ret != sizeof(*len)) {
 		errno = EIO;
 		return -1;
 	}
+	return 0;
+}
+
+ssize_t mpath_recv_reply_len(int fd, unsigned int timeout)
+{
+	size_t len;
+
+	if (recv_len(fd, &len, timeout) != 0)
+		return -1;
 	if (len <= 0 || len >= MAX_REPLY_LEN) {
 		errno = ERANGE;
 		return -1;
@@ -165,6 +176,19 @@ ssize_t mpath_recv_reply_len(int fd, unsigned int timeout)
 	return len;
 }
 
+ssize_t mpath_recv_chunk_len(int fd, unsigned int timeout)
+{
+	size_t len;
+
+	if (recv_len(fd, &len, timeout) != 0)
+		return -1;
+	if (len > MPATH_REPLY_CHUNKED) {
+		errno = ERANGE;
+		return -1;
+	}
+	return len;
+}
+
 int mpath_recv_reply_data(int fd, char *reply, size_t len,
 			  unsigned int timeout)
 {
@@ -181,15 +205,54 @@ int mpath_recv_reply_data(int fd, char *reply, size_t len,
 	return 0;
 }
 
+/*
+ * collect all chunks of a chunked reply into one string
+ */
+static int recv_chunked_reply(int fd, char **reply, unsigned int timeout)
+{
+	char *buf = NULL, *tmp;
+	size_t total = 0;
+	ssize_t len;
+
+	while ((len = mpath_recv_chunk_len(fd, timeout)) > 0) {
+		if (len == MPATH_REPLY_CHUNKED ||
+		    total + len >= MAX_REPLY_LEN) {
+			errno = ERANGE;
+			goto fail;
+		}
+		tmp = realloc(buf, total + len);
+		if (!tmp)
+			goto fail;
+		buf = tmp;
+		if (mpath_recv_reply_data(fd, buf + total, len, timeout) != 0)
+			goto fail;
+		/* overwrite the terminating NUL with the next chunk */
+		total += len - 1;
+	}
+	if (len < 0)
+		goto fail;
+	*reply = buf;
+	return 0;
+fail:
+	free(buf);
+	return -1;
+}
+
 int mpath_recv_reply(int fd, char **reply, unsigned int timeout)
 {
 	int err;
 	ssize_t len;
 
 	*reply = NULL;
-	len = mpath_recv_reply_len(fd, timeout);
-	if (len <= 0)
+	len = mpath_recv_chunk_len(fd, timeout);
+	if (len == MPATH_REPLY_CHUNKED)
+		return recv_chunked_reply(fd, reply, timeout);
+	if (len < 0)
 		return len;
+	if (len == 0 || len >= MAX_REPLY_LEN) {
+		errno = ERANGE;
+		return -1;
+	}
 	*reply = malloc(len);
 	if (!*reply)
 		return -1;
@@ -217,6 +280,292 @@ int mpath_send_cmd(int fd, const char *cmd)
 	return 0;
 }
 
+int mpath_send_cmd_chunked(int fd, const char *cmd)
+{
+	size_t cmdlen, len;
+
+	if (cmd == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	cmdlen = strlen(cmd) + 1;
+	len = cmdlen + sizeof(MPATH_CMD_CHUNKED_TAG);
+	if (write_all(fd, &len, sizeof(len)) != sizeof(len) ||
+	    write_all(fd, cmd, cmdlen) != cmdlen ||
+	    write_all(fd, MPATH_CMD_CHUNKED_TAG, sizeof(MPATH_CMD_CHUNKED_TAG))
+	    != sizeof(MPATH_CMD_CHUNKED_TAG))
+		return -1;
+	return 0;
+}
+
+struct mpath_session {
+	int fd;
+	int broken;
+	/* ID of the next command to send */
+	unsigned int next_id;
+	/* ID of the command the next reply belongs to */
+	unsigned int next_reply;
+};
+
+struct mpath_session *mpath_session_open(void)
+{
+	struct mpath_session *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->fd = mpath_connect();
+	if (s->fd == -1) {
+		int err = errno;
+
+		free(s);
+		errno = err;
+		return NULL;
+	}
+	return s;
+}
+
+void mpath_session_close(struct mpath_session *s)
+{
+	if (!s)
+		return;
+	mpath_disconnect(s->fd);
+	free(s);
+}
+
+int mpath_session_send(struct mpath_session *s, const char *cmd,
+		       unsigned int *id)
+{
+	if (s->broken) {
+		errno = EPIPE;
+		return -1;
+	}
+	if (s->next_id - s->next_reply >= MPATH_SESSION_MAX_INFLIGHT) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (mpath_send_cmd(s->fd, cmd) != 0) {
+		/* we don't know how much of the command was sent */
+		s->broken = 1;
+		return -1;
+	}
+	if (id)
+		*id = s->next_id;
+	s->next_id++;
+	return 0;
+}
+
+int mpath_session_recv(struct mpath_session *s, unsigned int *id,
+		       char **reply, unsigned int timeout)
+{
+	*reply = NULL;
+	if (s->broken) {
+		errno = EPIPE;
+		return -1;
+	}
+	if (s->next_id == s->next_reply) {
+		errno = ENOENT;
+		return -1;
+	}
+	if (mpath_recv_reply(s->fd, reply, timeout) != 0) {
+		/* the byte stream may be out of sync now */
+		s->broken = 1;
+		return -1;
+	}
+	if (id)
+		*id = s->next_reply;
+	s->next_reply++;
+	return 0;
+}
+
+int mpath_send_bin_request(int fd, unsigned int opcode)
+{
+	struct mpath_bin_hdr hdr = {
+		.magic = MPATH_BIN_MAGIC,
+		.version = MPATH_BIN_VERSION,
+		.opcode = opcode,
+	};
+	char buf[1 + sizeof(hdr)];
+	size_t len = sizeof(buf);
+
+	/* the leading NUL makes this an empty text command */
+	buf[0] = '\0';
+	memcpy(buf + 1, &hdr, sizeof(hdr));
+	if (write_all(fd, &len, sizeof(len)) != sizeof(len) ||
+	    write_all(fd, buf, len) != len)
+		return -1;
+	return 0;
+}
+
+int mpath_recv_bin_reply(int fd, struct mpath_bin_hdr **reply,
+			 unsigned int timeout)
+{
+	struct mpath_bin_hdr *hdr;
+	ssize_t len;
+
+	*reply = NULL;
+	len = mpath_recv_reply_len(fd, timeout);
+	if (len < 0)
+		return -1;
+	/* malloc() returns memory suitably aligned for the header */
+	hdr = malloc(len);
+	if (!hdr)
+		return -1;
+	if (mpath_recv_reply_data(fd, (char *)hdr, len, timeout) != 0)
+		goto fail;
+	if ((size_t)len < sizeof(*hdr) + 1 || hdr->magic != MPATH_BIN_MAGIC ||
+	    hdr->version != MPATH_BIN_VERSION ||
+	    hdr->len != len - sizeof(*hdr) - 1) {
+		errno = EPROTO;
+		goto fail;
+	}
+	*reply = hdr;
+	return 0;
+fail:
+	free(hdr);
+	return -1;
+}
+
+const struct mpath_tlv *mpath_tlv_next(const void *buf, size_t len,
+				       const struct mpath_tlv *prev)
+{
+	const char *start = buf, *next;
+	size_t left;
+
+	if (!prev)
+		next = start;
+	else
+		next = (const char *)MPATH_TLV_VALUE(prev) +
+			MPATH_TLV_ALIGN(prev->len);
+	if (next < start || (size_t)(next - start) >= len)
+		return NULL;
+	left = len - (next - start);
+	if (left < sizeof(struct mpath_tlv) ||
+	    left - sizeof(struct mpath_tlv) <
+	    ((const struct mpath_tlv *)next)->len)
+		return NULL;
+	return (const struct mpath_tlv *)next;
+}
+
+struct mpath_state {
+	int fd;
+	/* mapped read-only */
+	struct mpath_state_hdr *hdr;
+	size_t size;
+};
+
+/* Map the whole file, after it has grown */
+static int state_map(struct mpath_state *st, size_t size)
+{
+	void *p;
+
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, st->fd, 0);
+	if (p == MAP_FAILED)
+		return -1;
+	if (st->hdr)
+		munmap(st->hdr, st->size);
+	st->hdr = p;
+	st->size = size;
+	return 0;
+}
+
+struct mpath_state *mpath_state_open(void)
+{
+	struct mpath_state *st;
+	struct stat sb;
+	int err;
+
+	st = calloc(1, sizeof(*st));
+	if (!st)
+		return NULL;
+	st->fd = open(MPATH_STATE_FILE, O_RDONLY | O_CLOEXEC);
+	if (st->fd == -1)
+		goto fail;
+	if (fstat(st->fd, &sb) != 0)
+		goto fail_close;
+	if ((size_t)sb.st_size < sizeof(*st->hdr)) {
+		errno = ENODATA;
+		goto fail_close;
+	}
+	if (state_map(st, sb.st_size) != 0)
+		goto fail_close;
+	if (st->hdr->magic != MPATH_STATE_MAGIC ||
+	    st->hdr->version != MPATH_STATE_VERSION) {
+		munmap(st->hdr, st->size);
+		errno = EPROTO;
+		goto fail_close;
+	}
+	return st;
+
+fail_close:
+	err = errno;
+	close(st->fd);
+	errno = err;
+fail:
+	free(st);
+	return NULL;
+}
+
+void mpath_state_close(struct mpath_state *st)
+{
+	if (!st)
+		return;
+	munmap(st->hdr, st->size);
+	close(st->fd);
+	free(st);
+}
+
+/* Retries before giving up on a state that keeps changing */
+#define STATE_READ_TRIES 1000
+
+ssize_t mpath_state_read(struct mpath_state *st, void *buf, size_t size,
+			 uint32_t *gen)
+{
+	const struct mpath_state_hdr *hdr;
+	uint32_t seq, len, fsize;
+	uint16_t flags;
+	int tries;
+
+	for (tries = 0; tries < STATE_READ_TRIES; tries++) {
+		hdr = st->hdr;
+		seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			/* let the writer finish */
+			sched_yield();
+			continue;
+		}
+		flags = hdr->flags;
+		len = hdr->len;
+		fsize = hdr->size;
+		if (fsize > st->size || sizeof(*hdr) + len > st->size) {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) != seq)
+				continue;
+			if (fsize <= st->size) {
+				errno = EPROTO;
+				return -1;
+			}
+			if (state_map(st, fsize) != 0)
+				return -1;
+			continue;
+		}
+		if (len <= size)
+			memcpy(buf, hdr + 1, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		if (flags & MPATH_STATE_STOPPED) {
+			errno = ESRCH;
+			return -1;
+		}
+		if (gen)
+			*gen = seq;
+		return len;
+	}
+	errno = EAGAIN;
+	return -1;
+}
+
 int mpath_process_cmd(int fd, const char *cmd, char **reply,
 		      unsigned int timeout)
 {
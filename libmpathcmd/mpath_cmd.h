@@ -20,12 +20,28 @@
 #ifndef LIB_MPATH_CMD_H
 #define LIB_MPATH_CMD_H
 
+#include <stdint.h>
+#include <sys/types.h>
+
 /*
  * This should be sufficient for json output for >10000 maps,
  * and >60000 paths.
  */
 #define MAX_REPLY_LEN (32 * 1024 * 1024)
 
+/*
+ * Chunked replies: a client that sends its command with
+ * mpath_send_cmd_chunked() may get the reply as a sequence of chunks.
+ * Such a reply starts with the length value MPATH_REPLY_CHUNKED, followed
+ * by the chunks in the usual length prefix format, each of them a
+ * NUL-terminated string. A length of 0 ends the reply. Small replies are
+ * still sent in one piece.
+ * Daemons that don't support chunked replies ignore the tag that
+ * mpath_send_cmd_chunked() appends to the command after its NUL byte.
+ */
+#define MPATH_REPLY_CHUNKED	MAX_REPLY_LEN
+#define MPATH_CMD_CHUNKED_TAG	"chunked"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -33,6 +49,84 @@ extern "C" {
 #define DEFAULT_SOCKET		"/org/kernel/linux/storage/multipathd"
 #define DEFAULT_REPLY_TIMEOUT	4000
 
+/*
+ * Binary queries: an alternative to text commands for monitoring tools.
+ *
+ * A binary request is a packet holding a NUL byte followed by a struct
+ * mpath_bin_hdr with len == 0 (see mpath_send_bin_request()). Daemons
+ * without binary support see an empty text command and reply with text.
+ * A binary reply is a packet holding a struct mpath_bin_hdr with the
+ * request's opcode, followed by hdr.len bytes of records and a NUL byte.
+ * All integers are in host byte order.
+ *
+ * Records are TLVs: a struct mpath_tlv followed by len bytes of value,
+ * padded with zeroes to a multiple of 4 bytes. The value of MPATH_TLV_MAP
+ * and MPATH_TLV_PATH records is a sequence of attribute records. String
+ * values include the terminating NUL. Clients must skip records of
+ * unknown type. Use mpath_tlv_next() to walk a sequence of records.
+ */
+#define MPATH_BIN_MAGIC		0x3142504dU	/* "MPB1" */
+#define MPATH_BIN_VERSION	1
+
+enum mpath_bin_opcode {
+	MPATH_OP_LIST_MAPS = 1,		/* MPATH_TLV_MAP records */
+	MPATH_OP_LIST_PATHS = 2,	/* MPATH_TLV_PATH records */
+};
+
+struct mpath_bin_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t opcode;
+	/* 0, or a negative errno value in replies */
+	int32_t status;
+	/* number of record bytes following the header */
+	uint32_t len;
+};
+
+struct mpath_tlv {
+	uint16_t type;
+	uint16_t len;
+};
+
+#define MPATH_TLV_ALIGN(len)	(((len) + 3U) & ~3U)
+#define MPATH_TLV_VALUE(tlv)	((const void *)((const struct mpath_tlv *)(tlv) + 1))
+
+enum mpath_tlv_type {
+	MPATH_TLV_MAP = 1,
+	MPATH_TLV_PATH = 2,
+	/* attributes */
+	MPATH_TLV_NAME = 16,		/* string, map alias or path device */
+	MPATH_TLV_WWID = 17,		/* string */
+	MPATH_TLV_DEV_T = 18,		/* string, "major:minor" */
+	MPATH_TLV_MAP_NAME = 19,	/* string, alias of the path's map */
+	MPATH_TLV_NR_PATHS = 20,	/* uint32_t */
+	MPATH_TLV_NR_ACTIVE = 21,	/* uint32_t */
+	MPATH_TLV_CHK_STATE = 22,	/* uint32_t, enum mpath_chk_state */
+	MPATH_TLV_DM_STATE = 23,	/* uint32_t, enum mpath_dm_state */
+	MPATH_TLV_PRIO = 24,		/* int32_t */
+};
+
+/* path checker states, as shown by "show paths" */
+enum mpath_chk_state {
+	MPATH_CHK_WILD = 0,
+	MPATH_CHK_UNCHECKED = 1,
+	MPATH_CHK_DOWN = 2,
+	MPATH_CHK_UP = 3,
+	MPATH_CHK_SHAKY = 4,
+	MPATH_CHK_GHOST = 5,
+	MPATH_CHK_PENDING = 6,
+	MPATH_CHK_TIMEOUT = 7,
+	MPATH_CHK_REMOVED = 8,
+	MPATH_CHK_DELAYED = 9,
+};
+
+/* path states in the kernel map */
+enum mpath_dm_state {
+	MPATH_DM_UNDEF = 0,
+	MPATH_DM_FAILED = 1,
+	MPATH_DM_ACTIVE = 2,
+};
+
 
 /*
  * DESCRIPTION:
@@ -98,6 +192,19 @@ int mpath_process_cmd(int fd, const char *cmd, char **reply,
 int mpath_send_cmd(int fd, const char *cmd);
 
 
+/*
+ * DESCRIPTION:
+ *	Send a command to multipathd, and tell it that the reply may be
+ *	sent in chunks (see MPATH_REPLY_CHUNKED above). Use
+ *	mpath_recv_chunk_len() and mpath_recv_reply_data() to process the
+ *	reply chunk by chunk, or mpath_recv_reply() to receive all of it.
+ *
+ * RETURNS:
+ *	0 on success. -1 on failure (with errno set)
+ */
+int mpath_send_cmd_chunked(int fd, const char *cmd);
+
+
 /*
  * DESCRIPTION:
  *	Return a reply from multipathd for a previously sent command.
@@ -125,6 +232,21 @@ int mpath_recv_reply(int fd, char **reply, unsigned int timeout);
 ssize_t mpath_recv_reply_len(int fd, unsigned int timeout);
 
 
+/*
+ * DESCRIPTION:
+ *	Like mpath_recv_reply_len(), for commands sent with
+ *	mpath_send_cmd_chunked(). The first call returns either the length
+ *	of a single reply, or MPATH_REPLY_CHUNKED. In the latter case,
+ *	the following calls return the size of the next chunk, which must
+ *	be read with mpath_recv_reply_data(), or 0 at the end of the reply.
+ *
+ * RETURNS:
+ *	The size of the next reply data buffer, MPATH_REPLY_CHUNKED or 0
+ *	on success. -1 on failure (with errno set).
+ */
+ssize_t mpath_recv_chunk_len(int fd, unsigned int timeout);
+
+
 /*
  * DESCRIPTION:
  *	Return the reply data from the sent multipath command.
@@ -138,6 +260,180 @@ ssize_t mpath_recv_reply_len(int fd, unsigned int timeout);
 int mpath_recv_reply_data(int fd, char *reply, size_t len,
 			  unsigned int timeout);
 
+
+/*
+ * Sessions: send several commands over one connection without waiting
+ * for the replies in between. multipathd handles the commands of a
+ * connection one after the other, so replies arrive in the order in
+ * which the commands were sent. Each command gets an ID, and
+ * mpath_session_recv() returns the ID of the command a reply belongs to.
+ * At most MPATH_SESSION_MAX_INFLIGHT commands can be waiting for their
+ * replies. A session must not be used by several threads at once.
+ */
+#define MPATH_SESSION_MAX_INFLIGHT	64
+
+struct mpath_session;
+
+/*
+ * DESCRIPTION:
+ *	Connect to multipathd and start a session.
+ *
+ * RETURNS:
+ *	A session handle on success. NULL on failure (with errno set).
+ */
+struct mpath_session *mpath_session_open(void);
+
+
+/*
+ * DESCRIPTION:
+ *	Close the connection and free the session. Replies that haven't
+ *	been received yet are discarded.
+ */
+void mpath_session_close(struct mpath_session *s);
+
+
+/*
+ * DESCRIPTION:
+ *	Send a command in a session. If id is not NULL, the ID of the
+ *	command is stored in it.
+ *
+ * RETURNS:
+ *	0 on success. -1 on failure (with errno set). errno is EBUSY if
+ *	MPATH_SESSION_MAX_INFLIGHT commands are waiting for their replies.
+ */
+int mpath_session_send(struct mpath_session *s, const char *cmd,
+		       unsigned int *id);
+
+
+/*
+ * DESCRIPTION:
+ *	Receive the reply for the oldest command in the session that has
+ *	no reply yet. If id is not NULL, the command's ID is stored in it.
+ *
+ * RETURNS:
+ *	0 on success, and reply will either be NULL (if there was no
+ *	reply data), or point to the reply string, which must be freed by
+ *	the caller. -1 on failure (with errno set). errno is ENOENT if no
+ *	command is waiting for a reply. After other errors, the session
+ *	can't be used any more, and further calls fail with EPIPE.
+ */
+int mpath_session_recv(struct mpath_session *s, unsigned int *id,
+		       char **reply, unsigned int timeout);
+
+
+/*
+ * DESCRIPTION:
+ *	Send a binary request (see MPATH_BIN_MAGIC above) to multipathd.
+ *	Receive the reply with mpath_recv_bin_reply().
+ *
+ * RETURNS:
+ *	0 on success. -1 on failure (with errno set)
+ */
+int mpath_send_bin_request(int fd, unsigned int opcode);
+
+
+/*
+ * DESCRIPTION:
+ *	Receive the reply to a binary request. On success, *reply points
+ *	to the reply header, which is followed by reply->len bytes of
+ *	records. It must be freed by the caller.
+ *
+ * RETURNS:
+ *	0 on success. The caller must check (*reply)->status.
+ *	-1 on failure (with errno set). errno is EPROTO if the daemon
+ *	doesn't support binary requests.
+ */
+int mpath_recv_bin_reply(int fd, struct mpath_bin_hdr **reply,
+			 unsigned int timeout);
+
+
+/*
+ * DESCRIPTION:
+ *	Iterate over the records in buf, which has len bytes, e.g. the
+ *	records after a struct mpath_bin_hdr, or the value of a
+ *	MPATH_TLV_MAP record. Pass prev == NULL to get the first record.
+ *
+ * RETURNS:
+ *	The record following prev, or NULL if there are no more records,
+ *	or the next record would exceed buf.
+ */
+const struct mpath_tlv *mpath_tlv_next(const void *buf, size_t len,
+				       const struct mpath_tlv *prev);
+
+
+/*
+ * Shared state: with "publish_state yes", multipathd keeps the records of
+ * MPATH_OP_LIST_MAPS followed by those of MPATH_OP_LIST_PATHS in the
+ * file MPATH_STATE_FILE, which readers map read-only. The file starts
+ * with a struct mpath_state_hdr, followed by len bytes of records.
+ *
+ * The header and records are protected by a sequence lock: seq is odd
+ * while multipathd is updating them, and changes with every update.
+ * A reader copies the data and retries if seq was odd or has changed.
+ * The file only grows; size is its current size. multipathd sets
+ * MPATH_STATE_STOPPED when it exits, and creates a new file when it
+ * starts. Use the functions below rather than reading the file
+ * directly.
+ */
+#define MPATH_STATE_FILE	"/run/multipathd/state"
+#define MPATH_STATE_MAGIC	0x3153504dU	/* "MPS1" */
+#define MPATH_STATE_VERSION	1
+
+enum mpath_state_flags {
+	MPATH_STATE_STOPPED = 1,
+};
+
+struct mpath_state_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t seq;
+	uint32_t pid;
+	/* number of record bytes following the header */
+	uint32_t len;
+	/* size of the file */
+	uint32_t size;
+	/* CLOCK_REALTIME of the last change, in seconds */
+	int64_t time;
+};
+
+struct mpath_state;
+
+/*
+ * DESCRIPTION:
+ *	Map the state file of multipathd.
+ *
+ * RETURNS:
+ *	A handle on success. NULL on failure (with errno set). errno is
+ *	ENOENT if multipathd doesn't publish its state.
+ */
+struct mpath_state *mpath_state_open(void);
+
+
+/*
+ * DESCRIPTION:
+ *	Unmap the state file and free the handle.
+ */
+void mpath_state_close(struct mpath_state *st);
+
+
+/*
+ * DESCRIPTION:
+ *	Copy a consistent set of records into buf, which has room for size
+ *	bytes. No system calls are made, unless the file has grown since
+ *	the last call. If gen is not NULL, the generation of the state is
+ *	stored in it. The generation changes with every update, so readers
+ *	with a cached copy may call this with size 0 to check for changes.
+ *
+ * RETURNS:
+ *	The length of the records. If it's larger than size, nothing has
+ *	been copied. -1 on failure (with errno set). errno is ESRCH if
+ *	multipathd has stopped, and EAGAIN if no consistent copy could be
+ *	made because the state was changing too often.
+ */
+ssize_t mpath_state_read(struct mpath_state *st, void *buf, size_t size,
+			 uint32_t *gen);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,6 +22,7 @@
 #include "propsel.h"
 #include "util.h"
 #include "unaligned.h"
+#include "worker_pool.h"
 
 #include "mpath_persist.h"
 #include "mpathpr.h"
@@ -37,6 +38,17 @@
 
 extern struct udev *udev;
 
+/* Maximum number of PR OUT commands sent in parallel */
+#define PR_POOL_SIZE 16
+
+static pthread_mutex_t pr_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct worker_pool *pr_pool;
+
+/* Per-thread PR IN response buffers, see mpath_get_prin_buffer() */
+static pthread_once_t prin_buffer_once = PTHREAD_ONCE_INIT;
+static pthread_key_t prin_buffer_key;
+static bool prin_buffer_key_ok;
+
 static void adapt_config(struct config *conf)
 {
 	conf->force_sync = 1;
@@ -78,6 +90,14 @@ mpath_lib_init (void)
 
 static void libmpathpersist_cleanup(void)
 {
+	if (prin_buffer_key_ok) {
+		free(pthread_getspecific(prin_buffer_key));
+		pthread_setspecific(prin_buffer_key, NULL);
+	}
+	pthread_mutex_lock(&pr_pool_lock);
+	worker_pool_destroy(pr_pool);
+	pr_pool = NULL;
+	pthread_mutex_unlock(&pr_pool_lock);
 	libmultipath_exit();
 	dm_lib_exit();
 }
@@ -135,6 +155,11 @@ mpath_prin_activepath (struct multipath *mpp, int rq_servact,
 
 static vector curmp;
 static vector pathvec;
+/*
+ * Serializes looking up maps and their paths in curmp and pathvec, so
+ * that PR commands for different maps can be sent from several threads.
+ */
+static pthread_mutex_t vecs_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void __mpath_persistent_reserve_free_vecs(vector curmp, vector pathvec)
 {
@@ -204,10 +229,12 @@ static int mpath_get_map(vector curmp, vector pathvec, int fd, char **palias,
 	minor = minor(info.st_rdev);
 	condlog(4, "Device  %d:%d", major, minor);
 
+	pthread_mutex_lock(&vecs_lock);
 	/* get alias from major:minor*/
 	alias = dm_mapname(major, minor);
 	if (!alias){
 		condlog(0, "%d:%d failed to get device alias.", major, minor);
+		pthread_mutex_unlock(&vecs_lock);
 		return MPATH_PR_DMMP_ERROR;
 	}
 
@@ -239,10 +266,50 @@ static int mpath_get_map(vector curmp, vector pathvec, int fd, char **palias,
 		alias = NULL;
 	}
 out:
+	pthread_mutex_unlock(&vecs_lock);
 	FREE(alias);
 	return ret;
 }
 
+/*
+ * Send the PR IN command through the paths that multipathd reports as
+ * usable for the map of fd, which spares discovering the map and its
+ * paths here. Returns false if multipathd can't tell, e.g. because it
+ * isn't running, and the map must be set up locally.
+ */
+static bool prin_daemon_paths(int fd, int rq_servact, struct prin_resp *resp,
+			      int noisy, int *ret)
+{
+	struct stat info;
+	char *reply, *line, *saveptr;
+	const char *alias = NULL;
+
+	if (fstat(fd, &info) != 0 || !S_ISBLK(info.st_mode) ||
+	    !dm_is_dm_major(major(info.st_rdev)))
+		return false;
+	if (get_map_paths_from_daemon(minor(info.st_rdev), &reply) != 0)
+		return false;
+
+	*ret = MPATH_PR_DMMP_ERROR;
+	for (line = strtok_r(reply, "\n", &saveptr); line;
+	     line = strtok_r(NULL, "\n", &saveptr)) {
+		if (!alias) {
+			alias = line;
+			continue;
+		}
+		condlog(3, "%s: sending pr in command to %s ", alias, line);
+		*ret = mpath_send_prin_activepath(line, rq_servact, resp,
+						  noisy);
+		if (*ret == MPATH_PR_SUCCESS ||
+		    *ret == MPATH_PR_SENSE_INVALID_OP)
+			break;
+	}
+	if (alias && *ret == MPATH_PR_DMMP_ERROR)
+		condlog(2, "%s: no usable paths", alias);
+	free(reply);
+	return alias != NULL;
+}
+
 static int do_mpath_persistent_reserve_in (vector curmp, vector pathvec,
 	int fd, int rq_servact, struct prin_resp *resp, int noisy)
 {
@@ -262,13 +329,21 @@ static int do_mpath_persistent_reserve_in (vector curmp, vector pathvec,
 int __mpath_persistent_reserve_in (int fd, int rq_servact,
 	struct prin_resp *resp, int noisy)
 {
+	int ret;
+
+	if (prin_daemon_paths(fd, rq_servact, resp, noisy, &ret))
+		return ret;
 	return do_mpath_persistent_reserve_in(curmp, pathvec, fd, rq_servact,
 					      resp, noisy);
 }
 
-static int do_mpath_persistent_reserve_out(vector curmp, vector pathvec, int fd,
-	int rq_servact, int rq_scope, unsigned int rq_type,
-	struct prout_param_descriptor *paramp, int noisy)
+/*
+ * Look up the map of fd and check the reservation key. On success, *alias
+ * must be freed by the caller.
+ */
+static int prepare_prout(vector curmp, vector pathvec, int fd,
+			 int rq_servact, struct prout_param_descriptor *paramp,
+			 char **palias, struct multipath **pmpp)
 {
 	struct multipath *mpp;
 	char *alias;
@@ -297,7 +372,7 @@ static int do_mpath_persistent_reserve_out(vector curmp, vector pathvec, int fd,
 			condlog(0, "%s: failed to set prkey for multipathd.",
 				alias);
 			ret = MPATH_PR_DMMP_ERROR;
-			goto out1;
+			goto out;
 		}
 	}
 
@@ -306,8 +381,50 @@ static int do_mpath_persistent_reserve_out(vector curmp, vector pathvec, int fd,
 	    (prkey || rq_servact != MPATH_PROUT_REG_IGN_SA)) {
 		condlog(0, "%s: configured reservation key doesn't match: 0x%" PRIx64, alias, get_be64(mpp->reservation_key));
 		ret = MPATH_PR_SYNTAX_ERROR;
-		goto out1;
+		goto out;
+	}
+
+	*palias = alias;
+	*pmpp = mpp;
+	return MPATH_PR_SUCCESS;
+out:
+	FREE(alias);
+	return ret;
+}
+
+/* Tell multipathd about the result of a successful PR OUT command */
+static void finish_prout(char *alias, int rq_servact,
+			 const struct prout_param_descriptor *paramp, int ret)
+{
+	uint64_t prkey;
+
+	memcpy(&prkey, paramp->sa_key, 8);
+	if ((ret == MPATH_PR_SUCCESS) && ((rq_servact == MPATH_PROUT_REG_SA) ||
+				(rq_servact ==  MPATH_PROUT_REG_IGN_SA)))
+	{
+		if (prkey == 0) {
+			update_prflag(alias, 0);
+			update_prkey(alias, 0);
+		} else
+			update_prflag(alias, 1);
+	} else if ((ret == MPATH_PR_SUCCESS) && (rq_servact == MPATH_PROUT_CLEAR_SA)) {
+		update_prflag(alias, 0);
+		update_prkey(alias, 0);
 	}
+}
+
+static int do_mpath_persistent_reserve_out(vector curmp, vector pathvec, int fd,
+	int rq_servact, int rq_scope, unsigned int rq_type,
+	struct prout_param_descriptor *paramp, int noisy)
+{
+	struct multipath *mpp;
+	char *alias;
+	int ret;
+
+	ret = prepare_prout(curmp, pathvec, fd, rq_servact, paramp,
+			    &alias, &mpp);
+	if (ret != MPATH_PR_SUCCESS)
+		return ret;
 
 	switch(rq_servact)
 	{
@@ -329,24 +446,12 @@ static int do_mpath_persistent_reserve_out(vector curmp, vector pathvec, int fd,
 		goto out1;
 	}
 
-	if ((ret == MPATH_PR_SUCCESS) && ((rq_servact == MPATH_PROUT_REG_SA) ||
-				(rq_servact ==  MPATH_PROUT_REG_IGN_SA)))
-	{
-		if (prkey == 0) {
-			update_prflag(alias, 0);
-			update_prkey(alias, 0);
-		} else
-			update_prflag(alias, 1);
-	} else if ((ret == MPATH_PR_SUCCESS) && (rq_servact == MPATH_PROUT_CLEAR_SA)) {
-		update_prflag(alias, 0);
-		update_prkey(alias, 0);
-	}
+	finish_prout(alias, rq_servact, paramp, ret);
 out1:
 	FREE(alias);
 	return ret;
 }
 
-
 int __mpath_persistent_reserve_out ( int fd, int rq_servact, int rq_scope,
 	unsigned int rq_type, struct prout_param_descriptor *paramp, int noisy)
 {
@@ -359,9 +464,12 @@ int mpath_persistent_reserve_in (int fd, int rq_servact,
 	struct prin_resp *resp, int noisy, int verbose)
 {
 	vector curmp = NULL, pathvec;
-	int ret = __mpath_persistent_reserve_init_vecs(&curmp, &pathvec,
-						       verbose);
+	int ret;
 
+	libmp_verbosity = verbose;
+	if (prin_daemon_paths(fd, rq_servact, resp, noisy, &ret))
+		return ret;
+	ret = __mpath_persistent_reserve_init_vecs(&curmp, &pathvec, verbose);
 	if (ret != MPATH_PR_SUCCESS)
 		return ret;
 	ret = do_mpath_persistent_reserve_in(curmp, pathvec, fd, rq_servact,
@@ -385,6 +493,281 @@ int mpath_persistent_reserve_out ( int fd, int rq_servact, int rq_scope,
 	return ret;
 }
 
+static void prout_worker_fn(void *item, __attribute__((unused)) void *arg)
+{
+	struct prout_param *param = item;
+
+	param->status = prout_do_scsi_ioctl(param->dev, param->rq_servact,
+					    param->rq_scope, param->rq_type,
+					    param->paramp, param->noisy);
+}
+
+/*
+ * Send the PR OUT commands in list in parallel. The worker pool is
+ * created on first use, and only one job can run on it at a time.
+ * If another thread is using it, the commands are sent one by one from
+ * the calling thread, which is then running in parallel itself.
+ */
+static void run_prout_params(struct prout_param **list, int n)
+{
+	struct _vector items = { .allocated = n, .slot = (void **)list };
+
+	if (n <= 0)
+		return;
+	if (pthread_mutex_trylock(&pr_pool_lock) != 0) {
+		worker_pool_run(NULL, &items, prout_worker_fn, NULL);
+		return;
+	}
+	if (!pr_pool && n > 1)
+		pr_pool = worker_pool_create(PR_POOL_SIZE, "mpathpersist");
+	worker_pool_run(pr_pool, &items, prout_worker_fn, NULL);
+	pthread_mutex_unlock(&pr_pool_lock);
+}
+
+/*
+ * Set up one registration command per usable path of mpp in params,
+ * which has room for max entries. Returns the number of commands.
+ */
+static int setup_prout_reg(struct multipath *mpp, int rq_servact,
+			   int rq_scope, unsigned int rq_type,
+			   struct prout_param_descriptor *paramp, int noisy,
+			   struct prout_param *params, int max)
+{
+	int i, j, k;
+	struct pathgroup *pgp = NULL;
+	struct path *pp = NULL;
+	int count = 0;
+	int all_tg_pt;
+	int hosts[max > 0 ? max : 1];
+
+	all_tg_pt = (mpp->all_tg_pt == ALL_TG_PT_ON ||
+		     paramp->sa_flags & MPATH_F_ALL_TG_PT_MASK);
+
+	vector_foreach_slot (mpp->pg, pgp, j){
+		vector_foreach_slot (pgp->paths, pp, i){
+			if (!((pp->state == PATH_UP) || (pp->state == PATH_GHOST))){
+				condlog (1, "%s: %s path not up. Skip.", mpp->wwid, pp->dev);
+				continue;
+			}
+			if (all_tg_pt && pp->sg_id.host_no != -1) {
+				for (k = 0; k < count; k++) {
+					if (pp->sg_id.host_no == hosts[k]) {
+						condlog(3, "%s: %s host %d matches skip.", pp->wwid, pp->dev, pp->sg_id.host_no);
+						break;
+					}
+				}
+				if (k < count)
+					continue;
+			}
+			if (count == max)
+				return count;
+
+			memset(&params[count], 0, sizeof(params[count]));
+			strlcpy(params[count].dev, pp->dev, FILE_NAME_SIZE);
+			params[count].rq_servact = rq_servact;
+			params[count].rq_scope = rq_scope;
+			params[count].rq_type = rq_type;
+			params[count].paramp = paramp;
+			params[count].noisy = noisy;
+			params[count].status = MPATH_PR_SKIP;
+			hosts[count] = pp->sg_id.host_no;
+			condlog (3, "%s: sending pr out command to %s", mpp->wwid, pp->dev);
+			count = count + 1;
+		}
+	}
+	return count;
+}
+
+/* Combined status of the registration commands in params */
+static int prout_reg_status(const struct prout_param *params, int count,
+			    bool *conflict)
+{
+	int i, status = MPATH_PR_SUCCESS;
+
+	*conflict = false;
+	for (i = 0; i < count; i++) {
+		if (!*conflict &&
+		    params[i].status == MPATH_PR_RESERV_CONFLICT) {
+			*conflict = true;
+			status = MPATH_PR_RESERV_CONFLICT;
+		}
+		if (!*conflict && status == MPATH_PR_SUCCESS)
+			status = params[i].status;
+	}
+	return status;
+}
+
+/* Parameter data for undoing a registration with paramp */
+static void init_rollback_param(struct prout_param_descriptor *rb,
+				const struct prout_param_descriptor *paramp)
+{
+	memcpy(rb, paramp, sizeof(*rb));
+	memcpy(rb->key, paramp->sa_key, 8);
+	memset(rb->sa_key, 0, 8);
+	rb->sa_flags &= ~MPATH_F_SPEC_I_PT_MASK;
+	rb->num_transportid = 0;
+}
+
+/*
+ * Set up the rollback of the successful registrations in params, and add
+ * them to list. Returns the number of commands added.
+ */
+static int setup_prout_reg_rollback(struct prout_param *params, int count,
+				    struct prout_param_descriptor *rb,
+				    struct prout_param **list)
+{
+	int i, n = 0;
+
+	for (i = 0; i < count; i++) {
+		if (params[i].status != MPATH_PR_SUCCESS)
+			continue;
+		params[i].paramp = rb;
+		list[n++] = &params[i];
+	}
+	return n;
+}
+
+struct prout_batch_map {
+	char *alias;
+	struct multipath *mpp;
+	int first;	/* index of the map's first command */
+	int count;	/* number of commands for the map */
+};
+
+/*
+ * Register a key on all maps at once: the commands for all paths of all
+ * maps are sent in a single run of the worker pool.
+ */
+static int batch_prout_reg(vector curmp, vector pathvec, const int *fds,
+			   int nfds, int rq_servact, int rq_scope,
+			   unsigned int rq_type,
+			   struct prout_param_descriptor *paramp, int noisy,
+			   int *status)
+{
+	struct prout_batch_map *maps;
+	struct prout_param *params = NULL;
+	struct prout_param **list = NULL;
+	struct prout_param_descriptor *rb = NULL;
+	int i, n, total = 0, ret = MPATH_PR_SUCCESS;
+	bool conflict;
+
+	maps = calloc(nfds, sizeof(*maps));
+	if (!maps)
+		return MPATH_PR_OTHER;
+
+	for (i = 0; i < nfds; i++) {
+		status[i] = prepare_prout(curmp, pathvec, fds[i], rq_servact,
+					  paramp, &maps[i].alias,
+					  &maps[i].mpp);
+		if (status[i] != MPATH_PR_SUCCESS)
+			continue;
+		maps[i].count = count_active_paths(maps[i].mpp);
+		if (maps[i].count == 0) {
+			condlog(0, "%s: no path available", maps[i].mpp->wwid);
+			status[i] = MPATH_PR_DMMP_ERROR;
+		}
+		total += maps[i].count;
+	}
+
+	params = calloc(total ? total : 1, sizeof(*params));
+	list = calloc(total ? total : 1, sizeof(*list));
+	if (!params || !list) {
+		for (i = 0; i < nfds; i++)
+			if (status[i] == MPATH_PR_SUCCESS)
+				status[i] = MPATH_PR_OTHER;
+		goto out;
+	}
+
+	for (i = 0, n = 0; i < nfds; i++) {
+		if (status[i] != MPATH_PR_SUCCESS)
+			continue;
+		maps[i].first = n;
+		maps[i].count = setup_prout_reg(maps[i].mpp, rq_servact,
+						rq_scope, rq_type, paramp,
+						noisy, params + n,
+						maps[i].count);
+		n += maps[i].count;
+	}
+	for (i = 0; i < n; i++)
+		list[i] = &params[i];
+	run_prout_params(list, n);
+
+	for (i = 0, n = 0; i < nfds; i++) {
+		if (status[i] != MPATH_PR_SUCCESS)
+			continue;
+		status[i] = prout_reg_status(params + maps[i].first,
+					     maps[i].count, &conflict);
+		if (!conflict || rq_servact != MPATH_PROUT_REG_SA ||
+		    !get_unaligned_be64(&paramp->sa_key[0]))
+			continue;
+		if (!rb) {
+			rb = malloc(sizeof(*rb));
+			if (!rb) {
+				condlog(0, "failed to alloc pr out rollback parameter");
+				continue;
+			}
+			init_rollback_param(rb, paramp);
+		}
+		condlog(3, "%s: ERROR: initiating pr out rollback",
+			maps[i].mpp->wwid);
+		n += setup_prout_reg_rollback(params + maps[i].first,
+					      maps[i].count, rb, list + n);
+	}
+	run_prout_params(list, n);
+
+out:
+	for (i = 0; i < nfds; i++) {
+		if (maps[i].alias) {
+			finish_prout(maps[i].alias, rq_servact, paramp,
+				     status[i]);
+			FREE(maps[i].alias);
+		}
+		if (ret == MPATH_PR_SUCCESS)
+			ret = status[i];
+	}
+	free(rb);
+	free(list);
+	free(params);
+	free(maps);
+	return ret;
+}
+
+int mpath_persistent_reserve_out_batch(const int *fds, int nfds,
+	int rq_servact, int rq_scope, unsigned int rq_type,
+	struct prout_param_descriptor *paramp, int noisy, int verbose,
+	int *status)
+{
+	vector curmp = NULL, pathvec;
+	int i, ret;
+
+	if (nfds <= 0 || !fds || !status)
+		return MPATH_PR_SYNTAX_ERROR;
+
+	ret = __mpath_persistent_reserve_init_vecs(&curmp, &pathvec, verbose);
+	if (ret != MPATH_PR_SUCCESS)
+		return ret;
+
+	if ((rq_servact == MPATH_PROUT_REG_SA ||
+	     rq_servact == MPATH_PROUT_REG_IGN_SA) &&
+	    !(paramp->sa_flags & MPATH_F_SPEC_I_PT_MASK))
+		ret = batch_prout_reg(curmp, pathvec, fds, nfds, rq_servact,
+				      rq_scope, rq_type, paramp, noisy,
+				      status);
+	else {
+		/* Other commands are sent to one path per map, or need
+		 * the full sequence of mpath_prout_rel() */
+		for (i = 0; i < nfds; i++) {
+			status[i] = do_mpath_persistent_reserve_out(curmp,
+					pathvec, fds[i], rq_servact, rq_scope,
+					rq_type, paramp, noisy);
+			if (ret == MPATH_PR_SUCCESS)
+				ret = status[i];
+		}
+	}
+	__mpath_persistent_reserve_free_vecs(curmp, pathvec);
+	return ret;
+}
+
 int
 get_mpvec (vector curmp, vector pathvec, char * refwwid)
 {
@@ -432,23 +815,16 @@ int mpath_send_prin_activepath (char * dev, int rq_servact,
 int mpath_prout_reg(struct multipath *mpp,int rq_servact, int rq_scope,
 	unsigned int rq_type, struct prout_param_descriptor * paramp, int noisy)
 {
-
-	int i, j, k;
-	struct pathgroup *pgp = NULL;
-	struct path *pp = NULL;
-	int rollback = 0;
+	int i, first = 0;
 	int active_pathcount=0;
-	int rc;
-	int count=0;
-	int status = MPATH_PR_SUCCESS;
-	int all_tg_pt;
-	uint64_t sa_key = 0;
+	int count;
+	int status;
+	bool conflict;
+	struct prout_param_descriptor *rb;
 
 	if (!mpp)
 		return MPATH_PR_DMMP_ERROR;
 
-	all_tg_pt = (mpp->all_tg_pt == ALL_TG_PT_ON ||
-		     paramp->sa_flags & MPATH_F_ALL_TG_PT_MASK);
 	active_pathcount = count_active_paths(mpp);
 
 	if (active_pathcount == 0) {
@@ -456,130 +832,41 @@ int mpath_prout_reg(struct multipath *mpp,int rq_servact, int rq_scope,
 		return MPATH_PR_DMMP_ERROR;
 	}
 
-	struct threadinfo thread[active_pathcount];
-	int hosts[active_pathcount];
-
-	memset(thread, 0, sizeof(thread));
-
-	/* init thread parameter */
-	for (i =0; i< active_pathcount; i++){
-		hosts[i] = -1;
-		thread[i].param.rq_servact = rq_servact;
-		thread[i].param.rq_scope = rq_scope;
-		thread[i].param.rq_type = rq_type;
-		thread[i].param.paramp = paramp;
-		thread[i].param.noisy = noisy;
-		thread[i].param.status = MPATH_PR_SKIP;
+	struct prout_param params[active_pathcount];
+	struct prout_param *list[active_pathcount];
 
-		condlog (3, "THREAD ID [%d] INFO]", i);
-		condlog (3, "rq_servact=%d ", thread[i].param.rq_servact);
-		condlog (3, "rq_scope=%d ", thread[i].param.rq_scope);
-		condlog (3, "rq_type=%d ", thread[i].param.rq_type);
-		condlog (3, "rkey=");
-		condlog (3, "paramp->sa_flags =%02x ",
-			 thread[i].param.paramp->sa_flags);
-		condlog (3, "noisy=%d ", thread[i].param.noisy);
-		condlog (3, "status=%d ", thread[i].param.status);
+	count = setup_prout_reg(mpp, rq_servact, rq_scope, rq_type, paramp,
+				noisy, params, active_pathcount);
+	if (count > 1 && (paramp->sa_flags & MPATH_F_SPEC_I_PT_MASK)) {
+		/*
+		 * The first command registers the transport IDs. Clear
+		 * SPEC_I_PT for the others once it has completed.
+		 */
+		list[0] = &params[0];
+		run_prout_params(list, 1);
+		paramp->sa_flags &= (~MPATH_F_SPEC_I_PT_MASK);
+		first = 1;
 	}
+	for (i = first; i < count; i++)
+		list[i - first] = &params[i];
+	run_prout_params(list, count - first);
 
-	pthread_attr_t attr;
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-	vector_foreach_slot (mpp->pg, pgp, j){
-		vector_foreach_slot (pgp->paths, pp, i){
-			if (!((pp->state == PATH_UP) || (pp->state == PATH_GHOST))){
-				condlog (1, "%s: %s path not up. Skip.", mpp->wwid, pp->dev);
-				continue;
-			}
-			if (all_tg_pt && pp->sg_id.host_no != -1) {
-				for (k = 0; k < count; k++) {
-					if (pp->sg_id.host_no == hosts[k]) {
-						condlog(3, "%s: %s host %d matches skip.", pp->wwid, pp->dev, pp->sg_id.host_no);
-						break;
-					}
-				}
-				if (k < count)
-					continue;
-			}
-			strlcpy(thread[count].param.dev, pp->dev,
-				FILE_NAME_SIZE);
-
-			if (count && (thread[count].param.paramp->sa_flags & MPATH_F_SPEC_I_PT_MASK)){
-				/*
-				 * Clearing SPEC_I_PT as transportids are already registered by now.
-				 */
-				thread[count].param.paramp->sa_flags &= (~MPATH_F_SPEC_I_PT_MASK);
-			}
-
-			condlog (3, "%s: sending pr out command to %s", mpp->wwid, pp->dev);
-
-			rc = pthread_create(&thread[count].id, &attr, mpath_prout_pthread_fn, (void *)(&thread[count].param));
-			if (rc){
-				condlog (0, "%s: failed to create thread %d", mpp->wwid, rc);
-				thread[count].param.status = MPATH_PR_THREAD_ERROR;
-			}
-			else
-				hosts[count] = pp->sg_id.host_no;
-			count = count + 1;
-		}
-	}
-	for( i=0; i < count ; i++){
-		if (thread[i].param.status != MPATH_PR_THREAD_ERROR) {
-			rc = pthread_join(thread[i].id, NULL);
-			if (rc){
-				condlog (0, "%s: Thread[%d] failed to join thread %d", mpp->wwid, i, rc);
-			}
-		}
-		if (!rollback && (thread[i].param.status == MPATH_PR_RESERV_CONFLICT)){
-			rollback = 1;
-			sa_key = get_unaligned_be64(&paramp->sa_key[0]);
-			status = MPATH_PR_RESERV_CONFLICT ;
-		}
-		if (!rollback && (status == MPATH_PR_SUCCESS)){
-			status = thread[i].param.status;
-		}
-	}
-	if (rollback && ((rq_servact == MPATH_PROUT_REG_SA) && sa_key != 0 )){
+	status = prout_reg_status(params, count, &conflict);
+	if (conflict && ((rq_servact == MPATH_PROUT_REG_SA) &&
+			 get_unaligned_be64(&paramp->sa_key[0]) != 0)) {
 		condlog (3, "%s: ERROR: initiating pr out rollback", mpp->wwid);
-		memcpy(&paramp->key, &paramp->sa_key, 8);
-		memset(&paramp->sa_key, 0, 8);
-		for( i=0 ; i < count ; i++){
-			if(thread[i].param.status == MPATH_PR_SUCCESS) {
-				rc = pthread_create(&thread[i].id, &attr, mpath_prout_pthread_fn,
-						(void *)(&thread[i].param));
-				if (rc){
-					condlog (0, "%s: failed to create thread for rollback. %d",  mpp->wwid, rc);
-					thread[i].param.status = MPATH_PR_THREAD_ERROR;
-				}
-			} else
-				thread[i].param.status = MPATH_PR_SKIP;
-		}
-		for(i=0; i < count ; i++){
-			if (thread[i].param.status != MPATH_PR_SKIP &&
-			    thread[i].param.status != MPATH_PR_THREAD_ERROR) {
-				rc = pthread_join(thread[i].id, NULL);
-				if (rc){
-					condlog (3, "%s: failed to join thread while rolling back %d",
-						 mpp->wwid, i);
-				}
-			}
+		rb = malloc(sizeof(*rb));
+		if (!rb) {
+			condlog(0, "%s: failed to alloc pr out rollback parameter",
+				mpp->wwid);
+			return status;
 		}
+		init_rollback_param(rb, paramp);
+		run_prout_params(list, setup_prout_reg_rollback(params, count,
+								rb, list));
+		free(rb);
 	}
-
-	pthread_attr_destroy(&attr);
-	return (status);
-}
-
-void * mpath_prout_pthread_fn(void *p)
-{
-	int ret;
-	struct prout_param * param = (struct prout_param *)p;
-
-	ret = prout_do_scsi_ioctl( param->dev,param->rq_servact, param->rq_scope,
-			param->rq_type, param->paramp, param->noisy);
-	param->status = ret;
-	pthread_exit(NULL);
+	return status;
 }
 
 int mpath_prout_common(struct multipath *mpp,int rq_servact, int rq_scope,
@@ -611,34 +898,8 @@ int mpath_prout_common(struct multipath *mpp,int rq_servact, int rq_scope,
 int send_prout_activepath(char * dev, int rq_servact, int rq_scope,
 	unsigned int rq_type, struct prout_param_descriptor * paramp, int noisy)
 {
-	struct prout_param param;
-	param.rq_servact = rq_servact;
-	param.rq_scope  = rq_scope;
-	param.rq_type   = rq_type;
-	param.paramp    = paramp;
-	param.noisy = noisy;
-	param.status = -1;
-
-	pthread_t thread;
-	pthread_attr_t attr;
-	int rc;
-
-	memset(&thread, 0, sizeof(thread));
-	strlcpy(param.dev, dev, FILE_NAME_SIZE);
-	/* Initialize and set thread joinable attribute */
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-	rc = pthread_create(&thread, &attr, mpath_prout_pthread_fn, (void *)(&param));
-	if (rc){
-		condlog (3, "%s: failed to create thread %d", dev, rc);
-		return MPATH_PR_THREAD_ERROR;
-	}
-	/* Free attribute and wait for the other threads */
-	pthread_attr_destroy(&attr);
-	rc = pthread_join(thread, NULL);
-
-	return (param.status);
+	return prout_do_scsi_ioctl(dev, rq_servact, rq_scope, rq_type,
+				   paramp, noisy);
 }
 
 int mpath_prout_rel(struct multipath *mpp,int rq_servact, int rq_scope,
@@ -649,8 +910,7 @@ int mpath_prout_rel(struct multipath *mpp,int rq_servact, int rq_scope,
 	struct pathgroup *pgp = NULL;
 	struct path *pp = NULL;
 	int active_pathcount = 0;
-	pthread_attr_t attr;
-	int rc, found = 0;
+	int found = 0;
 	int count = 0;
 	int status = MPATH_PR_SUCCESS;
 	struct prin_resp resp;
@@ -669,64 +929,41 @@ int mpath_prout_rel(struct multipath *mpp,int rq_servact, int rq_scope,
 		return MPATH_PR_DMMP_ERROR;
 	}
 
-	struct threadinfo thread[active_pathcount];
-	memset(thread, 0, sizeof(thread));
-	for (i = 0; i < active_pathcount; i++){
-		thread[i].param.rq_servact = rq_servact;
-		thread[i].param.rq_scope = rq_scope;
-		thread[i].param.rq_type = rq_type;
-		thread[i].param.paramp = paramp;
-		thread[i].param.noisy = noisy;
-		thread[i].param.status = MPATH_PR_SKIP;
-
-		condlog (3, " path count = %d", i);
-		condlog (3, "rq_servact=%d ", thread[i].param.rq_servact);
-		condlog (3, "rq_scope=%d ", thread[i].param.rq_scope);
-		condlog (3, "rq_type=%d ", thread[i].param.rq_type);
-		condlog (3, "noisy=%d ", thread[i].param.noisy);
-		condlog (3, "status=%d ", thread[i].param.status);
-	}
-
-	pthread_attr_init (&attr);
-	pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+	struct prout_param params[active_pathcount];
+	struct prout_param *list[active_pathcount];
 
+	memset(params, 0, sizeof(params));
 	vector_foreach_slot (mpp->pg, pgp, j){
 		vector_foreach_slot (pgp->paths, pp, i){
 			if (!((pp->state == PATH_UP) || (pp->state == PATH_GHOST))){
 				condlog (1, "%s: %s path not up.", mpp->wwid, pp->dev);
 				continue;
 			}
-
-			strlcpy(thread[count].param.dev, pp->dev,
-				FILE_NAME_SIZE);
+			if (count == active_pathcount)
+				break;
+
+			strlcpy(params[count].dev, pp->dev, FILE_NAME_SIZE);
+			params[count].rq_servact = rq_servact;
+			params[count].rq_scope = rq_scope;
+			params[count].rq_type = rq_type;
+			params[count].paramp = paramp;
+			params[count].noisy = noisy;
+			params[count].status = MPATH_PR_SKIP;
+			list[count] = &params[count];
 			condlog (3, "%s: sending pr out command to %s", mpp->wwid, pp->dev);
-			rc = pthread_create (&thread[count].id, &attr, mpath_prout_pthread_fn,
-					(void *) (&thread[count].param));
-			if (rc) {
-				condlog (0, "%s: failed to create thread. %d",  mpp->wwid, rc);
-				thread[count].param.status = MPATH_PR_THREAD_ERROR;
-			}
 			count = count + 1;
 		}
 	}
-	pthread_attr_destroy (&attr);
-	for (i = 0; i < count; i++){
-		if (thread[i].param.status != MPATH_PR_THREAD_ERROR) {
-			rc = pthread_join (thread[i].id, NULL);
-			if (rc){
-				condlog (1, "%s: failed to join thread.  %d",  mpp->wwid,  rc);
-			}
-		}
-	}
+	run_prout_params(list, count);
 
 	for (i = 0; i < count; i++){
 		/*  check thread status here and return the status */
 
-		if (thread[i].param.status == MPATH_PR_RESERV_CONFLICT)
+		if (params[i].status == MPATH_PR_RESERV_CONFLICT)
 			status = MPATH_PR_RESERV_CONFLICT;
 		else if (status == MPATH_PR_SUCCESS
-				&& thread[i].param.status != MPATH_PR_RESERV_CONFLICT)
-			status = thread[i].param.status;
+				&& params[i].status != MPATH_PR_RESERV_CONFLICT)
+			status = params[i].status;
 	}
 
 	status = mpath_prin_activepath (mpp, MPATH_PRIN_RRES_SA, &resp, noisy);
@@ -869,6 +1106,33 @@ void * mpath_alloc_prin_response(int prin_sa)
 	return ptr;
 }
 
+static void create_prin_buffer_key(void)
+{
+	if (pthread_key_create(&prin_buffer_key, free) == 0)
+		prin_buffer_key_ok = true;
+	else
+		condlog(0, "failed to create key for PR IN buffers");
+}
+
+struct prin_resp *mpath_get_prin_buffer(void)
+{
+	struct prin_resp *resp;
+
+	pthread_once(&prin_buffer_once, create_prin_buffer_key);
+	if (!prin_buffer_key_ok)
+		return NULL;
+	resp = pthread_getspecific(prin_buffer_key);
+	if (resp)
+		return resp;
+	/* The READ FULL STATUS buffer is big enough for all service actions */
+	resp = mpath_alloc_prin_response(MPATH_PRIN_RFSTAT_SA);
+	if (resp && pthread_setspecific(prin_buffer_key, resp) != 0) {
+		free(resp);
+		resp = NULL;
+	}
+	return resp;
+}
+
 int update_map_pr(struct multipath *mpp)
 {
 	int noisy=0;
@@ -884,7 +1148,7 @@ int update_map_pr(struct multipath *mpp)
 		return MPATH_PR_SUCCESS;
 	}
 
-	resp = mpath_alloc_prin_response(MPATH_PRIN_RKEY_SA);
+	resp = mpath_get_prin_buffer();
 	if (!resp)
 	{
 		condlog(0,"%s : failed to alloc resp in update_map_pr", mpp->alias);
@@ -895,14 +1159,12 @@ int update_map_pr(struct multipath *mpp)
 	if (ret != MPATH_PR_SUCCESS )
 	{
 		condlog(0,"%s : pr in read keys service action failed Error=%d", mpp->alias, ret);
-		free(resp);
 		return  ret;
 	}
 
 	if (resp->prin_descriptor.prin_readkeys.additional_length == 0 )
 	{
 		condlog(3,"%s: No key found. Device may not be registered. ", mpp->alias);
-		free(resp);
 		return MPATH_PR_SUCCESS;
 	}
 
@@ -928,6 +1190,5 @@ int update_map_pr(struct multipath *mpp)
 		condlog(2, "%s: prflag flag set.", mpp->alias );
 	}
 
-	free(resp);
 	return MPATH_PR_SUCCESS;
 }
@@ -252,7 +252,10 @@ extern int mpath_persistent_reserve_in (int fd, int rq_servact, struct prin_resp
  * by calling mpath_persistent_reserve_free_vecs().
  *
  * RESTRICTIONS:
- * This function uses static internal variables, and is not thread-safe.
+ * This function uses static internal variables. It may be called from
+ * several threads at once for different multipath devices, but not
+ * concurrently with mpath_persistent_reserve_init_vecs() or
+ * mpath_persistent_reserve_free_vecs().
  */
 extern int __mpath_persistent_reserve_in(int fd, int rq_servact,
 		struct prin_resp *resp, int noisy);
@@ -290,12 +293,40 @@ extern int mpath_persistent_reserve_out ( int fd, int rq_servact, int rq_scope,
  * by calling mpath_persistent_reserve_free_vecs().
  *
  * RESTRICTIONS:
- * This function uses static internal variables, and is not thread-safe.
+ * This function uses static internal variables. It may be called from
+ * several threads at once for different multipath devices, but not
+ * concurrently with mpath_persistent_reserve_init_vecs() or
+ * mpath_persistent_reserve_free_vecs().
  */
 extern int __mpath_persistent_reserve_out( int fd, int rq_servact, int rq_scope,
 		unsigned int rq_type, struct prout_param_descriptor *paramp,
 		int noisy);
 
+/*
+ * DESCRIPTION :
+ * This function sends the same PROUT command to several DM devices. For
+ * MPATH_PROUT_REG_SA and MPATH_PROUT_REG_IGN_SA without SPEC_I_PT, the
+ * commands for all paths of all devices are sent in parallel. Other
+ * service actions are sent to one device after the other, like with
+ * mpath_persistent_reserve_out().
+ *
+ * @fds: The file descriptors of the multipath devices. Input argument.
+ * @nfds: The number of file descriptors in @fds. Input argument.
+ * @rq_servact, @rq_scope, @rq_type, @paramp, @noisy, @verbose: like for
+ *	mpath_persistent_reserve_out().
+ * @status: Array of @nfds entries, receives the status of the command for
+ *	each device. Output argument.
+ *
+ * RESTRICTIONS:
+ *
+ * RETURNS: MPATH_PR_SUCCESS if the PR command was successful for all
+ *	devices, otherwise the first failing status in @status.
+ */
+extern int mpath_persistent_reserve_out_batch(const int *fds, int nfds,
+		int rq_servact, int rq_scope, unsigned int rq_type,
+		struct prout_param_descriptor *paramp, int noisy, int verbose,
+		int *status);
+
 /*
  * DESCRIPTION :
  * This function allocates data structures and performs basic initialization and
@@ -22,6 +22,12 @@
 
 #define TIMEOUT 2000
 #define MAXRETRY 5
+/*
+ * Allocation length of the first PR IN command if the response may be
+ * longer. Enough for the keys of 63 registrants, or the full status of
+ * at least 10.
+ */
+#define PRIN_SHORT_LEN 512
 
 int prin_do_scsi_ioctl(char * dev, int rq_servact, struct prin_resp *resp, int noisy);
 int mpath_translate_response (char * dev, struct sg_io_hdr io_hdr,
@@ -206,17 +212,34 @@ end_loop:
 	return buff_offset;
 }
 
-static void mpath_format_readkeys(struct prin_resp *pr_buff)
+/*
+ * The ADDITIONAL LENGTH of a READ KEYS, READ RESERVATION or READ FULL
+ * STATUS response, limited to the got bytes actually received, so that
+ * callers never look at data left in the buffer by a previous command.
+ */
+static uint32_t prin_additional_length(const struct prin_resp *pr_buff,
+				       int got)
+{
+	uint32_t len = get_unaligned_be32(&pr_buff->prin_descriptor.prin_readkeys.additional_length);
+
+	if (got < 8)
+		return 0;
+	return len > (uint32_t)got - 8 ? (uint32_t)got - 8 : len;
+}
+
+static void mpath_format_readkeys(struct prin_resp *pr_buff, int got)
 {
 	convert_be32_to_cpu(&pr_buff->prin_descriptor.prin_readkeys.prgeneration);
-	convert_be32_to_cpu(&pr_buff->prin_descriptor.prin_readkeys.additional_length);
+	pr_buff->prin_descriptor.prin_readkeys.additional_length =
+		prin_additional_length(pr_buff, got) & ~7U;
 }
 
-static void mpath_format_readresv(struct prin_resp *pr_buff)
+static void mpath_format_readresv(struct prin_resp *pr_buff, int got)
 {
 
 	convert_be32_to_cpu(&pr_buff->prin_descriptor.prin_readresv.prgeneration);
-	convert_be32_to_cpu(&pr_buff->prin_descriptor.prin_readresv.additional_length);
+	pr_buff->prin_descriptor.prin_readresv.additional_length =
+		prin_additional_length(pr_buff, got);
 
 	return;
 }
@@ -229,7 +252,20 @@ static void mpath_format_reportcapabilities(struct prin_resp *pr_buff)
 	return;
 }
 
-static void mpath_format_readfullstatus(struct prin_resp *pr_buff)
+/*
+ * Sizing: the decoded descriptors are stored in the private buffer, and
+ * mpath_alloc_prin_response() has room for MPATH_MX_TIDS pointers to them.
+ */
+#define FULLDESCR_MAX							\
+	(MPATH_MAX_PARAM_LEN / sizeof(struct prin_fulldescr) < MPATH_MX_TIDS ? \
+	 MPATH_MAX_PARAM_LEN / sizeof(struct prin_fulldescr) : MPATH_MX_TIDS)
+
+/*
+ * Decode the header and the status descriptors in one pass. Only the
+ * received descriptor bytes are saved before the private buffer is
+ * overwritten with the decoded descriptors.
+ */
+static void mpath_format_readfullstatus(struct prin_resp *pr_buff, int got)
 {
 	int num;
 	uint32_t fdesc_count=0;
@@ -242,15 +278,15 @@ static void mpath_format_readfullstatus(struct prin_resp *pr_buff)
 		sizeof(pr_buff->prin_descriptor.prin_readfd.private_buffer);
 
 	convert_be32_to_cpu(&pr_buff->prin_descriptor.prin_readfd.prgeneration);
-	convert_be32_to_cpu(&pr_buff->prin_descriptor.prin_readfd.number_of_descriptor);
+	additional_length = prin_additional_length(pr_buff, got);
+	pr_buff->prin_descriptor.prin_readfd.number_of_descriptor = 0;
 
-	if (pr_buff->prin_descriptor.prin_readfd.number_of_descriptor == 0)
+	if (additional_length == 0)
 	{
 		condlog(3, "No registration or reservation found.");
 		return;
 	}
 
-	additional_length = pr_buff->prin_descriptor.prin_readfd.number_of_descriptor;
 	if (additional_length > pbuf_size) {
 		condlog(3, "PRIN length %u exceeds max length %d", additional_length,
 			pbuf_size);
@@ -259,15 +295,23 @@ static void mpath_format_readfullstatus(struct prin_resp *pr_buff)
 
 	memset(&fdesc, 0, sizeof(struct prin_fulldescr));
 
-	memcpy( tempbuff, pr_buff->prin_descriptor.prin_readfd.private_buffer,
-		pbuf_size);
-	memset(&pr_buff->prin_descriptor.prin_readfd.private_buffer, 0,
-	       pbuf_size);
+	memcpy(tempbuff, pr_buff->prin_descriptor.prin_readfd.private_buffer,
+	       additional_length);
 
 	p =(unsigned char *)tempbuff;
 	ppbuff = (char *)pr_buff->prin_descriptor.prin_readfd.private_buffer;
 
 	for (k = 0; k < additional_length; k += num, p += num) {
+		if (additional_length - k < 24) {
+			condlog(0, "%s: corrupt PRIN response: %u trailing bytes",
+				__func__, additional_length - k);
+			break;
+		}
+		if (fdesc_count >= FULLDESCR_MAX) {
+			condlog(2, "%s: more than %zu status descriptors, ignoring the rest",
+				__func__, FULLDESCR_MAX);
+			break;
+		}
 		memcpy(&fdesc.key, p, 8 );
 		fdesc.flag = p[12];
 		fdesc.scope_type =  p[13];
@@ -332,7 +376,7 @@ int prin_do_scsi_ioctl(char * dev, int rq_servact, struct prin_resp * resp, int
 {
 
 	int ret, status, got, fd;
-	int mx_resp_len;
+	int mx_resp_len, max_len;
 	SenseData_t Sensedata;
 	int retry = MAXRETRY;
 	struct sg_io_hdr io_hdr;
@@ -357,11 +401,21 @@ int prin_do_scsi_ioctl(char * dev, int rq_servact, struct prin_resp * resp, int
 		goto out;
 	}
 
+	/*
+	 * Unless the allocation length was set by the user, start with a
+	 * short one, and repeat the command with the length from the
+	 * ADDITIONAL LENGTH field if the response didn't fit.
+	 */
+	max_len = mx_resp_len;
+	if (!mpath_mx_alloc_len && rq_servact != MPATH_PRIN_RCAP_SA &&
+	    mx_resp_len > PRIN_SHORT_LEN)
+		mx_resp_len = PRIN_SHORT_LEN;
+
 	cdb[1] = (unsigned char)(rq_servact & 0x1f);
-	cdb[7] = (unsigned char)((mx_resp_len >> 8) & 0xff);
-	cdb[8] = (unsigned char)(mx_resp_len & 0xff);
 
 retry :
+	cdb[7] = (unsigned char)((mx_resp_len >> 8) & 0xff);
+	cdb[8] = (unsigned char)(mx_resp_len & 0xff);
 	memset(&Sensedata, 0, sizeof(SenseData_t));
 	memset(&io_hdr,0 , sizeof( struct sg_io_hdr));
 
@@ -411,6 +465,17 @@ retry :
 	if (status != MPATH_PR_SUCCESS)
 		goto out;
 
+	if (mx_resp_len < max_len && got >= 8) {
+		uint32_t need = get_unaligned_be32(&resp->prin_descriptor.prin_readkeys.additional_length) + 8;
+
+		if (need > (uint32_t)mx_resp_len) {
+			mx_resp_len = need < (uint32_t)max_len ? (int)need : max_len;
+			condlog(4, "%s: repeating PR IN with %d bytes", dev,
+				mx_resp_len);
+			goto retry;
+		}
+	}
+
 	if (noisy)
 		dumpHex((const char *)resp, got , 1);
 
@@ -418,16 +483,16 @@ retry :
 	switch (rq_servact)
 	{
 		case MPATH_PRIN_RKEY_SA :
-			mpath_format_readkeys(resp);
+			mpath_format_readkeys(resp, got);
 			break;
 		case MPATH_PRIN_RRES_SA :
-			mpath_format_readresv(resp);
+			mpath_format_readresv(resp, got);
 			break;
 		case MPATH_PRIN_RCAP_SA :
 			mpath_format_reportcapabilities(resp);
 			break;
 		case MPATH_PRIN_RFSTAT_SA :
-			mpath_format_readfullstatus(resp);
+			mpath_format_readfullstatus(resp, got);
 	}
 
 out:
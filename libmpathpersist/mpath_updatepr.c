@@ -55,6 +55,41 @@ static int do_update_pr(char *alias, char *arg)
 	return ret;
 }
 
+int get_map_paths_from_daemon(int minor, char **reply)
+{
+	int fd;
+	char str[64];
+	int ret;
+
+	*reply = NULL;
+	fd = mpath_connect();
+	if (fd == -1)
+		return -1;
+
+	snprintf(str, sizeof(str), "show map dm-%d paths", minor);
+	if (send_packet(fd, str) != 0) {
+		condlog(3, "dm-%d: message=%s send error=%d", minor, str, errno);
+		mpath_disconnect(fd);
+		return -1;
+	}
+	ret = recv_packet(fd, reply, DEFAULT_REPLY_TIMEOUT);
+	mpath_disconnect(fd);
+	if (ret < 0) {
+		condlog(3, "dm-%d: message=%s recv error=%d", minor, str, errno);
+		return -1;
+	}
+	/* Older versions of multipathd don't know the command */
+	if (!*reply || !**reply || !strcmp(*reply, "fail\n") ||
+	    !strcmp(*reply, "timeout\n")) {
+		condlog(3, "dm-%d: message=%s reply=%s", minor, str,
+			*reply ? *reply : "(null)");
+		free(*reply);
+		*reply = NULL;
+		return -1;
+	}
+	return 0;
+}
+
 int update_prflag(char *mapname, int set) {
 	return do_update_pr(mapname, (set)? "setprstatus" : "unsetprstatus");
 }
@@ -21,19 +21,12 @@ struct prout_param {
 	int status;
 };
 
-struct threadinfo {
-	int status;
-	pthread_t id;
-	struct prout_param param;
-};
-
 int prin_do_scsi_ioctl(char * dev, int rq_servact, struct prin_resp * resp, int noisy);
 int prout_do_scsi_ioctl( char * dev, int rq_servact, int rq_scope,
 		unsigned int rq_type, struct prout_param_descriptor *paramp, int noisy);
 void * _mpath_pr_update (void *arg);
 int mpath_send_prin_activepath (char * dev, int rq_servact, struct prin_resp * resp, int noisy);
 int get_mpvec (vector curmp, vector pathvec, char * refwwid);
-void * mpath_prout_pthread_fn(void *p);
 void dumpHex(const char* , int len, int no_ascii);
 
 int mpath_prout_reg(struct multipath *mpp,int rq_servact, int rq_scope,
@@ -45,10 +38,22 @@ int mpath_prout_rel(struct multipath *mpp,int rq_servact, int rq_scope,
 int send_prout_activepath(char * dev, int rq_servact, int rq_scope,
 	unsigned int rq_type,   struct prout_param_descriptor * paramp, int noisy);
 
+/*
+ * Ask multipathd for the usable paths of the map dm-<minor>, see
+ * "show map $map paths". On success, *reply is the alias of the map
+ * followed by the path devices, one per line, and must be freed.
+ */
+int get_map_paths_from_daemon(int minor, char **reply);
 int update_prflag(char *mapname, int set);
 int update_prkey_flags(char *mapname, uint64_t prkey, uint8_t sa_flags);
 #define update_prkey(mapname, prkey) update_prkey_flags(mapname, prkey, 0)
 void * mpath_alloc_prin_response(int prin_sa);
+/*
+ * Return a PR IN response buffer for any service action, which belongs to
+ * the calling thread and is reused by its later calls. It must not be
+ * freed, and is released when the thread exits.
+ */
+struct prin_resp *mpath_get_prin_buffer(void);
 int update_map_pr(struct multipath *mpp);
 
 #endif
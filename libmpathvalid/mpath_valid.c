@@ -4,6 +4,7 @@
 #include <libdevmapper.h>
 #include <libudev.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "devmapper.h"
 #include "structs.h"
@@ -17,6 +18,13 @@
 #include "mpath_valid.h"
 #include "debug.h"
 
+/*
+ * mpathvalid_is_path() and mpathvalid_get_mode() may run in several
+ * threads at once. They only read the configuration, which
+ * mpathvalid_reload_config() replaces.
+ */
+static pthread_rwlock_t conf_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 static unsigned int
 get_conf_mode(struct config *conf)
 {
@@ -44,12 +52,14 @@ mpathvalid_get_mode(void)
 	int mode;
 	struct config *conf;
 
+	pthread_rwlock_rdlock(&conf_lock);
 	conf = get_multipath_config();
 	if (!conf)
 		mode = MPATH_MODE_ERROR;
 	else
 		mode = get_conf_mode(conf);
 	put_multipath_config(conf);
+	pthread_rwlock_unlock(&conf_lock);
 	return mode;
 }
 
@@ -121,8 +131,13 @@ fail:
 int
 mpathvalid_reload_config(void)
 {
+	int ret;
+
+	pthread_rwlock_wrlock(&conf_lock);
 	uninit_config();
-	return load_default_config(libmp_verbosity);
+	ret = load_default_config(libmp_verbosity);
+	pthread_rwlock_unlock(&conf_lock);
+	return ret;
 }
 
 int
@@ -144,8 +159,8 @@ int
 mpathvalid_is_path(const char *name, unsigned int mode, char **wwid,
 	           const char **path_wwids, unsigned int nr_paths)
 {
-	struct config *conf;
-	int find_multipaths_saved, r = MPATH_IS_ERROR;
+	struct config *conf, *cfg, mode_conf;
+	int findmp, r = MPATH_IS_ERROR;
 	unsigned int i;
 	struct path *pp;
 
@@ -166,15 +181,32 @@ mpathvalid_is_path(const char *name, unsigned int mode, char **wwid,
 			goto out;
 	}
 
+	pthread_rwlock_rdlock(&conf_lock);
 	conf = get_multipath_config();
-	if (!conf)
+	if (!conf) {
+		pthread_rwlock_unlock(&conf_lock);
 		goto out_wwid;
-	find_multipaths_saved = conf->find_multipaths;
-	if (mode != MPATH_DEFAULT)
-		set_conf_mode(conf, mode);
-	r = convert_result(is_path_valid(name, conf, pp, true));
-	conf->find_multipaths = find_multipaths_saved;
+	}
+	/*
+	 * Don't change the shared configuration for the mode, other
+	 * threads may be using it.
+	 */
+	cfg = conf;
+	if (mode != MPATH_DEFAULT) {
+		mode_conf = *conf;
+		set_conf_mode(&mode_conf, mode);
+		cfg = &mode_conf;
+	}
+	findmp = mode == MPATH_DEFAULT ? FIND_MULTIPATHS_UNDEF :
+		cfg->find_multipaths;
+	r = lookup_path_valid(name, findmp, true, pp->wwid);
+	if (r == PATH_IS_ERROR) {
+		r = is_path_valid(name, cfg, pp, true);
+		cache_path_valid(pp, cfg, findmp, r);
+	}
+	r = convert_result(r);
 	put_multipath_config(conf);
+	pthread_rwlock_unlock(&conf_lock);
 
 	if (r == MPATH_IS_MAYBE_VALID) {
 		for (i = 0; i < nr_paths; i++) {
@@ -85,7 +85,8 @@ int mpathvalid_init(int verbosity, int log_style);
  * DESCRIPTION:
  * 	Reread the multipath configuration files and reinitalize
  * 	the device mapper multipath configuration. This function can
- * 	be called as many times as necessary.
+ * 	be called as many times as necessary. It waits for running
+ * 	mpathvalid_is_path() calls in other threads to finish.
  *
  * RETURNS: 0 = Success, -1 = Failure
  */
@@ -141,6 +142,9 @@ unsigned int mpathvalid_get_mode(void);
  * @path_wwids: Array of pointers to path wwids, or NULL. input argument
  * @nr_paths: number of elements in path_wwids array. input argument.
  *
+ * RESTRICTIONS:
+ * 	This function may be called from several threads at once.
+ *
  * RETURNS: device claim result (mpath_valid_result)
  * 	    Also sets *wwid if wwid is not NULL, and the claim result is
  * 	    MPATH_IS_VALID, MPATH_IS_VALID_NO_CHECK, or
@@ -9,6 +9,9 @@
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "debug.h"
 #include "util.h"
@@ -53,6 +56,24 @@
 
 static const char bindings_file_header[] = BINDINGS_FILE_HEADER;
 
+struct binding {
+	char *alias;
+	char *wwid;
+};
+
+static void _free_binding(struct binding *bdg)
+{
+	free(bdg->wwid);
+	free(bdg->alias);
+	free(bdg);
+}
+
+/*
+ * Perhaps one day we'll implement this more efficiently, thus use
+ * an abstract type.
+ */
+typedef struct _vector Bindings;
+
 int
 valid_alias(const char *alias)
 {
@@ -137,6 +158,86 @@ id_already_taken(int id, const char *prefix, const char *map_wwid)
 }
 
 
+/*
+ * State for finding a free id for a new alias while scanning the
+ * bindings in file order. id is the next candidate, or -1 if no id
+ * is available any more.
+ */
+struct id_scan {
+	int id;
+	int biggest_id;
+	int smallest_bigger_id;
+};
+
+static void init_id_scan(struct id_scan *ids)
+{
+	ids->id = 1;
+	ids->biggest_id = 1;
+	ids->smallest_bigger_id = INT_MAX;
+}
+
+/* Returns false if the available ids are exhausted */
+static bool id_scan_add(struct id_scan *ids, int curr_id)
+{
+	if (ids->id < 0)
+		return false;
+	if (curr_id == ids->id) {
+		if (ids->id < INT_MAX)
+			ids->id++;
+		else {
+			ids->id = -1;
+			return false;
+		}
+	}
+	if (curr_id > ids->biggest_id)
+		ids->biggest_id = curr_id;
+	if (curr_id > ids->id && curr_id < ids->smallest_bigger_id)
+		ids->smallest_bigger_id = curr_id;
+	return true;
+}
+
+/* Returns a free id for map_wwid, or -1 */
+static int
+select_free_id(const struct id_scan *ids, const char *map_wwid,
+	       const char *prefix, int check_if_taken)
+{
+	int id = ids->id;
+	int biggest_id = ids->biggest_id;
+	int smallest_bigger_id = ids->smallest_bigger_id;
+
+	if (!prefix && check_if_taken)
+		id = -1;
+	if (id >= smallest_bigger_id) {
+		if (biggest_id < INT_MAX)
+			id = biggest_id + 1;
+		else
+			id = -1;
+	}
+	if (id > 0 && check_if_taken) {
+		while(id_already_taken(id, prefix, map_wwid)) {
+			if (id == INT_MAX) {
+				id = -1;
+				break;
+			}
+			id++;
+			if (id == smallest_bigger_id) {
+				if (biggest_id == INT_MAX) {
+					id = -1;
+					break;
+				}
+				if (biggest_id >= smallest_bigger_id)
+					id = biggest_id + 1;
+			}
+		}
+	}
+	if (id < 0) {
+		condlog(0, "no more available user_friendly_names");
+		return -1;
+	} else
+		condlog(3, "No matching wwid [%s] in bindings file.", map_wwid);
+	return id;
+}
+
 /*
  * Returns: 0   if matching entry in WWIDs file found
  *         -1   if an error occurs
@@ -150,17 +251,15 @@ lookup_binding(FILE *f, const char *map_wwid, char **map_alias,
 {
 	char buf[LINE_MAX];
 	unsigned int line_nr = 0;
-	int id = 1;
-	int biggest_id = 1;
-	int smallest_bigger_id = INT_MAX;
+	struct id_scan ids;
 
 	*map_alias = NULL;
+	init_id_scan(&ids);
 
 	rewind(f);
 	while (fgets(buf, LINE_MAX, f)) {
 		const char *alias, *wwid;
 		char *c, *saveptr;
-		int curr_id;
 
 		line_nr++;
 		c = strpbrk(buf, "#\n\r");
@@ -169,19 +268,8 @@ lookup_binding(FILE *f, const char *map_wwid, char **map_alias,
 		alias = strtok_r(buf, " \t", &saveptr);
 		if (!alias) /* blank line */
 			continue;
-		curr_id = scan_devname(alias, prefix);
-		if (curr_id == id) {
-			if (id < INT_MAX)
-				id++;
-			else {
-				id = -1;
-				break;
-			}
-		}
-		if (curr_id > biggest_id)
-			biggest_id = curr_id;
-		if (curr_id > id && curr_id < smallest_bigger_id)
-			smallest_bigger_id = curr_id;
+		if (!id_scan_add(&ids, scan_devname(alias, prefix)))
+			break;
 		wwid = strtok_r(NULL, " \t", &saveptr);
 		if (!wwid){
 			condlog(3,
@@ -201,37 +289,7 @@ lookup_binding(FILE *f, const char *map_wwid, char **map_alias,
 			return 0;
 		}
 	}
-	if (!prefix && check_if_taken)
-		id = -1;
-	if (id >= smallest_bigger_id) {
-		if (biggest_id < INT_MAX)
-			id = biggest_id + 1;
-		else
-			id = -1;
-	}
-	if (id > 0 && check_if_taken) {
-		while(id_already_taken(id, prefix, map_wwid)) {
-			if (id == INT_MAX) {
-				id = -1;
-				break;
-			}
-			id++;
-			if (id == smallest_bigger_id) {
-				if (biggest_id == INT_MAX) {
-					id = -1;
-					break;
-				}
-				if (biggest_id >= smallest_bigger_id)
-					id = biggest_id + 1;
-			}
-		}
-	}
-	if (id < 0) {
-		condlog(0, "no more available user_friendly_names");
-		return -1;
-	} else
-		condlog(3, "No matching wwid [%s] in bindings file.", map_wwid);
-	return id;
+	return select_free_id(&ids, map_wwid, prefix, check_if_taken);
 }
 
 static int
@@ -326,6 +384,292 @@ allocate_binding(int fd, const char *wwid, int id, const char *prefix)
 	return alias;
 }
 
+/*
+ * In-memory copy of the bindings file, so that lookups don't need to
+ * parse the whole file every time. The cache is reloaded if the identity,
+ * size or modification time of the file changes, e.g. when another
+ * process has modified it. Bindings allocated by this process are added
+ * to the cache directly. Protected by bindings_cache_lock.
+ */
+struct bindings_cache {
+	char *file;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	/* All lines with an alias, in file order. wwid may be NULL. */
+	struct _vector lines;
+	/* The first binding for every alias, sorted by alias */
+	struct _vector by_alias;
+	/* The first binding for every wwid, sorted by wwid */
+	struct _vector by_wwid;
+	/* id scan state for prefix, valid if have_ids is set */
+	bool have_ids;
+	char *prefix;
+	struct id_scan ids;
+};
+
+static pthread_mutex_t bindings_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct bindings_cache bindings_cache;
+
+static void clear_bindings_cache(struct bindings_cache *bc)
+{
+	struct binding *bdg;
+	int i;
+
+	vector_foreach_slot(&bc->lines, bdg, i)
+		_free_binding(bdg);
+	vector_reset(&bc->lines);
+	vector_reset(&bc->by_alias);
+	vector_reset(&bc->by_wwid);
+	free(bc->file);
+	bc->file = NULL;
+	free(bc->prefix);
+	bc->prefix = NULL;
+	bc->have_ids = false;
+}
+
+/*
+ * Binary search in one of the sorted cache vectors.
+ * Returns the index of key, or -1 - (the index to insert key at).
+ */
+static int find_cached_binding(const struct _vector *v, const char *key,
+			       bool by_wwid)
+{
+	int lo = 0, hi = VECTOR_SIZE(v) - 1;
+
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		const struct binding *bdg = VECTOR_SLOT(v, mid);
+		int cmp = strcmp(by_wwid ? bdg->wwid : bdg->alias, key);
+
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1 - lo;
+}
+
+/* Like the file lookups, use the first line matching a key */
+static int index_binding(vector v, struct binding *bdg, bool by_wwid)
+{
+	int i = find_cached_binding(v, by_wwid ? bdg->wwid : bdg->alias,
+				    by_wwid);
+
+	if (i >= 0)
+		return 0;
+	return vector_insert_slot(v, -1 - i, bdg) ? 0 : -1;
+}
+
+static int cache_binding(struct bindings_cache *bc, const char *alias,
+			 const char *wwid)
+{
+	struct binding *bdg;
+
+	bdg = calloc(1, sizeof(*bdg));
+	if (!bdg)
+		return -1;
+	bdg->alias = strdup(alias);
+	if (wwid)
+		bdg->wwid = strdup(wwid);
+	if (!bdg->alias || (wwid && !bdg->wwid) ||
+	    !vector_alloc_slot(&bc->lines)) {
+		_free_binding(bdg);
+		return -1;
+	}
+	vector_set_slot(&bc->lines, bdg);
+
+	if (bc->have_ids)
+		id_scan_add(&bc->ids, scan_devname(alias, bc->prefix));
+	if (!wwid)
+		return 0;
+	if (index_binding(&bc->by_wwid, bdg, true) != 0)
+		return -1;
+	/* rlookup_binding() ignores these */
+	if (strlen(wwid) > WWID_SIZE - 1)
+		return 0;
+	return index_binding(&bc->by_alias, bdg, false);
+}
+
+static int load_bindings_cache(struct bindings_cache *bc, FILE *f)
+{
+	char *line = NULL;
+	size_t line_len = 0;
+	int rc = 0;
+
+	rewind(f);
+	pthread_cleanup_push(cleanup_free_ptr, &line);
+	while (getline(&line, &line_len, f) >= 0) {
+		char *c, *alias, *wwid, *saveptr;
+
+		c = strpbrk(line, "#\n\r");
+		if (c)
+			*c = '\0';
+		alias = strtok_r(line, " \t", &saveptr);
+		if (!alias) /* blank line */
+			continue;
+		wwid = strtok_r(NULL, " \t", &saveptr);
+		if (cache_binding(bc, alias, wwid) != 0) {
+			rc = -1;
+			break;
+		}
+	}
+	pthread_cleanup_pop(1);
+	return rc;
+}
+
+static void set_cache_stat(struct bindings_cache *bc, const struct stat *st)
+{
+	bc->dev = st->st_dev;
+	bc->ino = st->st_ino;
+	bc->size = st->st_size;
+	bc->mtime = st->st_mtim;
+}
+
+static bool cache_matches(const struct bindings_cache *bc, const char *file,
+			  const struct stat *st)
+{
+	return bc->file && !strcmp(bc->file, file) &&
+		bc->dev == st->st_dev && bc->ino == st->st_ino &&
+		bc->size == st->st_size &&
+		bc->mtime.tv_sec == st->st_mtim.tv_sec &&
+		bc->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * Make sure the cache reflects the bindings file opened as fd / f.
+ * Must be called with bindings_cache_lock held.
+ * Returns 0 if the cache can be used, -1 otherwise.
+ */
+static int update_bindings_cache(const char *file, int fd, FILE *f)
+{
+	struct bindings_cache *bc = &bindings_cache;
+	struct stat st;
+
+	/* stat before reading, so that we reload if the file grows now */
+	if (fstat(fd, &st) != 0) {
+		clear_bindings_cache(bc);
+		return -1;
+	}
+	if (cache_matches(bc, file, &st))
+		return 0;
+
+	clear_bindings_cache(bc);
+	if (load_bindings_cache(bc, f) != 0 ||
+	    !(bc->file = strdup(file))) {
+		condlog(1, "%s: failed to cache bindings from %s",
+			__func__, file);
+		clear_bindings_cache(bc);
+		return -1;
+	}
+	set_cache_stat(bc, &st);
+	condlog(4, "%s: cached %d lines from %s", __func__,
+		VECTOR_SIZE(&bc->lines), file);
+	return 0;
+}
+
+/* Add a binding just written by allocate_binding() to fd */
+static void cache_new_binding(int fd, const char *alias, const char *wwid)
+{
+	struct bindings_cache *bc = &bindings_cache;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || cache_binding(bc, alias, wwid) != 0)
+		clear_bindings_cache(bc);
+	else
+		set_cache_stat(bc, &st);
+}
+
+static int set_cache_prefix(struct bindings_cache *bc, const char *prefix)
+{
+	struct binding *bdg;
+	int i;
+
+	if (bc->have_ids &&
+	    (bc->prefix ? prefix && !strcmp(bc->prefix, prefix) : !prefix))
+		return 0;
+
+	free(bc->prefix);
+	bc->prefix = NULL;
+	bc->have_ids = false;
+	if (prefix && !(bc->prefix = strdup(prefix)))
+		return -1;
+
+	init_id_scan(&bc->ids);
+	vector_foreach_slot(&bc->lines, bdg, i) {
+		if (!id_scan_add(&bc->ids, scan_devname(bdg->alias, prefix)))
+			break;
+	}
+	bc->have_ids = true;
+	return 0;
+}
+
+/* Same semantics as lookup_binding(), using the cache */
+static int
+lookup_cached_binding(const char *map_wwid, char **map_alias,
+		      const char *prefix, int check_if_taken)
+{
+	struct bindings_cache *bc = &bindings_cache;
+	struct id_scan no_prefix;
+	const struct binding *bdg;
+	int i;
+
+	*map_alias = NULL;
+	i = find_cached_binding(&bc->by_wwid, map_wwid, true);
+	if (i >= 0) {
+		bdg = VECTOR_SLOT(&bc->by_wwid, i);
+		condlog(3, "Found matching wwid [%s] in bindings file."
+			" Setting alias to %s", bdg->wwid, bdg->alias);
+		*map_alias = strdup(bdg->alias);
+		if (*map_alias == NULL) {
+			condlog(0, "Cannot copy alias from bindings "
+				"file: out of memory");
+			return -1;
+		}
+		return 0;
+	}
+	/* No alias matches a NULL prefix. Don't discard the cached state */
+	if (!prefix) {
+		init_id_scan(&no_prefix);
+		return select_free_id(&no_prefix, map_wwid, prefix,
+				      check_if_taken);
+	}
+	if (set_cache_prefix(bc, prefix) != 0)
+		return -1;
+	return select_free_id(&bc->ids, map_wwid, prefix, check_if_taken);
+}
+
+/* Same semantics as rlookup_binding(), using the cache */
+static int rlookup_cached_binding(char *buff, const char *map_alias)
+{
+	const struct _vector *v = &bindings_cache.by_alias;
+	const struct binding *bdg;
+	int i;
+
+	buff[0] = '\0';
+	i = find_cached_binding(v, map_alias, false);
+	if (i < 0) {
+		condlog(3, "No matching alias [%s] in bindings file.",
+			map_alias);
+		return -1;
+	}
+	bdg = VECTOR_SLOT(v, i);
+	condlog(3, "Found matching alias [%s] in bindings file."
+		" Setting wwid to %s", bdg->alias, bdg->wwid);
+	strlcpy(buff, bdg->wwid, WWID_SIZE);
+	return 0;
+}
+
+void cleanup_bindings(void)
+{
+	pthread_mutex_lock(&bindings_cache_lock);
+	clear_bindings_cache(&bindings_cache);
+	pthread_mutex_unlock(&bindings_cache_lock);
+}
+
 char *
 use_existing_alias (const char *wwid, const char *file, const char *alias_old,
 		    const char *prefix, int bindings_read_only)
@@ -335,6 +679,7 @@ use_existing_alias (const char *wwid, const char *file, const char *alias_old,
 	int fd, can_write;
 	char buff[WWID_SIZE];
 	FILE *f;
+	bool cached;
 
 	fd = open_file(file, &can_write, bindings_file_header);
 	if (fd < 0)
@@ -346,10 +691,18 @@ use_existing_alias (const char *wwid, const char *file, const char *alias_old,
 		close(fd);
 		return NULL;
 	}
+
+	pthread_mutex_lock(&bindings_cache_lock);
+	pthread_cleanup_push(cleanup_mutex, &bindings_cache_lock);
+	cached = update_bindings_cache(file, fd, f) == 0;
+
 	/* lookup the binding. if it exists, the wwid will be in buff
 	 * either way, id contains the id for the alias
 	 */
-	rlookup_binding(f, buff, alias_old);
+	if (cached)
+		rlookup_cached_binding(buff, alias_old);
+	else
+		rlookup_binding(f, buff, alias_old);
 
 	if (strlen(buff) > 0) {
 		/* if buff is our wwid, it's already
@@ -365,7 +718,10 @@ use_existing_alias (const char *wwid, const char *file, const char *alias_old,
 		goto out;
 	}
 
-	id = lookup_binding(f, wwid, &alias, NULL, 0);
+	if (cached)
+		id = lookup_cached_binding(wwid, &alias, NULL, 0);
+	else
+		id = lookup_binding(f, wwid, &alias, NULL, 0);
 	if (alias) {
 		condlog(3, "Use existing binding [%s] for WWID [%s]",
 			alias, wwid);
@@ -387,12 +743,15 @@ use_existing_alias (const char *wwid, const char *file, const char *alias_old,
 		alias = allocate_binding(fd, wwid, id, prefix);
 		condlog(0, "Allocated existing binding [%s] for WWID [%s]",
 			alias, wwid);
+		if (alias && cached)
+			cache_new_binding(fd, alias, wwid);
 	}
 
 out:
 	pthread_cleanup_push(free, alias);
 	fclose(f);
 	pthread_cleanup_pop(0);
+	pthread_cleanup_pop(1);
 	return alias;
 }
 
@@ -400,10 +759,11 @@ char *
 get_user_friendly_alias(const char *wwid, const char *file, const char *prefix,
 			int bindings_read_only)
 {
-	char *alias;
+	char *alias = NULL;
 	int fd, id;
 	FILE *f;
 	int can_write;
+	bool cached;
 
 	if (!wwid || *wwid == '\0') {
 		condlog(3, "Cannot find binding for empty WWID");
@@ -422,10 +782,17 @@ get_user_friendly_alias(const char *wwid, const char *file, const char *prefix,
 		return NULL;
 	}
 
-	id = lookup_binding(f, wwid, &alias, prefix, 1);
+	pthread_mutex_lock(&bindings_cache_lock);
+	pthread_cleanup_push(cleanup_mutex, &bindings_cache_lock);
+	cached = update_bindings_cache(file, fd, f) == 0;
+
+	if (cached)
+		id = lookup_cached_binding(wwid, &alias, prefix, 1);
+	else
+		id = lookup_binding(f, wwid, &alias, prefix, 1);
 	if (id < 0) {
 		fclose(f);
-		return NULL;
+		goto out;
 	}
 
 	pthread_cleanup_push(free, alias);
@@ -435,19 +802,24 @@ get_user_friendly_alias(const char *wwid, const char *file, const char *prefix,
 			strerror(errno));
 		free(alias);
 		alias = NULL;
-	} else if (can_write && !bindings_read_only && !alias)
+	} else if (can_write && !bindings_read_only && !alias) {
 		alias = allocate_binding(fd, wwid, id, prefix);
+		if (alias && cached)
+			cache_new_binding(fd, alias, wwid);
+	}
 
 	fclose(f);
 
 	pthread_cleanup_pop(0);
+out:
+	pthread_cleanup_pop(1);
 	return alias;
 }
 
 int
 get_user_friendly_wwid(const char *alias, char *buff, const char *file)
 {
-	int fd, unused;
+	int fd, unused, rc;
 	FILE *f;
 
 	if (!alias || *alias == '\0') {
@@ -467,34 +839,19 @@ get_user_friendly_wwid(const char *alias, char *buff, const char *file)
 		return -1;
 	}
 
-	rlookup_binding(f, buff, alias);
-	if (!strlen(buff)) {
-		fclose(f);
-		return -1;
-	}
-
+	pthread_mutex_lock(&bindings_cache_lock);
+	pthread_cleanup_push(cleanup_mutex, &bindings_cache_lock);
+	if (update_bindings_cache(file, fd, f) == 0)
+		rlookup_cached_binding(buff, alias);
+	else
+		rlookup_binding(f, buff, alias);
+	rc = strlen(buff) ? 0 : -1;
 	fclose(f);
-	return 0;
-}
-
-struct binding {
-	char *alias;
-	char *wwid;
-};
+	pthread_cleanup_pop(1);
 
-static void _free_binding(struct binding *bdg)
-{
-	free(bdg->wwid);
-	free(bdg->alias);
-	free(bdg);
+	return rc;
 }
 
-/*
- * Perhaps one day we'll implement this more efficiently, thus use
- * an abstract type.
- */
-typedef struct _vector Bindings;
-
 static void free_bindings(Bindings *bindings)
 {
 	struct binding *bdg;
@@ -613,6 +970,7 @@ static int _check_bindings_file(const struct config *conf, FILE *file,
 	pthread_cleanup_push(cleanup_free_ptr, &line);
 	while ((n = getline(&line, &line_len, file)) >= 0) {
 		char *c, *alias, *wwid, *saveptr;
+		const struct mpentry *mpe;
 		const char *mpe_wwid;
 
 		linenr++;
@@ -634,7 +992,8 @@ static int _check_bindings_file(const struct config *conf, FILE *file,
 			condlog(1, "invalid line %d in bindings file, extra args \"%s\"",
 				linenr, c);
 
-		mpe_wwid = get_mpe_wwid(conf->mptable, alias);
+		mpe = find_mpe_by_alias(conf, alias);
+		mpe_wwid = mpe ? mpe->wwid : NULL;
 		if (mpe_wwid && strcmp(mpe_wwid, wwid)) {
 			condlog(0, "ERROR: alias \"%s\" for WWID %s in bindings file "
 				"on line %u conflicts with multipath.conf entry for %s",
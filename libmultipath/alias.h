@@ -13,4 +13,7 @@ char *use_existing_alias (const char *wwid, const char *file,
 struct config;
 int check_alias_settings(const struct config *);
 
+/* Free the in-memory copy of the bindings file */
+void cleanup_bindings(void);
+
 #endif /* _ALIAS_H */
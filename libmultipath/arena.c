@@ -0,0 +1,80 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "vector.h"
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE 4096
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static size_t align_size(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+	struct arena_chunk *c;
+	size_t csize;
+	void *p;
+
+	size = align_size(size ? size : 1);
+	if (a->cur && (size_t)(a->end - a->cur) >= size) {
+		p = a->cur;
+		a->cur += size;
+		memset(p, 0, size);
+		return p;
+	}
+	csize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+	c = calloc(1, sizeof(*c) + csize);
+	if (!c)
+		return NULL;
+	c->next = a->chunks;
+	a->chunks = c;
+	a->cur = c->data + size;
+	a->end = c->data + csize;
+	return c->data;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p = arena_alloc(a, len);
+
+	if (p)
+		memcpy(p, s, len);
+	return p;
+}
+
+vector arena_vector(struct arena *a, int capacity)
+{
+	vector v = arena_alloc(a, sizeof(*v));
+
+	if (!v || capacity <= 0)
+		return v;
+	v->slot = arena_alloc(a, capacity * sizeof(*v->slot));
+	if (!v->slot)
+		return NULL;
+	v->capacity = capacity;
+	return v;
+}
+
+void release_arena(struct arena *a)
+{
+	struct arena_chunk *c, *next;
+
+	for (c = a->chunks; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	a->chunks = NULL;
+	a->cur = a->buf;
+	a->end = a->buf ? a->buf + a->buf_size : NULL;
+}
@@ -0,0 +1,55 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+#include "vector.h"
+
+/*
+ * Arena for short-lived allocations, e.g. while handling one CLI
+ * command. Memory is handed out from a caller-provided buffer first,
+ * then from chunks allocated on demand, and is only released all at
+ * once by release_arena(). An arena must only be used by one thread.
+ */
+struct arena_chunk;
+
+struct arena {
+	/* the caller-provided buffer */
+	char *buf;
+	size_t buf_size;
+	/* free space in the buffer or the newest chunk */
+	char *cur;
+	char *end;
+	struct arena_chunk *chunks;
+};
+
+#define ARENA_ALIGN 16
+/* An arena without buffer, all memory comes from chunks */
+#define ARENA_INIT { .buf = NULL, }
+
+/**
+ * macro: ARENA_ON_STACK
+ *
+ * Define a local struct arena @__x that starts with a stack buffer of
+ * @__size bytes, and is released when the current scope is left.
+ */
+#define ARENA_ON_STACK(__x, __size)					\
+	char __x ## _buf[__size] __attribute__((aligned(ARENA_ALIGN)));	\
+	struct arena __attribute__((cleanup(release_arena))) (__x) =	\
+		{ .buf = __x ## _buf, .buf_size = (__size),		\
+		  .cur = __x ## _buf, .end = __x ## _buf + (__size), }
+
+/* Zeroed memory, or NULL on allocation failure */
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_strdup(struct arena *a, const char *s);
+/*
+ * A vector with room for @capacity slots in the arena. It must not
+ * grow beyond that, and must not be freed with vector_free().
+ */
+vector arena_vector(struct arena *a, int capacity);
+/* Free all memory of the arena, it can be used again afterwards */
+void release_arena(struct arena *a);
+
+#endif /* _ARENA_H */
@@ -0,0 +1,535 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "list.h"
+#include "debug.h"
+#include "util.h"
+#include "time-util.h"
+#include "checkers.h"
+#include "thread_settings.h"
+#include "async_check.h"
+
+/*
+ * The pool grows on demand up to ASYNC_MAX_WORKERS threads, and threads
+ * beyond ASYNC_MIN_WORKERS exit after being idle for ASYNC_IDLE_SECS.
+ */
+#define ASYNC_MIN_WORKERS 4
+#define ASYNC_MAX_WORKERS 128
+#define ASYNC_IDLE_SECS 60
+/* Queued requests a worker looks at to find one for its NUMA node */
+#define ASYNC_NUMA_SCAN 16
+
+struct async_req {
+	struct list_head node; /* in async_pool.queue until started */
+	const struct async_check_ops *ops;
+	/* Keeps the DSO providing ops loaded */
+	struct checker_class *cls;
+	const char *name;
+	dev_t devt;
+	int numa_node;
+	int fd; /* a dup of the path fd, or -1 */
+	unsigned int timeout;
+	/*
+	 * Set when a worker starts the request, 0 while it's queued. Time
+	 * spent waiting for a worker doesn't count against the timeout.
+	 */
+	time_t deadline;
+	int state; /* PATH_PENDING until completed */
+	short msgid;
+	/* the checker got PATH_PENDING, signal event_fd on completion */
+	bool notify;
+	int refcount;
+	char arg[] __attribute__((aligned));
+};
+
+/* Below fields are protected by lock */
+static struct async_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* signalled when a request is queued */
+	pthread_cond_t done; /* broadcast when a request is completed */
+	struct list_head queue;
+	int nr_queued;
+	int workers;
+	int idle;
+	int event_fd; /* set once, see async_check_event_fd() */
+	bool stopping; /* see async_check_shutdown() */
+} async_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.queue = LIST_HEAD_INIT(async_pool.queue),
+	.event_fd = -1,
+};
+static pthread_once_t async_pool_once = PTHREAD_ONCE_INIT;
+
+static void init_async_pool(void)
+{
+	pthread_cond_init_mono(&async_pool.work);
+	pthread_cond_init_mono(&async_pool.done);
+	async_pool.event_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+	if (async_pool.event_fd == -1)
+		condlog(2, "async checker: failed to create eventfd: %m");
+}
+
+int async_check_event_fd(void)
+{
+	pthread_once(&async_pool_once, init_async_pool);
+	return async_pool.event_fd;
+}
+
+void async_check_clear_event(void)
+{
+	uint64_t val;
+
+	if (async_pool.event_fd != -1 &&
+	    read(async_pool.event_fd, &val, sizeof(val)) != sizeof(val) &&
+	    errno != EAGAIN)
+		condlog(3, "async checker: failed to read eventfd: %m");
+}
+
+static struct async_req *alloc_req(struct checker *c,
+				   const struct async_check_ops *ops)
+{
+	const struct async_check *ac = c->context;
+	struct async_req *req;
+
+	req = calloc(1, sizeof(*req) + ops->arg_size);
+	if (!req)
+		return NULL;
+	INIT_LIST_HEAD(&req->node);
+	req->ops = ops;
+	req->name = checker_name(c);
+	req->devt = ac->devt;
+	req->numa_node = ac->numa_node;
+	req->fd = -1;
+	req->timeout = c->timeout;
+	req->state = PATH_PENDING;
+	req->msgid = CHECKER_MSGID_NONE;
+	req->refcount = 1;
+	if (ops->prepare)
+		ops->prepare(c, req->arg);
+	return req;
+}
+
+static void free_req(struct async_req *req)
+{
+	if (req->fd != -1)
+		close(req->fd);
+	if (req->cls)
+		checker_class_put(req->cls);
+	free(req);
+}
+
+/* Called with async_pool.lock held */
+static void put_req(struct async_req *req)
+{
+	if (--req->refcount > 0)
+		return;
+	free_req(req);
+}
+
+/* Called with async_pool.lock held */
+static void dequeue_req(struct async_req *req)
+{
+	if (list_empty(&req->node))
+		return;
+	list_del_init(&req->node);
+	async_pool.nr_queued--;
+	put_req(req);
+}
+
+/* Apply the result of a completed request to the checker */
+static int complete_req(struct checker *c, const struct async_req *req)
+{
+	c->msgid = req->msgid;
+	if (req->ops->done)
+		req->ops->done(c, req->arg);
+	return req->state;
+}
+
+/* Run a check in the calling thread */
+static int run_req(struct checker *c, struct async_req *req)
+{
+	int state;
+
+	bind_numa_node(req->numa_node);
+	req->state = req->ops->check(c->fd, req->timeout, req->arg,
+				     &req->msgid);
+	state = complete_req(c, req);
+	free_req(req);
+	return state;
+}
+
+int async_check_init(struct checker *c, size_t size)
+{
+	struct async_check *ac;
+	struct stat sb;
+
+	assert(size >= sizeof(*ac));
+	ac = calloc(1, size);
+	if (!ac)
+		return 1;
+	ac->numa_node = -1;
+	if (fstat(c->fd, &sb) == 0) {
+		ac->devt = sb.st_rdev;
+		ac->numa_node = devt_numa_node(ac->devt);
+	}
+	c->context = ac;
+	return 0;
+}
+
+static void release_req(struct async_check *ac)
+{
+	if (!ac->req)
+		return;
+	pthread_mutex_lock(&async_pool.lock);
+	dequeue_req(ac->req);
+	put_req(ac->req);
+	pthread_mutex_unlock(&async_pool.lock);
+	ac->req = NULL;
+	ac->timed_out = false;
+}
+
+void async_check_shutdown(void)
+{
+	struct async_req *req, *tmp;
+
+	pthread_mutex_lock(&async_pool.lock);
+	async_pool.stopping = true;
+	list_for_each_entry_safe(req, tmp, &async_pool.queue, node)
+		dequeue_req(req);
+	pthread_cond_broadcast(&async_pool.work);
+	pthread_mutex_unlock(&async_pool.lock);
+}
+
+void async_check_free(struct checker *c)
+{
+	if (c->context) {
+		release_req(c->context);
+		free(c->context);
+		c->context = NULL;
+	}
+}
+
+/*
+ * Called with async_pool.lock held, and a non-empty queue. Prefer the
+ * requests for the NUMA node the worker is bound to, so that workers
+ * don't need to move between nodes for every request.
+ */
+static struct async_req *pick_req(int numa_node)
+{
+	struct async_req *req;
+	int n = 0;
+
+	if (numa_node >= 0) {
+		list_for_each_entry(req, &async_pool.queue, node) {
+			if (req->numa_node == numa_node)
+				return req;
+			if (++n >= ASYNC_NUMA_SCAN)
+				break;
+		}
+	}
+	return list_entry(async_pool.queue.next, struct async_req, node);
+}
+
+static void *async_worker(void *arg __attribute__((unused)))
+{
+	struct async_req *req;
+	struct timespec ts;
+	int state, r, numa_node = -1;
+	short msgid;
+
+	pthread_mutex_lock(&async_pool.lock);
+	for (;;) {
+		r = 0;
+		async_pool.idle++;
+		get_monotonic_time(&ts);
+		ts.tv_sec += ASYNC_IDLE_SECS;
+		while (list_empty(&async_pool.queue) && r != ETIMEDOUT &&
+		       !async_pool.stopping)
+			r = pthread_cond_timedwait(&async_pool.work,
+						   &async_pool.lock, &ts);
+		async_pool.idle--;
+		if (async_pool.stopping)
+			break;
+		if (list_empty(&async_pool.queue)) {
+			if (async_pool.workers > ASYNC_MIN_WORKERS)
+				break;
+			continue;
+		}
+
+		req = pick_req(numa_node);
+		list_del_init(&req->node);
+		async_pool.nr_queued--;
+		get_monotonic_time(&ts);
+		req->deadline = ts.tv_sec + req->timeout;
+		pthread_mutex_unlock(&async_pool.lock);
+
+		bind_numa_node(req->numa_node);
+		numa_node = req->numa_node;
+
+		condlog(4, "%d:%d : %s checker starting up",
+			major(req->devt), minor(req->devt), req->name);
+		msgid = CHECKER_MSGID_NONE;
+		state = req->ops->check(req->fd, req->timeout, req->arg,
+					&msgid);
+		condlog(4, "%d:%d : %s checker finished, state %s",
+			major(req->devt), minor(req->devt), req->name,
+			checker_state_name(state));
+
+		pthread_mutex_lock(&async_pool.lock);
+		req->state = state;
+		req->msgid = msgid;
+		if (req->notify && async_pool.event_fd != -1) {
+			uint64_t one = 1;
+
+			if (write(async_pool.event_fd, &one, sizeof(one)) !=
+			    sizeof(one) && errno != EAGAIN)
+				condlog(3, "async checker: failed to signal "
+					"eventfd: %m");
+		}
+		put_req(req);
+		pthread_cond_broadcast(&async_pool.done);
+	}
+	async_pool.workers--;
+	count_thread(THREAD_ASYNC_CHECK, -1);
+	condlog(4, "async checker: idle worker exiting, %d left",
+		async_pool.workers);
+	pthread_mutex_unlock(&async_pool.lock);
+
+	return NULL;
+}
+
+/* Called with async_pool.lock held */
+static void start_async_worker(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int rc;
+
+	setup_thread_attr_for(&attr, THREAD_ASYNC_CHECK, 1);
+	rc = pthread_create(&thread, &attr, async_worker, NULL);
+	if (rc == 0) {
+		async_pool.workers++;
+		count_thread(THREAD_ASYNC_CHECK, 1);
+	} else
+		condlog(1, "failed to start async checker thread: %s",
+			strerror(rc));
+	pthread_attr_destroy(&attr);
+}
+
+/* Returns 0 if the request was queued, -1 otherwise */
+static int submit_req(struct checker *c, struct async_req *req)
+{
+	struct async_check *ac = c->context;
+
+	pthread_once(&async_pool_once, init_async_pool);
+	req->fd = fcntl(c->fd, F_DUPFD_CLOEXEC, 0);
+	if (req->fd == -1)
+		return -1;
+	req->cls = checker_class_get(c);
+	/* One reference for the queue / worker, one for the context */
+	req->refcount = 2;
+
+	pthread_mutex_lock(&async_pool.lock);
+	if (async_pool.stopping) {
+		pthread_mutex_unlock(&async_pool.lock);
+		req->refcount = 1;
+		return -1;
+	}
+	list_add_tail(&req->node, &async_pool.queue);
+	async_pool.nr_queued++;
+	if (async_pool.nr_queued > async_pool.idle &&
+	    async_pool.workers < ASYNC_MAX_WORKERS)
+		start_async_worker();
+	if (async_pool.workers == 0) {
+		list_del_init(&req->node);
+		async_pool.nr_queued--;
+		pthread_mutex_unlock(&async_pool.lock);
+		req->refcount = 1;
+		return -1;
+	}
+	pthread_cond_signal(&async_pool.work);
+	pthread_mutex_unlock(&async_pool.lock);
+
+	ac->req = req;
+	ac->timed_out = false;
+	return 0;
+}
+
+/*
+ * Collect the result of the outstanding request, if it's completed.
+ * Returns PATH_PENDING otherwise, and if notify is set, the completion
+ * will be signalled on the event fd.
+ */
+static int collect_req(struct checker *c, struct async_check *ac,
+		       bool notify)
+{
+	int state;
+
+	pthread_mutex_lock(&async_pool.lock);
+	state = ac->req->state;
+	if (state != PATH_PENDING) {
+		/* The worker has dropped its reference */
+		complete_req(c, ac->req);
+		put_req(ac->req);
+		ac->req = NULL;
+	} else if (notify)
+		ac->req->notify = true;
+	pthread_mutex_unlock(&async_pool.lock);
+	return state;
+}
+
+/*
+ * A request that no worker has started yet never times out. If all
+ * workers hang on other devices, this path stays pending rather than
+ * failing without having been checked.
+ */
+static bool async_timed_out(const struct async_check *ac)
+{
+	struct timespec now;
+	time_t deadline;
+
+	pthread_mutex_lock(&async_pool.lock);
+	deadline = ac->req->deadline;
+	pthread_mutex_unlock(&async_pool.lock);
+	if (!deadline)
+		return false;
+	get_monotonic_time(&now);
+	return now.tv_sec > deadline;
+}
+
+/*
+ * Everything but waiting for a new request. Returns PATH_MAX_STATE if
+ * a request was submitted, and the path state otherwise.
+ */
+static int async_start(struct checker *c, const struct async_check_ops *ops)
+{
+	struct async_check *ac = c->context;
+	struct async_req *req;
+	int state;
+
+	if (!ac)
+		return PATH_UNCHECKED;
+
+	if (checker_is_sync(c)) {
+		req = alloc_req(c, ops);
+		return req ? run_req(c, req) : PATH_UNCHECKED;
+	}
+
+	if (ac->req && ac->timed_out) {
+		/*
+		 * The results of a timed out check are stale. Don't start
+		 * another check while the old one is still hanging in
+		 * a worker thread.
+		 */
+		if (collect_req(c, ac, false) == PATH_PENDING) {
+			condlog(3, "%d:%d : %s checker not responding",
+				major(ac->devt), minor(ac->devt),
+				checker_name(c));
+			c->msgid = CHECKER_MSGID_TIMEOUT;
+			return PATH_TIMEOUT;
+		}
+		ac->timed_out = false;
+	} else if (ac->req) {
+		state = collect_req(c, ac, true);
+		if (state != PATH_PENDING)
+			return state;
+		if (!async_timed_out(ac)) {
+			condlog(3, "%d:%d : %s checker not finished",
+				major(ac->devt), minor(ac->devt),
+				checker_name(c));
+			return PATH_PENDING;
+		}
+		condlog(3, "%d:%d : %s checker timeout",
+			major(ac->devt), minor(ac->devt), checker_name(c));
+		ac->timed_out = true;
+		c->msgid = CHECKER_MSGID_TIMEOUT;
+		return PATH_TIMEOUT;
+	}
+
+	req = alloc_req(c, ops);
+	if (!req)
+		return PATH_UNCHECKED;
+	if (submit_req(c, req) != 0) {
+		condlog(3, "%d:%d : failed to start %s checker thread, using"
+			" sync mode", major(ac->devt), minor(ac->devt),
+			checker_name(c));
+		return run_req(c, req);
+	}
+	return PATH_MAX_STATE;
+}
+
+/* Collect the result of a request submitted by async_start() */
+static int async_finish(struct checker *c)
+{
+	struct async_check *ac = c->context;
+	int state;
+
+	state = collect_req(c, ac, true);
+	if (state == PATH_PENDING)
+		condlog(4, "%d:%d : %s checker still running",
+			major(ac->devt), minor(ac->devt), checker_name(c));
+	return state;
+}
+
+/*
+ * Wait up to 1ms for the requests of the checkers in c[] whose state is
+ * PATH_MAX_STATE.
+ */
+static void async_wait(struct checker **c, const int *states, int n)
+{
+	struct async_check *ac;
+	struct timespec ts;
+	int i = 0, r = 0;
+
+	get_monotonic_time(&ts);
+	ts.tv_nsec += 1000 * 1000;
+	normalize_timespec(&ts);
+	pthread_mutex_lock(&async_pool.lock);
+	while (i < n && r != ETIMEDOUT) {
+		ac = c[i]->context;
+		if (states[i] != PATH_MAX_STATE ||
+		    ac->req->state != PATH_PENDING) {
+			i++;
+			continue;
+		}
+		r = pthread_cond_timedwait(&async_pool.done, &async_pool.lock,
+					   &ts);
+	}
+	pthread_mutex_unlock(&async_pool.lock);
+}
+
+int async_check(struct checker *c, const struct async_check_ops *ops)
+{
+	int state;
+
+	state = async_start(c, ops);
+	if (state != PATH_MAX_STATE)
+		return state;
+	async_wait(&c, &state, 1);
+	return async_finish(c);
+}
+
+void async_check_batch(struct checker **checkers, int *states, int n,
+		       const struct async_check_ops *ops)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		states[i] = async_start(checkers[i], ops);
+	async_wait(checkers, states, n);
+	for (i = 0; i < n; i++)
+		if (states[i] == PATH_MAX_STATE)
+			states[i] = async_finish(checkers[i]);
+}
@@ -0,0 +1,87 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _ASYNC_CHECK_H
+#define _ASYNC_CHECK_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+
+struct checker;
+struct async_req;
+
+/*
+ * Shared engine for path checkers that do blocking I/O.
+ *
+ * In async mode, checks are run by a pool of worker threads which is
+ * shared by all checker classes. Every check submits a request to the
+ * pool queue, and collects the result in the same or a later call, so
+ * that a hanging device never blocks the caller for longer than ~1ms.
+ * In sync mode (checker_is_sync()), checks are run by the caller.
+ *
+ * The context of a checker using this engine must be allocated with
+ * async_check_init(), and start with a struct async_check.
+ */
+struct async_check {
+	/* The outstanding request, if any */
+	struct async_req *req;
+	dev_t devt;
+	/* NUMA node of the adapter of devt, see devt_numa_node() */
+	int numa_node;
+	/* req was started, but timed out */
+	bool timed_out;
+};
+
+struct async_check_ops {
+	/*
+	 * Run the check on fd, possibly in a worker thread. arg points to
+	 * arg_size bytes private to this check.
+	 * Returns the path state and sets *msgid.
+	 */
+	int (*check)(int fd, unsigned int timeout, void *arg, short *msgid);
+	/* Optional, fill arg from the checker before the check is run */
+	void (*prepare)(struct checker *c, void *arg);
+	/*
+	 * Optional, called from the collecting thread after check()
+	 * has completed, to update the checker from arg.
+	 */
+	void (*done)(struct checker *c, const void *arg);
+	size_t arg_size;
+};
+
+/*
+ * Allocate a zeroed checker context of size bytes, which must be at least
+ * sizeof(struct async_check). Returns 0 on success.
+ */
+int async_check_init(struct checker *c, size_t size);
+/* Drop the outstanding request, and free the checker context */
+void async_check_free(struct checker *c);
+/*
+ * Drop all queued requests at once, and make the workers exit as soon
+ * as their current check returns, without waiting for them. Checks
+ * started later run in the calling thread.
+ */
+void async_check_shutdown(void);
+
+/* Check a path, usable as libcheck_check() implementation */
+int async_check(struct checker *c, const struct async_check_ops *ops);
+/*
+ * Check n paths using the same ops, usable as libcheck_check_batch()
+ * implementation. All requests are submitted before waiting, so that
+ * the wait time is shared between them.
+ */
+void async_check_batch(struct checker **checkers, int *states, int n,
+		       const struct async_check_ops *ops);
+
+/*
+ * An eventfd which becomes readable when a check completes for which
+ * PATH_PENDING was returned, so that the caller can collect the result
+ * right away. Returns -1 if it couldn't be created.
+ * async_check_clear_event() makes it unreadable again.
+ */
+int async_check_event_fd(void);
+void async_check_clear_event(void);
+
+#endif /* _ASYNC_CHECK_H */
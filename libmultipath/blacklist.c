@@ -60,6 +60,7 @@ int store_ble(vector blist, const char *str, int origin)
 
 	ble->str = strdup_str;
 	ble->origin = origin;
+	ble->literal = get_regex_literal(regex_str, &ble->anchored);
 	vector_set_slot(blist, ble);
 	return 0;
 out1:
@@ -114,6 +115,8 @@ int set_ble_device(vector blist, const char *vendor, const char *product, int or
 			goto out;
 
 		ble->vendor = vendor_str;
+		ble->vendor_literal = get_regex_literal(regex_str,
+							&ble->vendor_anchored);
 	}
 	if (product) {
 		product_str = STRDUP(product);
@@ -125,6 +128,8 @@ int set_ble_device(vector blist, const char *vendor, const char *product, int or
 			goto out1;
 
 		ble->product = product_str;
+		ble->product_literal = get_regex_literal(regex_str,
+							 &ble->product_anchored);
 	}
 	ble->origin = origin;
 	return 0;
@@ -132,6 +137,8 @@ out1:
 	if (vendor) {
 		regfree(&ble->vendor_reg);
 		ble->vendor = NULL;
+		free(ble->vendor_literal);
+		ble->vendor_literal = NULL;
 	}
 out:
 	free(vendor_str);
@@ -139,6 +146,15 @@ out:
 	return 1;
 }
 
+/* Like regexec() == 0, skipping regexec() if the literal doesn't match */
+static bool
+regmatch(const regex_t *reg, const char *literal, bool anchored,
+	 const char *str)
+{
+	return regex_literal_match(literal, anchored, str) &&
+		!regexec(reg, str, 0, NULL, 0);
+}
+
 static int
 match_reglist (const struct _vector *blist, const char *str)
 {
@@ -146,7 +162,8 @@ match_reglist (const struct _vector *blist, const char *str)
 	struct blentry * ble;
 
 	vector_foreach_slot (blist, ble, i) {
-		if (!!regexec(&ble->regex, str, 0, NULL, 0) == ble->invert)
+		if (regmatch(&ble->regex, ble->literal, ble->anchored, str) !=
+		    ble->invert)
 			return 1;
 	}
 	return 0;
@@ -163,10 +180,12 @@ match_reglist_device (const struct _vector *blist, const char *vendor,
 		if (!ble->vendor && !ble->product)
 			continue;
 		if ((!ble->vendor ||
-		     !!regexec(&ble->vendor_reg, vendor, 0, NULL, 0) ==
+		     regmatch(&ble->vendor_reg, ble->vendor_literal,
+			      ble->vendor_anchored, vendor) !=
 		     ble->vendor_invert) &&
 		    (!ble->product ||
-		     !!regexec(&ble->product_reg, product, 0, NULL, 0) ==
+		     regmatch(&ble->product_reg, ble->product_literal,
+			      ble->product_anchored, product) !=
 		     ble->product_invert))
 			return 1;
 	}
@@ -372,7 +391,7 @@ filter_path (const struct config *conf, const struct path *pp)
 	if (r > 0)
 		return r;
 	r = filter_device(conf->blist_device, conf->elist_device,
-			   pp->vendor_id, pp->product_id, pp->dev);
+			   pp->ident->vendor_id, pp->ident->product_id, pp->dev);
 	if (r > 0)
 		return r;
 	r = filter_protocol(conf->blist_protocol, conf->elist_protocol, pp);
@@ -446,6 +465,7 @@ static void free_ble(struct blentry *ble)
 		return;
 	regfree(&ble->regex);
 	FREE(ble->str);
+	free(ble->literal);
 	FREE(ble);
 }
 
@@ -494,6 +514,8 @@ static void free_ble_device(struct blentry_device *ble)
 			regfree(&ble->product_reg);
 			FREE(ble->product);
 		}
+		free(ble->vendor_literal);
+		free(ble->product_literal);
 		FREE(ble);
 	}
 }
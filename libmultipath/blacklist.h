@@ -17,11 +17,17 @@
 #define MATCH_PROPERTY_BLIST_EXCEPT -MATCH_PROPERTY_BLIST
 #define MATCH_PROTOCOL_BLIST_EXCEPT -MATCH_PROTOCOL_BLIST
 
+/*
+ * The *literal fields hold strings that any string matching the regex
+ * must contain (see get_regex_literal()), to skip most regexec() calls.
+ */
 struct blentry {
 	char * str;
 	regex_t regex;
 	bool invert;
 	int origin;
+	char * literal;
+	bool anchored;
 };
 
 struct blentry_device {
@@ -32,6 +38,10 @@ struct blentry_device {
 	bool vendor_invert;
 	bool product_invert;
 	int origin;
+	char * vendor_literal;
+	char * product_literal;
+	bool vendor_anchored;
+	bool product_anchored;
 };
 
 int setup_default_blist (struct config *);
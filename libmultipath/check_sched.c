@@ -0,0 +1,324 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdbool.h>
+#include <time.h>
+#include "list.h"
+#include "vector.h"
+#include "structs.h"
+#include "debug.h"
+#include "time-util.h"
+#include "check_sched.h"
+
+/* Must be a power of 2 */
+#define WHEEL_SIZE 256
+#define WHEEL_SLOT(t) (&wheel[(t) & (WHEEL_SIZE - 1)])
+
+static bool sched_enabled;
+static struct list_head wheel[WHEEL_SIZE];
+/* Current scheduler clock, in checker ticks */
+static unsigned long sched_now;
+/* Vector currently filled by get_due_paths(), or NULL */
+static vector due_batch;
+static LIST_HEAD(map_timers);
+/* Paths with a fast polling interval, sorted by pp->fast_due */
+static LIST_HEAD(fast_paths);
+/* Paths with an async check in flight */
+static LIST_HEAD(pending_paths);
+
+void init_check_sched(void)
+{
+	int i;
+
+	for (i = 0; i < WHEEL_SIZE; i++)
+		INIT_LIST_HEAD(&wheel[i]);
+	sched_now = 0;
+	sched_enabled = true;
+}
+
+/* Also handles struct path objects not created by alloc_path() */
+static inline bool path_scheduled(const struct path *pp)
+{
+	return pp->sched_node.next != NULL &&
+		pp->sched_node.next != &pp->sched_node;
+}
+
+/*
+ * A tick value of 0 means "check in the next checker loop iteration",
+ * like it did for the old per-path countdown.
+ */
+static void link_path(struct path *pp)
+{
+	pp->sched_due = sched_now + (pp->tick ? pp->tick : 1);
+	list_add_tail(&pp->sched_node, WHEEL_SLOT(pp->sched_due));
+}
+
+void set_path_tick(struct path *pp, unsigned int ticks)
+{
+	pp->tick = ticks;
+	if (sched_enabled && path_scheduled(pp)) {
+		list_del(&pp->sched_node);
+		link_path(pp);
+	}
+}
+
+void schedule_path_check(struct path *pp, unsigned int ticks)
+{
+	pp->tick = ticks;
+	if (!sched_enabled)
+		return;
+	if (path_scheduled(pp))
+		list_del(&pp->sched_node);
+	link_path(pp);
+}
+
+static inline bool path_fast_scheduled(const struct path *pp)
+{
+	return pp->fast_node.next != NULL &&
+		pp->fast_node.next != &pp->fast_node;
+}
+
+static inline bool path_pending(const struct path *pp)
+{
+	return pp->pending_node.next != NULL &&
+		pp->pending_node.next != &pp->pending_node;
+}
+
+void unschedule_path_check(struct path *pp)
+{
+	int i;
+
+	if (path_fast_scheduled(pp))
+		list_del_init(&pp->fast_node);
+	if (path_pending(pp))
+		list_del_init(&pp->pending_node);
+	if (!path_scheduled(pp))
+		return;
+	list_del_init(&pp->sched_node);
+	if (due_batch) {
+		i = find_slot(due_batch, pp);
+		if (i >= 0)
+			due_batch->slot[i] = NULL;
+	}
+}
+
+void schedule_all_path_checks(const struct _vector *pathvec)
+{
+	struct path *pp;
+	int i;
+
+	if (!sched_enabled)
+		return;
+	vector_foreach_slot(pathvec, pp, i) {
+		if (!path_scheduled(pp))
+			link_path(pp);
+	}
+}
+
+unsigned int path_check_ticks(const struct path *pp)
+{
+	if (!sched_enabled || !path_scheduled(pp))
+		return pp->tick;
+	return pp->sched_due > sched_now ? pp->sched_due - sched_now : 0;
+}
+
+static int collect_slot(struct list_head *slot, vector due)
+{
+	struct path *pp, *tmp;
+	int n = 0;
+
+	list_for_each_entry_safe(pp, tmp, slot, sched_node) {
+		if (pp->sched_due > sched_now)
+			continue;
+		if (!vector_alloc_slot(due))
+			return -1;
+		vector_set_slot(due, pp);
+		/*
+		 * Keep the path scheduled in case the caller doesn't
+		 * get to check it. The slot for sched_now + 1 is never
+		 * among the slots scanned in the same call, or its
+		 * entries are not due yet.
+		 */
+		pp->tick = 0;
+		pp->sched_due = sched_now + 1;
+		list_move_tail(&pp->sched_node, WHEEL_SLOT(pp->sched_due));
+		n++;
+	}
+	return n;
+}
+
+int get_due_paths(unsigned int ticks, vector due)
+{
+	unsigned long t, start = sched_now;
+	int n, total = 0;
+
+	if (!sched_enabled)
+		return 0;
+
+	due_batch = due;
+	sched_now += ticks;
+	if (ticks >= WHEEL_SIZE)
+		start = sched_now - WHEEL_SIZE;
+	for (t = start + 1; t <= sched_now; t++) {
+		n = collect_slot(WHEEL_SLOT(t), due);
+		if (n < 0)
+			return -1;
+		total += n;
+	}
+	return total;
+}
+
+void end_due_paths(void)
+{
+	due_batch = NULL;
+}
+
+static unsigned long long now_ms(void)
+{
+	struct timespec now;
+
+	get_monotonic_time(&now);
+	return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int fast_checkint(const struct path *pp)
+{
+	return pp->mpp ? pp->mpp->fast_checkint : FAST_CHECKINT_OFF;
+}
+
+/*
+ * Paths of one map share the interval, so new entries usually go to the
+ * tail, and the list is short anyway.
+ */
+static void link_fast_path(struct path *pp, unsigned long long due)
+{
+	struct path *prev;
+
+	pp->fast_due = due;
+	list_for_each_entry_reverse(prev, &fast_paths, fast_node) {
+		if (prev->fast_due <= due) {
+			list_add(&pp->fast_node, &prev->fast_node);
+			return;
+		}
+	}
+	list_add(&pp->fast_node, &fast_paths);
+}
+
+void update_fast_check(struct path *pp)
+{
+	int interval = fast_checkint(pp);
+
+	if (!sched_enabled)
+		return;
+	if (interval <= 0) {
+		if (path_fast_scheduled(pp))
+			list_del_init(&pp->fast_node);
+	} else if (!path_fast_scheduled(pp))
+		link_fast_path(pp, now_ms() + interval);
+}
+
+int next_fast_check(void)
+{
+	struct path *pp;
+	unsigned long long now;
+
+	if (list_empty(&fast_paths))
+		return -1;
+	pp = list_entry(fast_paths.next, struct path, fast_node);
+	now = now_ms();
+	return pp->fast_due > now ? (int)(pp->fast_due - now) : 0;
+}
+
+int get_fast_due_paths(vector due)
+{
+	struct path *pp, *tmp;
+	unsigned long long now = now_ms();
+	LIST_HEAD(requeue);
+	int n = 0;
+
+	due_batch = due;
+	list_for_each_entry_safe(pp, tmp, &fast_paths, fast_node) {
+		if (pp->fast_due > now)
+			break;
+		list_del_init(&pp->fast_node);
+		if (fast_checkint(pp) <= 0)
+			continue;
+		list_add_tail(&pp->fast_node, &requeue);
+		if (!vector_alloc_slot(due)) {
+			n = -1;
+			break;
+		}
+		vector_set_slot(due, pp);
+		/* Like collect_slot(), this also postpones the regular check */
+		set_path_tick(pp, 0);
+		n++;
+	}
+	list_for_each_entry_safe(pp, tmp, &requeue, fast_node) {
+		list_del_init(&pp->fast_node);
+		link_fast_path(pp, now + fast_checkint(pp));
+	}
+	return n;
+}
+
+void set_path_pending(struct path *pp)
+{
+	if (sched_enabled && !path_pending(pp))
+		list_add_tail(&pp->pending_node, &pending_paths);
+}
+
+int get_pending_paths(vector due)
+{
+	struct path *pp, *tmp;
+	int n = 0;
+
+	due_batch = due;
+	list_for_each_entry_safe(pp, tmp, &pending_paths, pending_node) {
+		if (!vector_alloc_slot(due))
+			return -1;
+		list_del_init(&pp->pending_node);
+		vector_set_slot(due, pp);
+		set_path_tick(pp, 0);
+		n++;
+	}
+	return n;
+}
+
+static inline bool map_scheduled(const struct multipath *mpp)
+{
+	return mpp->timer_node.next != NULL &&
+		mpp->timer_node.next != &mpp->timer_node;
+}
+
+static bool map_timers_armed(const struct multipath *mpp)
+{
+	return (mpp->pgfailback > 0 && mpp->failback_tick > 0) ||
+		mpp->retry_tick > 0 || mpp->wait_for_udev ||
+		mpp->ghost_delay_tick > 0 || mpp->reload_tick > 0;
+}
+
+void schedule_map_timers(struct multipath *mpp)
+{
+	if (sched_enabled && !map_scheduled(mpp))
+		list_add_tail(&mpp->timer_node, &map_timers);
+}
+
+void unschedule_map_timers(struct multipath *mpp)
+{
+	if (map_scheduled(mpp))
+		list_del_init(&mpp->timer_node);
+}
+
+struct list_head *get_map_timers(void)
+{
+	return &map_timers;
+}
+
+void prune_map_timers(void)
+{
+	struct multipath *mpp, *tmp;
+
+	list_for_each_entry_safe(mpp, tmp, &map_timers, timer_node) {
+		if (!map_timers_armed(mpp))
+			list_del_init(&mpp->timer_node);
+	}
+}
@@ -0,0 +1,95 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _CHECK_SCHED_H
+#define _CHECK_SCHED_H
+
+#include <stdbool.h>
+#include "vector.h"
+
+struct path;
+struct multipath;
+struct list_head;
+
+/*
+ * Path check scheduling for multipathd.
+ *
+ * Paths are kept in a hashed timer wheel keyed on the checker tick at
+ * which their next check is due, so that the checker loop only needs to
+ * look at the paths which are actually due.
+ *
+ * pp->tick keeps its meaning (number of ticks until the next check) for
+ * code that sets it, but must be changed with set_path_tick() while the
+ * path is scheduled. Use path_check_ticks() to read the remaining time.
+ *
+ * Scheduling is off unless init_check_sched() has been called. All
+ * functions except init_check_sched() must be called with the lock
+ * protecting the path vector held.
+ */
+void init_check_sched(void);
+
+/* Set pp->tick, and move the path in the wheel if it's scheduled */
+void set_path_tick(struct path *pp, unsigned int ticks);
+/* Set pp->tick, and add the path to the wheel if it isn't scheduled */
+void schedule_path_check(struct path *pp, unsigned int ticks);
+/* Remove a path from the wheel; called from free_path() */
+void unschedule_path_check(struct path *pp);
+/* Add all unscheduled paths in pathvec to the wheel */
+void schedule_all_path_checks(const struct _vector *pathvec);
+
+/* Ticks until the next check of this path */
+unsigned int path_check_ticks(const struct path *pp);
+
+/*
+ * Advance the scheduler clock by ticks, and append all paths that are
+ * due to the due vector. The paths remain scheduled for the next tick
+ * and have pp->tick set to 0. unschedule_path_check() clears the slot
+ * of a path in due, so callers must expect NULL slots and must not use
+ * vector_foreach_slot() on it. end_due_paths() must be called after
+ * processing.
+ * Returns the number of due paths, or -1 on allocation failure.
+ */
+int get_due_paths(unsigned int ticks, vector due);
+void end_due_paths(void);
+
+/*
+ * Paths in maps with a fast_polling_interval are additionally kept in a
+ * list sorted by the monotonic time of their next check, in ms, so that
+ * the checker loop can check them between its regular ticks.
+ * update_fast_check() adds or removes a path according to the interval
+ * of its map, and must be called after every check of a path.
+ * next_fast_check() returns the ms until the next fast check is due, or
+ * -1 if there are no fast paths.
+ * get_fast_due_paths() works like get_due_paths() for the fast paths
+ * which are due, without advancing the scheduler clock, and re-arms
+ * their fast checks. The same rules for due and end_due_paths() apply.
+ */
+void update_fast_check(struct path *pp);
+int next_fast_check(void);
+int get_fast_due_paths(vector due);
+
+/*
+ * Paths whose async checker returned PATH_PENDING are kept in a list
+ * as well, so that the checker loop can collect their results as soon
+ * as async_check_event_fd() signals. set_path_pending() adds a path.
+ * get_pending_paths() moves all of them to due, like get_fast_due_paths().
+ */
+void set_path_pending(struct path *pp);
+int get_pending_paths(vector due);
+
+/*
+ * Maps with an armed countdown (deferred failback, no_path_retry,
+ * creation uevent wait, ghost delay, deferred reload) are kept in a list, so that the
+ * per-tick housekeeping doesn't need to look at all maps.
+ * schedule_map_timers() must be called after arming one of these, and
+ * is a no-op unless init_check_sched() has been called. Maps without
+ * armed countdown are removed from the list by prune_map_timers().
+ */
+void schedule_map_timers(struct multipath *mpp);
+/* Called from free_multipath() */
+void unschedule_map_timers(struct multipath *mpp);
+/* Iterate with list_for_each_entry_safe(mpp, tmp, ..., timer_node) */
+struct list_head *get_map_timers(void);
+void prune_map_timers(void);
+
+#endif /* _CHECK_SCHED_H */
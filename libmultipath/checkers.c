@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <dlfcn.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include <urcu.h>
 #include <urcu/uatomic.h>
 
@@ -10,6 +11,7 @@
 #include "checkers.h"
 #include "vector.h"
 #include "util.h"
+#include "trace.h"
 
 struct checker_class {
 	struct list_head node;
@@ -18,6 +20,8 @@ struct checker_class {
 	int sync;
 	char name[CHECKER_NAME_LEN];
 	int (*check)(struct checker *);
+	/* optional, check multiple paths at once */
+	void (*check_batch)(struct checker **, int *, int);
 	int (*init)(struct checker *);       /* to allocate the context */
 	int (*mp_init)(struct checker *);    /* to allocate the mpcontext */
 	void (*free)(struct checker *);      /* to free the context */
@@ -41,6 +45,11 @@ static const char *checker_state_names[PATH_MAX_STATE] = {
 };
 
 static LIST_HEAD(checkers);
+/*
+ * Protects the list of checker classes. Checkers may be selected for
+ * different paths concurrently, e.g. during parallel path discovery.
+ */
+static pthread_mutex_t checkers_lock = PTHREAD_MUTEX_INITIALIZER;
 
 const char *checker_state_name(int i)
 {
@@ -80,14 +89,17 @@ void free_checker_class(struct checker_class *c)
 
 	if (!c)
 		return;
+	pthread_mutex_lock(&checkers_lock);
 	cnt = checker_class_unref(c);
 	if (cnt != 0) {
+		pthread_mutex_unlock(&checkers_lock);
 		condlog(cnt < 0 ? 1 : 4, "%s checker refcount %d",
 			c->name, cnt);
 		return;
 	}
-	condlog(3, "unloading %s checker", c->name);
 	list_del(&c->node);
+	pthread_mutex_unlock(&checkers_lock);
+	condlog(3, "unloading %s checker", c->name);
 	if (c->reset)
 		c->reset();
 	if (c->handle) {
@@ -132,6 +144,78 @@ void reset_checker_classes(void)
 	}
 }
 
+#ifdef STATIC_PLUGINS
+/*
+ * Checkers built into libmultipath, see libmultipath/Makefile.
+ * STATIC_CHECKERS expands to STATIC_CHECKER(name) for each of them.
+ * The optional functions are weak, like they'd be missing from dlsym().
+ */
+#ifndef STATIC_CHECKERS
+#define STATIC_CHECKERS
+#endif
+
+#define STATIC_CHECKER(n)						\
+	int libcheck_##n##_check(struct checker *);			\
+	void libcheck_##n##_check_batch(struct checker **, int *, int)	\
+		__attribute__((weak));					\
+	int libcheck_##n##_init(struct checker *);			\
+	int libcheck_##n##_mp_init(struct checker *) __attribute__((weak)); \
+	void libcheck_##n##_free(struct checker *);			\
+	void libcheck_##n##_reset(void) __attribute__((weak));		\
+	void *libcheck_##n##_thread(void *) __attribute__((weak));	\
+	extern const char *libcheck_##n##_msgtable[] __attribute__((weak));
+STATIC_CHECKERS
+#undef STATIC_CHECKER
+
+static const struct static_checker {
+	const char *name;
+	int (*check)(struct checker *);
+	void (*check_batch)(struct checker **, int *, int);
+	int (*init)(struct checker *);
+	int (*mp_init)(struct checker *);
+	void (*free)(struct checker *);
+	void (*reset)(void);
+	void *(*thread)(void *);
+	const char **msgtable;
+} static_checkers[] = {
+#define STATIC_CHECKER(n) {						\
+		.name = #n,						\
+		.check = libcheck_##n##_check,				\
+		.check_batch = libcheck_##n##_check_batch,		\
+		.init = libcheck_##n##_init,				\
+		.mp_init = libcheck_##n##_mp_init,			\
+		.free = libcheck_##n##_free,				\
+		.reset = libcheck_##n##_reset,				\
+		.thread = libcheck_##n##_thread,			\
+		.msgtable = libcheck_##n##_msgtable,			\
+	},
+	STATIC_CHECKERS
+#undef STATIC_CHECKER
+};
+
+static bool find_static_checker(struct checker_class *c)
+{
+	const struct static_checker *sc;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(static_checkers); i++) {
+		sc = &static_checkers[i];
+		if (strcmp(sc->name, c->name))
+			continue;
+		c->check = sc->check;
+		c->check_batch = sc->check_batch;
+		c->init = sc->init;
+		c->mp_init = sc->mp_init;
+		c->free = sc->free;
+		c->reset = sc->reset;
+		c->thread = sc->thread;
+		c->msgtable = sc->msgtable;
+		return true;
+	}
+	return false;
+}
+#endif
+
 static struct checker_class *add_checker_class(const char *multipath_dir,
 					       const char *name)
 {
@@ -146,6 +230,12 @@ static struct checker_class *add_checker_class(const char *multipath_dir,
 	snprintf(c->name, CHECKER_NAME_LEN, "%s", name);
 	if (!strncmp(c->name, NONE, 4))
 		goto done;
+#ifdef STATIC_PLUGINS
+	if (find_static_checker(c)) {
+		condlog(3, "using built-in %s checker", name);
+		goto msgtable;
+	}
+#endif
 	snprintf(libname, LIB_CHECKER_NAMELEN, "%s/libcheck%s.so",
 		 multipath_dir, name);
 	if (stat(libname,&stbuf) < 0) {
@@ -178,7 +268,9 @@ static struct checker_class *add_checker_class(const char *multipath_dir,
 	c->mp_init = (int (*)(struct checker *)) dlsym(c->handle, "libcheck_mp_init");
 	c->reset = (void (*)(void)) dlsym(c->handle, "libcheck_reset");
 	c->thread = (void *(*)(void*)) dlsym(c->handle, "libcheck_thread");
-	/* These 3 functions can be NULL. call dlerror() to clear out any
+	c->check_batch = (void (*)(struct checker **, int *, int))
+		dlsym(c->handle, "libcheck_check_batch");
+	/* These 4 functions can be NULL. call dlerror() to clear out any
 	 * error string */
 	dlerror();
 
@@ -192,6 +284,9 @@ static struct checker_class *add_checker_class(const char *multipath_dir,
 	c->msgtable_size = 0;
 	c->msgtable = dlsym(c->handle, "libcheck_msgtable");
 
+#ifdef STATIC_PLUGINS
+msgtable:
+#endif
 	if (c->msgtable != NULL) {
 		const char **p;
 
@@ -297,10 +392,12 @@ void checker_put (struct checker * dst)
 	free_checker_class(src);
 }
 
-int checker_check (struct checker * c, int path_state)
+/*
+ * Handle the cases in which the checker function isn't called.
+ * Returns PATH_MAX_STATE if it needs to be called.
+ */
+static int checker_precheck(struct checker *c, int path_state)
 {
-	int r;
-
 	if (!c)
 		return PATH_WILD;
 
@@ -316,11 +413,84 @@ int checker_check (struct checker * c, int path_state)
 		c->msgid = CHECKER_MSGID_NO_FD;
 		return PATH_WILD;
 	}
+	return PATH_MAX_STATE;
+}
+
+int checker_check (struct checker * c, int path_state)
+{
+	int r;
+
+	r = checker_precheck(c, path_state);
+	if (r != PATH_MAX_STATE)
+		return r;
+	TRACE2(checker_start, c->cls->name, c->fd);
 	r = c->cls->check(c);
+	TRACE3(checker_end, c->cls->name, c->fd, r);
 
 	return r;
 }
 
+bool checker_has_batch(const struct checker *c)
+{
+	return c && c->cls && c->cls->check_batch && !c->cls->sync;
+}
+
+void checker_check_batch(struct checker **checkers, const int *path_states,
+			 int *states, int n)
+{
+	struct checker **batch;
+	int *batch_states, *idx;
+	bool *done;
+	int i, j, nb;
+
+	batch = calloc(n, sizeof(*batch));
+	batch_states = calloc(n, sizeof(*batch_states));
+	idx = calloc(n, sizeof(*idx));
+	done = calloc(n, sizeof(*done));
+	if (!batch || !batch_states || !idx || !done) {
+		for (i = 0; i < n; i++)
+			states[i] = checker_check(checkers[i], path_states[i]);
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		states[i] = checker_precheck(checkers[i], path_states[i]);
+		done[i] = states[i] != PATH_MAX_STATE;
+	}
+
+	/* One call for every checker class */
+	for (i = 0; i < n; i++) {
+		struct checker_class *cls;
+
+		if (done[i])
+			continue;
+		cls = checkers[i]->cls;
+		for (j = i, nb = 0; j < n; j++) {
+			if (done[j] || checkers[j]->cls != cls)
+				continue;
+			done[j] = true;
+			if (!cls->check_batch) {
+				states[j] = cls->check(checkers[j]);
+				continue;
+			}
+			idx[nb] = j;
+			batch[nb++] = checkers[j];
+		}
+		if (nb == 0)
+			continue;
+		TRACE2(checker_batch_start, cls->name, nb);
+		cls->check_batch(batch, batch_states, nb);
+		TRACE2(checker_batch_end, cls->name, nb);
+		for (j = 0; j < nb; j++)
+			states[idx[j]] = batch_states[j];
+	}
+out:
+	free(done);
+	free(idx);
+	free(batch_states);
+	free(batch);
+}
+
 const char *checker_name(const struct checker *c)
 {
 	if (!c || !c->cls)
@@ -342,21 +512,22 @@ static const char *generic_msg[CHECKER_GENERIC_MSGTABLE_SIZE] = {
 	[CHECKER_MSGID_DOWN] = " reports path is down",
 	[CHECKER_MSGID_GHOST] = " reports path is ghost",
 	[CHECKER_MSGID_UNSUPPORTED] = " doesn't support this device",
+	[CHECKER_MSGID_TIMEOUT] = " timed out",
 };
 
-const char *checker_message(const struct checker *c)
+const char *checker_msgid_message(const struct checker *c, short msgid)
 {
 	int id;
 
-	if (!c || !c->cls || c->msgid < 0 ||
-	    (c->msgid >= CHECKER_GENERIC_MSGTABLE_SIZE &&
-	     c->msgid < CHECKER_FIRST_MSGID))
+	if (!c || !c->cls || msgid < 0 ||
+	    (msgid >= CHECKER_GENERIC_MSGTABLE_SIZE &&
+	     msgid < CHECKER_FIRST_MSGID))
 		goto bad_id;
 
-	if (c->msgid < CHECKER_GENERIC_MSGTABLE_SIZE)
-		return generic_msg[c->msgid];
+	if (msgid < CHECKER_GENERIC_MSGTABLE_SIZE)
+		return generic_msg[msgid];
 
-	id = c->msgid - CHECKER_FIRST_MSGID;
+	id = msgid - CHECKER_FIRST_MSGID;
 	if (id < c->cls->msgtable_size)
 		return c->cls->msgtable[id];
 
@@ -364,6 +535,11 @@ bad_id:
 	return generic_msg[CHECKER_MSGID_NONE];
 }
 
+const char *checker_message(const struct checker *c)
+{
+	return checker_msgid_message(c, c ? c->msgid : CHECKER_MSGID_NONE);
+}
+
 static void checker_cleanup_thread(void *arg)
 {
 	struct checker_class *cls = arg;
@@ -401,6 +577,17 @@ int start_checker_thread(pthread_t *thread, const pthread_attr_t *attr,
 	return rv;
 }
 
+struct checker_class *checker_class_get(const struct checker *c)
+{
+	(void)checker_class_ref(c->cls);
+	return c->cls;
+}
+
+void checker_class_put(struct checker_class *cls)
+{
+	free_checker_class(cls);
+}
+
 void checker_clear_message (struct checker *c)
 {
 	if (!c)
@@ -416,16 +603,16 @@ void checker_get(const char *multipath_dir, struct checker *dst,
 	if (!dst)
 		return;
 
+	pthread_mutex_lock(&checkers_lock);
 	if (name && strlen(name)) {
 		src = checker_class_lookup(name);
 		if (!src)
 			src = add_checker_class(multipath_dir, name);
 	}
 	dst->cls = src;
-	if (!src)
-		return;
-
-	(void)checker_class_ref(dst->cls);
+	if (src)
+		(void)checker_class_ref(dst->cls);
+	pthread_mutex_unlock(&checkers_lock);
 }
 
 int init_checkers(const char *multipath_dir)
@@ -439,6 +626,7 @@ int init_checkers(const char *multipath_dir)
 		EMC_CLARIION,
 		READSECTOR0,
 		CCISS_TUR,
+		NVME,
 	};
 	unsigned int i;
 
@@ -2,6 +2,7 @@
 #define _CHECKERS_H
 
 #include <pthread.h>
+#include <stdbool.h>
 #include "list.h"
 #include "memory.h"
 #include "defaults.h"
@@ -52,7 +53,7 @@
  * - Description: Indicates a check IO is in flight.
  *
  * PATH_TIMEOUT:
- * - Use: Only tur checker
+ * - Use: All async checkers
  * - Description: Command timed out
  *
  * PATH REMOVED:
@@ -88,6 +89,7 @@ enum path_check_state {
 #define EMC_CLARIION "emc_clariion"
 #define READSECTOR0  "readsector0"
 #define CCISS_TUR    "cciss_tur"
+#define NVME         "nvme"
 #define NONE         "none"
 #define INVALID      "invalid"
 
@@ -113,6 +115,7 @@ enum {
 	CHECKER_MSGID_DOWN,
 	CHECKER_MSGID_GHOST,
 	CHECKER_MSGID_UNSUPPORTED,
+	CHECKER_MSGID_TIMEOUT,
 	CHECKER_GENERIC_MSGTABLE_SIZE,
 	CHECKER_FIRST_MSGID = 100,	/* lowest msgid for checkers */
 	CHECKER_MSGTABLE_SIZE = 100,	/* max msg table size for checkers */
@@ -171,7 +174,31 @@ struct checker_context {
 };
 int start_checker_thread (pthread_t *thread, const pthread_attr_t *attr,
 			  struct checker_context *ctx);
+/*
+ * Take a reference on the class of a checker, for objects which may
+ * outlive the checker and call into the DSO. Drop it with
+ * checker_class_put().
+ */
+struct checker_class *checker_class_get(const struct checker *c);
+void checker_class_put(struct checker_class *cls);
 int checker_check (struct checker *, int);
+/*
+ * checker_check_batch(): check multiple paths at once
+ * @param checkers: array of n checkers, possibly of different classes
+ * @param path_states: the states returned for the "none" checker
+ * @param states: array of n elements for the results
+ *
+ * Equivalent to calling checker_check() for every checker, but checker
+ * classes which provide libcheck_check_batch() get called only once with
+ * all their checkers, so that they can issue their I/O in parallel.
+ */
+void checker_check_batch(struct checker **checkers, const int *path_states,
+			 int *states, int n);
+/*
+ * True if the class of this checker can check multiple paths at once.
+ * Sync checkers aren't batched, they are better run in parallel threads.
+ */
+bool checker_has_batch(const struct checker *);
 int checker_is_sync(const struct checker *);
 const char *checker_name (const struct checker *);
 void reset_checker_classes(void);
@@ -180,11 +207,18 @@ void reset_checker_classes(void);
  * where $NAME is the return value of checker_name().
  */
 const char *checker_message(const struct checker *);
+/* Like checker_message(), for msgid instead of the current message */
+const char *checker_msgid_message(const struct checker *, short msgid);
 void checker_clear_message (struct checker *c);
 void checker_get(const char *, struct checker *, const char *);
 
 /* Prototypes for symbols exported by path checker dynamic libraries (.so) */
 int libcheck_check(struct checker *);
+/*
+ * Optional. Check n paths, and store the results in states. All checkers
+ * are enabled and use this class, and have a valid fd.
+ */
+void libcheck_check_batch(struct checker **checkers, int *states, int n);
 int libcheck_init(struct checker *);
 void libcheck_free(struct checker *);
 void *libcheck_thread(struct checker_context *ctx);
@@ -13,6 +13,7 @@
 #include <linux/fs.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <libaio.h>
 
 #include "checkers.h"
@@ -21,11 +22,15 @@
 
 #define AIO_GROUP_SIZE 1024
 
-/* Note: This checker type relies on the fact that only one checker can be run
- * at a time, since multiple checkers share the same aio_group, and must be
- * able to modify other checker's async_reqs. If multple checkers become able
- * to be run at the same time, this checker will need to add locking, and
- * probably polling on event fds, to deal with that */
+/*
+ * Multiple checkers share the same aio_group, and modify other checkers'
+ * async_reqs when they reap events. multipathd may run checkers for
+ * different paths in parallel (checker_threads), so the groups and the
+ * request states are protected by aio_lock. It isn't held while waiting
+ * for events. Every thread that calls io_getevents() on a group processes
+ * all events it gets, so completions are reaped in one pass regardless of
+ * the path they belong to.
+ */
 
 struct aio_group {
 	struct list_head node;
@@ -43,6 +48,7 @@ struct async_req {
 };
 
 static LIST_HEAD(aio_grp_list);
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
 
 enum {
 	MSG_DIRECTIO_UNKNOWN = CHECKER_FIRST_MSGID,
@@ -145,8 +151,10 @@ void libcheck_reset (void)
 {
 	struct aio_group *aio_grp, *tmp;
 
+	pthread_mutex_lock(&aio_lock);
 	list_for_each_entry_safe(aio_grp, tmp, &aio_grp_list, node)
 		remove_aio_group(aio_grp);
+	pthread_mutex_unlock(&aio_lock);
 }
 
 int libcheck_init (struct checker * c)
@@ -155,13 +163,17 @@ int libcheck_init (struct checker * c)
 	struct directio_context * ct;
 	struct async_req *req = NULL;
 	long flags;
+	int rc;
 
 	ct = malloc(sizeof(struct directio_context));
 	if (!ct)
 		return 1;
 	memset(ct, 0, sizeof(struct directio_context));
 
-	if (set_aio_group(ct) < 0)
+	pthread_mutex_lock(&aio_lock);
+	rc = set_aio_group(ct);
+	pthread_mutex_unlock(&aio_lock);
+	if (rc < 0)
 		goto out;
 
 	req = malloc(sizeof(struct async_req));
@@ -208,8 +220,11 @@ out:
 			free(req->buf);
 		free(req);
 	}
-	if (ct->aio_grp)
+	if (ct->aio_grp) {
+		pthread_mutex_lock(&aio_lock);
 		ct->aio_grp->holders--;
+		pthread_mutex_unlock(&aio_lock);
+	}
 	free(ct);
 	return 1;
 }
@@ -233,6 +248,7 @@ void libcheck_free (struct checker * c)
 		}
 	}
 
+	pthread_mutex_lock(&aio_lock);
 	if (ct->running &&
 	    (ct->req->state != PATH_PENDING ||
 	     io_cancel(ct->aio_grp->ioctx, &ct->req->io, &event) == 0))
@@ -246,11 +262,13 @@ void libcheck_free (struct checker * c)
 		list_add(&ct->req->node, &ct->aio_grp->orphans);
 		check_orphaned_group(ct->aio_grp);
 	}
+	pthread_mutex_unlock(&aio_lock);
 
 	free(ct);
 	c->context = NULL;
 }
 
+/* Called without aio_lock held */
 static int
 get_events(struct aio_group *aio_grp, struct timespec *timeout)
 {
@@ -264,6 +282,7 @@ get_events(struct aio_group *aio_grp, struct timespec *timeout)
 		nr = io_getevents(aio_grp->ioctx, 1, 128, events, timep);
 		got_events |= (nr > 0);
 
+		pthread_mutex_lock(&aio_lock);
 		for (i = 0; i < nr; i++) {
 			struct async_req *req = container_of(events[i].obj, struct async_req, io);
 
@@ -280,6 +299,7 @@ get_events(struct aio_group *aio_grp, struct timespec *timeout)
 				req->state = (events[i].res == req->blksize) ?
 					      PATH_UP : PATH_DOWN;
 		}
+		pthread_mutex_unlock(&aio_lock);
 		timep = &zero_timeout;
 	} while (nr == 128); /* assume there are more events and try again */
 
@@ -290,6 +310,56 @@ get_events(struct aio_group *aio_grp, struct timespec *timeout)
 	return got_events;
 }
 
+static int get_req_state(const struct async_req *req)
+{
+	int state;
+
+	pthread_mutex_lock(&aio_lock);
+	state = req->state;
+	pthread_mutex_unlock(&aio_lock);
+	return state;
+}
+
+/* Set up a new read request, it must be submitted by the caller */
+static void prep_req(int fd, struct directio_context *ct)
+{
+	LOG(3, "starting new request");
+	memset(&ct->req->io, 0, sizeof(struct iocb));
+	io_prep_pread(&ct->req->io, fd, ct->req->buf,
+		      ct->req->blksize, 0);
+	pthread_mutex_lock(&aio_lock);
+	ct->req->state = PATH_PENDING;
+	pthread_mutex_unlock(&aio_lock);
+}
+
+/* The request is still pending after waiting for it */
+static int pending_state(struct directio_context *ct, int sync,
+			 int timeout_secs)
+{
+	int rc;
+	long r;
+
+	if (ct->running > timeout_secs || sync) {
+		struct io_event event;
+
+		LOG(3, "abort check on timeout");
+
+		r = io_cancel(ct->aio_grp->ioctx, &ct->req->io, &event);
+		/*
+		 * Only reset ct->running if we really
+		 * could abort the pending I/O
+		 */
+		if (!r)
+			ct->running = 0;
+		rc = PATH_DOWN;
+	} else {
+		LOG(3, "async io pending");
+		rc = PATH_PENDING;
+	}
+
+	return rc;
+}
+
 static int
 check_state(int fd, struct directio_context *ct, int sync, int timeout_secs)
 {
@@ -309,18 +379,14 @@ check_state(int fd, struct directio_context *ct, int sync, int timeout_secs)
 	}
 
 	if (ct->running) {
-		if (ct->req->state != PATH_PENDING) {
+		if ((rc = get_req_state(ct->req)) != PATH_PENDING) {
 			ct->running = 0;
-			return ct->req->state;
+			return rc;
 		}
 	} else {
 		struct iocb *ios[1] = { &ct->req->io };
 
-		LOG(3, "starting new request");
-		memset(&ct->req->io, 0, sizeof(struct iocb));
-		io_prep_pread(&ct->req->io, fd, ct->req->buf,
-			      ct->req->blksize, 0);
-		ct->req->state = PATH_PENDING;
+		prep_req(fd, ct);
 		if (io_submit(ct->aio_grp->ioctx, 1, ios) != 1) {
 			LOG(3, "io_submit error %i", errno);
 			return PATH_UNCHECKED;
@@ -335,9 +401,9 @@ check_state(int fd, struct directio_context *ct, int sync, int timeout_secs)
 	while(1) {
 		r = get_events(ct->aio_grp, &timeout);
 
-		if (ct->req->state != PATH_PENDING) {
+		if ((rc = get_req_state(ct->req)) != PATH_PENDING) {
 			ct->running = 0;
-			return ct->req->state;
+			return rc;
 		} else if (r == 0 ||
 			   (timeout.tv_sec == 0 && timeout.tv_nsec == 0))
 			break;
@@ -347,37 +413,11 @@ check_state(int fd, struct directio_context *ct, int sync, int timeout_secs)
 		if (timeout.tv_sec < 0)
 			timeout.tv_sec = timeout.tv_nsec = 0;
 	}
-	if (ct->running > timeout_secs || sync) {
-		struct io_event event;
-
-		LOG(3, "abort check on timeout");
-
-		r = io_cancel(ct->aio_grp->ioctx, &ct->req->io, &event);
-		/*
-		 * Only reset ct->running if we really
-		 * could abort the pending I/O
-		 */
-		if (!r)
-			ct->running = 0;
-		rc = PATH_DOWN;
-	} else {
-		LOG(3, "async io pending");
-		rc = PATH_PENDING;
-	}
-
-	return rc;
+	return pending_state(ct, sync, timeout_secs);
 }
 
-int libcheck_check (struct checker * c)
+static void set_msgid(struct checker *c, int ret)
 {
-	int ret;
-	struct directio_context * ct = (struct directio_context *)c->context;
-
-	if (!ct)
-		return PATH_UNCHECKED;
-
-	ret = check_state(c->fd, ct, checker_is_sync(c), c->timeout);
-
 	switch (ret)
 	{
 	case PATH_UNCHECKED:
@@ -395,5 +435,125 @@ int libcheck_check (struct checker * c)
 	default:
 		break;
 	}
+}
+
+int libcheck_check (struct checker * c)
+{
+	int ret;
+	struct directio_context * ct = (struct directio_context *)c->context;
+
+	if (!ct)
+		return PATH_UNCHECKED;
+
+	ret = check_state(c->fd, ct, checker_is_sync(c), c->timeout);
+	set_msgid(c, ret);
 	return ret;
 }
+
+/* Submit the new requests in ct[] which use the same aio group as ct[i] */
+static void submit_group(struct directio_context **ct, int *states,
+			 struct iocb **ios, int *idx, int i, int n)
+{
+	struct aio_group *aio_grp = ct[i]->aio_grp;
+	int j, nr = 0;
+	long r;
+
+	for (j = i; j < n; j++) {
+		if (states[j] != PATH_MAX_STATE || ct[j]->running ||
+		    ct[j]->aio_grp != aio_grp)
+			continue;
+		idx[nr] = j;
+		ios[nr++] = &ct[j]->req->io;
+	}
+	r = io_submit(aio_grp->ioctx, nr, ios);
+	if (r != nr)
+		LOG(3, "io_submit error %i, %ld of %d requests submitted",
+		    errno, r < 0 ? 0 : r, nr);
+	for (j = 0; j < nr; j++) {
+		if (j < r)
+			ct[idx[j]]->running++;
+		else
+			states[idx[j]] = PATH_UNCHECKED;
+	}
+}
+
+/*
+ * Submit the requests of all checkers with one io_submit() call per aio
+ * group, and then reap the events of every group once. In sync mode, the
+ * checkers are run one by one.
+ */
+void libcheck_check_batch(struct checker **checkers, int *states, int n)
+{
+	struct timespec timeout = { .tv_nsec = 1000 };
+	struct directio_context **ct;
+	struct aio_group **grps;
+	struct iocb **ios;
+	int *idx;
+	int i, j, ngrps = 0;
+
+	ct = calloc(n, sizeof(*ct));
+	grps = calloc(n, sizeof(*grps));
+	ios = calloc(n, sizeof(*ios));
+	idx = calloc(n, sizeof(*idx));
+	if (!ct || !grps || !ios || !idx || checker_is_sync(checkers[0])) {
+		for (i = 0; i < n; i++)
+			states[i] = libcheck_check(checkers[i]);
+		goto out;
+	}
+
+	/* PATH_MAX_STATE marks the checkers that need to wait for events */
+	for (i = 0; i < n; i++) {
+		ct[i] = checkers[i]->context;
+		if (!ct[i]) {
+			states[i] = PATH_UNCHECKED;
+			continue;
+		}
+		if (!ct[i]->running) {
+			prep_req(checkers[i]->fd, ct[i]);
+			states[i] = PATH_MAX_STATE;
+			continue;
+		}
+		states[i] = get_req_state(ct[i]->req);
+		if (states[i] != PATH_PENDING) {
+			ct[i]->running = 0;
+			continue;
+		}
+		ct[i]->running++;
+		states[i] = PATH_MAX_STATE;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (states[i] != PATH_MAX_STATE || ct[i]->running)
+			continue;
+		submit_group(ct, states, ios, idx, i, n);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (states[i] != PATH_MAX_STATE)
+			continue;
+		for (j = 0; j < ngrps; j++)
+			if (grps[j] == ct[i]->aio_grp)
+				break;
+		if (j < ngrps)
+			continue;
+		grps[ngrps++] = ct[i]->aio_grp;
+		get_events(ct[i]->aio_grp, &timeout);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (states[i] == PATH_MAX_STATE) {
+			if ((states[i] = get_req_state(ct[i]->req))
+			    != PATH_PENDING)
+				ct[i]->running = 0;
+			else
+				states[i] = pending_state(ct[i], 0,
+							  checkers[i]->timeout);
+		}
+		set_msgid(checkers[i], states[i]);
+	}
+out:
+	free(idx);
+	free(ios);
+	free(grps);
+	free(ct);
+}
@@ -14,6 +14,7 @@
 #include "../libmultipath/sg_include.h"
 #include "libsg.h"
 #include "checkers.h"
+#include "async_check.h"
 #include "debug.h"
 #include "memory.h"
 
@@ -33,18 +34,19 @@
  * simple read test would return 02/04/03 instead
  * of 05/25/01 sensekey/ASC/ASCQ data.
  */
-#define	IS_INACTIVE_SNAP(c)   (c->mpcontext ?				   \
-			       ((struct emc_clariion_checker_LU_context *) \
-					(*c->mpcontext))->inactive_snap	   \
-					    : 0)
+#define LU_CONTEXT(c) (c->mpcontext && *c->mpcontext ?			\
+		       (struct emc_clariion_checker_LU_context *)	\
+		       (*c->mpcontext) : NULL)
 
-#define	SET_INACTIVE_SNAP(c)  if (c->mpcontext)				   \
-				((struct emc_clariion_checker_LU_context *)\
-					(*c->mpcontext))->inactive_snap = 1
-
-#define	CLR_INACTIVE_SNAP(c)  if (c->mpcontext)				   \
-				((struct emc_clariion_checker_LU_context *)\
-					(*c->mpcontext))->inactive_snap = 0
+/*
+ * The check runs on a copy of the LU state, see emc_clariion_check_arg.
+ * inactive_snap is -1 there if there's no multipath context.
+ */
+#define	IS_INACTIVE_SNAP(a)   ((a)->inactive_snap > 0)
+#define	SET_INACTIVE_SNAP(a)  if ((a)->inactive_snap >= 0)		   \
+				(a)->inactive_snap = 1
+#define	CLR_INACTIVE_SNAP(a)  if ((a)->inactive_snap >= 0)		   \
+				(a)->inactive_snap = 0
 
 enum {
 	MSG_CLARIION_QUERY_FAILED = CHECKER_FIRST_MSGID,
@@ -84,7 +86,20 @@ struct emc_clariion_checker_LU_context {
 	int inactive_snap;
 };
 
-void hexadecimal_to_ascii(char * wwn, char *wwnstr)
+struct emc_clariion_checker_context {
+	struct async_check ac;
+	struct emc_clariion_checker_path_context path;
+};
+
+/* Private copy of the checker state for a single check */
+struct emc_clariion_check_arg {
+	struct emc_clariion_checker_path_context path;
+	int inactive_snap;
+	/* value of inactive_snap when the check was started */
+	int old_inactive_snap;
+};
+
+static void hexadecimal_to_ascii(char * wwn, char *wwnstr)
 {
 	int i,j, nbl;
 
@@ -102,12 +117,7 @@ int libcheck_init (struct checker * c)
 	/*
 	 * Allocate and initialize the path specific context.
 	 */
-	c->context = MALLOC(sizeof(struct emc_clariion_checker_path_context));
-	if (!c->context)
-		return 1;
-	((struct emc_clariion_checker_path_context *)c->context)->wwn_set = 0;
-
-	return 0;
+	return async_check_init(c, sizeof(struct emc_clariion_checker_context));
 }
 
 int libcheck_mp_init (struct checker * c)
@@ -120,7 +130,7 @@ int libcheck_mp_init (struct checker * c)
 		if (!mpctxt)
 			return 1;
 		*c->mpcontext = mpctxt;
-		CLR_INACTIVE_SNAP(c);
+		LU_CONTEXT(c)->inactive_snap = 0;
 	}
 
 	return 0;
@@ -128,18 +138,19 @@ int libcheck_mp_init (struct checker * c)
 
 void libcheck_free (struct checker * c)
 {
-	free(c->context);
+	async_check_free(c);
 }
 
-int libcheck_check (struct checker * c)
+static int emc_clariion_check(int fd, unsigned int timeout, void *arg,
+			      short *msgid)
 {
 	unsigned char sense_buffer[128] = { 0, };
 	unsigned char sb[SENSE_BUFF_LEN] = { 0, }, *sbb;
 	unsigned char inqCmdBlk[INQUIRY_CMDLEN] = {INQUIRY_CMD, 1, 0xC0, 0,
 						sizeof(sense_buffer), 0};
 	struct sg_io_hdr io_hdr;
-	struct emc_clariion_checker_path_context * ct =
-		(struct emc_clariion_checker_path_context *)c->context;
+	struct emc_clariion_check_arg *a = arg;
+	struct emc_clariion_checker_path_context *ct = &a->path;
 	char wwnstr[33];
 	int ret;
 	int retry_emc = 5;
@@ -156,14 +167,14 @@ retry:
 	io_hdr.dxferp = sense_buffer;
 	io_hdr.cmdp = inqCmdBlk;
 	io_hdr.sbp = sb;
-	io_hdr.timeout = c->timeout * 1000;
+	io_hdr.timeout = timeout * 1000;
 	io_hdr.pack_id = 0;
-	if (ioctl(c->fd, SG_IO, &io_hdr) < 0) {
+	if (ioctl(fd, SG_IO, &io_hdr) < 0) {
 		if (errno == ENOTTY) {
-			c->msgid = CHECKER_MSGID_UNSUPPORTED;
+			*msgid = CHECKER_MSGID_UNSUPPORTED;
 			return PATH_WILD;
 		}
-		c->msgid = MSG_CLARIION_QUERY_FAILED;
+		*msgid = MSG_CLARIION_QUERY_FAILED;
 		return PATH_DOWN;
 	}
 
@@ -195,12 +206,12 @@ retry:
 				sense_key = sbp[2] & 0xf;
 
 			if (sense_key == ILLEGAL_REQUEST) {
-				c->msgid = CHECKER_MSGID_UNSUPPORTED;
+				*msgid = CHECKER_MSGID_UNSUPPORTED;
 				return PATH_WILD;
 			} else if (sense_key != RECOVERED_ERROR) {
 				condlog(1, "emc_clariion_checker: INQUIRY failed with sense key %02x",
 					sense_key);
-				c->msgid = MSG_CLARIION_QUERY_ERROR;
+				*msgid = MSG_CLARIION_QUERY_ERROR;
 				return PATH_DOWN;
 			}
 		}
@@ -209,13 +220,13 @@ retry:
 	if (io_hdr.info & SG_INFO_OK_MASK) {
 		condlog(1, "emc_clariion_checker: INQUIRY failed without sense, status %02x",
 			io_hdr.status);
-		c->msgid = MSG_CLARIION_QUERY_ERROR;
+		*msgid = MSG_CLARIION_QUERY_ERROR;
 		return PATH_DOWN;
 	}
 
 	if (/* Verify the code page - right page & revision */
 	    sense_buffer[1] != 0xc0 || sense_buffer[9] != 0x00) {
-		c->msgid = MSG_CLARIION_UNIT_REPORT;
+		*msgid = MSG_CLARIION_UNIT_REPORT;
 		return PATH_DOWN;
 	}
 
@@ -229,19 +240,19 @@ retry:
 		    ((sense_buffer[28] & 0x07) != 0x06))
 		/* Arraycommpath should be set to 1 */
 		|| (sense_buffer[30] & 0x04) != 0x04) {
-		c->msgid = MSG_CLARIION_PATH_CONFIG;
+		*msgid = MSG_CLARIION_PATH_CONFIG;
 		return PATH_DOWN;
 	}
 
 	if ( /* LUN operations should indicate normal operations */
 		sense_buffer[48] != 0x00) {
-		c->msgid = MSG_CLARIION_PATH_NOT_AVAIL;
+		*msgid = MSG_CLARIION_PATH_NOT_AVAIL;
 		return PATH_SHAKY;
 	}
 
 	if ( /* LUN should at least be bound somewhere and not be LUNZ */
 		sense_buffer[4] == 0x00) {
-		c->msgid = MSG_CLARIION_LUN_UNBOUND;
+		*msgid = MSG_CLARIION_LUN_UNBOUND;
 		return PATH_DOWN;
 	}
 
@@ -252,7 +263,7 @@ retry:
 	 */
 	if (ct->wwn_set) {
 		if (memcmp(ct->wwn, &sense_buffer[10], 16) != 0) {
-			c->msgid = MSG_CLARIION_WWN_CHANGED;
+			*msgid = MSG_CLARIION_WWN_CHANGED;
 			return PATH_DOWN;
 		}
 	} else {
@@ -267,8 +278,8 @@ retry:
 		unsigned char buf[4096];
 
 		memset(buf, 0, 4096);
-		ret = sg_read(c->fd, &buf[0], 4096,
-			      sbb = &sb[0], SENSE_BUFF_LEN, c->timeout);
+		ret = sg_read(fd, &buf[0], 4096,
+			      sbb = &sb[0], SENSE_BUFF_LEN, timeout);
 		if (ret == PATH_DOWN) {
 			hexadecimal_to_ascii(ct->wwn, wwnstr);
 
@@ -283,7 +294,7 @@ retry:
 				 * passive paths which will return
 				 * 02/04/03 not 05/25/01 on read.
 				 */
-				SET_INACTIVE_SNAP(c);
+				SET_INACTIVE_SNAP(a);
 				condlog(3, "emc_clariion_checker: Active "
 					"path to inactive snapshot WWN %s.",
 					wwnstr);
@@ -292,29 +303,72 @@ retry:
 					"error for WWN %s.  Sense data are "
 					"0x%x/0x%x/0x%x.", wwnstr,
 					sbb[2]&0xf, sbb[12], sbb[13]);
-				c->msgid = MSG_CLARIION_READ_ERROR;
+				*msgid = MSG_CLARIION_READ_ERROR;
 			}
 		} else {
-			c->msgid = MSG_CLARIION_PASSIVE_GOOD;
+			*msgid = MSG_CLARIION_PASSIVE_GOOD;
 			/*
 			 * Remove the path from the set of paths to inactive
 			 * snapshot LUs if it was in this list since the
 			 * snapshot is no longer inactive.
 			 */
-			CLR_INACTIVE_SNAP(c);
+			CLR_INACTIVE_SNAP(a);
 		}
 	} else {
-		if (IS_INACTIVE_SNAP(c)) {
+		if (IS_INACTIVE_SNAP(a)) {
 			hexadecimal_to_ascii(ct->wwn, wwnstr);
 			condlog(3, "emc_clariion_checker: Passive "
 				"path to inactive snapshot WWN %s.",
 				wwnstr);
 			ret = PATH_DOWN;
 		} else {
-			c->msgid = MSG_CLARIION_PASSIVE_GOOD;
+			*msgid = MSG_CLARIION_PASSIVE_GOOD;
 			ret = PATH_UP;	/* not ghost */
 		}
 	}
 
 	return ret;
 }
+
+static void emc_clariion_prepare(struct checker *c, void *arg)
+{
+	const struct emc_clariion_checker_context *ct = c->context;
+	const struct emc_clariion_checker_LU_context *lu = LU_CONTEXT(c);
+	struct emc_clariion_check_arg *a = arg;
+
+	a->path = ct->path;
+	a->inactive_snap = lu ? lu->inactive_snap : -1;
+	a->old_inactive_snap = a->inactive_snap;
+}
+
+/*
+ * The LU context is shared with the other paths of the map, so only
+ * store inactive_snap if this check changed it.
+ */
+static void emc_clariion_done(struct checker *c, const void *arg)
+{
+	struct emc_clariion_checker_context *ct = c->context;
+	struct emc_clariion_checker_LU_context *lu = LU_CONTEXT(c);
+	const struct emc_clariion_check_arg *a = arg;
+
+	ct->path = a->path;
+	if (lu && a->inactive_snap != a->old_inactive_snap)
+		lu->inactive_snap = a->inactive_snap;
+}
+
+static const struct async_check_ops emc_clariion_ops = {
+	.check = emc_clariion_check,
+	.prepare = emc_clariion_prepare,
+	.done = emc_clariion_done,
+	.arg_size = sizeof(struct emc_clariion_check_arg),
+};
+
+int libcheck_check (struct checker * c)
+{
+	return async_check(c, &emc_clariion_ops);
+}
+
+void libcheck_check_batch(struct checker **checkers, int *states, int n)
+{
+	async_check_batch(checkers, states, n, &emc_clariion_ops);
+}
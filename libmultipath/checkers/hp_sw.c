@@ -13,6 +13,7 @@
 
 #include "checkers.h"
 
+#include "../libmultipath/async_check.h"
 #include "../libmultipath/sg_include.h"
 #include "../libmultipath/unaligned.h"
 
@@ -28,20 +29,6 @@
 #define MX_ALLOC_LEN		255
 #define HEAVY_CHECK_COUNT       10
 
-struct sw_checker_context {
-	void * dummy;
-};
-
-int libcheck_init (__attribute__((unused)) struct checker * c)
-{
-	return 0;
-}
-
-void libcheck_free (__attribute__((unused)) struct checker * c)
-{
-	return;
-}
-
 static int
 do_inq(int sg_fd, int cmddt, int evpd, unsigned int pg_op,
        void *resp, int mx_resp_len, unsigned int timeout)
@@ -127,24 +114,49 @@ do_tur (int fd, unsigned int timeout)
 	return 0;
 }
 
-int libcheck_check(struct checker * c)
+static int hp_sw_check(int fd, unsigned int timeout,
+		       void *arg __attribute__((unused)), short *msgid)
 {
 	char buff[MX_ALLOC_LEN];
-	int ret = do_inq(c->fd, 0, 1, 0x80, buff, MX_ALLOC_LEN, c->timeout);
+	int ret = do_inq(fd, 0, 1, 0x80, buff, MX_ALLOC_LEN, timeout);
 
 	if (ret == PATH_WILD) {
-		c->msgid = CHECKER_MSGID_UNSUPPORTED;
+		*msgid = CHECKER_MSGID_UNSUPPORTED;
 		return ret;
 	}
 	if (ret != PATH_UP) {
-		c->msgid = CHECKER_MSGID_DOWN;
+		*msgid = CHECKER_MSGID_DOWN;
 		return ret;
 	};
 
-	if (do_tur(c->fd, c->timeout)) {
-		c->msgid = CHECKER_MSGID_GHOST;
+	if (do_tur(fd, timeout)) {
+		*msgid = CHECKER_MSGID_GHOST;
 		return PATH_GHOST;
 	}
-	c->msgid = CHECKER_MSGID_UP;
+	*msgid = CHECKER_MSGID_UP;
 	return PATH_UP;
 }
+
+static const struct async_check_ops hp_sw_ops = {
+	.check = hp_sw_check,
+};
+
+int libcheck_init (struct checker * c)
+{
+	return async_check_init(c, sizeof(struct async_check));
+}
+
+void libcheck_free (struct checker * c)
+{
+	async_check_free(c);
+}
+
+int libcheck_check (struct checker * c)
+{
+	return async_check(c, &hp_sw_ops);
+}
+
+void libcheck_check_batch(struct checker **checkers, int *states, int n)
+{
+	async_check_batch(checkers, states, n, &hp_sw_ops);
+}
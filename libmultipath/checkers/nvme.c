@@ -0,0 +1,149 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Path checker for NVMe namespaces that are managed by dm-multipath
+ * (nvme_core.multipath=N).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "checkers.h"
+#include "nvme-lib.h"
+
+#include "../libmultipath/debug.h"
+#include "../libmultipath/util.h"
+
+enum {
+	MSG_NVME_FAILED = CHECKER_FIRST_MSGID,
+	MSG_NVME_STATUS,
+};
+
+#define _IDX(x) (MSG_NVME_##x - CHECKER_FIRST_MSGID)
+const char *libcheck_msgtable[] = {
+	[_IDX(FAILED)] = " failed to send admin command",
+	[_IDX(STATUS)] = " got an error status from the controller",
+	NULL,
+};
+
+#define LOG(prio, fmt, args...) condlog(prio, "nvme checker: " fmt, ##args)
+
+struct nvme_checker_context {
+	/* sysfs name of the controller, e.g. "nvme0", or "" if unknown */
+	char ctrl[32];
+};
+
+/*
+ * The "device" link of an NVMe namespace points to its controller.
+ */
+static void get_ctrl_name(int fd, char *name, size_t len)
+{
+	char path[PATH_MAX], link[PATH_MAX];
+	struct stat st;
+	ssize_t n;
+	char *p;
+
+	*name = '\0';
+	if (fstat(fd, &st) != 0 || !S_ISBLK(st.st_mode))
+		return;
+	if (safe_sprintf(path, "/sys/dev/block/%u:%u/device",
+			 major(st.st_rdev), minor(st.st_rdev)))
+		return;
+	n = readlink(path, link, sizeof(link) - 1);
+	if (n <= 0)
+		return;
+	link[n] = '\0';
+	p = strrchr(link, '/');
+	strlcpy(name, p ? p + 1 : link, len);
+}
+
+int libcheck_init(struct checker *c)
+{
+	struct nvme_checker_context *ct;
+
+	ct = calloc(1, sizeof(*ct));
+	if (!ct)
+		return 1;
+	get_ctrl_name(c->fd, ct->ctrl, sizeof(ct->ctrl));
+	c->context = ct;
+	return 0;
+}
+
+void libcheck_free(struct checker *c)
+{
+	free(c->context);
+	c->context = NULL;
+}
+
+int libcheck_check(struct checker *c)
+{
+	int rc;
+
+	rc = libmp_nvme_ping(c->fd, c->timeout * 1000);
+	if (rc == 0) {
+		c->msgid = CHECKER_MSGID_UP;
+		return PATH_UP;
+	} else if (rc > 0) {
+		LOG(3, "fd %d: NVMe status 0x%x", c->fd, rc);
+		c->msgid = MSG_NVME_STATUS;
+		return PATH_DOWN;
+	}
+	if (errno == ENOTTY || errno == EINVAL) {
+		c->msgid = CHECKER_MSGID_UNSUPPORTED;
+		return PATH_WILD;
+	}
+	LOG(3, "fd %d: %s", c->fd, strerror(errno));
+	c->msgid = MSG_NVME_FAILED;
+	return PATH_DOWN;
+}
+
+static const char *ctrl_of(const struct checker *c)
+{
+	const struct nvme_checker_context *ct = c->context;
+
+	return ct && *ct->ctrl ? ct->ctrl : NULL;
+}
+
+/*
+ * The admin command tests the controller, so all namespaces attached
+ * to the same controller share the result of a single command.
+ */
+void libcheck_check_batch(struct checker **checkers, int *states, int n)
+{
+	bool *done;
+	int i, j;
+
+	done = calloc(n, sizeof(*done));
+	if (!done) {
+		for (i = 0; i < n; i++)
+			states[i] = libcheck_check(checkers[i]);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		const char *ctrl;
+
+		if (done[i])
+			continue;
+		states[i] = libcheck_check(checkers[i]);
+		done[i] = true;
+		ctrl = ctrl_of(checkers[i]);
+		if (!ctrl || states[i] == PATH_WILD)
+			continue;
+		for (j = i + 1; j < n; j++) {
+			const char *other = ctrl_of(checkers[j]);
+
+			if (done[j] || !other || strcmp(ctrl, other))
+				continue;
+			states[j] = states[i];
+			checkers[j]->msgid = checkers[i]->msgid;
+			done[j] = true;
+		}
+	}
+	free(done);
+}
@@ -13,6 +13,7 @@
 
 #include "checkers.h"
 #include "debug.h"
+#include "async_check.h"
 
 #include "../libmultipath/sg_include.h"
 
@@ -55,10 +56,6 @@ struct control_mode_page {
 	unsigned char dontcare1[6];
 };
 
-struct rdac_checker_context {
-	void * dummy;
-};
-
 int libcheck_init (struct checker * c)
 {
 	unsigned char cmd[MODE_SEN_SEL_CMDLEN];
@@ -130,12 +127,12 @@ int libcheck_init (struct checker * c)
 out:
 	if (set == 0)
 		condlog(3, "rdac checker failed to set TAS bit");
-	return 0;
+	return async_check_init(c, sizeof(struct async_check));
 }
 
-void libcheck_free(__attribute__((unused)) struct checker *c)
+void libcheck_free(struct checker *c)
 {
-	return;
+	async_check_free(c);
 }
 
 static int
@@ -288,15 +285,16 @@ checker_msg_string(const struct volume_access_inq *inq)
 	}
 }
 
-int libcheck_check(struct checker * c)
+static int rdac_check(int fd, unsigned int timeout,
+		      void *arg __attribute__((unused)), short *msgid)
 {
 	struct volume_access_inq inq;
 	int ret, inqfail;
 
 	inqfail = 0;
 	memset(&inq, 0, sizeof(struct volume_access_inq));
-	ret = do_inq(c->fd, 0xC9, &inq, sizeof(struct volume_access_inq),
-		     c->timeout);
+	ret = do_inq(fd, 0xC9, &inq, sizeof(struct volume_access_inq),
+		     timeout);
 	if (ret != PATH_UP) {
 		inqfail = 1;
 		goto done;
@@ -340,19 +338,33 @@ int libcheck_check(struct checker * c)
 done:
 	switch (ret) {
 	case PATH_WILD:
-		c->msgid = CHECKER_MSGID_UNSUPPORTED;
+		*msgid = CHECKER_MSGID_UNSUPPORTED;
 		break;
 	case PATH_DOWN:
-		c->msgid = (inqfail ? RDAC_MSGID_INQUIRY_FAILED :
+		*msgid = (inqfail ? RDAC_MSGID_INQUIRY_FAILED :
 			    checker_msg_string(&inq));
 		break;
 	case PATH_UP:
-		c->msgid = CHECKER_MSGID_UP;
+		*msgid = CHECKER_MSGID_UP;
 		break;
 	case PATH_GHOST:
-		c->msgid = CHECKER_MSGID_GHOST;
+		*msgid = CHECKER_MSGID_GHOST;
 		break;
 	}
 
 	return ret;
 }
+
+static const struct async_check_ops rdac_ops = {
+	.check = rdac_check,
+};
+
+int libcheck_check(struct checker * c)
+{
+	return async_check(c, &rdac_ops);
+}
+
+void libcheck_check_batch(struct checker **checkers, int *states, int n)
+{
+	async_check_batch(checkers, states, n, &rdac_ops);
+}
@@ -4,41 +4,53 @@
 #include <stdio.h>
 
 #include "checkers.h"
+#include "async_check.h"
 #include "libsg.h"
 
-struct readsector0_checker_context {
-	void * dummy;
-};
-
-int libcheck_init (__attribute__((unused)) struct checker * c)
-{
-	return 0;
-}
-
-void libcheck_free (__attribute__((unused)) struct checker * c)
-{
-	return;
-}
-
-int libcheck_check (struct checker * c)
+static int readsector0_check(int fd, unsigned int timeout,
+			     void *arg __attribute__((unused)), short *msgid)
 {
 	unsigned char buf[4096];
 	unsigned char sbuf[SENSE_BUFF_LEN];
 	int ret;
 
-	ret = sg_read(c->fd, &buf[0], 4096, &sbuf[0],
-		      SENSE_BUFF_LEN, c->timeout);
+	ret = sg_read(fd, &buf[0], 4096, &sbuf[0],
+		      SENSE_BUFF_LEN, timeout);
 
 	switch (ret)
 	{
 	case PATH_DOWN:
-		c->msgid = CHECKER_MSGID_DOWN;
+		*msgid = CHECKER_MSGID_DOWN;
 		break;
 	case PATH_UP:
-		c->msgid = CHECKER_MSGID_UP;
+		*msgid = CHECKER_MSGID_UP;
 		break;
 	default:
 		break;
 	}
 	return ret;
 }
+
+static const struct async_check_ops readsector0_ops = {
+	.check = readsector0_check,
+};
+
+int libcheck_init (struct checker * c)
+{
+	return async_check_init(c, sizeof(struct async_check));
+}
+
+void libcheck_free (struct checker * c)
+{
+	async_check_free(c);
+}
+
+int libcheck_check (struct checker * c)
+{
+	return async_check(c, &readsector0_ops);
+}
+
+void libcheck_check_batch(struct checker **checkers, int *states, int n)
+{
+	async_check_batch(checkers, states, n, &readsector0_ops);
+}
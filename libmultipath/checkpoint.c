@@ -0,0 +1,213 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libudev.h>
+#include <urcu/uatomic.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "checkers.h"
+#include "prio.h"
+#include "debug.h"
+#include "file.h"
+#include "util.h"
+#include "strbuf.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_TMP_FILE CHECKPOINT_FILE ".new"
+#define CHECKPOINT_VERSION 1
+#define DISKSEQ_SIZE 24
+
+struct checkpoint_ent {
+	char dev_t[BLK_DEV_SIZE];
+	char diskseq[DISKSEQ_SIZE];
+	int state;
+	int priority;
+	char wwid[WWID_SIZE];
+};
+
+/* Sorted by dev_t */
+static struct checkpoint_ent *entries;
+static int n_entries;
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Without "diskseq" support in the kernel, it's "-" */
+static void get_diskseq(const struct path *pp, char *buf, size_t len)
+{
+	const char *seq = NULL;
+
+	if (pp->udev)
+		seq = udev_device_get_sysattr_value(pp->udev, "diskseq");
+	strlcpy(buf, seq && *seq ? seq : "-", len);
+}
+
+/* Only states that a check is likely to confirm */
+static bool state_restorable(int state)
+{
+	return state == PATH_UP || state == PATH_GHOST ||
+		state == PATH_DOWN;
+}
+
+int save_checkpoint(const struct _vector *pathvec)
+{
+	STRBUF_ON_STACK(buf);
+	char diskseq[DISKSEQ_SIZE];
+	const struct path *pp;
+	FILE *f;
+	int i, n = 0;
+
+	if (print_strbuf(&buf, "# multipathd checkpoint %d %lld\n",
+			 CHECKPOINT_VERSION, (long long)time(NULL)) < 0)
+		return -1;
+	vector_foreach_slot(pathvec, pp, i) {
+		if (pp->initialized != INIT_OK || !*pp->wwid ||
+		    !state_restorable(pp->state) || strchr(pp->wwid, '\n'))
+			continue;
+		get_diskseq(pp, diskseq, sizeof(diskseq));
+		if (print_strbuf(&buf, "%s %s %d %d %s\n", pp->dev_t, diskseq,
+				 pp->state, pp->priority, pp->wwid) < 0)
+			return -1;
+		n++;
+	}
+
+	if (ensure_directories_exist(CHECKPOINT_FILE, 0700) != 0)
+		return -1;
+	f = fopen(CHECKPOINT_TMP_FILE, "we");
+	if (!f) {
+		condlog(2, "failed to create %s: %m", CHECKPOINT_TMP_FILE);
+		return -1;
+	}
+	if (fputs(get_strbuf_str(&buf), f) == EOF || fclose(f) != 0 ||
+	    rename(CHECKPOINT_TMP_FILE, CHECKPOINT_FILE) != 0) {
+		condlog(2, "failed to write %s: %m", CHECKPOINT_FILE);
+		unlink(CHECKPOINT_TMP_FILE);
+		return -1;
+	}
+	condlog(4, "saved checkpoint of %d paths", n);
+	return 0;
+}
+
+static int ent_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct checkpoint_ent *)a)->dev_t,
+		      ((const struct checkpoint_ent *)b)->dev_t);
+}
+
+static int parse_entry(char *line, struct checkpoint_ent *ent)
+{
+	int pos = 0;
+
+	if (sscanf(line, "%32s %23s %d %d %n", ent->dev_t, ent->diskseq,
+		   &ent->state, &ent->priority, &pos) != 4 || !pos)
+		return -1;
+	line[strcspn(line, "\n")] = '\0';
+	if (!line[pos] ||
+	    strlcpy(ent->wwid, line + pos, sizeof(ent->wwid)) >=
+	    sizeof(ent->wwid))
+		return -1;
+	return state_restorable(ent->state) ? 0 : -1;
+}
+
+int load_checkpoint(void)
+{
+	char line[WWID_SIZE + 128];
+	struct checkpoint_ent *ents = NULL, *tmp;
+	int version, n = 0, size = 0;
+	long long saved;
+	FILE *f;
+
+	f = fopen(CHECKPOINT_FILE, "re");
+	if (!f) {
+		if (errno != ENOENT)
+			condlog(2, "failed to open %s: %m", CHECKPOINT_FILE);
+		return -1;
+	}
+	if (!fgets(line, sizeof(line), f) ||
+	    sscanf(line, "# multipathd checkpoint %d %lld", &version,
+		   &saved) != 2 || version != CHECKPOINT_VERSION) {
+		condlog(2, "%s: invalid checkpoint", CHECKPOINT_FILE);
+		goto out;
+	}
+	if (time(NULL) - saved > CHECKPOINT_MAX_AGE || saved > time(NULL)) {
+		condlog(3, "%s: checkpoint too old", CHECKPOINT_FILE);
+		goto out;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (n == size) {
+			size = size ? 2 * size : 64;
+			tmp = realloc(ents, size * sizeof(*ents));
+			if (!tmp) {
+				n = 0;
+				break;
+			}
+			ents = tmp;
+		}
+		if (parse_entry(line, &ents[n]) == 0)
+			n++;
+	}
+out:
+	fclose(f);
+	if (n == 0) {
+		free(ents);
+		return n;
+	}
+	qsort(ents, n, sizeof(*ents), ent_cmp);
+
+	pthread_mutex_lock(&checkpoint_lock);
+	free(entries);
+	entries = ents;
+	uatomic_set(&n_entries, n);
+	pthread_mutex_unlock(&checkpoint_lock);
+	condlog(3, "loaded checkpoint of %d paths", n);
+	return n;
+}
+
+void drop_checkpoint(void)
+{
+	pthread_mutex_lock(&checkpoint_lock);
+	free(entries);
+	entries = NULL;
+	uatomic_set(&n_entries, 0);
+	pthread_mutex_unlock(&checkpoint_lock);
+}
+
+int checkpoint_lookup(const struct path *pp, int *state, int *priority)
+{
+	struct checkpoint_ent key, *ent;
+	const char *wwid;
+	int ret = 1;
+
+	/* no checkpoint loaded, e.g. in multipath(8) */
+	if (!uatomic_read(&n_entries))
+		return 1;
+	if (!pp->udev || !pp->uid_attribute || !*pp->uid_attribute ||
+	    !*pp->dev_t)
+		return 1;
+	/* cheap, and it's what get_uid() will use */
+	wwid = udev_device_get_property_value(pp->udev, pp->uid_attribute);
+	if (!wwid)
+		return 1;
+	strlcpy(key.dev_t, pp->dev_t, sizeof(key.dev_t));
+	get_diskseq(pp, key.diskseq, sizeof(key.diskseq));
+
+	pthread_mutex_lock(&checkpoint_lock);
+	if (entries) {
+		ent = bsearch(&key, entries, n_entries, sizeof(*entries),
+			      ent_cmp);
+		if (ent && !strcmp(ent->diskseq, key.diskseq) &&
+		    !strcmp(ent->wwid, wwid)) {
+			*state = ent->state;
+			*priority = ent->priority;
+			ret = 0;
+		}
+	}
+	pthread_mutex_unlock(&checkpoint_lock);
+	return ret;
+}
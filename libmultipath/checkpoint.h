@@ -0,0 +1,39 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include "vector.h"
+
+struct path;
+
+/*
+ * Checkpoint of the path states and priorities of multipathd, for fast
+ * restarts, see warm_restart in multipath.conf(5).
+ *
+ * multipathd saves the checkpoint periodically and on shutdown. After
+ * load_checkpoint(), pathinfo() takes the checker state and priority of
+ * a path from the checkpoint instead of running the checker and the
+ * prioritizer, if the device number, the diskseq and the WWID in the
+ * udev database still match. The checker loop verifies the states soon
+ * after startup. drop_checkpoint() ends this again.
+ */
+#define CHECKPOINT_FILE "/" RUN_DIR "/multipathd/checkpoint"
+/* Older checkpoints are ignored, in seconds */
+#define CHECKPOINT_MAX_AGE 300
+/* How often multipathd saves the checkpoint, in seconds */
+#define CHECKPOINT_INTERVAL 60
+
+/* Must be called with the lock protecting pathvec held */
+int save_checkpoint(const struct _vector *pathvec);
+/* Returns the number of entries loaded, or -1 */
+int load_checkpoint(void);
+void drop_checkpoint(void);
+/*
+ * If there's a valid entry for pp, fill in its checker state and
+ * priority, and return 0. Otherwise, return 1.
+ */
+int checkpoint_lookup(const struct path *pp, int *state, int *priority);
+
+#endif /* _CHECKPOINT_H */
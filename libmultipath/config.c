@@ -9,11 +9,14 @@
 #include <dirent.h>
 #include <limits.h>
 #include <errno.h>
+#include <pthread.h>
+#include <urcu/uatomic.h>
 
 #include "checkers.h"
 #include "memory.h"
 #include "util.h"
 #include "debug.h"
+#include "log.h"
 #include "parser.h"
 #include "dict.h"
 #include "hwtable.h"
@@ -27,6 +30,9 @@
 #include "mpath_cmd.h"
 #include "propsel.h"
 #include "foreign.h"
+#include "alias.h"
+#include "prkey.h"
+#include "uevent.h"
 
 /*
  * We don't support re-initialization after
@@ -64,7 +70,12 @@ static void _libmultipath_exit(void)
 	cleanup_foreign();
 	cleanup_checkers();
 	cleanup_prio();
+	cleanup_bindings();
+	cleanup_prkeys();
 	libmp_dm_exit();
+	cleanup_path_pool();
+	cleanup_path_filters();
+	cleanup_uevent_pool();
 	udev_unref(udev);
 }
 
@@ -73,9 +84,67 @@ void libmultipath_exit(void)
 	pthread_once(&_exit_once, _libmultipath_exit);
 }
 
+struct libmp_context {
+	int refcount;
+	struct config *conf;
+};
+
+/* Context used by libmp_get_multipath_config() in this thread, or NULL */
+static __thread struct libmp_context *thread_context;
+
+struct libmp_context *libmp_context_new(const char *file)
+{
+	struct libmp_context *ctx = calloc(1, sizeof(*ctx));
+
+	if (!ctx)
+		return NULL;
+	ctx->conf = load_config(file);
+	if (!ctx->conf) {
+		free(ctx);
+		return NULL;
+	}
+	uatomic_set(&ctx->refcount, 1);
+	return ctx;
+}
+
+void libmp_context_ref(struct libmp_context *ctx)
+{
+	uatomic_add_return(&ctx->refcount, 1);
+}
+
+void libmp_context_unref(struct libmp_context *ctx)
+{
+	if (!ctx || uatomic_sub_return(&ctx->refcount, 1) > 0)
+		return;
+	free_config(ctx->conf);
+	free(ctx);
+}
+
+struct config *libmp_context_config(const struct libmp_context *ctx)
+{
+	return ctx->conf;
+}
+
+void libmp_use_context(struct libmp_context *ctx)
+{
+	struct libmp_context *old = thread_context;
+
+	if (ctx)
+		libmp_context_ref(ctx);
+	thread_context = ctx;
+	libmp_context_unref(old);
+}
+
+struct libmp_context *libmp_current_context(void)
+{
+	return thread_context;
+}
+
 static struct config __internal_config;
 struct config *libmp_get_multipath_config(void)
 {
+	if (thread_context)
+		return thread_context->conf;
 	if (!__internal_config.hwtable)
 		/* not initialized */
 		return NULL;
@@ -129,44 +198,139 @@ find_hwe_strmatch (const struct _vector *hwtable, const struct hwentry *hwe)
 	return ret;
 }
 
-static int
-hwe_regmatch (const struct hwentry *hwe1, const char *vendor,
-	      const char *product, const char *revision)
-{
-	regex_t vre, pre, rre;
-	int retval = 1;
+enum {
+	/* regexes are compiled on first use */
+	HWE_REGEX_NONE = 0,
+	HWE_REGEX_OK,
+	/* one of the regexes is invalid, the entry never matches */
+	HWE_REGEX_INVALID,
+};
 
-	if (hwe1->vendor &&
-	    regcomp(&vre, hwe1->vendor, REG_EXTENDED|REG_NOSUB))
-		goto out;
+/* Serializes compile_hwe_regexes() for hwtables used by several threads */
+static pthread_mutex_t hwe_regex_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	if (hwe1->product &&
-	    regcomp(&pre, hwe1->product, REG_EXTENDED|REG_NOSUB))
+static int
+compile_hwe_regexes (struct hwentry *hwe)
+{
+	if (hwe->vendor &&
+	    regcomp(&hwe->vendor_re, hwe->vendor, REG_EXTENDED|REG_NOSUB)) {
+		condlog(1, "invalid vendor regex \"%s\" in hwtable",
+			hwe->vendor);
+		return HWE_REGEX_INVALID;
+	}
+	if (hwe->product &&
+	    regcomp(&hwe->product_re, hwe->product, REG_EXTENDED|REG_NOSUB)) {
+		condlog(1, "invalid product regex \"%s\" in hwtable",
+			hwe->product);
 		goto out_vre;
-
-	if (hwe1->revision &&
-	    regcomp(&rre, hwe1->revision, REG_EXTENDED|REG_NOSUB))
+	}
+	if (hwe->revision &&
+	    regcomp(&hwe->revision_re, hwe->revision,
+		    REG_EXTENDED|REG_NOSUB)) {
+		condlog(1, "invalid revision regex \"%s\" in hwtable",
+			hwe->revision);
 		goto out_pre;
+	}
+	return HWE_REGEX_OK;
 
-	if ((vendor || product || revision) &&
-	    (!hwe1->vendor || !vendor ||
-	     !regexec(&vre, vendor, 0, NULL, 0)) &&
-	    (!hwe1->product || !product ||
-	     !regexec(&pre, product, 0, NULL, 0)) &&
-	    (!hwe1->revision || !revision ||
-	     !regexec(&rre, revision, 0, NULL, 0)))
-		retval = 0;
-
-	if (hwe1->revision)
-		regfree(&rre);
 out_pre:
-	if (hwe1->product)
-		regfree(&pre);
+	if (hwe->product)
+		regfree(&hwe->product_re);
 out_vre:
-	if (hwe1->vendor)
-		regfree(&vre);
-out:
-	return retval;
+	if (hwe->vendor)
+		regfree(&hwe->vendor_re);
+	return HWE_REGEX_INVALID;
+}
+
+static int
+get_hwe_regexes (struct hwentry *hwe)
+{
+	int state = uatomic_read(&hwe->regex_state);
+
+	if (state != HWE_REGEX_NONE) {
+		/* pairs with cmm_smp_wmb() below */
+		cmm_smp_rmb();
+		return state;
+	}
+
+	pthread_mutex_lock(&hwe_regex_lock);
+	pthread_cleanup_push(cleanup_mutex, &hwe_regex_lock);
+	state = hwe->regex_state;
+	if (state == HWE_REGEX_NONE) {
+		state = compile_hwe_regexes(hwe);
+		cmm_smp_wmb();
+		uatomic_set(&hwe->regex_state, state);
+	}
+	pthread_cleanup_pop(1);
+	return state;
+}
+
+static int
+hwe_regmatch (struct hwentry *hwe1, const char *vendor,
+	      const char *product, const char *revision)
+{
+	if (!vendor && !product && !revision)
+		return 1;
+
+	/* Most entries are ruled out here, without compiling regexes */
+	if (hwe1->vendor && vendor &&
+	    !regex_literal_match(hwe1->vendor_literal,
+				 hwe1->vendor_anchored, vendor))
+		return 1;
+
+	if (get_hwe_regexes(hwe1) != HWE_REGEX_OK)
+		return 1;
+
+	if (hwe1->vendor && vendor &&
+	    regexec(&hwe1->vendor_re, vendor, 0, NULL, 0))
+		return 1;
+	if (hwe1->product && product &&
+	    regexec(&hwe1->product_re, product, 0, NULL, 0))
+		return 1;
+	if (hwe1->revision && revision &&
+	    regexec(&hwe1->revision_re, revision, 0, NULL, 0))
+		return 1;
+	return 0;
+}
+
+static void
+free_hwe_regexes (struct hwentry *hwe)
+{
+	if (hwe->regex_state == HWE_REGEX_OK) {
+		if (hwe->vendor)
+			regfree(&hwe->vendor_re);
+		if (hwe->product)
+			regfree(&hwe->product_re);
+		if (hwe->revision)
+			regfree(&hwe->revision_re);
+	}
+	free(hwe->vendor_literal);
+	hwe->vendor_literal = NULL;
+	hwe->vendor_anchored = false;
+	hwe->regex_state = HWE_REGEX_NONE;
+}
+
+/*
+ * Set up the vendor literals of all hwtable entries, which let find_hwe()
+ * skip most entries without compiling their regexes. The regexes are
+ * compiled by find_hwe() when an entry is first matched against, so that
+ * short-lived tools only compile the few entries that may match their
+ * devices. Must be called after the table is complete, i.e. after
+ * factorize_hwtable().
+ */
+void
+prepare_hwtable_regexes (vector hwtable)
+{
+	int i;
+	struct hwentry *hwe;
+
+	vector_foreach_slot (hwtable, hwe, i) {
+		free_hwe_regexes(hwe);
+		if (hwe->vendor)
+			hwe->vendor_literal =
+				get_regex_literal(hwe->vendor,
+						  &hwe->vendor_anchored);
+	}
 }
 
 static void _log_match(const char *fn, const struct hwentry *h,
@@ -208,7 +372,133 @@ find_hwe (const struct _vector *hwtable,
 	return n;
 }
 
-struct mpentry *find_mpe(vector mptable, char *wwid)
+/*
+ * Hash index of the hwtable entries by vendor literal (see
+ * get_regex_literal()). A vendor string can only match entries whose
+ * literal is one of its substrings, so lookups hash all substrings of
+ * the vendor, and only try the regexes of the entries found this way,
+ * and of the entries without literal. Chains are linked by hwtable
+ * index, -1 terminates.
+ */
+#define HWE_MAX_VENDOR_LEN 64
+
+struct hwtable_index {
+	int size;
+	unsigned int mask;
+	int *heads;
+	int *next;
+	/* entries without vendor literal */
+	int *unkeyed;
+	int n_unkeyed;
+};
+
+static void free_hwtable_index(struct config *conf)
+{
+	free(conf->hwtable_index);
+	conf->hwtable_index = NULL;
+}
+
+static int index_hwtable(struct config *conf)
+{
+	struct hwtable_index *idx;
+	struct hwentry *hwe;
+	unsigned int size, h;
+	int i, n = VECTOR_SIZE(conf->hwtable);
+
+	free_hwtable_index(conf);
+	for (size = 16; size < 2 * (unsigned int)n; size <<= 1)
+		;
+	idx = malloc(sizeof(*idx) + (size + 2 * n) * sizeof(int));
+	if (!idx)
+		return 1;
+	idx->size = n;
+	idx->mask = size - 1;
+	idx->heads = (int *)(idx + 1);
+	idx->next = idx->heads + size;
+	idx->unkeyed = idx->next + n;
+	idx->n_unkeyed = 0;
+	memset(idx->heads, -1, size * sizeof(int));
+
+	for (i = 0; i < n; i++) {
+		hwe = VECTOR_SLOT(conf->hwtable, i);
+		idx->next[i] = -1;
+		if (!hwe->vendor_literal ||
+		    strlen(hwe->vendor_literal) > HWE_MAX_VENDOR_LEN) {
+			idx->unkeyed[idx->n_unkeyed++] = i;
+			continue;
+		}
+		h = hash_str(hwe->vendor_literal) & idx->mask;
+		idx->next[i] = idx->heads[h];
+		idx->heads[h] = i;
+	}
+	conf->hwtable_index = idx;
+	return 0;
+}
+
+/* Mark all entries whose literal equals vendor[start..start+len) */
+static void mark_hwe_literal(const struct config *conf, const char *vendor,
+			     size_t len, unsigned int h, bool *hit)
+{
+	const struct hwtable_index *idx = conf->hwtable_index;
+	const struct hwentry *hwe;
+	int i;
+
+	for (i = idx->heads[h & idx->mask]; i >= 0; i = idx->next[i]) {
+		hwe = VECTOR_SLOT(conf->hwtable, i);
+		if (!strncmp(hwe->vendor_literal, vendor, len) &&
+		    hwe->vendor_literal[len] == '\0')
+			hit[i] = true;
+	}
+}
+
+int lookup_hwe(const struct config *conf, const char *vendor,
+	       const char *product, const char *revision, vector result)
+{
+	const struct hwtable_index *idx = conf->hwtable_index;
+	struct hwentry *tmp;
+	size_t len, start, end;
+	unsigned int h;
+	bool *hit;
+	int i, n = 0;
+
+	if (!idx || idx->size != VECTOR_SIZE(conf->hwtable) || !vendor ||
+	    (len = strlen(vendor)) > HWE_MAX_VENDOR_LEN ||
+	    !(hit = calloc(idx->size, sizeof(*hit))))
+		return find_hwe(conf->hwtable, vendor, product, revision,
+				result);
+
+	for (i = 0; i < idx->n_unkeyed; i++)
+		hit[idx->unkeyed[i]] = true;
+	for (start = 0; start < len; start++) {
+		h = 2166136261U;
+		for (end = start; end < len; end++) {
+			/* FNV-1a, like hash_str() */
+			h = (h ^ (unsigned char)vendor[end]) * 16777619U;
+			mark_hwe_literal(conf, vendor + start,
+					 end - start + 1, h, hit);
+		}
+	}
+
+	vector_reset(result);
+	for (i = idx->size - 1; i >= 0; i--) {
+		if (!hit[i])
+			continue;
+		tmp = VECTOR_SLOT(conf->hwtable, i);
+		if (hwe_regmatch(tmp, vendor, product, revision))
+			continue;
+		if (vector_alloc_slot(result)) {
+			vector_set_slot(result, tmp);
+			n++;
+		}
+		log_match(tmp, vendor, product, revision);
+	}
+	free(hit);
+	condlog(n > 1 ? 3 : 4, "%s: found %d hwtable matches for %s:%s:%s",
+		__func__, n, vendor, product, revision);
+	return n;
+}
+
+struct mpentry *find_mpe(vector mptable, const char *wwid)
 {
 	int i;
 	struct mpentry * mpe;
@@ -238,6 +528,112 @@ const char *get_mpe_wwid(const struct _vector *mptable, const char *alias)
 	return NULL;
 }
 
+/*
+ * Open addressing hash tables of the mptable entries by wwid and by
+ * alias. Entries with the same key are stored in mptable order along
+ * the probe sequence, so lookups find the same entry as a linear scan.
+ * The entries' keys are compared on lookup, so entries whose alias was
+ * removed later (see check_alias_settings()) are simply skipped.
+ */
+struct mptable_index {
+	unsigned int mask;
+	struct mpentry **by_wwid;
+	struct mpentry **by_alias;
+};
+
+static unsigned int mpe_table_size(int n)
+{
+	unsigned int size = 16;
+
+	while (size < 2 * (unsigned int)n)
+		size <<= 1;
+	return size;
+}
+
+static void mpe_table_add(struct mpentry **table, unsigned int mask,
+			  const char *key, struct mpentry *mpe)
+{
+	unsigned int h = hash_str(key) & mask;
+
+	while (table[h])
+		h = (h + 1) & mask;
+	table[h] = mpe;
+}
+
+static void free_mptable_index(struct config *conf)
+{
+	free(conf->mptable_index);
+	conf->mptable_index = NULL;
+}
+
+static int index_mptable(struct config *conf)
+{
+	struct mptable_index *idx;
+	struct mpentry *mpe;
+	unsigned int size;
+	int i;
+
+	free_mptable_index(conf);
+	size = mpe_table_size(VECTOR_SIZE(conf->mptable));
+	idx = calloc(1, sizeof(*idx) + 2 * size * sizeof(*idx->by_wwid));
+	if (!idx)
+		return 1;
+	idx->mask = size - 1;
+	idx->by_wwid = (struct mpentry **)(idx + 1);
+	idx->by_alias = idx->by_wwid + size;
+
+	vector_foreach_slot (conf->mptable, mpe, i) {
+		if (mpe->wwid)
+			mpe_table_add(idx->by_wwid, idx->mask, mpe->wwid, mpe);
+		if (mpe->alias)
+			mpe_table_add(idx->by_alias, idx->mask, mpe->alias, mpe);
+	}
+	conf->mptable_index = idx;
+	return 0;
+}
+
+struct mpentry *find_mpe_by_wwid(const struct config *conf, const char *wwid)
+{
+	const struct mptable_index *idx = conf->mptable_index;
+	struct mpentry *mpe;
+	unsigned int h;
+
+	if (!wwid || !*wwid)
+		return NULL;
+	if (!idx)
+		return find_mpe(conf->mptable, wwid);
+
+	for (h = hash_str(wwid) & idx->mask; (mpe = idx->by_wwid[h]);
+	     h = (h + 1) & idx->mask)
+		if (mpe->wwid && !strcmp(mpe->wwid, wwid))
+			return mpe;
+	return NULL;
+}
+
+struct mpentry *find_mpe_by_alias(const struct config *conf,
+				  const char *alias)
+{
+	const struct mptable_index *idx = conf->mptable_index;
+	struct mpentry *mpe;
+	unsigned int h;
+	int i;
+
+	if (!alias)
+		return NULL;
+	if (!idx) {
+		vector_foreach_slot (conf->mptable, mpe, i)
+			if (mpe->alias && !strcmp(mpe->alias, alias))
+				return mpe;
+		return NULL;
+	}
+
+	for (h = hash_str(alias) & idx->mask; (mpe = idx->by_alias[h]);
+	     h = (h + 1) & idx->mask)
+		if (mpe->alias && !strcmp(mpe->alias, alias))
+			return mpe;
+	return NULL;
+}
+
 void
 free_hwe (struct hwentry * hwe)
 {
@@ -280,9 +676,13 @@ free_hwe (struct hwentry * hwe)
 	if (hwe->alias_prefix)
 		FREE(hwe->alias_prefix);
 
+	if (hwe->queue_profile)
+		FREE(hwe->queue_profile);
+
 	if (hwe->bl_product)
 		FREE(hwe->bl_product);
 
+	free_hwe_regexes(hwe);
 	FREE(hwe);
 }
 
@@ -328,6 +728,9 @@ free_mpe (struct mpentry * mpe)
 	if (mpe->prio_args)
 		FREE(mpe->prio_args);
 
+	if (mpe->queue_profile)
+		FREE(mpe->queue_profile);
+
 	FREE(mpe);
 }
 
@@ -414,6 +817,7 @@ merge_hwe (struct hwentry * dst, struct hwentry * src)
 	merge_str(prio_name);
 	merge_str(prio_args);
 	merge_str(alias_prefix);
+	merge_str(queue_profile);
 	merge_str(bl_product);
 	merge_num(pgpolicy);
 	merge_num(pgfailback);
@@ -433,8 +837,11 @@ merge_hwe (struct hwentry * dst, struct hwentry * src)
 	merge_num(delay_watch_checks);
 	merge_num(delay_wait_checks);
 	merge_num(skip_kpartx);
+	merge_num(selector_autotune);
 	merge_num(max_sectors_kb);
 	merge_num(ghost_delay);
+	merge_num(fast_checkint);
+	merge_num(array_check_rate);
 	merge_num(all_tg_pt);
 	merge_num(recheck_wwid);
 	merge_num(vpd_vendor_id);
@@ -466,6 +873,7 @@ merge_mpe(struct mpentry *dst, struct mpentry *src)
 	merge_str(features);
 	merge_str(prio_name);
 	merge_str(prio_args);
+	merge_str(queue_profile);
 
 	if (dst->prkey_source == PRKEY_SOURCE_NONE &&
 	    src->prkey_source != PRKEY_SOURCE_NONE) {
@@ -495,8 +903,11 @@ merge_mpe(struct mpentry *dst, struct mpentry *src)
 	merge_num(marginal_path_err_recheck_gap_time);
 	merge_num(marginal_path_double_failed_time);
 	merge_num(skip_kpartx);
+	merge_num(selector_autotune);
 	merge_num(max_sectors_kb);
 	merge_num(ghost_delay);
+	merge_num(fast_checkint);
+	merge_num(startup_priority);
 	merge_num(uid);
 	merge_num(gid);
 	merge_num(mode);
@@ -504,9 +915,15 @@ merge_mpe(struct mpentry *dst, struct mpentry *src)
 	return 0;
 }
 
+/*
+ * Merge every entry into the next entry with the same wwid, and remove
+ * it. Walking the table backwards, the surviving last entry of each
+ * wwid is merged with all earlier ones in the same order.
+ */
 void merge_mptable(vector mptable)
 {
-	struct mpentry *mp1, *mp2;
+	struct mpentry *mp1, *mp2, **table;
+	unsigned int mask, h;
 	int i, j;
 
 	vector_foreach_slot(mptable, mp1, i) {
@@ -515,21 +932,40 @@ void merge_mptable(vector mptable)
 			condlog(0, "multipaths config section missing wwid");
 			vector_del_slot(mptable, i--);
 			free_mpe(mp1);
-			continue;
 		}
-		j = i + 1;
-		vector_foreach_slot_after(mptable, mp2, j) {
-			if (!mp2->wwid || strcmp(mp1->wwid, mp2->wwid))
-				continue;
-			condlog(1, "%s: duplicate multipath config section for %s",
-				__func__, mp1->wwid);
-			merge_mpe(mp2, mp1);
-			free_mpe(mp1);
-			vector_del_slot(mptable, i);
-			i--;
-			break;
+	}
+	if (VECTOR_SIZE(mptable) <= 1)
+		return;
+
+	mask = mpe_table_size(VECTOR_SIZE(mptable)) - 1;
+	table = calloc(mask + 1, sizeof(*table));
+	if (!table) {
+		condlog(0, "%s: failed to allocate hash table", __func__);
+		return;
+	}
+	for (i = VECTOR_SIZE(mptable) - 1; i >= 0; i--) {
+		mp1 = VECTOR_SLOT(mptable, i);
+		for (h = hash_str(mp1->wwid) & mask; (mp2 = table[h]);
+		     h = (h + 1) & mask)
+			if (!strcmp(mp1->wwid, mp2->wwid))
+				break;
+		if (!mp2) {
+			table[h] = mp1;
+			continue;
 		}
+		condlog(1, "%s: duplicate multipath config section for %s",
+			__func__, mp1->wwid);
+		merge_mpe(mp2, mp1);
+		free_mpe(mp1);
+		mptable->slot[i] = NULL;
 	}
+	free(table);
+
+	for (i = 0, j = 0; i < VECTOR_SIZE(mptable); i++)
+		if (mptable->slot[i])
+			mptable->slot[j++] = mptable->slot[i];
+	while (VECTOR_SIZE(mptable) > j)
+		vector_del_slot(mptable, VECTOR_SIZE(mptable) - 1);
 }
 
 int
@@ -594,6 +1030,8 @@ store_hwe (vector hwtable, struct hwentry * dhwe)
 	hwe->detect_prio = dhwe->detect_prio;
 	hwe->detect_checker = dhwe->detect_checker;
 	hwe->ghost_delay = dhwe->ghost_delay;
+	hwe->fast_checkint = dhwe->fast_checkint;
+	hwe->array_check_rate = dhwe->array_check_rate;
 	hwe->vpd_vendor_id = dhwe->vpd_vendor_id;
 
 	if (dhwe->bl_product && !(hwe->bl_product = set_param_str(dhwe->bl_product)))
@@ -660,6 +1098,8 @@ static void _uninit_config(struct config *conf)
 	if (!conf)
 		conf = &__internal_config;
 
+	flush_propsel_cache(conf);
+
 	if (conf->multipath_dir)
 		FREE(conf->multipath_dir);
 
@@ -694,6 +1134,8 @@ static void _uninit_config(struct config *conf)
 
 	if (conf->alias_prefix)
 		FREE(conf->alias_prefix);
+	if (conf->queue_profile)
+		FREE(conf->queue_profile);
 	if (conf->partition_delim)
 		FREE(conf->partition_delim);
 
@@ -707,6 +1149,12 @@ static void _uninit_config(struct config *conf)
 		FREE(conf->config_dir);
 	if (conf->enable_foreign)
 		FREE(conf->enable_foreign);
+	if (conf->cpu_affinity)
+		FREE(conf->cpu_affinity);
+	if (conf->sched_policy)
+		FREE(conf->sched_policy);
+	if (conf->thread_stack_size)
+		FREE(conf->thread_stack_size);
 
 	free_blacklist(conf->blist_devnode);
 	free_blacklist(conf->blist_wwid);
@@ -720,7 +1168,9 @@ static void _uninit_config(struct config *conf)
 	free_blacklist(conf->elist_protocol);
 	free_blacklist_device(conf->elist_device);
 
+	free_mptable_index(conf);
 	free_mptable(conf->mptable);
+	free_hwtable_index(conf);
 	free_hwtable(conf->hwtable);
 	free_hwe(conf->overrides);
 	free_keywords(conf->keywords);
@@ -842,6 +1292,8 @@ int _init_config (const char *file, struct config *conf)
 	 * When we return, we'll copy the config value back
 	 */
 	conf->verbosity = libmp_verbosity;
+	conf->log_rate_limit = DEFAULT_LOG_RATE_LIMIT;
+	conf->log_journal = DEFAULT_LOG_JOURNAL;
 
 	/*
 	 * internal defaults
@@ -865,10 +1317,36 @@ int _init_config (const char *file, struct config *conf)
 	conf->retrigger_tries = DEFAULT_RETRIGGER_TRIES;
 	conf->retrigger_delay = DEFAULT_RETRIGGER_DELAY;
 	conf->uev_wait_timeout = DEFAULT_UEV_WAIT_TIMEOUT;
+	conf->uev_batch_min_wait = DEFAULT_UEV_BATCH_MIN_WAIT;
+	conf->uev_batch_max_wait = DEFAULT_UEV_BATCH_MAX_WAIT;
+	conf->uev_batch_max_events = DEFAULT_UEV_BATCH_MAX_EVENTS;
+	conf->uev_batch_max_time = DEFAULT_UEV_BATCH_MAX_TIME;
+	conf->reconfigure_debounce = DEFAULT_RECONFIGURE_DEBOUNCE;
+	conf->reload_debounce = DEFAULT_RELOAD_DEBOUNCE;
 	conf->remove_retries = 0;
 	conf->ghost_delay = DEFAULT_GHOST_DELAY;
+	conf->fast_checkint = DEFAULT_FAST_CHECKINT;
+	conf->array_check_rate = DEFAULT_ARRAY_CHECK_RATE;
 	conf->all_tg_pt = DEFAULT_ALL_TG_PT;
 	conf->recheck_wwid = DEFAULT_RECHECK_WWID;
+	conf->checker_threads = DEFAULT_CHECKER_THREADS;
+	conf->discovery_threads = DEFAULT_DISCOVERY_THREADS;
+	conf->uevent_threads = DEFAULT_UEVENT_THREADS;
+	conf->internal_kpartx = DEFAULT_INTERNAL_KPARTX;
+	conf->wwids_index = DEFAULT_WWIDS_INDEX;
+	conf->adaptive_checkint = DEFAULT_ADAPTIVE_CHECKINT;
+	conf->max_check_rate = DEFAULT_MAX_CHECK_RATE;
+	conf->vpd_cache = DEFAULT_VPD_CACHE;
+	conf->alua_prio_refresh = DEFAULT_ALUA_PRIO_REFRESH;
+	conf->prio_max_age = DEFAULT_PRIO_MAX_AGE;
+	conf->async_prio = DEFAULT_ASYNC_PRIO;
+	conf->recheck_siblings = DEFAULT_RECHECK_SIBLINGS;
+	conf->numa_affinity = DEFAULT_NUMA_AFFINITY;
+	conf->unified_event_loop = DEFAULT_UNIFIED_EVENT_LOOP;
+	conf->publish_state = DEFAULT_PUBLISH_STATE;
+	conf->warm_restart = DEFAULT_WARM_RESTART;
+	conf->io_stats = DEFAULT_IO_STATS;
+	conf->mlock_memory = DEFAULT_MLOCK_MEMORY;
 	/*
 	 * preload default hwtable
 	 */
@@ -902,6 +1380,9 @@ int _init_config (const char *file, struct config *conf)
 		conf->config_dir = set_default(DEFAULT_CONFIG_DIR);
 	if (conf->config_dir && conf->config_dir[0] != '\0')
 		process_config_dir(conf, conf->config_dir);
+	prepare_hwtable_regexes(conf->hwtable);
+	if (index_hwtable(conf))
+		condlog(1, "failed to index hwtable");
 
 	/*
 	 * fill the voids left in the config file
@@ -996,6 +1477,8 @@ int _init_config (const char *file, struct config *conf)
 	}
 
 	merge_mptable(conf->mptable);
+	if (index_mptable(conf))
+		condlog(1, "failed to index multipaths section");
 	merge_blacklist(conf->blist_devnode);
 	merge_blacklist(conf->blist_property);
 	merge_blacklist(conf->blist_wwid);
@@ -1013,6 +1496,8 @@ int _init_config (const char *file, struct config *conf)
 		goto out;
 
 	libmp_verbosity = conf->verbosity;
+	log_rate_limit = conf->log_rate_limit;
+	uatomic_set(&log_use_journal, conf->log_journal == YN_YES);
 	return 0;
 out:
 	_uninit_config(conf);
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <urcu.h>
 #include <inttypes.h>
+#include <regex.h>
 #include "byteorder.h"
 
 #define ORIGIN_DEFAULT 0
@@ -53,6 +54,7 @@ struct hwentry {
 	char * prio_name;
 	char * prio_args;
 	char * alias_prefix;
+	char * queue_profile;
 
 	int pgpolicy;
 	int pgfailback;
@@ -79,12 +81,24 @@ struct hwentry {
 	int marginal_path_err_recheck_gap_time;
 	int marginal_path_double_failed_time;
 	int skip_kpartx;
+	int selector_autotune;
 	int max_sectors_kb;
 	int ghost_delay;
+	int fast_checkint;
+	int array_check_rate;
 	int all_tg_pt;
 	int vpd_vendor_id;
 	int recheck_wwid;
 	char * bl_product;
+
+	/* Set by prepare_hwtable_regexes() and find_hwe() */
+	int regex_state;
+	regex_t vendor_re;
+	regex_t product_re;
+	regex_t revision_re;
+	/* Literal string that matching vendor strings must contain */
+	char *vendor_literal;
+	bool vendor_anchored;
 };
 
 struct mpentry {
@@ -97,6 +111,7 @@ struct mpentry {
 
 	char * prio_name;
 	char * prio_args;
+	char * queue_profile;
 	int prkey_source;
 	struct be64 reservation_key;
 	uint8_t sa_flags;
@@ -120,8 +135,11 @@ struct mpentry {
 	int marginal_path_err_recheck_gap_time;
 	int marginal_path_double_failed_time;
 	int skip_kpartx;
+	int selector_autotune;
 	int max_sectors_kb;
 	int ghost_delay;
+	int fast_checkint;
+	int startup_priority;
 	uid_t uid;
 	gid_t gid;
 	mode_t mode;
@@ -130,6 +148,8 @@ struct mpentry {
 struct config {
 	struct rcu_head rcu;
 	int verbosity;
+	unsigned int log_rate_limit;
+	int log_journal;
 	int pgpolicy_flag;
 	int pgpolicy;
 	int minio;
@@ -176,19 +196,46 @@ struct config {
 	int marginal_path_double_failed_time;
 	int uxsock_timeout;
 	int strict_timing;
+	int checker_threads;
+	int discovery_threads;
+	int uevent_threads;
+	int internal_kpartx;
 	int retrigger_tries;
 	int retrigger_delay;
 	int delayed_reconfig;
 	int uev_wait_timeout;
+	unsigned int uev_batch_min_wait;
+	unsigned int uev_batch_max_wait;
+	unsigned int uev_batch_max_events;
+	unsigned int uev_batch_max_time;
+	unsigned int reconfigure_debounce;
+	unsigned int reload_debounce;
 	int skip_kpartx;
+	int selector_autotune;
 	int remove_retries;
 	int max_sectors_kb;
 	int ghost_delay;
+	int fast_checkint;
+	int array_check_rate;
 	int find_multipaths_timeout;
 	int marginal_pathgroups;
 	int skip_delegate;
 	unsigned int sequence_nr;
 	int recheck_wwid;
+	int wwids_index;
+	int adaptive_checkint;
+	int max_check_rate;
+	int vpd_cache;
+	int alua_prio_refresh;
+	int prio_max_age;
+	int async_prio;
+	int recheck_siblings;
+	int numa_affinity;
+	int unified_event_loop;
+	int publish_state;
+	int warm_restart;
+	int io_stats;
+	int mlock_memory;
 
 	char * multipath_dir;
 	char * selector;
@@ -204,6 +251,7 @@ struct config {
 	char * prio_args;
 	char * checker_name;
 	char * alias_prefix;
+	char * queue_profile;
 	char * partition_delim;
 	char * config_dir;
 	int prkey_source;
@@ -213,7 +261,11 @@ struct config {
 
 	vector keywords;
 	vector mptable;
+	/* hash index of mptable, see find_mpe_by_wwid() */
+	struct mptable_index *mptable_index;
 	vector hwtable;
+	/* hash index of hwtable, see lookup_hwe() */
+	struct hwtable_index *hwtable_index;
 	struct hwentry *overrides;
 
 	vector blist_devnode;
@@ -227,6 +279,9 @@ struct config {
 	vector elist_property;
 	vector elist_protocol;
 	char *enable_foreign;
+	char *cpu_affinity;
+	char *sched_policy;
+	char *thread_stack_size;
 };
 
 /**
@@ -280,8 +335,22 @@ void libmultipath_exit(void);
 int find_hwe (const struct _vector *hwtable,
 	      const char * vendor, const char * product, const char *revision,
 	      vector result);
-struct mpentry * find_mpe (vector mptable, char * wwid);
+/*
+ * Like find_hwe() for conf->hwtable, but only trying the entries which
+ * may match the vendor, using the index built when the configuration
+ * is loaded.
+ */
+int lookup_hwe(const struct config *conf, const char *vendor,
+	       const char *product, const char *revision, vector result);
+struct mpentry * find_mpe (vector mptable, const char * wwid);
 const char *get_mpe_wwid (const struct _vector *mptable, const char *alias);
+/*
+ * Like find_mpe() and get_mpe_wwid() for conf->mptable, but using the
+ * hash index built when the configuration is loaded.
+ */
+struct mpentry *find_mpe_by_wwid(const struct config *conf, const char *wwid);
+struct mpentry *find_mpe_by_alias(const struct config *conf,
+				  const char *alias);
 
 struct hwentry * alloc_hwe (void);
 struct mpentry * alloc_mpe (void);
@@ -292,6 +361,7 @@ void free_mpe (struct mpentry * mpe);
 void free_mptable (vector mptable);
 
 int store_hwe (vector hwtable, struct hwentry *);
+void prepare_hwtable_regexes (vector hwtable);
 
 struct config *load_config (const char *file);
 void free_config (struct config * conf);
@@ -314,6 +384,37 @@ struct config *get_multipath_config(void);
 void libmp_put_multipath_config(void *);
 void put_multipath_config(void *);
 
+/*
+ * A libmp_context holds a configuration that is independent of the one
+ * set up by init_config(). It allows applications to run libmultipath
+ * functions in several threads at once, and to switch to a reloaded
+ * configuration without stopping the threads that are using the old one.
+ *
+ * libmp_context_new() loads the configuration from file, and returns a
+ * context with one reference, or NULL on failure. The configuration must
+ * not be changed once the context is used by more than one thread.
+ * libmp_context_unref() frees the context once the last reference is
+ * dropped.
+ *
+ * libmp_use_context() makes libmp_get_multipath_config() return the
+ * configuration of ctx in the calling thread, until it is called again.
+ * It takes a reference on ctx, and drops the one on the previously used
+ * context. ctx may be NULL, to go back to the configuration from
+ * init_config(). Threads must call libmp_use_context(NULL) before they
+ * exit. libmp_current_context() returns the context used by the calling
+ * thread, without taking a reference.
+ *
+ * The udev instance, the checker and prioritizer classes and
+ * libmp_verbosity are still shared by all contexts.
+ */
+struct libmp_context;
+struct libmp_context *libmp_context_new(const char *file);
+void libmp_context_ref(struct libmp_context *ctx);
+void libmp_context_unref(struct libmp_context *ctx);
+struct config *libmp_context_config(const struct libmp_context *ctx);
+void libmp_use_context(struct libmp_context *ctx);
+struct libmp_context *libmp_current_context(void);
+
 int parse_uid_attrs(char *uid_attrs, struct config *conf);
 char *get_uid_attribute_by_attrs(struct config *conf,
 				 const char *path_dev);
@@ -13,6 +13,9 @@
 #include <sys/file.h>
 #include <errno.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <libdevmapper.h>
 #include <libudev.h>
 #include "mpath_cmd.h"
@@ -43,115 +46,101 @@
 #include "wwids.h"
 #include "sysfs.h"
 #include "io_err_stat.h"
+#include "trace.h"
+#include "strpool.h"
+#include "check_sched.h"
+#include "worker_pool.h"
 
 /* Time in ms to wait for pending checkers in setup_map() */
 #define WAIT_CHECKERS_PENDING_MS 10
 #define WAIT_ALL_CHECKERS_PENDING_MS 90
 
+static struct adapter_group *
+find_adaptergroup(const struct _vector *adapters, const char *adapter_name)
+{
+	struct adapter_group *agp;
+	int i;
+
+	vector_foreach_slot(adapters, agp, i)
+		if (!strcmp(agp->adapter_name, adapter_name))
+			return agp;
+	return NULL;
+}
+
+static struct host_group *
+find_hostgroup(const struct adapter_group *agp, int host_no)
+{
+	struct host_group *hgp;
+	int i;
+
+	vector_foreach_slot(agp->host_groups, hgp, i)
+		if (hgp->host_no == host_no)
+			return hgp;
+	return NULL;
+}
+
 /* group paths in pg by host adapter
+ * The adapter name is looked up in sysfs once per path. Adapter and host
+ * groups are created in order of first appearance, and paths keep their
+ * relative order. pgp->paths is only emptied on success.
  */
 int group_by_host_adapter(struct pathgroup *pgp, vector adapters)
 {
 	struct adapter_group *agp;
 	struct host_group *hgp;
-	struct path *pp, *pp1;
-	char adapter_name1[SLOT_NAME_SIZE];
-	char adapter_name2[SLOT_NAME_SIZE];
-	int i, j;
-	int found_hostgroup = 0;
-
-	while (VECTOR_SIZE(pgp->paths) > 0) {
-
-		pp = VECTOR_SLOT(pgp->paths, 0);
+	struct path *pp;
+	char adapter_name[SLOT_NAME_SIZE];
+	int i;
 
-		if (sysfs_get_host_adapter_name(pp, adapter_name1))
-			goto out;
-		/* create a new host adapter group
-		 */
-		agp = alloc_adaptergroup();
-		if (!agp)
+	vector_foreach_slot(pgp->paths, pp, i) {
+		if (sysfs_get_host_adapter_name(pp, adapter_name))
 			goto out;
-		agp->pgp = pgp;
 
-		strlcpy(agp->adapter_name, adapter_name1, SLOT_NAME_SIZE);
-		store_adaptergroup(adapters, agp);
+		agp = find_adaptergroup(adapters, adapter_name);
+		if (!agp) {
+			/* create a new host adapter group
+			 */
+			agp = alloc_adaptergroup();
+			if (!agp)
+				goto out;
+			agp->pgp = pgp;
+			strlcpy(agp->adapter_name, adapter_name,
+				SLOT_NAME_SIZE);
+			if (store_adaptergroup(adapters, agp)) {
+				free_hostgroup(agp->host_groups);
+				FREE(agp);
+				goto out;
+			}
+		}
 
-		/* create a new host port group
-		 */
-		hgp = alloc_hostgroup();
-		if (!hgp)
-			goto out;
-		if (store_hostgroup(agp->host_groups, hgp))
-			goto out;
+		hgp = find_hostgroup(agp, pp->sg_id.host_no);
+		if (!hgp) {
+			/* this path belongs to new host port
+			 * within this adapter
+			 */
+			hgp = alloc_hostgroup();
+			if (!hgp)
+				goto out;
+			if (store_hostgroup(agp->host_groups, hgp)) {
+				vector_free(hgp->paths);
+				FREE(hgp);
+				goto out;
+			}
+			hgp->host_no = pp->sg_id.host_no;
+			agp->num_hosts++;
+		}
 
-		hgp->host_no = pp->sg_id.host_no;
-		agp->num_hosts++;
 		if (store_path(hgp->paths, pp))
 			goto out;
-
 		hgp->num_paths++;
-		/* delete path from path group
-		 */
-		vector_del_slot(pgp->paths, 0);
-
-		/* add all paths belonging to same host adapter
-		 */
-		vector_foreach_slot(pgp->paths, pp1, i) {
-			if (sysfs_get_host_adapter_name(pp1, adapter_name2))
-				goto out;
-			if (strcmp(adapter_name1, adapter_name2) == 0) {
-				found_hostgroup = 0;
-				vector_foreach_slot(agp->host_groups, hgp, j) {
-					if (hgp->host_no == pp1->sg_id.host_no) {
-						if (store_path(hgp->paths, pp1))
-							goto out;
-						hgp->num_paths++;
-						found_hostgroup = 1;
-						break;
-					}
-				}
-				if (!found_hostgroup) {
-					/* this path belongs to new host port
-					 * within this adapter
-					 */
-					hgp = alloc_hostgroup();
-					if (!hgp)
-						goto out;
-
-					if (store_hostgroup(agp->host_groups, hgp))
-						goto out;
-
-					agp->num_hosts++;
-					if (store_path(hgp->paths, pp1))
-						goto out;
-
-					hgp->host_no = pp1->sg_id.host_no;
-					hgp->num_paths++;
-				}
-				/* delete paths from original path_group
-				 * as they are added into adapter group now
-				 */
-				vector_del_slot(pgp->paths, i);
-				i--;
-			}
-		}
 	}
+	/* paths are in the adapter groups now
+	 */
+	vector_reset(pgp->paths);
 	return 0;
 
-out:	/* add back paths into pg as re-ordering failed
+out:	/* pgp->paths is unchanged
 	 */
-	vector_foreach_slot(adapters, agp, i) {
-			vector_foreach_slot(agp->host_groups, hgp, j) {
-				while (VECTOR_SIZE(hgp->paths) > 0) {
-					pp = VECTOR_SLOT(hgp->paths, 0);
-					if (store_path(pgp->paths, pp))
-						condlog(3, "failed to restore "
-						"path %s into path group",
-						 pp->dev);
-					vector_del_slot(hgp->paths, 0);
-				}
-			}
-		}
 	free_adaptergroup(adapters);
 	return 1;
 }
@@ -188,15 +177,17 @@ int order_paths_in_pg_by_alt_adapters(struct pathgroup *pgp, vector adapters,
 			continue;
 		}
 
-		pp  = VECTOR_SLOT(hgp->paths, 0);
+		/* hgp->paths is consumed from the front, without
+		 * shifting it down
+		 */
+		pp = VECTOR_SLOT(hgp->paths,
+				 VECTOR_SIZE(hgp->paths) - hgp->num_paths);
 
 		if (store_path(pgp->paths, pp))
 			return 1;
 
 		total_paths--;
 
-		vector_del_slot(hgp->paths, 0);
-
 		hgp->num_paths--;
 
 		agp->next_host_index++;
@@ -277,8 +268,8 @@ static int wait_for_pending_paths(struct multipath *mpp,
 			vector_foreach_slot(pgp->paths, pp, j) {
 				if (pp->state != PATH_PENDING)
 					continue;
-				pp->state = get_state(pp, conf,
-						      0, PATH_PENDING);
+				set_path_state(pp, get_state(pp, conf,
+							     0, PATH_PENDING));
 				if (pp->state != PATH_PENDING &&
 				    --n_pending <= goal)
 					return 0;
@@ -298,6 +289,7 @@ int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
 	struct config *conf;
 	int i, n_paths, marginal_pathgroups;
 	char *save_attr;
+	const char *save_str;
 
 	/*
 	 * don't bother if devmap size is unknown
@@ -329,19 +321,21 @@ int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
 	conf = get_multipath_config();
 	pthread_cleanup_push(put_multipath_config, conf);
 
-	select_pgfailback(conf, mpp);
-	select_pgpolicy(conf, mpp);
+	select_static_props(conf, mpp);
 
 	/*
 	 * If setup_map() is called from e.g. from reload_map() or resize_map(),
 	 * make sure that we don't corrupt attributes.
 	 */
-	save_attr = steal_ptr(mpp->selector);
+	save_str = mpp->selector;
+	mpp->selector = NULL;
 	select_selector(conf, mpp);
 	if (!mpp->selector)
-		mpp->selector = save_attr;
+		mpp->selector = save_str;
 	else
-		free(save_attr);
+		strpool_put(save_str);
+	if (mpp->selector)
+		select_selector_autotune(conf, mpp);
 
 	select_no_path_retry(conf, mpp);
 	select_retain_hwhandler(conf, mpp);
@@ -353,35 +347,16 @@ int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
 	else
 		free(save_attr);
 
-	save_attr = steal_ptr(mpp->hwhandler);
+	save_str = mpp->hwhandler;
+	mpp->hwhandler = NULL;
 	select_hwhandler(conf, mpp);
 	if (!mpp->hwhandler)
-		mpp->hwhandler = save_attr;
+		mpp->hwhandler = save_str;
 	else
-		free(save_attr);
+		strpool_put(save_str);
 
-	select_rr_weight(conf, mpp);
-	select_minio(conf, mpp);
-	select_mode(conf, mpp);
-	select_uid(conf, mpp);
-	select_gid(conf, mpp);
-	select_fast_io_fail(conf, mpp);
-	select_dev_loss(conf, mpp);
-	select_eh_deadline(conf, mpp);
 	select_reservation_key(conf, mpp);
 	select_deferred_remove(conf, mpp);
-	select_marginal_path_err_sample_time(conf, mpp);
-	select_marginal_path_err_rate_threshold(conf, mpp);
-	select_marginal_path_err_recheck_gap_time(conf, mpp);
-	select_marginal_path_double_failed_time(conf, mpp);
-	select_san_path_err_threshold(conf, mpp);
-	select_san_path_err_forget_rate(conf, mpp);
-	select_san_path_err_recovery_time(conf, mpp);
-	select_delay_checks(conf, mpp);
-	select_skip_kpartx(conf, mpp);
-	select_max_sectors_kb(conf, mpp);
-	select_ghost_delay(conf, mpp);
-	select_flush_on_last_del(conf, mpp);
 
 	sysfs_set_scsi_tmo(mpp, conf->checkint);
 	marginal_pathgroups = conf->marginal_pathgroups;
@@ -406,6 +381,7 @@ int setup_map(struct multipath *mpp, char **params, struct vectors *vecs)
 
 		vector_free(mpp->pg);
 		mpp->pg = NULL;
+		invalidate_path_counts(mpp);
 	}
 	if (group_paths(mpp, marginal_pathgroups))
 		return 1;
@@ -526,42 +502,141 @@ get_udev_for_mpp(const struct multipath *mpp)
 	return udd;
 }
 
+/*
+ * The partitions of a block device are the subdirectories of its sysfs
+ * directory which have a "partition" attribute. Reading the directory is
+ * much cheaper than a udev enumeration, which scans all block devices
+ * with some libudev versions.
+ */
 void trigger_partitions_udev_change(struct udev_device *dev,
 				    const char *action, int len)
 {
-	struct udev_enumerate *part_enum;
-	struct udev_list_entry *item;
-	const char *devtype;
+	const char *syspath = udev_device_get_syspath(dev);
+	char attr[NAME_MAX + sizeof("/partition")];
+	struct dirent *di;
+	DIR *dir;
+	int fd;
 
-	part_enum = udev_enumerate_new(udev);
-	if (!part_enum)
+	if (!syspath || !(dir = opendir(syspath)))
 		return;
 
-	if (udev_enumerate_add_match_parent(part_enum, dev) < 0 ||
-	    udev_enumerate_add_match_subsystem(part_enum, "block") < 0 ||
-	    udev_enumerate_scan_devices(part_enum) < 0)
-		goto unref;
+	while ((di = readdir(dir)) != NULL) {
+		if ((di->d_type != DT_DIR && di->d_type != DT_UNKNOWN) ||
+		    di->d_name[0] == '.')
+			continue;
+		if (safe_sprintf(attr, "%s/partition", di->d_name) ||
+		    faccessat(dirfd(dir), attr, F_OK, 0) != 0)
+			continue;
+		if (safe_sprintf(attr, "%s/uevent", di->d_name))
+			continue;
+		fd = openat(dirfd(dir), attr, O_WRONLY|O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		condlog(4, "%s: triggering %s event for %s/%s", __func__,
+			action, syspath, di->d_name);
+		if (write(fd, action, len) != len)
+			condlog(3, "%s: failed to trigger %s event for %s/%s: %m",
+				__func__, action, syspath, di->d_name);
+		close(fd);
+	}
+	closedir(dir);
+}
 
-	udev_list_entry_foreach(item,
-				udev_enumerate_get_list_entry(part_enum)) {
-		const char *syspath;
-		struct udev_device *part;
+/*
+ * Synthetic path uevents queued between start_path_triggers() and
+ * flush_path_triggers(). A NULL action records that the path's udev
+ * state already matches its multipath state, and cancels a trigger
+ * queued earlier in the same pass.
+ */
+struct path_trigger {
+	struct udev_device *udev;
+	dev_t devt;
+	unsigned int seq;
+	const char *action;
+};
+
+static pthread_mutex_t triggers_lock = PTHREAD_MUTEX_INITIALIZER;
+static int triggers_depth;
+static unsigned int triggers_seq;
+static vector triggers;
+
+static void send_path_trigger(struct udev_device *dev, const char *action)
+{
+	sysfs_attr_set_value(dev, "uevent", action, strlen(action));
+	trigger_partitions_udev_change(dev, action, strlen(action));
+}
 
-		syspath = udev_list_entry_get_name(item);
-		part = udev_device_new_from_syspath(udev, syspath);
-		if (!part)
-			continue;
+/* Returns true if the trigger is queued and mustn't be sent now */
+static bool queue_path_trigger(struct udev_device *dev, const char *action)
+{
+	struct path_trigger *trg;
+	bool queued = false;
+
+	pthread_mutex_lock(&triggers_lock);
+	if (triggers_depth > 0 && (trg = calloc(1, sizeof(*trg))) != NULL) {
+		if (vector_alloc_slot(triggers)) {
+			trg->udev = udev_device_ref(dev);
+			trg->devt = udev_device_get_devnum(dev);
+			trg->seq = triggers_seq++;
+			trg->action = action;
+			vector_set_slot(triggers, trg);
+			queued = true;
+		} else
+			free(trg);
+	}
+	pthread_mutex_unlock(&triggers_lock);
+	return queued;
+}
+
+void start_path_triggers(void)
+{
+	pthread_mutex_lock(&triggers_lock);
+	if (triggers_depth++ == 0 && !(triggers = vector_alloc()))
+		triggers_depth = 0;
+	pthread_mutex_unlock(&triggers_lock);
+}
+
+static int trigger_cmp(const void *a, const void *b)
+{
+	const struct path_trigger *ta = *(const struct path_trigger * const *)a;
+	const struct path_trigger *tb = *(const struct path_trigger * const *)b;
+
+	if (ta->devt != tb->devt)
+		return ta->devt < tb->devt ? -1 : 1;
+	return ta->seq < tb->seq ? -1 : ta->seq > tb->seq;
+}
+
+void flush_path_triggers(void)
+{
+	struct path_trigger *trg, *next;
+	vector queue = NULL;
+	int i;
+
+	pthread_mutex_lock(&triggers_lock);
+	if (triggers_depth > 0 && --triggers_depth == 0) {
+		queue = triggers;
+		triggers = NULL;
+		triggers_seq = 0;
+	}
+	pthread_mutex_unlock(&triggers_lock);
+	if (!queue)
+		return;
 
-		devtype = udev_device_get_devtype(part);
-		if (devtype && !strcmp("partition", devtype)) {
-			condlog(4, "%s: triggering %s event for %s", __func__,
-				action, syspath);
-			sysfs_attr_set_value(part, "uevent", action, len);
+	/* Only the last decision for every device counts */
+	if (VECTOR_SIZE(queue) > 1)
+		qsort(queue->slot, VECTOR_SIZE(queue), sizeof(void *),
+		      trigger_cmp);
+	vector_foreach_slot(queue, trg, i) {
+		next = i + 1 < VECTOR_SIZE(queue) ? VECTOR_SLOT(queue, i + 1) : NULL;
+		if (trg->action && !(next && next->devt == trg->devt)) {
+			condlog(3, "triggering %s uevent for %s", trg->action,
+				udev_device_get_sysname(trg->udev));
+			send_path_trigger(trg->udev, trg->action);
 		}
-		udev_device_unref(part);
+		udev_device_unref(trg->udev);
+		free(trg);
 	}
-unref:
-	udev_enumerate_unref(part_enum);
+	vector_free(queue);
 }
 
 void
@@ -604,18 +679,24 @@ trigger_paths_udev_change(struct multipath *mpp, bool is_mpath)
 				 */
 				env = udev_device_get_property_value(
 					pp->udev, "FIND_MULTIPATHS_WAIT_UNTIL");
-				if (env == NULL || !strcmp(env, "0"))
+				if (env == NULL || !strcmp(env, "0")) {
+					queue_path_trigger(pp->udev, NULL);
 					continue;
+				}
 			} else if (!is_mpath &&
-				   (env == NULL || !strcmp(env, "0")))
+				   (env == NULL || !strcmp(env, "0"))) {
+				queue_path_trigger(pp->udev, NULL);
 				continue;
+			}
 
+			if (queue_path_trigger(pp->udev, action)) {
+				condlog(4, "queued %s uevent for %s (is %smultipath member)",
+					action, pp->dev, is_mpath ? "" : "no ");
+				continue;
+			}
 			condlog(3, "triggering %s uevent for %s (is %smultipath member)",
 				action, pp->dev, is_mpath ? "" : "no ");
-			sysfs_attr_set_value(pp->udev, "uevent",
-					     action, strlen(action));
-			trigger_partitions_udev_change(pp->udev, action,
-						       strlen(action));
+			send_path_trigger(pp->udev, action);
 		}
 	}
 
@@ -674,6 +755,98 @@ sysfs_set_max_sectors_kb(struct multipath *mpp, int is_reload)
 	return err;
 }
 
+static int set_queue_attr(struct udev_device *udd, const char *dev,
+			  const char *attr, const char *value)
+{
+	ssize_t ret;
+
+	ret = sysfs_attr_set_value(udd, attr, value, strlen(value));
+	if (ret < 0) {
+		condlog(2, "%s: failed to set %s to %s: %s", dev, attr, value,
+			strerror(-ret));
+		return 1;
+	}
+	return 0;
+}
+
+static int set_queue_uint(struct udev_device *udd, const char *dev,
+			  const char *attr, unsigned int value)
+{
+	char buff[11];
+
+	snprintf(buff, sizeof(buff), "%u", value);
+	return set_queue_attr(udd, dev, attr, buff);
+}
+
+/*
+ * The scheduler is set first, because switching the scheduler resets
+ * nr_requests to the default of the new one.
+ */
+static int apply_queue_profile(struct udev_device *udd, const char *dev,
+			       const struct queue_profile *qp)
+{
+	int err = 0;
+
+	if (qp->flags & QP_SCHEDULER)
+		err |= set_queue_attr(udd, dev, "queue/scheduler",
+				      qp->scheduler);
+	if (qp->flags & QP_NR_REQUESTS)
+		err |= set_queue_uint(udd, dev, "queue/nr_requests",
+				      qp->nr_requests);
+	if (qp->flags & QP_READ_AHEAD_KB)
+		err |= set_queue_uint(udd, dev, "queue/read_ahead_kb",
+				      qp->read_ahead_kb);
+	if (qp->flags & QP_RQ_AFFINITY)
+		err |= set_queue_uint(udd, dev, "queue/rq_affinity",
+				      qp->rq_affinity);
+	if (qp->flags & QP_NOMERGES)
+		err |= set_queue_uint(udd, dev, "queue/nomerges",
+				      qp->nomerges);
+	return err;
+}
+
+/*
+ * Called before a table is loaded, so that the paths of a map, including
+ * new ones, never carry I/O of the map with their untuned defaults.
+ */
+static int set_paths_queue_profile(struct multipath *mpp)
+{
+	struct pathgroup *pgp;
+	struct path *pp;
+	int i, j, err = 0;
+
+	if (!mpp->queue_profile.flags)
+		return 0;
+	vector_foreach_slot (mpp->pg, pgp, i) {
+		vector_foreach_slot(pgp->paths, pp, j) {
+			if (pp->udev)
+				err |= apply_queue_profile(pp->udev, pp->dev,
+							   &mpp->queue_profile);
+		}
+	}
+	return err;
+}
+
+/* Called after the table has been loaded, when the map device exists */
+static int set_map_queue_profile(struct multipath *mpp)
+{
+	struct udev_device *udd;
+	int err;
+
+	if (!mpp->queue_profile.flags)
+		return 0;
+	if (!mpp->dmi && dm_get_info(mpp->alias, &mpp->dmi) != 0) {
+		condlog(1, "failed to get dm info for %s", mpp->alias);
+		return 1;
+	}
+	udd = get_udev_for_mpp(mpp);
+	if (!udd)
+		return 1;
+	err = apply_queue_profile(udd, mpp->alias, &mpp->queue_profile);
+	udev_device_unref(udd);
+	return err;
+}
+
 static bool is_udev_ready(struct multipath *cmpp)
 {
 	struct udev_device *mpp_ud;
@@ -788,6 +961,7 @@ void select_action (struct multipath *mpp, const struct _vector *curmp,
 	}
 	if ((mpp->retain_hwhandler != RETAIN_HWHANDLER_ON ||
 	     strcmp(cmpp->hwhandler, "0") == 0) &&
+	    cmpp->hwhandler != mpp->hwhandler &&
 	    (strlen(cmpp->hwhandler) != strlen(mpp->hwhandler) ||
 	     strncmp(cmpp->hwhandler, mpp->hwhandler,
 		    strlen(mpp->hwhandler)))) {
@@ -820,8 +994,9 @@ void select_action (struct multipath *mpp, const struct _vector *curmp,
 	FREE(cmpp_feat);
 	FREE(mpp_feat);
 
-	if (!cmpp->selector || strncmp(cmpp->selector, mpp->selector,
-		    strlen(mpp->selector))) {
+	if (!cmpp->selector || (cmpp->selector != mpp->selector &&
+				strncmp(cmpp->selector, mpp->selector,
+					strlen(mpp->selector)))) {
 		select_reload_action(mpp, "selector change");
 		return;
 	}
@@ -916,9 +1091,47 @@ fail:
 	return 1;
 }
 
-int domap(struct multipath *mpp, char *params, int is_daemon)
+/*
+ * The kernel doesn't report a table exactly like it was loaded (e.g.
+ * path selectors add their default per-path arguments), so assembled
+ * params can't be compared with the live table directly. Instead, the
+ * live table is compared with the table the kernel reported after our
+ * last load of the same params.
+ */
+static bool reload_is_noop(const struct multipath *mpp, const char *params)
+{
+	unsigned long long size;
+	char *table = NULL;
+	bool noop;
+
+	if (mpp->force_udev_reload || !mpp->loaded_params ||
+	    !mpp->loaded_table || mpp->loaded_ro != mpp->force_readonly ||
+	    strcmp(mpp->loaded_params, params))
+		return false;
+	if (dm_get_map(mpp->alias, &size, &table) != DMP_OK)
+		return false;
+	noop = size == mpp->size && !strcmp(table, mpp->loaded_table) &&
+		dm_is_suspended(mpp->alias) == 0;
+	free(table);
+	return noop;
+}
+
+static void record_loaded_table(struct multipath *mpp, const char *params)
+{
+	free(mpp->loaded_params);
+	free(mpp->loaded_table);
+	mpp->loaded_table = NULL;
+	mpp->loaded_params = strdup(params);
+	mpp->loaded_ro = mpp->force_readonly;
+	if (mpp->loaded_params &&
+	    dm_get_map(mpp->alias, NULL, &mpp->loaded_table) != DMP_OK)
+		mpp->loaded_table = NULL;
+}
+
+static int __domap(struct multipath *mpp, char *params, int is_daemon)
 {
 	int r = DOMAP_FAIL;
+	bool loaded = false;
 	struct config *conf;
 
 	/*
@@ -929,6 +1142,13 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 		return DOMAP_DRY;
 	}
 
+	if (is_daemon) {
+		conf = get_multipath_config();
+		mpp->internal_kpartx = conf->internal_kpartx &&
+			mpp->skip_kpartx != SKIP_KPARTX_ON;
+		put_multipath_config(conf);
+	}
+
 	if (mpp->action == ACT_CREATE && dm_map_present(mpp->alias)) {
 		char wwid[WWID_SIZE];
 
@@ -970,33 +1190,50 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 		}
 
 		sysfs_set_max_sectors_kb(mpp, 0);
+		set_paths_queue_profile(mpp);
 		if (is_daemon && mpp->ghost_delay > 0 && count_active_paths(mpp) &&
-		    pathcount(mpp, PATH_UP) == 0)
+		    pathcount(mpp, PATH_UP) == 0) {
 			mpp->ghost_delay_tick = mpp->ghost_delay;
+			schedule_map_timers(mpp);
+		}
 		r = dm_addmap_create(mpp, params);
+		loaded = true;
 
 		lock_multipath(mpp, 0);
 		break;
 
 	case ACT_RELOAD:
-		sysfs_set_max_sectors_kb(mpp, 1);
 		if (mpp->ghost_delay_tick > 0 && pathcount(mpp, PATH_UP))
 			mpp->ghost_delay_tick = 0;
+		if (reload_is_noop(mpp, params)) {
+			condlog(3, "%s: table unchanged, skipping reload",
+				mpp->alias);
+			if (is_daemon)
+				mpp->action = ACT_NOTHING;
+			return DOMAP_EXIST;
+		}
+		sysfs_set_max_sectors_kb(mpp, 1);
+		set_paths_queue_profile(mpp);
 		r = dm_addmap_reload(mpp, params, 0);
+		loaded = true;
 		break;
 
 	case ACT_RESIZE:
 		sysfs_set_max_sectors_kb(mpp, 1);
+		set_paths_queue_profile(mpp);
 		if (mpp->ghost_delay_tick > 0 && pathcount(mpp, PATH_UP))
 			mpp->ghost_delay_tick = 0;
 		r = dm_addmap_reload(mpp, params, 1);
+		loaded = true;
 		break;
 
 	case ACT_RENAME:
 		conf = get_multipath_config();
 		pthread_cleanup_push(put_multipath_config, conf);
 		r = dm_rename(mpp->alias_old, mpp->alias,
-			      conf->partition_delim, mpp->skip_kpartx);
+			      conf->partition_delim,
+			      mpp->internal_kpartx ? SKIP_KPARTX_ON :
+			      mpp->skip_kpartx);
 		pthread_cleanup_pop(1);
 		break;
 
@@ -1004,14 +1241,18 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 		conf = get_multipath_config();
 		pthread_cleanup_push(put_multipath_config, conf);
 		r = dm_rename(mpp->alias_old, mpp->alias,
-			      conf->partition_delim, mpp->skip_kpartx);
+			      conf->partition_delim,
+			      mpp->internal_kpartx ? SKIP_KPARTX_ON :
+			      mpp->skip_kpartx);
 		pthread_cleanup_pop(1);
 		if (r) {
 			sysfs_set_max_sectors_kb(mpp, 1);
+			set_paths_queue_profile(mpp);
 			if (mpp->ghost_delay_tick > 0 &&
 			    pathcount(mpp, PATH_UP))
 				mpp->ghost_delay_tick = 0;
 			r = dm_addmap_reload(mpp, params, 0);
+			loaded = true;
 		}
 		break;
 
@@ -1025,6 +1266,10 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 		 * succeeded
 		 */
 		mpp->force_udev_reload = 0;
+		if (loaded) {
+			record_loaded_table(mpp, params);
+			set_map_queue_profile(mpp);
+		}
 		if (mpp->action == ACT_CREATE &&
 		    (remember_wwid(mpp->wwid) == 1 ||
 		     mpp->needs_paths_uevent))
@@ -1049,6 +1294,7 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 				mpp->wait_for_udev = 1;
 				mpp->uev_wait_tick = conf->uev_wait_timeout;
 				put_multipath_config(conf);
+				schedule_map_timers(mpp);
 			}
 		}
 		dm_setgeometry(mpp);
@@ -1060,6 +1306,16 @@ int domap(struct multipath *mpp, char *params, int is_daemon)
 	return DOMAP_FAIL;
 }
 
+int domap(struct multipath *mpp, char *params, int is_daemon)
+{
+	int action = mpp->action, r;
+
+	TRACE2(domap_start, mpp->alias, action);
+	r = __domap(mpp, params, is_daemon);
+	TRACE3(domap_end, mpp->alias, action, r);
+	return r;
+}
+
 extern int
 check_daemon(void)
 {
@@ -1093,6 +1349,224 @@ out:
 	return ret;
 }
 
+/*
+ * The paths of pathvec grouped by WWID, so that coalesce_paths() can
+ * assemble maps without scanning the entire path vector for every map.
+ * Paths without WWID aren't indexed.
+ */
+struct wwid_bucket {
+	/* indices in pathvec of the first and last path, first < 0 if unused */
+	int first;
+	int last;
+	vector paths;
+};
+
+struct wwid_index {
+	unsigned int mask;
+	struct wwid_bucket *buckets;
+	/* next[k]: index of the next path with the WWID of path k, or -1 */
+	int *next;
+};
+
+static struct wwid_bucket *
+wwid_index_slot(const struct wwid_index *idx, const struct _vector *pathvec,
+		const char *wwid)
+{
+	unsigned int h, hash = wwid_hash(wwid);
+	struct wwid_bucket *b;
+	const struct path *pp;
+
+	/* the table is never more than half full */
+	for (h = hash & idx->mask; ; h = (h + 1) & idx->mask) {
+		b = &idx->buckets[h];
+		if (b->first < 0)
+			return b;
+		pp = VECTOR_SLOT(pathvec, b->first);
+		if (same_wwid(pp->wwid, pp->wwid_hash, wwid, hash))
+			return b;
+	}
+}
+
+static void free_wwid_index(struct wwid_index *idx)
+{
+	unsigned int i;
+
+	if (idx->buckets) {
+		for (i = 0; i <= idx->mask; i++)
+			vector_free(idx->buckets[i].paths);
+		free(idx->buckets);
+		idx->buckets = NULL;
+	}
+	free(idx->next);
+	idx->next = NULL;
+}
+
+static int build_wwid_index(struct wwid_index *idx,
+			    const struct _vector *pathvec)
+{
+	unsigned int i, size = 2;
+	int k, n = VECTOR_SIZE(pathvec);
+	struct wwid_bucket *b;
+	struct path *pp;
+
+	while (size < 2U * n)
+		size <<= 1;
+	idx->mask = size - 1;
+	idx->buckets = calloc(size, sizeof(*idx->buckets));
+	idx->next = malloc(n * sizeof(*idx->next));
+	if (!idx->buckets || !idx->next)
+		goto fail;
+	for (i = 0; i < size; i++)
+		idx->buckets[i].first = -1;
+
+	vector_foreach_slot(pathvec, pp, k) {
+		idx->next[k] = -1;
+		if (!*pp->wwid)
+			continue;
+		b = wwid_index_slot(idx, pathvec, pp->wwid);
+		if (b->first < 0) {
+			b->paths = vector_alloc();
+			if (!b->paths)
+				goto fail;
+			b->first = k;
+		} else
+			idx->next[b->last] = k;
+		b->last = k;
+		if (store_path(b->paths, pp))
+			goto fail;
+	}
+	return 0;
+fail:
+	free_wwid_index(idx);
+	return 1;
+}
+
+/*
+ * Maps set up by coalesce_paths() in the multipath tool, which are
+ * loaded in parallel, see coalesce_paths().
+ */
+struct domap_job {
+	struct multipath *mpp;
+	char *params;
+	int r;
+};
+
+static void run_domap_job(void *item, __attribute__((unused)) void *arg)
+{
+	struct domap_job *job = item;
+
+	job->r = domap(job->mpp, job->params, 0);
+}
+
+/* Maps of jobs which haven't been run are removed */
+static void free_domap_jobs(struct vectors *vecs, vector jobs)
+{
+	struct domap_job *job;
+	int i;
+
+	vector_foreach_slot(jobs, job, i) {
+		if (job->mpp)
+			remove_map(job->mpp, vecs->pathvec, NULL);
+		free(job->params);
+		free(job);
+	}
+	vector_free(jobs);
+}
+
+/*
+ * Handle the domap() result r for mpp, and add mpp to newmp if it's kept.
+ * Returns CP_OK if coalesce_paths() can go on with the next map.
+ */
+static int finish_coalesced_map(struct vectors *vecs, vector newmp,
+				struct multipath *mpp, int r, int is_daemon)
+{
+	struct config *conf;
+	int allow_queueing;
+
+	if (r == DOMAP_FAIL || r == DOMAP_RETRY) {
+		condlog(3, "%s: domap (%u) failure "
+			   "for create/reload map",
+			mpp->alias, r);
+		if (r == DOMAP_FAIL || is_daemon) {
+			condlog(2, "%s: %s map",
+				mpp->alias, (mpp->action == ACT_CREATE)?
+				"ignoring" : "removing");
+			remove_map(mpp, vecs->pathvec, NULL);
+			return CP_OK;
+		} else /* if (r == DOMAP_RETRY && !is_daemon) */
+			return CP_RETRY;
+	}
+	if (r == DOMAP_DRY) {
+		if (!vector_alloc_slot(newmp)) {
+			remove_map(mpp, vecs->pathvec, NULL);
+			return CP_FAIL;
+		}
+		vector_set_slot(newmp, mpp);
+		return CP_OK;
+	}
+
+	conf = get_multipath_config();
+	allow_queueing = conf->allow_queueing;
+	put_multipath_config(conf);
+	if (!is_daemon && !allow_queueing && !check_daemon()) {
+		if (mpp->no_path_retry != NO_PATH_RETRY_UNDEF &&
+		    mpp->no_path_retry != NO_PATH_RETRY_FAIL)
+			condlog(3, "%s: multipathd not running, unset "
+				"queue_if_no_path feature", mpp->alias);
+		if (!dm_queue_if_no_path(mpp->alias, 0))
+			remove_feature(&mpp->features,
+				       "queue_if_no_path");
+	}
+
+	if (!is_daemon && mpp->action != ACT_NOTHING)
+		print_multipath_topology(mpp, libmp_verbosity);
+
+	if (mpp->action != ACT_REJECT) {
+		if (!vector_alloc_slot(newmp)) {
+			remove_map(mpp, vecs->pathvec, NULL);
+			return CP_FAIL;
+		}
+		vector_set_slot(newmp, mpp);
+	}
+	else
+		remove_map(mpp, vecs->pathvec, NULL);
+	return CP_OK;
+}
+
+/*
+ * Load the maps in jobs in parallel, and handle the results in the
+ * order in which the maps were set up.
+ */
+static int run_domap_jobs(struct vectors *vecs, vector newmp, vector jobs)
+{
+	struct worker_pool *pool;
+	struct domap_job *job;
+	struct config *conf;
+	int i, r, ret = CP_OK, nthreads;
+
+	conf = get_multipath_config();
+	nthreads = conf->discovery_threads;
+	put_multipath_config(conf);
+	if (nthreads > VECTOR_SIZE(jobs))
+		nthreads = VECTOR_SIZE(jobs);
+	pool = worker_pool_create(nthreads, "domap");
+	worker_pool_run(pool, jobs, run_domap_job, NULL);
+	worker_pool_destroy(pool);
+
+	vector_foreach_slot(jobs, job, i) {
+		if (ret == CP_FAIL)
+			break;
+		r = finish_coalesced_map(vecs, newmp, job->mpp, job->r, 0);
+		if (r == CP_RETRY) {
+			remove_map(job->mpp, vecs->pathvec, NULL);
+			ret = CP_RETRY;
+		} else if (r == CP_FAIL)
+			ret = CP_FAIL;
+		job->mpp = NULL;
+	}
+	return ret;
+}
+
 /*
  * The force_reload parameter determines how coalesce_paths treats existing maps.
  * FORCE_RELOAD_NONE: existing maps aren't touched at all
@@ -1113,13 +1587,19 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 	vector curmp = vecs->mpvec;
 	vector pathvec = vecs->pathvec;
 	vector newmp;
+	vector jobs = NULL;
+	struct domap_job *job;
 	struct config *conf = NULL;
-	int allow_queueing;
 	struct bitfield *size_mismatch_seen;
+	struct wwid_index idx = { .buckets = NULL, };
+	struct wwid_bucket *bucket;
+	unsigned int refwwid_hash = 0;
 
 	/* ignore refwwid if it's empty */
 	if (refwwid && !strlen(refwwid))
 		refwwid = NULL;
+	if (refwwid)
+		refwwid_hash = wwid_hash(refwwid);
 
 	if (force_reload != FORCE_RELOAD_NONE) {
 		vector_foreach_slot (pathvec, pp1, k) {
@@ -1132,6 +1612,7 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 	size_mismatch_seen = alloc_bitfield(VECTOR_SIZE(pathvec));
 	if (size_mismatch_seen == NULL)
 		return CP_FAIL;
+	start_path_triggers();
 
 	if (mpvec)
 		newmp = mpvec;
@@ -1141,6 +1622,26 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 		condlog(0, "can not allocate newmp");
 		goto out;
 	}
+	/*
+	 * pathvec doesn't change below. remove_map() only frees paths
+	 * in INIT_REMOVED state, which are never adopted by new maps.
+	 */
+	if (build_wwid_index(&idx, pathvec)) {
+		condlog(0, "can not allocate WWID index");
+		goto out;
+	}
+	start_tmo_cache();
+
+	/*
+	 * The multipath tool loads its maps in parallel. The maps are
+	 * independent, as every path is in at most one of them.
+	 */
+	if (!is_daemon && cmd != CMD_DRY_RUN) {
+		conf = get_multipath_config();
+		if (conf->discovery_threads > 1)
+			jobs = vector_alloc();
+		put_multipath_config(conf);
+	}
 
 	vector_foreach_slot (pathvec, pp1, k) {
 		int invalid;
@@ -1178,11 +1679,13 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 		}
 
 		/* 4. path is out of scope */
-		if (refwwid && strncmp(pp1->wwid, refwwid, WWID_SIZE - 1))
+		if (refwwid && !same_wwid(pp1->wwid, pp1->wwid_hash,
+					  refwwid, refwwid_hash))
 			continue;
 
 		/* If find_multipaths was selected check if the path is valid */
-		if (!refwwid && !should_multipath(pp1, pathvec, curmp)) {
+		bucket = wwid_index_slot(&idx, pathvec, pp1->wwid);
+		if (!refwwid && !should_multipath(pp1, bucket->paths, curmp)) {
 			orphan_path(pp1, "only one path");
 			continue;
 		}
@@ -1190,7 +1693,7 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 		/*
 		 * at this point, we know we really got a new mp
 		 */
-		mpp = add_map_with_path(vecs, pp1, 0);
+		mpp = add_map_with_wwid_paths(vecs, pp1, bucket->paths, 0);
 		if (!mpp) {
 			orphan_path(pp1, "failed to create multipath device");
 			continue;
@@ -1202,12 +1705,9 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 			continue;
 		}
 
-		for (i = k + 1; i < VECTOR_SIZE(pathvec); i++) {
+		for (i = idx.next[k]; i >= 0; i = idx.next[i]) {
 			pp2 = VECTOR_SLOT(pathvec, i);
 
-			if (strcmp(pp1->wwid, pp2->wwid))
-				continue;
-
 			if (!mpp->size && pp2->size)
 				mpp->size = pp2->size;
 
@@ -1236,62 +1736,37 @@ int coalesce_paths (struct vectors *vecs, vector mpvec, char *refwwid,
 			select_action(mpp, curmp,
 				      force_reload == FORCE_RELOAD_YES ? 1 : 0);
 
-		r = domap(mpp, params, is_daemon);
-		free(params);
-		params = NULL;
-
-		if (r == DOMAP_FAIL || r == DOMAP_RETRY) {
-			condlog(3, "%s: domap (%u) failure "
-				   "for create/reload map",
-				mpp->alias, r);
-			if (r == DOMAP_FAIL || is_daemon) {
-				condlog(2, "%s: %s map",
-					mpp->alias, (mpp->action == ACT_CREATE)?
-					"ignoring" : "removing");
-				remove_map(mpp, vecs->pathvec, NULL);
-				continue;
-			} else /* if (r == DOMAP_RETRY && !is_daemon) */ {
-				ret = CP_RETRY;
-				goto out;
-			}
-		}
-		if (r == DOMAP_DRY) {
-			if (!vector_alloc_slot(newmp)) {
+		if (jobs) {
+			job = calloc(1, sizeof(*job));
+			if (!job || !vector_alloc_slot(jobs)) {
+				free(job);
 				remove_map(mpp, vecs->pathvec, NULL);
 				goto out;
 			}
-			vector_set_slot(newmp, mpp);
+			job->mpp = mpp;
+			job->params = params;
+			params = NULL;
+			vector_set_slot(jobs, job);
 			continue;
 		}
 
-		conf = get_multipath_config();
-		allow_queueing = conf->allow_queueing;
-		put_multipath_config(conf);
-		if (!is_daemon && !allow_queueing && !check_daemon()) {
-			if (mpp->no_path_retry != NO_PATH_RETRY_UNDEF &&
-			    mpp->no_path_retry != NO_PATH_RETRY_FAIL)
-				condlog(3, "%s: multipathd not running, unset "
-					"queue_if_no_path feature", mpp->alias);
-			if (!dm_queue_if_no_path(mpp->alias, 0))
-				remove_feature(&mpp->features,
-					       "queue_if_no_path");
-		}
-
-		if (!is_daemon && mpp->action != ACT_NOTHING)
-			print_multipath_topology(mpp, libmp_verbosity);
+		r = domap(mpp, params, is_daemon);
+		free(params);
+		params = NULL;
 
-		if (mpp->action != ACT_REJECT) {
-			if (!vector_alloc_slot(newmp)) {
-				remove_map(mpp, vecs->pathvec, NULL);
-				goto out;
-			}
-			vector_set_slot(newmp, mpp);
+		r = finish_coalesced_map(vecs, newmp, mpp, r, is_daemon);
+		if (r != CP_OK) {
+			ret = r;
+			goto out;
 		}
-		else
-			remove_map(mpp, vecs->pathvec, NULL);
 	}
-	ret = CP_OK;
+	ret = jobs ? run_domap_jobs(vecs, newmp, jobs) : CP_OK;
 out:
+	if (jobs)
+		free_domap_jobs(vecs, jobs);
+	flush_path_triggers();
+	end_tmo_cache();
+	free_wwid_index(&idx);
 	free(size_mismatch_seen);
 	if (!mpvec)
 		free_multipathvec(newmp, KEEP_PATHS);
@@ -1413,11 +1888,10 @@ static int _get_refwwid(enum mpath_cmds cmd, const char *dev,
 
 		/* or may be an alias */
 		else {
-			refwwid = get_mpe_wwid(conf->mptable, dev);
+			struct mpentry *mpe = find_mpe_by_alias(conf, dev);
 
 			/* or directly a wwid */
-			if (!refwwid)
-				refwwid = dev;
+			refwwid = mpe ? mpe->wwid : dev;
 		}
 
 		if (flags & DI_BLACKLIST && refwwid && strlen(refwwid) &&
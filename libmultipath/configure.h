@@ -59,4 +59,13 @@ struct udev_device *get_udev_device(const char *dev, enum devtypes dev_type);
 void trigger_paths_udev_change(struct multipath *mpp, bool is_mpath);
 void trigger_partitions_udev_change(struct udev_device *dev, const char *action,
 				    int len);
+/*
+ * Between these calls, the uevents of trigger_paths_udev_change() are
+ * queued and sent once per device by the outermost flush_path_triggers(),
+ * with the action of the last call for the device. Paths whose udev state
+ * turned out to match their multipath state again get no uevent. The
+ * calls may be nested, and coalesce_paths() uses them for its pass.
+ */
+void start_path_triggers(void);
+void flush_path_triggers(void);
 int check_daemon(void);
@@ -9,6 +9,7 @@
 #include "log_pthread.h"
 #include <sys/types.h>
 #include <time.h>
+#include <pthread.h>
 #include "../third-party/valgrind/drd.h"
 #include "vector.h"
 #include "config.h"
@@ -19,12 +20,32 @@
 
 int logsink;
 int libmp_verbosity = DEFAULT_VERBOSITY;
+unsigned int log_rate_limit = DEFAULT_LOG_RATE_LIMIT;
 
-void dlog(int prio, const char * fmt, ...)
-{
-	va_list ap;
+/*
+ * Rate limiting state, in a fixed size hash table. A key that is
+ * hashed to a used slot evicts the previous key, after logging its
+ * summary. This bounds the memory, at the cost of rate limiting less
+ * if many devices log at the same time.
+ */
+#define LOG_RATELIMIT_SLOTS 512
+#define LOG_RATELIMIT_DEV_SIZE 32
 
-	va_start(ap, fmt);
+struct log_ratelimit_slot {
+	uintptr_t id;
+	char dev[LOG_RATELIMIT_DEV_SIZE];
+	time_t start;
+	unsigned int count;
+	unsigned int suppressed;
+	int prio;
+};
+
+static pthread_mutex_t ratelimit_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ratelimit_slot ratelimit_slots[LOG_RATELIMIT_SLOTS];
+
+static void vdlog(int prio, const struct log_fields *fields,
+		  const char * fmt, va_list ap)
+{
 	if (logsink != LOGSINK_SYSLOG) {
 		if (logsink == LOGSINK_STDERR_WITH_TIME) {
 			struct timespec ts;
@@ -39,6 +60,100 @@ void dlog(int prio, const char * fmt, ...)
 		vfprintf(stderr, fmt, ap);
 	}
 	else
-		log_safe(prio + 3, fmt, ap);
+		log_safe_fields(prio + 3, fields, fmt, ap);
+}
+
+void dlog(int prio, const char * fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vdlog(prio, NULL, fmt, ap);
+	va_end(ap);
+}
+
+void dlog_fields(int prio, const struct log_fields *fields,
+		 const char * fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vdlog(prio, fields, fmt, ap);
 	va_end(ap);
 }
+
+static unsigned int ratelimit_hash(const char *dev, uintptr_t id)
+{
+	/* FNV-1a */
+	unsigned int h = 2166136261U;
+
+	for (; *dev; dev++)
+		h = (h ^ (unsigned char)*dev) * 16777619U;
+	h = (h ^ (unsigned int)id) * 16777619U;
+	h = (h ^ (unsigned int)((unsigned long long)id >> 32)) * 16777619U;
+	return h % LOG_RATELIMIT_SLOTS;
+}
+
+/* Called with ratelimit_lock held */
+static void end_ratelimit_window(struct log_ratelimit_slot *s)
+{
+	if (s->suppressed)
+		dlog(s->prio, "%s: %u similar messages suppressed\n",
+		     s->dev, s->suppressed);
+	s->count = 0;
+	s->suppressed = 0;
+}
+
+bool log_ratelimit(int prio, const char *dev, uintptr_t id)
+{
+	struct log_ratelimit_slot *s;
+	struct timespec now;
+	bool ok = true;
+
+	if (!log_rate_limit || !dev)
+		return true;
+
+	get_monotonic_time(&now);
+	s = &ratelimit_slots[ratelimit_hash(dev, id)];
+	pthread_mutex_lock(&ratelimit_lock);
+	if (s->id != id || strncmp(s->dev, dev, sizeof(s->dev))) {
+		end_ratelimit_window(s);
+		s->id = id;
+		strlcpy(s->dev, dev, sizeof(s->dev));
+		s->start = now.tv_sec;
+	} else if (now.tv_sec - s->start >= LOG_RATELIMIT_SECS) {
+		end_ratelimit_window(s);
+		s->start = now.tv_sec;
+	}
+	if (s->count < log_rate_limit)
+		s->count++;
+	else {
+		/* the summary has the priority of the most severe message */
+		if (!s->suppressed++ || prio < s->prio)
+			s->prio = prio;
+		ok = false;
+	}
+	pthread_mutex_unlock(&ratelimit_lock);
+	return ok;
+}
+
+void log_ratelimit_flush(void)
+{
+	struct log_ratelimit_slot *s;
+	struct timespec now;
+
+	if (!log_rate_limit)
+		return;
+
+	get_monotonic_time(&now);
+	pthread_mutex_lock(&ratelimit_lock);
+	for (s = ratelimit_slots; s < ratelimit_slots + LOG_RATELIMIT_SLOTS;
+	     s++) {
+		if (s->suppressed &&
+		    now.tv_sec - s->start >= LOG_RATELIMIT_SECS) {
+			end_ratelimit_window(s);
+			s->start = now.tv_sec;
+		}
+	}
+	pthread_mutex_unlock(&ratelimit_lock);
+}
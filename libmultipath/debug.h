@@ -1,17 +1,36 @@
 #ifndef _DEBUG_H
 #define _DEBUG_H
+/* What a message is about, for the journal. Members may be NULL */
+struct log_fields {
+	const char *dev;
+	const char *map;
+	const char *wwid;
+};
+
 void dlog (int prio, const char *fmt, ...)
 	__attribute__((format(printf, 2, 3)));
+/* Like dlog(), with journal fields, see log_use_journal in log.h */
+void dlog_fields (int prio, const struct log_fields *fields,
+		  const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
 
 
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #include "log_pthread.h"
 
 extern int logsink;
 extern int libmp_verbosity;
+/* messages per device and message per LOG_RATELIMIT_SECS, 0 = unlimited */
+extern unsigned int log_rate_limit;
 
+/*
+ * Messages above MAX_VERBOSITY are compiled out. Set it with
+ * "make MAX_VERBOSITY=n".
+ */
 #ifndef MAX_VERBOSITY
 #define MAX_VERBOSITY 4
 #endif
@@ -22,11 +41,52 @@ enum {
 	LOGSINK_SYSLOG = 1,
 };
 
+/*
+ * True if condlog() would print a message of priority prio. Use this to
+ * skip work that is only done for the sake of logging. With a constant
+ * prio above MAX_VERBOSITY, the compiler removes the guarded code.
+ */
+#define condlog_enabled(prio)						\
+	((prio) <= MAX_VERBOSITY && (prio) <= libmp_verbosity)
+
 #define condlog(prio, fmt, args...)					\
 	do {								\
 		int __p = (prio);					\
 									\
-		if (__p <= MAX_VERBOSITY && __p <= libmp_verbosity)	\
+		if (condlog_enabled(__p))				\
 			dlog(__p, fmt "\n", ##args);			\
 	} while (0)
+
+#define LOG_RATELIMIT_SECS 60
+/*
+ * True if a message with the given id may be logged for dev, i.e. if
+ * fewer than log_rate_limit of them have been logged in the current
+ * LOG_RATELIMIT_SECS window. Otherwise, the message is counted, and
+ * a summary is logged when the window ends. See log_ratelimit_flush().
+ */
+bool log_ratelimit(int prio, const char *dev, uintptr_t id);
+/* Log the summaries of all windows that have ended */
+void log_ratelimit_flush(void);
+
+/*
+ * Like condlog(), rate limited per device and id, with the journal
+ * fields in the struct log_fields fields points to. condlog_rl() only
+ * sets the device field. condlog_dev() uses the format string as id,
+ * for messages that repeat per device, e.g. if a path fails in every
+ * check.
+ */
+#define condlog_fields(prio, fields, id, fmt, args...)			\
+	do {								\
+		int __p = (prio);					\
+		const struct log_fields *__f = (fields);		\
+									\
+		if (condlog_enabled(__p) &&				\
+		    log_ratelimit(__p, __f->dev, id))			\
+			dlog_fields(__p, __f, fmt "\n", ##args);	\
+	} while (0)
+#define condlog_rl(prio, _dev, id, fmt, args...)			\
+	condlog_fields(prio, (&(const struct log_fields){ .dev = (_dev) }), \
+		       id, fmt, ##args)
+#define condlog_dev(prio, dev, fmt, args...)				\
+	condlog_rl(prio, dev, (uintptr_t)fmt, fmt, ##args)
 #endif /* _DEBUG_H */
@@ -22,6 +22,8 @@
 #define DEFAULT_RR_WEIGHT	RR_WEIGHT_NONE
 #define DEFAULT_NO_PATH_RETRY	NO_PATH_RETRY_UNDEF
 #define DEFAULT_VERBOSITY	2
+#define DEFAULT_LOG_RATE_LIMIT	0
+#define DEFAULT_LOG_JOURNAL	YN_NO
 #define DEFAULT_REASSIGN_MAPS	0
 #define DEFAULT_FIND_MULTIPATHS	FIND_MULTIPATHS_STRICT
 #define DEFAULT_FAST_IO_FAIL	5
@@ -47,13 +49,43 @@
 #define UNSET_PARTITION_DELIM "/UNSET/"
 #define DEFAULT_PARTITION_DELIM	NULL
 #define DEFAULT_SKIP_KPARTX SKIP_KPARTX_OFF
+#define DEFAULT_SELECTOR_AUTOTUNE YNU_NO
 #define DEFAULT_DISABLE_CHANGED_WWIDS 1
 #define DEFAULT_MAX_SECTORS_KB MAX_SECTORS_KB_UNDEF
 #define DEFAULT_GHOST_DELAY GHOST_DELAY_OFF
+#define DEFAULT_FAST_CHECKINT FAST_CHECKINT_OFF
+/* Lower limit for fast_polling_interval, in ms */
+#define MIN_FAST_CHECKINT 100
+#define DEFAULT_ARRAY_CHECK_RATE NU_NO
 #define DEFAULT_FIND_MULTIPATHS_TIMEOUT -10
 #define DEFAULT_UNKNOWN_FIND_MULTIPATHS_TIMEOUT 1
 #define DEFAULT_ALL_TG_PT ALL_TG_PT_OFF
 #define DEFAULT_RECHECK_WWID RECHECK_WWID_OFF
+#define DEFAULT_CHECKER_THREADS	1
+#define MAX_CHECKER_THREADS	64
+#define DEFAULT_DISCOVERY_THREADS	8
+#define DEFAULT_UEVENT_THREADS	4
+#define DEFAULT_INTERNAL_KPARTX	0
+#define DEFAULT_VPD_CACHE	YN_NO
+#define DEFAULT_ALUA_PRIO_REFRESH	0
+#define DEFAULT_PRIO_MAX_AGE	0
+#define DEFAULT_ASYNC_PRIO	YN_NO
+#define DEFAULT_RECHECK_SIBLINGS	YN_NO
+#define DEFAULT_NUMA_AFFINITY	YN_NO
+#define DEFAULT_UNIFIED_EVENT_LOOP	YN_NO
+#define DEFAULT_PUBLISH_STATE	YN_NO
+#define DEFAULT_WARM_RESTART	YN_NO
+#define DEFAULT_IO_STATS	YN_NO
+#define DEFAULT_MLOCK_MEMORY	MLOCK_MEMORY_YES
+#define DEFAULT_WWIDS_INDEX	0
+#define DEFAULT_ADAPTIVE_CHECKINT 0
+#define DEFAULT_MAX_CHECK_RATE	0
+#define DEFAULT_UEV_BATCH_MIN_WAIT	10
+#define DEFAULT_UEV_BATCH_MAX_WAIT	1000
+#define DEFAULT_UEV_BATCH_MAX_EVENTS	2048
+#define DEFAULT_UEV_BATCH_MAX_TIME	30000
+#define DEFAULT_RECONFIGURE_DEBOUNCE	0
+#define DEFAULT_RELOAD_DEBOUNCE	0
 /* Enable no foreign libraries by default */
 #define DEFAULT_ENABLE_FOREIGN "NONE"
 
@@ -63,6 +95,8 @@
 #define DEV_LOSS_TMO_UNSET	0U
 #define MAX_DEV_LOSS_TMO	UINT_MAX
 #define DEFAULT_PIDFILE		"/" RUN_DIR "/multipathd.pid"
+#define DEFAULT_VALID_CACHE_DIR	"/" RUN_DIR "/multipath/valid"
+#define DEFAULT_DM_VERSIONS_CACHE "/" RUN_DIR "/multipath/dm-versions"
 #define DEFAULT_SOCKET		"/org/kernel/linux/storage/multipathd"
 #define DEFAULT_CONFIGFILE	"/etc/multipath.conf"
 #define DEFAULT_BINDINGS_FILE	"/etc/multipath/bindings"
@@ -14,6 +14,8 @@
 #include <errno.h>
 #include <syslog.h>
 #include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 #include <linux/dm-ioctl.h>
 
 #include "util.h"
@@ -28,6 +30,11 @@
 #include "wwids.h"
 #include "version.h"
 #include "time-util.h"
+#include "trace.h"
+#include "list.h"
+#include "file.h"
+#include "defaults.h"
+#include "dm-direct.h"
 
 #include "log_pthread.h"
 #include <sys/types.h>
@@ -72,8 +79,15 @@ static void dm_udev_set_sync_support(int c)
 {
 }
 #else
+/*
+ * Without udev sync support (multipathd, see libmp_udev_set_sync_support())
+ * libdm hands out cookie 0 and there's nothing to wait for; don't contend
+ * for libmp_dm_lock in that case.
+ */
 static void libmp_udev_wait(unsigned int c)
 {
+	if (!c)
+		return;
 	pthread_mutex_lock(&libmp_dm_lock);
 	pthread_cleanup_push(cleanup_mutex, &libmp_dm_lock);
 	dm_udev_wait(c);
@@ -81,6 +95,41 @@ static void libmp_udev_wait(unsigned int c)
 }
 #endif
 
+/*
+ * Cookie shared by the dm operations of the calling thread between
+ * dm_udev_batch_start() and dm_udev_batch_end(). libdevmapper counts the
+ * udev notifications for all operations using the same cookie, so a
+ * single wait covers them all.
+ */
+static __thread int udev_batch;
+static __thread uint32_t udev_batch_cookie;
+
+static uint32_t *udev_cookie(uint32_t *cookie)
+{
+	return udev_batch ? &udev_batch_cookie : cookie;
+}
+
+static void udev_cookie_wait(uint32_t cookie)
+{
+	if (!udev_batch)
+		libmp_udev_wait(cookie);
+}
+
+void dm_udev_batch_start(void)
+{
+	udev_batch++;
+}
+
+void dm_udev_batch_end(void)
+{
+	if (!udev_batch || --udev_batch > 0)
+		return;
+	if (udev_batch_cookie) {
+		libmp_udev_wait(udev_batch_cookie);
+		udev_batch_cookie = 0;
+	}
+}
+
 int libmp_dm_task_run(struct dm_task *dmt)
 {
 	int r;
@@ -106,6 +155,9 @@ dm_write_log (int level, const char *file, int line, const char *f, ...)
 
 	if (level > dm_conf_verbosity)
 		return;
+	/* libdm doesn't say which device a message is about */
+	if (!log_ratelimit(level >= LOG_ERR ? level - LOG_ERR : 0, file, line))
+		return;
 
 	va_start(ap, f);
 	if (logsink != LOGSINK_SYSLOG) {
@@ -277,14 +329,126 @@ static int dm_tgt_prereq (unsigned int *ver)
 	return 1;
 }
 
+/*
+ * The kernel driver and target versions are cached in a file, so that
+ * short-lived processes (multipath -u, libmpathvalid users) don't need
+ * to ask the kernel for them. The cache entry is keyed on the boot id,
+ * the kernel release, and the sysfs inodes of the dm_mod and
+ * dm_multipath modules, which change if a module is reloaded. If
+ * either module is built in or not loaded, the cache isn't used.
+ */
+#define DM_VERSIONS_MAGIC "MPDMVER1"
+
+static int dm_versions_key(char *buf, size_t len)
+{
+	char boot_id[64];
+	struct utsname name;
+	struct stat st_dm, st_mpath;
+	FILE *f;
+	size_t n;
+
+	if (stat("/sys/module/dm_mod", &st_dm) != 0 ||
+	    stat("/sys/module/dm_multipath", &st_mpath) != 0)
+		return -1;
+	f = fopen("/proc/sys/kernel/random/boot_id", "r");
+	if (!f)
+		return -1;
+	if (!fgets(boot_id, sizeof(boot_id), f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	n = strlen(boot_id);
+	if (n > 0 && boot_id[n - 1] == '\n')
+		boot_id[n - 1] = '\0';
+	uname(&name);
+	return safe_snprintf(buf, len, "%s %s %lu %lu", boot_id, name.release,
+			     (unsigned long)st_dm.st_ino,
+			     (unsigned long)st_mpath.st_ino);
+}
+
+static int read_dm_versions_cache(const char *key)
+{
+	char line[LINE_MAX];
+	unsigned int kv[3], tv[3];
+	FILE *f;
+	int r = -1;
+	size_t n;
+
+	f = fopen(DEFAULT_DM_VERSIONS_CACHE, "r");
+	if (!f)
+		return -1;
+	if (!fgets(line, sizeof(line), f) ||
+	    strcmp(line, DM_VERSIONS_MAGIC "\n") ||
+	    !fgets(line, sizeof(line), f))
+		goto out;
+	n = strlen(line);
+	if (n == 0 || line[n - 1] != '\n')
+		goto out;
+	line[n - 1] = '\0';
+	if (strcmp(line, key) ||
+	    fscanf(f, "%u.%u.%u %u.%u.%u", &kv[0], &kv[1], &kv[2],
+		   &tv[0], &tv[1], &tv[2]) != 6)
+		goto out;
+	memcpy(dm_kernel_version, kv, sizeof(dm_kernel_version));
+	memcpy(dm_mpath_target_version, tv, sizeof(dm_mpath_target_version));
+	r = 0;
+out:
+	fclose(f);
+	return r;
+}
+
+static void write_dm_versions_cache(const char *key)
+{
+	char tmp[] = DEFAULT_DM_VERSIONS_CACHE ".XXXXXX";
+	int fd;
+	FILE *f;
+
+	if (ensure_directories_exist(DEFAULT_DM_VERSIONS_CACHE, 0700))
+		return;
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		goto fail;
+	}
+	fprintf(f, DM_VERSIONS_MAGIC "\n%s\n%u.%u.%u %u.%u.%u\n", key,
+		dm_kernel_version[0], dm_kernel_version[1],
+		dm_kernel_version[2], dm_mpath_target_version[0],
+		dm_mpath_target_version[1], dm_mpath_target_version[2]);
+	if (fclose(f) != 0 || rename(tmp, DEFAULT_DM_VERSIONS_CACHE) != 0)
+		goto fail;
+	return;
+fail:
+	condlog(3, "failed to write %s: %m", DEFAULT_DM_VERSIONS_CACHE);
+	unlink(tmp);
+}
+
 static void _init_versions(void)
 {
+	char key[LINE_MAX];
+	bool cacheable;
+
 	/* Can't use condlog here because of how VERSION_STRING is defined */
-	if (3 <= libmp_verbosity)
+	if (condlog_enabled(3))
 		dlog(3, VERSION_STRING);
 	init_dm_library_version();
+
+	cacheable = dm_versions_key(key, sizeof(key)) == 0;
+	if (cacheable && read_dm_versions_cache(key) == 0) {
+		condlog(3, "kernel device mapper v%u.%u.%u, multipath v%u.%u.%u (cached)",
+			dm_kernel_version[0], dm_kernel_version[1],
+			dm_kernel_version[2], dm_mpath_target_version[0],
+			dm_mpath_target_version[1], dm_mpath_target_version[2]);
+		return;
+	}
 	init_dm_drv_version();
 	init_dm_mpath_version();
+	if (cacheable && dm_kernel_version[0] != INVALID_VERSION &&
+	    dm_mpath_target_version[0] != INVALID_VERSION)
+		write_dm_versions_cache(key);
 }
 
 static int init_versions(void) {
@@ -343,6 +507,7 @@ void libmp_udev_set_sync_support(int on)
 static bool libmp_dm_init_called;
 void libmp_dm_exit(void)
 {
+	cleanup_dm_direct();
 	if (!libmp_dm_init_called)
 		return;
 
@@ -413,7 +578,7 @@ dm_simplecmd (int task, const char *name, int no_flush, int need_sync,
 		dm_task_deferred_remove(dmt);
 #endif
 	if (udev_wait_flag &&
-	    !dm_task_set_cookie(dmt, &cookie,
+	    !dm_task_set_cookie(dmt, udev_cookie(&cookie),
 				DM_UDEV_DISABLE_LIBRARY_FALLBACK | udev_flags))
 		goto out;
 
@@ -422,7 +587,7 @@ dm_simplecmd (int task, const char *name, int no_flush, int need_sync,
 		dm_log_error(2, task, dmt);
 
 	if (udev_wait_flag)
-			libmp_udev_wait(cookie);
+			udev_cookie_wait(cookie);
 out:
 	dm_task_destroy (dmt);
 	return r;
@@ -506,7 +671,7 @@ dm_addmap (int task, const char *target, struct multipath *mpp,
 	dm_task_no_open_count(dmt);
 
 	if (task == DM_DEVICE_CREATE &&
-	    !dm_task_set_cookie(dmt, &cookie, udev_flags))
+	    !dm_task_set_cookie(dmt, udev_cookie(&cookie), udev_flags))
 		goto freeout;
 
 	r = libmp_dm_task_run (dmt);
@@ -514,7 +679,7 @@ dm_addmap (int task, const char *target, struct multipath *mpp,
 		dm_log_error(2, task, dmt);
 
 	if (task == DM_DEVICE_CREATE)
-			libmp_udev_wait(cookie);
+			udev_cookie_wait(cookie);
 freeout:
 	if (prefixed_uuid)
 		FREE(prefixed_uuid);
@@ -528,7 +693,7 @@ addout:
 static uint16_t build_udev_flags(const struct multipath *mpp, int reload)
 {
 	/* DM_UDEV_DISABLE_LIBRARY_FALLBACK is added in dm_addmap */
-	return	(mpp->skip_kpartx == SKIP_KPARTX_ON ?
+	return	(mpp->skip_kpartx == SKIP_KPARTX_ON || mpp->internal_kpartx ?
 		 MPATH_UDEV_NO_KPARTX_FLAG : 0) |
 		((count_active_pending_paths(mpp) == 0 ||
 		  mpp->ghost_delay_tick > 0) ?
@@ -770,6 +935,14 @@ int dm_get_status(const char *name, char **outstatus)
 	char *target_type = NULL;
 	char *status = NULL;
 
+	r = dm_direct_status(name, outstatus);
+	if (r != DM_DIRECT_FALLBACK) {
+		if (r != DMP_OK)
+			condlog(0, "%s: error getting map status string", name);
+		return r;
+	}
+	r = DMP_ERR;
+
 	if (!(dmt = libmp_dm_task_create(DM_DEVICE_STATUS)))
 		return r;
 
@@ -1165,6 +1338,12 @@ int dm_flush_maps (int need_suspend, int retries)
 	if (!names->dev)
 		goto out;
 
+	/*
+	 * Look up partitions in a single device list, and wait for udev
+	 * once at the end.
+	 */
+	dm_partmaps_cache_start();
+	dm_udev_batch_start();
 	do {
 		if (need_suspend)
 			r |= dm_suspend_and_flush_map(names->name, retries);
@@ -1173,6 +1352,8 @@ int dm_flush_maps (int need_suspend, int retries)
 		next = names->next;
 		names = (void *) names + next;
 	} while (next);
+	dm_udev_batch_end();
+	dm_partmaps_cache_end();
 
 out:
 	dm_task_destroy (dmt);
@@ -1185,6 +1366,16 @@ dm_message(const char * mapname, char * message)
 	int r = 1;
 	struct dm_task *dmt;
 
+	TRACE2(dm_message_start, mapname, message);
+	r = dm_direct_message(mapname, message);
+	if (r != DM_DIRECT_FALLBACK) {
+		TRACE3(dm_message_end, mapname, message, r ? 1 : 0);
+		if (r)
+			condlog(0, "DM message failed [%s]", message);
+		return r ? 1 : 0;
+	}
+	r = 1;
+
 	if (!(dmt = libmp_dm_task_create(DM_DEVICE_TARGET_MSG)))
 		return 1;
 
@@ -1200,9 +1391,11 @@ dm_message(const char * mapname, char * message)
 	dm_task_no_open_count(dmt);
 
 	if (!libmp_dm_task_run(dmt)) {
+		TRACE3(dm_message_end, mapname, message, 1);
 		dm_log_error(2, DM_DEVICE_TARGET_MSG, dmt);
 		goto out;
 	}
+	TRACE3(dm_message_end, mapname, message, 0);
 
 	r = 0;
 out:
@@ -1224,6 +1417,37 @@ dm_fail_path(const char * mapname, char * path)
 	return dm_message(mapname, message);
 }
 
+int dm_message_response(const char *mapname, const char *message,
+			char **response)
+{
+	struct dm_task *dmt;
+	const char *resp;
+	int r = 1;
+
+	*response = NULL;
+	if (!(dmt = libmp_dm_task_create(DM_DEVICE_TARGET_MSG)))
+		return 1;
+
+	if (!dm_task_set_name(dmt, mapname) ||
+	    !dm_task_set_sector(dmt, 0) ||
+	    !dm_task_set_message(dmt, message))
+		goto out;
+
+	dm_task_no_open_count(dmt);
+
+	if (!libmp_dm_task_run(dmt)) {
+		dm_log_error(3, DM_DEVICE_TARGET_MSG, dmt);
+		goto out;
+	}
+	resp = dm_task_get_message_response(dmt);
+	*response = strdup(resp ? resp : "");
+	if (*response)
+		r = 0;
+out:
+	dm_task_destroy(dmt);
+	return r;
+}
+
 int
 dm_reinstate_path(const char * mapname, char * path)
 {
@@ -1277,29 +1501,102 @@ dm_disablegroup(const char * mapname, int index)
 	return dm_groupmsg("disable", mapname, index);
 }
 
-struct multipath *dm_get_multipath(const char *name)
+/*
+ * Set up a struct multipath for the map name with a single DM_DEVICE_TABLE
+ * ioctl, which returns the info and uuid of the map along with its table.
+ * The table is kept in mpp->cached_params for update_multipath_table().
+ * With mpath_only set, maps which aren't multipath maps are skipped.
+ * Returns DMP_OK, DMP_NOT_FOUND if the map doesn't exist, was skipped or
+ * couldn't be queried, or DMP_ERR if memory allocation failed.
+ */
+static int
+dm_get_multipath_table(const char *name, bool mpath_only,
+		       struct multipath **mpp_p)
 {
-	struct multipath *mpp = NULL;
+	struct dm_task *dmt;
+	struct dm_info info;
+	struct multipath *mpp;
+	uint64_t start, length;
+	char *target_type = NULL;
+	char *params = NULL;
+	const char *uuid;
+	bool mpath_uuid;
+	int r = DMP_NOT_FOUND;
 
-	mpp = alloc_multipath();
-	if (!mpp)
-		return NULL;
+	*mpp_p = NULL;
+	if (!(dmt = libmp_dm_task_create(DM_DEVICE_TABLE)))
+		return DMP_ERR;
 
-	mpp->alias = STRDUP(name);
+	if (!dm_task_set_name(dmt, name))
+		goto out;
 
-	if (!mpp->alias)
+	dm_task_no_open_count(dmt);
+
+	if (!libmp_dm_task_run(dmt)) {
+		dm_log_error(3, DM_DEVICE_TABLE, dmt);
 		goto out;
+	}
 
-	if (dm_get_map(name, &mpp->size, NULL) != DMP_OK)
+	if (!dm_task_get_info(dmt, &info) || !info.exists)
 		goto out;
 
-	dm_get_uuid(name, mpp->wwid, WWID_SIZE);
-	dm_get_info(name, &mpp->dmi);
+	uuid = dm_task_get_uuid(dmt);
+	mpath_uuid = uuid && !strncmp(uuid, UUID_PREFIX, UUID_PREFIX_LEN);
+	if (mpath_only && !mpath_uuid)
+		goto out;
 
-	return mpp;
+	/* Fetch 1st target */
+	if (dm_get_next_target(dmt, NULL, &start, &length,
+			       &target_type, &params) != NULL)
+		/* more than one target */
+		goto out;
+
+	if (mpath_only && (!target_type || strcmp(target_type, TGT_MPATH)))
+		goto out;
+
+	r = DMP_ERR;
+	mpp = alloc_multipath();
+	if (!mpp)
+		goto out;
+	mpp->alias = STRDUP(name);
+	mpp->dmi = MALLOC(sizeof(*mpp->dmi));
+	if (params)
+		mpp->cached_params = strdup(params);
+	if (!mpp->alias || !mpp->dmi || (params && !mpp->cached_params)) {
+		free_multipath(mpp, KEEP_PATHS);
+		goto out;
+	}
+	mpp->size = length;
+	memcpy(mpp->dmi, &info, sizeof(info));
+	if (mpath_uuid) {
+		strlcpy(mpp->wwid, uuid + UUID_PREFIX_LEN, WWID_SIZE);
+		hash_map_wwid(mpp);
+	}
+
+	*mpp_p = mpp;
+	r = DMP_OK;
 out:
-	free_multipath(mpp, KEEP_PATHS);
-	return NULL;
+	dm_task_destroy(dmt);
+	return r;
+}
+
+struct multipath *dm_get_multipath(const char *name)
+{
+	struct multipath *mpp;
+
+	dm_get_multipath_table(name, false, &mpp);
+	return mpp;
+}
+
+static int count_dm_names(struct dm_names *names)
+{
+	int n = 1;
+
+	while (names->next) {
+		names = (void *)names + names->next;
+		n++;
+	}
+	return n;
 }
 
 int
@@ -1332,13 +1629,18 @@ dm_get_maps (vector mp)
 		goto out;
 	}
 
+	if (!vector_reserve(mp, VECTOR_SIZE(mp) + count_dm_names(names)))
+		goto out;
+
 	do {
-		if (dm_is_mpath(names->name) != 1)
+		switch (dm_get_multipath_table(names->name, true, &mpp)) {
+		case DMP_OK:
+			break;
+		case DMP_NOT_FOUND:
 			goto next;
-
-		mpp = dm_get_multipath(names->name);
-		if (!mpp)
+		default:
 			goto out;
+		}
 
 		if (!vector_alloc_slot(mp)) {
 			free_multipath(mpp, KEEP_PATHS);
@@ -1359,6 +1661,68 @@ out:
 	return r;
 }
 
+static int name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+vector dm_get_map_names(void)
+{
+	struct dm_task *dmt;
+	struct dm_names *names;
+	unsigned next = 0;
+	vector v;
+	char *name;
+
+	if (!(v = vector_alloc()))
+		return NULL;
+
+	if (!(dmt = libmp_dm_task_create(DM_DEVICE_LIST)))
+		goto out_free;
+
+	dm_task_no_open_count(dmt);
+
+	if (!libmp_dm_task_run(dmt)) {
+		dm_log_error(3, DM_DEVICE_LIST, dmt);
+		goto out_free;
+	}
+
+	if (!(names = dm_task_get_names(dmt)))
+		goto out_free;
+
+	if (names->dev) {
+		do {
+			if (!vector_alloc_slot(v))
+				goto out_free;
+			if (!(name = strdup(names->name))) {
+				vector_del_slot(v, VECTOR_SIZE(v) - 1);
+				goto out_free;
+			}
+			vector_set_slot(v, name);
+			next = names->next;
+			names = (void *) names + next;
+		} while (next);
+	}
+	if (VECTOR_SIZE(v) > 1)
+		qsort(v->slot, VECTOR_SIZE(v), sizeof(*v->slot), name_cmp);
+	dm_task_destroy(dmt);
+	return v;
+
+out_free:
+	if (dmt)
+		dm_task_destroy(dmt);
+	free_strvec(v);
+	return NULL;
+}
+
+bool dm_map_in_names(const struct _vector *names, const char *name)
+{
+	if (!name || VECTOR_SIZE(names) == 0)
+		return false;
+	return bsearch(&name, names->slot, VECTOR_SIZE(names),
+		       sizeof(*names->slot), name_cmp) != NULL;
+}
+
 int
 dm_geteventnr (const char *name)
 {
@@ -1430,6 +1794,359 @@ bad:
 	return NULL;
 }
 
+/*
+ * Names and uuids of all dm devices, used by do_foreach_partmaps() in the
+ * calling thread between dm_partmaps_cache_start() and
+ * dm_partmaps_cache_end(). Entries of devices that have been removed in
+ * the meantime fail the table checks in is_partmap_of().
+ */
+struct dm_dev_ent {
+	char *name;
+	char uuid[DM_UUID_LEN];
+};
+
+static __thread struct dm_dev_ent *dev_cache;
+static __thread int dev_cache_size;
+
+static void free_dev_cache(struct dm_dev_ent *devs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		free(devs[i].name);
+	free(devs);
+}
+
+int dm_partmaps_cache_start(void)
+{
+	struct dm_task *dmt;
+	struct dm_names *names;
+	struct dm_dev_ent *devs = NULL;
+	unsigned next = 0;
+	int n = 0, r = 1;
+
+	if (dev_cache)
+		return 0;
+
+	if (!(dmt = libmp_dm_task_create(DM_DEVICE_LIST)))
+		return 1;
+
+	dm_task_no_open_count(dmt);
+
+	if (!libmp_dm_task_run(dmt)) {
+		dm_log_error(3, DM_DEVICE_LIST, dmt);
+		goto out;
+	}
+
+	if (!(names = dm_task_get_names(dmt)))
+		goto out;
+
+	if (names->dev) {
+		struct dm_names *nm = names;
+
+		do {
+			n++;
+			next = nm->next;
+			nm = (void *) nm + next;
+		} while (next);
+	}
+
+	devs = calloc(n ? n : 1, sizeof(*devs));
+	if (!devs)
+		goto out;
+
+	for (n = 0; names->dev; ) {
+		devs[n].name = strdup(names->name);
+		if (!devs[n].name) {
+			free_dev_cache(devs, n);
+			goto out;
+		}
+		if (dm_get_prefixed_uuid(names->name, devs[n].uuid,
+					 sizeof(devs[n].uuid)))
+			devs[n].uuid[0] = '\0';
+		n++;
+		next = names->next;
+		if (!next)
+			break;
+		names = (void *) names + next;
+	}
+	dev_cache = devs;
+	dev_cache_size = n;
+	r = 0;
+out:
+	dm_task_destroy(dmt);
+	return r;
+}
+
+void dm_partmaps_cache_end(void)
+{
+	free_dev_cache(dev_cache, dev_cache_size);
+	dev_cache = NULL;
+	dev_cache_size = 0;
+}
+
+/*
+ * Index of partition maps for multipathd, kept up to date from dm uevents
+ * with dm_partmap_index_update() and hashed on the uuid of the map they
+ * belong to. Entries are only candidates that do_foreach_partmaps()
+ * verifies, so stale entries for devices that went away are harmless.
+ */
+#define PARTMAP_HASH_SIZE 256
+
+struct partmap_ent {
+	struct list_head uuid_node;
+	struct list_head parent_node;
+	char name[DM_NAME_LEN];
+	char uuid[DM_UUID_LEN];
+};
+
+static pthread_mutex_t partmap_index_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool partmap_index_on;
+static struct list_head partmaps_by_uuid[PARTMAP_HASH_SIZE];
+static struct list_head partmaps_by_parent[PARTMAP_HASH_SIZE];
+
+#define PARTMAP_BUCKET(table, uuid) \
+	(&(table)[hash_str(uuid) & (PARTMAP_HASH_SIZE - 1)])
+
+/* uuid of the map a partition map belongs to, or NULL */
+static const char *partmap_parent_uuid(const char *uuid)
+{
+	if (strncmp(uuid, "part", 4) != 0)
+		return NULL;
+	return strstr(uuid, UUID_PREFIX);
+}
+
+static struct partmap_ent *__find_partmap(const char *uuid)
+{
+	struct partmap_ent *pe;
+
+	list_for_each_entry(pe, PARTMAP_BUCKET(partmaps_by_uuid, uuid),
+			    uuid_node)
+		if (!strcmp(pe->uuid, uuid))
+			return pe;
+	return NULL;
+}
+
+static void __set_partmap(const char *name, const char *uuid)
+{
+	struct partmap_ent *pe = __find_partmap(uuid);
+	const char *parent = partmap_parent_uuid(uuid);
+
+	if (!parent)
+		return;
+	if (!pe) {
+		pe = calloc(1, sizeof(*pe));
+		if (!pe) {
+			/* can't trust the index any more */
+			condlog(2, "%s: failed to index partition map %s",
+				__func__, name);
+			partmap_index_on = false;
+			return;
+		}
+		strlcpy(pe->uuid, uuid, sizeof(pe->uuid));
+		list_add_tail(&pe->uuid_node,
+			      PARTMAP_BUCKET(partmaps_by_uuid, pe->uuid));
+		list_add_tail(&pe->parent_node,
+			      PARTMAP_BUCKET(partmaps_by_parent, parent));
+	}
+	strlcpy(pe->name, name, sizeof(pe->name));
+}
+
+static void __del_partmap(struct partmap_ent *pe)
+{
+	list_del(&pe->uuid_node);
+	list_del(&pe->parent_node);
+	free(pe);
+}
+
+static void __clear_partmap_index(void)
+{
+	struct partmap_ent *pe, *tmp;
+	int i;
+
+	for (i = 0; i < PARTMAP_HASH_SIZE; i++) {
+		if (partmaps_by_uuid[i].next)
+			list_for_each_entry_safe(pe, tmp, &partmaps_by_uuid[i],
+						 uuid_node)
+				__del_partmap(pe);
+		INIT_LIST_HEAD(&partmaps_by_uuid[i]);
+		INIT_LIST_HEAD(&partmaps_by_parent[i]);
+	}
+	partmap_index_on = false;
+}
+
+int dm_partmap_index_init(void)
+{
+	struct dm_task *dmt;
+	struct dm_names *names;
+	char uuid[DM_UUID_LEN];
+	unsigned next = 0;
+	int r = 1;
+
+	pthread_mutex_lock(&partmap_index_lock);
+	pthread_cleanup_push(cleanup_mutex, &partmap_index_lock);
+	__clear_partmap_index();
+
+	if (!(dmt = libmp_dm_task_create(DM_DEVICE_LIST)))
+		goto out;
+
+	dm_task_no_open_count(dmt);
+
+	if (!libmp_dm_task_run(dmt)) {
+		dm_log_error(3, DM_DEVICE_LIST, dmt);
+		goto out_task;
+	}
+
+	if (!(names = dm_task_get_names(dmt)))
+		goto out_task;
+
+	partmap_index_on = true;
+	if (names->dev) {
+		do {
+			if (!dm_get_prefixed_uuid(names->name, uuid,
+						  sizeof(uuid)))
+				__set_partmap(names->name, uuid);
+			next = names->next;
+			names = (void *) names + next;
+		} while (next && partmap_index_on);
+	}
+	r = partmap_index_on ? 0 : 1;
+	if (r)
+		__clear_partmap_index();
+out_task:
+	dm_task_destroy(dmt);
+out:
+	pthread_cleanup_pop(1);
+	return r;
+}
+
+void dm_partmap_index_exit(void)
+{
+	pthread_mutex_lock(&partmap_index_lock);
+	__clear_partmap_index();
+	pthread_mutex_unlock(&partmap_index_lock);
+}
+
+void dm_partmap_index_update(const char *name, const char *uuid, bool removed)
+{
+	struct partmap_ent *pe;
+
+	if (!uuid || !partmap_parent_uuid(uuid) || (!removed && !name))
+		return;
+	pthread_mutex_lock(&partmap_index_lock);
+	if (partmap_index_on) {
+		if (!removed)
+			__set_partmap(name, uuid);
+		else if ((pe = __find_partmap(uuid)))
+			__del_partmap(pe);
+		if (!partmap_index_on)
+			__clear_partmap_index();
+	}
+	pthread_mutex_unlock(&partmap_index_lock);
+}
+
+/* Keep the index usable until the uevent for the rename arrives */
+static void partmap_index_rename(const char *old, const char *new)
+{
+	struct partmap_ent *pe;
+	int i;
+
+	pthread_mutex_lock(&partmap_index_lock);
+	for (i = 0; partmap_index_on && i < PARTMAP_HASH_SIZE; i++)
+		list_for_each_entry(pe, &partmaps_by_uuid[i], uuid_node)
+			if (!strcmp(pe->name, old))
+				strlcpy(pe->name, new, sizeof(pe->name));
+	pthread_mutex_unlock(&partmap_index_lock);
+}
+
+/*
+ * Copy the indexed partition maps of the map with the given uuid to *devs.
+ * Returns the number of entries, or -1 if the index can't be used.
+ */
+static int get_indexed_partmaps(const char *map_uuid, struct dm_dev_ent **devs)
+{
+	struct list_head *bucket;
+	struct partmap_ent *pe;
+	int n = -1;
+
+	pthread_mutex_lock(&partmap_index_lock);
+	if (!partmap_index_on)
+		goto out;
+	bucket = PARTMAP_BUCKET(partmaps_by_parent, map_uuid);
+	n = 0;
+	list_for_each_entry(pe, bucket, parent_node)
+		if (!strcmp(partmap_parent_uuid(pe->uuid), map_uuid))
+			n++;
+	*devs = calloc(n ? n : 1, sizeof(**devs));
+	if (!*devs) {
+		n = -1;
+		goto out;
+	}
+	n = 0;
+	list_for_each_entry(pe, bucket, parent_node) {
+		if (strcmp(partmap_parent_uuid(pe->uuid), map_uuid))
+			continue;
+		(*devs)[n].name = strdup(pe->name);
+		if (!(*devs)[n].name) {
+			free_dev_cache(*devs, n);
+			n = -1;
+			goto out;
+		}
+		strlcpy((*devs)[n].uuid, pe->uuid, sizeof((*devs)[n].uuid));
+		n++;
+	}
+out:
+	pthread_mutex_unlock(&partmap_index_lock);
+	return n;
+}
+
+/*
+ * Check the uuid first. It's compared without further ioctls, and rules
+ * out almost all devices.
+ */
+static bool
+is_partmap_of(const char *name, const char *part_uuid, const char *map_uuid,
+	      const char *dev_t)
+{
+	unsigned long long size;
+	char *params = NULL;
+	const char *p;
+	bool r;
+
+	if (strncmp(part_uuid, "part", 4) != 0 ||
+	    !(p = strstr(part_uuid, UUID_PREFIX)) || strcmp(p, map_uuid))
+		return false;
+
+	/*
+	 * if there is only a single "linear" target,
+	 * and we can fetch the map table from the kernel
+	 */
+	if (dm_type(name, TGT_PART) != 1 ||
+	    dm_get_map(name, &size, &params) != DMP_OK)
+		return false;
+
+	/*
+	 * and the table maps over the multipath map
+	 */
+	r = (p = strstr(params, dev_t)) && !isdigit(*(p + strlen(dev_t)));
+	free(params);
+	return r;
+}
+
+static int
+foreach_partmap_in(const struct dm_dev_ent *devs, int n, const char *map_uuid,
+		   const char *dev_t, int (*partmap_func)(const char *, void *),
+		   void *data)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (is_partmap_of(devs[i].name, devs[i].uuid, map_uuid, dev_t) &&
+		    partmap_func(devs[i].name, data) != 0)
+			return 1;
+	return 0;
+}
+
 static int
 do_foreach_partmaps (const char * mapname,
 		     int (*partmap_func)(const char *, void *),
@@ -1437,12 +2154,29 @@ do_foreach_partmaps (const char * mapname,
 {
 	struct dm_task *dmt;
 	struct dm_names *names;
+	struct dm_dev_ent *devs;
 	unsigned next = 0;
-	char *params = NULL;
-	unsigned long long size;
 	char dev_t[32];
-	int r = 1;
-	char *p;
+	char map_uuid[DM_UUID_LEN], part_uuid[DM_UUID_LEN];
+	int n, r = 1;
+
+	if (dm_dev_t(mapname, &dev_t[0], 32))
+		return 1;
+
+	if (dm_get_prefixed_uuid(mapname, map_uuid, sizeof(map_uuid)))
+		return 0;
+
+	if (dev_cache)
+		return foreach_partmap_in(dev_cache, dev_cache_size, map_uuid,
+					  dev_t, partmap_func, data);
+
+	n = get_indexed_partmaps(map_uuid, &devs);
+	if (n >= 0) {
+		r = foreach_partmap_in(devs, n, map_uuid, dev_t,
+				       partmap_func, data);
+		free_dev_cache(devs, n);
+		return r;
+	}
 
 	if (!(dmt = libmp_dm_task_create(DM_DEVICE_LIST)))
 		return 1;
@@ -1462,46 +2196,19 @@ do_foreach_partmaps (const char * mapname,
 		goto out;
 	}
 
-	if (dm_dev_t(mapname, &dev_t[0], 32))
-		goto out;
-
 	do {
-		if (
-		    /*
-		     * if there is only a single "linear" target
-		     */
-		    (dm_type(names->name, TGT_PART) == 1) &&
-
-		    /*
-		     * and the uuid of the target is a partition of the
-		     * uuid of the multipath device
-		     */
-		    is_mpath_part(names->name, mapname) &&
-
-		    /*
-		     * and we can fetch the map table from the kernel
-		     */
-		    dm_get_map(names->name, &size, &params) == DMP_OK &&
-
-		    /*
-		     * and the table maps over the multipath map
-		     */
-		    (p = strstr(params, dev_t)) &&
-		    !isdigit(*(p + strlen(dev_t)))
-		   ) {
-			if (partmap_func(names->name, data) != 0)
-				goto out;
-		}
+		if (!dm_get_prefixed_uuid(names->name, part_uuid,
+					  sizeof(part_uuid)) &&
+		    is_partmap_of(names->name, part_uuid, map_uuid, dev_t) &&
+		    partmap_func(names->name, data) != 0)
+			goto out;
 
-		free(params);
-		params = NULL;
 		next = names->next;
 		names = (void *) names + next;
 	} while (next);
 
 	r = 0;
 out:
-	free(params);
 	dm_task_destroy (dmt);
 	return r;
 }
@@ -1536,6 +2243,153 @@ dm_remove_partmaps (const char * mapname, int need_sync, int deferred_remove)
 	return do_foreach_partmaps(mapname, remove_partmap, &rd);
 }
 
+static int
+dm_addpartmap(int task, const char *name, const char *uuid,
+	      unsigned long long size, const char *params, int ro)
+{
+	struct dm_task *dmt;
+	uint32_t cookie = 0;
+	int r = 0;
+
+	if (!(dmt = libmp_dm_task_create(task)))
+		return 0;
+
+	if (!dm_task_set_name(dmt, name) ||
+	    !dm_task_add_target(dmt, 0, size, TGT_PART, params))
+		goto out;
+	if (ro)
+		dm_task_set_ro(dmt);
+	if (task == DM_DEVICE_CREATE && !dm_task_set_uuid(dmt, uuid))
+		goto out;
+	dm_task_no_open_count(dmt);
+
+	if (task == DM_DEVICE_CREATE &&
+	    !dm_task_set_cookie(dmt, udev_cookie(&cookie),
+				DM_UDEV_DISABLE_LIBRARY_FALLBACK))
+		goto out;
+
+	r = libmp_dm_task_run(dmt);
+	if (!r)
+		dm_log_error(2, task, dmt);
+
+	if (task == DM_DEVICE_CREATE)
+		udev_cookie_wait(cookie);
+out:
+	dm_task_destroy(dmt);
+	return r;
+}
+
+/* Returns 1 if the table of partition map name is params, size and ro */
+static int
+partmap_unchanged(const char *name, unsigned long long size,
+		  const char *params, int ro)
+{
+	struct dm_info info;
+	unsigned long long cur_size;
+	char *cur_params = NULL;
+	int r;
+
+	if (do_get_info(name, &info) != 0 || !info.read_only != !ro ||
+	    dm_type(name, TGT_PART) != 1 ||
+	    dm_get_map(name, &cur_size, &cur_params) != DMP_OK)
+		return 0;
+	r = cur_size == size && !strcmp(cur_params, params);
+	free(cur_params);
+	return r;
+}
+
+struct update_data {
+	const struct dm_partition *parts;
+	int n;
+	int failed;
+};
+
+static int
+remove_stale_partmap(const char *name, void *data)
+{
+	struct update_data *ud = data;
+	char part_uuid[DM_UUID_LEN];
+	int num;
+
+	if (dm_get_prefixed_uuid(name, part_uuid, sizeof(part_uuid)) ||
+	    sscanf(part_uuid, "part%d-", &num) != 1 || num < 1 ||
+	    (num <= ud->n && ud->parts[num - 1].size))
+		return 0;
+	if (dm_get_opencount(name)) {
+		condlog(2, "%s: partition map in use, not removing", name);
+		ud->failed++;
+		return 0;
+	}
+	if (!dm_device_remove(name, 1, 0))
+		ud->failed++;
+	else
+		condlog(3, "%s: partition map removed", name);
+	return 0;
+}
+
+int
+dm_update_partmaps(const char *mapname, const char *delim,
+		   const struct dm_partition *parts, int n, int ro)
+{
+	struct update_data ud = { parts, n, 0 };
+	char dev_t[32], map_uuid[DM_UUID_LEN], uuid[DM_UUID_LEN];
+	char cur_uuid[DM_UUID_LEN], params[64];
+	char *partname;
+	int i, task;
+
+	if (dm_dev_t(mapname, dev_t, sizeof(dev_t)) ||
+	    dm_get_prefixed_uuid(mapname, map_uuid, sizeof(map_uuid)) ||
+	    !*map_uuid)
+		return 1;
+
+	for (i = 0; i < n; i++) {
+		if (parts[i].size == 0)
+			continue;
+		if (asprintf(&partname, "%s%s%d", mapname, delim, i + 1) < 0) {
+			ud.failed++;
+			continue;
+		}
+		if (safe_sprintf(uuid, "part%d-%s", i + 1, map_uuid) ||
+		    safe_sprintf(params, "%s %llu", dev_t, parts[i].start)) {
+			ud.failed++;
+			goto next;
+		}
+		if (dm_get_prefixed_uuid(partname, cur_uuid,
+					 sizeof(cur_uuid)) != 0)
+			task = DM_DEVICE_CREATE;
+		else if (strcmp(cur_uuid, uuid)) {
+			condlog(1, "%s: map is already in use with uuid \"%s\"",
+				partname, cur_uuid);
+			ud.failed++;
+			goto next;
+		} else if (partmap_unchanged(partname, parts[i].size, params,
+					     ro)) {
+			condlog(4, "%s: partition map unchanged", partname);
+			goto next;
+		} else
+			task = DM_DEVICE_RELOAD;
+
+		condlog(3, "%s: %s [0 %llu %s %s]", partname,
+			task == DM_DEVICE_RELOAD ? "reload" : "addmap",
+			parts[i].size, TGT_PART, params);
+		if (!dm_addpartmap(task, partname, uuid, parts[i].size,
+				   params, ro) ||
+		    (task == DM_DEVICE_RELOAD &&
+		     !dm_simplecmd_noflush(DM_DEVICE_RESUME, partname,
+					   MPATH_UDEV_RELOAD_FLAG))) {
+			condlog(1, "%s: failed to set up partition map",
+				partname);
+			ud.failed++;
+		}
+	next:
+		free(partname);
+	}
+
+	if (do_foreach_partmaps(mapname, remove_stale_partmap, &ud))
+		ud.failed++;
+	return ud.failed;
+}
+
 #ifdef LIBDM_API_DEFERRED
 
 static int
@@ -1692,6 +2546,8 @@ dm_rename (const char * old, char * new, char *delim, int skip_kpartx)
 	r = libmp_dm_task_run(dmt);
 	if (!r)
 		dm_log_error(2, DM_DEVICE_RENAME, dmt);
+	else
+		partmap_index_rename(old, new);
 
 	libmp_udev_wait(cookie);
 
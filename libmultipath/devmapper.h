@@ -37,6 +37,32 @@ int dm_prereq(unsigned int *v);
 void skip_libmp_dm_init(void);
 void libmp_dm_exit(void);
 void libmp_udev_set_sync_support(int on);
+/*
+ * Between these calls, creating, resuming and removing maps in the calling
+ * thread doesn't wait for udev. dm_udev_batch_end() waits for udev to
+ * finish processing all of them. Renames still wait immediately.
+ * Batches nest, only the outermost dm_udev_batch_end() waits.
+ */
+void dm_udev_batch_start(void);
+void dm_udev_batch_end(void);
+/*
+ * Between these calls, partition maps are looked up in a single list of
+ * dm devices taken by dm_partmaps_cache_start() in the calling thread,
+ * rather than listing all devices again for every map. Devices created or
+ * renamed in the meantime aren't seen, so use it only while flushing many
+ * maps at once. dm_partmaps_cache_start() returns 0 on success.
+ */
+int dm_partmaps_cache_start(void);
+void dm_partmaps_cache_end(void);
+/*
+ * Index of partition maps, used for partition lookups in all threads while
+ * it's set up. dm_partmap_index_init() (re)builds it from the list of dm
+ * devices and returns 0 on success. The caller must then feed it all
+ * change and remove uevents of dm devices with dm_partmap_index_update().
+ */
+int dm_partmap_index_init(void);
+void dm_partmap_index_exit(void);
+void dm_partmap_index_update(const char *name, const char *uuid, bool removed);
 struct dm_task *libmp_dm_task_create(int task);
 int dm_simplecmd_flush (int, const char *, uint16_t);
 int dm_simplecmd_noflush (int, const char *, uint16_t);
@@ -58,17 +84,45 @@ int dm_cancel_deferred_remove(struct multipath *mpp);
 int dm_flush_maps (int need_suspend, int retries);
 int dm_fail_path(const char * mapname, char * path);
 int dm_reinstate_path(const char * mapname, char * path);
+/*
+ * Send message to mapname and set *response to a copy of the reply of
+ * the target, which the caller must free. Returns 0 on success.
+ */
+int dm_message_response(const char *mapname, const char *message,
+			char **response);
 int dm_queue_if_no_path(const char *mapname, int enable);
 int dm_switchgroup(const char * mapname, int index);
 int dm_enablegroup(const char * mapname, int index);
 int dm_disablegroup(const char * mapname, int index);
 int dm_get_maps (vector mp);
+/*
+ * Names of all dm devices, from a single DM_DEVICE_LIST ioctl. Returns a
+ * sorted vector to be freed with free_strvec(), or NULL on error.
+ */
+vector dm_get_map_names(void);
+bool dm_map_in_names(const struct _vector *names, const char *name);
 int dm_geteventnr (const char *name);
 int dm_is_suspended(const char *name);
 int dm_get_major_minor (const char *name, int *major, int *minor);
 char * dm_mapname(int major, int minor);
 int dm_remove_partmaps (const char * mapname, int need_sync,
 			int deferred_remove);
+
+/* A partition of a multipath map, in 512 byte sectors */
+struct dm_partition {
+	unsigned long long start;
+	unsigned long long size;
+};
+
+/*
+ * Make the partition maps of mapname match its n partitions in parts,
+ * like "kpartx -u": partition i is mapped as mapname, delim and i + 1,
+ * unless its size is 0. Maps whose table is unchanged are left alone,
+ * maps of partitions that are gone are removed unless they are open.
+ * Returns the number of partition maps that couldn't be updated.
+ */
+int dm_update_partmaps(const char *mapname, const char *delim,
+		       const struct dm_partition *parts, int n, int ro);
 int dm_get_uuid(const char *name, char *uuid, int uuid_len);
 int dm_get_info (const char * mapname, struct dm_info ** dmi);
 int dm_rename (const char * old, char * new, char * delim, int skip_kpartx);
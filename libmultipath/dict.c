@@ -194,16 +194,16 @@ def_ ## option ## _handler (struct config *conf, vector strvec)		\
 
 #define declare_def_snprint(option, function)				\
 static int								\
-snprint_def_ ## option (struct config *conf, struct strbuf *buff,	\
-			const void *data)				\
+snprint_def_ ## option (const struct config *conf,			\
+			struct strbuf *buff, const void *data)		\
 {									\
 	return function(buff, conf->option);				\
 }
 
 #define declare_def_snprint_defint(option, function, value)		\
 static int								\
-snprint_def_ ## option (struct config *conf, struct strbuf *buff,	\
-			const void *data)				\
+snprint_def_ ## option (const struct config *conf,			\
+			struct strbuf *buff, const void *data)		\
 {									\
 	int i = value;							\
 	if (!conf->option)						\
@@ -213,8 +213,8 @@ snprint_def_ ## option (struct config *conf, struct strbuf *buff,	\
 
 #define declare_def_snprint_defstr(option, function, value)		\
 static int								\
-snprint_def_ ## option (struct config *conf, struct strbuf *buff,	\
-			const void *data)				\
+snprint_def_ ## option (const struct config *conf,			\
+			struct strbuf *buff, const void *data)		\
 {									\
 	static const char *s = value;					\
 	if (!conf->option)						\
@@ -234,8 +234,8 @@ hw_ ## option ## _handler (struct config *conf, vector strvec)		\
 
 #define declare_hw_snprint(option, function)				\
 static int								\
-snprint_hw_ ## option (struct config *conf, struct strbuf *buff,	\
-		       const void *data)				\
+snprint_hw_ ## option (const struct config *conf,			\
+		       struct strbuf *buff, const void *data)		\
 {									\
 	const struct hwentry * hwe = (const struct hwentry *)data;	\
 	return function(buff, hwe->option);				\
@@ -252,8 +252,8 @@ ovr_ ## option ## _handler (struct config *conf, vector strvec)		\
 
 #define declare_ovr_snprint(option, function)				\
 static int								\
-snprint_ovr_ ## option (struct config *conf, struct strbuf *buff,	\
-			const void *data)				\
+snprint_ovr_ ## option (const struct config *conf,			\
+			struct strbuf *buff, const void *data)		\
 {									\
 	return function (buff, conf->overrides->option);		\
 }
@@ -270,8 +270,8 @@ mp_ ## option ## _handler (struct config *conf, vector strvec)		\
 
 #define declare_mp_snprint(option, function)				\
 static int								\
-snprint_mp_ ## option (struct config *conf, struct strbuf *buff,	\
-		       const void *data)				\
+snprint_mp_ ## option (const struct config *conf,			\
+		       struct strbuf *buff, const void *data)		\
 {									\
 	const struct mpentry * mpe = (const struct mpentry *)data;	\
 	return function(buff, mpe->option);				\
@@ -293,9 +293,50 @@ declare_def_snprint(checkint, print_int)
 declare_def_handler(max_checkint, set_uint)
 declare_def_snprint(max_checkint, print_int)
 
+declare_def_handler(adaptive_checkint, set_yes_no)
+declare_def_snprint(adaptive_checkint, print_yes_no)
+
+static int
+def_max_check_rate_handler(struct config *conf, vector strvec)
+{
+	int rc = set_int(strvec, &conf->max_check_rate);
+
+	if (rc)
+		return rc;
+	if (conf->max_check_rate < 0) {
+		condlog(1, "%s: invalid value for max_polling_rate: %d",
+			__func__, conf->max_check_rate);
+		conf->max_check_rate = DEFAULT_MAX_CHECK_RATE;
+	}
+	return 0;
+}
+
+declare_def_snprint(max_check_rate, print_int)
+
+declare_def_handler(vpd_cache, set_yes_no)
+declare_def_snprint(vpd_cache, print_yes_no)
+
+declare_def_handler(alua_prio_refresh, set_int)
+declare_def_snprint(alua_prio_refresh, print_int)
+
+declare_def_handler(prio_max_age, set_int)
+declare_def_snprint(prio_max_age, print_int)
+
+declare_def_handler(async_prio, set_yes_no)
+declare_def_snprint(async_prio, print_yes_no)
+
+declare_def_handler(recheck_siblings, set_yes_no)
+declare_def_snprint(recheck_siblings, print_yes_no)
+
 declare_def_handler(verbosity, set_int)
 declare_def_snprint(verbosity, print_int)
 
+declare_def_handler(log_rate_limit, set_uint)
+declare_def_snprint(log_rate_limit, print_int)
+
+declare_def_handler(log_journal, set_yes_no)
+declare_def_snprint(log_journal, print_yes_no)
+
 declare_def_handler(reassign_maps, set_yes_no)
 declare_def_snprint(reassign_maps, print_yes_no)
 
@@ -316,8 +357,8 @@ static int def_partition_delim_handler(struct config *conf, vector strvec)
 	return 0;
 }
 
-static int snprint_def_partition_delim(struct config *conf, struct strbuf *buff,
-				       const void *data)
+static int snprint_def_partition_delim(const struct config *conf,
+				       struct strbuf *buff, const void *data)
 {
 	if (default_partition_delim == NULL || conf->partition_delim != NULL)
 		return print_str(buff, conf->partition_delim);
@@ -365,7 +406,7 @@ def_find_multipaths_handler(struct config *conf, vector strvec)
 }
 
 static int
-snprint_def_find_multipaths(struct config *conf, struct strbuf *buff,
+snprint_def_find_multipaths(const struct config *conf, struct strbuf *buff,
 			    const void *data)
 {
 	return append_strbuf_quoted(buff,
@@ -381,7 +422,7 @@ declare_ovr_snprint(selector, print_str)
 declare_mp_handler(selector, set_str)
 declare_mp_snprint(selector, print_str)
 
-static int snprint_uid_attrs(struct config *conf, struct strbuf *buff,
+static int snprint_uid_attrs(const struct config *conf, struct strbuf *buff,
 			     const void *dummy)
 {
 	int j, ret, total = 0;
@@ -484,9 +525,12 @@ declare_hw_snprint(minio_rq, print_nonzero)
 declare_mp_handler(minio_rq, set_int)
 declare_mp_snprint(minio_rq, print_nonzero)
 
+declare_mp_handler(startup_priority, set_int)
+declare_mp_snprint(startup_priority, print_nonzero)
+
 declare_def_handler(queue_without_daemon, set_yes_no)
 static int
-snprint_def_queue_without_daemon(struct config *conf, struct strbuf *buff,
+snprint_def_queue_without_daemon(const struct config *conf, struct strbuf *buff,
 				 const void * data)
 {
 	const char *qwd = "unknown";
@@ -536,6 +580,9 @@ declare_def_snprint(bindings_file, print_str)
 declare_def_handler(wwids_file, set_str)
 declare_def_snprint(wwids_file, print_str)
 
+declare_def_handler(wwids_index, set_yes_no)
+declare_def_snprint(wwids_index, print_yes_no)
+
 declare_def_handler(prkeys_file, set_str)
 declare_def_snprint(prkeys_file, print_str)
 
@@ -585,6 +632,24 @@ declare_def_snprint(retrigger_delay, print_int)
 declare_def_handler(uev_wait_timeout, set_int)
 declare_def_snprint(uev_wait_timeout, print_int)
 
+declare_def_handler(uev_batch_min_wait, set_uint)
+declare_def_snprint(uev_batch_min_wait, print_int)
+
+declare_def_handler(uev_batch_max_wait, set_uint)
+declare_def_snprint(uev_batch_max_wait, print_int)
+
+declare_def_handler(uev_batch_max_events, set_uint)
+declare_def_snprint(uev_batch_max_events, print_int)
+
+declare_def_handler(uev_batch_max_time, set_uint)
+declare_def_snprint(uev_batch_max_time, print_int)
+
+declare_def_handler(reconfigure_debounce, set_uint)
+declare_def_snprint(reconfigure_debounce, print_int)
+
+declare_def_handler(reload_debounce, set_uint)
+declare_def_snprint(reload_debounce, print_int)
+
 declare_def_handler(strict_timing, set_yes_no)
 declare_def_snprint(strict_timing, print_yes_no)
 
@@ -597,11 +662,21 @@ declare_hw_handler(skip_kpartx, set_yes_no_undef)
 declare_hw_snprint(skip_kpartx, print_yes_no_undef)
 declare_mp_handler(skip_kpartx, set_yes_no_undef)
 declare_mp_snprint(skip_kpartx, print_yes_no_undef)
+
+declare_def_handler(selector_autotune, set_yes_no_undef)
+declare_def_snprint_defint(selector_autotune, print_yes_no_undef,
+			   DEFAULT_SELECTOR_AUTOTUNE)
+declare_ovr_handler(selector_autotune, set_yes_no_undef)
+declare_ovr_snprint(selector_autotune, print_yes_no_undef)
+declare_hw_handler(selector_autotune, set_yes_no_undef)
+declare_hw_snprint(selector_autotune, print_yes_no_undef)
+declare_mp_handler(selector_autotune, set_yes_no_undef)
+declare_mp_snprint(selector_autotune, print_yes_no_undef)
 static int def_disable_changed_wwids_handler(struct config *conf, vector strvec)
 {
 	return 0;
 }
-static int snprint_def_disable_changed_wwids(struct config *conf,
+static int snprint_def_disable_changed_wwids(const struct config *conf,
 					     struct strbuf *buff,
 					     const void *data)
 {
@@ -620,6 +695,15 @@ declare_hw_snprint(max_sectors_kb, print_nonzero)
 declare_mp_handler(max_sectors_kb, set_int)
 declare_mp_snprint(max_sectors_kb, print_nonzero)
 
+declare_def_handler(queue_profile, set_str)
+declare_def_snprint(queue_profile, print_str)
+declare_ovr_handler(queue_profile, set_str)
+declare_ovr_snprint(queue_profile, print_str)
+declare_hw_handler(queue_profile, set_str)
+declare_hw_snprint(queue_profile, print_str)
+declare_mp_handler(queue_profile, set_str)
+declare_mp_snprint(queue_profile, print_str)
+
 declare_def_handler(find_multipaths_timeout, set_int)
 declare_def_snprint_defint(find_multipaths_timeout, print_int,
 			   DEFAULT_FIND_MULTIPATHS_TIMEOUT)
@@ -628,6 +712,66 @@ declare_def_handler(enable_foreign, set_str)
 declare_def_snprint_defstr(enable_foreign, print_str,
 			   DEFAULT_ENABLE_FOREIGN)
 
+declare_def_handler(cpu_affinity, set_str)
+declare_def_snprint(cpu_affinity, print_str)
+
+declare_def_handler(sched_policy, set_str)
+declare_def_snprint(sched_policy, print_str)
+
+declare_def_handler(thread_stack_size, set_str)
+declare_def_snprint(thread_stack_size, print_str)
+
+declare_def_handler(numa_affinity, set_yes_no)
+declare_def_snprint(numa_affinity, print_yes_no)
+
+static int
+def_mlock_memory_handler(struct config *conf, vector strvec)
+{
+	char * buff;
+
+	buff = set_value(strvec);
+	if (!buff)
+		return 1;
+
+	if (!strcmp(buff, "onfault"))
+		conf->mlock_memory = MLOCK_MEMORY_ONFAULT;
+	else if (!strcmp(buff, "no") || !strcmp(buff, "0"))
+		conf->mlock_memory = MLOCK_MEMORY_NO;
+	else if (!strcmp(buff, "yes") || !strcmp(buff, "1"))
+		conf->mlock_memory = MLOCK_MEMORY_YES;
+	else
+		condlog(1, "invalid value for mlock_memory: \"%s\"", buff);
+
+	free(buff);
+	return 0;
+}
+
+static int
+snprint_def_mlock_memory(const struct config *conf, struct strbuf *buff,
+			 const void * data)
+{
+	switch (conf->mlock_memory) {
+	case MLOCK_MEMORY_NO:
+		return append_strbuf_quoted(buff, "no");
+	case MLOCK_MEMORY_ONFAULT:
+		return append_strbuf_quoted(buff, "onfault");
+	default:
+		return append_strbuf_quoted(buff, "yes");
+	}
+}
+
+declare_def_handler(unified_event_loop, set_yes_no)
+declare_def_snprint(unified_event_loop, print_yes_no)
+
+declare_def_handler(publish_state, set_yes_no)
+declare_def_snprint(publish_state, print_yes_no)
+
+declare_def_handler(warm_restart, set_yes_no)
+declare_def_snprint(warm_restart, print_yes_no)
+
+declare_def_handler(io_stats, set_yes_no)
+declare_def_snprint(io_stats, print_yes_no)
+
 static int
 def_config_dir_handler(struct config *conf, vector strvec)
 {
@@ -647,8 +791,8 @@ def_ ## option ## _handler (struct config *conf, vector strvec)		\
 
 #define declare_def_attr_snprint(option, function)			\
 static int								\
-snprint_def_ ## option (struct config *conf, struct strbuf *buff,	\
-			const void *data)				\
+snprint_def_ ## option (const struct config *conf,			\
+			struct strbuf *buff, const void *data)		\
 {									\
 	return function(buff, conf->option, conf->attribute_flags);	\
 }
@@ -665,8 +809,8 @@ mp_ ## option ## _handler (struct config *conf, vector strvec)		\
 
 #define declare_mp_attr_snprint(option, function)			\
 static int								\
-snprint_mp_ ## option (struct config *conf, struct strbuf *buff,	\
-		       const void * data)				\
+snprint_mp_ ## option (const struct config *conf,			\
+		       struct strbuf *buff, const void *data)		\
 {									\
 	const struct mpentry * mpe = (const struct mpentry *)data;	\
 	return function(buff, mpe->option, mpe->attribute_flags);	\
@@ -966,7 +1110,8 @@ max_fds_handler(struct config *conf, vector strvec)
 }
 
 static int
-snprint_max_fds (struct config *conf, struct strbuf *buff, const void *data)
+snprint_max_fds (const struct config *conf, struct strbuf *buff,
+		 const void *data)
 {
 	int r = 0, max_fds;
 
@@ -997,6 +1142,9 @@ set_rr_weight(vector strvec, void *ptr)
 	if (!strcmp(buff, "uniform"))
 		*int_ptr = RR_WEIGHT_NONE;
 
+	if (!strcmp(buff, "latency"))
+		*int_ptr = RR_WEIGHT_LATENCY;
+
 	FREE(buff);
 
 	return 0;
@@ -1011,6 +1159,8 @@ print_rr_weight (struct strbuf *buff, long v)
 		return append_strbuf_quoted(buff, "priorities");
 	if (v == RR_WEIGHT_NONE)
 		return append_strbuf_quoted(buff, "uniform");
+	if (v == RR_WEIGHT_LATENCY)
+		return append_strbuf_quoted(buff, "latency");
 
 	return 0;
 }
@@ -1139,7 +1289,7 @@ def_log_checker_err_handler(struct config *conf, vector strvec)
 }
 
 static int
-snprint_def_log_checker_err(struct config *conf, struct strbuf *buff,
+snprint_def_log_checker_err(const struct config *conf, struct strbuf *buff,
 			    const void * data)
 {
 	if (conf->log_checker_err == LOG_CHKR_ERR_ONCE)
@@ -1201,7 +1351,7 @@ def_reservation_key_handler(struct config *conf, vector strvec)
 }
 
 static int
-snprint_def_reservation_key (struct config *conf, struct strbuf *buff,
+snprint_def_reservation_key (const struct config *conf, struct strbuf *buff,
 			     const void * data)
 {
 	return print_reservation_key(buff, conf->reservation_key,
@@ -1220,7 +1370,7 @@ mp_reservation_key_handler(struct config *conf, vector strvec)
 }
 
 static int
-snprint_mp_reservation_key (struct config *conf, struct strbuf *buff,
+snprint_mp_reservation_key (const struct config *conf, struct strbuf *buff,
 			    const void *data)
 {
 	const struct mpentry * mpe = (const struct mpentry *)data;
@@ -1351,6 +1501,22 @@ declare_hw_snprint(ghost_delay, print_off_int_undef)
 declare_mp_handler(ghost_delay, set_off_int_undef)
 declare_mp_snprint(ghost_delay, print_off_int_undef)
 
+declare_def_handler(fast_checkint, set_off_int_undef)
+declare_def_snprint(fast_checkint, print_off_int_undef)
+declare_ovr_handler(fast_checkint, set_off_int_undef)
+declare_ovr_snprint(fast_checkint, print_off_int_undef)
+declare_hw_handler(fast_checkint, set_off_int_undef)
+declare_hw_snprint(fast_checkint, print_off_int_undef)
+declare_mp_handler(fast_checkint, set_off_int_undef)
+declare_mp_snprint(fast_checkint, print_off_int_undef)
+
+declare_def_handler(array_check_rate, set_off_int_undef)
+declare_def_snprint(array_check_rate, print_off_int_undef)
+declare_ovr_handler(array_check_rate, set_off_int_undef)
+declare_ovr_snprint(array_check_rate, print_off_int_undef)
+declare_hw_handler(array_check_rate, set_off_int_undef)
+declare_hw_snprint(array_check_rate, print_off_int_undef)
+
 declare_def_handler(all_tg_pt, set_yes_no_undef)
 declare_def_snprint_defint(all_tg_pt, print_yes_no_undef, DEFAULT_ALL_TG_PT)
 declare_ovr_handler(all_tg_pt, set_yes_no_undef)
@@ -1389,6 +1555,72 @@ def_uxsock_timeout_handler(struct config *conf, vector strvec)
 	return 0;
 }
 
+static int
+def_checker_threads_handler(struct config *conf, vector strvec)
+{
+	int rc = set_int(strvec, &conf->checker_threads);
+
+	if (rc)
+		return rc;
+	if (conf->checker_threads < 1) {
+		condlog(1, "%s: invalid value for checker_threads: %d",
+			__func__, conf->checker_threads);
+		conf->checker_threads = DEFAULT_CHECKER_THREADS;
+	} else if (conf->checker_threads > MAX_CHECKER_THREADS) {
+		condlog(1, "%s: checker_threads limited to %d",
+			__func__, MAX_CHECKER_THREADS);
+		conf->checker_threads = MAX_CHECKER_THREADS;
+	}
+	return 0;
+}
+
+declare_def_snprint(checker_threads, print_int)
+
+static int
+def_discovery_threads_handler(struct config *conf, vector strvec)
+{
+	int rc = set_int(strvec, &conf->discovery_threads);
+
+	if (rc)
+		return rc;
+	if (conf->discovery_threads < 1) {
+		condlog(1, "%s: invalid value for discovery_threads: %d",
+			__func__, conf->discovery_threads);
+		conf->discovery_threads = DEFAULT_DISCOVERY_THREADS;
+	} else if (conf->discovery_threads > MAX_CHECKER_THREADS) {
+		condlog(1, "%s: discovery_threads limited to %d",
+			__func__, MAX_CHECKER_THREADS);
+		conf->discovery_threads = MAX_CHECKER_THREADS;
+	}
+	return 0;
+}
+
+declare_def_snprint(discovery_threads, print_int)
+
+static int
+def_uevent_threads_handler(struct config *conf, vector strvec)
+{
+	int rc = set_int(strvec, &conf->uevent_threads);
+
+	if (rc)
+		return rc;
+	if (conf->uevent_threads < 1) {
+		condlog(1, "%s: invalid value for uevent_threads: %d",
+			__func__, conf->uevent_threads);
+		conf->uevent_threads = DEFAULT_UEVENT_THREADS;
+	} else if (conf->uevent_threads > MAX_CHECKER_THREADS) {
+		condlog(1, "%s: uevent_threads limited to %d",
+			__func__, MAX_CHECKER_THREADS);
+		conf->uevent_threads = MAX_CHECKER_THREADS;
+	}
+	return 0;
+}
+
+declare_def_snprint(uevent_threads, print_int)
+
+declare_def_handler(internal_kpartx, set_yes_no)
+declare_def_snprint(internal_kpartx, print_yes_no)
+
 static int
 hw_vpd_vendor_handler(struct config *conf, vector strvec)
 {
@@ -1415,7 +1647,7 @@ out:
 }
 
 static int
-snprint_hw_vpd_vendor(struct config *conf, struct strbuf *buff,
+snprint_hw_vpd_vendor(const struct config *conf, struct strbuf *buff,
 		      const void * data)
 {
 	const struct hwentry * hwe = (const struct hwentry *)data;
@@ -1521,14 +1753,15 @@ declare_ble_handler(blist_protocol)
 declare_ble_handler(elist_protocol)
 
 static int
-snprint_def_uxsock_timeout(struct config *conf, struct strbuf *buff,
+snprint_def_uxsock_timeout(const struct config *conf, struct strbuf *buff,
 			   const void *data)
 {
 	return print_strbuf(buff, "%u", conf->uxsock_timeout);
 }
 
 static int
-snprint_ble_simple (struct config *conf, struct strbuf *buff, const void *data)
+snprint_ble_simple (const struct config *conf, struct strbuf *buff,
+		    const void *data)
 {
 	const struct blentry *ble = (const struct blentry *)data;
 
@@ -1552,7 +1785,7 @@ declare_ble_device_handler(vendor, elist_device, buff, NULL)
 declare_ble_device_handler(product, blist_device, NULL, buff)
 declare_ble_device_handler(product, elist_device, NULL, buff)
 
-static int snprint_bled_vendor(struct config *conf, struct strbuf *buff,
+static int snprint_bled_vendor(const struct config *conf, struct strbuf *buff,
 			       const void * data)
 {
 	const struct blentry_device * bled =
@@ -1561,7 +1794,7 @@ static int snprint_bled_vendor(struct config *conf, struct strbuf *buff,
 	return print_str(buff, bled->vendor);
 }
 
-static int snprint_bled_product(struct config *conf, struct strbuf *buff,
+static int snprint_bled_product(const struct config *conf, struct strbuf *buff,
 				const void *data)
 {
 	const struct blentry_device * bled =
@@ -1695,7 +1928,8 @@ deprecated_handler(struct config *conf, vector strvec)
 }
 
 static int
-snprint_deprecated (struct config *conf, struct strbuf *buff, const void * data)
+snprint_deprecated (const struct config *conf, struct strbuf *buff,
+		    const void * data)
 {
 	return 0;
 }
@@ -1710,8 +1944,12 @@ init_keywords(vector keywords)
 {
 	install_keyword_root("defaults", NULL);
 	install_keyword("verbosity", &def_verbosity_handler, &snprint_def_verbosity);
+	install_keyword("log_rate_limit", &def_log_rate_limit_handler, &snprint_def_log_rate_limit);
+	install_keyword("log_journal", &def_log_journal_handler, &snprint_def_log_journal);
 	install_keyword("polling_interval", &checkint_handler, &snprint_def_checkint);
 	install_keyword("max_polling_interval", &def_max_checkint_handler, &snprint_def_max_checkint);
+	install_keyword("adaptive_polling", &def_adaptive_checkint_handler, &snprint_def_adaptive_checkint);
+	install_keyword("max_polling_rate", &def_max_check_rate_handler, &snprint_def_max_check_rate);
 	install_keyword("reassign_maps", &def_reassign_maps_handler, &snprint_def_reassign_maps);
 	install_keyword("multipath_dir", &def_multipath_dir_handler, &snprint_def_multipath_dir);
 	install_keyword("path_selector", &def_selector_handler, &snprint_def_selector);
@@ -1745,6 +1983,7 @@ init_keywords(vector keywords)
 	install_keyword("eh_deadline", &def_eh_deadline_handler, &snprint_def_eh_deadline);
 	install_keyword("bindings_file", &def_bindings_file_handler, &snprint_def_bindings_file);
 	install_keyword("wwids_file", &def_wwids_file_handler, &snprint_def_wwids_file);
+	install_keyword("wwids_index", &def_wwids_index_handler, &snprint_def_wwids_index);
 	install_keyword("prkeys_file", &def_prkeys_file_handler, &snprint_def_prkeys_file);
 	install_keyword("log_checker_err", &def_log_checker_err_handler, &snprint_def_log_checker_err);
 	install_keyword("reservation_key", &def_reservation_key_handler, &snprint_def_reservation_key);
@@ -1754,6 +1993,15 @@ init_keywords(vector keywords)
 	install_keyword("detect_checker", &def_detect_checker_handler, &snprint_def_detect_checker);
 	install_keyword("force_sync", &def_force_sync_handler, &snprint_def_force_sync);
 	install_keyword("strict_timing", &def_strict_timing_handler, &snprint_def_strict_timing);
+	install_keyword("checker_threads", &def_checker_threads_handler, &snprint_def_checker_threads);
+	install_keyword("discovery_threads", &def_discovery_threads_handler, &snprint_def_discovery_threads);
+	install_keyword("uevent_threads", &def_uevent_threads_handler, &snprint_def_uevent_threads);
+	install_keyword("internal_kpartx", &def_internal_kpartx_handler, &snprint_def_internal_kpartx);
+	install_keyword("vpd_cache", &def_vpd_cache_handler, &snprint_def_vpd_cache);
+	install_keyword("alua_prio_refresh", &def_alua_prio_refresh_handler, &snprint_def_alua_prio_refresh);
+	install_keyword("prio_max_age", &def_prio_max_age_handler, &snprint_def_prio_max_age);
+	install_keyword("async_prio", &def_async_prio_handler, &snprint_def_async_prio);
+	install_keyword("recheck_siblings", &def_recheck_siblings_handler, &snprint_def_recheck_siblings);
 	install_keyword("deferred_remove", &def_deferred_remove_handler, &snprint_def_deferred_remove);
 	install_keyword("partition_delimiter", &def_partition_delim_handler, &snprint_def_partition_delim);
 	install_keyword("config_dir", &def_config_dir_handler, &snprint_def_config_dir);
@@ -1772,16 +2020,44 @@ init_keywords(vector keywords)
 	install_keyword("retrigger_tries", &def_retrigger_tries_handler, &snprint_def_retrigger_tries);
 	install_keyword("retrigger_delay", &def_retrigger_delay_handler, &snprint_def_retrigger_delay);
 	install_keyword("missing_uev_wait_timeout", &def_uev_wait_timeout_handler, &snprint_def_uev_wait_timeout);
+	install_keyword("uevent_batch_min_wait", &def_uev_batch_min_wait_handler, &snprint_def_uev_batch_min_wait);
+	install_keyword("uevent_batch_max_wait", &def_uev_batch_max_wait_handler, &snprint_def_uev_batch_max_wait);
+	install_keyword("uevent_batch_max_events", &def_uev_batch_max_events_handler, &snprint_def_uev_batch_max_events);
+	install_keyword("uevent_batch_max_time", &def_uev_batch_max_time_handler, &snprint_def_uev_batch_max_time);
+	install_keyword("reconfigure_debounce", &def_reconfigure_debounce_handler, &snprint_def_reconfigure_debounce);
+	install_keyword("reload_debounce", &def_reload_debounce_handler, &snprint_def_reload_debounce);
 	install_keyword("skip_kpartx", &def_skip_kpartx_handler, &snprint_def_skip_kpartx);
+	install_keyword("selector_autotune", &def_selector_autotune_handler, &snprint_def_selector_autotune);
 	install_keyword("disable_changed_wwids", &def_disable_changed_wwids_handler, &snprint_def_disable_changed_wwids);
 	install_keyword("remove_retries", &def_remove_retries_handler, &snprint_def_remove_retries);
 	install_keyword("max_sectors_kb", &def_max_sectors_kb_handler, &snprint_def_max_sectors_kb);
+	install_keyword("queue_profile", &def_queue_profile_handler, &snprint_def_queue_profile);
 	install_keyword("ghost_delay", &def_ghost_delay_handler, &snprint_def_ghost_delay);
+	install_keyword("fast_polling_interval", &def_fast_checkint_handler, &snprint_def_fast_checkint);
+	install_keyword("array_check_rate", &def_array_check_rate_handler, &snprint_def_array_check_rate);
 	install_keyword("find_multipaths_timeout",
 			&def_find_multipaths_timeout_handler,
 			&snprint_def_find_multipaths_timeout);
 	install_keyword("enable_foreign", &def_enable_foreign_handler,
 			&snprint_def_enable_foreign);
+	install_keyword("cpu_affinity", &def_cpu_affinity_handler,
+			&snprint_def_cpu_affinity);
+	install_keyword("sched_policy", &def_sched_policy_handler,
+			&snprint_def_sched_policy);
+	install_keyword("thread_stack_size", &def_thread_stack_size_handler,
+			&snprint_def_thread_stack_size);
+	install_keyword("mlock_memory", &def_mlock_memory_handler,
+			&snprint_def_mlock_memory);
+	install_keyword("numa_affinity", &def_numa_affinity_handler,
+			&snprint_def_numa_affinity);
+	install_keyword("unified_event_loop", &def_unified_event_loop_handler,
+			&snprint_def_unified_event_loop);
+	install_keyword("publish_state", &def_publish_state_handler,
+			&snprint_def_publish_state);
+	install_keyword("warm_restart", &def_warm_restart_handler,
+			&snprint_def_warm_restart);
+	install_keyword("io_stats", &def_io_stats_handler,
+			&snprint_def_io_stats);
 	install_keyword("marginal_pathgroups", &def_marginal_pathgroups_handler, &snprint_def_marginal_pathgroups);
 	install_keyword("recheck_wwid", &def_recheck_wwid_handler, &snprint_def_recheck_wwid);
 	__deprecated install_keyword("default_selector", &def_selector_handler, NULL);
@@ -1869,8 +2145,12 @@ init_keywords(vector keywords)
 	install_keyword("marginal_path_err_recheck_gap_time", &hw_marginal_path_err_recheck_gap_time_handler, &snprint_hw_marginal_path_err_recheck_gap_time);
 	install_keyword("marginal_path_double_failed_time", &hw_marginal_path_double_failed_time_handler, &snprint_hw_marginal_path_double_failed_time);
 	install_keyword("skip_kpartx", &hw_skip_kpartx_handler, &snprint_hw_skip_kpartx);
+	install_keyword("selector_autotune", &hw_selector_autotune_handler, &snprint_hw_selector_autotune);
 	install_keyword("max_sectors_kb", &hw_max_sectors_kb_handler, &snprint_hw_max_sectors_kb);
+	install_keyword("queue_profile", &hw_queue_profile_handler, &snprint_hw_queue_profile);
 	install_keyword("ghost_delay", &hw_ghost_delay_handler, &snprint_hw_ghost_delay);
+	install_keyword("fast_polling_interval", &hw_fast_checkint_handler, &snprint_hw_fast_checkint);
+	install_keyword("array_check_rate", &hw_array_check_rate_handler, &snprint_hw_array_check_rate);
 	install_keyword("all_tg_pt", &hw_all_tg_pt_handler, &snprint_hw_all_tg_pt);
 	install_keyword("vpd_vendor", &hw_vpd_vendor_handler, &snprint_hw_vpd_vendor);
 	install_keyword("recheck_wwid", &hw_recheck_wwid_handler, &snprint_hw_recheck_wwid);
@@ -1912,8 +2192,12 @@ init_keywords(vector keywords)
 	install_keyword("marginal_path_double_failed_time", &ovr_marginal_path_double_failed_time_handler, &snprint_ovr_marginal_path_double_failed_time);
 
 	install_keyword("skip_kpartx", &ovr_skip_kpartx_handler, &snprint_ovr_skip_kpartx);
+	install_keyword("selector_autotune", &ovr_selector_autotune_handler, &snprint_ovr_selector_autotune);
 	install_keyword("max_sectors_kb", &ovr_max_sectors_kb_handler, &snprint_ovr_max_sectors_kb);
+	install_keyword("queue_profile", &ovr_queue_profile_handler, &snprint_ovr_queue_profile);
 	install_keyword("ghost_delay", &ovr_ghost_delay_handler, &snprint_ovr_ghost_delay);
+	install_keyword("fast_polling_interval", &ovr_fast_checkint_handler, &snprint_ovr_fast_checkint);
+	install_keyword("array_check_rate", &ovr_array_check_rate_handler, &snprint_ovr_array_check_rate);
 	install_keyword("all_tg_pt", &ovr_all_tg_pt_handler, &snprint_ovr_all_tg_pt);
 	install_keyword("recheck_wwid", &ovr_recheck_wwid_handler, &snprint_ovr_recheck_wwid);
 
@@ -1922,6 +2206,7 @@ init_keywords(vector keywords)
 	install_sublevel();
 	install_keyword("wwid", &mp_wwid_handler, &snprint_mp_wwid);
 	install_keyword("alias", &mp_alias_handler, &snprint_mp_alias);
+	install_keyword("startup_priority", &mp_startup_priority_handler, &snprint_mp_startup_priority);
 	install_keyword("path_grouping_policy", &mp_pgpolicy_handler, &snprint_mp_pgpolicy);
 	install_keyword("path_selector", &mp_selector_handler, &snprint_mp_selector);
 	install_keyword("prio", &mp_prio_name_handler, &snprint_mp_prio_name);
@@ -1950,7 +2235,10 @@ init_keywords(vector keywords)
 	install_keyword("marginal_path_err_recheck_gap_time", &mp_marginal_path_err_recheck_gap_time_handler, &snprint_mp_marginal_path_err_recheck_gap_time);
 	install_keyword("marginal_path_double_failed_time", &mp_marginal_path_double_failed_time_handler, &snprint_mp_marginal_path_double_failed_time);
 	install_keyword("skip_kpartx", &mp_skip_kpartx_handler, &snprint_mp_skip_kpartx);
+	install_keyword("selector_autotune", &mp_selector_autotune_handler, &snprint_mp_selector_autotune);
 	install_keyword("max_sectors_kb", &mp_max_sectors_kb_handler, &snprint_mp_max_sectors_kb);
+	install_keyword("queue_profile", &mp_queue_profile_handler, &snprint_mp_queue_profile);
 	install_keyword("ghost_delay", &mp_ghost_delay_handler, &snprint_mp_ghost_delay);
+	install_keyword("fast_polling_interval", &mp_fast_checkint_handler, &snprint_mp_fast_checkint);
 	install_sublevel_end();
 }
@@ -14,6 +14,7 @@
 #include <errno.h>
 #include <libgen.h>
 #include <libudev.h>
+#include <urcu/uatomic.h>
 
 #include "checkers.h"
 #include "vector.h"
@@ -36,6 +37,14 @@
 #include "configure.h"
 #include "print.h"
 #include "strbuf.h"
+#include "check_sched.h"
+#include "worker_pool.h"
+#include "vpd_cache.h"
+#include "checkpoint.h"
+#include "prio_async.h"
+#include "time-util.h"
+#include "udev_cache.h"
+#include "switchgroup.h"
 
 struct vpd_vendor_page vpd_vendor_pages[VPD_VP_ARRAY_SIZE] = {
 	[VPD_VP_UNDEF]	= { 0x00, "undef" },
@@ -62,8 +71,10 @@ alloc_path_with_pathinfo (struct config *conf, struct udev_device *udevice,
 	if (!pp)
 		return PATHINFO_FAILED;
 
-	if (wwid)
+	if (wwid) {
 		strlcpy(pp->wwid, wwid, sizeof(pp->wwid));
+		hash_path_wwid(pp);
+	}
 
 	if (safe_sprintf(pp->dev, "%s", devname)) {
 		condlog(0, "pp->dev too small");
@@ -146,6 +157,148 @@ path_discover (vector pathvec, struct config * conf,
 		return pathinfo(pp, conf, flag);
 }
 
+/*
+ * path_discovery() runs pathinfo() in parallel if there are at least this
+ * many devices, and discovery_threads > 1.
+ */
+#define MIN_PARALLEL_DISCOVERY 64
+
+struct discover_job {
+	struct udev_device *udev;
+	struct path *pp;
+	/* pp was allocated by path_discovery(), and isn't in pathvec yet */
+	bool new_path;
+	int flag;
+	int rc;
+};
+
+struct discover_args {
+	struct config *conf;
+	int flag;
+};
+
+/* Progress of the running path_discovery(), accessed atomically */
+static unsigned int discovery_done;
+static unsigned int discovery_total;
+
+void get_discovery_progress(unsigned int *done, unsigned int *total)
+{
+	*done = uatomic_read(&discovery_done);
+	*total = uatomic_read(&discovery_total);
+}
+
+static void free_discover_jobs(vector jobs)
+{
+	struct discover_job *job;
+	int i;
+
+	vector_foreach_slot(jobs, job, i) {
+		if (job->new_path)
+			free_path(job->pp);
+		udev_device_unref(job->udev);
+		free(job);
+	}
+	vector_free(jobs);
+}
+
+static void cleanup_discover_jobs(void *arg)
+{
+	free_discover_jobs(arg);
+}
+
+static int
+prepare_discover_job (struct discover_job *job, const struct _vector *pathvec,
+		      int flag)
+{
+	char devt[BLK_DEV_SIZE];
+	dev_t devnum = udev_device_get_devnum(job->udev);
+	const char *devname;
+
+	snprintf(devt, BLK_DEV_SIZE, "%d:%d",
+		 major(devnum), minor(devnum));
+	job->pp = find_path_by_devt(pathvec, devt);
+	if (job->pp) {
+		/* See path_discover() */
+		job->flag = flag;
+		return 0;
+	}
+	devname = udev_device_get_sysname(job->udev);
+	if (!devname)
+		return -1;
+	job->pp = alloc_path();
+	if (!job->pp)
+		return -1;
+	job->new_path = true;
+	if (safe_sprintf(job->pp->dev, "%s", devname)) {
+		condlog(0, "pp->dev too small");
+		return -1;
+	}
+	job->pp->udev = udev_device_ref(job->udev);
+	job->flag = flag | DI_BLACKLIST;
+	return 0;
+}
+
+/*
+ * Called concurrently from worker pool threads. pathinfo() only modifies
+ * the path it's called for, except for loading checker and prioritizer
+ * classes, which is serialized in checkers.c and prio.c.
+ */
+static void run_discover_job(void *item, void *arg)
+{
+	struct discover_job *job = item;
+	const struct discover_args *args = arg;
+
+	if (!job->pp || should_exit())
+		return;
+	job->rc = pathinfo(job->pp, args->conf, job->flag);
+	uatomic_inc(&discovery_done);
+}
+
+/*
+ * Run pathinfo() for all devices in jobs in parallel, and add the new
+ * paths to pathvec in the original order afterwards.
+ * Returns the number of devices for which pathinfo() succeeded.
+ */
+static int
+discover_parallel (vector pathvec, struct config *conf, vector jobs,
+		   int flag)
+{
+	struct discover_args args = { .conf = conf };
+	struct worker_pool *pool;
+	struct discover_job *job;
+	int i, num_paths = 0;
+
+	vector_foreach_slot(jobs, job, i) {
+		job->rc = PATHINFO_FAILED;
+		if (prepare_discover_job(job, pathvec, flag) != 0) {
+			if (job->new_path)
+				free_path(job->pp);
+			job->pp = NULL;
+			job->new_path = false;
+		}
+	}
+
+	pool = worker_pool_create(conf->discovery_threads, "discovery");
+	condlog(3, "discovering %d devices with %d threads",
+		VECTOR_SIZE(jobs), worker_pool_size(pool));
+	worker_pool_run(pool, jobs, run_discover_job, &args);
+	worker_pool_destroy(pool);
+
+	vector_foreach_slot(jobs, job, i) {
+		if (job->rc == PATHINFO_OK && job->new_path) {
+			if (store_path(pathvec, job->pp) != 0)
+				job->rc = PATHINFO_FAILED;
+			else {
+				job->pp->checkint = conf->checkint;
+				job->new_path = false;
+			}
+		}
+		if (job->rc == PATHINFO_OK)
+			num_paths++;
+	}
+	return num_paths;
+}
+
 static void cleanup_udev_enumerate_ptr(void *arg)
 {
 	struct udev_enumerate *ue;
@@ -175,13 +328,21 @@ path_discovery (vector pathvec, int flag)
 	struct udev_list_entry *entry;
 	struct udev_device *udevice = NULL;
 	struct config *conf;
-	int num_paths = 0, total_paths = 0, ret;
+	struct discover_job *job;
+	vector jobs = NULL;
+	int num_paths = 0, total_paths = 0, n_devs = 0, ret, i;
 
 	pthread_cleanup_push(cleanup_udev_enumerate_ptr, &udev_iter);
 	pthread_cleanup_push(cleanup_udev_device_ptr, &udevice);
 	conf = get_multipath_config();
 	pthread_cleanup_push(put_multipath_config, conf);
 
+	uatomic_set(&discovery_done, 0);
+	uatomic_set(&discovery_total, 0);
+	if (conf->discovery_threads > 1)
+		jobs = vector_alloc();
+	pthread_cleanup_push(cleanup_discover_jobs, jobs);
+
 	udev_iter = udev_enumerate_new(udev);
 	if (!udev_iter) {
 		ret = -ENOMEM;
@@ -196,6 +357,14 @@ path_discovery (vector pathvec, int flag)
 		goto out;
 	}
 
+	/* Not all block devices are paths, but this avoids regrowing */
+	udev_list_entry_foreach(entry,
+				udev_enumerate_get_list_entry(udev_iter))
+		n_devs++;
+	vector_reserve(pathvec, VECTOR_SIZE(pathvec) + n_devs);
+	if (jobs)
+		vector_reserve(jobs, n_devs);
+
 	udev_list_entry_foreach(entry,
 				udev_enumerate_get_list_entry(udev_iter)) {
 		const char *devtype;
@@ -214,21 +383,83 @@ path_discovery (vector pathvec, int flag)
 		devtype = udev_device_get_devtype(udevice);
 		if(devtype && !strncmp(devtype, "disk", 4)) {
 			total_paths++;
+			uatomic_inc(&discovery_total);
+			/* Collect the devices, and decide later */
+			if (jobs && (job = calloc(1, sizeof(*job))) != NULL) {
+				if (vector_alloc_slot(jobs)) {
+					job->udev = udevice;
+					vector_set_slot(jobs, job);
+					udevice = NULL;
+					continue;
+				}
+				free(job);
+			}
 			if (path_discover(pathvec, conf,
 					  udevice, flag) == PATHINFO_OK)
 				num_paths++;
+			uatomic_inc(&discovery_done);
 		}
 		udevice = udev_device_unref(udevice);
 	}
+
+	if (VECTOR_SIZE(jobs) >= MIN_PARALLEL_DISCOVERY && !should_exit())
+		num_paths += discover_parallel(pathvec, conf, jobs, flag);
+	else {
+		vector_foreach_slot(jobs, job, i) {
+			if (should_exit())
+				break;
+			if (path_discover(pathvec, conf,
+					  job->udev, flag) == PATHINFO_OK)
+				num_paths++;
+			uatomic_inc(&discovery_done);
+		}
+	}
 	ret = total_paths - num_paths;
 	condlog(4, "Discovered %d/%d paths", num_paths, total_paths);
 out:
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
 	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 	return ret;
 }
 
+static void run_pathinfo_job(void *item, void *arg)
+{
+	struct path *pp = item;
+	const struct discover_args *args = arg;
+
+	if (should_exit())
+		return;
+	pathinfo(pp, args->conf, args->flag);
+}
+
+/*
+ * Unlike path_discovery(), this doesn't require a minimum number of
+ * paths, because it's meant for flags which make pathinfo() call the
+ * checker or prioritizer, which may take up to checker_timeout.
+ */
+void pathinfo_parallel(const struct _vector *paths, int flag)
+{
+	struct discover_args args = { .flag = flag };
+	struct worker_pool *pool = NULL;
+	struct config *conf;
+	int nthreads;
+
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	args.conf = conf;
+	nthreads = conf->discovery_threads;
+	if (nthreads > VECTOR_SIZE(paths))
+		nthreads = VECTOR_SIZE(paths);
+	pool = worker_pool_create(nthreads, "pathinfo");
+	condlog(4, "running pathinfo for %d paths with %d threads",
+		VECTOR_SIZE(paths), worker_pool_size(pool));
+	worker_pool_run(pool, paths, run_pathinfo_job, &args);
+	worker_pool_destroy(pool);
+	pthread_cleanup_pop(1);
+}
+
 #define declare_sysfs_get_str(fname)					\
 ssize_t									\
 sysfs_get_##fname (struct udev_device * udev, char * buff, size_t len)	\
@@ -401,24 +632,16 @@ sysfs_get_tgt_nodename(struct path *pp, char *node)
 	value = udev_device_get_sysname(tgtdev);
 	if (value && sscanf(value, "rport-%d:%d-%d",
 		   &host, &channel, &tgtid) == 3) {
-		tgtdev = udev_device_new_from_subsystem_sysname(udev,
-				"fc_remote_ports", value);
-		if (tgtdev) {
+		if (get_cached_sysattr("fc_remote_ports", value, "node_name",
+				       node, NODE_NAME_SIZE) == 0) {
 			condlog(4, "SCSI target %d:%d:%d -> "
 				"FC rport %d:%d-%d",
 				pp->sg_id.host_no, pp->sg_id.channel,
 				pp->sg_id.scsi_id, host, channel,
 				tgtid);
-			value = udev_device_get_sysattr_value(tgtdev,
-							      "node_name");
-			if (value) {
-				pp->sg_id.proto_id = SCSI_PROTOCOL_FCP;
-				pp->sg_id.transport_id = tgtid;
-				strlcpy(node, value, NODE_NAME_SIZE);
-				udev_device_unref(tgtdev);
-				return 0;
-			} else
-				udev_device_unref(tgtdev);
+			pp->sg_id.proto_id = SCSI_PROTOCOL_FCP;
+			pp->sg_id.transport_id = tgtid;
+			return 0;
 		}
 	}
 
@@ -433,23 +656,12 @@ sysfs_get_tgt_nodename(struct path *pp, char *node)
 		tgtname = NULL;
 		tgtid = -1;
 	}
-	if (parent && tgtname) {
-		tgtdev = udev_device_new_from_subsystem_sysname(udev,
-				"iscsi_session", tgtname);
-		if (tgtdev) {
-			const char *value;
-
-			value = udev_device_get_sysattr_value(tgtdev, "targetname");
-			if (value) {
-				pp->sg_id.proto_id = SCSI_PROTOCOL_ISCSI;
-				pp->sg_id.transport_id = tgtid;
-				strlcpy(node, value, NODE_NAME_SIZE);
-				udev_device_unref(tgtdev);
-				return 0;
-			}
-			else
-				udev_device_unref(tgtdev);
-		}
+	if (parent && tgtname &&
+	    get_cached_sysattr("iscsi_session", tgtname, "targetname",
+			       node, NODE_NAME_SIZE) == 0) {
+		pp->sg_id.proto_id = SCSI_PROTOCOL_ISCSI;
+		pp->sg_id.transport_id = tgtid;
+		return 0;
 	}
 	/* Check for libata */
 	parent = pp->udev;
@@ -479,6 +691,10 @@ int sysfs_get_host_adapter_name(const struct path *pp, char *adapter_name)
 	if (!pp || !adapter_name)
 		return 1;
 
+	if (pp->transport && *pp->transport->adapter) {
+		strlcpy(adapter_name, pp->transport->adapter, SLOT_NAME_SIZE);
+		return 0;
+	}
 	proto_id = pp->sg_id.proto_id;
 
 	if (proto_id != SCSI_PROTOCOL_FCP &&
@@ -502,12 +718,16 @@ int sysfs_get_host_pci_name(const struct path *pp, char *pci_name)
 {
 	struct udev_device *hostdev, *parent;
 	char host_name[HOST_NAME_LEN];
+	char key[HOST_NAME_LEN + 32];
 	const char *driver_name, *value;
 
 	if (!pp || !pci_name)
 		return 1;
 
 	sprintf(host_name, "host%d", pp->sg_id.host_no);
+	sprintf(key, "scsi_host/%s/@pci_name", host_name);
+	if (get_cached_value(key, pci_name, SLOT_NAME_SIZE) == 0)
+		return 0;
 	hostdev = udev_device_new_from_subsystem_sysname(udev,
 			"scsi_host", host_name);
 	if (!hostdev)
@@ -535,6 +755,7 @@ int sysfs_get_host_pci_name(const struct path *pp, char *pci_name)
 		}
 
 		strncpy(pci_name, value, SLOT_NAME_SIZE);
+		set_cached_value(key, value);
 		udev_device_unref(hostdev);
 		return 0;
 	}
@@ -544,26 +765,53 @@ int sysfs_get_host_pci_name(const struct path *pp, char *pci_name)
 
 int sysfs_get_iscsi_ip_address(const struct path *pp, char *ip_address)
 {
-	struct udev_device *hostdev;
 	char host_name[HOST_NAME_LEN];
-	const char *value;
 
 	sprintf(host_name, "host%d", pp->sg_id.host_no);
-	hostdev = udev_device_new_from_subsystem_sysname(udev,
-			"iscsi_host", host_name);
-	if (hostdev) {
-		value = udev_device_get_sysattr_value(hostdev,
-				"ipaddress");
-		if (value) {
-			strncpy(ip_address, value, SLOT_NAME_SIZE);
-			udev_device_unref(hostdev);
-			return 0;
-		} else
-			udev_device_unref(hostdev);
-	}
+	if (get_cached_sysattr("iscsi_host", host_name, "ipaddress",
+			       ip_address, SLOT_NAME_SIZE) == 0)
+		return 0;
 	return 1;
 }
 
+int sysfs_target_unreachable(const struct path *pp)
+{
+	struct udev_device *tgtdev;
+	const char *subsys, *attr, *up;
+	char id[42], value[32];
+	int r = -1;
+
+	if (pp->bus != SYSFS_BUS_SCSI)
+		return -1;
+	switch (pp->sg_id.proto_id) {
+	case SCSI_PROTOCOL_FCP:
+		snprintf(id, sizeof(id), "rport-%d:%d-%d", pp->sg_id.host_no,
+			 pp->sg_id.channel, pp->sg_id.transport_id);
+		subsys = "fc_remote_ports";
+		attr = "port_state";
+		up = "Online";
+		break;
+	case SCSI_PROTOCOL_ISCSI:
+		snprintf(id, sizeof(id), "session%d", pp->sg_id.transport_id);
+		subsys = "iscsi_session";
+		attr = "state";
+		up = "LOGGED_IN";
+		break;
+	default:
+		return -1;
+	}
+	/* not get_cached_sysattr(), the state must be current */
+	tgtdev = udev_device_new_from_subsystem_sysname(udev, subsys, id);
+	if (!tgtdev)
+		return -1;
+	if (sysfs_attr_get_value(tgtdev, attr, value, sizeof(value)) > 0) {
+		condlog(4, "%s: %s %s = %s", pp->dev, id, attr, value);
+		r = strcmp(value, up) != 0;
+	}
+	udev_device_unref(tgtdev);
+	return r;
+}
+
 int
 sysfs_get_asymmetric_access_state(struct path *pp, char *buff, int buflen)
 {
@@ -595,6 +843,91 @@ sysfs_get_asymmetric_access_state(struct path *pp, char *buff, int buflen)
 	return !!preferred;
 }
 
+/*
+ * Transport timeouts written during a configure pass, see
+ * start_tmo_cache(). Many paths share the same rport, iSCSI session,
+ * SAS end device and SCSI host, so most writes would just repeat the
+ * previous one. Entries are keyed on the sysname of the device, and
+ * hold the settings that have been written successfully.
+ */
+#define TMO_CACHE_SIZE 256
+
+struct tmo_cache_ent {
+	struct tmo_cache_ent *next;
+	char value[32];
+	char id[];
+};
+
+static bool tmo_cache_active;
+static struct tmo_cache_ent *tmo_cache[TMO_CACHE_SIZE];
+
+void start_tmo_cache(void)
+{
+	tmo_cache_active = true;
+}
+
+void end_tmo_cache(void)
+{
+	struct tmo_cache_ent *ent, *next;
+	int i;
+
+	for (i = 0; i < TMO_CACHE_SIZE; i++) {
+		for (ent = tmo_cache[i]; ent; ent = next) {
+			next = ent->next;
+			free(ent);
+		}
+		tmo_cache[i] = NULL;
+	}
+	tmo_cache_active = false;
+}
+
+static struct tmo_cache_ent **tmo_cache_head(const char *id)
+{
+	return &tmo_cache[hash_str(id) % TMO_CACHE_SIZE];
+}
+
+static struct tmo_cache_ent *tmo_cache_find(const char *id)
+{
+	struct tmo_cache_ent *ent;
+
+	for (ent = *tmo_cache_head(id); ent; ent = ent->next)
+		if (!strcmp(ent->id, id))
+			return ent;
+	return NULL;
+}
+
+/* true if value has been written to the device id in this pass */
+static bool tmo_cache_hit(const char *id, const char *value)
+{
+	struct tmo_cache_ent *ent;
+
+	if (!tmo_cache_active)
+		return false;
+	ent = tmo_cache_find(id);
+	return ent && !strcmp(ent->value, value);
+}
+
+static void tmo_cache_store(const char *id, const char *value)
+{
+	struct tmo_cache_ent *ent, **head;
+	size_t len;
+
+	if (!tmo_cache_active)
+		return;
+	ent = tmo_cache_find(id);
+	if (!ent) {
+		len = strlen(id) + 1;
+		ent = malloc(sizeof(*ent) + len);
+		if (!ent)
+			return;
+		memcpy(ent->id, id, len);
+		head = tmo_cache_head(id);
+		ent->next = *head;
+		*head = ent;
+	}
+	strlcpy(ent->value, value, sizeof(ent->value));
+}
+
 static int
 sysfs_set_eh_deadline(struct multipath *mpp, struct path *pp)
 {
@@ -605,12 +938,6 @@ sysfs_set_eh_deadline(struct multipath *mpp, struct path *pp)
 	if (mpp->eh_deadline == EH_DEADLINE_UNSET)
 		return 0;
 
-	sprintf(host_name, "host%d", pp->sg_id.host_no);
-	hostdev = udev_device_new_from_subsystem_sysname(udev,
-			"scsi_host", host_name);
-	if (!hostdev)
-		return 1;
-
 	if (mpp->eh_deadline == EH_DEADLINE_OFF)
 		len = sprintf(value, "off");
 	else if (mpp->eh_deadline == EH_DEADLINE_ZERO)
@@ -618,6 +945,14 @@ sysfs_set_eh_deadline(struct multipath *mpp, struct path *pp)
 	else
 		len = sprintf(value, "%d", mpp->eh_deadline);
 
+	sprintf(host_name, "host%d", pp->sg_id.host_no);
+	if (tmo_cache_hit(host_name, value))
+		return 0;
+	hostdev = udev_device_new_from_subsystem_sysname(udev,
+			"scsi_host", host_name);
+	if (!hostdev)
+		return 1;
+
 	ret = sysfs_attr_set_value(hostdev, "eh_deadline",
 				   value, len + 1);
 	/*
@@ -626,19 +961,52 @@ sysfs_set_eh_deadline(struct multipath *mpp, struct path *pp)
 	 */
 	if (ret <= 0)
 		condlog(3, "%s: failed to set eh_deadline to %s, error %d", udev_device_get_sysname(hostdev), value, -ret);
+	else
+		tmo_cache_store(host_name, value);
 
 	udev_device_unref(hostdev);
 	return (ret <= 0);
 }
 
+static bool fast_io_fail_is_tmo(const struct multipath *mpp)
+{
+	return mpp->fast_io_fail != MP_FAST_IO_FAIL_UNSET &&
+		mpp->fast_io_fail != MP_FAST_IO_FAIL_ZERO &&
+		mpp->fast_io_fail != MP_FAST_IO_FAIL_OFF;
+}
+
+/* dev_loss_tmo will be limited to 600 if fast_io_fail is _not_ set */
+static bool must_limit_dev_loss(const struct multipath *mpp)
+{
+	return !fast_io_fail_is_tmo(mpp) &&
+		mpp->dev_loss > DEFAULT_DEV_LOSS_TMO &&
+		mpp->no_path_retry != NO_PATH_RETRY_QUEUE;
+}
+
+/* Returns true if fast_io_fail is set to a timeout */
+static bool limit_rport_dev_loss(struct multipath *mpp, const char *rport_id)
+{
+	if (fast_io_fail_is_tmo(mpp))
+		return true;
+	if (must_limit_dev_loss(mpp)) {
+		condlog(2, "%s: limiting dev_loss_tmo to %d, since "
+			"fast_io_fail is not set",
+			rport_id, DEFAULT_DEV_LOSS_TMO);
+		mpp->dev_loss = DEFAULT_DEV_LOSS_TMO;
+	}
+	return false;
+}
+
 static void
 sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 {
 	struct udev_device *rport_dev = NULL;
 	char value[16], *eptr;
 	char rport_id[42];
+	char settings[32];
 	unsigned int tmo;
 	int ret;
+	bool failed = false;
 
 	if (mpp->dev_loss == DEV_LOSS_TMO_UNSET &&
 	    mpp->fast_io_fail == MP_FAST_IO_FAIL_UNSET)
@@ -646,6 +1014,17 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 
 	sprintf(rport_id, "rport-%d:%d-%d",
 		pp->sg_id.host_no, pp->sg_id.channel, pp->sg_id.transport_id);
+	if (tmo_cache_active) {
+		/* the values we'd write below */
+		snprintf(settings, sizeof(settings), "%d %u",
+			 mpp->fast_io_fail,
+			 must_limit_dev_loss(mpp) ?
+			 DEFAULT_DEV_LOSS_TMO : mpp->dev_loss);
+		if (tmo_cache_hit(rport_id, settings)) {
+			limit_rport_dev_loss(mpp, rport_id);
+			return;
+		}
+	}
 	rport_dev = udev_device_new_from_subsystem_sysname(udev,
 				"fc_remote_ports", rport_id);
 	if (!rport_dev) {
@@ -683,9 +1062,7 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 	 * then set fast_io_fail, and _then_ set dev_loss_tmo
 	 * to the correct value.
 	 */
-	if (mpp->fast_io_fail != MP_FAST_IO_FAIL_UNSET &&
-	    mpp->fast_io_fail != MP_FAST_IO_FAIL_ZERO &&
-	    mpp->fast_io_fail != MP_FAST_IO_FAIL_OFF) {
+	if (limit_rport_dev_loss(mpp, rport_id)) {
 		/* Check if we need to temporarily increase dev_loss_tmo */
 		if ((unsigned int)mpp->fast_io_fail >= tmo) {
 			/* Increase dev_loss_tmo temporarily */
@@ -704,12 +1081,6 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 				goto out;
 			}
 		}
-	} else if (mpp->dev_loss > DEFAULT_DEV_LOSS_TMO &&
-		mpp->no_path_retry != NO_PATH_RETRY_QUEUE) {
-		condlog(2, "%s: limiting dev_loss_tmo to %d, since "
-			"fast_io_fail is not set",
-			rport_id, DEFAULT_DEV_LOSS_TMO);
-		mpp->dev_loss = DEFAULT_DEV_LOSS_TMO;
 	}
 	if (mpp->fast_io_fail != MP_FAST_IO_FAIL_UNSET) {
 		if (mpp->fast_io_fail == MP_FAST_IO_FAIL_OFF)
@@ -721,6 +1092,7 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 		ret = sysfs_attr_set_value(rport_dev, "fast_io_fail_tmo",
 					   value, strlen(value));
 		if (ret <= 0) {
+			failed = true;
 			if (ret == -EBUSY)
 				condlog(3, "%s: rport blocked", rport_id);
 			else
@@ -733,6 +1105,7 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 		ret = sysfs_attr_set_value(rport_dev, "dev_loss_tmo",
 					   value, strlen(value));
 		if (ret <= 0) {
+			failed = true;
 			if (ret == -EBUSY)
 				condlog(3, "%s: rport blocked", rport_id);
 			else
@@ -740,6 +1113,11 @@ sysfs_set_rport_tmo(struct multipath *mpp, struct path *pp)
 					rport_id, value, -ret);
 		}
 	}
+	if (!failed && tmo_cache_active) {
+		snprintf(settings, sizeof(settings), "%d %u",
+			 mpp->fast_io_fail, mpp->dev_loss);
+		tmo_cache_store(rport_id, settings);
+	}
 out:
 	udev_device_unref(rport_dev);
 }
@@ -757,6 +1135,12 @@ sysfs_set_session_tmo(struct multipath *mpp, struct path *pp)
 		return;
 
 	sprintf(session_id, "session%d", pp->sg_id.transport_id);
+	if (mpp->fast_io_fail != MP_FAST_IO_FAIL_OFF &&
+	    mpp->fast_io_fail != MP_FAST_IO_FAIL_ZERO) {
+		snprintf(value, 11, "%u", mpp->fast_io_fail);
+		if (tmo_cache_hit(session_id, value))
+			return;
+	}
 	session_dev = udev_device_new_from_subsystem_sysname(udev,
 				"iscsi_session", session_id);
 	if (!session_dev) {
@@ -780,7 +1164,8 @@ sysfs_set_session_tmo(struct multipath *mpp, struct path *pp)
 						 value, strlen(value)) <= 0) {
 				condlog(3, "%s: Failed to set recovery_tmo, "
 					" error %d", pp->dev, errno);
-			}
+			} else
+				tmo_cache_store(session_id, value);
 		}
 	}
 	udev_device_unref(session_dev);
@@ -812,6 +1197,9 @@ sysfs_set_nexus_loss_tmo(struct multipath *mpp, struct path *pp)
 		condlog(1, "%s: No SAS end device", pp->dev);
 		return;
 	}
+	snprintf(value, 11, "%u", mpp->dev_loss);
+	if (tmo_cache_hit(end_dev_id, value))
+		return;
 	sas_dev = udev_device_new_from_subsystem_sysname(udev,
 				"sas_end_device", end_dev_id);
 	if (!sas_dev) {
@@ -829,6 +1217,8 @@ sysfs_set_nexus_loss_tmo(struct multipath *mpp, struct path *pp)
 			condlog(3, "%s: failed to update "
 				"I_T Nexus loss timeout, error %d",
 				pp->dev, errno);
+		else
+			tmo_cache_store(end_dev_id, value);
 	}
 	udev_device_unref(sas_dev);
 	return;
@@ -967,17 +1357,21 @@ get_serial (char * str, int maxlen, int fd)
 	if (fd < 0)
 		return 1;
 
-	if (0 == do_inq(fd, 0, 1, 0x80, buff, MX_ALLOC_LEN)) {
-		len = buff[3];
-		if (len >= maxlen)
+	if (vpd_cache_get(fd, 0x80, (unsigned char *)buff, MX_ALLOC_LEN) < 0) {
+		if (0 != do_inq(fd, 0, 1, 0x80, buff, MX_ALLOC_LEN))
 			return 1;
-		if (len > 0) {
-			memcpy(str, buff + 4, len);
-			str[len] = '\0';
-		}
-		return 0;
+		len = get_unaligned_be16(&buff[2]) + 4;
+		if ((unsigned char)buff[1] == 0x80 && len <= MX_ALLOC_LEN)
+			vpd_cache_put(fd, 0x80, (unsigned char *)buff, len);
 	}
-	return 1;
+	len = buff[3];
+	if (len >= maxlen)
+		return 1;
+	if (len > 0) {
+		memcpy(str, buff + 4, len);
+		str[len] = '\0';
+	}
+	return 0;
 }
 
 /*
@@ -1107,6 +1501,23 @@ parse_vpd_pg80(const unsigned char *in, char *out, size_t out_len)
 	return len;
 }
 
+/* out must have room for 2 * len + 1 bytes */
+static size_t hex_encode(char *out, const unsigned char *in, size_t len)
+{
+	static const char hex_digits[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		*out++ = hex_digits[in[i] >> 4];
+		*out++ = hex_digits[in[i] & 0xf];
+	}
+	*out = '\0';
+	return 2 * len;
+}
+
+/* Priority of the NAA designator of an IEEE Registered Extended name */
+#define VPD_PRIO_MAX 8
+
 static int
 parse_vpd_pg83(const unsigned char *in, size_t in_len,
 	       char *out, size_t out_len)
@@ -1117,7 +1528,8 @@ parse_vpd_pg83(const unsigned char *in, size_t in_len,
 	int vpd_type, prio = -1, naa_prio;
 
 	d = in + 4;
-	while (d < in + in_len) {
+	/* No later designator can beat the best one */
+	while (d < in + in_len && prio < VPD_PRIO_MAX) {
 		/* Select 'association: LUN' */
 		if ((d[1] & 0x30) != 0) {
 			d += d[3] + 4;
@@ -1129,7 +1541,7 @@ parse_vpd_pg83(const unsigned char *in, size_t in_len,
 			switch (d[4] >> 4) {
 			case 6:
 				/* IEEE Registered Extended: Prio 8 */
-				naa_prio = 8;
+				naa_prio = VPD_PRIO_MAX;
 				break;
 			case 5:
 				/* IEEE Registered: Prio 7 */
@@ -1193,18 +1605,15 @@ parse_vpd_pg83(const unsigned char *in, size_t in_len,
 	vpd_len = vpd[3];
 	vpd += 4;
 	if (vpd_type == 0x2 || vpd_type == 0x3) {
-		size_t i;
-
-		len = sprintf(out, "%d", vpd_type);
+		out[0] = '0' + vpd_type;
+		len = 1;
 		if (2 * vpd_len >= out_len - len) {
 			condlog(1, "%s: WWID overflow, type %d, %zu/%zu bytes required",
 				__func__, vpd_type,
 				2 * vpd_len + len + 1, out_len);
 			vpd_len = (out_len - len - 1) / 2;
 		}
-		for (i = 0; i < vpd_len; i++)
-			len += sprintf(out + len,
-				       "%02x", vpd[i]);
+		len += hex_encode(out + len, vpd, vpd_len);
 	} else if (vpd_type == 0x8 && vpd_len < 4) {
 		condlog(1, "%s: VPD length %zu too small for designator type 8",
 			__func__, vpd_len);
@@ -1349,6 +1758,9 @@ fetch_vpd_page(int fd, int pg, unsigned char *buff, int maxlen)
 	int buff_len;
 
 	memset(buff, 0x0, maxlen);
+	buff_len = vpd_cache_get(fd, pg, buff, maxlen);
+	if (buff_len > 0)
+		return buff_len;
 	if (sgio_get_vpd(buff, maxlen, fd, pg) < 0) {
 		int lvl = pg == 0x80 || pg == 0x83 ? 3 : 4;
 
@@ -1366,7 +1778,8 @@ fetch_vpd_page(int fd, int pg, unsigned char *buff, int maxlen)
 	if (buff_len > maxlen) {
 		condlog(3, "vpd pg%02x page truncated", pg);
 		buff_len = maxlen;
-	}
+	} else
+		vpd_cache_put(fd, pg, buff, buff_len);
 	return buff_len;
 }
 
@@ -1415,8 +1828,57 @@ get_vpd_sgio (int fd, int pg, int vend_id, char * str, int maxlen)
 	return len;
 }
 
+static bool has_host_adapter(const struct path *pp)
+{
+	return pp->sg_id.proto_id == SCSI_PROTOCOL_FCP ||
+		pp->sg_id.proto_id == SCSI_PROTOCOL_SAS ||
+		pp->sg_id.proto_id == SCSI_PROTOCOL_ISCSI ||
+		pp->sg_id.proto_id == SCSI_PROTOCOL_SRP;
+}
+
+/*
+ * Resolve the transport attributes once here, rather than every time
+ * paths are listed or grouped by host adapter.
+ */
+static void get_path_transport(struct path *pp)
+{
+	struct path_transport *tp;
+	char id[42];
+
+	if (!has_host_adapter(pp)) {
+		free(pp->transport);
+		pp->transport = NULL;
+		return;
+	}
+	if (!pp->transport) {
+		pp->transport = malloc(sizeof(*pp->transport));
+		if (!pp->transport)
+			return;
+	}
+	tp = pp->transport;
+	memset(tp, 0, sizeof(*tp));
+
+	if (sysfs_get_host_adapter_name(pp, tp->adapter))
+		*tp->adapter = '\0';
+	if (pp->sg_id.proto_id != SCSI_PROTOCOL_FCP)
+		return;
+
+	sprintf(id, "host%d", pp->sg_id.host_no);
+	if (get_cached_sysattr("fc_host", id, "node_name",
+			       tp->host_wwnn, sizeof(tp->host_wwnn)))
+		*tp->host_wwnn = '\0';
+	if (get_cached_sysattr("fc_host", id, "port_name",
+			       tp->host_wwpn, sizeof(tp->host_wwpn)))
+		*tp->host_wwpn = '\0';
+	sprintf(id, "rport-%d:%d-%d", pp->sg_id.host_no, pp->sg_id.channel,
+		pp->sg_id.transport_id);
+	if (get_cached_sysattr("fc_remote_ports", id, "port_name",
+			       tp->tgt_wwpn, sizeof(tp->tgt_wwpn)))
+		*tp->tgt_wwpn = '\0';
+}
+
 static int
-scsi_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
+scsi_sysfs_pathinfo (struct path *pp, const struct config *conf)
 {
 	struct udev_device *parent;
 	const char *attr_path = NULL;
@@ -1440,25 +1902,25 @@ scsi_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 	if (!attr_path || pp->sg_id.host_no == -1)
 		return PATHINFO_FAILED;
 
-	if (sysfs_get_vendor(parent, pp->vendor_id, SCSI_VENDOR_SIZE) <= 0)
+	if (sysfs_get_vendor(parent, pp->ident->vendor_id, SCSI_VENDOR_SIZE) <= 0)
 		return PATHINFO_FAILED;;
 
-	condlog(3, "%s: vendor = %s", pp->dev, pp->vendor_id);
+	condlog(3, "%s: vendor = %s", pp->dev, pp->ident->vendor_id);
 
-	if (sysfs_get_model(parent, pp->product_id, PATH_PRODUCT_SIZE) <= 0)
+	if (sysfs_get_model(parent, pp->ident->product_id, PATH_PRODUCT_SIZE) <= 0)
 		return PATHINFO_FAILED;;
 
-	condlog(3, "%s: product = %s", pp->dev, pp->product_id);
+	condlog(3, "%s: product = %s", pp->dev, pp->ident->product_id);
 
-	if (sysfs_get_rev(parent, pp->rev, PATH_REV_SIZE) < 0)
+	if (sysfs_get_rev(parent, pp->ident->rev, PATH_REV_SIZE) < 0)
 		return PATHINFO_FAILED;;
 
-	condlog(3, "%s: rev = %s", pp->dev, pp->rev);
+	condlog(3, "%s: rev = %s", pp->dev, pp->ident->rev);
 
 	/*
 	 * set the hwe configlet pointer
 	 */
-	find_hwe(hwtable, pp->vendor_id, pp->product_id, pp->rev, pp->hwe);
+	lookup_hwe(conf, pp->ident->vendor_id, pp->ident->product_id, pp->ident->rev, pp->hwe);
 
 	/*
 	 * host / bus / target / lun
@@ -1473,17 +1935,19 @@ scsi_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 	/*
 	 * target node name
 	 */
-	if(sysfs_get_tgt_nodename(pp, pp->tgt_node_name))
+	if(sysfs_get_tgt_nodename(pp, pp->ident->tgt_node_name))
 		return PATHINFO_FAILED;
 
 	condlog(3, "%s: tgt_node_name = %s",
-		pp->dev, pp->tgt_node_name);
+		pp->dev, pp->ident->tgt_node_name);
+
+	get_path_transport(pp);
 
 	return PATHINFO_OK;
 }
 
 static int
-nvme_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
+nvme_sysfs_pathinfo (struct path *pp, const struct config *conf)
 {
 	struct udev_device *parent;
 	const char *attr_path = NULL;
@@ -1510,26 +1974,26 @@ nvme_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 	attr = udev_device_get_sysattr_value(parent, "cntlid");
 	pp->sg_id.channel = attr ? atoi(attr) : 0;
 
-	snprintf(pp->vendor_id, SCSI_VENDOR_SIZE, "NVME");
-	snprintf(pp->product_id, PATH_PRODUCT_SIZE, "%s",
+	snprintf(pp->ident->vendor_id, SCSI_VENDOR_SIZE, "NVME");
+	snprintf(pp->ident->product_id, PATH_PRODUCT_SIZE, "%s",
 		 udev_device_get_sysattr_value(parent, "model"));
-	snprintf(pp->serial, SERIAL_SIZE, "%s",
+	snprintf(pp->ident->serial, SERIAL_SIZE, "%s",
 		 udev_device_get_sysattr_value(parent, "serial"));
-	snprintf(pp->rev, PATH_REV_SIZE, "%s",
+	snprintf(pp->ident->rev, PATH_REV_SIZE, "%s",
 		 udev_device_get_sysattr_value(parent, "firmware_rev"));
 
-	condlog(3, "%s: vendor = %s", pp->dev, pp->vendor_id);
-	condlog(3, "%s: product = %s", pp->dev, pp->product_id);
-	condlog(3, "%s: serial = %s", pp->dev, pp->serial);
-	condlog(3, "%s: rev = %s", pp->dev, pp->rev);
+	condlog(3, "%s: vendor = %s", pp->dev, pp->ident->vendor_id);
+	condlog(3, "%s: product = %s", pp->dev, pp->ident->product_id);
+	condlog(3, "%s: serial = %s", pp->dev, pp->ident->serial);
+	condlog(3, "%s: rev = %s", pp->dev, pp->ident->rev);
 
-	find_hwe(hwtable, pp->vendor_id, pp->product_id, NULL, pp->hwe);
+	lookup_hwe(conf, pp->ident->vendor_id, pp->ident->product_id, NULL, pp->hwe);
 
 	return PATHINFO_OK;
 }
 
 static int
-ccw_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
+ccw_sysfs_pathinfo (struct path *pp, const struct config *conf)
 {
 	struct udev_device *parent;
 	char attr_buff[NAME_SIZE];
@@ -1545,27 +2009,27 @@ ccw_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 	if (!parent)
 		return PATHINFO_FAILED;
 
-	sprintf(pp->vendor_id, "IBM");
+	sprintf(pp->ident->vendor_id, "IBM");
 
-	condlog(3, "%s: vendor = %s", pp->dev, pp->vendor_id);
+	condlog(3, "%s: vendor = %s", pp->dev, pp->ident->vendor_id);
 
 	if (sysfs_get_devtype(parent, attr_buff, FILE_NAME_SIZE) <= 0)
 		return PATHINFO_FAILED;
 
 	if (!strncmp(attr_buff, "3370", 4)) {
-		sprintf(pp->product_id,"S/390 DASD FBA");
+		sprintf(pp->ident->product_id,"S/390 DASD FBA");
 	} else if (!strncmp(attr_buff, "9336", 4)) {
-		sprintf(pp->product_id,"S/390 DASD FBA");
+		sprintf(pp->ident->product_id,"S/390 DASD FBA");
 	} else {
-		sprintf(pp->product_id,"S/390 DASD ECKD");
+		sprintf(pp->ident->product_id,"S/390 DASD ECKD");
 	}
 
-	condlog(3, "%s: product = %s", pp->dev, pp->product_id);
+	condlog(3, "%s: product = %s", pp->dev, pp->ident->product_id);
 
 	/*
 	 * set the hwe configlet pointer
 	 */
-	find_hwe(hwtable, pp->vendor_id, pp->product_id, NULL, pp->hwe);
+	lookup_hwe(conf, pp->ident->vendor_id, pp->ident->product_id, NULL, pp->hwe);
 
 	/*
 	 * host / bus / target / lun
@@ -1590,7 +2054,7 @@ ccw_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 }
 
 static int
-cciss_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
+cciss_sysfs_pathinfo (struct path *pp, const struct config *conf)
 {
 	const char * attr_path = NULL;
 	struct udev_device *parent;
@@ -1612,25 +2076,25 @@ cciss_sysfs_pathinfo (struct path *pp, const struct _vector *hwtable)
 	if (!attr_path || pp->sg_id.host_no == -1)
 		return PATHINFO_FAILED;
 
-	if (sysfs_get_vendor(parent, pp->vendor_id, SCSI_VENDOR_SIZE) <= 0)
+	if (sysfs_get_vendor(parent, pp->ident->vendor_id, SCSI_VENDOR_SIZE) <= 0)
 		return PATHINFO_FAILED;
 
-	condlog(3, "%s: vendor = %s", pp->dev, pp->vendor_id);
+	condlog(3, "%s: vendor = %s", pp->dev, pp->ident->vendor_id);
 
-	if (sysfs_get_model(parent, pp->product_id, PATH_PRODUCT_SIZE) <= 0)
+	if (sysfs_get_model(parent, pp->ident->product_id, PATH_PRODUCT_SIZE) <= 0)
 		return PATHINFO_FAILED;
 
-	condlog(3, "%s: product = %s", pp->dev, pp->product_id);
+	condlog(3, "%s: product = %s", pp->dev, pp->ident->product_id);
 
-	if (sysfs_get_rev(parent, pp->rev, PATH_REV_SIZE) <= 0)
+	if (sysfs_get_rev(parent, pp->ident->rev, PATH_REV_SIZE) <= 0)
 		return PATHINFO_FAILED;
 
-	condlog(3, "%s: rev = %s", pp->dev, pp->rev);
+	condlog(3, "%s: rev = %s", pp->dev, pp->ident->rev);
 
 	/*
 	 * set the hwe configlet pointer
 	 */
-	find_hwe(hwtable, pp->vendor_id, pp->product_id, pp->rev, pp->hwe);
+	lookup_hwe(conf, pp->ident->vendor_id, pp->ident->product_id, pp->ident->rev, pp->hwe);
 
 	/*
 	 * host / bus / target / lun
@@ -1707,7 +2171,8 @@ path_offline (struct path * pp)
 	}
 
 	memset(buff, 0x0, SCSI_STATE_SIZE);
-	err = sysfs_attr_get_value(parent, "state", buff, SCSI_STATE_SIZE);
+	err = sysfs_attr_fd_get_value(&pp->state_attr, parent, "state",
+				      buff, SCSI_STATE_SIZE);
 	if (err <= 0) {
 		if (err == -ENXIO)
 			return PATH_REMOVED;
@@ -1748,7 +2213,7 @@ path_offline (struct path * pp)
 }
 
 static int
-sysfs_pathinfo(struct path *pp, const struct _vector *hwtable)
+sysfs_pathinfo(struct path *pp, const struct config *conf)
 {
 	int r = common_sysfs_pathinfo(pp);
 
@@ -1767,13 +2232,13 @@ sysfs_pathinfo(struct path *pp, const struct _vector *hwtable)
 
 	switch (pp->bus) {
 	case SYSFS_BUS_SCSI:
-		return scsi_sysfs_pathinfo(pp, hwtable);
+		return scsi_sysfs_pathinfo(pp, conf);
 	case SYSFS_BUS_CCW:
-		return ccw_sysfs_pathinfo(pp, hwtable);
+		return ccw_sysfs_pathinfo(pp, conf);
 	case SYSFS_BUS_CCISS:
-		return cciss_sysfs_pathinfo(pp, hwtable);
+		return cciss_sysfs_pathinfo(pp, conf);
 	case SYSFS_BUS_NVME:
-		return nvme_sysfs_pathinfo(pp, hwtable);
+		return nvme_sysfs_pathinfo(pp, conf);
 	case SYSFS_BUS_UNDEF:
 	default:
 		return PATHINFO_OK;
@@ -1828,29 +2293,28 @@ scsi_ioctl_pathinfo (struct path * pp, int mask)
 	if (!attr_path || pp->sg_id.host_no == -1)
 		return;
 
-	if (get_vpd_sysfs(parent, 0x80, pp->serial, SERIAL_SIZE) <= 0) {
-		if (get_serial(pp->serial, SERIAL_SIZE, pp->fd)) {
+	if (get_vpd_sysfs(parent, 0x80, pp->ident->serial, SERIAL_SIZE) <= 0) {
+		if (get_serial(pp->ident->serial, SERIAL_SIZE, pp->fd)) {
 			condlog(3, "%s: fail to get serial", pp->dev);
 			return;
 		}
 	}
 
-	condlog(3, "%s: serial = %s", pp->dev, pp->serial);
+	condlog(3, "%s: serial = %s", pp->dev, pp->ident->serial);
 	return;
 }
 
 static void
 cciss_ioctl_pathinfo(struct path *pp)
 {
-	get_serial(pp->serial, SERIAL_SIZE, pp->fd);
-	condlog(3, "%s: serial = %s", pp->dev, pp->serial);
+	get_serial(pp->ident->serial, SERIAL_SIZE, pp->fd);
+	condlog(3, "%s: serial = %s", pp->dev, pp->ident->serial);
 }
 
 int
-get_state (struct path * pp, struct config *conf, int daemon, int oldstate)
+prepare_checker (struct path * pp, struct config *conf, int daemon)
 {
 	struct checker * c = &pp->checker;
-	int state;
 
 	if (!checker_selected(c)) {
 		if (daemon) {
@@ -1883,22 +2347,89 @@ get_state (struct path * pp, struct config *conf, int daemon, int oldstate)
 	if (!conf->checker_timeout &&
 	    sysfs_get_timeout(pp, &(c->timeout)) <= 0)
 		c->timeout = DEF_TIMEOUT;
-	state = checker_check(c, oldstate);
+	return 0;
+}
+
+void
+log_checker_state (const struct path * pp, int state)
+{
+	const struct checker * c = &pp->checker;
+
+	/* called for every checked path */
+	if (!condlog_enabled(3))
+		return;
 	condlog(3, "%s: %s state = %s", pp->dev,
 		checker_name(c), checker_state_name(state));
 	if (state != PATH_UP && state != PATH_GHOST &&
 	    strlen(checker_message(c)))
 		condlog(3, "%s: %s checker%s",
 			pp->dev, checker_name(c), checker_message(c));
+}
+
+int
+get_state (struct path * pp, struct config *conf, int daemon, int oldstate)
+{
+	int state;
+
+	state = prepare_checker(pp, conf, daemon);
+	if (state != 0)
+		return state;
+	state = checker_check(&pp->checker, oldstate);
+	log_checker_state(pp, state);
 	return state;
 }
 
+/*
+ * With alua_prio_refresh > 0, the alua prioritizer is only run if the
+ * ALUA state that scsi_dh_alua exposes in sysfs has changed since the
+ * last run, or if alua_prio_refresh updates have been skipped in a row.
+ * scsi_dh_alua updates the sysfs state on ALUA state change unit
+ * attentions, so reading it is a cheap way to watch for changes.
+ */
+static bool
+alua_prio_unchanged(struct path *pp, int refresh)
+{
+	char state[sizeof(pp->alua_state)];
+	int rc;
+	size_t len;
+
+	if (refresh <= 0 || strcmp(prio_name(&pp->prio), PRIO_ALUA))
+		return false;
+	rc = sysfs_get_asymmetric_access_state(pp, state, sizeof(state) - 1);
+	if (rc < 0) {
+		pp->alua_state[0] = '\0';
+		return false;
+	}
+	/* A change of the preferred bit changes the priority, too */
+	len = strlen(state);
+	state[len] = rc ? '+' : '-';
+	state[len + 1] = '\0';
+
+	if (pp->priority != PRIO_UNDEF && pp->alua_prio_skipped < refresh &&
+	    !strcmp(state, pp->alua_state)) {
+		pp->alua_prio_skipped++;
+		return true;
+	}
+	strlcpy(pp->alua_state, state, sizeof(pp->alua_state));
+	pp->alua_prio_skipped = 0;
+	return false;
+}
+
+static void set_prio_time(struct path *pp)
+{
+	struct timespec now;
+
+	get_monotonic_time(&now);
+	pp->prio_time = now.tv_sec;
+	pp->prio_state = pp->state;
+}
+
 static int
-get_prio (struct path * pp, int timeout)
+do_get_prio (struct path * pp, int timeout, bool async)
 {
 	struct prio * p;
 	struct config *conf;
-	int old_prio;
+	int old_prio, refresh, prio;
 
 	if (!pp)
 		return 0;
@@ -1916,8 +2447,25 @@ get_prio (struct path * pp, int timeout)
 			return 1;
 		}
 	}
+	conf = get_multipath_config();
+	refresh = conf->alua_prio_refresh;
+	async = async && conf->async_prio == YN_YES;
+	put_multipath_config(conf);
+	if (alua_prio_unchanged(pp, refresh)) {
+		condlog(4, "%s: alua state unchanged, keeping prio = %d",
+			pp->dev, pp->priority);
+		set_prio_time(pp);
+		return 0;
+	}
 	old_prio = pp->priority;
-	pp->priority = prio_getprio(p, pp, timeout);
+	if (!async)
+		prio = prio_getprio(p, pp, timeout);
+	else if (prio_getprio_async(pp, timeout, &prio) != 0) {
+		condlog(4, "%s: %s prio pending, keeping prio = %d",
+			pp->dev, prio_name(p), pp->priority);
+		return 0;
+	}
+	pp->priority = prio;
 	if (pp->priority < 0) {
 		/* this changes pp->offline, but why not */
 		int state = path_offline(pp);
@@ -1935,9 +2483,24 @@ get_prio (struct path * pp, int timeout)
 	}
 	condlog((old_prio == pp->priority ? 4 : 3), "%s: %s prio = %u",
 		pp->dev, prio_name(p), pp->priority);
+	set_prio_time(pp);
 	return 0;
 }
 
+static int
+get_prio (struct path * pp, int timeout, bool async)
+{
+	int old_prio, rc;
+
+	if (!pp)
+		return 0;
+	old_prio = pp->priority;
+	rc = do_get_prio(pp, timeout, async);
+	if (pp->priority != old_prio)
+		invalidate_pg_prios();
+	return rc;
+}
+
 /*
  * Mangle string of length *len starting at start
  * by removing character sequence "00" (hex for a 0 byte),
@@ -2168,6 +2731,7 @@ get_uid (struct path * pp, int path_state, struct udev_device *udev,
 	}
 
 	memset(pp->wwid, 0, WWID_SIZE);
+	pp->wwid_hash = 0;
 	if (pp->getuid) {
 		char buff[CALLOUT_MAX_SIZE];
 
@@ -2214,18 +2778,40 @@ get_uid (struct path * pp, int path_state, struct udev_device *udev,
 		for (i = strlen(pp->wwid); i > 0 && pp->wwid[i-1] == ' '; i--);
 			/* no-op */
 		pp->wwid[i] = '\0';
+		hash_path_wwid(pp);
 	}
 	condlog((used_fallback)? 1 : 3, "%s: uid = %s (%s)", pp->dev,
 		*pp->wwid == '\0' ? "<empty>" : pp->wwid, origin);
 	return 0;
 }
 
-int pathinfo(struct path *pp, struct config *conf, int mask)
+/*
+ * Take the checker state and priority from the checkpoint that
+ * multipathd saved before it was restarted, see checkpoint.h. The
+ * checker is still set up for the checker loop.
+ */
+static bool restore_path_state(struct path *pp, struct config *conf,
+			       int *prio)
 {
-	int path_state;
+	int state;
 
-	if (!pp || !conf)
-		return PATHINFO_FAILED;
+	if (checkpoint_lookup(pp, &state, prio) != 0)
+		return false;
+	if (prepare_checker(pp, conf, 0) != 0) {
+		*prio = PRIO_UNDEF;
+		return false;
+	}
+	condlog(3, "%s: state %s from checkpoint", pp->dev,
+		checker_state_name(state));
+	pp->chkrstate = state;
+	set_path_state(pp, state);
+	return true;
+}
+
+static int do_pathinfo(struct path *pp, struct config *conf, int mask)
+{
+	int path_state;
+	int restored_prio = PRIO_UNDEF;
 
 	/* Treat removed paths as if they didn't exist */
 	if (pp->initialized == INIT_REMOVED)
@@ -2238,17 +2824,21 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 	 * message with the mask value.
 	 */
 	if (pp->udev) {
-		const char *hidden =
-			udev_device_get_sysattr_value(pp->udev, "hidden");
+		const char *hidden;
 
+		/*
+		 * Foreign libraries must see hidden devices, too. The
+		 * nvme library uses them to track native multipath paths.
+		 */
+		if (is_claimed_by_foreign(pp->udev))
+			return PATHINFO_SKIPPED;
+
+		hidden = udev_device_get_sysattr_value(pp->udev, "hidden");
 		if (hidden && !strcmp(hidden, "1")) {
 			condlog(4, "%s: hidden", pp->dev);
 			return PATHINFO_SKIPPED;
 		}
 
-		if (is_claimed_by_foreign(pp->udev))
-			return PATHINFO_SKIPPED;
-
 		/*
 		 * uid_attribute is required for filter_property below,
 		 * and needs access to pp->hwe.
@@ -2279,7 +2869,7 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 	 * fetch info available in sysfs
 	 */
 	if (mask & DI_SYSFS) {
-		int rc = sysfs_pathinfo(pp, conf->hwtable);
+		int rc = sysfs_pathinfo(pp, conf);
 
 		if (rc != PATHINFO_OK)
 			return rc;
@@ -2288,7 +2878,7 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 		    pp->sg_id.proto_id == SCSI_PROTOCOL_USB &&
 		    !conf->allow_usb_devices) {
 			condlog(3, "%s: skip USB device %s", pp->dev,
-				pp->tgt_node_name);
+				pp->ident->tgt_node_name);
 			return PATHINFO_SKIPPED;
 		}
 	}
@@ -2302,7 +2892,7 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 
 		if (filter_property(conf, pp->udev, 4, pp->uid_attribute) > 0 ||
 		    filter_device(conf->blist_device, conf->elist_device,
-				  pp->vendor_id, pp->product_id, pp->dev) > 0 ||
+				  pp->ident->vendor_id, pp->ident->product_id, pp->dev) > 0 ||
 		    filter_protocol(conf->blist_protocol, conf->elist_protocol,
 				    pp) > 0)
 			return PATHINFO_SKIPPED;
@@ -2312,20 +2902,24 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 	if (path_state == PATH_REMOVED)
 		goto blank;
 	else if (mask & DI_NOIO) {
-		if (mask & DI_CHECKER)
+		if (mask & DI_CHECKER) {
 			/*
 			 * Avoid any IO on the device itself.
 			 * simply use the path_offline() return as its state
 			 */
-			pp->chkrstate = pp->state = path_state;
+			pp->chkrstate = path_state;
+			set_path_state(pp, path_state);
+		}
 		return PATHINFO_OK;
 	}
 
 	/*
 	 * fetch info not available through sysfs
 	 */
-	if (pp->fd < 0)
+	if (pp->fd < 0) {
 		pp->fd = open(udev_device_get_devnode(pp->udev), O_RDONLY);
+		path_fd_opened(pp);
+	}
 
 	if (pp->fd < 0) {
 		condlog(4, "Couldn't open device node for %s: %s",
@@ -2343,22 +2937,28 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 		cciss_ioctl_pathinfo(pp);
 
 	if (mask & DI_CHECKER) {
-		if (path_state == PATH_UP) {
+		if (path_state == PATH_UP &&
+		    restore_path_state(pp, conf, &restored_prio)) {
+			/* the checker loop will verify it soon */
+		} else if (path_state == PATH_UP) {
 			int newstate = get_state(pp, conf, 0, path_state);
 			if (newstate != PATH_PENDING ||
 			    pp->state == PATH_UNCHECKED ||
-			    pp->state == PATH_WILD)
-				pp->chkrstate = pp->state = newstate;
+			    pp->state == PATH_WILD) {
+				pp->chkrstate = newstate;
+				set_path_state(pp, newstate);
+			}
 			if (pp->state == PATH_TIMEOUT)
-				pp->state = PATH_DOWN;
+				set_path_state(pp, PATH_DOWN);
 			if (pp->state == PATH_UP && !pp->size) {
 				condlog(3, "%s: device size is 0, "
 					"path unusable", pp->dev);
-				pp->state = PATH_GHOST;
+				set_path_state(pp, PATH_GHOST);
 			}
 		} else {
 			condlog(3, "%s: path inaccessible", pp->dev);
-			pp->chkrstate = pp->state = path_state;
+			pp->chkrstate = path_state;
+			set_path_state(pp, path_state);
 		}
 	}
 
@@ -2370,7 +2970,7 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 				return PATHINFO_SKIPPED;
 			if (pp->initialized != INIT_FAILED) {
 				pp->initialized = INIT_MISSING_UDEV;
-				pp->tick = conf->retrigger_delay;
+				set_path_tick(pp, conf->retrigger_delay);
 			} else if (pp->retriggers >= conf->retrigger_tries &&
 				   (pp->state == PATH_UP || pp->state == PATH_GHOST)) {
 				/*
@@ -2383,7 +2983,7 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 				 */
 				STRBUF_ON_STACK(buf);
 
-				snprint_path(&buf, "%T", pp, 0);
+				snprint_path(&buf, "%T", pp, NULL);
 				condlog(1, "%s: no WWID in state \"%s\", giving up",
 					pp->dev, get_strbuf_str(&buf));
 				return PATHINFO_SKIPPED;
@@ -2391,7 +2991,7 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 			return PATHINFO_OK;
 		}
 		else
-			pp->tick = 1;
+			set_path_tick(pp, 1);
 	}
 
 	if (mask & DI_BLACKLIST && mask & DI_WWID) {
@@ -2407,9 +3007,13 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 	  * for too long.
 	  */
 	if ((mask & DI_PRIO) && path_state == PATH_UP && strlen(pp->wwid)) {
-		if (pp->state != PATH_DOWN || pp->priority == PRIO_UNDEF) {
+		if (restored_prio != PRIO_UNDEF)
+			pp->priority = restored_prio;
+		else if (pp->state != PATH_DOWN ||
+			 pp->priority == PRIO_UNDEF) {
 			get_prio(pp, (pp->state != PATH_DOWN)?
-				     (conf->checker_timeout * 1000) : 10);
+				     (conf->checker_timeout * 1000) : 10,
+				 mask & DI_ASYNC);
 		}
 	}
 
@@ -2421,9 +3025,27 @@ blank:
 	/*
 	 * Recoverable error, for example faulty or offline path
 	 */
-	pp->chkrstate = pp->state = PATH_DOWN;
-	if (pp->initialized == INIT_NEW || pp->initialized == INIT_FAILED)
+	pp->chkrstate = PATH_DOWN;
+	set_path_state(pp, PATH_DOWN);
+	if (pp->initialized == INIT_NEW || pp->initialized == INIT_FAILED) {
 		memset(pp->wwid, 0, WWID_SIZE);
+		pp->wwid_hash = 0;
+	}
 
 	return PATHINFO_OK;
 }
+
+int pathinfo(struct path *pp, struct config *conf, int mask)
+{
+	int rc;
+
+	if (!pp || !conf)
+		return PATHINFO_FAILED;
+	/* The identification strings are only changed with these flags */
+	if ((!pp->ident || mask & (DI_SYSFS | DI_SERIAL)) &&
+	    unshare_path_ident(pp))
+		return PATHINFO_FAILED;
+	rc = do_pathinfo(pp, conf, mask);
+	intern_path_ident(pp);
+	return rc;
+}
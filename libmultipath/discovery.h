@@ -31,10 +31,24 @@
 struct config;
 
 int path_discovery (vector pathvec, int flag);
+/*
+ * Call pathinfo() with flag for all paths in paths, using up to
+ * discovery_threads threads. The paths must not be modified otherwise
+ * until this returns.
+ */
+void pathinfo_parallel(const struct _vector *paths, int flag);
+/* Devices examined and found so far by the running path_discovery() */
+void get_discovery_progress(unsigned int *done, unsigned int *total);
 int path_get_tpgs(struct path *pp); /* This function never returns TPGS_UNDEF */
 int do_tur (char *);
 int path_offline (struct path *);
 int get_state (struct path * pp, struct config * conf, int daemon, int state);
+/*
+ * The two halves of get_state(): prepare_checker() returns 0 if the checker
+ * is ready to be called, and PATH_UNCHECKED otherwise.
+ */
+int prepare_checker (struct path * pp, struct config * conf, int daemon);
+void log_checker_state (const struct path * pp, int state);
 int get_vpd_sgio (int fd, int pg, int vend_id, char * str, int maxlen);
 int pathinfo (struct path * pp, struct config * conf, int mask);
 int alloc_path_with_pathinfo (struct config *conf, struct udev_device *udevice,
@@ -43,9 +57,20 @@ int store_pathinfo (vector pathvec, struct config *conf,
 		    struct udev_device *udevice, int flag,
 		    struct path **pp_ptr);
 int sysfs_set_scsi_tmo (struct multipath *mpp, unsigned int checkint);
+/*
+ * Between these calls, sysfs_set_scsi_tmo() skips writing transport
+ * timeouts that it has already written to the same device.
+ */
+void start_tmo_cache(void);
+void end_tmo_cache(void);
 int sysfs_get_timeout(const struct path *pp, unsigned int *timeout);
 int sysfs_get_host_pci_name(const struct path *pp, char *pci_name);
 int sysfs_get_iscsi_ip_address(const struct path *pp, char *ip_address);
+/*
+ * Returns 1 if the FC remote port or iSCSI session of the SCSI target
+ * of pp is down, 0 if it's up, and -1 if the transport doesn't tell.
+ */
+int sysfs_target_unreachable(const struct path *pp);
 int sysfs_get_host_adapter_name(const struct path *pp,
 				char *adapter_name);
 ssize_t sysfs_get_vpd (struct udev_device *udev, unsigned char pg,
@@ -70,6 +95,7 @@ enum discovery_mode {
 	__DI_WWID,
 	__DI_BLACKLIST,
 	__DI_NOIO,
+	__DI_ASYNC,
 };
 
 #define DI_SYSFS	(1 << __DI_SYSFS)
@@ -79,6 +105,8 @@ enum discovery_mode {
 #define DI_WWID		(1 << __DI_WWID)
 #define DI_BLACKLIST	(1 << __DI_BLACKLIST)
 #define DI_NOIO		(1 << __DI_NOIO) /* Avoid IO on the device */
+/* Run the prioritizer asynchronously if async_prio is set */
+#define DI_ASYNC	(1 << __DI_ASYNC)
 
 #define DI_ALL		(DI_SYSFS  | DI_SERIAL | DI_CHECKER | DI_PRIO | \
 			 DI_WWID)
@@ -0,0 +1,174 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/dm-ioctl.h>
+
+#include "debug.h"
+#include "devmapper.h"
+#include "dm-direct.h"
+
+#define DM_CONTROL_PATH "/dev/mapper/control"
+/* Like libdevmapper, enough for the status of maps with many paths */
+#define DM_BUF_MIN 16384
+#define DM_BUF_MAX (1024 * 1024)
+
+struct dm_buf {
+	size_t size;
+	/* for the alignment of struct dm_ioctl */
+	uint64_t data[];
+};
+
+static pthread_once_t dm_direct_once = PTHREAD_ONCE_INIT;
+static int control_fd = -1;
+static pthread_key_t buf_key;
+static bool buf_key_ok;
+
+static void dm_direct_init(void)
+{
+	control_fd = open(DM_CONTROL_PATH, O_RDWR | O_CLOEXEC);
+	if (control_fd < 0)
+		condlog(3, "%s: failed to open %s, using libdevmapper: %m",
+			__func__, DM_CONTROL_PATH);
+	if (pthread_key_create(&buf_key, free) == 0)
+		buf_key_ok = true;
+}
+
+static bool dm_direct_usable(void)
+{
+	pthread_once(&dm_direct_once, dm_direct_init);
+	return control_fd >= 0 && buf_key_ok;
+}
+
+void cleanup_dm_direct(void)
+{
+	if (buf_key_ok) {
+		free(pthread_getspecific(buf_key));
+		pthread_setspecific(buf_key, NULL);
+	}
+	if (control_fd >= 0) {
+		close(control_fd);
+		control_fd = -1;
+	}
+}
+
+/* The calling thread's buffer, grown to at least size bytes */
+static void *get_dm_buf(size_t size)
+{
+	struct dm_buf *buf = pthread_getspecific(buf_key), *new;
+
+	if (buf && buf->size >= size)
+		return buf->data;
+	new = malloc(sizeof(*new) + size);
+	if (!new)
+		return NULL;
+	new->size = size;
+	if (pthread_setspecific(buf_key, new) != 0) {
+		free(new);
+		return NULL;
+	}
+	free(buf);
+	return new->data;
+}
+
+static struct dm_ioctl *prepare_dm_ioctl(const char *name, size_t size)
+{
+	struct dm_ioctl *dmi;
+
+	if (strlen(name) >= DM_NAME_LEN)
+		return NULL;
+	dmi = get_dm_buf(size < DM_BUF_MIN ? DM_BUF_MIN : size);
+	if (!dmi)
+		return NULL;
+	memset(dmi, 0, sizeof(*dmi));
+	/* The kernel only checks the major number, and the minimum minor */
+	dmi->version[0] = DM_VERSION_MAJOR;
+	dmi->data_size = size;
+	dmi->data_start = sizeof(*dmi);
+	dmi->flags = DM_SKIP_BDGET_FLAG;
+	strcpy(dmi->name, name);
+	return dmi;
+}
+
+int dm_direct_message(const char *name, const char *message)
+{
+	struct dm_ioctl *dmi;
+	struct dm_target_msg *tmsg;
+	size_t len = strlen(message) + 1;
+	int err;
+
+	if (!dm_direct_usable())
+		return DM_DIRECT_FALLBACK;
+	/* The multipath target messages don't return data */
+	dmi = prepare_dm_ioctl(name, sizeof(*dmi) + sizeof(*tmsg) + len);
+	if (!dmi)
+		return DM_DIRECT_FALLBACK;
+	tmsg = (void *)dmi + dmi->data_start;
+	tmsg->sector = 0;
+	memcpy(tmsg->message, message, len);
+
+	if (ioctl(control_fd, DM_TARGET_MSG, dmi) == 0)
+		return 0;
+	err = errno;
+	condlog(2, "%s: %s: DM_TARGET_MSG failed: %s", __func__, name,
+		strerror(err));
+	return err;
+}
+
+int dm_direct_status(const char *name, char **outstatus)
+{
+	size_t size = DM_BUF_MIN;
+	struct dm_ioctl *dmi;
+	struct dm_target_spec *spec;
+	const char *status, *end;
+
+	if (!dm_direct_usable())
+		return DM_DIRECT_FALLBACK;
+
+	for (;;) {
+		dmi = prepare_dm_ioctl(name, size);
+		if (!dmi)
+			return DM_DIRECT_FALLBACK;
+		if (ioctl(control_fd, DM_TABLE_STATUS, dmi) != 0) {
+			int err = errno;
+
+			condlog(3, "%s: %s: DM_TABLE_STATUS failed: %s",
+				__func__, name, strerror(err));
+			return err == ENXIO ? DMP_NOT_FOUND : DMP_ERR;
+		}
+		if (!(dmi->flags & DM_BUFFER_FULL_FLAG))
+			break;
+		if (size >= DM_BUF_MAX) {
+			condlog(2, "%s: %s: status exceeds %d bytes", __func__,
+				name, DM_BUF_MAX);
+			return DMP_ERR;
+		}
+		size *= 2;
+	}
+
+	/* Like dm_get_status(), accept only a single multipath target */
+	if (dmi->target_count != 1)
+		return DMP_NOT_FOUND;
+	spec = (void *)dmi + dmi->data_start;
+	if (strncmp(spec->target_type, TGT_MPATH, DM_MAX_TYPE_NAME))
+		return DMP_NOT_FOUND;
+
+	status = (const char *)(spec + 1);
+	end = (const char *)dmi + dmi->data_size;
+	if (status >= end || !memchr(status, '\0', end - status)) {
+		condlog(2, "%s: %s: malformed status", __func__, name);
+		return DMP_ERR;
+	}
+	if (!outstatus)
+		return DMP_OK;
+	*outstatus = strdup(status);
+	return *outstatus ? DMP_OK : DMP_ERR;
+}
@@ -0,0 +1,38 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _DM_DIRECT_H
+#define _DM_DIRECT_H
+
+/*
+ * Direct DM ioctls for the multipath target messages and status queries
+ * which multipathd sends very often, e.g. while failing over many paths.
+ * They use an fd for /dev/mapper/control that is opened once, and a
+ * per-thread ioctl buffer, and skip libdevmapper's task setup and its
+ * global lock. All other DM operations, in particular those that need
+ * udev synchronization, keep using libdevmapper.
+ *
+ * If the direct path can't be used, the functions return
+ * DM_DIRECT_FALLBACK before doing anything, and the caller must use
+ * libdevmapper instead.
+ */
+#define DM_DIRECT_FALLBACK -1
+
+/*
+ * Send message to sector 0 of the map name.
+ * Returns 0 on success, DM_DIRECT_FALLBACK, or a positive errno value.
+ */
+int dm_direct_message(const char *name, const char *message);
+
+/*
+ * Get the status of the map name, which must have a single multipath
+ * target. If outstatus is not NULL, it is set to a copy of the status
+ * string, which the caller must free.
+ * Returns DMP_OK, DMP_NOT_FOUND, DMP_ERR, or DM_DIRECT_FALLBACK.
+ */
+int dm_direct_status(const char *name, char **outstatus);
+
+/* Close the control fd and free the calling thread's buffer */
+void cleanup_dm_direct(void);
+
+#endif /* _DM_DIRECT_H */
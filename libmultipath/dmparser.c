@@ -16,30 +16,84 @@
 #include "debug.h"
 #include "dmparser.h"
 #include "strbuf.h"
+#include "latency_weight.h"
+#include "strpool.h"
 
 #define WORD_SIZE 64
 
-static int
-merge_words(char **dst, const char *word)
+/*
+ * Words in dm table and status strings are parsed in place, without
+ * copying them. A word is terminated by a blank or the end of the
+ * string, so that atoi() and sscanf() can be used on it directly.
+ */
+struct dm_word {
+	const char *str;
+	int len;
+};
+
+/* Returns false if there are no more words */
+static bool next_word(const char **p, struct dm_word *w)
 {
-	char * p = *dst;
-	int len, dstlen;
+	const char *s = *p;
+
+	while (*s == ' ')
+		s++;
+	if (*s == '\0')
+		return false;
+	w->str = s;
+	while (*s != ' ' && *s != '\0')
+		s++;
+	w->len = s - w->str;
+	*p = s;
+	return true;
+}
 
-	dstlen = strlen(*dst);
-	len = dstlen + strlen(word) + 2;
-	*dst = REALLOC(*dst, len);
+static void skip_words(const char **p, int n)
+{
+	struct dm_word w;
 
-	if (!*dst) {
-		free(p);
-		return 1;
-	}
+	while (n-- > 0 && next_word(p, &w))
+		;
+}
 
-	p = *dst + dstlen;
-	*p = ' ';
-	++p;
-	strncpy(p, word, len - dstlen - 1);
+static bool next_int(const char **p, int *val)
+{
+	struct dm_word w;
 
-	return 0;
+	if (!next_word(p, &w))
+		return false;
+	*val = atoi(w.str);
+	return true;
+}
+
+/*
+ * Read a count and that many words following it, and return them as
+ * one string, like "2 pg_init_retries 50".
+ */
+static char *dup_counted_words(const char **p)
+{
+	struct dm_word w;
+	const char *start;
+	char *str, *d;
+	int i, n;
+
+	if (!next_word(p, &w))
+		return NULL;
+	start = w.str;
+	n = atoi(w.str);
+	for (i = 0; i < n; i++)
+		if (!next_word(p, &w))
+			return NULL;
+
+	str = MALLOC(*p - start + 1);
+	if (!str)
+		return NULL;
+	/* collapse blanks between words */
+	for (d = str; start < *p; start++)
+		if (*start != ' ' || d[-1] != ' ')
+			*d++ = *start;
+	*d = '\0';
+	return str;
 }
 
 /*
@@ -52,6 +106,7 @@ int assemble_map(struct multipath *mp, char **params)
 	int i, j;
 	int minio;
 	int nr_priority_groups, initial_pg_nr;
+	bool weights = use_latency_weights(mp);
 	STRBUF_ON_STACK(buff);
 	struct pathgroup * pgp;
 	struct path * pp;
@@ -75,8 +130,8 @@ int assemble_map(struct multipath *mp, char **params)
 
 	vector_foreach_slot (mp->pg, pgp, i) {
 		pgp = VECTOR_SLOT(mp->pg, i);
-		if (print_strbuf(&buff, " %s %i 1", mp->selector,
-				 VECTOR_SIZE(pgp->paths)) < 0)
+		if (print_strbuf(&buff, " %s %i %i", mp->selector,
+				 VECTOR_SIZE(pgp->paths), weights ? 2 : 1) < 0)
 			goto err;
 
 		vector_foreach_slot (pgp->paths, pp, j) {
@@ -91,6 +146,10 @@ int assemble_map(struct multipath *mp, char **params)
 			}
 			if (print_strbuf(&buff, " %s %d", pp->dev_t, tmp_minio) < 0)
 				goto err;
+			if (weights &&
+			    print_strbuf(&buff, " %d",
+					 path_relative_throughput(pgp, pp)) < 0)
+				goto err;
 		}
 	}
 
@@ -111,11 +170,11 @@ err:
 int disassemble_map(const struct _vector *pathvec,
 		    const char *params, struct multipath *mpp)
 {
-	char * word;
-	const char *p;
-	int i, j, k;
-	int num_features = 0;
-	int num_hwhandler = 0;
+	struct dm_word word;
+	char devt[BLK_DEV_SIZE];
+	const char *p, *sel;
+	char *word_str;
+	int i, j;
 	int num_pg = 0;
 	int num_pg_args = 0;
 	int num_paths = 0;
@@ -132,61 +191,27 @@ int disassemble_map(const struct _vector *pathvec,
 	/*
 	 * features
 	 */
-	p += get_word(p, &mpp->features);
-
+	mpp->features = dup_counted_words(&p);
 	if (!mpp->features)
 		return 1;
 
-	num_features = atoi(mpp->features);
-
-	for (i = 0; i < num_features; i++) {
-		p += get_word(p, &word);
-
-		if (!word)
-			return 1;
-
-		if (merge_words(&mpp->features, word)) {
-			FREE(word);
-			return 1;
-		}
-
-		FREE(word);
-	}
-
 	/*
 	 * hwhandler
 	 */
-	p += get_word(p, &mpp->hwhandler);
-
+	word_str = dup_counted_words(&p);
+	if (!word_str)
+		return 1;
+	mpp->hwhandler = strpool_get(word_str);
+	FREE(word_str);
 	if (!mpp->hwhandler)
 		return 1;
 
-	num_hwhandler = atoi(mpp->hwhandler);
-
-	for (i = 0; i < num_hwhandler; i++) {
-		p += get_word(p, &word);
-
-		if (!word)
-			return 1;
-
-		if (merge_words(&mpp->hwhandler, word)) {
-			FREE(word);
-			return 1;
-		}
-		FREE(word);
-	}
-
 	/*
 	 * nb of path groups
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &num_pg))
 		return 1;
 
-	num_pg = atoi(word);
-	FREE(word);
-
 	if (num_pg > 0) {
 		if (!mpp->pg) {
 			mpp->pg = vector_alloc();
@@ -201,45 +226,24 @@ int disassemble_map(const struct _vector *pathvec,
 	/*
 	 * first pg to try
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &mpp->nextpg))
 		goto out;
 
-	mpp->nextpg = atoi(word);
-	FREE(word);
-
 	for (i = 0; i < num_pg; i++) {
 		/*
-		 * selector
+		 * selector and number of selector args
 		 */
-
+		if (!next_word(&p, &word))
+			goto out;
+		sel = word.str;
+		if (!next_int(&p, &num_pg_args))
+			goto out;
 		if (!mpp->selector) {
-			p += get_word(p, &mpp->selector);
-
+			mpp->selector = strpool_getn(sel, p - sel);
 			if (!mpp->selector)
 				goto out;
-
-			/*
-			 * selector args
-			 */
-			p += get_word(p, &word);
-
-			if (!word)
-				goto out;
-
-			num_pg_args = atoi(word);
-
-			if (merge_words(&mpp->selector, word))
-				goto out1;
-			FREE(word);
-		} else {
-			p += get_word(p, NULL);
-			p += get_word(p, NULL);
 		}
-
-		for (j = 0; j < num_pg_args; j++)
-			p += get_word(p, NULL);
+		skip_words(&p, num_pg_args);
 
 		/*
 		 * paths
@@ -254,86 +258,73 @@ int disassemble_map(const struct _vector *pathvec,
 			goto out;
 		}
 
-		p += get_word(p, &word);
-
-		if (!word)
-			goto out;
-
-		num_paths = atoi(word);
-		FREE(word);
-
-		p += get_word(p, &word);
-
-		if (!word)
+		if (!next_int(&p, &num_paths) ||
+		    !next_int(&p, &num_paths_args))
 			goto out;
 
-		num_paths_args = atoi(word);
-		FREE(word);
-
 		for (j = 0; j < num_paths; j++) {
-			pp = NULL;
-			p += get_word(p, &word);
-
-			if (!word)
+			if (!next_word(&p, &word))
 				goto out;
+			strlcpy(devt, word.str,
+				word.len < BLK_DEV_SIZE ?
+				word.len + 1 : BLK_DEV_SIZE);
 
-			pp = find_path_by_devt(pathvec, word);
+			pp = find_path_by_devt(pathvec, devt);
 
 			if (!pp) {
 				pp = alloc_path();
 
 				if (!pp)
-					goto out1;
+					goto out;
 
-				strlcpy(pp->dev_t, word, BLK_DEV_SIZE);
+				strlcpy(pp->dev_t, devt, BLK_DEV_SIZE);
 
 				if (store_path(pgp->paths, pp)) {
 					free_path(pp);
-					goto out1;
+					goto out;
 				}
 			} else if (store_path(pgp->paths, pp))
-				goto out1;
-
-			FREE(word);
+				goto out;
 
 			pgp->id ^= (long)pp;
 			pp->pgindex = i + 1;
 
-			for (k = 0; k < num_paths_args; k++)
-				if (k == 0) {
-					p += get_word(p, &word);
-					def_minio = atoi(word);
-					FREE(word);
-
-					if (!strncmp(mpp->selector,
-						     "round-robin", 11)) {
+			if (num_paths_args == 0)
+				continue;
 
-						if (mpp->rr_weight == RR_WEIGHT_PRIO
-						    && pp->priority > 0)
-							def_minio /= pp->priority;
+			if (next_int(&p, &def_minio)) {
+				if (!strncmp(mpp->selector, "round-robin", 11)) {
 
-					}
+					if (mpp->rr_weight == RR_WEIGHT_PRIO
+					    && pp->priority > 0)
+						def_minio /= pp->priority;
 
-					if (def_minio != mpp->minio)
-						mpp->minio = def_minio;
 				}
-				else
-					p += get_word(p, NULL);
 
+				if (def_minio != mpp->minio)
+					mpp->minio = def_minio;
+			}
+			if (num_paths_args >= 2 &&
+			    !strncmp(mpp->selector, "service-time", 12)) {
+				if (!next_int(&p, &pp->rel_throughput))
+					goto out;
+				skip_words(&p, num_paths_args - 2);
+			} else
+				skip_words(&p, num_paths_args - 1);
 		}
 	}
+	invalidate_path_counts(mpp);
 	return 0;
-out1:
-	FREE(word);
 out:
 	free_pgvec(mpp->pg, KEEP_PATHS);
 	mpp->pg = NULL;
+	invalidate_path_counts(mpp);
 	return 1;
 }
 
 int disassemble_status(const char *params, struct multipath *mpp)
 {
-	char *word;
+	struct dm_word word;
 	const char *p;
 	int i, j, k;
 	int num_feature_args;
@@ -352,60 +343,39 @@ int disassemble_status(const char *params, struct multipath *mpp)
 	/*
 	 * features
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &num_feature_args))
 		return 1;
 
-	num_feature_args = atoi(word);
-	FREE(word);
-
 	for (i = 0; i < num_feature_args; i++) {
 		if (i == 1) {
-			p += get_word(p, &word);
-
-			if (!word)
+			if (!next_int(&p, &mpp->queuedio))
 				return 1;
-
-			mpp->queuedio = atoi(word);
-			FREE(word);
 			continue;
 		}
 		/* unknown */
-		p += get_word(p, NULL);
+		skip_words(&p, 1);
 	}
 	/*
 	 * hwhandler
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &num_hwhandler_args))
 		return 1;
 
-	num_hwhandler_args = atoi(word);
-	FREE(word);
-
-	for (i = 0; i < num_hwhandler_args; i++)
-		p += get_word(p, NULL);
+	skip_words(&p, num_hwhandler_args);
 
 	/*
 	 * nb of path groups
 	 */
-	p += get_word(p, &word);
-
-	if (!word)
+	if (!next_int(&p, &num_pg))
 		return 1;
 
-	num_pg = atoi(word);
-	FREE(word);
-
 	if (num_pg == 0)
 		return 0;
 
 	/*
 	 * next pg to try
 	 */
-	p += get_word(p, NULL);
+	skip_words(&p, 1);
 
 	if (VECTOR_SIZE(mpp->pg) < num_pg)
 		return 1;
@@ -415,12 +385,10 @@ int disassemble_status(const char *params, struct multipath *mpp)
 		/*
 		 * PG status
 		 */
-		p += get_word(p, &word);
-
-		if (!word)
+		if (!next_word(&p, &word))
 			return 1;
 
-		switch (*word) {
+		switch (*word.str) {
 		case 'D':
 			pgp->status = PGSTATE_DISABLED;
 			break;
@@ -434,29 +402,16 @@ int disassemble_status(const char *params, struct multipath *mpp)
 			pgp->status = PGSTATE_UNDEF;
 			break;
 		}
-		FREE(word);
 
 		/*
 		 * PG Status (discarded, would be '0' anyway)
 		 */
-		p += get_word(p, NULL);
-
-		p += get_word(p, &word);
-
-		if (!word)
-			return 1;
-
-		num_paths = atoi(word);
-		FREE(word);
+		skip_words(&p, 1);
 
-		p += get_word(p, &word);
-
-		if (!word)
+		if (!next_int(&p, &num_paths) ||
+		    !next_int(&p, &num_pg_args))
 			return 1;
 
-		num_pg_args = atoi(word);
-		FREE(word);
-
 		if (VECTOR_SIZE(pgp->paths) < num_paths)
 			return 1;
 
@@ -465,17 +420,15 @@ int disassemble_status(const char *params, struct multipath *mpp)
 			/*
 			 * path
 			 */
-			p += get_word(p, NULL);
+			skip_words(&p, 1);
 
 			/*
 			 * path status
 			 */
-			p += get_word(p, &word);
-
-			if (!word)
+			if (!next_word(&p, &word))
 				return 1;
 
-			switch (*word) {
+			switch (*word.str) {
 			case 'F':
 				pp->dmstate = PSTATE_FAILED;
 				break;
@@ -485,32 +438,25 @@ int disassemble_status(const char *params, struct multipath *mpp)
 			default:
 				break;
 			}
-			FREE(word);
 			/*
 			 * fail count
 			 */
-			p += get_word(p, &word);
-
-			if (!word)
+			if (!next_int(&p, &pp->failcount))
 				return 1;
 
-			pp->failcount = atoi(word);
-			FREE(word);
-
 			/*
 			 * selector args
 			 */
 			for (k = 0; k < num_pg_args; k++) {
 				if (!strncmp(mpp->selector,
-					     "least-pending", 13)) {
-					p += get_word(p, &word);
-					if (sscanf(word,"%d:*d",
+					     "least-pending", 13) &&
+				    next_word(&p, &word)) {
+					if (sscanf(word.str, "%d:*d",
 						   &def_minio) == 1 &&
 					    def_minio != mpp->minio)
 							mpp->minio = def_minio;
-					FREE(word);
 				} else
-					p += get_word(p, NULL);
+					skip_words(&p, 1);
 			}
 		}
 	}
@@ -0,0 +1,57 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <limits.h>
+#include <string.h>
+#include "fail_rate.h"
+
+#define BUCKET(w, b) ((w)->count[(b) % FAIL_WINDOW_BUCKETS])
+
+static unsigned long bucket_of(time_t now)
+{
+	return now > 0 ? (unsigned long)now / FAIL_WINDOW_BUCKET_SECS : 0;
+}
+
+void fail_window_add(struct fail_window *w, time_t now)
+{
+	unsigned long b = bucket_of(now);
+
+	if (b > w->head) {
+		if (b - w->head >= FAIL_WINDOW_BUCKETS)
+			memset(w->count, 0, sizeof(w->count));
+		else
+			while (w->head < b)
+				BUCKET(w, ++w->head) = 0;
+		w->head = b;
+	}
+	/* the monotonic clock doesn't go backwards, count late adds now */
+	if (BUCKET(w, w->head) < UCHAR_MAX)
+		BUCKET(w, w->head)++;
+}
+
+unsigned int fail_window_count(const struct fail_window *w, time_t now,
+			       unsigned int secs)
+{
+	unsigned long b = bucket_of(now), last;
+	unsigned int n, sum = 0;
+
+	n = (secs + FAIL_WINDOW_BUCKET_SECS - 1) / FAIL_WINDOW_BUCKET_SECS;
+	if (n == 0)
+		n = 1;
+	else if (n > FAIL_WINDOW_BUCKETS)
+		n = FAIL_WINDOW_BUCKETS;
+
+	/* buckets from b - n + 1 to b, as far as they're still in w */
+	last = b >= n ? b - n + 1 : 0;
+	if (w->head >= FAIL_WINDOW_BUCKETS &&
+	    last <= w->head - FAIL_WINDOW_BUCKETS)
+		last = w->head - FAIL_WINDOW_BUCKETS + 1;
+	if (b > w->head)
+		b = w->head;
+	for (; b >= last; b--) {
+		sum += BUCKET(w, b);
+		if (b == 0)
+			break;
+	}
+	return sum;
+}
@@ -0,0 +1,37 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _FAIL_RATE_H
+#define _FAIL_RATE_H
+
+#include <time.h>
+
+/*
+ * Sliding window of path failures, counted in buckets of
+ * FAIL_WINDOW_BUCKET_SECS seconds of monotonic time. Adding a failure
+ * and counting the failures of the recent past don't depend on the
+ * number of failures, and no timestamps are stored. Counts are exact
+ * to bucket granularity: a failure counts as long as its bucket
+ * overlaps the time frame. A zeroed struct is an empty window.
+ */
+#define FAIL_WINDOW_BUCKETS 60
+#define FAIL_WINDOW_BUCKET_SECS 10
+#define FAIL_WINDOW_SECS (FAIL_WINDOW_BUCKETS * FAIL_WINDOW_BUCKET_SECS)
+
+struct fail_window {
+	/* number of the newest bucket, now / FAIL_WINDOW_BUCKET_SECS */
+	unsigned long head;
+	/* saturating */
+	unsigned char count[FAIL_WINDOW_BUCKETS];
+};
+
+/* now is the time of the failure, from get_monotonic_time() */
+void fail_window_add(struct fail_window *w, time_t now);
+/*
+ * Failures in the last secs seconds before now. Time frames longer
+ * than FAIL_WINDOW_SECS are cut to the window size.
+ */
+unsigned int fail_window_count(const struct fail_window *w, time_t now,
+			       unsigned int secs);
+
+#endif /* _FAIL_RATE_H */
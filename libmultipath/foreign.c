@@ -437,7 +437,7 @@ void check_foreign(void)
 }
 
 /* Call this after get_path_layout */
-void foreign_path_layout(void)
+void foreign_path_layout(fieldwidth_t *width)
 {
 	struct foreign *fgn;
 	int i;
@@ -452,12 +452,12 @@ void foreign_path_layout(void)
 	vector_foreach_slot(foreigns, fgn, i) {
 		const struct _vector *vec;
 
-		fgn->lock(fgn->context);
+		(fgn->lock)(fgn->context);
 		pthread_cleanup_push(fgn->unlock, fgn->context);
 
 		vec = fgn->get_paths(fgn->context);
 		if (vec != NULL) {
-			_get_path_layout(vec, LAYOUT_RESET_NOT);
+			_get_path_layout(vec, LAYOUT_RESET_NOT, width);
 		}
 		fgn->release_paths(fgn->context, vec);
 
@@ -468,7 +468,7 @@ void foreign_path_layout(void)
 }
 
 /* Call this after get_multipath_layout */
-void foreign_multipath_layout(void)
+void foreign_multipath_layout(fieldwidth_t *width)
 {
 	struct foreign *fgn;
 	int i;
@@ -483,12 +483,12 @@ void foreign_multipath_layout(void)
 	vector_foreach_slot(foreigns, fgn, i) {
 		const struct _vector *vec;
 
-		fgn->lock(fgn->context);
+		(fgn->lock)(fgn->context);
 		pthread_cleanup_push(fgn->unlock, fgn->context);
 
 		vec = fgn->get_multipaths(fgn->context);
 		if (vec != NULL) {
-			_get_multipath_layout(vec, LAYOUT_RESET_NOT);
+			_get_multipath_layout(vec, LAYOUT_RESET_NOT, width);
 		}
 		fgn->release_multipaths(fgn->context, vec);
 
@@ -498,7 +498,8 @@ void foreign_multipath_layout(void)
 	pthread_cleanup_pop(1);
 }
 
-int snprint_foreign_topology(struct strbuf *buf, int verbosity)
+int snprint_foreign_topology(struct strbuf *buf, int verbosity,
+			     const fieldwidth_t *p_width)
 {
 	struct foreign *fgn;
 	int i;
@@ -516,14 +517,14 @@ int snprint_foreign_topology(struct strbuf *buf, int verbosity)
 		const struct gen_multipath *gm;
 		int j;
 
-		fgn->lock(fgn->context);
+		(fgn->lock)(fgn->context);
 		pthread_cleanup_push(fgn->unlock, fgn->context);
 
 		vec = fgn->get_multipaths(fgn->context);
 		if (vec != NULL) {
 			vector_foreach_slot(vec, gm, j) {
 				if (_snprint_multipath_topology(
-					    gm, buf, verbosity) < 0)
+					    gm, buf, verbosity, p_width) < 0)
 					break;
 			}
 		}
@@ -538,12 +539,16 @@ int snprint_foreign_topology(struct strbuf *buf, int verbosity)
 void print_foreign_topology(int verbosity)
 {
 	STRBUF_ON_STACK(buf);
+	fieldwidth_t *p_width = alloc_path_layout();
 
-	snprint_foreign_topology(&buf, verbosity);
+	foreign_path_layout(p_width);
+	snprint_foreign_topology(&buf, verbosity, p_width);
 	printf("%s", get_strbuf_str(&buf));
+	free(p_width);
 }
 
-int snprint_foreign_paths(struct strbuf *buf, const char *style, int pretty)
+int snprint_foreign_paths(struct strbuf *buf, const char *style,
+			  const fieldwidth_t *width)
 {
 	struct foreign *fgn;
 	int i;
@@ -561,13 +566,13 @@ int snprint_foreign_paths(struct strbuf *buf, const char *style, int pretty)
 		const struct gen_path *gp;
 		int j, ret = 0;
 
-		fgn->lock(fgn->context);
+		(fgn->lock)(fgn->context);
 		pthread_cleanup_push(fgn->unlock, fgn->context);
 
 		vec = fgn->get_paths(fgn->context);
 		if (vec != NULL) {
 			vector_foreach_slot(vec, gp, j) {
-				ret = _snprint_path(gp, buf, style, pretty);
+				ret = _snprint_path(gp, buf, style, width);
 				if (ret < 0)
 					break;
 			}
@@ -582,8 +587,8 @@ int snprint_foreign_paths(struct strbuf *buf, const char *style, int pretty)
 	return get_strbuf_len(buf) - initial_len;
 }
 
-int snprint_foreign_multipaths(struct strbuf *buf,
-			       const char *style, int pretty)
+int snprint_foreign_multipaths(struct strbuf *buf, const char *style,
+			       const fieldwidth_t *width)
 {
 	struct foreign *fgn;
 	int i;
@@ -601,14 +606,14 @@ int snprint_foreign_multipaths(struct strbuf *buf,
 		const struct gen_multipath *gm;
 		int j, ret = 0;
 
-		fgn->lock(fgn->context);
+		(fgn->lock)(fgn->context);
 		pthread_cleanup_push(fgn->unlock, fgn->context);
 
 		vec = fgn->get_multipaths(fgn->context);
 		if (vec != NULL) {
 			vector_foreach_slot(vec, gm, j) {
 				ret = _snprint_multipath(gm, buf,
-							 style, pretty);
+							 style, width);
 				if (ret < 0)
 					break;
 			}
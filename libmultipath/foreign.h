@@ -18,6 +18,7 @@
 #define _FOREIGN_H
 #include <stdbool.h>
 #include <libudev.h>
+#include "generic.h"
 #define LIBMP_FOREIGN_API ((1 << 8) | 1)
 
 struct strbuf;
@@ -249,51 +250,56 @@ int delete_all_foreign(void);
 void check_foreign(void);
 
 /**
- * foreign_path_layout()
+ * foreign_path_layout(width)
  * call this before printing paths, after get_path_layout(), to determine
  * output field width.
+ * @param width: the path layout to update
  */
-void foreign_path_layout(void);
+void foreign_path_layout(fieldwidth_t *width);
 
 /**
- * foreign_multipath_layout()
+ * foreign_multipath_layout(width)
  * call this before printing maps, after get_multipath_layout(), to determine
  * output field width.
+ * @param width: the map layout to update
  */
-void foreign_multipath_layout(void);
+void foreign_multipath_layout(fieldwidth_t *width);
 
 /**
- * snprint_foreign_topology(buf, len, verbosity);
+ * snprint_foreign_topology(buf, verbosity, p_width);
  * prints topology information from foreign libraries into buffer,
  * '\0' - terminated.
  * @param buf: output buffer
  * @param verbosity: verbosity level
+ * @param p_width: path layout, see foreign_path_layout()
  * @returns: number of printed characters excluding trailing '\0'.
  */
-int snprint_foreign_topology(struct strbuf *buf, int verbosity);
+int snprint_foreign_topology(struct strbuf *buf, int verbosity,
+			     const fieldwidth_t *p_width);
 
 /**
- * snprint_foreign_paths(buf, len, style, pad);
+ * snprint_foreign_paths(buf, style, width);
  * prints formatted path information from foreign libraries into buffer,
  * '\0' - terminated.
  * @param buf: output buffer
  * @param style: format string
- * @param pad: whether to pad field width
+ * @param width: path layout for padding, or NULL for no padding
  * @returns: number of printed characters excluding trailing '\0'.
  */
-int snprint_foreign_paths(struct strbuf *buf, const char *style, int pad);
+int snprint_foreign_paths(struct strbuf *buf, const char *style,
+			  const fieldwidth_t *width);
 
 /**
- * snprint_foreign_multipaths(buf, len, style, pad);
+ * snprint_foreign_multipaths(buf, style, width);
  * prints formatted map information from foreign libraries into buffer,
  * '\0' - terminated.
  * @param buf: output buffer
  * @param style: format string
- * @param pad: whether to pad field width
+ * @param width: map layout for padding, or NULL for no padding
  * @returns: number of printed characters excluding trailing '\0'.
  */
-int snprint_foreign_multipaths(struct strbuf *buf,
-			       const char *style, int pretty);
+int snprint_foreign_multipaths(struct strbuf *buf, const char *style,
+			       const fieldwidth_t *width);
 
 /**
  * print_foreign_topology(v)
@@ -43,6 +43,20 @@ static const char nvme_vendor[] = "NVMe";
 static const char N_A[] = "n/a";
 const char *THIS;
 
+/*
+ * Controllers of a map are rescanned only after uevents for the map or
+ * its paths. As a safety net for missed events, all maps are rescanned
+ * every NVME_RESCAN_CHECKS calls of check().
+ */
+#define NVME_RESCAN_CHECKS 16
+
+/* sysfs attributes read with cached fds, see nvme_path_attr() */
+enum {
+	NVME_ATTR_STATE,	/* controller state */
+	NVME_ATTR_ANA,		/* ANA state of the path */
+	__NVME_ATTR_NR,
+};
+
 struct nvme_map;
 struct nvme_pathgroup {
 	struct gen_pathgroup gen;
@@ -55,6 +69,8 @@ struct nvme_path {
 	struct udev_device *ctl;
 	struct nvme_map *map;
 	bool seen;
+	/* __NVME_ATTR_NR elements, may be NULL */
+	struct sysfs_attr_fd *attrs;
 	/*
 	 * The kernel works in failover mode.
 	 * Each path has a separate path group.
@@ -70,6 +86,8 @@ struct nvme_map {
 	struct _vector pgvec;
 	int nr_live;
 	int ana_supported;
+	/* a uevent indicated that paths may have changed */
+	bool rescan;
 };
 
 #define NAME_LEN 64 /* buffer length for temp attributes */
@@ -87,7 +105,14 @@ struct nvme_map {
 
 static void cleanup_nvme_path(struct nvme_path *path)
 {
+	int i;
+
 	condlog(5, "%s: %p %p", __func__, path, path->udev);
+	if (path->attrs) {
+		for (i = 0; i < __NVME_ATTR_NR; i++)
+			sysfs_attr_fd_close(&path->attrs[i]);
+		free(path->attrs);
+	}
 	if (path->udev)
 		udev_device_unref(path->udev);
 	vector_reset(&path->pg.pathvec);
@@ -229,6 +254,21 @@ static int snprint_hcil(const struct nvme_path *np, struct strbuf *buf)
 		return print_strbuf(buf, "%u:%u:%u", nvmeid, ctlid, nsid);
 }
 
+static ssize_t nvme_path_attr(const struct nvme_path *np, int attr,
+			      char *value, size_t len)
+{
+	static const char * const names[__NVME_ATTR_NR] = {
+		[NVME_ATTR_STATE] = "state",
+		[NVME_ATTR_ANA] = "ana_state",
+	};
+	struct udev_device *dev = attr == NVME_ATTR_STATE ? np->ctl : np->udev;
+
+	if (!np->attrs)
+		return sysfs_attr_get_value(dev, names[attr], value, len);
+	return sysfs_attr_fd_get_value(&np->attrs[attr], dev, names[attr],
+				       value, len);
+}
+
 static int snprint_nvme_path(const struct gen_path *gp,
 			     struct strbuf *buff, char wildcard)
 {
@@ -251,18 +291,15 @@ static int snprint_nvme_path(const struct gen_path *gp,
 		devt = udev_device_get_devnum(np->udev);
 		return print_strbuf(buff, "%u:%u", major(devt), minor(devt));
 	case 'o':
-		if (sysfs_attr_get_value(np->ctl, "state",
-					 fld, sizeof(fld)) > 0)
+		if (nvme_path_attr(np, NVME_ATTR_STATE, fld, sizeof(fld)) > 0)
 			return append_strbuf_str(buff, fld);
 		break;
 	case 'T':
-		if (sysfs_attr_get_value(np->udev, "ana_state", fld,
-					 sizeof(fld)) > 0)
+		if (nvme_path_attr(np, NVME_ATTR_ANA, fld, sizeof(fld)) > 0)
 			return append_strbuf_str(buff, fld);
 		break;
 	case 'p':
-		if (sysfs_attr_get_value(np->udev, "ana_state", fld,
-					 sizeof(fld)) > 0) {
+		if (nvme_path_attr(np, NVME_ATTR_ANA, fld, sizeof(fld)) > 0) {
 			rstrip(fld);
 			if (!strcmp(fld, "optimized"))
 				return print_strbuf(buff, "%d", 50);
@@ -359,6 +396,7 @@ struct context {
 	pthread_mutex_t mutex;
 	vector mpvec;
 	struct udev *udev;
+	unsigned int checks;
 };
 
 void lock(struct context *ctx)
@@ -498,6 +536,33 @@ _find_path_by_syspath(struct nvme_map *map, const char *syspath)
 	return NULL;
 }
 
+/*
+ * Native multipath path devices are called nvme<S>c<C>n<N>, the map
+ * they belong to is nvme<S>n<N>.
+ */
+static struct nvme_map *_find_map_of_path(const struct context *ctx,
+					  struct udev_device *ud)
+{
+	const char *sysname = udev_device_get_sysname(ud);
+	char mapname[32];
+	struct nvme_map *nm;
+	unsigned int s, c, n;
+	int i;
+
+	if (ctx->mpvec == NULL || sysname == NULL ||
+	    sscanf(sysname, "nvme%uc%un%u", &s, &c, &n) != 3 ||
+	    safe_sprintf(mapname, "nvme%un%u", s, n))
+		return NULL;
+
+	vector_foreach_slot(ctx->mpvec, nm, i) {
+		const char *name = udev_device_get_sysname(nm->udev);
+
+		if (name && !strcmp(name, mapname))
+			return nm;
+	}
+	return NULL;
+}
+
 static void _udev_device_unref(void *p)
 {
 	udev_device_unref(p);
@@ -613,6 +678,28 @@ static void test_ana_support(struct nvme_map *map, struct udev_device *ctl)
 	pthread_cleanup_pop(1);
 }
 
+static void _update_nr_live(struct nvme_map *map)
+{
+	static const char live_state[] = "live";
+	struct nvme_pathgroup *pg;
+	char state[16];
+	int i, nr_live = 0;
+
+	vector_foreach_slot(&map->pgvec, pg, i) {
+		struct nvme_path *path = nvme_pg_to_path(pg);
+
+		if (nvme_path_attr(path, NVME_ATTR_STATE, state,
+				   sizeof(state)) > 0 &&
+		    !strncmp(state, live_state, sizeof(live_state) - 1))
+			nr_live++;
+	}
+	if (nr_live != map->nr_live)
+		condlog(3, "%s: %s: map %s has %d/%d live paths", __func__,
+			THIS, udev_device_get_sysname(map->udev), nr_live,
+			VECTOR_SIZE(&map->pgvec));
+	map->nr_live = nr_live;
+}
+
 static void _find_controllers(struct context *ctx, struct nvme_map *map)
 {
 	char pathbuf[PATH_MAX], realbuf[PATH_MAX];
@@ -707,6 +794,13 @@ static void _find_controllers(struct context *ctx, struct nvme_map *map)
 		path->udev = udev;
 		path->seen = true;
 		path->map = map;
+		path->attrs = calloc(__NVME_ATTR_NR, sizeof(*path->attrs));
+		if (path->attrs) {
+			int k;
+
+			for (k = 0; k < __NVME_ATTR_NR; k++)
+				sysfs_attr_fd_init(&path->attrs[k]);
+		}
 		path->ctl = udev_device_get_parent_with_subsystem_devtype
 			(udev, "nvme", NULL);
 		if (path->ctl == NULL) {
@@ -734,7 +828,6 @@ static void _find_controllers(struct context *ctx, struct nvme_map *map)
 	}
 	pthread_cleanup_pop(1);
 
-	map->nr_live = 0;
 	vector_foreach_slot_backwards(&map->pgvec, pg, i) {
 		path = nvme_pg_to_path(pg);
 		if (!path->seen) {
@@ -742,19 +835,10 @@ static void _find_controllers(struct context *ctx, struct nvme_map *map)
 				i, udev_device_get_sysname(map->udev));
 			vector_del_slot(&map->pgvec, i);
 			cleanup_nvme_path(path);
-		} else {
-			static const char live_state[] = "live";
-			char state[16];
-
-			if ((sysfs_attr_get_value(path->ctl, "state", state,
-						  sizeof(state)) > 0) &&
-			    !strncmp(state, live_state, sizeof(live_state) - 1))
-				map->nr_live++;
 		}
 	}
-	condlog(3, "%s: %s: map %s has %d/%d live paths", __func__, THIS,
-		udev_device_get_sysname(map->udev), map->nr_live,
-		VECTOR_SIZE(&map->pgvec));
+	map->rescan = false;
+	_update_nr_live(map);
 }
 
 static int _add_map(struct context *ctx, struct udev_device *ud,
@@ -806,12 +890,18 @@ int add(struct context *ctx, struct udev_device *ud)
 	subsys = udev_device_get_parent_with_subsystem_devtype(ud,
 							       "nvme-subsystem",
 							       NULL);
-	if (subsys == NULL)
-		return FOREIGN_IGNORED;
-
 	lock(ctx);
 	pthread_cleanup_push(unlock, ctx);
-	rc = _add_map(ctx, ud, subsys);
+	if (subsys != NULL)
+		rc = _add_map(ctx, ud, subsys);
+	else {
+		/* A new path of a known map: pick it up right away */
+		struct nvme_map *map = _find_map_of_path(ctx, ud);
+
+		if (map != NULL)
+			_find_controllers(ctx, map);
+		rc = FOREIGN_IGNORED;
+	}
 	pthread_cleanup_pop(1);
 
 	if (rc == FOREIGN_CLAIMED)
@@ -824,13 +914,67 @@ int add(struct context *ctx, struct udev_device *ud)
 	return rc;
 }
 
-int change(__attribute__((unused)) struct context *ctx,
-	   __attribute__((unused)) struct udev_device *ud)
+static int _change(struct context *ctx, struct udev_device *ud)
 {
-	condlog(5, "%s called for \"%s\"", __func__, THIS);
+	struct nvme_map *map;
+
+	map = _find_nvme_map_by_devt(ctx, udev_device_get_devnum(ud));
+	if (map != NULL) {
+		map->rescan = true;
+		return FOREIGN_OK;
+	}
+	map = _find_map_of_path(ctx, ud);
+	if (map != NULL)
+		map->rescan = true;
 	return FOREIGN_IGNORED;
 }
 
+/*
+ * Changes are picked up by the next check(), which is cheap for maps
+ * without pending events.
+ */
+int change(struct context *ctx, struct udev_device *ud)
+{
+	int rc;
+
+	condlog(5, "%s called for \"%s\"", __func__, THIS);
+
+	if (ud == NULL)
+		return FOREIGN_ERR;
+
+	lock(ctx);
+	pthread_cleanup_push(unlock, ctx);
+	rc = _change(ctx, ud);
+	pthread_cleanup_pop(1);
+
+	return rc;
+}
+
+static void _delete_path(struct context *ctx, struct udev_device *ud)
+{
+	dev_t devt = udev_device_get_devnum(ud);
+	struct nvme_map *map = _find_map_of_path(ctx, ud);
+	struct nvme_pathgroup *pg;
+	int i;
+
+	if (map == NULL)
+		return;
+
+	vector_foreach_slot(&map->pgvec, pg, i) {
+		struct nvme_path *path = nvme_pg_to_path(pg);
+
+		if (udev_device_get_devnum(path->udev) == devt) {
+			condlog(3, "%s: %s: path %s removed from %s",
+				__func__, THIS, udev_device_get_sysname(ud),
+				udev_device_get_sysname(map->udev));
+			vector_del_slot(&map->pgvec, i);
+			cleanup_nvme_path(path);
+			_update_nr_live(map);
+			return;
+		}
+	}
+}
+
 static int _delete_map(struct context *ctx, struct udev_device *ud)
 {
 	int k;
@@ -838,8 +982,10 @@ static int _delete_map(struct context *ctx, struct udev_device *ud)
 	dev_t devt = udev_device_get_devnum(ud);
 
 	map = _find_nvme_map_by_devt(ctx, devt);
-	if (map ==NULL)
+	if (map == NULL) {
+		_delete_path(ctx, ud);
 		return FOREIGN_IGNORED;
+	}
 
 	k = find_slot(ctx->mpvec, map);
 	if (k == -1)
@@ -881,10 +1027,15 @@ void _check(struct context *ctx)
 	struct gen_multipath *gm;
 	int i;
 
+	bool rescan_all = ++ctx->checks % NVME_RESCAN_CHECKS == 0;
+
 	vector_foreach_slot(ctx->mpvec, gm, i) {
 		struct nvme_map *map = gen_mp_to_nvme(gm);
 
-		_find_controllers(ctx, map);
+		if (rescan_all || map->rescan)
+			_find_controllers(ctx, map);
+		else
+			_update_nr_live(map);
 	}
 }
 
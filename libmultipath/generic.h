@@ -23,6 +23,12 @@ struct gen_multipath;
 struct gen_pathgroup;
 struct gen_path;
 
+/*
+ * Column widths for printing paths or maps with padding, an array with
+ * one element per path or map wildcard, see alloc_path_layout().
+ */
+typedef unsigned int fieldwidth_t;
+
 /**
  * Methods implemented for gen_multipath "objects"
  */
@@ -18,9 +18,12 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
+#ifdef USE_LIBURING
+#include <liburing.h>
+#else
 #include <libaio.h>
+#endif
 #include <errno.h>
-#include <sys/mman.h>
 #include <sys/select.h>
 
 #include "vector.h"
@@ -35,22 +38,40 @@
 #include "time-util.h"
 #include "io_err_stat.h"
 #include "util.h"
+#include "check_sched.h"
+#include "thread_settings.h"
 
 #define TIMEOUT_NO_IO_NSEC		10000000 /*10ms = 10000000ns*/
 #define FLAKY_PATHFAIL_THRESHOLD	2
 #define CONCUR_NR_EVENT			32
+#ifdef USE_LIBURING
+/* Every read takes two SQEs, the read and its linked timeout */
+#define URING_ENTRIES			1024
+#define URING_BUF_SLOTS			512
+#define URING_SLOT_SIZE			4096
+#endif
 
 #define PATH_IO_ERR_IN_CHECKING		-1
 #define PATH_IO_ERR_WAITING_TO_CHECK	-2
 
 #define io_err_stat_log(prio, fmt, args...) \
 	condlog(prio, "io error statistic: " fmt, ##args)
+/* For messages that may repeat for dev in every check, see log_rate_limit */
+#define io_err_stat_log_dev(prio, dev, fmt, args...) \
+	condlog_dev(prio, dev, "io error statistic: " fmt, ##args)
+
+struct io_err_stat_path;
 
 struct dio_ctx {
 	struct timespec	io_starttime;
 	unsigned int	blksize;
 	void		*buf;
+#ifdef USE_LIBURING
+	struct io_err_stat_path *pp;
+	int		buf_slot;	/* in the registered buffer, or -1 */
+#else
 	struct iocb	io;
+#endif
 };
 
 struct io_err_stat_path {
@@ -63,6 +84,10 @@ struct io_err_stat_path {
 
 	int		total_time;
 	int		err_rate_threshold;
+#ifdef USE_LIBURING
+	int		inflight;
+	bool		dead;
+#endif
 };
 
 static pthread_t	io_err_stat_thr;
@@ -74,7 +99,22 @@ static int io_err_thread_running = 0;
 
 static vector io_err_pathvec;
 struct vectors *vecs;
+#ifdef USE_LIBURING
+/*
+ * One ring for all paths under test. Reads use a slot of a registered
+ * buffer if one is free, and are linked with a timeout op, so that no
+ * scan for timed out requests is needed.
+ */
+static struct io_uring	ring;
+static void		*uring_bufs;
+static unsigned char	uring_slot_used[URING_BUF_SLOTS];
+static pthread_mutex_t	uring_slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct __kernel_timespec io_timeout = { .tv_sec = IOTIMEOUT_SEC };
+/* Freed paths with reads still in flight, only used by io_err_stat_loop */
+static vector		io_err_orphans;
+#else
 io_context_t	ioctx;
+#endif
 
 static void cancel_inflight_io(struct io_err_stat_path *pp);
 
@@ -99,21 +139,65 @@ static struct io_err_stat_path *find_err_path_by_dev(vector pathvec, char *dev)
 	return NULL;
 }
 
-static int init_each_dio_ctx(struct dio_ctx *ct, int blksize,
-		unsigned long pgsize)
+#ifdef USE_LIBURING
+static int get_uring_slot(void)
+{
+	int i, slot = -1;
+
+	if (!uring_bufs)
+		return -1;
+	pthread_mutex_lock(&uring_slot_lock);
+	for (i = 0; i < URING_BUF_SLOTS; i++) {
+		if (!uring_slot_used[i]) {
+			uring_slot_used[i] = 1;
+			slot = i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&uring_slot_lock);
+	return slot;
+}
+
+static void put_uring_slot(int slot)
+{
+	pthread_mutex_lock(&uring_slot_lock);
+	uring_slot_used[slot] = 0;
+	pthread_mutex_unlock(&uring_slot_lock);
+}
+#endif
+
+static int init_each_dio_ctx(struct io_err_stat_path *p, struct dio_ctx *ct,
+			     int blksize, unsigned long pgsize)
 {
 	ct->blksize = blksize;
+	ct->io_starttime.tv_sec = 0;
+	ct->io_starttime.tv_nsec = 0;
+#ifdef USE_LIBURING
+	ct->pp = p;
+	ct->buf_slot = blksize <= URING_SLOT_SIZE ? get_uring_slot() : -1;
+	if (ct->buf_slot >= 0) {
+		ct->buf = (char *)uring_bufs + ct->buf_slot * URING_SLOT_SIZE;
+		memset(ct->buf, 0, blksize);
+		return 0;
+	}
+#endif
 	if (posix_memalign(&ct->buf, pgsize, blksize))
 		return 1;
 	memset(ct->buf, 0, blksize);
-	ct->io_starttime.tv_sec = 0;
-	ct->io_starttime.tv_nsec = 0;
 
 	return 0;
 }
 
 static void deinit_each_dio_ctx(struct dio_ctx *ct)
 {
+#ifdef USE_LIBURING
+	if (ct->buf_slot >= 0) {
+		put_uring_slot(ct->buf_slot);
+		ct->buf_slot = -1;
+		ct->buf = NULL;
+		return;
+	}
+#endif
 	if (ct->buf)
 		free(ct->buf);
 }
@@ -145,13 +229,14 @@ static int setup_directio_ctx(struct io_err_stat_path *p)
 		goto free_pdctx;
 
 	for (i = 0; i < CONCUR_NR_EVENT; i++) {
-		if (init_each_dio_ctx(p->dio_ctx_array + i, blksize, pgsize))
+		if (init_each_dio_ctx(p, p->dio_ctx_array + i, blksize,
+				      pgsize))
 			goto deinit;
 	}
 	return 0;
 
 deinit:
-	for (i = 0; i < CONCUR_NR_EVENT; i++)
+	while (i-- > 0)
 		deinit_each_dio_ctx(p->dio_ctx_array + i);
 free_pdctx:
 	FREE(p->dio_ctx_array);
@@ -171,6 +256,18 @@ static void free_io_err_stat_path(struct io_err_stat_path *p)
 		goto free_path;
 
 	cancel_inflight_io(p);
+#ifdef USE_LIBURING
+	if (p->inflight > 0) {
+		/* Freed from handle_async_io_done_event() */
+		p->dead = true;
+		if (io_err_orphans && vector_alloc_slot(io_err_orphans))
+			vector_set_slot(io_err_orphans, p);
+		else
+			io_err_stat_log(2, "%s: leaking buffers of inflight io",
+					p->devname);
+		return;
+	}
+#endif
 
 	for (i = 0; i < CONCUR_NR_EVENT; i++)
 		deinit_each_dio_ctx(p->dio_ctx_array + i);
@@ -252,8 +349,8 @@ static int enqueue_io_err_stat_by_path(struct path *path)
 	vector_set_slot(io_err_pathvec, p);
 	pthread_mutex_unlock(&io_err_pathvec_lock);
 
-	io_err_stat_log(3, "%s: enqueue path %s to check",
-			path->mpp->alias, path->dev);
+	io_err_stat_log_dev(3, path->dev, "%s: enqueue path %s to check",
+			    path->mpp->alias, path->dev);
 	return 0;
 
 unlock_pathvec:
@@ -264,6 +361,40 @@ free_ioerr_path:
 	return 1;
 }
 
+/* Fail path and wait for it to come up, to enqueue it for checking */
+static void start_io_err_check(struct path *path)
+{
+	path->io_err_disable_reinstate = 1;
+	path->io_err_pathfail_cnt = PATH_IO_ERR_WAITING_TO_CHECK;
+	/* enqueue path as soon as it comes up */
+	path->io_err_dis_reinstate_time = 0;
+	if (path->state != PATH_DOWN) {
+		struct config *conf;
+		int oldstate = path->state;
+		unsigned int checkint;
+
+		conf = get_multipath_config();
+		checkint = conf->checkint;
+		put_multipath_config(conf);
+		io_err_stat_log_dev(2, path->dev, "%s: mark as failed",
+				    path->dev);
+		path->mpp->stat_path_failures++;
+		path->dmstate = PSTATE_FAILED;
+		set_path_state(path, PATH_DOWN);
+		if (oldstate == PATH_UP || oldstate == PATH_GHOST)
+			update_queue_mode_del_path(path->mpp);
+		if (path_check_ticks(path) > checkint)
+			set_path_tick(path, checkint);
+	}
+}
+
+static int sample_health(struct path *path)
+{
+	return sample_path_health(path,
+				  path->mpp->marginal_path_err_rate_threshold,
+				  path->mpp->marginal_path_double_failed_time);
+}
+
 int io_err_stat_handle_pathfail(struct path *path)
 {
 	struct timespec curr_time;
@@ -272,8 +403,9 @@ int io_err_stat_handle_pathfail(struct path *path)
 		return 0;
 
 	if (path->io_err_disable_reinstate) {
-		io_err_stat_log(3, "%s: reinstate is already disabled",
-				path->dev);
+		io_err_stat_log_dev(3, path->dev,
+				    "%s: reinstate is already disabled",
+				    path->dev);
 		return 0;
 	}
 	if (path->io_err_pathfail_cnt < 0)
@@ -289,52 +421,48 @@ int io_err_stat_handle_pathfail(struct path *path)
 	 * The test should only be started for paths that have failed
 	 * repeatedly in a certain time frame, so that we have reason
 	 * to assume they're flaky. Without bother the admin to configure
-	 * the repeated count threshold and time frame, we assume a path
-	 * which fails at least twice within 60 seconds is flaky.
+	 * the repeated count threshold, we assume a path which fails at
+	 * least twice within marginal_path_double_failed_time is flaky.
+	 * The caller has recorded this failure in pp->fail_window.
 	 */
 	get_monotonic_time(&curr_time);
-	if (path->io_err_pathfail_cnt == 0) {
-		path->io_err_pathfail_cnt++;
-		path->io_err_pathfail_starttime = curr_time.tv_sec;
-		io_err_stat_log(5, "%s: start path flakiness pre-checking",
+	if (fail_window_count(&path->fail_window, curr_time.tv_sec,
+			      path->mpp->marginal_path_double_failed_time) <
+	    FLAKY_PATHFAIL_THRESHOLD) {
+		io_err_stat_log(5, "%s: path flakiness pre-checking",
 				path->dev);
 		return 0;
 	}
-	if ((curr_time.tv_sec - path->io_err_pathfail_starttime) >
-			path->mpp->marginal_path_double_failed_time) {
-		path->io_err_pathfail_cnt = 0;
-		path->io_err_pathfail_starttime = curr_time.tv_sec;
-		io_err_stat_log(5, "%s: restart path flakiness pre-checking",
+	/*
+	 * No need for test I/O if the device counters show that the
+	 * I/O on the path is completing without errors.
+	 */
+	if (sample_health(path) == PATH_HEALTH_OK) {
+		io_err_stat_log(3, "%s: no recent I/O errors, not probing",
 				path->dev);
+		return 0;
 	}
-	path->io_err_pathfail_cnt++;
-	if (path->io_err_pathfail_cnt >= FLAKY_PATHFAIL_THRESHOLD) {
-		path->io_err_disable_reinstate = 1;
-		path->io_err_pathfail_cnt = PATH_IO_ERR_WAITING_TO_CHECK;
-		/* enqueue path as soon as it comes up */
-		path->io_err_dis_reinstate_time = 0;
-		if (path->state != PATH_DOWN) {
-			struct config *conf;
-			int oldstate = path->state;
-			unsigned int checkint;
-
-			conf = get_multipath_config();
-			checkint = conf->checkint;
-			put_multipath_config(conf);
-			io_err_stat_log(2, "%s: mark as failed", path->dev);
-			path->mpp->stat_path_failures++;
-			path->state = PATH_DOWN;
-			path->dmstate = PSTATE_FAILED;
-			if (oldstate == PATH_UP || oldstate == PATH_GHOST)
-				update_queue_mode_del_path(path->mpp);
-			if (path->tick > checkint)
-				path->tick = checkint;
-		}
-	}
-
+	start_io_err_check(path);
 	return 0;
 }
 
+int io_err_stat_check_health(struct path *path)
+{
+	if (uatomic_read(&io_err_thread_running) == 0 || !path->mpp ||
+	    !marginal_path_check_enabled(path->mpp))
+		return 0;
+	if (sample_health(path) != PATH_HEALTH_SUSPECT ||
+	    path->io_err_disable_reinstate || path->io_err_pathfail_cnt < 0 ||
+	    (path->state != PATH_UP && path->state != PATH_GHOST))
+		return 0;
+
+	io_err_stat_log_dev(2, path->dev,
+			    "%s: I/O errors in device counters, start checking",
+			    path->dev);
+	start_io_err_check(path);
+	return 1;
+}
+
 int need_io_err_check(struct path *pp)
 {
 	struct timespec curr_time;
@@ -413,8 +541,8 @@ static void end_io_err_stat(struct io_err_stat_path *pp)
 	io_err_stat_log(4, "%s: check end", pp->devname);
 
 	err_rate = pp->io_nr == 0 ? 0 : (pp->io_err_nr * 1000.0f) / pp->io_nr;
-	io_err_stat_log(3, "%s: IO error rate (%.1f/1000)",
-			pp->devname, err_rate);
+	io_err_stat_log_dev(3, pp->devname, "%s: IO error rate (%.1f/1000)",
+			    pp->devname, err_rate);
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
 	lock(&vecs->lock);
 	pthread_testcancel();
@@ -430,11 +558,12 @@ static void end_io_err_stat(struct io_err_stat_path *pp)
 		 * schedule path check as soon as possible to
 		 * update path state. Do NOT reinstate dm path here
 		 */
-		path->tick = 1;
+		set_path_tick(path, 1);
 
 	} else if (path->mpp && count_active_paths(path->mpp) > 0) {
-		io_err_stat_log(3, "%s: keep failing the dm path %s",
-				path->mpp->alias, path->dev);
+		io_err_stat_log_dev(3, path->dev,
+				    "%s: keep failing the dm path %s",
+				    path->mpp->alias, path->dev);
 		path->io_err_pathfail_cnt = PATH_IO_ERR_WAITING_TO_CHECK;
 		path->io_err_disable_reinstate = 1;
 		path->io_err_dis_reinstate_time = currtime.tv_sec;
@@ -449,6 +578,38 @@ static void end_io_err_stat(struct io_err_stat_path *pp)
 	lock_cleanup_pop(vecs->lock);
 }
 
+#ifdef USE_LIBURING
+static int send_each_async_io(struct dio_ctx *ct, int fd, char *dev)
+{
+	struct io_uring_sqe *sqe, *tsqe;
+
+	if (ct->io_starttime.tv_nsec != 0 ||
+	    ct->io_starttime.tv_sec != 0)
+		return -1;
+
+	/* The read and its timeout must be submitted together */
+	if (io_uring_sq_space_left(&ring) < 2)
+		io_uring_submit(&ring);
+	if (io_uring_sq_space_left(&ring) < 2) {
+		io_err_stat_log(5, "%s: submission queue full", dev);
+		return -1;
+	}
+	sqe = io_uring_get_sqe(&ring);
+	tsqe = io_uring_get_sqe(&ring);
+	if (ct->buf_slot >= 0)
+		io_uring_prep_read_fixed(sqe, fd, ct->buf, ct->blksize, 0, 0);
+	else
+		io_uring_prep_read(sqe, fd, ct->buf, ct->blksize, 0);
+	sqe->flags |= IOSQE_IO_LINK;
+	io_uring_sqe_set_data(sqe, ct);
+	io_uring_prep_link_timeout(tsqe, &io_timeout, 0);
+	io_uring_sqe_set_data(tsqe, NULL);
+
+	get_monotonic_time(&ct->io_starttime);
+	ct->pp->inflight++;
+	return 0;
+}
+#else
 static int send_each_async_io(struct dio_ctx *ct, int fd, char *dev)
 {
 	int rc = -1;
@@ -469,6 +630,7 @@ static int send_each_async_io(struct dio_ctx *ct, int fd, char *dev)
 
 	return rc;
 }
+#endif
 
 static void send_batch_async_ios(struct io_err_stat_path *pp)
 {
@@ -495,6 +657,145 @@ static void send_batch_async_ios(struct io_err_stat_path *pp)
 		get_monotonic_time(&pp->start_time);
 }
 
+#ifdef USE_LIBURING
+/* Timeouts are handled by the linked timeout ops */
+static void poll_async_io_timeout(void)
+{
+}
+
+static void cancel_inflight_io(struct io_err_stat_path *pp)
+{
+	struct io_uring_sqe *sqe;
+	int i;
+
+	for (i = 0; i < CONCUR_NR_EVENT; i++) {
+		struct dio_ctx *ct = pp->dio_ctx_array + i;
+
+		if (ct->io_starttime.tv_sec == 0
+				&& ct->io_starttime.tv_nsec == 0)
+			continue;
+		io_err_stat_log(5, "%s: abort infligh io",
+				pp->devname);
+		sqe = io_uring_get_sqe(&ring);
+		if (!sqe) {
+			io_uring_submit(&ring);
+			sqe = io_uring_get_sqe(&ring);
+		}
+		if (!sqe)
+			break;
+		io_uring_prep_cancel(sqe, ct, 0);
+		io_uring_sqe_set_data(sqe, NULL);
+	}
+	io_uring_submit(&ring);
+}
+
+static void free_orphan(struct io_err_stat_path *pp)
+{
+	int i;
+
+	i = find_slot(io_err_orphans, pp);
+	if (i >= 0)
+		vector_del_slot(io_err_orphans, i);
+	pp->dead = false;
+	free_io_err_stat_path(pp);
+}
+
+static void handle_async_io_done_event(struct io_uring_cqe *cqe)
+{
+	struct dio_ctx *ct = io_uring_cqe_get_data(cqe);
+	struct io_err_stat_path *pp;
+	int rc;
+
+	/* Completions of timeout and cancel ops */
+	if (!ct)
+		return;
+	pp = ct->pp;
+	ct->io_starttime.tv_sec = 0;
+	ct->io_starttime.tv_nsec = 0;
+	pp->inflight--;
+	if (pp->dead) {
+		if (pp->inflight == 0)
+			free_orphan(pp);
+		return;
+	}
+	if (cqe->res == -ECANCELED) {
+		io_err_stat_log(5, "%s: abort check on timeout", pp->devname);
+		rc = PATH_TIMEOUT;
+	} else
+		rc = (cqe->res == (int)ct->blksize) ? PATH_UP : PATH_DOWN;
+	account_async_io_state(pp, rc);
+}
+
+static void process_async_ios_event(int timeout_nsecs)
+{
+	struct __kernel_timespec timeout = { .tv_nsec = timeout_nsecs };
+	struct io_uring_cqe *cqe;
+	unsigned int head, n = 0;
+	int r;
+
+	pthread_testcancel();
+	io_uring_submit(&ring);
+	r = io_uring_wait_cqe_timeout(&ring, &cqe, &timeout);
+	if (r < 0) {
+		if (r != -ETIME && r != -EINTR)
+			io_err_stat_log(3, "async io events returned %d (errno=%s)",
+					r, strerror(-r));
+		return;
+	}
+	io_uring_for_each_cqe(&ring, head, cqe) {
+		handle_async_io_done_event(cqe);
+		n++;
+	}
+	io_uring_cq_advance(&ring, n);
+}
+
+static int setup_async_io(void)
+{
+	struct iovec iov;
+	int r;
+
+	r = io_uring_queue_init(URING_ENTRIES, &ring, 0);
+	if (r < 0) {
+		io_err_stat_log(4, "io_uring_queue_init failed: %s",
+				strerror(-r));
+		return 1;
+	}
+	io_err_orphans = vector_alloc();
+	if (!io_err_orphans) {
+		io_uring_queue_exit(&ring);
+		return 1;
+	}
+	memset(uring_slot_used, 0, sizeof(uring_slot_used));
+	if (posix_memalign(&uring_bufs, getpagesize(),
+			   URING_BUF_SLOTS * URING_SLOT_SIZE)) {
+		uring_bufs = NULL;
+		return 0;
+	}
+	iov.iov_base = uring_bufs;
+	iov.iov_len = URING_BUF_SLOTS * URING_SLOT_SIZE;
+	r = io_uring_register_buffers(&ring, &iov, 1);
+	if (r < 0) {
+		io_err_stat_log(3, "failed to register io buffers: %s",
+				strerror(-r));
+		free(uring_bufs);
+		uring_bufs = NULL;
+	}
+	return 0;
+}
+
+static void destroy_async_io(void)
+{
+	bool orphans = VECTOR_SIZE(io_err_orphans) > 0;
+
+	io_uring_queue_exit(&ring);
+	/* Orphans may still be written to; leak rather than free them */
+	vector_free(io_err_orphans);
+	io_err_orphans = NULL;
+	if (!orphans)
+		free(uring_bufs);
+	uring_bufs = NULL;
+}
+#else
 static int try_to_cancel_timeout_io(struct dio_ctx *ct, struct timespec *t,
 		char *dev)
 {
@@ -590,7 +891,7 @@ static void handle_async_io_done_event(struct io_event *io_evt)
 	}
 }
 
-static void process_async_ios_event(int timeout_nsecs, char *dev)
+static void process_async_ios_event(int timeout_nsecs)
 {
 	struct io_event events[CONCUR_NR_EVENT];
 	int		i, n;
@@ -600,14 +901,30 @@ static void process_async_ios_event(int timeout_nsecs, char *dev)
 	pthread_testcancel();
 	n = io_getevents(ioctx, 1L, CONCUR_NR_EVENT, events, &timeout);
 	if (n < 0) {
-		io_err_stat_log(3, "%s: async io events returned %d (errno=%s)",
-				dev, n, strerror(errno));
+		io_err_stat_log(3, "async io events returned %d (errno=%s)",
+				n, strerror(errno));
 	} else {
 		for (i = 0; i < n; i++)
 			handle_async_io_done_event(&events[i]);
 	}
 }
 
+
+static int setup_async_io(void)
+{
+	if (io_setup(CONCUR_NR_EVENT, &ioctx) != 0) {
+		io_err_stat_log(4, "io_setup failed");
+		return 1;
+	}
+	return 0;
+}
+
+static void destroy_async_io(void)
+{
+	io_destroy(ioctx);
+}
+#endif
+
 static void service_paths(void)
 {
 	struct _vector _pathvec = { .allocated = 0 };
@@ -618,10 +935,12 @@ static void service_paths(void)
 
 	pthread_mutex_lock(&io_err_pathvec_lock);
 	pthread_cleanup_push(cleanup_mutex, &io_err_pathvec_lock);
-	vector_foreach_slot(io_err_pathvec, pp, i) {
+	vector_foreach_slot(io_err_pathvec, pp, i)
 		send_batch_async_ios(pp);
-		process_async_ios_event(TIMEOUT_NO_IO_NSEC, pp->devname);
-		poll_async_io_timeout();
+	/* Completions of all paths are reaped together */
+	process_async_ios_event(TIMEOUT_NO_IO_NSEC);
+	poll_async_io_timeout();
+	vector_foreach_slot(io_err_pathvec, pp, i) {
 		if (io_err_stat_time_up(pp)) {
 			if (!vector_alloc_slot(tmp_pathvec))
 				continue;
@@ -656,7 +975,7 @@ static void *io_err_stat_loop(void *data)
 	sigfillset(&set);
 	sigdelset(&set, SIGUSR2);
 
-	mlockall(MCL_CURRENT | MCL_FUTURE);
+	lock_memory();
 
 	pthread_mutex_lock(&io_err_thread_lock);
 	uatomic_set(&io_err_thread_running, 1);
@@ -667,6 +986,7 @@ static void *io_err_stat_loop(void *data)
 		struct timespec ts;
 
 		service_paths();
+		sample_thread_cpu(THREAD_IO_ERR_STAT);
 
 		ts.tv_sec = 0;
 		ts.tv_nsec = 100 * 1000 * 1000;
@@ -690,10 +1010,8 @@ int start_io_err_stat_thread(void *data)
 	if (uatomic_read(&io_err_thread_running) == 1)
 		return 0;
 
-	if (io_setup(CONCUR_NR_EVENT, &ioctx) != 0) {
-		io_err_stat_log(4, "io_setup failed");
+	if (setup_async_io() != 0)
 		return 1;
-	}
 
 	pthread_mutex_lock(&io_err_pathvec_lock);
 	io_err_pathvec = vector_alloc();
@@ -703,7 +1021,7 @@ int start_io_err_stat_thread(void *data)
 	}
 	pthread_mutex_unlock(&io_err_pathvec_lock);
 
-	setup_thread_attr(&io_err_stat_attr, 32 * 1024, 0);
+	setup_thread_attr_for(&io_err_stat_attr, THREAD_IO_ERR_STAT, 0);
 	pthread_mutex_lock(&io_err_thread_lock);
 	pthread_cleanup_push(cleanup_mutex, &io_err_thread_lock);
 
@@ -722,6 +1040,7 @@ int start_io_err_stat_thread(void *data)
 		goto out_free;
 	}
 
+	register_thread(THREAD_IO_ERR_STAT, io_err_stat_thr);
 	io_err_stat_log(2, "io_error statistic thread started");
 	return 0;
 
@@ -731,7 +1050,7 @@ out_free:
 	io_err_pathvec = NULL;
 	pthread_mutex_unlock(&io_err_pathvec_lock);
 destroy_ctx:
-	io_destroy(ioctx);
+	destroy_async_io();
 	io_err_stat_log(0, "failed to start io_error statistic thread");
 	return 1;
 }
@@ -741,10 +1060,11 @@ void stop_io_err_stat_thread(void)
 	if (io_err_stat_thr == (pthread_t)0)
 		return;
 
+	unregister_thread(THREAD_IO_ERR_STAT);
 	if (uatomic_read(&io_err_thread_running) == 1)
 		pthread_cancel(io_err_stat_thr);
 
 	pthread_join(io_err_stat_thr, NULL);
 	free_io_err_pathvec();
-	io_destroy(ioctx);
+	destroy_async_io();
 }
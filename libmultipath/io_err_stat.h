@@ -11,5 +11,11 @@ int start_io_err_stat_thread(void *data);
 void stop_io_err_stat_thread(void);
 int io_err_stat_handle_pathfail(struct path *path);
 int need_io_err_check(struct path *pp);
+/*
+ * Sample the passive health of pp, see path_health.h, and start the
+ * marginal path check if it is suspect. Returns 1 in that case, and the
+ * caller must fail the path in the kernel.
+ */
+int io_err_stat_check_health(struct path *pp);
 
 #endif /* _IO_ERR_STAT_H */
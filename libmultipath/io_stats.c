@@ -0,0 +1,321 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <libudev.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "sysfs.h"
+#include "devmapper.h"
+#include "debug.h"
+#include "time-util.h"
+#include "io_stats.h"
+
+#define IO_STATS_PROGRAM "multipathd"
+/* Upper bounds (us) of all histogram buckets but the last */
+static const unsigned int io_stats_bounds[IO_STATS_BUCKETS - 1] = {
+	100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000,
+};
+/* The same bounds in ns, for a dm-stats region with precise_timestamps */
+#define IO_STATS_HISTOGRAM "histogram:100000,200000,500000,1000000," \
+	"2000000,5000000,10000000,20000000,50000000,100000000,200000000"
+/* Halve the histogram when it holds more I/O than this */
+#define IO_STATS_DECAY_IOS 100000
+/* Shorter sample intervals are ignored, as their rates are too coarse */
+#define IO_STATS_MIN_INTERVAL_US 100000
+/* Maps doing less I/O than this are not classified */
+#define IO_TUNE_MIN_IOPS 20
+/* Mean request sizes (KiB) of streaming and transactional workloads */
+#define IO_TUNE_STREAMING_KB 128
+#define IO_TUNE_TRANSACTIONAL_KB 32
+/* Minimum mean queue depth of a transactional workload */
+#define IO_TUNE_TRANSACTIONAL_DEPTH 4
+/* Busy samples a workload must be seen in before the map is retuned */
+#define IO_TUNE_STABLE_SAMPLES 5
+
+static unsigned int latency_bucket(unsigned int latency)
+{
+	int i;
+
+	for (i = 0; i < IO_STATS_BUCKETS - 1; i++)
+		if (latency < io_stats_bounds[i])
+			break;
+	return i;
+}
+
+static void decay_histogram(struct io_stats *st)
+{
+	unsigned long long total = 0;
+	int i;
+
+	for (i = 0; i < IO_STATS_BUCKETS; i++)
+		total += st->hist[i];
+	if (total <= IO_STATS_DECAY_IOS)
+		return;
+	for (i = 0; i < IO_STATS_BUCKETS; i++)
+		st->hist[i] /= 2;
+}
+
+unsigned int io_stats_percentile(const struct io_stats *st, unsigned int pct)
+{
+	unsigned long long total = 0, sum = 0, target;
+	int i;
+
+	for (i = 0; i < IO_STATS_BUCKETS; i++)
+		total += st->hist[i];
+	if (total == 0)
+		return 0;
+	target = (total * pct + 99) / 100;
+	for (i = 0; i < IO_STATS_BUCKETS - 1; i++) {
+		sum += st->hist[i];
+		if (sum >= target)
+			return io_stats_bounds[i];
+	}
+	/* The last bucket has no upper bound; report its lower bound */
+	return io_stats_bounds[IO_STATS_BUCKETS - 2];
+}
+
+/*
+ * Update the rates of st from the new counters. Returns the number of
+ * I/Os completed since the last sample, or -1 if there was no usable
+ * previous sample. Counters that went backwards, e.g. because the
+ * device was replaced, start a new series.
+ */
+static long long advance_io_stats(struct io_stats *st, unsigned long long ios,
+				  unsigned long long sectors,
+				  unsigned long long ticks_us,
+				  const struct timespec *now)
+{
+	struct timespec diff;
+	unsigned long long us, d_ios;
+	long long ret = -1;
+
+	if ((st->time.tv_sec || st->time.tv_nsec) && ios >= st->ios &&
+	    sectors >= st->sectors && ticks_us >= st->ticks_us) {
+		timespecsub(now, &st->time, &diff);
+		us = diff.tv_sec * 1000000ULL + diff.tv_nsec / 1000;
+		if (us < IO_STATS_MIN_INTERVAL_US)
+			return 0;
+		d_ios = ios - st->ios;
+		st->iops = d_ios * 1000000 / us;
+		/* 512 byte sectors, in KiB/s */
+		st->kbps = (sectors - st->sectors) * 500000 / us;
+		/* Idle devices keep their previous latency */
+		if (d_ios)
+			st->latency = (ticks_us - st->ticks_us) / d_ios;
+		ret = d_ios;
+	}
+	st->ios = ios;
+	st->sectors = sectors;
+	st->ticks_us = ticks_us;
+	st->time = *now;
+	return ret;
+}
+
+void sample_path_io_stats(struct path *pp)
+{
+	char buf[256];
+	unsigned long long rd_ios, rd_sec, rd_ticks, wr_ios, wr_sec, wr_ticks;
+	struct timespec now;
+	long long d_ios;
+	ssize_t len;
+
+	if (!pp->udev)
+		return;
+	len = sysfs_attr_get_value(pp->udev, "stat", buf, sizeof(buf));
+	if (len <= 0 || (size_t)len >= sizeof(buf) ||
+	    sscanf(buf, "%llu %*u %llu %llu %llu %*u %llu %llu",
+		   &rd_ios, &rd_sec, &rd_ticks, &wr_ios, &wr_sec,
+		   &wr_ticks) != 6)
+		return;
+
+	get_monotonic_time(&now);
+	d_ios = advance_io_stats(&pp->io_stats, rd_ios + wr_ios,
+				 rd_sec + wr_sec,
+				 (rd_ticks + wr_ticks) * 1000, &now);
+	if (d_ios <= 0)
+		return;
+	pp->io_stats.hist[latency_bucket(pp->io_stats.latency)] += d_ios;
+	decay_histogram(&pp->io_stats);
+}
+
+/* Find the region of an earlier run of multipathd, or create one */
+static int setup_stats_region(struct multipath *mpp)
+{
+	char *resp, *line, *save = NULL;
+	int id, region = IO_STATS_NO_REGION;
+
+	if (!dm_message_response(mpp->alias, "@stats_list " IO_STATS_PROGRAM,
+				 &resp)) {
+		for (line = strtok_r(resp, "\n", &save); line;
+		     line = strtok_r(NULL, "\n", &save)) {
+			if (sscanf(line, "%d:", &id) == 1 &&
+			    strstr(line, " precise_timestamps") &&
+			    strstr(line, " " IO_STATS_HISTOGRAM)) {
+				region = id;
+				break;
+			}
+		}
+		free(resp);
+	}
+
+	if (region == IO_STATS_NO_REGION) {
+		if (dm_message_response(mpp->alias, "@stats_create - /1 2 "
+					"precise_timestamps " IO_STATS_HISTOGRAM
+					" " IO_STATS_PROGRAM, &resp) != 0) {
+			condlog(2, "%s: failed to create dm-stats region",
+				mpp->alias);
+			mpp->stats_region = IO_STATS_REGION_FAILED;
+			return 1;
+		}
+		if (sscanf(resp, "%d", &region) != 1 || region < 0) {
+			condlog(2, "%s: invalid dm-stats region \"%s\"",
+				mpp->alias, resp);
+			free(resp);
+			mpp->stats_region = IO_STATS_REGION_FAILED;
+			return 1;
+		}
+		free(resp);
+		condlog(3, "%s: created dm-stats region %d", mpp->alias,
+			region);
+	}
+	mpp->stats_region = region;
+	return 0;
+}
+
+static int parse_histogram(const char *str, unsigned long long *hist)
+{
+	char *end;
+	int i;
+
+	for (i = 0; i < IO_STATS_BUCKETS; i++) {
+		hist[i] = strtoull(str, &end, 10);
+		if (end == str)
+			return 1;
+		if (i < IO_STATS_BUCKETS - 1 && *end != ':')
+			return 1;
+		str = end + 1;
+	}
+	return *end != '\0' && *end != '\n';
+}
+
+int sample_map_io_stats(struct multipath *mpp, unsigned int interval)
+{
+	char msg[32], *resp, *hist_str;
+	unsigned long long rd_ios, rd_sec, rd_ns, wr_ios, wr_sec, wr_ns;
+	unsigned long long hist[IO_STATS_BUCKETS];
+	struct io_stats *st = &mpp->io_stats;
+	struct timespec now;
+	long long d_ios;
+	int i;
+
+	if (!mpp->alias || mpp->stats_region == IO_STATS_REGION_FAILED)
+		return 0;
+	get_monotonic_time(&now);
+	if ((st->time.tv_sec || st->time.tv_nsec) &&
+	    (unsigned long)(now.tv_sec - st->time.tv_sec) < interval)
+		return 0;
+	if (mpp->stats_region == IO_STATS_NO_REGION &&
+	    setup_stats_region(mpp) != 0)
+		return 0;
+
+	snprintf(msg, sizeof(msg), "@stats_print %d", mpp->stats_region);
+	if (dm_message_response(mpp->alias, msg, &resp) != 0) {
+		/* The region may have been deleted, set it up again */
+		condlog(3, "%s: failed to read dm-stats region %d",
+			mpp->alias, mpp->stats_region);
+		mpp->stats_region = IO_STATS_NO_REGION;
+		return 0;
+	}
+	hist_str = strrchr(resp, ' ');
+	if (sscanf(resp, "%*u+%*u %llu %*u %llu %llu %llu %*u %llu %llu",
+		   &rd_ios, &rd_sec, &rd_ns, &wr_ios, &wr_sec, &wr_ns) != 6 ||
+	    !hist_str || parse_histogram(hist_str + 1, hist) != 0) {
+		condlog(2, "%s: unexpected dm-stats output \"%s\"",
+			mpp->alias, resp);
+		free(resp);
+		return 0;
+	}
+	free(resp);
+
+	d_ios = advance_io_stats(st, rd_ios + wr_ios, rd_sec + wr_sec,
+				 (rd_ns + wr_ns) / 1000, &now);
+	if (d_ios == 0)
+		return 1;
+	for (i = 0; i < IO_STATS_BUCKETS; i++) {
+		if (d_ios > 0 && hist[i] >= st->hist_last[i])
+			st->hist[i] += hist[i] - st->hist_last[i];
+		st->hist_last[i] = hist[i];
+	}
+	decay_histogram(st);
+	return d_ios > 0;
+}
+
+enum io_workload io_stats_workload(const struct io_stats *st)
+{
+	unsigned int size_kb;
+	unsigned long long depth;
+
+	if (st->iops < IO_TUNE_MIN_IOPS)
+		return IO_WORKLOAD_UNKNOWN;
+	size_kb = st->kbps / st->iops;
+	/* Little's law: the mean number of requests in flight */
+	depth = (unsigned long long)st->iops * st->latency / 1000000;
+	if (size_kb >= IO_TUNE_STREAMING_KB)
+		return IO_WORKLOAD_STREAMING;
+	if (size_kb < IO_TUNE_TRANSACTIONAL_KB &&
+	    depth >= IO_TUNE_TRANSACTIONAL_DEPTH)
+		return IO_WORKLOAD_TRANSACTIONAL;
+	return IO_WORKLOAD_MIXED;
+}
+
+int io_stats_tune(struct io_tune *t, const struct io_stats *st)
+{
+	int wl = io_stats_workload(st);
+	bool quiet;
+
+	/* Quiet: little I/O, or much less than the recent average */
+	quiet = wl == IO_WORKLOAD_UNKNOWN || st->iops < t->avg_iops / 4;
+	t->avg_iops = t->avg_iops ? (3 * t->avg_iops + st->iops) / 4 :
+		st->iops;
+
+	if (!quiet) {
+		if (wl == t->candidate)
+			t->streak++;
+		else {
+			t->candidate = wl;
+			t->streak = 1;
+		}
+		return 0;
+	}
+	if (t->candidate == IO_WORKLOAD_UNKNOWN ||
+	    t->candidate == t->applied ||
+	    t->streak < IO_TUNE_STABLE_SAMPLES)
+		return 0;
+	/* No previous tuning, and the configured selector fits */
+	if (t->applied == IO_WORKLOAD_UNKNOWN &&
+	    t->candidate == IO_WORKLOAD_MIXED) {
+		t->applied = t->candidate;
+		return 0;
+	}
+	t->applied = t->candidate;
+	return 1;
+}
+
+const char *io_workload_name(int workload)
+{
+	switch (workload) {
+	case IO_WORKLOAD_MIXED:
+		return "mixed";
+	case IO_WORKLOAD_TRANSACTIONAL:
+		return "transactional";
+	case IO_WORKLOAD_STREAMING:
+		return "streaming";
+	default:
+		return "unknown";
+	}
+}
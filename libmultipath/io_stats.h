@@ -0,0 +1,93 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _IO_STATS_H
+#define _IO_STATS_H
+
+#include <time.h>
+
+struct path;
+struct multipath;
+
+/*
+ * I/O statistics of paths and maps for "show paths format", "show maps
+ * format" and "show metrics", enabled with the io_stats option.
+ *
+ * Paths are sampled on every path check from the block layer counters in
+ * sysfs. The block layer only keeps the total I/O time, so the latency
+ * histogram of a path counts the I/O of each sample interval in the
+ * bucket of the interval's average latency.
+ *
+ * Maps are sampled at most once per polling interval from a dm-stats
+ * region with a latency histogram, which multipathd creates on each map
+ * with the program id "multipathd". The region is kept when multipathd
+ * stops, and used again when it starts.
+ *
+ * The histograms decay, so that the percentiles follow the recent I/O.
+ */
+#define IO_STATS_BUCKETS 12
+
+struct io_stats {
+	/* counters at the last sample */
+	unsigned long long ios;
+	unsigned long long sectors;
+	unsigned long long ticks_us;
+	unsigned long long hist_last[IO_STATS_BUCKETS];
+	struct timespec time;
+	/* rates over the last sample interval */
+	unsigned int iops;
+	unsigned int kbps;
+	unsigned int latency;
+	/* decaying latency histogram, see io_stats_bounds */
+	unsigned long long hist[IO_STATS_BUCKETS];
+};
+
+/* No dm-stats region has been set up for the map yet */
+#define IO_STATS_NO_REGION -1
+/* Setting up a dm-stats region failed, don't try again */
+#define IO_STATS_REGION_FAILED -2
+
+/*
+ * Workloads told apart by selector_autotune, from the mean request size
+ * and the mean number of requests in flight of a map.
+ */
+enum io_workload {
+	IO_WORKLOAD_UNKNOWN = 0,
+	/* neither of the below, use the configured path selector */
+	IO_WORKLOAD_MIXED,
+	/* small requests at a high queue depth, e.g. OLTP */
+	IO_WORKLOAD_TRANSACTIONAL,
+	/* large requests, e.g. backups */
+	IO_WORKLOAD_STREAMING,
+};
+
+struct io_tune {
+	/* workload the current table was set up for */
+	int applied;
+	/* workload of the last busy samples, and how many there were */
+	int candidate;
+	unsigned int streak;
+	/* moving average of the IOPS, to detect quiet periods */
+	unsigned int avg_iops;
+};
+
+void sample_path_io_stats(struct path *pp);
+/*
+ * Sample mpp if interval seconds have passed since the last sample.
+ * Returns 1 if the rates of mpp->io_stats have been updated.
+ */
+int sample_map_io_stats(struct multipath *mpp, unsigned int interval);
+
+enum io_workload io_stats_workload(const struct io_stats *st);
+/*
+ * Feed a new sample of st into t. Returns 1 if the workload has been
+ * stable for long enough and the map is quiet, so that it should be
+ * reloaded for t->applied now.
+ */
+int io_stats_tune(struct io_tune *t, const struct io_stats *st);
+const char *io_workload_name(int workload);
+
+/* Latency (us) below which pct percent of the I/O completed, or 0 */
+unsigned int io_stats_percentile(const struct io_stats *st, unsigned int pct);
+
+#endif /* _IO_STATS_H */
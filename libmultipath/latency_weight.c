@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <libudev.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "sysfs.h"
+#include "debug.h"
+#include "time-util.h"
+#include "latency_weight.h"
+
+/* Minimum I/O time (ms) between two samples for a usable measurement */
+#define LATENCY_MIN_TICKS		10
+/* Minimum time between reloads of a map for weight changes (s) */
+#define LATENCY_WEIGHT_INTERVAL		60
+/* Minimum change of a path's relative_throughput to warrant a reload */
+#define LATENCY_WEIGHT_MIN_CHANGE	20
+#define MAX_RELATIVE_THROUGHPUT		100
+
+bool use_latency_weights(const struct multipath *mpp)
+{
+	return mpp->rr_weight == RR_WEIGHT_LATENCY && mpp->selector &&
+		!strncmp(mpp->selector, "service-time", 12);
+}
+
+static int read_io_stat(struct path *pp, unsigned long long *ios,
+			unsigned long long *ticks)
+{
+	char buf[256];
+	unsigned long long rd_ios, rd_ticks, wr_ios, wr_ticks;
+	ssize_t len;
+
+	if (!pp->udev)
+		return -1;
+	len = sysfs_attr_get_value(pp->udev, "stat", buf, sizeof(buf));
+	if (len <= 0 || (size_t)len >= sizeof(buf))
+		return -1;
+	if (sscanf(buf, "%llu %*u %*u %llu %llu %*u %*u %llu",
+		   &rd_ios, &rd_ticks, &wr_ios, &wr_ticks) != 4)
+		return -1;
+	*ios = rd_ios + wr_ios;
+	*ticks = rd_ticks + wr_ticks;
+	return 0;
+}
+
+void sample_path_latency(struct path *pp)
+{
+	unsigned long long ios, ticks, d_ios, d_ticks;
+	unsigned int latency;
+
+	if (!pp->mpp || !use_latency_weights(pp->mpp) ||
+	    read_io_stat(pp, &ios, &ticks) != 0)
+		return;
+
+	if (pp->io_stat_ios == 0 || ios < pp->io_stat_ios ||
+	    ticks < pp->io_stat_ticks) {
+		pp->io_stat_ios = ios;
+		pp->io_stat_ticks = ticks;
+		return;
+	}
+	d_ios = ios - pp->io_stat_ios;
+	d_ticks = ticks - pp->io_stat_ticks;
+	/* Idle paths keep their previous latency */
+	if (d_ios == 0 || d_ticks < LATENCY_MIN_TICKS)
+		return;
+
+	pp->io_stat_ios = ios;
+	pp->io_stat_ticks = ticks;
+	latency = d_ticks * 1000 / d_ios;
+	if (latency == 0)
+		latency = 1;
+	if (pp->svc_latency == 0)
+		pp->svc_latency = latency;
+	else
+		pp->svc_latency = (3ULL * pp->svc_latency + latency) / 4;
+	condlog(4, "%s: service time %u us, average %u us", pp->dev,
+		latency, pp->svc_latency);
+}
+
+int path_relative_throughput(const struct pathgroup *pgp,
+			     const struct path *pp)
+{
+	const struct path *pp1;
+	unsigned int min_latency = 0;
+	int i, rt;
+
+	if (pp->svc_latency == 0)
+		return MAX_RELATIVE_THROUGHPUT;
+	vector_foreach_slot(pgp->paths, pp1, i) {
+		if (pp1->svc_latency &&
+		    (!min_latency || pp1->svc_latency < min_latency))
+			min_latency = pp1->svc_latency;
+	}
+	rt = (unsigned long long)MAX_RELATIVE_THROUGHPUT * min_latency /
+		pp->svc_latency;
+	return rt > 0 ? rt : 1;
+}
+
+bool latency_weights_changed(struct multipath *mpp)
+{
+	struct pathgroup *pgp;
+	struct path *pp;
+	struct timespec now;
+	int i, j, rt;
+
+	if (!use_latency_weights(mpp))
+		return false;
+	get_monotonic_time(&now);
+	if (mpp->latency_weight_time &&
+	    now.tv_sec - mpp->latency_weight_time < LATENCY_WEIGHT_INTERVAL)
+		return false;
+
+	vector_foreach_slot(mpp->pg, pgp, i) {
+		vector_foreach_slot(pgp->paths, pp, j) {
+			rt = path_relative_throughput(pgp, pp);
+			if (abs(rt - pp->rel_throughput) <
+			    LATENCY_WEIGHT_MIN_CHANGE)
+				continue;
+			condlog(3, "%s: %s relative_throughput %d -> %d",
+				mpp->alias, pp->dev, pp->rel_throughput, rt);
+			mpp->latency_weight_time = now.tv_sec;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,41 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _LATENCY_WEIGHT_H
+#define _LATENCY_WEIGHT_H
+
+#include <stdbool.h>
+
+struct path;
+struct pathgroup;
+struct multipath;
+
+/*
+ * Latency based path weights for "rr_weight latency".
+ *
+ * multipathd samples the I/O statistics of each path in sysfs on every
+ * path check, and keeps a moving average of the service time of the
+ * completed I/O in pp->svc_latency. For the service-time path selector,
+ * assemble_map() passes relative_throughput values inversely
+ * proportional to these latencies, so that slower paths in a path group
+ * get less I/O.
+ */
+
+/* True if the map's table carries latency based weights */
+bool use_latency_weights(const struct multipath *mpp);
+
+/* Update pp->svc_latency from the path's I/O statistics */
+void sample_path_latency(struct path *pp);
+
+/* relative_throughput argument (1 .. 100) for a path in pgp */
+int path_relative_throughput(const struct pathgroup *pgp,
+			     const struct path *pp);
+
+/*
+ * True if the weights have changed enough since the table was loaded
+ * that the map should be reloaded. Rate limited per map; returns true
+ * at most once per interval.
+ */
+bool latency_weights_changed(struct multipath *mpp);
+
+#endif /* _LATENCY_WEIGHT_H */
@@ -1,4 +1,98 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for pthread_rwlockattr_setkind_np() */
+#endif
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <urcu/uatomic.h>
 #include "lock.h"
+#include "strbuf.h"
+#include "time-util.h"
+
+/* Must be a power of 2 */
+#define PROF_SITES 128
+#define PROF_TOP 10
+/* Nesting depth of profiled holds per thread */
+#define PROF_MAX_HELD 8
+/* Waits shorter than this don't count as contended */
+#define PROF_CONTENDED_NS 10000
+
+struct lock_site {
+	const char *func;
+	const void *addr;
+	int line;
+	unsigned long count;
+	unsigned long long hold_ns;
+	unsigned long long max_ns;
+	unsigned long long wait_ns;
+};
+
+struct lock_hold {
+	const char *func;
+	const void *addr;
+	int line;
+	int shared;
+	unsigned long long ns;
+	/* CLOCK_REALTIME at release */
+	time_t when;
+};
+
+struct lock_profile {
+	int waiters;
+	int max_waiters;
+	/* Below fields are protected by mutex */
+	pthread_mutex_t mutex;
+	unsigned long acquired;
+	unsigned long contended;
+	unsigned long dropped_sites;
+	struct lock_site sites[PROF_SITES];
+	int nr_sites;
+	/* longest holds, shortest first */
+	struct lock_hold top[PROF_TOP];
+	int nr_top;
+	/* current exclusive holder */
+	const char *holder_func;
+	const void *holder_addr;
+	int holder_line;
+	struct timespec holder_since;
+};
+
+static __thread struct held_lock {
+	struct lock_profile *prof;
+	const char *func;
+	const void *addr;
+	int line;
+	int shared;
+	int depth;
+	struct timespec start;
+	unsigned long long wait_ns;
+} held[PROF_MAX_HELD];
+static __thread int nr_held;
+
+void init_lock(struct mutex_lock *a)
+{
+	pthread_rwlockattr_t attr;
+
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr,
+			PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&a->rwlock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+#ifdef LOCK_PROFILE
+	a->prof = alloc_lock_profile();
+#endif
+}
+
+void destroy_lock(struct mutex_lock *a)
+{
+	pthread_rwlock_destroy(&a->rwlock);
+#ifdef LOCK_PROFILE
+	free_lock_profile(a->prof);
+	a->prof = NULL;
+#endif
+}
 
 void cleanup_lock (void * data)
 {
@@ -6,3 +100,342 @@ void cleanup_lock (void * data)
 
 	unlock(lock);
 }
+
+struct lock_profile *alloc_lock_profile(void)
+{
+	struct lock_profile *prof = calloc(1, sizeof(*prof));
+
+	if (!prof)
+		return NULL;
+	pthread_mutex_init(&prof->mutex, NULL);
+	return prof;
+}
+
+void free_lock_profile(struct lock_profile *prof)
+{
+	if (!prof)
+		return;
+	pthread_mutex_destroy(&prof->mutex);
+	free(prof);
+}
+
+static unsigned long long ts_to_ns(const struct timespec *ts)
+{
+	if (ts->tv_sec < 0)
+		return 0;
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+void lock_profile_wait(struct lock_profile *prof, struct timespec *wait_start)
+{
+	int w, max;
+
+	get_monotonic_time(wait_start);
+	w = uatomic_add_return(&prof->waiters, 1);
+	max = uatomic_read(&prof->max_waiters);
+	while (w > max) {
+		int old = uatomic_cmpxchg(&prof->max_waiters, max, w);
+
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
+void lock_profile_wait_failed(struct lock_profile *prof)
+{
+	uatomic_dec(&prof->waiters);
+}
+
+void lock_profile_hold(struct lock_profile *prof, const char *func, int line,
+		       const void *addr, const struct timespec *wait_start,
+		       int shared)
+{
+	struct held_lock *h;
+	struct timespec diff;
+	int i;
+
+	if (wait_start)
+		uatomic_dec(&prof->waiters);
+	for (i = nr_held - 1; i >= 0; i--) {
+		if (held[i].prof == prof) {
+			held[i].depth++;
+			return;
+		}
+	}
+	if (nr_held >= PROF_MAX_HELD)
+		return;
+	h = &held[nr_held++];
+	h->prof = prof;
+	h->func = func;
+	h->addr = addr;
+	h->line = line;
+	h->shared = shared;
+	h->depth = 1;
+	get_monotonic_time(&h->start);
+	h->wait_ns = 0;
+	if (wait_start) {
+		timespecsub(&h->start, wait_start, &diff);
+		h->wait_ns = ts_to_ns(&diff);
+	}
+	if (!shared) {
+		pthread_mutex_lock(&prof->mutex);
+		prof->holder_func = func;
+		prof->holder_addr = addr;
+		prof->holder_line = line;
+		prof->holder_since = h->start;
+		pthread_mutex_unlock(&prof->mutex);
+	}
+}
+
+/* Called with prof->mutex held */
+static struct lock_site *find_site(struct lock_profile *prof,
+				   const struct held_lock *h)
+{
+	unsigned long key = (unsigned long)h->func ^ (unsigned long)h->addr;
+	unsigned int i, n;
+
+	key = key * 31 + h->line;
+	for (n = 0, i = key & (PROF_SITES - 1); n < PROF_SITES;
+	     n++, i = (i + 1) & (PROF_SITES - 1)) {
+		struct lock_site *s = &prof->sites[i];
+
+		if (s->count == 0 && !s->func && !s->addr) {
+			/* Keep a free slot, so that lookups terminate */
+			if (prof->nr_sites >= PROF_SITES - 1)
+				return NULL;
+			s->func = h->func;
+			s->addr = h->addr;
+			s->line = h->line;
+			prof->nr_sites++;
+			return s;
+		}
+		if (s->func == h->func && s->addr == h->addr &&
+		    s->line == h->line)
+			return s;
+	}
+	return NULL;
+}
+
+/* Called with prof->mutex held */
+static void add_top_hold(struct lock_profile *prof, const struct held_lock *h,
+			 unsigned long long ns)
+{
+	struct lock_hold *t;
+	struct timespec now;
+	int i;
+
+	if (prof->nr_top == PROF_TOP) {
+		if (ns <= prof->top[0].ns)
+			return;
+		i = 0;
+	} else
+		i = prof->nr_top++;
+	/* insertion sort, shortest first */
+	for (; i + 1 < prof->nr_top && prof->top[i + 1].ns < ns; i++)
+		prof->top[i] = prof->top[i + 1];
+	for (; i > 0 && prof->top[i - 1].ns > ns; i--)
+		prof->top[i] = prof->top[i - 1];
+	t = &prof->top[i];
+	t->func = h->func;
+	t->addr = h->addr;
+	t->line = h->line;
+	t->shared = h->shared;
+	t->ns = ns;
+	clock_gettime(CLOCK_REALTIME, &now);
+	t->when = now.tv_sec;
+}
+
+void lock_profile_release(struct lock_profile *prof)
+{
+	struct held_lock *h = NULL;
+	struct lock_site *s;
+	struct timespec now, diff;
+	unsigned long long ns;
+	int i;
+
+	for (i = nr_held - 1; i >= 0; i--) {
+		if (held[i].prof == prof) {
+			h = &held[i];
+			break;
+		}
+	}
+	if (!h || --h->depth > 0)
+		return;
+
+	get_monotonic_time(&now);
+	timespecsub(&now, &h->start, &diff);
+	ns = ts_to_ns(&diff);
+
+	pthread_mutex_lock(&prof->mutex);
+	if (!h->shared) {
+		prof->holder_func = NULL;
+		prof->holder_addr = NULL;
+	}
+	prof->acquired++;
+	if (h->wait_ns >= PROF_CONTENDED_NS)
+		prof->contended++;
+	s = find_site(prof, h);
+	if (s) {
+		s->count++;
+		s->hold_ns += ns;
+		s->wait_ns += h->wait_ns;
+		if (ns > s->max_ns)
+			s->max_ns = ns;
+	} else
+		prof->dropped_sites++;
+	add_top_hold(prof, h, ns);
+	pthread_mutex_unlock(&prof->mutex);
+
+	/* holds are usually released in reverse order */
+	nr_held--;
+	if (h != &held[nr_held])
+		*h = held[nr_held];
+}
+
+void reset_lock_profile(struct lock_profile *prof)
+{
+	if (!prof)
+		return;
+	pthread_mutex_lock(&prof->mutex);
+	memset(prof->sites, 0, sizeof(prof->sites));
+	prof->nr_sites = 0;
+	prof->nr_top = 0;
+	prof->acquired = prof->contended = prof->dropped_sites = 0;
+	uatomic_set(&prof->max_waiters, uatomic_read(&prof->waiters));
+	pthread_mutex_unlock(&prof->mutex);
+}
+
+static int print_site(struct strbuf *buf, const char *func, int line,
+		      const void *addr)
+{
+	Dl_info info = { .dli_fname = NULL };
+
+	if (func)
+		return print_strbuf(buf, "%s:%d", func, line);
+	if (!dladdr(addr, &info))
+		return print_strbuf(buf, "%p", addr);
+	if (info.dli_sname)
+		return print_strbuf(buf, "%s+0x%lx", info.dli_sname,
+				    (unsigned long)addr -
+				    (unsigned long)info.dli_saddr);
+	if (info.dli_fname)
+		return print_strbuf(buf, "%s+0x%lx", info.dli_fname,
+				    (unsigned long)addr -
+				    (unsigned long)info.dli_fbase);
+	return print_strbuf(buf, "%p", addr);
+}
+
+static int cmp_site_hold(const void *a, const void *b)
+{
+	const struct lock_site *s1 = a, *s2 = b;
+
+	if (s1->hold_ns != s2->hold_ns)
+		return s1->hold_ns < s2->hold_ns ? 1 : -1;
+	return 0;
+}
+
+/* The site name column is padded to this width */
+#define SITE_WIDTH 32
+
+static int print_site_padded(struct strbuf *buf, const char *func, int line,
+			     const void *addr)
+{
+	size_t len = get_strbuf_len(buf);
+	int rc;
+
+	if ((rc = print_site(buf, func, line, addr)) < 0)
+		return rc;
+	if (get_strbuf_len(buf) - len < SITE_WIDTH)
+		return fill_strbuf(buf, ' ',
+				   SITE_WIDTH - (get_strbuf_len(buf) - len));
+	return append_strbuf_str(buf, " ");
+}
+
+int snprint_lock_profile(struct strbuf *buf, const char *name,
+			 struct lock_profile *prof)
+{
+	struct lock_site *sites;
+	struct lock_hold top[PROF_TOP];
+	struct timespec now, diff;
+	const char *holder_func;
+	const void *holder_addr;
+	int holder_line, nr_sites = 0, nr_top, i, rc;
+	unsigned long acquired, contended, dropped;
+
+	if (!prof)
+		return print_strbuf(buf, "%s: lock profiling is not enabled\n",
+				    name);
+
+	sites = calloc(PROF_SITES, sizeof(*sites));
+	if (!sites)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&prof->mutex);
+	for (i = 0; i < PROF_SITES; i++)
+		if (prof->sites[i].count)
+			sites[nr_sites++] = prof->sites[i];
+	nr_top = prof->nr_top;
+	memcpy(top, prof->top, sizeof(top));
+	acquired = prof->acquired;
+	contended = prof->contended;
+	dropped = prof->dropped_sites;
+	holder_func = prof->holder_func;
+	holder_addr = prof->holder_addr;
+	holder_line = prof->holder_line;
+	get_monotonic_time(&now);
+	timespecsub(&now, &prof->holder_since, &diff);
+	pthread_mutex_unlock(&prof->mutex);
+
+	qsort(sites, nr_sites, sizeof(*sites), cmp_site_hold);
+
+	if ((rc = print_strbuf(buf, "%s: holds %lu contended %lu waiters %d max %d\n",
+			       name, acquired, contended,
+			       uatomic_read(&prof->waiters),
+			       uatomic_read(&prof->max_waiters))) < 0)
+		goto out;
+	if (holder_func || holder_addr) {
+		if ((rc = append_strbuf_str(buf, "held by ")) < 0 ||
+		    (rc = print_site(buf, holder_func, holder_line,
+				     holder_addr)) < 0 ||
+		    (rc = print_strbuf(buf, " for %llu us\n",
+				       ts_to_ns(&diff) / 1000)) < 0)
+			goto out;
+	}
+	if ((rc = print_strbuf(buf, "%-*s %10s %12s %10s %10s %12s\n",
+			       SITE_WIDTH - 1, "site", "holds", "total_us",
+			       "avg_us", "max_us", "wait_us")) < 0)
+		goto out;
+	for (i = 0; i < nr_sites; i++) {
+		const struct lock_site *s = &sites[i];
+
+		if ((rc = print_site_padded(buf, s->func, s->line,
+					    s->addr)) < 0 ||
+		    (rc = print_strbuf(buf, "%10lu %12llu %10llu %10llu %12llu\n",
+				       s->count, s->hold_ns / 1000,
+				       s->hold_ns / s->count / 1000,
+				       s->max_ns / 1000,
+				       s->wait_ns / 1000)) < 0)
+			goto out;
+	}
+	if (dropped > 0 &&
+	    (rc = print_strbuf(buf, "%lu holds from other sites not shown\n",
+			       dropped)) < 0)
+		goto out;
+	if (nr_top > 0 &&
+	    (rc = append_strbuf_str(buf, "longest holds:\n")) < 0)
+		goto out;
+	for (i = nr_top - 1; i >= 0; i--) {
+		if ((rc = print_strbuf(buf, "%12llu us %s ", top[i].ns / 1000,
+				       top[i].shared ? "shared   " :
+				       "exclusive")) < 0 ||
+		    (rc = print_site(buf, top[i].func, top[i].line,
+				     top[i].addr)) < 0 ||
+		    (rc = print_strbuf(buf, " at %ld\n",
+				       (long)top[i].when)) < 0)
+			goto out;
+	}
+out:
+	free(sites);
+	return rc;
+}
@@ -2,28 +2,202 @@
 #define _LOCK_H
 
 #include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+#include "trace.h"
+
+/*
+ * A reader/writer lock. lock()/timedlock() take it exclusively, which is
+ * what all code modifying the protected data must do. Code that only
+ * reads may use lock_shared()/timedlock_shared() instead, and run
+ * concurrently with other readers. unlock() and cleanup_lock() release
+ * the lock in either mode.
+ *
+ * Waiting writers are preferred over new readers, so that a steady
+ * stream of readers can't starve the threads that need to update state.
+ *
+ * A release hook, see set_release_hook(), is called whenever the lock
+ * is released after an exclusive hold, still holding it.
+ *
+ * With "make ENABLE_LOCK_PROFILE=1", locks set up with init_lock() record
+ * the call sites holding them, hold and wait times, and waiters, see
+ * snprint_lock_profile().
+ */
+struct lock_profile;
 
 struct mutex_lock {
-	pthread_mutex_t mutex;
+	pthread_rwlock_t rwlock;
+	/* held exclusively, only changed by the holder */
+	bool exclusive;
+	void (*release_hook)(void *);
+	void *release_arg;
+#ifdef LOCK_PROFILE
+	struct lock_profile *prof;
+#endif
 };
 
-static inline void lock(struct mutex_lock *a)
+/* Static initializer, for locks that are only used exclusively */
+#define MUTEX_LOCK_INITIALIZER { .rwlock = PTHREAD_RWLOCK_INITIALIZER }
+
+/*
+ * Profiling hooks. A holder is identified by func and line, or by addr
+ * if func is NULL. wait_start may be NULL if the holder didn't wait.
+ * lock_profile_wait() sets *wait_start. A thread may hold the same
+ * profiled object recursively, only the outermost hold is recorded.
+ */
+struct lock_profile *alloc_lock_profile(void);
+void free_lock_profile(struct lock_profile *prof);
+void lock_profile_wait(struct lock_profile *prof, struct timespec *wait_start);
+/* Called instead of lock_profile_hold() if the lock wasn't taken */
+void lock_profile_wait_failed(struct lock_profile *prof);
+void lock_profile_hold(struct lock_profile *prof, const char *func, int line,
+		       const void *addr, const struct timespec *wait_start,
+		       int shared);
+void lock_profile_release(struct lock_profile *prof);
+void reset_lock_profile(struct lock_profile *prof);
+struct strbuf;
+/* Print the statistics of prof. Also handles prof == NULL */
+int snprint_lock_profile(struct strbuf *buf, const char *name,
+			 struct lock_profile *prof);
+
+#ifdef LOCK_PROFILE
+static inline struct lock_profile *get_lock_profile(struct mutex_lock *a)
+{
+	return a->prof;
+}
+
+static inline void __lock_wait(struct mutex_lock *a, struct timespec *ts)
+{
+	if (a->prof)
+		lock_profile_wait(a->prof, ts);
+}
+
+static inline void __lock_held(struct mutex_lock *a, const char *func,
+			       int line, const struct timespec *ts, int shared)
 {
-	pthread_mutex_lock(&a->mutex);
+	if (a->prof)
+		lock_profile_hold(a->prof, func, line, NULL, ts, shared);
 }
 
-static inline int timedlock(struct mutex_lock *a, struct timespec *tmo)
+static inline void __lock_wait_failed(struct mutex_lock *a)
+{
+	if (a->prof)
+		lock_profile_wait_failed(a->prof);
+}
+
+static inline void __lock_release(struct mutex_lock *a)
+{
+	if (a->prof)
+		lock_profile_release(a->prof);
+}
+#else
+static inline struct lock_profile *get_lock_profile(struct mutex_lock *a
+						    __attribute__((unused)))
+{
+	return NULL;
+}
+
+#define __lock_wait(a, ts) do {} while (0)
+#define __lock_held(a, func, line, ts, shared) do {} while (0)
+#define __lock_wait_failed(a) do {} while (0)
+#define __lock_release(a) do {} while (0)
+#endif
+
+static inline void __lock(struct mutex_lock *a, const char *func, int line)
+{
+	struct timespec ts __attribute__((unused));
+
+	TRACE2(lock_wait, a, 0);
+	__lock_wait(a, &ts);
+	pthread_rwlock_wrlock(&a->rwlock);
+	a->exclusive = true;
+	__lock_held(a, func, line, &ts, 0);
+	TRACE2(lock_acquired, a, 0);
+}
+
+static inline int __timedlock(struct mutex_lock *a, struct timespec *tmo,
+			      const char *func, int line)
+{
+	struct timespec ts __attribute__((unused));
+	int r;
+
+	TRACE2(lock_wait, a, 0);
+	__lock_wait(a, &ts);
+	r = pthread_rwlock_timedwrlock(&a->rwlock, tmo);
+	if (r == 0) {
+		a->exclusive = true;
+		__lock_held(a, func, line, &ts, 0);
+		TRACE2(lock_acquired, a, 0);
+	} else
+		__lock_wait_failed(a);
+	return r;
+}
+
+static inline void __lock_shared(struct mutex_lock *a, const char *func,
+				 int line)
+{
+	struct timespec ts __attribute__((unused));
+
+	TRACE2(lock_wait, a, 1);
+	__lock_wait(a, &ts);
+	pthread_rwlock_rdlock(&a->rwlock);
+	__lock_held(a, func, line, &ts, 1);
+	TRACE2(lock_acquired, a, 1);
+}
+
+static inline int __timedlock_shared(struct mutex_lock *a,
+				     struct timespec *tmo,
+				     const char *func, int line)
+{
+	struct timespec ts __attribute__((unused));
+	int r;
+
+	TRACE2(lock_wait, a, 1);
+	__lock_wait(a, &ts);
+	r = pthread_rwlock_timedrdlock(&a->rwlock, tmo);
+	if (r == 0) {
+		__lock_held(a, func, line, &ts, 1);
+		TRACE2(lock_acquired, a, 1);
+	} else
+		__lock_wait_failed(a);
+	return r;
+}
+
+/* The macros record the call site for lock profiling */
+#define lock(a) __lock(a, __func__, __LINE__)
+#define timedlock(a, tmo) __timedlock(a, tmo, __func__, __LINE__)
+#define lock_shared(a) __lock_shared(a, __func__, __LINE__)
+#define timedlock_shared(a, tmo) \
+	__timedlock_shared(a, tmo, __func__, __LINE__)
+
+/*
+ * Call fn(arg) at the end of each exclusive hold of the lock, e.g. to
+ * publish what the holder has changed. Must be set before the lock is
+ * used by multiple threads.
+ */
+static inline void set_release_hook(struct mutex_lock *a,
+				    void (*fn)(void *), void *arg)
 {
-	return pthread_mutex_timedlock(&a->mutex, tmo);
+	a->release_hook = fn;
+	a->release_arg = arg;
 }
 
 static inline void unlock(struct mutex_lock *a)
 {
-	pthread_mutex_unlock(&a->mutex);
+	if (a->exclusive) {
+		a->exclusive = false;
+		if (a->release_hook)
+			a->release_hook(a->release_arg);
+	}
+	TRACE1(lock_release, a);
+	__lock_release(a);
+	pthread_rwlock_unlock(&a->rwlock);
 }
 
 #define lock_cleanup_pop(a) pthread_cleanup_pop(1)
 
+void init_lock(struct mutex_lock *a);
+void destroy_lock(struct mutex_lock *a);
 void cleanup_lock (void * data);
 
 #endif /* _LOCK_H */
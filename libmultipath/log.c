@@ -10,39 +10,35 @@
 #include <syslog.h>
 #include <time.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#include <urcu/uatomic.h>
+#if defined(USE_SYSTEMD) && USE_SYSTEMD > 209
+#define SD_JOURNAL_SUPPRESS_LOCATION
+#include <systemd/sd-journal.h>
+#define LOG_HAVE_JOURNAL 1
+#endif
 
 #include "memory.h"
 #include "log.h"
+#include "debug.h"
 #include "util.h"
 
-#define ALIGN(len, s) (((len)+(s)-1)/(s)*(s))
+#define LOG_MIN_SLOTS 16
+/* MESSAGE, PRIORITY, SYSLOG_IDENTIFIER, SYSLOG_FACILITY and the fields */
+#define LOG_MAX_IOV 7
 
 struct logarea* la;
-static pthread_mutex_t logq_lock = PTHREAD_MUTEX_INITIALIZER;
-
-#if LOGDBG
-static void dump_logarea (void)
-{
-	struct logmsg * msg;
-
-	logdbg(stderr, "\n==== area: start addr = %p, end addr = %p ====\n",
-		la->start, la->end);
-	logdbg(stderr, "|addr     |next     |prio|msg\n");
-
-	for (msg = (struct logmsg *)la->head; (void *)msg != la->tail;
-	     msg = msg->next)
-		logdbg(stderr, "|%p |%p |%i   |%s\n", (void *)msg, msg->next,
-				msg->prio, (char *)&msg->str);
-
-	logdbg(stderr, "|%p |%p |%i   |%s\n", (void *)msg, msg->next,
-			msg->prio, (char *)&msg->str);
-
-	logdbg(stderr, "\n\n");
-}
+int log_use_journal;
+#ifdef LOG_HAVE_JOURNAL
+static char log_identifier[64] = "SYSLOG_IDENTIFIER=";
 #endif
+/* serializes log_init(), log_close() and log_reset() */
+static pthread_mutex_t logq_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int logarea_init (int size)
 {
+	unsigned long i;
+
 	logdbg(stderr,"enter logarea_init\n");
 	la = (struct logarea *)MALLOC(sizeof(struct logarea));
 
@@ -52,22 +48,25 @@ static int logarea_init (int size)
 	if (size < MAX_MSG_SIZE)
 		size = DEFAULT_AREA_SIZE;
 
-	la->start = MALLOC(size);
-	if (!la->start) {
+	la->nr_slots = size / sizeof(struct logslot);
+	if (la->nr_slots < LOG_MIN_SLOTS)
+		la->nr_slots = LOG_MIN_SLOTS;
+	la->slots = MALLOC(la->nr_slots * sizeof(struct logslot));
+	if (!la->slots) {
 		FREE(la);
 		return 1;
 	}
-	memset(la->start, 0, size);
-
-	la->empty = 1;
-	la->end = la->start + size;
-	la->head = la->start;
-	la->tail = la->start;
+	for (i = 0; i < la->nr_slots; i++)
+		la->slots[i].seq = i;
+	la->head = 0;
+	la->tail = 0;
+	la->messages = 0;
+	la->dropped = 0;
 
-	la->buff = MALLOC(MAX_MSG_SIZE + sizeof(struct logmsg));
+	la->buff = MALLOC(sizeof(struct logmsg));
 
 	if (!la->buff) {
-		FREE(la->start);
+		FREE(la->slots);
 		FREE(la);
 		return 1;
 	}
@@ -85,6 +84,10 @@ int log_init(char *program_name, int size)
 	pthread_cleanup_push(cleanup_mutex, &logq_lock);
 
 	openlog(program_name, 0, LOG_DAEMON);
+#ifdef LOG_HAVE_JOURNAL
+	snprintf(log_identifier, sizeof(log_identifier),
+		 "SYSLOG_IDENTIFIER=%s", program_name);
+#endif
 	if (!la)
 		ret = logarea_init(size);
 
@@ -95,12 +98,17 @@ int log_init(char *program_name, int size)
 
 static void free_logarea (void)
 {
-	FREE(la->start);
+	FREE(la->slots);
 	FREE(la->buff);
 	FREE(la);
+	la = NULL;
 	return;
 }
 
+/*
+ * The caller must make sure that log_enqueue() and log_dequeue()
+ * aren't running any more, see log_thread_stop().
+ */
 void log_close (void)
 {
 	pthread_mutex_lock(&logq_lock);
@@ -125,117 +133,116 @@ void log_reset (char *program_name)
 	pthread_cleanup_pop(1);
 }
 
-__attribute__((format(printf, 2, 0)))
-static int _log_enqueue(int prio, const char * fmt, va_list ap)
+/* Append "name=value" to the fields at *pos, if there's room */
+static void add_log_field(char *fields, size_t *pos, const char *name,
+			  const char *value)
 {
-	int len, fwd;
-	char buff[MAX_MSG_SIZE];
-	struct logmsg * msg;
-	struct logmsg * lastmsg;
-
-	lastmsg = (struct logmsg *)la->tail;
-
-	if (!la->empty) {
-		fwd = sizeof(struct logmsg) +
-		      strlen((char *)&lastmsg->str) * sizeof(char) + 1;
-		la->tail += ALIGN(fwd, sizeof(void *));
-	}
-	vsnprintf(buff, MAX_MSG_SIZE, fmt, ap);
-	len = ALIGN(sizeof(struct logmsg) + strlen(buff) * sizeof(char) + 1,
-		    sizeof(void *));
-
-	/* not enough space on tail : rewind */
-	if (la->head <= la->tail && len > (la->end - la->tail)) {
-		logdbg(stderr, "enqueue: rewind tail to %p\n", la->tail);
-		if (la->head == la->start ) {
-			logdbg(stderr, "enqueue: can not rewind tail, drop msg\n");
-			la->tail = lastmsg;
-			return 1;  /* can't reuse */
-		}
-		la->tail = la->start;
-
-		if (la->empty)
-			la->head = la->start;
-	}
-
-	/* not enough space on head : drop msg */
-	if (la->head > la->tail && len >= (la->head - la->tail)) {
-		logdbg(stderr, "enqueue: log area overrun, drop msg\n");
+	int n;
+
+	if (!value || !*value)
+		return;
+	/* keep a byte for the terminating empty string */
+	n = snprintf(fields + *pos, LOG_FIELDS_SIZE - 1 - *pos, "%s=%s",
+		     name, value);
+	if (n >= 0 && (size_t)n < LOG_FIELDS_SIZE - 1 - *pos)
+		*pos += n + 1;
+}
 
-		if (!la->empty)
-			la->tail = lastmsg;
+static void set_log_fields(char *fields, const struct log_fields *f)
+{
+	size_t pos = 0;
 
-		return 1;
+	if (f) {
+		add_log_field(fields, &pos, "DEVICE", f->dev);
+		add_log_field(fields, &pos, "MAP", f->map);
+		add_log_field(fields, &pos, "WWID", f->wwid);
 	}
-
-	/* ok, we can stage the msg in the area */
-	la->empty = 0;
-	msg = (struct logmsg *)la->tail;
-	msg->prio = prio;
-	memcpy((void *)&msg->str, buff, strlen(buff) + 1);
-	lastmsg->next = la->tail;
-	msg->next = la->head;
-
-	logdbg(stderr, "enqueue: %p, %p, %i, %s\n", (void *)msg, msg->next,
-		msg->prio, (char *)&msg->str);
-
-#if LOGDBG
-	dump_logarea();
-#endif
-	return 0;
+	fields[pos] = '\0';
 }
 
 int log_enqueue(int prio, const char *fmt, va_list ap)
 {
-	int ret = 1;
-
-	pthread_mutex_lock(&logq_lock);
-	pthread_cleanup_push(cleanup_mutex, &logq_lock);
-	if (la)
-		ret = _log_enqueue(prio, fmt, ap);
-	pthread_cleanup_pop(1);
-	return ret;
+	return log_enqueue_fields(prio, NULL, fmt, ap);
 }
 
-static int _log_dequeue(void *buff)
+/*
+ * Reserve a slot and format the message into it. A full queue drops
+ * the message rather than waiting for the log thread.
+ */
+int log_enqueue_fields(int prio, const struct log_fields *fields,
+		       const char *fmt, va_list ap)
 {
-	struct logmsg * src = (struct logmsg *)la->head;
-	struct logmsg * dst = (struct logmsg *)buff;
-	struct logmsg * lst = (struct logmsg *)la->tail;
+	struct logslot *slot;
+	unsigned long pos, seq, old;
+	long diff;
 
-	if (la->empty)
+	if (!la)
 		return 1;
 
-	int len = strlen((char *)&src->str) * sizeof(char) +
-		  sizeof(struct logmsg) + 1;
-
-	dst->prio = src->prio;
-	memcpy(dst, src,  len);
-
-	if (la->tail == la->head)
-		la->empty = 1; /* we purge the last logmsg */
-	else {
-		la->head = src->next;
-		lst->next = la->head;
+	pos = uatomic_read(&la->tail);
+	for (;;) {
+		slot = &la->slots[pos % la->nr_slots];
+		seq = uatomic_read(&slot->seq);
+		cmm_smp_rmb();
+		diff = (long)(seq - pos);
+		if (diff == 0) {
+			old = uatomic_cmpxchg(&la->tail, pos, pos + 1);
+			if (old == pos)
+				break;
+			pos = old;
+		} else if (diff < 0) {
+			/* the consumer hasn't freed this slot yet */
+			uatomic_inc(&la->dropped);
+			return 1;
+		} else
+			pos = uatomic_read(&la->tail);
 	}
-	logdbg(stderr, "dequeue: %p, %p, %i, %s\n",
-		(void *)src, src->next, src->prio, (char *)&src->str);
-
-	memset((void *)src, 0,  len);
 
+	slot->msg.prio = prio;
+	vsnprintf(slot->msg.str, MAX_MSG_SIZE, fmt, ap);
+	if (uatomic_read(&log_use_journal))
+		set_log_fields(slot->msg.fields, fields);
+	else
+		slot->msg.fields[0] = '\0';
+	/* publish the message */
+	cmm_smp_wmb();
+	uatomic_set(&slot->seq, pos + 1);
+	uatomic_inc(&la->messages);
+
+	logdbg(stderr, "enqueue: %lu, %i, %s\n", pos, slot->msg.prio,
+	       slot->msg.str);
 	return 0;
 }
 
+/*
+ * Must only be called from one thread at a time
+ */
 int log_dequeue(void *buff)
 {
-	int ret = 1;
+	struct logslot *slot;
+	struct logmsg *dst = (struct logmsg *)buff;
+	unsigned long pos;
 
-	pthread_mutex_lock(&logq_lock);
-	pthread_cleanup_push(cleanup_mutex, &logq_lock);
-	if (la)
-		ret = _log_dequeue(buff);
-	pthread_cleanup_pop(1);
-	return ret;
+	if (!la)
+		return 1;
+
+	pos = la->head;
+	slot = &la->slots[pos % la->nr_slots];
+	if (uatomic_read(&slot->seq) != pos + 1)
+		return 1;
+	cmm_smp_rmb();
+
+	dst->prio = slot->msg.prio;
+	strlcpy(dst->str, slot->msg.str, sizeof(dst->str));
+	memcpy(dst->fields, slot->msg.fields, sizeof(dst->fields));
+	logdbg(stderr, "dequeue: %lu, %i, %s\n", pos, dst->prio, dst->str);
+
+	/* hand the slot back to the producers */
+	cmm_smp_mb();
+	uatomic_set(&slot->seq, pos + la->nr_slots);
+	la->head = pos + 1;
+
+	return 0;
 }
 
 /*
@@ -247,3 +254,52 @@ void log_syslog (void * buff)
 
 	syslog(msg->prio, "%s", (char *)&msg->str);
 }
+
+#ifdef LOG_HAVE_JOURNAL
+void log_journal (void * buff)
+{
+	struct logmsg * msg = (struct logmsg *)buff;
+	char message[sizeof("MESSAGE=") + MAX_MSG_SIZE];
+	char priority[sizeof("PRIORITY=") + 3];
+	struct iovec iov[LOG_MAX_IOV];
+	char *f;
+	int n = 0, len;
+
+	len = snprintf(message, sizeof(message), "MESSAGE=%s", msg->str);
+	/* condlog() messages end with a newline, syslog() strips it */
+	if (len > 0 && (size_t)len < sizeof(message) &&
+	    message[len - 1] == '\n')
+		message[--len] = '\0';
+	iov[n++] = (struct iovec){ message, strlen(message) };
+	snprintf(priority, sizeof(priority), "PRIORITY=%d", msg->prio);
+	iov[n++] = (struct iovec){ priority, strlen(priority) };
+	iov[n++] = (struct iovec){ log_identifier, strlen(log_identifier) };
+	iov[n++] = (struct iovec){ "SYSLOG_FACILITY=3",
+				   sizeof("SYSLOG_FACILITY=3") - 1 };
+	for (f = msg->fields; *f && n < LOG_MAX_IOV; f += strlen(f) + 1)
+		iov[n++] = (struct iovec){ f, strlen(f) };
+
+	if (sd_journal_sendv(iov, n) < 0)
+		log_syslog(buff);
+}
+#else
+void log_journal (void * buff)
+{
+	log_syslog(buff);
+}
+#endif
+
+void log_get_stats (struct log_stats *st)
+{
+	pthread_mutex_lock(&logq_lock);
+	if (la) {
+		st->messages = uatomic_read(&la->messages);
+		st->dropped = uatomic_read(&la->dropped);
+		st->area_size = sizeof(*la) +
+			la->nr_slots * sizeof(struct logslot);
+	} else {
+		st->messages = st->dropped = 0;
+		st->area_size = 0;
+	}
+	pthread_mutex_unlock(&logq_lock);
+}
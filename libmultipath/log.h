@@ -1,8 +1,10 @@
 #ifndef LOG_H
 #define LOG_H
 
-#define DEFAULT_AREA_SIZE 16384
+#define DEFAULT_AREA_SIZE 65536
 #define MAX_MSG_SIZE 256
+/* journal fields of a message, see struct logmsg */
+#define LOG_FIELDS_SIZE 160
 
 #ifndef LOGLEVEL
 #define LOGLEVEL 5
@@ -14,30 +16,75 @@
 #define logdbg(file, fmt, args...) do {} while (0)
 #endif
 
+/* see debug.h */
+struct log_fields;
+
 struct logmsg {
 	short int prio;
-	void * next;
-	char str[0];
+	char str[MAX_MSG_SIZE];
+	/*
+	 * "DEVICE=...", "MAP=..." and "WWID=..." journal fields, each
+	 * terminated by '\0', and an empty string after the last one.
+	 * Only filled in if log_use_journal is set.
+	 */
+	char fields[LOG_FIELDS_SIZE];
+};
+
+/*
+ * A log slot is free for the producer that reserved position pos if
+ * seq == pos, and holds a message for the consumer if seq == pos + 1.
+ */
+struct logslot {
+	unsigned long seq;
+	struct logmsg msg;
 };
 
+/*
+ * Bounded lock-free queue of log messages, with multiple producers
+ * (log_enqueue()) and a single consumer (log_dequeue()).
+ * Messages are formatted by the caller of log_enqueue(); the arguments
+ * may refer to objects that are freed before the log thread sees them.
+ */
 struct logarea {
-	int empty;
-	void * head;
-	void * tail;
-	void * start;
-	void * end;
+	unsigned long nr_slots;
+	/* next position to fill, advanced by producers with cmpxchg */
+	unsigned long tail;
+	/* next position to read, only accessed by the consumer */
+	unsigned long head;
+	unsigned long messages;
+	unsigned long dropped;
+	struct logslot *slots;
 	char * buff;
 };
 
+struct log_stats {
+	/* messages queued for syslog */
+	unsigned long messages;
+	/* messages dropped because the log area was full */
+	unsigned long dropped;
+	/* bytes allocated for the log area */
+	size_t area_size;
+};
+
 extern struct logarea* la;
+/* send messages to the journal with sd_journal_sendv(), not to syslog */
+extern int log_use_journal;
 
 int log_init (char * progname, int size);
 void log_close (void);
 void log_reset (char * progname);
 int log_enqueue (int prio, const char * fmt, va_list ap)
 	__attribute__((format(printf, 2, 0)));
+int log_enqueue_fields (int prio, const struct log_fields *fields,
+			const char * fmt, va_list ap)
+	__attribute__((format(printf, 3, 0)));
 int log_dequeue (void *);
 void log_syslog (void *);
-void dump_logmsg (void *);
+/*
+ * Like log_syslog(), with the fields of the message. Without systemd
+ * support, this is log_syslog().
+ */
+void log_journal (void *);
+void log_get_stats (struct log_stats *st);
 
 #endif /* LOG_H */
@@ -4,127 +4,129 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <syslog.h>
 #include <pthread.h>
-#include <sys/mman.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <urcu/uatomic.h>
 
 #include "memory.h"
 
 #include "log_pthread.h"
 #include "log.h"
-#include "lock.h"
 #include "util.h"
+#include "thread_settings.h"
 
 static pthread_t log_thr;
+static int log_area_size;
 
-/* logev_lock must not be taken with logq_lock held */
-static pthread_mutex_t logev_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t logev_cond = PTHREAD_COND_INITIALIZER;
-
+/*
+ * log_safe() doesn't take any locks. logq_users counts the callers
+ * that may be accessing the logarea, so that log_thread_stop() can
+ * wait for them before log_close() frees it.
+ */
 static int logq_running;
+static int logq_users;
+/* set by producers, the first one to set it wakes the log thread */
 static int log_messages_pending;
+static sem_t logev_sem;
 
 void log_safe (int prio, const char * fmt, va_list ap)
+{
+	log_safe_fields(prio, NULL, fmt, ap);
+}
+
+void log_safe_fields (int prio, const struct log_fields *fields,
+		      const char * fmt, va_list ap)
 {
 	bool running;
 
 	if (prio > LOG_DEBUG)
 		prio = LOG_DEBUG;
 
-	/*
-	 * logev_lock protects logq_running. By holding it, we avoid a race
-	 * with log_thread_stop() -> log_close(), which would free the logarea.
-	 */
-	pthread_mutex_lock(&logev_lock);
-	pthread_cleanup_push(cleanup_mutex, &logev_lock);
-	running = logq_running;
-
-	if (running) {
-		log_enqueue(prio, fmt, ap);
-
-		log_messages_pending = 1;
-		pthread_cond_signal(&logev_cond);
-	}
-	pthread_cleanup_pop(1);
+	uatomic_inc(&logq_users);
+	cmm_smp_mb();
+	running = uatomic_read(&logq_running);
+	if (running && log_enqueue_fields(prio, fields, fmt, ap) == 0 &&
+	    uatomic_xchg(&log_messages_pending, 1) == 0)
+		sem_post(&logev_sem);
+	cmm_smp_mb();
+	uatomic_dec(&logq_users);
 
 	if (!running)
 		vsyslog(prio, fmt, ap);
 }
 
+/* One wakeup of the log thread writes out all queued messages */
 static void flush_logqueue (void)
 {
+	bool journal = uatomic_read(&log_use_journal);
 	int empty;
 
 	do {
 		empty = log_dequeue(la->buff);
-		if (!empty)
-			log_syslog(la->buff);
+		if (!empty) {
+			if (journal)
+				log_journal(la->buff);
+			else
+				log_syslog(la->buff);
+		}
 	} while (empty == 0);
 }
 
 static void cleanup_log_thread(__attribute((unused)) void *arg)
 {
 	logdbg(stderr, "log thread exiting");
-	pthread_mutex_lock(&logev_lock);
-	logq_running = 0;
-	pthread_mutex_unlock(&logev_lock);
+	uatomic_set(&logq_running, 0);
 }
 
 static void * log_thread (__attribute__((unused)) void * et)
 {
-	int running;
-
-	pthread_mutex_lock(&logev_lock);
-	running = logq_running;
-	if (!running)
-		logq_running = 1;
-	pthread_cond_signal(&logev_cond);
-	pthread_mutex_unlock(&logev_lock);
-	if (running)
-		/* already started */
-		return NULL;
 	pthread_cleanup_push(cleanup_log_thread, NULL);
 
-	mlockall(MCL_CURRENT | MCL_FUTURE);
+	lock_memory();
 	logdbg(stderr,"enter log_thread\n");
 
 	while (1) {
-		pthread_mutex_lock(&logev_lock);
-		pthread_cleanup_push(cleanup_mutex, &logev_lock);
-		while (!log_messages_pending)
-			/* this is a cancellation point */
-			pthread_cond_wait(&logev_cond, &logev_lock);
-		log_messages_pending = 0;
-		pthread_cleanup_pop(1);
-
+		sample_thread_cpu(THREAD_LOG);
+		/* this is a cancellation point */
+		if (sem_wait(&logev_sem) != 0)
+			continue;
+		/* producers after this point will post again */
+		uatomic_xchg(&log_messages_pending, 0);
 		flush_logqueue();
 	}
 	pthread_cleanup_pop(1);
 	return NULL;
 }
 
-void log_thread_start (pthread_attr_t *attr)
+void log_thread_set_area_size (int size)
 {
-	int running = 0;
+	log_area_size = size;
+}
 
+void log_thread_start (pthread_attr_t *attr)
+{
 	logdbg(stderr,"enter log_thread_start\n");
 
-	if (log_init("multipathd", 0)) {
+	if (log_init("multipathd", log_area_size)) {
 		fprintf(stderr,"can't initialize log buffer\n");
 		exit(1);
 	}
 
-	pthread_mutex_lock(&logev_lock);
-	pthread_cleanup_push(cleanup_mutex, &logev_lock);
-	if (!pthread_create(&log_thr, attr, log_thread, NULL))
-		while (!(running = logq_running))
-			pthread_cond_wait(&logev_cond, &logev_lock);
-	pthread_cleanup_pop(1);
-
-	if (!running) {
+	if (sem_init(&logev_sem, 0, 0) != 0) {
+		fprintf(stderr,"can't initialize log semaphore\n");
+		exit(1);
+	}
+	/* messages logged before the thread is up will be queued */
+	uatomic_set(&logq_running, 1);
+	if (pthread_create(&log_thr, attr, log_thread, NULL)) {
+		uatomic_set(&logq_running, 0);
 		fprintf(stderr,"can't start log thread\n");
 		exit(1);
 	}
+	register_thread(THREAD_LOG, log_thr);
 
 	return;
 }
@@ -144,18 +146,17 @@ void log_thread_stop (void)
 
 	logdbg(stderr,"enter log_thread_stop\n");
 
-	pthread_mutex_lock(&logev_lock);
-	pthread_cleanup_push(cleanup_mutex, &logev_lock);
-	running = logq_running;
+	running = uatomic_xchg(&logq_running, 0);
 	if (running) {
+		unregister_thread(THREAD_LOG);
 		pthread_cancel(log_thr);
-		pthread_cond_signal(&logev_cond);
-	}
-	pthread_cleanup_pop(1);
-
-	if (running)
 		pthread_join(log_thr, NULL);
+	}
+	/* wait for log_safe() callers that saw logq_running set */
+	while (uatomic_read(&logq_users) > 0)
+		sched_yield();
 
 	flush_logqueue();
 	log_close();
+	sem_destroy(&logev_sem);
 }
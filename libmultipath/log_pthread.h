@@ -3,8 +3,16 @@
 
 #include <pthread.h>
 
+struct log_fields;
+
 void log_safe(int prio, const char * fmt, va_list ap)
 	__attribute__((format(printf, 2, 0)));
+/* Like log_safe(), with journal fields, see log_use_journal */
+void log_safe_fields(int prio, const struct log_fields *fields,
+		     const char * fmt, va_list ap)
+	__attribute__((format(printf, 3, 0)));
+/* Size of the log area in bytes, must be called before log_thread_start() */
+void log_thread_set_area_size(int size);
 void log_thread_start(pthread_attr_t *attr);
 void log_thread_reset (void);
 void log_thread_stop(void);
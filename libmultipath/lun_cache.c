@@ -0,0 +1,93 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "structs.h"
+#include "time-util.h"
+#include "util.h"
+#include "lun_cache.h"
+
+#define LUN_CACHE_SIZE 256
+
+struct lun_cache_entry {
+	char wwid[WWID_SIZE];
+	unsigned int query;
+	struct timespec time;
+	unsigned int len;
+	unsigned char buf[LUN_CACHE_BUFLEN];
+};
+
+static pthread_mutex_t lun_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct lun_cache_entry lun_cache[LUN_CACHE_SIZE];
+
+static struct lun_cache_entry *lun_cache_slot(const char *wwid,
+					      unsigned int query)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261U;
+
+	for (; *wwid; wwid++)
+		h = (h ^ (unsigned char)*wwid) * 16777619U;
+	h = (h ^ query) * 16777619U;
+	return &lun_cache[h % LUN_CACHE_SIZE];
+}
+
+unsigned int lun_cache_get(const char *wwid, unsigned int query,
+			   unsigned char *buf, unsigned int buflen,
+			   unsigned int ttl_ms)
+{
+	struct lun_cache_entry *ent;
+	struct timespec now, diff;
+	unsigned int len = 0;
+
+	if (!*wwid)
+		return 0;
+	get_monotonic_time(&now);
+	ent = lun_cache_slot(wwid, query);
+	pthread_mutex_lock(&lun_cache_lock);
+	if (ent->len > 0 && ent->len <= buflen && ent->query == query &&
+	    !strncmp(ent->wwid, wwid, WWID_SIZE)) {
+		timespecsub(&now, &ent->time, &diff);
+		if (diff.tv_sec * 1000 + diff.tv_nsec / 1000000 < ttl_ms) {
+			len = ent->len;
+			memcpy(buf, ent->buf, len);
+		}
+	}
+	pthread_mutex_unlock(&lun_cache_lock);
+	return len;
+}
+
+void lun_cache_put(const char *wwid, unsigned int query,
+		   const unsigned char *buf, unsigned int len)
+{
+	struct lun_cache_entry *ent;
+
+	if (!*wwid || len == 0 || len > LUN_CACHE_BUFLEN)
+		return;
+	ent = lun_cache_slot(wwid, query);
+	pthread_mutex_lock(&lun_cache_lock);
+	strlcpy(ent->wwid, wwid, WWID_SIZE);
+	ent->query = query;
+	get_monotonic_time(&ent->time);
+	memcpy(ent->buf, buf, len);
+	ent->len = len;
+	pthread_mutex_unlock(&lun_cache_lock);
+}
+
+void lun_cache_invalidate(const char *wwid)
+{
+	int i;
+
+	if (!*wwid)
+		return;
+	pthread_mutex_lock(&lun_cache_lock);
+	for (i = 0; i < LUN_CACHE_SIZE; i++)
+		if (lun_cache[i].len > 0 &&
+		    !strncmp(lun_cache[i].wwid, wwid, WWID_SIZE))
+			lun_cache[i].len = 0;
+	pthread_mutex_unlock(&lun_cache_lock);
+}
@@ -0,0 +1,41 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _LUN_CACHE_H
+#define _LUN_CACHE_H
+
+/*
+ * Results of SCSI queries that describe a LUN as a whole, shared by all
+ * paths of the LUN, i.e. of the map. If the checker or prioritizer of
+ * every path sends such a query, the first path to run it puts the
+ * response here, and the other paths of the map use it for a short
+ * time, typically one checker tick. Entries are keyed by WWID and a
+ * query code, e.g. LUN_QUERY(opcode, page). The table is direct mapped;
+ * colliding entries simply evict each other. It holds copies of the
+ * responses, and is safe to use from the async checker and prioritizer
+ * threads, which have no access to the map.
+ *
+ * Only use this for responses that don't depend on the path they were
+ * received on. Most vendor specific pages, like those of the rdac and EMC
+ * prioritizers, report the state of the controller the query was sent
+ * to, and must not be shared.
+ */
+#define LUN_QUERY(opcode, page) ((unsigned int)(opcode) << 8 | (page))
+#define LUN_CACHE_BUFLEN 512
+#define LUN_CACHE_TTL_MS 1000
+
+/*
+ * Copy the response of query for wwid to buf, if it was put there less
+ * than ttl_ms milliseconds ago, and fits into buflen. Returns the
+ * response length, or 0 if there's no such response.
+ */
+unsigned int lun_cache_get(const char *wwid, unsigned int query,
+			   unsigned char *buf, unsigned int buflen,
+			   unsigned int ttl_ms);
+/* Responses longer than LUN_CACHE_BUFLEN aren't stored */
+void lun_cache_put(const char *wwid, unsigned int query,
+		   const unsigned char *buf, unsigned int len);
+/* Drop all responses for wwid, e.g. if a path state changed */
+void lun_cache_invalidate(const char *wwid);
+
+#endif /* _LUN_CACHE_H */
@@ -35,6 +35,13 @@ int libmp_nvme_ana_log(int fd, void *ana_log, size_t ana_log_len, int rgo)
 	return nvme_ana_log(fd, ana_log, ana_log_len, rgo);
 }
 
+int libmp_nvme_ping(int fd, unsigned int timeout_ms)
+{
+	return nvme_passthru(fd, NVME_IOCTL_ADMIN_CMD, nvme_admin_get_features,
+			     0, 0, 0, 0, 0, NVME_FEAT_NUM_QUEUES, 0, 0, 0, 0, 0,
+			     0, NULL, 0, NULL, timeout_ms, NULL);
+}
+
 int nvme_id_ctrl_ana(int fd, struct nvme_id_ctrl *ctrl)
 {
 	int rc;
@@ -9,6 +9,13 @@ int libmp_nvme_identify_ctrl(int fd, struct nvme_id_ctrl *ctrl);
 int libmp_nvme_identify_ns(int fd, __u32 nsid, bool present,
 			   struct nvme_id_ns *ns);
 int libmp_nvme_ana_log(int fd, void *ana_log, size_t ana_log_len, int rgo);
+/*
+ * Send a Get Features (Number of Queues) admin command, which the
+ * controller answers without media access. Returns 0 on success, the
+ * NVMe status if the controller returned an error, or a negative value
+ * with errno set.
+ */
+int libmp_nvme_ping(int fd, unsigned int timeout_ms);
 /*
  * Identify controller, and return true if ANA is supported
  * ctrl will be filled in if controller is identified, even w/o ANA
@@ -0,0 +1,63 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "objpool.h"
+
+struct pool_obj {
+	struct pool_obj *next;
+};
+
+void *obj_pool_get(struct obj_pool *pool)
+{
+	struct pool_obj *obj;
+
+	pthread_mutex_lock(&pool->lock);
+	obj = pool->free_list;
+	if (obj) {
+		pool->free_list = obj->next;
+		pool->nr_free--;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!obj)
+		return calloc(1, pool->obj_size);
+	memset(obj, 0, pool->obj_size);
+	return obj;
+}
+
+void obj_pool_put(struct obj_pool *pool, void *p)
+{
+	struct pool_obj *obj = p;
+
+	if (!obj)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	if (pool->nr_free < pool->max_free) {
+		obj->next = pool->free_list;
+		pool->free_list = obj;
+		pool->nr_free++;
+		obj = NULL;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	free(obj);
+}
+
+void obj_pool_drain(struct obj_pool *pool)
+{
+	struct pool_obj *obj, *next;
+
+	pthread_mutex_lock(&pool->lock);
+	obj = pool->free_list;
+	pool->free_list = NULL;
+	pool->nr_free = 0;
+	pthread_mutex_unlock(&pool->lock);
+
+	for (; obj; obj = next) {
+		next = obj->next;
+		free(obj);
+	}
+}
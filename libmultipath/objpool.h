@@ -0,0 +1,41 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _OBJPOOL_H
+#define _OBJPOOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Pool of equally sized objects, for structures that are allocated and
+ * freed in bursts (paths, uevents). Freed objects are kept on a free
+ * list, up to max_free of them, and handed out again by obj_pool_get().
+ *
+ * The objects are plain malloc()ed blocks without a header, so an
+ * object that isn't returned to the pool may also be released with
+ * free().
+ */
+struct pool_obj;
+
+struct obj_pool {
+	pthread_mutex_t lock;
+	size_t obj_size;
+	unsigned int max_free;
+	unsigned int nr_free;
+	struct pool_obj *free_list;
+};
+
+#define OBJ_POOL_INIT(size, max) {			\
+		.lock = PTHREAD_MUTEX_INITIALIZER,	\
+		.obj_size = (size),			\
+		.max_free = (max),			\
+	}
+
+/* Returns a zeroed object, or NULL on allocation failure */
+void *obj_pool_get(struct obj_pool *pool);
+void obj_pool_put(struct obj_pool *pool, void *obj);
+/* Frees all objects on the free list */
+void obj_pool_drain(struct obj_pool *pool);
+
+#endif /* _OBJPOOL_H */
@@ -26,6 +26,8 @@
 #include "memory.h"
 #include "debug.h"
 #include "strbuf.h"
+#include "util.h"
+#include "arena.h"
 
 /* local vars */
 static int sublevel = 0;
@@ -115,6 +117,8 @@ free_keywords(vector keywords)
 		keyword = VECTOR_SLOT(keywords, i);
 		if (keyword->sub)
 			free_keywords(keyword->sub);
+		if (keyword->sub_hash)
+			FREE(keyword->sub_hash);
 		FREE(keyword);
 	}
 	vector_free(keywords);
@@ -150,12 +154,11 @@ find_keyword(vector keywords, vector v, char * name)
 }
 
 int
-snprint_keyword(struct strbuf *buff, const char *fmt, struct keyword *kw,
-		const void *data)
+snprint_keyword(const struct config *conf, struct strbuf *buff,
+		const char *fmt, struct keyword *kw, const void *data)
 {
 	int r;
 	char *f;
-	struct config *conf;
 	STRBUF_ON_STACK(sbuf);
 
 	if (!kw || !kw->print)
@@ -177,10 +180,7 @@ snprint_keyword(struct strbuf *buff, const char *fmt, struct keyword *kw,
 				goto out;
 			break;
 		case 'v':
-			conf = get_multipath_config();
-			pthread_cleanup_push(put_multipath_config, conf);
 			r = kw->print(conf, &sbuf, data);
-			pthread_cleanup_pop(1);
 			if (r < 0)
 				goto out;
 			else if (r == 0) {/* no output if no value */
@@ -203,13 +203,61 @@ bool is_quote(const char* token)
 		token[2] == quote_marker[2];
 }
 
-vector
-alloc_strvec(char *string)
+/*
+ * Token storage for tokenize(). All tokens of a line are stored in one
+ * buffer, which is reused for the next line.
+ */
+struct strvec_arena {
+	char *buf;
+	size_t size;
+	void **slot;
+	int nr_slots;
+	struct _vector vec;
+};
+
+static void
+free_arena(struct strvec_arena *a)
+{
+	FREE(a->buf);
+	FREE(a->slot);
+}
+
+/*
+ * Every token is made of at least one character of a line of length len.
+ * The longest token for a single character is the 3 byte quote marker.
+ */
+static int
+reserve_arena(struct strvec_arena *a, size_t len)
 {
-	char *cp, *start, *token;
-	int strlen;
+	void *tmp;
+
+	if (3 * len + 1 > a->size) {
+		tmp = REALLOC(a->buf, 3 * len + 1);
+		if (!tmp)
+			return 1;
+		a->buf = tmp;
+		a->size = 3 * len + 1;
+	}
+	if (len + 1 > (size_t)a->nr_slots) {
+		tmp = REALLOC(a->slot, (len + 1) * sizeof(*a->slot));
+		if (!tmp)
+			return 1;
+		a->slot = tmp;
+		a->nr_slots = len + 1;
+	}
+	return 0;
+}
+
+/*
+ * Split string into tokens stored in a. The returned vector is valid
+ * until the next call with the same arena.
+ */
+static vector
+tokenize(char *string, struct strvec_arena *a)
+{
+	char *cp, *start, *token, *out;
+	int len, n = 0;
 	int in_string;
-	vector strvec;
 
 	if (!string)
 		return NULL;
@@ -228,42 +276,27 @@ alloc_strvec(char *string)
 	if (*cp == '!' || *cp == '#')
 		return NULL;
 
-	/* Create a vector and alloc each command piece */
-	strvec = vector_alloc();
-
-	if (!strvec)
+	if (reserve_arena(a, strlen(cp)))
 		return NULL;
+	out = a->buf;
 
 	in_string = 0;
 	while (1) {
 		int two_quotes = 0;
 
-		if (!vector_alloc_slot(strvec))
-			goto out;
-
-		vector_set_slot(strvec, NULL);
 		start = cp;
+		token = out;
 		if (*cp == '"' && !(in_string && *(cp + 1) == '"')) {
 			cp++;
-			token = MALLOC(sizeof(quote_marker));
-
-			if (!token)
-				goto out;
-
-			memcpy(token, quote_marker, sizeof(quote_marker));
+			memcpy(out, quote_marker, sizeof(quote_marker));
+			out += sizeof(quote_marker);
 			if (in_string)
 				in_string = 0;
 			else
 				in_string = 1;
 		} else if (!in_string && (*cp == '{' || *cp == '}')) {
-			token = MALLOC(2);
-
-			if (!token)
-				goto out;
-
-			*(token) = *cp;
-			*(token + 1) = '\0';
-			cp++;
+			*out++ = *cp++;
+			*out++ = '\0';
 		} else {
 
 		move_on:
@@ -282,39 +315,95 @@ alloc_strvec(char *string)
 				}
 			}
 
-			strlen = cp - start;
-			token = MALLOC(strlen + 1);
-
-			if (!token)
-				goto out;
-
-			memcpy(token, start, strlen);
-			*(token + strlen) = '\0';
+			len = cp - start;
+			memcpy(token, start, len);
+			*(token + len) = '\0';
 
 			/* Replace "" by " */
 			if (two_quotes) {
 				char *qq = strstr(token, "\"\"");
 				while (qq != NULL) {
 					memmove(qq + 1, qq + 2,
-						strlen + 1 - (qq + 2 - token));
+						len + 1 - (qq + 2 - token));
 					qq = strstr(qq + 1, "\"\"");
 				}
 			}
+			out += len + 1;
 		}
-		vector_set_slot(strvec, token);
+		a->slot[n++] = token;
 
 		while ((!in_string &&
 			(isspace((int) *cp) || !isascii((int) *cp)))
 		       && *cp != '\0')
 			cp++;
 		if (*cp == '\0' ||
-		    (!in_string && (*cp == '!' || *cp == '#'))) {
-			return strvec;
-		}
+		    (!in_string && (*cp == '!' || *cp == '#')))
+			break;
+	}
+	a->vec.allocated = n;
+	a->vec.slot = a->slot;
+	return &a->vec;
+}
+
+vector
+alloc_strvec(char *string)
+{
+	struct strvec_arena a = { .size = 0 };
+	vector tokens, strvec = NULL;
+	char *token;
+	int i;
+
+	tokens = tokenize(string, &a);
+	if (!tokens)
+		goto out;
+
+	strvec = vector_alloc();
+	if (!strvec)
+		goto out;
+	vector_foreach_slot(tokens, token, i) {
+		/* quote markers contain a NUL byte */
+		size_t size = is_quote(token) ? sizeof(quote_marker) :
+			strlen(token) + 1;
+		char *tmp;
+
+		if (!vector_alloc_slot(strvec))
+			goto fail;
+		vector_set_slot(strvec, NULL);
+		tmp = MALLOC(size);
+		if (!tmp)
+			goto fail;
+		memcpy(tmp, token, size);
+		vector_set_slot(strvec, tmp);
 	}
 out:
-	vector_free(strvec);
-	return NULL;
+	free_arena(&a);
+	return strvec;
+fail:
+	free_strvec(strvec);
+	strvec = NULL;
+	goto out;
+}
+
+vector
+alloc_strvec_arena(char *string, struct arena *arena)
+{
+	struct strvec_arena *a;
+	size_t len;
+
+	if (!string)
+		return NULL;
+	len = strlen(string);
+	a = arena_alloc(arena, sizeof(*a));
+	if (!a)
+		return NULL;
+	/* sized so that tokenize() never needs to grow them */
+	a->size = 3 * len + 1;
+	a->buf = arena_alloc(arena, a->size);
+	a->nr_slots = len + 1;
+	a->slot = arena_alloc(arena, a->nr_slots * sizeof(*a->slot));
+	if (!a->buf || !a->slot)
+		return NULL;
+	return tokenize(string, a);
 }
 
 static int
@@ -394,37 +483,62 @@ oom:
 /* non-recursive configuration stream handler */
 static int kw_level = 0;
 
-int warn_on_duplicates(vector uniques, char *str, const char *file)
+/*
+ * Keywords in sublevels are looked up in a hash table of the indices of
+ * the sub keywords, which is built on first use. There are only a few
+ * root keywords, these are searched linearly.
+ */
+static int
+build_sub_hash(struct keyword *parent)
 {
-	char *tmp;
-	int i;
-
-	vector_foreach_slot(uniques, tmp, i) {
-		if (!strcmp(str, tmp)) {
-			condlog(1, "%s line %d, duplicate keyword: %s",
-				file, line_nr, str);
-			return 0;
-		}
-	}
-	tmp = strdup(str);
-	if (!tmp)
-		return 1;
-	if (!vector_alloc_slot(uniques)) {
-		free(tmp);
+	unsigned int size = 4, h;
+	struct keyword *kw;
+	int i, j;
+
+	while (size < 2 * (unsigned int)VECTOR_SIZE(parent->sub))
+		size <<= 1;
+	parent->sub_hash = MALLOC(size * sizeof(*parent->sub_hash));
+	if (!parent->sub_hash)
 		return 1;
+	parent->sub_hash_mask = size - 1;
+
+	vector_foreach_slot(parent->sub, kw, i) {
+		h = hash_str(kw->string) & parent->sub_hash_mask;
+		/* Keep the first of several keywords with the same name */
+		while ((j = parent->sub_hash[h]) != 0 &&
+		       strcmp(((struct keyword *)
+			       VECTOR_SLOT(parent->sub, j - 1))->string,
+			      kw->string))
+			h = (h + 1) & parent->sub_hash_mask;
+		if (j == 0)
+			parent->sub_hash[h] = i + 1;
 	}
-	vector_set_slot(uniques, tmp);
 	return 0;
 }
 
-void free_uniques(vector uniques)
+/* Returns the index of the keyword in keywords, or -1 */
+static int
+lookup_keyword(struct keyword *parent, vector keywords, const char *str)
 {
-	char *tmp;
+	struct keyword *kw;
+	unsigned int h;
 	int i;
 
-	vector_foreach_slot(uniques, tmp, i)
-		free(tmp);
-	vector_free(uniques);
+	if (!parent || (!parent->sub_hash && build_sub_hash(parent))) {
+		vector_foreach_slot(keywords, kw, i)
+			if (!strcmp(kw->string, str))
+				return i;
+		return -1;
+	}
+
+	h = hash_str(str) & parent->sub_hash_mask;
+	while ((i = parent->sub_hash[h]) != 0) {
+		kw = VECTOR_SLOT(keywords, i - 1);
+		if (!strcmp(kw->string, str))
+			return i - 1;
+		h = (h + 1) & parent->sub_hash_mask;
+	}
+	return -1;
 }
 
 int
@@ -502,89 +616,81 @@ validate_config_strvec(vector strvec, const char *file)
 	return 0;
 }
 
+struct parse_state {
+	struct config *conf;
+	FILE *stream;
+	const char *file;
+	char *buf;
+	struct strvec_arena arena;
+};
+
 static int
-process_stream(struct config *conf, FILE *stream, vector keywords,
-	       const char *file)
+process_stream(struct parse_state *ps, vector keywords,
+	       struct keyword *parent)
 {
 	int i;
 	int r = 0, t;
 	struct keyword *keyword;
 	char *str;
-	char *buf;
 	vector strvec;
-	vector uniques;
+	/* unique keywords already seen in this section, by index */
+	char *seen;
 
-	uniques = vector_alloc();
-	if (!uniques)
+	seen = MALLOC(VECTOR_SIZE(keywords) + 1);
+	if (!seen)
 		return 1;
 
-	buf = MALLOC(MAXBUF);
-
-	if (!buf) {
-		vector_free(uniques);
-		return 1;
-	}
-
-	while (read_line(stream, buf, MAXBUF)) {
+	while (read_line(ps->stream, ps->buf, MAXBUF)) {
 		line_nr++;
-		strvec = alloc_strvec(buf);
+		strvec = tokenize(ps->buf, &ps->arena);
 		if (!strvec)
 			continue;
 
-		if (validate_config_strvec(strvec, file) != 0) {
-			free_strvec(strvec);
+		if (validate_config_strvec(strvec, ps->file) != 0)
 			continue;
-		}
 
 		str = VECTOR_SLOT(strvec, 0);
 
 		if (!strcmp(str, EOB)) {
-			if (kw_level > 0) {
-				free_strvec(strvec);
+			if (kw_level > 0)
 				goto out;
-			}
 			condlog(0, "unmatched '%s' at line %d of %s",
-				EOB, line_nr, file);
+				EOB, line_nr, ps->file);
 		}
 
-		for (i = 0; i < VECTOR_SIZE(keywords); i++) {
-			keyword = VECTOR_SLOT(keywords, i);
-
-			if (!strcmp(keyword->string, str)) {
-				if (keyword->unique &&
-				    warn_on_duplicates(uniques, str, file)) {
-						r = 1;
-						free_strvec(strvec);
-						goto out;
-				}
-				if (keyword->handler) {
-				    t = (*keyword->handler) (conf, strvec);
-					r += t;
-					if (t)
-						condlog(1, "multipath.conf +%d, parsing failed: %s",
-							line_nr, buf);
-				}
+		i = lookup_keyword(parent, keywords, str);
+		if (i < 0) {
+			condlog(1, "%s line %d, invalid keyword: %s",
+				ps->file, line_nr, str);
+			continue;
+		}
+		keyword = VECTOR_SLOT(keywords, i);
 
-				if (keyword->sub) {
-					kw_level++;
-					r += process_stream(conf, stream,
-							    keyword->sub, file);
-					kw_level--;
-				}
-				break;
-			}
+		if (keyword->unique) {
+			if (seen[i])
+				condlog(1, "%s line %d, duplicate keyword: %s",
+					ps->file, line_nr, str);
+			seen[i] = 1;
+		}
+		if (keyword->handler) {
+			t = (*keyword->handler) (ps->conf, strvec);
+			r += t;
+			if (t)
+				condlog(1, "multipath.conf +%d, parsing failed: %s",
+					line_nr, ps->buf);
 		}
-		if (i >= VECTOR_SIZE(keywords))
-			condlog(1, "%s line %d, invalid keyword: %s",
-				file, line_nr, str);
 
-		free_strvec(strvec);
+		/* this invalidates strvec */
+		if (keyword->sub) {
+			kw_level++;
+			r += process_stream(ps, keyword->sub, keyword);
+			kw_level--;
+		}
 	}
 	if (kw_level == 1)
-		condlog(1, "missing '%s' at end of %s", EOB, file);
+		condlog(1, "missing '%s' at end of %s", EOB, ps->file);
 out:
-	FREE(buf);
-	free_uniques(uniques);
+	FREE(seen);
 	return r;
 }
 
@@ -593,23 +699,29 @@ int
 process_file(struct config *conf, const char *file)
 {
 	int r;
-	FILE *stream;
+	struct parse_state ps = { .conf = conf, .file = file };
 
 	if (!conf->keywords) {
 		condlog(0, "No keywords allocated");
 		return 1;
 	}
-	stream = fopen(file, "r");
-	if (!stream) {
+	ps.buf = MALLOC(MAXBUF);
+	if (!ps.buf)
+		return 1;
+	ps.stream = fopen(file, "r");
+	if (!ps.stream) {
 		condlog(0, "couldn't open configuration file '%s': %s",
 			file, strerror(errno));
+		FREE(ps.buf);
 		return 1;
 	}
 
 	/* Stream handling */
 	line_nr = 0;
-	r = process_stream(conf, stream, conf->keywords, file);
-	fclose(stream);
+	r = process_stream(&ps, conf->keywords, NULL);
+	fclose(ps.stream);
+	free_arena(&ps.arena);
+	FREE(ps.buf);
 	//free_keywords(keywords);
 
 	return r;
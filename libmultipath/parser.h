@@ -42,7 +42,7 @@ struct strbuf;
 
 
 /* keyword definition */
-typedef int print_fn(struct config *, struct strbuf *, const void *);
+typedef int print_fn(const struct config *, struct strbuf *, const void *);
 
 struct keyword {
 	char *string;
@@ -50,6 +50,9 @@ struct keyword {
 	print_fn *print;
 	vector sub;
 	int unique;
+	/* sub keyword indices + 1 by name hash, built by process_file() */
+	int *sub_hash;
+	unsigned int sub_hash_mask;
 };
 
 /* Reloading helpers */
@@ -79,11 +82,14 @@ extern int _install_keyword(vector keywords, char *string,
 extern void dump_keywords(vector keydump, int level);
 extern void free_keywords(vector keywords);
 extern vector alloc_strvec(char *string);
+struct arena;
+/* Like alloc_strvec(), but everything is allocated from the arena */
+vector alloc_strvec_arena(char *string, struct arena *arena);
 extern void *set_value(vector strvec);
 extern int process_file(struct config *conf, const char *conf_file);
 extern struct keyword * find_keyword(vector keywords, vector v, char * name);
-int snprint_keyword(struct strbuf *buff, const char *fmt, struct keyword *kw,
-		    const void *data);
+int snprint_keyword(const struct config *conf, struct strbuf *buff,
+		    const char *fmt, struct keyword *kw, const void *data);
 bool is_quote(const char* token);
 
 #endif
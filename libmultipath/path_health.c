@@ -0,0 +1,127 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <libudev.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "sysfs.h"
+#include "debug.h"
+#include "time-util.h"
+#include "path_health.h"
+
+/* Windows with less I/O than this are judged as if they had this much */
+#define PATH_HEALTH_MIN_IOS 100
+
+void path_health_init(struct path_health *ph)
+{
+	memset(ph, 0, sizeof(*ph));
+	sysfs_attr_fd_init(&ph->ioerr_attr);
+	sysfs_attr_fd_init(&ph->iodone_attr);
+	sysfs_attr_fd_init(&ph->iorequest_attr);
+}
+
+void path_health_close(struct path_health *ph)
+{
+	sysfs_attr_fd_close(&ph->ioerr_attr);
+	sysfs_attr_fd_close(&ph->iodone_attr);
+	sysfs_attr_fd_close(&ph->iorequest_attr);
+}
+
+/* The counters are printed as hex numbers, e.g. "0x1a" */
+static int read_counter(struct sysfs_attr_fd *attr, struct udev_device *dev,
+			const char *name, uint32_t *val)
+{
+	char buf[32], *end;
+	ssize_t len;
+	unsigned long v;
+
+	len = sysfs_attr_fd_get_value(attr, dev, name, buf, sizeof(buf));
+	if (len <= 0 || (size_t)len >= sizeof(buf))
+		return 1;
+	v = strtoul(buf, &end, 0);
+	if (end == buf)
+		return 1;
+	*val = v;
+	return 0;
+}
+
+int sample_path_health(struct path *pp, int err_rate_threshold,
+		       unsigned int window)
+{
+	struct path_health *ph = &pp->health;
+	struct path_health_sample cur;
+	struct udev_device *parent;
+	struct timespec now;
+	unsigned int fails, ios;
+	bool stalled;
+
+	if (pp->bus != SYSFS_BUS_SCSI || !pp->udev)
+		goto unknown;
+	parent = udev_device_get_parent_with_subsystem_devtype(pp->udev, "scsi",
+							       "scsi_device");
+	if (!parent ||
+	    read_counter(&ph->ioerr_attr, parent, "ioerr_cnt", &cur.ioerr) ||
+	    read_counter(&ph->iodone_attr, parent, "iodone_cnt", &cur.iodone) ||
+	    read_counter(&ph->iorequest_attr, parent, "iorequest_cnt",
+			 &cur.iorequest))
+		goto unknown;
+	cur.failcount = pp->failcount;
+	get_monotonic_time(&now);
+	cur.time = now.tv_sec;
+
+	/*
+	 * Start a new window at the previous sample, so that the window
+	 * always covers at least the last "window" seconds.
+	 */
+	if (!ph->base.time)
+		ph->base = cur;
+	else if (cur.time - ph->base.time > (time_t)window)
+		ph->base = ph->last;
+	ph->last = cur;
+
+	/* The 32 bit counters wrap */
+	ph->errors = cur.ioerr - ph->base.ioerr;
+	ph->done = cur.iodone - ph->base.iodone;
+	fails = cur.failcount > ph->base.failcount ?
+		cur.failcount - ph->base.failcount : 0;
+	/* requests outstanding for the whole window, none completed */
+	stalled = ph->done == 0 && cur.iorequest != cur.iodone &&
+		ph->base.iorequest != ph->base.iodone &&
+		cur.time - ph->base.time >= (time_t)window;
+
+	ios = ph->done > PATH_HEALTH_MIN_IOS ? ph->done : PATH_HEALTH_MIN_IOS;
+	if (stalled ||
+	    (unsigned long long)(ph->errors + fails) * 1000 >
+	    (unsigned long long)err_rate_threshold * ios) {
+		if (ph->state != PATH_HEALTH_SUSPECT)
+			condlog(3, "%s: passive health suspect: %u errors, %u fails, %u completions%s in %ld seconds",
+				pp->dev, ph->errors, fails, ph->done,
+				stalled ? " (stalled)" : "",
+				(long)(cur.time - ph->base.time));
+		ph->state = PATH_HEALTH_SUSPECT;
+	} else
+		ph->state = PATH_HEALTH_OK;
+	return ph->state;
+
+unknown:
+	ph->base.time = 0;
+	ph->state = PATH_HEALTH_UNKNOWN;
+	return ph->state;
+}
+
+const char *path_health_name(int state)
+{
+	switch (state) {
+	case PATH_HEALTH_OK:
+		return "ok";
+	case PATH_HEALTH_SUSPECT:
+		return "suspect";
+	default:
+		return "unknown";
+	}
+}
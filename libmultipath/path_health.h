@@ -0,0 +1,66 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _PATH_HEALTH_H
+#define _PATH_HEALTH_H
+
+#include <stdint.h>
+#include <time.h>
+#include "sysfs.h"
+
+struct path;
+
+/*
+ * Passive health of a path, from the I/O counters the SCSI midlayer
+ * keeps for each device (ioerr_cnt, iodone_cnt and iorequest_cnt) and
+ * the fail count of the path in the dm status. The counters are
+ * sampled on every path check, and compared with the sample at the
+ * start of a window of marginal_path_double_failed_time seconds.
+ *
+ * The marginal path check only sends its test I/O to paths which look
+ * unhealthy here, so that paths which failed without any I/O errors on
+ * the device, e.g. because of a brief transport problem, aren't
+ * probed. Non-SCSI paths have no counters, their passive health is
+ * always PATH_HEALTH_UNKNOWN.
+ */
+enum path_health_state {
+	PATH_HEALTH_UNKNOWN = 0,
+	PATH_HEALTH_OK,
+	/* errors above the threshold, or requests but no completions */
+	PATH_HEALTH_SUSPECT,
+};
+
+struct path_health_sample {
+	uint32_t ioerr;
+	uint32_t iodone;
+	uint32_t iorequest;
+	int failcount;
+	time_t time;
+};
+
+struct path_health {
+	struct sysfs_attr_fd ioerr_attr;
+	struct sysfs_attr_fd iodone_attr;
+	struct sysfs_attr_fd iorequest_attr;
+	/* start of the window, and the last sample; time 0 if unset */
+	struct path_health_sample base;
+	struct path_health_sample last;
+	/* I/O errors and completions in the window */
+	unsigned int errors;
+	unsigned int done;
+	int state;
+};
+
+void path_health_init(struct path_health *ph);
+void path_health_close(struct path_health *ph);
+
+/*
+ * Sample the counters of pp and update pp->health.state, with an error
+ * rate threshold in 1/1000 and a window in seconds. Returns the new
+ * state.
+ */
+int sample_path_health(struct path *pp, int err_rate_threshold,
+		       unsigned int window);
+const char *path_health_name(int state);
+
+#endif /* _PATH_HEALTH_H */
@@ -58,25 +58,33 @@ int get_pgpolicy_name(char * buff, int len, int id)
 }
 
 
-void
-sort_pathgroups (struct multipath *mp) {
+/*
+ * Order in which path groups appear in the map: non-marginal groups first,
+ * then by descending priority, then by descending number of enabled paths.
+ */
+static int pgp_cmp(const struct pathgroup *pgp1, const struct pathgroup *pgp2)
+{
+	if (pgp1->marginal != pgp2->marginal)
+		return pgp1->marginal < pgp2->marginal ? -1 : 1;
+	if (pgp1->priority != pgp2->priority)
+		return pgp1->priority > pgp2->priority ? -1 : 1;
+	if (pgp1->enabled_paths != pgp2->enabled_paths)
+		return pgp1->enabled_paths > pgp2->enabled_paths ? -1 : 1;
+	return 0;
+}
+
+/* Fallback for allocation failure; priorities must be up to date */
+static void insertion_sort_pathgroups(struct multipath *mp)
+{
 	int i, j;
 	struct pathgroup * pgp1, * pgp2;
 
-	if (!mp->pg)
-		return;
-
 	vector_foreach_slot(mp->pg, pgp1, i) {
-		path_group_prio_update(pgp1);
 		for (j = i - 1; j >= 0; j--) {
 			pgp2 = VECTOR_SLOT(mp->pg, j);
 			if (!pgp2)
 				continue;
-			if (pgp2->marginal < pgp1->marginal ||
-			    (pgp2->marginal == pgp1->marginal &&
-			     (pgp2->priority > pgp1->priority ||
-			      (pgp2->priority == pgp1->priority &&
-			       pgp2->enabled_paths >= pgp1->enabled_paths)))) {
+			if (pgp_cmp(pgp2, pgp1) <= 0) {
 				vector_move_up(mp->pg, i, j + 1);
 				break;
 			}
@@ -86,6 +94,50 @@ sort_pathgroups (struct multipath *mp) {
 	}
 }
 
+struct pg_sort_entry {
+	struct pathgroup *pgp;
+	int idx;
+};
+
+static int pg_sort_entry_cmp(const void *a, const void *b)
+{
+	const struct pg_sort_entry *e1 = a, *e2 = b;
+	int r = pgp_cmp(e1->pgp, e2->pgp);
+
+	/* qsort() isn't stable, keep the grouping order for equal groups */
+	return r ? r : e1->idx - e2->idx;
+}
+
+void
+sort_pathgroups (struct multipath *mp) {
+	struct pg_sort_entry *ents;
+	struct pathgroup *pgp;
+	int i, n = 0;
+
+	if (!mp->pg)
+		return;
+
+	vector_foreach_slot(mp->pg, pgp, i)
+		path_group_prio_update(pgp);
+	if (VECTOR_SIZE(mp->pg) <= 1)
+		return;
+
+	ents = malloc(VECTOR_SIZE(mp->pg) * sizeof(*ents));
+	if (!ents) {
+		insertion_sort_pathgroups(mp);
+		return;
+	}
+	vector_foreach_slot(mp->pg, pgp, i) {
+		ents[n].pgp = pgp;
+		ents[n].idx = n;
+		n++;
+	}
+	qsort(ents, n, sizeof(*ents), pg_sort_entry_cmp);
+	for (i = 0; i < n; i++)
+		mp->pg->slot[i] = ents[i].pgp;
+	free(ents);
+}
+
 static int
 split_marginal_paths(vector paths, vector *normal_p, vector *marginal_p)
 {
@@ -135,6 +187,12 @@ int group_paths(struct multipath *mp, int marginal_pathgroups)
 {
 	vector normal, marginal;
 
+	/* mp->pg won't match the dm table any more */
+	free(mp->pg_table);
+	mp->pg_table = NULL;
+	free(mp->pg_status);
+	mp->pg_status = NULL;
+
 	if (!mp->pg)
 		mp->pg = vector_alloc();
 	if (!mp->pg)
@@ -161,6 +219,7 @@ int group_paths(struct multipath *mp, int marginal_pathgroups)
 out:
 	vector_free(mp->paths);
 	mp->paths = NULL;
+	invalidate_path_counts(mp);
 	return 0;
 fail_marginal:
 	vector_free(normal);
@@ -168,88 +227,98 @@ fail_marginal:
 fail:
 	vector_free(mp->pg);
 	mp->pg = NULL;
+	invalidate_path_counts(mp);
 	return 1;
 }
 
-typedef bool (path_match_fn)(struct path *pp1, struct path *pp2);
+typedef bool (path_match_fn)(const struct path *pp1, const struct path *pp2);
+typedef unsigned int (path_hash_fn)(const struct path *pp);
 
-bool
-node_names_match(struct path *pp1, struct path *pp2)
+static bool
+node_names_match(const struct path *pp1, const struct path *pp2)
 {
-	return (strncmp(pp1->tgt_node_name, pp2->tgt_node_name,
+	return (strncmp(pp1->ident->tgt_node_name, pp2->ident->tgt_node_name,
 			NODE_NAME_SIZE) == 0);
 }
 
-bool
-serials_match(struct path *pp1, struct path *pp2)
+static unsigned int node_name_hash(const struct path *pp)
+{
+	return hash_str(pp->ident->tgt_node_name);
+}
+
+static bool
+serials_match(const struct path *pp1, const struct path *pp2)
+{
+	return (strncmp(pp1->ident->serial, pp2->ident->serial, SERIAL_SIZE) == 0);
+}
+
+static unsigned int serial_hash(const struct path *pp)
 {
-	return (strncmp(pp1->serial, pp2->serial, SERIAL_SIZE) == 0);
+	return hash_str(pp->ident->serial);
 }
 
-bool
-prios_match(struct path *pp1, struct path *pp2)
+static bool
+prios_match(const struct path *pp1, const struct path *pp2)
 {
 	return (pp1->priority == pp2->priority);
 }
 
-int group_by_match(struct multipath * mp, vector paths,
-		   bool (*path_match_fn)(struct path *, struct path *))
+static unsigned int prio_hash(const struct path *pp)
 {
-	int i, j;
-	struct bitfield *bitmap;
+	/* spread small consecutive values over the table */
+	return (unsigned int)pp->priority * 2654435761U;
+}
+
+/*
+ * Paths are bucketed in an open addressing hash table keyed on the
+ * grouping attribute, so grouping is linear in the number of paths.
+ * Groups are created in order of the first appearance of their key,
+ * and paths keep their relative order inside a group.
+ */
+static int group_by_match(struct multipath * mp, vector paths,
+			  path_match_fn *match_fn, path_hash_fn *hash_fn)
+{
+	int i;
+	unsigned int h, mask;
+	struct pathgroup **table;
 	struct path * pp;
 	struct pathgroup * pgp;
-	struct path * pp2;
 
-	/* init the bitmap */
-	bitmap = alloc_bitfield(VECTOR_SIZE(paths));
+	for (mask = 1; mask < 2U * VECTOR_SIZE(paths); mask <<= 1)
+		;
+	table = calloc(mask, sizeof(*table));
+	mask--;
 
-	if (!bitmap)
+	if (!table)
 		goto out;
 
-	for (i = 0; i < VECTOR_SIZE(paths); i++) {
-
-		if (is_bit_set_in_bitfield(i, bitmap))
-			continue;
-
-		pp = VECTOR_SLOT(paths, i);
+	vector_foreach_slot(paths, pp, i) {
+		for (h = hash_fn(pp) & mask; (pgp = table[h]);
+		     h = (h + 1) & mask)
+			if (match_fn(VECTOR_SLOT(pgp->paths, 0), pp))
+				break;
 
-		/* here, we really got a new pg */
-		pgp = alloc_pathgroup();
+		if (!pgp) {
+			/* here, we really got a new pg */
+			pgp = alloc_pathgroup();
 
-		if (!pgp)
-			goto out1;
+			if (!pgp)
+				goto out1;
 
-		if (add_pathgroup(mp, pgp))
-			goto out2;
+			if (add_pathgroup(mp, pgp))
+				goto out2;
 
-		/* feed the first path */
+			table[h] = pgp;
+		}
 		if (store_path(pgp->paths, pp))
 			goto out1;
-
-		set_bit_in_bitfield(i, bitmap);
-
-		for (j = i + 1; j < VECTOR_SIZE(paths); j++) {
-
-			if (is_bit_set_in_bitfield(j, bitmap))
-				continue;
-
-			pp2 = VECTOR_SLOT(paths, j);
-
-			if (path_match_fn(pp, pp2)) {
-				if (store_path(pgp->paths, pp2))
-					goto out1;
-
-				set_bit_in_bitfield(j, bitmap);
-			}
-		}
 	}
-	FREE(bitmap);
+	free(table);
 	return 0;
 out2:
 	free_pathgroup(pgp, KEEP_PATHS);
 out1:
-	FREE(bitmap);
+	free(table);
 out:
 	free_pgvec(mp->pg, KEEP_PATHS);
 	mp->pg = NULL;
@@ -261,7 +330,7 @@ out:
  */
 int group_by_node_name(struct multipath * mp, vector paths)
 {
-	return group_by_match(mp, paths, node_names_match);
+	return group_by_match(mp, paths, node_names_match, node_name_hash);
 }
 
 /*
@@ -269,7 +338,7 @@ int group_by_node_name(struct multipath * mp, vector paths)
  */
 int group_by_serial(struct multipath * mp, vector paths)
 {
-	return group_by_match(mp, paths, serials_match);
+	return group_by_match(mp, paths, serials_match, serial_hash);
 }
 
 /*
@@ -277,7 +346,7 @@ int group_by_serial(struct multipath * mp, vector paths)
  */
 int group_by_prio(struct multipath *mp, vector paths)
 {
-	return group_by_match(mp, paths, prios_match);
+	return group_by_match(mp, paths, prios_match, prio_hash);
 }
 
 int one_path_per_group(struct multipath *mp, vector paths)
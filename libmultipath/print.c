@@ -33,9 +33,11 @@
 #include "util.h"
 #include "foreign.h"
 #include "strbuf.h"
+#include "check_sched.h"
+#include "udev_cache.h"
+#include "time-util.h"
 
 #define PRINT_PATH_LONG      "%w %i %d %D %p %t %T %s %o"
-#define PRINT_PATH_INDENT    "%i %d %D %t %T %o"
 #define PRINT_MAP_PROPS      "size=%S features='%f' hwhandler='%h' wp=%r"
 #define PRINT_PG_INDENT      "policy='%s' prio=%p status=%t"
 
@@ -54,50 +56,8 @@
 #define PRINT_JSON_END_LAST       "}\n"
 #define PRINT_JSON_END_ARRAY      "]\n"
 #define PRINT_JSON_INDENT_N    3
-#define PRINT_JSON_MAP       "{\n" \
-			     "      \"name\" : \"%n\",\n" \
-			     "      \"uuid\" : \"%w\",\n" \
-			     "      \"sysfs\" : \"%d\",\n" \
-			     "      \"failback\" : \"%F\",\n" \
-			     "      \"queueing\" : \"%Q\",\n" \
-			     "      \"paths\" : %N,\n" \
-			     "      \"write_prot\" : \"%r\",\n" \
-			     "      \"dm_st\" : \"%t\",\n" \
-			     "      \"features\" : \"%f\",\n" \
-			     "      \"hwhandler\" : \"%h\",\n" \
-			     "      \"action\" : \"%A\",\n" \
-			     "      \"path_faults\" : %0,\n" \
-			     "      \"vend\" : \"%v\",\n" \
-			     "      \"prod\" : \"%p\",\n" \
-			     "      \"rev\" : \"%e\",\n" \
-			     "      \"switch_grp\" : %1,\n" \
-			     "      \"map_loads\" : %2,\n" \
-			     "      \"total_q_time\" : %3,\n" \
-			     "      \"q_timeouts\" : %4,"
-
-#define PRINT_JSON_GROUP     "{\n" \
-			     "         \"selector\" : \"%s\",\n" \
-			     "         \"pri\" : %p,\n" \
-			     "         \"dm_st\" : \"%t\",\n" \
-			     "         \"marginal_st\" : \"%M\","
-
 #define PRINT_JSON_GROUP_NUM "         \"group\" : %d,\n"
 
-#define PRINT_JSON_PATH      "{\n" \
-			     "            \"dev\" : \"%d\",\n"\
-			     "            \"dev_t\" : \"%D\",\n" \
-			     "            \"dm_st\" : \"%t\",\n" \
-			     "            \"dev_st\" : \"%o\",\n" \
-			     "            \"chk_st\" : \"%T\",\n" \
-			     "            \"checker\" : \"%c\",\n" \
-			     "            \"pri\" : %p,\n" \
-			     "            \"host_wwnn\" : \"%N\",\n" \
-			     "            \"target_wwnn\" : \"%n\",\n" \
-			     "            \"host_wwpn\" : \"%R\",\n" \
-			     "            \"target_wwpn\" : \"%r\",\n" \
-			     "            \"host_adapter\" : \"%a\",\n" \
-			     "            \"marginal_st\" : \"%M\""
-
 #define PROGRESS_LEN  10
 
 #define MAX(x,y) (((x) > (y)) ? (x) : (y))
@@ -313,9 +273,9 @@ snprint_multipath_vpr (struct strbuf *buff, const struct multipath * mpp)
 
 	vector_foreach_slot(mpp->pg, pgp, i) {
 		vector_foreach_slot(pgp->paths, pp, j) {
-			if (strlen(pp->vendor_id) && strlen(pp->product_id))
+			if (strlen(pp->ident->vendor_id) && strlen(pp->ident->product_id))
 				return print_strbuf(buff, "%s,%s",
-						    pp->vendor_id, pp->product_id);
+						    pp->ident->vendor_id, pp->ident->product_id);
 		}
 	}
 	return append_strbuf_str(buff, "##,##");
@@ -331,8 +291,8 @@ snprint_multipath_vend (struct strbuf *buff, const struct multipath * mpp)
 
 	vector_foreach_slot(mpp->pg, pgp, i) {
 		vector_foreach_slot(pgp->paths, pp, j) {
-			if (strlen(pp->vendor_id))
-				return append_strbuf_str(buff, pp->vendor_id);
+			if (strlen(pp->ident->vendor_id))
+				return append_strbuf_str(buff, pp->ident->vendor_id);
 		}
 	}
 	return append_strbuf_str(buff, "##");
@@ -347,8 +307,8 @@ snprint_multipath_prod (struct strbuf *buff, const struct multipath * mpp)
 
 	vector_foreach_slot(mpp->pg, pgp, i) {
 		vector_foreach_slot(pgp->paths, pp, j) {
-			if (strlen(pp->product_id))
-				return append_strbuf_str(buff, pp->product_id);
+			if (strlen(pp->ident->product_id))
+				return append_strbuf_str(buff, pp->ident->product_id);
 		}
 	}
 	return append_strbuf_str(buff, "##");
@@ -363,8 +323,8 @@ snprint_multipath_rev (struct strbuf *buff, const struct multipath * mpp)
 
 	vector_foreach_slot(mpp->pg, pgp, i) {
 		vector_foreach_slot(pgp->paths, pp, j) {
-			if (strlen(pp->rev))
-				return append_strbuf_str(buff, pp->rev);
+			if (strlen(pp->ident->rev))
+				return append_strbuf_str(buff, pp->ident->rev);
 		}
 	}
 	return append_strbuf_str(buff, "##");
@@ -507,7 +467,7 @@ snprint_dm_path_state (struct strbuf *buff, const struct path * pp)
 static int
 snprint_vpr (struct strbuf *buff, const struct path * pp)
 {
-	return print_strbuf(buff, "%s,%s", pp->vendor_id, pp->product_id);
+	return print_strbuf(buff, "%s,%s", pp->ident->vendor_id, pp->ident->product_id);
 }
 
 static int
@@ -516,7 +476,7 @@ snprint_next_check (struct strbuf *buff, const struct path * pp)
 	if (!pp || !pp->mpp)
 		return append_strbuf_str(buff, "orphan");
 
-	return snprint_progress(buff, pp->tick, pp->checkint);
+	return snprint_progress(buff, path_check_ticks(pp), pp->checkint);
 }
 
 static int
@@ -525,6 +485,120 @@ snprint_pri (struct strbuf *buff, const struct path * pp)
 	return snprint_int(buff, pp ? pp->priority : -1);
 }
 
+static int
+snprint_latency (struct strbuf *buff, unsigned int latency)
+{
+	if (!latency)
+		return append_strbuf_str(buff, "undef");
+	if (latency < 1000)
+		return print_strbuf(buff, "%uus", latency);
+	if (latency < 1000 * 1000)
+		return print_strbuf(buff, "%.1fms", latency / 1000.);
+	return print_strbuf(buff, "%.1fs", latency / (1000. * 1000.));
+}
+
+static int
+snprint_latency_p50 (struct strbuf *buff, const struct path * pp)
+{
+	return snprint_latency(buff, pp->latency_p50);
+}
+
+static int
+snprint_latency_p99 (struct strbuf *buff, const struct path * pp)
+{
+	return snprint_latency(buff, pp->latency_p99);
+}
+
+static int
+snprint_iops (struct strbuf *buff, const struct io_stats *st)
+{
+	if (!st->time.tv_sec && !st->time.tv_nsec)
+		return append_strbuf_str(buff, "undef");
+	return snprint_uint(buff, st->iops);
+}
+
+static int
+snprint_kbps (struct strbuf *buff, const struct io_stats *st)
+{
+	if (!st->time.tv_sec && !st->time.tv_nsec)
+		return append_strbuf_str(buff, "undef");
+	if (st->kbps < 10 * 1024)
+		return print_strbuf(buff, "%uK/s", st->kbps);
+	return print_strbuf(buff, "%.1fM/s", st->kbps / 1024.);
+}
+
+static int
+snprint_path_iops (struct strbuf *buff, const struct path * pp)
+{
+	return snprint_iops(buff, &pp->io_stats);
+}
+
+static int
+snprint_path_kbps (struct strbuf *buff, const struct path * pp)
+{
+	return snprint_kbps(buff, &pp->io_stats);
+}
+
+static int
+snprint_path_io_lat (struct strbuf *buff, const struct path * pp)
+{
+	return snprint_latency(buff, pp->io_stats.latency);
+}
+
+static int
+snprint_path_io_p50 (struct strbuf *buff, const struct path * pp)
+{
+	return snprint_latency(buff, io_stats_percentile(&pp->io_stats, 50));
+}
+
+static int
+snprint_path_io_p90 (struct strbuf *buff, const struct path * pp)
+{
+	return snprint_latency(buff, io_stats_percentile(&pp->io_stats, 90));
+}
+
+static int
+snprint_path_io_p99 (struct strbuf *buff, const struct path * pp)
+{
+	return snprint_latency(buff, io_stats_percentile(&pp->io_stats, 99));
+}
+
+static int
+snprint_map_iops (struct strbuf *buff, const struct multipath * mpp)
+{
+	return snprint_iops(buff, &mpp->io_stats);
+}
+
+static int
+snprint_map_kbps (struct strbuf *buff, const struct multipath * mpp)
+{
+	return snprint_kbps(buff, &mpp->io_stats);
+}
+
+static int
+snprint_map_io_lat (struct strbuf *buff, const struct multipath * mpp)
+{
+	return snprint_latency(buff, mpp->io_stats.latency);
+}
+
+static int
+snprint_map_io_p50 (struct strbuf *buff, const struct multipath * mpp)
+{
+	return snprint_latency(buff, io_stats_percentile(&mpp->io_stats, 50));
+}
+
+static int
+snprint_map_io_p90 (struct strbuf *buff, const struct multipath * mpp)
+{
+	return snprint_latency(buff, io_stats_percentile(&mpp->io_stats, 90));
+}
+
+static int
+snprint_map_io_p99 (struct strbuf *buff, const struct multipath * mpp)
+{
+	return snprint_latency(buff, io_stats_percentile(&mpp->io_stats, 99));
+}
+
 static int
 snprint_pg_selector (struct strbuf *buff, const struct pathgroup * pgp)
 {
@@ -571,7 +645,7 @@ snprint_path_size (struct strbuf *buff, const struct path * pp)
 int
 snprint_path_serial (struct strbuf *buff, const struct path * pp)
 {
-	return snprint_str(buff, pp->serial);
+	return snprint_str(buff, pp->ident->serial);
 }
 
 static int
@@ -585,80 +659,70 @@ snprint_path_mpp (struct strbuf *buff, const struct path * pp)
 }
 
 static int
-snprint_host_attr (struct strbuf *buff, const struct path * pp, char *attr)
+snprint_host_attr (struct strbuf *buff, const struct path * pp, char *attr,
+		   const char *resolved)
 {
-	struct udev_device *host_dev = NULL;
 	char host_id[32];
-	const char *value = NULL;
-	int ret;
+	char value[NODE_NAME_SIZE];
+	int rc;
 
 	if (pp->sg_id.proto_id != SCSI_PROTOCOL_FCP)
 		return append_strbuf_str(buff, "[undef]");
+	if (resolved && *resolved)
+		return snprint_str(buff, resolved);
 	sprintf(host_id, "host%d", pp->sg_id.host_no);
-	host_dev = udev_device_new_from_subsystem_sysname(udev, "fc_host",
-							  host_id);
-	if (!host_dev) {
+	rc = get_cached_sysattr("fc_host", host_id, attr, value, sizeof(value));
+	if (rc == 0)
+		return snprint_str(buff, value);
+	if (rc == -ENODEV)
 		condlog(1, "%s: No fc_host device for '%s'", pp->dev, host_id);
-		goto out;
-	}
-	value = udev_device_get_sysattr_value(host_dev, attr);
-	if (value)
-		ret = snprint_str(buff, value);
-	udev_device_unref(host_dev);
-out:
-	if (!value)
-		ret = append_strbuf_str(buff, "[unknown]");
-	return ret;
+	return append_strbuf_str(buff, "[unknown]");
 }
 
 int
 snprint_host_wwnn (struct strbuf *buff, const struct path * pp)
 {
-	return snprint_host_attr(buff, pp, "node_name");
+	return snprint_host_attr(buff, pp, "node_name",
+				 pp->transport ? pp->transport->host_wwnn : NULL);
 }
 
 int
 snprint_host_wwpn (struct strbuf *buff, const struct path * pp)
 {
-	return snprint_host_attr(buff, pp, "port_name");
+	return snprint_host_attr(buff, pp, "port_name",
+				 pp->transport ? pp->transport->host_wwpn : NULL);
 }
 
 int
 snprint_tgt_wwpn (struct strbuf *buff, const struct path * pp)
 {
-	struct udev_device *rport_dev = NULL;
 	char rport_id[42];
-	const char *value = NULL;
-	int ret;
+	char value[NODE_NAME_SIZE];
+	int rc;
 
 	if (pp->sg_id.proto_id != SCSI_PROTOCOL_FCP)
 		return append_strbuf_str(buff, "[undef]");
+	if (pp->transport && *pp->transport->tgt_wwpn)
+		return snprint_str(buff, pp->transport->tgt_wwpn);
 	sprintf(rport_id, "rport-%d:%d-%d",
 		pp->sg_id.host_no, pp->sg_id.channel, pp->sg_id.transport_id);
-	rport_dev = udev_device_new_from_subsystem_sysname(udev,
-				"fc_remote_ports", rport_id);
-	if (!rport_dev) {
+	rc = get_cached_sysattr("fc_remote_ports", rport_id, "port_name",
+				value, sizeof(value));
+	if (rc == 0)
+		return snprint_str(buff, value);
+	if (rc == -ENODEV)
 		condlog(1, "%s: No fc_remote_port device for '%s'", pp->dev,
 			rport_id);
-		goto out;
-	}
-	value = udev_device_get_sysattr_value(rport_dev, "port_name");
-	if (value)
-		ret = snprint_str(buff, value);
-	udev_device_unref(rport_dev);
-out:
-	if (!value)
-		ret = append_strbuf_str(buff, "[unknown]");
-	return ret;
+	return append_strbuf_str(buff, "[unknown]");
 }
 
 
 int
 snprint_tgt_wwnn (struct strbuf *buff, const struct path * pp)
 {
-	if (pp->tgt_node_name[0] == '\0')
+	if (pp->ident->tgt_node_name[0] == '\0')
 		return append_strbuf_str(buff, "[undef]");
-	return snprint_str(buff, pp->tgt_node_name);
+	return snprint_str(buff, pp->ident->tgt_node_name);
 }
 
 static int
@@ -691,6 +755,17 @@ snprint_path_failures(struct strbuf *buff, const struct path * pp)
 	return snprint_int(buff, pp->failcount);
 }
 
+static int
+snprint_path_fail_rate(struct strbuf *buff, const struct path * pp)
+{
+	struct timespec now;
+
+	get_monotonic_time(&now);
+	return snprint_uint(buff, fail_window_count(&pp->fail_window,
+						    now.tv_sec,
+						    FAIL_WINDOW_SECS));
+}
+
 /* if you add a protocol string bigger than "scsi:unspec" you must
  * also change PROTOCOL_BUF_SIZE */
 int
@@ -743,6 +818,12 @@ snprint_path_marginal(struct strbuf *buff, const struct path * pp)
 	return append_strbuf_str(buff, "normal");
 }
 
+static int
+snprint_path_health(struct strbuf *buff, const struct path * pp)
+{
+	return append_strbuf_str(buff, path_health_name(pp->health.state));
+}
+
 static int
 snprint_path_vpd_data(struct strbuf *buff, const struct path * pp)
 {
@@ -752,67 +833,83 @@ snprint_path_vpd_data(struct strbuf *buff, const struct path * pp)
 }
 
 struct multipath_data mpd[] = {
-	{'n', "name",          0, snprint_name},
-	{'w', "uuid",          0, snprint_multipath_uuid},
-	{'d', "sysfs",         0, snprint_sysfs},
-	{'F', "failback",      0, snprint_failback},
-	{'Q', "queueing",      0, snprint_queueing},
-	{'N', "paths",         0, snprint_nb_paths},
-	{'r', "write_prot",    0, snprint_ro},
-	{'t', "dm-st",         0, snprint_dm_map_state},
-	{'S', "size",          0, snprint_multipath_size},
-	{'f', "features",      0, snprint_features},
-	{'x', "failures",      0, snprint_map_failures},
-	{'h', "hwhandler",     0, snprint_hwhandler},
-	{'A', "action",        0, snprint_action},
-	{'0', "path_faults",   0, snprint_path_faults},
-	{'1', "switch_grp",    0, snprint_switch_grp},
-	{'2', "map_loads",     0, snprint_map_loads},
-	{'3', "total_q_time",  0, snprint_total_q_time},
-	{'4', "q_timeouts",    0, snprint_q_timeouts},
-	{'s', "vend/prod/rev", 0, snprint_multipath_vpr},
-	{'v', "vend",          0, snprint_multipath_vend},
-	{'p', "prod",          0, snprint_multipath_prod},
-	{'e', "rev",           0, snprint_multipath_rev},
-	{'G', "foreign",       0, snprint_multipath_foreign},
-	{'g', "vpd page data", 0, snprint_multipath_vpd_data},
-	{0, NULL, 0 , NULL}
+	{'n', "name",          snprint_name},
+	{'w', "uuid",          snprint_multipath_uuid},
+	{'d', "sysfs",         snprint_sysfs},
+	{'F', "failback",      snprint_failback},
+	{'Q', "queueing",      snprint_queueing},
+	{'N', "paths",         snprint_nb_paths},
+	{'r', "write_prot",    snprint_ro},
+	{'t', "dm-st",         snprint_dm_map_state},
+	{'S', "size",          snprint_multipath_size},
+	{'f', "features",      snprint_features},
+	{'x', "failures",      snprint_map_failures},
+	{'h', "hwhandler",     snprint_hwhandler},
+	{'A', "action",        snprint_action},
+	{'0', "path_faults",   snprint_path_faults},
+	{'1', "switch_grp",    snprint_switch_grp},
+	{'2', "map_loads",     snprint_map_loads},
+	{'3', "total_q_time",  snprint_total_q_time},
+	{'4', "q_timeouts",    snprint_q_timeouts},
+	{'s', "vend/prod/rev", snprint_multipath_vpr},
+	{'v', "vend",          snprint_multipath_vend},
+	{'p', "prod",          snprint_multipath_prod},
+	{'e', "rev",           snprint_multipath_rev},
+	{'G', "foreign",       snprint_multipath_foreign},
+	{'g', "vpd page data", snprint_multipath_vpd_data},
+	{'I', "iops",          snprint_map_iops},
+	{'B', "throughput",    snprint_map_kbps},
+	{'u', "io_lat",        snprint_map_io_lat},
+	{'j', "io_p50",        snprint_map_io_p50},
+	{'k', "io_p90",        snprint_map_io_p90},
+	{'K', "io_p99",        snprint_map_io_p99},
+	{0, NULL, NULL}
 };
 
 struct path_data pd[] = {
-	{'w', "uuid",          0, snprint_path_uuid},
-	{'i', "hcil",          0, snprint_hcil},
-	{'d', "dev",           0, snprint_dev},
-	{'D', "dev_t",         0, snprint_dev_t},
-	{'t', "dm_st",         0, snprint_dm_path_state},
-	{'o', "dev_st",        0, snprint_offline},
-	{'T', "chk_st",        0, snprint_chk_state},
-	{'s', "vend/prod/rev", 0, snprint_vpr},
-	{'c', "checker",       0, snprint_path_checker},
-	{'C', "next_check",    0, snprint_next_check},
-	{'p', "pri",           0, snprint_pri},
-	{'S', "size",          0, snprint_path_size},
-	{'z', "serial",        0, snprint_path_serial},
-	{'M', "marginal_st",   0, snprint_path_marginal},
-	{'m', "multipath",     0, snprint_path_mpp},
-	{'N', "host WWNN",     0, snprint_host_wwnn},
-	{'n', "target WWNN",   0, snprint_tgt_wwnn},
-	{'R', "host WWPN",     0, snprint_host_wwpn},
-	{'r', "target WWPN",   0, snprint_tgt_wwpn},
-	{'a', "host adapter",  0, snprint_host_adapter},
-	{'G', "foreign",       0, snprint_path_foreign},
-	{'g', "vpd page data", 0, snprint_path_vpd_data},
-	{'0', "failures",      0, snprint_path_failures},
-	{'P', "protocol",      0, snprint_path_protocol},
-	{0, NULL, 0 , NULL}
+	{'w', "uuid",          snprint_path_uuid},
+	{'i', "hcil",          snprint_hcil},
+	{'d', "dev",           snprint_dev},
+	{'D', "dev_t",         snprint_dev_t},
+	{'t', "dm_st",         snprint_dm_path_state},
+	{'o', "dev_st",        snprint_offline},
+	{'T', "chk_st",        snprint_chk_state},
+	{'s', "vend/prod/rev", snprint_vpr},
+	{'c', "checker",       snprint_path_checker},
+	{'C', "next_check",    snprint_next_check},
+	{'p', "pri",           snprint_pri},
+	{'S', "size",          snprint_path_size},
+	{'z', "serial",        snprint_path_serial},
+	{'M', "marginal_st",   snprint_path_marginal},
+	{'h', "health",        snprint_path_health},
+	{'m', "multipath",     snprint_path_mpp},
+	{'N', "host WWNN",     snprint_host_wwnn},
+	{'n', "target WWNN",   snprint_tgt_wwnn},
+	{'R', "host WWPN",     snprint_host_wwpn},
+	{'r', "target WWPN",   snprint_tgt_wwpn},
+	{'a', "host adapter",  snprint_host_adapter},
+	{'G', "foreign",       snprint_path_foreign},
+	{'g', "vpd page data", snprint_path_vpd_data},
+	{'0', "failures",      snprint_path_failures},
+	{'f', "fails_10m",     snprint_path_fail_rate},
+	{'P', "protocol",      snprint_path_protocol},
+	{'l', "lat_p50",       snprint_latency_p50},
+	{'L', "lat_p99",       snprint_latency_p99},
+	{'I', "iops",          snprint_path_iops},
+	{'B', "throughput",    snprint_path_kbps},
+	{'u', "io_lat",        snprint_path_io_lat},
+	{'j', "io_p50",        snprint_path_io_p50},
+	{'k', "io_p90",        snprint_path_io_p90},
+	{'K', "io_p99",        snprint_path_io_p99},
+	{0, NULL, NULL}
 };
 
 struct pathgroup_data pgd[] = {
-	{'s', "selector",      0, snprint_pg_selector},
-	{'p', "pri",           0, snprint_pg_pri},
-	{'t', "dm_st",         0, snprint_pg_state},
-	{'M', "marginal_st",   0, snprint_pg_marginal},
-	{0, NULL, 0 , NULL}
+	{'s', "selector",      snprint_pg_selector},
+	{'p', "pri",           snprint_pg_pri},
+	{'t', "dm_st",         snprint_pg_state},
+	{'M', "marginal_st",   snprint_pg_marginal},
+	{0, NULL, NULL}
 };
 
 int snprint_wildcards(struct strbuf *buff)
@@ -844,18 +941,48 @@ int snprint_wildcards(struct strbuf *buff)
 	return get_strbuf_len(buff) - initial_len;
 }
 
+fieldwidth_t *alloc_path_layout(void)
+{
+	return calloc(ARRAY_SIZE(pd), sizeof(fieldwidth_t));
+}
+
 void
-get_path_layout(vector pathvec, int header)
+get_path_layout_fmt(vector pathvec, int header, const char *fmt,
+		    fieldwidth_t *width)
 {
 	vector gpvec = vector_convert(NULL, pathvec, struct path,
 				      dm_path_to_gen);
-	_get_path_layout(gpvec,
-			 header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO);
+	__get_path_layout(gpvec,
+			  header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO,
+			  fmt, width);
 	vector_free(gpvec);
 }
 
+void
+get_path_layout(vector pathvec, int header, fieldwidth_t *width)
+{
+	get_path_layout_fmt(pathvec, header, NULL, width);
+}
+
+/*
+ * Check if fmt contains the given wildcard. The format is scanned
+ * like in _snprint_path(). A NULL format uses all wildcards.
+ */
+static bool
+fmt_has_wildcard(const char *fmt, char wildcard)
+{
+	const char *f;
+
+	if (!fmt)
+		return true;
+	for (f = strchr(fmt, '%'); f && f[1]; f = strchr(f + 2, '%'))
+		if (f[1] == wildcard)
+			return true;
+	return false;
+}
+
 static void
-reset_width(unsigned int *width, enum layout_reset reset, const char *header)
+reset_width(fieldwidth_t *width, enum layout_reset reset, const char *header)
 {
 	switch (reset) {
 	case LAYOUT_RESET_HEADER:
@@ -871,79 +998,100 @@ reset_width(unsigned int *width, enum layout_reset reset, const char *header)
 }
 
 void
-_get_path_layout (const struct _vector *gpvec, enum layout_reset reset)
+__get_path_layout (const struct _vector *gpvec, enum layout_reset reset,
+		   const char *fmt, fieldwidth_t *width)
 {
 	int i, j;
 	const struct gen_path *gp;
 
+	if (width == NULL)
+		return;
+
 	for (j = 0; pd[j].header; j++) {
 		STRBUF_ON_STACK(buff);
 
-		reset_width(&pd[j].width, reset, pd[j].header);
+		reset_width(&width[j], reset, pd[j].header);
 
-		if (gpvec == NULL)
+		if (gpvec == NULL || !fmt_has_wildcard(fmt, pd[j].wildcard))
 			continue;
 
 		vector_foreach_slot (gpvec, gp, i) {
 			gp->ops->snprint(gp, &buff, pd[j].wildcard);
-			pd[j].width = MAX(pd[j].width, get_strbuf_len(&buff));
+			width[j] = MAX(width[j], get_strbuf_len(&buff));
 			truncate_strbuf(&buff, 0);
 		}
 	}
 }
 
-static void
-reset_multipath_layout (void)
+fieldwidth_t *alloc_multipath_layout(void)
 {
-	int i;
-
-	for (i = 0; mpd[i].header; i++)
-		mpd[i].width = 0;
+	return calloc(ARRAY_SIZE(mpd), sizeof(fieldwidth_t));
 }
 
 void
-get_multipath_layout (vector mpvec, int header) {
+get_multipath_layout_fmt (vector mpvec, int header, const char *fmt,
+			  fieldwidth_t *width)
+{
 	vector gmvec = vector_convert(NULL, mpvec, struct multipath,
 				      dm_multipath_to_gen);
-	_get_multipath_layout(gmvec,
-			 header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO);
+	__get_multipath_layout(gmvec,
+			       header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO,
+			       fmt, width);
 	vector_free(gmvec);
 }
 
 void
-_get_multipath_layout (const struct _vector *gmvec,
-			    enum layout_reset reset)
+get_multipath_layout (vector mpvec, int header, fieldwidth_t *width)
+{
+	get_multipath_layout_fmt(mpvec, header, NULL, width);
+}
+
+void
+__get_multipath_layout (const struct _vector *gmvec,
+			enum layout_reset reset, const char *fmt,
+			fieldwidth_t *width)
 {
 	int i, j;
 	const struct gen_multipath * gm;
 
+	if (width == NULL)
+		return;
+
 	for (j = 0; mpd[j].header; j++) {
 		STRBUF_ON_STACK(buff);
 
-		reset_width(&mpd[j].width, reset, mpd[j].header);
+		reset_width(&width[j], reset, mpd[j].header);
 
-		if (gmvec == NULL)
+		if (gmvec == NULL || !fmt_has_wildcard(fmt, mpd[j].wildcard))
 			continue;
 
 		vector_foreach_slot (gmvec, gm, i) {
 			gm->ops->snprint(gm, &buff, mpd[j].wildcard);
-			mpd[j].width = MAX(mpd[j].width, get_strbuf_len(&buff));
+			width[j] = MAX(width[j], get_strbuf_len(&buff));
 			truncate_strbuf(&buff, 0);
 		}
-		condlog(4, "%s: width %d", mpd[j].header, mpd[j].width);
+		condlog(4, "%s: width %d", mpd[j].header, width[j]);
 	}
 }
 
-static struct multipath_data *
-mpd_lookup(char wildcard)
+static int
+mpd_index(char wildcard)
 {
 	int i;
 
 	for (i = 0; mpd[i].header; i++)
 		if (mpd[i].wildcard == wildcard)
-			return &mpd[i];
+			return i;
 
-	return NULL;
+	return -1;
+}
+
+static struct multipath_data *
+mpd_lookup(char wildcard)
+{
+	int i = mpd_index(wildcard);
+
+	return i < 0 ? NULL : &mpd[i];
 }
 
 int snprint_multipath_attr(const struct gen_multipath* gm,
@@ -957,16 +1105,24 @@ int snprint_multipath_attr(const struct gen_multipath* gm,
 	return mpd->snprint(buf, mpp);
 }
 
-static struct path_data *
-pd_lookup(char wildcard)
+static int
+pd_index(char wildcard)
 {
 	int i;
 
 	for (i = 0; pd[i].header; i++)
 		if (pd[i].wildcard == wildcard)
-			return &pd[i];
+			return i;
 
-	return NULL;
+	return -1;
+}
+
+static struct path_data *
+pd_lookup(char wildcard)
+{
+	int i = pd_index(wildcard);
+
+	return i < 0 ? NULL : &pd[i];
 }
 
 int snprint_path_attr(const struct gen_path* gp,
@@ -1003,25 +1159,25 @@ int snprint_pathgroup_attr(const struct gen_pathgroup* gpg,
 	return pdg->snprint(buf, pg);
 }
 
-int snprint_multipath_header(struct strbuf *line, const char *format)
+int snprint_multipath_header(struct strbuf *line, const char *format,
+			     const fieldwidth_t *width)
 {
 	int initial_len = get_strbuf_len(line);
 	const char *f;
-	struct multipath_data * data;
-	int rc;
+	int i, rc;
 
 	for (f = strchr(format, '%'); f; f = strchr(++format, '%')) {
 		if ((rc = __append_strbuf_str(line, format, f - format)) < 0)
 			return rc;
 
 		format = f + 1;
-		if (!(data = mpd_lookup(*format)))
+		if ((i = mpd_index(*format)) < 0)
 			continue; /* unknown wildcard */
 
-		if ((rc = append_strbuf_str(line, data->header)) < 0)
+		if ((rc = append_strbuf_str(line, mpd[i].header)) < 0)
 			return rc;
-		else if ((unsigned int)rc < data->width)
-			if ((rc = fill_strbuf(line, ' ', data->width - rc)) < 0)
+		else if (width && (unsigned int)rc < width[i])
+			if ((rc = fill_strbuf(line, ' ', width[i] - rc)) < 0)
 				return rc;
 	}
 
@@ -1031,25 +1187,25 @@ int snprint_multipath_header(struct strbuf *line, const char *format)
 }
 
 int _snprint_multipath(const struct gen_multipath *gmp,
-		       struct strbuf *line, const char *format, int pad)
+		       struct strbuf *line, const char *format,
+		       const fieldwidth_t *width)
 {
 	int initial_len = get_strbuf_len(line);
 	const char *f;
-	struct multipath_data * data;
-	int rc;
+	int i, rc;
 
 	for (f = strchr(format, '%'); f; f = strchr(++format, '%')) {
 		if ((rc = __append_strbuf_str(line, format, f - format)) < 0)
 			return rc;
 
 		format = f + 1;
-		if (!(data = mpd_lookup(*format)))
+		if ((i = mpd_index(*format)) < 0)
 			continue; /* unknown wildcard */
 
 		if ((rc = gmp->ops->snprint(gmp, line, *format)) < 0)
 			return rc;
-		else if (pad && (unsigned int)rc < data->width)
-			if ((rc = fill_strbuf(line, ' ', data->width - rc)) < 0)
+		else if (width && (unsigned int)rc < width[i])
+			if ((rc = fill_strbuf(line, ' ', width[i] - rc)) < 0)
 				return rc;
 	}
 
@@ -1058,25 +1214,25 @@ int _snprint_multipath(const struct gen_multipath *gmp,
 	return get_strbuf_len(line) - initial_len;
 }
 
-int snprint_path_header(struct strbuf *line, const char *format)
+int snprint_path_header(struct strbuf *line, const char *format,
+			const fieldwidth_t *width)
 {
 	int initial_len = get_strbuf_len(line);
 	const char *f;
-	struct path_data *data;
-	int rc;
+	int i, rc;
 
 	for (f = strchr(format, '%'); f; f = strchr(++format, '%')) {
 		if ((rc = __append_strbuf_str(line, format, f - format)) < 0)
 			return rc;
 
 		format = f + 1;
-		if (!(data = pd_lookup(*format)))
+		if ((i = pd_index(*format)) < 0)
 			continue; /* unknown wildcard */
 
-		if ((rc = append_strbuf_str(line, data->header)) < 0)
+		if ((rc = append_strbuf_str(line, pd[i].header)) < 0)
 			return rc;
-		else if ((unsigned int)rc < data->width)
-			if ((rc = fill_strbuf(line, ' ', data->width - rc)) < 0)
+		else if (width && (unsigned int)rc < width[i])
+			if ((rc = fill_strbuf(line, ' ', width[i] - rc)) < 0)
 				return rc;
 	}
 
@@ -1086,25 +1242,24 @@ int snprint_path_header(struct strbuf *line, const char *format)
 }
 
 int _snprint_path(const struct gen_path *gp, struct strbuf *line,
-		  const char *format, int pad)
+		  const char *format, const fieldwidth_t *width)
 {
 	int initial_len = get_strbuf_len(line);
 	const char *f;
-	struct path_data * data;
-	int rc;
+	int i, rc;
 
 	for (f = strchr(format, '%'); f; f = strchr(++format, '%')) {
 		if ((rc = __append_strbuf_str(line, format, f - format)) < 0)
 			return rc;
 
 		format = f + 1;
-		if (!(data = pd_lookup(*format)))
+		if ((i = pd_index(*format)) < 0)
 			continue; /* unknown wildcard */
 
 		if ((rc = gp->ops->snprint(gp, line, *format)) < 0)
 			return rc;
-		else if (pad && (unsigned int)rc < data->width)
-			if ((rc = fill_strbuf(line, ' ', data->width - rc)) < 0)
+		else if (width && (unsigned int)rc < width[i])
+			if ((rc = fill_strbuf(line, ' ', width[i] - rc)) < 0)
 				return rc;
 	}
 
@@ -1113,12 +1268,177 @@ int _snprint_path(const struct gen_path *gp, struct strbuf *line,
 	return get_strbuf_len(line) - initial_len;
 }
 
+int snprint_path_history(struct strbuf *buff, const struct path *pp)
+{
+	int initial_len = get_strbuf_len(buff);
+	const struct path_transition *pt;
+	const char *name = checker_name(&pp->checker);
+	unsigned int i, n = pp->history.n;
+	char tbuf[32];
+	struct tm tm;
+	int rc;
+
+	i = n > PATH_HISTORY_SIZE ? n - PATH_HISTORY_SIZE : 0;
+	for (; i < n; i++) {
+		pt = &pp->history.ent[i % PATH_HISTORY_SIZE];
+		if (!localtime_r(&pt->time.tv_sec, &tm) ||
+		    !strftime(tbuf, sizeof(tbuf), "%F %T", &tm))
+			tbuf[0] = '\0';
+		if ((rc = print_strbuf(buff, "%s.%03ld %s -> %s prio %d",
+				       tbuf, pt->time.tv_nsec / 1000000,
+				       checker_state_name(pt->oldstate),
+				       checker_state_name(pt->newstate),
+				       pt->priority)) < 0)
+			return rc;
+		/* The message table of the current checker is used */
+		if (name && (rc = print_strbuf(buff, ", %s checker%s", name,
+					       checker_msgid_message(&pp->checker,
+								     pt->msgid))) < 0)
+			return rc;
+		if ((rc = append_strbuf_str(buff, "\n")) < 0)
+			return rc;
+	}
+	return get_strbuf_len(buff) - initial_len;
+}
+
+/*
+ * A format string compiled into an array of literal text and wildcard
+ * entries, so that printing many rows doesn't have to parse the format
+ * and look up the wildcards for every row. Unknown wildcards are
+ * dropped like in _snprint_path(). idx is the index of the wildcard in
+ * pd[] or mpd[], and in the width array, or -1 for literal text only.
+ */
+struct print_fmt_op {
+	const char *lit;
+	int lit_len;
+	int idx;
+};
+
+struct print_fmt {
+	const char *tail;
+	int tail_len;
+	int nr_ops;
+	struct print_fmt_op ops[];
+};
+
+static struct print_fmt *
+compile_fmt(const char *format, int (*lookup)(char))
+{
+	struct print_fmt *pf;
+	struct print_fmt_op *op;
+	const char *f;
+	char *copy, *p;
+	size_t len = strlen(format);
+	int n = 0;
+
+	for (f = strchr(format, '%'); f; f = strchr(f + 1, '%'))
+		n++;
+	pf = malloc(sizeof(*pf) + n * sizeof(*pf->ops) + len + 1);
+	if (!pf)
+		return NULL;
+	copy = (char *)&pf->ops[n];
+	memcpy(copy, format, len + 1);
+
+	pf->nr_ops = 0;
+	for (p = strchr(copy, '%'); p; p = strchr(copy, '%')) {
+		op = &pf->ops[pf->nr_ops];
+		op->lit = copy;
+		op->lit_len = p - copy;
+		if (!p[1]) {
+			op->idx = -1;
+			copy = p + 1;
+		} else {
+			op->idx = lookup(p[1]);
+			copy = p + 2;
+		}
+		if (op->idx >= 0 || op->lit_len)
+			pf->nr_ops++;
+	}
+	pf->tail = copy;
+	pf->tail_len = strlen(copy);
+	return pf;
+}
+
+struct print_fmt *compile_path_fmt(const char *format)
+{
+	return compile_fmt(format, pd_index);
+}
+
+struct print_fmt *compile_multipath_fmt(const char *format)
+{
+	return compile_fmt(format, mpd_index);
+}
+
+void free_print_fmt(struct print_fmt *pf)
+{
+	free(pf);
+}
+
+static int snprint_fmt_tail(struct strbuf *line, const struct print_fmt *pf)
+{
+	int rc;
+
+	if ((rc = __append_strbuf_str(line, pf->tail, pf->tail_len)) < 0)
+		return rc;
+	return fill_strbuf(line, '\n', 1);
+}
+
+int snprint_path_fmt(struct strbuf *line, const struct print_fmt *pf,
+		     const struct path *pp, const fieldwidth_t *width)
+{
+	int initial_len = get_strbuf_len(line);
+	int i, rc;
+
+	for (i = 0; i < pf->nr_ops; i++) {
+		const struct print_fmt_op *op = &pf->ops[i];
+
+		if ((rc = __append_strbuf_str(line, op->lit, op->lit_len)) < 0)
+			return rc;
+		if (op->idx < 0)
+			continue;
+		if ((rc = pd[op->idx].snprint(line, pp)) < 0)
+			return rc;
+		else if (width && (unsigned int)rc < width[op->idx])
+			if ((rc = fill_strbuf(line, ' ',
+					      width[op->idx] - rc)) < 0)
+				return rc;
+	}
+	if ((rc = snprint_fmt_tail(line, pf)) < 0)
+		return rc;
+	return get_strbuf_len(line) - initial_len;
+}
+
+int snprint_multipath_fmt(struct strbuf *line, const struct print_fmt *pf,
+			  const struct multipath *mpp,
+			  const fieldwidth_t *width)
+{
+	int initial_len = get_strbuf_len(line);
+	int i, rc;
+
+	for (i = 0; i < pf->nr_ops; i++) {
+		const struct print_fmt_op *op = &pf->ops[i];
+
+		if ((rc = __append_strbuf_str(line, op->lit, op->lit_len)) < 0)
+			return rc;
+		if (op->idx < 0)
+			continue;
+		if ((rc = mpd[op->idx].snprint(line, mpp)) < 0)
+			return rc;
+		else if (width && (unsigned int)rc < width[op->idx])
+			if ((rc = fill_strbuf(line, ' ',
+					      width[op->idx] - rc)) < 0)
+				return rc;
+	}
+	if ((rc = snprint_fmt_tail(line, pf)) < 0)
+		return rc;
+	return get_strbuf_len(line) - initial_len;
+}
+
 int _snprint_pathgroup(const struct gen_pathgroup *ggp, struct strbuf *line,
 		       const char *format)
 {
 	int initial_len = get_strbuf_len(line);
 	const char *f;
-	struct pathgroup_data *data;
 	int rc;
 
 	for (f = strchr(format, '%'); f; f = strchr(++format, '%')) {
@@ -1126,14 +1446,11 @@ int _snprint_pathgroup(const struct gen_pathgroup *ggp, struct strbuf *line,
 			return rc;
 
 		format = f + 1;
-		if (!(data = pgd_lookup(*format)))
+		if (!pgd_lookup(*format))
 			continue; /* unknown wildcard */
 
 		if ((rc = ggp->ops->snprint(ggp, line, *format)) < 0)
 			return rc;
-		else if ((unsigned int)rc < data->width)
-			if ((rc = fill_strbuf(line, ' ', data->width - rc)) < 0)
-				return rc;
 	}
 
 	if ((rc = print_strbuf(line, "%s\n", format)) < 0)
@@ -1147,9 +1464,29 @@ int _snprint_pathgroup(const struct gen_pathgroup *ggp, struct strbuf *line,
 void _print_multipath_topology(const struct gen_multipath *gmp, int verbosity)
 {
 	STRBUF_ON_STACK(buff);
+	fieldwidth_t *p_width = alloc_path_layout();
+	const struct _vector *pgvec, *pathvec;
+	const struct gen_pathgroup *gpg;
+	int j;
+
+	/* align the paths of this map */
+	pgvec = gmp->ops->get_pathgroups(gmp);
+	if (p_width && pgvec) {
+		vector_foreach_slot (pgvec, gpg, j) {
+			pathvec = gpg->ops->get_paths(gpg);
+			if (pathvec == NULL)
+				continue;
+			__get_path_layout(pathvec, LAYOUT_RESET_NOT,
+					  PRINT_PATH_INDENT, p_width);
+			gpg->ops->rel_paths(gpg, pathvec);
+		}
+	}
+	if (pgvec)
+		gmp->ops->rel_pathgroups(gmp, pgvec);
 
-	_snprint_multipath_topology(gmp, &buff, verbosity);
+	_snprint_multipath_topology(gmp, &buff, verbosity, p_width);
 	printf("%s", get_strbuf_str(&buff));
+	free(p_width);
 }
 
 int snprint_multipath_style(const struct gen_multipath *gmp,
@@ -1168,7 +1505,8 @@ int snprint_multipath_style(const struct gen_multipath *gmp,
 }
 
 int _snprint_multipath_topology(const struct gen_multipath *gmp,
-				struct strbuf *buff, int verbosity)
+				struct strbuf *buff, int verbosity,
+				const fieldwidth_t *p_width)
 {
 	int j, i, rc;
 	const struct _vector *pgvec;
@@ -1179,10 +1517,8 @@ int _snprint_multipath_topology(const struct gen_multipath *gmp,
 	if (verbosity <= 0)
 		return 0;
 
-	reset_multipath_layout();
-
 	if (verbosity == 1)
-		return _snprint_multipath(gmp, buff, "%n", 1);
+		return _snprint_multipath(gmp, buff, "%n", NULL);
 
 	if(isatty(1) &&
 	   (rc = print_strbuf(&style, "%c[%dm", 0x1B, 1)) < 0) /* bold on */
@@ -1193,8 +1529,9 @@ int _snprint_multipath_topology(const struct gen_multipath *gmp,
 	   (rc = print_strbuf(&style, "%c[%dm", 0x1B, 0)) < 0) /* bold off */
 		return rc;
 
-	if ((rc = _snprint_multipath(gmp, buff, get_strbuf_str(&style), 1)) < 0
-	    || (rc = _snprint_multipath(gmp, buff, PRINT_MAP_PROPS, 1)) < 0)
+	if ((rc = _snprint_multipath(gmp, buff, get_strbuf_str(&style),
+				     NULL)) < 0
+	    || (rc = _snprint_multipath(gmp, buff, PRINT_MAP_PROPS, NULL)) < 0)
 		return rc;
 
 	pgvec = gmp->ops->get_pathgroups(gmp);
@@ -1221,7 +1558,7 @@ int _snprint_multipath_topology(const struct gen_multipath *gmp,
 					       i + 1 == VECTOR_SIZE(pathvec) ?
 					       '`': '|')) < 0 ||
 			    (rc = _snprint_path(gp, buff,
-						PRINT_PATH_INDENT, 1)) < 0)
+						PRINT_PATH_INDENT, p_width)) < 0)
 				return rc;
 		}
 		gpg->ops->rel_paths(gpg, pathvec);
@@ -1267,6 +1604,190 @@ static int snprint_json_elem_footer(struct strbuf *buff, int indent, bool last)
 		return append_strbuf_str(buff, PRINT_JSON_END_ELEM);
 }
 
+/*
+ * The JSON fields of maps, path groups and paths. Each value is printed
+ * by its wildcard function between two precomputed fragments, which
+ * hold the indentation, the key and the quotes. Quoted values are
+ * escaped after printing.
+ */
+#define JSON_MAP_KEY(key)	"      \"" key "\" : "
+#define JSON_GROUP_KEY(key)	"         \"" key "\" : "
+#define JSON_PATH_KEY(key)	"            \"" key "\" : "
+#define JSON_FRAG(s)		s, sizeof(s) - 1
+
+struct json_frag {
+	const char *str;
+	int len;
+};
+
+#define JSON_STR_FIELD(indent_key, fn) \
+	{ { JSON_FRAG(indent_key "\"") }, fn, true }
+#define JSON_NUM_FIELD(indent_key, fn) \
+	{ { JSON_FRAG(indent_key) }, fn, false }
+
+/* Indexed by [quoted][last field without comma] */
+static const struct json_frag json_field_end[2][2] = {
+	{ { JSON_FRAG(",\n") }, { JSON_FRAG("\n") } },
+	{ { JSON_FRAG("\",\n") }, { JSON_FRAG("\"\n") } },
+};
+
+static const struct {
+	struct json_frag key;
+	int (*snprint)(struct strbuf *, const struct multipath *);
+	bool quoted;
+} json_map_fields[] = {
+	JSON_STR_FIELD(JSON_MAP_KEY("name"), snprint_name),
+	JSON_STR_FIELD(JSON_MAP_KEY("uuid"), snprint_multipath_uuid),
+	JSON_STR_FIELD(JSON_MAP_KEY("sysfs"), snprint_sysfs),
+	JSON_STR_FIELD(JSON_MAP_KEY("failback"), snprint_failback),
+	JSON_STR_FIELD(JSON_MAP_KEY("queueing"), snprint_queueing),
+	JSON_NUM_FIELD(JSON_MAP_KEY("paths"), snprint_nb_paths),
+	JSON_STR_FIELD(JSON_MAP_KEY("write_prot"), snprint_ro),
+	JSON_STR_FIELD(JSON_MAP_KEY("dm_st"), snprint_dm_map_state),
+	JSON_STR_FIELD(JSON_MAP_KEY("features"), snprint_features),
+	JSON_STR_FIELD(JSON_MAP_KEY("hwhandler"), snprint_hwhandler),
+	JSON_STR_FIELD(JSON_MAP_KEY("action"), snprint_action),
+	JSON_NUM_FIELD(JSON_MAP_KEY("path_faults"), snprint_path_faults),
+	JSON_STR_FIELD(JSON_MAP_KEY("vend"), snprint_multipath_vend),
+	JSON_STR_FIELD(JSON_MAP_KEY("prod"), snprint_multipath_prod),
+	JSON_STR_FIELD(JSON_MAP_KEY("rev"), snprint_multipath_rev),
+	JSON_NUM_FIELD(JSON_MAP_KEY("switch_grp"), snprint_switch_grp),
+	JSON_NUM_FIELD(JSON_MAP_KEY("map_loads"), snprint_map_loads),
+	JSON_NUM_FIELD(JSON_MAP_KEY("total_q_time"), snprint_total_q_time),
+	JSON_NUM_FIELD(JSON_MAP_KEY("q_timeouts"), snprint_q_timeouts),
+};
+
+static const struct {
+	struct json_frag key;
+	int (*snprint)(struct strbuf *, const struct pathgroup *);
+	bool quoted;
+} json_group_fields[] = {
+	JSON_STR_FIELD(JSON_GROUP_KEY("selector"), snprint_pg_selector),
+	JSON_NUM_FIELD(JSON_GROUP_KEY("pri"), snprint_pg_pri),
+	JSON_STR_FIELD(JSON_GROUP_KEY("dm_st"), snprint_pg_state),
+	JSON_STR_FIELD(JSON_GROUP_KEY("marginal_st"), snprint_pg_marginal),
+};
+
+static const struct {
+	struct json_frag key;
+	int (*snprint)(struct strbuf *, const struct path *);
+	bool quoted;
+} json_path_fields[] = {
+	JSON_STR_FIELD(JSON_PATH_KEY("dev"), snprint_dev),
+	JSON_STR_FIELD(JSON_PATH_KEY("dev_t"), snprint_dev_t),
+	JSON_STR_FIELD(JSON_PATH_KEY("dm_st"), snprint_dm_path_state),
+	JSON_STR_FIELD(JSON_PATH_KEY("dev_st"), snprint_offline),
+	JSON_STR_FIELD(JSON_PATH_KEY("chk_st"), snprint_chk_state),
+	JSON_STR_FIELD(JSON_PATH_KEY("checker"), snprint_path_checker),
+	JSON_NUM_FIELD(JSON_PATH_KEY("pri"), snprint_pri),
+	JSON_STR_FIELD(JSON_PATH_KEY("host_wwnn"), snprint_host_wwnn),
+	JSON_STR_FIELD(JSON_PATH_KEY("target_wwnn"), snprint_tgt_wwnn),
+	JSON_STR_FIELD(JSON_PATH_KEY("host_wwpn"), snprint_host_wwpn),
+	JSON_STR_FIELD(JSON_PATH_KEY("target_wwpn"), snprint_tgt_wwpn),
+	JSON_STR_FIELD(JSON_PATH_KEY("host_adapter"), snprint_host_adapter),
+	JSON_STR_FIELD(JSON_PATH_KEY("marginal_st"), snprint_path_marginal),
+};
+
+/*
+ * The fields of "show paths json", which lists the paths on their own.
+ * They can be selected by name, see json_path_field_mask().
+ */
+#define JSON_LIST_STR_FIELD(key, fn) \
+	{ key, { JSON_FRAG(JSON_MAP_KEY(key) "\"") }, fn, true }
+#define JSON_LIST_NUM_FIELD(key, fn) \
+	{ key, { JSON_FRAG(JSON_MAP_KEY(key)) }, fn, false }
+
+static const struct {
+	const char *name;
+	struct json_frag key;
+	int (*snprint)(struct strbuf *, const struct path *);
+	bool quoted;
+} json_path_list_fields[] = {
+	JSON_LIST_STR_FIELD("dev", snprint_dev),
+	JSON_LIST_STR_FIELD("dev_t", snprint_dev_t),
+	JSON_LIST_STR_FIELD("multipath", snprint_path_mpp),
+	JSON_LIST_STR_FIELD("uuid", snprint_path_uuid),
+	JSON_LIST_STR_FIELD("hcil", snprint_hcil),
+	JSON_LIST_STR_FIELD("dm_st", snprint_dm_path_state),
+	JSON_LIST_STR_FIELD("dev_st", snprint_offline),
+	JSON_LIST_STR_FIELD("chk_st", snprint_chk_state),
+	JSON_LIST_STR_FIELD("checker", snprint_path_checker),
+	JSON_LIST_NUM_FIELD("pri", snprint_pri),
+	JSON_LIST_STR_FIELD("host_wwnn", snprint_host_wwnn),
+	JSON_LIST_STR_FIELD("target_wwnn", snprint_tgt_wwnn),
+	JSON_LIST_STR_FIELD("host_wwpn", snprint_host_wwpn),
+	JSON_LIST_STR_FIELD("target_wwpn", snprint_tgt_wwpn),
+	JSON_LIST_STR_FIELD("host_adapter", snprint_host_adapter),
+	JSON_LIST_STR_FIELD("marginal_st", snprint_path_marginal),
+};
+
+static int append_json_frag(struct strbuf *buff, const struct json_frag *f)
+{
+	return __append_strbuf_str(buff, f->str, f->len);
+}
+
+/*
+ * Escape the value that was printed to buff at offset start. Values
+ * almost never need escaping, so they are only copied if they do.
+ */
+static int escape_json_value(struct strbuf *buff, size_t start)
+{
+	const char *p, *value = get_strbuf_str(buff) + start;
+	char *copy;
+	int rc = 0;
+
+	for (p = value; *p; p++)
+		if (*p == '"' || *p == '\\' || (unsigned char)*p < 0x20)
+			break;
+	if (!*p)
+		return 0;
+
+	copy = strdup(value);
+	if (!copy)
+		return -ENOMEM;
+	if ((rc = truncate_strbuf(buff, start)) < 0)
+		goto out;
+	for (p = copy; *p && rc >= 0; p++) {
+		if (*p == '"' || *p == '\\')
+			rc = print_strbuf(buff, "\\%c", *p);
+		else if ((unsigned char)*p < 0x20)
+			rc = print_strbuf(buff, "\\u%04x", (unsigned char)*p);
+		else
+			rc = fill_strbuf(buff, *p, 1);
+	}
+out:
+	free(copy);
+	return rc < 0 ? rc : 0;
+}
+
+/*
+ * Print the fields of one of the tables above. All fields are followed
+ * by a comma, except the last one if last_sep is false.
+ */
+#define snprint_json_fields(buff, fields, obj, last_sep)		\
+({									\
+	unsigned int __i;						\
+	size_t __start;							\
+	int __rc = 0;							\
+									\
+	for (__i = 0; __i < ARRAY_SIZE(fields) && __rc >= 0; __i++) {	\
+		bool __last = __i + 1 == ARRAY_SIZE(fields);		\
+									\
+		if ((__rc = append_json_frag(buff, &fields[__i].key)) < 0) \
+			break;						\
+		__start = get_strbuf_len(buff);				\
+		if ((__rc = fields[__i].snprint(buff, obj)) < 0)	\
+			break;						\
+		if (fields[__i].quoted &&				\
+		    (__rc = escape_json_value(buff, __start)) < 0)	\
+			break;						\
+		__rc = append_json_frag(buff, &json_field_end		\
+					[fields[__i].quoted]		\
+					[__last && !(last_sep)]);	\
+	}								\
+	__rc;								\
+})
+
 static int snprint_multipath_fields_json(struct strbuf *buff,
 					 const struct multipath *mpp, int last)
 {
@@ -1275,20 +1796,25 @@ static int snprint_multipath_fields_json(struct strbuf *buff,
 	struct pathgroup *pgp;
 	size_t initial_len = get_strbuf_len(buff);
 
-	if ((rc = snprint_multipath(buff, PRINT_JSON_MAP, mpp, 0)) < 0 ||
+	if ((rc = snprint_json(buff, 0, PRINT_JSON_START_ELEM)) < 0 ||
+	    (rc = snprint_json_fields(buff, json_map_fields, mpp, true)) < 0 ||
 	    (rc = snprint_json(buff, 2, PRINT_JSON_START_GROUPS)) < 0)
 		return rc;
 
 	vector_foreach_slot (mpp->pg, pgp, i) {
 
-		if ((rc = snprint_pathgroup(buff, PRINT_JSON_GROUP, pgp)) < 0 ||
+		if ((rc = snprint_json(buff, 0, PRINT_JSON_START_ELEM)) < 0 ||
+		    (rc = snprint_json_fields(buff, json_group_fields,
+					      pgp, true)) < 0 ||
 		    (rc = print_strbuf(buff, PRINT_JSON_GROUP_NUM, i + 1)) < 0 ||
 		    (rc = snprint_json(buff, 3, PRINT_JSON_START_PATHS)) < 0)
 			return rc;
 
 		vector_foreach_slot (pgp->paths, pp, j) {
-			if ((rc = snprint_path(buff, PRINT_JSON_PATH,
-					       pp, 0)) < 0 ||
+			if ((rc = snprint_json(buff, 0,
+					       PRINT_JSON_START_ELEM)) < 0 ||
+			    (rc = snprint_json_fields(buff, json_path_fields,
+						      pp, false)) < 0 ||
 			    (rc = snprint_json_elem_footer(
 				    buff, 3,
 				    j + 1 == VECTOR_SIZE(pgp->paths))) < 0)
@@ -1307,6 +1833,78 @@ static int snprint_multipath_fields_json(struct strbuf *buff,
 	return get_strbuf_len(buff) - initial_len;
 }
 
+/*
+ * Print the fields of json_path_list_fields that are set in the mask
+ * fields, which must not be empty.
+ */
+static int snprint_path_list_fields_json(struct strbuf *buff,
+					 const struct path *pp, uint64_t fields)
+{
+	unsigned int i, last = 0;
+	size_t start;
+	int rc;
+
+	for (i = 0; i < ARRAY_SIZE(json_path_list_fields); i++)
+		if (fields & (1ULL << i))
+			last = i;
+
+	for (i = 0; i <= last; i++) {
+		if (!(fields & (1ULL << i)))
+			continue;
+		if ((rc = append_json_frag(buff,
+					   &json_path_list_fields[i].key)) < 0)
+			return rc;
+		start = get_strbuf_len(buff);
+		if ((rc = json_path_list_fields[i].snprint(buff, pp)) < 0)
+			return rc;
+		if (json_path_list_fields[i].quoted &&
+		    (rc = escape_json_value(buff, start)) < 0)
+			return rc;
+		if ((rc = append_json_frag(buff, &json_field_end
+					   [json_path_list_fields[i].quoted]
+					   [i == last])) < 0)
+			return rc;
+	}
+	return 0;
+}
+
+int json_path_field_mask(const char *names, uint64_t *mask)
+{
+	char *copy, *name, *save = NULL;
+	unsigned int i;
+	int ret = 0;
+
+	copy = strdup(names);
+	if (!copy)
+		return 1;
+	*mask = 0;
+	for (name = strtok_r(copy, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < ARRAY_SIZE(json_path_list_fields); i++)
+			if (!strcmp(name, json_path_list_fields[i].name))
+				break;
+		if (i == ARRAY_SIZE(json_path_list_fields)) {
+			condlog(2, "unknown path field \"%s\"", name);
+			ret = 1;
+			break;
+		}
+		*mask |= 1ULL << i;
+	}
+	free(copy);
+	return ret != 0 || *mask == 0;
+}
+
+int snprint_path_field(struct strbuf *buff, const struct path *pp,
+		       const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(json_path_list_fields); i++)
+		if (!strcmp(name, json_path_list_fields[i].name))
+			return json_path_list_fields[i].snprint(buff, pp);
+	return -ENOENT;
+}
+
 int snprint_multipath_map_json(struct strbuf *buff, const struct multipath * mpp)
 {
 	size_t initial_len = get_strbuf_len(buff);
@@ -1326,21 +1924,135 @@ int snprint_multipath_map_json(struct strbuf *buff, const struct multipath * mpp
 	return get_strbuf_len(buff) - initial_len;
 }
 
+/*
+ * Rough output sizes per map and path, used to preallocate the buffer
+ * for printing all maps at once
+ */
+#define MAP_TOPOLOGY_SIZE 256
+#define PATH_TOPOLOGY_SIZE 128
+#define MAP_JSON_SIZE 1024
+#define PATH_JSON_SIZE 512
+
+int reserve_topology_strbuf(struct strbuf *buff, const struct vectors *vecs,
+			    bool json)
+{
+	return reserve_strbuf(buff, json ?
+			      VECTOR_SIZE(vecs->mpvec) * MAP_JSON_SIZE +
+			      VECTOR_SIZE(vecs->pathvec) * PATH_JSON_SIZE :
+			      VECTOR_SIZE(vecs->mpvec) * MAP_TOPOLOGY_SIZE +
+			      VECTOR_SIZE(vecs->pathvec) * PATH_TOPOLOGY_SIZE);
+}
+
+int snprint_multipath_list_json (struct strbuf *buff,
+				 const struct _vector *mpvec)
+{
+	int i;
+	struct multipath * mpp;
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	if ((rc = snprint_json_header(buff)) < 0 ||
+	    (rc = snprint_json(buff, 1, PRINT_JSON_START_MAPS)) < 0)
+		return rc;
+
+	vector_foreach_slot(mpvec, mpp, i) {
+		if ((rc = snprint_multipath_fields_json(
+			     buff, mpp, i + 1 == VECTOR_SIZE(mpvec))) < 0)
+			return rc;
+	}
+
+	if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0 ||
+	    (rc = snprint_json(buff, 0, PRINT_JSON_END_LAST)) < 0)
+		return rc;
+
+	return get_strbuf_len(buff) - initial_len;
+}
+
 int snprint_multipath_topology_json (struct strbuf *buff,
 				     const struct vectors * vecs)
+{
+	int rc;
+
+	if ((rc = reserve_topology_strbuf(buff, vecs, true)) < 0)
+		return rc;
+	return snprint_multipath_list_json(buff, vecs->mpvec);
+}
+
+int snprint_paths_json (struct strbuf *buff, const struct _vector *paths,
+			uint64_t fields)
 {
 	int i;
-	struct multipath * mpp;
+	struct path * pp;
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	if ((rc = reserve_strbuf(buff, VECTOR_SIZE(paths) *
+				 PATH_JSON_SIZE)) < 0 ||
+	    (rc = snprint_json_header(buff)) < 0 ||
+	    (rc = snprint_json(buff, 1, PRINT_JSON_START_PATHS)) < 0)
+		return rc;
+
+	vector_foreach_slot(paths, pp, i) {
+		if ((rc = snprint_json(buff, 0, PRINT_JSON_START_ELEM)) < 0 ||
+		    (rc = snprint_path_list_fields_json(buff, pp, fields)) < 0 ||
+		    (rc = snprint_json_elem_footer(
+			    buff, 1, i + 1 == VECTOR_SIZE(paths))) < 0)
+			return rc;
+	}
+
+	if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0 ||
+	    (rc = snprint_json(buff, 0, PRINT_JSON_END_LAST)) < 0)
+		return rc;
+
+	return get_strbuf_len(buff) - initial_len;
+}
+
+unsigned int multipath_json_hash(const struct multipath *mpp)
+{
+	STRBUF_ON_STACK(buff);
+
+	if (snprint_multipath_fields_json(&buff, mpp, 1) < 0)
+		return 0;
+	return hash_str(get_strbuf_str(&buff));
+}
+
+int snprint_multipath_changes_json(struct strbuf *buff,
+				   const struct vectors *vecs,
+				   uint64_t since, uint64_t generation,
+				   bool complete, const struct _vector *removed)
+{
+	int i, last = -1;
+	struct multipath *mpp;
+	const char *wwid;
 	size_t initial_len = get_strbuf_len(buff);
 	int rc;
 
 	if ((rc = snprint_json_header(buff)) < 0 ||
+	    (rc = print_strbuf(buff, "   \"generation\": %" PRIu64 ",\n"
+			       "   \"complete\": %s,\n"
+			       "   \"removed\": [", generation,
+			       complete ? "true" : "false")) < 0)
+		return rc;
+
+	vector_foreach_slot(removed, wwid, i) {
+		if ((rc = print_strbuf(buff, "%s\"%s\"", i ? ", " : "",
+				       wwid)) < 0)
+			return rc;
+	}
+
+	if ((rc = append_strbuf_str(buff, "],\n")) < 0 ||
 	    (rc = snprint_json(buff, 1, PRINT_JSON_START_MAPS)) < 0)
 		return rc;
 
+	vector_foreach_slot(vecs->mpvec, mpp, i)
+		if (complete || mpp->generation > since)
+			last = i;
+
 	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if ((rc = snprint_multipath_fields_json(
-			     buff, mpp, i + 1 == VECTOR_SIZE(vecs->mpvec))) < 0)
+		if (!complete && mpp->generation <= since)
+			continue;
+		if ((rc = snprint_multipath_fields_json(buff, mpp,
+							i == last)) < 0)
 			return rc;
 	}
 
@@ -1369,7 +2081,8 @@ snprint_hwentry (const struct config *conf,
 		return rc;
 
 	iterate_sub_keywords(rootkw, kw, i) {
-		if ((rc = snprint_keyword(buff, "\t\t%k %v\n", kw, hwe)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t\t%k %v\n",
+					  kw, hwe)) < 0)
 			return rc;
 	}
 	if ((rc = append_strbuf_str(buff, "\t}\n")) < 0)
@@ -1422,7 +2135,8 @@ snprint_mpentry (const struct config *conf, struct strbuf *buff,
 		return rc;
 
 	iterate_sub_keywords(rootkw, kw, i) {
-		if ((rc = snprint_keyword(buff, "\t\t%k %v\n", kw, mpe)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t\t%k %v\n",
+					  kw, mpe)) < 0)
 			return rc;
 	}
 	/*
@@ -1460,7 +2174,7 @@ static int snprint_mptable(const struct config *conf, struct strbuf *buff,
 		struct multipath *mpp;
 
 		vector_foreach_slot(mpvec, mpp, i) {
-			if (find_mpe(conf->mptable, mpp->wwid) != NULL)
+			if (find_mpe_by_wwid(conf, mpp->wwid) != NULL)
 				continue;
 
 			if ((rc = print_strbuf(buff,
@@ -1502,7 +2216,8 @@ static int snprint_overrides(const struct config *conf, struct strbuf *buff,
 		goto out;
 
 	iterate_sub_keywords(rootkw, kw, i) {
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, NULL)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, NULL)) < 0)
 			return rc;
 	}
 out:
@@ -1525,7 +2240,8 @@ static int snprint_defaults(const struct config *conf, struct strbuf *buff)
 		return rc;
 
 	iterate_sub_keywords(rootkw, kw, i) {
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, NULL)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, NULL)) < 0)
 			return rc;
 	}
 	if ((rc = append_strbuf_str(buff, "}\n")) < 0)
@@ -1653,25 +2369,29 @@ static int snprint_blacklist(const struct config *conf, struct strbuf *buff)
 	vector_foreach_slot (conf->blist_devnode, ble, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "devnode");
 		assert(kw);
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ble)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, ble)) < 0)
 			return rc;
 	}
 	vector_foreach_slot (conf->blist_wwid, ble, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "wwid");
 		assert(kw);
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ble)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, ble)) < 0)
 			return rc;
 	}
 	vector_foreach_slot (conf->blist_property, ble, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "property");
 		assert(kw);
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ble)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, ble)) < 0)
 			return rc;
 	}
 	vector_foreach_slot (conf->blist_protocol, ble, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "protocol");
 		assert(kw);
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ble)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, ble)) < 0)
 			return rc;
 	}
 
@@ -1682,11 +2402,12 @@ static int snprint_blacklist(const struct config *conf, struct strbuf *buff)
 	assert(kw && pkw);
 
 	vector_foreach_slot (conf->blist_device, bled, i) {
-		if ((rc = snprint_keyword(buff, "\tdevice {\n\t\t%k %v\n",
+		if ((rc = snprint_keyword(conf, buff,
+					  "\tdevice {\n\t\t%k %v\n",
 					  kw, bled)) < 0)
 			return rc;
-		if ((rc = snprint_keyword(buff, "\t\t%k %v\n\t}\n",
-					  pkw, bled)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t\t%k %v\n\t}\n",
+				  pkw, bled)) < 0)
 			return rc;
 	}
 
@@ -1714,25 +2435,29 @@ static int snprint_blacklist_except(const struct config *conf,
 	vector_foreach_slot (conf->elist_devnode, ele, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "devnode");
 		assert(kw);
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ele)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, ele)) < 0)
 			return rc;
 	}
 	vector_foreach_slot (conf->elist_wwid, ele, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "wwid");
 		assert(kw);
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ele)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, ele)) < 0)
 			return rc;
 	}
 	vector_foreach_slot (conf->elist_property, ele, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "property");
 		assert(kw);
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ele)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, ele)) < 0)
 			return rc;
 	}
 	vector_foreach_slot (conf->elist_protocol, ele, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "protocol");
 		assert(kw);
-		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ele)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t%k %v\n",
+					  kw, ele)) < 0)
 			return rc;
 	}
 
@@ -1743,11 +2468,12 @@ static int snprint_blacklist_except(const struct config *conf,
 	assert(kw && pkw);
 
 	vector_foreach_slot (conf->elist_device, eled, i) {
-		if ((rc = snprint_keyword(buff, "\tdevice {\n\t\t%k %v\n",
+		if ((rc = snprint_keyword(conf, buff,
+					  "\tdevice {\n\t\t%k %v\n",
 					  kw, eled)) < 0)
 			return rc;
-		if ((rc = snprint_keyword(buff, "\t\t%k %v\n\t}\n",
-					  pkw, eled)) < 0)
+		if ((rc = snprint_keyword(conf, buff, "\t\t%k %v\n\t}\n",
+				  pkw, eled)) < 0)
 			return rc;
 	}
 
@@ -1756,6 +2482,11 @@ static int snprint_blacklist_except(const struct config *conf,
 	return get_strbuf_len(buff) - initial_len;
 }
 
+/* Rough output sizes of the config sections */
+#define DEFAULTS_CONFIG_SIZE 4096
+#define HWENTRY_CONFIG_SIZE 256
+#define MPENTRY_CONFIG_SIZE 256
+
 char *snprint_config(const struct config *conf, int *len,
 		     const struct _vector *hwtable, const struct _vector *mpvec)
 {
@@ -1763,7 +2494,12 @@ char *snprint_config(const struct config *conf, int *len,
 	char *reply;
 	int rc;
 
-	if ((rc = snprint_defaults(conf, &buff)) < 0 ||
+	if ((rc = reserve_strbuf(&buff, DEFAULTS_CONFIG_SIZE +
+				 VECTOR_SIZE(hwtable ? hwtable : conf->hwtable) *
+				 HWENTRY_CONFIG_SIZE +
+				 (VECTOR_SIZE(conf->mptable) +
+				  VECTOR_SIZE(mpvec)) * MPENTRY_CONFIG_SIZE)) < 0 ||
+	    (rc = snprint_defaults(conf, &buff)) < 0 ||
 	    (rc = snprint_blacklist(conf, &buff)) < 0 ||
 	    (rc = snprint_blacklist_except(conf, &buff)) < 0 ||
 	    (rc = snprint_hwtable(conf, &buff,
@@ -1782,32 +2518,87 @@ char *snprint_config(const struct config *conf, int *len,
 	return reply;
 }
 
-int snprint_status(struct strbuf *buff, const struct vectors *vecs)
+static int snprint_section(const struct config *conf, struct strbuf *buff,
+			   int section)
+{
+	switch (section) {
+	case CONF_SECT_DEFAULTS:
+		return snprint_defaults(conf, buff);
+	case CONF_SECT_BLACKLIST:
+		return snprint_blacklist(conf, buff);
+	case CONF_SECT_BLACKLIST_EXCEPT:
+		return snprint_blacklist_except(conf, buff);
+	case CONF_SECT_DEVICES:
+		return snprint_hwtable(conf, buff, conf->hwtable);
+	case CONF_SECT_OVERRIDES:
+		return snprint_overrides(conf, buff, conf->overrides);
+	case CONF_SECT_MULTIPATHS:
+		return snprint_mptable(conf, buff, NULL);
+	default:
+		return -EINVAL;
+	}
+}
+
+static bool strbuf_equal(const struct strbuf *a, const struct strbuf *b)
+{
+	return get_strbuf_len(a) == get_strbuf_len(b) &&
+		(get_strbuf_len(a) == 0 ||
+		 !strcmp(get_strbuf_str(a), get_strbuf_str(b)));
+}
+
+int config_changed_sections(const struct config *old,
+			    const struct config *new)
+{
+	STRBUF_ON_STACK(obuf);
+	STRBUF_ON_STACK(nbuf);
+	int section, changed = 0;
+
+	for (section = CONF_SECT_DEFAULTS; section & CONF_SECT_ALL;
+	     section <<= 1) {
+		reset_strbuf(&obuf);
+		reset_strbuf(&nbuf);
+		if (snprint_section(old, &obuf, section) < 0 ||
+		    snprint_section(new, &nbuf, section) < 0)
+			return CONF_SECT_ALL;
+		if (!strbuf_equal(&obuf, &nbuf))
+			changed |= section;
+	}
+	return changed;
+}
+
+int mpentry_changed(const struct config *old_conf, const struct mpentry *old,
+		    const struct config *new_conf, const struct mpentry *new)
+{
+	STRBUF_ON_STACK(obuf);
+	STRBUF_ON_STACK(nbuf);
+
+	if (!old || !new)
+		return old != new;
+	if (snprint_mpentry(old_conf, &obuf, old, NULL) < 0 ||
+	    snprint_mpentry(new_conf, &nbuf, new, NULL) < 0)
+		return 1;
+	return !strbuf_equal(&obuf, &nbuf);
+}
+
+int snprint_status(struct strbuf *buff)
 {
 	int i, rc;
-	unsigned int count[PATH_MAX_STATE] = {0};
-	int monitored_count = 0;
-	struct path * pp;
+	struct path_totals pt;
 	size_t initial_len = get_strbuf_len(buff);
 
-	vector_foreach_slot (vecs->pathvec, pp, i) {
-		count[pp->state]++;
-	}
+	get_path_totals(&pt);
 	if ((rc = append_strbuf_str(buff, "path checker states:\n")) < 0)
 		return rc;
 	for (i = 0; i < PATH_MAX_STATE; i++) {
-		if (!count[i])
+		if (!pt.nr[i])
 			continue;
 		if ((rc = print_strbuf(buff, "%-20s%u\n",
-				       checker_state_name(i), count[i])) < 0)
+				       checker_state_name(i), pt.nr[i])) < 0)
 			return rc;
 	}
 
-	vector_foreach_slot(vecs->pathvec, pp, i)
-		if (pp->fd >= 0)
-			monitored_count++;
-	if ((rc = print_strbuf(buff, "\npaths: %d\nbusy: %s\n",
-			       monitored_count,
+	if ((rc = print_strbuf(buff, "\npaths: %u\nbusy: %s\n",
+			       pt.monitored,
 			       is_uevent_busy()? "True" : "False")) < 0)
 		return rc;
 
@@ -1893,6 +2684,8 @@ static void print_all_paths_custo(vector pathvec, int banner, const char *fmt)
 {
 	int i;
 	struct path * pp;
+	struct print_fmt *pf;
+	fieldwidth_t *width;
 	STRBUF_ON_STACK(line);
 
 	if (!VECTOR_SIZE(pathvec)) {
@@ -1904,11 +2697,19 @@ static void print_all_paths_custo(vector pathvec, int banner, const char *fmt)
 	if (banner)
 		append_strbuf_str(&line, "===== paths list =====\n");
 
-	get_path_layout(pathvec, 1);
-	snprint_path_header(&line, fmt);
+	width = alloc_path_layout();
+	get_path_layout_fmt(pathvec, 1, fmt, width);
+	snprint_path_header(&line, fmt, width);
 
-	vector_foreach_slot (pathvec, pp, i)
-		snprint_path(&line, fmt, pp, 1);
+	pf = compile_path_fmt(fmt);
+	vector_foreach_slot (pathvec, pp, i) {
+		if (pf)
+			snprint_path_fmt(&line, pf, pp, width);
+		else
+			snprint_path(&line, fmt, pp, width);
+	}
+	free_print_fmt(pf);
+	free(width);
 
 	printf("%s", get_strbuf_str(&line));
 }
@@ -6,27 +6,26 @@
 #define PRINT_MAP_STATUS     "%n %F %Q %N %t %r"
 #define PRINT_MAP_STATS      "%n %0 %1 %2 %3 %4"
 #define PRINT_MAP_NAMES      "%n %d %w"
+/* Path format used in topology output */
+#define PRINT_PATH_INDENT    "%i %d %D %t %T %o"
 
 struct strbuf;
 
 struct path_data {
 	char wildcard;
 	char * header;
-	unsigned int width;
 	int (*snprint)(struct strbuf *, const struct path * pp);
 };
 
 struct multipath_data {
 	char wildcard;
 	char * header;
-	unsigned int width;
 	int (*snprint)(struct strbuf *, const struct multipath * mpp);
 };
 
 struct pathgroup_data {
 	char wildcard;
 	char * header;
-	unsigned int width;
 	int (*snprint)(struct strbuf *, const struct pathgroup * pgp);
 };
 
@@ -36,31 +35,132 @@ enum layout_reset {
 	LAYOUT_RESET_HEADER,
 };
 
-void _get_path_layout (const struct _vector *gpvec, enum layout_reset);
-void get_path_layout (vector pathvec, int header);
-void _get_multipath_layout (const struct _vector *gmvec, enum layout_reset);
-void get_multipath_layout (vector mpvec, int header);
-int snprint_path_header(struct strbuf *, const char *);
-int snprint_multipath_header(struct strbuf *, const char *);
-int _snprint_path (const struct gen_path *, struct strbuf *, const char *, int);
-#define snprint_path(buf, fmt, pp, v) \
-	_snprint_path(dm_path_to_gen(pp), buf, fmt,  v)
+/*
+ * The caller owns the fieldwidth_t array, so that concurrent printers
+ * don't share any state. Free it with free().
+ */
+fieldwidth_t *alloc_path_layout(void);
+fieldwidth_t *alloc_multipath_layout(void);
+/*
+ * Calculate the column widths for printing the given paths or maps with
+ * padding. Every wildcard function is called once per object and column,
+ * which may access sysfs. The *_fmt() variants only calculate the widths
+ * of the columns used in fmt; the widths of the other columns are reset.
+ * A NULL fmt selects all columns. A NULL width is ignored.
+ */
+void __get_path_layout (const struct _vector *gpvec, enum layout_reset,
+			const char *fmt, fieldwidth_t *width);
+#define _get_path_layout(gpvec, reset, width) \
+	__get_path_layout(gpvec, reset, NULL, width)
+void get_path_layout (vector pathvec, int header, fieldwidth_t *width);
+void get_path_layout_fmt (vector pathvec, int header, const char *fmt,
+			  fieldwidth_t *width);
+void __get_multipath_layout (const struct _vector *gmvec, enum layout_reset,
+			     const char *fmt, fieldwidth_t *width);
+#define _get_multipath_layout(gmvec, reset, width) \
+	__get_multipath_layout(gmvec, reset, NULL, width)
+void get_multipath_layout (vector mpvec, int header, fieldwidth_t *width);
+void get_multipath_layout_fmt (vector mpvec, int header, const char *fmt,
+			       fieldwidth_t *width);
+/* The printing functions don't pad if width is NULL */
+int snprint_path_header(struct strbuf *, const char *,
+			const fieldwidth_t *width);
+int snprint_multipath_header(struct strbuf *, const char *,
+			     const fieldwidth_t *width);
+int _snprint_path (const struct gen_path *, struct strbuf *, const char *,
+		   const fieldwidth_t *width);
+#define snprint_path(buf, fmt, pp, w) \
+	_snprint_path(dm_path_to_gen(pp), buf, fmt, w)
+/* The state changes in pp->history, oldest first */
+int snprint_path_history(struct strbuf *, const struct path *pp);
 int _snprint_multipath (const struct gen_multipath *, struct strbuf *,
-			const char *, int);
-#define snprint_multipath(buf, fmt, mp, v)				\
-	_snprint_multipath(dm_multipath_to_gen(mp), buf, fmt,  v)
+			const char *, const fieldwidth_t *width);
+#define snprint_multipath(buf, fmt, mp, w)				\
+	_snprint_multipath(dm_multipath_to_gen(mp), buf, fmt, w)
+
+/*
+ * Compiled format strings, for printing many paths or maps with the same
+ * format. The output is the same as with snprint_path() and
+ * snprint_multipath(), respectively. The compile functions return NULL
+ * on allocation failure.
+ */
+struct print_fmt;
+struct print_fmt *compile_path_fmt(const char *format);
+struct print_fmt *compile_multipath_fmt(const char *format);
+void free_print_fmt(struct print_fmt *pf);
+int snprint_path_fmt(struct strbuf *, const struct print_fmt *,
+		     const struct path *, const fieldwidth_t *width);
+int snprint_multipath_fmt(struct strbuf *, const struct print_fmt *,
+			  const struct multipath *, const fieldwidth_t *width);
+/* p_width is the path layout for PRINT_PATH_INDENT */
 int _snprint_multipath_topology (const struct gen_multipath *, struct strbuf *,
-				 int verbosity);
-#define snprint_multipath_topology(buf, mpp, v) \
-	_snprint_multipath_topology (dm_multipath_to_gen(mpp), buf, v)
+				 int verbosity, const fieldwidth_t *p_width);
+#define snprint_multipath_topology(buf, mpp, v, w) \
+	_snprint_multipath_topology (dm_multipath_to_gen(mpp), buf, v, w)
+int reserve_topology_strbuf(struct strbuf *buff, const struct vectors *vecs,
+			    bool json);
 int snprint_multipath_topology_json(struct strbuf *, const struct vectors *vecs);
+/* Like snprint_multipath_topology_json(), for the maps in mpvec */
+int snprint_multipath_list_json(struct strbuf *, const struct _vector *mpvec);
+/* All fields of "show paths json" */
+#define JSON_PATH_FIELDS_ALL (~0ULL)
+/*
+ * Set mask to the fields of "show paths json" in the comma separated
+ * list names. Returns 1 if a field is unknown or the list is empty.
+ */
+int json_path_field_mask(const char *names, uint64_t *mask);
+/*
+ * Print the value of the "show paths json" field name of pp, without
+ * quotes. Returns -ENOENT if there is no such field.
+ */
+int snprint_path_field(struct strbuf *, const struct path *pp,
+		       const char *name);
+/* Print the paths in the paths vector, with the fields in the mask */
+int snprint_paths_json(struct strbuf *, const struct _vector *paths,
+		       uint64_t fields);
 char *snprint_config(const struct config *conf, int *len,
 		     const struct _vector *hwtable,
 		     const struct _vector *mpvec);
+
+/* multipath.conf sections, for config_changed_sections() */
+enum {
+	CONF_SECT_DEFAULTS		= (1 << 0),
+	CONF_SECT_BLACKLIST		= (1 << 1),
+	CONF_SECT_BLACKLIST_EXCEPT	= (1 << 2),
+	CONF_SECT_DEVICES		= (1 << 3),
+	CONF_SECT_OVERRIDES		= (1 << 4),
+	CONF_SECT_MULTIPATHS		= (1 << 5),
+	CONF_SECT_ALL			= (1 << 6) - 1,
+};
+
+/*
+ * Compare two configurations section by section, using the same output
+ * as "show config". Returns the mask of CONF_SECT_* values of the
+ * sections that differ, or CONF_SECT_ALL if printing failed.
+ */
+int config_changed_sections(const struct config *old,
+			    const struct config *new);
+/*
+ * Returns 0 if two multipaths entries (either of which may be NULL)
+ * are equal, and 1 otherwise.
+ */
+int mpentry_changed(const struct config *old_conf, const struct mpentry *old,
+		    const struct config *new_conf, const struct mpentry *new);
 int snprint_multipath_map_json(struct strbuf *, const struct multipath *mpp);
+/* Hash of the JSON output for a map, used for detecting changes */
+unsigned int multipath_json_hash(const struct multipath *mpp);
+/*
+ * Print the maps with a generation greater than since (all maps if
+ * complete is set), along with the current generation and the WWIDs of
+ * the removed maps in the removed vector.
+ */
+int snprint_multipath_changes_json(struct strbuf *buff,
+				   const struct vectors *vecs,
+				   uint64_t since, uint64_t generation,
+				   bool complete, const struct _vector *removed);
 int snprint_blacklist_report(struct config *, struct strbuf *);
 int snprint_wildcards(struct strbuf *);
-int snprint_status(struct strbuf *, const struct vectors *);
+int snprint_status(struct strbuf *);
 int snprint_devices(struct config *, struct strbuf *, const struct vectors *);
 int snprint_path_serial(struct strbuf *, const struct path *);
 int snprint_host_wwnn(struct strbuf *, const struct path *);
@@ -70,6 +170,7 @@ int snprint_tgt_wwpn(struct strbuf *, const struct path *);
 #define PROTOCOL_BUF_SIZE sizeof("scsi:unspec")
 int snprint_path_protocol(struct strbuf *, const struct path *);
 
+/* The paths are aligned with the other paths of the map only */
 void _print_multipath_topology (const struct gen_multipath * gmp,
 				int verbosity);
 #define print_multipath_topology(mpp, v) \
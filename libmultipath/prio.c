@@ -1,14 +1,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <dlfcn.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include "debug.h"
 #include "util.h"
 #include "prio.h"
 
 static LIST_HEAD(prioritizers);
+/* Protects prioritizers and their refcounts in prio_get() and prio_put() */
+static pthread_mutex_t prio_lock = PTHREAD_MUTEX_INITIALIZER;
 
 unsigned int get_prio_timeout(unsigned int timeout_ms,
 			      unsigned int default_timeout)
@@ -104,6 +108,43 @@ static struct prio * prio_lookup (char * name)
 	return NULL;
 }
 
+#ifdef STATIC_PLUGINS
+/*
+ * Prioritizers built into libmultipath, see libmultipath/Makefile.
+ * STATIC_PRIOS expands to STATIC_PRIO(name) for each of them.
+ */
+#ifndef STATIC_PRIOS
+#define STATIC_PRIOS
+#endif
+
+#define STATIC_PRIO(n)							\
+	int libprio_##n##_getprio(struct path *, char *, unsigned int);
+STATIC_PRIOS
+#undef STATIC_PRIO
+
+static const struct static_prio {
+	const char *name;
+	int (*getprio)(struct path *, char *, unsigned int);
+} static_prios[] = {
+#define STATIC_PRIO(n) { #n, libprio_##n##_getprio },
+	STATIC_PRIOS
+#undef STATIC_PRIO
+};
+
+static bool find_static_prio(struct prio *p)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(static_prios); i++) {
+		if (!strcmp(static_prios[i].name, p->name)) {
+			p->getprio = static_prios[i].getprio;
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
 int prio_set_args (struct prio * p, const char * args)
 {
 	return snprintf(p->args, PRIO_ARGS_LEN, "%s", args);
@@ -120,6 +161,12 @@ struct prio * add_prio (const char *multipath_dir, const char * name)
 	if (!p)
 		return NULL;
 	snprintf(p->name, PRIO_NAME_LEN, "%s", name);
+#ifdef STATIC_PLUGINS
+	if (find_static_prio(p)) {
+		condlog(3, "using built-in %s prioritizer", name);
+		goto done;
+	}
+#endif
 	snprintf(libname, LIB_PRIO_NAMELEN, "%s/libprio%s.so",
 		 multipath_dir, name);
 	if (stat(libname,&stbuf) < 0) {
@@ -141,6 +188,9 @@ struct prio * add_prio (const char *multipath_dir, const char * name)
 		condlog(0, "A dynamic linking error occurred: (%s)", errstr);
 	if (!p->getprio)
 		goto out;
+#ifdef STATIC_PLUGINS
+done:
+#endif
 	list_add(&p->node, &prioritizers);
 	return p;
 out:
@@ -177,12 +227,14 @@ void prio_get (char *multipath_dir, struct prio * dst, char * name, char * args)
 	if (!dst)
 		return;
 
+	pthread_mutex_lock(&prio_lock);
 	if (name && strlen(name)) {
 		src = prio_lookup(name);
 		if (!src)
 			src = add_prio(multipath_dir, name);
 	}
 	if (!src) {
+		pthread_mutex_unlock(&prio_lock);
 		dst->getprio = NULL;
 		return;
 	}
@@ -194,6 +246,25 @@ void prio_get (char *multipath_dir, struct prio * dst, char * name, char * args)
 	dst->handle = NULL;
 
 	src->refcount++;
+	pthread_mutex_unlock(&prio_lock);
+}
+
+void prio_dup (struct prio * dst, const struct prio * src)
+{
+	struct prio * p;
+
+	memcpy(dst, src, sizeof(*dst));
+	INIT_LIST_HEAD(&dst->node);
+	if (!src->getprio)
+		return;
+
+	pthread_mutex_lock(&prio_lock);
+	p = prio_lookup(dst->name);
+	if (p)
+		p->refcount++;
+	else
+		dst->getprio = NULL;
+	pthread_mutex_unlock(&prio_lock);
 }
 
 void prio_put (struct prio * dst)
@@ -203,7 +274,9 @@ void prio_put (struct prio * dst)
 	if (!dst || !dst->getprio)
 		return;
 
+	pthread_mutex_lock(&prio_lock);
 	src = prio_lookup(dst->name);
 	memset(dst, 0x0, sizeof(struct prio));
 	free_prio(src);
+	pthread_mutex_unlock(&prio_lock);
 }
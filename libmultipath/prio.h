@@ -61,6 +61,8 @@ struct prio * add_prio (const char *, const char *);
 int prio_getprio (struct prio *, struct path *, unsigned int);
 void prio_get (char *, struct prio *, char *, char *);
 void prio_put (struct prio *);
+/* Copy a selected prio, taking another reference on its prioritizer */
+void prio_dup (struct prio *dst, const struct prio *src);
 int prio_selected (const struct prio *);
 const char * prio_name (const struct prio *);
 const char * prio_args (const struct prio *);
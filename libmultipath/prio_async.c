@@ -0,0 +1,281 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libudev.h>
+#include <urcu.h>
+
+#include "debug.h"
+#include "list.h"
+#include "util.h"
+#include "time-util.h"
+#include "structs.h"
+#include "config.h"
+#include "sysfs.h"
+#include "prio.h"
+#include "thread_settings.h"
+#include "prio_async.h"
+
+#define PRIO_MAX_WORKERS 16
+#define PRIO_IDLE_SECS 60
+
+struct prio_req {
+	struct list_head node; /* in prio_pool.queue until started */
+	/* Private copy of the path the prioritizer runs on */
+	struct path pp;
+	unsigned int timeout;
+	int prio;
+	bool done;
+	int refcount;
+};
+
+/* Below fields are protected by lock */
+static struct prio_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* signalled when a request is queued */
+	pthread_cond_t done; /* broadcast when a request is completed */
+	struct list_head queue;
+	int nr_queued;
+	int workers;
+	int idle;
+} prio_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.queue = LIST_HEAD_INIT(prio_pool.queue),
+};
+static pthread_once_t prio_pool_once = PTHREAD_ONCE_INIT;
+
+static void init_prio_pool(void)
+{
+	pthread_cond_init_mono(&prio_pool.work);
+	pthread_cond_init_mono(&prio_pool.done);
+}
+
+static void free_req(struct prio_req *req)
+{
+	if (req->pp.fd >= 0)
+		close(req->pp.fd);
+	if (req->pp.udev)
+		udev_device_unref(req->pp.udev);
+	prio_put(&req->pp.prio);
+	put_path_ident(req->pp.ident);
+	free(req);
+}
+
+/* Called with prio_pool.lock held. Returns true if req must be freed */
+static bool put_req(struct prio_req *req)
+{
+	return --req->refcount == 0;
+}
+
+static struct prio_req *alloc_req(const struct path *pp, unsigned int timeout)
+{
+	struct prio_req *req;
+	const char *syspath;
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return NULL;
+	memcpy(&req->pp, pp, sizeof(req->pp));
+	/* Don't share anything the path owns with the worker */
+	req->pp.vpd_data = NULL;
+	req->pp.uid_attribute = NULL;
+	req->pp.getuid = NULL;
+	memset(&req->pp.checker, 0, sizeof(req->pp.checker));
+	req->pp.mpp = NULL;
+	req->pp.hwe = NULL;
+	req->pp.prio_req = NULL;
+	sysfs_attr_fd_init(&req->pp.state_attr);
+	path_health_init(&req->pp.health);
+	req->pp.sched_node.next = req->pp.sched_node.prev = NULL;
+	req->pp.fast_node.next = req->pp.fast_node.prev = NULL;
+	req->pp.pending_node.next = req->pp.pending_node.prev = NULL;
+	prio_dup(&req->pp.prio, &pp->prio);
+
+	req->pp.ident = get_path_ident(pp->ident);
+
+	req->pp.udev = NULL;
+	syspath = pp->udev ? udev_device_get_syspath(pp->udev) : NULL;
+	if (syspath)
+		req->pp.udev = udev_device_new_from_syspath(udev, syspath);
+	req->pp.fd = fcntl(pp->fd, F_DUPFD_CLOEXEC, 0);
+	if (req->pp.fd == -1 || (syspath && !req->pp.udev) ||
+	    (pp->ident && !req->pp.ident)) {
+		free_req(req);
+		return NULL;
+	}
+	INIT_LIST_HEAD(&req->node);
+	req->timeout = timeout;
+	req->prio = PRIO_UNDEF;
+	req->done = false;
+	/* One reference for the queue / worker, one for the path */
+	req->refcount = 2;
+	return req;
+}
+
+static void *prio_worker(void *arg __attribute__((unused)))
+{
+	struct prio_req *req;
+	struct timespec ts;
+	int prio, r;
+	bool last;
+
+	rcu_register_thread();
+	pthread_mutex_lock(&prio_pool.lock);
+	for (;;) {
+		r = 0;
+		prio_pool.idle++;
+		get_monotonic_time(&ts);
+		ts.tv_sec += PRIO_IDLE_SECS;
+		while (list_empty(&prio_pool.queue) && r != ETIMEDOUT)
+			r = pthread_cond_timedwait(&prio_pool.work,
+						   &prio_pool.lock, &ts);
+		prio_pool.idle--;
+		if (list_empty(&prio_pool.queue))
+			break;
+
+		req = list_entry(prio_pool.queue.next, struct prio_req, node);
+		list_del_init(&req->node);
+		prio_pool.nr_queued--;
+		pthread_mutex_unlock(&prio_pool.lock);
+
+		prio = prio_getprio(&req->pp.prio, &req->pp, req->timeout);
+		condlog(4, "%s: async %s prio = %d", req->pp.dev,
+			prio_name(&req->pp.prio), prio);
+
+		pthread_mutex_lock(&prio_pool.lock);
+		req->prio = prio;
+		req->done = true;
+		last = put_req(req);
+		pthread_cond_broadcast(&prio_pool.done);
+		if (last) {
+			pthread_mutex_unlock(&prio_pool.lock);
+			free_req(req);
+			pthread_mutex_lock(&prio_pool.lock);
+		}
+	}
+	prio_pool.workers--;
+	count_thread(THREAD_PRIO, -1);
+	pthread_mutex_unlock(&prio_pool.lock);
+	rcu_unregister_thread();
+	return NULL;
+}
+
+/* Called with prio_pool.lock held */
+static void start_prio_worker(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	setup_thread_attr_for(&attr, THREAD_PRIO, 1);
+	if (pthread_create(&thread, &attr, prio_worker, NULL) == 0) {
+		prio_pool.workers++;
+		count_thread(THREAD_PRIO, 1);
+	} else
+		condlog(2, "failed to start prioritizer worker: %m");
+	pthread_attr_destroy(&attr);
+}
+
+/* Returns 0 if the request was queued, -1 otherwise */
+static int submit_req(struct prio_req *req)
+{
+	pthread_mutex_lock(&prio_pool.lock);
+	if (prio_pool.nr_queued >= prio_pool.idle &&
+	    prio_pool.workers < PRIO_MAX_WORKERS)
+		start_prio_worker();
+	if (prio_pool.workers == 0) {
+		pthread_mutex_unlock(&prio_pool.lock);
+		return -1;
+	}
+	list_add_tail(&req->node, &prio_pool.queue);
+	prio_pool.nr_queued++;
+	pthread_cond_signal(&prio_pool.work);
+	pthread_mutex_unlock(&prio_pool.lock);
+	return 0;
+}
+
+/*
+ * Take the result of the path's request if it's done, waiting until
+ * deadline if it's not NULL. Returns 0 if the result was collected.
+ */
+static int collect_req(struct path *pp, int *prio,
+		       const struct timespec *deadline)
+{
+	struct prio_req *req = pp->prio_req;
+	bool last = false;
+	int r = 0;
+
+	pthread_mutex_lock(&prio_pool.lock);
+	while (!req->done && deadline && r != ETIMEDOUT)
+		r = pthread_cond_timedwait(&prio_pool.done, &prio_pool.lock,
+					   deadline);
+	if (req->done) {
+		*prio = req->prio;
+		/* Set by the path_latency prioritizer */
+		pp->latency_p50 = req->pp.latency_p50;
+		pp->latency_p99 = req->pp.latency_p99;
+		last = put_req(req);
+		pp->prio_req = NULL;
+	}
+	pthread_mutex_unlock(&prio_pool.lock);
+	if (last)
+		free_req(req);
+	return pp->prio_req ? 1 : 0;
+}
+
+int prio_getprio_async(struct path *pp, unsigned int timeout, int *prio)
+{
+	struct prio_req *req;
+	struct timespec deadline;
+
+	if (pp->prio_req) {
+		if (collect_req(pp, prio, NULL) == 0)
+			return 0;
+		condlog(3, "%s: %s prioritizer still running", pp->dev,
+			prio_name(&pp->prio));
+		return 1;
+	}
+
+	pthread_once(&prio_pool_once, init_prio_pool);
+	req = alloc_req(pp, timeout);
+	if (!req || submit_req(req) != 0) {
+		if (req)
+			free_req(req);
+		condlog(3, "%s: failed to start async prioritizer, using sync mode",
+			pp->dev);
+		*prio = prio_getprio(&pp->prio, pp, timeout);
+		return 0;
+	}
+	pp->prio_req = req;
+
+	get_monotonic_time(&deadline);
+	deadline.tv_nsec += 1000 * 1000; /* 1 millisecond */
+	normalize_timespec(&deadline);
+	return collect_req(pp, prio, &deadline);
+}
+
+void prio_async_release(struct path *pp)
+{
+	struct prio_req *req = pp->prio_req;
+	bool last;
+
+	if (!req)
+		return;
+	pp->prio_req = NULL;
+	pthread_mutex_lock(&prio_pool.lock);
+	if (!list_empty(&req->node)) {
+		/* Never started */
+		list_del_init(&req->node);
+		prio_pool.nr_queued--;
+		put_req(req);
+	}
+	last = put_req(req);
+	pthread_mutex_unlock(&prio_pool.lock);
+	if (last)
+		free_req(req);
+}
@@ -0,0 +1,28 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _PRIO_ASYNC_H
+#define _PRIO_ASYNC_H
+
+struct path;
+
+/*
+ * Asynchronous prioritizer runs, for "async_prio yes".
+ *
+ * prio_getprio_async() runs the prioritizer of a path in a worker thread,
+ * on a private copy of the path with its own fd and udev device, so that
+ * a slow prioritizer doesn't block the caller. If the run completes
+ * within a millisecond, the result is returned right away. Otherwise it
+ * is collected by a later call for the same path, which doesn't start a
+ * new run. The worker pool grows on demand.
+ *
+ * Returns 0 and sets *prio to the prioritizer's return value if a result
+ * is available, or 1 if a run is still in progress. Must be called with
+ * the lock protecting the path held.
+ */
+int prio_getprio_async(struct path *pp, unsigned int timeout, int *prio);
+
+/* Drop the outstanding run of a path, if any; called from free_path() */
+void prio_async_release(struct path *pp);
+
+#endif /* _PRIO_ASYNC_H */
@@ -78,7 +78,7 @@ get_alua_info(struct path * pp, unsigned int timeout)
 	return rc;
 }
 
-int get_exclusive_pref_arg(char *args)
+static int get_exclusive_pref_arg(char *args)
 {
 	char *ptr;
 
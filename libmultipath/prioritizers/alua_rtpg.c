@@ -29,6 +29,7 @@
 #include "../discovery.h"
 #include "../unaligned.h"
 #include "../debug.h"
+#include "../lun_cache.h"
 #include "alua_rtpg.h"
 
 #define SENSE_BUFF_LEN  32
@@ -365,6 +366,29 @@ retry:
 	return 0;
 }
 
+/*
+ * The RTPG response describes all target port groups of a LUN, so it's
+ * the same for every path of the LUN, and is shared through the LUN
+ * cache. Responses reporting a port group in transitioning state aren't
+ * shared, as they are about to change.
+ */
+#define RTPG_QUERY LUN_QUERY(OPERATION_CODE_RTPG, 0x0a)
+
+static void
+rtpg_cache_put(const char *wwid, unsigned char *buf, unsigned int len)
+{
+	struct rtpg_data *tpgd = (struct rtpg_data *)buf;
+	struct rtpg_tpg_dscr *dscr;
+
+	if (len < 4 || get_unaligned_be32(&buf[0]) + 4 > len)
+		return;
+	RTPG_FOR_EACH_PORT_GROUP(tpgd, dscr) {
+		if ((rtpg_tpg_dscr_get_aas(dscr) & 0x0f) == AAS_TRANSITIONING)
+			return;
+	}
+	lun_cache_put(wwid, RTPG_QUERY, buf, len);
+}
+
 int
 get_asymmetric_access_state(const struct path *pp, unsigned int tpg,
 			    unsigned int timeout)
@@ -385,6 +409,11 @@ get_asymmetric_access_state(const struct path *pp, unsigned int tpg,
 		return -RTPG_RTPG_FAILED;
 	}
 	memset(buf, 0, buflen);
+	if (lun_cache_get(pp->wwid, RTPG_QUERY, buf, buflen,
+			  LUN_CACHE_TTL_MS) > 0) {
+		condlog(4, "%s: RTPG data from cache", pp->dev);
+		goto parse;
+	}
 	rc = do_rtpg(fd, buf, buflen, timeout);
 	if (rc < 0) {
 		PRINT_DEBUG("%s: do_rtpg returned %d", __func__, rc);
@@ -407,7 +436,10 @@ get_asymmetric_access_state(const struct path *pp, unsigned int tpg,
 		if (rc < 0)
 			goto out;
 	}
+	rtpg_cache_put(pp->wwid, buf,
+		       scsi_buflen < buflen ? scsi_buflen : buflen);
 
+parse:
 	tpgd = (struct rtpg_data *) buf;
 	rc   = -RTPG_TPG_NOT_FOUND;
 	RTPG_FOR_EACH_PORT_GROUP(tpgd, dscr) {
@@ -13,6 +13,9 @@
  * This file is released under the GPL version 2, or any later version.
  */
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -24,6 +27,7 @@
 #include "prio.h"
 #include "util.h"
 #include "structs.h"
+#include "time-util.h"
 
 enum {
 	ANA_ERR_GETCTRL_FAILED		= 1,
@@ -36,6 +40,7 @@ enum {
 	ANA_ERR_GETNS_FAILED,
 	ANA_ERR_NO_MEMORY,
 	ANA_ERR_NO_INFORMATION,
+	ANA_ERR_CACHE_MISS,
 };
 
 static const char *ana_errmsg[] = {
@@ -49,6 +54,7 @@ static const char *ana_errmsg[] = {
 	[ANA_ERR_GETNS_FAILED]		= "couldn't get namespace info",
 	[ANA_ERR_NO_MEMORY]		= "out of memory",
 	[ANA_ERR_NO_INFORMATION]	= "invalid fd",
+	[ANA_ERR_CACHE_MISS]		= "no cached ana log",
 };
 
 static const char *anas_string[] = {
@@ -107,6 +113,157 @@ static int get_ana_state(__u32 nsid, __u32 anagrpid, void *ana_log,
 	return -ANA_ERR_GETANAS_NOTFOUND;
 }
 
+/* True if any ANA group in the log is in CHANGE state */
+static bool ana_log_in_change(void *ana_log, size_t ana_log_len)
+{
+	void *base = ana_log;
+	struct nvme_ana_rsp_hdr *hdr = base;
+	struct nvme_ana_group_desc *ana_desc;
+	size_t offset = sizeof(struct nvme_ana_rsp_hdr);
+	int i;
+
+	for (i = 0; i < le16_to_cpu(hdr->ngrps); i++) {
+		ana_desc = base + offset;
+		offset += sizeof(*ana_desc);
+		if (offset > ana_log_len)
+			return true;
+		if (ana_desc->state == NVME_ANA_CHANGE)
+			return true;
+		offset += le32_to_cpu(ana_desc->nnsids) * sizeof(__le32);
+	}
+	return false;
+}
+
+/*
+ * The ANA log is the same for all namespaces of a controller. It's cached
+ * per controller, and reused for other namespaces as long as the change
+ * count in the log header stays the same. Within ANA_CACHE_TTL_MS after a
+ * read or a check of the header, the cached log is used without any I/O.
+ */
+#define ANA_CACHE_SIZE		64
+#define ANA_CACHE_TTL_MS	1000
+
+struct ana_cache_entry {
+	char ctrl[FILE_NAME_SIZE];	/* sysfs path of the controller */
+	struct timespec time;
+	__u64 chgcnt;
+	bool rgo;
+	void *log;
+	size_t log_len;
+};
+
+static pthread_mutex_t ana_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ana_cache_entry ana_cache[ANA_CACHE_SIZE];
+
+static struct ana_cache_entry *ana_cache_slot(const char *ctrl)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261U;
+
+	for (; *ctrl; ctrl++)
+		h = (h ^ (unsigned char)*ctrl) * 16777619U;
+	return &ana_cache[h % ANA_CACHE_SIZE];
+}
+
+static const char *ana_ctrl_syspath(struct path *pp)
+{
+	struct udev_device *ctrl;
+
+	if (!pp->udev)
+		return NULL;
+	ctrl = udev_device_get_parent_with_subsystem_devtype(pp->udev,
+							     "nvme", NULL);
+	return ctrl ? udev_device_get_syspath(ctrl) : NULL;
+}
+
+static void ana_cache_put(const char *ctrl, void *ana_log, size_t ana_log_len,
+			  bool rgo)
+{
+	struct ana_cache_entry *ent;
+	void *log;
+
+	if (!ctrl || ana_log_in_change(ana_log, ana_log_len))
+		return;
+	log = malloc(ana_log_len);
+	if (!log)
+		return;
+	memcpy(log, ana_log, ana_log_len);
+
+	ent = ana_cache_slot(ctrl);
+	pthread_mutex_lock(&ana_cache_lock);
+	free(ent->log);
+	strlcpy(ent->ctrl, ctrl, sizeof(ent->ctrl));
+	get_monotonic_time(&ent->time);
+	ent->chgcnt = le64_to_cpu(((struct nvme_ana_rsp_hdr *)log)->chgcnt);
+	ent->rgo = rgo;
+	ent->log = log;
+	ent->log_len = ana_log_len;
+	pthread_mutex_unlock(&ana_cache_lock);
+}
+
+static bool ana_cache_fresh(const struct ana_cache_entry *ent)
+{
+	struct timespec now, diff;
+
+	get_monotonic_time(&now);
+	timespecsub(&now, &ent->time, &diff);
+	return diff.tv_sec * 1000 + diff.tv_nsec / 1000000 < ANA_CACHE_TTL_MS;
+}
+
+/*
+ * Look up the ANA state of nsid in the cached log of the controller.
+ * Returns -ANA_ERR_CACHE_MISS if the log has to be read.
+ */
+static int ana_cache_get(struct path *pp, const char *ctrl, __u32 nsid)
+{
+	struct ana_cache_entry *ent;
+	struct nvme_ana_rsp_hdr hdr;
+	struct nvme_id_ns ns;
+	__u64 chgcnt;
+	bool rgo, fresh;
+	int rc = -ANA_ERR_CACHE_MISS;
+
+	if (!ctrl)
+		return rc;
+	ent = ana_cache_slot(ctrl);
+	pthread_mutex_lock(&ana_cache_lock);
+	if (!ent->log || strcmp(ent->ctrl, ctrl)) {
+		pthread_mutex_unlock(&ana_cache_lock);
+		return rc;
+	}
+	chgcnt = ent->chgcnt;
+	rgo = ent->rgo;
+	fresh = ana_cache_fresh(ent);
+	pthread_mutex_unlock(&ana_cache_lock);
+
+	if (!fresh) {
+		if (nvme_ana_log(pp->fd, &hdr, sizeof(hdr),
+				 rgo ? NVME_ANA_LOG_RGO : 0) ||
+		    le64_to_cpu(hdr.chgcnt) != chgcnt)
+			return rc;
+	}
+	if (rgo) {
+		rc = nvme_identify_ns(pp->fd, nsid, 0, &ns);
+		if (rc) {
+			log_nvme_errcode(rc, pp->dev, "nvme_identify_ns");
+			return -ANA_ERR_GETNS_FAILED;
+		}
+	}
+
+	rc = -ANA_ERR_CACHE_MISS;
+	pthread_mutex_lock(&ana_cache_lock);
+	if (ent->log && !strcmp(ent->ctrl, ctrl) && ent->chgcnt == chgcnt) {
+		rc = get_ana_state(nsid, rgo ? le32_to_cpu(ns.anagrpid) : 0,
+				   ent->log, ent->log_len);
+		if (!fresh)
+			get_monotonic_time(&ent->time);
+	}
+	pthread_mutex_unlock(&ana_cache_lock);
+	if (rc >= 0)
+		condlog(4, "%s: ana state from cache", pp->dev);
+	return rc;
+}
+
 static int get_ana_info(struct path * pp)
 {
 	int	rc;
@@ -116,6 +273,19 @@ static int get_ana_info(struct path * pp)
 	void *ana_log;
 	size_t ana_log_len;
 	bool is_anagrpid_const;
+	const char *ctrl_path;
+
+	rc = nvme_get_nsid(pp->fd);
+	if (rc <= 0) {
+		log_nvme_errcode(rc, pp->dev, "nvme_get_nsid");
+		return -ANA_ERR_GETNSID_FAILED;
+	}
+	nsid = rc;
+
+	ctrl_path = ana_ctrl_syspath(pp);
+	rc = ana_cache_get(pp, ctrl_path, nsid);
+	if (rc != -ANA_ERR_CACHE_MISS)
+		goto out;
 
 	rc = nvme_id_ctrl_ana(pp->fd, &ctrl);
 	if (rc < 0) {
@@ -124,11 +294,6 @@ static int get_ana_info(struct path * pp)
 	} else if (rc == 0)
 		return -ANA_ERR_NOT_SUPPORTED;
 
-	nsid = nvme_get_nsid(pp->fd);
-	if (nsid <= 0) {
-		log_nvme_errcode(rc, pp->dev, "nvme_get_nsid");
-		return -ANA_ERR_GETNSID_FAILED;
-	}
 	is_anagrpid_const = ctrl.anacap & (1 << 6);
 
 	/*
@@ -158,12 +323,17 @@ static int get_ana_info(struct path * pp)
 	if (rc) {
 		log_nvme_errcode(rc, pp->dev, "nvme_ana_log");
 		rc = -ANA_ERR_GETANALOG_FAILED;
-	} else
+	} else {
 		rc = get_ana_state(nsid,
 				   is_anagrpid_const ?
 				   le32_to_cpu(ns.anagrpid) : 0,
 				   ana_log, ana_log_len);
+		if (rc >= 0)
+			ana_cache_put(ctrl_path, ana_log, ana_log_len,
+				      is_anagrpid_const);
+	}
 	pthread_cleanup_pop(1);
+out:
 	if (rc >= 0)
 		condlog(4, "%s: ana state = %02x [%s]", pp->dev, rc,
 			aas_print_string(rc));
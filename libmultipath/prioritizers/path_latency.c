@@ -14,6 +14,13 @@
  *    the average latency of each path and the "base_num" of logarithmic
  *    scale, the priority "rc" of each path can be provided.
  *
+ * With "mode=sample", no burst of IOs is sent. Instead, every run adds one
+ * latency sample to a per-path histogram: the average latency of the IOs
+ * the path completed since the previous run, taken from the kernel's I/O
+ * statistics, or the latency of a single read if the path was idle. The
+ * priority is derived from the median of the histogram, which holds about
+ * "io_num" recent samples.
+ *
  * Author(s): Yang Feng <philip.yang@huawei.com>
  * Revised:   Guan Junxiong <guanjunxiong@huawei.com>
  *
@@ -26,6 +33,10 @@
 #include <ctype.h>
 #include <time.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <libudev.h>
+#include <sys/sysmacros.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
 #include <unistd.h>
@@ -35,6 +46,7 @@
 #include "structs.h"
 #include "util.h"
 #include "time-util.h"
+#include "sysfs.h"
 
 #define pp_pl_log(prio, fmt, args...) condlog(prio, "path_latency prio: " fmt, ##args)
 
@@ -57,6 +69,30 @@
 
 #define DEF_BLK_SIZE		4096
 
+enum {
+	MODE_BURST,
+	MODE_SAMPLE,
+};
+
+/* Histogram buckets per factor of 2, the last bucket is above 2**27 us */
+#define HIST_STEPS		4
+#define HIST_BUCKETS		(27 * HIST_STEPS + 1)
+/* Must be a power of 2 */
+#define HIST_TABLE_SIZE		256
+/* Minimum I/O time (ms) between runs for using the kernel's statistics */
+#define STAT_MIN_TICKS		10
+
+struct latency_hist {
+	dev_t devt;	/* 0 if unused */
+	unsigned long long ios;
+	unsigned long long ticks;
+	unsigned int total;
+	unsigned short count[HIST_BUCKETS];
+};
+
+static struct latency_hist hist_table[HIST_TABLE_SIZE];
+static pthread_mutex_t hist_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int prepare_directio_read(int fd, int *blksz, char **pbuf,
 		int *restore_flags)
 {
@@ -141,16 +177,16 @@ int check_args_valid(int io_num, double base_num)
 }
 
 /*
- * In multipath.conf, args form: io_num=n base_num=m. For example, args are
- * "io_num=20 base_num=10", this function can get io_num value 20 and
- * base_num value 10.
+ * In multipath.conf, args form: io_num=n base_num=m [mode=burst|sample].
+ * For example, args are "io_num=20 base_num=10", this function can get
+ * io_num value 20 and base_num value 10. The mode defaults to "burst".
  */
-static int get_ionum_and_basenum(char *args, int *ionum, double *basenum)
+static int get_ionum_and_basenum(char *args, int *ionum, double *basenum,
+				 int *mode)
 {
 	char split_char[] = " \t";
 	char *arg, *temp;
 	char *str, *str_inval;
-	int i;
 	int flag_io = 0, flag_base = 0;
 
 	if ((args == NULL) || (ionum == NULL) || (basenum == NULL)) {
@@ -162,11 +198,13 @@ static int get_ionum_and_basenum(char *args, int *ionum, double *basenum)
 	if (!arg)
 		return 0;
 
-	for (i = 0; i < 2; i++) {
-		str = get_next_string(&temp, split_char);
-		if (!str)
-			goto out;
-		if (!strncmp(str, "io_num=", 7) && strlen(str) > 7) {
+	*mode = MODE_BURST;
+	while ((str = get_next_string(&temp, split_char)) != NULL) {
+		if (!strcmp(str, "mode=burst"))
+			*mode = MODE_BURST;
+		else if (!strcmp(str, "mode=sample"))
+			*mode = MODE_SAMPLE;
+		else if (!strncmp(str, "io_num=", 7) && strlen(str) > 7) {
 			*ionum = (int)strtoul(str + 7, &str_inval, 10);
 			if (str == str_inval)
 				goto out;
@@ -177,7 +215,8 @@ static int get_ionum_and_basenum(char *args, int *ionum, double *basenum)
 			if (str == str_inval)
 				goto out;
 			flag_base = 1;
-		}
+		} else
+			goto out;
 	}
 
 	if (!flag_io || !flag_base)
@@ -208,10 +247,171 @@ int calcPrio(double lg_avglatency, double lg_maxavglatency,
 	return lg_maxavglatency - lg_avglatency;
 }
 
+/* Sum of IOs and of IO time (ms) of the reads and writes of a path */
+static int get_io_stat(struct path *pp, unsigned long long *ios,
+		       unsigned long long *ticks)
+{
+	char buf[256];
+	unsigned long long rd_ios, rd_ticks, wr_ios, wr_ticks;
+	ssize_t len;
+
+	if (!pp->udev)
+		return -1;
+	len = sysfs_attr_get_value(pp->udev, "stat", buf, sizeof(buf));
+	if (len <= 0 || (size_t)len >= sizeof(buf))
+		return -1;
+	if (sscanf(buf, "%llu %*u %*u %llu %llu %*u %*u %llu",
+		   &rd_ios, &rd_ticks, &wr_ios, &wr_ticks) != 4)
+		return -1;
+	*ios = rd_ios + wr_ios;
+	*ticks = rd_ticks + wr_ticks;
+	return 0;
+}
+
+/* Called with hist_lock held */
+static struct latency_hist *find_hist(dev_t devt, bool create)
+{
+	struct latency_hist *h;
+
+	h = &hist_table[(major(devt) * 31 + minor(devt)) &
+			(HIST_TABLE_SIZE - 1)];
+	if (h->devt == devt)
+		return h;
+	if (!create)
+		return NULL;
+	memset(h, 0, sizeof(*h));
+	h->devt = devt;
+	return h;
+}
+
+static int hist_bucket(double latency)
+{
+	int i;
+
+	if (latency < 1.)
+		return 0;
+	i = log2(latency) * HIST_STEPS;
+	return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+
+static double bucket_latency(int i)
+{
+	return exp2((i + 0.5) / HIST_STEPS);
+}
+
+/* Called with hist_lock held */
+static void hist_add(struct latency_hist *h, double latency, int io_num)
+{
+	int i;
+
+	if (h->total >= (unsigned int)io_num) {
+		/* Age out old samples */
+		h->total = 0;
+		for (i = 0; i < HIST_BUCKETS; i++) {
+			h->count[i] /= 2;
+			h->total += h->count[i];
+		}
+	}
+	h->count[hist_bucket(latency)]++;
+	h->total++;
+}
+
+/* Called with hist_lock held. h->total must not be 0 */
+static double hist_percentile(const struct latency_hist *h, unsigned int pct)
+{
+	unsigned int n = 0, want = (h->total * pct + 99) / 100;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS - 1; i++) {
+		n += h->count[i];
+		if (n >= want)
+			break;
+	}
+	return bucket_latency(i);
+}
+
+/* Latency (us) of a single read, or -1 on failure */
+static double probe_latency(struct path *pp, unsigned int timeout)
+{
+	struct timespec tv_before, tv_after, tv_diff;
+	int blksize, restore_flags = 0, r;
+	char *buf;
+
+	if (prepare_directio_read(pp->fd, &blksize, &buf, &restore_flags) < 0)
+		return -1;
+	(void)clock_gettime(CLOCK_MONOTONIC, &tv_before);
+	r = do_directio_read(pp->fd, timeout, buf, blksize);
+	(void)clock_gettime(CLOCK_MONOTONIC, &tv_after);
+	cleanup_directio_read(pp->fd, buf, restore_flags);
+	if (r)
+		return -1;
+	timespecsub(&tv_after, &tv_before, &tv_diff);
+	return tv_diff.tv_sec * 1000. * 1000. + tv_diff.tv_nsec / 1000.;
+}
+
+static int getprio_sample(struct path *pp, int io_num, double lg_base,
+			  unsigned int timeout)
+{
+	struct latency_hist *h;
+	unsigned long long ios = 0, ticks = 0, d_ios = 0, d_ticks = 0;
+	bool have_stat;
+	dev_t devt;
+	double latency, p50, p99;
+	int rc;
+
+	devt = pp->udev ? udev_device_get_devnum(pp->udev) : 0;
+	if (devt == 0)
+		return PRIO_UNDEF;
+
+	have_stat = get_io_stat(pp, &ios, &ticks) == 0;
+	pthread_mutex_lock(&hist_lock);
+	h = find_hist(devt, true);
+	if (have_stat) {
+		if (h->total > 0 && ios >= h->ios && ticks >= h->ticks) {
+			d_ios = ios - h->ios;
+			d_ticks = ticks - h->ticks;
+		}
+		h->ios = ios;
+		h->ticks = ticks;
+	}
+	pthread_mutex_unlock(&hist_lock);
+
+	if (d_ios > 0 && d_ticks >= STAT_MIN_TICKS)
+		latency = d_ticks * 1000. / d_ios;
+	else {
+		latency = probe_latency(pp, timeout);
+		if (latency < 0) {
+			pp_pl_log(0, "%s: path down", pp->dev);
+			return -1;
+		}
+	}
+
+	pthread_mutex_lock(&hist_lock);
+	/* The entry may have been taken over by another path meanwhile */
+	h = find_hist(devt, true);
+	hist_add(h, latency, io_num);
+	p50 = hist_percentile(h, 50);
+	p99 = hist_percentile(h, 99);
+	pthread_mutex_unlock(&hist_lock);
+
+	pp->latency_p50 = (unsigned int)p50;
+	pp->latency_p99 = (unsigned int)p99;
+	if (p50 > MAX_AVG_LATENCY) {
+		pp_pl_log(2, "%s: median latency (%lld us) is outside the thresold (%lld us)",
+			  pp->dev, (long long)p50, (long long)MAX_AVG_LATENCY);
+		return DEFAULT_PRIORITY;
+	}
+	rc = calcPrio(log(p50) / lg_base, log(MAX_AVG_LATENCY) / lg_base,
+		      log(MIN_AVG_LATENCY) / lg_base);
+	pp_pl_log(3, "%s: latency sample=%.2e p50=%.2e p99=%.2e prio=%d",
+		  pp->dev, latency, p50, p99, rc);
+	return rc;
+}
+
 int getprio(struct path *pp, char *args, unsigned int timeout)
 {
 	int rc, temp;
-	int io_num = 0;
+	int io_num = 0, mode = MODE_BURST;
 	double base_num = 0;
 	double lg_avglatency, lg_maxavglatency, lg_minavglatency;
 	double standard_deviation;
@@ -225,15 +425,18 @@ int getprio(struct path *pp, char *args, unsigned int timeout)
 	if (pp->fd < 0)
 		return -1;
 
-	if (get_ionum_and_basenum(args, &io_num, &base_num) == 0) {
+	if (get_ionum_and_basenum(args, &io_num, &base_num, &mode) == 0) {
 		io_num = DEF_IO_NUM;
 		base_num = DEF_BASE_NUM;
+		mode = MODE_BURST;
 		pp_pl_log(0, "%s: fails to get path_latency args, set default:"
 				"io_num=%d base_num=%.3lf",
 				pp->dev, io_num, base_num);
 	}
 
 	lg_base = log(base_num);
+	if (mode == MODE_SAMPLE)
+		return getprio_sample(pp, io_num, lg_base, timeout);
 	lg_maxavglatency = log(MAX_AVG_LATENCY) / lg_base;
 	lg_minavglatency = log(MIN_AVG_LATENCY) / lg_base;
 
@@ -20,7 +20,7 @@ static const struct {
 	{  1, "standby" },
 };
 
-int get_exclusive_pref_arg(char *args)
+static int get_exclusive_pref_arg(char *args)
 {
 	char *ptr;
 
@@ -23,7 +23,10 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "prio.h"
 #include "weightedpath.h"
@@ -54,75 +57,259 @@ build_wwn_path(struct path *pp, struct strbuf *buf)
 	    (rc = fill_strbuf(buf, ':', 1)) < 0 ||
 	    (rc = snprint_host_wwpn(buf, pp)) < 0 ||
 	    (rc = fill_strbuf(buf, ':', 1)) < 0 ||
-	    (rc = snprint_tgt_wwnn(buf, pp) < 0) ||
-	    (rc = fill_strbuf(buf, ':', 1) < 0) ||
-	    (rc = snprint_tgt_wwpn(buf, pp) < 0))
+	    (rc = snprint_tgt_wwnn(buf, pp)) < 0 ||
+	    (rc = fill_strbuf(buf, ':', 1)) < 0 ||
+	    (rc = snprint_tgt_wwpn(buf, pp)) < 0)
 		return rc;
 	return 0;
 }
 
+/*
+ * The parsed and compiled form of a prio_args string. Rule sets are
+ * shared by all paths using the same arguments, and kept until the
+ * prioritizer is unloaded. As the weight of a path only depends on
+ * its match string, the weights of the match strings seen so far are
+ * remembered, too.
+ */
+enum {
+	MATCH_INVALID,
+	MATCH_HBTL,
+	MATCH_DEV_NAME,
+	MATCH_SERIAL,
+	MATCH_WWN,
+};
+
+#define WEIGHT_MEMO_BUCKETS 64
+#define WEIGHT_MEMO_MAX 4096
+
+struct weight_memo {
+	struct weight_memo *next;
+	int priority;
+	char match[];
+};
+
+struct weight_rule {
+	regex_t re;
+	int priority;
+};
+
+struct weight_rules {
+	struct weight_rules *next;
+	char *args;
+	int mode;
+	unsigned int nr_memo;
+	struct weight_memo *memo[WEIGHT_MEMO_BUCKETS];
+	int nr_rules;
+	struct weight_rule rules[];
+};
+
+static pthread_mutex_t rules_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct weight_rules *rules_list;
+
+static int match_mode(const char *mode)
+{
+	if (!strcmp(mode, HBTL))
+		return MATCH_HBTL;
+	if (!strcmp(mode, DEV_NAME))
+		return MATCH_DEV_NAME;
+	if (!strcmp(mode, SERIAL))
+		return MATCH_SERIAL;
+	if (!strcmp(mode, WWN))
+		return MATCH_WWN;
+	return MATCH_INVALID;
+}
+
+static struct weight_rules *compile_rules(const char *prio_args)
+{
+	char *arg __attribute__((cleanup(cleanup_charp))) = NULL;
+	char *temp, *mode, *regex, *prio;
+	char split_char[] = " \t";
+	struct weight_rules *wr;
+	const char *c;
+	int n = 0;
+
+	arg = temp = strdup(prio_args);
+	if (!arg)
+		return NULL;
+	/* at most one rule per two words */
+	for (c = arg; *c; c++)
+		if (*c == ' ' || *c == '\t')
+			n++;
+	wr = calloc(1, sizeof(*wr) + (n / 2 + 1) * sizeof(*wr->rules));
+	if (!wr)
+		return NULL;
+	wr->args = strdup(prio_args);
+	if (!wr->args) {
+		free(wr);
+		return NULL;
+	}
+
+	mode = get_next_string(&temp, split_char);
+	/* Use the default priority if the argument is not parseable */
+	wr->mode = mode ? match_mode(mode) : MATCH_INVALID;
+	if (wr->mode == MATCH_INVALID)
+		return wr;
+
+	while (temp && wr->nr_rules <= n / 2) {
+		struct weight_rule *rule = &wr->rules[wr->nr_rules];
+
+		if (!(regex = get_next_string(&temp, split_char)))
+			break;
+		if (!(prio = get_next_string(&temp, split_char)))
+			break;
+		if (regcomp(&rule->re, regex, REG_EXTENDED|REG_NOSUB))
+			continue;
+		rule->priority = atoi(prio);
+		wr->nr_rules++;
+	}
+	return wr;
+}
+
+static void free_rules(struct weight_rules *wr)
+{
+	struct weight_memo *wm, *next;
+	int i;
+
+	for (i = 0; i < wr->nr_rules; i++)
+		regfree(&wr->rules[i].re);
+	for (i = 0; i < WEIGHT_MEMO_BUCKETS; i++)
+		for (wm = wr->memo[i]; wm; wm = next) {
+			next = wm->next;
+			free(wm);
+		}
+	free(wr->args);
+	free(wr);
+}
+
+static void __attribute__((destructor)) cleanup_rules(void)
+{
+	struct weight_rules *wr, *next;
+
+	for (wr = rules_list; wr; wr = next) {
+		next = wr->next;
+		free_rules(wr);
+	}
+	rules_list = NULL;
+}
+
+static const struct weight_rules *get_rules(const char *prio_args)
+{
+	struct weight_rules *wr;
+
+	pthread_mutex_lock(&rules_lock);
+	for (wr = rules_list; wr; wr = wr->next)
+		if (!strcmp(wr->args, prio_args))
+			break;
+	if (!wr) {
+		wr = compile_rules(prio_args);
+		if (wr) {
+			wr->next = rules_list;
+			rules_list = wr;
+		}
+	}
+	pthread_mutex_unlock(&rules_lock);
+	return wr;
+}
+
+/* Returns 0 and sets *priority if the weight of match is known */
+static int get_memo(const struct weight_rules *wr, const char *match,
+		    int *priority)
+{
+	const struct weight_memo *wm;
+	int rc = 1;
+
+	pthread_mutex_lock(&rules_lock);
+	for (wm = wr->memo[hash_str(match) % WEIGHT_MEMO_BUCKETS]; wm;
+	     wm = wm->next)
+		if (!strcmp(wm->match, match)) {
+			*priority = wm->priority;
+			rc = 0;
+			break;
+		}
+	pthread_mutex_unlock(&rules_lock);
+	return rc;
+}
+
+static void set_memo(const struct weight_rules *cwr, const char *match,
+		     int priority)
+{
+	/* only the memo is modified after compile_rules() */
+	struct weight_rules *wr = (struct weight_rules *)(uintptr_t)cwr;
+	struct weight_memo *wm, **bucket;
+	size_t len = strlen(match);
+
+	bucket = &wr->memo[hash_str(match) % WEIGHT_MEMO_BUCKETS];
+	pthread_mutex_lock(&rules_lock);
+	for (wm = *bucket; wm; wm = wm->next)
+		if (!strcmp(wm->match, match))
+			break;
+	if (!wm && wr->nr_memo < WEIGHT_MEMO_MAX &&
+	    (wm = malloc(sizeof(*wm) + len + 1)) != NULL) {
+		memcpy(wm->match, match, len + 1);
+		wm->priority = priority;
+		wm->next = *bucket;
+		*bucket = wm;
+		wr->nr_memo++;
+	}
+	pthread_mutex_unlock(&rules_lock);
+}
+
+static int
+build_match(const struct weight_rules *wr, struct path *pp,
+	    struct strbuf *buf)
+{
+	switch (wr->mode) {
+	case MATCH_HBTL:
+		return print_strbuf(buf, "%d:%d:%d:%" PRIu64,
+				    pp->sg_id.host_no, pp->sg_id.channel,
+				    pp->sg_id.scsi_id, pp->sg_id.lun);
+	case MATCH_DEV_NAME:
+		return append_strbuf_str(buf, pp->dev);
+	case MATCH_SERIAL:
+		return build_serial_path(pp, buf);
+	case MATCH_WWN:
+		return build_wwn_path(pp, buf);
+	default:
+		return -EINVAL;
+	}
+}
+
 /* main priority routine */
 int prio_path_weight(struct path *pp, char *prio_args)
 {
 	STRBUF_ON_STACK(path);
-	char *arg __attribute__((cleanup(cleanup_charp))) = NULL;
-	char *temp, *regex, *prio;
-	char split_char[] = " \t";
-	int priority = DEFAULT_PRIORITY, path_found = 0;
-	regex_t pathe;
+	const struct weight_rules *wr;
+	const char *match;
+	int priority = DEFAULT_PRIORITY, i;
 
 	/* Return default priority if there is no argument */
 	if (!prio_args)
 		return priority;
 
-	arg = temp = STRDUP(prio_args);
-
-	regex = get_next_string(&temp, split_char);
-
-	/* Return default priority if the argument is not parseable */
-	if (!regex) {
-		FREE(arg);
+	wr = get_rules(prio_args);
+	if (!wr)
 		return priority;
-	}
-
-	if (!strcmp(regex, HBTL)) {
-		if (print_strbuf(&path, "%d:%d:%d:%" PRIu64, pp->sg_id.host_no,
-				 pp->sg_id.channel, pp->sg_id.scsi_id,
-				 pp->sg_id.lun) < 0)
-			return priority;
-	} else if (!strcmp(regex, DEV_NAME)) {
-		if (append_strbuf_str(&path, pp->dev) < 0)
-			return priority;
-	} else if (!strcmp(regex, SERIAL)) {
-		if (build_serial_path(pp, &path) != 0)
-			return priority;
-	} else if (!strcmp(regex, WWN)) {
-		if (build_wwn_path(pp, &path) != 0)
-			return priority;
-	} else {
+	if (wr->mode == MATCH_INVALID) {
 		condlog(0, "%s: %s - Invalid arguments", pp->dev,
 			pp->prio.name);
 		return priority;
 	}
+	if (build_match(wr, pp, &path) < 0)
+		return priority;
 
-	while (!path_found) {
-		if (!temp)
-			break;
-		if (!(regex = get_next_string(&temp, split_char)))
-			break;
-		if (!(prio = get_next_string(&temp, split_char)))
-			break;
+	match = get_strbuf_str(&path);
+	if (!match)
+		match = "";
+	if (get_memo(wr, match, &priority) == 0)
+		return priority;
 
-		if (!regcomp(&pathe, regex, REG_EXTENDED|REG_NOSUB)) {
-			if (!regexec(&pathe, get_strbuf_str(&path), 0,
-				     NULL, 0)) {
-				path_found = 1;
-				priority = atoi(prio);
-			}
-			regfree(&pathe);
+	for (i = 0; i < wr->nr_rules; i++) {
+		if (!regexec(&wr->rules[i].re, match, 0, NULL, 0)) {
+			priority = wr->rules[i].priority;
+			break;
 		}
 	}
-
+	set_memo(wr, match, priority);
 	return priority;
 }
 
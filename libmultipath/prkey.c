@@ -5,134 +5,439 @@
 #include "util.h"
 #include "propsel.h"
 #include "prkey.h"
+#include "strbuf.h"
+#include "vector.h"
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <pthread.h>
 #include <libudev.h>
 #include <mpath_persist.h>
 
-#define PRKEY_READ 0
-#define PRKEY_WRITE 1
+#define PRKEY_KEY_LEN (PRKEY_SIZE - 1)
+/*
+ * Rewrite the file if it has at least this many lines without a key, and
+ * more of them than keys
+ */
+#define PRKEYS_COMPACT_MIN 64
 
-static int do_prkey(int fd, char *wwid, char *keystr, int cmd)
+struct prkey_entry {
+	/* offset of the line in the file */
+	off_t offset;
+	unsigned int hash;
+	/* starts with '#' if the key was cleared */
+	char key[PRKEY_SIZE];
+	char wwid[];
+};
+
+/*
+ * In-memory copy of the prkeys file, like the bindings cache in alias.c.
+ * It's reloaded if the identity, size or modification time of the file
+ * changes. Keys set or cleared by this process update the file in place
+ * and the cache along with it. Only the first line for a WWID counts.
+ * Protected by prkeys_cache_lock.
+ */
+struct prkeys_cache {
+	char *file;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	/* The first entry of every WWID, in file order */
+	struct _vector entries;
+	/* Open addressing hash table of the entries, by WWID */
+	struct prkey_entry **table;
+	unsigned int mask;
+	/* Lines in the file without a usable key */
+	int dead_lines;
+};
+
+static pthread_mutex_t prkeys_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct prkeys_cache prkeys_cache;
+
+static void clear_prkeys_cache(struct prkeys_cache *pc)
 {
-	char buf[4097];
-	char *ptr;
-	off_t start = 0;
-	int bytes;
+	struct prkey_entry *ent;
+	int i;
 
-	while (1) {
-		if (lseek(fd, start, SEEK_SET) < 0) {
-			condlog(0, "prkey file read lseek failed : %s",
-				strerror(errno));
-			return 1;
-		}
-		bytes = read(fd, buf, 4096);
-		if (bytes < 0) {
-			if (errno == EINTR || errno == EAGAIN)
-				continue;
-			condlog(0, "failed to read from prkey file : %s",
-				strerror(errno));
-			return 1;
-		}
-		if (!bytes) {
-			ptr = NULL;
-			break;
-		}
-		buf[bytes] = '\0';
-		ptr = strstr(buf, wwid);
-		while (ptr) {
-			if (ptr == buf || *(ptr - 1) != ' ' ||
-			    *(ptr + strlen(wwid)) != '\n')
-				ptr = strstr(ptr + strlen(wwid), wwid);
-			else
-				break;
-		}
-		if (ptr) {
-			condlog(3, "found prkey for '%s'", wwid);
-			ptr[strlen(wwid)] = '\0';
-			if (ptr - PRKEY_SIZE < buf ||
-			    (ptr - PRKEY_SIZE != buf &&
-			     *(ptr - PRKEY_SIZE - 1) != '\n')) {
-				condlog(0, "malformed prkey file line for wwid: '%s'", ptr);
-				return 1;
-			}
-			ptr = ptr - PRKEY_SIZE;
+	vector_foreach_slot(&pc->entries, ent, i)
+		free(ent);
+	vector_reset(&pc->entries);
+	free(pc->table);
+	pc->table = NULL;
+	pc->mask = 0;
+	free(pc->file);
+	pc->file = NULL;
+	pc->dead_lines = 0;
+}
+
+void cleanup_prkeys(void)
+{
+	pthread_mutex_lock(&prkeys_cache_lock);
+	clear_prkeys_cache(&prkeys_cache);
+	pthread_mutex_unlock(&prkeys_cache_lock);
+}
+
+static struct prkey_entry **
+prkey_slot(const struct prkeys_cache *pc, const char *wwid, unsigned int hash)
+{
+	unsigned int h;
+	struct prkey_entry **slot;
+
+	/* the table is never more than half full */
+	for (h = hash & pc->mask; ; h = (h + 1) & pc->mask) {
+		slot = &pc->table[h];
+		if (!*slot || ((*slot)->hash == hash &&
+			       !strcmp((*slot)->wwid, wwid)))
+			return slot;
+	}
+}
+
+static struct prkey_entry *
+find_prkey(const struct prkeys_cache *pc, const char *wwid)
+{
+	if (!pc->table)
+		return NULL;
+	return *prkey_slot(pc, wwid, hash_str(wwid));
+}
+
+static int grow_prkeys_table(struct prkeys_cache *pc)
+{
+	unsigned int size = 64, n = VECTOR_SIZE(&pc->entries) + 1;
+	struct prkey_entry *ent;
+	int i;
+
+	if (pc->table && 2 * n <= pc->mask + 1)
+		return 0;
+	while (size < 4 * n)
+		size <<= 1;
+	free(pc->table);
+	pc->table = calloc(size, sizeof(*pc->table));
+	if (!pc->table)
+		return -1;
+	pc->mask = size - 1;
+	vector_foreach_slot(&pc->entries, ent, i)
+		*prkey_slot(pc, ent->wwid, ent->hash) = ent;
+	return 0;
+}
+
+static int cache_prkey(struct prkeys_cache *pc, const char *key,
+		       const char *wwid, size_t wwid_len, off_t offset)
+{
+	struct prkey_entry *ent, **slot;
+
+	ent = malloc(sizeof(*ent) + wwid_len + 1);
+	if (!ent)
+		return -1;
+	memcpy(ent->wwid, wwid, wwid_len);
+	ent->wwid[wwid_len] = '\0';
+	ent->hash = hash_str(ent->wwid);
+	if (pc->table && *prkey_slot(pc, ent->wwid, ent->hash)) {
+		/* lookups use the first line */
+		free(ent);
+		pc->dead_lines++;
+		return 0;
+	}
+	memcpy(ent->key, key, PRKEY_KEY_LEN);
+	ent->key[PRKEY_KEY_LEN] = '\0';
+	ent->offset = offset;
+	if (grow_prkeys_table(pc) != 0 || !vector_alloc_slot(&pc->entries)) {
+		free(ent);
+		return -1;
+	}
+	vector_set_slot(&pc->entries, ent);
+	slot = prkey_slot(pc, ent->wwid, ent->hash);
+	*slot = ent;
+	if (*key == '#')
+		pc->dead_lines++;
+	return 0;
+}
+
+/*
+ * Lines look like "0x0123456789abcdef wwid", with a capital 'X' for the
+ * APTPL flag, and with the first character replaced by '#' once the key
+ * was cleared.
+ */
+static bool prkey_line(const char *line, size_t len)
+{
+	size_t i;
+
+	if (len <= PRKEY_SIZE || line[PRKEY_KEY_LEN] != ' ' ||
+	    (line[0] != '0' && line[0] != '#') ||
+	    (line[1] != 'x' && line[1] != 'X'))
+		return false;
+	for (i = 2; i < PRKEY_KEY_LEN; i++)
+		if (!isxdigit((unsigned char)line[i]))
+			return false;
+	return true;
+}
+
+static int load_prkeys_cache(struct prkeys_cache *pc, int fd, off_t size)
+{
+	char *buf, *line, *end, *nl;
+	ssize_t n;
+	size_t len, done = 0;
+	int rc = 0;
+
+	buf = malloc(size + 1);
+	if (!buf)
+		return -1;
+	while (done < (size_t)size) {
+		n = pread(fd, buf + done, size - done, done);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0)
 			break;
+		done += n;
+	}
+	buf[done] = '\0';
+	end = buf + done;
+	/* a last line without newline may still be written */
+	for (line = buf; line < end && (nl = memchr(line, '\n', end - line));
+	     line = nl + 1) {
+		len = nl - line;
+		if (!prkey_line(line, len)) {
+			if (*line != '#' && len > 0)
+				pc->dead_lines++;
+			continue;
 		}
-		ptr = strrchr(buf, '\n');
-		if (ptr == NULL) {
-			condlog(4, "couldn't file newline, assuming end of file");
+		if (cache_prkey(pc, line, line + PRKEY_SIZE,
+				len - PRKEY_SIZE, line - buf) != 0) {
+			rc = -1;
 			break;
 		}
-		start = start + (ptr - buf) + 1;
 	}
-	if (cmd == PRKEY_READ) {
-		if (!ptr || *ptr == '#')
-			return 1;
-		memcpy(keystr, ptr, PRKEY_SIZE - 1);
-		keystr[PRKEY_SIZE - 1] = '\0';
-		return 0;
+	free(buf);
+	return rc;
+}
+
+static void set_cache_stat(struct prkeys_cache *pc, const struct stat *st)
+{
+	pc->dev = st->st_dev;
+	pc->ino = st->st_ino;
+	pc->size = st->st_size;
+	pc->mtime = st->st_mtim;
+}
+
+static bool cache_matches(const struct prkeys_cache *pc, const char *file,
+			  const struct stat *st)
+{
+	return pc->file && !strcmp(pc->file, file) &&
+		pc->dev == st->st_dev && pc->ino == st->st_ino &&
+		pc->size == st->st_size &&
+		pc->mtime.tv_sec == st->st_mtim.tv_sec &&
+		pc->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/*
+ * Make sure the cache reflects the prkeys file opened as fd.
+ * Must be called with prkeys_cache_lock held.
+ * Returns 0 if the cache can be used, -1 otherwise.
+ */
+static int update_prkeys_cache(const char *file, int fd)
+{
+	struct prkeys_cache *pc = &prkeys_cache;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0) {
+		clear_prkeys_cache(pc);
+		return -1;
 	}
-	if (!ptr && !keystr)
+	if (cache_matches(pc, file, &st))
 		return 0;
-	if (ptr) {
-		if (lseek(fd, start + (ptr - buf), SEEK_SET) < 0) {
-			condlog(0, "prkey write lseek failed : %s",
-				strerror(errno));
-			return 1;
-		}
+
+	clear_prkeys_cache(pc);
+	if (load_prkeys_cache(pc, fd, st.st_size) != 0 ||
+	    !(pc->file = strdup(file))) {
+		condlog(1, "%s: failed to cache prkeys from %s",
+			__func__, file);
+		clear_prkeys_cache(pc);
+		return -1;
 	}
-	if (!keystr) {
-		if (safe_write(fd, "#", 1) < 0) {
-			condlog(0, "failed to write to prkey file : %s",
-				strerror(errno));
-			return 1;
-		}
-		return 0;
+	set_cache_stat(pc, &st);
+	condlog(4, "%s: cached %d prkeys from %s", __func__,
+		VECTOR_SIZE(&pc->entries), file);
+	return 0;
+}
+
+/*
+ * Like open_file(), but make sure that the file we locked is still the
+ * prkeys file, which compact_prkeys_file() may have replaced while we
+ * waited for the lock.
+ */
+static int open_prkeys_file(const char *file, int *can_write)
+{
+	struct stat fst, st;
+	int fd, tries;
+
+	for (tries = 0; tries < 3; tries++) {
+		fd = open_file(file, can_write, PRKEYS_FILE_HEADER);
+		if (fd < 0 || !*can_write)
+			return fd;
+		if (fstat(fd, &fst) == 0 && stat(file, &st) == 0 &&
+		    fst.st_dev == st.st_dev && fst.st_ino == st.st_ino)
+			return fd;
+		close(fd);
 	}
-	if (!ptr) {
-		if (lseek(fd, 0, SEEK_END) < 0) {
-			condlog(0, "prkey write lseek failed : %s",
-				strerror(errno));
-			return 1;
-		}
+	condlog(0, "prkeys file %s keeps changing", file);
+	return -1;
+}
+
+/*
+ * Replace the file by a copy with only the key lines, once cleared keys
+ * have piled up. The cache is reloaded from the new file.
+ */
+static void compact_prkeys_file(struct prkeys_cache *pc, const char *file)
+{
+	STRBUF_ON_STACK(buf);
+	char tempname[PATH_MAX];
+	const struct prkey_entry *ent;
+	long fd;
+	int i, keys = 0, rc = -1;
+
+	if (pc->dead_lines < PRKEYS_COMPACT_MIN)
+		return;
+	vector_foreach_slot(&pc->entries, ent, i)
+		if (*ent->key != '#')
+			keys++;
+	if (pc->dead_lines <= keys)
+		return;
+	if (append_strbuf_str(&buf, PRKEYS_FILE_HEADER) < 0)
+		return;
+	vector_foreach_slot(&pc->entries, ent, i) {
+		if (*ent->key != '#' &&
+		    print_strbuf(&buf, "%s %s\n", ent->key, ent->wwid) < 0)
+			return;
+	}
+	if (safe_sprintf(tempname, "%s.XXXXXX", file))
+		return;
+	if ((fd = mkstemp(tempname)) == -1) {
+		condlog(1, "%s: mkstemp: %m", __func__);
+		return;
+	}
+	pthread_cleanup_push(close_fd, (void *)fd);
+	if (safe_write(fd, get_strbuf_str(&buf), get_strbuf_len(&buf)) == 0)
+		rc = fsync(fd);
+	pthread_cleanup_pop(1);
+	if (rc != 0 || rename(tempname, file) != 0) {
+		condlog(1, "%s: failed to replace %s: %m", __func__, file);
+		unlink(tempname);
+		return;
 	}
-	bytes = sprintf(buf, "%s %s\n", keystr, wwid);
-	if (safe_write(fd, buf, bytes) < 0) {
-		condlog(0, "failed to write to prkey file: %s",
+	condlog(3, "compacted prkeys file %s, dropped %d lines", file,
+		pc->dead_lines);
+	clear_prkeys_cache(pc);
+}
+
+static int write_prkey_at(int fd, off_t offset, const char *str, size_t len)
+{
+	if (lseek(fd, offset, SEEK_SET) < 0) {
+		condlog(0, "prkey write lseek failed : %s", strerror(errno));
+		return -1;
+	}
+	if (safe_write(fd, str, len) < 0) {
+		condlog(0, "failed to write to prkey file : %s",
 			strerror(errno));
-		return 1;
+		return -1;
 	}
 	return 0;
 }
 
+/*
+ * Set the key of wwid to keystr, or clear it if keystr is NULL.
+ * Must be called with prkeys_cache_lock held, and the cache updated for
+ * fd.
+ */
+static int write_prkey(struct prkeys_cache *pc, int fd, const char *wwid,
+		       const char *keystr)
+{
+	struct prkey_entry *ent = find_prkey(pc, wwid);
+	char line[PRKEY_SIZE + WWID_SIZE + 1];
+	struct stat st;
+	off_t offset;
+	int len, rc = 0;
+
+	if (!keystr) {
+		if (!ent || *ent->key == '#')
+			return 0;
+		if (write_prkey_at(fd, ent->offset, "#", 1) != 0)
+			goto fail;
+		*ent->key = '#';
+		pc->dead_lines++;
+	} else if (ent) {
+		if (write_prkey_at(fd, ent->offset, keystr, PRKEY_KEY_LEN) != 0)
+			goto fail;
+		if (*ent->key == '#')
+			pc->dead_lines--;
+		memcpy(ent->key, keystr, PRKEY_KEY_LEN);
+	} else {
+		len = snprintf(line, sizeof(line), "%s %s\n", keystr, wwid);
+		if (len < 0 || len >= (int)sizeof(line) ||
+		    (offset = lseek(fd, 0, SEEK_END)) < 0 ||
+		    write_prkey_at(fd, offset, line, len) != 0)
+			goto fail;
+		rc = cache_prkey(pc, keystr, wwid, strlen(wwid), offset);
+	}
+	if (rc == 0 && fstat(fd, &st) == 0) {
+		set_cache_stat(pc, &st);
+		return 0;
+	}
+	/* The file is fine, but the cache has to be reloaded */
+	clear_prkeys_cache(pc);
+	return 0;
+fail:
+	clear_prkeys_cache(pc);
+	return 1;
+}
+
 int get_prkey(struct config *conf, struct multipath *mpp, uint64_t *prkey,
 	      uint8_t *sa_flags)
 {
+	struct prkeys_cache *pc = &prkeys_cache;
+	const struct prkey_entry *ent;
+	struct stat st;
 	int fd;
 	int unused;
 	int ret = 1;
+	bool cached;
 	char keystr[PRKEY_SIZE];
 
 	if (!strlen(mpp->wwid))
 		goto out;
 
-	fd = open_file(conf->prkeys_file, &unused, PRKEYS_FILE_HEADER);
-	if (fd < 0)
-		goto out;
-	ret = do_prkey(fd, mpp->wwid, keystr, PRKEY_READ);
+	pthread_mutex_lock(&prkeys_cache_lock);
+	pthread_cleanup_push(cleanup_mutex, &prkeys_cache_lock);
+	/* Only open and lock the file if it has changed */
+	cached = stat(conf->prkeys_file, &st) == 0 &&
+		cache_matches(pc, conf->prkeys_file, &st);
+	if (!cached) {
+		fd = open_file(conf->prkeys_file, &unused, PRKEYS_FILE_HEADER);
+		if (fd >= 0) {
+			cached = update_prkeys_cache(conf->prkeys_file,
+						     fd) == 0;
+			close(fd);
+		}
+	}
+	ent = cached ? find_prkey(pc, mpp->wwid) : NULL;
+	if (ent && *ent->key != '#') {
+		memcpy(keystr, ent->key, PRKEY_SIZE);
+		ret = 0;
+	}
+	pthread_cleanup_pop(1);
 	if (ret)
-		goto out_file;
+		goto out;
+	condlog(3, "found prkey for '%s'", mpp->wwid);
 	*sa_flags = 0;
 	if (strchr(keystr, 'X'))
 		*sa_flags = MPATH_F_APTPL_MASK;
 	ret = !!parse_prkey(keystr, prkey);
-out_file:
-	close(fd);
 out:
 	return ret;
 }
@@ -154,7 +459,7 @@ int set_prkey(struct config *conf, struct multipath *mpp, uint64_t prkey,
 		sa_flags &= MPATH_F_APTPL_MASK;
 	}
 
-	fd = open_file(conf->prkeys_file, &can_write, PRKEYS_FILE_HEADER);
+	fd = open_prkeys_file(conf->prkeys_file, &can_write);
 	if (fd < 0)
 		goto out;
 	if (!can_write) {
@@ -172,10 +477,17 @@ int set_prkey(struct config *conf, struct multipath *mpp, uint64_t prkey,
 		else
 			snprintf(keystr, PRKEY_SIZE, "0x%016" PRIx64, prkey);
 		keystr[PRKEY_SIZE - 1] = '\0';
-		ret = do_prkey(fd, mpp->wwid, keystr, PRKEY_WRITE);
 	}
-	else
-		ret = do_prkey(fd, mpp->wwid, NULL, PRKEY_WRITE);
+	pthread_mutex_lock(&prkeys_cache_lock);
+	pthread_cleanup_push(cleanup_mutex, &prkeys_cache_lock);
+	if (update_prkeys_cache(conf->prkeys_file, fd) == 0) {
+		ret = write_prkey(&prkeys_cache, fd, mpp->wwid,
+				  prkey ? keystr : NULL);
+		if (ret == 0 && !prkey)
+			compact_prkeys_file(&prkeys_cache, conf->prkeys_file);
+	}
+	pthread_cleanup_pop(1);
+	/* get_prkey() takes prkeys_cache_lock */
 	if (ret == 0)
 		select_reservation_key(conf, mpp);
 	if (get_be64(mpp->reservation_key) != prkey)
@@ -17,5 +17,6 @@ int set_prkey(struct config *conf, struct multipath *mpp, uint64_t prkey,
 	      uint8_t sa_flags);
 int get_prkey(struct config *conf, struct multipath *mpp, uint64_t *prkey,
 	      uint8_t *sa_flags);
+void cleanup_prkeys(void);
 
 #endif /* _PRKEY_H */
@@ -4,6 +4,11 @@
  * Copyright (c) 2005 Kiyoshi Ueda, NEC
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "nvme-lib.h"
 #include "checkers.h"
@@ -25,6 +30,7 @@
 #include "prkey.h"
 #include "propsel.h"
 #include "strbuf.h"
+#include "strpool.h"
 #include <inttypes.h>
 #include <libudev.h>
 
@@ -90,6 +96,8 @@ static const char delay_watch_origin[] =
 	"(setting: implied by delay_watch_checks)";
 static const char delay_wait_origin[] =
 	"(setting: implied by delay_wait_checks)";
+static const char autotune_origin[] =
+	"(setting: selector_autotune)";
 
 #define do_default(dest, value)						\
 do {									\
@@ -255,12 +263,59 @@ int select_selector(struct config *conf, struct multipath * mp)
 	mp_set_conf(selector);
 	mp_set_default(selector, DEFAULT_SELECTOR);
 out:
-	mp->selector = STRDUP(mp->selector);
+	mp->selector = strpool_get(mp->selector);
 	condlog(3, "%s: path_selector = \"%s\" %s", mp->alias, mp->selector,
 		origin);
 	return 0;
 }
 
+/* repeat_count for streaming workloads, to keep merging on one path */
+#define AUTOTUNE_STREAMING_MINIO 16
+
+/*
+ * Must be called after select_selector() and select_minio(), as it
+ * replaces their result with the one for the workload observed on mp.
+ */
+int select_selector_autotune(struct config *conf, struct multipath *mp)
+{
+	const char *origin, *selector;
+	int minio;
+
+	mp_set_mpe(selector_autotune);
+	mp_set_ovr(selector_autotune);
+	mp_set_hwe(selector_autotune);
+	mp_set_conf(selector_autotune);
+	mp_set_default(selector_autotune, DEFAULT_SELECTOR_AUTOTUNE);
+out:
+	condlog(3, "%s: selector_autotune = %s %s", mp->alias,
+		mp->selector_autotune == YNU_YES ? "yes" : "no", origin);
+	if (mp->selector_autotune != YNU_YES) {
+		memset(&mp->io_tune, 0, sizeof(mp->io_tune));
+		return 0;
+	}
+
+	switch (mp->io_tune.applied) {
+	case IO_WORKLOAD_TRANSACTIONAL:
+		selector = "queue-length 0";
+		minio = 1;
+		break;
+	case IO_WORKLOAD_STREAMING:
+		selector = "round-robin 0";
+		minio = mp->minio > AUTOTUNE_STREAMING_MINIO ?
+			mp->minio : AUTOTUNE_STREAMING_MINIO;
+		break;
+	default:
+		return 0;
+	}
+	strpool_put(mp->selector);
+	mp->selector = strpool_get(selector);
+	mp->minio = minio;
+	condlog(3, "%s: path_selector = \"%s\", minio = %d %s (%s workload)",
+		mp->alias, mp->selector, mp->minio, autotune_origin,
+		io_workload_name(mp->io_tune.applied));
+	return 0;
+}
+
 static void
 select_alias_prefix (struct config *conf, struct multipath * mp)
 {
@@ -477,7 +532,7 @@ out:
 		mp->hwhandler = DEFAULT_HWHANDLER;
 		origin = tpgs_origin;
 	}
-	mp->hwhandler = STRDUP(mp->hwhandler);
+	mp->hwhandler = strpool_get(mp->hwhandler);
 	condlog(3, "%s: hardware_handler = \"%s\" %s", mp->alias, mp->hwhandler,
 		origin);
 	return 0;
@@ -675,7 +730,7 @@ int select_prio(struct config *conf, struct path *pp)
 			goto out;
 		}
 	}
-	mpe = find_mpe(conf->mptable, pp->wwid);
+	mpe = find_mpe_by_wwid(conf, pp->wwid);
 	set_prio(conf->multipath_dir, mpe, multipaths_origin);
 	set_prio(conf->multipath_dir, conf->overrides, overrides_origin);
 	set_prio_from_vec(struct hwentry, conf->multipath_dir,
@@ -1214,6 +1269,92 @@ out:
 	return 0;
 }
 
+static int parse_queue_param(const char *val, unsigned int max,
+			     unsigned int *res)
+{
+	char *end;
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(val, &end, 10);
+	if (errno || *end || end == val || *val == '-' || v > max)
+		return 1;
+	*res = v;
+	return 0;
+}
+
+/*
+ * A queue profile is a list of attribute=value pairs separated by white
+ * space, e.g. "scheduler=none nr_requests=256 read_ahead_kb=4096".
+ * Invalid entries are ignored.
+ */
+static void parse_queue_profile(const char *alias, const char *str,
+				struct queue_profile *qp)
+{
+	char *copy, *tok, *val, *save = NULL;
+
+	memset(qp, 0, sizeof(*qp));
+	if (!str || !(copy = strdup(str)))
+		return;
+
+	for (tok = strtok_r(copy, " \t", &save); tok;
+	     tok = strtok_r(NULL, " \t", &save)) {
+		val = strchr(tok, '=');
+		if (!val || val == tok || !val[1])
+			goto invalid;
+		*val++ = '\0';
+		if (!strcmp(tok, "scheduler")) {
+			if (strlen(val) >= sizeof(qp->scheduler) ||
+			    strchr(val, '/'))
+				goto invalid;
+			strlcpy(qp->scheduler, val, sizeof(qp->scheduler));
+			qp->flags |= QP_SCHEDULER;
+		} else if (!strcmp(tok, "nr_requests")) {
+			if (parse_queue_param(val, UINT_MAX, &qp->nr_requests) ||
+			    qp->nr_requests == 0)
+				goto invalid;
+			qp->flags |= QP_NR_REQUESTS;
+		} else if (!strcmp(tok, "read_ahead_kb")) {
+			if (parse_queue_param(val, UINT_MAX, &qp->read_ahead_kb))
+				goto invalid;
+			qp->flags |= QP_READ_AHEAD_KB;
+		} else if (!strcmp(tok, "rq_affinity")) {
+			if (parse_queue_param(val, 2, &qp->rq_affinity))
+				goto invalid;
+			qp->flags |= QP_RQ_AFFINITY;
+		} else if (!strcmp(tok, "nomerges")) {
+			if (parse_queue_param(val, 2, &qp->nomerges))
+				goto invalid;
+			qp->flags |= QP_NOMERGES;
+		} else
+			goto invalid;
+		continue;
+	invalid:
+		condlog(1, "%s: ignoring invalid queue_profile entry for \"%s\"",
+			alias, tok);
+	}
+	free(copy);
+}
+
+int select_queue_profile(struct config *conf, struct multipath *mp)
+{
+	const char *origin;
+	const char *profile;
+
+	do_set(queue_profile, mp->mpe, profile, multipaths_origin);
+	do_set(queue_profile, conf->overrides, profile, overrides_origin);
+	do_set_from_hwe(queue_profile, mp, profile, hwe_origin);
+	do_set(queue_profile, conf, profile, conf_origin);
+	/* Like max_sectors_kb, queue settings aren't touched by default */
+	memset(&mp->queue_profile, 0, sizeof(mp->queue_profile));
+	return 0;
+out:
+	parse_queue_profile(mp->alias, profile, &mp->queue_profile);
+	condlog(3, "%s: queue_profile = \"%s\" %s", mp->alias, profile,
+		origin);
+	return 0;
+}
+
 int select_ghost_delay (struct config *conf, struct multipath * mp)
 {
 	const char *origin;
@@ -1231,6 +1372,244 @@ out:
 	return 0;
 }
 
+int select_fast_checkint(struct config *conf, struct multipath *mp)
+{
+	const char *origin;
+	STRBUF_ON_STACK(buff);
+
+	mp_set_mpe(fast_checkint);
+	mp_set_ovr(fast_checkint);
+	mp_set_hwe(fast_checkint);
+	mp_set_conf(fast_checkint);
+	mp_set_default(fast_checkint, DEFAULT_FAST_CHECKINT);
+out:
+	if (mp->fast_checkint > 0 && mp->fast_checkint < MIN_FAST_CHECKINT) {
+		condlog(2, "%s: fast_polling_interval %dms is too short, using %dms",
+			mp->alias, mp->fast_checkint, MIN_FAST_CHECKINT);
+		mp->fast_checkint = MIN_FAST_CHECKINT;
+	}
+	if (print_off_int_undef(&buff, mp->fast_checkint) != 0)
+		condlog(3, "%s: fast_polling_interval = %s %s", mp->alias,
+			get_strbuf_str(&buff), origin);
+	return 0;
+}
+
+int select_array_check_rate(struct config *conf, struct multipath *mp)
+{
+	const char *origin;
+	STRBUF_ON_STACK(buff);
+
+	mp_set_ovr(array_check_rate);
+	mp_set_hwe(array_check_rate);
+	mp_set_conf(array_check_rate);
+	mp_set_default(array_check_rate, DEFAULT_ARRAY_CHECK_RATE);
+out:
+	if (print_off_int_undef(&buff, mp->array_check_rate) != 0)
+		condlog(3, "%s: array_check_rate = %s %s", mp->alias,
+			get_strbuf_str(&buff), origin);
+	return 0;
+}
+
+/*
+ * Cache for the map properties which only depend on the configuration,
+ * the hwentries and the multipaths entry of a map. Maps on the same kind
+ * of storage without a multipaths entry of their own always get the same
+ * values, so the configuration is only walked once for each combination.
+ * Entries are only valid for the config they were computed with, and
+ * are dropped by flush_propsel_cache() when a config is freed.
+ */
+#define PROPSEL_CACHE_SIZE 16
+#define PROPSEL_CACHE_HWES 4
+#define ATTR_FLAGS_MASK ((1 << ATTR_UID) | (1 << ATTR_GID) | (1 << ATTR_MODE))
+
+struct static_props {
+	const struct config *conf;
+	const struct mpentry *mpe;
+	int n_hwe;
+	const struct hwentry *hwe[PROPSEL_CACHE_HWES];
+	/* the map the values were selected for, for logging */
+	char alias[WWID_SIZE];
+
+	int pgfailback;
+	int pgpolicy;
+	int rr_weight;
+	int minio;
+	int attribute_flags;
+	uid_t uid;
+	gid_t gid;
+	mode_t mode;
+	int fast_io_fail;
+	unsigned int dev_loss;
+	int eh_deadline;
+	int flush_on_last_del;
+	int marginal_path_err_sample_time;
+	int marginal_path_err_rate_threshold;
+	int marginal_path_err_recheck_gap_time;
+	int marginal_path_double_failed_time;
+	int san_path_err_threshold;
+	int san_path_err_forget_rate;
+	int san_path_err_recovery_time;
+	int skip_kpartx;
+	int max_sectors_kb;
+	struct queue_profile queue_profile;
+	int ghost_delay;
+	int fast_checkint;
+	int array_check_rate;
+};
+
+static pthread_mutex_t propsel_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct static_props propsel_cache[PROPSEL_CACHE_SIZE];
+static int propsel_cache_next;
+
+static bool static_props_match(const struct static_props *sp,
+			       const struct config *conf,
+			       const struct multipath *mp)
+{
+	const struct hwentry *hwe;
+	int i;
+
+	if (sp->conf != conf || sp->mpe != mp->mpe ||
+	    sp->n_hwe != VECTOR_SIZE(mp->hwe))
+		return false;
+	vector_foreach_slot(mp->hwe, hwe, i)
+		if (sp->hwe[i] != hwe)
+			return false;
+	return true;
+}
+
+static void copy_static_props(struct static_props *sp, struct multipath *mp,
+			      bool to_map)
+{
+#define __copy(var)				\
+	do {					\
+		if (to_map)			\
+			mp->var = sp->var;	\
+		else				\
+			sp->var = mp->var;	\
+	} while (0)
+
+	__copy(pgfailback);
+	__copy(pgpolicy);
+	__copy(rr_weight);
+	__copy(minio);
+	__copy(uid);
+	__copy(gid);
+	__copy(mode);
+	__copy(fast_io_fail);
+	__copy(dev_loss);
+	__copy(eh_deadline);
+	__copy(flush_on_last_del);
+	__copy(marginal_path_err_sample_time);
+	__copy(marginal_path_err_rate_threshold);
+	__copy(marginal_path_err_recheck_gap_time);
+	__copy(marginal_path_double_failed_time);
+	__copy(san_path_err_threshold);
+	__copy(san_path_err_forget_rate);
+	__copy(san_path_err_recovery_time);
+	__copy(skip_kpartx);
+	__copy(max_sectors_kb);
+	__copy(queue_profile);
+	__copy(ghost_delay);
+	__copy(fast_checkint);
+	__copy(array_check_rate);
+#undef __copy
+	if (to_map) {
+		mp->attribute_flags = (mp->attribute_flags & ~ATTR_FLAGS_MASK) |
+			(sp->attribute_flags & ATTR_FLAGS_MASK);
+		mp->pgpolicyfn = pgpolicies[mp->pgpolicy];
+	} else
+		sp->attribute_flags = mp->attribute_flags & ATTR_FLAGS_MASK;
+}
+
+static bool get_cached_static_props(const struct config *conf,
+				    struct multipath *mp)
+{
+	int i;
+	bool found = false;
+
+	pthread_mutex_lock(&propsel_cache_lock);
+	for (i = 0; i < PROPSEL_CACHE_SIZE; i++) {
+		if (static_props_match(&propsel_cache[i], conf, mp)) {
+			copy_static_props(&propsel_cache[i], mp, true);
+			condlog(3, "%s: using properties selected for %s",
+				mp->alias, propsel_cache[i].alias);
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&propsel_cache_lock);
+	return found;
+}
+
+static void put_cached_static_props(const struct config *conf,
+				    struct multipath *mp)
+{
+	struct static_props *sp;
+	const struct hwentry *hwe;
+	int i;
+
+	if (VECTOR_SIZE(mp->hwe) > PROPSEL_CACHE_HWES)
+		return;
+
+	pthread_mutex_lock(&propsel_cache_lock);
+	sp = &propsel_cache[propsel_cache_next];
+	propsel_cache_next = (propsel_cache_next + 1) % PROPSEL_CACHE_SIZE;
+	sp->conf = conf;
+	sp->mpe = mp->mpe;
+	sp->n_hwe = VECTOR_SIZE(mp->hwe);
+	vector_foreach_slot(mp->hwe, hwe, i)
+		sp->hwe[i] = hwe;
+	strlcpy(sp->alias, mp->alias ? mp->alias : mp->wwid, sizeof(sp->alias));
+	copy_static_props(sp, mp, false);
+	pthread_mutex_unlock(&propsel_cache_lock);
+}
+
+void select_static_props(struct config *conf, struct multipath *mp)
+{
+	if (get_cached_static_props(conf, mp))
+		return;
+
+	select_pgfailback(conf, mp);
+	select_pgpolicy(conf, mp);
+	select_rr_weight(conf, mp);
+	select_minio(conf, mp);
+	select_mode(conf, mp);
+	select_uid(conf, mp);
+	select_gid(conf, mp);
+	select_fast_io_fail(conf, mp);
+	select_dev_loss(conf, mp);
+	select_eh_deadline(conf, mp);
+	select_flush_on_last_del(conf, mp);
+	/* the san_path and delay_checks options depend on marginal_path */
+	select_marginal_path_err_sample_time(conf, mp);
+	select_marginal_path_err_rate_threshold(conf, mp);
+	select_marginal_path_err_recheck_gap_time(conf, mp);
+	select_marginal_path_double_failed_time(conf, mp);
+	select_san_path_err_threshold(conf, mp);
+	select_san_path_err_forget_rate(conf, mp);
+	select_san_path_err_recovery_time(conf, mp);
+	select_delay_checks(conf, mp);
+	select_skip_kpartx(conf, mp);
+	select_max_sectors_kb(conf, mp);
+	select_queue_profile(conf, mp);
+	select_ghost_delay(conf, mp);
+	select_fast_checkint(conf, mp);
+	select_array_check_rate(conf, mp);
+
+	put_cached_static_props(conf, mp);
+}
+
+void flush_propsel_cache(const struct config *conf)
+{
+	int i;
+
+	pthread_mutex_lock(&propsel_cache_lock);
+	for (i = 0; i < PROPSEL_CACHE_SIZE; i++)
+		if (!conf || propsel_cache[i].conf == conf)
+			propsel_cache[i].conf = NULL;
+	pthread_mutex_unlock(&propsel_cache_lock);
+}
+
 int select_find_multipaths_timeout(struct config *conf, struct path *pp)
 {
 	const char *origin;
@@ -2,6 +2,7 @@ int select_rr_weight (struct config *conf, struct multipath * mp);
 int select_pgfailback (struct config *conf, struct multipath * mp);
 int select_pgpolicy (struct config *conf, struct multipath * mp);
 int select_selector (struct config *conf, struct multipath * mp);
+int select_selector_autotune(struct config *conf, struct multipath *mp);
 int select_alias (struct config *conf, struct multipath * mp);
 int select_features (struct config *conf, struct multipath * mp);
 int select_hwhandler (struct config *conf, struct multipath * mp);
@@ -27,6 +28,7 @@ int select_deferred_remove(struct config *conf, struct multipath *mp);
 int select_delay_checks(struct config *conf, struct multipath * mp);
 int select_skip_kpartx (struct config *conf, struct multipath * mp);
 int select_max_sectors_kb (struct config *conf, struct multipath * mp);
+int select_queue_profile(struct config *conf, struct multipath *mp);
 int select_san_path_err_forget_rate(struct config *conf, struct multipath *mp);
 int select_san_path_err_threshold(struct config *conf, struct multipath *mp);
 int select_san_path_err_recovery_time(struct config *conf, struct multipath *mp);
@@ -35,8 +37,18 @@ int select_marginal_path_err_rate_threshold(struct config *conf, struct multipat
 int select_marginal_path_err_recheck_gap_time(struct config *conf, struct multipath *mp);
 int select_marginal_path_double_failed_time(struct config *conf, struct multipath *mp);
 int select_ghost_delay(struct config *conf, struct multipath * mp);
+int select_fast_checkint(struct config *conf, struct multipath *mp);
+int select_array_check_rate(struct config *conf, struct multipath *mp);
 void reconcile_features_with_options(const char *id, char **features,
 				     int* no_path_retry,
 				     int *retain_hwhandler);
 int select_all_tg_pt (struct config *conf, struct multipath * mp);
+/*
+ * Select all map properties that only depend on the configuration,
+ * mp->hwe and mp->mpe, using cached values of an earlier map with
+ * the same settings if possible.
+ */
+void select_static_props(struct config *conf, struct multipath *mp);
+/* drop cached selections for conf, or for all configs if conf is NULL */
+void flush_propsel_cache(const struct config *conf);
 int select_vpd_vendor_id (struct path *pp);
@@ -0,0 +1,248 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <mntent.h>
+#include <sys/stat.h>
+#include <libudev.h>
+
+#include "memory.h"
+#include "vector.h"
+#include "util.h"
+#include "debug.h"
+#include "config.h"
+#include "structs.h"
+#include "devmapper.h"
+#include "startup_order.h"
+
+/* Stacked devices are followed this deep to find the multipath maps */
+#define BOOT_DEV_MAX_DEPTH 8
+#define PART_UUID_INFIX "-" UUID_PREFIX
+
+struct boot_devs {
+	/* WWIDs of multipath maps */
+	vector wwids;
+	/* kernel names of disks that aren't multipathed yet */
+	vector disks;
+};
+
+static bool has_str(const struct _vector *v, const char *str)
+{
+	const char *s;
+	int i;
+
+	vector_foreach_slot(v, s, i)
+		if (!strcmp(s, str))
+			return true;
+	return false;
+}
+
+static void add_str(vector v, const char *str)
+{
+	char *s;
+
+	/* free_strvec() frees with FREE() */
+	if (has_str(v, str) || !(s = STRDUP(str)))
+		return;
+	if (!vector_alloc_slot(v)) {
+		FREE(s);
+		return;
+	}
+	vector_set_slot(v, s);
+}
+
+static void add_boot_udev(struct boot_devs *bd, struct udev_device *ud,
+			  int depth)
+{
+	struct udev_device *parent;
+	const char *uuid, *p;
+	char slaves[PATH_MAX];
+	struct dirent *de;
+	DIR *dir;
+
+	if (!strcmp(udev_device_get_devtype(ud) ?: "", "partition")) {
+		parent = udev_device_get_parent_with_subsystem_devtype(
+			ud, "block", "disk");
+		if (!parent)
+			return;
+		ud = parent;
+	}
+
+	uuid = udev_device_get_sysattr_value(ud, "dm/uuid");
+	if (!uuid) {
+		add_str(bd->disks, udev_device_get_sysname(ud));
+		return;
+	}
+	if (!strncmp(uuid, UUID_PREFIX, UUID_PREFIX_LEN)) {
+		add_str(bd->wwids, uuid + UUID_PREFIX_LEN);
+		return;
+	}
+	/* kpartx partition maps are named "part<N>-mpath-<WWID>" */
+	if (!strncmp(uuid, "part", 4) &&
+	    (p = strstr(uuid, PART_UUID_INFIX)) != NULL) {
+		add_str(bd->wwids, p + sizeof(PART_UUID_INFIX) - 1);
+		return;
+	}
+
+	if (depth >= BOOT_DEV_MAX_DEPTH ||
+	    safe_sprintf(slaves, "%s/slaves", udev_device_get_syspath(ud)) ||
+	    !(dir = opendir(slaves)))
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		struct udev_device *slave;
+
+		if (de->d_name[0] == '.')
+			continue;
+		slave = udev_device_new_from_subsystem_sysname(udev, "block",
+							       de->d_name);
+		if (!slave)
+			continue;
+		add_boot_udev(bd, slave, depth + 1);
+		udev_device_unref(slave);
+	}
+	closedir(dir);
+}
+
+/* spec is a device as in the first field of fstab */
+static void add_boot_spec(struct boot_devs *bd, const char *spec)
+{
+	static const struct {
+		const char *tag;
+		const char *dir;
+	} tags[] = {
+		{ "UUID=", "/dev/disk/by-uuid/" },
+		{ "LABEL=", "/dev/disk/by-label/" },
+		{ "PARTUUID=", "/dev/disk/by-partuuid/" },
+		{ "PARTLABEL=", "/dev/disk/by-partlabel/" },
+	};
+	char devnode[PATH_MAX];
+	struct udev_device *ud;
+	struct stat st;
+	size_t i, len;
+
+	for (i = 0; i < ARRAY_SIZE(tags); i++) {
+		len = strlen(tags[i].tag);
+		if (!strncmp(spec, tags[i].tag, len))
+			break;
+	}
+	if (i < ARRAY_SIZE(tags)) {
+		if (safe_sprintf(devnode, "%s%s", tags[i].dir, spec + len))
+			return;
+	} else if (spec[0] != '/' || strlcpy(devnode, spec, sizeof(devnode))
+		   >= sizeof(devnode))
+		return;
+
+	if (stat(devnode, &st) != 0 || !S_ISBLK(st.st_mode))
+		return;
+	ud = udev_device_new_from_devnum(udev, 'b', st.st_rdev);
+	if (!ud)
+		return;
+	condlog(4, "%s: boot device %s", __func__, devnode);
+	add_boot_udev(bd, ud, 0);
+	udev_device_unref(ud);
+}
+
+static void collect_boot_devs(struct boot_devs *bd)
+{
+	char cmdline[4096], *tok, *save = NULL;
+	struct mntent *ent;
+	FILE *f;
+
+	f = setmntent("/etc/fstab", "r");
+	if (f) {
+		while ((ent = getmntent(f)) != NULL) {
+			/* the boot doesn't wait for these */
+			if (hasmntopt(ent, "noauto") || hasmntopt(ent, "nofail"))
+				continue;
+			add_boot_spec(bd, ent->mnt_fsname);
+		}
+		endmntent(f);
+	}
+
+	/* the initrd may have no fstab, but the root device is here */
+	f = fopen("/proc/cmdline", "r");
+	if (!f)
+		return;
+	if (fgets(cmdline, sizeof(cmdline), f)) {
+		for (tok = strtok_r(cmdline, " \t\n", &save); tok;
+		     tok = strtok_r(NULL, " \t\n", &save)) {
+			if (!strncmp(tok, "root=", 5))
+				add_boot_spec(bd, tok + 5);
+			else if (!strncmp(tok, "resume=", 7))
+				add_boot_spec(bd, tok + 7);
+		}
+	}
+	fclose(f);
+}
+
+struct startup_ent {
+	struct path *pp;
+	int prio;
+	int idx;
+};
+
+static int startup_ent_cmp(const void *a, const void *b)
+{
+	const struct startup_ent *e1 = a, *e2 = b;
+
+	if (e1->prio != e2->prio)
+		return e1->prio > e2->prio ? -1 : 1;
+	/* qsort() isn't stable, keep the discovery order otherwise */
+	return e1->idx - e2->idx;
+}
+
+void sort_paths_by_startup_priority(vector pathvec)
+{
+	struct boot_devs bd = { .wwids = vector_alloc(),
+				.disks = vector_alloc(), };
+	struct startup_ent *ents = NULL;
+	struct config *conf;
+	struct mpentry *mpe;
+	struct path *pp;
+	int i, n = 0, nr_prio = 0;
+
+	if (VECTOR_SIZE(pathvec) <= 1 || !bd.wwids || !bd.disks)
+		goto out;
+	ents = malloc(VECTOR_SIZE(pathvec) * sizeof(*ents));
+	if (!ents)
+		goto out;
+
+	collect_boot_devs(&bd);
+	/* all paths of a map go first, if one of them is a boot device */
+	vector_foreach_slot(pathvec, pp, i)
+		if (*pp->wwid && has_str(bd.disks, pp->dev))
+			add_str(bd.wwids, pp->wwid);
+
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	vector_foreach_slot(pathvec, pp, i) {
+		ents[n].pp = pp;
+		ents[n].idx = n;
+		mpe = find_mpe_by_wwid(conf, pp->wwid);
+		if (mpe && mpe->startup_priority)
+			ents[n].prio = mpe->startup_priority;
+		else if (*pp->wwid && has_str(bd.wwids, pp->wwid))
+			ents[n].prio = BOOT_STARTUP_PRIORITY;
+		else
+			ents[n].prio = 0;
+		if (ents[n].prio)
+			nr_prio++;
+		n++;
+	}
+	pthread_cleanup_pop(1);
+
+	if (nr_prio) {
+		condlog(3, "setting up %d paths with a startup priority first",
+			nr_prio);
+		qsort(ents, n, sizeof(*ents), startup_ent_cmp);
+		for (i = 0; i < n; i++)
+			pathvec->slot[i] = ents[i].pp;
+	}
+out:
+	free(ents);
+	free_strvec(bd.wwids);
+	free_strvec(bd.disks);
+}
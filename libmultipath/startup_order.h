@@ -0,0 +1,22 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _STARTUP_ORDER_H
+#define _STARTUP_ORDER_H
+
+#include "vector.h"
+
+/*
+ * Reorder pathvec so that coalesce_paths() sets up the maps with a
+ * higher startup priority first. The priority of a map is its
+ * startup_priority from the multipaths section. Maps without one get
+ * BOOT_STARTUP_PRIORITY if they hold a file system or swap device from
+ * /etc/fstab, or the root= or resume= device of the kernel command line,
+ * also through stacked devices like LVM. The other paths keep their
+ * order.
+ */
+#define BOOT_STARTUP_PRIORITY 1
+
+void sort_paths_by_startup_priority(vector pathvec);
+
+#endif /* _STARTUP_ORDER_H */
@@ -74,7 +74,7 @@ int truncate_strbuf(struct strbuf *buf, size_t offs)
 
 #define BUF_CHUNK 64
 
-static int expand_strbuf(struct strbuf *buf, int addsz)
+static int __expand_strbuf(struct strbuf *buf, int addsz, bool exact)
 {
 	size_t add;
 	char *tmp;
@@ -87,6 +87,9 @@ static int expand_strbuf(struct strbuf *buf, int addsz)
 
 	add = ((addsz - (buf->size - buf->offs)) / BUF_CHUNK + 1)
 		* BUF_CHUNK;
+	/* Grow geometrically, so that large outputs don't realloc often */
+	if (!exact && add < buf->size)
+		add = buf->size;
 
 	if (buf->size >= SIZE_MAX - add) {
 		add = SIZE_MAX - buf->size;
@@ -105,6 +108,16 @@ static int expand_strbuf(struct strbuf *buf, int addsz)
 	return 0;
 }
 
+static int expand_strbuf(struct strbuf *buf, int addsz)
+{
+	return __expand_strbuf(buf, addsz, false);
+}
+
+int reserve_strbuf(struct strbuf *buf, int len)
+{
+	return __expand_strbuf(buf, len, true);
+}
+
 int __append_strbuf_str(struct strbuf *buf, const char *str, int slen)
 {
 	int ret;
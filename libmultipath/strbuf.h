@@ -97,6 +97,18 @@ size_t get_strbuf_len(const struct strbuf *buf);
  */
 int truncate_strbuf(struct strbuf *buf, size_t offs);
 
+/**
+ * reserve_strbuf(): preallocate space
+ * @param buf: the struct strbuf to expand
+ * @param len: number of characters expected to be appended
+ * @returns: 0 on success, negative error code otherwise.
+ *
+ * Makes sure that @len more characters can be appended to @buf without
+ * reallocating. Use this before producing large output of roughly
+ * known size.
+ */
+int reserve_strbuf(struct strbuf *buf, int len);
+
 /**
  * __append_strbuf_str(): append string of known length
  * @param buf: the struct strbuf to write to
@@ -0,0 +1,108 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strpool.h"
+
+#define STRPOOL_HASH_SIZE 256
+
+struct strpool_ent {
+	struct strpool_ent *next;
+	unsigned int hash;
+	int refcount;
+	char str[];
+};
+
+static pthread_mutex_t strpool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct strpool_ent *strpool_hash[STRPOOL_HASH_SIZE];
+
+/* hash_str() for at most len characters */
+static unsigned int hash_strn(const char *s, size_t len)
+{
+	unsigned int h = 2166136261U;
+
+	while (len-- > 0 && *s)
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+const char *strpool_getn(const char *s, size_t len)
+{
+	struct strpool_ent *ent, **head;
+	unsigned int hash;
+
+	if (!s)
+		return NULL;
+	len = strnlen(s, len);
+	hash = hash_strn(s, len);
+	head = &strpool_hash[hash % STRPOOL_HASH_SIZE];
+
+	pthread_mutex_lock(&strpool_lock);
+	for (ent = *head; ent; ent = ent->next) {
+		if (ent->hash == hash && !strncmp(ent->str, s, len) &&
+		    ent->str[len] == '\0') {
+			ent->refcount++;
+			goto out;
+		}
+	}
+	ent = malloc(sizeof(*ent) + len + 1);
+	if (ent) {
+		memcpy(ent->str, s, len);
+		ent->str[len] = '\0';
+		ent->hash = hash;
+		ent->refcount = 1;
+		ent->next = *head;
+		*head = ent;
+	}
+out:
+	pthread_mutex_unlock(&strpool_lock);
+	return ent ? ent->str : NULL;
+}
+
+const char *strpool_get(const char *s)
+{
+	return strpool_getn(s, s ? strlen(s) : 0);
+}
+
+static struct strpool_ent *strpool_entry(const char *s)
+{
+	/* the pool owns the string, it's only const for the users */
+	return (struct strpool_ent *)((uintptr_t)s -
+				      offsetof(struct strpool_ent, str));
+}
+
+const char *strpool_ref(const char *s)
+{
+	if (s) {
+		pthread_mutex_lock(&strpool_lock);
+		strpool_entry(s)->refcount++;
+		pthread_mutex_unlock(&strpool_lock);
+	}
+	return s;
+}
+
+void strpool_put(const char *s)
+{
+	struct strpool_ent *ent, **p;
+
+	if (!s)
+		return;
+	ent = strpool_entry(s);
+	pthread_mutex_lock(&strpool_lock);
+	if (--ent->refcount > 0) {
+		pthread_mutex_unlock(&strpool_lock);
+		return;
+	}
+	for (p = &strpool_hash[ent->hash % STRPOOL_HASH_SIZE];
+	     *p && *p != ent; p = &(*p)->next)
+		;
+	if (*p)
+		*p = ent->next;
+	pthread_mutex_unlock(&strpool_lock);
+	free(ent);
+}
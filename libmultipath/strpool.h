@@ -0,0 +1,26 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _STRPOOL_H
+#define _STRPOOL_H
+
+#include <stddef.h>
+
+/*
+ * Refcounted pool of immutable strings, for map attributes that are
+ * equal for many maps (path selector, hardware handler). Equal strings
+ * from the pool have equal pointers.
+ *
+ * Strings from the pool must be released with strpool_put(), never
+ * with free().
+ */
+
+/* Returns the pooled copy of s, or NULL on allocation failure */
+const char *strpool_get(const char *s);
+/* Like strpool_get() for the first len characters of s */
+const char *strpool_getn(const char *s, size_t len);
+/* Takes another reference to a pooled string */
+const char *strpool_ref(const char *s);
+void strpool_put(const char *s);
+
+#endif /* _STRPOOL_H */
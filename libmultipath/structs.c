@@ -3,9 +3,13 @@
  * Copyright (c) 2004 Stefan Bader, IBM
  */
 #include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <libdevmapper.h>
 #include <libudev.h>
+#include <urcu/uatomic.h>
 
 #include "checkers.h"
 #include "memory.h"
@@ -19,6 +23,13 @@
 #include "prio.h"
 #include "prioritizers/alua_spc3.h"
 #include "dm-generic.h"
+#include "check_sched.h"
+#include "prio_async.h"
+#include "strpool.h"
+#include "objpool.h"
+#include "switchgroup.h"
+#include "time-util.h"
+#include "lun_cache.h"
 
 struct adapter_group *
 alloc_adaptergroup(void)
@@ -84,14 +95,194 @@ alloc_hostgroup(void)
 	return hgp;
 }
 
+#define IDENT_HASH_SIZE 1024
+
+/* Interned identification strings, see struct path_ident */
+static pthread_mutex_t ident_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct path_ident *ident_hash[IDENT_HASH_SIZE];
+
+static unsigned int ident_hash_value(const struct path_ident *id)
+{
+	unsigned int h;
+
+	h = hash_str(id->vendor_id);
+	h = h * 31 + hash_str(id->product_id);
+	h = h * 31 + hash_str(id->rev);
+	h = h * 31 + hash_str(id->serial);
+	return h * 31 + hash_str(id->tgt_node_name);
+}
+
+static bool ident_equal(const struct path_ident *a,
+			const struct path_ident *b)
+{
+	return !strcmp(a->vendor_id, b->vendor_id) &&
+		!strcmp(a->product_id, b->product_id) &&
+		!strcmp(a->rev, b->rev) &&
+		!strcmp(a->serial, b->serial) &&
+		!strcmp(a->tgt_node_name, b->tgt_node_name);
+}
+
+static struct path_ident *copy_path_ident(const struct path_ident *id)
+{
+	struct path_ident *new = malloc(sizeof(*new));
+
+	if (new) {
+		memcpy(new, id, sizeof(*new));
+		new->refcount = 0;
+		new->hash = 0;
+		new->next = NULL;
+	}
+	return new;
+}
+
+/* Called with ident_lock held */
+static void unhash_path_ident(struct path_ident *id)
+{
+	struct path_ident **p = &ident_hash[id->hash % IDENT_HASH_SIZE];
+
+	while (*p && *p != id)
+		p = &(*p)->next;
+	if (*p)
+		*p = id->next;
+	id->next = NULL;
+}
+
+struct path_ident *get_path_ident(struct path_ident *id)
+{
+	if (!id)
+		return NULL;
+	pthread_mutex_lock(&ident_lock);
+	if (id->refcount > 0) {
+		id->refcount++;
+		pthread_mutex_unlock(&ident_lock);
+		return id;
+	}
+	pthread_mutex_unlock(&ident_lock);
+	return copy_path_ident(id);
+}
+
+void put_path_ident(struct path_ident *id)
+{
+	if (!id)
+		return;
+	pthread_mutex_lock(&ident_lock);
+	if (id->refcount > 0) {
+		if (--id->refcount > 0) {
+			pthread_mutex_unlock(&ident_lock);
+			return;
+		}
+		unhash_path_ident(id);
+	}
+	pthread_mutex_unlock(&ident_lock);
+	free(id);
+}
+
+void intern_path_ident(struct path *pp)
+{
+	struct path_ident *id = pp->ident, *p;
+	unsigned int hash;
+
+	if (!id || id->refcount > 0)
+		return;
+	hash = ident_hash_value(id);
+	pthread_mutex_lock(&ident_lock);
+	for (p = ident_hash[hash % IDENT_HASH_SIZE]; p; p = p->next) {
+		if (p->hash == hash && ident_equal(p, id))
+			break;
+	}
+	if (p) {
+		p->refcount++;
+		pp->ident = p;
+	} else {
+		id->hash = hash;
+		id->refcount = 1;
+		id->next = ident_hash[hash % IDENT_HASH_SIZE];
+		ident_hash[hash % IDENT_HASH_SIZE] = id;
+	}
+	pthread_mutex_unlock(&ident_lock);
+	if (p)
+		free(id);
+}
+
+int unshare_path_ident(struct path *pp)
+{
+	struct path_ident *id = pp->ident, *new;
+
+	if (!id) {
+		pp->ident = calloc(1, sizeof(*pp->ident));
+		return pp->ident ? 0 : 1;
+	}
+	pthread_mutex_lock(&ident_lock);
+	if (id->refcount == 0) {
+		pthread_mutex_unlock(&ident_lock);
+		return 0;
+	}
+	if (id->refcount == 1) {
+		/* last user, take it back */
+		unhash_path_ident(id);
+		id->refcount = 0;
+		pthread_mutex_unlock(&ident_lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&ident_lock);
+	new = copy_path_ident(id);
+	if (!new)
+		return 1;
+	put_path_ident(id);
+	pp->ident = new;
+	return 0;
+}
+
+/* Paths are freed and allocated in bulk on reconfigure and rescans */
+#define PATH_POOL_MAX_FREE 1024
+
+static struct obj_pool path_pool =
+	OBJ_POOL_INIT(sizeof(struct path), PATH_POOL_MAX_FREE);
+
+void cleanup_path_pool(void)
+{
+	obj_pool_drain(&path_pool);
+}
+
+/* see get_path_totals() */
+static struct path_totals path_totals;
+
+static void count_path_total(const struct path *pp, int delta)
+{
+	if (pp->state >= 0 && pp->state < PATH_MAX_STATE)
+		uatomic_add(&path_totals.nr[pp->state], delta);
+	if (pp->fd >= 0)
+		uatomic_add(&path_totals.monitored, delta);
+}
+
+void get_path_totals(struct path_totals *pt)
+{
+	int i;
+
+	for (i = 0; i < PATH_MAX_STATE; i++)
+		pt->nr[i] = uatomic_read(&path_totals.nr[i]);
+	pt->monitored = uatomic_read(&path_totals.monitored);
+}
+
+void path_fd_opened(const struct path *pp)
+{
+	if (pp->totaled && pp->fd >= 0)
+		uatomic_inc(&path_totals.monitored);
+}
+
 struct path *
 alloc_path (void)
 {
 	struct path * pp;
 
-	pp = (struct path *)MALLOC(sizeof(struct path));
+	pp = obj_pool_get(&path_pool);
 
 	if (pp) {
+		pp->ident = calloc(1, sizeof(*pp->ident));
+		if (!pp->ident) {
+			free(pp);
+			return NULL;
+		}
 		pp->initialized = INIT_NEW;
 		pp->sg_id.host_no = -1;
 		pp->sg_id.channel = -1;
@@ -99,13 +290,21 @@ alloc_path (void)
 		pp->sg_id.lun = SCSI_INVALID_LUN;
 		pp->sg_id.proto_id = SCSI_PROTOCOL_UNSPEC;
 		pp->fd = -1;
+		sysfs_attr_fd_init(&pp->state_attr);
+		path_health_init(&pp->health);
 		pp->tpgs = TPGS_UNDEF;
 		pp->priority = PRIO_UNDEF;
 		pp->checkint = CHECKINT_UNDEF;
+		pp->prechecked_state = PATH_MAX_STATE;
+		INIT_LIST_HEAD(&pp->sched_node);
+		INIT_LIST_HEAD(&pp->fast_node);
+		INIT_LIST_HEAD(&pp->pending_node);
+		pp->numa_node = NUMA_NODE_UNSET;
 		checker_clear(&pp->checker);
 		dm_path_to_gen(pp)->ops = &dm_gen_path_ops;
 		pp->hwe = vector_alloc();
 		if (pp->hwe == NULL) {
+			free(pp->ident);
 			free(pp);
 			return NULL;
 		}
@@ -126,13 +325,18 @@ uninitialize_path(struct path *pp)
 	if (checker_selected(&pp->checker))
 		checker_put(&pp->checker);
 
+	prio_async_release(pp);
 	if (prio_selected(&pp->prio))
 		prio_put(&pp->prio);
 
 	if (pp->fd >= 0) {
+		if (pp->totaled)
+			uatomic_dec(&path_totals.monitored);
 		close(pp->fd);
 		pp->fd = -1;
 	}
+	sysfs_attr_fd_close(&pp->state_attr);
+	path_health_close(&pp->health);
 }
 
 void
@@ -141,6 +345,11 @@ free_path (struct path * pp)
 	if (!pp)
 		return;
 
+	unschedule_path_check(pp);
+	if (pp->totaled) {
+		count_path_total(pp, -1);
+		pp->totaled = false;
+	}
 	uninitialize_path(pp);
 
 	if (pp->udev) {
@@ -149,10 +358,12 @@ free_path (struct path * pp)
 	}
 	if (pp->vpd_data)
 		free(pp->vpd_data);
+	free(pp->transport);
 
 	vector_free(pp->hwe);
+	put_path_ident(pp->ident);
 
-	FREE(pp);
+	obj_pool_put(&path_pool, pp);
 }
 
 void
@@ -229,7 +440,13 @@ alloc_multipath (void)
 		mpp->mpcontext = NULL;
 		mpp->no_path_retry = NO_PATH_RETRY_UNDEF;
 		mpp->fast_io_fail = MP_FAST_IO_FAIL_UNSET;
+		mpp->stats_region = IO_STATS_NO_REGION;
+		/* not synced yet */
+		mpp->msgs_evts = -1;
+		INIT_LIST_HEAD(&mpp->timer_node);
 		dm_multipath_to_gen(mpp)->ops = &dm_gen_multipath_ops;
+		/* without it, paths are counted on every call */
+		mpp->path_counts = calloc(1, sizeof(*mpp->path_counts));
 	}
 	return mpp;
 }
@@ -250,20 +467,16 @@ void free_multipath_attributes(struct multipath *mpp)
 	if (!mpp)
 		return;
 
-	if (mpp->selector) {
-		FREE(mpp->selector);
-		mpp->selector = NULL;
-	}
+	strpool_put(mpp->selector);
+	mpp->selector = NULL;
 
 	if (mpp->features) {
 		FREE(mpp->features);
 		mpp->features = NULL;
 	}
 
-	if (mpp->hwhandler) {
-		FREE(mpp->hwhandler);
-		mpp->hwhandler = NULL;
-	}
+	strpool_put(mpp->hwhandler);
+	mpp->hwhandler = NULL;
 }
 
 void
@@ -272,6 +485,7 @@ free_multipath (struct multipath * mpp, enum free_path_mode free_paths)
 	if (!mpp)
 		return;
 
+	unschedule_map_timers(mpp);
 	free_multipath_attributes(mpp);
 
 	if (mpp->alias) {
@@ -283,6 +497,12 @@ free_multipath (struct multipath * mpp, enum free_path_mode free_paths)
 		FREE(mpp->dmi);
 		mpp->dmi = NULL;
 	}
+	free(mpp->cached_params);
+	free(mpp->pg_table);
+	free(mpp->pg_status);
+	free(mpp->loaded_params);
+	free(mpp->loaded_table);
+	free(mpp->path_counts);
 
 	if (!free_paths && mpp->pg) {
 		struct pathgroup *pgp;
@@ -314,12 +534,14 @@ drop_multipath (vector mpvec, char * wwid, enum free_path_mode free_paths)
 {
 	int i;
 	struct multipath * mpp;
+	unsigned int hash;
 
 	if (!mpvec)
 		return;
 
+	hash = wwid_hash(wwid);
 	vector_foreach_slot (mpvec, mpp, i) {
-		if (!strncmp(mpp->wwid, wwid, WWID_SIZE)) {
+		if (same_wwid(mpp->wwid, mpp->wwid_hash, wwid, hash)) {
 			free_multipath(mpp, free_paths);
 			vector_del_slot(mpvec, i);
 			return;
@@ -342,9 +564,13 @@ free_multipathvec (vector mpvec, enum free_path_mode free_paths)
 	vector_free(mpvec);
 }
 
+static void path_stored(const struct _vector *pathvec, unsigned long old_gen,
+			const struct path *pp);
+
 int
 store_path (vector pathvec, struct path * pp)
 {
+	unsigned long old_gen;
 	int err = 0;
 
 	if (!strlen(pp->dev_t)) {
@@ -359,10 +585,16 @@ store_path (vector pathvec, struct path * pp)
 	if (err > 1)
 		return 1;
 
+	old_gen = pathvec->gen;
 	if (!vector_alloc_slot(pathvec))
 		return 1;
 
 	vector_set_slot(pathvec, pp);
+	path_stored(pathvec, old_gen, pp);
+	if (!pp->totaled) {
+		pp->totaled = true;
+		count_path_total(pp, 1);
+	}
 
 	return 0;
 }
@@ -398,62 +630,352 @@ store_adaptergroup(vector adapters, struct adapter_group * agp)
 	return 0;
 }
 
-struct multipath *
-find_mp_by_minor (const struct _vector *mpvec, unsigned int minor)
+/*
+ * Lookup cache for the find_*() functions below.
+ *
+ * An entry remembers the slot in which an element with a given key was
+ * last found, in any vector. An entry is only used if that slot of the
+ * caller's vector holds an element whose key matches. Stale entries
+ * (elements that were moved, removed or freed, keys that have changed,
+ * or entries of other vectors) are therefore harmless, and don't need
+ * to be invalidated when vectors or elements are modified. If the cached
+ * element doesn't match, the vector is scanned as before. The entries
+ * are read and written atomically, without a lock.
+ */
+enum lookup_kind {
+	LOOKUP_MP_MINOR,
+	LOOKUP_MP_WWID,
+	LOOKUP_MP_ALIAS,
+	LOOKUP_PATH_DEV,
+	LOOKUP_PATH_DEVT,
+	__LOOKUP_LAST,
+};
+
+/* Must be a power of 2 */
+#define LOOKUP_CACHE_SIZE 1024
+
+typedef bool (lookup_match_fn)(const void *item, const void *key);
+
+/* slot index + 1, 0 for no entry */
+static int lookup_cache[__LOOKUP_LAST][LOOKUP_CACHE_SIZE];
+
+static int *
+lookup_slot(enum lookup_kind kind, const struct _vector *vec,
+	    unsigned int hash)
+{
+	hash ^= (unsigned int)((uintptr_t)vec >> 4);
+	return &lookup_cache[kind][hash & (LOOKUP_CACHE_SIZE - 1)];
+}
+
+static void *
+find_hinted(int *ent, const struct _vector *vec, lookup_match_fn *match,
+	    const void *key)
+{
+	int idx = uatomic_read(ent) - 1;
+	/* item is in vec, so it hasn't been freed */
+	void *item = VECTOR_SLOT(vec, idx);
+
+	return item && match(item, key) ? item : NULL;
+}
+
+static void *
+find_scan(int *ent, const struct _vector *vec, lookup_match_fn *match,
+	  const void *key)
 {
+	void *item;
 	int i;
-	struct multipath * mpp;
 
-	if (!mpvec)
+	vector_foreach_slot (vec, item, i) {
+		if (match(item, key)) {
+			uatomic_set(ent, i + 1);
+			return item;
+		}
+	}
+	return NULL;
+}
+
+static void *
+find_cached(enum lookup_kind kind, const struct _vector *vec,
+	    unsigned int hash, lookup_match_fn *match, const void *key)
+{
+	int *ent = lookup_slot(kind, vec, hash);
+	void *item = find_hinted(ent, vec, match, key);
+
+	return item ? item : find_scan(ent, vec, match, key);
+}
+
+/*
+ * Negative lookup filters for find_path_by_dev() and find_path_by_devt().
+ *
+ * Paths that aren't known yet are looked up for every "add" uevent, and
+ * the lookup cache can't help there. A filter is a bitmap with 2 bits
+ * set for the key hash of each path in a vector. If one of them isn't
+ * set for a key, the path isn't in the vector, and it isn't scanned.
+ *
+ * A filter is built when a lookup misses in the lookup cache, and the
+ * vector has changed since, as told by its generation. store_path()
+ * adds the new path to filters that were current before, so that adding
+ * a path doesn't require rebuilding the filter. Other changes of the
+ * vector do. Removed paths just leave stale bits.
+ *
+ * This relies on the device name and number of a path not changing
+ * once they are set. A filter of a vector that has paths without a key
+ * can't be used, until the vector changes and the filter is rebuilt.
+ *
+ * Each thread has its own filters, so that lookups don't need a lock.
+ * Maps aren't filtered, their aliases and minor numbers change in place.
+ */
+enum path_filter_kind {
+	FILTER_PATH_DEV,
+	FILTER_PATH_DEVT,
+	__FILTER_LAST,
+};
+
+/* Bits per path, and minimum bitmap size */
+#define FILTER_BITS_PER_KEY 16
+#define FILTER_MIN_BITS 1024
+#define LONG_BITS (8 * sizeof(unsigned long))
+
+struct path_filter {
+	const struct _vector *vec;
+	unsigned long gen;
+	/* a path had no key, the filter can't be used */
+	bool incomplete;
+	unsigned int nr_keys;
+	/* number of bits - 1 */
+	unsigned int mask;
+	unsigned long *bits;
+};
+
+struct path_filters {
+	struct path_filter filter[__FILTER_LAST];
+};
+
+static pthread_once_t path_filter_once = PTHREAD_ONCE_INIT;
+static pthread_key_t path_filter_key;
+static bool path_filter_key_ok;
+
+static void free_path_filters(void *arg)
+{
+	struct path_filters *pfs = arg;
+	int i;
+
+	if (!pfs)
+		return;
+	for (i = 0; i < __FILTER_LAST; i++)
+		free(pfs->filter[i].bits);
+	free(pfs);
+}
+
+static void init_path_filter_key(void)
+{
+	if (pthread_key_create(&path_filter_key, free_path_filters) == 0)
+		path_filter_key_ok = true;
+}
+
+void cleanup_path_filters(void)
+{
+	if (!path_filter_key_ok)
+		return;
+	free_path_filters(pthread_getspecific(path_filter_key));
+	pthread_setspecific(path_filter_key, NULL);
+}
+
+/* The calling thread's filter of kind. With create unset, may be NULL */
+static struct path_filter *get_path_filter(int kind, bool create)
+{
+	struct path_filters *pfs;
+
+	pthread_once(&path_filter_once, init_path_filter_key);
+	if (!path_filter_key_ok)
 		return NULL;
+	pfs = pthread_getspecific(path_filter_key);
+	if (!pfs && create) {
+		pfs = calloc(1, sizeof(*pfs));
+		if (pfs && pthread_setspecific(path_filter_key, pfs) != 0) {
+			free(pfs);
+			pfs = NULL;
+		}
+	}
+	return pfs ? &pfs->filter[kind] : NULL;
+}
 
-	vector_foreach_slot (mpvec, mpp, i) {
-		if (!mpp->dmi)
-			continue;
+static const char *path_filter_key_of(const struct path *pp, int kind)
+{
+	return kind == FILTER_PATH_DEV ? pp->dev : pp->dev_t;
+}
+
+static void filter_bits(const struct path_filter *pf, unsigned int hash,
+			unsigned int bit[2])
+{
+	bit[0] = hash & pf->mask;
+	bit[1] = ((hash ^ (hash >> 16)) * 0x45d9f3bU) & pf->mask;
+}
+
+static void filter_add(struct path_filter *pf, const char *key)
+{
+	unsigned int bit[2];
+	int i;
 
-		if (mpp->dmi->minor == minor)
-			return mpp;
+	if (!*key) {
+		pf->incomplete = true;
+		return;
 	}
-	return NULL;
+	filter_bits(pf, hash_str(key), bit);
+	for (i = 0; i < 2; i++)
+		pf->bits[bit[i] / LONG_BITS] |= 1UL << (bit[i] % LONG_BITS);
+	pf->nr_keys++;
 }
 
-struct multipath *
-find_mp_by_wwid (const struct _vector *mpvec, const char * wwid)
+static bool build_path_filter(struct path_filter *pf,
+			      const struct _vector *vec, int kind)
 {
+	unsigned int nbits = FILTER_MIN_BITS;
+	struct path *pp;
 	int i;
-	struct multipath * mpp;
 
+	while (nbits < FILTER_BITS_PER_KEY * (unsigned int)VECTOR_SIZE(vec))
+		nbits <<= 1;
+	if (!pf->bits || pf->mask + 1 < nbits) {
+		unsigned long *bits = malloc(nbits / 8);
+
+		if (!bits) {
+			pf->vec = NULL;
+			return false;
+		}
+		free(pf->bits);
+		pf->bits = bits;
+		pf->mask = nbits - 1;
+	}
+	memset(pf->bits, 0, (pf->mask + 1) / 8);
+	pf->incomplete = false;
+	pf->nr_keys = 0;
+	vector_foreach_slot(vec, pp, i)
+		filter_add(pf, path_filter_key_of(pp, kind));
+	pf->vec = vec;
+	pf->gen = vec->gen;
+	return true;
+}
+
+/* false if no path with key can be in vec */
+static bool path_may_be_in(const struct _vector *vec, int kind,
+			   const char *key)
+{
+	struct path_filter *pf;
+	unsigned int bit[2];
+	int i;
+
+	if (!vec->gen || !(pf = get_path_filter(kind, true)))
+		return true;
+	if ((pf->vec != vec || pf->gen != vec->gen) &&
+	    !build_path_filter(pf, vec, kind))
+		return true;
+	if (pf->incomplete)
+		return true;
+	filter_bits(pf, hash_str(key), bit);
+	for (i = 0; i < 2; i++)
+		if (!(pf->bits[bit[i] / LONG_BITS] &
+		      (1UL << (bit[i] % LONG_BITS))))
+			return false;
+	return true;
+}
+
+/* pp has just been appended to pathvec, which had generation old_gen */
+static void path_stored(const struct _vector *pathvec, unsigned long old_gen,
+			const struct path *pp)
+{
+	int kind;
+
+	for (kind = 0; kind < __FILTER_LAST; kind++) {
+		struct path_filter *pf = get_path_filter(kind, false);
+
+		if (!pf || pf->vec != pathvec || pf->gen != old_gen)
+			continue;
+		filter_add(pf, path_filter_key_of(pp, kind));
+		/* rebuild a bigger filter on the next lookup if it's full */
+		if (pf->nr_keys * FILTER_BITS_PER_KEY > pf->mask + 1)
+			pf->vec = NULL;
+		else
+			pf->gen = pathvec->gen;
+	}
+}
+
+static bool match_mp_minor(const void *item, const void *key)
+{
+	const struct multipath *mpp = item;
+
+	return mpp->dmi && mpp->dmi->minor == *(const unsigned int *)key;
+}
+
+struct multipath *
+find_mp_by_minor (const struct _vector *mpvec, unsigned int minor)
+{
 	if (!mpvec)
 		return NULL;
 
-	vector_foreach_slot (mpvec, mpp, i)
-		if (!strncmp(mpp->wwid, wwid, WWID_SIZE))
-			return mpp;
+	return find_cached(LOOKUP_MP_MINOR, mpvec, minor * 2654435761U,
+			   match_mp_minor, &minor);
+}
 
-	return NULL;
+/* Never 0, that's the hash of unknown WWIDs */
+unsigned int wwid_hash(const char *wwid)
+{
+	unsigned int h = hash_str(wwid);
+
+	return h ? h : 1;
+}
+
+bool same_wwid(const char *wwid1, unsigned int hash1,
+	       const char *wwid2, unsigned int hash2)
+{
+	if (hash1 && hash2 && hash1 != hash2)
+		return false;
+	return !strncmp(wwid1, wwid2, WWID_SIZE);
+}
+
+struct wwid_key {
+	const char *wwid;
+	unsigned int hash;
+};
+
+static bool match_mp_wwid(const void *item, const void *key)
+{
+	const struct multipath *mpp = item;
+	const struct wwid_key *k = key;
+
+	return same_wwid(mpp->wwid, mpp->wwid_hash, k->wwid, k->hash);
 }
 
 struct multipath *
-find_mp_by_alias (const struct _vector *mpvec, const char * alias)
+find_mp_by_wwid (const struct _vector *mpvec, const char * wwid)
 {
-	int i;
-	size_t len;
-	struct multipath * mpp;
+	struct wwid_key key = { .wwid = wwid, .hash = wwid_hash(wwid) };
 
 	if (!mpvec)
 		return NULL;
 
-	len = strlen(alias);
+	return find_cached(LOOKUP_MP_WWID, mpvec, key.hash,
+			   match_mp_wwid, &key);
+}
+
+static bool match_mp_alias(const void *item, const void *key)
+{
+	const struct multipath *mpp = item;
 
-	if (!len)
+	return !strcmp(mpp->alias, key);
+}
+
+struct multipath *
+find_mp_by_alias (const struct _vector *mpvec, const char * alias)
+{
+	if (!mpvec)
 		return NULL;
 
-	vector_foreach_slot (mpvec, mpp, i) {
-		if (strlen(mpp->alias) == len &&
-		    !strncmp(mpp->alias, alias, len))
-			return mpp;
-	}
-	return NULL;
+	if (!strlen(alias))
+		return NULL;
+
+	return find_cached(LOOKUP_MP_ALIAS, mpvec, hash_str(alias),
+			   match_mp_alias, alias);
 }
 
 struct multipath *
@@ -467,38 +989,62 @@ find_mp_by_str (const struct _vector *mpvec, const char * str)
 		return find_mp_by_alias(mpvec, str);
 }
 
+/* Like find_cached(), but skip the scan if the path filter rules it out */
+static struct path *
+find_path_cached(enum lookup_kind kind, int filter,
+		 const struct _vector *pathvec, lookup_match_fn *match,
+		 const char *key)
+{
+	int *ent = lookup_slot(kind, pathvec, hash_str(key));
+	struct path *pp = find_hinted(ent, pathvec, match, key);
+
+	if (pp || !path_may_be_in(pathvec, filter, key))
+		return pp;
+	return find_scan(ent, pathvec, match, key);
+}
+
+static bool match_path_dev(const void *item, const void *key)
+{
+	const struct path *pp = item;
+
+	return !strcmp(pp->dev, key);
+}
+
 struct path *
 find_path_by_dev (const struct _vector *pathvec, const char *dev)
 {
-	int i;
 	struct path * pp;
 
 	if (!pathvec || !dev)
 		return NULL;
 
-	vector_foreach_slot (pathvec, pp, i)
-		if (!strcmp(pp->dev, dev))
-			return pp;
+	pp = find_path_cached(LOOKUP_PATH_DEV, FILTER_PATH_DEV, pathvec,
+			      match_path_dev, dev);
+	if (!pp)
+		condlog(4, "%s: dev not found in pathvec", dev);
+	return pp;
+}
 
-	condlog(4, "%s: dev not found in pathvec", dev);
-	return NULL;
+static bool match_path_devt(const void *item, const void *key)
+{
+	const struct path *pp = item;
+
+	return !strcmp(pp->dev_t, key);
 }
 
 struct path *
 find_path_by_devt (const struct _vector *pathvec, const char * dev_t)
 {
-	int i;
 	struct path * pp;
 
 	if (!pathvec)
 		return NULL;
 
-	vector_foreach_slot (pathvec, pp, i)
-		if (!strcmp(pp->dev_t, dev_t))
-			return pp;
-
-	condlog(4, "%s: dev_t not found in pathvec", dev_t);
-	return NULL;
+	pp = find_path_cached(LOOKUP_PATH_DEVT, FILTER_PATH_DEVT, pathvec,
+			      match_path_devt, dev_t);
+	if (!pp)
+		condlog(4, "%s: dev_t not found in pathvec", dev_t);
+	return pp;
 }
 
 static int do_pathcount(const struct multipath *mpp, const int *states,
@@ -525,34 +1071,181 @@ static int do_pathcount(const struct multipath *mpp, const int *states,
 	return count;
 }
 
-int pathcount(const struct multipath *mpp, int state)
+/* Bumped for state changes of counted paths that can't be tracked */
+static unsigned long path_counts_epoch;
+static unsigned long path_counts_last_key;
+
+static inline bool valid_path_state(int state)
 {
-	return do_pathcount(mpp, &state, 1);
+	return state >= 0 && state < PATH_MAX_STATE;
 }
 
-int count_active_paths(const struct multipath *mpp)
+static bool path_counts_usable(const struct path_counts *pc)
+{
+	return pc && pc->valid && pc->epoch == path_counts_epoch;
+}
+
+void invalidate_path_counts(struct multipath *mpp)
+{
+	struct pathgroup *pgp;
+	int i;
+
+	if (!mpp)
+		return;
+	if (mpp->path_counts)
+		mpp->path_counts->valid = false;
+	/* the paths of the groups have changed */
+	vector_foreach_slot (mpp->pg, pgp, i)
+		pgp->prio_epoch = 0;
+}
+
+void record_path_failure(struct path *pp)
+{
+	struct timespec now;
+
+	get_monotonic_time(&now);
+	fail_window_add(&pp->fail_window, now.tv_sec);
+}
+
+void record_path_transition(struct path *pp, int newstate)
+{
+	struct path_transition *pt;
+
+	pt = &pp->history.ent[pp->history.n++ % PATH_HISTORY_SIZE];
+	clock_gettime(CLOCK_REALTIME, &pt->time);
+	pt->priority = pp->priority;
+	pt->msgid = pp->checker.msgid;
+	pt->oldstate = pp->state;
+	pt->newstate = newstate;
+}
+
+void set_path_state(struct path *pp, int state)
+{
+	struct path_counts *pc = pp->mpp ? pp->mpp->path_counts : NULL;
+
+	if (state == pp->state)
+		return;
+	/* the kernel has reported failures of failed paths already */
+	if ((pp->state == PATH_UP || pp->state == PATH_GHOST) &&
+	    (state == PATH_DOWN || state == PATH_SHAKY ||
+	     state == PATH_TIMEOUT) && pp->dmstate != PSTATE_FAILED)
+		record_path_failure(pp);
+	/* only usable paths count for path group priorities */
+	if (state == PATH_UP || state == PATH_GHOST ||
+	    pp->state == PATH_UP || pp->state == PATH_GHOST) {
+		invalidate_pg_prios();
+		/* the LUN may have changed, e.g. its ALUA states */
+		lun_cache_invalidate(pp->wwid);
+	}
+	if (!valid_path_state(state))
+		invalidate_path_counts(pp->mpp);
+	else if (pp->counted_key) {
+		if (pc && pc->key == pp->counted_key) {
+			if (path_counts_usable(pc) &&
+			    valid_path_state(pp->state)) {
+				pc->nr[pp->state]--;
+				pc->nr[state]++;
+			}
+		} else {
+			/* counted in a map we don't know */
+			path_counts_epoch++;
+			pp->counted_key = 0;
+		}
+	}
+	if (pp->totaled) {
+		if (valid_path_state(pp->state))
+			uatomic_dec(&path_totals.nr[pp->state]);
+		if (valid_path_state(state))
+			uatomic_inc(&path_totals.nr[state]);
+	}
+	pp->state = state;
+}
+
+void update_path_counts(struct multipath *mpp)
 {
+	struct path_counts *pc = mpp->path_counts;
 	struct pathgroup *pgp;
 	struct path *pp;
-	int count = 0;
 	int i, j;
 
-	if (!mpp->pg)
-		return 0;
+	if (!pc || path_counts_usable(pc))
+		return;
 
+	memset(pc->nr, 0, sizeof(pc->nr));
+	pc->key = ++path_counts_last_key;
+	pc->epoch = path_counts_epoch;
+	pc->valid = true;
 	vector_foreach_slot (mpp->pg, pgp, i) {
 		vector_foreach_slot (pgp->paths, pp, j) {
-			if (pp->state == PATH_UP || pp->state == PATH_GHOST)
-				count++;
+			/*
+			 * State changes of paths that belong to another map
+			 * couldn't be tracked here
+			 */
+			if (pp->mpp != mpp || !valid_path_state(pp->state))
+				pc->valid = false;
+			else {
+				pp->counted_key = pc->key;
+				pc->nr[pp->state]++;
+			}
 		}
 	}
-	return count;
+}
+
+/*
+ * Returns the cached counts of mpp, or NULL if they aren't up to date.
+ * This only reads the map, so that the counting functions can be used
+ * by concurrent readers.
+ */
+static const struct path_counts *get_path_counts(const struct multipath *mpp)
+{
+	const struct path_counts *pc = mpp->path_counts;
+#ifdef CHECK_PATH_COUNTS
+	int i;
+#endif
+
+	if (!path_counts_usable(pc))
+		return NULL;
+#ifdef CHECK_PATH_COUNTS
+	for (i = 0; i < PATH_MAX_STATE; i++) {
+		int n = do_pathcount(mpp, &i, 1);
+
+		if (n != pc->nr[i]) {
+			condlog(0, "BUG: %s: %d paths in state %d, counted %d",
+				mpp->alias, n, i, pc->nr[i]);
+			assert(n == pc->nr[i]);
+		}
+	}
+#endif
+	return pc;
+}
+
+int pathcount(const struct multipath *mpp, int state)
+{
+	const struct path_counts *pc;
+
+	if (valid_path_state(state) && (pc = get_path_counts(mpp)))
+		return pc->nr[state];
+	return do_pathcount(mpp, &state, 1);
+}
+
+int count_active_paths(const struct multipath *mpp)
+{
+	const struct path_counts *pc = get_path_counts(mpp);
+	int states[] = {PATH_UP, PATH_GHOST};
+
+	if (pc)
+		return pc->nr[PATH_UP] + pc->nr[PATH_GHOST];
+	return do_pathcount(mpp, states, 2);
 }
 
 int count_active_pending_paths(const struct multipath *mpp)
 {
+	const struct path_counts *pc = get_path_counts(mpp);
 	int states[] = {PATH_UP, PATH_GHOST, PATH_PENDING};
 
+	if (pc)
+		return pc->nr[PATH_UP] + pc->nr[PATH_GHOST] +
+			pc->nr[PATH_PENDING];
 	return do_pathcount(mpp, states, 3);
 }
 
@@ -8,6 +8,10 @@
 #include "prio.h"
 #include "byteorder.h"
 #include "generic.h"
+#include "sysfs.h"
+#include "fail_rate.h"
+#include "io_stats.h"
+#include "path_health.h"
 
 #define WWID_SIZE		128
 #define SERIAL_SIZE		128
@@ -46,7 +50,8 @@ enum free_path_mode {
 enum rr_weight_mode {
 	RR_WEIGHT_UNDEF,
 	RR_WEIGHT_NONE,
-	RR_WEIGHT_PRIO
+	RR_WEIGHT_PRIO,
+	RR_WEIGHT_LATENCY,
 };
 
 enum failback_mode {
@@ -70,6 +75,13 @@ enum pathstates {
 	PSTATE_ACTIVE
 };
 
+/* dm messages queued by multipathd's checker, see struct path */
+enum pending_msgs {
+	MSG_NONE,
+	MSG_FAIL_PATH,
+	MSG_REINSTATE_PATH,
+};
+
 enum pgstates {
 	PGSTATE_UNDEF,
 	PGSTATE_ENABLED,
@@ -121,6 +133,12 @@ enum log_checker_err_states {
 	LOG_CHKR_ERR_ONCE,
 };
 
+enum mlock_memory_states {
+	MLOCK_MEMORY_NO = YN_NO,
+	MLOCK_MEMORY_YES = YN_YES,
+	MLOCK_MEMORY_ONFAULT,
+};
+
 enum user_friendly_names_states {
 	USER_FRIENDLY_NAMES_UNDEF = YNU_UNDEF,
 	USER_FRIENDLY_NAMES_OFF = YNU_NO,
@@ -163,6 +181,29 @@ enum max_sectors_kb_states {
 	MAX_SECTORS_KB_MIN = 4,  /* can't be smaller than page size */
 };
 
+/*
+ * Block queue attributes set by queue_profile, see select_queue_profile().
+ * Only the attributes whose bit is set in flags are written.
+ */
+enum queue_profile_flags {
+	QP_SCHEDULER	= (1 << 0),
+	QP_NR_REQUESTS	= (1 << 1),
+	QP_READ_AHEAD_KB = (1 << 2),
+	QP_RQ_AFFINITY	= (1 << 3),
+	QP_NOMERGES	= (1 << 4),
+};
+
+#define QP_SCHEDULER_SIZE 32
+
+struct queue_profile {
+	unsigned int flags;
+	unsigned int nr_requests;
+	unsigned int read_ahead_kb;
+	unsigned int rq_affinity;
+	unsigned int nomerges;
+	char scheduler[QP_SCHEDULER_SIZE];
+};
+
 enum scsi_protocol {
 	SCSI_PROTOCOL_FCP = 0,	/* Fibre Channel */
 	SCSI_PROTOCOL_SPI = 1,	/* parallel SCSI */
@@ -189,6 +230,13 @@ enum ghost_delay_states {
 	GHOST_DELAY_UNDEF = NU_UNDEF,
 };
 
+#define NUMA_NODE_UNSET -2
+
+enum fast_checkint_states {
+	FAST_CHECKINT_OFF = NU_NO,
+	FAST_CHECKINT_UNDEF = NU_UNDEF,
+};
+
 enum initialized_states {
 	INIT_NEW,
 	INIT_FAILED,
@@ -277,53 +325,162 @@ struct hd_geometry {
 };
 #endif
 
-struct path {
-	char dev[FILE_NAME_SIZE];
-	char dev_t[BLK_DEV_SIZE];
-	struct udev_device *udev;
-	struct sg_id sg_id;
-	struct hd_geometry geom;
-	char wwid[WWID_SIZE];
+/*
+ * Identification strings of a path. They are set by pathinfo() and are
+ * only read afterwards, so paths with equal strings share one interned
+ * copy, see intern_path_ident(). Code that changes them must first call
+ * unshare_path_ident().
+ */
+struct path_ident {
 	char vendor_id[SCSI_VENDOR_SIZE];
 	char product_id[PATH_PRODUCT_SIZE];
 	char rev[PATH_REV_SIZE];
 	char serial[SERIAL_SIZE];
 	char tgt_node_name[NODE_NAME_SIZE];
-	char *vpd_data;
-	unsigned long long size;
-	unsigned int checkint;
-	unsigned int tick;
-	int bus;
-	int offline;
+	/* 0 for private copies */
+	int refcount;
+	unsigned int hash;
+	struct path_ident *next;
+};
+
+/*
+ * Transport attributes of a SCSI path, resolved by pathinfo() for the
+ * print wildcards and host adapter grouping. Empty strings haven't been
+ * resolved, and are looked up again when needed.
+ */
+#define TRANSPORT_ID_SIZE 32
+struct path_transport {
+	char host_wwnn[TRANSPORT_ID_SIZE];
+	char host_wwpn[TRANSPORT_ID_SIZE];
+	char tgt_wwpn[TRANSPORT_ID_SIZE];
+	char adapter[SLOT_NAME_SIZE];
+};
+
+/*
+ * The last state changes of a path found by the checker, for
+ * "show path $path history". See record_path_transition().
+ */
+#define PATH_HISTORY_SIZE 16
+struct path_transition {
+	/* CLOCK_REALTIME */
+	struct timespec time;
+	int priority;
+	short msgid;
+	signed char oldstate;
+	signed char newstate;
+};
+
+struct path_history {
+	/* number of transitions recorded, the last one is at (n - 1) % size */
+	unsigned int n;
+	struct path_transition ent[PATH_HISTORY_SIZE];
+};
+
+struct path {
+	/*
+	 * Fields used for every path in the checker loop come first,
+	 * so that they share few cache lines.
+	 */
+	/* change with set_path_state() */
 	int state;
 	int dmstate;
 	int chkrstate;
+	/* fail/reinstate message to send with the next batch */
+	int pending_msg;
+	/* checker result from the parallel phase, or PATH_MAX_STATE */
+	int prechecked_state;
+	unsigned int checkint;
+	unsigned int tick;
+	int offline;
+	int initialized;
 	int failcount;
 	int priority;
+	/* monotonic time (s) priority was last obtained from the prioritizer */
+	time_t prio_time;
+	/* path state at prio_time */
+	int prio_state;
+	int marginal;
+	int disable_reinstate;
+	int io_err_disable_reinstate;
+	/* recent state changes, for adaptive polling */
+	unsigned int instability;
+	int last_failcount;
+	/* monotonic time (s) of the last checker state change */
+	time_t chkrstate_since;
+	/* key of the path_counts this path was last counted in */
+	unsigned long counted_key;
+	/* counted in the path totals, see get_path_totals() */
+	bool totaled;
+	struct multipath * mpp;
+	int fd;
+	/* SCSI / NVMe device state, read by path_offline() */
+	struct sysfs_attr_fd state_attr;
+	struct checker checker;
+	/* check scheduling, see check_sched.h */
+	struct list_head sched_node;
+	unsigned long sched_due;
+	struct list_head fast_node;
+	/* monotonic time of the next fast check, in ms */
+	unsigned long long fast_due;
+	struct list_head pending_node;
+	/* NUMA node of the adapter, -1 if unknown, see devt_numa_node() */
+	int numa_node;
+
+	char dev[FILE_NAME_SIZE];
+	char dev_t[BLK_DEV_SIZE];
+	struct udev_device *udev;
+	struct sg_id sg_id;
+	struct hd_geometry geom;
+	char wwid[WWID_SIZE];
+	/* see wwid_hash() */
+	unsigned int wwid_hash;
+	/* never NULL for paths from alloc_path() */
+	struct path_ident *ident;
+	/* NULL for non-SCSI paths and unknown transports */
+	struct path_transport *transport;
+	char *vpd_data;
+	unsigned long long size;
+	int bus;
+	/* Latency percentiles (us) from the path_latency prioritizer */
+	unsigned int latency_p50;
+	unsigned int latency_p99;
+	/* For rr_weight latency, see latency_weight.h */
+	unsigned long long io_stat_ios;
+	unsigned long long io_stat_ticks;
+	unsigned int svc_latency;
+	int rel_throughput;
+	/* see io_stats.h */
+	struct io_stats io_stats;
+	/* see path_health.h */
+	struct path_health health;
 	int pgindex;
 	int detect_prio;
 	int detect_checker;
 	int tpgs;
+	/* sysfs ALUA state at the last alua prio update, see get_prio() */
+	char alua_state[32];
+	int alua_prio_skipped;
 	char * uid_attribute;
 	char * getuid;
 	struct prio prio;
-	struct checker checker;
-	struct multipath * mpp;
-	int fd;
-	int initialized;
+	/* outstanding async prioritizer run, see prio_async.h */
+	struct prio_req *prio_req;
 	int retriggers;
 	unsigned int path_failures;
 	time_t dis_reinstate_time;
-	int disable_reinstate;
 	int san_path_err_forget_rate;
 	time_t io_err_dis_reinstate_time;
-	int io_err_disable_reinstate;
 	int io_err_pathfail_cnt;
-	int io_err_pathfail_starttime;
+	/* failures seen by the kernel or the checker, see record_path_failure() */
+	struct fail_window fail_window;
+	struct path_history history;
 	int find_multipaths_timeout;
-	int marginal;
 	int vpd_vendor_id;
 	int recheck_wwid;
+	/* PR key registration queued, see mpath_pr_event_handle() */
+	bool pr_pending;
+	/* is_path_valid() result may be cached, see valid.h */
+	bool valid_cacheable;
 	/* configlet pointers */
 	vector hwe;
 	struct gen_path generic_path;
@@ -333,6 +490,8 @@ typedef int (pgpolicyfn) (struct multipath *, vector);
 
 struct multipath {
 	char wwid[WWID_SIZE];
+	/* see wwid_hash() */
+	unsigned int wwid_hash;
 	char alias_old[WWID_SIZE];
 	int pgpolicy;
 	pgpolicyfn *pgpolicyfn;
@@ -340,10 +499,13 @@ struct multipath {
 	int bestpg;
 	int queuedio;
 	int action;
+	/* in the map timer list, see schedule_map_timers() */
+	struct list_head timer_node;
 	int wait_for_udev;
 	int uev_wait_tick;
 	int pgfailback;
 	int failback_tick;
+	time_t latency_weight_time;
 	int rr_weight;
 	int no_path_retry; /* number of retries after all paths are down */
 	int retry_tick;    /* remaining times for retries */
@@ -354,7 +516,19 @@ struct multipath {
 	int fast_io_fail;
 	int retain_hwhandler;
 	int deferred_remove;
+	/* the map is being removed by the flush thread, see flush_queue.h */
+	bool flush_queued;
 	bool in_recovery;
+	/* number of paths with a pending_msg */
+	int pending_msgs;
+	/* event number the map was last synced at after sending messages */
+	uint32_t msgs_evt_nr;
+	/* event number of the last update_multipath_strings() */
+	uint32_t synced_evt_nr;
+	/* dm events caused by messages since then, -1 if unknown */
+	int msgs_evts;
+	/* monotonic time of the last update_multipath_strings(), in s */
+	time_t synced_at;
 	int san_path_err_threshold;
 	int san_path_err_forget_rate;
 	int san_path_err_recovery_time;
@@ -363,12 +537,27 @@ struct multipath {
 	int marginal_path_err_recheck_gap_time;
 	int marginal_path_double_failed_time;
 	int skip_kpartx;
+	/* multipathd maps the partitions, see internal_kpartx */
+	int internal_kpartx;
 	int max_sectors_kb;
+	struct queue_profile queue_profile;
 	int force_readonly;
 	int force_udev_reload;
 	int needs_paths_uevent;
 	int ghost_delay;
 	int ghost_delay_tick;
+	/* deferred reload, see reload_debounce */
+	int reload_tick;
+	int reload_refresh;
+	/* dm-stats region for io_stats, or IO_STATS_NO_REGION */
+	int stats_region;
+	struct io_stats io_stats;
+	/* see selector_autotune */
+	int selector_autotune;
+	struct io_tune io_tune;
+	/* fast_polling_interval, in ms */
+	int fast_checkint;
+	int array_check_rate;
 	unsigned int dev_loss;
 	int eh_deadline;
 	uid_t uid;
@@ -379,18 +568,32 @@ struct multipath {
 	vector pg;
 	struct dm_info * dmi;
 
+	/* table fetched by dm_get_maps(), see update_multipath_table() */
+	char *cached_params;
+	/* table mpp->pg was parsed from, see update_multipath_table() */
+	char *pg_table;
+	/* status the path states in mpp->pg were last parsed from */
+	char *pg_status;
+	/*
+	 * params of our last table load, and the table the kernel reported
+	 * right after it, see reload_is_noop()
+	 */
+	char *loaded_params;
+	char *loaded_table;
+	int loaded_ro;
+	/* see count_active_paths() */
+	struct path_counts *path_counts;
+
 	/* configlet pointers */
 	char * alias;
 	char * alias_prefix;
-	char * selector;
+	/* selector and hwhandler are from the strpool, see strpool.h */
+	const char * selector;
 	char * features;
-	char * hwhandler;
+	const char * hwhandler;
 	struct mpentry * mpe;
 	vector hwe;
 
-	/* threads */
-	pthread_t waiter;
-
 	/* stats */
 	unsigned int stat_switchgroup;
 	unsigned int stat_path_failures;
@@ -399,6 +602,13 @@ struct multipath {
 	unsigned int stat_queueing_timeouts;
 	unsigned int stat_map_failures;
 
+	/*
+	 * Set by multipathd from a global counter when the JSON output
+	 * for this map changes, see "show maps since $gen json"
+	 */
+	uint64_t generation;
+	unsigned int json_hash;
+
 	/* checkers shared data */
 	void * mpcontext;
 
@@ -432,6 +642,8 @@ struct pathgroup {
 	int priority;
 	int enabled_paths;
 	int marginal;
+	/* see invalidate_pg_prios() */
+	unsigned long prio_epoch;
 	vector paths;
 	struct multipath *mpp;
 	struct gen_pathgroup generic_pg;
@@ -457,6 +669,10 @@ struct multipath * alloc_multipath (void);
 void *set_mpp_hwe(struct multipath *mpp, const struct path *pp);
 void uninitialize_path(struct path *pp);
 void free_path (struct path *);
+/* Frees the paths cached for reuse by alloc_path() */
+void cleanup_path_pool(void);
+/* Frees the calling thread's path lookup filters */
+void cleanup_path_filters(void);
 void free_pathvec (vector vec, enum free_path_mode free_paths);
 void free_pathgroup (struct pathgroup * pgp, enum free_path_mode free_paths);
 void free_pgvec (vector pgvec, enum free_path_mode free_paths);
@@ -476,16 +692,94 @@ int store_hostgroup(vector hostgroupvec, struct host_group *hgp);
 int store_path (vector pathvec, struct path * pp);
 int add_pathgroup(struct multipath*, struct pathgroup *);
 
+/*
+ * The WWIDs of paths and maps are kept along with their wwid_hash(), so
+ * that same_wwid() can tell most different WWIDs apart without comparing
+ * the strings. A hash of 0 is unknown, and falls back to the string
+ * comparison. Code that changes pp->wwid or mpp->wwid must update the
+ * hash with hash_path_wwid() or hash_map_wwid() afterwards.
+ */
+unsigned int wwid_hash(const char *wwid);
+bool same_wwid(const char *wwid1, unsigned int hash1,
+	       const char *wwid2, unsigned int hash2);
+
+static inline void hash_path_wwid(struct path *pp)
+{
+	pp->wwid_hash = wwid_hash(pp->wwid);
+}
+
+static inline void hash_map_wwid(struct multipath *mpp)
+{
+	mpp->wwid_hash = wwid_hash(mpp->wwid);
+}
+
 struct multipath * find_mp_by_alias (const struct _vector *mp, const char *alias);
 struct multipath * find_mp_by_wwid (const struct _vector *mp, const char *wwid);
 struct multipath * find_mp_by_str (const struct _vector *mp, const char *wwid);
 struct multipath * find_mp_by_minor (const struct _vector *mp,
 				     unsigned int minor);
 
+/*
+ * Numbers of paths by checker state, and of monitored paths, which have
+ * an open fd, for "show status". A path is counted from its first
+ * store_path() until free_path(). set_path_state() and the opening and
+ * closing of pp->fd keep the numbers up to date, so that they can be
+ * read without the vecs lock. Whoever opens pp->fd must call
+ * path_fd_opened().
+ */
+struct path_totals {
+	unsigned int nr[PATH_MAX_STATE];
+	unsigned int monitored;
+};
+void get_path_totals(struct path_totals *pt);
+void path_fd_opened(const struct path *pp);
+
+/*
+ * The lookups use per-thread filters that rely on pp->dev and pp->dev_t
+ * not changing while the path is in the vector, once they are set. To
+ * change them, remove the path from the vector and store it again.
+ */
 struct path * find_path_by_devt (const struct _vector *pathvec, const char *devt);
 struct path * find_path_by_dev (const struct _vector *pathvec, const char *dev);
 struct path * first_path (const struct multipath *mpp);
 
+/*
+ * Per-state numbers of the paths in the path groups of a map, cached by
+ * the counting functions below. set_path_state() keeps them up to date
+ * for paths counted in the map they belong to. Other state changes of
+ * counted paths invalidate all caches by bumping the global epoch, and
+ * changes of the path groups must be followed by
+ * invalidate_path_counts(). The counting functions never count into the
+ * cache, they count the paths directly if it's out of date. Only
+ * update_path_counts() fills it in, and must only be called by code that
+ * can modify the map, i.e. with vecs->lock held exclusively in multipathd.
+ */
+struct path_counts {
+	unsigned long key;
+	unsigned long epoch;
+	bool valid;
+	int nr[PATH_MAX_STATE];
+};
+
+void set_path_state(struct path *pp, int state);
+/*
+ * Count a failure of pp in pp->fail_window. set_path_state() calls this
+ * for paths that fail while the kernel still uses them, and multipathd
+ * for PATH_FAILED events from the kernel.
+ */
+void record_path_failure(struct path *pp);
+/* Add the change of pp->state to newstate to pp->history */
+void record_path_transition(struct path *pp, int newstate);
+void invalidate_path_counts(struct multipath *mpp);
+/* Count the paths of mpp into its cache if it's out of date */
+void update_path_counts(struct multipath *mpp);
+/* Share pp->ident with paths that have the same strings */
+void intern_path_ident(struct path *pp);
+/* Make pp->ident private, allocating it if needed. Returns 1 on error */
+int unshare_path_ident(struct path *pp);
+/* Another reference to id if it's interned, otherwise a private copy */
+struct path_ident *get_path_ident(struct path_ident *id);
+void put_path_ident(struct path_ident *id);
 int pathcount (const struct multipath *, int);
 int count_active_paths(const struct multipath *);
 int count_active_pending_paths(const struct multipath *);
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <urcu/uatomic.h>
 
 #include "util.h"
 #include "checkers.h"
@@ -20,6 +21,37 @@
 #include "libdevmapper.h"
 #include "io_err_stat.h"
 #include "switchgroup.h"
+#include "check_sched.h"
+#include "time-util.h"
+
+static unsigned long topology_gen;
+
+void topology_changed(void)
+{
+	uatomic_inc(&topology_gen);
+}
+
+void note_topology_vectors(const struct vectors *vecs)
+{
+	/* protected by vecs->lock */
+	static const struct _vector *pathvec, *mpvec;
+	static unsigned long pathvec_gen, mpvec_gen;
+
+	if (vecs->pathvec == pathvec && vecs->mpvec == mpvec &&
+	    (!pathvec || pathvec->gen == pathvec_gen) &&
+	    (!mpvec || mpvec->gen == mpvec_gen))
+		return;
+	pathvec = vecs->pathvec;
+	mpvec = vecs->mpvec;
+	pathvec_gen = pathvec ? pathvec->gen : 0;
+	mpvec_gen = mpvec ? mpvec->gen : 0;
+	topology_changed();
+}
+
+unsigned long topology_generation(void)
+{
+	return uatomic_read(&topology_gen);
+}
 
 /*
  * creates or updates mpp->paths reading mpp->pg
@@ -74,6 +106,7 @@ static bool guess_mpp_wwid(struct multipath *mpp)
 		vector_foreach_slot(pgp->paths, pp, j) {
 			if (pp->initialized == INIT_OK && strlen(pp->wwid)) {
 				strlcpy(mpp->wwid, pp->wwid, sizeof(mpp->wwid));
+				hash_map_wwid(mpp);
 				condlog(2, "%s: guessed WWID %s from path %s",
 					mpp->alias, mpp->wwid, pp->dev);
 				return true;
@@ -195,7 +228,7 @@ bool update_pathvec_from_dm(vector pathvec, struct multipath *mpp,
 					condlog(2, "%s: adding new path %s",
 						mpp->alias, pp->dev);
 					store_path(pathvec, pp);
-					pp->tick = 1;
+					schedule_path_check(pp, 1);
 				}
 			}
 
@@ -207,7 +240,9 @@ bool update_pathvec_from_dm(vector pathvec, struct multipath *mpp,
 			 * At this point, pp->udev is valid and and pp->wwid
 			 * is the best we could get
 			 */
-			if (*pp->wwid && strcmp(mpp->wwid, pp->wwid)) {
+			if (*pp->wwid &&
+			    !same_wwid(mpp->wwid, mpp->wwid_hash,
+				       pp->wwid, pp->wwid_hash)) {
 				condlog(0, "%s: path %s WWID %s doesn't match, removing from map",
 					mpp->wwid, pp->dev_t, pp->wwid);
 				/*
@@ -220,13 +255,14 @@ bool update_pathvec_from_dm(vector pathvec, struct multipath *mpp,
 				dm_fail_path(mpp->alias, pp->dev_t);
 				vector_del_slot(pgp->paths, j--);
 				orphan_path(pp, "WWID mismatch");
-				pp->tick = 1;
+				set_path_tick(pp, 1);
 				must_reload = true;
 			} else if (!*pp->wwid) {
 				condlog(3, "%s: setting wwid from map: %s",
 					pp->dev, mpp->wwid);
 				strlcpy(pp->wwid, mpp->wwid,
 					sizeof(pp->wwid));
+				pp->wwid_hash = mpp->wwid_hash;
 			}
 		}
 		if (VECTOR_SIZE(pgp->paths) != 0)
@@ -237,6 +273,7 @@ bool update_pathvec_from_dm(vector pathvec, struct multipath *mpp,
 		free_pathgroup(pgp, KEEP_PATHS);
 		must_reload = true;
 	}
+	invalidate_path_counts(mpp);
 	return must_reload;
 }
 
@@ -253,7 +290,8 @@ int adopt_paths(vector pathvec, struct multipath *mpp)
 		return 1;
 
 	vector_foreach_slot (pathvec, pp, i) {
-		if (!strncmp(mpp->wwid, pp->wwid, WWID_SIZE)) {
+		if (same_wwid(mpp->wwid, mpp->wwid_hash,
+			      pp->wwid, pp->wwid_hash)) {
 			if (pp->size != 0 && mpp->size != 0 &&
 			    pp->size != mpp->size) {
 				condlog(3, "%s: size mismatch for %s, not adding path",
@@ -295,6 +333,7 @@ void orphan_path(struct path *pp, const char *reason)
 {
 	condlog(3, "%s: orphan path, %s", pp->dev, reason);
 	pp->mpp = NULL;
+	pp->pending_msg = MSG_NONE;
 	uninitialize_path(pp);
 }
 
@@ -412,37 +451,119 @@ done:
 		condlog(2, "%s: no hwe found", mpp->alias);
 }
 
+/*
+ * Check if mpp->pg can be kept because the table it was parsed from
+ * is unchanged. This requires that none of the groups has been rebuilt
+ * and their paths still belong to the map.
+ */
+static bool pg_table_unchanged(const struct multipath *mpp,
+			       const char *params)
+{
+	struct pathgroup *pgp;
+	struct path *pp;
+	int i, j;
+
+	if (!mpp->pg_table || !mpp->pg || !mpp->features ||
+	    !mpp->hwhandler || !mpp->selector ||
+	    strcmp(mpp->pg_table, params))
+		return false;
+	vector_foreach_slot(mpp->pg, pgp, i)
+		vector_foreach_slot(pgp->paths, pp, j)
+			if (pp->mpp != mpp)
+				return false;
+	return true;
+}
+
+static void clear_multipath_table(struct multipath *mpp)
+{
+	free(mpp->pg_table);
+	mpp->pg_table = NULL;
+	free(mpp->pg_status);
+	mpp->pg_status = NULL;
+	free_multipath_attributes(mpp);
+	free_pgvec(mpp->pg, KEEP_PATHS);
+	mpp->pg = NULL;
+}
+
 int
 update_multipath_table (struct multipath *mpp, vector pathvec, int flags)
 {
 	int r = DMP_ERR;
 	char *params = NULL;
+	bool unchanged;
+	unsigned long long size;
 
 	if (!mpp)
 		return r;
-
-	r = dm_get_map(mpp->alias, &mpp->size, &params);
+	size = mpp->size;
+
+	/* Use the table from dm_get_maps() once, fetch it afterwards */
+	if (mpp->cached_params) {
+		params = mpp->cached_params;
+		mpp->cached_params = NULL;
+		r = DMP_OK;
+	} else
+		r = dm_get_map(mpp->alias, &mpp->size, &params);
 	if (r != DMP_OK) {
 		condlog(2, "%s: %s", mpp->alias, (r == DMP_ERR)? "error getting table" : "map not present");
+		clear_multipath_table(mpp);
+		topology_changed();
 		return r;
 	}
 
-	if (disassemble_map(pathvec, params, mpp)) {
-		condlog(2, "%s: cannot disassemble map", mpp->alias);
+	unchanged = pg_table_unchanged(mpp, params);
+	if (!unchanged || mpp->size != size)
+		topology_changed();
+	if (unchanged) {
+		condlog(4, "%s: table unchanged", mpp->alias);
 		free(params);
-		return DMP_ERR;
+	} else {
+		clear_multipath_table(mpp);
+		if (disassemble_map(pathvec, params, mpp)) {
+			condlog(2, "%s: cannot disassemble map", mpp->alias);
+			free(params);
+			return DMP_ERR;
+		}
+		mpp->pg_table = params;
 	}
 
-	free(params);
+	/*
+	 * Many dm events, e.g. the ones caused by our own dm_fail_path()
+	 * calls, leave the status as it was after the last update.
+	 */
 	params = NULL;
-	if (dm_get_status(mpp->alias, &params) != DMP_OK)
+	if (dm_get_status(mpp->alias, &params) != DMP_OK) {
 		condlog(2, "%s: %s", mpp->alias, (r == DMP_ERR)? "error getting status" : "map not present");
-	else if (disassemble_status(params, mpp))
-		condlog(2, "%s: cannot disassemble status", mpp->alias);
-	free(params);
+		free(mpp->pg_status);
+		mpp->pg_status = NULL;
+		topology_changed();
+	} else if (unchanged && mpp->pg_status &&
+		   !strcmp(mpp->pg_status, params)) {
+		condlog(4, "%s: status unchanged", mpp->alias);
+		free(params);
+	} else {
+		if (unchanged)
+			topology_changed();
+		free(mpp->pg_status);
+		mpp->pg_status = NULL;
+		if (disassemble_status(params, mpp)) {
+			condlog(2, "%s: cannot disassemble status",
+				mpp->alias);
+			free(params);
+		} else
+			mpp->pg_status = params;
+	}
 
-	/* FIXME: we should deal with the return value here */
-	update_pathvec_from_dm(pathvec, mpp, flags);
+	/*
+	 * FIXME: we should deal with the return value here.
+	 * If paths were dropped, mpp->pg differs from the table.
+	 */
+	if (!unchanged && update_pathvec_from_dm(pathvec, mpp, flags)) {
+		free(mpp->pg_table);
+		mpp->pg_table = NULL;
+		free(mpp->pg_status);
+		mpp->pg_status = NULL;
+	}
 
 	return DMP_OK;
 }
@@ -509,6 +630,7 @@ int
 update_multipath_strings(struct multipath *mpp, vector pathvec)
 {
 	struct pathgroup *pgp;
+	struct timespec now;
 	int i, r = DMP_ERR;
 
 	if (!mpp)
@@ -517,20 +639,25 @@ update_multipath_strings(struct multipath *mpp, vector pathvec)
 	update_mpp_paths(mpp, pathvec);
 	condlog(4, "%s: %s", mpp->alias, __FUNCTION__);
 
-	free_multipath_attributes(mpp);
-	free_pgvec(mpp->pg, KEEP_PATHS);
-	mpp->pg = NULL;
-
 	r = update_multipath_table(mpp, pathvec, 0);
 	if (r != DMP_OK)
 		return r;
 
 	sync_paths(mpp, pathvec);
+	update_path_counts(mpp);
 
 	vector_foreach_slot(mpp->pg, pgp, i)
 		if (pgp->paths)
 			path_group_prio_update(pgp);
 
+	get_monotonic_time(&now);
+	mpp->synced_at = now.tv_sec;
+	/* mpp->dmi is always read before the table */
+	if (mpp->dmi) {
+		mpp->synced_evt_nr = mpp->dmi->event_nr;
+		mpp->msgs_evts = 0;
+	} else
+		mpp->msgs_evts = -1;
 	return DMP_OK;
 }
 
@@ -554,6 +681,7 @@ static void enter_recovery_mode(struct multipath *mpp)
 	mpp->in_recovery = true;
 	mpp->stat_queueing_timeouts++;
 	mpp->retry_tick = mpp->no_path_retry * checkint + 1;
+	schedule_map_timers(mpp);
 	condlog(1, "%s: Entering recovery mode: max_retries=%d",
 		mpp->alias, mpp->no_path_retry);
 }
@@ -655,14 +783,16 @@ find_existing_alias (struct multipath * mpp,
 	int i;
 
 	vector_foreach_slot (vecs->mpvec, mp, i)
-		if (strncmp(mp->wwid, mpp->wwid, WWID_SIZE - 1) == 0) {
+		if (same_wwid(mp->wwid, mp->wwid_hash,
+			      mpp->wwid, mpp->wwid_hash)) {
 			strlcpy(mpp->alias_old, mp->alias, WWID_SIZE);
 			return;
 		}
 }
 
-struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
-				    int add_vec)
+struct multipath *add_map_with_wwid_paths(struct vectors *vecs,
+					  struct path *pp, vector wwid_paths,
+					  int add_vec)
 {
 	struct multipath * mpp;
 	struct config *conf = NULL;
@@ -674,7 +804,7 @@ struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
 		return NULL;
 
 	conf = get_multipath_config();
-	mpp->mpe = find_mpe(conf->mptable, pp->wwid);
+	mpp->mpe = find_mpe_by_wwid(conf, pp->wwid);
 	put_multipath_config(conf);
 
 	/*
@@ -685,12 +815,13 @@ struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
 		goto out;
 
 	strcpy(mpp->wwid, pp->wwid);
+	mpp->wwid_hash = pp->wwid_hash;
 	find_existing_alias(mpp, vecs);
 	if (select_alias(conf, mpp))
 		goto out;
 	mpp->size = pp->size;
 
-	if (adopt_paths(vecs->pathvec, mpp) || pp->mpp != mpp ||
+	if (adopt_paths(wwid_paths, mpp) || pp->mpp != mpp ||
 	    find_slot(mpp->paths, pp) == -1)
 		goto out;
 
@@ -708,6 +839,12 @@ out:
 	return NULL;
 }
 
+struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
+				    int add_vec)
+{
+	return add_map_with_wwid_paths(vecs, pp, vecs->pathvec, add_vec);
+}
+
 int verify_paths(struct multipath *mpp)
 {
 	struct path * pp;
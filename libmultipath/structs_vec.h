@@ -34,10 +34,28 @@ void remove_maps (struct vectors * vecs);
 void sync_map_state (struct multipath *);
 struct multipath * add_map_with_path (struct vectors * vecs,
 				struct path * pp, int add_vec);
+/*
+ * Like add_map_with_path(), but adopts paths only from wwid_paths, which
+ * must contain all paths of vecs->pathvec with the WWID of pp
+ */
+struct multipath *add_map_with_wwid_paths(struct vectors *vecs,
+					  struct path *pp, vector wwid_paths,
+					  int add_vec);
 void update_queue_mode_del_path(struct multipath *mpp);
 void update_queue_mode_add_path(struct multipath *mpp);
 int update_multipath_table (struct multipath *mpp, vector pathvec, int flags);
 int update_multipath_status (struct multipath *mpp);
 vector get_used_hwes(const struct _vector *pathvec);
 
+/*
+ * Generation of the maps and paths as the CLI shows them, see
+ * multipathd/snapshot.h. Code changing what's shown must call
+ * topology_changed(), unless the change is to the slots of vecs->pathvec
+ * or vecs->mpvec. Those are picked up by note_topology_vectors(), which
+ * must be called with vecs->lock held exclusively, before releasing it.
+ */
+void topology_changed(void);
+void note_topology_vectors(const struct vectors *vecs);
+unsigned long topology_generation(void);
+
 #endif /* _STRUCTS_VEC_H */
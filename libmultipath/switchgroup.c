@@ -7,6 +7,17 @@
 #include "structs.h"
 #include "switchgroup.h"
 
+/*
+ * Cached path group priorities are valid if their prio_epoch is equal to
+ * this. It starts at 1, so that new path groups are never valid.
+ */
+static unsigned long pg_prio_epoch = 1;
+
+void invalidate_pg_prios(void)
+{
+	pg_prio_epoch++;
+}
+
 void path_group_prio_update(struct pathgroup *pgp)
 {
 	int i;
@@ -15,6 +26,7 @@ void path_group_prio_update(struct pathgroup *pgp)
 	struct path * pp;
 
 	pgp->enabled_paths = 0;
+	pgp->prio_epoch = pg_prio_epoch;
 	if (!pgp->paths) {
 		pgp->priority = 0;
 		return;
@@ -52,7 +64,8 @@ int select_path_group(struct multipath *mpp)
 		if (!pgp->paths)
 			continue;
 
-		path_group_prio_update(pgp);
+		if (pgp->prio_epoch != pg_prio_epoch)
+			path_group_prio_update(pgp);
 		if (pgp->marginal && normal_pgp)
 			continue;
 		if (pgp->enabled_paths) {
@@ -1,2 +1,9 @@
 void path_group_prio_update (struct pathgroup * pgp);
 int select_path_group (struct multipath * mpp);
+/*
+ * select_path_group() reuses the priorities of path groups computed by
+ * path_group_prio_update() until this is called. set_path_state() and
+ * the priority code call it, changes of the marginal status of paths
+ * must be followed by it.
+ */
+void invalidate_pg_prios (void);
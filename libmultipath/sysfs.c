@@ -39,26 +39,16 @@
 #include "debug.h"
 #include "devmapper.h"
 
-/*
- * When we modify an attribute value we cannot rely on libudev for now,
- * as libudev lacks the capability to update an attribute value.
- * So for modified attributes we need to implement our own function.
- */
-ssize_t sysfs_attr_get_value(struct udev_device *dev, const char *attr_name,
-			     char * value, size_t value_len)
+/* Returns an fd for reading the attribute, or -errno */
+static int open_attr(struct udev_device *dev, const char *attr_name)
 {
 	char devpath[PATH_SIZE];
 	struct stat statbuf;
 	int fd;
-	ssize_t size = -1;
-
-	if (!dev || !attr_name || !value)
-		return 0;
 
 	snprintf(devpath, PATH_SIZE, "%s/%s", udev_device_get_syspath(dev),
 		 attr_name);
 	condlog(4, "open '%s'", devpath);
-	/* read attribute value */
 	fd = open(devpath, O_RDONLY);
 	if (fd < 0) {
 		condlog(4, "attribute '%s' can not be opened: %s",
@@ -82,25 +72,95 @@ ssize_t sysfs_attr_get_value(struct udev_device *dev, const char *attr_name,
 		close(fd);
 		return -EPERM;
 	}
+	return fd;
+}
 
-	size = read(fd, value, value_len);
+static ssize_t read_attr(int fd, struct udev_device *dev,
+			 const char *attr_name, char *value, size_t value_len)
+{
+	ssize_t size;
+
+	/* sysfs attributes are regenerated on every read from offset 0 */
+	size = pread(fd, value, value_len, 0);
 	if (size < 0) {
-		condlog(4, "read from %s failed: %s", devpath, strerror(errno));
+		condlog(4, "read from %s/%s failed: %s",
+			udev_device_get_syspath(dev), attr_name,
+			strerror(errno));
 		size = -errno;
 		value[0] = '\0';
 	} else if (size == (ssize_t)value_len) {
 		value[size - 1] = '\0';
-		condlog(4, "overflow while reading from %s", devpath);
+		condlog(4, "overflow while reading from %s/%s",
+			udev_device_get_syspath(dev), attr_name);
 		size = 0;
 	} else {
 		value[size] = '\0';
 		size = strchop(value);
 	}
+	return size;
+}
+
+/*
+ * When we modify an attribute value we cannot rely on libudev for now,
+ * as libudev lacks the capability to update an attribute value.
+ * So for modified attributes we need to implement our own function.
+ */
+ssize_t sysfs_attr_get_value(struct udev_device *dev, const char *attr_name,
+			     char * value, size_t value_len)
+{
+	int fd;
+	ssize_t size;
 
+	if (!dev || !attr_name || !value)
+		return 0;
+
+	fd = open_attr(dev, attr_name);
+	if (fd < 0)
+		return fd;
+	size = read_attr(fd, dev, attr_name, value, value_len);
 	close(fd);
 	return size;
 }
 
+void sysfs_attr_fd_close(struct sysfs_attr_fd *attr)
+{
+	if (attr->dev && attr->fd >= 0)
+		close(attr->fd);
+	attr->fd = -1;
+	attr->dev = NULL;
+}
+
+ssize_t sysfs_attr_fd_get_value(struct sysfs_attr_fd *attr,
+				struct udev_device *dev, const char *attr_name,
+				char *value, size_t value_len)
+{
+	int fd;
+	ssize_t size;
+
+	if (!attr || !dev || !attr_name || !value)
+		return 0;
+
+	if (attr->dev == dev && attr->fd >= 0) {
+		size = read_attr(attr->fd, dev, attr_name, value, value_len);
+		if (size >= 0)
+			return size;
+		/* The device may have been replaced, try once more */
+	}
+	sysfs_attr_fd_close(attr);
+
+	fd = open_attr(dev, attr_name);
+	if (fd < 0)
+		return fd;
+	size = read_attr(fd, dev, attr_name, value, value_len);
+	if (size < 0)
+		close(fd);
+	else {
+		attr->fd = fd;
+		attr->dev = dev;
+	}
+	return size;
+}
+
 ssize_t sysfs_bin_attr_get_value(struct udev_device *dev, const char *attr_name,
 				 unsigned char * value, size_t value_len)
 {
@@ -357,6 +417,7 @@ bool sysfs_is_multipathed(struct path *pp, bool set_wwid)
 					pp->wwid[nr] = '\0';
 					strchop(pp->wwid);
 				}
+				hash_path_wwid(pp);
 			}
 		} else if (nr < 0)
 			condlog(1, "%s: error reading from %s: %m",
@@ -5,6 +5,21 @@
 #ifndef _LIBMULTIPATH_SYSFS_H
 #define _LIBMULTIPATH_SYSFS_H
 #include <stdbool.h>
+#include <sys/types.h>
+
+struct path;
+struct udev_device;
+
+/*
+ * A sysfs attribute that is kept open and re-read with pread(), for
+ * attributes which are read very often, like the SCSI device state.
+ * The fd is reopened if it's used with a different udev device, e.g.
+ * after a uevent replaced pp->udev.
+ */
+struct sysfs_attr_fd {
+	int fd;
+	const struct udev_device *dev;
+};
 
 ssize_t sysfs_attr_set_value(struct udev_device *dev, const char *attr_name,
 			     const char * value, size_t value_len);
@@ -15,4 +30,14 @@ ssize_t sysfs_bin_attr_get_value(struct udev_device *dev, const char *attr_name,
 int sysfs_get_size (struct path *pp, unsigned long long * size);
 int sysfs_check_holders(char * check_devt, char * new_devt);
 bool sysfs_is_multipathed(struct path *pp, bool set_wwid);
+
+static inline void sysfs_attr_fd_init(struct sysfs_attr_fd *attr)
+{
+	attr->fd = -1;
+	attr->dev = NULL;
+}
+void sysfs_attr_fd_close(struct sysfs_attr_fd *attr);
+ssize_t sysfs_attr_fd_get_value(struct sysfs_attr_fd *attr,
+				struct udev_device *dev, const char *attr_name,
+				char *value, size_t value_len);
 #endif
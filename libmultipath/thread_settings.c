@@ -0,0 +1,589 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <sched.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
+#include <urcu/uatomic.h>
+
+#include "util.h"
+#include "vector.h"
+#include "debug.h"
+#include "structs.h"
+#include "config.h"
+#include "defaults.h"
+#include "strbuf.h"
+#include "thread_settings.h"
+
+#define MAX_THREADS 8
+#define MAX_VALUE 128
+#define MAX_NUMA_NODES 64
+#define NUMA_NODE_DIR "/sys/devices/system/node"
+
+struct thread_ent {
+	const char *name;
+	pthread_t thread;
+};
+
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_ent threads[MAX_THREADS];
+
+struct stack_ent {
+	const char *name;
+	size_t def_size;
+	/* from thread_stack_size, 0 for the default */
+	size_t size;
+	int nr;
+};
+
+#define STACK_ENT(n, s) { .name = (n), .def_size = (s), }
+
+static struct stack_ent stacks[] = {
+	STACK_ENT(THREAD_UEVENT, DEFAULT_UEVENT_STACKSIZE * 1024),
+	STACK_ENT(THREAD_UEVQ, 64 * 1024),
+	STACK_ENT(THREAD_CHECKER, 64 * 1024),
+	STACK_ENT(THREAD_UXLSNR, 64 * 1024),
+	STACK_ENT(THREAD_DMEVENTS, 64 * 1024),
+	STACK_ENT(THREAD_LOG, 64 * 1024),
+	STACK_ENT(THREAD_IO_ERR_STAT, 32 * 1024),
+	STACK_ENT(THREAD_FLUSH, 64 * 1024),
+	STACK_ENT(THREAD_WORKER, 64 * 1024),
+	STACK_ENT(THREAD_ASYNC_CHECK, 64 * 1024),
+	STACK_ENT(THREAD_PRIO, 64 * 1024),
+	STACK_ENT(THREAD_CLI, 64 * 1024),
+};
+
+static pthread_mutex_t cpu_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_cpu_stats cpu_stats[] = {
+	{ .name = THREAD_UEVENT, },
+	{ .name = THREAD_UEVQ, },
+	{ .name = THREAD_CHECKER, },
+	{ .name = THREAD_UXLSNR, },
+	{ .name = THREAD_DMEVENTS, },
+	{ .name = THREAD_LOG, },
+	{ .name = THREAD_IO_ERR_STAT, },
+	{ .name = THREAD_FLUSH, },
+};
+static __thread struct thread_cpu_stats *cpu_self;
+
+/* The mlock_memory setting, and the one the memory is locked with */
+static int mlock_mode = MLOCK_MEMORY_YES;
+static int locked_mode = -1;
+
+static int numa_affinity;
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static bool numa_multi_node;
+/* The affinity of the process when the node CPU sets were read */
+static cpu_set_t numa_all_cpus;
+/* CPUs of each node that are in numa_all_cpus, empty if unusable */
+static cpu_set_t numa_cpus[MAX_NUMA_NODES];
+/* The node the calling thread is bound to, or -1 */
+static __thread int bound_node = -1;
+/* The affinity of the calling thread before it was bound */
+static __thread cpu_set_t unbound_cpus;
+
+/*
+ * Find the "name=value" word for name in a list of words, and copy
+ * the value to buf. Returns true if found.
+ */
+static bool find_value(const char *list, const char *name,
+		       char *buf, size_t len)
+{
+	size_t nlen = strlen(name);
+	const char *p = list, *end;
+
+	while (p && *p) {
+		p += strspn(p, " \t");
+		end = p + strcspn(p, " \t");
+		if ((size_t)(end - p) > nlen && !strncmp(p, name, nlen) &&
+		    p[nlen] == '=') {
+			p += nlen + 1;
+			if ((size_t)(end - p) >= len)
+				return false;
+			memcpy(buf, p, end - p);
+			buf[end - p] = '\0';
+			return true;
+		}
+		p = end;
+	}
+	return false;
+}
+
+/* Parse a CPU list like "0-3,8" */
+static int parse_cpulist(const char *str, cpu_set_t *set)
+{
+	const char *p = str;
+	char *end;
+	unsigned long first, last;
+
+	CPU_ZERO(set);
+	do {
+		first = strtoul(p, &end, 10);
+		if (end == p)
+			return -1;
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p || last < first)
+				return -1;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+		p = end + 1;
+	} while (*end == ',');
+	return *end ? -1 : 0;
+}
+
+/* Parse "other", "batch", "idle", "fifo:prio" or "rr:prio" */
+static int parse_policy(const char *str, int *policy,
+			struct sched_param *param)
+{
+	static const struct {
+		const char *name;
+		int policy;
+		bool rt;
+	} policies[] = {
+		{ "other", SCHED_OTHER, false },
+		{ "batch", SCHED_BATCH, false },
+		{ "idle", SCHED_IDLE, false },
+		{ "fifo", SCHED_FIFO, true },
+		{ "rr", SCHED_RR, true },
+	};
+	size_t len = strcspn(str, ":");
+	unsigned int i;
+	char *end;
+
+	memset(param, 0, sizeof(*param));
+	for (i = 0; i < ARRAY_SIZE(policies); i++) {
+		if (strlen(policies[i].name) != len ||
+		    strncmp(str, policies[i].name, len))
+			continue;
+		*policy = policies[i].policy;
+		if (!policies[i].rt)
+			return str[len] ? -1 : 0;
+		if (str[len] != ':')
+			return -1;
+		param->sched_priority = strtol(str + len + 1, &end, 10);
+		if (end == str + len + 1 || *end ||
+		    param->sched_priority < sched_get_priority_min(*policy) ||
+		    param->sched_priority > sched_get_priority_max(*policy))
+			return -1;
+		return 0;
+	}
+	return -1;
+}
+
+static void apply_settings(const struct config *conf,
+			   const struct thread_ent *te)
+{
+	char val[MAX_VALUE];
+	struct sched_param param;
+	cpu_set_t set;
+	int policy, rc;
+
+	if (find_value(conf->cpu_affinity, te->name, val, sizeof(val))) {
+		if (parse_cpulist(val, &set))
+			condlog(1, "invalid cpu_affinity for %s thread: \"%s\"",
+				te->name, val);
+		else if ((rc = pthread_setaffinity_np(te->thread,
+						      sizeof(set), &set)))
+			condlog(1, "failed to set cpu_affinity of %s thread: %s",
+				te->name, strerror(rc));
+		else
+			condlog(3, "%s thread: cpu_affinity %s", te->name, val);
+	}
+	if (find_value(conf->sched_policy, te->name, val, sizeof(val))) {
+		if (parse_policy(val, &policy, &param))
+			condlog(1, "invalid sched_policy for %s thread: \"%s\"",
+				te->name, val);
+		else if ((rc = pthread_setschedparam(te->thread, policy,
+						     &param)))
+			condlog(1, "failed to set sched_policy of %s thread: %s",
+				te->name, strerror(rc));
+		else
+			condlog(3, "%s thread: sched_policy %s", te->name, val);
+	}
+}
+
+static struct stack_ent *find_stack_ent(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(stacks); i++)
+		if (!strcmp(stacks[i].name, name))
+			return &stacks[i];
+	return NULL;
+}
+
+size_t thread_stack_size(const char *name)
+{
+	struct stack_ent *se = find_stack_ent(name);
+	size_t size;
+
+	if (!se)
+		return 64 * 1024;
+	size = uatomic_read(&se->size);
+	return size ? size : se->def_size;
+}
+
+void setup_thread_attr_for(pthread_attr_t *attr, const char *name,
+			   int detached)
+{
+	setup_thread_attr(attr, thread_stack_size(name), detached);
+}
+
+void count_thread(const char *name, int delta)
+{
+	struct stack_ent *se = find_stack_ent(name);
+
+	if (se)
+		uatomic_add(&se->nr, delta);
+}
+
+static void set_stack_sizes(const struct config *conf)
+{
+	char val[MAX_VALUE], *end;
+	unsigned long kb;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(stacks); i++) {
+		kb = 0;
+		if (find_value(conf->thread_stack_size, stacks[i].name,
+			       val, sizeof(val))) {
+			kb = strtoul(val, &end, 10);
+			if (end == val || *end || kb == 0 ||
+			    kb > SIZE_MAX / 1024) {
+				condlog(1, "invalid thread_stack_size for %s thread: \"%s\"",
+					stacks[i].name, val);
+				kb = 0;
+			}
+		}
+		uatomic_set(&stacks[i].size, kb * 1024);
+	}
+}
+
+/* Call with thread_lock held */
+static void __lock_memory(void)
+{
+	int flags = MCL_CURRENT | MCL_FUTURE;
+
+	if (mlock_mode == locked_mode)
+		return;
+	if (locked_mode != -1 && locked_mode != MLOCK_MEMORY_NO)
+		munlockall();
+	locked_mode = mlock_mode;
+	if (mlock_mode == MLOCK_MEMORY_NO)
+		return;
+#ifdef MCL_ONFAULT
+	if (mlock_mode == MLOCK_MEMORY_ONFAULT)
+		flags |= MCL_ONFAULT;
+#endif
+	if (mlockall(flags) != 0) {
+		condlog(2, "failed to lock memory: %m");
+		/*
+		 * MCL_ONFAULT needs kernel 4.4, lock all pages like
+		 * before rather than nothing at all
+		 */
+		if (flags & ~(MCL_CURRENT | MCL_FUTURE))
+			mlockall(MCL_CURRENT | MCL_FUTURE);
+	}
+}
+
+void lock_memory(void)
+{
+	pthread_mutex_lock(&thread_lock);
+	__lock_memory();
+	pthread_mutex_unlock(&thread_lock);
+}
+
+void register_thread(const char *name, pthread_t thread)
+{
+	struct config *conf;
+	struct thread_ent *te = NULL;
+	int i;
+
+	pthread_mutex_lock(&thread_lock);
+	for (i = 0; i < MAX_THREADS; i++) {
+		if (threads[i].name == name || (!te && !threads[i].name))
+			te = &threads[i];
+		if (threads[i].name == name)
+			break;
+	}
+	if (te) {
+		if (te->name != name)
+			count_thread(name, 1);
+		te->name = name;
+		te->thread = thread;
+		conf = get_multipath_config();
+		if (conf)
+			apply_settings(conf, te);
+		put_multipath_config(conf);
+	}
+	pthread_mutex_unlock(&thread_lock);
+}
+
+void unregister_thread(const char *name)
+{
+	int i;
+
+	pthread_mutex_lock(&thread_lock);
+	for (i = 0; i < MAX_THREADS; i++) {
+		if (threads[i].name == name) {
+			threads[i].name = NULL;
+			count_thread(name, -1);
+		}
+	}
+	pthread_mutex_unlock(&thread_lock);
+}
+
+void apply_thread_settings(const struct config *conf)
+{
+	int i;
+
+	uatomic_set(&numa_affinity, conf->numa_affinity == YN_YES);
+	set_stack_sizes(conf);
+	pthread_mutex_lock(&thread_lock);
+	for (i = 0; i < MAX_THREADS; i++) {
+		if (threads[i].name)
+			apply_settings(conf, &threads[i]);
+	}
+	/* Only lock memory here if a thread has locked it before */
+	mlock_mode = conf->mlock_memory;
+	if (locked_mode != -1)
+		__lock_memory();
+	pthread_mutex_unlock(&thread_lock);
+}
+
+void sample_thread_cpu(const char *name)
+{
+	struct timespec ts;
+	struct rusage ru;
+	unsigned int i;
+
+	if (!cpu_self) {
+		for (i = 0; i < ARRAY_SIZE(cpu_stats); i++)
+			if (!strcmp(cpu_stats[i].name, name))
+				cpu_self = &cpu_stats[i];
+		if (!cpu_self)
+			return;
+	}
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0 ||
+	    getrusage(RUSAGE_THREAD, &ru) != 0)
+		return;
+	pthread_mutex_lock(&cpu_lock);
+	cpu_self->cpu_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	cpu_self->wakeups = ru.ru_nvcsw;
+	cpu_self->preempted = ru.ru_nivcsw;
+	pthread_mutex_unlock(&cpu_lock);
+}
+
+int get_thread_cpu_stats(struct thread_cpu_stats *st, int n)
+{
+	int i;
+
+	pthread_mutex_lock(&cpu_lock);
+	for (i = 0; i < n && i < (int)ARRAY_SIZE(cpu_stats); i++)
+		st[i] = cpu_stats[i];
+	pthread_mutex_unlock(&cpu_lock);
+	return i;
+}
+
+static const char *mlock_mode_name(int mode)
+{
+	switch (mode) {
+	case MLOCK_MEMORY_NO:
+		return "no";
+	case MLOCK_MEMORY_ONFAULT:
+		return "onfault";
+	default:
+		return "yes";
+	}
+}
+
+int snprint_process_memory(struct strbuf *buff)
+{
+	static const char *const fields[] = {
+		"VmLck", "VmRSS", "VmData", "VmStk",
+	};
+	static const char *const names[] = {
+		"locked", "resident", "data", "main stack",
+	};
+	char line[128];
+	unsigned long kb;
+	unsigned int i;
+	size_t initial_len = get_strbuf_len(buff);
+	FILE *f;
+	int mode;
+
+	pthread_mutex_lock(&thread_lock);
+	mode = locked_mode;
+	pthread_mutex_unlock(&thread_lock);
+	if (print_strbuf(buff, "%-16s %s\n", "memory locking",
+			 mode == -1 ? "no" : mlock_mode_name(mode)) < 0)
+		return -1;
+
+	f = fopen("/proc/self/status", "re");
+	if (f) {
+		while (fgets(line, sizeof(line), f)) {
+			for (i = 0; i < ARRAY_SIZE(fields); i++) {
+				size_t len = strlen(fields[i]);
+
+				if (strncmp(line, fields[i], len) ||
+				    line[len] != ':' ||
+				    sscanf(line + len + 1, "%lu", &kb) != 1)
+					continue;
+				if (print_strbuf(buff, "%-16s %lu kB\n",
+						 names[i], kb) < 0) {
+					fclose(f);
+					return -1;
+				}
+			}
+		}
+		fclose(f);
+	}
+#if defined(__GLIBC__) && \
+	(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	{
+		struct mallinfo2 mi = mallinfo2();
+
+		if (print_strbuf(buff, "%-16s %zu kB\n%-16s %zu kB\n",
+				 "heap", (mi.arena + mi.hblkhd) / 1024,
+				 "heap in use",
+				 (mi.uordblks + mi.hblkhd) / 1024) < 0)
+			return -1;
+	}
+#endif
+	return get_strbuf_len(buff) - initial_len;
+}
+
+int snprint_thread_stacks(struct strbuf *buff)
+{
+	size_t initial_len = get_strbuf_len(buff);
+	size_t size, total = 0;
+	unsigned int i;
+	int nr;
+
+	if (append_strbuf_str(buff, "thread        threads stack kB total kB\n") < 0)
+		return -1;
+	for (i = 0; i < ARRAY_SIZE(stacks); i++) {
+		nr = uatomic_read(&stacks[i].nr);
+		size = thread_stack_size(stacks[i].name);
+		total += nr * size;
+		if (print_strbuf(buff, "%-13s %7d %8zu %8zu\n",
+				 stacks[i].name, nr, size / 1024,
+				 nr * size / 1024) < 0)
+			return -1;
+	}
+	if (print_strbuf(buff, "%-13s %7s %8s %8zu\n", "total", "", "",
+			 total / 1024) < 0)
+		return -1;
+	return get_strbuf_len(buff) - initial_len;
+}
+
+static void init_numa_nodes(void)
+{
+	char path[PATH_MAX], buf[4096];
+	FILE *f;
+	int node, nodes = 0;
+
+	if (sched_getaffinity(0, sizeof(numa_all_cpus), &numa_all_cpus))
+		return;
+	for (node = 0; node < MAX_NUMA_NODES; node++) {
+		CPU_ZERO(&numa_cpus[node]);
+		snprintf(path, sizeof(path), NUMA_NODE_DIR "/node%d/cpulist",
+			 node);
+		f = fopen(path, "re");
+		if (!f)
+			continue;
+		if (fgets(buf, sizeof(buf), f)) {
+			buf[strcspn(buf, "\n")] = '\0';
+			if (*buf && !parse_cpulist(buf, &numa_cpus[node]))
+				CPU_AND(&numa_cpus[node], &numa_cpus[node],
+					&numa_all_cpus);
+			else
+				CPU_ZERO(&numa_cpus[node]);
+		}
+		fclose(f);
+		if (CPU_COUNT(&numa_cpus[node]) > 0)
+			nodes++;
+	}
+	numa_multi_node = nodes > 1;
+	condlog(3, "%d usable NUMA nodes", nodes);
+}
+
+int devt_numa_node(dev_t devt)
+{
+	char path[PATH_MAX], dir[PATH_MAX];
+	char *p;
+	FILE *f;
+	int node = -1;
+
+	pthread_once(&numa_once, init_numa_nodes);
+	if (!numa_multi_node || !major(devt))
+		return -1;
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u",
+		 major(devt), minor(devt));
+	if (!realpath(path, dir))
+		return -1;
+	/* The first ancestor with a numa_node attribute is the adapter */
+	while ((p = strrchr(dir, '/')) && p > dir &&
+	       strcmp(dir, "/sys/devices")) {
+		if (safe_snprintf(path, sizeof(path), "%s/numa_node", dir))
+			break;
+		f = fopen(path, "re");
+		if (f) {
+			if (fscanf(f, "%d", &node) != 1)
+				node = -1;
+			fclose(f);
+			break;
+		}
+		*p = '\0';
+	}
+	if (node >= MAX_NUMA_NODES || (node >= 0 &&
+				       CPU_COUNT(&numa_cpus[node]) == 0))
+		node = -1;
+	return node;
+}
+
+void bind_numa_node(int node)
+{
+	cpu_set_t set;
+	int rc;
+
+	if (!uatomic_read(&numa_affinity))
+		node = -1;
+	if (node == bound_node || node >= MAX_NUMA_NODES)
+		return;
+	pthread_once(&numa_once, init_numa_nodes);
+	if (bound_node == -1 &&
+	    pthread_getaffinity_np(pthread_self(), sizeof(unbound_cpus),
+				   &unbound_cpus))
+		return;
+	if (node >= 0) {
+		/* Don't leave the CPUs set with cpu_affinity */
+		CPU_AND(&set, &numa_cpus[node], &unbound_cpus);
+		if (CPU_COUNT(&set) == 0)
+			return;
+	} else
+		set = unbound_cpus;
+	rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rc) {
+		condlog(3, "failed to bind thread to NUMA node %d: %s",
+			node, strerror(rc));
+		return;
+	}
+	bound_node = node;
+}
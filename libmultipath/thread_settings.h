@@ -0,0 +1,107 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _THREAD_SETTINGS_H
+#define _THREAD_SETTINGS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct config;
+struct strbuf;
+
+/*
+ * Per-thread CPU affinity and scheduling policy of multipathd threads.
+ *
+ * The "cpu_affinity" and "sched_policy" options in the defaults section
+ * are lists of "thread=value" words, e.g.
+ *
+ *	cpu_affinity "checker=0-1 uevent=0-1"
+ *	sched_policy "uxlsnr=other checker=rr:99"
+ *
+ * Threads register under one of the names below when they are started,
+ * and get the settings of the current configuration. Threads without
+ * an entry keep the settings they inherited from their creator.
+ */
+#define THREAD_UEVENT		"uevent"
+#define THREAD_UEVQ		"uevq"
+#define THREAD_CHECKER		"checker"
+#define THREAD_UXLSNR		"uxlsnr"
+#define THREAD_DMEVENTS		"dmevents"
+#define THREAD_LOG		"log"
+#define THREAD_IO_ERR_STAT	"io_err_stat"
+#define THREAD_FLUSH		"flush"
+/* Thread pools, for thread_stack_size only */
+#define THREAD_WORKER		"worker"
+#define THREAD_ASYNC_CHECK	"async_check"
+#define THREAD_PRIO		"prio"
+#define THREAD_CLI		"cli"
+
+/* The name must be a string constant */
+void register_thread(const char *name, pthread_t thread);
+void unregister_thread(const char *name);
+
+/* Apply the settings of conf to all registered threads */
+void apply_thread_settings(const struct config *conf);
+
+/*
+ * Stack sizes of multipathd threads, set with the "thread_stack_size"
+ * option, a list of "thread=KiB" words with the names above. They apply
+ * to threads started after the configuration has been read.
+ * setup_thread_attr_for() is setup_thread_attr() with the stack size
+ * for the named thread type. Threads of the pools call count_thread()
+ * when they start (+1) and exit (-1), for snprint_thread_stacks();
+ * registered threads are counted by register_thread().
+ */
+size_t thread_stack_size(const char *name);
+void setup_thread_attr_for(pthread_attr_t *attr, const char *name,
+			   int detached);
+void count_thread(const char *name, int delta);
+
+/*
+ * Lock the memory of the process as set with the "mlock_memory" option:
+ * all current and future pages, only the pages that are faulted in, or
+ * nothing. Until the configuration has been read, all pages are locked.
+ */
+void lock_memory(void);
+
+/*
+ * CPU time and context switches of the registered threads, from
+ * CLOCK_THREAD_CPUTIME_ID and getrusage(RUSAGE_THREAD). Each thread
+ * calls sample_thread_cpu() with its name whenever it wakes up, so the
+ * values are as of its last wakeup. Voluntary context switches are the
+ * times the thread went to sleep, and thus its wakeups.
+ */
+struct thread_cpu_stats {
+	const char *name;
+	unsigned long long cpu_ns;
+	unsigned long wakeups;
+	unsigned long preempted;
+};
+
+void sample_thread_cpu(const char *name);
+/* Fill st with up to n entries, returns the number filled */
+int get_thread_cpu_stats(struct thread_cpu_stats *st, int n);
+
+/* Locked, resident and heap memory of the process */
+int snprint_process_memory(struct strbuf *buff);
+/* Thread and stack memory of each thread type */
+int snprint_thread_stacks(struct strbuf *buff);
+
+/*
+ * NUMA locality of path I/O, for the "numa_affinity" option.
+ *
+ * devt_numa_node() returns the NUMA node of the PCI adapter a block
+ * device is attached to, or -1 if it's unknown or the system has a
+ * single node. With numa_affinity enabled, bind_numa_node() binds the
+ * calling thread to the CPUs of a node before it sends I/O to a device
+ * on that node, so that commands and their buffers stay on the node of
+ * the adapter. It does nothing if the thread is bound to this node
+ * already, and restores the original affinity for node -1 or if
+ * numa_affinity is disabled.
+ */
+int devt_numa_node(dev_t devt);
+void bind_numa_node(int node);
+
+#endif /* _THREAD_SETTINGS_H */
@@ -0,0 +1,31 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/*
+ * Static user space probes (USDT) for tracing with bpftrace, perf or
+ * systemtap, like "bpftrace -e 'usdt:/sbin/multipathd:multipath:domap_start
+ * { printf("%s\n", str(arg0)); }'". Build with "make ENABLE_USDT=1" to
+ * enable them. Without it, the probes compile to nothing.
+ *
+ * A disabled USDT probe is a single nop instruction, but the arguments
+ * are still evaluated, so they should be cheap and free of side effects.
+ */
+#ifdef USE_USDT
+#include <sys/sdt.h>
+
+#define TRACE0(name) DTRACE_PROBE(multipath, name)
+#define TRACE1(name, a) DTRACE_PROBE1(multipath, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(multipath, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(multipath, name, a, b, c)
+#else
+#define TRACE0(name) do {} while (0)
+#define TRACE1(name, a) do { (void)(a); } while (0)
+#define TRACE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define TRACE3(name, a, b, c)				\
+	do { (void)(a); (void)(b); (void)(c); } while (0)
+#endif
+
+#endif /* _TRACE_H */
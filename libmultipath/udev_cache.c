@@ -0,0 +1,121 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libudev.h>
+
+#include "util.h"
+#include "vector.h"
+#include "config.h"
+#include "udev_cache.h"
+
+#define UDEV_CACHE_SIZE 256
+#define UDEV_CACHE_KEY_LEN 128
+
+struct udev_cache_ent {
+	struct udev_cache_ent *next;
+	const char *value;
+	/* the key, followed by the value */
+	char key[];
+};
+
+static pthread_mutex_t udev_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct udev_cache_ent *udev_cache[UDEV_CACHE_SIZE];
+
+static struct udev_cache_ent **udev_cache_head(const char *key)
+{
+	return &udev_cache[hash_str(key) % UDEV_CACHE_SIZE];
+}
+
+int get_cached_value(const char *key, char *buf, size_t len)
+{
+	struct udev_cache_ent *ent;
+	int ret = -ENOENT;
+
+	pthread_mutex_lock(&udev_cache_lock);
+	for (ent = *udev_cache_head(key); ent; ent = ent->next) {
+		if (!strcmp(ent->key, key)) {
+			strlcpy(buf, ent->value, len);
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&udev_cache_lock);
+	return ret;
+}
+
+void set_cached_value(const char *key, const char *value)
+{
+	struct udev_cache_ent *ent, **head, **p;
+	size_t klen = strlen(key) + 1, vlen = strlen(value) + 1;
+
+	ent = malloc(sizeof(*ent) + klen + vlen);
+	if (!ent)
+		return;
+	memcpy(ent->key, key, klen);
+	memcpy(ent->key + klen, value, vlen);
+	ent->value = ent->key + klen;
+
+	head = udev_cache_head(key);
+	pthread_mutex_lock(&udev_cache_lock);
+	/* replace an existing entry */
+	for (p = head; *p; p = &(*p)->next) {
+		if (!strcmp((*p)->key, key)) {
+			struct udev_cache_ent *old = *p;
+
+			*p = old->next;
+			free(old);
+			break;
+		}
+	}
+	ent->next = *head;
+	*head = ent;
+	pthread_mutex_unlock(&udev_cache_lock);
+}
+
+int get_cached_sysattr(const char *subsystem, const char *sysname,
+		       const char *attr, char *buf, size_t len)
+{
+	char key[UDEV_CACHE_KEY_LEN];
+	struct udev_device *dev;
+	const char *value;
+
+	if (safe_sprintf(key, "%s/%s/%s", subsystem, sysname, attr))
+		return -ENOENT;
+	if (get_cached_value(key, buf, len) == 0)
+		return 0;
+
+	dev = udev_device_new_from_subsystem_sysname(udev, subsystem, sysname);
+	if (!dev)
+		return -ENODEV;
+	value = udev_device_get_sysattr_value(dev, attr);
+	if (value) {
+		strlcpy(buf, value, len);
+		set_cached_value(key, value);
+	}
+	udev_device_unref(dev);
+	return value ? 0 : -ENOENT;
+}
+
+void invalidate_udev_cache(void)
+{
+	struct udev_cache_ent *list[UDEV_CACHE_SIZE];
+	struct udev_cache_ent *ent, *next;
+	int i;
+
+	pthread_mutex_lock(&udev_cache_lock);
+	memcpy(list, udev_cache, sizeof(list));
+	memset(udev_cache, 0, sizeof(udev_cache));
+	pthread_mutex_unlock(&udev_cache_lock);
+
+	for (i = 0; i < UDEV_CACHE_SIZE; i++) {
+		for (ent = list[i]; ent; ent = next) {
+			next = ent->next;
+			free(ent);
+		}
+	}
+}
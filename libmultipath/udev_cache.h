@@ -0,0 +1,38 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _UDEV_CACHE_H
+#define _UDEV_CACHE_H
+
+#include <stddef.h>
+
+/*
+ * Cache of attributes of the SCSI hosts, FC rports and iSCSI sessions
+ * behind paths, which are otherwise looked up with libudev for every
+ * path, re-reading the uevent files in sysfs each time.
+ *
+ * Values are cached rather than udev_device handles, because libudev
+ * objects must not be used by several threads at once, and cache
+ * attribute values on their own. Only attributes that don't change
+ * during the lifetime of a device should be read through the cache.
+ * invalidate_udev_cache() drops all entries; multipathd calls it for
+ * path add and remove uevents, and when it reconfigures.
+ */
+
+/*
+ * Copy the value of the sysfs attribute attr of the device sysname in
+ * subsystem to buf. Returns 0 on success, -ENODEV if there's no such
+ * device, and -ENOENT if it doesn't have the attribute.
+ */
+int get_cached_sysattr(const char *subsystem, const char *sysname,
+		       const char *attr, char *buf, size_t len);
+/*
+ * Low level access, for values derived from a device in other ways.
+ * key should start with subsystem/sysname. get_cached_value() returns 0
+ * if the key is cached, and -ENOENT otherwise.
+ */
+int get_cached_value(const char *key, char *buf, size_t len);
+void set_cached_value(const char *key, const char *value);
+void invalidate_udev_cache(void);
+
+#endif /* _UDEV_CACHE_H */
@@ -38,10 +38,11 @@
 #include <linux/types.h>
 #include <linux/netlink.h>
 #include <pthread.h>
-#include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
 #include <libudev.h>
 #include <errno.h>
+#include <urcu/uatomic.h>
 
 #include "memory.h"
 #include "debug.h"
@@ -53,54 +54,187 @@
 #include "config.h"
 #include "blacklist.h"
 #include "devmapper.h"
+#include "configure.h"
+#include "wwids.h"
+#include "time-util.h"
+#include "trace.h"
+#include "objpool.h"
+#include "thread_settings.h"
+#include "worker_pool.h"
+#include "defaults.h"
+
+/* poll timeout of uevent_listen() while no uevents are accumulated */
+#define UEV_IDLE_TIMEOUT_MS (30 * 1000)
+/* poll timeout of uevent_listen() while the uevent queue is full */
+#define UEV_RETRY_TIMEOUT_MS 10
+/* Must be a power of 2 */
+#define UEVQ_SIZE 4096
+/*
+ * Receive buffer of the udev monitor. It starts small, and is doubled
+ * whenever it overflows.
+ */
+#define UEV_RCVBUF_MIN (16 * 1024 * 1024)
+#define UEV_RCVBUF_MAX (128 * 1024 * 1024)
 
-#define MAX_ACCUMULATION_COUNT 2048
-#define MAX_ACCUMULATION_TIME 30*1000
-#define MIN_BURST_SPEED 10
+/* Subsystems of the transport objects that paths depend on */
+static const char *const transport_subsystems[] = {
+	"fc_remote_ports",
+	"iscsi_session",
+};
 
 typedef int (uev_trigger)(struct uevent *, void * trigger_data);
 
-static LIST_HEAD(uevq);
-static pthread_mutex_t uevq_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t *uevq_lockp = &uevq_lock;
-static pthread_cond_t uev_cond = PTHREAD_COND_INITIALIZER;
-static pthread_cond_t *uev_condp = &uev_cond;
+/*
+ * uevent_listen() hands uevents over to uevent_dispatch() through a
+ * single-producer, single-consumer ring, so that the listener never
+ * waits for the dispatcher. uevq_head is only written by the listener,
+ * uevq_tail only by the dispatcher. uevq_efd wakes up the dispatcher.
+ */
+static struct uevent *uevq[UEVQ_SIZE];
+static unsigned long uevq_head;
+static unsigned long uevq_tail;
+static int uevq_efd = -1;
+static pthread_once_t uevq_once = PTHREAD_ONCE_INIT;
 static uev_trigger *my_uev_trigger;
 static void *my_trigger_data;
 static int servicing_uev;
+/* highest ring fill level seen, only written by the listener */
+static unsigned int uevq_max_depth;
+/* Set by the listener while a resync uevent is queued, see uevent_overrun() */
+static int resync_pending;
+static const char resync_action[] = "resync";
+static pthread_mutex_t uev_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct uevent_stats uev_stats;
+/* see uevent_record_start() */
+static pthread_mutex_t uev_record_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *uev_record_file;
+static long uev_recorded;
+
+void uevent_get_stats(struct uevent_stats *st)
+{
+	pthread_mutex_lock(&uev_stats_lock);
+	*st = uev_stats;
+	pthread_mutex_unlock(&uev_stats_lock);
+	st->queued = uatomic_read(&uevq_head) - uatomic_read(&uevq_tail);
+	st->max_queued = uatomic_read(&uevq_max_depth);
+}
+
+static void init_uevq(void)
+{
+	uevq_efd = eventfd(0, EFD_CLOEXEC);
+	if (uevq_efd < 0)
+		condlog(0, "failed to create uevent queue eventfd: %m");
+}
+
+static bool uevq_empty(void)
+{
+	return uatomic_read(&uevq_head) == uatomic_read(&uevq_tail);
+}
+
+/* Called by the listener only */
+static bool uevq_push(struct uevent *uev)
+{
+	unsigned long head = uevq_head, depth;
+
+	depth = head - uatomic_read(&uevq_tail);
+	if (depth >= UEVQ_SIZE)
+		return false;
+	if (depth + 1 > uevq_max_depth)
+		uatomic_set(&uevq_max_depth, depth + 1);
+	/* Don't overwrite the slot before the dispatcher has read it */
+	cmm_smp_mb();
+	uevq[head & (UEVQ_SIZE - 1)] = uev;
+	cmm_smp_wmb();
+	uatomic_set(&uevq_head, head + 1);
+	return true;
+}
+
+/* Called by the dispatcher only */
+static unsigned int uevq_pop_all(struct list_head *tmpq)
+{
+	unsigned long tail = uevq_tail, head;
+	unsigned int n = 0;
+
+	head = uatomic_read(&uevq_head);
+	cmm_smp_rmb();
+	for (; tail != head; tail++, n++)
+		list_add_tail(&uevq[tail & (UEVQ_SIZE - 1)]->node, tmpq);
+	cmm_smp_mb();
+	uatomic_set(&uevq_tail, tail);
+	return n;
+}
 
 int is_uevent_busy(void)
 {
-	int empty;
+	bool empty = uevq_empty();
 
-	pthread_mutex_lock(uevq_lockp);
-	empty = list_empty(&uevq);
-	pthread_mutex_unlock(uevq_lockp);
-	return (!empty || servicing_uev);
+	/* servicing_uev is set before the dispatcher empties the ring */
+	cmm_smp_rmb();
+	return !empty || uatomic_read(&servicing_uev);
 }
 
-struct uevent * alloc_uevent (void)
+/*
+ * Size of the uevents in the uevent pool, including the storage for
+ * the environment. The environment of typical block device uevents
+ * fits; uevents with a larger one are allocated with their exact size.
+ */
+#define UEVENT_POOL_OBJ_SIZE 2048
+#define UEVENT_POOL_MAX_FREE 1024
+
+static struct obj_pool uevent_pool =
+	OBJ_POOL_INIT(UEVENT_POOL_OBJ_SIZE, UEVENT_POOL_MAX_FREE);
+
+/* Allocates a uevent with nr_envp slots in envp, and buflen bytes in buffer */
+static struct uevent *alloc_uevent_size(int nr_envp, size_t buflen)
 {
-	struct uevent *uev = MALLOC(sizeof(struct uevent));
+	struct uevent *uev;
+	size_t size = sizeof(*uev) + nr_envp * sizeof(*uev->envp) + buflen;
+	bool pooled = size <= UEVENT_POOL_OBJ_SIZE;
 
+	if (pooled)
+		uev = obj_pool_get(&uevent_pool);
+	else
+		uev = calloc(1, size);
 	if (uev) {
 		INIT_LIST_HEAD(&uev->node);
 		INIT_LIST_HEAD(&uev->merge_node);
+		uev->buffer = (char *)&uev->envp[nr_envp];
+		uev->pooled = pooled;
 	}
 
 	return uev;
 }
 
+struct uevent * alloc_uevent (void)
+{
+	return alloc_uevent_size(HOTPLUG_NUM_ENVP,
+				 HOTPLUG_BUFFER_SIZE + OBJECT_SIZE);
+}
+
+void free_uevent(struct uevent *uev)
+{
+	if (!uev)
+		return;
+	if (uev->udev)
+		udev_device_unref(uev->udev);
+	if (uev->pooled)
+		obj_pool_put(&uevent_pool, uev);
+	else
+		free(uev);
+}
+
+void cleanup_uevent_pool(void)
+{
+	obj_pool_drain(&uevent_pool);
+}
+
 static void uevq_cleanup(struct list_head *tmpq)
 {
 	struct uevent *uev, *tmp;
 
 	list_for_each_entry_safe(uev, tmp, tmpq, node) {
 		list_del_init(&uev->node);
-
-		if (uev->udev)
-			udev_device_unref(uev->udev);
-		FREE(uev);
+		free_uevent(uev);
 	}
 }
 
@@ -118,6 +252,10 @@ static const char* uevent_get_env_var(const struct uevent *uev,
 	if (len == 0)
 		goto invalid;
 
+	if (uev->udev) {
+		p = udev_device_get_property_value(uev->udev, attr);
+		goto out;
+	}
 	for (i = 0; uev->envp[i] != NULL; i++) {
 		const char *var = uev->envp[i];
 
@@ -127,7 +265,7 @@ static const char* uevent_get_env_var(const struct uevent *uev,
 			break;
 		}
 	}
-
+out:
 	condlog(4, "%s: %s -> '%s'", __func__, attr, p ?: "(null)");
 	return p;
 
@@ -167,8 +305,52 @@ uevent_get_wwid(struct uevent *uev)
 	pthread_cleanup_pop(1);
 
 	val = uevent_get_env_var(uev, uid_attribute);
-	if (val)
+	if (val) {
 		uev->wwid = val;
+		uev->wwid_hash = wwid_hash(val);
+	}
+}
+
+/* Properties of path uevents that uev_update_path() acts on */
+static const char *const digest_props[] = {
+	"ID_SERIAL", "ID_WWN", "DM_MULTIPATH_DEVICE_PATH", "DISK_RO",
+};
+
+/* Properties of change uevents for device changes udev doesn't see */
+static const char *const forced_props[] = {
+	"RESIZE", "SDEV_UA", "SDEV_MEDIA_CHANGE", "DISK_MEDIA_CHANGE",
+};
+
+/* 64 bit FNV-1a, fed one string at a time */
+static unsigned long long digest_add(unsigned long long h, const char *str)
+{
+	if (!str)
+		str = "";
+	do
+		h = (h ^ (unsigned char)*str) * 1099511628211ULL;
+	while (*str++);
+	return h;
+}
+
+unsigned long long uevent_path_digest(const struct uevent *uev,
+				      const char *uid_attribute)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	const char *uid;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(forced_props); i++)
+		if (uevent_get_env_var(uev, forced_props[i]))
+			return 0;
+	if (!uid_attribute || !*uid_attribute ||
+	    !(uid = uevent_get_env_var(uev, uid_attribute)))
+		return 0;
+	h = digest_add(h, uev->kernel);
+	h = digest_add(h, uev->wwid);
+	h = digest_add(h, uid);
+	for (i = 0; i < ARRAY_SIZE(digest_props); i++)
+		h = digest_add(h, uevent_get_env_var(uev, digest_props[i]));
+	return h ? h : 1;
 }
 
 static bool uevent_need_merge(void)
@@ -184,15 +366,21 @@ static bool uevent_need_merge(void)
 	return need_merge;
 }
 
+bool uevent_is_resync(const struct uevent *uev)
+{
+	return uev->action == resync_action;
+}
+
 static bool uevent_can_discard(struct uevent *uev)
 {
 	int invalid = 0;
 	struct config * conf;
 
 	/*
-	 * do not filter dm devices by devnode
+	 * do not filter dm devices, transport objects and resyncs by devnode
 	 */
-	if (!strncmp(uev->kernel, "dm-", 3))
+	if (!strncmp(uev->kernel, "dm-", 3) || uevent_is_transport(uev) ||
+	    uevent_is_resync(uev))
 		return false;
 	/*
 	 * filter paths devices by devnode
@@ -271,7 +459,8 @@ merge_need_stop(struct uevent *earlier, struct uevent *later)
 	 * with the same wwid and different action
 	 * it would be better to stop merging.
 	 */
-	if (!strcmp(earlier->wwid, later->wwid) &&
+	if (earlier->wwid_hash == later->wwid_hash &&
+	    !strcmp(earlier->wwid, later->wwid) &&
 	    strcmp(earlier->action, later->action) &&
 	    strcmp(earlier->action, "change") &&
 	    strcmp(later->action, "change"))
@@ -289,6 +478,7 @@ uevent_can_merge(struct uevent *earlier, struct uevent *later)
 	 * and actions are addition or deletion
 	 */
 	if (earlier->wwid && later->wwid &&
+	    earlier->wwid_hash == later->wwid_hash &&
 	    !strcmp(earlier->wwid, later->wwid) &&
 	    !strcmp(earlier->action, later->action) &&
 	    strncmp(earlier->action, "change", 6) &&
@@ -299,100 +489,450 @@ uevent_can_merge(struct uevent *earlier, struct uevent *later)
 	return false;
 }
 
-static void
+/* Returns the number of discarded uevents */
+static unsigned int
 uevent_prepare(struct list_head *tmpq)
 {
 	struct uevent *uev, *tmp;
+	unsigned int discarded = 0;
 
 	list_for_each_entry_reverse_safe(uev, tmp, tmpq, node) {
 		if (uevent_can_discard(uev)) {
 			list_del_init(&uev->node);
-			if (uev->udev)
-				udev_device_unref(uev->udev);
-			FREE(uev);
+			free_uevent(uev);
+			discarded++;
 			continue;
 		}
 
 		if (strncmp(uev->kernel, "dm-", 3) &&
+		    !uevent_is_transport(uev) && !uevent_is_resync(uev) &&
 		    uevent_need_merge())
 			uevent_get_wwid(uev);
 	}
+	return discarded;
+}
+
+/*
+ * Index of the queued uevents for merge_uevq(). A uevent can only filter
+ * earlier uevents for the same device, and only be merged with earlier
+ * uevents with the same WWID. These are found through hash chains on
+ * the kernel device name and on the WWID, so that a uevent storm doesn't
+ * take quadratic time. The chains are in queue order.
+ */
+struct uev_ref {
+	struct uevent *uev;
+	unsigned int pos;
+	bool removed;
+	struct list_head kernel_node;
+	/* in the WWID chain, or in nowwid if the uevent has no WWID */
+	struct list_head wwid_node;
+};
+
+struct uev_index {
+	unsigned int nr;
+	unsigned int mask;
+	struct uev_ref *refs;
+	struct list_head *kernel_hash;
+	struct list_head *wwid_hash;
+	struct list_head nowwid;
+	/* The latest uevent without WWID before the current one, or NULL */
+	struct uev_ref *boundary;
+	bool boundary_valid;
+	unsigned int filtered;
+	unsigned int merged;
+};
+
+static void free_uev_index(struct uev_index *idx)
+{
+	free(idx->wwid_hash);
+	free(idx->kernel_hash);
+	free(idx->refs);
+}
+
+static int init_uev_index(struct uev_index *idx, struct list_head *tmpq)
+{
+	struct uevent *uev;
+	struct uev_ref *ref;
+	unsigned int i, nr = 0, size = 16;
+
+	memset(idx, 0, sizeof(*idx));
+	INIT_LIST_HEAD(&idx->nowwid);
+	list_for_each_entry(uev, tmpq, node)
+		nr++;
+	while (size < nr)
+		size <<= 1;
+	idx->refs = calloc(nr, sizeof(*idx->refs));
+	idx->kernel_hash = calloc(size, sizeof(*idx->kernel_hash));
+	idx->wwid_hash = calloc(size, sizeof(*idx->wwid_hash));
+	if (!idx->refs || !idx->kernel_hash || !idx->wwid_hash) {
+		free_uev_index(idx);
+		return -1;
+	}
+	idx->mask = size - 1;
+	for (i = 0; i < size; i++) {
+		INIT_LIST_HEAD(&idx->kernel_hash[i]);
+		INIT_LIST_HEAD(&idx->wwid_hash[i]);
+	}
+
+	list_for_each_entry(uev, tmpq, node) {
+		ref = &idx->refs[idx->nr];
+		ref->uev = uev;
+		ref->pos = idx->nr++;
+		list_add_tail(&ref->kernel_node,
+			      &idx->kernel_hash[hash_str(uev->kernel) &
+						idx->mask]);
+		if (uev->wwid)
+			list_add_tail(&ref->wwid_node,
+					      &idx->wwid_hash[uev->wwid_hash &
+						      idx->mask]);
+		else
+			list_add_tail(&ref->wwid_node, &idx->nowwid);
+	}
+	return 0;
+}
+
+/* Drop an uevent from the index when it's removed from the queue */
+static void uev_index_remove(struct uev_index *idx, struct uev_ref *ref)
+{
+	if (!ref->uev->wwid && idx->boundary == ref)
+		idx->boundary = ref->wwid_node.prev == &idx->nowwid ? NULL :
+			list_entry(ref->wwid_node.prev, struct uev_ref,
+				   wwid_node);
+	list_del_init(&ref->wwid_node);
+	list_del_init(&ref->kernel_node);
+	ref->removed = true;
+}
+
+/* Find the latest uevent without WWID before the current one */
+static void uev_index_set_boundary(struct uev_index *idx,
+				   const struct uev_ref *later)
+{
+	struct uev_ref *b = idx->boundary;
+
+	/* The current uevent only ever moves towards the queue head */
+	if (!idx->boundary_valid) {
+		idx->boundary_valid = true;
+		b = list_empty(&idx->nowwid) ? NULL :
+			list_entry(idx->nowwid.prev, struct uev_ref, wwid_node);
+	}
+	while (b && b->pos >= later->pos)
+		b = b->wwid_node.prev == &idx->nowwid ? NULL :
+			list_entry(b->wwid_node.prev, struct uev_ref,
+				   wwid_node);
+	idx->boundary = b;
 }
 
 static void
-uevent_filter(struct uevent *later, struct list_head *tmpq)
+uevent_filter(struct uev_ref *later, struct uev_index *idx)
 {
-	struct uevent *earlier, *tmp;
+	struct list_head *head;
+	struct uev_ref *earlier, *tmp;
 
-	list_for_some_entry_reverse_safe(earlier, tmp, &later->node, tmpq, node) {
+	head = &idx->kernel_hash[hash_str(later->uev->kernel) & idx->mask];
+	list_for_some_entry_reverse_safe(earlier, tmp, &later->kernel_node,
+					 head, kernel_node) {
 		/*
 		 * filter unnessary earlier uevents
 		 * by the later uevent
 		 */
-		if (uevent_can_filter(earlier, later)) {
+		if (uevent_can_filter(earlier->uev, later->uev)) {
 			condlog(3, "uevent: %s-%s has filtered by uevent: %s-%s",
-				earlier->kernel, earlier->action,
-				later->kernel, later->action);
-
-			list_del_init(&earlier->node);
-			if (earlier->udev)
-				udev_device_unref(earlier->udev);
-			FREE(earlier);
+				earlier->uev->kernel, earlier->uev->action,
+				later->uev->kernel, later->uev->action);
+
+			TRACE2(uevent_filtered, earlier->uev->kernel,
+			       earlier->uev->action);
+			uev_index_remove(idx, earlier);
+			idx->filtered++;
+			list_del_init(&earlier->uev->node);
+			free_uevent(earlier->uev);
+			earlier->uev = NULL;
 		}
 	}
 }
 
+/*
+ * Merging stops at the first earlier uevent without WWID, and at uevents
+ * with the same WWID for which merge_need_stop() is true. Uevents with
+ * other WWIDs in between don't matter.
+ */
 static void
-uevent_merge(struct uevent *later, struct list_head *tmpq)
+uevent_merge(struct uev_ref *later, struct uev_index *idx)
 {
-	struct uevent *earlier, *tmp;
-
-	list_for_some_entry_reverse_safe(earlier, tmp, &later->node, tmpq, node) {
-		if (merge_need_stop(earlier, later))
+	struct list_head *head;
+	struct uev_ref *earlier, *tmp;
+
+	if (!later->uev->wwid || !strncmp(later->uev->kernel, "dm-", 3))
+		return;
+	uev_index_set_boundary(idx, later);
+	head = &idx->wwid_hash[later->uev->wwid_hash & idx->mask];
+	list_for_some_entry_reverse_safe(earlier, tmp, &later->wwid_node,
+					 head, wwid_node) {
+		if (idx->boundary && earlier->pos < idx->boundary->pos)
+			break;
+		if (earlier->uev->wwid_hash != later->uev->wwid_hash ||
+		    strcmp(earlier->uev->wwid, later->uev->wwid))
+			continue;
+		if (merge_need_stop(earlier->uev, later->uev))
 			break;
 		/*
 		 * merge earlier uevents to the later uevent
 		 */
-		if (uevent_can_merge(earlier, later)) {
+		if (uevent_can_merge(earlier->uev, later->uev)) {
 			condlog(3, "merged uevent: %s-%s-%s with uevent: %s-%s-%s",
-				earlier->action, earlier->kernel, earlier->wwid,
-				later->action, later->kernel, later->wwid);
-
-			list_move(&earlier->node, &later->merge_node);
+				earlier->uev->action, earlier->uev->kernel,
+				earlier->uev->wwid, later->uev->action,
+				later->uev->kernel, later->uev->wwid);
+
+			TRACE3(uevent_merged, earlier->uev->kernel,
+			       earlier->uev->action, later->uev->kernel);
+			uev_index_remove(idx, earlier);
+			idx->merged++;
+			list_move(&earlier->uev->node, &later->uev->merge_node);
 		}
 	}
 }
 
 static void
-merge_uevq(struct list_head *tmpq)
+merge_uevq(struct list_head *tmpq, unsigned int *merged,
+	   unsigned int *filtered, unsigned int *discarded)
 {
-	struct uevent *later;
+	struct uev_index idx;
+	bool need_merge;
+	unsigned int i;
+
+	*merged = *filtered = 0;
+	*discarded = uevent_prepare(tmpq);
+	if (list_empty(tmpq))
+		return;
+	if (init_uev_index(&idx, tmpq) != 0) {
+		condlog(1, "%s: failed to index uevents, not merging", __func__);
+		return;
+	}
+	need_merge = uevent_need_merge();
+	for (i = idx.nr; i > 0; i--) {
+		struct uev_ref *later = &idx.refs[i - 1];
 
-	uevent_prepare(tmpq);
-	list_for_each_entry_reverse(later, tmpq, node) {
-		uevent_filter(later, tmpq);
-		if(uevent_need_merge())
-			uevent_merge(later, tmpq);
+		if (later->removed)
+			continue;
+		uevent_filter(later, &idx);
+		if (need_merge)
+			uevent_merge(later, &idx);
 	}
+	*merged = idx.merged;
+	*filtered = idx.filtered;
+	free_uev_index(&idx);
 }
 
-static void
-service_uevq(struct list_head *tmpq)
+static void end_uevq_batch(void *arg __attribute__((unused)))
+{
+	dm_udev_batch_end();
+	/* The path uevents for new WWIDs must follow the wwids file update */
+	wwids_batch_end();
+	flush_path_triggers();
+}
+
+/* Lag of the uevents in a batch, added to uev_stats afterwards */
+struct uev_lag {
+	unsigned long sum_us;
+	unsigned long max_us;
+	unsigned long buckets[UEV_LAG_BUCKETS];
+};
+
+static void add_lag(struct uev_lag *lag, const struct uevent *uev,
+		    const struct timespec *now)
+{
+	struct timespec diff;
+	unsigned long us = 0;
+	int b = 0;
+
+	timespecsub(now, &uev->received, &diff);
+	if (diff.tv_sec >= 0)
+		us = diff.tv_sec * 1000000UL + diff.tv_nsec / 1000;
+	while (b < UEV_LAG_BUCKETS - 1 && us >= 1UL << b)
+		b++;
+	lag->buckets[b]++;
+	lag->sum_us += us;
+	if (us > lag->max_us)
+		lag->max_us = us;
+}
+
+static void add_lags(struct uev_lag *lag, const struct uev_lag *other)
 {
+	int i;
+
+	lag->sum_us += other->sum_us;
+	if (other->max_us > lag->max_us)
+		lag->max_us = other->max_us;
+	for (i = 0; i < UEV_LAG_BUCKETS; i++)
+		lag->buckets[i] += other->buckets[i];
+}
+
+static void dispatch_uevent(struct uevent *uev, struct uev_lag *lag)
+{
+	struct uevent *merged;
+	struct timespec now;
+
+	/* Overruns from now on need another resync */
+	if (uevent_is_resync(uev))
+		uatomic_set(&resync_pending, 0);
+
+	TRACE3(uevent_dispatch_start, uev->kernel, uev->action, uev->seqnum);
+	if (my_uev_trigger && my_uev_trigger(uev, my_trigger_data))
+		condlog(0, "uevent trigger error");
+	TRACE1(uevent_dispatch_end, uev->seqnum);
+
+	/* merged uevents have been handled along with this one */
+	get_monotonic_time(&now);
+	add_lag(lag, uev, &now);
+	list_for_each_entry(merged, &uev->merge_node, node)
+		add_lag(lag, merged, &now);
+	uevq_cleanup(&uev->merge_node);
+	free_uevent(uev);
+}
+
+/*
+ * Path uevents of different LUNs are dispatched in parallel, in lanes
+ * chosen by the WWID. Uevents in a lane stay in order. Uevents without
+ * a WWID, and those of maps, transport objects and resyncs, which may
+ * concern paths of any LUN, are dispatched alone after all uevents
+ * queued before them. There are more lanes than threads, so that
+ * the threads can balance lanes of different lengths.
+ */
+#define UEV_LANES_PER_THREAD 4
+
+struct uev_lane {
+	struct list_head uevs;
+	struct uev_lag lag;
+};
+
+struct uev_dispatcher {
+	int threads;
+	struct worker_pool *pool;
+	int nr_lanes;
+	struct uev_lane *lanes;
+};
+
+static void free_dispatcher(struct uev_dispatcher *d)
+{
+	worker_pool_destroy(d->pool);
+	d->pool = NULL;
+	free(d->lanes);
+	d->lanes = NULL;
+	d->nr_lanes = 0;
+}
+
+static void cleanup_dispatcher(void *arg)
+{
+	free_dispatcher(arg);
+}
+
+static void setup_dispatcher(struct uev_dispatcher *d, int threads)
+{
+	int i;
+
+	free_dispatcher(d);
+	d->threads = threads;
+	d->pool = worker_pool_create(threads, "uevent");
+	if (!d->pool)
+		return;
+	d->nr_lanes = UEV_LANES_PER_THREAD * worker_pool_size(d->pool);
+	d->lanes = calloc(d->nr_lanes, sizeof(*d->lanes));
+	if (!d->lanes) {
+		free_dispatcher(d);
+		return;
+	}
+	for (i = 0; i < d->nr_lanes; i++)
+		INIT_LIST_HEAD(&d->lanes[i].uevs);
+}
+
+/*
+ * With uid_attrs, uevent_prepare() has set the WWIDs. Otherwise the
+ * default uid_attribute tells paths of the same LUN apart well enough.
+ * Any uevent of a device must get the same key, or NULL.
+ */
+static const char *uevent_lane_key(const struct uevent *uev, bool need_merge)
+{
+	if (!strncmp(uev->kernel, "dm-", 3) || uevent_is_transport(uev) ||
+	    uevent_is_resync(uev))
+		return NULL;
+	if (need_merge)
+		return uev->wwid;
+	return uevent_get_env_var(uev, DEFAULT_UID_ATTRIBUTE);
+}
+
+static void run_uev_lane(void *item, void *arg __attribute__((unused)))
+{
+	struct uev_lane *lane = item;
 	struct uevent *uev, *tmp;
 
-	list_for_each_entry_safe(uev, tmp, tmpq, node) {
+	/* In the dispatcher thread, these nest in the batches of service_uevq() */
+	wwids_batch_start();
+	dm_udev_batch_start();
+	list_for_each_entry_safe(uev, tmp, &lane->uevs, node) {
 		list_del_init(&uev->node);
+		dispatch_uevent(uev, &lane->lag);
+	}
+	dm_udev_batch_end();
+	wwids_batch_end();
+}
 
-		if (my_uev_trigger && my_uev_trigger(uev, my_trigger_data))
-			condlog(0, "uevent trigger error");
+static void dispatch_lanes(struct uev_dispatcher *d, struct uev_lag *lag)
+{
+	struct _vector items = { .allocated = 0, .slot = NULL };
+	int i;
 
-		uevq_cleanup(&uev->merge_node);
+	for (i = 0; i < d->nr_lanes; i++) {
+		if (list_empty(&d->lanes[i].uevs))
+			continue;
+		if (vector_alloc_slot(&items))
+			vector_set_slot(&items, &d->lanes[i]);
+		else
+			run_uev_lane(&d->lanes[i], NULL);
+	}
+	worker_pool_run(d->pool, &items, run_uev_lane, NULL);
+	vector_reset(&items);
+	for (i = 0; i < d->nr_lanes; i++) {
+		add_lags(lag, &d->lanes[i].lag);
+		memset(&d->lanes[i].lag, 0, sizeof(d->lanes[i].lag));
+	}
+}
 
-		if (uev->udev)
-			udev_device_unref(uev->udev);
-		FREE(uev);
+static void
+service_uevq(struct list_head *tmpq, struct uev_lag *lag,
+	     struct uev_dispatcher *d)
+{
+	struct uevent *uev, *tmp;
+	const char *key;
+	bool need_merge = d->pool && uevent_need_merge();
+	unsigned int queued = 0;
+
+	/*
+	 * Don't wait for udev after each map created during a uevent storm,
+	 * and write the WWIDs of the new maps to the wwids file at once.
+	 */
+	start_path_triggers();
+	wwids_batch_start();
+	dm_udev_batch_start();
+	pthread_cleanup_push(end_uevq_batch, NULL);
+	list_for_each_entry_safe(uev, tmp, tmpq, node) {
+		key = d->pool ? uevent_lane_key(uev, need_merge) : NULL;
+		if (key) {
+			list_move_tail(&uev->node, &d->lanes[hash_str(key) %
+							    d->nr_lanes].uevs);
+			queued++;
+			continue;
+		}
+		if (queued) {
+			dispatch_lanes(d, lag);
+			queued = 0;
+		}
+		list_del_init(&uev->node);
+		dispatch_uevent(uev, lag);
 	}
+	if (queued)
+		dispatch_lanes(d, lag);
+	pthread_cleanup_pop(1);
 }
 
 static void uevent_cleanup(void *arg)
@@ -411,144 +951,424 @@ static void monitor_cleanup(void *arg)
 	udev_monitor_unref(monitor);
 }
 
+static unsigned long us_between(const struct timespec *a,
+				const struct timespec *b)
+{
+	struct timespec diff;
+
+	timespecsub(b, a, &diff);
+	if (diff.tv_sec < 0)
+		return 0;
+	return diff.tv_sec * 1000000UL + diff.tv_nsec / 1000;
+}
+
+static void update_service_stats(unsigned int events, unsigned int merged,
+				 unsigned int filtered, unsigned int discarded,
+				 const struct uev_lag *lag, unsigned long us)
+{
+	unsigned long cost = us / events;
+	int i;
+
+	pthread_mutex_lock(&uev_stats_lock);
+	uev_stats.cost_us = uev_stats.batches == 0 ? cost :
+		(3 * uev_stats.cost_us + cost) / 4;
+	uev_stats.batches++;
+	uev_stats.events += events;
+	uev_stats.merged += merged;
+	uev_stats.filtered += filtered;
+	uev_stats.discarded += discarded;
+	uev_stats.lag_sum_us += lag->sum_us;
+	if (lag->max_us > uev_stats.lag_max_us)
+		uev_stats.lag_max_us = lag->max_us;
+	for (i = 0; i < UEV_LAG_BUCKETS; i++)
+		uev_stats.lag_buckets[i] += lag->buckets[i];
+	pthread_mutex_unlock(&uev_stats_lock);
+}
+
 /*
  * Service the uevent queue.
  */
 int uevent_dispatch(int (*uev_trigger)(struct uevent *, void * trigger_data),
 		    void * trigger_data)
 {
+	LIST_HEAD(uevq_tmp);
+	struct uev_dispatcher d = { .threads = 1, };
+	struct config *conf;
+	int threads, rc = 0;
+
+	pthread_once(&uevq_once, init_uevq);
+	if (uevq_efd < 0)
+		return 1;
+
 	my_uev_trigger = uev_trigger;
 	my_trigger_data = trigger_data;
 
-	mlockall(MCL_CURRENT | MCL_FUTURE);
+	lock_memory();
 
+	pthread_cleanup_push(cleanup_dispatcher, &d);
 	while (1) {
-		LIST_HEAD(uevq_tmp);
+		struct timespec start, end;
+		unsigned int events, merged, filtered, discarded;
+		struct uev_lag lag = { .sum_us = 0, };
+		uint64_t val;
 
-		pthread_mutex_lock(uevq_lockp);
-		servicing_uev = 0;
+		uatomic_set(&servicing_uev, 0);
+		cmm_smp_mb();
 		/*
-		 * Condition signals are unreliable,
-		 * so make sure we only wait if we have to.
+		 * The listener writes to the eventfd after adding uevents,
+		 * so a wakeup can't be lost between this check and read().
+		 * Spurious wakeups just find the ring empty.
 		 */
-		if (list_empty(&uevq)) {
-			pthread_cond_wait(uev_condp, uevq_lockp);
+		sample_thread_cpu(THREAD_UEVQ);
+		if (uevq_empty() &&
+		    read(uevq_efd, &val, sizeof(val)) < 0 && errno != EINTR) {
+			condlog(0, "error waiting for uevents: %m");
+			rc = 1;
+			break;
 		}
-		servicing_uev = 1;
-		list_splice_init(&uevq, &uevq_tmp);
-		pthread_mutex_unlock(uevq_lockp);
+		uatomic_set(&servicing_uev, 1);
+		cmm_smp_mb();
+		events = uevq_pop_all(&uevq_tmp);
 		if (!my_uev_trigger)
 			break;
-		merge_uevq(&uevq_tmp);
-		service_uevq(&uevq_tmp);
+		if (events == 0)
+			continue;
+		conf = get_multipath_config();
+		threads = conf->uevent_threads;
+		put_multipath_config(conf);
+		if (threads != d.threads)
+			setup_dispatcher(&d, threads);
+		get_monotonic_time(&start);
+		merge_uevq(&uevq_tmp, &merged, &filtered, &discarded);
+		service_uevq(&uevq_tmp, &lag, &d);
+		get_monotonic_time(&end);
+		update_service_stats(events, merged, filtered, discarded, &lag,
+				     us_between(&start, &end));
 	}
+	pthread_cleanup_pop(1);
+	if (rc)
+		return rc;
 	condlog(3, "Terminating uev service queue");
-	uevq_cleanup(&uevq);
+	uevq_pop_all(&uevq_tmp);
+	uevq_cleanup(&uevq_tmp);
 	return 0;
 }
 
-static struct uevent *uevent_from_udev_device(struct udev_device *dev)
+static void get_udev_property(struct udev_list_entry *list_entry,
+			      const char **name, const char **value)
+{
+	*name = udev_list_entry_get_name(list_entry);
+	if (!*name)
+		*name = "(null)";
+	*value = udev_list_entry_get_value(list_entry);
+	if (!*value)
+		*value = "(null)";
+}
+
+/*
+ * The environment of uevents from libudev isn't copied. Lookups use
+ * the properties of uev->udev, which libudev received along with the
+ * uevent, and the fields used for every uevent are resolved here.
+ */
+struct uevent *uevent_from_device(struct udev_device *dev, const char *action)
 {
 	struct uevent *uev;
-	int i = 0;
-	char *pos, *end;
 	struct udev_list_entry *list_entry;
+	const char *name, *value;
 
-	uev = alloc_uevent();
+	uev = alloc_uevent_size(1, 0);
 	if (!uev) {
 		udev_device_unref(dev);
 		condlog(1, "lost uevent, oom");
 		return NULL;
 	}
-	pos = uev->buffer;
-	end = pos + HOTPLUG_BUFFER_SIZE + OBJECT_SIZE - 1;
-	udev_list_entry_foreach(list_entry, udev_device_get_properties_list_entry(dev)) {
-		const char *name, *value;
-		int bytes;
-
-		name = udev_list_entry_get_name(list_entry);
-		if (!name)
-			name = "(null)";
-		value = udev_list_entry_get_value(list_entry);
-		if (!value)
-			value = "(null)";
-		bytes = snprintf(pos, end - pos, "%s=%s", name, value);
-		if (pos + bytes >= end) {
-			condlog(2, "buffer overflow for uevent");
-			break;
-		}
-		uev->envp[i] = pos;
-		pos += bytes;
-		*pos = '\0';
-		pos++;
-		if (strcmp(name, "DEVPATH") == 0)
-			uev->devpath = uev->envp[i] + 8;
-		if (strcmp(name, "ACTION") == 0)
-			uev->action = uev->envp[i] + 7;
-		i++;
-		if (i == HOTPLUG_NUM_ENVP - 1)
-			break;
-	}
+	get_monotonic_time(&uev->received);
+	uev->envp[0] = NULL;
+	uev->udev = dev;
+	uev->devpath = udev_device_get_property_value(dev, "DEVPATH");
+	uev->action = action ?: udev_device_get_property_value(dev, "ACTION");
 	if (!uev->devpath || ! uev->action) {
-		udev_device_unref(dev);
 		condlog(1, "uevent missing necessary fields");
-		FREE(uev);
+		free_uevent(uev);
 		return NULL;
 	}
-	uev->udev = dev;
-	uev->envp[i] = NULL;
+	uev->seqnum = udev_device_get_seqnum(dev);
 
 	condlog(3, "uevent '%s' from '%s'", uev->action, uev->devpath);
 	uev->kernel = strrchr(uev->devpath, '/');
 	if (uev->kernel)
 		uev->kernel++;
+	uev->major = uevent_get_env_positive_int(uev, "MAJOR");
+	uev->minor = uevent_get_env_positive_int(uev, "MINOR");
 
 	/* print payload environment */
-	for (i = 0; uev->envp[i] != NULL; i++)
-		condlog(5, "%s", uev->envp[i]);
+	if (condlog_enabled(5))
+		udev_list_entry_foreach(list_entry,
+				udev_device_get_properties_list_entry(dev)) {
+			get_udev_property(list_entry, &name, &value);
+			condlog(5, "%s=%s", name, value);
+		}
 	return uev;
 }
 
-static bool uevent_burst(struct timeval *start_time, int events)
+int uevent_record_start(const char *path)
 {
-	struct timeval diff_time, end_time;
-	unsigned long speed;
-	unsigned long eclipse_ms;
+	FILE *f;
+	int fd, ret = 0;
 
-	if(events > MAX_ACCUMULATION_COUNT) {
-		condlog(2, "burst got %u uevents, too much uevents, stopped", events);
-		return false;
+	pthread_mutex_lock(&uev_record_lock);
+	if (uev_record_file) {
+		ret = -EBUSY;
+		goto out;
+	}
+	/* Never follow a link planted in place of the file */
+	fd = open(path, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0600);
+	if (fd == -1) {
+		ret = -errno;
+		goto out;
+	}
+	f = fdopen(fd, "w");
+	if (!f) {
+		ret = -errno;
+		close(fd);
+		goto out;
 	}
+	fprintf(f, "%s\n", UEVENT_RECORD_HEADER);
+	uev_recorded = 0;
+	uatomic_set(&uev_record_file, f);
+	condlog(2, "recording uevents to %s", path);
+out:
+	pthread_mutex_unlock(&uev_record_lock);
+	return ret;
+}
 
-	gettimeofday(&end_time, NULL);
-	timersub(&end_time, start_time, &diff_time);
+long uevent_record_stop(void)
+{
+	long n = -1;
+
+	pthread_mutex_lock(&uev_record_lock);
+	if (uev_record_file) {
+		if (fclose(uev_record_file) != 0)
+			condlog(1, "error writing uevent record: %m");
+		uatomic_set(&uev_record_file, NULL);
+		n = uev_recorded;
+		condlog(2, "recorded %ld uevents", n);
+	}
+	pthread_mutex_unlock(&uev_record_lock);
+	return n;
+}
 
-	eclipse_ms = diff_time.tv_sec * 1000 + diff_time.tv_usec / 1000;
+static void record_uevent(const struct uevent *uev)
+{
+	struct udev_list_entry *list_entry;
+	const char *name, *value;
 
-	if (eclipse_ms == 0)
-		return true;
+	pthread_mutex_lock(&uev_record_lock);
+	if (!uev_record_file)
+		goto out;
+	fprintf(uev_record_file, "UEVENT %ld.%09ld %lu\n",
+		(long)uev->received.tv_sec, uev->received.tv_nsec,
+		uev->seqnum);
+	udev_list_entry_foreach(list_entry,
+			udev_device_get_properties_list_entry(uev->udev)) {
+		get_udev_property(list_entry, &name, &value);
+		fprintf(uev_record_file, "%s=%s\n", name, value);
+	}
+	if (fputc('\n', uev_record_file) == EOF) {
+		condlog(1, "error writing uevent record, stopped: %m");
+		fclose(uev_record_file);
+		uatomic_set(&uev_record_file, NULL);
+		goto out;
+	}
+	uev_recorded++;
+out:
+	pthread_mutex_unlock(&uev_record_lock);
+}
+
+/*
+ * uevent_listen() accumulates uevents which arrive in quick succession,
+ * and forwards them to the service thread together, so that they can be
+ * merged. After each uevent, it waits for the next one for four times the
+ * average interval between the uevents of the burst so far. After the
+ * first uevent, it waits for as long as processing a uevent took in the
+ * previous batches, so that single uevents aren't delayed much longer
+ * than they take to process.
+ */
+struct uev_burst {
+	unsigned int min_wait;
+	unsigned int max_wait;
+	unsigned int max_events;
+	unsigned int max_time;
+	unsigned int events;
+	struct timespec start;
+	struct timespec last;
+	/* average interval between uevents, in us */
+	unsigned long gap_us;
+	unsigned int window;
+};
+
+static void uevent_burst_init(struct uev_burst *b)
+{
+	struct config *conf;
+
+	conf = get_multipath_config();
+	b->min_wait = conf->uev_batch_min_wait;
+	b->max_wait = conf->uev_batch_max_wait;
+	b->max_events = conf->uev_batch_max_events;
+	b->max_time = conf->uev_batch_max_time;
+	put_multipath_config(conf);
+	b->events = 0;
+	b->gap_us = 0;
+	b->window = 0;
+}
+
+/*
+ * Called for every uevent received at now. Returns the time in ms to wait
+ * for the next one, or -1 if the uevents should be forwarded right away.
+ */
+static int uevent_burst(struct uev_burst *b, const struct timespec *now)
+{
+	unsigned long elapsed_ms, wait;
+
+	if (++b->events == 1) {
+		b->start = *now;
+		pthread_mutex_lock(&uev_stats_lock);
+		wait = uev_stats.cost_us / 1000;
+		pthread_mutex_unlock(&uev_stats_lock);
+	} else {
+		unsigned long gap = us_between(&b->last, now);
+
+		b->gap_us = b->events == 2 ? gap : (7 * b->gap_us + gap) / 8;
+		wait = 4 * b->gap_us / 1000;
+	}
+	b->last = *now;
+
+	if (b->events >= b->max_events) {
+		condlog(2, "burst got %u uevents, too much uevents, stopped",
+			b->events);
+		return -1;
+	}
+	elapsed_ms = us_between(&b->start, now) / 1000;
+	if (elapsed_ms >= b->max_time) {
+		condlog(2, "burst continued %lu ms, too long time, stopped",
+			elapsed_ms);
+		return -1;
+	}
+	if (wait < b->min_wait)
+		wait = b->min_wait;
+	if (wait > b->max_wait)
+		wait = b->max_wait;
+	if (wait > b->max_time - elapsed_ms)
+		wait = b->max_time - elapsed_ms;
+	b->window = wait;
+	return wait;
+}
+
+/*
+ * Queue uevents and poke the service thread. If the ring is full, the
+ * remaining uevents are kept in tmpq, and true is returned.
+ */
+static bool forward_uevents(struct list_head *tmpq)
+{
+	struct uevent *uev, *tmp;
+	uint64_t one = 1;
+	bool pushed = false;
 
-	if (eclipse_ms > MAX_ACCUMULATION_TIME) {
-		condlog(2, "burst continued %lu ms, too long time, stopped", eclipse_ms);
+	list_for_each_entry_safe(uev, tmp, tmpq, node) {
+		/* The dispatcher owns uev->node once uev is in the ring */
+		list_del_init(&uev->node);
+		if (!uevq_push(uev)) {
+			list_add(&uev->node, tmpq);
+			break;
+		}
+		pushed = true;
+	}
+	if (pushed && write(uevq_efd, &one, sizeof(one)) < 0)
+		condlog(1, "failed to wake up uevent dispatcher: %m");
+	if (list_empty(tmpq))
 		return false;
+	condlog(2, "uevent queue is full, delaying uevents");
+	return true;
+}
+
+static void set_rcvbuf(struct udev_monitor *monitor __attribute__((unused)),
+		       unsigned int size __attribute__((unused)))
+{
+#ifdef LIBUDEV_API_RECVBUF
+	if (udev_monitor_set_receive_buffer_size(monitor, size) < 0) {
+		condlog(2, "failed to set uevent receive buffer size to %u",
+			size);
+		return;
 	}
+	pthread_mutex_lock(&uev_stats_lock);
+	uev_stats.rcvbuf = size;
+	pthread_mutex_unlock(&uev_stats_lock);
+	condlog(3, "uevent receive buffer size %u", size);
+#endif
+}
 
-	speed = (events * 1000) / eclipse_ms;
-	if (speed > MIN_BURST_SPEED)
-		return true;
+static struct uevent *alloc_resync_uevent(void)
+{
+	struct uevent *uev = alloc_uevent_size(1, 0);
 
-	return false;
+	if (!uev)
+		return NULL;
+	get_monotonic_time(&uev->received);
+	uev->envp[0] = NULL;
+	uev->action = resync_action;
+	uev->devpath = "";
+	uev->kernel = uev->devpath;
+	uev->major = uev->minor = -1;
+	return uev;
+}
+
+/*
+ * The receive buffer of the monitor has overflowed, and uevents have been
+ * lost. Grow the buffer, and queue a resync uevent unless one is queued
+ * already, which will cover this overrun too.
+ */
+static void uevent_overrun(struct udev_monitor *monitor, struct list_head *tmpq)
+{
+	struct uevent *uev;
+	unsigned int size;
+
+	pthread_mutex_lock(&uev_stats_lock);
+	uev_stats.overruns++;
+	size = uev_stats.rcvbuf;
+	pthread_mutex_unlock(&uev_stats_lock);
+	condlog(1, "uevent receive buffer overrun, uevents were lost");
+	if (size && size < UEV_RCVBUF_MAX)
+		set_rcvbuf(monitor, size < UEV_RCVBUF_MAX / 2 ?
+			   2 * size : UEV_RCVBUF_MAX);
+
+	if (uatomic_read(&resync_pending))
+		return;
+	uev = alloc_resync_uevent();
+	if (!uev) {
+		condlog(0, "failed to queue uevent resync, oom");
+		return;
+	}
+	uatomic_set(&resync_pending, 1);
+	pthread_mutex_lock(&uev_stats_lock);
+	uev_stats.resyncs++;
+	pthread_mutex_unlock(&uev_stats_lock);
+	list_add_tail(&uev->node, tmpq);
 }
 
 int uevent_listen(struct udev *udev)
 {
 	int err = 2;
 	struct udev_monitor *monitor = NULL;
-	int fd, socket_flags, events;
-	struct timeval start_time;
-	int timeout = 30;
+	int fd, socket_flags;
+	unsigned int i;
+	struct uev_burst burst;
+	int timeout = UEV_IDLE_TIMEOUT_MS;
 	LIST_HEAD(uevlisten_tmp);
 
+	pthread_once(&uevq_once, init_uevq);
+	if (uevq_efd < 0)
+		return 1;
+
 	/*
 	 * Queue uevents for service by dedicated thread so that the uevent
 	 * listening thread does not block on multipathd locks (vecs->lock)
@@ -568,10 +1388,7 @@ int uevent_listen(struct udev *udev)
 		goto out_udev;
 	}
 	pthread_cleanup_push(monitor_cleanup, monitor);
-#ifdef LIBUDEV_API_RECVBUF
-	if (udev_monitor_set_receive_buffer_size(monitor, 128 * 1024 * 1024) < 0)
-		condlog(2, "failed to increase buffer size");
-#endif
+	set_rcvbuf(monitor, UEV_RCVBUF_MIN);
 	fd = udev_monitor_get_fd(monitor);
 	if (fd < 0) {
 		condlog(2, "failed to get monitor fd");
@@ -592,42 +1409,56 @@ int uevent_listen(struct udev *udev)
 							      "disk");
 	if (err)
 		condlog(2, "failed to create filter : %s", strerror(-err));
+	for (i = 0; i < ARRAY_SIZE(transport_subsystems); i++) {
+		err = udev_monitor_filter_add_match_subsystem_devtype(
+			monitor, transport_subsystems[i], NULL);
+		if (err)
+			condlog(2, "failed to create %s filter : %s",
+				transport_subsystems[i], strerror(-err));
+	}
 	err = udev_monitor_enable_receiving(monitor);
 	if (err) {
 		condlog(2, "failed to enable receiving : %s", strerror(-err));
 		goto out;
 	}
 
-	events = 0;
-	gettimeofday(&start_time, NULL);
+	uevent_burst_init(&burst);
 	while (1) {
 		struct uevent *uev;
 		struct udev_device *dev;
 		struct pollfd ev_poll;
-		int poll_timeout;
 		int fdcount;
 
 		memset(&ev_poll, 0, sizeof(struct pollfd));
 		ev_poll.fd = fd;
 		ev_poll.events = POLLIN;
-		poll_timeout = timeout * 1000;
+		sample_thread_cpu(THREAD_UEVENT);
 		errno = 0;
-		fdcount = poll(&ev_poll, 1, poll_timeout);
-		if (fdcount > 0 && ev_poll.revents & POLLIN) {
-			timeout = uevent_burst(&start_time, events + 1) ? 1 : 0;
+		fdcount = poll(&ev_poll, 1, timeout);
+		/* An overrun is reported as POLLERR, and by recvmsg() */
+		if (fdcount > 0 && ev_poll.revents & (POLLIN | POLLERR)) {
+			errno = 0;
 			dev = udev_monitor_receive_device(monitor);
-			if (!dev) {
+			if (!dev && errno == ENOBUFS)
+				/* Forward the resync right away */
+				uevent_overrun(monitor, &uevlisten_tmp);
+			else if (!dev) {
 				condlog(0, "failed getting udev device");
 				continue;
+			} else {
+				uev = uevent_from_device(dev, NULL);
+				if (!uev)
+					continue;
+				TRACE3(uevent_received, uev->kernel,
+				       uev->action, uev->seqnum);
+				if (uatomic_read(&uev_record_file))
+					record_uevent(uev);
+				list_add_tail(&uev->node, &uevlisten_tmp);
+				timeout = uevent_burst(&burst, &uev->received);
+				if (timeout >= 0)
+					continue;
 			}
-			uev = uevent_from_udev_device(dev);
-			if (!uev)
-				continue;
-			list_add_tail(&uev->node, &uevlisten_tmp);
-			events++;
-			continue;
-		}
-		if (fdcount < 0) {
+		} else if (fdcount < 0) {
 			if (errno == EINTR)
 				continue;
 
@@ -636,19 +1467,17 @@ int uevent_listen(struct udev *udev)
 			err = -errno;
 			break;
 		}
+		timeout = UEV_IDLE_TIMEOUT_MS;
 		if (!list_empty(&uevlisten_tmp)) {
-			/*
-			 * Queue uevents and poke service pthread.
-			 */
-			condlog(3, "Forwarding %d uevents", events);
-			pthread_mutex_lock(uevq_lockp);
-			list_splice_tail_init(&uevlisten_tmp, &uevq);
-			pthread_cond_signal(uev_condp);
-			pthread_mutex_unlock(uevq_lockp);
-			events = 0;
+			condlog(3, "Forwarding %u uevents", burst.events);
+			pthread_mutex_lock(&uev_stats_lock);
+			uev_stats.last_batch = burst.events;
+			uev_stats.last_window = burst.window;
+			pthread_mutex_unlock(&uev_stats_lock);
+			if (forward_uevents(&uevlisten_tmp))
+				timeout = UEV_RETRY_TIMEOUT_MS;
 		}
-		gettimeofday(&start_time, NULL);
-		timeout = 30;
+		uevent_burst_init(&burst);
 	}
 out:
 	pthread_cleanup_pop(1);
@@ -666,6 +1495,19 @@ char *uevent_get_dm_str(const struct uevent *uev, char *attr)
 	return strdup(tmp);
 }
 
+bool uevent_is_transport(const struct uevent *uev)
+{
+	const char *subsys = uevent_get_env_var(uev, "SUBSYSTEM");
+	unsigned int i;
+
+	if (!subsys)
+		return false;
+	for (i = 0; i < ARRAY_SIZE(transport_subsystems); i++)
+		if (!strcmp(subsys, transport_subsystems[i]))
+			return true;
+	return false;
+}
+
 bool uevent_is_mpath(const struct uevent *uev)
 {
 	const char *uuid = uevent_get_env_var(uev, "DM_UUID");
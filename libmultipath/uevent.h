@@ -1,6 +1,9 @@
 #ifndef _UEVENT_H
 #define _UEVENT_H
 
+#include <stdbool.h>
+#include <time.h>
+
 /*
  * buffer for environment variables, the kernel's size in
  * lib/kobject_uevent.c should fit in
@@ -14,36 +17,139 @@ struct udev;
 struct uevent {
 	struct list_head node;
 	struct list_head merge_node;
+	/*
+	 * For uevents from libudev, the strings are owned by udev, and
+	 * envp is empty. All lookups use the properties of udev.
+	 */
 	struct udev_device *udev;
-	char buffer[HOTPLUG_BUFFER_SIZE + OBJECT_SIZE];
-	char *devpath;
-	char *action;
-	char *kernel;
+	/* storage for the strings in envp, allocated along with the uevent */
+	char *buffer;
+	const char *devpath;
+	const char *action;
+	const char *kernel;
 	const char *wwid;
+	/* wwid_hash() of wwid, set along with it */
+	unsigned int wwid_hash;
+	/* MAJOR and MINOR, only set for uevents from libudev */
+	int major;
+	int minor;
 	unsigned long seqnum;
-	char *envp[HOTPLUG_NUM_ENVP];
+	/* CLOCK_MONOTONIC time at which uevent_listen() received it */
+	struct timespec received;
+	/* set if the uevent came from the uevent pool */
+	bool pooled;
+	/* NULL-terminated */
+	char *envp[];
+};
+
+/*
+ * Buckets of the uevent lag histogram. Bucket i counts uevents handled
+ * less than 2^i us after they were received, the last one all others.
+ */
+#define UEV_LAG_BUCKETS 25
+
+/* Counters for "show daemon" */
+struct uevent_stats {
+	unsigned long batches;
+	unsigned long events;
+	unsigned long merged;
+	unsigned long filtered;
+	/* uevents in the last batch, and the last wait for more, in ms */
+	unsigned int last_batch;
+	unsigned int last_window;
+	/* average processing time per uevent */
+	unsigned long cost_us;
+	/* uevents waiting for the dispatcher */
+	unsigned int queued;
+	/* maximum of queued since startup */
+	unsigned int max_queued;
+	/* uevents dropped by uevent_can_discard() */
+	unsigned long discarded;
+	/* time from receipt until the uevent trigger returned */
+	unsigned long lag_sum_us;
+	unsigned long lag_max_us;
+	unsigned long lag_buckets[UEV_LAG_BUCKETS];
+	/* receive buffer overruns, and the resyncs queued for them */
+	unsigned long overruns;
+	unsigned long resyncs;
+	/* receive buffer size of the udev monitor, 0 if unknown */
+	unsigned int rcvbuf;
 };
 
+/*
+ * Allocates a uevent with room for HOTPLUG_NUM_ENVP variables and
+ * HOTPLUG_BUFFER_SIZE + OBJECT_SIZE bytes in buffer
+ */
 struct uevent *alloc_uevent(void);
+/* Releases uev and its udev device */
+void free_uevent(struct uevent *uev);
+/* Frees the uevents cached in the uevent pool */
+void cleanup_uevent_pool(void);
+void uevent_get_stats(struct uevent_stats *st);
+
+/*
+ * Recording of the uevents received by uevent_listen(), for replaying
+ * them with tests/replay-test. The file starts with UEVENT_RECORD_HEADER,
+ * followed by one record per uevent: a line
+ * "UEVENT <seconds>.<nanoseconds> <seqnum>" with the CLOCK_MONOTONIC
+ * time of receipt, one "KEY=VALUE" line per udev property, and an empty
+ * line.
+ * uevent_record_start() creates path, which must not exist, and returns
+ * 0 or a negative error code. uevent_record_stop() returns the number
+ * of recorded uevents, or -1 if there was no recording.
+ */
+#define UEVENT_RECORD_HEADER "# multipathd uevent record 1"
+int uevent_record_start(const char *path);
+long uevent_record_stop(void);
 int is_uevent_busy(void);
 
 int uevent_listen(struct udev *udev);
+/*
+ * If the receive buffer of the udev monitor overflows, uevent_listen()
+ * grows it and queues a resync uevent, for which uevent_is_resync() is
+ * true. Its trigger should compare the block devices with its state,
+ * because any uevent may have been lost. Uevents for the differences can
+ * be made with uevent_from_device(), which takes over the reference to
+ * dev. If action is NULL, it's taken from the properties of dev.
+ * The uevent sequence numbers can't tell about lost uevents, as the
+ * monitor only gets some subsystems, and udev reorders uevents.
+ */
+bool uevent_is_resync(const struct uevent *uev);
+struct uevent *uevent_from_device(struct udev_device *dev, const char *action);
 int uevent_dispatch(int (*store_uev)(struct uevent *, void * trigger_data),
 		    void * trigger_data);
 bool uevent_is_mpath(const struct uevent *uev);
+/*
+ * True for uevents of FC remote ports and iSCSI sessions. The paths
+ * behind them are those whose devpath starts with the devpath of the
+ * device the transport object belongs to.
+ */
+bool uevent_is_transport(const struct uevent *uev);
 void uevent_get_wwid(struct uevent *uev);
+/*
+ * Hash of the device name, WWID and the other properties of a path
+ * uevent that multipathd acts on, for detecting change uevents that
+ * repeat the previous one. uid_attribute is the property the path
+ * gets its WWID from. Returns 0 for uevents that report changes which
+ * don't show in the properties, like capacity changes, and if the WWID
+ * isn't in the properties, because it's read from sysfs or VPD.
+ */
+unsigned long long uevent_path_digest(const struct uevent *uev,
+				      const char *uid_attribute);
 
 int uevent_get_env_positive_int(const struct uevent *uev,
 				const char *attr);
 
 static inline int uevent_get_major(const struct uevent *uev)
 {
-	return uevent_get_env_positive_int(uev, "MAJOR");
+	return uev->udev ? uev->major :
+		uevent_get_env_positive_int(uev, "MAJOR");
 }
 
 static inline int uevent_get_minor(const struct uevent *uev)
 {
-	return uevent_get_env_positive_int(uev, "MINOR");
+	return uev->udev ? uev->minor :
+		uevent_get_env_positive_int(uev, "MINOR");
 }
 
 static inline int uevent_get_disk_ro(const struct uevent *uev)
@@ -165,6 +165,35 @@ size_t strlcat(char * restrict dst, const char * restrict src, size_t size)
 	return bytes;
 }
 
+/*
+ * Return a newly allocated literal string that every string matching the
+ * extended regular expression re must contain, or NULL if there's none.
+ * If *anchored is set on return, matching strings start with the literal.
+ * This is used for skipping regexec() calls that can't match.
+ */
+char *get_regex_literal(const char *re, bool *anchored)
+{
+	size_t len;
+
+	*anchored = false;
+	/* With alternatives, there's no single literal */
+	if (!re || strchr(re, '|'))
+		return NULL;
+	if (*re == '^') {
+		*anchored = true;
+		re++;
+	}
+	len = strcspn(re, "\\^$.[]()*+?{}");
+	/* The last character may be optional */
+	if (len > 0 && re[len] && strchr("*?{", re[len]))
+		len--;
+	if (len == 0) {
+		*anchored = false;
+		return NULL;
+	}
+	return strndup(re, len);
+}
+
 int devt2devname(char *devname, int devname_len, const char *devt)
 {
 	struct udev_device *u_dev;
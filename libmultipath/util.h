@@ -17,6 +17,7 @@ char *get_next_string(char **temp, const char *split_char);
 int get_word (const char * sentence, char ** word);
 size_t strlcpy(char * restrict dst, const char * restrict src, size_t size);
 size_t strlcat(char * restrict dst, const char * restrict src, size_t size);
+char *get_regex_literal(const char *re, bool *anchored);
 int devt2devname (char *, int, const char *);
 dev_t parse_devt(const char *dev_t);
 char *convert_dev(char *dev, int is_path_device);
@@ -29,6 +30,29 @@ int safe_write(int fd, const void *buf, size_t count);
 void set_max_fds(rlim_t max_fds);
 int should_exit(void);
 
+/*
+ * Check whether str may match a regex, given the literal obtained from
+ * get_regex_literal() for it.
+ */
+static inline bool regex_literal_match(const char *literal, bool anchored,
+				       const char *str)
+{
+	if (!literal)
+		return true;
+	return anchored ? !strncmp(str, literal, strlen(literal)) :
+		strstr(str, literal) != NULL;
+}
+
+/* FNV-1a */
+static inline unsigned int hash_str(const char *str)
+{
+	unsigned int h = 2166136261U;
+
+	while (*str)
+		h = (h ^ (unsigned char)*str++) * 16777619U;
+	return h;
+}
+
 #define KERNEL_VERSION(maj, min, ptc) ((((maj) * 256) + (min)) * 256 + (ptc))
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
 
@@ -6,6 +6,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <fcntl.h>
@@ -30,9 +31,10 @@
  * and debug-able malloc.
  * When limit == 0, it means no limit on data size, used for socket client
  * to receiving data from multipathd.
+ * If plen is not NULL, the received length is stored in it.
  */
 static int _recv_packet(int fd, char **buf, unsigned int timeout,
-			ssize_t limit);
+			ssize_t limit, ssize_t *plen);
 
 /*
  * create a unix domain socket and start listening on it
@@ -97,7 +99,50 @@ int send_packet(int fd, const char *buf)
 	return 0;
 }
 
-static int _recv_packet(int fd, char **buf, unsigned int timeout, ssize_t limit)
+static int send_all(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -errno;
+		}
+		if (!n)
+			return -EIO;
+		buf = n + (const char *)buf;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * send a packet with binary data in length prefix format
+ */
+int send_packet_len(int fd, const char *buf, size_t len)
+{
+	int r;
+
+	if ((r = send_all(fd, &len, sizeof(len))) != 0)
+		return r;
+	return send_all(fd, buf, len);
+}
+
+/*
+ * start a chunked reply, see MPATH_REPLY_CHUNKED in mpath_cmd.h.
+ * The chunks are sent with send_packet(), send_packet(fd, NULL) ends it.
+ */
+int send_chunked_header(int fd)
+{
+	size_t len = MPATH_REPLY_CHUNKED;
+
+	return send_all(fd, &len, sizeof(len));
+}
+
+static int _recv_packet(int fd, char **buf, unsigned int timeout, ssize_t limit,
+			ssize_t *plen)
 {
 	int err = 0;
 	ssize_t len = 0;
@@ -119,6 +164,8 @@ static int _recv_packet(int fd, char **buf, unsigned int timeout, ssize_t limit)
 		(*buf) = NULL;
 		return -errno;
 	}
+	if (plen)
+		*plen = len;
 	return err;
 }
 
@@ -127,10 +174,31 @@ static int _recv_packet(int fd, char **buf, unsigned int timeout, ssize_t limit)
  */
 int recv_packet(int fd, char **buf, unsigned int timeout)
 {
-	return _recv_packet(fd, buf, timeout, 0 /* no limit */);
+	return _recv_packet(fd, buf, timeout, 0 /* no limit */, NULL);
 }
 
 int recv_packet_from_client(int fd, char **buf, unsigned int timeout)
 {
-	return _recv_packet(fd, buf, timeout, _MAX_CMD_LEN);
+	return _recv_packet(fd, buf, timeout, _MAX_CMD_LEN, NULL);
+}
+
+int recv_cmd_from_client(int fd, char **buf, size_t *buflen, bool *chunked,
+			 unsigned int timeout)
+{
+	ssize_t len = 0;
+	size_t cmdlen;
+	int err;
+
+	*chunked = false;
+	*buflen = 0;
+	err = _recv_packet(fd, buf, timeout, _MAX_CMD_LEN, &len);
+	if (err != 0 || !*buf)
+		return err;
+	*buflen = len;
+	/* mpath_recv_reply_data() has NUL-terminated the buffer */
+	cmdlen = strlen(*buf) + 1;
+	if ((size_t)len == cmdlen + sizeof(MPATH_CMD_CHUNKED_TAG) &&
+	    !strcmp(*buf + cmdlen, MPATH_CMD_CHUNKED_TAG))
+		*chunked = true;
+	return 0;
 }
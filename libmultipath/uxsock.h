@@ -1,6 +1,11 @@
+#include <stdbool.h>
+#include <stddef.h>
+
 /* some prototypes */
 int ux_socket_listen(const char *name);
 int send_packet(int fd, const char *buf);
+int send_packet_len(int fd, const char *buf, size_t len);
+int send_chunked_header(int fd);
 int recv_packet(int fd, char **buf, unsigned int timeout);
 
 #define _MAX_CMD_LEN		512
@@ -11,3 +16,10 @@ int recv_packet(int fd, char **buf, unsigned int timeout);
  * Return -EINVAL if data length requested by client exceeded the _MAX_CMD_LEN.
  */
 int recv_packet_from_client(int fd, char **buf, unsigned int timeout);
+/*
+ * Same as recv_packet_from_client(), and set *buflen to the packet
+ * length and *chunked if the client accepts chunked replies
+ * (see mpath_send_cmd_chunked()).
+ */
+int recv_cmd_from_client(int fd, char **buf, size_t *buflen, bool *chunked,
+			 unsigned int timeout);
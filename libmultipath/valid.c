@@ -15,7 +15,16 @@
   along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include <stddef.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <libudev.h>
 
 #include "vector.h"
@@ -28,17 +37,45 @@
 #include "sysfs.h"
 #include "blacklist.h"
 #include "mpath_cmd.h"
+#include "file.h"
+#include "version.h"
 #include "valid.h"
 
+/*
+ * "multipath -u" may be run before the daemon is started. In this
+ * case, systemd might own the socket but might delay multipathd
+ * startup until some other unit (udev settle!)  has finished
+ * starting. With many LUNs, the listen backlog may be exceeded, which
+ * would cause connect() to block. This causes udev workers calling
+ * "multipath -u" to hang, and thus creates a deadlock, until "udev
+ * settle" times out.  To avoid this, call connect() in non-blocking
+ * mode here, and take EAGAIN as indication for a filled-up systemd
+ * backlog.
+ */
+static bool multipathd_available(const char *name)
+{
+	int fd;
+
+	fd = __mpath_connect(1);
+	if (fd < 0) {
+		if (errno != EAGAIN && !systemd_service_enabled(name)) {
+			condlog(3, "multipathd not running or enabled");
+			return false;
+		}
+	} else
+		mpath_disconnect(fd);
+	return true;
+}
+
 int
 is_path_valid(const char *name, struct config *conf, struct path *pp,
 	      bool check_multipathd)
 {
 	int r;
-	int fd;
 
 	if (!pp || !name || !conf)
 		return PATH_IS_ERROR;
+	pp->valid_cacheable = false;
 
 	if (conf->find_multipaths <= FIND_MULTIPATHS_UNDEF ||
 	    conf->find_multipaths >= __FIND_MULTIPATHS_LAST)
@@ -53,37 +90,18 @@ is_path_valid(const char *name, struct config *conf, struct path *pp,
 		return PATH_IS_VALID_NO_CHECK;
 	}
 
-	/*
-	 * "multipath -u" may be run before the daemon is started. In this
-	 * case, systemd might own the socket but might delay multipathd
-	 * startup until some other unit (udev settle!)  has finished
-	 * starting. With many LUNs, the listen backlog may be exceeded, which
-	 * would cause connect() to block. This causes udev workers calling
-	 * "multipath -u" to hang, and thus creates a deadlock, until "udev
-	 * settle" times out.  To avoid this, call connect() in non-blocking
-	 * mode here, and take EAGAIN as indication for a filled-up systemd
-	 * backlog.
-	 */
-
-	if (check_multipathd) {
-		fd = __mpath_connect(1);
-		if (fd < 0) {
-			if (errno != EAGAIN && !systemd_service_enabled(name)) {
-				condlog(3, "multipathd not running or enabled");
-				return PATH_IS_NOT_VALID;
-			}
-		} else
-			mpath_disconnect(fd);
-	}
+	if (check_multipathd && !multipathd_available(name))
+		return PATH_IS_NOT_VALID;
 
 	pp->udev = udev_device_new_from_subsystem_sysname(udev, "block", name);
 	if (!pp->udev)
 		return PATH_IS_ERROR;
 
 	r = pathinfo(pp, conf, DI_SYSFS | DI_WWID | DI_BLACKLIST);
-	if (r == PATHINFO_SKIPPED)
+	if (r == PATHINFO_SKIPPED) {
+		pp->valid_cacheable = true;
 		return PATH_IS_NOT_VALID;
-	else if (r)
+	} else if (r)
 		return PATH_IS_ERROR;
 
 	if (pp->wwid[0] == '\0')
@@ -99,8 +117,10 @@ is_path_valid(const char *name, struct config *conf, struct path *pp,
 	if (conf->find_multipaths == FIND_MULTIPATHS_GREEDY)
 		return PATH_IS_VALID;
 
-	if (check_wwids_file(pp->wwid, 0) == 0)
+	if (check_wwids_file(pp->wwid, 0) == 0) {
+		pp->valid_cacheable = true;
 		return PATH_IS_VALID_NO_CHECK;
+	}
 
 	if (dm_map_present_by_uuid(pp->wwid) == 1)
 		return PATH_IS_VALID;
@@ -112,3 +132,264 @@ is_path_valid(const char *name, struct config *conf, struct path *pp,
 
 	return PATH_IS_MAYBE_VALID;
 }
+
+/*
+ * Cache entries are stored in one file per device number. An entry is
+ * only used for the same device (same udev initialization time), the
+ * same WWID, and the same find_multipaths override, and only if the
+ * configuration files (and for wwids file decisions, the wwids file)
+ * haven't changed since it was written. The files are compared by
+ * identity, size and mtime, like the wwids file index does.
+ */
+#define VALID_CACHE_MAGIC "MPVALID1"
+
+struct valid_cache_entry {
+	unsigned long long usec;
+	int find_multipaths;
+	int result;
+	uint64_t conf_stamp;
+	uint64_t wwids_stamp;
+	char dev[FILE_NAME_SIZE];
+	char uid_attribute[LINE_MAX];
+	char wwid[WWID_SIZE];
+	char config_dir[PATH_MAX];
+	char wwids_file[PATH_MAX];
+};
+
+#define STAMP_INIT 0xcbf29ce484222325ULL
+#define STAMP_PRIME 0x100000001b3ULL
+
+static uint64_t stamp_add(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--)
+		h = (h ^ *p++) * STAMP_PRIME;
+	return h;
+}
+
+static uint64_t stamp_file(uint64_t h, const char *file)
+{
+	struct stat st;
+	uint64_t v[5] = { 0 };
+
+	if (stat(file, &st) == 0) {
+		v[0] = st.st_dev;
+		v[1] = st.st_ino;
+		v[2] = st.st_size;
+		v[3] = st.st_mtim.tv_sec;
+		v[4] = st.st_mtim.tv_nsec;
+	}
+	return stamp_add(h, v, sizeof(v));
+}
+
+/* Covers the files read by init_config(), see process_config_dir() */
+static uint64_t config_stamp(const char *config_dir)
+{
+	uint64_t h = STAMP_INIT;
+	unsigned int version = VERSION_CODE;
+	struct dirent **namelist;
+	struct scandir_result sr;
+	char path[LINE_MAX];
+	int i, n;
+
+	h = stamp_add(h, &version, sizeof(version));
+	h = stamp_file(h, DEFAULT_CONFIGFILE);
+	if (config_dir[0] != '/')
+		return h;
+	h = stamp_file(h, config_dir);
+	n = scandir(config_dir, &namelist, NULL, alphasort);
+	if (n <= 0)
+		return h;
+	for (i = 0; i < n; i++) {
+		char *ext = strrchr(namelist[i]->d_name, '.');
+
+		if (!ext || strcmp(ext, ".conf"))
+			continue;
+		h = stamp_add(h, namelist[i]->d_name,
+			      strlen(namelist[i]->d_name));
+		if (safe_sprintf(path, "%s/%s", config_dir,
+				 namelist[i]->d_name) == 0)
+			h = stamp_file(h, path);
+	}
+	sr.di = namelist;
+	sr.n = n;
+	free_scandir_result(&sr);
+	return h;
+}
+
+/* Compare wwid with the udev attribute it was taken from, see get_uid() */
+static bool uid_matches(struct udev_device *ud, const char *uid_attribute,
+			const char *wwid)
+{
+	const char *value;
+	size_t len;
+
+	if (!*uid_attribute)
+		return false;
+	value = udev_device_get_property_value(ud, uid_attribute);
+	if (!value || !*value)
+		value = getenv(uid_attribute);
+	if (!value)
+		return false;
+	for (len = strlen(value); len > 0 && value[len - 1] == ' '; len--)
+		;
+	return len < WWID_SIZE && len == strlen(wwid) &&
+		!strncmp(value, wwid, len);
+}
+
+static int valid_cache_file(char *buf, size_t len, struct udev_device *ud,
+			    unsigned long long *usec)
+{
+	dev_t devt = udev_device_get_devnum(ud);
+
+	/* udev hasn't stored this device in its database yet */
+	*usec = udev_device_get_usec_since_initialized(ud);
+	if (*usec == 0 || (major(devt) == 0 && minor(devt) == 0))
+		return -1;
+	return safe_snprintf(buf, len, DEFAULT_VALID_CACHE_DIR "/%u:%u",
+			     major(devt), minor(devt));
+}
+
+static int read_line(FILE *f, char *buf, size_t len)
+{
+	size_t n;
+
+	if (!fgets(buf, len, f))
+		return -1;
+	n = strlen(buf);
+	if (n == 0 || buf[n - 1] != '\n')
+		return -1;
+	buf[n - 1] = '\0';
+	return 0;
+}
+
+static int read_valid_cache(const char *file, struct valid_cache_entry *e)
+{
+	char line[LINE_MAX];
+	FILE *f;
+	int r = -1;
+
+	f = fopen(file, "r");
+	if (!f)
+		return -1;
+	if (read_line(f, line, sizeof(line)) ||
+	    strcmp(line, VALID_CACHE_MAGIC) ||
+	    read_line(f, line, sizeof(line)) ||
+	    sscanf(line, "%llu %d %d %" SCNx64 " %" SCNx64, &e->usec,
+		   &e->find_multipaths, &e->result, &e->conf_stamp,
+		   &e->wwids_stamp) != 5 ||
+	    read_line(f, e->dev, sizeof(e->dev)) ||
+	    read_line(f, e->uid_attribute, sizeof(e->uid_attribute)) ||
+	    read_line(f, e->wwid, sizeof(e->wwid)) ||
+	    read_line(f, e->config_dir, sizeof(e->config_dir)) ||
+	    read_line(f, e->wwids_file, sizeof(e->wwids_file)))
+		goto out;
+	r = 0;
+out:
+	fclose(f);
+	return r;
+}
+
+int lookup_path_valid(const char *name, int find_multipaths,
+		      bool check_multipathd, char *wwid)
+{
+	struct valid_cache_entry e;
+	struct udev_device *ud;
+	unsigned long long usec;
+	char file[PATH_MAX];
+	int r = PATH_IS_ERROR;
+
+	if (!name || !udev)
+		return PATH_IS_ERROR;
+	ud = udev_device_new_from_subsystem_sysname(udev, "block", name);
+	if (!ud)
+		return PATH_IS_ERROR;
+
+	if (valid_cache_file(file, sizeof(file), ud, &usec) ||
+	    read_valid_cache(file, &e) ||
+	    e.usec != usec || strcmp(e.dev, name) ||
+	    e.find_multipaths != find_multipaths)
+		goto out;
+	if ((e.result != PATH_IS_NOT_VALID || *e.wwid) &&
+	    !uid_matches(ud, e.uid_attribute, e.wwid))
+		goto out;
+	if (e.conf_stamp != config_stamp(e.config_dir))
+		goto out;
+	if (e.result == PATH_IS_VALID_NO_CHECK) {
+		if (e.wwids_stamp != stamp_file(STAMP_INIT, e.wwids_file) ||
+		    is_failed_wwid(e.wwid) != WWID_IS_NOT_FAILED)
+			goto out;
+	} else if (e.result != PATH_IS_NOT_VALID)
+		goto out;
+
+	if (check_multipathd && !multipathd_available(name))
+		r = PATH_IS_NOT_VALID;
+	else
+		r = e.result;
+	if (wwid)
+		strlcpy(wwid, e.wwid, WWID_SIZE);
+	condlog(3, "%s: using cached validity %d", name, r);
+out:
+	udev_device_unref(ud);
+	return r;
+}
+
+void cache_path_valid(const struct path *pp, const struct config *conf,
+		      int find_multipaths, int result)
+{
+	struct valid_cache_entry e = { .find_multipaths = find_multipaths };
+	char file[PATH_MAX], tmp[PATH_MAX];
+	int fd;
+	FILE *f;
+
+	if (!pp || !conf || !pp->valid_cacheable || !pp->udev)
+		return;
+	if (result != PATH_IS_NOT_VALID && result != PATH_IS_VALID_NO_CHECK)
+		return;
+	/* the WWID must be cheap to check, i.e. come from udev */
+	if ((result != PATH_IS_NOT_VALID || *pp->wwid) &&
+	    (pp->getuid || !pp->uid_attribute ||
+	     !uid_matches(pp->udev, pp->uid_attribute, pp->wwid)))
+		return;
+	if (valid_cache_file(file, sizeof(file), pp->udev, &e.usec) ||
+	    safe_sprintf(tmp, "%s.XXXXXX", file))
+		return;
+
+	e.result = result;
+	if (strlcpy(e.dev, pp->dev, sizeof(e.dev)) >= sizeof(e.dev) ||
+	    strlcpy(e.uid_attribute, pp->uid_attribute ? : "",
+		    sizeof(e.uid_attribute)) >= sizeof(e.uid_attribute) ||
+	    strlcpy(e.config_dir, conf->config_dir ? : "",
+		    sizeof(e.config_dir)) >= sizeof(e.config_dir) ||
+	    strlcpy(e.wwids_file, conf->wwids_file ? : "",
+		    sizeof(e.wwids_file)) >= sizeof(e.wwids_file))
+		return;
+	strlcpy(e.wwid, pp->wwid, sizeof(e.wwid));
+	e.conf_stamp = config_stamp(e.config_dir);
+	e.wwids_stamp = stamp_file(STAMP_INIT, e.wwids_file);
+
+	if (ensure_directories_exist(file, 0700))
+		return;
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		condlog(3, "%s: failed to create %s: %m", pp->dev, tmp);
+		return;
+	}
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		goto fail;
+	}
+	fprintf(f, VALID_CACHE_MAGIC "\n%llu %d %d %" PRIx64 " %" PRIx64
+		"\n%s\n%s\n%s\n%s\n%s\n", e.usec, e.find_multipaths,
+		e.result, e.conf_stamp, e.wwids_stamp, e.dev,
+		e.uid_attribute, e.wwid, e.config_dir, e.wwids_file);
+	if (fclose(f) != 0 || rename(tmp, file) != 0)
+		goto fail;
+	condlog(4, "%s: cached validity %d", pp->dev, result);
+	return;
+fail:
+	condlog(3, "%s: failed to write %s: %m", pp->dev, file);
+	unlink(tmp);
+}
@@ -39,4 +39,27 @@ enum is_path_valid_result {
 int is_path_valid(const char *name, struct config *conf, struct path *pp,
 		  bool check_multipathd);
 
+/*
+ * Cache of is_path_valid() results in DEFAULT_VALID_CACHE_DIR, for
+ * repeated udev events for the same device. Only decisions which depend
+ * on nothing but the device, the configuration and the wwids file are
+ * cached, i.e. blacklisting and wwids file lookups.
+ *
+ * find_multipaths is the value the caller overrides the configured
+ * find_multipaths setting with, or FIND_MULTIPATHS_UNDEF.
+ */
+
+/*
+ * lookup_path_valid(): get the cached result for a device
+ * Doesn't need the configuration. If check_multipathd is set, checks
+ * multipathd like is_path_valid() does. On success, copies the path's
+ * WWID to wwid (of size WWID_SIZE) if it isn't NULL.
+ * Returns PATH_IS_ERROR if there's no usable cache entry.
+ */
+int lookup_path_valid(const char *name, int find_multipaths,
+		      bool check_multipathd, char *wwid);
+/* Store the result of is_path_valid() for pp, if it can be cached */
+void cache_path_valid(const struct path *pp, const struct config *conf,
+		      int find_multipaths, int result);
+
 #endif /* _VALID_D */
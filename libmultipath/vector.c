@@ -21,8 +21,16 @@
 
 #include "memory.h"
 #include <stdlib.h>
+#include <urcu/uatomic.h>
 #include "vector.h"
 
+static unsigned long vector_gen;
+
+static void vector_changed(vector v)
+{
+	v->gen = uatomic_add_return(&vector_gen, 1);
+}
+
 /*
  * Initialize vector struct.
  * allocated 'size' slot elements then return vector.
@@ -34,27 +42,64 @@ vector_alloc(void)
 	return v;
 }
 
+static bool
+vector_set_capacity(vector v, int capacity)
+{
+	void **new_slot;
+
+	if (capacity == 0) {
+		FREE(v->slot);
+		v->slot = NULL;
+		v->capacity = 0;
+		return true;
+	}
+	new_slot = REALLOC(v->slot, sizeof (void *) * capacity);
+	if (!new_slot)
+		return false;
+	v->slot = new_slot;
+	v->capacity = capacity;
+	return true;
+}
+
+/*
+ * Make room for at least n slots in total, so that the next
+ * n - VECTOR_SIZE(v) calls of vector_alloc_slot() don't allocate memory.
+ */
+bool
+vector_reserve(vector v, int n)
+{
+	if (!v || n < 0)
+		return false;
+	if (n <= v->capacity)
+		return true;
+	return vector_set_capacity(v, n);
+}
+
+/* Release the memory of unused slots */
+void
+vector_shrink_to_fit(vector v)
+{
+	if (!v || v->allocated == v->capacity)
+		return;
+	vector_set_capacity(v, v->allocated);
+}
+
 /* allocated one slot */
 bool
 vector_alloc_slot(vector v)
 {
-	void *new_slot = NULL;
-	int new_allocated;
-	int i;
-
 	if (!v)
 		return false;
 
-	new_allocated = v->allocated + VECTOR_DEFAULT_SIZE;
-	new_slot = REALLOC(v->slot, sizeof (void *) * new_allocated);
-	if (!new_slot)
+	/* grow geometrically, to avoid reallocating for every slot */
+	if (v->allocated == v->capacity &&
+	    !vector_set_capacity(v, v->capacity ? 2 * v->capacity :
+				 VECTOR_DEFAULT_SIZE))
 		return false;
 
-	v->slot = new_slot;
-	for (i = v->allocated; i < new_allocated; i++)
-		v->slot[i] = NULL;
-
-	v->allocated = new_allocated;
+	v->slot[v->allocated] = NULL;
+	v->allocated += VECTOR_DEFAULT_SIZE;
+	vector_changed(v);
 	return true;
 }
 
@@ -71,6 +116,7 @@ vector_move_up(vector v, int src, int dest)
 	for (i = src - 1; i >= dest; i--)
 		v->slot[i + 1] = v->slot[i];
 	v->slot[dest] = value;
+	vector_changed(v);
 	return 0;
 }
 
@@ -86,6 +132,7 @@ vector_insert_slot(vector v, int slot, void *value)
 		v->slot[i + 1] = v->slot[i];
 
 	v->slot[slot] = value;
+	vector_changed(v);
 
 	return v->slot[slot];
 }
@@ -117,20 +164,13 @@ vector_del_slot(vector v, int slot)
 		v->slot[i-1] = v->slot[i];
 
 	v->allocated -= VECTOR_DEFAULT_SIZE;
+	vector_changed(v);
 
-	if (v->allocated <= 0) {
-		FREE(v->slot);
-		v->slot = NULL;
-		v->allocated = 0;
-	} else {
-		void *new_slot;
-
-		new_slot = REALLOC(v->slot, sizeof (void *) * v->allocated);
-		if (!new_slot)
-			v->allocated += VECTOR_DEFAULT_SIZE;
-		else
-			v->slot = new_slot;
-	}
+	/* Shrink only when mostly unused, failure is harmless */
+	if (v->allocated == 0)
+		vector_set_capacity(v, 0);
+	else if (v->allocated <= v->capacity / 4)
+		vector_set_capacity(v, v->capacity / 2);
 }
 
 void
@@ -156,7 +196,9 @@ vector_reset(vector v)
 		FREE(v->slot);
 
 	v->allocated = 0;
+	v->capacity = 0;
 	v->slot = NULL;
+	vector_changed(v);
 	return v;
 }
 
@@ -196,6 +238,7 @@ vector_set_slot(vector v, void *value)
 
 	i = VECTOR_SIZE(v) - 1;
 	v->slot[i] = value;
+	vector_changed(v);
 }
 
 int vector_find_or_add_slot(vector v, void *value)
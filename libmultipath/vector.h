@@ -27,8 +27,19 @@
 
 /* vector definition */
 struct _vector {
+	/* number of used slots */
 	int allocated;
 	void **slot;
+	/* number of slots that fit into slot[] */
+	int capacity;
+	/*
+	 * Set to a new value by the vector_*() functions that add, remove
+	 * or move slots, and unique across all vectors, so that caches of
+	 * the contents can tell if they are current. 0 if the vector has
+	 * never been changed that way. Code writing slot[] directly must
+	 * only reorder existing elements.
+	 */
+	unsigned long gen;
 };
 typedef struct _vector *vector;
 
@@ -76,6 +87,8 @@ typedef struct _vector *vector;
 /* Prototypes */
 extern vector vector_alloc(void);
 extern bool vector_alloc_slot(vector v);
+bool vector_reserve(vector v, int n);
+void vector_shrink_to_fit(vector v);
 vector vector_reset(vector v);
 extern void vector_free(vector v);
 #define vector_free_const(x) vector_free((vector)(long)(x))
@@ -0,0 +1,284 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "debug.h"
+#include "util.h"
+#include "file.h"
+#include "defaults.h"
+#include "structs.h"
+#include "config.h"
+#include "vpd_cache.h"
+
+#define VPD_CACHE_MAGIC		0x4d505643	/* "MPVC" */
+#define VPD_CACHE_VERSION	1
+/* Upper limit for the cache file of one device */
+#define VPD_CACHE_MAX_SIZE	(32 * 1024)
+#define VPD_CACHE_NAME_LEN	32
+
+static const char cache_dir[] = MULTIPATH_SHM_BASE "vpd_cache";
+
+/*
+ * A cache file consists of this header, followed by records of the
+ * cached pages, each consisting of a struct vpd_cache_rec and the page.
+ */
+struct vpd_cache_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t gen;
+};
+
+struct vpd_cache_rec {
+	uint8_t pg;
+	uint8_t pad;
+	uint16_t len;
+};
+
+/* Set in the generation if it's derived from the sysfs inode number */
+#define GEN_FROM_INODE (1ULL << 63)
+
+static bool vpd_cache_enabled(void)
+{
+	struct config *conf;
+	bool on;
+
+	conf = get_multipath_config();
+	on = conf->vpd_cache == YN_YES;
+	put_multipath_config(conf);
+	return on;
+}
+
+/*
+ * The kernel assigns a new diskseq to every disk it creates. Older
+ * kernels don't have it; use the inode number of the device's sysfs
+ * directory instead, which isn't reused while the directory exists, and
+ * contains a generation count on 64 bit systems.
+ */
+static int get_generation(dev_t devt, uint64_t *gen)
+{
+	char path[64], buf[32];
+	struct stat st;
+	ssize_t n;
+	int fd;
+
+	safe_sprintf(path, "/sys/dev/block/%u:%u/diskseq",
+		     major(devt), minor(devt));
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd >= 0) {
+		n = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (n > 0) {
+			char *end;
+
+			buf[n] = '\0';
+			*gen = strtoull(buf, &end, 10);
+			if (end != buf && *gen != 0 && !(*gen & GEN_FROM_INODE))
+				return 0;
+		}
+	}
+
+	safe_sprintf(path, "/sys/dev/block/%u:%u", major(devt), minor(devt));
+	if (stat(path, &st) != 0)
+		return -1;
+	*gen = GEN_FROM_INODE | st.st_ino;
+	return 0;
+}
+
+static int cache_key(int fd, dev_t *devt, uint64_t *gen)
+{
+	struct stat st;
+
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISBLK(st.st_mode))
+		return -1;
+	*devt = st.st_rdev;
+	return get_generation(*devt, gen);
+}
+
+static void cache_name(char *name, dev_t devt)
+{
+	snprintf(name, VPD_CACHE_NAME_LEN, "%u:%u", major(devt), minor(devt));
+}
+
+/*
+ * Read the cache file of devt into buf. Returns the file size, or -1 if
+ * there's no valid file for this generation of the device.
+ */
+static ssize_t read_cache_file(int dfd, dev_t devt, uint64_t gen,
+			       unsigned char *buf, size_t size)
+{
+	char name[VPD_CACHE_NAME_LEN];
+	const struct vpd_cache_hdr *hdr = (const struct vpd_cache_hdr *)buf;
+	ssize_t n;
+	int fd;
+
+	cache_name(name, devt);
+	fd = openat(dfd, name, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, size);
+	close(fd);
+	if (n < (ssize_t)sizeof(*hdr) || hdr->magic != VPD_CACHE_MAGIC ||
+	    hdr->version != VPD_CACHE_VERSION || hdr->gen != gen)
+		return -1;
+	return n;
+}
+
+/* Returns the offset of the record for pg in buf, or -1 */
+static ssize_t find_record(const unsigned char *buf, size_t len, int pg)
+{
+	const struct vpd_cache_rec *rec;
+	size_t off = sizeof(struct vpd_cache_hdr);
+
+	while (off + sizeof(*rec) <= len) {
+		rec = (const struct vpd_cache_rec *)(buf + off);
+		if (off + sizeof(*rec) + rec->len > len)
+			break;
+		if (rec->pg == pg)
+			return off;
+		off += sizeof(*rec) + rec->len;
+	}
+	return -1;
+}
+
+static int open_cache_dir(bool create)
+{
+	int dfd;
+
+	dfd = open(cache_dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (dfd == -1 && errno == ENOENT && create) {
+		char path[sizeof(cache_dir) + 2];
+
+		/* arg for ensure_directories_exist() must not end with "/" */
+		safe_sprintf(path, "%s/_", cache_dir);
+		ensure_directories_exist(path, 0700);
+		dfd = open(cache_dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	}
+	if (dfd == -1 && create)
+		condlog(3, "%s: can't setup %s: %m", __func__, cache_dir);
+	return dfd;
+}
+
+int vpd_cache_get(int fd, int pg, unsigned char *buff, int maxlen)
+{
+	unsigned char *buf;
+	const struct vpd_cache_rec *rec;
+	dev_t devt;
+	uint64_t gen;
+	ssize_t n, off;
+	int dfd, len = -1;
+
+	if (!vpd_cache_enabled() || cache_key(fd, &devt, &gen) != 0)
+		return -1;
+	dfd = open_cache_dir(false);
+	if (dfd == -1)
+		return -1;
+	buf = malloc(VPD_CACHE_MAX_SIZE);
+	if (!buf)
+		goto out;
+	n = read_cache_file(dfd, devt, gen, buf, VPD_CACHE_MAX_SIZE);
+	if (n < 0 || (off = find_record(buf, n, pg)) < 0)
+		goto out_free;
+	rec = (const struct vpd_cache_rec *)(buf + off);
+	if (rec->len > maxlen)
+		goto out_free;
+	len = rec->len;
+	memcpy(buff, buf + off + sizeof(*rec), len);
+	condlog(4, "%u:%u: vpd pg%02x from cache", major(devt), minor(devt),
+		pg);
+out_free:
+	free(buf);
+out:
+	close(dfd);
+	return len;
+}
+
+void vpd_cache_put(int fd, int pg, const unsigned char *buff, int len)
+{
+	char name[VPD_CACHE_NAME_LEN], tmp[VPD_CACHE_NAME_LEN + 2 * sizeof(long) + 1];
+	struct vpd_cache_hdr *hdr;
+	struct vpd_cache_rec *rec;
+	unsigned char *buf;
+	dev_t devt;
+	uint64_t gen;
+	ssize_t n, off;
+	int dfd, tfd;
+
+	if (len < 4 || len > UINT16_MAX || (size_t)len + sizeof(*hdr) +
+	    sizeof(*rec) > VPD_CACHE_MAX_SIZE)
+		return;
+	if (!vpd_cache_enabled() || cache_key(fd, &devt, &gen) != 0)
+		return;
+	dfd = open_cache_dir(true);
+	if (dfd == -1)
+		return;
+	buf = malloc(VPD_CACHE_MAX_SIZE);
+	if (!buf)
+		goto out;
+
+	n = read_cache_file(dfd, devt, gen, buf, VPD_CACHE_MAX_SIZE);
+	if (n >= 0 && (off = find_record(buf, n, pg)) >= 0) {
+		size_t rlen;
+
+		rec = (struct vpd_cache_rec *)(buf + off);
+		rlen = sizeof(*rec) + rec->len;
+		memmove(buf + off, buf + off + rlen, n - off - rlen);
+		n -= rlen;
+	}
+	if (n < 0 || n + sizeof(*rec) + len > VPD_CACHE_MAX_SIZE) {
+		hdr = (struct vpd_cache_hdr *)buf;
+		hdr->magic = VPD_CACHE_MAGIC;
+		hdr->version = VPD_CACHE_VERSION;
+		hdr->gen = gen;
+		n = sizeof(*hdr);
+	}
+	rec = (struct vpd_cache_rec *)(buf + n);
+	rec->pg = pg;
+	rec->pad = 0;
+	rec->len = len;
+	memcpy(buf + n + sizeof(*rec), buff, len);
+	n += sizeof(*rec) + len;
+
+	/* Write a temporary file and rename it, so that readers never
+	 * see a partially written file */
+	cache_name(name, devt);
+	safe_sprintf(tmp, "%s.%lx", name, (long)getpid());
+	tfd = openat(dfd, tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (tfd < 0)
+		goto out_free;
+	if (write(tfd, buf, n) != n) {
+		close(tfd);
+		unlinkat(dfd, tmp, 0);
+		goto out_free;
+	}
+	close(tfd);
+	if (renameat(dfd, tmp, dfd, name) != 0) {
+		condlog(3, "%s: failed to rename %s/%s: %m", __func__,
+			cache_dir, tmp);
+		unlinkat(dfd, tmp, 0);
+	}
+out_free:
+	free(buf);
+out:
+	close(dfd);
+}
+
+void vpd_cache_invalidate(dev_t devt)
+{
+	char path[sizeof(cache_dir) + VPD_CACHE_NAME_LEN + 1];
+	char name[VPD_CACHE_NAME_LEN];
+
+	cache_name(name, devt);
+	safe_sprintf(path, "%s/%s", cache_dir, name);
+	if (unlink(path) == 0)
+		condlog(4, "%s: dropped cached vpd data", name);
+}
@@ -0,0 +1,30 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _VPD_CACHE_H
+#define _VPD_CACHE_H
+
+#include <sys/types.h>
+
+/*
+ * Cache of SCSI VPD pages, stored in MULTIPATH_SHM_BASE "vpd_cache", so
+ * that it survives restarts of multipathd and is shared with multipath.
+ * Entries are keyed by the device number of the block device an fd
+ * refers to, and by a generation number of the device (its "diskseq"
+ * if the kernel provides one), so that a device which reuses the device
+ * number of a removed one is never served its predecessor's data.
+ *
+ * The cache is only used if "vpd_cache" is set in multipath.conf.
+ */
+
+/*
+ * Copy the cached page pg of the device fd refers to into buff.
+ * Returns the page length, or -1 if the page isn't cached or doesn't fit.
+ */
+int vpd_cache_get(int fd, int pg, unsigned char *buff, int maxlen);
+/* Store a complete VPD page, as returned by the device */
+void vpd_cache_put(int fd, int pg, const unsigned char *buff, int len);
+/* Drop all cached pages of a device */
+void vpd_cache_invalidate(dev_t devt);
+
+#endif /* _VPD_CACHE_H */
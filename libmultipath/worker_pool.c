@@ -0,0 +1,189 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <urcu.h>
+#include <urcu/uatomic.h>
+
+#include "debug.h"
+#include "util.h"
+#include "vector.h"
+#include "thread_settings.h"
+#include "worker_pool.h"
+
+#define WORKER_NAME_LEN 16
+
+struct worker_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	char name[WORKER_NAME_LEN];
+	int nthreads;
+	pthread_t *threads;
+	/* Below fields are protected by lock */
+	unsigned int generation;
+	int busy;
+	bool stop;
+	/* The current job */
+	const struct _vector *items;
+	worker_fn *fn;
+	void *arg;
+	/* Index of the next unprocessed item, accessed atomically */
+	int next;
+};
+
+static void process_items(struct worker_pool *pool)
+{
+	int n = VECTOR_SIZE(pool->items);
+	int i;
+
+	while ((i = uatomic_add_return(&pool->next, 1) - 1) < n)
+		pool->fn(VECTOR_SLOT(pool->items, i), pool->arg);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker_pool *pool = arg;
+	unsigned int seen;
+
+	rcu_register_thread();
+	pthread_mutex_lock(&pool->lock);
+	seen = pool->generation;
+	while (1) {
+		while (!pool->stop && pool->generation == seen)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->stop)
+			break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		process_items(pool);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	rcu_unregister_thread();
+	return NULL;
+}
+
+struct worker_pool *worker_pool_create(int nthreads, const char *name)
+{
+	struct worker_pool *pool;
+	pthread_attr_t attr;
+	int i;
+
+	if (nthreads <= 1)
+		return NULL;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	pool->threads = calloc(nthreads - 1, sizeof(*pool->threads));
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+	strlcpy(pool->name, name, sizeof(pool->name));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	setup_thread_attr_for(&attr, THREAD_WORKER, 0);
+	for (i = 0; i < nthreads - 1; i++) {
+		if (pthread_create(&pool->threads[i], &attr,
+				   worker_thread, pool) != 0) {
+			condlog(1, "%s: failed to start worker thread %d",
+				pool->name, i + 1);
+			break;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	/* The caller of worker_pool_run() is the remaining worker */
+	pool->nthreads = i + 1;
+	count_thread(THREAD_WORKER, i);
+
+	if (pool->nthreads == 1) {
+		worker_pool_destroy(pool);
+		return NULL;
+	}
+	condlog(3, "%s: started %d worker threads", pool->name,
+		pool->nthreads - 1);
+	return pool;
+}
+
+void worker_pool_destroy(struct worker_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nthreads - 1; i++)
+		pthread_join(pool->threads[i], NULL);
+	count_thread(THREAD_WORKER, 1 - pool->nthreads);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+void cleanup_worker_pool(void *arg)
+{
+	struct worker_pool **pool = arg;
+
+	worker_pool_destroy(*pool);
+	*pool = NULL;
+}
+
+int worker_pool_size(const struct worker_pool *pool)
+{
+	return pool ? pool->nthreads : 1;
+}
+
+void worker_pool_run(struct worker_pool *pool, const struct _vector *items,
+		     worker_fn *fn, void *arg)
+{
+	int oldstate, i;
+	void *item;
+
+	if (!pool || VECTOR_SIZE(items) <= 1) {
+		vector_foreach_slot(items, item, i)
+			fn(item, arg);
+		return;
+	}
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->items = items;
+	pool->fn = fn;
+	pool->arg = arg;
+	uatomic_set(&pool->next, 0);
+	pool->busy = pool->nthreads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	process_items(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pool->items = NULL;
+	pool->fn = NULL;
+	pool->arg = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	pthread_setcancelstate(oldstate, NULL);
+}
@@ -0,0 +1,64 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _WORKER_POOL_H
+#define _WORKER_POOL_H
+
+#include "vector.h"
+
+/*
+ * A small pool of helper threads for running the same function on all
+ * elements of a vector in parallel. The calling thread takes part in the
+ * work, so a pool of size N uses N-1 helper threads. worker_pool_run()
+ * returns only after every element has been processed, so callers can
+ * keep holding whatever locks protect the elements.
+ *
+ * Helper threads are registered with RCU, so the work function may call
+ * get_multipath_config().
+ */
+struct worker_pool;
+
+typedef void (worker_fn)(void *item, void *arg);
+
+/**
+ * worker_pool_create(): start a worker pool
+ * @param nthreads: total number of threads working on a job,
+ *                  including the caller of worker_pool_run()
+ * @param name: name for the helper threads (used in log messages)
+ *
+ * Returns NULL for nthreads <= 1, or if no helper thread could be started.
+ * A NULL pool is valid for worker_pool_run(), which will then process
+ * all elements in the calling thread.
+ */
+struct worker_pool *worker_pool_create(int nthreads, const char *name);
+
+/**
+ * worker_pool_destroy(): stop all helper threads and free the pool
+ * @param pool: worker pool, may be NULL
+ *
+ * Must not be called while worker_pool_run() is in progress.
+ */
+void worker_pool_destroy(struct worker_pool *pool);
+
+/* cleanup handler, takes a struct worker_pool ** */
+void cleanup_worker_pool(void *arg);
+
+/**
+ * worker_pool_size(): number of threads working on a job
+ * @param pool: worker pool, may be NULL
+ */
+int worker_pool_size(const struct worker_pool *pool);
+
+/**
+ * worker_pool_run(): call fn(item, arg) for every item in items
+ * @param pool: worker pool, may be NULL
+ * @param items: vector of work items
+ * @param fn: work function. Called concurrently for different items
+ * @param arg: passed to every invocation of fn
+ *
+ * Thread cancellation is disabled while the job is running.
+ */
+void worker_pool_run(struct worker_pool *pool, const struct _vector *items,
+		     worker_fn *fn, void *arg);
+
+#endif /* _WORKER_POOL_H */
@@ -4,9 +4,15 @@
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/file.h>
 
 #include "util.h"
 #include "checkers.h"
@@ -24,6 +30,12 @@
  * Copyright (c) 2010 Benjamin Marzinski, Redhat
  */
 
+/*
+ * The fcntl() lock taken by open_file() only excludes other processes.
+ * This serializes the threads of a process changing the wwids file.
+ */
+static pthread_mutex_t wwids_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int
 lookup_wwid(FILE *f, char *wwid) {
 	int c;
@@ -57,25 +69,18 @@ next:
 	return 0;
 }
 
+/* Append the wwid lines in buf to the wwids file */
 static int
-write_out_wwid(int fd, char *wwid) {
-	int ret;
+write_out_wwid_lines(int fd, const char *buf, size_t len) {
 	off_t offset;
-	char buf[WWID_SIZE + 3];
 
-	ret = snprintf(buf, WWID_SIZE + 3, "/%s/\n", wwid);
-	if (ret >= (WWID_SIZE + 3) || ret < 0){
-		condlog(0, "can't format wwid for writing (%d) : %s",
-			ret, strerror(errno));
-		return -1;
-	}
 	offset = lseek(fd, 0, SEEK_END);
 	if (offset < 0) {
 		condlog(0, "can't seek to the end of wwids file : %s",
 			strerror(errno));
 		return -1;
 	}
-	if (write(fd, buf, strlen(buf)) != (ssize_t)strlen(buf)) {
+	if (write(fd, buf, len) != (ssize_t)len) {
 		condlog(0, "cannot write wwid to wwids file : %s",
 			strerror(errno));
 		if (ftruncate(fd, offset))
@@ -86,8 +91,351 @@ write_out_wwid(int fd, char *wwid) {
 	return 1;
 }
 
-int
-replace_wwids(vector mp)
+static int
+write_out_wwid(int fd, char *wwid) {
+	int ret;
+	char buf[WWID_SIZE + 3];
+
+	ret = snprintf(buf, WWID_SIZE + 3, "/%s/\n", wwid);
+	if (ret >= (WWID_SIZE + 3) || ret < 0){
+		condlog(0, "can't format wwid for writing (%d) : %s",
+			ret, strerror(errno));
+		return -1;
+	}
+	return write_out_wwid_lines(fd, buf, ret);
+}
+
+/*
+ * Optional sorted index of the wwids file, so that lookups don't need to
+ * read the entire file. The index records the identity, size and mtime
+ * of the wwids file it was created for, and is ignored if they don't
+ * match, e.g. because the wwids file was edited. wwids appended by
+ * check_wwids_file() are not sorted into the index. Instead, the index
+ * header is updated, and the part of the wwids file after indexed_size
+ * is searched as text. The index is only written with the wwids file
+ * lock held.
+ */
+#define WWIDS_INDEX_SUFFIX ".index"
+#define WWIDS_INDEX_MAGIC "MPWWIDX1"
+/* Rebuild the index if the unindexed part gets larger than this */
+#define WWIDS_INDEX_MAX_TAIL (64 * 1024)
+
+struct wwids_index_hdr {
+	char magic[8];
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	/* all wwids before this offset in the wwids file are indexed */
+	uint64_t indexed_size;
+	/* number of string offsets following the header */
+	uint32_t nr;
+	uint32_t pad;
+};
+
+static void set_index_stat(struct wwids_index_hdr *hdr, const struct stat *st)
+{
+	hdr->dev = st->st_dev;
+	hdr->ino = st->st_ino;
+	hdr->size = st->st_size;
+	hdr->mtime_sec = st->st_mtim.tv_sec;
+	hdr->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+static bool index_matches(const struct wwids_index_hdr *hdr,
+			  const struct stat *st)
+{
+	return !memcmp(hdr->magic, WWIDS_INDEX_MAGIC, sizeof(hdr->magic)) &&
+		hdr->dev == (uint64_t)st->st_dev &&
+		hdr->ino == (uint64_t)st->st_ino &&
+		hdr->size == (uint64_t)st->st_size &&
+		hdr->mtime_sec == st->st_mtim.tv_sec &&
+		hdr->mtime_nsec == st->st_mtim.tv_nsec &&
+		hdr->indexed_size <= hdr->size;
+}
+
+static int wwids_index_name(char *buf, size_t len, const char *wwids_file)
+{
+	return safe_snprintf(buf, len, "%s" WWIDS_INDEX_SUFFIX, wwids_file);
+}
+
+/*
+ * Look up wwid using the index for the wwids file open as fd and f.
+ * On success, the index header is copied to hdr.
+ * Returns 1 if the wwid was found, 0 if not, and -1 if the index
+ * can't be used.
+ */
+static int
+lookup_wwid_index(const char *index_file, int fd, FILE *f, char *wwid,
+		  struct wwids_index_hdr *hdr)
+{
+	struct stat st, ist;
+	void *map;
+	const char *base;
+	const uint32_t *offs;
+	uint32_t start;
+	int ifd, lo, hi, ret = -1;
+
+	if (fstat(fd, &st) != 0)
+		return -1;
+	ifd = open(index_file, O_RDONLY|O_CLOEXEC);
+	if (ifd < 0)
+		return -1;
+	if (fstat(ifd, &ist) != 0 ||
+	    ist.st_size < (off_t)sizeof(*hdr) || ist.st_size > UINT32_MAX) {
+		close(ifd);
+		return -1;
+	}
+	map = mmap(NULL, ist.st_size, PROT_READ, MAP_SHARED, ifd, 0);
+	close(ifd);
+	if (map == MAP_FAILED)
+		return -1;
+	base = map;
+
+	memcpy(hdr, base, sizeof(*hdr));
+	if (!index_matches(hdr, &st) ||
+	    hdr->nr > (ist.st_size - sizeof(*hdr)) / sizeof(*offs) ||
+	    /* The last string must be terminated */
+	    (hdr->nr > 0 && base[ist.st_size - 1] != '\0'))
+		goto out;
+
+	offs = (const uint32_t *)(base + sizeof(*hdr));
+	start = sizeof(*hdr) + hdr->nr * sizeof(*offs);
+	lo = 0;
+	hi = (int)hdr->nr - 1;
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		int cmp;
+
+		if (offs[mid] < start || offs[mid] >= ist.st_size)
+			goto out;
+		cmp = strcmp(base + offs[mid], wwid);
+		if (cmp == 0) {
+			ret = 1;
+			goto out;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	if (hdr->indexed_size == hdr->size)
+		ret = 0;
+	else if (fseeko(f, hdr->indexed_size, SEEK_SET) == 0)
+		ret = lookup_wwid(f, wwid);
+out:
+	munmap(map, ist.st_size);
+	if (ret >= 0)
+		condlog(4, "%s: %s %sfound in wwids index", __func__, wwid,
+			ret ? "" : "not ");
+	return ret;
+}
+
+static int wwid_strcmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Read the wwids of the wwids file open as f into wwids, sorted and
+ * without duplicates. The strings are allocated.
+ */
+static int read_wwids(FILE *f, vector wwids)
+{
+	char *line = NULL, *wwid;
+	size_t line_len = 0;
+	int i, rc = -1;
+
+	rewind(f);
+	while (getline(&line, &line_len, f) >= 0) {
+		char *end;
+
+		if (line[0] != '/')
+			continue;
+		end = strchr(line + 1, '/');
+		/* lookup_wwid() doesn't match longer wwids */
+		if (!end || end == line + 1 || end - line - 1 > WWID_SIZE - 1)
+			continue;
+		*end = '\0';
+		if (!vector_alloc_slot(wwids))
+			goto out;
+		wwid = strdup(line + 1);
+		if (!wwid) {
+			vector_del_slot(wwids, VECTOR_SIZE(wwids) - 1);
+			goto out;
+		}
+		vector_set_slot(wwids, wwid);
+	}
+
+	qsort(wwids->slot, VECTOR_SIZE(wwids), sizeof(char *), wwid_strcmp);
+	for (i = VECTOR_SIZE(wwids) - 1; i > 0; i--) {
+		if (!strcmp(wwids->slot[i], wwids->slot[i - 1])) {
+			free(wwids->slot[i]);
+			vector_del_slot(wwids, i);
+		}
+	}
+	rc = 0;
+out:
+	free(line);
+	return rc;
+}
+
+static void free_wwids(vector wwids)
+{
+	char *wwid;
+	int i;
+
+	vector_foreach_slot(wwids, wwid, i)
+		free(wwid);
+	vector_reset(wwids);
+}
+
+/* wwids must be sorted and free of duplicates */
+static int write_wwids_index(int ifd, const struct _vector *wwids,
+			     const struct stat *st)
+{
+	struct wwids_index_hdr hdr = { .nr = 0, };
+	uint32_t *offs;
+	const char *wwid;
+	size_t offs_len, pos;
+	int i, rc = -1;
+
+	offs_len = VECTOR_SIZE(wwids) * sizeof(*offs);
+	offs = malloc(offs_len + 1);
+	if (!offs)
+		return -1;
+
+	pos = sizeof(hdr) + offs_len;
+	vector_foreach_slot(wwids, wwid, i) {
+		offs[i] = pos;
+		pos += strlen(wwid) + 1;
+		if (pos > UINT32_MAX)
+			goto out;
+	}
+
+	memcpy(hdr.magic, WWIDS_INDEX_MAGIC, sizeof(hdr.magic));
+	set_index_stat(&hdr, st);
+	hdr.indexed_size = st->st_size;
+	hdr.nr = VECTOR_SIZE(wwids);
+
+	if (write(ifd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write(ifd, offs, offs_len) != (ssize_t)offs_len)
+		goto out;
+	vector_foreach_slot(wwids, wwid, i) {
+		ssize_t len = strlen(wwid) + 1;
+
+		if (write(ifd, wwid, len) != len)
+			goto out;
+	}
+	rc = 0;
+out:
+	free(offs);
+	return rc;
+}
+
+/*
+ * (Re)create the index for the wwids file open as fd and f.
+ * Must be called with the wwids file lock held.
+ */
+static void
+build_wwids_index(const char *index_file, int fd, FILE *f)
+{
+	struct _vector _wwids = { .allocated = 0, };
+	vector wwids = &_wwids;
+	char tmpname[PATH_MAX];
+	struct stat st;
+	long ifd;
+	int rc = -1;
+
+	if (fstat(fd, &st) != 0 ||
+	    safe_sprintf(tmpname, "%s.XXXXXX", index_file))
+		return;
+
+	if (read_wwids(f, wwids) != 0)
+		goto out;
+
+	ifd = mkstemp(tmpname);
+	if (ifd == -1) {
+		condlog(3, "%s: mkstemp: %m", __func__);
+		goto out;
+	}
+	pthread_cleanup_push(close_fd, (void *)ifd);
+	rc = write_wwids_index(ifd, wwids, &st);
+	pthread_cleanup_pop(1);
+	if (rc == 0 && rename(tmpname, index_file) == 0)
+		condlog(3, "created wwids index %s with %d entries",
+			index_file, VECTOR_SIZE(wwids));
+	else {
+		condlog(2, "failed to create wwids index %s: %m", index_file);
+		unlink(tmpname);
+	}
+out:
+	free_wwids(wwids);
+}
+
+/*
+ * Read the header of the index of the wwids file open as fd.
+ * Returns 0 if the index matches the wwids file, and -1 otherwise.
+ */
+static int
+read_wwids_index_hdr(const char *index_file, int fd,
+		     struct wwids_index_hdr *hdr)
+{
+	struct stat st;
+	ssize_t len;
+	int ifd;
+
+	if (fstat(fd, &st) != 0)
+		return -1;
+	ifd = open(index_file, O_RDONLY|O_CLOEXEC);
+	if (ifd < 0)
+		return -1;
+	len = pread(ifd, hdr, sizeof(*hdr), 0);
+	close(ifd);
+	return len == sizeof(*hdr) && index_matches(hdr, &st) ? 0 : -1;
+}
+
+/*
+ * Update the index after appending to the wwids file. hdr is the index
+ * header that matched the wwids file before.
+ * Must be called with the wwids file lock held.
+ */
+static void
+update_wwids_index(const char *index_file, int fd, FILE *f,
+		   struct wwids_index_hdr *hdr)
+{
+	struct stat st;
+	int ifd;
+
+	if (fstat(fd, &st) != 0) {
+		unlink(index_file);
+		return;
+	}
+	if ((uint64_t)st.st_size - hdr->indexed_size > WWIDS_INDEX_MAX_TAIL) {
+		build_wwids_index(index_file, fd, f);
+		return;
+	}
+	set_index_stat(hdr, &st);
+	ifd = open(index_file, O_WRONLY|O_CLOEXEC);
+	if (ifd < 0 || pwrite(ifd, hdr, sizeof(*hdr), 0) != sizeof(*hdr)) {
+		condlog(2, "failed to update wwids index %s: %m", index_file);
+		unlink(index_file);
+	}
+	if (ifd >= 0)
+		close(ifd);
+}
+
+/* Called with the wwids file lock held, after modifying the wwids file */
+static void remove_wwids_index(const char *index_file)
+{
+	if (unlink(index_file) == 0)
+		condlog(3, "removed wwids index %s", index_file);
+}
+
+static int
+__replace_wwids(vector mp)
 {
 	int i, can_write;
 	long fd;
@@ -95,10 +443,13 @@ replace_wwids(vector mp)
 	size_t len;
 	int ret = -1;
 	struct config *conf;
+	char index_file[PATH_MAX];
 
 	conf = get_multipath_config();
 	pthread_cleanup_push(put_multipath_config, conf);
 	fd = open_file(conf->wwids_file, &can_write, WWIDS_FILE_HEADER);
+	if (wwids_index_name(index_file, sizeof(index_file), conf->wwids_file))
+		index_file[0] = '\0';
 	pthread_cleanup_pop(1);
 	if (fd < 0)
 		goto out;
@@ -108,6 +459,8 @@ replace_wwids(vector mp)
 		condlog(0, "cannot replace wwids. wwids file is read-only");
 		goto out_file;
 	}
+	if (*index_file)
+		remove_wwids_index(index_file);
 	if (ftruncate(fd, 0) < 0) {
 		condlog(0, "cannot truncate wwids file : %s", strerror(errno));
 		goto out_file;
@@ -194,13 +547,14 @@ do_remove_wwid(int fd, char *str) {
 }
 
 
-int
-remove_wwid(char *wwid) {
+static int
+__remove_wwid(char *wwid) {
 	long fd;
 	int len, can_write;
 	char *str;
 	int ret = -1;
 	struct config *conf;
+	char index_file[PATH_MAX];
 
 	len = strlen(wwid) + 4; /* two slashes the newline and a zero byte */
 	str = malloc(len);
@@ -219,6 +573,8 @@ remove_wwid(char *wwid) {
 	conf = get_multipath_config();
 	pthread_cleanup_push(put_multipath_config, conf);
 	fd = open_file(conf->wwids_file, &can_write, WWIDS_FILE_HEADER);
+	if (wwids_index_name(index_file, sizeof(index_file), conf->wwids_file))
+		index_file[0] = '\0';
 	pthread_cleanup_pop(1);
 
 	if (fd < 0) {
@@ -230,8 +586,11 @@ remove_wwid(char *wwid) {
 	if (!can_write) {
 		ret = -1;
 		condlog(0, "cannot remove wwid. wwids file is read-only");
-	} else
+	} else {
 		ret = do_remove_wwid(fd, str);
+		if (ret == 0 && *index_file)
+			remove_wwids_index(index_file);
+	}
 	pthread_cleanup_pop(1);
 out:
 	/* free(str) */
@@ -239,16 +598,22 @@ out:
 	return ret;
 }
 
-int
-check_wwids_file(char *wwid, int write_wwid)
+static int
+__check_wwids_file(char *wwid, int write_wwid)
 {
-	int fd, can_write, found, ret;
+	int fd, can_write, found, ret, indexed = -1;
 	FILE *f;
 	struct config *conf;
+	char index_file[PATH_MAX];
+	struct wwids_index_hdr hdr;
+	bool use_index;
 
 	conf = get_multipath_config();
 	pthread_cleanup_push(put_multipath_config, conf);
 	fd = open_file(conf->wwids_file, &can_write, WWIDS_FILE_HEADER);
+	use_index = conf->wwids_index &&
+		!wwids_index_name(index_file, sizeof(index_file),
+				  conf->wwids_file);
 	pthread_cleanup_pop(1);
 	if (fd < 0)
 		return -1;
@@ -259,7 +624,9 @@ check_wwids_file(char *wwid, int write_wwid)
 		close(fd);
 		return -1;
 	}
-	found = lookup_wwid(f, wwid);
+	if (use_index)
+		indexed = lookup_wwid_index(index_file, fd, f, wwid, &hdr);
+	found = indexed >= 0 ? indexed : lookup_wwid(f, wwid);
 	if (found) {
 		ret = 0;
 		goto out;
@@ -283,10 +650,285 @@ check_wwids_file(char *wwid, int write_wwid)
 
 	ret = write_out_wwid(fd, wwid);
 out:
+	if (use_index && can_write) {
+		if (indexed < 0)
+			build_wwids_index(index_file, fd, f);
+		else if (ret == 1)
+			update_wwids_index(index_file, fd, f, &hdr);
+	}
+	fclose(f);
+	return ret;
+}
+
+/*
+ * New wwids are collected between wwids_batch_start() and
+ * wwids_batch_end() of a thread, and appended to the wwids file at once.
+ * known holds the wwids of the wwids file, sorted, as read when the
+ * first wwid of the batch was checked, and the wwids added since. These
+ * are also in pending, which doesn't own its strings.
+ */
+struct wwids_batch {
+	int depth;
+	bool loaded;
+	int can_write;
+	struct stat st;
+	struct _vector known;
+	struct _vector pending;
+};
+
+static __thread struct wwids_batch wwids_batch;
+
+/* Called with wwids_lock held */
+static int load_wwids_batch(struct wwids_batch *b)
+{
+	int fd, ret = -1;
+	FILE *f;
+	struct config *conf;
+
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	fd = open_file(conf->wwids_file, &b->can_write, WWIDS_FILE_HEADER);
+	pthread_cleanup_pop(1);
+	if (fd < 0)
+		return -1;
+
+	f = fdopen(fd, "r");
+	if (!f) {
+		condlog(0, "can't fdopen wwids file : %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (fstat(fd, &b->st) == 0 && read_wwids(f, &b->known) == 0) {
+		b->loaded = true;
+		ret = 0;
+	} else
+		free_wwids(&b->known);
+	fclose(f);
+	return ret;
+}
+
+/* Index of the first wwid in the sorted vector v not less than wwid */
+static int wwid_lower_bound(const struct _vector *v, const char *wwid)
+{
+	int lo = 0, hi = VECTOR_SIZE(v);
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (strcmp(v->slot[mid], wwid) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Like __check_wwids_file() for the batch b. Returns -2 if the wwid
+ * couldn't be added to the batch, and must be written right away.
+ */
+static int batch_check_wwid(struct wwids_batch *b, char *wwid,
+			    int write_wwid)
+{
+	char *copy;
+	int pos;
+
+	if (!b->loaded && load_wwids_batch(b) != 0)
+		return -2;
+	pos = wwid_lower_bound(&b->known, wwid);
+	if (pos < VECTOR_SIZE(&b->known) &&
+	    !strcmp(b->known.slot[pos], wwid))
+		return 0;
+	if (!write_wwid)
+		return -1;
+	if (!b->can_write) {
+		condlog(0, "wwids file is read-only. Can't write wwid");
+		return -1;
+	}
+	if (strlen(wwid) > WWID_SIZE - 1 || !(copy = strdup(wwid)))
+		return -2;
+	if (!vector_insert_slot(&b->known, pos, copy)) {
+		free(copy);
+		return -2;
+	}
+	if (!vector_alloc_slot(&b->pending)) {
+		vector_del_slot(&b->known, pos);
+		free(copy);
+		return -2;
+	}
+	vector_set_slot(&b->pending, copy);
+	condlog(4, "%s: wwid %s added to batch", __func__, wwid);
+	return 1;
+}
+
+/*
+ * Append the pending wwids of b to the wwids file, with a single write.
+ * Wwids that other processes added to the file since it was read are
+ * skipped. Called with wwids_lock held.
+ */
+static int write_wwids_batch(struct wwids_batch *b)
+{
+	struct _vector _current = { .allocated = 0, };
+	vector current = NULL;
+	int fd, can_write, i, ret = -1, indexed = -1, n = 0;
+	char index_file[PATH_MAX];
+	struct wwids_index_hdr hdr;
+	struct config *conf;
+	struct stat st;
+	bool use_index;
+	char *buf, *wwid;
+	size_t len = 0;
+	FILE *f;
+
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	fd = open_file(conf->wwids_file, &can_write, WWIDS_FILE_HEADER);
+	use_index = conf->wwids_index &&
+		!wwids_index_name(index_file, sizeof(index_file),
+				  conf->wwids_file);
+	pthread_cleanup_pop(1);
+	if (fd < 0)
+		return -1;
+
+	f = fdopen(fd, "r");
+	if (!f) {
+		condlog(0, "can't fdopen wwids file : %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (!can_write) {
+		condlog(0, "wwids file is read-only. Can't write wwids");
+		goto out;
+	}
+	if (fstat(fd, &st) != 0)
+		goto out;
+	if (st.st_ino != b->st.st_ino || st.st_size != b->st.st_size ||
+	    st.st_mtim.tv_sec != b->st.st_mtim.tv_sec ||
+	    st.st_mtim.tv_nsec != b->st.st_mtim.tv_nsec) {
+		current = &_current;
+		if (read_wwids(f, current) != 0)
+			goto out;
+	}
+
+	buf = malloc(VECTOR_SIZE(&b->pending) * (WWID_SIZE + 2));
+	if (!buf)
+		goto out;
+	vector_foreach_slot(&b->pending, wwid, i) {
+		int pos;
+
+		if (current) {
+			pos = wwid_lower_bound(current, wwid);
+			if (pos < VECTOR_SIZE(current) &&
+			    !strcmp(current->slot[pos], wwid))
+				continue;
+		}
+		len += sprintf(buf + len, "/%s/\n", wwid);
+		n++;
+	}
+
+	if (use_index)
+		indexed = read_wwids_index_hdr(index_file, fd, &hdr);
+	ret = n > 0 ? write_out_wwid_lines(fd, buf, len) : 0;
+	free(buf);
+	if (ret == 1)
+		condlog(3, "wrote %d wwids to wwids file", n);
+	if (use_index) {
+		if (indexed < 0)
+			build_wwids_index(index_file, fd, f);
+		else if (ret == 1)
+			update_wwids_index(index_file, fd, f, &hdr);
+	}
+out:
+	if (current)
+		free_wwids(current);
 	fclose(f);
 	return ret;
 }
 
+/* Keep a wwid removed from the wwids file from being written again */
+static void batch_remove_wwid(struct wwids_batch *b, const char *wwid)
+{
+	int pos, slot;
+
+	pos = wwid_lower_bound(&b->known, wwid);
+	if (pos == VECTOR_SIZE(&b->known) ||
+	    strcmp(b->known.slot[pos], wwid))
+		return;
+	slot = find_slot(&b->pending, b->known.slot[pos]);
+	if (slot >= 0)
+		vector_del_slot(&b->pending, slot);
+	free(b->known.slot[pos]);
+	vector_del_slot(&b->known, pos);
+}
+
+void wwids_batch_start(void)
+{
+	wwids_batch.depth++;
+}
+
+int wwids_batch_end(void)
+{
+	struct wwids_batch *b = &wwids_batch;
+	int ret = 0;
+
+	if (b->depth == 0 || --b->depth > 0)
+		return 0;
+	if (VECTOR_SIZE(&b->pending) > 0) {
+		pthread_mutex_lock(&wwids_lock);
+		pthread_cleanup_push(cleanup_mutex, &wwids_lock);
+		ret = write_wwids_batch(b);
+		pthread_cleanup_pop(1);
+		if (ret < 0)
+			condlog(1, "failed to write %d wwids to wwids file",
+				VECTOR_SIZE(&b->pending));
+	}
+	vector_reset(&b->pending);
+	free_wwids(&b->known);
+	b->loaded = false;
+	return ret;
+}
+
+int
+replace_wwids(vector mp)
+{
+	int ret;
+
+	pthread_mutex_lock(&wwids_lock);
+	pthread_cleanup_push(cleanup_mutex, &wwids_lock);
+	ret = __replace_wwids(mp);
+	pthread_cleanup_pop(1);
+	return ret;
+}
+
+int
+remove_wwid(char *wwid)
+{
+	int ret;
+
+	pthread_mutex_lock(&wwids_lock);
+	pthread_cleanup_push(cleanup_mutex, &wwids_lock);
+	if (wwids_batch.loaded)
+		batch_remove_wwid(&wwids_batch, wwid);
+	ret = __remove_wwid(wwid);
+	pthread_cleanup_pop(1);
+	return ret;
+}
+
+int
+check_wwids_file(char *wwid, int write_wwid)
+{
+	int ret;
+
+	pthread_mutex_lock(&wwids_lock);
+	pthread_cleanup_push(cleanup_mutex, &wwids_lock);
+	ret = wwids_batch.depth > 0 ?
+		batch_check_wwid(&wwids_batch, wwid, write_wwid) : -2;
+	if (ret == -2)
+		ret = __check_wwids_file(wwid, write_wwid);
+	pthread_cleanup_pop(1);
+	return ret;
+}
+
 int
 should_multipath(struct path *pp1, vector pathvec, vector mpvec)
 {
@@ -316,7 +958,8 @@ should_multipath(struct path *pp1, vector pathvec, vector mpvec)
 		vector_foreach_slot(pathvec, pp2, i) {
 			if (pp1->dev == pp2->dev)
 				continue;
-			if (strncmp(pp1->wwid, pp2->wwid, WWID_SIZE) == 0) {
+			if (same_wwid(pp1->wwid, pp1->wwid_hash,
+				      pp2->wwid, pp2->wwid_hash)) {
 				condlog(3, "found multiple paths with wwid %s, "
 					"multipathing %s", pp1->wwid, pp1->dev);
 				return 1;
@@ -342,7 +985,8 @@ remember_wwid(char *wwid)
 		return -1;
 	}
 	if (ret == 1)
-		condlog(3, "wrote wwid %s to wwids file", wwid);
+		condlog(3, "%s wwid %s to wwids file",
+			wwids_batch.depth > 0 ? "queued" : "wrote", wwid);
 	else
 		condlog(4, "wwid %s already in wwids file", wwid);
 	return ret;
@@ -366,7 +1010,7 @@ static void print_failed_wwid_result(const char * msg, const char *wwid, int r)
 	}
 }
 
-int is_failed_wwid(const char *wwid)
+static int is_failed_wwid_file(const char *wwid)
 {
 	struct stat st;
 	char path[PATH_MAX];
@@ -388,7 +1032,7 @@ int is_failed_wwid(const char *wwid)
 	return r;
 }
 
-int mark_failed_wwid(const char *wwid)
+static int mark_failed_wwid_file(const char *wwid)
 {
 	char tmpfile[WWID_SIZE + 2 * sizeof(long) + 1];
 	int r = WWID_FAILED_ERROR, fd, dfd;
@@ -431,7 +1075,7 @@ out_closedir:
 	return r;
 }
 
-int unmark_failed_wwid(const char *wwid)
+static int unmark_failed_wwid_file(const char *wwid)
 {
 	char path[PATH_MAX];
 	int r;
@@ -451,3 +1095,321 @@ int unmark_failed_wwid(const char *wwid)
 	print_failed_wwid_result("unmark_failed", wwid, r);
 	return r;
 }
+
+/*
+ * The failed wwids are kept in memory, and published as a single table
+ * in shared memory: a header followed by the sorted wwids, WWID_SIZE
+ * bytes each, which readers look up with mmap() and a binary search.
+ * The table is replaced with rename() on every change, under a lock
+ * that serializes the processes changing it. If the table exists, the
+ * files of the wwids in shm_dir are not used. They are only read if
+ * there is no table, and written if the table can't be written.
+ */
+#define FAILED_TABLE_MAGIC "MPFWWID1"
+#define FAILED_TABLE_VERSION 1
+
+static const char failed_table[] = MULTIPATH_SHM_BASE "failed_wwids.table";
+static const char failed_table_lock[] = MULTIPATH_SHM_BASE "failed_wwids.lock";
+
+struct failed_table_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t nr;
+	/* incremented on every change */
+	uint64_t generation;
+};
+
+/* In-memory copy of the table, protected by failed_lock */
+static pthread_mutex_t failed_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct _vector _failed_wwids;
+static const vector failed_wwids = &_failed_wwids;
+static uint64_t failed_generation;
+/* Identity of the table failed_wwids was read from or written to */
+static ino_t failed_ino;
+static bool failed_loaded;
+
+static int failed_cmp(const void *a, const void *b)
+{
+	return strncmp(a, b, WWID_SIZE);
+}
+
+/*
+ * Look up wwid in the table. Returns WWID_IS_FAILED or WWID_IS_NOT_FAILED,
+ * or WWID_FAILED_ERROR if there is no valid table.
+ */
+static int lookup_failed_table(const char *wwid)
+{
+	struct failed_table_hdr hdr;
+	struct stat st;
+	void *map;
+	int fd, r = WWID_FAILED_ERROR;
+
+	fd = open(failed_table, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return WWID_FAILED_ERROR;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(hdr)) {
+		close(fd);
+		return WWID_FAILED_ERROR;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return WWID_FAILED_ERROR;
+
+	memcpy(&hdr, map, sizeof(hdr));
+	if (!memcmp(hdr.magic, FAILED_TABLE_MAGIC, sizeof(hdr.magic)) &&
+	    hdr.version == FAILED_TABLE_VERSION &&
+	    hdr.nr <= (st.st_size - sizeof(hdr)) / WWID_SIZE)
+		r = bsearch(wwid, (const char *)map + sizeof(hdr), hdr.nr,
+			    WWID_SIZE, failed_cmp) ?
+			WWID_IS_FAILED : WWID_IS_NOT_FAILED;
+	munmap(map, st.st_size);
+	return r;
+}
+
+int is_failed_wwid(const char *wwid)
+{
+	int r = lookup_failed_table(wwid);
+
+	if (r == WWID_FAILED_ERROR)
+		return is_failed_wwid_file(wwid);
+	print_failed_wwid_result("is_failed", wwid, r);
+	return r;
+}
+
+static void free_failed_wwids(void)
+{
+	free_wwids(failed_wwids);
+	failed_loaded = false;
+}
+
+static int add_failed_wwid(int pos, const char *wwid)
+{
+	char *copy = strdup(wwid);
+
+	if (!copy)
+		return -1;
+	if (!vector_insert_slot(failed_wwids, pos, copy)) {
+		free(copy);
+		return -1;
+	}
+	return 0;
+}
+
+/* Read the wwids marked in shm_dir by the per-file scheme */
+static int import_failed_files(void)
+{
+	DIR *dir;
+	struct dirent *de;
+	int r = 0;
+
+	dir = opendir(shm_dir);
+	if (!dir)
+		return errno == ENOENT ? 0 : -1;
+	while (r == 0 && (de = readdir(dir))) {
+		int pos;
+
+		if (de->d_name[0] == '.' || strlen(de->d_name) >= WWID_SIZE)
+			continue;
+		pos = wwid_lower_bound(failed_wwids, de->d_name);
+		if (pos < VECTOR_SIZE(failed_wwids) &&
+		    !strcmp(failed_wwids->slot[pos], de->d_name))
+			continue;
+		r = add_failed_wwid(pos, de->d_name);
+	}
+	closedir(dir);
+	return r;
+}
+
+/*
+ * Bring failed_wwids up to date with the table. Called with failed_lock
+ * and the table lock held.
+ */
+static int load_failed_wwids(void)
+{
+	struct failed_table_hdr hdr;
+	struct stat st;
+	char wwid[WWID_SIZE];
+	FILE *f;
+	uint32_t i;
+	int r = -1;
+
+	f = fopen(failed_table, "re");
+	if (!f) {
+		if (errno != ENOENT)
+			return -1;
+		/* First use, or the per-file scheme was used before */
+		free_failed_wwids();
+		if (import_failed_files() != 0) {
+			free_failed_wwids();
+			return -1;
+		}
+		failed_ino = 0;
+		failed_loaded = true;
+		return 0;
+	}
+	if (fstat(fileno(f), &st) != 0)
+		goto out;
+	if (failed_loaded && st.st_ino == failed_ino) {
+		r = 0;
+		goto out;
+	}
+
+	free_failed_wwids();
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, FAILED_TABLE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != FAILED_TABLE_VERSION)
+		goto out;
+	for (i = 0; i < hdr.nr; i++) {
+		if (fread(wwid, WWID_SIZE, 1, f) != 1)
+			goto out;
+		wwid[WWID_SIZE - 1] = '\0';
+		if (add_failed_wwid(VECTOR_SIZE(failed_wwids), wwid) != 0)
+			goto out;
+	}
+	failed_generation = hdr.generation;
+	failed_ino = st.st_ino;
+	failed_loaded = true;
+	r = 0;
+out:
+	if (r != 0)
+		free_failed_wwids();
+	fclose(f);
+	return r;
+}
+
+/* Write failed_wwids as the new table, with the table lock held */
+static int publish_failed_wwids(void)
+{
+	struct failed_table_hdr hdr = { .nr = 0, };
+	char tmpname[sizeof(failed_table) + 8];
+	char entry[WWID_SIZE];
+	struct stat st;
+	const char *wwid;
+	int fd, i, r = -1;
+	FILE *f;
+
+	memcpy(hdr.magic, FAILED_TABLE_MAGIC, sizeof(hdr.magic));
+	hdr.version = FAILED_TABLE_VERSION;
+	hdr.nr = VECTOR_SIZE(failed_wwids);
+	hdr.generation = failed_generation + 1;
+
+	safe_sprintf(tmpname, "%s.XXXXXX", failed_table);
+	fd = mkstemp(tmpname);
+	if (fd < 0)
+		return -1;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmpname);
+		return -1;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto out;
+	vector_foreach_slot(failed_wwids, wwid, i) {
+		memset(entry, 0, sizeof(entry));
+		strlcpy(entry, wwid, sizeof(entry));
+		if (fwrite(entry, sizeof(entry), 1, f) != 1)
+			goto out;
+	}
+	if (fflush(f) != 0 || fchmod(fd, 0644) != 0 || fstat(fd, &st) != 0)
+		goto out;
+	if (rename(tmpname, failed_table) == 0) {
+		failed_generation = hdr.generation;
+		failed_ino = st.st_ino;
+		r = 0;
+	}
+out:
+	fclose(f);
+	if (r != 0) {
+		condlog(2, "failed to write %s: %m", failed_table);
+		unlink(tmpname);
+	}
+	return r;
+}
+
+static int lock_failed_table(void)
+{
+	int fd;
+
+	if (ensure_directories_exist(failed_table_lock, 0700))
+		return -1;
+	fd = open(failed_table_lock, O_RDWR|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR);
+	if (fd < 0)
+		return -1;
+	if (flock(fd, LOCK_EX) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Add wwid to the failed wwids if failed is set, and remove it otherwise.
+ * Returns WWID_FAILED_ERROR if the table couldn't be used.
+ */
+static int change_failed_wwid(const char *wwid, bool failed)
+{
+	int lock_fd, pos, r = WWID_FAILED_ERROR;
+	bool present;
+
+	if (strlen(wwid) >= WWID_SIZE)
+		return WWID_FAILED_ERROR;
+
+	pthread_mutex_lock(&failed_lock);
+	pthread_cleanup_push(cleanup_mutex, &failed_lock);
+	lock_fd = lock_failed_table();
+	if (lock_fd >= 0) {
+		if (load_failed_wwids() == 0) {
+			pos = wwid_lower_bound(failed_wwids, wwid);
+			present = pos < VECTOR_SIZE(failed_wwids) &&
+				!strcmp(failed_wwids->slot[pos], wwid);
+			if (present == failed)
+				r = WWID_FAILED_UNCHANGED;
+			else if (failed) {
+				if (add_failed_wwid(pos, wwid) == 0)
+					r = WWID_FAILED_CHANGED;
+			} else {
+				free(failed_wwids->slot[pos]);
+				vector_del_slot(failed_wwids, pos);
+				r = WWID_FAILED_CHANGED;
+			}
+			/* Don't keep a copy that differs from the table */
+			if (r == WWID_FAILED_CHANGED &&
+			    publish_failed_wwids() != 0) {
+				free_failed_wwids();
+				r = WWID_FAILED_ERROR;
+			}
+		}
+		close(lock_fd);
+	}
+	pthread_cleanup_pop(1);
+	return r;
+}
+
+int mark_failed_wwid(const char *wwid)
+{
+	int r = change_failed_wwid(wwid, true);
+
+	if (r == WWID_FAILED_ERROR)
+		return mark_failed_wwid_file(wwid);
+	print_failed_wwid_result("mark_failed", wwid, r);
+	return r;
+}
+
+int unmark_failed_wwid(const char *wwid)
+{
+	int r = change_failed_wwid(wwid, false);
+
+	if (r == WWID_FAILED_ERROR)
+		return unmark_failed_wwid_file(wwid);
+	/* The file may be left over from the per-file scheme */
+	if (r == WWID_FAILED_CHANGED) {
+		char path[PATH_MAX];
+
+		if (!safe_sprintf(path, "%s/%s", shm_dir, wwid))
+			unlink(path);
+	}
+	print_failed_wwid_result("unmark_failed", wwid, r);
+	return r;
+}
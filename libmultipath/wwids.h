@@ -17,6 +17,14 @@ int remember_wwid(char *wwid);
 int check_wwids_file(char *wwid, int write_wwid);
 int remove_wwid(char *wwid);
 int replace_wwids(vector mp);
+/*
+ * Between these calls, wwids added by this thread are looked up in
+ * memory, and only appended to the wwids file by the outermost
+ * wwids_batch_end(). Lookups in other threads and processes don't see
+ * them before. Calls can be nested.
+ */
+void wwids_batch_start(void);
+int wwids_batch_end(void);
 
 enum {
 	WWID_IS_NOT_FAILED = 0,
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include "checkers.h"
 #include "vector.h"
@@ -12,6 +13,7 @@
 #include "mpath_persist.h"
 #include "main.h"
 #include "debug.h"
+#include "worker_pool.h"
 #include <pthread.h>
 #include <ctype.h>
 #include <string.h>
@@ -48,8 +50,36 @@ void rcu_unregister_thread_memb(void) {}
 
 
 static int verbose, loglevel, noisy;
+/* Number of batch file commands to run in parallel, 0 for one by one */
+static int batch_jobs;
+
+/* parse_args() return value for --help */
+#define PARSE_HELP -1
+
+/* A PR command from the command line or from a batch file line */
+struct pr_cmd {
+	int nline;
+	char *device_name;
+	int prin;
+	int prin_sa;
+	int prout;
+	int prout_sa;
+	unsigned int prout_type;
+	struct prout_param_descriptor *paramp;
+	int hex;
+	/* set by run_pr_cmd() */
+	int status;
+	bool sent;
+	void *resp;
+	/* used by run_batch_jobs() */
+	dev_t devt;
+};
 
 static int handle_args(int argc, char * argv[], int line);
+static int parse_args(int argc, char *argv[], int nline, struct pr_cmd *cmd,
+		      char **batch_fn);
+static void free_pr_cmd(struct pr_cmd *cmd);
+static int run_batch_jobs(vector cmds);
 
 static int do_batch_file(const char *batch_fn)
 {
@@ -63,16 +93,27 @@ static int do_batch_file(const char *batch_fn)
 	int argl = ARGV_CHUNK;
 	FILE *fl;
 	char **argv = calloc(argl, sizeof(*argv));
-	int ret = MPATH_PR_SUCCESS;
+	vector cmds = NULL;
+	struct pr_cmd *cmd;
+	int j, ret = MPATH_PR_SUCCESS;
 
 	if (argv == NULL)
 		return MPATH_PR_OTHER;
 
-	fl = fopen(batch_fn, "r");
+	if (batch_jobs > 0 && (cmds = vector_alloc()) == NULL) {
+		free(argv);
+		return MPATH_PR_OTHER;
+	}
+
+	if (!strcmp(batch_fn, "-"))
+		fl = stdin;
+	else
+		fl = fopen(batch_fn, "r");
 	if (fl == NULL) {
 		fprintf(stderr, "unable to open %s: %s\n",
 			batch_fn, strerror(errno));
 		free(argv);
+		vector_free(cmds);
 		return MPATH_PR_SYNTAX_ERROR;
 	} else {
 		if (verbose >= 2)
@@ -128,12 +169,51 @@ static int do_batch_file(const char *batch_fn)
 		}
 
 		optind = 0;
-		rv = handle_args(argc, argv, nline);
-		if (rv != MPATH_PR_SUCCESS)
-			ret = rv;
+		if (cmds == NULL) {
+			rv = handle_args(argc, argv, nline);
+			if (rv != MPATH_PR_SUCCESS)
+				ret = rv;
+			continue;
+		}
+
+		/*
+		 * In parallel mode, all lines are parsed first. Lines
+		 * with syntax errors are kept to report their status.
+		 */
+		cmd = calloc(1, sizeof(*cmd));
+		if (cmd == NULL || !vector_alloc_slot(cmds)) {
+			fprintf(stderr, "failed to allocate command for line %d\n",
+				nline);
+			free(cmd);
+			ret = MPATH_PR_OTHER;
+			continue;
+		}
+		vector_set_slot(cmds, cmd);
+		cmd->nline = nline;
+		rv = parse_args(argc, argv, nline, cmd, NULL);
+		if (rv == PARSE_HELP) {
+			free_pr_cmd(cmd);
+			vector_del_slot(cmds, VECTOR_SIZE(cmds) - 1);
+		} else if (rv != MPATH_PR_SUCCESS) {
+			if (rv == MPATH_PR_SYNTAX_ERROR)
+				fprintf(stderr, "syntax error on line %d in batch file\n",
+					nline);
+			cmd->status = rv;
+		}
 	}
 
-	fclose(fl);
+	if (cmds != NULL) {
+		if (VECTOR_SIZE(cmds) > 0) {
+			int rv = run_batch_jobs(cmds);
+
+			ret = ret == MPATH_PR_SUCCESS ? rv : ret;
+		}
+		vector_foreach_slot(cmds, cmd, j)
+			free_pr_cmd(cmd);
+		vector_free(cmds);
+	}
+	if (fl != stdin)
+		fclose(fl);
 	free(argv);
 	free(line);
 	return ret;
@@ -170,17 +250,65 @@ static void free_prout_param_descriptor(struct prout_param_descriptor *paramp)
 	free(paramp);
 }
 
-static int handle_args(int argc, char * argv[], int nline)
+static void free_pr_cmd(struct pr_cmd *cmd)
+{
+	free(cmd->device_name);
+	free_prout_param_descriptor(cmd->paramp);
+	free(cmd->resp);
+	free(cmd);
+}
+
+static const char *pr_cmd_action(const struct pr_cmd *cmd)
+{
+	if (cmd->prin) {
+		switch (cmd->prin_sa) {
+		case MPATH_PRIN_RKEY_SA:
+			return "read-keys";
+		case MPATH_PRIN_RRES_SA:
+			return "read-reservation";
+		case MPATH_PRIN_RCAP_SA:
+			return "report-capabilities";
+		case MPATH_PRIN_RFSTAT_SA:
+			return "read-full-status";
+		}
+	} else if (cmd->prout) {
+		switch (cmd->prout_sa) {
+		case MPATH_PROUT_REG_SA:
+			return "register";
+		case MPATH_PROUT_RES_SA:
+			return "reserve";
+		case MPATH_PROUT_REL_SA:
+			return "release";
+		case MPATH_PROUT_CLEAR_SA:
+			return "clear";
+		case MPATH_PROUT_PREE_SA:
+			return "preempt";
+		case MPATH_PROUT_PREE_AB_SA:
+			return "preempt-abort";
+		case MPATH_PROUT_REG_IGN_SA:
+			return "register-ignore";
+		}
+	}
+	return "-";
+}
+
+/*
+ * Parse a command line into cmd. Returns MPATH_PR_SUCCESS if the command
+ * is valid, or if there is nothing to do besides the batch file.
+ * batch_fn is NULL for batch file lines, which are parsed for parallel
+ * execution.
+ */
+static int parse_args(int argc, char *argv[], int nline, struct pr_cmd *cmd,
+		      char **batch_fn)
 {
 	int c;
-	int fd = -1;
 	const char *device_name = NULL;
 	int num_prin_sa = 0;
 	int num_prout_sa = 0;
 	int num_prout_param = 0;
 	int prin_flag = 0;
 	int prout_flag = 0;
-	int ret = 0;
+	int ret = MPATH_PR_SUCCESS;
 	int hex = 0;
 	uint64_t param_sark = 0;
 	unsigned int prout_type = 0;
@@ -190,20 +318,21 @@ static int handle_args(int argc, char * argv[], int nline)
 	unsigned int param_rtp = 0;
 	int num_transportids = 0;
 	struct transportid transportids[MPATH_MX_TIDS];
-	int prout = 1;
-	int prin = 1;
 	int prin_sa = -1;
 	int prout_sa = -1;
-	char *batch_fn = NULL;
-	void *resp = NULL;
+	char *no_batch_fn = NULL;
+	int j;
+	struct prout_param_descriptor *paramp;
 
+	if (batch_fn == NULL)
+		batch_fn = &no_batch_fn;
 	memset(transportids, 0, MPATH_MX_TIDS * sizeof(struct transportid));
 
 	while (1)
 	{
 		int option_index = 0;
 
-		c = getopt_long (argc, argv, "v:Cd:hHioYZK:S:PAT:skrGILcRX:l:f:",
+		c = getopt_long (argc, argv, "v:Cd:hHioYZK:S:PAT:skrGILcRX:l:f:j:",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -217,13 +346,22 @@ static int handle_args(int argc, char * argv[], int nline)
 					ret = MPATH_PR_SYNTAX_ERROR;
 					goto out;
 				}
-				if (batch_fn != NULL) {
+				if (*batch_fn != NULL) {
 					fprintf(stderr,
 						"ERROR: -f option can be used at most once\n");
 					ret = MPATH_PR_SYNTAX_ERROR;
 					goto out;
 				}
-				batch_fn = strdup(optarg);
+				*batch_fn = strdup(optarg);
+				break;
+			case 'j':
+				if (nline == 0 &&
+				    (1 != sscanf(optarg, "%d", &batch_jobs) ||
+				     batch_jobs < 1)) {
+					fprintf(stderr, "bad argument to '--jobs'\n");
+					ret = MPATH_PR_SYNTAX_ERROR;
+					goto out;
+				}
 				break;
 			case 'v':
 				if (nline == 0 && 1 != sscanf (optarg, "%d", &loglevel))
@@ -245,8 +383,7 @@ static int handle_args(int argc, char * argv[], int nline)
 
 			case 'h':
 				usage ();
-				free(batch_fn);
-				return 0;
+				return PARSE_HELP;
 
 			case 'H':
 				hex=1;
@@ -395,16 +532,7 @@ static int handle_args(int argc, char * argv[], int nline)
 		}
 	}
 
-	if (nline == 0) {
-		/* set verbosity */
-		noisy = (loglevel >= 3) ? 1 : hex;
-		verbose	= (loglevel >= 3)? 3: loglevel;
-		ret = mpath_persistent_reserve_init_vecs(verbose);
-		if (ret != MPATH_PR_SUCCESS)
-			goto out;
-	}
-
-	if ((prout_flag + prin_flag) == 0 && batch_fn == NULL)
+	if ((prout_flag + prin_flag) == 0 && *batch_fn == NULL)
 	{
 		fprintf (stderr, "choose either '--in' or '--out' \n");
 		ret = MPATH_PR_SYNTAX_ERROR;
@@ -418,7 +546,6 @@ static int handle_args(int argc, char * argv[], int nline)
 	}
 	else if (prout_flag)
 	{				/* syntax check on PROUT arguments */
-		prin = 0;
 		if ((1 != num_prout_sa) || (0 != num_prin_sa))
 		{
 			fprintf (stderr, " For Persistent Reserve Out only one "
@@ -430,7 +557,6 @@ static int handle_args(int argc, char * argv[], int nline)
 	}
 	else if (prin_flag)
 	{				/* syntax check on PRIN arguments */
-		prout = 0;
 		if (num_prout_sa > 0)
 		{
 			fprintf (stderr, " When a service action for Persistent "
@@ -456,7 +582,7 @@ static int handle_args(int argc, char * argv[], int nline)
 	}
 	else
 	{
-		if (batch_fn == NULL)
+		if (*batch_fn == NULL)
 			ret = MPATH_PR_SYNTAX_ERROR;
 		goto out;
 	}
@@ -490,118 +616,246 @@ static int handle_args(int argc, char * argv[], int nline)
 		goto out;
 	}
 
+	cmd->device_name = strdup(device_name);
+	if (!cmd->device_name) {
+		ret = MPATH_PR_OTHER;
+		goto out;
+	}
+	cmd->hex = hex;
+	if (prin_flag) {
+		cmd->prin = 1;
+		cmd->prin_sa = prin_sa;
+		goto out;
+	}
+
+	paramp = alloc_prout_param_descriptor(num_transportids);
+	if (!paramp) {
+		fprintf(stderr, "malloc paramp failed\n");
+		ret = MPATH_PR_OTHER;
+		goto out;
+	}
+
+	for (j = 7; j >= 0; --j) {
+		paramp->key[j] = (param_rk & 0xff);
+		param_rk >>= 8;
+	}
+
+	for (j = 7; j >= 0; --j) {
+		paramp->sa_key[j] = (param_sark & 0xff);
+		param_sark >>= 8;
+	}
+
+	if (param_alltgpt)
+		paramp->sa_flags |= MPATH_F_ALL_TG_PT_MASK;
+	if (param_aptpl)
+		paramp->sa_flags |= MPATH_F_APTPL_MASK;
+
+	if (num_transportids)
+	{
+		paramp->sa_flags |= MPATH_F_SPEC_I_PT_MASK;
+		paramp->num_transportid = num_transportids;
+		for (j = 0 ; j < num_transportids; j++)
+		{
+			paramp->trnptid_list[j] = (struct transportid *)malloc(sizeof(struct transportid));
+			if (!paramp->trnptid_list[j]) {
+				fprintf(stderr, "malloc paramp->trnptid_list[%d] failed.\n", j);
+				ret = MPATH_PR_OTHER;
+				free_prout_param_descriptor(paramp);
+				goto out;
+			}
+			memcpy(paramp->trnptid_list[j], &transportids[j],sizeof(struct transportid));
+		}
+	}
+	cmd->prout = 1;
+	cmd->prout_sa = prout_sa;
+	cmd->prout_type = prout_type;
+	cmd->paramp = paramp;
+out:
+	free(no_batch_fn);
+	return ret;
+}
+
+/* Send the command of cmd. Called concurrently in parallel batch mode. */
+static void run_pr_cmd(struct pr_cmd *cmd)
+{
+	int fd;
+
 	/* open device */
-	if ((fd = open (device_name, O_RDONLY)) < 0)
+	if ((fd = open (cmd->device_name, O_RDONLY)) < 0)
 	{
 		fprintf (stderr, "%s: error opening file (rw) fd=%d\n",
-				device_name, fd);
-		ret = MPATH_PR_FILE_ERROR;
-		goto out;
+				cmd->device_name, fd);
+		cmd->status = MPATH_PR_FILE_ERROR;
+		return;
 	}
 
-
-	if (prin)
+	if (cmd->prin)
 	{
-		resp = mpath_alloc_prin_response(prin_sa);
-		if (!resp)
+		cmd->resp = mpath_alloc_prin_response(cmd->prin_sa);
+		if (!cmd->resp)
 		{
 			fprintf (stderr, "failed to allocate PRIN response buffer\n");
-			ret = MPATH_PR_OTHER;
+			cmd->status = MPATH_PR_OTHER;
 			goto out_fd;
 		}
 
-		ret = __mpath_persistent_reserve_in (fd, prin_sa, resp, noisy);
-		if (ret != MPATH_PR_SUCCESS )
-		{
+		cmd->status = __mpath_persistent_reserve_in (fd, cmd->prin_sa,
+							     cmd->resp, noisy);
+		if (cmd->status != MPATH_PR_SUCCESS )
 			fprintf (stderr, "Persistent Reserve IN command failed\n");
-			free(resp);
-			goto out_fd;
-		}
+	}
+	else if (cmd->prout)
+	{
+		/* PROUT commands other than 'register and move' */
+		cmd->status = __mpath_persistent_reserve_out (fd, cmd->prout_sa,
+				0, cmd->prout_type, cmd->paramp, noisy);
+		cmd->sent = true;
+	}
+
+out_fd:
+	close (fd);
+}
 
-		switch(prin_sa)
+static void print_pr_cmd(const struct pr_cmd *cmd)
+{
+	if (cmd->prin && cmd->status == MPATH_PR_SUCCESS)
+	{
+		switch(cmd->prin_sa)
 		{
 			case MPATH_PRIN_RKEY_SA:
-				mpath_print_buf_readkeys(resp);
+				mpath_print_buf_readkeys(cmd->resp);
 				break;
 			case MPATH_PRIN_RRES_SA:
-				mpath_print_buf_readresv(resp);
+				mpath_print_buf_readresv(cmd->resp);
 				break;
 			case MPATH_PRIN_RCAP_SA:
-				mpath_print_buf_readcap(resp);
+				mpath_print_buf_readcap(cmd->resp);
 				break;
 			case MPATH_PRIN_RFSTAT_SA:
-				mpath_print_buf_readfullstat(resp);
+				mpath_print_buf_readfullstat(cmd->resp);
 				break;
 		}
-		free(resp);
 	}
-	else if (prout)
+	else if (cmd->sent && cmd->status != MPATH_PR_SUCCESS)
 	{
-		int j;
-		struct prout_param_descriptor *paramp;
-
-		paramp = alloc_prout_param_descriptor(num_transportids);
-		if (!paramp) {
-			fprintf(stderr, "malloc paramp failed\n");
-			ret = MPATH_PR_OTHER;
-			goto out_fd;
+		switch(cmd->status)
+		{
+			case MPATH_PR_SENSE_UNIT_ATTENTION:
+				printf("persistent reserve out: scsi status: Unit Attention\n");
+				break;
+			case MPATH_PR_RESERV_CONFLICT:
+				printf("persistent reserve out: scsi status: Reservation Conflict\n");
+				break;
 		}
+		printf("PR out: command failed\n");
+	}
+}
 
-		for (j = 7; j >= 0; --j) {
-			paramp->key[j] = (param_rk & 0xff);
-			param_rk >>= 8;
-		}
+static void batch_job_fn(void *item, __attribute__((unused)) void *arg)
+{
+	struct pr_cmd *cmd = item;
 
-		for (j = 7; j >= 0; --j) {
-			paramp->sa_key[j] = (param_sark & 0xff);
-			param_sark >>= 8;
-		}
+	if (cmd->prin || cmd->prout)
+		run_pr_cmd(cmd);
+}
 
-		if (param_alltgpt)
-			paramp->sa_flags |= MPATH_F_ALL_TG_PT_MASK;
-		if (param_aptpl)
-			paramp->sa_flags |= MPATH_F_APTPL_MASK;
+static bool same_device(const struct pr_cmd *c1, const struct pr_cmd *c2)
+{
+	if (!c1->device_name || !c2->device_name)
+		return false;
+	if (c1->devt != 0 && c1->devt == c2->devt)
+		return true;
+	return !strcmp(c1->device_name, c2->device_name);
+}
 
-		if (num_transportids)
-		{
-			paramp->sa_flags |= MPATH_F_SPEC_I_PT_MASK;
-			paramp->num_transportid = num_transportids;
-			for (j = 0 ; j < num_transportids; j++)
-			{
-				paramp->trnptid_list[j] = (struct transportid *)malloc(sizeof(struct transportid));
-				if (!paramp->trnptid_list[j]) {
-					fprintf(stderr, "malloc paramp->trnptid_list[%d] failed.\n", j);
-					ret = MPATH_PR_OTHER;
-					free_prout_param_descriptor(paramp);
-					goto out_fd;
-				}
-				memcpy(paramp->trnptid_list[j], &transportids[j],sizeof(struct transportid));
-			}
-		}
+/*
+ * Run the parsed batch file commands in cmds on batch_jobs threads.
+ * The commands are run in waves that don't contain two commands for the
+ * same device, so that commands for one device are still executed in
+ * the order of the batch file. Output is printed in this order, too,
+ * followed by a result line for every command.
+ */
+static int run_batch_jobs(vector cmds)
+{
+	struct worker_pool *pool;
+	struct _vector wave;
+	struct pr_cmd *cmd;
+	struct stat st;
+	int i, j, start, end;
+	int ret = MPATH_PR_SUCCESS;
 
-		/* PROUT commands other than 'register and move' */
-		ret = __mpath_persistent_reserve_out (fd, prout_sa, 0, prout_type,
-				paramp, noisy);
-		free_prout_param_descriptor(paramp);
+	vector_foreach_slot(cmds, cmd, i) {
+		if (cmd->device_name && stat(cmd->device_name, &st) == 0 &&
+		    S_ISBLK(st.st_mode))
+			cmd->devt = st.st_rdev;
 	}
 
-	if (ret != MPATH_PR_SUCCESS)
-	{
-		switch(ret)
-		{
-			case MPATH_PR_SENSE_UNIT_ATTENTION:
-				printf("persistent reserve out: scsi status: Unit Attention\n");
-				break;
-			case MPATH_PR_RESERV_CONFLICT:
-				printf("persistent reserve out: scsi status: Reservation Conflict\n");
+	pool = worker_pool_create(batch_jobs, "mpathpersist");
+	for (start = 0; start < VECTOR_SIZE(cmds); start = end) {
+		for (end = start + 1; end < VECTOR_SIZE(cmds); end++) {
+			for (j = start; j < end; j++)
+				if (same_device(VECTOR_SLOT(cmds, j),
+						VECTOR_SLOT(cmds, end)))
+					break;
+			if (j < end)
 				break;
 		}
-		printf("PR out: command failed\n");
+		wave.allocated = end - start;
+		wave.slot = &cmds->slot[start];
+		worker_pool_run(pool, &wave, batch_job_fn, NULL);
+
+		for (i = start; i < end; i++) {
+			cmd = VECTOR_SLOT(cmds, i);
+			print_pr_cmd(cmd);
+			printf("## result line=%d device=%s action=%s status=%d\n",
+			       cmd->nline,
+			       cmd->device_name ? cmd->device_name : "-",
+			       pr_cmd_action(cmd), cmd->status);
+			if (cmd->status != MPATH_PR_SUCCESS &&
+			    ret == MPATH_PR_SUCCESS)
+				ret = cmd->status;
+		}
+		fflush(stdout);
+	}
+	worker_pool_destroy(pool);
+	return ret;
+}
+
+static int handle_args(int argc, char * argv[], int nline)
+{
+	struct pr_cmd *cmd;
+	char *batch_fn = NULL;
+	int ret;
+
+	cmd = calloc(1, sizeof(*cmd));
+	if (!cmd)
+		return MPATH_PR_OTHER;
+	cmd->nline = nline;
+
+	ret = parse_args(argc, argv, nline, cmd, &batch_fn);
+	if (ret == PARSE_HELP) {
+		free(batch_fn);
+		free_pr_cmd(cmd);
+		return 0;
+	}
+
+	if (nline == 0 && ret != MPATH_PR_SYNTAX_ERROR) {
+		/* set verbosity */
+		noisy = (loglevel >= 3) ? 1 : cmd->hex;
+		verbose	= (loglevel >= 3)? 3: loglevel;
+		ret = mpath_persistent_reserve_init_vecs(verbose);
+		if (ret != MPATH_PR_SUCCESS)
+			goto out;
+	}
+
+	if (ret == MPATH_PR_SUCCESS && (cmd->prin || cmd->prout)) {
+		run_pr_cmd(cmd);
+		print_pr_cmd(cmd);
+		ret = cmd->status;
 	}
 
-out_fd:
-	close (fd);
 out :
+	free_pr_cmd(cmd);
 	if (ret == MPATH_PR_SYNTAX_ERROR) {
 		free(batch_fn);
 		if (nline == 0)
@@ -846,7 +1100,8 @@ static void usage(void)
 			"                   4           Informational messages with trace enabled\n"
 			"    --clear|-C                 PR Out: Clear\n"
 			"    --device=DEVICE|-d DEVICE  query or change DEVICE\n"
-			"    --batch-file|-f FILE       run commands from FILE\n"
+			"    --batch-file|-f FILE       run commands from FILE (- for stdin)\n"
+			"    --jobs=N|-j N              run N batch file commands in parallel\n"
 			"    --help|-h                  output this usage message\n"
 			"    --hex|-H                   output response in hex\n"
 			"    --in|-i                    request PR In command \n"
@@ -24,6 +24,7 @@ static struct option long_options[] = {
 	{"reserve", 0, NULL, 'R'},
 	{"transport-id", 1, NULL, 'X'},
 	{"alloc-length", 1, NULL, 'l'},
+	{"jobs", 1, NULL, 'j'},
 	{NULL, 0, NULL, 0}
 };
 
@@ -177,8 +177,11 @@ usage (char * progname)
 static int
 get_dm_mpvec (enum mpath_cmds cmd, vector curmp, vector pathvec, char * refwwid)
 {
-	int i;
+	int i, j, k;
 	struct multipath * mpp;
+	struct pathgroup *pgp;
+	struct path *pp;
+	struct _vector paths = { .allocated = 0, .slot = NULL };
 	int flags = (cmd == CMD_LIST_SHORT ? DI_NOIO : DI_ALL);
 
 	if (dm_get_maps(curmp))
@@ -196,13 +199,30 @@ get_dm_mpvec (enum mpath_cmds cmd, vector curmp, vector pathvec, char * refwwid)
 			continue;
 		}
 
-		if (update_multipath_table(mpp, pathvec, flags) != DMP_OK) {
+		/* The paths are examined below, all at once */
+		if (update_multipath_table(mpp, pathvec, DI_NOIO) != DMP_OK) {
 			condlog(1, "error parsing map %s", mpp->wwid);
 			remove_map(mpp, pathvec, curmp);
 			i--;
 			continue;
 		}
+	}
 
+	/*
+	 * Checkers and prioritizers of unresponsive paths may take up to
+	 * checker_timeout, so don't call them one after the other.
+	 */
+	if (flags != DI_NOIO) {
+		vector_foreach_slot (curmp, mpp, i)
+			vector_foreach_slot (mpp->pg, pgp, j)
+				vector_foreach_slot (pgp->paths, pp, k)
+					if (pp->udev && vector_alloc_slot(&paths))
+						vector_set_slot(&paths, pp);
+		pathinfo_parallel(&paths, flags | DI_WWID);
+		vector_reset(&paths);
+	}
+
+	vector_foreach_slot (curmp, mpp, i) {
 		if (cmd == CMD_LIST_LONG)
 			mpp->bestpg = select_path_group(mpp);
 
@@ -220,8 +240,7 @@ get_dm_mpvec (enum mpath_cmds cmd, vector curmp, vector pathvec, char * refwwid)
 	return 0;
 }
 
-static int check_usable_paths(struct config *conf,
-			      const char *devpath, enum devtypes dev_type)
+static int check_usable_paths(const char *devpath, enum devtypes dev_type)
 {
 	struct udev_device *ud = NULL;
 	struct multipath *mpp = NULL;
@@ -229,6 +248,7 @@ static int check_usable_paths(struct config *conf,
 	struct path *pp;
 	char *mapname;
 	vector pathvec = NULL;
+	struct _vector paths = { .allocated = 0, .slot = NULL };
 	dev_t devt;
 	int r = 1, i, j;
 
@@ -268,10 +288,18 @@ static int check_usable_paths(struct config *conf,
 	vector_foreach_slot (mpp->pg, pg, i) {
 		vector_foreach_slot (pg->paths, pp, j) {
 			pp->udev = get_udev_device(pp->dev_t, DEV_DEVT);
+			if (pp->udev && vector_alloc_slot(&paths))
+				vector_set_slot(&paths, pp);
+		}
+	}
+	/* Don't wait for unresponsive paths one after the other */
+	pathinfo_parallel(&paths, DI_SYSFS|DI_NOIO|DI_CHECKER);
+	vector_reset(&paths);
+
+	vector_foreach_slot (mpp->pg, pg, i) {
+		vector_foreach_slot (pg->paths, pp, j) {
 			if (pp->udev == NULL)
 				continue;
-			if (pathinfo(pp, conf, DI_SYSFS|DI_NOIO|DI_CHECKER) != PATHINFO_OK)
-				continue;
 
 			if (pp->state == PATH_UP &&
 			    pp->dmstate == PSTATE_ACTIVE) {
@@ -389,6 +417,13 @@ retry:
 	return FIND_MULTIPATHS_WAITING;
 }
 
+/* The reply to the "find_multipaths" command, see query_find_multipaths() */
+static struct {
+	bool answered;
+	int wait;
+	struct timespec until;
+} daemon_wait;
+
 static int print_cmd_valid(int k, const vector pathvec,
 			   struct config *conf)
 {
@@ -400,7 +435,12 @@ static int print_cmd_valid(int k, const vector pathvec,
 	    k != PATH_IS_MAYBE_VALID)
 		return PATH_IS_NOT_VALID;
 
-	if (k == PATH_IS_MAYBE_VALID) {
+	if (daemon_wait.answered) {
+		wait = daemon_wait.wait;
+		until = daemon_wait.until;
+		if (k == PATH_IS_MAYBE_VALID && wait != FIND_MULTIPATHS_WAITING)
+			k = PATH_IS_NOT_VALID;
+	} else if (k == PATH_IS_MAYBE_VALID) {
 		/*
 		 * Caller ensures that pathvec[0] is the path to
 		 * examine.
@@ -413,10 +453,13 @@ static int print_cmd_valid(int k, const vector pathvec,
 			k = PATH_IS_NOT_VALID;
 	} else if (pathvec != NULL && (pp = VECTOR_SLOT(pathvec, 0)))
 		wait = find_multipaths_check_timeout(pp, 0, &until);
-	if (wait == FIND_MULTIPATHS_WAITING)
+	if (wait == FIND_MULTIPATHS_WAITING) {
 		printf("FIND_MULTIPATHS_WAIT_UNTIL=\"%ld.%06ld\"\n",
 		       (long)until.tv_sec, until.tv_nsec/1000);
-	else if (wait == FIND_MULTIPATHS_WAIT_DONE)
+		/* multipathd triggers the uevent, the rules needn't */
+		if (daemon_wait.answered)
+			printf("FIND_MULTIPATHS_WAIT_DAEMON=\"1\"\n");
+	} else if (wait == FIND_MULTIPATHS_WAIT_DONE)
 		printf("FIND_MULTIPATHS_WAIT_UNTIL=\"0\"\n");
 	printf("DM_MULTIPATH_DEVICE_PATH=\"%d\"\n",
 	       k == PATH_IS_MAYBE_VALID ? 2 : k == PATH_IS_VALID ? 1 : 0);
@@ -443,6 +486,137 @@ static bool released_to_systemd(void)
 	return ret;
 }
 
+/*
+ * Print the cached result for the path, like check_path_valid() would.
+ * Only results for which print_cmd_valid() needs no path or config
+ * are cached.
+ * Returns -1 if there is no cached result.
+ */
+static int check_path_valid_cached(const char *name)
+{
+	int r;
+
+	r = lookup_path_valid(name, FIND_MULTIPATHS_UNDEF, true, NULL);
+	if (r == PATH_IS_ERROR)
+		return -1;
+	if (r == PATH_IS_VALID_NO_CHECK)
+		r = PATH_IS_VALID;
+	print_cmd_valid(r, NULL, NULL);
+	return 0;
+}
+
+/*
+ * True if multipathd holds the lock on its pidfile. Unlike connecting to
+ * the socket, this can't start multipathd through socket activation.
+ */
+static bool multipathd_running(void)
+{
+	struct flock lock = {
+		.l_type = F_WRLCK,
+		.l_whence = SEEK_SET,
+	};
+	int fd;
+	bool running;
+
+	fd = open(DEFAULT_PIDFILE, O_RDONLY);
+	if (fd < 0)
+		return false;
+	running = fcntl(fd, F_GETLK, &lock) == 0 && lock.l_type != F_UNLCK;
+	close(fd);
+	return running;
+}
+
+/*
+ * Count the paths with the given wwid other than dev, as seen by
+ * multipathd. Returns -1 if multipathd isn't running or can't answer.
+ */
+static int count_wwid_paths_multipathd(const char *wwid, const char *dev,
+				       const struct config *conf)
+{
+	char *reply = NULL, *line, *next, *sep;
+	int fd, n = -1;
+
+	if (conf->skip_delegate || !multipathd_running())
+		return -1;
+	fd = mpath_connect();
+	if (fd == -1)
+		return -1;
+	if (mpath_process_cmd(fd, "show paths raw format \"%d %w\"", &reply,
+			      conf->uxsock_timeout) == -1 || !reply ||
+	    !strcmp(reply, "fail\n"))
+		goto out;
+
+	n = 0;
+	for (line = reply; *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		sep = strchr(line, ' ');
+		if (!sep)
+			continue;
+		*sep++ = '\0';
+		if (!strcmp(sep, wwid) && strcmp(line, dev))
+			n++;
+	}
+out:
+	FREE(reply);
+	close(fd);
+	return n;
+}
+
+/*
+ * Ask multipathd whether pp should be claimed, because it knows other
+ * paths with the same WWID. If not, multipathd waits up to tmo seconds
+ * for them, and triggers a uevent for pp when the time is up.
+ * Returns PATH_IS_VALID or PATH_IS_MAYBE_VALID, and fills daemon_wait,
+ * or -1 if multipathd isn't running or can't answer.
+ */
+static int query_find_multipaths(const struct path *pp, long tmo,
+				 const struct config *conf)
+{
+	char cmd[FILE_NAME_SIZE + WWID_SIZE + 64];
+	char *reply = NULL, *sep;
+	long sec, usec;
+	int fd, r = -1;
+
+	if (conf->skip_delegate || !multipathd_running() ||
+	    safe_sprintf(cmd, "find_multipaths path %s wwid %s timeout %ld",
+			 pp->dev, pp->wwid, tmo))
+		return -1;
+	fd = mpath_connect();
+	if (fd == -1)
+		return -1;
+	if (mpath_process_cmd(fd, cmd, &reply, conf->uxsock_timeout) == -1 ||
+	    !reply || !(sep = strchr(reply, ' ')))
+		goto out;
+	*sep++ = '\0';
+	strchop(sep);
+
+	if (!strcmp(sep, "never"))
+		daemon_wait.wait = FIND_MULTIPATHS_NEVER;
+	else if (!strcmp(sep, "done"))
+		daemon_wait.wait = FIND_MULTIPATHS_WAIT_DONE;
+	else if (sscanf(sep, "%ld.%ld", &sec, &usec) == 2) {
+		daemon_wait.wait = FIND_MULTIPATHS_WAITING;
+		daemon_wait.until.tv_sec = sec;
+		daemon_wait.until.tv_nsec = usec * 1000;
+	} else
+		goto out;
+	if (!strcmp(reply, "valid"))
+		r = PATH_IS_VALID;
+	else if (!strcmp(reply, "maybe"))
+		r = PATH_IS_MAYBE_VALID;
+	else
+		goto out;
+	daemon_wait.answered = true;
+out:
+	FREE(reply);
+	close(fd);
+	return r;
+}
+
 static struct vectors vecs;
 static void cleanup_vecs(void)
 {
@@ -532,8 +706,11 @@ configure (struct config *conf, enum mpath_cmds cmd,
 		di_flag = DI_WWID;
 
 	if (cmd == CMD_LIST_LONG)
-		/* extended path info '-ll' */
-		di_flag |= DI_SYSFS | DI_CHECKER | DI_SERIAL;
+		/*
+		 * extended path info '-ll'. get_dm_mpvec() compares the
+		 * path WWIDs with the maps before examining the paths
+		 */
+		di_flag |= DI_SYSFS | DI_CHECKER | DI_SERIAL | DI_WWID;
 	else if (cmd == CMD_LIST_SHORT)
 		/* minimum path info '-l' */
 		di_flag |= DI_SYSFS;
@@ -547,9 +724,6 @@ configure (struct config *conf, enum mpath_cmds cmd,
 	if (libmp_verbosity > 2)
 		print_all_paths(pathvec, 1);
 
-	get_path_layout(pathvec, 0);
-	foreign_path_layout();
-
 	if (get_dm_mpvec(cmd, curmp, pathvec, refwwid))
 		goto out;
 
@@ -571,8 +745,10 @@ configure (struct config *conf, enum mpath_cmds cmd,
 	/*
 	 * core logic entry point
 	 */
+	dm_udev_batch_start();
 	rc = coalesce_paths(&vecs, newmp, refwwid,
 			   conf->force_reload, cmd);
+	dm_udev_batch_end();
 	r = rc == CP_RETRY ? RTVL_RETRY : rc == CP_OK ? RTVL_OK : RTVL_FAIL;
 
 out:
@@ -595,10 +771,13 @@ out:
 	return r;
 }
 
+/* find_multipaths value set by -i, for the is_path_valid() cache */
+static int find_multipaths_override = FIND_MULTIPATHS_UNDEF;
+
 static int
 check_path_valid(const char *name, struct config *conf, bool is_uevent)
 {
-	int fd, r = PATH_IS_ERROR;
+	int fd, n, r = PATH_IS_ERROR;
 	struct path *pp;
 	vector pathvec = NULL;
 	const char *wwid;
@@ -608,6 +787,7 @@ check_path_valid(const char *name, struct config *conf, bool is_uevent)
 		return RTVL_FAIL;
 
 	r = is_path_valid(name, conf, pp, is_uevent);
+	cache_path_valid(pp, conf, find_multipaths_override, r);
 	if (r <= PATH_IS_ERROR || r >= PATH_MAX_VALID_RESULT)
 		goto fail;
 
@@ -664,6 +844,7 @@ check_path_valid(const char *name, struct config *conf, bool is_uevent)
 		goto out;
 	}
 
+	/* print_cmd_valid() examines pathvec[0] */
 	pathvec = vector_alloc();
 	if (!pathvec)
 		goto fail;
@@ -678,6 +859,29 @@ check_path_valid(const char *name, struct config *conf, bool is_uevent)
 		pp = NULL;
 	}
 
+	/*
+	 * multipathd already knows the other paths, don't scan all of
+	 * them again. It also keeps track of the time to wait.
+	 */
+	pp = VECTOR_SLOT(pathvec, 0);
+	select_find_multipaths_timeout(conf, pp);
+	n = query_find_multipaths(pp, pp->find_multipaths_timeout, conf);
+	if (n < 0) {
+		/* multipathd doesn't know the command yet */
+		n = count_wwid_paths_multipathd(wwid, pp->dev, conf);
+		if (n >= 0) {
+			condlog(3, "%s: multipathd knows %d other paths with wwid %s",
+				pp->dev, n, wwid);
+			n = n > 0 ? PATH_IS_VALID : PATH_IS_MAYBE_VALID;
+		}
+	}
+	/* owned by pathvec */
+	pp = NULL;
+	if (n >= 0) {
+		r = n;
+		goto out;
+	}
+
 	/* For find_multipaths = SMART, if there is more than one path
 	 * matching the refwwid, then the path is valid */
 	if (path_discovery(pathvec, DI_SYSFS | DI_WWID) < 0)
@@ -750,6 +954,7 @@ int delegate_to_multipathd(enum mpath_cmds cmd,
 	int fd;
 	char command[1024], *p, *reply = NULL;
 	int n, r = DELEGATE_ERROR;
+	bool list = false;
 
 	p = command;
 	*p = '\0';
@@ -759,7 +964,7 @@ int delegate_to_multipathd(enum mpath_cmds cmd,
 		return NOT_DELEGATED;
 
 	if (cmd == CMD_CREATE && conf->force_reload == FORCE_RELOAD_YES) {
-		p += snprintf(p, n, "reconfigure");
+		p += snprintf(p, n, "reconfigure all");
 	}
 	else if (cmd == CMD_FLUSH_ONE && dev && dev_type == DEV_DEVMAP) {
 		p += snprintf(p, n, "del map %s", dev);
@@ -775,12 +980,24 @@ int delegate_to_multipathd(enum mpath_cmds cmd,
 		 * command */
 		r = NOT_DELEGATED;
 	}
+	else if ((cmd == CMD_LIST_SHORT || cmd == CMD_LIST_LONG) && !dev &&
+		 libmp_verbosity == 2) {
+		/* multipathd renders the topology with verbosity 2 */
+		p += snprintf(p, n, "show topology");
+		/* If multipathd isn't running or fails, list the maps
+		 * ourselves */
+		r = NOT_DELEGATED;
+		list = true;
+	}
 	/* Add other translations here */
 
 	if (strlen(command) == 0)
 		/* No command found, no need to delegate */
 		return NOT_DELEGATED;
 
+	if (list && !multipathd_running())
+		return NOT_DELEGATED;
+
 	fd = mpath_connect();
 	if (fd == -1)
 		return NOT_DELEGATED;
@@ -804,7 +1021,9 @@ int delegate_to_multipathd(enum mpath_cmds cmd,
 			r = DELEGATE_OK;
 		if (r != NOT_DELEGATED && strcmp(reply, "ok\n"))
 			printf("%s", reply);
-	}
+	} else if (list && reply != NULL)
+		/* no maps */
+		r = DELEGATE_OK;
 
 out:
 	FREE(reply);
@@ -830,6 +1049,14 @@ main (int argc, char *argv[])
 	if (atexit(dm_lib_exit) || atexit(libmultipath_exit))
 		condlog(1, "failed to register cleanup handler for libmultipath: %m");
 	logsink = LOGSINK_STDERR_WITH_TIME;
+	/*
+	 * Fast path for "multipath -u %k" from multipath.rules: answer
+	 * repeated events for a device from the is_path_valid() cache,
+	 * without parsing the configuration.
+	 */
+	if (argc == 3 && !strcmp(argv[1], "-u") && getuid() == 0 &&
+	    check_path_valid_cached(argv[2]) == 0)
+		exit(RTVL_OK);
 	if (init_config(DEFAULT_CONFIGFILE))
 		exit(RTVL_FAIL);
 	if (atexit(uninit_config))
@@ -908,6 +1135,7 @@ main (int argc, char *argv[])
 				conf->find_multipaths = FIND_MULTIPATHS_SMART;
 			else if (conf->find_multipaths == FIND_MULTIPATHS_OFF)
 				conf->find_multipaths = FIND_MULTIPATHS_GREEDY;
+			find_multipaths_override = conf->find_multipaths;
 			break;
 		case 't':
 			r = dump_config(conf, NULL, NULL) ? RTVL_FAIL : RTVL_OK;
@@ -1003,7 +1231,7 @@ main (int argc, char *argv[])
 	/* Failing here is non-fatal */
 	init_foreign(conf->multipath_dir, conf->enable_foreign);
 	if (cmd == CMD_USABLE_PATHS) {
-		r = check_usable_paths(conf, dev, dev_type) ?
+		r = check_usable_paths(dev, dev_type) ?
 			RTVL_FAIL : RTVL_OK;
 		goto out;
 	}
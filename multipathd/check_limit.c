@@ -0,0 +1,118 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "check_sched.h"
+#include "debug.h"
+#include "time-util.h"
+#include "util.h"
+#include "check_limit.h"
+
+/* Buckets that haven't been used for this long are dropped, in s */
+#define BUCKET_IDLE_TIME 300
+#define ARRAY_KEY_SIZE NODE_NAME_SIZE
+
+struct check_bucket {
+	char key[ARRAY_KEY_SIZE];
+	/* in 1/1000 tokens */
+	long long tokens;
+	struct timespec last;
+};
+
+/* There are few arrays, so the buckets are searched linearly */
+static vector buckets;
+
+static void array_key(const struct path *pp, char *key, size_t len)
+{
+	if (*pp->ident->tgt_node_name)
+		strlcpy(key, pp->ident->tgt_node_name, len);
+	else
+		snprintf(key, len, "%s/%s", pp->ident->vendor_id,
+			 pp->ident->product_id);
+}
+
+static struct check_bucket *
+find_bucket(const char *key, int rate, const struct timespec *now)
+{
+	struct check_bucket *b;
+	int i;
+
+	if (!buckets && !(buckets = vector_alloc()))
+		return NULL;
+	vector_foreach_slot(buckets, b, i) {
+		if (!strcmp(b->key, key))
+			return b;
+		if (now->tv_sec - b->last.tv_sec > BUCKET_IDLE_TIME) {
+			vector_del_slot(buckets, i--);
+			free(b);
+		}
+	}
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+	if (!vector_alloc_slot(buckets)) {
+		free(b);
+		return NULL;
+	}
+	strlcpy(b->key, key, sizeof(b->key));
+	b->tokens = rate * 1000LL;
+	b->last = *now;
+	vector_set_slot(buckets, b);
+	return b;
+}
+
+static bool take_token(struct check_bucket *b, int rate,
+		       const struct timespec *now)
+{
+	struct timespec diff;
+	long long ms;
+
+	timespecsub(now, &b->last, &diff);
+	ms = diff.tv_sec * 1000LL + diff.tv_nsec / 1000000;
+	if (ms > 0) {
+		b->tokens += ms * rate;
+		if (b->tokens > rate * 1000LL)
+			b->tokens = rate * 1000LL;
+		b->last = *now;
+	}
+	if (b->tokens < 1000)
+		return false;
+	b->tokens -= 1000;
+	return true;
+}
+
+int limit_due_paths(vector due)
+{
+	char key[ARRAY_KEY_SIZE];
+	struct timespec now;
+	struct check_bucket *b;
+	struct path *pp;
+	int i, rate, deferred = 0;
+
+	get_monotonic_time(&now);
+	for (i = 0; i < VECTOR_SIZE(due); i++) {
+		pp = VECTOR_SLOT(due, i);
+		if (!pp || !pp->mpp || !pp->ident ||
+		    (rate = pp->mpp->array_check_rate) <= 0)
+			continue;
+		array_key(pp, key, sizeof(key));
+		b = find_bucket(key, rate, &now);
+		if (!b || take_token(b, rate, &now))
+			continue;
+		condlog(4, "%s: check rate limit of %s reached, deferring",
+			pp->dev, key);
+		due->slot[i] = NULL;
+		set_path_tick(pp, 1);
+		deferred++;
+	}
+	if (deferred)
+		condlog(3, "deferred %d path checks for array_check_rate",
+			deferred);
+	return deferred;
+}
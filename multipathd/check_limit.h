@@ -0,0 +1,27 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _CHECK_LIMIT_H
+#define _CHECK_LIMIT_H
+
+#include "vector.h"
+
+/*
+ * Per-array limit for path checks, see array_check_rate in
+ * multipath.conf(5).
+ *
+ * Every storage array, identified by the target node name of its paths,
+ * or by vendor and product if the transport has no node names, has a
+ * token bucket that refills at mpp->array_check_rate tokens per second,
+ * up to the same number. Each check takes a token. Due paths without a
+ * token are taken out of due and stay scheduled for the next tick. As
+ * path priorities are only updated after checks, this also limits the
+ * prioritizer commands sent to the array.
+ *
+ * Must be called with vecs->lock held, on the vector filled by
+ * get_due_paths() or get_fast_due_paths(). Returns the number of
+ * deferred paths.
+ */
+int limit_due_paths(vector due);
+
+#endif /* _CHECK_LIMIT_H */
@@ -0,0 +1,91 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdbool.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "check_sched.h"
+#include "check_policy.h"
+
+/* Average number of path checks per second, times 16 */
+static int check_rate;
+
+void
+update_check_rate(int checks, unsigned int ticks)
+{
+	int rate = checks * 16 / (int)(ticks ? ticks : 1);
+
+	check_rate += (rate - check_rate) / 8;
+}
+
+void
+add_instability(struct path *pp, unsigned int n)
+{
+	pp->instability += n;
+	if (pp->instability > INSTABILITY_MAX)
+		pp->instability = INSTABILITY_MAX;
+}
+
+unsigned int
+next_checkint(struct path *pp, unsigned int checkint,
+	      unsigned int max_checkint, int adaptive, int max_rate)
+{
+	unsigned int limit = max_checkint;
+
+	if (adaptive) {
+		if (pp->failcount != pp->last_failcount) {
+			pp->last_failcount = pp->failcount;
+			add_instability(pp, INSTABILITY_IO_ERR);
+		}
+		if (pp->marginal)
+			return checkint;
+		if (pp->instability > 0) {
+			pp->instability--;
+			return checkint;
+		}
+		if (max_rate > 0 && check_rate > max_rate * 16) {
+			int scale = (check_rate + max_rate * 16 - 1) /
+				(max_rate * 16);
+
+			if (scale > MAX_CHECK_RATE_SCALE)
+				scale = MAX_CHECK_RATE_SCALE;
+			limit = max_checkint * scale;
+		}
+	}
+	if (pp->checkint >= limit)
+		return limit;
+	if (pp->checkint < limit / 2)
+		return 2 * pp->checkint;
+	return limit;
+}
+
+bool
+same_target(const struct path *a, const struct path *b)
+{
+	return a->bus == SYSFS_BUS_SCSI && b->bus == SYSFS_BUS_SCSI &&
+		a->sg_id.host_no == b->sg_id.host_no &&
+		a->sg_id.channel == b->sg_id.channel &&
+		a->sg_id.scsi_id == b->sg_id.scsi_id &&
+		a->checker.cls == b->checker.cls;
+}
+
+void
+recheck_target_paths(const struct _vector *pathvec, const struct path *pp,
+		     unsigned int checkint)
+{
+	struct path *pp1;
+	int i;
+
+	if (pp->bus != SYSFS_BUS_SCSI)
+		return;
+	vector_foreach_slot(pathvec, pp1, i) {
+		if (pp1 == pp || !same_target(pp1, pp) ||
+		    (pp1->state != PATH_UP && pp1->state != PATH_GHOST))
+			continue;
+		add_instability(pp1, INSTABILITY_TARGET);
+		pp1->checkint = checkint;
+		if (path_check_ticks(pp1) > checkint)
+			set_path_tick(pp1, checkint);
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _CHECK_POLICY_H
+#define _CHECK_POLICY_H
+
+#include <stdbool.h>
+#include "vector.h"
+
+struct path;
+
+/*
+ * Check intervals of the path checker.
+ *
+ * Adaptive polling. pp->instability is raised when a path changes state,
+ * when the kernel fails its I/O, and when another path to its target
+ * fails. While it's non-zero, the path is checked every checkint seconds,
+ * and every such check lowers it by one.
+ */
+#define INSTABILITY_STATE_CHANGE 4
+#define INSTABILITY_IO_ERR 4
+#define INSTABILITY_TARGET 2
+#define INSTABILITY_MAX 16
+/* Limit for stretching max_checkint to stay below max_polling_rate */
+#define MAX_CHECK_RATE_SCALE 4
+
+/* Account for the path checks done in the last ticks checker ticks */
+void update_check_rate(int checks, unsigned int ticks);
+void add_instability(struct path *pp, unsigned int n);
+
+/*
+ * Interval before the next check of a path which is still fine. It
+ * doubles at every check, up to max_checkint. With adaptive polling,
+ * unstable paths stay at checkint, and the limit is raised if paths are
+ * checked more often than max_rate per second.
+ */
+unsigned int next_checkint(struct path *pp, unsigned int checkint,
+			   unsigned int max_checkint, int adaptive,
+			   int max_rate);
+
+/* SCSI paths through the same remote port, using the same checker */
+bool same_target(const struct path *a, const struct path *b);
+/*
+ * Check the paths in pathvec through the target of a failed path soon.
+ * Must be called with the lock protecting pathvec held.
+ */
+void recheck_target_paths(const struct _vector *pathvec,
+			  const struct path *pp, unsigned int checkint);
+
+#endif /* _CHECK_POLICY_H */
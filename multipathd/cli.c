@@ -2,8 +2,11 @@
  * Copyright (c) 2005 Christophe Varoqui
  */
 #include <sys/time.h>
+#include <stdlib.h>
+#include <time.h>
 #include <errno.h>
 #include <pthread.h>
+#include <string.h>
 #include "memory.h"
 #include "vector.h"
 #include "structs.h"
@@ -14,12 +17,29 @@
 #include <readline/readline.h>
 
 #include "mpath_cmd.h"
+#include "uxsock.h"
 #include "cli.h"
 #include "debug.h"
 #include "strbuf.h"
+#include "snapshot.h"
+#include "arena.h"
 
 static vector keys;
 static vector handlers;
+/*
+ * keys sorted by string and handlers sorted by fingerprint, for lookups.
+ * The vectors above keep the order in which entries were added, which
+ * determines the output of "help" and of command completion.
+ */
+static vector key_index;
+static vector handler_index;
+static pthread_mutex_t cli_cpu_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Client socket for chunked replies, see flush_reply_chunk() */
+static __thread int reply_stream_fd = -1;
+static __thread bool reply_stream_started;
+static __thread bool subscribe_request;
+static __thread bool reconfigure_wait;
+static __thread unsigned long reconfigure_wait_seq;
 
 static struct key *
 alloc_key (void)
@@ -64,10 +84,29 @@ out:
 	return 1;
 }
 
+/* Index of the first handler in handler_index with fingerprint >= fp */
+static int
+handler_lower_bound (uint64_t fp)
+{
+	int lo = 0, hi = VECTOR_SIZE(handler_index), mid;
+	struct handler *h;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		h = VECTOR_SLOT(handler_index, mid);
+		if (h->fingerprint < fp)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 int
 add_handler (uint64_t fp, int (*fn)(void *, char **, int *, void *))
 {
 	struct handler * h;
+	int i;
 
 	h = alloc_handler();
 
@@ -78,6 +117,13 @@ add_handler (uint64_t fp, int (*fn)(void *, char **, int *, void *))
 		FREE(h);
 		return 1;
 	}
+	/* insert after existing entries with the same fingerprint */
+	i = handler_lower_bound(fp + 1);
+	if (!vector_insert_slot(handler_index, i, h)) {
+		vector_del_slot(handlers, VECTOR_SIZE(handlers) - 1);
+		FREE(h);
+		return 1;
+	}
 
 	vector_set_slot(handlers, h);
 	h->fingerprint = fp;
@@ -89,14 +135,13 @@ add_handler (uint64_t fp, int (*fn)(void *, char **, int *, void *))
 static struct handler *
 find_handler (uint64_t fp)
 {
-	int i;
+	int i = handler_lower_bound(fp);
 	struct handler *h;
 
-	vector_foreach_slot (handlers, h, i)
-		if (h->fingerprint == fp)
-			return h;
-
-	return NULL;
+	if (i >= VECTOR_SIZE(handler_index))
+		return NULL;
+	h = VECTOR_SLOT(handler_index, i);
+	return h->fingerprint == fp ? h : NULL;
 }
 
 int
@@ -107,7 +152,7 @@ set_handler_callback (uint64_t fp, int (*fn)(void *, char **, int *, void *))
 	if (!h)
 		return 1;
 	h->fn = fn;
-	h->locked = 1;
+	h->locked = HANDLER_LOCKED;
 	return 0;
 }
 
@@ -119,10 +164,103 @@ set_unlocked_handler_callback (uint64_t fp,int (*fn)(void *, char **, int *, voi
 	if (!h)
 		return 1;
 	h->fn = fn;
-	h->locked = 0;
+	h->locked = HANDLER_UNLOCKED;
+	return 0;
+}
+
+int
+set_shared_handler_callback (uint64_t fp,int (*fn)(void *, char **, int *, void *))
+{
+	struct handler * h = find_handler(fp);
+
+	if (!h)
+		return 1;
+	h->fn = fn;
+	h->locked = HANDLER_LOCKED_SHARED;
+	return 0;
+}
+
+int
+set_handler_snapshot (uint64_t fp, int snapshot)
+{
+	struct handler * h = find_handler(fp);
+
+	if (!h)
+		return 1;
+	h->snapshot = snapshot;
+	/* the reply is rendered with vecs->lock held shared */
+	h->locked = HANDLER_LOCKED_SHARED;
 	return 0;
 }
 
+void
+set_reply_stream (int fd)
+{
+	reply_stream_fd = fd;
+	reply_stream_started = false;
+	subscribe_request = false;
+	reconfigure_wait = false;
+}
+
+bool
+reply_streamed (void)
+{
+	return reply_stream_started;
+}
+
+void
+request_subscribe (void)
+{
+	subscribe_request = true;
+}
+
+bool
+subscribe_requested (void)
+{
+	return subscribe_request;
+}
+
+void
+request_reconfigure_wait (unsigned long seq)
+{
+	reconfigure_wait = true;
+	reconfigure_wait_seq = seq;
+}
+
+bool
+reconfigure_wait_requested (unsigned long *seq)
+{
+	if (reconfigure_wait)
+		*seq = reconfigure_wait_seq;
+	return reconfigure_wait;
+}
+
+int
+flush_reply_chunk (struct strbuf *reply)
+{
+	int r;
+
+	if (reply_stream_fd < 0 || get_strbuf_len(reply) < REPLY_CHUNK_SIZE)
+		return 0;
+	if (!reply_stream_started) {
+		r = send_chunked_header(reply_stream_fd);
+		if (r != 0)
+			goto fail;
+		reply_stream_started = true;
+	}
+	r = send_packet(reply_stream_fd, get_strbuf_str(reply));
+	if (r != 0)
+		goto fail;
+	truncate_strbuf(reply, 0);
+	return 1;
+fail:
+	condlog(3, "cli[%d]: failed to send reply chunk: %s",
+		reply_stream_fd, strerror(-r));
+	/* don't try again, the caller will drop the client */
+	reply_stream_fd = -1;
+	return r;
+}
+
 static void
 free_key (struct key * kw)
 {
@@ -158,6 +296,42 @@ free_handlers (void)
 
 	vector_free(handlers);
 	handlers = NULL;
+	vector_free(handler_index);
+	handler_index = NULL;
+}
+
+static int
+cmp_key_str (const void *a, const void *b)
+{
+	const struct key *ka = *(const struct key * const *)a;
+	const struct key *kb = *(const struct key * const *)b;
+
+	return strcmp(ka->str, kb->str);
+}
+
+static int
+build_key_index (void)
+{
+	int i;
+	struct key *kw;
+
+	key_index = vector_alloc();
+	if (!key_index || !vector_reserve(key_index, VECTOR_SIZE(keys)))
+		return 1;
+	vector_foreach_slot (keys, kw, i) {
+		vector_alloc_slot(key_index);
+		vector_set_slot(key_index, kw);
+	}
+	qsort(key_index->slot, VECTOR_SIZE(key_index),
+	      sizeof(key_index->slot[0]), cmp_key_str);
+	return 0;
+}
+
+static void
+free_key_index (void)
+{
+	vector_free(key_index);
+	key_index = NULL;
 }
 
 int
@@ -218,113 +392,127 @@ load_keys (void)
 	r += add_key(keys, "local", LOCAL, 0);
 	r += add_key(keys, "setmarginal", SETMARGINAL, 0);
 	r += add_key(keys, "unsetmarginal", UNSETMARGINAL, 0);
-
-
-	if (r) {
+	r += add_key(keys, "all", ALL, 0);
+	r += add_key(keys, "subscribe", SUBSCRIBE, 0);
+	r += add_key(keys, "events", EVENTS, 0);
+	r += add_key(keys, "metrics", METRICS, 0);
+	r += add_key(keys, "locks", LOCKS, 0);
+	r += add_key(keys, "since", SINCE, 1);
+	r += add_key(keys, "record", RECORD, 0);
+	r += add_key(keys, "stop", STOP, 0);
+	r += add_key(keys, "uevents", UEVENTS, 0);
+	r += add_key(keys, "file", FILENAME, 1);
+	r += add_key(keys, "wait", WAIT, 0);
+	r += add_key(keys, "history", HISTORY, 0);
+	r += add_key(keys, "filter", FILTER, 1);
+	r += add_key(keys, "fields", FIELDS, 1);
+	r += add_key(keys, "memory", MEMORY, 0);
+	r += add_key(keys, "find_multipaths", FINDMP, 0);
+	r += add_key(keys, "wwid", WWID, 1);
+	r += add_key(keys, "timeout", TIMEOUT, 1);
+
+
+	if (r || build_key_index()) {
+		free_key_index();
 		free_keys(keys);
 		keys = NULL;
 		return 1;
 	}
+	vector_shrink_to_fit(keys);
 	return 0;
 }
 
+/*
+ * Binary search in key_index. An exact match sorts before all other
+ * keywords starting with str. A prefix of more than one keyword is
+ * ambiguous.
+ */
 static struct key *
 find_key (const char * str)
 {
-	int i;
-	int len, klen;
-	struct key * kw = NULL;
-	struct key * foundkw = NULL;
-
-	len = strlen(str);
+	int lo = 0, hi = VECTOR_SIZE(key_index), mid;
+	size_t len = strlen(str);
+	struct key * kw;
 
-	vector_foreach_slot (keys, kw, i) {
-		if (strncmp(kw->str, str, len))
-			continue;
-		klen = strlen(kw->str);
-		if (len == klen)
-			return kw; /* exact match */
-		if (len < klen) {
-			if (!foundkw)
-				foundkw = kw; /* shortcut match */
-			else
-				return NULL; /* ambiguous word */
-		}
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		kw = VECTOR_SLOT(key_index, mid);
+		if (strcmp(kw->str, str) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	return foundkw;
+	if (lo >= VECTOR_SIZE(key_index))
+		return NULL;
+	kw = VECTOR_SLOT(key_index, lo);
+	if (strncmp(kw->str, str, len))
+		return NULL;
+	if (kw->str[len] == '\0')
+		return kw; /* exact match */
+	if (lo + 1 < VECTOR_SIZE(key_index) &&
+	    !strncmp(((struct key *)VECTOR_SLOT(key_index, lo + 1))->str,
+		     str, len))
+		return NULL; /* ambiguous word */
+	return kw; /* shortcut match */
 }
 
 /*
  * get_cmdvec
  *
+ * The keys of the command vector and their parameters are allocated
+ * from the arena, and are valid until it's released.
+ *
  * returns:
  * ENOMEM: not enough memory to allocate command
  * EAGAIN: command not found
  * EINVAL: argument missing for command
  */
 static int
-get_cmdvec (char * cmd, vector *v)
+get_cmdvec (char * cmd, vector *v, struct arena *arena)
 {
 	int i;
-	int r = 0;
 	int get_param = 0;
 	char * buff;
 	struct key * kw = NULL;
 	struct key * cmdkw = NULL;
 	vector cmdvec, strvec;
 
-	strvec = alloc_strvec(cmd);
+	*v = NULL;
+	strvec = alloc_strvec_arena(cmd, arena);
 	if (!strvec)
 		return ENOMEM;
 
-	cmdvec = vector_alloc();
-
-	if (!cmdvec) {
-		free_strvec(strvec);
+	cmdvec = arena_vector(arena, VECTOR_SIZE(strvec));
+	if (!cmdvec)
 		return ENOMEM;
-	}
 
 	vector_foreach_slot(strvec, buff, i) {
 		if (is_quote(buff))
 			continue;
 		if (get_param) {
 			get_param = 0;
-			cmdkw->param = strdup(buff);
+			/* the token lives in the arena, too */
+			cmdkw->param = buff;
 			continue;
 		}
 		kw = find_key(buff);
-		if (!kw) {
-			r = EAGAIN;
-			goto out;
-		}
-		cmdkw = alloc_key();
-		if (!cmdkw) {
-			r = ENOMEM;
-			goto out;
-		}
-		if (!vector_alloc_slot(cmdvec)) {
-			FREE(cmdkw);
-			r = ENOMEM;
-			goto out;
-		}
+		if (!kw)
+			return EAGAIN;
+		cmdkw = arena_alloc(arena, sizeof(*cmdkw));
+		if (!cmdkw)
+			return ENOMEM;
+		/* can't fail, there's a slot for every token */
+		vector_alloc_slot(cmdvec);
 		vector_set_slot(cmdvec, cmdkw);
 		cmdkw->code = kw->code;
 		cmdkw->has_param = kw->has_param;
 		if (kw->has_param)
 			get_param = 1;
 	}
-	if (get_param) {
-		r = EINVAL;
-		goto out;
-	}
 	*v = cmdvec;
-	free_strvec(strvec);
+	if (get_param)
+		return EINVAL;
 	return 0;
-
-out:
-	free_strvec(strvec);
-	free_keys(cmdvec);
-	return r;
 }
 
 static uint64_t
@@ -347,9 +535,14 @@ int
 alloc_handlers (void)
 {
 	handlers = vector_alloc();
+	handler_index = vector_alloc();
 
-	if (!handlers)
+	if (!handlers || !handler_index) {
+		vector_free(handlers);
+		vector_free(handler_index);
+		handlers = handler_index = NULL;
 		return 1;
+	}
 
 	return 0;
 }
@@ -431,6 +624,79 @@ genhelp_handler (const char *cmd, int error)
 	return steal_strbuf_str(&reply);
 }
 
+int
+cmd_handler_lock (char * cmd)
+{
+	struct handler * h;
+	vector cmdvec = NULL;
+	ARENA_ON_STACK(arena, 1024);
+
+	if (get_cmdvec(cmd, &cmdvec, &arena))
+		return HANDLER_UNLOCKED;
+	h = find_handler(fingerprint(cmdvec));
+	return h && h->fn ? h->locked : HANDLER_UNLOCKED;
+}
+
+static unsigned long long thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void account_cli_cpu(struct handler *h, unsigned long long start)
+{
+	unsigned long long end = thread_cpu_ns();
+
+	pthread_mutex_lock(&cli_cpu_lock);
+	h->calls++;
+	if (start && end > start)
+		h->cpu_ns += end - start;
+	pthread_mutex_unlock(&cli_cpu_lock);
+}
+
+/* The command of a fingerprint, with the first name of each key */
+static void fingerprint_cmd(uint64_t fp, char *buf, size_t len)
+{
+	STRBUF_ON_STACK(cmd);
+	struct key *kw;
+	int i;
+
+	vector_foreach_slot (keys, kw, i) {
+		if (!(kw->code & fp))
+			continue;
+		fp -= kw->code;
+		if (print_strbuf(&cmd, "%s%s", get_strbuf_len(&cmd) ? " " : "",
+				 kw->str) < 0)
+			break;
+	}
+	strlcpy(buf, get_strbuf_str(&cmd) ? : "", len);
+}
+
+int get_cli_cpu_stats(struct cli_cpu_stats **st)
+{
+	struct handler *h;
+	int i, n = 0;
+
+	*st = calloc(VECTOR_SIZE(handlers) ? : 1, sizeof(**st));
+	if (!*st)
+		return -1;
+	pthread_mutex_lock(&cli_cpu_lock);
+	vector_foreach_slot (handlers, h, i) {
+		if (!h->calls)
+			continue;
+		(*st)[n].calls = h->calls;
+		(*st)[n].cpu_ns = h->cpu_ns;
+		fingerprint_cmd(h->fingerprint, (*st)[n].cmd,
+				sizeof((*st)[n].cmd));
+		n++;
+	}
+	pthread_mutex_unlock(&cli_cpu_lock);
+	return n;
+}
+
 int
 parse_cmd (char * cmd, char ** reply, int * len, void * data, int timeout )
 {
@@ -438,8 +704,10 @@ parse_cmd (char * cmd, char ** reply, int * len, void * data, int timeout )
 	struct handler * h;
 	vector cmdvec = NULL;
 	struct timespec tmo;
+	unsigned long long cpu_start;
+	ARENA_ON_STACK(arena, 1024);
 
-	r = get_cmdvec(cmd, &cmdvec);
+	r = get_cmdvec(cmd, &cmdvec, &arena);
 
 	if (r) {
 		*reply = genhelp_handler(cmd, r);
@@ -452,7 +720,6 @@ parse_cmd (char * cmd, char ** reply, int * len, void * data, int timeout )
 	h = find_handler(fingerprint(cmdvec));
 
 	if (!h || !h->fn) {
-		free_keys(cmdvec);
 		*reply = genhelp_handler(cmd, EINVAL);
 		if (*reply == NULL)
 			return EINVAL;
@@ -460,20 +727,33 @@ parse_cmd (char * cmd, char ** reply, int * len, void * data, int timeout )
 		return 0;
 	}
 
+	if (h->snapshot &&
+	    get_snapshot_reply((struct vectors *)data, h->snapshot,
+			       reply, len) == 0)
+		return 0;
+
 	/*
 	 * execute handler
 	 */
+	cpu_start = thread_cpu_ns();
 	if (clock_gettime(CLOCK_REALTIME, &tmo) == 0) {
 		tmo.tv_sec += timeout;
 	} else {
 		tmo.tv_sec = 0;
 	}
-	if (h->locked) {
+	if (h->locked != HANDLER_UNLOCKED) {
 		int locked = 0;
 		struct vectors * vecs = (struct vectors *)data;
 
 		pthread_cleanup_push(cleanup_lock, &vecs->lock);
-		if (tmo.tv_sec) {
+		if (h->locked == HANDLER_LOCKED_SHARED) {
+			if (tmo.tv_sec)
+				r = timedlock_shared(&vecs->lock, &tmo);
+			else {
+				lock_shared(&vecs->lock);
+				r = 0;
+			}
+		} else if (tmo.tv_sec) {
 			r = timedlock(&vecs->lock, &tmo);
 		} else {
 			lock(&vecs->lock);
@@ -482,13 +762,20 @@ parse_cmd (char * cmd, char ** reply, int * len, void * data, int timeout )
 		if (r == 0) {
 			locked = 1;
 			pthread_testcancel();
-			r = h->fn(cmdvec, reply, len, data);
+			if (h->snapshot)
+				r = render_topology_snapshot(vecs, h->snapshot,
+							     reply, len);
+			else
+				r = h->fn(cmdvec, reply, len, data);
+			/* the client must see what its command did */
+			if (h->locked == HANDLER_LOCKED)
+				topology_changed();
 		}
 		pthread_cleanup_pop(locked);
 	} else
 		r = h->fn(cmdvec, reply, len, data);
-	free_keys(cmdvec);
 
+	account_cli_cpu(h, cpu_start);
 	return r;
 }
 
@@ -516,9 +803,23 @@ cli_init (void) {
 	add_handler(LIST+PATHS, NULL);
 	add_handler(LIST+PATHS+FMT, NULL);
 	add_handler(LIST+PATHS+RAW+FMT, NULL);
+	add_handler(LIST+PATHS+FILTER, NULL);
+	add_handler(LIST+PATHS+FILTER+FMT, NULL);
+	add_handler(LIST+PATHS+FILTER+RAW+FMT, NULL);
+	add_handler(LIST+PATHS+JSON, NULL);
+	add_handler(LIST+PATHS+FILTER+JSON, NULL);
+	add_handler(LIST+PATHS+JSON+FIELDS, NULL);
+	add_handler(LIST+PATHS+FILTER+JSON+FIELDS, NULL);
 	add_handler(LIST+PATH, NULL);
+	add_handler(LIST+PATH+HISTORY, NULL);
 	add_handler(LIST+STATUS, NULL);
 	add_handler(LIST+DAEMON, NULL);
+	add_handler(LIST+DAEMON+STATS, NULL);
+	add_handler(LIST+DAEMON+STATS+JSON, NULL);
+	add_handler(LIST+DAEMON+MEMORY, NULL);
+	add_handler(FINDMP+PATH+WWID+TIMEOUT, NULL);
+	add_handler(LIST+METRICS, NULL);
+	add_handler(LIST+LOCKS, NULL);
 	add_handler(LIST+MAPS, NULL);
 	add_handler(LIST+MAPS+STATUS, NULL);
 	add_handler(LIST+MAPS+STATS, NULL);
@@ -526,8 +827,14 @@ cli_init (void) {
 	add_handler(LIST+MAPS+RAW+FMT, NULL);
 	add_handler(LIST+MAPS+TOPOLOGY, NULL);
 	add_handler(LIST+MAPS+JSON, NULL);
+	add_handler(LIST+MAPS+FILTER, NULL);
+	add_handler(LIST+MAPS+FILTER+FMT, NULL);
+	add_handler(LIST+MAPS+FILTER+RAW+FMT, NULL);
+	add_handler(LIST+MAPS+FILTER+JSON, NULL);
+	add_handler(LIST+MAPS+SINCE+JSON, NULL);
 	add_handler(LIST+TOPOLOGY, NULL);
 	add_handler(LIST+MAP+TOPOLOGY, NULL);
+	add_handler(LIST+MAP+PATHS, NULL);
 	add_handler(LIST+MAP+JSON, NULL);
 	add_handler(LIST+MAP+FMT, NULL);
 	add_handler(LIST+MAP+RAW+FMT, NULL);
@@ -538,6 +845,10 @@ cli_init (void) {
 	add_handler(LIST+WILDCARDS, NULL);
 	add_handler(RESET+MAPS+STATS, NULL);
 	add_handler(RESET+MAP+STATS, NULL);
+	add_handler(RESET+DAEMON+STATS, NULL);
+	add_handler(RESET+LOCKS, NULL);
+	add_handler(RECORD+UEVENTS+FILENAME, NULL);
+	add_handler(STOP+RECORD+UEVENTS, NULL);
 	add_handler(ADD+PATH, NULL);
 	add_handler(DEL+PATH, NULL);
 	add_handler(ADD+MAP, NULL);
@@ -545,6 +856,9 @@ cli_init (void) {
 	add_handler(DEL+MAPS, NULL);
 	add_handler(SWITCH+MAP+GROUP, NULL);
 	add_handler(RECONFIGURE, NULL);
+	add_handler(RECONFIGURE+ALL, NULL);
+	add_handler(RECONFIGURE+WAIT, NULL);
+	add_handler(RECONFIGURE+ALL+WAIT, NULL);
 	add_handler(SUSPEND+MAP, NULL);
 	add_handler(RESUME+MAP, NULL);
 	add_handler(RESIZE+MAP, NULL);
@@ -569,6 +883,7 @@ cli_init (void) {
 	add_handler(SETMARGINAL+PATH, NULL);
 	add_handler(UNSETMARGINAL+PATH, NULL);
 	add_handler(UNSETMARGINAL+MAP, NULL);
+	add_handler(SUBSCRIBE+EVENTS, NULL);
 
 	return 0;
 }
@@ -576,6 +891,7 @@ cli_init (void) {
 void cli_exit(void)
 {
 	free_handlers();
+	free_key_index();
 	free_keys(keys);
 	keys = NULL;
 }
@@ -607,23 +923,9 @@ key_generator (const char * str, int state)
 		has_param = 0;
 		rlfp = 0;
 		len = strlen(str);
-		int r = get_cmdvec(rl_line_buffer, &v);
-		/*
-		 * If a word completion is in progress, we don't want
-		 * to take an exact keyword match in the fingerprint.
-		 * For ex "show map[tab]" would validate "map" and discard
-		 * "maps" as a valid candidate.
-		 */
-		if (v && len)
-			vector_del_slot(v, VECTOR_SIZE(v) - 1);
-		/*
-		 * Clean up the mess if we dropped the last slot of a 1-slot
-		 * vector
-		 */
-		if (v && !VECTOR_SIZE(v)) {
-			vector_free(v);
-			v = NULL;
-		}
+		ARENA_ON_STACK(arena, 1024);
+		int r = get_cmdvec(rl_line_buffer, &v, &arena);
+
 		/*
 		 * If last keyword takes a param, don't even try to guess
 		 */
@@ -633,11 +935,20 @@ key_generator (const char * str, int state)
 		}
 		/*
 		 * Compute a command fingerprint to find out possible completions.
-		 * Once done, the vector is useless. Free it.
+		 * Once done, the vector is useless; it's released with
+		 * the arena.
 		 */
-		if (v) {
+		if (r == 0) {
 			rlfp = fingerprint(v);
-			free_keys(v);
+			/*
+			 * If a word completion is in progress, we don't want
+			 * to take an exact keyword match in the fingerprint.
+			 * For ex "show map[tab]" would validate "map" and
+			 * discard "maps" as a valid candidate.
+			 */
+			kw = VECTOR_LAST_SLOT(v);
+			if (kw && len)
+				rlfp -= kw->code;
 		}
 	}
 	/*
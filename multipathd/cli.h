@@ -2,6 +2,7 @@
 #define _CLI_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 
 enum {
 	__LIST,
@@ -47,6 +48,24 @@ enum {
 	__LOCAL,
 	__SETMARGINAL,
 	__UNSETMARGINAL,
+	__ALL,
+	__SUBSCRIBE,
+	__EVENTS,
+	__METRICS,
+	__LOCKS,
+	__SINCE,
+	__RECORD,
+	__STOP,
+	__UEVENTS,
+	__FILENAME,
+	__WAIT,
+	__HISTORY,
+	__FILTER,
+	__FIELDS,
+	__MEMORY,
+	__FINDMP,
+	__WWID,
+	__TIMEOUT,
 };
 
 #define LIST		(1 << __LIST)
@@ -93,6 +112,24 @@ enum {
 #define LOCAL		(1ULL << __LOCAL)
 #define SETMARGINAL	(1ULL << __SETMARGINAL)
 #define UNSETMARGINAL	(1ULL << __UNSETMARGINAL)
+#define ALL		(1ULL << __ALL)
+#define SUBSCRIBE	(1ULL << __SUBSCRIBE)
+#define EVENTS		(1ULL << __EVENTS)
+#define METRICS		(1ULL << __METRICS)
+#define LOCKS		(1ULL << __LOCKS)
+#define SINCE		(1ULL << __SINCE)
+#define RECORD		(1ULL << __RECORD)
+#define STOP		(1ULL << __STOP)
+#define UEVENTS		(1ULL << __UEVENTS)
+#define FILENAME	(1ULL << __FILENAME)
+#define WAIT		(1ULL << __WAIT)
+#define HISTORY		(1ULL << __HISTORY)
+#define FILTER		(1ULL << __FILTER)
+#define FIELDS		(1ULL << __FIELDS)
+#define MEMORY		(1ULL << __MEMORY)
+#define FINDMP		(1ULL << __FINDMP)
+#define WWID		(1ULL << __WWID)
+#define TIMEOUT		(1ULL << __TIMEOUT)
 
 #define INITIAL_REPLY_LEN	1200
 
@@ -124,17 +161,83 @@ struct key {
 	int has_param;
 };
 
+/* How parse_cmd() takes vecs->lock for a handler */
+enum handler_lock {
+	HANDLER_UNLOCKED = 0,
+	HANDLER_LOCKED,
+	/* handler doesn't modify vecs, and may run with the lock shared */
+	HANDLER_LOCKED_SHARED,
+};
+
 struct handler {
 	uint64_t fingerprint;
 	int locked;
+	/* if set, reply from the topology snapshot, see snapshot.h */
+	int snapshot;
 	int (*fn)(void *, char **, int *, void *);
+	/* protected by cli_cpu_lock, see get_cli_cpu_stats() */
+	unsigned long calls;
+	unsigned long long cpu_ns;
 };
 
 int alloc_handlers (void);
 int add_handler (uint64_t fp, int (*fn)(void *, char **, int *, void *));
 int set_handler_callback (uint64_t fp, int (*fn)(void *, char **, int *, void *));
 int set_unlocked_handler_callback (uint64_t fp, int (*fn)(void *, char **, int *, void *));
+int set_shared_handler_callback (uint64_t fp, int (*fn)(void *, char **, int *, void *));
+int set_handler_snapshot (uint64_t fp, int snapshot);
 int parse_cmd (char * cmd, char ** reply, int * len, void *, int);
+/*
+ * The enum handler_lock value of the handler parse_cmd() would run for
+ * cmd. Invalid commands only get a help text, and are HANDLER_UNLOCKED.
+ */
+int cmd_handler_lock (char * cmd);
+
+/*
+ * The number of times each command has been run, and the CPU time of
+ * the thread that ran it, from CLOCK_THREAD_CPUTIME_ID. Replies from
+ * the topology snapshot aren't counted. Returns the number of commands
+ * that have been run, and an array of them in *st, which the caller
+ * must free, or -1 on error.
+ */
+struct cli_cpu_stats {
+	char cmd[64];
+	unsigned long calls;
+	unsigned long long cpu_ns;
+};
+int get_cli_cpu_stats(struct cli_cpu_stats **st);
+
+/*
+ * Chunked replies. While parse_cmd() runs a handler for a client that
+ * accepts chunked replies (set_reply_stream(fd) has been called in the
+ * calling thread), handlers that render large replies may pass their
+ * strbuf to flush_reply_chunk() after every item. Once the buffer holds
+ * REPLY_CHUNK_SIZE bytes, it is sent to the client and emptied.
+ * If reply_streamed() is true after parse_cmd(), the caller must send the
+ * rest of the reply as the last chunk and end the chunked reply.
+ * flush_reply_chunk() returns 1 if it sent a chunk, 0 if not, and
+ * a negative error code if sending failed.
+ */
+#define REPLY_CHUNK_SIZE (64 * 1024)
+struct strbuf;
+void set_reply_stream(int fd);
+bool reply_streamed(void);
+int flush_reply_chunk(struct strbuf *reply);
+
+/*
+ * Set by the "subscribe events" handler. The caller of parse_cmd() turns
+ * the client connection into an event feed subscription if
+ * subscribe_requested() returns true.
+ */
+void request_subscribe(void);
+bool subscribe_requested(void);
+/*
+ * Set by the "reconfigure wait" handlers. The caller of parse_cmd() holds
+ * back the reply until reconfigure_completed(seq) if
+ * reconfigure_wait_requested() returns true.
+ */
+void request_reconfigure_wait(unsigned long seq);
+bool reconfigure_wait_requested(unsigned long *seq);
 int load_keys (void);
 char * get_keyparam (vector v, uint64_t code);
 void free_keys (vector vec);
@@ -0,0 +1,210 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpath_cmd.h"
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "checkers.h"
+#include "lock.h"
+#include "debug.h"
+#include "strbuf.h"
+#include "cli_binary.h"
+
+bool is_bin_request(const char *req, size_t len)
+{
+	struct mpath_bin_hdr hdr;
+
+	if (len < 1 + sizeof(hdr) || req[0] != '\0')
+		return false;
+	memcpy(&hdr, req + 1, sizeof(hdr));
+	return hdr.magic == MPATH_BIN_MAGIC;
+}
+
+static int append_tlv(struct strbuf *buf, unsigned int type,
+		      const void *val, size_t len)
+{
+	struct mpath_tlv tlv = { .type = type, .len = len, };
+	size_t pad = MPATH_TLV_ALIGN(len) - len;
+	int r;
+
+	if (len > UINT16_MAX)
+		return -ERANGE;
+	if ((r = __append_strbuf_str(buf, (const char *)&tlv,
+				     sizeof(tlv))) < 0 ||
+	    (len && (r = __append_strbuf_str(buf, val, len)) < 0) ||
+	    (pad && (r = fill_strbuf(buf, '\0', pad)) < 0))
+		return r;
+	return 0;
+}
+
+static int append_tlv_str(struct strbuf *buf, unsigned int type,
+			  const char *str)
+{
+	return append_tlv(buf, type, str, strlen(str) + 1);
+}
+
+static int append_tlv_u32(struct strbuf *buf, unsigned int type,
+			  uint32_t val)
+{
+	return append_tlv(buf, type, &val, sizeof(val));
+}
+
+static uint32_t bin_chk_state(int state)
+{
+	switch (state) {
+	case PATH_UNCHECKED:
+		return MPATH_CHK_UNCHECKED;
+	case PATH_DOWN:
+		return MPATH_CHK_DOWN;
+	case PATH_UP:
+		return MPATH_CHK_UP;
+	case PATH_SHAKY:
+		return MPATH_CHK_SHAKY;
+	case PATH_GHOST:
+		return MPATH_CHK_GHOST;
+	case PATH_PENDING:
+		return MPATH_CHK_PENDING;
+	case PATH_TIMEOUT:
+		return MPATH_CHK_TIMEOUT;
+	case PATH_REMOVED:
+		return MPATH_CHK_REMOVED;
+	case PATH_DELAYED:
+		return MPATH_CHK_DELAYED;
+	default:
+		return MPATH_CHK_WILD;
+	}
+}
+
+static uint32_t bin_dm_state(int dmstate)
+{
+	switch (dmstate) {
+	case PSTATE_FAILED:
+		return MPATH_DM_FAILED;
+	case PSTATE_ACTIVE:
+		return MPATH_DM_ACTIVE;
+	default:
+		return MPATH_DM_UNDEF;
+	}
+}
+
+static int append_map(struct strbuf *buf, struct strbuf *rec,
+		      const struct multipath *mpp)
+{
+	int r;
+
+	truncate_strbuf(rec, 0);
+	if ((r = append_tlv_str(rec, MPATH_TLV_NAME, mpp->alias)) < 0 ||
+	    (r = append_tlv_str(rec, MPATH_TLV_WWID, mpp->wwid)) < 0 ||
+	    (r = append_tlv_u32(rec, MPATH_TLV_NR_PATHS,
+				VECTOR_SIZE(mpp->paths))) < 0 ||
+	    (r = append_tlv_u32(rec, MPATH_TLV_NR_ACTIVE,
+				count_active_paths(mpp))) < 0)
+		return r;
+	return append_tlv(buf, MPATH_TLV_MAP, get_strbuf_str(rec),
+			  get_strbuf_len(rec));
+}
+
+static int append_path(struct strbuf *buf, struct strbuf *rec,
+		       const struct path *pp)
+{
+	int r;
+
+	truncate_strbuf(rec, 0);
+	if ((r = append_tlv_str(rec, MPATH_TLV_NAME, pp->dev)) < 0 ||
+	    (r = append_tlv_str(rec, MPATH_TLV_DEV_T, pp->dev_t)) < 0 ||
+	    (r = append_tlv_str(rec, MPATH_TLV_WWID, pp->wwid)) < 0 ||
+	    (pp->mpp && pp->mpp->alias &&
+	     (r = append_tlv_str(rec, MPATH_TLV_MAP_NAME,
+				 pp->mpp->alias)) < 0) ||
+	    (r = append_tlv_u32(rec, MPATH_TLV_CHK_STATE,
+				bin_chk_state(pp->state))) < 0 ||
+	    (r = append_tlv_u32(rec, MPATH_TLV_DM_STATE,
+				bin_dm_state(pp->dmstate))) < 0 ||
+	    (r = append_tlv_u32(rec, MPATH_TLV_PRIO,
+				(uint32_t)pp->priority)) < 0)
+		return r;
+	return append_tlv(buf, MPATH_TLV_PATH, get_strbuf_str(rec),
+			  get_strbuf_len(rec));
+}
+
+int append_bin_records(struct strbuf *buf, unsigned int opcode,
+		       const struct vectors *vecs)
+{
+	STRBUF_ON_STACK(rec);
+	struct multipath *mpp;
+	struct path *pp;
+	int i, r = 0;
+
+	switch (opcode) {
+	case MPATH_OP_LIST_MAPS:
+		vector_foreach_slot(vecs->mpvec, mpp, i)
+			if ((r = append_map(buf, &rec, mpp)) < 0)
+				break;
+		break;
+	case MPATH_OP_LIST_PATHS:
+		vector_foreach_slot(vecs->pathvec, pp, i)
+			if ((r = append_path(buf, &rec, pp)) < 0)
+				break;
+		break;
+	default:
+		r = -EOPNOTSUPP;
+		break;
+	}
+	return r;
+}
+
+static int append_records(struct strbuf *buf, unsigned int opcode,
+			  struct vectors *vecs)
+{
+	int r;
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock_shared(&vecs->lock);
+	pthread_testcancel();
+	r = append_bin_records(buf, opcode, vecs);
+	pthread_cleanup_pop(1);
+	return r;
+}
+
+void handle_bin_request(const char *req, size_t len, char **reply,
+			size_t *rlen, struct vectors *vecs)
+{
+	STRBUF_ON_STACK(buf);
+	struct mpath_bin_hdr hdr;
+	int r;
+
+	*reply = NULL;
+	*rlen = 0;
+	memcpy(&hdr, req + 1, sizeof(hdr));
+	condlog(4, "binary request version %u opcode %u", hdr.version,
+		hdr.opcode);
+
+	/* the header is filled in below */
+	if (fill_strbuf(&buf, '\0', sizeof(hdr)) < 0)
+		return;
+	if (len != 1 + sizeof(hdr) || hdr.version != MPATH_BIN_VERSION ||
+	    hdr.len != 0)
+		r = -EINVAL;
+	else
+		r = append_records(&buf, hdr.opcode, vecs);
+	if (r < 0) {
+		if (r == -ENOMEM)
+			return;
+		truncate_strbuf(&buf, sizeof(hdr));
+	}
+
+	hdr.version = MPATH_BIN_VERSION;
+	hdr.status = r < 0 ? r : 0;
+	hdr.len = get_strbuf_len(&buf) - sizeof(hdr);
+	/* include the terminating NUL, see mpath_recv_reply_data() */
+	*rlen = get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	if (*reply)
+		memcpy(*reply, &hdr, sizeof(hdr));
+}
@@ -0,0 +1,34 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _CLI_BINARY_H
+#define _CLI_BINARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct vectors;
+struct strbuf;
+
+/*
+ * Binary queries, see MPATH_BIN_MAGIC in mpath_cmd.h.
+ * is_bin_request() tells whether a packet received from a client is a
+ * binary request rather than a text command.
+ */
+bool is_bin_request(const char *req, size_t len);
+
+/*
+ * Build the reply for a binary request. Errors are reported in the status
+ * field of the reply. On allocation failure, *reply is NULL.
+ */
+void handle_bin_request(const char *req, size_t len, char **reply,
+			size_t *rlen, struct vectors *vecs);
+
+/*
+ * Append the records of the binary reply for opcode to buf.
+ * Must be called with vecs->lock held. Returns 0 or a negative error code.
+ */
+int append_bin_records(struct strbuf *buf, unsigned int opcode,
+		       const struct vectors *vecs);
+
+#endif /* _CLI_BINARY_H */
@@ -16,6 +16,7 @@
 #include "configure.h"
 #include "blacklist.h"
 #include "debug.h"
+#include "log.h"
 #include "dm-generic.h"
 #include "print.h"
 #include "sysfs.h"
@@ -32,6 +33,15 @@
 #include "foreign.h"
 #include "strbuf.h"
 #include "cli_handlers.h"
+#include "check_sched.h"
+#include "snapshot.h"
+#include "loop_stats.h"
+#include "metrics.h"
+#include "map_gen.h"
+#include "switchgroup.h"
+#include "thread_settings.h"
+#include "reply_cache.h"
+#include "smart_wait.h"
 
 #define SET_REPLY_AND_LEN(__rep, __len, string_literal)			\
 	do {								\
@@ -39,35 +49,263 @@
 		*(__len) = *(__rep) ? sizeof(string_literal) : 0;	\
 	} while (0)
 
-int
-show_paths (char ** r, int * len, struct vectors * vecs, char * style,
-	    int pretty)
+/*
+ * The predicates of the "filter" keyword, a comma separated list of
+ * key=value terms. An object is shown if all terms match. The keys are
+ * "state", "dmstate", "map", "host", "target", and the field names of
+ * "show paths json".
+ */
+#define MAX_FILTER_TERMS 8
+
+struct cli_filter {
+	/* copy of the keyword parameter, which the terms point into */
+	char *buf;
+	int n_terms;
+	struct {
+		const char *key;
+		const char *value;
+	} term[MAX_FILTER_TERMS];
+};
+
+static void free_filter(struct cli_filter *f)
+{
+	free(f->buf);
+	f->buf = NULL;
+}
+
+static int parse_filter(const char *param, struct cli_filter *f)
+{
+	char *str, *val, *save = NULL;
+	uint64_t mask;
+
+	f->n_terms = 0;
+	f->buf = strdup(param);
+	if (!f->buf)
+		return 1;
+	for (str = strtok_r(f->buf, ",", &save); str;
+	     str = strtok_r(NULL, ",", &save)) {
+		val = strchr(str, '=');
+		if (!val || val == str || f->n_terms == MAX_FILTER_TERMS)
+			goto invalid;
+		*val++ = '\0';
+		if (strcmp(str, "state") && strcmp(str, "dmstate") &&
+		    strcmp(str, "map") && strcmp(str, "host") &&
+		    strcmp(str, "target") && json_path_field_mask(str, &mask))
+			goto invalid;
+		f->term[f->n_terms].key = str;
+		f->term[f->n_terms].value = val;
+		f->n_terms++;
+	}
+	if (f->n_terms > 0)
+		return 0;
+invalid:
+	condlog(0, "invalid filter: %s", param);
+	free_filter(f);
+	return 1;
+}
+
+static bool path_field_is(const struct path *pp, const char *name,
+			  const char *value)
 {
-	STRBUF_ON_STACK(reply);
+	STRBUF_ON_STACK(buf);
+
+	return snprint_path_field(&buf, pp, name) >= 0 &&
+		!strcmp(get_strbuf_str(&buf), value);
+}
+
+static bool path_term_matches(const struct path *pp, const char *key,
+			      const char *value)
+{
+	int host, channel, target;
+	char *eptr;
+
+	if (!strcmp(key, "state"))
+		/* both the "chk_st" and the checker state names */
+		return !strcmp(value, checker_state_name(pp->state)) ||
+			path_field_is(pp, "chk_st", value);
+	if (!strcmp(key, "dmstate"))
+		return path_field_is(pp, "dm_st", value);
+	if (!strcmp(key, "map"))
+		return pp->mpp && (!strcmp(value, pp->mpp->wwid) ||
+				   (pp->mpp->alias &&
+				    !strcmp(value, pp->mpp->alias)));
+	if (!strcmp(key, "host")) {
+		/* SCSI host number, or FC port name or adapter of the host */
+		host = strtol(value + (strncmp(value, "host", 4) ? 0 : 4),
+			      &eptr, 10);
+		if (*value && *eptr == '\0' && host >= 0)
+			return pp->bus == SYSFS_BUS_SCSI &&
+				pp->sg_id.host_no == host;
+		return path_field_is(pp, "host_wwpn", value) ||
+			path_field_is(pp, "host_adapter", value);
+	}
+	if (!strcmp(key, "target")) {
+		/* SCSI host:channel:target, or FC port name of the target */
+		if (sscanf(value, "%d:%d:%d", &host, &channel, &target) == 3)
+			return pp->bus == SYSFS_BUS_SCSI &&
+				pp->sg_id.host_no == host &&
+				pp->sg_id.channel == channel &&
+				pp->sg_id.scsi_id == target;
+		return path_field_is(pp, "target_wwpn", value);
+	}
+	return path_field_is(pp, key, value);
+}
+
+static bool path_matches(const struct path *pp, const struct cli_filter *f)
+{
+	int i;
+
+	for (i = 0; i < f->n_terms; i++)
+		if (!path_term_matches(pp, f->term[i].key, f->term[i].value))
+			return false;
+	return true;
+}
+
+/*
+ * Maps match by name or WWID with "map", and by their own dm state,
+ * "active" or "suspend", with "dmstate". The terms for paths match if
+ * they all match one of the paths of the map.
+ */
+static bool map_matches(const struct multipath *mpp,
+			const struct cli_filter *f)
+{
+	struct path *pp;
+	bool path_terms = false;
 	int i;
+
+	for (i = 0; i < f->n_terms; i++) {
+		const char *key = f->term[i].key, *value = f->term[i].value;
+
+		if (!strcmp(key, "map")) {
+			if (strcmp(value, mpp->wwid) &&
+			    (!mpp->alias || strcmp(value, mpp->alias)))
+				return false;
+		} else if (!strcmp(key, "dmstate")) {
+			if (strcmp(value, mpp->dmi && mpp->dmi->suspended ?
+				   "suspend" : "active"))
+				return false;
+		} else
+			path_terms = true;
+	}
+	if (!path_terms)
+		return true;
+
+	vector_foreach_slot(mpp->paths, pp, i) {
+		int j;
+
+		for (j = 0; j < f->n_terms; j++) {
+			const char *key = f->term[j].key;
+
+			if (strcmp(key, "map") && strcmp(key, "dmstate") &&
+			    !path_term_matches(pp, key, f->term[j].value))
+				break;
+		}
+		if (j == f->n_terms)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * The paths that match f, or all paths if f is NULL. The vector only
+ * holds references, free it with vector_free().
+ */
+static vector filter_paths(const struct _vector *pathvec,
+			   const struct cli_filter *f)
+{
+	vector v = vector_alloc();
+	struct path *pp;
+	int i;
+
+	if (!v)
+		return NULL;
+	vector_foreach_slot(pathvec, pp, i) {
+		if (f && !path_matches(pp, f))
+			continue;
+		if (!vector_alloc_slot(v)) {
+			vector_free(v);
+			return NULL;
+		}
+		vector_set_slot(v, pp);
+	}
+	return v;
+}
+
+/* Foreign paths are only printed if all paths are shown */
+static int
+_show_paths (char ** r, int * len, vector pathvec, char * style,
+	     int pretty, bool foreign)
+{
+	STRBUF_ON_STACK(reply);
+	int i, flushed, ret = 1;
 	struct path * pp;
+	struct print_fmt *pf;
+	fieldwidth_t *width __attribute__((cleanup(cleanup_free_ptr))) = NULL;
 	int hdr_len = 0;
+	bool streamed = false;
 
-	get_path_layout(vecs->pathvec, 1);
-	foreign_path_layout();
+	if (pretty) {
+		if (!(width = alloc_path_layout()))
+			return 1;
+		get_path_layout_fmt(pathvec, 1, style, width);
+		if (foreign)
+			foreign_path_layout(width);
+	}
 
-	if (pretty && (hdr_len = snprint_path_header(&reply, style)) < 0)
+	pf = compile_path_fmt(style);
+	if (!pf)
 		return 1;
 
-	vector_foreach_slot(vecs->pathvec, pp, i) {
-		if (snprint_path(&reply, style, pp, pretty) < 0)
-			return 1;
+	if (pretty && (hdr_len = snprint_path_header(&reply, style,
+						     width)) < 0)
+		goto out;
+
+	vector_foreach_slot(pathvec, pp, i) {
+		if (snprint_path_fmt(&reply, pf, pp, width) < 0)
+			goto out;
+		if ((flushed = flush_reply_chunk(&reply)) < 0)
+			goto out;
+		streamed = streamed || flushed;
 	}
-	if (snprint_foreign_paths(&reply, style, pretty) < 0)
-		return 1;
+	if (foreign && snprint_foreign_paths(&reply, style, width) < 0)
+		goto out;
 
-	if (pretty && get_strbuf_len(&reply) == (size_t)hdr_len)
+	if (pretty && !streamed && get_strbuf_len(&reply) == (size_t)hdr_len)
 		/* No output - clear header */
 		truncate_strbuf(&reply, 0);
 
 	*len = (int)get_strbuf_len(&reply) + 1;
 	*r = steal_strbuf_str(&reply);
-	return 0;
+	ret = 0;
+out:
+	free_print_fmt(pf);
+	return ret;
+}
+
+int
+show_paths (char ** r, int * len, struct vectors * vecs, char * style,
+	    int pretty)
+{
+	return _show_paths(r, len, vecs->pathvec, style, pretty, true);
+}
+
+static int
+show_paths_filtered (char ** r, int * len, struct vectors * vecs,
+		     char * style, int pretty, const char * param)
+{
+	struct cli_filter f;
+	vector paths;
+	int ret;
+
+	if (parse_filter(param, &f))
+		return 1;
+	paths = filter_paths(vecs->pathvec, &f);
+	free_filter(&f);
+	if (!paths)
+		return 1;
+	ret = _show_paths(r, len, paths, style, pretty, false);
+	vector_free(paths);
+	return ret;
 }
 
 int
@@ -76,8 +314,7 @@ show_path (char ** r, int * len, struct vectors * vecs, struct path *pp,
 {
 	STRBUF_ON_STACK(reply);
 
-	get_path_layout(vecs->pathvec, 1);
-	if (snprint_path(&reply, style, pp, 0) < 0)
+	if (snprint_path(&reply, style, pp, NULL) < 0)
 		return 1;
 	*len = (int)get_strbuf_len(&reply) + 1;
 	*r = steal_strbuf_str(&reply);
@@ -90,11 +327,15 @@ show_map_topology (char ** r, int * len, struct multipath * mpp,
 		   struct vectors * vecs)
 {
 	STRBUF_ON_STACK(reply);
+	fieldwidth_t *p_width __attribute__((cleanup(cleanup_free_ptr))) = NULL;
 
+	if (!(p_width = alloc_path_layout()))
+		return 1;
 	if (update_multipath(vecs, mpp->alias, 0))
 		return 1;
 
-	if (snprint_multipath_topology(&reply, mpp, 2) < 0)
+	get_path_layout_fmt(vecs->pathvec, 0, PRINT_PATH_INDENT, p_width);
+	if (snprint_multipath_topology(&reply, mpp, 2, p_width) < 0)
 		return 1;
 	*len = (int)get_strbuf_len(&reply) + 1;
 	*r = steal_strbuf_str(&reply);
@@ -102,25 +343,36 @@ show_map_topology (char ** r, int * len, struct multipath * mpp,
 	return 0;
 }
 
-int
-show_maps_topology (char ** r, int * len, struct vectors * vecs)
+/*
+ * The _show_maps*() functions only print the current state of the maps
+ * if refresh is 0, and can be used to render topology snapshots.
+ */
+static int
+_show_maps_topology (char ** r, int * len, struct vectors * vecs,
+		     int refresh)
 {
 	STRBUF_ON_STACK(reply);
 	int i;
 	struct multipath * mpp;
+	fieldwidth_t *p_width __attribute__((cleanup(cleanup_free_ptr))) = NULL;
 
-	get_path_layout(vecs->pathvec, 0);
-	foreign_path_layout();
+	if (!(p_width = alloc_path_layout()))
+		return 1;
+	get_path_layout_fmt(vecs->pathvec, 0, PRINT_PATH_INDENT, p_width);
+	foreign_path_layout(p_width);
 
+	if (reserve_topology_strbuf(&reply, vecs, false) < 0)
+		return 1;
 	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if (update_multipath(vecs, mpp->alias, 0)) {
+		if (refresh && update_multipath(vecs, mpp->alias, 0)) {
 			i--;
 			continue;
 		}
-		if (snprint_multipath_topology(&reply, mpp, 2) < 0)
+		if (snprint_multipath_topology(&reply, mpp, 2, p_width) < 0 ||
+		    flush_reply_chunk(&reply) < 0)
 			return 1;
 	}
-	if (snprint_foreign_topology(&reply, 2) < 0)
+	if (snprint_foreign_topology(&reply, 2, p_width) < 0)
 		return 1;
 
 	*len = (int)get_strbuf_len(&reply) + 1;
@@ -129,14 +381,20 @@ show_maps_topology (char ** r, int * len, struct vectors * vecs)
 }
 
 int
-show_maps_json (char ** r, int * len, struct vectors * vecs)
+show_maps_topology (char ** r, int * len, struct vectors * vecs)
+{
+	return _show_maps_topology(r, len, vecs, 1);
+}
+
+static int
+_show_maps_json (char ** r, int * len, struct vectors * vecs, int refresh)
 {
 	STRBUF_ON_STACK(reply);
 	int i;
 	struct multipath * mpp;
 
 	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if (update_multipath(vecs, mpp->alias, 0)) {
+		if (refresh && update_multipath(vecs, mpp->alias, 0)) {
 			return 1;
 		}
 	}
@@ -149,6 +407,12 @@ show_maps_json (char ** r, int * len, struct vectors * vecs)
 	return 0;
 }
 
+int
+show_maps_json (char ** r, int * len, struct vectors * vecs)
+{
+	return _show_maps_json(r, len, vecs, 1);
+}
+
 int
 show_map_json (char ** r, int * len, struct multipath * mpp,
 		   struct vectors * vecs)
@@ -171,11 +435,20 @@ show_config (char ** r, int * len, const struct _vector *hwtable,
 	     const struct _vector *mpvec)
 {
 	struct config *conf;
-	char *reply;
+	char *reply = NULL;
+	/* "show config local" depends on the paths and maps */
+	bool cache = !hwtable && !mpvec;
 
 	conf = get_multipath_config();
 	pthread_cleanup_push(put_multipath_config, conf);
-	reply = snprint_config(conf, len, hwtable, mpvec);
+	if (!cache ||
+	    get_cached_reply(REPLY_CACHE_CONFIG, conf->sequence_nr, &reply,
+			     len) != 0) {
+		reply = snprint_config(conf, len, hwtable, mpvec);
+		if (cache && reply)
+			set_cached_reply(REPLY_CACHE_CONFIG, conf->sequence_nr,
+					 0, reply, *len);
+	}
 	pthread_cleanup_pop(1);
 	if (reply == NULL)
 		return 1;
@@ -255,6 +528,66 @@ cli_list_paths_raw (void * v, char ** reply, int * len, void * data)
 	return show_paths(reply, len, vecs, fmt, 0);
 }
 
+int
+cli_list_paths_filter (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, FILTER);
+	char * fmt = get_keyparam(v, FMT);
+
+	condlog(3, "list paths filter %s (operator)", param);
+
+	return show_paths_filtered(reply, len, vecs,
+				   fmt ? fmt : PRINT_PATH_CHECKER, 1, param);
+}
+
+int
+cli_list_paths_filter_raw (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, FILTER);
+	char * fmt = get_keyparam(v, FMT);
+
+	condlog(3, "list paths filter %s (operator)", param);
+
+	return show_paths_filtered(reply, len, vecs, fmt, 0, param);
+}
+
+int
+cli_list_paths_json (void * v, char ** reply, int * len, void * data)
+{
+	STRBUF_ON_STACK(buf);
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, FILTER);
+	char * names = get_keyparam(v, FIELDS);
+	uint64_t fields = JSON_PATH_FIELDS_ALL;
+	struct cli_filter f;
+	vector paths;
+	int rc;
+
+	condlog(3, "list paths json (operator)");
+
+	if (names && json_path_field_mask(names, &fields)) {
+		condlog(0, "invalid fields: %s", names);
+		return 1;
+	}
+	if (param && parse_filter(param, &f))
+		return 1;
+	paths = filter_paths(vecs->pathvec, param ? &f : NULL);
+	if (param)
+		free_filter(&f);
+	if (!paths)
+		return 1;
+	rc = snprint_paths_json(&buf, paths, fields);
+	vector_free(paths);
+	if (rc < 0)
+		return 1;
+
+	*len = (int)get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	return 0;
+}
+
 int
 cli_list_path (void * v, char ** reply, int * len, void * data)
 {
@@ -272,6 +605,28 @@ cli_list_path (void * v, char ** reply, int * len, void * data)
 	return show_path(reply, len, vecs, pp, "%o");
 }
 
+int
+cli_list_path_history (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, PATH);
+	struct path *pp;
+	STRBUF_ON_STACK(buf);
+
+	param = convert_dev(param, 1);
+	condlog(3, "%s: list path history (operator)", param);
+
+	pp = find_path_by_dev(vecs->pathvec, param);
+	if (!pp)
+		return 1;
+
+	if (snprint_path_history(&buf, pp) < 0)
+		return 1;
+	*len = get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	return 0;
+}
+
 int
 cli_list_map_topology (void * v, char ** reply, int * len, void * data)
 {
@@ -280,7 +635,6 @@ cli_list_map_topology (void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
 	if (!mpp)
@@ -309,8 +663,9 @@ cli_list_map_json (void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
+	if (!mpp)
+		mpp = find_mp_by_wwid(vecs->mpvec, param);
 
 	if (!mpp)
 		return 1;
@@ -330,6 +685,37 @@ cli_list_maps_json (void * v, char ** reply, int * len, void * data)
 	return show_maps_json(reply, len, vecs);
 }
 
+int
+cli_list_maps_since_json (void * v, char ** reply, int * len, void * data)
+{
+	STRBUF_ON_STACK(buf);
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, SINCE);
+	struct multipath * mpp;
+	unsigned long long since;
+	char *eptr;
+	int i;
+
+	since = strtoull(param, &eptr, 10);
+	if (*param == '\0' || *eptr != '\0') {
+		condlog(0, "invalid generation: %s", param);
+		return 1;
+	}
+	condlog(3, "list multipaths since %llu json (operator)", since);
+
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		if (update_multipath(vecs, mpp->alias, 0))
+			return 1;
+	}
+	if (reserve_topology_strbuf(&buf, vecs, true) < 0 ||
+	    snprint_maps_since_json(&buf, vecs, since) < 0)
+		return 1;
+
+	*len = (int)get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	return 0;
+}
+
 int
 cli_list_wildcards (void * v, char ** reply, int * len, void * data)
 {
@@ -344,11 +730,11 @@ cli_list_wildcards (void * v, char ** reply, int * len, void * data)
 }
 
 int
-show_status (char ** r, int *len, struct vectors * vecs)
+show_status (char ** r, int *len)
 {
 	STRBUF_ON_STACK(reply);
 
-	if (snprint_status(&reply, vecs) < 0)
+	if (snprint_status(&reply) < 0)
 		return 1;
 
 	*len = get_strbuf_len(&reply) + 1;
@@ -356,13 +742,71 @@ show_status (char ** r, int *len, struct vectors * vecs)
 	return 0;
 }
 
+static int
+snprint_daemon_cpu(struct strbuf *reply)
+{
+	struct thread_cpu_stats ts[16];
+	struct cli_cpu_stats *cs;
+	int i, n, rc = 0;
+
+	n = get_thread_cpu_stats(ts, ARRAY_SIZE(ts));
+	for (i = 0; i < n && rc >= 0; i++)
+		rc = print_strbuf(reply, "thread %s cpu %llu.%03llu s wakeups %lu preempted %lu\n",
+				  ts[i].name, ts[i].cpu_ns / 1000000000ULL,
+				  ts[i].cpu_ns % 1000000000ULL / 1000000,
+				  ts[i].wakeups, ts[i].preempted);
+	if (rc < 0)
+		return rc;
+
+	n = get_cli_cpu_stats(&cs);
+	for (i = 0; i < n && rc >= 0; i++)
+		rc = print_strbuf(reply, "command \"%s\" calls %lu cpu %llu.%03llu s\n",
+				  cs[i].cmd, cs[i].calls,
+				  cs[i].cpu_ns / 1000000000ULL,
+				  cs[i].cpu_ns % 1000000000ULL / 1000000);
+	if (n >= 0)
+		free(cs);
+	return rc;
+}
+
 int
 show_daemon (char ** r, int *len)
 {
 	STRBUF_ON_STACK(reply);
+	struct uevent_stats st;
+	struct log_stats lst;
 
+	uevent_get_stats(&st);
+	log_get_stats(&lst);
 	if (print_strbuf(&reply, "pid %d %s\n",
-			 daemon_pid, daemon_status()) < 0)
+			 daemon_pid, daemon_status()) < 0 ||
+	    snprint_configure_progress(&reply) < 0 ||
+	    print_strbuf(&reply, "uevent batches %lu uevents %lu merged %lu filtered %lu\n",
+			 st.batches, st.events, st.merged, st.filtered) < 0 ||
+	    print_strbuf(&reply, "last uevent batch %u window %u ms cost %lu us/uevent\n",
+			 st.last_batch, st.last_window, st.cost_us) < 0 ||
+	    print_strbuf(&reply, "uevent queue %u max %u discarded %lu merge ratio %lu%%\n",
+			 st.queued, st.max_queued, st.discarded,
+			 st.events ? st.merged * 100 / st.events : 0) < 0 ||
+	    print_strbuf(&reply, "uevent receive buffer %u KiB overruns %lu resyncs %lu\n",
+			 st.rcvbuf / 1024, st.overruns, st.resyncs) < 0 ||
+	    snprint_uevent_lag(&reply) < 0 ||
+	    print_strbuf(&reply, "log messages %lu dropped %lu\n",
+			 lst.messages, lst.dropped) < 0 ||
+	    snprint_daemon_cpu(&reply) < 0)
+		return 1;
+
+	*len = get_strbuf_len(&reply) + 1;
+	*r = steal_strbuf_str(&reply);
+	return 0;
+}
+
+static int
+show_daemon_stats (char ** r, int *len, bool json)
+{
+	STRBUF_ON_STACK(reply);
+
+	if (snprint_loop_stats(&reply, json) < 0)
 		return 1;
 
 	*len = get_strbuf_len(&reply) + 1;
@@ -372,11 +816,11 @@ show_daemon (char ** r, int *len)
 
 int
 show_map (char ** r, int *len, struct multipath * mpp, char * style,
-	  int pretty)
+	  const fieldwidth_t *width)
 {
 	STRBUF_ON_STACK(reply);
 
-	if (snprint_multipath(&reply, style, mpp, pretty) < 0)
+	if (snprint_multipath(&reply, style, mpp, width) < 0)
 		return 1;
 
 	*len = get_strbuf_len(&reply) + 1;
@@ -384,39 +828,98 @@ show_map (char ** r, int *len, struct multipath * mpp, char * style,
 	return 0;
 }
 
-int
-show_maps (char ** r, int *len, struct vectors * vecs, char * style,
-	   int pretty)
+/* If f is set, only the maps matching it are shown, and no foreign maps */
+static int
+_show_maps (char ** r, int *len, struct vectors * vecs, char * style,
+	    int pretty, int refresh, const struct cli_filter *f)
 {
 	STRBUF_ON_STACK(reply);
-	int i;
+	int i, flushed, ret = 1;
 	struct multipath * mpp;
+	struct print_fmt *pf;
+	fieldwidth_t *width __attribute__((cleanup(cleanup_free_ptr))) = NULL;
 	int hdr_len = 0;
+	bool streamed = false;
 
-	get_multipath_layout(vecs->mpvec, 1);
-	foreign_multipath_layout();
+	if (pretty) {
+		if (!(width = alloc_multipath_layout()))
+			return 1;
+		get_multipath_layout_fmt(vecs->mpvec, 1, style, width);
+		foreign_multipath_layout(width);
+	}
 
-	if (pretty && (hdr_len = snprint_multipath_header(&reply, style)) < 0)
+	pf = compile_multipath_fmt(style);
+	if (!pf)
 		return 1;
 
+	if (pretty && (hdr_len = snprint_multipath_header(&reply, style,
+							  width)) < 0)
+		goto out;
+
 	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if (update_multipath(vecs, mpp->alias, 0)) {
+		if (refresh && update_multipath(vecs, mpp->alias, 0)) {
 			i--;
 			continue;
 		}
-		if (snprint_multipath(&reply, style, mpp, pretty) < 0)
-			return 1;
+		if (f && !map_matches(mpp, f))
+			continue;
+		if (snprint_multipath_fmt(&reply, pf, mpp, width) < 0)
+			goto out;
+		if ((flushed = flush_reply_chunk(&reply)) < 0)
+			goto out;
+		streamed = streamed || flushed;
 	}
-	if (snprint_foreign_multipaths(&reply, style, pretty) < 0)
-		return 1;
+	if (!f && snprint_foreign_multipaths(&reply, style, width) < 0)
+		goto out;
 
-	if (pretty && get_strbuf_len(&reply) == (size_t)hdr_len)
+	if (pretty && !streamed && get_strbuf_len(&reply) == (size_t)hdr_len)
 		/* No output - clear header */
 		truncate_strbuf(&reply, 0);
 
 	*len = (int)get_strbuf_len(&reply) + 1;
 	*r = steal_strbuf_str(&reply);
-	return 0;
+	ret = 0;
+out:
+	free_print_fmt(pf);
+	return ret;
+}
+
+int
+show_maps (char ** r, int *len, struct vectors * vecs, char * style,
+	   int pretty)
+{
+	return _show_maps(r, len, vecs, style, pretty, 1, NULL);
+}
+
+static int
+show_maps_filtered (char ** r, int *len, struct vectors * vecs, char * style,
+		    int pretty, const char * param)
+{
+	struct cli_filter f;
+	int ret;
+
+	if (parse_filter(param, &f))
+		return 1;
+	ret = _show_maps(r, len, vecs, style, pretty, 1, &f);
+	free_filter(&f);
+	return ret;
+}
+
+int
+render_snapshot_reply (int id, char ** r, int * len, struct vectors * vecs)
+{
+	switch (id) {
+	case SNAPSHOT_PATHS:
+		return show_paths(r, len, vecs, PRINT_PATH_CHECKER, 1);
+	case SNAPSHOT_MAPS:
+		return _show_maps(r, len, vecs, PRINT_MAP_NAMES, 1, 0, NULL);
+	case SNAPSHOT_TOPOLOGY:
+		return _show_maps_topology(r, len, vecs, 0);
+	case SNAPSHOT_MAPS_JSON:
+		return _show_maps_json(r, len, vecs, 0);
+	default:
+		return 1;
+	}
 }
 
 int
@@ -441,6 +944,72 @@ cli_list_maps_raw (void * v, char ** reply, int * len, void * data)
 	return show_maps(reply, len, vecs, fmt, 0);
 }
 
+int
+cli_list_maps_filter (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, FILTER);
+	char * fmt = get_keyparam(v, FMT);
+
+	condlog(3, "list maps filter %s (operator)", param);
+
+	return show_maps_filtered(reply, len, vecs,
+				  fmt ? fmt : PRINT_MAP_NAMES, 1, param);
+}
+
+int
+cli_list_maps_filter_raw (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, FILTER);
+	char * fmt = get_keyparam(v, FMT);
+
+	condlog(3, "list maps filter %s (operator)", param);
+
+	return show_maps_filtered(reply, len, vecs, fmt, 0, param);
+}
+
+int
+cli_list_maps_filter_json (void * v, char ** reply, int * len, void * data)
+{
+	STRBUF_ON_STACK(buf);
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, FILTER);
+	struct cli_filter f;
+	struct multipath * mpp;
+	vector maps;
+	int i, rc = 1;
+
+	condlog(3, "list multipaths filter %s json (operator)", param);
+
+	if (parse_filter(param, &f))
+		return 1;
+	maps = vector_alloc();
+	if (!maps)
+		goto out;
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		if (update_multipath(vecs, mpp->alias, 0)) {
+			i--;
+			continue;
+		}
+		if (!map_matches(mpp, &f))
+			continue;
+		if (!vector_alloc_slot(maps))
+			goto out;
+		vector_set_slot(maps, mpp);
+	}
+	if (snprint_multipath_list_json(&buf, maps) < 0)
+		goto out;
+
+	*len = (int)get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	rc = 0;
+out:
+	vector_free(maps);
+	free_filter(&f);
+	return rc;
+}
+
 int
 cli_list_map_fmt (void * v, char ** reply, int * len, void * data)
 {
@@ -448,17 +1017,56 @@ cli_list_map_fmt (void * v, char ** reply, int * len, void * data)
 	struct vectors * vecs = (struct vectors *)data;
 	char * param = get_keyparam(v, MAP);
 	char * fmt = get_keyparam(v, FMT);
+	fieldwidth_t *width __attribute__((cleanup(cleanup_free_ptr))) = NULL;
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
-	get_multipath_layout(vecs->mpvec, 1);
+	if (!(width = alloc_multipath_layout()))
+		return 1;
+	get_multipath_layout_fmt(vecs->mpvec, 1, fmt, width);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 	if (!mpp)
 		return 1;
 
 	condlog(3, "list map %s fmt %s (operator)", param, fmt);
 
-	return show_map(reply, len, mpp, fmt, 1);
+	return show_map(reply, len, mpp, fmt, width);
+}
+
+/*
+ * The alias of the map, then the usable paths, in path group order, one
+ * per line. libmpathpersist sends PR IN commands through these.
+ */
+int
+cli_list_map_paths (void * v, char ** reply, int * len, void * data)
+{
+	struct multipath * mpp;
+	struct vectors * vecs = (struct vectors *)data;
+	char * param = get_keyparam(v, MAP);
+	STRBUF_ON_STACK(buf);
+	struct pathgroup *pgp;
+	struct path *pp;
+	int i, j;
+
+	param = convert_dev(param, 0);
+	mpp = find_mp_by_str(vecs->mpvec, param);
+	if (!mpp)
+		return 1;
+
+	condlog(4, "list map %s paths (operator)", param);
+
+	if (print_strbuf(&buf, "%s\n", mpp->alias) < 0)
+		return 1;
+	vector_foreach_slot (mpp->pg, pgp, i) {
+		vector_foreach_slot (pgp->paths, pp, j) {
+			if (pp->state != PATH_UP && pp->state != PATH_GHOST)
+				continue;
+			if (print_strbuf(&buf, "%s\n", pp->dev) < 0)
+				return 1;
+		}
+	}
+	*len = (int)get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	return 0;
 }
 
 int
@@ -470,15 +1078,13 @@ cli_list_map_raw (void * v, char ** reply, int * len, void * data)
 	char * fmt = get_keyparam(v, FMT);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
-	get_multipath_layout(vecs->mpvec, 1);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 	if (!mpp)
 		return 1;
 
 	condlog(3, "list map %s fmt %s (operator)", param, fmt);
 
-	return show_map(reply, len, mpp, fmt, 0);
+	return show_map(reply, len, mpp, fmt, NULL);
 }
 
 int
@@ -494,11 +1100,9 @@ cli_list_maps (void * v, char ** reply, int * len, void * data)
 int
 cli_list_status (void * v, char ** reply, int * len, void * data)
 {
-	struct vectors * vecs = (struct vectors *)data;
-
 	condlog(3, "list status (operator)");
 
-	return show_status(reply, len, vecs);
+	return show_status(reply, len);
 }
 
 int
@@ -529,6 +1133,140 @@ cli_list_daemon (void * v, char ** reply, int * len, void * data)
 	return show_daemon(reply, len);
 }
 
+int
+cli_list_daemon_stats (void * v, char ** reply, int * len, void * data)
+{
+	condlog(3, "list daemon stats (operator)");
+
+	return show_daemon_stats(reply, len, false);
+}
+
+int
+cli_list_daemon_stats_json (void * v, char ** reply, int * len, void * data)
+{
+	condlog(3, "list daemon stats json (operator)");
+
+	return show_daemon_stats(reply, len, true);
+}
+
+int
+cli_list_daemon_memory (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	struct log_stats lst;
+	STRBUF_ON_STACK(buf);
+
+	condlog(3, "list daemon memory (operator)");
+
+	log_get_stats(&lst);
+	if (snprint_process_memory(&buf) < 0 ||
+	    print_strbuf(&buf, "%-16s %zu kB\n", "log area",
+			 lst.area_size / 1024) < 0 ||
+	    print_strbuf(&buf, "%-16s %zu kB (%d)\n", "paths",
+			 VECTOR_SIZE(vecs->pathvec) * sizeof(struct path) / 1024,
+			 VECTOR_SIZE(vecs->pathvec)) < 0 ||
+	    print_strbuf(&buf, "%-16s %zu kB (%d)\n\n", "maps",
+			 VECTOR_SIZE(vecs->mpvec) *
+			 sizeof(struct multipath) / 1024,
+			 VECTOR_SIZE(vecs->mpvec)) < 0 ||
+	    snprint_thread_stacks(&buf) < 0)
+		return 1;
+
+	*len = get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	return 0;
+}
+
+int
+cli_list_metrics (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	STRBUF_ON_STACK(buf);
+
+	condlog(4, "list metrics (operator)");
+
+	if (snprint_metrics(&buf, vecs) < 0)
+		return 1;
+
+	*len = get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	return 0;
+}
+
+int
+cli_list_locks (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	STRBUF_ON_STACK(buf);
+
+	condlog(3, "list locks (operator)");
+
+	if (snprint_lock_profile(&buf, "vecs->lock",
+				 get_lock_profile(&vecs->lock)) < 0 ||
+	    append_strbuf_str(&buf, "\n") < 0 ||
+	    snprint_lock_profile(&buf, "config",
+				 get_config_profile()) < 0)
+		return 1;
+
+	*len = get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	return 0;
+}
+
+int
+cli_reset_locks (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+
+	condlog(3, "reset locks (operator)");
+
+	reset_lock_profile(get_lock_profile(&vecs->lock));
+	reset_lock_profile(get_config_profile());
+	return 0;
+}
+
+int
+cli_record_uevents (void * v, char ** reply, int * len, void * data)
+{
+	char * file = get_keyparam(v, FILENAME);
+	int r;
+
+	condlog(3, "record uevents file %s (operator)", file);
+
+	r = uevent_record_start(file);
+	if (r == 0)
+		return 0;
+	condlog(2, "failed to record uevents to %s: %s", file, strerror(-r));
+	return 1;
+}
+
+int
+cli_stop_record_uevents (void * v, char ** reply, int * len, void * data)
+{
+	STRBUF_ON_STACK(buf);
+	long n;
+
+	condlog(3, "stop record uevents (operator)");
+
+	n = uevent_record_stop();
+	if (n < 0)
+		return 1;
+	if (print_strbuf(&buf, "recorded %ld uevents\n", n) < 0)
+		return 1;
+	*len = get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	return 0;
+}
+
+int
+cli_reset_daemon_stats (void * v, char ** reply, int * len, void * data)
+{
+	condlog(3, "reset daemon stats (operator)");
+
+	loop_stats_reset();
+	return 0;
+}
+
 int
 cli_reset_maps_stats (void * v, char ** reply, int * len, void * data)
 {
@@ -608,6 +1346,7 @@ cli_add_path (void * v, char ** reply, int * len, void * data)
 		pp->mpp = NULL;
 		pp->initialized = INIT_NEW;
 		pp->wwid[0] = '\0';
+		pp->wwid_hash = 0;
 		conf = get_multipath_config();
 		pthread_cleanup_push(put_multipath_config, conf);
 		r = pathinfo(pp, conf, DI_ALL | DI_BLACKLIST);
@@ -617,11 +1356,12 @@ cli_add_path (void * v, char ** reply, int * len, void * data)
 			/* Similar logic as in uev_add_path() */
 			pp->mpp = prev_mpp;
 			if (r == PATHINFO_OK &&
-			    !strncmp(prev_mpp->wwid, pp->wwid, WWID_SIZE)) {
+			    same_wwid(prev_mpp->wwid, prev_mpp->wwid_hash,
+				      pp->wwid, pp->wwid_hash)) {
 				condlog(2, "%s: path re-added to %s", pp->dev,
 					pp->mpp->alias);
 				/* Have the checker reinstate this path asap */
-				pp->tick = 1;
+				set_path_tick(pp, 1);
 				return 0;
 			} else if (ev_remove_path(pp, vecs, true) &
 				   REMOVE_PATH_SUCCESS)
@@ -670,6 +1410,7 @@ cli_add_path (void * v, char ** reply, int * len, void * data)
 			condlog(0, "%s: failed to store path info", param);
 			return 1;
 		}
+		schedule_path_check(pp, pp->tick);
 	}
 	return ev_add_path(pp, vecs, 1);
 blacklisted:
@@ -787,6 +1528,11 @@ cli_del_map (void * v, char ** reply, int * len, void * data)
 	return rc;
 }
 
+static void cleanup_partmaps_cache(void *arg __attribute__((unused)))
+{
+	dm_partmaps_cache_end();
+}
+
 int
 cli_del_maps (void *v, char **reply, int *len, void *data)
 {
@@ -795,12 +1541,15 @@ cli_del_maps (void *v, char **reply, int *len, void *data)
 	int i, ret = 0;
 
 	condlog(2, "remove maps (operator)");
+	dm_partmaps_cache_start();
+	pthread_cleanup_push(cleanup_partmaps_cache, NULL);
 	vector_foreach_slot(vecs->mpvec, mpp, i) {
 		if (flush_map(mpp, vecs, 0))
 			ret++;
 		else
 			i--;
 	}
+	pthread_cleanup_pop(1);
 	/* flush any multipath maps that aren't currently known by multipathd */
 	ret |= dm_flush_maps(0, 0);
 	return ret;
@@ -934,6 +1683,7 @@ cli_force_no_daemon_q(void * v, char ** reply, int * len, void * data)
 	if (conf->queue_without_daemon == QUE_NO_DAEMON_OFF)
 		conf->queue_without_daemon = QUE_NO_DAEMON_FORCE;
 	put_multipath_config(conf);
+	drop_cached_reply(REPLY_CACHE_CONFIG);
 	return 0;
 }
 
@@ -947,6 +1697,7 @@ cli_restore_no_daemon_q(void * v, char ** reply, int * len, void * data)
 	if (conf->queue_without_daemon == QUE_NO_DAEMON_FORCE)
 		conf->queue_without_daemon = QUE_NO_DAEMON_OFF;
 	put_multipath_config(conf);
+	drop_cached_reply(REPLY_CACHE_CONFIG);
 	return 0;
 }
 
@@ -1073,23 +1824,51 @@ cli_switch_group(void * v, char ** reply, int * len, void * data)
 	return dm_switchgroup(mapname, groupnum);
 }
 
-int
-cli_reconfigure(void * v, char ** reply, int * len, void * data)
+static int
+__cli_reconfigure(bool reload_all, bool wait)
 {
-	int rc;
+	unsigned long seq;
 
-	condlog(2, "reconfigure (operator)");
-
-	rc = set_config_state(DAEMON_CONFIGURE);
-	if (rc == ETIMEDOUT) {
-		condlog(2, "timeout starting reconfiguration");
-		return 1;
-	} else if (rc == EINVAL)
+	if (schedule_reconfigure(reload_all, &seq) != 0)
 		/* daemon shutting down */
 		return 1;
+	if (wait)
+		request_reconfigure_wait(seq);
 	return 0;
 }
 
+int
+cli_reconfigure(void * v, char ** reply, int * len, void * data)
+{
+	condlog(2, "reconfigure (operator)");
+
+	return __cli_reconfigure(false, false);
+}
+
+int
+cli_reconfigure_all(void * v, char ** reply, int * len, void * data)
+{
+	condlog(2, "reconfigure all (operator)");
+
+	return __cli_reconfigure(true, false);
+}
+
+int
+cli_reconfigure_wait(void * v, char ** reply, int * len, void * data)
+{
+	condlog(2, "reconfigure (operator, waiting)");
+
+	return __cli_reconfigure(false, true);
+}
+
+int
+cli_reconfigure_all_wait(void * v, char ** reply, int * len, void * data)
+{
+	condlog(2, "reconfigure all (operator, waiting)");
+
+	return __cli_reconfigure(true, true);
+}
+
 int
 cli_suspend(void * v, char ** reply, int * len, void * data)
 {
@@ -1237,15 +2016,20 @@ show_blacklist (char ** r, int * len)
 
 	conf = get_multipath_config();
 	pthread_cleanup_push(put_multipath_config, conf);
-	fail = snprint_blacklist_report(conf, &reply) < 0;
+	if (get_cached_reply(REPLY_CACHE_BLACKLIST, conf->sequence_nr, r,
+			     len) == 0)
+		fail = false;
+	else if (!(fail = snprint_blacklist_report(conf, &reply) < 0)) {
+		*len = (int)get_strbuf_len(&reply) + 1;
+		*r = steal_strbuf_str(&reply);
+		fail = !*r;
+		if (!fail)
+			set_cached_reply(REPLY_CACHE_BLACKLIST,
+					 conf->sequence_nr, 0, *r, *len);
+	}
 	pthread_cleanup_pop(1);
 
-	if (fail)
-		return 1;
-
-	*len = (int)get_strbuf_len(&reply) + 1;
-	*r = steal_strbuf_str(&reply);
-	return 0;
+	return fail ? 1 : 0;
 }
 
 int
@@ -1263,18 +2047,25 @@ show_devices (char ** r, int * len, struct vectors *vecs)
 	struct config *conf;
 	bool fail;
 
+	unsigned long dev_gen = get_device_generation();
+
 	conf = get_multipath_config();
 	pthread_cleanup_push(put_multipath_config, conf);
-	fail = snprint_devices(conf, &reply, vecs) < 0;
+	if (get_cached_reply(REPLY_CACHE_DEVICES, conf->sequence_nr, r,
+			     len) == 0)
+		fail = false;
+	else if (!(fail = snprint_devices(conf, &reply, vecs) < 0)) {
+		*len = (int)get_strbuf_len(&reply) + 1;
+		*r = steal_strbuf_str(&reply);
+		fail = !*r;
+		if (!fail)
+			set_cached_reply(REPLY_CACHE_DEVICES,
+					 conf->sequence_nr, dev_gen, *r,
+					 *len);
+	}
 	pthread_cleanup_pop(1);
 
-	if (fail)
-		return 1;
-
-	*len = (int)get_strbuf_len(&reply) + 1;
-	*r = steal_strbuf_str(&reply);
-
-	return 0;
+	return fail ? 1 : 0;
 }
 
 int
@@ -1309,7 +2100,6 @@ cli_getprstatus (void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
 	if (!mpp)
@@ -1334,7 +2124,6 @@ cli_setprstatus(void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
 	if (!mpp)
@@ -1357,7 +2146,6 @@ cli_unsetprstatus(void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
 	if (!mpp)
@@ -1482,6 +2270,7 @@ int cli_set_marginal(void * v, char ** reply, int * len, void * data)
 		return 1;
 	}
 	pp->marginal = 1;
+	invalidate_pg_prios();
 
 	return reload_and_sync_map(pp->mpp, vecs, 0);
 }
@@ -1509,6 +2298,7 @@ int cli_unset_marginal(void * v, char ** reply, int * len, void * data)
 		return 1;
 	}
 	pp->marginal = 0;
+	invalidate_pg_prios();
 
 	return reload_and_sync_map(pp->mpp, vecs, 0);
 }
@@ -1546,6 +2336,64 @@ int cli_unset_all_marginal(void * v, char ** reply, int * len, void * data)
 	vector_foreach_slot (mpp->pg, pgp, i)
 		vector_foreach_slot (pgp->paths, pp, j)
 			pp->marginal = 0;
+	invalidate_pg_prios();
 
 	return reload_and_sync_map(mpp, vecs, 0);
 }
+
+int
+cli_subscribe_events (void * v, char ** reply, int * len, void * data)
+{
+	condlog(3, "subscribe events (operator)");
+	request_subscribe();
+	return 0;
+}
+
+int
+cli_find_multipaths (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	char *dev = get_keyparam(v, PATH);
+	char *wwid = get_keyparam(v, WWID);
+	char *tmo_str = get_keyparam(v, TIMEOUT);
+	struct timespec remaining;
+	struct path *pp;
+	bool claimed;
+	long tmo;
+	char *end;
+	int i, wait;
+	STRBUF_ON_STACK(buf);
+
+	dev = convert_dev(dev, 1);
+	condlog(4, "%s: find_multipaths wwid %s timeout %s", dev, wwid,
+		tmo_str);
+	tmo = strtol(tmo_str, &end, 10);
+	if (!*wwid || *end)
+		return 1;
+
+	/* like multipath -u finding more paths with this WWID */
+	claimed = find_mp_by_wwid(vecs->mpvec, wwid) != NULL;
+	for (i = 0; !claimed && i < VECTOR_SIZE(vecs->pathvec); i++) {
+		pp = VECTOR_SLOT(vecs->pathvec, i);
+		claimed = !strcmp(pp->wwid, wwid) && strcmp(pp->dev, dev);
+	}
+	if (claimed)
+		wait = smart_wait_forget(dev) ? SMART_WAIT_DONE :
+			SMART_WAIT_NEVER;
+	else
+		wait = smart_wait_check(dev, tmo, &remaining);
+
+	if (append_strbuf_str(&buf, claimed ? "valid " : "maybe ") < 0)
+		return 1;
+	if (wait == SMART_WAIT_WAITING) {
+		if (print_strbuf(&buf, "%ld.%06ld\n", (long)remaining.tv_sec,
+				 remaining.tv_nsec / 1000) < 0)
+			return 1;
+	} else if (append_strbuf_str(&buf, wait == SMART_WAIT_DONE ?
+				     "done\n" : "never\n") < 0)
+		return 1;
+
+	*len = get_strbuf_len(&buf) + 1;
+	*reply = steal_strbuf_str(&buf);
+	return 0;
+}
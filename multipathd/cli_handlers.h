@@ -1,20 +1,36 @@
 int cli_list_paths (void * v, char ** reply, int * len, void * data);
 int cli_list_paths_fmt (void * v, char ** reply, int * len, void * data);
 int cli_list_paths_raw (void * v, char ** reply, int * len, void * data);
+int cli_list_paths_filter (void * v, char ** reply, int * len, void * data);
+int cli_list_paths_filter_raw (void * v, char ** reply, int * len,
+			       void * data);
+int cli_list_paths_json (void * v, char ** reply, int * len, void * data);
 int cli_list_path (void * v, char ** reply, int * len, void * data);
+int cli_list_path_history (void * v, char ** reply, int * len, void * data);
 int cli_list_status (void * v, char ** reply, int * len, void * data);
 int cli_list_daemon (void * v, char ** reply, int * len, void * data);
+int cli_list_daemon_stats (void * v, char ** reply, int * len, void * data);
+int cli_list_daemon_memory (void * v, char ** reply, int * len, void * data);
+int cli_list_daemon_stats_json (void * v, char ** reply, int * len,
+				void * data);
 int cli_list_maps (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_fmt (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_raw (void * v, char ** reply, int * len, void * data);
+int cli_list_maps_filter (void * v, char ** reply, int * len, void * data);
+int cli_list_maps_filter_raw (void * v, char ** reply, int * len,
+			      void * data);
+int cli_list_maps_filter_json (void * v, char ** reply, int * len,
+			       void * data);
 int cli_list_map_fmt (void * v, char ** reply, int * len, void * data);
 int cli_list_map_raw (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_status (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_stats (void * v, char ** reply, int * len, void * data);
 int cli_list_map_topology (void * v, char ** reply, int * len, void * data);
+int cli_list_map_paths (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_topology (void * v, char ** reply, int * len, void * data);
 int cli_list_map_json (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_json (void * v, char ** reply, int * len, void * data);
+int cli_list_maps_since_json (void * v, char ** reply, int * len, void * data);
 int cli_list_config (void * v, char ** reply, int * len, void * data);
 int cli_list_config_local (void * v, char ** reply, int * len, void * data);
 int cli_list_blacklist (void * v, char ** reply, int * len, void * data);
@@ -22,6 +38,13 @@ int cli_list_devices (void * v, char ** reply, int * len, void * data);
 int cli_list_wildcards (void * v, char ** reply, int * len, void * data);
 int cli_reset_maps_stats (void * v, char ** reply, int * len, void * data);
 int cli_reset_map_stats (void * v, char ** reply, int * len, void * data);
+int cli_list_metrics (void * v, char ** reply, int * len, void * data);
+int cli_list_locks (void * v, char ** reply, int * len, void * data);
+int cli_reset_locks (void * v, char ** reply, int * len, void * data);
+int cli_record_uevents (void * v, char ** reply, int * len, void * data);
+int cli_stop_record_uevents (void * v, char ** reply, int * len,
+			     void * data);
+int cli_reset_daemon_stats (void * v, char ** reply, int * len, void * data);
 int cli_add_path (void * v, char ** reply, int * len, void * data);
 int cli_del_path (void * v, char ** reply, int * len, void * data);
 int cli_add_map (void * v, char ** reply, int * len, void * data);
@@ -29,6 +52,10 @@ int cli_del_map (void * v, char ** reply, int * len, void * data);
 int cli_del_maps (void * v, char ** reply, int * len, void * data);
 int cli_switch_group(void * v, char ** reply, int * len, void * data);
 int cli_reconfigure(void * v, char ** reply, int * len, void * data);
+int cli_reconfigure_all(void * v, char ** reply, int * len, void * data);
+int cli_reconfigure_wait(void * v, char ** reply, int * len, void * data);
+int cli_reconfigure_all_wait(void * v, char ** reply, int * len,
+			     void * data);
 int cli_resize(void * v, char ** reply, int * len, void * data);
 int cli_reload(void * v, char ** reply, int * len, void * data);
 int cli_disable_queueing(void * v, char ** reply, int * len, void * data);
@@ -53,3 +80,10 @@ int cli_unsetprkey(void * v, char ** reply, int * len, void * data);
 int cli_set_marginal(void * v, char ** reply, int * len, void * data);
 int cli_unset_marginal(void * v, char ** reply, int * len, void * data);
 int cli_unset_all_marginal(void * v, char ** reply, int * len, void * data);
+int cli_subscribe_events(void * v, char ** reply, int * len, void * data);
+int cli_find_multipaths(void * v, char ** reply, int * len, void * data);
+
+struct vectors;
+/* Render the reply for a topology snapshot id, without updating maps */
+int render_snapshot_reply(int id, char ** reply, int * len,
+			  struct vectors * vecs);
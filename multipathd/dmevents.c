@@ -6,7 +6,6 @@
  */
 #include <unistd.h>
 #include <libdevmapper.h>
-#include <sys/mman.h>
 #include <pthread.h>
 #include <urcu.h>
 #include <poll.h>
@@ -25,11 +24,17 @@
 #include "main.h"
 #include "dmevents.h"
 #include "util.h"
+#include "time-util.h"
+#include "loop_stats.h"
+#include "thread_settings.h"
 
 #ifndef DM_DEV_ARM_POLL
 #define DM_DEV_ARM_POLL _IOWR(DM_IOCTL, DM_DEV_SET_GEOMETRY_CMD + 1, struct dm_ioctl)
 #endif
 
+/* seconds between event number scans without DM_DEV_ARM_POLL */
+#define DMEVENT_SCAN_INTERVAL 1
+
 enum event_actions {
 	EVENT_NOTHING,
 	EVENT_REMOVE,
@@ -40,16 +45,27 @@ struct dev_event {
 	char name[WWID_SIZE];
 	uint32_t evt_nr;
 	enum event_actions action;
+	/* chains the events of a bucket in waiter->hash */
+	unsigned int hash;
+	struct dev_event *hnext;
 };
 
+/* Must be a power of 2 */
+#define EVENT_HASH_SIZE 1024
+
 struct dmevent_waiter {
 	int fd;
 	struct vectors *vecs;
 	vector events;
+	/* incremented whenever an element is deleted from events */
+	unsigned int events_gen;
+	/* index of events by device name */
+	struct dev_event *hash[EVENT_HASH_SIZE];
 	pthread_mutex_t events_lock;
 };
 
 static struct dmevent_waiter *waiter;
+static bool use_arm_poll = true;
 /*
  * DM_VERSION_MINOR hasn't been updated when DM_DEV_ARM_POLL
  * was added in kernel 4.13. 4.37.0 (4.14) has it, safely.
@@ -69,6 +85,19 @@ int dmevent_poll_supported(void)
 }
 
 
+/*
+ * Without DM_DEV_ARM_POLL, the waiter thread scans the event numbers of
+ * all watched maps periodically, instead of waiting for events in one
+ * thread per map.
+ */
+void set_dmevent_polling(bool enable)
+{
+	use_arm_poll = enable;
+	if (!enable)
+		condlog(2, "dmevents polling disabled, scanning maps every %ds",
+			DMEVENT_SCAN_INTERVAL);
+}
+
 int init_dmevent_waiter(struct vectors *vecs)
 {
 	if (!vecs) {
@@ -120,6 +149,41 @@ void cleanup_dmevent_waiter(void)
 	waiter = NULL;
 }
 
+/* The functions below must be called with events_lock held */
+static struct dev_event *find_dev_event(const char *name, unsigned int hash)
+{
+	struct dev_event *dev_evt;
+
+	for (dev_evt = waiter->hash[hash & (EVENT_HASH_SIZE - 1)];
+	     dev_evt; dev_evt = dev_evt->hnext)
+		if (dev_evt->hash == hash && !strcmp(dev_evt->name, name))
+			return dev_evt;
+	return NULL;
+}
+
+static void hash_dev_event(struct dev_event *dev_evt)
+{
+	struct dev_event **head =
+		&waiter->hash[dev_evt->hash & (EVENT_HASH_SIZE - 1)];
+
+	dev_evt->hnext = *head;
+	*head = dev_evt;
+}
+
+static void del_dev_event(int i)
+{
+	struct dev_event *dev_evt = VECTOR_SLOT(waiter->events, i);
+	struct dev_event **p =
+		&waiter->hash[dev_evt->hash & (EVENT_HASH_SIZE - 1)];
+
+	while (*p != dev_evt)
+		p = &(*p)->hnext;
+	*p = dev_evt->hnext;
+	vector_del_slot(waiter->events, i);
+	waiter->events_gen++;
+	free(dev_evt);
+}
+
 static int arm_dm_event_poll(int fd)
 {
 	struct dm_ioctl dmi;
@@ -170,22 +234,22 @@ static int dm_get_events(void)
 	while (names->dev) {
 		uint32_t event_nr;
 
+		/* Devices we don't watch, e.g. LVM volumes, are skipped */
+		dev_evt = find_dev_event(names->name, hash_str(names->name));
+		if (!dev_evt)
+			goto next;
+
 		/* Don't delete device if dm_is_mpath() fails without
 		 * checking the device type */
 		if (dm_is_mpath(names->name) == 0)
 			goto next;
 
 		event_nr = dm_event_nr(names);
-		vector_foreach_slot(waiter->events, dev_evt, i) {
-			if (!strcmp(dev_evt->name, names->name)) {
-				if (event_nr != dev_evt->evt_nr) {
-					dev_evt->evt_nr = event_nr;
-					dev_evt->action = EVENT_UPDATE;
-				} else
-					dev_evt->action = EVENT_NOTHING;
-				break;
-			}
-		}
+		if (event_nr != dev_evt->evt_nr) {
+			dev_evt->evt_nr = event_nr;
+			dev_evt->action = EVENT_UPDATE;
+		} else
+			dev_evt->action = EVENT_NOTHING;
 next:
 		if (!names->next)
 			break;
@@ -200,13 +264,34 @@ fail:
 	return -1;
 }
 
+/*
+ * Kernels without DM_DEV_ARM_POLL don't report event numbers in the
+ * DM_DEVICE_LIST output. Query them for every watched map. If that
+ * fails, let update_multipath() find out whether the map is gone.
+ */
+static void dm_scan_events(void)
+{
+	struct dev_event *dev_evt;
+	int i, event_nr;
+
+	pthread_mutex_lock(&waiter->events_lock);
+	vector_foreach_slot(waiter->events, dev_evt, i) {
+		event_nr = dm_geteventnr(dev_evt->name);
+		if (event_nr < 0 || (uint32_t)event_nr != dev_evt->evt_nr) {
+			if (event_nr >= 0)
+				dev_evt->evt_nr = event_nr;
+			dev_evt->action = EVENT_UPDATE;
+		}
+	}
+	pthread_mutex_unlock(&waiter->events_lock);
+}
+
 /* You must call __setup_multipath() after calling this function, to
  * deal with any events that came in before the device was added */
 int watch_dmevents(char *name)
 {
 	int event_nr;
 	struct dev_event *dev_evt, *old_dev_evt;
-	int i;
 
 	/* We know that this is a multipath device, so only fail if
 	 * device-mapper tells us that we're wrong */
@@ -228,19 +313,19 @@ int watch_dmevents(char *name)
 	strlcpy(dev_evt->name, name, WWID_SIZE);
 	dev_evt->evt_nr = event_nr;
 	dev_evt->action = EVENT_NOTHING;
+	dev_evt->hash = hash_str(dev_evt->name);
 
 	pthread_mutex_lock(&waiter->events_lock);
-	vector_foreach_slot(waiter->events, old_dev_evt, i){
-		if (!strcmp(dev_evt->name, old_dev_evt->name)) {
-			/* caller will be updating this device */
-			old_dev_evt->evt_nr = event_nr;
-			old_dev_evt->action = EVENT_NOTHING;
-			pthread_mutex_unlock(&waiter->events_lock);
-			condlog(2, "%s: already waiting for events on device",
-				name);
-			free(dev_evt);
-			return 0;
-		}
+	old_dev_evt = find_dev_event(dev_evt->name, dev_evt->hash);
+	if (old_dev_evt) {
+		/* caller will be updating this device */
+		old_dev_evt->evt_nr = event_nr;
+		old_dev_evt->action = EVENT_NOTHING;
+		pthread_mutex_unlock(&waiter->events_lock);
+		condlog(2, "%s: already waiting for events on device",
+			name);
+		free(dev_evt);
+		return 0;
 	}
 	if (!vector_alloc_slot(waiter->events)) {
 		pthread_mutex_unlock(&waiter->events_lock);
@@ -248,6 +333,7 @@ int watch_dmevents(char *name)
 		return -1;
 	}
 	vector_set_slot(waiter->events, dev_evt);
+	hash_dev_event(dev_evt);
 	pthread_mutex_unlock(&waiter->events_lock);
 	return 0;
 }
@@ -263,6 +349,8 @@ void unwatch_all_dmevents(void)
 	vector_foreach_slot(waiter->events, dev_evt, i)
 		free(dev_evt);
 	vector_reset(waiter->events);
+	memset(waiter->hash, 0, sizeof(waiter->hash));
+	waiter->events_gen++;
 	pthread_mutex_unlock(&waiter->events_lock);
 }
 
@@ -272,48 +360,35 @@ static void unwatch_dmevents(char *name)
 	int i;
 
 	pthread_mutex_lock(&waiter->events_lock);
-	vector_foreach_slot(waiter->events, dev_evt, i) {
-		if (!strcmp(dev_evt->name, name)) {
-			vector_del_slot(waiter->events, i);
-			free(dev_evt);
-			break;
-		}
-	}
+	dev_evt = find_dev_event(name, hash_str(name));
+	if (dev_evt && (i = find_slot(waiter->events, dev_evt)) >= 0)
+		del_dev_event(i);
 	pthread_mutex_unlock(&waiter->events_lock);
 }
 
 /*
- * returns the reschedule delay
- * negative means *stop*
+ * The checker resyncs maps after failing or reinstating paths, and
+ * records the event number it synced at. Events up to that number
+ * are caused by its own messages, and have been taken care of.
  */
-
-/* poll, arm, update, return */
-static int dmevent_loop (void)
+static bool event_already_synced(struct vectors *vecs,
+				 const struct dev_event *dev_evt)
 {
-	int r, i = 0;
-	struct pollfd pfd;
-	struct dev_event *dev_evt;
+	struct multipath *mpp = find_mp_by_alias(vecs->mpvec, dev_evt->name);
 
-	pfd.fd = waiter->fd;
-	pfd.events = POLLIN;
-	r = poll(&pfd, 1, -1);
-	if (r <= 0) {
-		condlog(0, "failed polling for dm events: %s", strerror(errno));
-		/* sleep 1s and hope things get better */
-		return 1;
-	}
+	return mpp && mpp->msgs_evt_nr &&
+		(int32_t)(dev_evt->evt_nr - mpp->msgs_evt_nr) <= 0;
+}
 
-	if (arm_dm_event_poll(waiter->fd) != 0) {
-		condlog(0, "Cannot re-arm event polling: %s", strerror(errno));
-		/* sleep 1s and hope things get better */
-		return 1;
-	}
+static int dmevent_update_maps(void)
+{
+	int r, i = 0, start = 0;
+	unsigned int gen;
+	struct dev_event *dev_evt;
 
-	if (dm_get_events() != 0) {
-		condlog(0, "failed getting dm events: %s", strerror(errno));
-		/* sleep 1s and hope things get better */
-		return 1;
-	}
+	pthread_mutex_lock(&waiter->events_lock);
+	gen = waiter->events_gen;
+	pthread_mutex_unlock(&waiter->events_lock);
 
 	/*
 	 * upon event ...
@@ -323,19 +398,29 @@ static int dmevent_loop (void)
 		int done = 1;
 		struct dev_event curr_dev;
 
+		/*
+		 * Continue the scan of the events vector where we left
+		 * off, unless elements were deleted in the meantime.
+		 */
 		pthread_mutex_lock(&waiter->events_lock);
-		vector_foreach_slot(waiter->events, dev_evt, i) {
+		if (waiter->events_gen != gen)
+			start = 0;
+		for (i = start; i < VECTOR_SIZE(waiter->events); i++) {
+			dev_evt = VECTOR_SLOT(waiter->events, i);
 			if (dev_evt->action != EVENT_NOTHING) {
 				curr_dev = *dev_evt;
 				if (dev_evt->action == EVENT_REMOVE) {
-					vector_del_slot(waiter->events, i);
-					free(dev_evt);
-				} else
+					del_dev_event(i);
+					start = i;
+				} else {
 					dev_evt->action = EVENT_NOTHING;
+					start = i + 1;
+				}
 				done = 0;
 				break;
 			}
 		}
+		gen = waiter->events_gen;
 		pthread_mutex_unlock(&waiter->events_lock);
 		if (done)
 			return 1;
@@ -360,6 +445,9 @@ static int dmevent_loop (void)
 		r = 0;
 		if (curr_dev.action == EVENT_REMOVE)
 			remove_map_by_alias(curr_dev.name, waiter->vecs);
+		else if (event_already_synced(waiter->vecs, &curr_dev))
+			condlog(4, "%s: event #%u already synced",
+				curr_dev.name, curr_dev.evt_nr);
 		else
 			r = update_multipath(waiter->vecs, curr_dev.name, 1);
 		pthread_cleanup_pop(1);
@@ -374,6 +462,71 @@ static int dmevent_loop (void)
 	return -1; /* never reach there */
 }
 
+/*
+ * returns the reschedule delay
+ * negative means *stop*
+ */
+
+static int dmevent_scan_loop(void)
+{
+	struct timespec start;
+
+	get_monotonic_time(&start);
+	dm_scan_events();
+	dmevent_update_maps();
+	loop_stat_since(LOOP_STAT_DMEVENT, &start);
+	return DMEVENT_SCAN_INTERVAL;
+}
+
+int dmevent_fd(void)
+{
+	return waiter && use_arm_poll ? waiter->fd : -1;
+}
+
+int dmevent_dispatch(void)
+{
+	int r;
+	struct timespec start;
+
+	get_monotonic_time(&start);
+
+	if (arm_dm_event_poll(waiter->fd) != 0) {
+		condlog(0, "Cannot re-arm event polling: %s", strerror(errno));
+		/* sleep 1s and hope things get better */
+		return 1;
+	}
+
+	if (dm_get_events() != 0) {
+		condlog(0, "failed getting dm events: %s", strerror(errno));
+		/* sleep 1s and hope things get better */
+		return 1;
+	}
+
+	r = dmevent_update_maps();
+	loop_stat_since(LOOP_STAT_DMEVENT, &start);
+	return r;
+}
+
+/* poll, arm, update, return */
+static int dmevent_loop (void)
+{
+	int r;
+	struct pollfd pfd;
+
+	if (!use_arm_poll)
+		return dmevent_scan_loop();
+
+	pfd.fd = waiter->fd;
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, -1);
+	if (r <= 0) {
+		condlog(0, "failed polling for dm events: %s", strerror(errno));
+		/* sleep 1s and hope things get better */
+		return 1;
+	}
+	return dmevent_dispatch();
+}
+
 static void rcu_unregister(__attribute__((unused)) void *param)
 {
 	rcu_unregister_thread();
@@ -391,9 +544,10 @@ void *wait_dmevents (__attribute__((unused)) void *unused)
 
 	pthread_cleanup_push(rcu_unregister, NULL);
 	rcu_register_thread();
-	mlockall(MCL_CURRENT | MCL_FUTURE);
+	lock_memory();
 
 	while (1) {
+		sample_thread_cpu(THREAD_DMEVENTS);
 		r = dmevent_loop();
 
 		if (r < 0)
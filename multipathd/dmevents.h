@@ -1,13 +1,24 @@
 #ifndef _DMEVENTS_H
 #define _DMEVENTS_H
 
+#include <stdbool.h>
 #include "structs_vec.h"
 
 int dmevent_poll_supported(void);
+void set_dmevent_polling(bool enable);
 int init_dmevent_waiter(struct vectors *vecs);
 void cleanup_dmevent_waiter(void);
 int watch_dmevents(char *name);
 void unwatch_all_dmevents(void);
 void *wait_dmevents (void *unused);
+/*
+ * For running the waiter in another event loop instead of the
+ * wait_dmevents() thread: dmevent_fd() returns the fd to poll for
+ * POLLIN, or -1 if the maps must be scanned periodically. Call
+ * dmevent_dispatch() when it's readable. It returns the delay in seconds
+ * before the fd should be polled again after an error, or 0.
+ */
+int dmevent_fd(void);
+int dmevent_dispatch(void);
 
 #endif /* _DMEVENTS_H */
@@ -0,0 +1,111 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <urcu/uatomic.h>
+
+#include "debug.h"
+#include "strbuf.h"
+#include "feed.h"
+
+/* Must be a power of 2 */
+#define FEED_SLOTS 512
+#define FEED_REC_LEN 128
+
+static pthread_mutex_t feed_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Below variables are protected by feed_lock */
+static char feed_ring[FEED_SLOTS][FEED_REC_LEN];
+static unsigned long feed_head, feed_tail;
+static unsigned long feed_seq, feed_lost;
+
+static int feed_fd = -1;
+static int feed_subscribers;
+
+int feed_init(void)
+{
+	feed_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (feed_fd == -1)
+		condlog(1, "failed to create event feed: %m");
+	return feed_fd;
+}
+
+void feed_exit(void)
+{
+	int fd = feed_fd;
+
+	feed_fd = -1;
+	if (fd != -1)
+		close(fd);
+}
+
+void feed_subscribe(void)
+{
+	uatomic_inc(&feed_subscribers);
+}
+
+void feed_unsubscribe(void)
+{
+	uatomic_dec(&feed_subscribers);
+}
+
+void feed_event(const char *fmt, ...)
+{
+	static const uint64_t one = 1;
+	struct timespec ts;
+	va_list ap;
+	char *rec;
+	bool wake;
+	int fd = feed_fd;
+	int n;
+
+	if (fd == -1 || uatomic_read(&feed_subscribers) == 0)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	pthread_mutex_lock(&feed_lock);
+	if (feed_head - feed_tail >= FEED_SLOTS) {
+		feed_lost++;
+		pthread_mutex_unlock(&feed_lock);
+		return;
+	}
+	rec = feed_ring[feed_head & (FEED_SLOTS - 1)];
+	n = snprintf(rec, FEED_REC_LEN, "%lu %ld.%03ld ", ++feed_seq,
+		     (long)ts.tv_sec, ts.tv_nsec / 1000000);
+	va_start(ap, fmt);
+	vsnprintf(rec + n, FEED_REC_LEN - n, fmt, ap);
+	va_end(ap);
+	/* Only the first record of a batch needs to wake up the listener */
+	wake = (feed_head++ == feed_tail);
+	pthread_mutex_unlock(&feed_lock);
+
+	if (wake && write(fd, &one, sizeof(one)) != sizeof(one))
+		condlog(3, "failed to signal event feed: %m");
+}
+
+int feed_drain(int fd, struct strbuf *buf)
+{
+	uint64_t val;
+	int n = 0;
+
+	if (read(fd, &val, sizeof(val)) < 0)
+		return 0;
+
+	pthread_mutex_lock(&feed_lock);
+	if (feed_lost) {
+		print_strbuf(buf, "lost %lu\n", feed_lost);
+		feed_lost = 0;
+	}
+	for (; feed_tail != feed_head; feed_tail++, n++) {
+		append_strbuf_str(buf, feed_ring[feed_tail & (FEED_SLOTS - 1)]);
+		fill_strbuf(buf, '\n', 1);
+	}
+	pthread_mutex_unlock(&feed_lock);
+	return n;
+}
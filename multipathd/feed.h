@@ -0,0 +1,32 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _FEED_H
+#define _FEED_H
+
+struct strbuf;
+
+/*
+ * Topology change feed for "subscribe events" clients.
+ *
+ * feed_event() queues a one-line record in a bounded ring. It may be
+ * called from any thread, and does nothing if there are no subscribers.
+ * Records have the form "<seq> <sec>.<msec> <event> <args...>", with the
+ * sequence number counting queued records and the time taken from
+ * CLOCK_REALTIME. If the ring overflows, the records that didn't fit are
+ * dropped, and the next batch starts with a "lost <n>" line.
+ *
+ * The fd returned by feed_init() becomes readable when records are
+ * pending. The uxsock listener then calls feed_drain() and sends the
+ * batch to all subscribers.
+ */
+int feed_init(void);
+void feed_exit(void);
+void feed_subscribe(void);
+void feed_unsubscribe(void);
+void feed_event(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+/* Clear the fd, and append all pending records to buf. Returns #records */
+int feed_drain(int fd, struct strbuf *buf);
+
+#endif /* _FEED_H */
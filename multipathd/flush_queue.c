@@ -0,0 +1,216 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <urcu.h>
+
+#include "list.h"
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "devmapper.h"
+#include "thread_settings.h"
+#include "debug.h"
+#include "util.h"
+#include "main.h"
+#include "feed.h"
+#include "flush_queue.h"
+
+struct flush_req {
+	struct list_head node;
+	char alias[WWID_SIZE];
+	char wwid[WWID_SIZE];
+	int deferred_remove;
+	/* dm_flush_map_nopaths() result */
+	int r;
+};
+
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static LIST_HEAD(flush_reqs);
+/* the batch being flushed, only accessed by the flush thread */
+static LIST_HEAD(flush_batch);
+static pthread_t flush_thr;
+static bool flush_thr_started;
+
+bool queue_map_flush(struct multipath *mpp)
+{
+	struct flush_req *req;
+
+	if (!flush_thr_started || !(req = calloc(1, sizeof(*req))))
+		return false;
+	strlcpy(req->alias, mpp->alias, sizeof(req->alias));
+	strlcpy(req->wwid, mpp->wwid, sizeof(req->wwid));
+	req->deferred_remove = mpp->deferred_remove;
+	mpp->flush_queued = true;
+	condlog(3, "%s: queueing map removal", mpp->alias);
+
+	pthread_mutex_lock(&flush_lock);
+	list_add_tail(&req->node, &flush_reqs);
+	pthread_cond_signal(&flush_cond);
+	pthread_mutex_unlock(&flush_lock);
+	return true;
+}
+
+static void free_reqs(struct list_head *head)
+{
+	struct flush_req *req, *tmp;
+
+	list_for_each_entry_safe(req, tmp, head, node) {
+		list_del(&req->node);
+		free(req);
+	}
+}
+
+/*
+ * Runs without the vecs lock. Cancellation is only allowed between two
+ * maps, not in the middle of removing one. Partition maps are found
+ * through the partition map index of multipathd.
+ */
+static void flush_maps(void)
+{
+	struct flush_req *req;
+	int oldstate, nr = 0;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+	dm_udev_batch_start();
+	list_for_each_entry(req, &flush_batch, node) {
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		pthread_testcancel();
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		req->r = dm_flush_map_nopaths(req->alias, req->deferred_remove);
+		nr++;
+	}
+	dm_udev_batch_end();
+	pthread_setcancelstate(oldstate, NULL);
+	condlog(3, "flushed %d maps", nr);
+}
+
+/*
+ * Add the paths of wwid that ev_add_path() orphaned while the map was
+ * queued for removal. The first one creates the map again, or adopts all
+ * of them into the map if it's still there.
+ */
+static void add_delayed_paths(struct vectors *vecs, const char *wwid,
+			      int need_do_map)
+{
+	struct path *pp;
+	int i;
+
+	vector_foreach_slot (vecs->pathvec, pp, i) {
+		if (!pp->mpp && pp->initialized != INIT_REMOVED &&
+		    !strcmp(pp->wwid, wwid)) {
+			condlog(2, "%s: adding path delayed by map removal",
+				pp->dev);
+			ev_add_path(pp, vecs, need_do_map);
+			break;
+		}
+	}
+}
+
+/*
+ * Called with vecs->lock held, after the flush thread has tried to
+ * remove a map queued by __ev_remove_path(). r is the result of
+ * dm_flush_map_nopaths(). If the map is still in use, it's reloaded
+ * without the removed paths, like ev_remove_path() does it if the
+ * flush fails there, but with the paths added in the meantime.
+ */
+static void finish_map_flush(struct vectors *vecs, const char *alias,
+			     const char *wwid, int r)
+{
+	struct multipath *mpp;
+
+	mpp = find_mp_by_alias(vecs->mpvec, alias);
+	/* removed by its remove uevent, the CLI, or a reconfigure */
+	if (!mpp || !mpp->flush_queued || strcmp(mpp->wwid, wwid)) {
+		condlog(3, "%s: map already removed", alias);
+		add_delayed_paths(vecs, wwid, 1);
+		return;
+	}
+	mpp->flush_queued = false;
+	if (!handle_flush_result(mpp, vecs, r)) {
+		condlog(2, "%s: removed map after removing all paths", alias);
+		add_delayed_paths(vecs, wwid, 1);
+		return;
+	}
+	feed_event("map_flush %s %s", alias, r == 1 ? "busy" : "deferred");
+	/* the reload below pushes the adopted paths */
+	add_delayed_paths(vecs, wwid, 0);
+	if (mpp->wait_for_udev)
+		mpp->wait_for_udev = 2;
+	else if (reload_and_sync_map(mpp, vecs, 0) == 1)
+		condlog(0, "%s: failed to reload map after "
+			"removing all paths", alias);
+}
+
+static void rcu_unregister(__attribute__((unused)) void *arg)
+{
+	rcu_unregister_thread();
+}
+
+static void *flush_loop(void *arg)
+{
+	struct vectors *vecs = arg;
+	struct flush_req *req;
+
+	pthread_cleanup_push(rcu_unregister, NULL);
+	rcu_register_thread();
+	for (;;) {
+		pthread_mutex_lock(&flush_lock);
+		pthread_cleanup_push(cleanup_mutex, &flush_lock);
+		while (list_empty(&flush_reqs))
+			pthread_cond_wait(&flush_cond, &flush_lock);
+		list_splice_tail_init(&flush_reqs, &flush_batch);
+		pthread_cleanup_pop(1);
+
+		flush_maps();
+
+		pthread_cleanup_push(cleanup_lock, &vecs->lock);
+		lock(&vecs->lock);
+		pthread_testcancel();
+		list_for_each_entry(req, &flush_batch, node)
+			finish_map_flush(vecs, req->alias, req->wwid, req->r);
+		lock_cleanup_pop(vecs->lock);
+		free_reqs(&flush_batch);
+		sample_thread_cpu(THREAD_FLUSH);
+	}
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+int start_flush_thread(struct vectors *vecs)
+{
+	pthread_attr_t attr;
+	int rc;
+
+	setup_thread_attr_for(&attr, THREAD_FLUSH, 0);
+	rc = pthread_create(&flush_thr, &attr, flush_loop, vecs);
+	pthread_attr_destroy(&attr);
+	if (rc) {
+		condlog(0, "failed to create map flush thread: %d", rc);
+		return 1;
+	}
+	flush_thr_started = true;
+	register_thread(THREAD_FLUSH, flush_thr);
+	return 0;
+}
+
+/*
+ * Called after the other threads have been joined. Maps that haven't
+ * been flushed yet stay in the kernel.
+ */
+void stop_flush_thread(void)
+{
+	if (!flush_thr_started)
+		return;
+	unregister_thread(THREAD_FLUSH);
+	pthread_cancel(flush_thr);
+	pthread_join(flush_thr, NULL);
+	flush_thr_started = false;
+	free_reqs(&flush_batch);
+	pthread_mutex_lock(&flush_lock);
+	free_reqs(&flush_reqs);
+	pthread_mutex_unlock(&flush_lock);
+}
@@ -0,0 +1,35 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _FLUSH_QUEUE_H
+#define _FLUSH_QUEUE_H
+
+#include <stdbool.h>
+
+struct vectors;
+struct multipath;
+
+/*
+ * Removal of maps whose last path is gone, off the vecs lock.
+ *
+ * When a path device is gone, __ev_remove_path() with queue_flush only
+ * changes the state of such a map under the lock: queue_map_flush() sets
+ * mpp->flush_queued. The flush thread
+ * takes all maps queued meanwhile at once, and removes them from the
+ * kernel with dm_flush_map_nopaths() without holding the lock. The
+ * removals of a batch share a udev cookie, so udev is waited for only
+ * once. Then the thread takes the lock, and calls finish_map_flush() for
+ * each of them, which drops the map from multipathd, or keeps it without
+ * paths if it's still in use, like flush_map() does. Paths added for a
+ * map while it's being removed wait for the removal, and create the map
+ * again afterwards.
+ */
+int start_flush_thread(struct vectors *vecs);
+void stop_flush_thread(void);
+/*
+ * Called with vecs->lock held. Returns false if the flush thread isn't
+ * running, and the map must be flushed right away.
+ */
+bool queue_map_flush(struct multipath *mpp);
+
+#endif /* _FLUSH_QUEUE_H */
@@ -0,0 +1,392 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <urcu/uatomic.h>
+
+#include "checkers.h"
+#include "debug.h"
+#include "strbuf.h"
+#include "time-util.h"
+#include "uevent.h"
+#include "util.h"
+#include "loop_stats.h"
+
+/* Bucket i counts samples < 2^i us, the last one all larger samples */
+#define HIST_BUCKETS 25
+/* Checkers with separate histograms; others are counted as "other" */
+#define MAX_CHECKER_STATS 15
+
+#if UEV_LAG_BUCKETS != HIST_BUCKETS
+#error "the uevent lag histogram must use the bucket limits of latency_hist"
+#endif
+
+struct latency_hist {
+	unsigned long count;
+	unsigned long sum_us;
+	unsigned long max_us;
+	unsigned long buckets[HIST_BUCKETS];
+};
+
+struct checker_stat {
+	char name[CHECKER_NAME_LEN];
+	struct latency_hist hist;
+};
+
+static const char * const loop_stat_names[__LOOP_STAT_NR] = {
+	[LOOP_STAT_PASS] = "pass",
+	[LOOP_STAT_LOCK_WAIT] = "lock_wait",
+	[LOOP_STAT_UPDATE_PRIO] = "update_prio",
+	[LOOP_STAT_MPATH_STRINGS] = "update_multipath_strings",
+	[LOOP_STAT_DMEVENT] = "dmevent",
+};
+
+static struct latency_hist loop_hists[__LOOP_STAT_NR];
+
+static pthread_mutex_t checker_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Entries are only added, under checker_stats_lock, and never removed */
+static struct checker_stat checker_stats[MAX_CHECKER_STATS + 1];
+static int nr_checker_stats;
+
+static unsigned long timespec_to_us(const struct timespec *ts)
+{
+	if (ts->tv_sec < 0)
+		return 0;
+	return ts->tv_sec * 1000000UL + ts->tv_nsec / 1000;
+}
+
+static void hist_add(struct latency_hist *h, unsigned long us)
+{
+	unsigned long max;
+	int b = 0;
+
+	while (b < HIST_BUCKETS - 1 && us >= 1UL << b)
+		b++;
+	uatomic_inc(&h->buckets[b]);
+	uatomic_inc(&h->count);
+	uatomic_add(&h->sum_us, us);
+	max = uatomic_read(&h->max_us);
+	while (us > max) {
+		unsigned long old = uatomic_cmpxchg(&h->max_us, max, us);
+
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
+void loop_stat_record(enum loop_stat stat, const struct timespec *elapsed)
+{
+	if (stat >= __LOOP_STAT_NR)
+		return;
+	hist_add(&loop_hists[stat], timespec_to_us(elapsed));
+}
+
+void loop_stat_since(enum loop_stat stat, const struct timespec *start)
+{
+	struct timespec now, elapsed;
+
+	get_monotonic_time(&now);
+	timespecsub(&now, start, &elapsed);
+	loop_stat_record(stat, &elapsed);
+}
+
+static struct checker_stat *find_checker_stat(const char *name)
+{
+	int i, n = uatomic_read(&nr_checker_stats);
+
+	cmm_smp_rmb();
+	for (i = 0; i < n; i++)
+		if (!strcmp(checker_stats[i].name, name))
+			return &checker_stats[i];
+	return NULL;
+}
+
+static struct checker_stat *get_checker_stat(const char *name)
+{
+	struct checker_stat *cs;
+
+	cs = find_checker_stat(name);
+	if (cs)
+		return cs;
+
+	pthread_mutex_lock(&checker_stats_lock);
+	cs = find_checker_stat(name);
+	if (!cs) {
+		int n = nr_checker_stats;
+
+		cs = &checker_stats[n];
+		if (n < MAX_CHECKER_STATS) {
+			strlcpy(cs->name, name, sizeof(cs->name));
+			cmm_smp_wmb();
+			uatomic_set(&nr_checker_stats, n + 1);
+		} else
+			/* the extra slot, named in snprint_hist_list() */
+			cs = &checker_stats[MAX_CHECKER_STATS];
+	}
+	pthread_mutex_unlock(&checker_stats_lock);
+	return cs;
+}
+
+void checker_stat_record(const char *checker, const struct timespec *elapsed)
+{
+	if (!checker || !*checker)
+		return;
+	hist_add(&get_checker_stat(checker)->hist, timespec_to_us(elapsed));
+}
+
+static void hist_reset(struct latency_hist *h)
+{
+	int i;
+
+	uatomic_set(&h->count, 0);
+	uatomic_set(&h->sum_us, 0);
+	uatomic_set(&h->max_us, 0);
+	for (i = 0; i < HIST_BUCKETS; i++)
+		uatomic_set(&h->buckets[i], 0);
+}
+
+void loop_stats_reset(void)
+{
+	int i, n;
+
+	for (i = 0; i < __LOOP_STAT_NR; i++)
+		hist_reset(&loop_hists[i]);
+	pthread_mutex_lock(&checker_stats_lock);
+	n = nr_checker_stats;
+	for (i = 0; i < n; i++)
+		hist_reset(&checker_stats[i].hist);
+	hist_reset(&checker_stats[MAX_CHECKER_STATS].hist);
+	pthread_mutex_unlock(&checker_stats_lock);
+}
+
+static void hist_copy(struct latency_hist *dst, const struct latency_hist *h)
+{
+	int i;
+
+	dst->count = uatomic_read(&h->count);
+	dst->sum_us = uatomic_read(&h->sum_us);
+	dst->max_us = uatomic_read(&h->max_us);
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] = uatomic_read(&h->buckets[i]);
+}
+
+/* Upper bound of the bucket holding the given fraction of samples */
+static unsigned long hist_percentile(const struct latency_hist *h,
+				     unsigned int permille)
+{
+	unsigned long sum = 0, total = 0, want;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		total += h->buckets[i];
+	if (total == 0)
+		return 0;
+	want = (total * permille + 999) / 1000;
+	for (i = 0; i < HIST_BUCKETS - 1; i++) {
+		sum += h->buckets[i];
+		if (sum >= want)
+			return 1UL << i;
+	}
+	return h->max_us;
+}
+
+static int snprint_hist(struct strbuf *buf, const char *name,
+			const struct latency_hist *hist, bool json,
+			bool last)
+{
+	struct latency_hist h;
+	bool first = true;
+	int i, rc;
+
+	hist_copy(&h, hist);
+	if (json)
+		rc = print_strbuf(buf, "      \"%s\" : { \"count\" : %lu, "
+				  "\"sum_us\" : %lu, \"max_us\" : %lu, "
+				  "\"buckets\" : [", name, h.count, h.sum_us,
+				  h.max_us);
+	else
+		rc = print_strbuf(buf, "%-24s count %lu avg %lu p50 %lu p90 %lu "
+				  "p99 %lu max %lu\n", name, h.count,
+				  h.count ? h.sum_us / h.count : 0,
+				  hist_percentile(&h, 500),
+				  hist_percentile(&h, 900),
+				  hist_percentile(&h, 990), h.max_us);
+	if (rc < 0)
+		return rc;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (!h.buckets[i])
+			continue;
+		if (json) {
+			/* the upper bound of the last bucket is null */
+			if (i < HIST_BUCKETS - 1)
+				rc = print_strbuf(buf, "%s[%lu, %lu]",
+						  first ? " " : ", ",
+						  1UL << i, h.buckets[i]);
+			else
+				rc = print_strbuf(buf, "%s[null, %lu]",
+						  first ? " " : ", ",
+						  h.buckets[i]);
+		} else {
+			if (i < HIST_BUCKETS - 1)
+				rc = print_strbuf(buf, "%s<%lu:%lu",
+						  first ? "  " : " ",
+						  1UL << i, h.buckets[i]);
+			else
+				rc = print_strbuf(buf, "%s>=%lu:%lu",
+						  first ? "  " : " ",
+						  1UL << (i - 1), h.buckets[i]);
+		}
+		if (rc < 0)
+			return rc;
+		first = false;
+	}
+	if (json)
+		rc = print_strbuf(buf, "%s] }%s\n", first ? "" : " ",
+				  last ? "" : ",");
+	else if (!first)
+		rc = append_strbuf_str(buf, "\n");
+	return rc;
+}
+
+/* The uevent lag is accounted in libmultipath, see uevent_get_stats() */
+static void get_uevent_lag(struct latency_hist *h)
+{
+	struct uevent_stats st;
+	int i;
+
+	uevent_get_stats(&st);
+	h->count = 0;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		h->buckets[i] = st.lag_buckets[i];
+		h->count += st.lag_buckets[i];
+	}
+	h->sum_us = st.lag_sum_us;
+	h->max_us = st.lag_max_us;
+}
+
+int snprint_uevent_lag(struct strbuf *buf)
+{
+	struct latency_hist h;
+
+	get_uevent_lag(&h);
+	return snprint_hist(buf, "uevent lag (us)", &h, false, true);
+}
+
+int snprint_loop_stats(struct strbuf *buf, bool json)
+{
+	struct latency_hist uev_lag;
+
+	int i, n, rc;
+
+	if (json)
+		rc = append_strbuf_str(buf, "{\n   \"loop_stats\" : {\n");
+	else
+		rc = append_strbuf_str(buf,
+			"multipathd latencies in us (bucket <limit:count)\n");
+	if (rc < 0)
+		return rc;
+	for (i = 0; i < __LOOP_STAT_NR; i++)
+		if ((rc = snprint_hist(buf, loop_stat_names[i], &loop_hists[i],
+				       json, false)) < 0)
+			return rc;
+	get_uevent_lag(&uev_lag);
+	if ((rc = snprint_hist(buf, "uevent_lag", &uev_lag, json, true)) < 0)
+		return rc;
+
+	if (json)
+		rc = append_strbuf_str(buf, "   },\n   \"checker_stats\" : {\n");
+	else
+		rc = append_strbuf_str(buf, "path checker latencies in us\n");
+	if (rc < 0)
+		return rc;
+	n = uatomic_read(&nr_checker_stats);
+	cmm_smp_rmb();
+	for (i = 0; i < n; i++)
+		if ((rc = snprint_hist(buf, checker_stats[i].name,
+				       &checker_stats[i].hist, json,
+				       i == n - 1 &&
+				       !uatomic_read(&checker_stats[MAX_CHECKER_STATS].hist.count))) < 0)
+			return rc;
+	if (uatomic_read(&checker_stats[MAX_CHECKER_STATS].hist.count) &&
+	    (rc = snprint_hist(buf, "other",
+			       &checker_stats[MAX_CHECKER_STATS].hist, json,
+			       true)) < 0)
+		return rc;
+	if (json)
+		rc = append_strbuf_str(buf, "   }\n}\n");
+	return rc;
+}
+
+static int snprint_hist_metric(struct strbuf *buf, const char *family,
+			       const char *label, const char *value,
+			       const struct latency_hist *hist)
+{
+	struct latency_hist h;
+	unsigned long cum = 0;
+	int i, rc;
+
+	hist_copy(&h, hist);
+	for (i = 0; i < HIST_BUCKETS - 1; i++) {
+		cum += h.buckets[i];
+		if ((rc = print_strbuf(buf, "%s_bucket{%s=\"%s\",le=\"%lu.%06lu\"} %lu\n",
+				       family, label, value,
+				       (1UL << i) / 1000000,
+				       (1UL << i) % 1000000, cum)) < 0)
+			return rc;
+	}
+	cum += h.buckets[HIST_BUCKETS - 1];
+	/* Keep _count consistent with the buckets, samples may be racing */
+	if ((rc = print_strbuf(buf, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %lu\n",
+			       family, label, value, cum)) < 0 ||
+	    (rc = print_strbuf(buf, "%s_count{%s=\"%s\"} %lu\n",
+			       family, label, value, cum)) < 0 ||
+	    (rc = print_strbuf(buf, "%s_sum{%s=\"%s\"} %lu.%06lu\n",
+			       family, label, value, h.sum_us / 1000000,
+			       h.sum_us % 1000000)) < 0)
+		return rc;
+	return 0;
+}
+
+int snprint_loop_stats_metrics(struct strbuf *buf)
+{
+	static const char latency[] = "multipathd_latency_seconds";
+	static const char checker[] = "multipathd_path_checker_seconds";
+	struct latency_hist uev_lag;
+	int i, n, rc;
+
+	if ((rc = print_strbuf(buf, "# TYPE %s histogram\n"
+			       "# HELP %s Duration of checker loop phases, dmevent processing, and time from uevent receipt until handled.\n",
+			       latency, latency)) < 0)
+		return rc;
+	for (i = 0; i < __LOOP_STAT_NR; i++)
+		if ((rc = snprint_hist_metric(buf, latency, "op",
+					      loop_stat_names[i],
+					      &loop_hists[i])) < 0)
+			return rc;
+	get_uevent_lag(&uev_lag);
+	if ((rc = snprint_hist_metric(buf, latency, "op", "uevent_lag",
+				      &uev_lag)) < 0)
+		return rc;
+
+	if ((rc = print_strbuf(buf, "# TYPE %s histogram\n"
+			       "# HELP %s Duration of single path checks.\n",
+			       checker, checker)) < 0)
+		return rc;
+	n = uatomic_read(&nr_checker_stats);
+	cmm_smp_rmb();
+	for (i = 0; i < n; i++)
+		if ((rc = snprint_hist_metric(buf, checker, "checker",
+					      checker_stats[i].name,
+					      &checker_stats[i].hist)) < 0)
+			return rc;
+	if (uatomic_read(&checker_stats[MAX_CHECKER_STATS].hist.count) &&
+	    (rc = snprint_hist_metric(buf, checker, "checker", "other",
+				      &checker_stats[MAX_CHECKER_STATS].hist)) < 0)
+		return rc;
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _LOOP_STATS_H
+#define _LOOP_STATS_H
+
+#include <stdbool.h>
+#include <time.h>
+
+struct strbuf;
+
+/*
+ * Latency histograms for the checker loop and the dmevent waiter, for
+ * "show daemon stats" and "show metrics".
+ *
+ * Every sample is counted in a bucket with a power-of-2 upper bound in
+ * microseconds. Samples may be recorded from any thread without locking.
+ */
+enum loop_stat {
+	/* a complete checker loop iteration */
+	LOOP_STAT_PASS,
+	/* waiting for vecs->lock in the checker loop */
+	LOOP_STAT_LOCK_WAIT,
+	LOOP_STAT_UPDATE_PRIO,
+	LOOP_STAT_MPATH_STRINGS,
+	/* from the wakeup of the dmevent waiter until the maps are updated */
+	LOOP_STAT_DMEVENT,
+	__LOOP_STAT_NR,
+};
+
+void loop_stat_record(enum loop_stat stat, const struct timespec *elapsed);
+/* Record the time elapsed since start */
+void loop_stat_since(enum loop_stat stat, const struct timespec *start);
+/* Record the time a single path check took with the named checker */
+void checker_stat_record(const char *checker,
+			 const struct timespec *elapsed);
+void loop_stats_reset(void);
+int snprint_loop_stats(struct strbuf *buf, bool json);
+/* The uevent lag histogram, in the text format of "show daemon" */
+int snprint_uevent_lag(struct strbuf *buf);
+/* Histogram families in OpenMetrics text format */
+int snprint_loop_stats_metrics(struct strbuf *buf);
+
+#endif /* _LOOP_STATS_H */
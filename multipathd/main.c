@@ -10,16 +10,19 @@
 #include <sys/wait.h>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <limits.h>
 #include <linux/oom.h>
 #include <libudev.h>
 #include <urcu.h>
+#include <urcu/uatomic.h>
 #ifdef USE_SYSTEMD
 #include <systemd/sd-daemon.h>
 #endif
 #include <semaphore.h>
+#include <poll.h>
 #include <time.h>
 #include <stdbool.h>
 
@@ -56,6 +59,7 @@
 #include "uevent.h"
 #include "switchgroup.h"
 #include "print.h"
+#include "strbuf.h"
 #include "configure.h"
 #include "prio.h"
 #include "wwids.h"
@@ -77,13 +81,34 @@
 #include "cli.h"
 #include "cli_handlers.h"
 #include "lock.h"
-#include "waiter.h"
 #include "dmevents.h"
 #include "io_err_stat.h"
+#include "latency_weight.h"
+#include "io_stats.h"
 #include "wwids.h"
 #include "foreign.h"
+#include "worker_pool.h"
+#include "vpd_cache.h"
+#include "udev_cache.h"
+#include "check_sched.h"
+#include "async_check.h"
+#include "startup_order.h"
 #include "../third-party/valgrind/drd.h"
 #include "init_unwinder.h"
+#include "snapshot.h"
+#include "feed.h"
+#include "loop_stats.h"
+#include "trace.h"
+#include "map_gen.h"
+#include "check_limit.h"
+#include "check_policy.h"
+#include "state_file.h"
+#include "checkpoint.h"
+#include "thread_settings.h"
+#include "partmaps.h"
+#include "reply_cache.h"
+#include "smart_wait.h"
+#include "flush_queue.h"
 
 #define FILE_NAME_SIZE 256
 #define CMDSIZE 160
@@ -92,20 +117,29 @@
 #define LOG_MSG(lvl, pp)					\
 do {								\
 	if (pp->mpp && checker_selected(&pp->checker) &&	\
-	    lvl <= libmp_verbosity) {					\
+	    condlog_enabled(lvl)) {					\
+		const struct log_fields __lf = {		\
+			.dev = pp->dev,				\
+			.map = pp->mpp->alias,			\
+			.wwid = pp->wwid,			\
+		};						\
+								\
 		if (pp->offline)				\
-			condlog(lvl, "%s: %s - path offline",	\
-				pp->mpp->alias, pp->dev);	\
+			condlog_fields(lvl, &__lf, 0,		\
+				       "%s: %s - path offline",	\
+				       pp->mpp->alias, pp->dev); \
 		else  {						\
 			const char *__m =			\
 				checker_message(&pp->checker);	\
 								\
 			if (strlen(__m))			      \
-				condlog(lvl, "%s: %s - %s checker%s", \
-					pp->mpp->alias,		      \
-					pp->dev,		      \
-					checker_name(&pp->checker),   \
-					__m);			      \
+				condlog_fields(lvl, &__lf,	      \
+					   pp->checker.msgid + 1,     \
+					   "%s: %s - %s checker%s",   \
+					   pp->mpp->alias,	      \
+					   pp->dev,		      \
+					   checker_name(&pp->checker), \
+					   __m);		      \
 		}						      \
 	}							      \
 } while(0)
@@ -125,6 +159,8 @@ static int poll_dmevents = 0;
 #else
 static int poll_dmevents = 1;
 #endif
+/* set at startup, see checkpoint.h */
+static bool warm_restart;
 /* Don't access this variable without holding config_lock */
 static volatile enum daemon_status running_state = DAEMON_INIT;
 pid_t daemon_pid;
@@ -161,6 +197,19 @@ struct config *multipath_conf;
 static volatile sig_atomic_t exit_sig;
 static volatile sig_atomic_t reconfig_sig;
 static volatile sig_atomic_t log_reset_sig;
+/* set by schedule_reconfigure(), accessed atomically */
+static int reconfigure_all;
+/*
+ * Reconfigure requests, protected by config_lock. Requests are numbered,
+ * reconfigure_done is the number of the last request that was served by
+ * a completed reconfigure. reconfigure_pending is set for requests which
+ * the main thread hasn't picked up yet.
+ */
+static unsigned long reconfigure_requested;
+static unsigned long reconfigure_done;
+static bool reconfigure_pending;
+static struct timespec first_reconfigure_request;
+static struct timespec last_reconfigure_request;
 
 static const char *daemon_status_msg[DAEMON_STATUS_SIZE] = {
 	[DAEMON_INIT] = "init",
@@ -307,17 +356,45 @@ int set_config_state(enum daemon_status state)
 	return rc;
 }
 
+/* RCU read-side critical sections holding the config, see lock.h */
+static struct lock_profile *config_prof;
+
+struct lock_profile *get_config_profile(void)
+{
+	return config_prof;
+}
+
 struct config *get_multipath_config(void)
 {
 	rcu_read_lock();
+#ifdef LOCK_PROFILE
+	if (config_prof)
+		lock_profile_hold(config_prof, NULL, 0,
+				  __builtin_return_address(0), NULL, 1);
+#endif
 	return rcu_dereference(multipath_conf);
 }
 
 void put_multipath_config(__attribute__((unused)) void *arg)
 {
+#ifdef LOCK_PROFILE
+	if (config_prof)
+		lock_profile_release(config_prof);
+#endif
 	rcu_read_unlock();
 }
 
+/*
+ * The priority of pp was obtained by the prioritizer less than max_age
+ * seconds ago, and the path state hasn't changed since
+ */
+static bool prio_is_fresh(const struct path *pp, unsigned int max_age,
+			  const struct timespec *now)
+{
+	return pp->prio_time && pp->prio_state == pp->state &&
+		now->tv_sec - pp->prio_time < (time_t)max_age;
+}
+
 static int
 need_switch_pathgroup (struct multipath * mpp, int refresh)
 {
@@ -326,16 +403,27 @@ need_switch_pathgroup (struct multipath * mpp, int refresh)
 	unsigned int i, j;
 	struct config *conf;
 	int bestpg;
+	unsigned int max_age;
+	struct timespec now;
 
 	if (!mpp)
 		return 0;
 
 	/*
-	 * Refresh path priority values
+	 * Refresh path priority values, unless the checker has done so
+	 * within prio_max_age, or the last polling interval
 	 */
 	if (refresh) {
+		conf = get_multipath_config();
+		max_age = conf->prio_max_age > 0 ?
+			(unsigned int)conf->prio_max_age :
+			conf->checkint;
+		put_multipath_config(conf);
+		get_monotonic_time(&now);
 		vector_foreach_slot (mpp->pg, pgp, i) {
 			vector_foreach_slot (pgp->paths, pp, j) {
+				if (prio_is_fresh(pp, max_age, &now))
+					continue;
 				conf = get_multipath_config();
 				pthread_cleanup_push(put_multipath_config,
 						     conf);
@@ -359,6 +447,39 @@ need_switch_pathgroup (struct multipath * mpp, int refresh)
 	return 0;
 }
 
+/*
+ * With group_by_prio, changed priorities only need a table reload if they
+ * regroup the paths. If all paths of every group still share a priority
+ * that no other group has, only the order of the groups is stale, and
+ * switching to the new best group is enough. The kernel keeps the old
+ * group order for its own failover until the next reload.
+ */
+static bool
+prio_groups_unchanged (const struct multipath *mpp)
+{
+	struct pathgroup *pgp, *pgp2;
+	struct path *pp;
+	int i, j, prio;
+
+	vector_foreach_slot (mpp->pg, pgp, i) {
+		if (VECTOR_SIZE(pgp->paths) == 0)
+			return false;
+		prio = ((struct path *)VECTOR_SLOT(pgp->paths, 0))->priority;
+		vector_foreach_slot (pgp->paths, pp, j) {
+			if (pp->priority != prio)
+				return false;
+		}
+		for (j = 0; j < i; j++) {
+			pgp2 = VECTOR_SLOT(mpp->pg, j);
+			pp = VECTOR_SLOT(pgp2->paths, 0);
+			if (pp->priority == prio &&
+			    pgp2->marginal == pgp->marginal)
+				return false;
+		}
+	}
+	return true;
+}
+
 static void
 switch_pathgroup (struct multipath * mpp)
 {
@@ -366,44 +487,47 @@ switch_pathgroup (struct multipath * mpp)
 	dm_switchgroup(mpp->alias, mpp->bestpg);
 	condlog(2, "%s: switch to path group #%i",
 		 mpp->alias, mpp->bestpg);
+	feed_event("pg_switch %s %d", mpp->alias, mpp->bestpg);
+}
+
+/* Report changes of the recovery state done by update_queue_mode_*() */
+static void
+feed_queueing (const struct multipath *mpp, bool was_recovering)
+{
+	if (mpp->in_recovery != was_recovering)
+		feed_event("queueing %s %s", mpp->alias,
+			   mpp->in_recovery ? "recovery" : "on");
 }
 
 static int
-wait_for_events(struct multipath *mpp, struct vectors *vecs)
+wait_for_events(struct multipath *mpp)
 {
-	if (poll_dmevents)
-		return watch_dmevents(mpp->alias);
-	else
-		return start_waiter_thread(mpp, vecs);
+	return watch_dmevents(mpp->alias);
 }
 
 static void
 remove_map_and_stop_waiter(struct multipath *mpp, struct vectors *vecs)
 {
-	/* devices are automatically removed by the dmevent polling code,
+	/* devices are automatically removed by the dmevent waiter code,
 	 * so they don't need to be manually removed here */
 	condlog(3, "%s: removing map from internal tables", mpp->alias);
-	if (!poll_dmevents)
-		stop_waiter_thread(mpp);
+	feed_event("map_remove %s", mpp->alias);
+	note_map_removed(mpp);
 	remove_map(mpp, vecs->pathvec, vecs->mpvec);
 }
 
 static void
 remove_maps_and_stop_waiters(struct vectors *vecs)
 {
+	struct multipath *mpp;
 	int i;
-	struct multipath * mpp;
 
 	if (!vecs)
 		return;
 
-	if (!poll_dmevents) {
-		vector_foreach_slot(vecs->mpvec, mpp, i)
-			stop_waiter_thread(mpp);
-	}
-	else
-		unwatch_all_dmevents();
-
+	vector_foreach_slot(vecs->mpvec, mpp, i)
+		note_map_removed(mpp);
+	unwatch_all_dmevents();
 	remove_maps(vecs);
 }
 
@@ -433,6 +557,34 @@ out:
 	return 1;
 }
 
+/*
+ * Check the usable paths through the SCSI host of a path that the kernel
+ * failed in the next tick. The checks run through the checker pool along
+ * with the other due paths.
+ */
+static void
+recheck_host_paths(const struct vectors *vecs, const struct path *pp)
+{
+	struct path *pp1;
+	int i, n = 0;
+
+	if (pp->bus != SYSFS_BUS_SCSI)
+		return;
+	vector_foreach_slot(vecs->pathvec, pp1, i) {
+		if (pp1 == pp || pp1->bus != SYSFS_BUS_SCSI ||
+		    pp1->sg_id.host_no != pp->sg_id.host_no ||
+		    (pp1->state != PATH_UP && pp1->state != PATH_GHOST))
+			continue;
+		if (path_check_ticks(pp1) > 0) {
+			set_path_tick(pp1, 0);
+			n++;
+		}
+	}
+	if (n)
+		condlog(3, "%s: checking %d other paths on host%d", pp->dev,
+			n, pp->sg_id.host_no);
+}
+
 int update_multipath (struct vectors *vecs, char *mapname, int reset)
 {
 	struct multipath *mpp;
@@ -462,23 +614,31 @@ int update_multipath (struct vectors *vecs, char *mapname, int reset)
 				struct config *conf;
 				int oldstate = pp->state;
 				unsigned int checkint;
+				int recheck_siblings;
 
 				conf = get_multipath_config();
 				checkint = conf->checkint;
+				recheck_siblings = conf->recheck_siblings;
 				put_multipath_config(conf);
 				condlog(2, "%s: mark as failed", pp->dev);
 				mpp->stat_path_failures++;
-				pp->state = PATH_DOWN;
+				set_path_state(pp, PATH_DOWN);
 				if (oldstate == PATH_UP ||
-				    oldstate == PATH_GHOST)
+				    oldstate == PATH_GHOST) {
+					bool rec = mpp->in_recovery;
+
 					update_queue_mode_del_path(mpp);
+					feed_queueing(mpp, rec);
+					if (recheck_siblings == YN_YES)
+						recheck_host_paths(vecs, pp);
+				}
 
 				/*
 				 * if opportune,
 				 * schedule the next check earlier
 				 */
-				if (pp->tick > checkint)
-					pp->tick = checkint;
+				if (path_check_ticks(pp) > checkint)
+					set_path_tick(pp, checkint);
 			}
 		}
 	}
@@ -516,7 +676,7 @@ retry:
 	}
 
 fail:
-	if (new_map && (retries < 0 || wait_for_events(mpp, vecs))) {
+	if (new_map && (retries < 0 || wait_for_events(mpp))) {
 		condlog(0, "%s: failed to create new map", mpp->alias);
 		remove_map(mpp, vecs->pathvec, vecs->mpvec);
 		return 1;
@@ -551,12 +711,14 @@ add_map_without_path (struct vectors *vecs, const char *alias)
 		condlog(3, "%s: cannot access table", mpp->alias);
 		goto out;
 	}
-	if (!strlen(mpp->wwid))
+	if (!strlen(mpp->wwid)) {
 		dm_get_uuid(mpp->alias, mpp->wwid, WWID_SIZE);
+		hash_map_wwid(mpp);
+	}
 	if (!strlen(mpp->wwid))
 		condlog(1, "%s: adding map with empty WWID", mpp->alias);
 	conf = get_multipath_config();
-	mpp->mpe = find_mpe(conf->mptable, mpp->wwid);
+	mpp->mpe = find_mpe_by_wwid(conf, mpp->wwid);
 	put_multipath_config(conf);
 
 	if (update_multipath_table(mpp, vecs->pathvec, 0) != DMP_OK)
@@ -633,15 +795,10 @@ sync_maps_state(vector mpvec)
 		sync_map_state(mpp);
 }
 
+/* r is the result of the dm_flush_map*() call for mpp */
 int
-flush_map(struct multipath * mpp, struct vectors * vecs, int nopaths)
+handle_flush_result(struct multipath *mpp, struct vectors *vecs, int r)
 {
-	int r;
-
-	if (nopaths)
-		r = dm_flush_map_nopaths(mpp->alias, mpp->deferred_remove);
-	else
-		r = dm_flush_map(mpp->alias);
 	/*
 	 * clear references to this map before flushing so we can ignore
 	 * the spurious uevent we may generate with the dm_flush_map call below
@@ -667,6 +824,18 @@ flush_map(struct multipath * mpp, struct vectors * vecs, int nopaths)
 	return 0;
 }
 
+int
+flush_map(struct multipath * mpp, struct vectors * vecs, int nopaths)
+{
+	int r;
+
+	if (nopaths)
+		r = dm_flush_map_nopaths(mpp->alias, mpp->deferred_remove);
+	else
+		r = dm_flush_map(mpp->alias);
+	return handle_flush_result(mpp, vecs, r);
+}
+
 static int
 uev_add_map (struct uevent * uev, struct vectors * vecs)
 {
@@ -701,7 +870,7 @@ uev_add_map (struct uevent * uev, struct vectors * vecs)
  * existing device.
  */
 int
-ev_add_map (char * dev, const char * alias, struct vectors * vecs)
+ev_add_map (const char * dev, const char * alias, struct vectors * vecs)
 {
 	struct multipath * mpp;
 	int delayed_reconfig, reassign_maps;
@@ -755,6 +924,7 @@ ev_add_map (char * dev, const char * alias, struct vectors * vecs)
 	if ((mpp = add_map_without_path(vecs, alias))) {
 		sync_map_state(mpp);
 		condlog(2, "%s: devmap %s registered", alias, dev);
+		feed_event("map_add %s", alias);
 		return 0;
 	} else {
 		condlog(2, "%s: ev_add_map failed", dev);
@@ -884,14 +1054,103 @@ check_path_wwid_change(struct path *pp)
 	return false;
 }
 
+/*
+ * Discovery of a new path does SCSI I/O and may take long for slow or
+ * failing devices. It runs on a detached path, like in multipath(8),
+ * without holding vecs->lock. Only adding the path to pathvec and the
+ * map is done with the lock held. The path may have been added through
+ * the CLI in the meantime, in which case the duplicate is dropped.
+ */
+static int
+uev_add_new_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
+{
+	struct path *pp = NULL;
+	struct config *conf;
+	int ret;
+
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	ret = alloc_path_with_pathinfo(conf, uev->udev,
+				       uev->wwid, DI_ALL, &pp);
+	pthread_cleanup_pop(1);
+	if (!pp) {
+		if (ret == PATHINFO_SKIPPED)
+			return 0;
+		condlog(3, "%s: failed to get path info", uev->kernel);
+		return 1;
+	}
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	if (find_path_by_dev(vecs->pathvec, uev->kernel)) {
+		condlog(3, "%s: path was added during discovery",
+			uev->kernel);
+		free_path(pp);
+		ret = 0;
+	} else if (!(ret = store_path(vecs->pathvec, pp))) {
+		conf = get_multipath_config();
+		pp->checkint = conf->checkint;
+		put_multipath_config(conf);
+		schedule_path_check(pp, pp->tick);
+		ret = ev_add_path(pp, vecs, need_do_map);
+	} else {
+		condlog(0, "%s: failed to store path info, "
+			"dropping event",
+			uev->kernel);
+		free_path(pp);
+		ret = 1;
+	}
+	lock_cleanup_pop(vecs->lock);
+	return ret;
+}
+
+/*
+ * Digests of the last handled change uevent of each path, see
+ * uevent_path_digest(). A slot is shared by paths whose names have the
+ * same hash, which only makes the filter miss.
+ */
+#define CHANGE_DIGESTS 4096
+static unsigned long long change_digests[CHANGE_DIGESTS];
+static pthread_mutex_t change_digest_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long *change_digest_slot(const char *dev)
+{
+	return &change_digests[hash_str(dev) & (CHANGE_DIGESTS - 1)];
+}
+
+static bool change_digest_matches(const char *dev, unsigned long long digest)
+{
+	bool match;
+
+	pthread_mutex_lock(&change_digest_lock);
+	match = *change_digest_slot(dev) == digest;
+	pthread_mutex_unlock(&change_digest_lock);
+	return match;
+}
+
+static void set_change_digest(const char *dev, unsigned long long digest)
+{
+	pthread_mutex_lock(&change_digest_lock);
+	*change_digest_slot(dev) = digest;
+	pthread_mutex_unlock(&change_digest_lock);
+}
+
+/* The next change uevent of dev must be handled */
+static void forget_change_digest(const char *dev)
+{
+	set_change_digest(dev, 0);
+}
+
 static int
 uev_add_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 {
 	struct path *pp;
 	int ret = 0, i;
 	struct config *conf;
+	bool handled;
 
 	condlog(3, "%s: add path (uevent)", uev->kernel);
+	forget_change_digest(uev->kernel);
 	if (strstr(uev->kernel, "..") != NULL) {
 		/*
 		 * Don't allow relative device names in the pathvec
@@ -918,6 +1177,7 @@ uev_add_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 			pp->mpp = NULL;
 			/* make sure get_uid() is called */
 			pp->wwid[0] = '\0';
+			pp->wwid_hash = 0;
 		} else
 			condlog(3,
 				"%s: spurious uevent, path already in pathvec",
@@ -935,14 +1195,15 @@ uev_add_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 			if (r == PATHINFO_OK && !prev_mpp)
 				ret = ev_add_path(pp, vecs, need_do_map);
 			else if (r == PATHINFO_OK &&
-				 !strncmp(pp->wwid, prev_mpp->wwid, WWID_SIZE)) {
+				 same_wwid(pp->wwid, pp->wwid_hash,
+					   prev_mpp->wwid, prev_mpp->wwid_hash)) {
 				/*
 				 * Path was unsuccessfully removed, but now
 				 * re-added, and still belongs to the right map
 				 * - all fine, reinstate asap
 				 */
 				pp->mpp = prev_mpp;
-				pp->tick = 1;
+				set_path_tick(pp, 1);
 				ret = 0;
 			} else if (prev_mpp) {
 				/*
@@ -983,42 +1244,12 @@ uev_add_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 			}
 		}
 	}
-	if (pp)
-		goto out;
-
-	/*
-	 * get path vital state
-	 */
-	conf = get_multipath_config();
-	pthread_cleanup_push(put_multipath_config, conf);
-	ret = alloc_path_with_pathinfo(conf, uev->udev,
-				       uev->wwid, DI_ALL, &pp);
-	pthread_cleanup_pop(1);
-	if (!pp) {
-		if (ret == PATHINFO_SKIPPED)
-			ret = 0;
-		else {
-			condlog(3, "%s: failed to get path info", uev->kernel);
-			ret = 1;
-		}
-		goto out;
-	}
-	ret = store_path(vecs->pathvec, pp);
-	if (!ret) {
-		conf = get_multipath_config();
-		pp->checkint = conf->checkint;
-		put_multipath_config(conf);
-		ret = ev_add_path(pp, vecs, need_do_map);
-	} else {
-		condlog(0, "%s: failed to store path info, "
-			"dropping event",
-			uev->kernel);
-		free_path(pp);
-		ret = 1;
-	}
-out:
+	handled = pp != NULL;
 	lock_cleanup_pop(vecs->lock);
-	return ret;
+	if (handled)
+		return ret;
+
+	return uev_add_new_path(uev, vecs, need_do_map);
 }
 
 /*
@@ -1035,6 +1266,7 @@ ev_add_path (struct path * pp, struct vectors * vecs, int need_do_map)
 	int start_waiter = 0;
 	int ret;
 
+	invalidate_device_replies();
 	/*
 	 * need path UID to go any further
 	 */
@@ -1043,6 +1275,13 @@ ev_add_path (struct path * pp, struct vectors * vecs, int need_do_map)
 		goto fail; /* leave path added to pathvec */
 	}
 	mpp = find_mp_by_wwid(vecs->mpvec, pp->wwid);
+	if (mpp && mpp->flush_queued) {
+		/* finish_map_flush() adds the path again */
+		condlog(2, "%s: delaying path addition until %s is removed",
+			pp->dev, mpp->alias);
+		orphan_path(pp, "waiting for map removal");
+		return 0;
+	}
 	if (mpp && pp->size && mpp->size != pp->size) {
 		condlog(0, "%s: failed to add new path %s, device size mismatch", mpp->alias, pp->dev);
 		int i = find_slot(vecs->pathvec, (void *)pp);
@@ -1142,8 +1381,8 @@ rescan:
 	}
 
 	if ((mpp->action == ACT_CREATE ||
-	     (mpp->action == ACT_NOTHING && start_waiter && !mpp->waiter)) &&
-	    wait_for_events(mpp, vecs))
+	     (mpp->action == ACT_NOTHING && start_waiter)) &&
+	    wait_for_events(mpp))
 			goto fail_map;
 
 	/*
@@ -1157,6 +1396,9 @@ rescan:
 	if (retries >= 0) {
 		condlog(2, "%s [%s]: path added to devmap %s",
 			pp->dev, pp->dev_t, mpp->alias);
+		if (start_waiter)
+			feed_event("map_add %s", mpp->alias);
+		feed_event("path_add %s %s", pp->dev, mpp->alias);
 		return 0;
 	} else
 		goto fail;
@@ -1174,6 +1416,8 @@ uev_remove_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 	struct path *pp;
 
 	condlog(3, "%s: remove path (uevent)", uev->kernel);
+	forget_change_digest(uev->kernel);
+	smart_wait_forget(uev->kernel);
 	delete_foreign(uev->udev);
 
 	pthread_cleanup_push(cleanup_lock, &vecs->lock);
@@ -1181,7 +1425,7 @@ uev_remove_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 	pthread_testcancel();
 	pp = find_path_by_dev(vecs->pathvec, uev->kernel);
 	if (pp)
-		ev_remove_path(pp, vecs, need_do_map);
+		__ev_remove_path(pp, vecs, need_do_map, true);
 	lock_cleanup_pop(vecs->lock);
 	if (!pp) /* Not an error; path might have been purged earlier */
 		condlog(0, "%s: path already removed", uev->kernel);
@@ -1189,12 +1433,14 @@ uev_remove_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 }
 
 int
-ev_remove_path (struct path *pp, struct vectors * vecs, int need_do_map)
+__ev_remove_path (struct path *pp, struct vectors * vecs, int need_do_map,
+		  bool queue_flush)
 {
 	struct multipath * mpp;
 	int i, retval = REMOVE_PATH_SUCCESS;
 	char *params __attribute__((cleanup(cleanup_charp))) = NULL;
 
+	invalidate_device_replies();
 	/*
 	 * avoid referring to the map of an orphaned path
 	 */
@@ -1242,6 +1488,13 @@ ev_remove_path (struct path *pp, struct vectors * vecs, int need_do_map)
 				mpp->stat_map_failures++;
 				dm_queue_if_no_path(mpp->alias, 0);
 			}
+			/* removing the map may take long, don't block */
+			if (queue_flush && queue_map_flush(mpp)) {
+				condlog(3, "%s: last path %s removed",
+					alias, pp->dev);
+				retval = REMOVE_PATH_DELAY;
+				goto out;
+			}
 			if (!flush_map(mpp, vecs, 1)) {
 				condlog(2, "%s: removed map after"
 					" removing all paths",
@@ -1284,8 +1537,10 @@ ev_remove_path (struct path *pp, struct vectors * vecs, int need_do_map)
 			 * update our state from kernel
 			 */
 			char devt[BLK_DEV_SIZE];
+			char dev[FILE_NAME_SIZE];
 
 			strlcpy(devt, pp->dev_t, sizeof(devt));
+			strlcpy(dev, pp->dev, sizeof(dev));
 
 			/* setup_multipath will free the path
 			 * regardless of whether it succeeds or
@@ -1296,6 +1551,7 @@ ev_remove_path (struct path *pp, struct vectors * vecs, int need_do_map)
 
 			condlog(2, "%s: path removed from map %s",
 				devt, mpp->alias);
+			feed_event("path_remove %s %s", dev, mpp->alias);
 		}
 	} else {
 		/* mpp == NULL */
@@ -1320,6 +1576,8 @@ uev_update_path (struct uevent *uev, struct vectors * vecs)
 	struct path * pp;
 	struct config *conf;
 	int needs_reinit = 0;
+	unsigned long long digest = 0;
+	bool settled = false;
 
 	switch ((rc = change_foreign(uev->udev))) {
 	case FOREIGN_OK:
@@ -1354,11 +1612,29 @@ uev_update_path (struct uevent *uev, struct vectors * vecs)
 		if (!strlen(pp->wwid))
 			goto out;
 
+		/*
+		 * udev emits many change uevents that don't change anything we
+		 * care about, e.g. for "udevadm trigger" runs of other tools.
+		 * Only keep the udev device of the uevent then.
+		 */
+		digest = uevent_path_digest(uev, pp->uid_attribute);
+		if (digest && pp->initialized == INIT_OK &&
+		    change_digest_matches(uev->kernel, digest)) {
+			condlog(4, "%s: change uevent without property changes",
+				uev->kernel);
+			udev_device_unref(pp->udev);
+			pp->udev = udev_device_ref(uev->udev);
+			goto out;
+		}
+		forget_change_digest(uev->kernel);
+
 		strcpy(wwid, pp->wwid);
 		rc = get_uid(pp, pp->state, uev->udev, 0);
 
-		if (rc != 0)
+		if (rc != 0) {
 			strcpy(pp->wwid, wwid);
+			hash_path_wwid(pp);
+		}
 		else if (strncmp(wwid, pp->wwid, WWID_SIZE) != 0) {
 			condlog(0, "%s: path wwid changed from '%s' to '%s'",
 				uev->kernel, wwid, pp->wwid);
@@ -1371,14 +1647,15 @@ uev_update_path (struct uevent *uev, struct vectors * vecs)
 			conf = get_multipath_config();
 			pthread_cleanup_push(put_multipath_config, conf);
 			if (pathinfo(pp, conf, DI_SYSFS|DI_NOIO) != PATHINFO_OK)
-				condlog(1, "%s: pathinfo failed after change uevent",
-					uev->kernel);
+				condlog_dev(1, uev->kernel,
+					    "%s: pathinfo failed after change uevent",
+					    uev->kernel);
 			pthread_cleanup_pop(1);
 		}
 
 		ro = uevent_get_disk_ro(uev);
 		if (mpp && ro >= 0) {
-			condlog(2, "%s: update path write_protect to '%d' (uevent)", uev->kernel, ro);
+			condlog_dev(2, uev->kernel, "%s: update path write_protect to '%d' (uevent)", uev->kernel, ro);
 
 			if (mpp->wait_for_udev)
 				mpp->wait_for_udev = 2;
@@ -1394,9 +1671,12 @@ uev_update_path (struct uevent *uev, struct vectors * vecs)
 				}
 			}
 		}
+		settled = pp->initialized == INIT_OK && retval == 0;
 	}
 out:
 	lock_cleanup_pop(vecs->lock);
+	if (settled && digest)
+		set_change_digest(uev->kernel, digest);
 	if (!pp) {
 		/* If the path is blacklisted, print a debug/non-default verbosity message. */
 		if (uev->udev) {
@@ -1408,12 +1688,12 @@ out:
 			pthread_cleanup_pop(1);
 
 			if (retval == PATHINFO_SKIPPED) {
-				condlog(3, "%s: spurious uevent, path is blacklisted", uev->kernel);
+				condlog_dev(3, uev->kernel, "%s: spurious uevent, path is blacklisted", uev->kernel);
 				return 0;
 			}
 		}
 
-		condlog(0, "%s: spurious uevent, path not found", uev->kernel);
+		condlog_dev(0, uev->kernel, "%s: spurious uevent, path not found", uev->kernel);
 	}
 	if (needs_reinit)
 		retval = uev_add_path(uev, vecs, 1);
@@ -1444,6 +1724,7 @@ uev_pathfail_check(struct uevent *uev, struct vectors *vecs)
 	pp = find_path_by_devt(vecs->pathvec, devt);
 	if (!pp)
 		goto out_lock;
+	record_path_failure(pp);
 	r = io_err_stat_handle_pathfail(pp);
 	if (r)
 		condlog(3, "io_err_stat: %s: cannot handle pathfail uevent",
@@ -1458,6 +1739,90 @@ out:
 	return 1;
 }
 
+/*
+ * State of an FC remote port or iSCSI session after a uevent. Paths
+ * behind a lost transport are failed right away; for other state
+ * changes, they are checked in the next checker tick.
+ */
+static bool
+transport_lost(const struct uevent *uev)
+{
+	const char *state;
+
+	if (!strncmp(uev->action, "remove", 6))
+		return true;
+	if (!uev->udev)
+		return false;
+	state = udev_device_get_sysattr_value(uev->udev, "port_state");
+	if (state)
+		return !strcmp(state, "Not Present") ||
+			!strcmp(state, "Lost") ||
+			!strcmp(state, "Deleted");
+	state = udev_device_get_sysattr_value(uev->udev, "state");
+	return state && !strcmp(state, "FAILED");
+}
+
+static int
+uev_transport_event(struct uevent *uev, struct vectors *vecs)
+{
+	char parent[PATH_MAX];
+	const char *devpath;
+	struct path *pp;
+	size_t len;
+	char *p;
+	bool lost;
+	int i, n = 0;
+
+	/* .../rport-0:0-1/fc_remote_ports/rport-0:0-1 -> .../rport-0:0-1 */
+	if (!uev->devpath ||
+	    strlcpy(parent, uev->devpath, sizeof(parent)) >= sizeof(parent))
+		return 1;
+	for (i = 0; i < 2; i++) {
+		p = strrchr(parent, '/');
+		if (!p || p == parent)
+			return 1;
+		*p = '\0';
+	}
+	len = strlen(parent);
+	lost = transport_lost(uev);
+	condlog(3, "%s: %s event for %s, transport %s", uev->kernel,
+		uev->action, parent, lost ? "lost" : "changed");
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	vector_foreach_slot(vecs->pathvec, pp, i) {
+		devpath = pp->udev ? udev_device_get_devpath(pp->udev) : NULL;
+		if (!devpath || strncmp(devpath, parent, len) ||
+		    devpath[len] != '/')
+			continue;
+		n++;
+		if (lost && pp->mpp &&
+		    (pp->state == PATH_UP || pp->state == PATH_GHOST)) {
+			struct multipath *mpp = pp->mpp;
+			bool rec = mpp->in_recovery;
+
+			condlog(2, "%s: transport %s lost, failing path in map %s",
+				pp->dev, uev->kernel, mpp->alias);
+			feed_event("path_fail %s %s", pp->dev, mpp->alias);
+			/* Like check_path(), so that it reinstates the path */
+			set_path_state(pp, PATH_DOWN);
+			pp->chkrstate = PATH_DOWN;
+			if (!dm_fail_path(mpp->alias, pp->dev_t))
+				pp->dmstate = PSTATE_FAILED;
+			update_queue_mode_del_path(mpp);
+			feed_queueing(mpp, rec);
+			mpp->failback_tick = 0;
+			mpp->stat_path_failures++;
+		}
+		set_path_tick(pp, 0);
+	}
+	lock_cleanup_pop(vecs->lock);
+	if (n)
+		condlog(3, "%s: %d paths affected", uev->kernel, n);
+	return 0;
+}
+
 static int
 map_discovery (struct vectors * vecs)
 {
@@ -1496,7 +1861,9 @@ uxsock_trigger (char * str, char ** reply, int * len, bool is_root,
 		return 1;
 	}
 
+	TRACE1(cli_start, str);
 	r = parse_cmd(str, reply, len, vecs, uxsock_timeout / 1000);
+	TRACE2(cli_end, str, r);
 
 	if (r > 0) {
 		if (r == ETIMEDOUT)
@@ -1518,67 +1885,302 @@ uxsock_trigger (char * str, char ** reply, int * len, bool is_root,
 	return r;
 }
 
-int
-uev_trigger (struct uevent * uev, void * trigger_data)
+/* Any uevent for a path may mean that its VPD data changed */
+static void drop_device_caches(const struct uevent *uev)
 {
-	int r = 0;
-	struct vectors * vecs;
-	struct uevent *merge_uev, *tmp;
-	enum daemon_status state;
+	if (uev->udev)
+		vpd_cache_invalidate(udev_device_get_devnum(uev->udev));
+	/* hosts, rports or sessions may have come or gone */
+	if (!strncmp(uev->action, "add", 3) ||
+	    !strncmp(uev->action, "remove", 6))
+		invalidate_udev_cache();
+}
 
-	vecs = (struct vectors *)trigger_data;
+static void
+uev_update_partmap(const struct uevent *uev)
+{
+	bool removed = !strncmp(uev->action, "remove", 6);
+	char *name, *uuid;
 
-	pthread_cleanup_push(config_cleanup, NULL);
-	pthread_mutex_lock(&config_lock);
-	while (running_state != DAEMON_IDLE &&
-	       running_state != DAEMON_RUNNING &&
-	       running_state != DAEMON_SHUTDOWN)
-		pthread_cond_wait(&config_cond, &config_lock);
-	state = running_state;
-	pthread_cleanup_pop(1);
+	if (!removed && strncmp(uev->action, "change", 6))
+		return;
+	name = uevent_get_dm_name(uev);
+	uuid = uevent_get_dm_str(uev, "DM_UUID");
+	dm_partmap_index_update(name, uuid, removed);
+	free(name);
+	free(uuid);
+}
 
-	if (state == DAEMON_SHUTDOWN)
-		return 0;
+/* The block devices seen by uev_resync_paths(), sorted by devnum */
+struct resync_devs {
+	vector devs;
+	/* devs[i] is a known path */
+	bool *known;
+	/* names of the paths whose devices have gone */
+	vector gone;
+};
 
-	/*
-	 * device map event
-	 * Add events are ignored here as the tables
-	 * are not fully initialised then.
-	 */
-	if (!strncmp(uev->kernel, "dm-", 3)) {
-		if (!uevent_is_mpath(uev)) {
-			if (!strncmp(uev->action, "change", 6))
-				(void)add_foreign(uev->udev);
-			else if (!strncmp(uev->action, "remove", 6))
-				(void)delete_foreign(uev->udev);
-			goto out;
-		}
-		if (!strncmp(uev->action, "change", 6)) {
-			r = uev_add_map(uev, vecs);
+static void cleanup_resync_devs(void *arg)
+{
+	struct resync_devs *rd = arg;
+	struct udev_device *dev;
+	char *name;
+	int i;
 
-			/*
-			 * the kernel-side dm-mpath issues a PATH_FAILED event
-			 * when it encounters a path IO error. It is reason-
-			 * able be the entry of path IO error accounting pro-
-			 * cess.
-			 */
-			uev_pathfail_check(uev, vecs);
-		} else if (!strncmp(uev->action, "remove", 6)) {
-			r = uev_remove_map(uev, vecs);
-		}
-		goto out;
-	}
+	vector_foreach_slot(rd->devs, dev, i)
+		udev_device_unref(dev);
+	vector_free(rd->devs);
+	vector_foreach_slot(rd->gone, name, i)
+		free(name);
+	vector_free(rd->gone);
+	free(rd->known);
+}
 
-	/*
-	 * path add/remove/change event, add/remove maybe merged
-	 */
+static int devnum_cmp(const void *a, const void *b)
+{
+	dev_t da = udev_device_get_devnum(*(struct udev_device * const *)a);
+	dev_t db = udev_device_get_devnum(*(struct udev_device * const *)b);
+
+	return da < db ? -1 : da > db;
+}
+
+/* Index of the device with the given devt in rd->devs, or -1 */
+static int find_resync_dev(const struct resync_devs *rd, const char *devt)
+{
+	unsigned int maj, min;
+	int lo = 0, hi = VECTOR_SIZE(rd->devs) - 1;
+	dev_t d;
+
+	if (sscanf(devt, "%u:%u", &maj, &min) != 2)
+		return -1;
+	d = makedev(maj, min);
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		dev_t m = udev_device_get_devnum(VECTOR_SLOT(rd->devs, mid));
+
+		if (m == d)
+			return mid;
+		if (m < d)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
+/* Collect the block devices that uevent_can_discard() would keep */
+static int enumerate_resync_devs(struct resync_devs *rd)
+{
+	struct udev_enumerate *ue;
+	struct udev_list_entry *entry;
+	struct udev_device *dev;
+	struct config *conf;
+	const char *devtype, *name;
+
+	ue = udev_enumerate_new(udev);
+	if (!ue)
+		return -1;
+	if (udev_enumerate_add_match_subsystem(ue, "block") < 0 ||
+	    udev_enumerate_add_match_is_initialized(ue) < 0 ||
+	    udev_enumerate_scan_devices(ue) < 0) {
+		condlog(1, "%s: error setting up udev_enumerate: %m", __func__);
+		udev_enumerate_unref(ue);
+		return -1;
+	}
+	conf = get_multipath_config();
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(ue)) {
+		dev = udev_device_new_from_syspath(udev,
+				udev_list_entry_get_name(entry));
+		if (!dev)
+			continue;
+		devtype = udev_device_get_devtype(dev);
+		name = udev_device_get_sysname(dev);
+		/* maps don't need a resync, dmevents keeps track of them */
+		if (!devtype || strcmp(devtype, "disk") || !name ||
+		    !strncmp(name, "dm-", 3) ||
+		    filter_devnode(conf->blist_devnode, conf->elist_devnode,
+				   name) > 0 ||
+		    !vector_alloc_slot(rd->devs)) {
+			udev_device_unref(dev);
+			continue;
+		}
+		vector_set_slot(rd->devs, dev);
+	}
+	put_multipath_config(conf);
+	udev_enumerate_unref(ue);
+
+	if (VECTOR_SIZE(rd->devs) > 1)
+		qsort(rd->devs->slot, VECTOR_SIZE(rd->devs),
+		      sizeof(*rd->devs->slot), devnum_cmp);
+	rd->known = calloc(VECTOR_SIZE(rd->devs) ?: 1, sizeof(*rd->known));
+	return rd->known ? 0 : -1;
+}
+
+/*
+ * Uevents have been lost in an overrun of the uevent receive buffer.
+ * Instead of discovering all paths again like reconfigure, compare the
+ * block devices with the pathvec by devt, and handle the differences like
+ * the lost add and remove uevents would have been. Paths whose device was
+ * replaced by another one with the same devt are removed and added again,
+ * removed paths whose device is back are added again.
+ */
+static int
+uev_resync_paths (struct vectors * vecs)
+{
+	struct resync_devs rd = { .devs = NULL, };
+	struct udev_device *dev;
+	struct uevent *uev;
+	struct path *pp;
+	char *name;
+	int i, n, r = 0, added = 0, removed = 0;
+
+	condlog(2, "resyncing paths after lost uevents");
+	pthread_cleanup_push(cleanup_resync_devs, &rd);
+	rd.devs = vector_alloc();
+	rd.gone = vector_alloc();
+	if (!rd.devs || !rd.gone || enumerate_resync_devs(&rd) != 0) {
+		condlog(0, "failed to enumerate block devices for resync");
+		r = 1;
+		goto out;
+	}
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	vector_foreach_slot(vecs->pathvec, pp, i) {
+		if (!*pp->dev_t)
+			continue;
+		n = find_resync_dev(&rd, pp->dev_t);
+		if (n >= 0 &&
+		    !strcmp(udev_device_get_sysname(VECTOR_SLOT(rd.devs, n)),
+			    pp->dev)) {
+			if (pp->initialized != INIT_REMOVED)
+				rd.known[n] = true;
+			continue;
+		}
+		if (vector_alloc_slot(rd.gone)) {
+			name = strdup(pp->dev);
+			vector_set_slot(rd.gone, name);
+			if (!name)
+				vector_del_slot(rd.gone, VECTOR_SIZE(rd.gone) - 1);
+		}
+	}
+	lock_cleanup_pop(vecs->lock);
+
+	/* Handle the removals first, the new devices may reuse a devt */
+	vector_foreach_slot(rd.gone, name, i) {
+		forget_change_digest(name);
+		pthread_cleanup_push(cleanup_lock, &vecs->lock);
+		lock(&vecs->lock);
+		pthread_testcancel();
+		pp = find_path_by_dev(vecs->pathvec, name);
+		if (pp) {
+			condlog(2, "%s: device is gone, removing path", name);
+			__ev_remove_path(pp, vecs, 1, true);
+			removed++;
+		}
+		lock_cleanup_pop(vecs->lock);
+	}
+
+	vector_foreach_slot(rd.devs, dev, i) {
+		if (rd.known[i])
+			continue;
+		uev = uevent_from_device(udev_device_ref(dev), "add");
+		if (!uev) {
+			r++;
+			continue;
+		}
+		condlog(3, "%s: device not known, adding path", uev->kernel);
+		r += uev_add_path(uev, vecs, 1);
+		free_uevent(uev);
+		added++;
+	}
+	condlog(2, "resync after lost uevents: %d new devices, %d paths removed",
+		added, removed);
+out:
+	pthread_cleanup_pop(1);
+	return r;
+}
+
+int
+uev_trigger (struct uevent * uev, void * trigger_data)
+{
+	int r = 0;
+	struct vectors * vecs;
+	struct uevent *merge_uev, *tmp;
+	enum daemon_status state;
+
+	vecs = (struct vectors *)trigger_data;
+	/* for "show devices" */
+	invalidate_device_replies();
+
+	pthread_cleanup_push(config_cleanup, NULL);
+	pthread_mutex_lock(&config_lock);
+	while (running_state != DAEMON_IDLE &&
+	       running_state != DAEMON_RUNNING &&
+	       running_state != DAEMON_SHUTDOWN)
+		pthread_cond_wait(&config_cond, &config_lock);
+	state = running_state;
+	pthread_cleanup_pop(1);
+
+	if (state == DAEMON_SHUTDOWN)
+		return 0;
+
+	if (uevent_is_resync(uev)) {
+		r = uev_resync_paths(vecs);
+		goto out;
+	}
+
+	/*
+	 * device map event
+	 * Add events are ignored here as the tables
+	 * are not fully initialised then.
+	 */
+	if (!strncmp(uev->kernel, "dm-", 3)) {
+		if (!uevent_is_mpath(uev)) {
+			uev_update_partmap(uev);
+			if (!strncmp(uev->action, "change", 6))
+				(void)add_foreign(uev->udev);
+			else if (!strncmp(uev->action, "remove", 6))
+				(void)delete_foreign(uev->udev);
+			goto out;
+		}
+		if (!strncmp(uev->action, "change", 6)) {
+			r = uev_add_map(uev, vecs);
+			if (!r)
+				r = uev_map_partitions(uev, vecs);
+
+			/*
+			 * the kernel-side dm-mpath issues a PATH_FAILED event
+			 * when it encounters a path IO error. It is reason-
+			 * able be the entry of path IO error accounting pro-
+			 * cess.
+			 */
+			uev_pathfail_check(uev, vecs);
+		} else if (!strncmp(uev->action, "remove", 6)) {
+			r = uev_remove_map(uev, vecs);
+		}
+		goto out;
+	}
+
+	if (uevent_is_transport(uev)) {
+		drop_device_caches(uev);
+		r = uev_transport_event(uev, vecs);
+		goto out;
+	}
+
+	/*
+	 * path add/remove/change event, add/remove maybe merged
+	 */
 	list_for_each_entry_safe(merge_uev, tmp, &uev->merge_node, node) {
+		drop_device_caches(merge_uev);
 		if (!strncmp(merge_uev->action, "add", 3))
 			r += uev_add_path(merge_uev, vecs, 0);
 		if (!strncmp(merge_uev->action, "remove", 6))
 			r += uev_remove_path(merge_uev, vecs, 0);
 	}
 
+	drop_device_caches(uev);
 	if (!strncmp(uev->action, "add", 3))
 		r += uev_add_path(uev, vecs, 1);
 	if (!strncmp(uev->action, "remove", 6))
@@ -1587,6 +2189,8 @@ uev_trigger (struct uevent * uev, void * trigger_data)
 		r += uev_update_path(uev, vecs);
 
 out:
+	/* the handlers change the state of paths in many places */
+	topology_changed();
 	return r;
 }
 
@@ -1643,31 +2247,67 @@ uxlsnrloop (void * ap)
 	/* Tell main thread that thread has started */
 	post_config_state(DAEMON_CONFIGURE);
 
-	set_handler_callback(LIST+PATHS, cli_list_paths);
-	set_handler_callback(LIST+PATHS+FMT, cli_list_paths_fmt);
-	set_handler_callback(LIST+PATHS+RAW+FMT, cli_list_paths_raw);
-	set_handler_callback(LIST+PATH, cli_list_path);
+	set_shared_handler_callback(LIST+PATHS, cli_list_paths);
+	set_shared_handler_callback(LIST+PATHS+FMT, cli_list_paths_fmt);
+	set_shared_handler_callback(LIST+PATHS+RAW+FMT, cli_list_paths_raw);
+	set_shared_handler_callback(LIST+PATHS+FILTER, cli_list_paths_filter);
+	set_shared_handler_callback(LIST+PATHS+FILTER+FMT,
+				    cli_list_paths_filter);
+	set_shared_handler_callback(LIST+PATHS+FILTER+RAW+FMT,
+				    cli_list_paths_filter_raw);
+	set_shared_handler_callback(LIST+PATHS+JSON, cli_list_paths_json);
+	set_shared_handler_callback(LIST+PATHS+FILTER+JSON,
+				    cli_list_paths_json);
+	set_shared_handler_callback(LIST+PATHS+JSON+FIELDS,
+				    cli_list_paths_json);
+	set_shared_handler_callback(LIST+PATHS+FILTER+JSON+FIELDS,
+				    cli_list_paths_json);
+	set_shared_handler_callback(LIST+PATH, cli_list_path);
+	set_shared_handler_callback(LIST+PATH+HISTORY, cli_list_path_history);
 	set_handler_callback(LIST+MAPS, cli_list_maps);
-	set_handler_callback(LIST+STATUS, cli_list_status);
+	set_unlocked_handler_callback(LIST+STATUS, cli_list_status);
 	set_unlocked_handler_callback(LIST+DAEMON, cli_list_daemon);
+	set_unlocked_handler_callback(LIST+DAEMON+STATS,
+				      cli_list_daemon_stats);
+	set_unlocked_handler_callback(LIST+DAEMON+STATS+JSON,
+				      cli_list_daemon_stats_json);
+	set_shared_handler_callback(LIST+DAEMON+MEMORY, cli_list_daemon_memory);
+	set_shared_handler_callback(FINDMP+PATH+WWID+TIMEOUT,
+				    cli_find_multipaths);
+	set_shared_handler_callback(LIST+METRICS, cli_list_metrics);
+	set_unlocked_handler_callback(LIST+LOCKS, cli_list_locks);
 	set_handler_callback(LIST+MAPS+STATUS, cli_list_maps_status);
 	set_handler_callback(LIST+MAPS+STATS, cli_list_maps_stats);
 	set_handler_callback(LIST+MAPS+FMT, cli_list_maps_fmt);
 	set_handler_callback(LIST+MAPS+RAW+FMT, cli_list_maps_raw);
+	set_handler_callback(LIST+MAPS+FILTER, cli_list_maps_filter);
+	set_handler_callback(LIST+MAPS+FILTER+FMT, cli_list_maps_filter);
+	set_handler_callback(LIST+MAPS+FILTER+RAW+FMT,
+			     cli_list_maps_filter_raw);
+	set_handler_callback(LIST+MAPS+FILTER+JSON, cli_list_maps_filter_json);
 	set_handler_callback(LIST+MAPS+TOPOLOGY, cli_list_maps_topology);
 	set_handler_callback(LIST+TOPOLOGY, cli_list_maps_topology);
 	set_handler_callback(LIST+MAPS+JSON, cli_list_maps_json);
+	set_handler_callback(LIST+MAPS+SINCE+JSON, cli_list_maps_since_json);
 	set_handler_callback(LIST+MAP+TOPOLOGY, cli_list_map_topology);
-	set_handler_callback(LIST+MAP+FMT, cli_list_map_fmt);
-	set_handler_callback(LIST+MAP+RAW+FMT, cli_list_map_fmt);
+	set_shared_handler_callback(LIST+MAP+PATHS, cli_list_map_paths);
+	set_shared_handler_callback(LIST+MAP+FMT, cli_list_map_fmt);
+	set_shared_handler_callback(LIST+MAP+RAW+FMT, cli_list_map_fmt);
 	set_handler_callback(LIST+MAP+JSON, cli_list_map_json);
-	set_handler_callback(LIST+CONFIG+LOCAL, cli_list_config_local);
-	set_handler_callback(LIST+CONFIG, cli_list_config);
-	set_handler_callback(LIST+BLACKLIST, cli_list_blacklist);
-	set_handler_callback(LIST+DEVICES, cli_list_devices);
-	set_handler_callback(LIST+WILDCARDS, cli_list_wildcards);
+	set_shared_handler_callback(LIST+CONFIG+LOCAL, cli_list_config_local);
+	set_shared_handler_callback(LIST+CONFIG, cli_list_config);
+	set_shared_handler_callback(LIST+BLACKLIST, cli_list_blacklist);
+	set_shared_handler_callback(LIST+DEVICES, cli_list_devices);
+	set_shared_handler_callback(LIST+WILDCARDS, cli_list_wildcards);
 	set_handler_callback(RESET+MAPS+STATS, cli_reset_maps_stats);
 	set_handler_callback(RESET+MAP+STATS, cli_reset_map_stats);
+	set_unlocked_handler_callback(RESET+DAEMON+STATS,
+				      cli_reset_daemon_stats);
+	set_unlocked_handler_callback(RESET+LOCKS, cli_reset_locks);
+	set_unlocked_handler_callback(RECORD+UEVENTS+FILENAME,
+				      cli_record_uevents);
+	set_unlocked_handler_callback(STOP+RECORD+UEVENTS,
+				      cli_stop_record_uevents);
 	set_handler_callback(ADD+PATH, cli_add_path);
 	set_handler_callback(DEL+PATH, cli_del_path);
 	set_handler_callback(ADD+MAP, cli_add_map);
@@ -1675,6 +2315,10 @@ uxlsnrloop (void * ap)
 	set_handler_callback(DEL+MAPS, cli_del_maps);
 	set_handler_callback(SWITCH+MAP+GROUP, cli_switch_group);
 	set_unlocked_handler_callback(RECONFIGURE, cli_reconfigure);
+	set_unlocked_handler_callback(RECONFIGURE+ALL, cli_reconfigure_all);
+	set_unlocked_handler_callback(RECONFIGURE+WAIT, cli_reconfigure_wait);
+	set_unlocked_handler_callback(RECONFIGURE+ALL+WAIT,
+				      cli_reconfigure_all_wait);
 	set_handler_callback(SUSPEND+MAP, cli_suspend);
 	set_handler_callback(RESUME+MAP, cli_resume);
 	set_handler_callback(RESIZE+MAP, cli_resize);
@@ -1699,6 +2343,13 @@ uxlsnrloop (void * ap)
 	set_handler_callback(SETMARGINAL+PATH, cli_set_marginal);
 	set_handler_callback(UNSETMARGINAL+PATH, cli_unset_marginal);
 	set_handler_callback(UNSETMARGINAL+MAP, cli_unset_all_marginal);
+	set_unlocked_handler_callback(SUBSCRIBE+EVENTS, cli_subscribe_events);
+
+	set_handler_snapshot(LIST+PATHS, SNAPSHOT_PATHS);
+	set_handler_snapshot(LIST+MAPS, SNAPSHOT_MAPS);
+	set_handler_snapshot(LIST+MAPS+TOPOLOGY, SNAPSHOT_TOPOLOGY);
+	set_handler_snapshot(LIST+TOPOLOGY, SNAPSHOT_TOPOLOGY);
+	set_handler_snapshot(LIST+MAPS+JSON, SNAPSHOT_MAPS_JSON);
 
 	umask(077);
 	uxsock_listen(&uxsock_trigger, ux_sock, ap);
@@ -1716,6 +2367,18 @@ exit_daemon (void)
 	post_config_state(DAEMON_SHUTDOWN);
 }
 
+/*
+ * The checker queues fail and reinstate messages, and sends them per map
+ * after checking all due paths, see flush_path_msgs().
+ */
+static void
+queue_path_msg (struct path *pp, int msg)
+{
+	if (pp->pending_msg == MSG_NONE)
+		pp->mpp->pending_msgs++;
+	pp->pending_msg = msg;
+}
+
 static void
 fail_path (struct path * pp, int del_active)
 {
@@ -1724,10 +2387,15 @@ fail_path (struct path * pp, int del_active)
 
 	condlog(2, "checker failed path %s in map %s",
 		 pp->dev_t, pp->mpp->alias);
+	feed_event("path_fail %s %s", pp->dev, pp->mpp->alias);
+
+	queue_path_msg(pp, MSG_FAIL_PATH);
+	if (del_active) {
+		bool rec = pp->mpp->in_recovery;
 
-	dm_fail_path(pp->mpp->alias, pp->dev_t);
-	if (del_active)
 		update_queue_mode_del_path(pp->mpp);
+		feed_queueing(pp->mpp, rec);
+	}
 }
 
 /*
@@ -1739,11 +2407,106 @@ reinstate_path (struct path * pp)
 	if (!pp->mpp)
 		return;
 
-	if (dm_reinstate_path(pp->mpp->alias, pp->dev_t))
-		condlog(0, "%s: reinstate failed", pp->dev_t);
-	else {
-		condlog(2, "%s: reinstated", pp->dev_t);
-		update_queue_mode_add_path(pp->mpp);
+	feed_event("path_reinstate %s %s", pp->dev, pp->mpp->alias);
+	queue_path_msg(pp, MSG_REINSTATE_PATH);
+}
+
+/*
+ * The kernel raises a dm event for a message that changed the state
+ * of the path, and none if the path already was in that state.
+ */
+static void
+count_msg_event(struct multipath *mpp, int olddmstate, int newdmstate)
+{
+	if (mpp->msgs_evts < 0 || olddmstate == newdmstate)
+		return;
+	if (olddmstate == PSTATE_UNDEF)
+		mpp->msgs_evts = -1;
+	else
+		mpp->msgs_evts++;
+}
+
+/*
+ * Send the messages queued by fail_path() and reinstate_path().
+ * Returns the number of messages sent.
+ */
+static int
+send_path_msgs (struct multipath *mpp)
+{
+	struct path *pp;
+	int i, sent = 0;
+
+	if (!mpp->pending_msgs)
+		return 0;
+
+	vector_foreach_slot(mpp->paths, pp, i) {
+		int msg = pp->pending_msg;
+		int olddmstate = pp->dmstate;
+
+		if (msg == MSG_NONE || pp->mpp != mpp)
+			continue;
+		pp->pending_msg = MSG_NONE;
+		/*
+		 * Track the kernel state of the path locally, the map is
+		 * only resynced lazily, see map_sync_due().
+		 */
+		if (msg == MSG_FAIL_PATH) {
+			if (!dm_fail_path(mpp->alias, pp->dev_t)) {
+				pp->dmstate = PSTATE_FAILED;
+				count_msg_event(mpp, olddmstate,
+						PSTATE_FAILED);
+			}
+		} else if (dm_reinstate_path(mpp->alias, pp->dev_t))
+			condlog(0, "%s: reinstate failed", pp->dev_t);
+		else {
+			bool rec = mpp->in_recovery;
+
+			pp->dmstate = PSTATE_ACTIVE;
+			count_msg_event(mpp, olddmstate, PSTATE_ACTIVE);
+			condlog(2, "%s: reinstated", pp->dev_t);
+			update_queue_mode_add_path(mpp);
+			feed_queueing(mpp, rec);
+		}
+		sent++;
+	}
+	mpp->pending_msgs = 0;
+	if (sent)
+		topology_changed();
+	return sent;
+}
+
+/*
+ * Send all queued path messages. send_path_msgs() has updated the path
+ * states the messages changed, and counted the dm events they cause.
+ * If the event number of the map has advanced by exactly that count
+ * since the last sync, no other event happened in the meantime, and the
+ * dmevents thread may skip the events up to the current number.
+ * Otherwise, the kernel changed the map as well, or hasn't raised all of
+ * our events yet, and the dmevents thread resyncs the map for them.
+ */
+static void
+flush_path_msgs (struct vectors *vecs)
+{
+	struct multipath *mpp;
+	int i;
+
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		send_path_msgs(mpp);
+		if (!mpp->msgs_evts)
+			continue;
+		mpp->msgs_evt_nr = 0;
+		if (mpp->msgs_evts < 0 || dm_get_info(mpp->alias, &mpp->dmi))
+			continue;
+		if (mpp->dmi->event_nr !=
+		    mpp->synced_evt_nr + (uint32_t)mpp->msgs_evts) {
+			condlog(3, "%s: event %u after %d messages since event %u, not skipping events",
+				mpp->alias, mpp->dmi->event_nr,
+				mpp->msgs_evts, mpp->synced_evt_nr);
+			continue;
+		}
+		mpp->msgs_evt_nr = mpp->dmi->event_nr;
+		mpp->synced_evt_nr = mpp->dmi->event_nr;
+		mpp->msgs_evts = 0;
 	}
 }
 
@@ -1770,8 +2533,13 @@ enable_group(struct path * pp)
 	}
 }
 
+/*
+ * names is the list of DM maps, obtained with one DM_DEVICE_LIST
+ * before taking the lock. Maps which aren't in it are double checked, as
+ * they may have been created since.
+ */
 static void
-mpvec_garbage_collector (struct vectors * vecs)
+mpvec_garbage_collector (struct vectors * vecs, const struct _vector *names)
 {
 	struct multipath * mpp;
 	unsigned int i;
@@ -1780,14 +2548,22 @@ mpvec_garbage_collector (struct vectors * vecs)
 		return;
 
 	vector_foreach_slot (vecs->mpvec, mpp, i) {
-		if (mpp && mpp->alias && !dm_map_present(mpp->alias)) {
-			condlog(2, "%s: remove dead map", mpp->alias);
-			remove_map_and_stop_waiter(mpp, vecs);
-			i--;
-		}
+		if (!mpp || !mpp->alias)
+			continue;
+		if ((names && dm_map_in_names(names, mpp->alias)) ||
+		    dm_map_present(mpp->alias))
+			continue;
+		condlog(2, "%s: remove dead map", mpp->alias);
+		remove_map_and_stop_waiter(mpp, vecs);
+		i--;
 	}
 }
 
+static void cleanup_map_names(void *arg)
+{
+	free_strvec(arg);
+}
+
 /* This is called after a path has started working again. It the multipath
  * device for this path uses the followover failback type, and this is the
  * best pathgroup, and this is the first path in the pathgroup to come back
@@ -1814,24 +2590,25 @@ followover_should_failback(struct path * pp)
 	return 1;
 }
 
+/*
+ * The *_tick() functions below only look at the maps in the map timer
+ * list, see schedule_map_timers().
+ */
 static void
 missing_uev_wait_tick(struct vectors *vecs)
 {
-	struct multipath * mpp;
-	unsigned int i;
+	struct multipath *mpp, *tmp;
 	int timed_out = 0, delayed_reconfig;
 	struct config *conf;
 
-	vector_foreach_slot (vecs->mpvec, mpp, i) {
+	list_for_each_entry_safe(mpp, tmp, get_map_timers(), timer_node) {
 		if (mpp->wait_for_udev && --mpp->uev_wait_tick <= 0) {
 			timed_out = 1;
 			condlog(0, "%s: timeout waiting on creation uevent. enabling reloads", mpp->alias);
 			if (mpp->wait_for_udev > 1 &&
-			    update_map(mpp, vecs, 0)) {
+			    update_map(mpp, vecs, 0))
 				/* update_map removed map */
-				i--;
 				continue;
-			}
 			mpp->wait_for_udev = 0;
 		}
 	}
@@ -1849,32 +2626,72 @@ missing_uev_wait_tick(struct vectors *vecs)
 static void
 ghost_delay_tick(struct vectors *vecs)
 {
-	struct multipath * mpp;
-	unsigned int i;
+	struct multipath *mpp, *tmp;
 
-	vector_foreach_slot (vecs->mpvec, mpp, i) {
+	list_for_each_entry_safe(mpp, tmp, get_map_timers(), timer_node) {
 		if (mpp->ghost_delay_tick <= 0)
 			continue;
 		if (--mpp->ghost_delay_tick <= 0) {
 			condlog(0, "%s: timed out waiting for active path",
 				mpp->alias);
 			mpp->force_udev_reload = 1;
-			if (update_map(mpp, vecs, 0) != 0) {
-				/* update_map removed map */
-				i--;
-				continue;
-			}
+			/* update_map() may remove the map */
+			update_map(mpp, vecs, 0);
 		}
 	}
 }
 
 static void
-defered_failback_tick (vector mpvec)
+deferred_reload_tick(struct vectors *vecs)
 {
-	struct multipath * mpp;
-	unsigned int i;
+	struct multipath *mpp, *tmp;
+	int refresh;
+
+	list_for_each_entry_safe(mpp, tmp, get_map_timers(), timer_node) {
+		if (mpp->reload_tick > 0 && --mpp->reload_tick == 0) {
+			condlog(2, "%s: performing deferred reload",
+				mpp->alias);
+			refresh = mpp->reload_refresh;
+			mpp->reload_refresh = 0;
+			reload_and_sync_map(mpp, vecs, refresh);
+		}
+	}
+}
+
+static void
+io_stats_tick(struct vectors *vecs)
+{
+	struct multipath *mpp;
+	struct config *conf;
+	unsigned int checkint;
+	int i, enabled;
 
-	vector_foreach_slot (mpvec, mpp, i) {
+	conf = get_multipath_config();
+	enabled = conf->io_stats == YN_YES;
+	checkint = conf->checkint;
+	put_multipath_config(conf);
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		/* selector_autotune needs the stats of the map */
+		if (!enabled && mpp->selector_autotune != YNU_YES)
+			continue;
+		if (!sample_map_io_stats(mpp, checkint) ||
+		    mpp->selector_autotune != YNU_YES ||
+		    !io_stats_tune(&mpp->io_tune, &mpp->io_stats))
+			continue;
+		condlog(2, "%s: retuning path selector for %s workload",
+			mpp->alias, io_workload_name(mpp->io_tune.applied));
+		/* The map may be removed */
+		if (reload_and_sync_map(mpp, vecs, 0) == 2)
+			i--;
+	}
+}
+
+static void
+defered_failback_tick (void)
+{
+	struct multipath *mpp, *tmp;
+
+	list_for_each_entry_safe(mpp, tmp, get_map_timers(), timer_node) {
 		/*
 		 * deferred failback getting sooner
 		 */
@@ -1888,12 +2705,11 @@ defered_failback_tick (vector mpvec)
 }
 
 static void
-retry_count_tick(vector mpvec)
+retry_count_tick(void)
 {
-	struct multipath *mpp;
-	unsigned int i;
+	struct multipath *mpp, *tmp;
 
-	vector_foreach_slot (mpvec, mpp, i) {
+	list_for_each_entry_safe(mpp, tmp, get_map_timers(), timer_node) {
 		if (mpp->retry_tick > 0) {
 			mpp->stat_total_queueing_time++;
 			condlog(4, "%s: Retrying.. No active path", mpp->alias);
@@ -1901,28 +2717,31 @@ retry_count_tick(vector mpvec)
 				mpp->stat_map_failures++;
 				dm_queue_if_no_path(mpp->alias, 0);
 				condlog(2, "%s: Disable queueing", mpp->alias);
+				feed_event("queueing %s off", mpp->alias);
 			}
 		}
 	}
 }
 
-int update_prio(struct path *pp, int refresh_all)
+static int __update_prio(struct path *pp, int refresh_all,
+			 struct config *conf)
 {
 	int oldpriority;
 	struct path *pp1;
 	struct pathgroup * pgp;
+	struct timespec now;
 	int i, j, changed = 0;
-	struct config *conf;
 
 	if (refresh_all) {
+		get_monotonic_time(&now);
 		vector_foreach_slot (pp->mpp->pg, pgp, i) {
 			vector_foreach_slot (pgp->paths, pp1, j) {
+				if (conf->prio_max_age > 0 &&
+				    prio_is_fresh(pp1, conf->prio_max_age,
+						  &now))
+					continue;
 				oldpriority = pp1->priority;
-				conf = get_multipath_config();
-				pthread_cleanup_push(put_multipath_config,
-						     conf);
-				pathinfo(pp1, conf, DI_PRIO);
-				pthread_cleanup_pop(1);
+				pathinfo(pp1, conf, DI_PRIO | DI_ASYNC);
 				if (pp1->priority != oldpriority)
 					changed = 1;
 			}
@@ -1930,17 +2749,26 @@ int update_prio(struct path *pp, int refresh_all)
 		return changed;
 	}
 	oldpriority = pp->priority;
-	conf = get_multipath_config();
-	pthread_cleanup_push(put_multipath_config, conf);
 	if (pp->state != PATH_DOWN)
-		pathinfo(pp, conf, DI_PRIO);
-	pthread_cleanup_pop(1);
+		pathinfo(pp, conf, DI_PRIO | DI_ASYNC);
 
 	if (pp->priority == oldpriority)
 		return 0;
 	return 1;
 }
 
+/* conf must be held by the caller */
+static int update_prio(struct path *pp, int refresh_all, struct config *conf)
+{
+	struct timespec start;
+	int rc;
+
+	get_monotonic_time(&start);
+	rc = __update_prio(pp, refresh_all, conf);
+	loop_stat_since(LOOP_STAT_UPDATE_PRIO, &start);
+	return rc;
+}
+
 static int reload_map(struct vectors *vecs, struct multipath *mpp, int refresh,
 		      int is_daemon)
 {
@@ -1948,6 +2776,12 @@ static int reload_map(struct vectors *vecs, struct multipath *mpp, int refresh,
 	struct path *pp;
 	int i, r;
 
+	/* This reload serves a deferred one, too */
+	if (mpp->reload_tick > 0) {
+		refresh |= mpp->reload_refresh;
+		mpp->reload_tick = 0;
+		mpp->reload_refresh = 0;
+	}
 	update_mpp_paths(mpp, vecs->pathvec);
 	if (refresh) {
 		vector_foreach_slot (mpp->paths, pp, i) {
@@ -1986,7 +2820,32 @@ int reload_and_sync_map(struct multipath *mpp,
 	if (setup_multipath(vecs, mpp) != 0)
 		return 2;
 	sync_map_state(mpp);
+	feed_event("map_reload %s", mpp->alias);
+
+	return 0;
+}
 
+/*
+ * Reload mpp like reload_and_sync_map(), or, if debounce is set, debounce
+ * checker ticks later. Requests arriving meanwhile are merged into that
+ * reload. Maps without usable paths are reloaded right away, as the
+ * reload may be what makes them usable again.
+ * Returns 0 if the reload has been deferred.
+ */
+static int
+request_map_reload(struct multipath *mpp, struct vectors *vecs, int refresh,
+		   unsigned int debounce)
+{
+	if (!debounce || count_active_paths(mpp) == 0)
+		return reload_and_sync_map(mpp, vecs, refresh);
+
+	mpp->reload_refresh |= refresh;
+	if (mpp->reload_tick <= 0) {
+		condlog(3, "%s: deferring reload by %u seconds", mpp->alias,
+			debounce);
+		mpp->reload_tick = debounce;
+		schedule_map_timers(mpp);
+	}
 	return 0;
 }
 
@@ -2100,22 +2959,420 @@ should_skip_path(struct path *pp){
 }
 
 /*
- * Returns '1' if the path has been checked, '-1' if it was blacklisted
- * and '0' otherwise
+ * Mirrors the conditions under which check_path() calls the path
+ * checker in this tick. Paths without a selected checker are left
+ * to check_path(), because selecting one requires pathinfo().
  */
-int
-check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
+static bool
+path_check_due(const struct path *pp, unsigned int ticks)
 {
-	int newstate;
-	int new_path_up = 0;
-	int chkr_new_path_up = 0;
-	int disable_reinstate = 0;
-	int oldchkrstate = pp->chkrstate;
-	int retrigger_tries;
-	unsigned int checkint, max_checkint;
+	if (((pp->initialized == INIT_OK ||
+	      pp->initialized == INIT_REQUESTED_UDEV) && !pp->mpp) ||
+	    pp->initialized == INIT_REMOVED)
+		return false;
+	if (pp->tick > ticks)
+		return false;
+	if (!pp->mpp && pp->initialized == INIT_MISSING_UDEV)
+		return false;
+	/* checker_mp_init() modifies the map-wide context */
+	if (pp->mpp && !pp->checker.mpcontext)
+		return false;
+	return checker_selected(&pp->checker);
+}
+
+static int
+get_new_path_state(struct path *pp, struct config *conf)
+{
+	int newstate;
+
+	newstate = path_offline(pp);
+	if (newstate == PATH_UP) {
+		struct timespec start, now;
+
+		get_monotonic_time(&start);
+		newstate = get_state(pp, conf, 1, newstate);
+		get_monotonic_time(&now);
+		timespecsub(&now, &start, &now);
+		checker_stat_record(checker_name(&pp->checker), &now);
+	} else {
+		checker_clear_message(&pp->checker);
+		condlog(3, "%s: state %s, checker not called",
+			pp->dev, checker_state_name(newstate));
+	}
+	return newstate;
+}
+
+static void
+precheck_path(void *item, __attribute__((unused)) void *arg)
+{
+	struct path *pp = item;
+	struct config *conf;
+
+	bind_numa_node(pp->numa_node);
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	pp->prechecked_state = get_new_path_state(pp, conf);
+	pthread_cleanup_pop(1);
+}
+
+/* Order checks by NUMA node, so that workers rarely change nodes */
+static int
+numa_node_cmp(const void *a, const void *b)
+{
+	const struct path *pa = *(struct path * const *)a;
+	const struct path *pb = *(struct path * const *)b;
+
+	return pa->numa_node - pb->numa_node;
+}
+
+/*
+ * Like precheck_path() for all paths in batch, whose checkers support
+ * checking multiple paths at once.
+ */
+static void
+precheck_batch(const struct _vector *batch)
+{
+	struct config *conf;
+	struct checker **checkers;
+	struct path **paths;
+	int *in, *out;
+	struct path *pp;
+	struct timespec start, now;
+	int i, n = 0, nr = VECTOR_SIZE(batch);
+
+	if (nr == 0)
+		return;
+	checkers = calloc(nr, sizeof(*checkers));
+	paths = calloc(nr, sizeof(*paths));
+	in = calloc(nr, sizeof(*in));
+	out = calloc(nr, sizeof(*out));
+	if (!checkers || !paths || !in || !out) {
+		vector_foreach_slot(batch, pp, i)
+			precheck_path(pp, NULL);
+		goto out;
+	}
+
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	vector_foreach_slot(batch, pp, i) {
+		int state = path_offline(pp);
+
+		if (state == PATH_UP)
+			state = prepare_checker(pp, conf, 1);
+		else {
+			checker_clear_message(&pp->checker);
+			condlog(3, "%s: state %s, checker not called",
+				pp->dev, checker_state_name(state));
+		}
+		if (state != 0) {
+			pp->prechecked_state = state;
+			continue;
+		}
+		paths[n] = pp;
+		checkers[n] = &pp->checker;
+		in[n++] = PATH_UP;
+	}
+	pthread_cleanup_pop(1);
+
+	get_monotonic_time(&start);
+	checker_check_batch(checkers, in, out, n);
+	get_monotonic_time(&now);
+	if (n > 0) {
+		/* account the batch as n checks of the average duration */
+		timespecsub(&now, &start, &now);
+		now.tv_nsec = ((now.tv_sec % n) * 1000000000L +
+			       now.tv_nsec) / n;
+		now.tv_sec /= n;
+	}
+	for (i = 0; i < n; i++) {
+		checker_stat_record(checker_name(checkers[i]), &now);
+		log_checker_state(paths[i], out[i]);
+		paths[i]->prechecked_state = out[i];
+	}
+out:
+	free(out);
+	free(in);
+	free(paths);
+	free(checkers);
+}
+
+/*
+ * Checkers that can check multiple paths at once get all their paths in
+ * one call, the others run in parallel if a worker pool is available.
+ */
+static void
+run_prechecks(const struct _vector *paths, struct worker_pool *pool)
+{
+	struct _vector checks = { .allocated = 0, .slot = NULL };
+	struct _vector batch = { .allocated = 0, .slot = NULL };
+	struct path *pp;
+	vector v;
+	int i;
+
+	vector_foreach_slot(paths, pp, i) {
+		if (pp->numa_node == NUMA_NODE_UNSET)
+			pp->numa_node = pp->udev ?
+				devt_numa_node(udev_device_get_devnum(pp->udev)) :
+				-1;
+		v = checker_has_batch(&pp->checker) ? &batch : &checks;
+		if (!vector_alloc_slot(v))
+			break;
+		vector_set_slot(v, pp);
+	}
+	if (checks.allocated > 1)
+		qsort(checks.slot, checks.allocated, sizeof(*checks.slot),
+		      numa_node_cmp);
+	precheck_batch(&batch);
+	worker_pool_run(pool, &checks, precheck_path, NULL);
+	vector_reset(&batch);
+	vector_reset(&checks);
+}
+
+/* Order paths by target, see same_target() */
+static int
+target_cmp(const void *a, const void *b)
+{
+	const struct path *pa = *(struct path * const *)a;
+	const struct path *pb = *(struct path * const *)b;
+
+	if (pa->bus != pb->bus)
+		return pa->bus < pb->bus ? -1 : 1;
+	if (pa->sg_id.host_no != pb->sg_id.host_no)
+		return pa->sg_id.host_no < pb->sg_id.host_no ? -1 : 1;
+	if (pa->sg_id.channel != pb->sg_id.channel)
+		return pa->sg_id.channel < pb->sg_id.channel ? -1 : 1;
+	if (pa->sg_id.scsi_id != pb->sg_id.scsi_id)
+		return pa->sg_id.scsi_id < pb->sg_id.scsi_id ? -1 : 1;
+	if (pa->checker.cls != pb->checker.cls)
+		return (uintptr_t)pa->checker.cls < (uintptr_t)pb->checker.cls ?
+			-1 : 1;
+	return 0;
+}
+
+/* End of the group of paths through the same target starting at s */
+static int
+group_end(const struct _vector *sorted, int s)
+{
+	int e = s + 1;
+
+	while (e < VECTOR_SIZE(sorted) &&
+	       same_target(VECTOR_SLOT(sorted, s), VECTOR_SLOT(sorted, e)))
+		e++;
+	return e;
+}
+
+/*
+ * The checker of the first path through the same target timed out, and
+ * either the transport reports the target down (second == NULL), or the
+ * checker of a second path timed out as well. pp inherits the result
+ * without calling its checker, which would only time out, too.
+ */
+static void
+precheck_timed_out_target(struct path *pp, const struct path *first,
+			  const struct path *second)
+{
+	int state = path_offline(pp);
+
+	checker_clear_message(&pp->checker);
+	if (state != PATH_UP)
+		condlog(3, "%s: state %s, checker not called",
+			pp->dev, checker_state_name(state));
+	else if (second) {
+		condlog(2, "%s: inheriting checker timeout of %s and %s, "
+			"target %d:%d:%d unreachable", pp->dev, first->dev,
+			second->dev, pp->sg_id.host_no, pp->sg_id.channel,
+			pp->sg_id.scsi_id);
+		state = PATH_TIMEOUT;
+	} else {
+		condlog(2, "%s: inheriting checker timeout of %s, "
+			"transport of target %d:%d:%d down", pp->dev,
+			first->dev, pp->sg_id.host_no, pp->sg_id.channel,
+			pp->sg_id.scsi_id);
+		state = PATH_TIMEOUT;
+	}
+	pp->prechecked_state = state;
+}
+
+/*
+ * sorted holds the due paths ordered by target, and the first path of
+ * each target has been checked. If it timed out, and the transport
+ * doesn't report the target down, check a second path of the target.
+ * Then settle or check the remaining paths.
+ */
+static void
+precheck_siblings(const struct _vector *sorted, struct worker_pool *pool)
+{
+	struct _vector v = { .allocated = 0, .slot = NULL };
+	struct path *pp, *first, *second;
+	int s, e, i;
+
+	for (s = 0; s < VECTOR_SIZE(sorted); s = e) {
+		e = group_end(sorted, s);
+		first = VECTOR_SLOT(sorted, s);
+		if (e - s < 2 || first->prechecked_state != PATH_TIMEOUT)
+			continue;
+		if (sysfs_target_unreachable(first) == 1) {
+			for (i = s + 1; i < e; i++)
+				precheck_timed_out_target(VECTOR_SLOT(sorted, i),
+							  first, NULL);
+			continue;
+		}
+		if (!vector_alloc_slot(&v))
+			break;
+		vector_set_slot(&v, VECTOR_SLOT(sorted, s + 1));
+	}
+	run_prechecks(&v, pool);
+	vector_reset(&v);
+
+	for (s = 0; s < VECTOR_SIZE(sorted); s = e) {
+		e = group_end(sorted, s);
+		first = VECTOR_SLOT(sorted, s);
+		second = e - s > 1 ? VECTOR_SLOT(sorted, s + 1) : NULL;
+		for (i = s + 1; i < e; i++) {
+			pp = VECTOR_SLOT(sorted, i);
+			/* checked above, or inherited the timeout */
+			if (pp->prechecked_state != PATH_MAX_STATE)
+				continue;
+			if (pp != second &&
+			    first->prechecked_state == PATH_TIMEOUT &&
+			    second->prechecked_state == PATH_TIMEOUT) {
+				precheck_timed_out_target(pp, first, second);
+				continue;
+			}
+			if (!vector_alloc_slot(&v))
+				goto run;
+			vector_set_slot(&v, pp);
+		}
+	}
+run:
+	run_prechecks(&v, pool);
+	vector_reset(&v);
+}
+
+/*
+ * Run the checkers of all paths that are due in this tick. The caller
+ * holds vecs->lock at least shared; check_path() picks up the results.
+ *
+ * Paths to different LUNs behind the same SCSI target fail together
+ * when the target becomes unreachable, and every one of them would wait
+ * for the full checker timeout. So one path per target is checked first.
+ * A timeout may still be specific to a LUN. It's only passed on to the
+ * other due paths of that target if the FC remote port or iSCSI session
+ * is down, or if the checker of a second path times out as well. Other
+ * failures aren't passed on. The due paths are sorted by target, so
+ * that the paths of a target are next to each other.
+ */
+static void
+precheck_paths(const struct _vector *due, struct worker_pool *pool,
+	       unsigned int ticks)
+{
+	struct _vector sorted = { .allocated = 0, .slot = NULL };
+	struct _vector first = { .allocated = 0, .slot = NULL };
+	struct path *pp;
+	int i;
+
+	for (i = 0; i < VECTOR_SIZE(due); i++) {
+		pp = VECTOR_SLOT(due, i);
+		if (!pp || !path_check_due(pp, ticks))
+			continue;
+		if (!vector_alloc_slot(&sorted))
+			break;
+		vector_set_slot(&sorted, pp);
+	}
+	if (sorted.allocated > 1)
+		qsort(sorted.slot, sorted.allocated, sizeof(*sorted.slot),
+		      target_cmp);
+	for (i = 0; i < sorted.allocated; i = group_end(&sorted, i)) {
+		if (!vector_alloc_slot(&first))
+			break;
+		vector_set_slot(&first, sorted.slot[i]);
+	}
+	run_prechecks(&first, pool);
+	vector_reset(&first);
+	precheck_siblings(&sorted, pool);
+	vector_reset(&sorted);
+}
+
+static void
+cleanup_due_paths(void *arg)
+{
+	end_due_paths();
+	vector_reset(arg);
+}
+
+/*
+ * Kernel state changes that we don't cause ourselves generate dm events,
+ * and the dmevents thread resyncs the map for them. So check_path() needs
+ * to resync a map only to verify that no event got lost, and does that at
+ * most once per checkint. Paths in an unknown kernel state always force
+ * a resync.
+ */
+static bool
+map_sync_due(const struct path *pp, unsigned int checkint)
+{
+	struct timespec now;
+
+	if (pp->dmstate == PSTATE_UNDEF || !pp->mpp->synced_at)
+		return true;
+	get_monotonic_time(&now);
+	return now.tv_sec - pp->mpp->synced_at >= (time_t)checkint;
+}
+
+/*
+ * The configuration used by check_path(), taken once per checker pass,
+ * so that the checks in one pass don't see different values.
+ */
+struct check_conf {
 	struct config *conf;
-	int marginal_pathgroups, marginal_changed = 0;
+	unsigned int checkint;
+	unsigned int max_checkint;
+	int retrigger_tries;
+	int marginal_pathgroups;
+	int adaptive;
+	int max_rate;
+	int log_checker_err;
+	unsigned int reload_debounce;
+	int io_stats;
+};
+
+/* conf must be held until the check_conf isn't used any more */
+static void
+init_check_conf(struct check_conf *cc, struct config *conf)
+{
+	cc->conf = conf;
+	cc->checkint = conf->checkint;
+	cc->max_checkint = conf->max_checkint;
+	cc->retrigger_tries = conf->retrigger_tries;
+	cc->marginal_pathgroups = conf->marginal_pathgroups;
+	cc->adaptive = conf->adaptive_checkint;
+	cc->max_rate = conf->max_check_rate;
+	cc->log_checker_err = conf->log_checker_err;
+	cc->reload_debounce = conf->reload_debounce;
+	cc->io_stats = conf->io_stats == YN_YES;
+}
+
+/*
+ * Returns '1' if the path has been checked, '-1' if it was blacklisted
+ * and '0' otherwise
+ */
+static int
+check_path (struct vectors * vecs, struct path * pp, unsigned int ticks,
+	    const struct check_conf *cc)
+{
+	int newstate;
+	int new_path_up = 0;
+	int chkr_new_path_up = 0;
+	int disable_reinstate = 0;
+	int oldchkrstate = pp->chkrstate;
+	int retrigger_tries = cc->retrigger_tries;
+	unsigned int checkint = cc->checkint;
+	unsigned int max_checkint = cc->max_checkint;
+	struct config *conf = cc->conf;
+	int marginal_pathgroups = cc->marginal_pathgroups;
+	int marginal_changed = 0;
+	int adaptive = cc->adaptive, max_rate = cc->max_rate;
 	int ret;
+	struct timespec start;
 
 	if (((pp->initialized == INIT_OK ||
 	      pp->initialized == INIT_REQUESTED_UDEV) && !pp->mpp) ||
@@ -2127,12 +3384,9 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	if (pp->tick)
 		return 0; /* don't check this path yet */
 
-	conf = get_multipath_config();
-	retrigger_tries = conf->retrigger_tries;
-	checkint = conf->checkint;
-	max_checkint = conf->max_checkint;
-	marginal_pathgroups = conf->marginal_pathgroups;
-	put_multipath_config(conf);
+	/* the CLI readers can't fill in the counts under the shared lock */
+	if (pp->mpp)
+		update_path_counts(pp->mpp);
 
 	if (pp->checkint == CHECKINT_UNDEF) {
 		condlog(0, "%s: BUG: checkint is not set", pp->dev);
@@ -2145,6 +3399,7 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 				pp->dev);
 			pp->initialized = INIT_REQUESTED_UDEV;
 			pp->retriggers++;
+			forget_change_digest(pp->dev);
 			sysfs_attr_set_value(pp->udev, "uevent", "change",
 					     strlen("change"));
 			return 0;
@@ -2168,19 +3423,13 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	 * provision a next check soonest,
 	 * in case we exit abnormaly from here
 	 */
-	pp->tick = checkint;
+	set_path_tick(pp, checkint);
 
-	newstate = path_offline(pp);
-	if (newstate == PATH_UP) {
-		conf = get_multipath_config();
-		pthread_cleanup_push(put_multipath_config, conf);
-		newstate = get_state(pp, conf, 1, newstate);
-		pthread_cleanup_pop(1);
-	} else {
-		checker_clear_message(&pp->checker);
-		condlog(3, "%s: state %s, checker not called",
-			pp->dev, checker_state_name(newstate));
-	}
+	if (pp->prechecked_state != PATH_MAX_STATE) {
+		newstate = pp->prechecked_state;
+		pp->prechecked_state = PATH_MAX_STATE;
+	} else
+		newstate = get_new_path_state(pp, conf);
 	/*
 	 * Wait for uevent for removed paths;
 	 * some LLDDs like zfcp keep paths unavailable
@@ -2193,15 +3442,12 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 		condlog(2, "%s: unusable path (%s) - checker failed",
 			pp->dev, checker_state_name(newstate));
 		LOG_MSG(2, pp);
-		conf = get_multipath_config();
-		pthread_cleanup_push(put_multipath_config, conf);
 		pathinfo(pp, conf, 0);
-		pthread_cleanup_pop(1);
 		return 1;
 	} else if ((newstate != PATH_UP && newstate != PATH_GHOST &&
 		    newstate != PATH_PENDING) && (pp->state == PATH_DELAYED)) {
 		/* If path state become failed again cancel path delay state */
-		pp->state = newstate;
+		set_path_state(pp, newstate);
 		/*
 		 * path state bad again should change the check interval time
 		 * to the shortest delay
@@ -2215,14 +3461,11 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 		     pp->initialized == INIT_NEW) &&
 		    (newstate == PATH_UP || newstate == PATH_GHOST)) {
 			condlog(2, "%s: add missing path", pp->dev);
-			conf = get_multipath_config();
-			pthread_cleanup_push(put_multipath_config, conf);
 			ret = pathinfo(pp, conf, DI_ALL | DI_BLACKLIST);
-			pthread_cleanup_pop(1);
 			/* INIT_OK implies ret == PATHINFO_OK */
 			if (pp->initialized == INIT_OK) {
 				ev_add_path(pp, vecs, 1);
-				pp->tick = 1;
+				set_path_tick(pp, 1);
 			} else {
 				if (ret == PATHINFO_SKIPPED)
 					return -1;
@@ -2240,23 +3483,28 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	 * and reschedule as soon as possible
 	 */
 	if (newstate == PATH_PENDING) {
-		pp->tick = 1;
+		set_path_tick(pp, 1);
+		set_path_pending(pp);
 		return 0;
 	}
 	/*
 	 * Synchronize with kernel state
 	 */
-	ret = update_multipath_strings(pp->mpp, vecs->pathvec);
-	if (ret != DMP_OK) {
-		if (ret == DMP_NOT_FOUND) {
-			/* multipath device missing. Likely removed */
-			condlog(1, "%s: multipath device '%s' not found",
-				pp->dev, pp->mpp ? pp->mpp->alias : "");
-			return 0;
-		} else
-			condlog(1, "%s: Couldn't synchronize with kernel state",
-				pp->dev);
-		pp->dmstate = PSTATE_UNDEF;
+	if (map_sync_due(pp, checkint)) {
+		get_monotonic_time(&start);
+		ret = update_multipath_strings(pp->mpp, vecs->pathvec);
+		loop_stat_since(LOOP_STAT_MPATH_STRINGS, &start);
+		if (ret != DMP_OK) {
+			if (ret == DMP_NOT_FOUND) {
+				/* multipath device missing. Likely removed */
+				condlog(1, "%s: multipath device '%s' not found",
+					pp->dev, pp->mpp ? pp->mpp->alias : "");
+				return 0;
+			} else
+				condlog(1, "%s: Couldn't synchronize with kernel state",
+					pp->dev);
+			pp->dmstate = PSTATE_UNDEF;
+		}
 	}
 	/* if update_multipath_strings orphaned the path, quit early */
 	if (!pp->mpp)
@@ -2284,12 +3532,13 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 					/* to reschedule as soon as possible,
 					 * so that this path can be recovered
 					 * in time */
-					pp->tick = 1;
-				pp->state = PATH_DELAYED;
+					set_path_tick(pp, 1);
+				set_path_state(pp, PATH_DELAYED);
 				return 1;
 			}
 			if (!pp->marginal) {
 				pp->marginal = 1;
+				invalidate_pg_prios();
 				marginal_changed = 1;
 			}
 		} else {
@@ -2298,6 +3547,7 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 					pp->dev);
 			if (marginal_pathgroups && pp->marginal) {
 				pp->marginal = 0;
+				invalidate_pg_prios();
 				marginal_changed = 1;
 			}
 		}
@@ -2313,10 +3563,18 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 			     count_active_paths(pp->mpp) == 0 &&
 			     path_get_tpgs(pp) == TPGS_IMPLICIT) ? 1 : 0;
 
+	if (newstate != pp->chkrstate || !pp->chkrstate_since) {
+		struct timespec now;
+
+		get_monotonic_time(&now);
+		pp->chkrstate_since = now.tv_sec;
+	}
 	pp->chkrstate = newstate;
 	if (newstate != pp->state) {
 		int oldstate = pp->state;
-		pp->state = newstate;
+
+		record_path_transition(pp, newstate);
+		set_path_state(pp, newstate);
 
 		LOG_MSG(1, pp);
 
@@ -2324,18 +3582,20 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 		 * upon state change, reset the checkint
 		 * to the shortest delay
 		 */
-		conf = get_multipath_config();
-		pp->checkint = conf->checkint;
-		put_multipath_config(conf);
+		pp->checkint = checkint;
+		add_instability(pp, INSTABILITY_STATE_CHANGE);
 
 		if (newstate != PATH_UP && newstate != PATH_GHOST) {
 			/*
 			 * proactively fail path in the DM
 			 */
 			if (oldstate == PATH_UP ||
-			    oldstate == PATH_GHOST)
+			    oldstate == PATH_GHOST) {
 				fail_path(pp, 1);
-			else
+				if (adaptive)
+					recheck_target_paths(vecs->pathvec, pp,
+							     checkint);
+			} else
 				fail_path(pp, 0);
 
 			/*
@@ -2382,21 +3642,17 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 			/* Clear IO errors */
 			reinstate_path(pp);
 		else {
-			LOG_MSG(4, pp);
-			if (pp->checkint != max_checkint) {
-				/*
-				 * double the next check delay.
-				 * max at conf->max_checkint
-				 */
-				if (pp->checkint < (max_checkint / 2))
-					pp->checkint = 2 * pp->checkint;
-				else
-					pp->checkint = max_checkint;
+			unsigned int next;
 
+			LOG_MSG(4, pp);
+			next = next_checkint(pp, checkint, max_checkint,
+					     adaptive, max_rate);
+			if (next != pp->checkint) {
+				pp->checkint = next;
 				condlog(4, "%s: delay next check %is",
 					pp->dev_t, pp->checkint);
 			}
-			pp->tick = pp->checkint;
+			set_path_tick(pp, pp->checkint);
 		}
 	}
 	else if (newstate != PATH_UP && newstate != PATH_GHOST) {
@@ -2404,19 +3660,21 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 		    pp->dmstate == PSTATE_UNDEF)
 			fail_path(pp, 0);
 		if (newstate == PATH_DOWN) {
-			int log_checker_err;
-
-			conf = get_multipath_config();
-			log_checker_err = conf->log_checker_err;
-			put_multipath_config(conf);
-			if (log_checker_err == LOG_CHKR_ERR_ONCE)
+			if (cc->log_checker_err == LOG_CHKR_ERR_ONCE)
 				LOG_MSG(3, pp);
 			else
 				LOG_MSG(2, pp);
 		}
 	}
 
-	pp->state = newstate;
+	set_path_state(pp, newstate);
+	if (newstate == PATH_UP || newstate == PATH_GHOST) {
+		sample_path_latency(pp);
+		if (cc->io_stats)
+			sample_path_io_stats(pp);
+	}
+	if (io_err_stat_check_health(pp))
+		fail_path(pp, 0);
 
 	if (pp->mpp->wait_for_udev)
 		return 1;
@@ -2425,43 +3683,424 @@ check_path (struct vectors * vecs, struct path * pp, unsigned int ticks)
 	 */
 	condlog(4, "path prio refresh");
 
-	if (marginal_changed)
-		reload_and_sync_map(pp->mpp, vecs, 1);
-	else if (update_prio(pp, new_path_up) &&
+	if (marginal_changed) {
+		send_path_msgs(pp->mpp);
+		request_map_reload(pp->mpp, vecs, 1, cc->reload_debounce);
+	} else if (update_prio(pp, new_path_up, conf) &&
 	    (pp->mpp->pgpolicyfn == (pgpolicyfn *)group_by_prio) &&
 	     pp->mpp->pgfailback == -FAILBACK_IMMEDIATE) {
-		condlog(2, "%s: path priorities changed. reloading",
-			pp->mpp->alias);
-		reload_and_sync_map(pp->mpp, vecs, !new_path_up);
+		/* Refresh the other priorities before looking at the groups */
+		bool need_switch = need_switch_pathgroup(pp->mpp, !new_path_up);
+
+		send_path_msgs(pp->mpp);
+		if (!prio_groups_unchanged(pp->mpp)) {
+			condlog(2, "%s: path priorities changed. reloading",
+				pp->mpp->alias);
+			request_map_reload(pp->mpp, vecs, 0,
+					   cc->reload_debounce);
+		} else if (need_switch) {
+			condlog(3, "%s: path priorities changed, groups unchanged",
+				pp->mpp->alias);
+			switch_pathgroup(pp->mpp);
+		}
 	} else if (need_switch_pathgroup(pp->mpp, 0)) {
 		if (pp->mpp->pgfailback > 0 &&
-		    (new_path_up || pp->mpp->failback_tick <= 0))
+		    (new_path_up || pp->mpp->failback_tick <= 0)) {
 			pp->mpp->failback_tick =
 				pp->mpp->pgfailback + 1;
-		else if (pp->mpp->pgfailback == -FAILBACK_IMMEDIATE ||
-			 (chkr_new_path_up && followover_should_failback(pp)))
+			schedule_map_timers(pp->mpp);
+		} else if (pp->mpp->pgfailback == -FAILBACK_IMMEDIATE ||
+			 (chkr_new_path_up && followover_should_failback(pp))) {
+			send_path_msgs(pp->mpp);
 			switch_pathgroup(pp->mpp);
+		}
+	} else if (latency_weights_changed(pp->mpp)) {
+		condlog(2, "%s: path latencies changed. reloading",
+			pp->mpp->alias);
+		request_map_reload(pp->mpp, vecs, 0, cc->reload_debounce);
 	}
 	return 1;
 }
 
+/* Is the reservation key of mpp registered on the LU? */
+static bool
+pr_key_registered(const struct multipath *mpp, struct prin_resp *resp)
+{
+	unsigned int i;
+
+	condlog(3, " event pr=%d addlen=%d",resp->prin_descriptor.prin_readkeys.prgeneration,
+			resp->prin_descriptor.prin_readkeys.additional_length );
+
+	if (resp->prin_descriptor.prin_readkeys.additional_length == 0 )
+	{
+		condlog(1, "%s: No key found. Device may not be registered.",
+			mpp->alias);
+		return false;
+	}
+	condlog(2, "Multipath  reservation_key: 0x%" PRIx64 " ",
+		get_be64(mpp->reservation_key));
+
+	for (i = 0; i < resp->prin_descriptor.prin_readkeys.additional_length/8; i++ )
+	{
+		condlog(2, "PR IN READKEYS[%d]  reservation key:",i);
+		dumpHex((char *)&resp->prin_descriptor.prin_readkeys.key_list[i*8], 8 , -1);
+		if (!memcmp(&mpp->reservation_key, &resp->prin_descriptor.prin_readkeys.key_list[i*8], 8))
+		{
+			condlog(2, "%s: pr key found in prin readkeys response", mpp->alias);
+			return true;
+		}
+	}
+	condlog(0, "%s: Either device not registered or ", mpp->alias);
+	condlog(0, "host is not authorised for registration. Skip paths");
+	return false;
+}
+
+struct pr_register {
+	struct path *pp;
+	struct prout_param_descriptor *param;
+	int status;
+};
+
+static void
+pr_register_path(void *item, __attribute__((unused)) void *arg)
+{
+	struct pr_register *reg = item;
+
+	reg->status = prout_do_scsi_ioctl(reg->pp->dev, MPATH_PROUT_REG_IGN_SA,
+					  0, 0, reg->param, 0);
+}
+
+/*
+ * Send the queued registrations of mpp: the registered keys of the LU
+ * are read once through one of the paths, and the registrations are
+ * sent in parallel on pool.
+ */
+static void
+register_pr_paths(struct multipath *mpp, struct worker_pool *pool)
+{
+	struct _vector _paths = { .allocated = 0, .slot = NULL };
+	vector paths = &_paths;
+	struct _vector items = { .allocated = 0, .slot = NULL };
+	struct pr_register *regs = NULL;
+	struct prout_param_descriptor *param = NULL;
+	struct prin_resp *resp = NULL;
+	struct path *pp;
+	int i, n = 0, ret = MPATH_PR_OTHER;
+
+	vector_foreach_slot(mpp->paths, pp, i) {
+		if (!pp->pr_pending)
+			continue;
+		pp->pr_pending = false;
+		if (!vector_alloc_slot(paths))
+			goto out;
+		vector_set_slot(paths, pp);
+		n++;
+	}
+	if (n == 0 || !get_be64(mpp->reservation_key))
+		goto out;
+
+	resp = mpath_get_prin_buffer();
+	if (!resp){
+		condlog(0,"%s Alloc failed for prin response", mpp->alias);
+		goto out;
+	}
+	vector_foreach_slot(paths, pp, i) {
+		ret = prin_do_scsi_ioctl(pp->dev, MPATH_PRIN_RKEY_SA, resp, 0);
+		if (ret == MPATH_PR_SUCCESS)
+			break;
+		condlog(0,"%s : pr in read keys service action failed. Error=%d", pp->dev, ret);
+	}
+	if (ret != MPATH_PR_SUCCESS || !pr_key_registered(mpp, resp))
+		goto out;
+
+	param = (struct prout_param_descriptor *)MALLOC(sizeof(struct prout_param_descriptor));
+	regs = calloc(n, sizeof(*regs));
+	if (!param || !regs)
+		goto out;
+
+	param->sa_flags = mpp->sa_flags;
+	memcpy(param->sa_key, &mpp->reservation_key, 8);
+	param->num_transportid = 0;
+
+	vector_foreach_slot(paths, pp, i) {
+		if (!vector_alloc_slot(&items))
+			break;
+		regs[i].pp = pp;
+		regs[i].param = param;
+		regs[i].status = MPATH_PR_SKIP;
+		vector_set_slot(&items, &regs[i]);
+		condlog(3, "device %s:%s", pp->dev, mpp->wwid);
+	}
+	worker_pool_run(pool, &items, pr_register_path, NULL);
+
+	for (i = 0; i < n; i++) {
+		if (regs[i].pp && regs[i].status != MPATH_PR_SUCCESS)
+			condlog(0,"%s: Reservation registration failed. Error: %d",
+				regs[i].pp->dev, regs[i].status);
+	}
+	mpp->prflag = 1;
+out:
+	vector_reset(&items);
+	vector_reset(paths);
+	free(regs);
+	free(param);
+}
+
+/* Send the PR key registrations queued by mpath_pr_event_handle() */
+static void
+flush_pr_events(struct vectors *vecs, struct worker_pool *pool)
+{
+	struct multipath *mpp;
+	int i;
+
+	vector_foreach_slot(vecs->mpvec, mpp, i)
+		register_pr_paths(mpp, pool);
+}
+
+/* Take vecs->lock in the checker loop, and record the time spent waiting */
+static void
+__checker_lock(struct mutex_lock *a, bool shared, const char *func, int line)
+{
+	struct timespec start;
+
+	get_monotonic_time(&start);
+	if (shared)
+		__lock_shared(a, func, line);
+	else
+		__lock(a, func, line);
+	loop_stat_since(LOOP_STAT_LOCK_WAIT, &start);
+}
+#define checker_lock(a, shared) __checker_lock(a, shared, __func__, __LINE__)
+
+/* What the CLI shows about a path, and check_path() may change */
+struct path_shown {
+	int state;
+	int dmstate;
+	int offline;
+	int priority;
+	int marginal;
+	const struct multipath *mpp;
+};
+
+static void
+get_path_shown(const struct path *pp, struct path_shown *ps)
+{
+	ps->state = pp->state;
+	ps->dmstate = pp->dmstate;
+	ps->offline = pp->offline;
+	ps->priority = pp->priority;
+	ps->marginal = pp->marginal;
+	ps->mpp = pp->mpp;
+}
+
+static bool
+path_shown_changed(const struct path *pp, const struct path_shown *ps)
+{
+	return ps->state != pp->state || ps->dmstate != pp->dmstate ||
+		ps->offline != pp->offline || ps->priority != pp->priority ||
+		ps->marginal != pp->marginal || ps->mpp != pp->mpp;
+}
+
+/*
+ * Check the paths in due. Must be called with vecs->lock held.
+ * Returns the number of checked paths.
+ */
+static int
+check_due_paths(struct vectors *vecs, vector due, struct worker_pool *pool,
+		unsigned int ticks)
+{
+	struct check_conf cc;
+	struct config *conf;
+	struct path_shown ps;
+	struct path *pp;
+	int i, rc, num_paths = 0;
+
+	conf = get_multipath_config();
+	pthread_cleanup_push(put_multipath_config, conf);
+	init_check_conf(&cc, conf);
+	for (i = 0; i < VECTOR_SIZE(due); i++) {
+		pp = VECTOR_SLOT(due, i);
+		/* path was freed while checking another one */
+		if (!pp)
+			continue;
+		get_path_shown(pp, &ps);
+		rc = check_path(vecs, pp, ticks, &cc);
+		/* most checks change nothing, keep the snapshots then */
+		if (path_shown_changed(pp, &ps))
+			topology_changed();
+		if (rc < 0) {
+			int j = find_slot(vecs->pathvec, pp);
+
+			condlog(1, "%s: check_path() failed, removing",
+				pp->dev);
+			if (j >= 0)
+				vector_del_slot(vecs->pathvec, j);
+			free_path(pp);
+		} else {
+			/*
+			 * The path may have changed while the lock
+			 * was dropped, and check_path() skipped it
+			 */
+			pp->prechecked_state = PATH_MAX_STATE;
+			update_fast_check(pp);
+			num_paths += rc;
+		}
+	}
+	pthread_cleanup_pop(1);
+	flush_pr_events(vecs, pool);
+	flush_path_msgs(vecs);
+	/* free_path() mustn't look at due after we drop the lock */
+	end_due_paths();
+	return num_paths;
+}
+
+/*
+ * Check the paths returned by get_due between two regular ticks of the
+ * checker loop: the paths with a fast_polling_interval which are due, or
+ * the paths whose async check has completed. The map timers and other
+ * per-tick housekeeping are left to the regular ticks.
+ */
+static void
+fast_check_paths(struct vectors *vecs, struct worker_pool *pool,
+		 int (*get_due)(vector), const char *what)
+{
+	struct _vector _due = { .allocated = 0, .slot = NULL };
+	vector due = &_due;
+	int num_paths;
+
+	if (set_config_state(DAEMON_RUNNING) != 0)
+		return;
+
+	pthread_cleanup_push(cleanup_due_paths, due);
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	checker_lock(&vecs->lock, false);
+	pthread_testcancel();
+	if (get_due(due) < 0)
+		condlog(0, "failed to allocate list of %s paths", what);
+	limit_due_paths(due);
+	lock_cleanup_pop(vecs->lock);
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	checker_lock(&vecs->lock, true);
+	pthread_testcancel();
+	precheck_paths(due, pool, 0);
+	lock_cleanup_pop(vecs->lock);
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	checker_lock(&vecs->lock, false);
+	pthread_testcancel();
+	num_paths = check_due_paths(vecs, due, pool, 0);
+	lock_cleanup_pop(vecs->lock);
+	pthread_cleanup_pop(1);
+
+	if (num_paths)
+		condlog(4, "checked %d %s path%s", num_paths, what,
+			num_paths > 1 ? "s" : "");
+	post_config_state(DAEMON_IDLE);
+}
+
+/*
+ * Run the fast path checks which fall due while the checker loop waits
+ * for *wait, and set *wait to the remaining time. Paths whose async
+ * check completes in the meantime are checked again right away, instead
+ * of on the next tick.
+ */
+static void
+fast_check_wait(struct vectors *vecs, struct worker_pool *pool,
+		struct timespec *wait)
+{
+	struct timespec now, end;
+	long long left;
+	int next, efd = async_check_event_fd();
+
+	get_monotonic_time(&end);
+	end.tv_sec += wait->tv_sec;
+	end.tv_nsec += wait->tv_nsec;
+	normalize_timespec(&end);
+
+	while (1) {
+		pthread_cleanup_push(cleanup_lock, &vecs->lock);
+		checker_lock(&vecs->lock, true);
+		pthread_testcancel();
+		next = next_fast_check();
+		lock_cleanup_pop(vecs->lock);
+
+		get_monotonic_time(&now);
+		timespecsub(&end, &now, wait);
+		left = (long long)wait->tv_sec * 1000 + wait->tv_nsec / 1000000;
+		if (efd == -1) {
+			if (next < 0 || next >= left)
+				break;
+			if (next > 0) {
+				struct timespec ts = {
+					.tv_sec = next / 1000,
+					.tv_nsec = (next % 1000) * 1000000L,
+				};
+
+				nanosleep(&ts, NULL);
+			}
+		} else if (next != 0) {
+			struct pollfd pfd = { .fd = efd, .events = POLLIN };
+			int r;
+
+			if (left <= 0)
+				break;
+			r = poll(&pfd, 1,
+				 next < 0 || next >= left ? (int)left : next);
+			if (r > 0) {
+				async_check_clear_event();
+				fast_check_paths(vecs, pool, get_pending_paths,
+						 "completed");
+				continue;
+			}
+			if (r < 0 && errno != EINTR) {
+				condlog(2, "failed to poll async checker events: %m");
+				efd = -1;
+			}
+			if (next < 0 || next >= left)
+				continue;
+		}
+		fast_check_paths(vecs, pool, get_fast_due_paths, "fast due");
+	}
+	if (wait->tv_sec < 0) {
+		wait->tv_sec = 0;
+		wait->tv_nsec = 0;
+	}
+}
+
+/* Must be called with vecs->lock held */
+static void periodic_checkpoint(struct vectors *vecs)
+{
+	static time_t last_saved;
+	struct timespec now;
+
+	get_monotonic_time(&now);
+	if (last_saved && now.tv_sec - last_saved < CHECKPOINT_INTERVAL)
+		return;
+	last_saved = now.tv_sec;
+	save_checkpoint(vecs->pathvec);
+}
+
 static void *
 checkerloop (void *ap)
 {
 	struct vectors *vecs;
-	struct path *pp;
 	int count = 0;
-	unsigned int i;
 	struct timespec last_time;
 	struct config *conf;
 	int foreign_tick = 0;
+	struct worker_pool *pool = NULL;
+	int pool_threads = 1;
+	int sched_npaths = -1, sched_sweep = 0;
 #ifdef USE_SYSTEMD
 	bool use_watchdog;
 #endif
 
 	pthread_cleanup_push(rcu_unregister, NULL);
+	pthread_cleanup_push(cleanup_worker_pool, &pool);
 	rcu_register_thread();
-	mlockall(MCL_CURRENT | MCL_FUTURE);
+	lock_memory();
 	vecs = (struct vectors *)ap;
 	condlog(2, "path checkers start up");
 
@@ -2478,9 +4117,12 @@ checkerloop (void *ap)
 
 	while (1) {
 		struct timespec diff_time, start_time, end_time;
-		int num_paths = 0, strict_timing, rc = 0;
+		int num_paths = 0, strict_timing, checker_threads, rc = 0;
 		unsigned int ticks = 0;
+		struct _vector _due = { .allocated = 0, .slot = NULL };
+		vector due = &_due;
 
+		sample_thread_cpu(THREAD_CHECKER);
 		get_monotonic_time(&start_time);
 		if (start_time.tv_sec && last_time.tv_sec) {
 			timespecsub(&start_time, &last_time, &diff_time);
@@ -2504,47 +4146,93 @@ checkerloop (void *ap)
 			/* daemon shutdown */
 			break;
 
+		conf = get_multipath_config();
+		checker_threads = conf->checker_threads;
+		put_multipath_config(conf);
+		if (checker_threads != pool_threads) {
+			worker_pool_destroy(pool);
+			pool = worker_pool_create(checker_threads, "checker");
+			pool_threads = checker_threads;
+		}
+
+		pthread_cleanup_push(cleanup_due_paths, due);
+
 		pthread_cleanup_push(cleanup_lock, &vecs->lock);
-		lock(&vecs->lock);
+		checker_lock(&vecs->lock, false);
 		pthread_testcancel();
-		vector_foreach_slot (vecs->pathvec, pp, i) {
-			rc = check_path(vecs, pp, ticks);
-			if (rc < 0) {
-				condlog(1, "%s: check_path() failed, removing",
-					pp->dev);
-				vector_del_slot(vecs->pathvec, i);
-				free_path(pp);
-				i--;
-			} else
-				num_paths += rc;
+		/*
+		 * Paths are scheduled where they are added to pathvec.
+		 * Catch any that were missed.
+		 */
+		if (VECTOR_SIZE(vecs->pathvec) != sched_npaths ||
+		    --sched_sweep <= 0) {
+			schedule_all_path_checks(vecs->pathvec);
+			sched_npaths = VECTOR_SIZE(vecs->pathvec);
+			sched_sweep = CHECK_SCHED_SWEEP_INT;
 		}
+		if (get_due_paths(ticks, due) < 0)
+			condlog(0, "failed to allocate list of due paths");
+		limit_due_paths(due);
 		lock_cleanup_pop(vecs->lock);
 
+		/*
+		 * Running the checkers only reads the path list. Do it
+		 * with the lock shared, so that read-only CLI commands
+		 * aren't held up by slow checkers. Paths removed in the
+		 * meantime are cleared from due by free_path().
+		 */
 		pthread_cleanup_push(cleanup_lock, &vecs->lock);
-		lock(&vecs->lock);
+		checker_lock(&vecs->lock, true);
+		pthread_testcancel();
+		precheck_paths(due, pool, ticks);
+		lock_cleanup_pop(vecs->lock);
+
+		pthread_cleanup_push(cleanup_lock, &vecs->lock);
+		checker_lock(&vecs->lock, false);
 		pthread_testcancel();
-		defered_failback_tick(vecs->mpvec);
-		retry_count_tick(vecs->mpvec);
+		num_paths = check_due_paths(vecs, due, pool, ticks);
+		lock_cleanup_pop(vecs->lock);
+		pthread_cleanup_pop(1);
+
+		pthread_cleanup_push(cleanup_lock, &vecs->lock);
+		checker_lock(&vecs->lock, false);
+		pthread_testcancel();
+		defered_failback_tick();
+		retry_count_tick();
 		missing_uev_wait_tick(vecs);
 		ghost_delay_tick(vecs);
+		smart_wait_tick(vecs);
+		deferred_reload_tick(vecs);
+		io_stats_tick(vecs);
+		prune_map_timers();
+		update_state_file(vecs);
+		if (warm_restart)
+			periodic_checkpoint(vecs);
 		lock_cleanup_pop(vecs->lock);
+		log_ratelimit_flush();
 
 		if (count)
 			count--;
 		else {
+			vector names = dm_get_map_names();
+
+			pthread_cleanup_push(cleanup_map_names, names);
 			pthread_cleanup_push(cleanup_lock, &vecs->lock);
-			lock(&vecs->lock);
+			checker_lock(&vecs->lock, false);
 			pthread_testcancel();
 			condlog(4, "map garbage collection");
-			mpvec_garbage_collector(vecs);
+			mpvec_garbage_collector(vecs, names);
 			count = MAPGCINT;
 			lock_cleanup_pop(vecs->lock);
+			pthread_cleanup_pop(1);
 		}
 
+		update_check_rate(num_paths, ticks);
 		diff_time.tv_nsec = 0;
 		if (start_time.tv_sec) {
 			get_monotonic_time(&end_time);
 			timespecsub(&end_time, &start_time, &diff_time);
+			loop_stat_record(LOOP_STAT_PASS, &diff_time);
 			if (num_paths) {
 				unsigned int max_checkint;
 
@@ -2575,9 +4263,12 @@ checkerloop (void *ap)
 		conf = get_multipath_config();
 		strict_timing = conf->strict_timing;
 		put_multipath_config(conf);
-		if (!strict_timing)
-			sleep(1);
-		else {
+		if (!strict_timing) {
+			diff_time.tv_sec = 1;
+			diff_time.tv_nsec = 0;
+			fast_check_wait(vecs, pool, &diff_time);
+			nanosleep(&diff_time, NULL);
+		} else {
 			if (diff_time.tv_nsec) {
 				diff_time.tv_sec = 0;
 				diff_time.tv_nsec =
@@ -2585,6 +4276,7 @@ checkerloop (void *ap)
 			} else
 				diff_time.tv_sec = 1;
 
+			fast_check_wait(vecs, pool, &diff_time);
 			condlog(3, "waiting for %ld.%06lu secs",
 				(long)diff_time.tv_sec,
 				diff_time.tv_nsec / 1000);
@@ -2594,28 +4286,76 @@ checkerloop (void *ap)
 				conf = get_multipath_config();
 				conf->strict_timing = 0;
 				put_multipath_config(conf);
+				drop_cached_reply(REPLY_CACHE_CONFIG);
 				break;
 			}
 		}
 	}
 	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 	return NULL;
 }
 
+enum configure_phase {
+	CONFIGURE_IDLE = 0,
+	CONFIGURE_PATHS,
+	CONFIGURE_MAPS,
+	CONFIGURE_COALESCE,
+	CONFIGURE_SETUP,
+	__CONFIGURE_PHASE_LAST,
+};
+
+static const char *configure_phase_name[__CONFIGURE_PHASE_LAST] = {
+	[CONFIGURE_IDLE] = "idle",
+	[CONFIGURE_PATHS] = "discovering paths",
+	[CONFIGURE_MAPS] = "discovering maps",
+	[CONFIGURE_COALESCE] = "coalescing paths",
+	[CONFIGURE_SETUP] = "setting up maps",
+};
+
+/* Progress of configure(), accessed atomically by the cli handlers */
+static int configure_phase;
+static unsigned int setup_done;
+static unsigned int setup_total;
+
+static void set_configure_phase(int phase)
+{
+	uatomic_set(&configure_phase, phase);
+}
+
+int snprint_configure_progress(struct strbuf *buf)
+{
+	unsigned int done, total;
+	int phase = uatomic_read(&configure_phase);
+
+	if (phase <= CONFIGURE_IDLE || phase >= __CONFIGURE_PHASE_LAST)
+		return 0;
+	if (phase == CONFIGURE_PATHS)
+		get_discovery_progress(&done, &total);
+	else if (phase == CONFIGURE_SETUP) {
+		done = uatomic_read(&setup_done);
+		total = uatomic_read(&setup_total);
+	} else
+		return print_strbuf(buf, "configure %s\n",
+				    configure_phase_name[phase]);
+	return print_strbuf(buf, "configure %s %u/%u\n",
+			    configure_phase_name[phase], done, total);
+}
+
 int
-configure (struct vectors * vecs)
+configure (struct vectors * vecs, int force_reload)
 {
 	struct multipath * mpp;
 	struct path * pp;
 	vector mpvec;
 	int i, ret;
 	struct config *conf;
-	static int force_reload = FORCE_RELOAD_WEAK;
 
 	if (!vecs->pathvec && !(vecs->pathvec = vector_alloc())) {
 		condlog(0, "couldn't allocate path vec in configure");
 		return 1;
 	}
+	invalidate_udev_cache();
 
 	if (!vecs->mpvec && !(vecs->mpvec = vector_alloc())) {
 		condlog(0, "couldn't allocate multipath vec in configure");
@@ -2630,6 +4370,7 @@ configure (struct vectors * vecs)
 	/*
 	 * probe for current path (from sysfs) and map (from dm) sets
 	 */
+	set_configure_phase(CONFIGURE_PATHS);
 	ret = path_discovery(vecs->pathvec, DI_ALL);
 	if (ret < 0) {
 		condlog(0, "configure failed at path discovery");
@@ -2649,6 +4390,9 @@ configure (struct vectors * vecs)
 		}
 	}
 	pthread_cleanup_pop(1);
+	schedule_all_path_checks(vecs->pathvec);
+	set_configure_phase(CONFIGURE_MAPS);
+	publish_partial_snapshot(vecs, configure_phase_name[CONFIGURE_MAPS]);
 
 	if (map_discovery(vecs)) {
 		condlog(0, "configure failed at map discovery");
@@ -2658,22 +4402,33 @@ configure (struct vectors * vecs)
 	if (should_exit())
 		goto fail;
 
+	set_configure_phase(CONFIGURE_COALESCE);
+	publish_partial_snapshot(vecs,
+				 configure_phase_name[CONFIGURE_COALESCE]);
+	/* the maps needed to boot are created first */
+	sort_paths_by_startup_priority(vecs->pathvec);
+
 	/*
 	 * create new set of maps & push changed ones into dm
-	 * In the first call, use FORCE_RELOAD_WEAK to avoid making
-	 * superfluous ACT_RELOAD ioctls. Later calls are done
-	 * with FORCE_RELOAD_YES.
+	 * With FORCE_RELOAD_WEAK, only maps whose table changed are
+	 * reloaded. FORCE_RELOAD_YES reloads all maps.
 	 */
+	/*
+	 * The path uevents of coalesce_paths() and of the new WWIDs below
+	 * are sent at once, after all maps are set up.
+	 */
+	start_path_triggers();
+	wwids_batch_start();
+	dm_udev_batch_start();
 	ret = coalesce_paths(vecs, mpvec, NULL, force_reload, CMD_NONE);
-	if (force_reload == FORCE_RELOAD_WEAK)
-		force_reload = FORCE_RELOAD_YES;
+	dm_udev_batch_end();
 	if (ret != CP_OK) {
 		condlog(0, "configure failed while coalescing paths");
-		goto fail;
+		goto fail_triggers;
 	}
 
 	if (should_exit())
-		goto fail;
+		goto fail_triggers;
 
 	/*
 	 * may need to remove some maps which are no longer relevant
@@ -2681,11 +4436,11 @@ configure (struct vectors * vecs)
 	 */
 	if (coalesce_maps(vecs, mpvec)) {
 		condlog(0, "configure failed while coalescing maps");
-		goto fail;
+		goto fail_triggers;
 	}
 
 	if (should_exit())
-		goto fail;
+		goto fail_triggers;
 
 	sync_maps_state(mpvec);
 	vector_foreach_slot(mpvec, mpp, i){
@@ -2693,6 +4448,8 @@ configure (struct vectors * vecs)
 			trigger_paths_udev_change(mpp, true);
 		update_map_pr(mpp);
 	}
+	wwids_batch_end();
+	flush_path_triggers();
 
 	/*
 	 * purge dm of old maps and save new set of maps formed by
@@ -2701,52 +4458,180 @@ configure (struct vectors * vecs)
 	remove_maps(vecs);
 	vecs->mpvec = mpvec;
 
-	/*
-	 * start dm event waiter threads for these new maps
-	 */
-	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if (wait_for_events(mpp, vecs)) {
-			remove_map(mpp, vecs->pathvec, vecs->mpvec);
-			i--;
+	/*
+	 * start watching dm events for these new maps
+	 */
+	uatomic_set(&setup_done, 0);
+	uatomic_set(&setup_total, VECTOR_SIZE(vecs->mpvec));
+	set_configure_phase(CONFIGURE_SETUP);
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		uatomic_inc(&setup_done);
+		if (wait_for_events(mpp)) {
+			remove_map(mpp, vecs->pathvec, vecs->mpvec);
+			i--;
+			continue;
+		}
+		if (setup_multipath(vecs, mpp))
+			i--;
+	}
+	set_configure_phase(CONFIGURE_IDLE);
+	invalidate_topology_snapshot();
+	return 0;
+
+fail_triggers:
+	wwids_batch_end();
+	flush_path_triggers();
+fail:
+	vector_free(mpvec);
+	set_configure_phase(CONFIGURE_IDLE);
+	invalidate_topology_snapshot();
+	return 1;
+}
+
+int
+need_to_delay_reconfig(struct vectors * vecs)
+{
+	struct multipath *mpp;
+	int i;
+
+	if (!VECTOR_SIZE(vecs->mpvec))
+		return 0;
+
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		if (mpp->wait_for_udev)
+			return 1;
+	}
+	return 0;
+}
+
+void rcu_free_config(struct rcu_head *head)
+{
+	struct config *conf = container_of(head, struct config, rcu);
+
+	free_config(conf);
+}
+
+static void
+swap_config(struct config *old, struct config *conf)
+{
+	uxsock_timeout = conf->uxsock_timeout;
+
+	conf->sequence_nr = old->sequence_nr + 1;
+	rcu_assign_pointer(multipath_conf, conf);
+	call_rcu(&old->rcu, rcu_free_config);
+	apply_thread_settings(conf);
+}
+
+static void
+move_hwes(vector hwes, const struct config *old, const struct config *conf)
+{
+	struct hwentry *hwe;
+	int i, n;
+
+	vector_foreach_slot(hwes, hwe, i) {
+		n = find_slot(old->hwtable, hwe);
+		/* Can't happen, all hwes come from the old hwtable */
+		if (n < 0) {
+			vector_del_slot(hwes, i--);
 			continue;
 		}
-		if (setup_multipath(vecs, mpp))
-			i--;
+		hwes->slot[i] = VECTOR_SLOT(conf->hwtable, n);
 	}
-	return 0;
+}
 
-fail:
-	vector_free(mpvec);
-	return 1;
+static bool
+mpentry_alias_changed(const struct mpentry *old, const struct mpentry *new)
+{
+	const char *old_alias = old ? old->alias : NULL;
+	const char *new_alias = new ? new->alias : NULL;
+
+	if (!old_alias || !new_alias)
+		return old_alias != new_alias;
+	return strcmp(old_alias, new_alias) != 0;
 }
 
-int
-need_to_delay_reconfig(struct vectors * vecs)
+/*
+ * Switch to a configuration which differs from the current one only in
+ * the multipaths section, without rediscovering paths and maps. The
+ * configlet pointers of all paths and maps are moved to the new
+ * configuration, and only maps whose multipaths entry changed are
+ * reloaded. Alias changes and new entries for WWIDs without a map need
+ * a full reconfigure.
+ *
+ * Returns 0 on success. If 1 is returned, nothing has been changed.
+ */
+static int
+reconfigure_multipaths(struct vectors *vecs, struct config *old,
+		       struct config *conf)
 {
+	vector changed;
+	struct mpentry *mpe, *old_mpe;
 	struct multipath *mpp;
+	struct path *pp;
 	int i;
 
-	if (!VECTOR_SIZE(vecs->mpvec))
-		return 0;
+	/* the section is unchanged, but be paranoid */
+	if (VECTOR_SIZE(old->hwtable) != VECTOR_SIZE(conf->hwtable))
+		return 1;
 
-	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if (mpp->wait_for_udev)
+	vector_foreach_slot(conf->mptable, mpe, i) {
+		if (find_mp_by_wwid(vecs->mpvec, mpe->wwid))
+			continue;
+		old_mpe = find_mpe_by_wwid(old, mpe->wwid);
+		if (mpentry_changed(old, old_mpe, conf, mpe)) {
+			condlog(3, "%s: multipaths entry changed for unused WWID",
+				mpe->wwid);
 			return 1;
+		}
 	}
-	return 0;
-}
 
-void rcu_free_config(struct rcu_head *head)
-{
-	struct config *conf = container_of(head, struct config, rcu);
+	if (!(changed = vector_alloc()))
+		return 1;
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		old_mpe = find_mpe_by_wwid(old, mpp->wwid);
+		mpe = find_mpe_by_wwid(conf, mpp->wwid);
+		if (!mpentry_changed(old, old_mpe, conf, mpe))
+			continue;
+		if (mpentry_alias_changed(old_mpe, mpe)) {
+			condlog(3, "%s: alias setting changed", mpp->alias);
+			goto fail;
+		}
+		if (!vector_alloc_slot(changed))
+			goto fail;
+		vector_set_slot(changed, mpp);
+	}
 
-	free_config(conf);
+	vector_foreach_slot(vecs->pathvec, pp, i) {
+		move_hwes(pp->hwe, old, conf);
+		select_getuid(conf, pp);
+	}
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		move_hwes(mpp->hwe, old, conf);
+		mpp->mpe = find_mpe_by_wwid(conf, mpp->wwid);
+		/* only used by select_alias(), which sets it again */
+		mpp->alias_prefix = NULL;
+	}
+	swap_config(old, conf);
+
+	condlog(2, "multipaths section changed, reloading %d maps",
+		VECTOR_SIZE(changed));
+	vector_foreach_slot(changed, mpp, i) {
+		if (reload_and_sync_map(mpp, vecs, 0) == 1)
+			condlog(1, "%s: failed to reload map", mpp->alias);
+	}
+	vector_free(changed);
+	return 0;
+
+fail:
+	vector_free(changed);
+	return 1;
 }
 
 int
-reconfigure (struct vectors * vecs)
+reconfigure (struct vectors * vecs, bool reload_all)
 {
 	struct config * old, *conf;
+	int changed = CONF_SECT_ALL;
 
 	conf = load_config(DEFAULT_CONFIGFILE);
 	if (!conf)
@@ -2756,6 +4641,28 @@ reconfigure (struct vectors * vecs)
 		libmp_verbosity = verbosity;
 	setlogmask(LOG_UPTO(libmp_verbosity + 3));
 
+	if (bindings_read_only)
+		conf->bindings_read_only = bindings_read_only;
+	check_alias_settings(conf);
+
+	/*
+	 * Paths and maps hold pointers into the old configuration, so
+	 * they can only be kept if the sections they point into are
+	 * unchanged.
+	 */
+	old = rcu_dereference(multipath_conf);
+	if (!reload_all && VECTOR_SIZE(vecs->mpvec))
+		changed = config_changed_sections(old, conf);
+	if (changed == 0) {
+		condlog(2, "configuration unchanged, keeping all maps");
+		old->delayed_reconfig = 0;
+		free_config(conf);
+		return 0;
+	}
+	if (changed == CONF_SECT_MULTIPATHS &&
+	    reconfigure_multipaths(vecs, old, conf) == 0)
+		return 0;
+
 	/*
 	 * free old map and path vectors ... they use old conf state
 	 */
@@ -2767,21 +4674,107 @@ reconfigure (struct vectors * vecs)
 	delete_all_foreign();
 
 	reset_checker_classes();
-	if (bindings_read_only)
-		conf->bindings_read_only = bindings_read_only;
-	check_alias_settings(conf);
+	swap_config(old, conf);
 
-	uxsock_timeout = conf->uxsock_timeout;
+	configure(vecs, reload_all ? FORCE_RELOAD_YES : FORCE_RELOAD_WEAK);
 
-	old = rcu_dereference(multipath_conf);
-	conf->sequence_nr = old->sequence_nr + 1;
-	rcu_assign_pointer(multipath_conf, conf);
-	call_rcu(&old->rcu, rcu_free_config);
+	return 0;
+}
+
+/*
+ * Request a reconfigure from the main thread. If reload_all is set,
+ * all maps are rebuilt and reloaded, even if the configuration is
+ * unchanged. Requests that arrive before the main thread starts the
+ * reconfigure are served together, see wait_reconfigure_debounce().
+ * If seq is not NULL, it's set to the number of the request, for
+ * reconfigure_completed().
+ */
+int
+schedule_reconfigure(bool reload_all, unsigned long *seq)
+{
+	int rc = 0;
 
-	configure(vecs);
+	if (reload_all)
+		uatomic_set(&reconfigure_all, 1);
+	pthread_mutex_lock(&config_lock);
+	pthread_cleanup_push(config_cleanup, NULL);
+	if (running_state == DAEMON_SHUTDOWN)
+		rc = EINVAL;
+	else {
+		get_monotonic_time(&last_reconfigure_request);
+		if (!reconfigure_pending)
+			first_reconfigure_request = last_reconfigure_request;
+		reconfigure_pending = true;
+		if (seq)
+			*seq = ++reconfigure_requested;
+		else
+			++reconfigure_requested;
+		pthread_cond_broadcast(&config_cond);
+	}
+	pthread_cleanup_pop(1);
+	return rc;
+}
 
+/*
+ * Returns 1 if a reconfigure serving request seq has completed, 0 if
+ * not, and -1 if the daemon is shutting down.
+ */
+int
+reconfigure_completed(unsigned long seq)
+{
+	int rc;
 
-	return 0;
+	pthread_mutex_lock(&config_lock);
+	pthread_cleanup_push(config_cleanup, NULL);
+	if (running_state == DAEMON_SHUTDOWN)
+		rc = -1;
+	else
+		rc = reconfigure_done >= seq;
+	pthread_cleanup_pop(1);
+	return rc;
+}
+
+/*
+ * Wait until no reconfigure request has arrived for reconfigure_debounce
+ * ms, or for at most four times that since the first pending request.
+ * Must be called with config_lock held.
+ */
+static void
+wait_reconfigure_debounce(void)
+{
+	struct config *conf;
+	struct timespec end, max_end;
+	unsigned int debounce;
+	int rc = 0;
+
+	conf = get_multipath_config();
+	debounce = conf->reconfigure_debounce;
+	put_multipath_config(conf);
+	if (debounce == 0)
+		return;
+
+	max_end = first_reconfigure_request;
+	max_end.tv_sec += (4ULL * debounce) / 1000;
+	max_end.tv_nsec += ((4ULL * debounce) % 1000) * 1000000;
+	normalize_timespec(&max_end);
+	while (rc != ETIMEDOUT && running_state != DAEMON_SHUTDOWN) {
+		end = last_reconfigure_request;
+		end.tv_sec += debounce / 1000;
+		end.tv_nsec += (debounce % 1000) * 1000000;
+		normalize_timespec(&end);
+		if (end.tv_sec > max_end.tv_sec ||
+		    (end.tv_sec == max_end.tv_sec &&
+		     end.tv_nsec > max_end.tv_nsec))
+			end = max_end;
+		rc = pthread_cond_timedwait(&config_cond, &config_lock, &end);
+	}
+}
+
+/* Called at the end of every exclusive hold of vecs->lock */
+static void
+vecs_lock_released(void *arg)
+{
+	note_topology_vectors(arg);
 }
 
 static struct vectors *
@@ -2794,7 +4787,8 @@ init_vecs (void)
 	if (!vecs)
 		return NULL;
 
-	pthread_mutex_init(&vecs->lock.mutex, NULL);
+	init_lock(&vecs->lock);
+	set_release_hook(&vecs->lock, vecs_lock_released, vecs);
 
 	return vecs;
 }
@@ -2830,7 +4824,7 @@ handle_signals(bool nonfatal)
 		return;
 	if (reconfig_sig) {
 		condlog(2, "reconfigure (signal)");
-		set_config_state(DAEMON_CONFIGURE);
+		schedule_reconfigure(false, NULL);
 	}
 	if (log_reset_sig) {
 		condlog(2, "reset log (signal)");
@@ -2966,6 +4960,19 @@ static void cleanup_conf(void) {
 	call_rcu(&conf->rcu, rcu_free_config);
 }
 
+/*
+ * The maps and paths needn't be freed if we're exiting for good, which
+ * takes a long time with many paths. Only free them for leak checking.
+ */
+static bool free_vecs_on_exit(void)
+{
+#ifdef _DEBUG_
+	return true;
+#else
+	return RUNNING_ON_VALGRIND;
+#endif
+}
+
 static void cleanup_maps(struct vectors *vecs)
 {
 	int queue_without_daemon, i;
@@ -2978,13 +4985,15 @@ static void cleanup_maps(struct vectors *vecs)
 	if (queue_without_daemon == QUE_NO_DAEMON_OFF)
 		vector_foreach_slot(vecs->mpvec, mpp, i)
 			dm_queue_if_no_path(mpp->alias, 0);
-	remove_maps_and_stop_waiters(vecs);
+	if (free_vecs_on_exit())
+		remove_maps_and_stop_waiters(vecs);
 	vecs->mpvec = NULL;
 }
 
 static void cleanup_paths(struct vectors *vecs)
 {
-	free_pathvec(vecs->pathvec, FREE_PATHS);
+	if (free_vecs_on_exit())
+		free_pathvec(vecs->pathvec, FREE_PATHS);
 	vecs->pathvec = NULL;
 }
 
@@ -2998,9 +5007,13 @@ static void cleanup_vecs(void)
 	 * Anyway, by the time we get here, all threads that might access
 	 * vecs should have been joined already (in cleanup_threads).
 	 */
+	invalidate_topology_snapshot();
+	exit_state_file();
+	if (warm_restart && gvecs->pathvec)
+		save_checkpoint(gvecs->pathvec);
 	cleanup_maps(gvecs);
 	cleanup_paths(gvecs);
-	pthread_mutex_destroy(&gvecs->lock.mutex);
+	destroy_lock(&gvecs->lock);
 	FREE(gvecs);
 }
 
@@ -3008,6 +5021,12 @@ static void cleanup_threads(void)
 {
 	stop_io_err_stat_thread();
 
+	unregister_thread(THREAD_CHECKER);
+	unregister_thread(THREAD_UEVENT);
+	unregister_thread(THREAD_UXLSNR);
+	unregister_thread(THREAD_UEVQ);
+	unregister_thread(THREAD_DMEVENTS);
+
 	if (check_thr_started)
 		pthread_cancel(check_thr);
 	if (uevent_thr_started)
@@ -3030,11 +5049,9 @@ static void cleanup_threads(void)
 	if (dmevent_thr_started)
 		pthread_join(dmevent_thr, NULL);
 
-	/*
-	 * As all threads are joined now, and we're in DAEMON_SHUTDOWN
-	 * state, no new waiter threads will be created any more.
-	 */
-	pthread_attr_destroy(&waiter_attr);
+	stop_flush_thread();
+	/* drop the queued checks, and don't wait for hanging ones */
+	async_check_shutdown();
 }
 
 #ifndef URCU_VERSION
@@ -3091,8 +5108,9 @@ static void cleanup_child(void)
 {
 	cleanup_threads();
 	cleanup_vecs();
-	if (poll_dmevents)
-		cleanup_dmevent_waiter();
+	cleanup_dmevent_waiter();
+	dm_partmap_index_exit();
+	cleanup_smart_wait();
 
 	cleanup_pidfile();
 	if (logsink == LOGSINK_SYSLOG)
@@ -3116,20 +5134,37 @@ static int sd_notify_exit(int err)
 	return err;
 }
 
+static int
+start_daemon_thread(pthread_t *thr, const char *name,
+		    void *(*fn)(void *), void *arg)
+{
+	pthread_attr_t attr;
+	int rc;
+
+	setup_thread_attr_for(&attr, name, 0);
+	rc = pthread_create(thr, &attr, fn, arg);
+	pthread_attr_destroy(&attr);
+	return rc;
+}
+
 static int
 child (__attribute__((unused)) void *param)
 {
-	pthread_attr_t log_attr, misc_attr, uevent_attr;
+	pthread_attr_t log_attr;
 	struct vectors * vecs;
 	int rc;
 	struct config *conf;
 	char *envp;
 	enum daemon_status state;
 	int exit_code = 1;
+	bool unified_loop;
 
 	init_unwinder();
-	mlockall(MCL_CURRENT | MCL_FUTURE);
+	lock_memory();
 	signal_init();
+#ifdef LOCK_PROFILE
+	config_prof = alloc_lock_profile();
+#endif
 #if (URCU_VERSION >= 0x000800)
 	mp_rcu_data = setup_rcu();
 	if (atexit(cleanup_rcu))
@@ -3140,12 +5175,9 @@ child (__attribute__((unused)) void *param)
 	if (atexit(cleanup_child))
 		fprintf(stderr, "failed to register cleanup handlers\n");
 
-	setup_thread_attr(&misc_attr, 64 * 1024, 0);
-	setup_thread_attr(&uevent_attr, DEFAULT_UEVENT_STACKSIZE * 1024, 0);
-	setup_thread_attr(&waiter_attr, 32 * 1024, 1);
-
 	if (logsink == LOGSINK_SYSLOG) {
-		setup_thread_attr(&log_attr, 64 * 1024, 0);
+		/* before the configuration is read, with the default stack */
+		setup_thread_attr_for(&log_attr, THREAD_LOG, 0);
 		log_thread_start(&log_attr);
 		pthread_attr_destroy(&log_attr);
 	}
@@ -3176,6 +5208,8 @@ child (__attribute__((unused)) void *param)
 		conf->bindings_read_only = bindings_read_only;
 	uxsock_timeout = conf->uxsock_timeout;
 	rcu_assign_pointer(multipath_conf, conf);
+	/* for the log thread, the others register when they're started */
+	apply_thread_settings(conf);
 	if (init_checkers(conf->multipath_dir)) {
 		condlog(0, "failed to initialize checkers");
 		goto failed;
@@ -3190,6 +5224,7 @@ child (__attribute__((unused)) void *param)
 
 	if (poll_dmevents)
 		poll_dmevents = dmevent_poll_supported();
+	unified_loop = poll_dmevents && conf->unified_event_loop == YN_YES;
 
 	envp = getenv("LimitNOFILE");
 
@@ -3199,8 +5234,15 @@ child (__attribute__((unused)) void *param)
 		set_max_fds(conf->max_fds);
 
 	vecs = gvecs = init_vecs();
+	init_check_sched();
 	if (!vecs)
 		goto failed;
+	/* Failing this is non-fatal */
+	if (conf->publish_state == YN_YES)
+		init_state_file();
+	warm_restart = conf->warm_restart == YN_YES;
+	if (warm_restart)
+		load_checkpoint();
 
 	setscheduler();
 	set_oom_adj();
@@ -3214,7 +5256,7 @@ child (__attribute__((unused)) void *param)
 	pthread_mutex_lock(&config_lock);
 
 	__post_config_state(DAEMON_IDLE);
-	rc = pthread_create(&uxlsnr_thr, &misc_attr, uxlsnrloop, vecs);
+	rc = start_daemon_thread(&uxlsnr_thr, THREAD_UXLSNR, uxlsnrloop, vecs);
 	if (!rc) {
 		/* Wait for uxlsnr startup */
 		while (running_state == DAEMON_IDLE)
@@ -3229,75 +5271,117 @@ child (__attribute__((unused)) void *param)
 	}
 	else {
 		uxlsnr_thr_started = true;
+		register_thread(THREAD_UXLSNR, uxlsnr_thr);
 		if (state != DAEMON_CONFIGURE) {
 			condlog(0, "cli listener failed to start");
 			goto failed;
 		}
 	}
 
-	if (poll_dmevents) {
-		if (init_dmevent_waiter(vecs)) {
-			condlog(0, "failed to allocate dmevents waiter info");
-			goto failed;
-		}
-		if ((rc = pthread_create(&dmevent_thr, &misc_attr,
-					 wait_dmevents, NULL))) {
-			condlog(0, "failed to create dmevent waiter thread: %d",
-				rc);
-			goto failed;
-		} else
-			dmevent_thr_started = true;
+	set_dmevent_polling(poll_dmevents);
+	if (init_dmevent_waiter(vecs)) {
+		condlog(0, "failed to allocate dmevents waiter info");
+		goto failed;
+	}
+	if (unified_loop && uxsock_watch_dmevents(dmevent_fd()) == 0)
+		condlog(2, "handling dm events in the cli listener");
+	else if ((rc = start_daemon_thread(&dmevent_thr, THREAD_DMEVENTS,
+					   wait_dmevents, NULL))) {
+		condlog(0, "failed to create dmevent waiter thread: %d",
+			rc);
+		goto failed;
+	} else {
+		dmevent_thr_started = true;
+		register_thread(THREAD_DMEVENTS, dmevent_thr);
 	}
 
 	/*
 	 * Start uevent listener early to catch events
 	 */
-	if ((rc = pthread_create(&uevent_thr, &uevent_attr, ueventloop, udev))) {
+	if ((rc = start_daemon_thread(&uevent_thr, THREAD_UEVENT, ueventloop,
+				      udev))) {
 		condlog(0, "failed to create uevent thread: %d", rc);
 		goto failed;
-	} else
+	} else {
 		uevent_thr_started = true;
-	pthread_attr_destroy(&uevent_attr);
+		register_thread(THREAD_UEVENT, uevent_thr);
+	}
 
 	/*
 	 * start threads
 	 */
-	if ((rc = pthread_create(&check_thr, &misc_attr, checkerloop, vecs))) {
+	if (start_flush_thread(vecs))
+		condlog(1, "removing maps without their last path synchronously");
+	if ((rc = start_daemon_thread(&check_thr, THREAD_CHECKER, checkerloop,
+				      vecs))) {
 		condlog(0,"failed to create checker loop thread: %d", rc);
 		goto failed;
-	} else
+	} else {
 		check_thr_started = true;
-	if ((rc = pthread_create(&uevq_thr, &misc_attr, uevqloop, vecs))) {
+		register_thread(THREAD_CHECKER, check_thr);
+	}
+	if ((rc = start_daemon_thread(&uevq_thr, THREAD_UEVQ, uevqloop, vecs))) {
 		condlog(0, "failed to create uevent dispatcher: %d", rc);
 		goto failed;
-	} else
+	} else {
 		uevq_thr_started = true;
-	pthread_attr_destroy(&misc_attr);
+		register_thread(THREAD_UEVQ, uevq_thr);
+	}
 
 	while (1) {
+		unsigned long seq;
+		bool delayed = false;
+
 		pthread_cleanup_push(config_cleanup, NULL);
 		pthread_mutex_lock(&config_lock);
 		while (running_state != DAEMON_CONFIGURE &&
-		       running_state != DAEMON_SHUTDOWN)
+		       running_state != DAEMON_SHUTDOWN &&
+		       !reconfigure_pending)
 			pthread_cond_wait(&config_cond, &config_lock);
+		if (running_state != DAEMON_CONFIGURE)
+			wait_reconfigure_debounce();
 		state = running_state;
 		pthread_cleanup_pop(1);
 		if (state == DAEMON_SHUTDOWN)
 			break;
-		if (state == DAEMON_CONFIGURE) {
-			pthread_cleanup_push(cleanup_lock, &vecs->lock);
-			lock(&vecs->lock);
-			pthread_testcancel();
-			if (!need_to_delay_reconfig(vecs)) {
-				reconfigure(vecs);
-			} else {
-				conf = get_multipath_config();
-				conf->delayed_reconfig = 1;
-				put_multipath_config(conf);
-			}
-			lock_cleanup_pop(vecs->lock);
-			post_config_state(DAEMON_IDLE);
+		/* a new request, the checker may still be running */
+		if (state != DAEMON_CONFIGURE &&
+		    set_config_state(DAEMON_CONFIGURE) != 0)
+			continue;
+
+		/* This reconfigure serves all requests received so far */
+		pthread_mutex_lock(&config_lock);
+		seq = reconfigure_requested;
+		reconfigure_pending = false;
+		pthread_mutex_unlock(&config_lock);
+
+		pthread_cleanup_push(cleanup_lock, &vecs->lock);
+		lock(&vecs->lock);
+		pthread_testcancel();
+		if (!need_to_delay_reconfig(vecs)) {
+			/*
+			 * Uevents are held back until we're done
+			 * here, none get lost for the index.
+			 */
+			if (dm_partmap_index_init())
+				condlog(2, "failed to index partition maps");
+			reconfigure(vecs, uatomic_xchg(&reconfigure_all, 0));
+			/* only the startup uses it */
+			drop_checkpoint();
+		} else {
+			conf = get_multipath_config();
+			conf->delayed_reconfig = 1;
+			put_multipath_config(conf);
+			delayed = true;
 		}
+		lock_cleanup_pop(vecs->lock);
+
+		pthread_mutex_lock(&config_lock);
+		/* the delayed reconfigure will serve the requests */
+		if (!delayed && seq > reconfigure_done)
+			reconfigure_done = seq;
+		__post_config_state(DAEMON_IDLE);
+		pthread_mutex_unlock(&config_lock);
 	}
 
 	exit_code = 0;
@@ -3400,7 +5484,7 @@ main (int argc, char *argv[])
 		condlog(3, "failed to register exit handler for libmultipath");
 	libmp_udev_set_sync_support(0);
 
-	while ((arg = getopt(argc, argv, ":dsv:k::Bniw")) != EOF ) {
+	while ((arg = getopt(argc, argv, ":dsv:k::Bniwl:")) != EOF ) {
 		switch(arg) {
 		case 'd':
 			foreground = 1;
@@ -3430,6 +5514,14 @@ main (int argc, char *argv[])
 		case 'w':
 			poll_dmevents = 0;
 			break;
+		case 'l':
+			if (!isdigit(optarg[0]) || atoi(optarg) <= 0) {
+				fprintf(stderr, "Invalid log area size '%s'\n",
+					optarg);
+				exit(1);
+			}
+			log_thread_set_area_size(atoi(optarg) * 1024);
+			break;
 		default:
 			fprintf(stderr, "Invalid argument '-%c'\n",
 				optopt);
@@ -3489,91 +5581,13 @@ main (int argc, char *argv[])
 		return (child(NULL));
 }
 
-void *  mpath_pr_event_handler_fn (void * pathp )
-{
-	struct multipath * mpp;
-	unsigned int i;
-	int ret, isFound;
-	struct path * pp = (struct path *)pathp;
-	struct prout_param_descriptor *param;
-	struct prin_resp *resp;
-
-	rcu_register_thread();
-	mpp = pp->mpp;
-
-	resp = mpath_alloc_prin_response(MPATH_PRIN_RKEY_SA);
-	if (!resp){
-		condlog(0,"%s Alloc failed for prin response", pp->dev);
-		goto out;
-	}
-
-	ret = prin_do_scsi_ioctl(pp->dev, MPATH_PRIN_RKEY_SA, resp, 0);
-	if (ret != MPATH_PR_SUCCESS )
-	{
-		condlog(0,"%s : pr in read keys service action failed. Error=%d", pp->dev, ret);
-		goto out;
-	}
-
-	condlog(3, " event pr=%d addlen=%d",resp->prin_descriptor.prin_readkeys.prgeneration,
-			resp->prin_descriptor.prin_readkeys.additional_length );
-
-	if (resp->prin_descriptor.prin_readkeys.additional_length == 0 )
-	{
-		condlog(1, "%s: No key found. Device may not be registered.", pp->dev);
-		goto out;
-	}
-	condlog(2, "Multipath  reservation_key: 0x%" PRIx64 " ",
-		get_be64(mpp->reservation_key));
-
-	isFound =0;
-	for (i = 0; i < resp->prin_descriptor.prin_readkeys.additional_length/8; i++ )
-	{
-		condlog(2, "PR IN READKEYS[%d]  reservation key:",i);
-		dumpHex((char *)&resp->prin_descriptor.prin_readkeys.key_list[i*8], 8 , -1);
-		if (!memcmp(&mpp->reservation_key, &resp->prin_descriptor.prin_readkeys.key_list[i*8], 8))
-		{
-			condlog(2, "%s: pr key found in prin readkeys response", mpp->alias);
-			isFound =1;
-			break;
-		}
-	}
-	if (!isFound)
-	{
-		condlog(0, "%s: Either device not registered or ", pp->dev);
-		condlog(0, "host is not authorised for registration. Skip path");
-		goto out;
-	}
-
-	param = (struct prout_param_descriptor *)MALLOC(sizeof(struct prout_param_descriptor));
-	if (!param)
-		goto out;
-
-	param->sa_flags = mpp->sa_flags;
-	memcpy(param->sa_key, &mpp->reservation_key, 8);
-	param->num_transportid = 0;
-
-	condlog(3, "device %s:%s", pp->dev, pp->mpp->wwid);
-
-	ret = prout_do_scsi_ioctl(pp->dev, MPATH_PROUT_REG_IGN_SA, 0, 0, param, 0);
-	if (ret != MPATH_PR_SUCCESS )
-	{
-		condlog(0,"%s: Reservation registration failed. Error: %d", pp->dev, ret);
-	}
-	mpp->prflag = 1;
-
-	free(param);
-out:
-	if (resp)
-		free(resp);
-	rcu_unregister_thread();
-	return NULL;
-}
-
+/*
+ * Queue the registration of the map's reservation key on a new or
+ * reinstated path. The checker loop sends the queued registrations of
+ * each map together in flush_pr_events().
+ */
 int mpath_pr_event_handle(struct path *pp)
 {
-	pthread_t thread;
-	int rc;
-	pthread_attr_t attr;
 	struct multipath * mpp;
 
 	if (pp->bus != SYSFS_BUS_SCSI)
@@ -3581,18 +5595,9 @@ int mpath_pr_event_handle(struct path *pp)
 
 	mpp = pp->mpp;
 
-	if (!get_be64(mpp->reservation_key))
+	if (!mpp || !get_be64(mpp->reservation_key))
 		return -1;
 
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-
-	rc = pthread_create(&thread, NULL , mpath_pr_event_handler_fn, pp);
-	if (rc) {
-		condlog(0, "%s: ERROR; return code from pthread_create() is %d", pp->dev, rc);
-		return -1;
-	}
-	pthread_attr_destroy(&attr);
-	rc = pthread_join(thread, NULL);
+	pp->pr_pending = true;
 	return 0;
 }
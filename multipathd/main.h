@@ -2,6 +2,8 @@
 #define MAIN_H
 
 #define MAPGCINT 5
+/* ticks between sweeps for unscheduled paths */
+#define CHECK_SCHED_SWEEP_INT 60
 
 enum daemon_status {
 	DAEMON_INIT = 0,
@@ -29,6 +31,7 @@ enum remove_path_result {
 
 struct prout_param_descriptor;
 struct prin_resp;
+struct strbuf;
 
 extern pid_t daemon_pid;
 extern int uxsock_timeout;
@@ -38,14 +41,32 @@ const char * daemon_status(void);
 enum daemon_status wait_for_state_change_if(enum daemon_status oldstate,
 					    unsigned long ms);
 int need_to_delay_reconfig (struct vectors *);
-int reconfigure (struct vectors *);
+int reconfigure (struct vectors *, bool reload_all);
+int schedule_reconfigure(bool reload_all, unsigned long *seq);
+int reconfigure_completed(unsigned long seq);
 int ev_add_path (struct path *, struct vectors *, int);
-int ev_remove_path (struct path *, struct vectors *, int);
-int ev_add_map (char *, const char *, struct vectors *);
+/*
+ * With queue_flush, a map whose last path is removed is flushed by the
+ * flush thread later, see flush_queue.h. Otherwise the path is removed
+ * from the map or the map is flushed before returning.
+ */
+int __ev_remove_path (struct path *, struct vectors *, int need_do_map,
+		      bool queue_flush);
+#define ev_remove_path(pp, vecs, need_do_map) \
+	__ev_remove_path(pp, vecs, need_do_map, false)
+int ev_add_map (const char *, const char *, struct vectors *);
 int ev_remove_map (char *, char *, int, struct vectors *);
 int flush_map(struct multipath *, struct vectors *, int);
+/*
+ * Drop mpp after dm_flush_map*() returned r == 0. Otherwise, it's still
+ * in use, and is kept. Returns r.
+ */
+int handle_flush_result(struct multipath *mpp, struct vectors *vecs, int r);
 int set_config_state(enum daemon_status);
+/* Print the progress of a running configure(), nothing if there is none */
+int snprint_configure_progress(struct strbuf *buf);
 void * mpath_alloc_prin_response(int prin_sa);
+struct prin_resp *mpath_get_prin_buffer(void);
 int prin_do_scsi_ioctl(char *, int rq_servact, struct prin_resp * resp,
 		       int noisy);
 void dumpHex(const char * , int len, int no_ascii);
@@ -53,9 +74,7 @@ int prout_do_scsi_ioctl(char * , int rq_servact, int rq_scope,
 			unsigned int rq_type,
 			struct prout_param_descriptor *param, int noisy);
 int mpath_pr_event_handle(struct path *pp);
-void * mpath_pr_event_handler_fn (void * );
 int update_map_pr(struct multipath *mpp);
-void * mpath_pr_event_handler_fn (void * pathp );
 void handle_signals(bool);
 int __setup_multipath (struct vectors * vecs, struct multipath * mpp,
 		       int reset);
@@ -66,4 +85,7 @@ int reload_and_sync_map(struct multipath *mpp, struct vectors *vecs,
 
 void handle_path_wwid_change(struct path *pp, struct vectors *vecs);
 bool check_path_wwid_change(struct path *pp);
+struct lock_profile;
+/* NULL unless built with ENABLE_LOCK_PROFILE=1 */
+struct lock_profile *get_config_profile(void);
 #endif /* MAIN_H */
@@ -0,0 +1,105 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "print.h"
+#include "strbuf.h"
+#include "util.h"
+#include "map_gen.h"
+
+#define MAX_REMOVED_MAPS 256
+
+struct removed_map {
+	uint64_t generation;
+	char wwid[WWID_SIZE];
+};
+
+static uint64_t map_generation;
+/* ring of the most recently removed maps */
+static struct removed_map removed_maps[MAX_REMOVED_MAPS];
+static unsigned int n_removed, removed_next;
+/* removals up to this generation may have been dropped from the ring */
+static uint64_t removed_horizon;
+
+static void init_generation(void)
+{
+	if (map_generation == 0) {
+		map_generation = (uint64_t)time(NULL) << 20;
+		removed_horizon = map_generation;
+	}
+}
+
+static uint64_t next_generation(void)
+{
+	init_generation();
+	return ++map_generation;
+}
+
+void note_map_removed(const struct multipath *mpp)
+{
+	struct removed_map *rm = &removed_maps[removed_next];
+
+	/* the client can't know maps that were never reported */
+	if (mpp->generation == 0)
+		return;
+	if (n_removed == MAX_REMOVED_MAPS)
+		removed_horizon = rm->generation;
+	else
+		n_removed++;
+	rm->generation = next_generation();
+	strlcpy(rm->wwid, mpp->wwid, sizeof(rm->wwid));
+	removed_next = (removed_next + 1) % MAX_REMOVED_MAPS;
+}
+
+static void update_map_generations(struct vectors *vecs)
+{
+	struct multipath *mpp;
+	unsigned int hash;
+	int i;
+
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		hash = multipath_json_hash(mpp);
+		if (mpp->generation && hash == mpp->json_hash)
+			continue;
+		mpp->json_hash = hash;
+		mpp->generation = next_generation();
+	}
+}
+
+int snprint_maps_since_json(struct strbuf *buff, struct vectors *vecs,
+			    uint64_t since)
+{
+	struct _vector removed = { .slot = NULL, };
+	bool complete;
+	unsigned int i, k;
+	int rc;
+
+	init_generation();
+	update_map_generations(vecs);
+	complete = since < removed_horizon || since > map_generation;
+
+	for (i = 0; !complete && i < n_removed; i++) {
+		k = (removed_next + MAX_REMOVED_MAPS - n_removed + i) %
+			MAX_REMOVED_MAPS;
+		if (removed_maps[k].generation <= since)
+			continue;
+		if (!vector_alloc_slot(&removed)) {
+			complete = true;
+			break;
+		}
+		vector_set_slot(&removed, removed_maps[k].wwid);
+	}
+	if (complete)
+		vector_reset(&removed);
+
+	rc = snprint_multipath_changes_json(buff, vecs, since, map_generation,
+					    complete, &removed);
+	vector_reset(&removed);
+	return rc;
+}
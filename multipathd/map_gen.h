@@ -0,0 +1,33 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _MAP_GEN_H
+#define _MAP_GEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct vectors;
+struct multipath;
+struct strbuf;
+
+/*
+ * Map generations for "show maps since $gen json".
+ *
+ * Every reply carries the current generation number. A map gets a new
+ * generation when its JSON output has changed since the last query, so
+ * that a client can pass the number from its previous reply and only
+ * get the maps that changed in between. Generations are seeded from the
+ * daemon start time, so they don't go backwards across restarts.
+ *
+ * Removed maps are kept in a bounded log. If the client's generation is
+ * older than the log, or from a different daemon instance, the reply
+ * has "complete" set and contains all maps.
+ *
+ * All functions must be called with vecs->lock held.
+ */
+void note_map_removed(const struct multipath *mpp);
+int snprint_maps_since_json(struct strbuf *buff, struct vectors *vecs,
+			    uint64_t since);
+
+#endif /* _MAP_GEN_H */
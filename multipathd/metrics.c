@@ -0,0 +1,410 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <string.h>
+#include <time.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "checkers.h"
+#include "log.h"
+#include "strbuf.h"
+#include "util.h"
+#include "time-util.h"
+#include "uevent.h"
+#include "loop_stats.h"
+#include "thread_settings.h"
+#include "cli.h"
+#include "metrics.h"
+
+#define PREFIX "multipathd_"
+
+static int print_family(struct strbuf *buf, const char *name,
+			const char *type, const char *help)
+{
+	return print_strbuf(buf, "# TYPE " PREFIX "%s %s\n# HELP " PREFIX "%s %s\n",
+			    name, type, name, help);
+}
+
+/* Append str as label value, escaping '\\', '"' and newlines */
+static int append_label_value(struct strbuf *buf, const char *str)
+{
+	int rc;
+
+	if ((rc = append_strbuf_str(buf, "\"")) < 0)
+		return rc;
+	while (*str) {
+		size_t n = strcspn(str, "\\\"\n");
+
+		if (n > 0 && (rc = __append_strbuf_str(buf, str, n)) < 0)
+			return rc;
+		str += n;
+		if (!*str)
+			break;
+		if ((rc = append_strbuf_str(buf, *str == '\n' ? "\\n" :
+					    *str == '"' ? "\\\"" : "\\\\")) < 0)
+			return rc;
+		str++;
+	}
+	return append_strbuf_str(buf, "\"");
+}
+
+static const char *map_name(const struct multipath *mpp)
+{
+	if (!mpp)
+		return "";
+	return mpp->alias ? mpp->alias : mpp->wwid;
+}
+
+enum map_metric {
+	MAP_PATHS,
+	MAP_ACTIVE_PATHS,
+	MAP_SWITCHGROUP,
+	MAP_PATH_FAILURES,
+	MAP_LOADS,
+	MAP_QUEUEING,
+	MAP_QUEUEING_TIMEOUTS,
+	MAP_FAILURES,
+	__MAP_METRIC_NR,
+};
+
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+} map_metrics[__MAP_METRIC_NR] = {
+	[MAP_PATHS] = { "map_paths", "gauge", "Number of paths of the map." },
+	[MAP_ACTIVE_PATHS] = { "map_active_paths", "gauge",
+			       "Number of usable paths of the map." },
+	[MAP_SWITCHGROUP] = { "map_switch_group", "counter",
+			      "Path group switches." },
+	[MAP_PATH_FAILURES] = { "map_path_failures", "counter",
+				"Path failures." },
+	[MAP_LOADS] = { "map_loads", "counter", "Map reloads." },
+	[MAP_QUEUEING] = { "map_queueing_seconds", "counter",
+			   "Time spent queueing I/O without usable paths." },
+	[MAP_QUEUEING_TIMEOUTS] = { "map_queueing_timeouts", "counter",
+				    "Expired no_path_retry timeouts." },
+	[MAP_FAILURES] = { "map_failures", "counter",
+			   "Times the map lost all usable paths." },
+};
+
+static unsigned int map_metric_value(const struct multipath *mpp,
+				     enum map_metric m)
+{
+	switch (m) {
+	case MAP_PATHS:
+		return VECTOR_SIZE(mpp->paths);
+	case MAP_ACTIVE_PATHS:
+		return count_active_paths(mpp);
+	case MAP_SWITCHGROUP:
+		return mpp->stat_switchgroup;
+	case MAP_PATH_FAILURES:
+		return mpp->stat_path_failures;
+	case MAP_LOADS:
+		return mpp->stat_map_loads;
+	case MAP_QUEUEING:
+		return mpp->stat_total_queueing_time;
+	case MAP_QUEUEING_TIMEOUTS:
+		return mpp->stat_queueing_timeouts;
+	case MAP_FAILURES:
+		return mpp->stat_map_failures;
+	default:
+		return 0;
+	}
+}
+
+static int snprint_map_metrics(struct strbuf *buf, const struct _vector *mpvec)
+{
+	struct multipath *mpp;
+	int i, m, rc;
+
+	for (m = 0; m < __MAP_METRIC_NR; m++) {
+		bool counter = !strcmp(map_metrics[m].type, "counter");
+
+		if ((rc = print_family(buf, map_metrics[m].name,
+				       map_metrics[m].type,
+				       map_metrics[m].help)) < 0)
+			return rc;
+		vector_foreach_slot(mpvec, mpp, i) {
+			if ((rc = print_strbuf(buf, PREFIX "%s%s{map=",
+					       map_metrics[m].name,
+					       counter ? "_total" : "")) < 0 ||
+			    (rc = append_label_value(buf, map_name(mpp))) < 0 ||
+			    (rc = print_strbuf(buf, "} %u\n",
+					       map_metric_value(mpp, m))) < 0)
+				return rc;
+		}
+	}
+	return 0;
+}
+
+static int print_path_labels(struct strbuf *buf, const char *name,
+			     const struct path *pp)
+{
+	int rc;
+
+	if ((rc = print_strbuf(buf, PREFIX "%s{path=\"%s\",map=", name,
+			       pp->dev)) < 0 ||
+	    (rc = append_label_value(buf, map_name(pp->mpp))) < 0)
+		return rc;
+	return 0;
+}
+
+static bool io_stats_valid(const struct io_stats *st)
+{
+	return st->time.tv_sec || st->time.tv_nsec;
+}
+
+enum io_metric {
+	IO_OPS,
+	IO_BYTES,
+	IO_LATENCY,
+	__IO_METRIC_NR,
+};
+
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+} io_metrics[__IO_METRIC_NR] = {
+	[IO_OPS] = { "io_ops", "gauge",
+		     "I/O operations per second in the last sample interval." },
+	[IO_BYTES] = { "io_bytes", "gauge",
+		       "Bytes per second in the last sample interval." },
+	[IO_LATENCY] = { "io_latency_seconds", "summary",
+			 "Estimated I/O latency quantiles." },
+};
+
+static const unsigned int io_quantiles[] = { 50, 90, 99 };
+
+static int print_io_family(struct strbuf *buf, const char *kind,
+			   enum io_metric m)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s_%s", kind, io_metrics[m].name);
+	return print_family(buf, name, io_metrics[m].type, io_metrics[m].help);
+}
+
+/* labels is the label list without braces, e.g. map="mpatha" */
+static int print_io_metric(struct strbuf *buf, const char *kind,
+			   const char *labels, const struct io_stats *st,
+			   enum io_metric m)
+{
+	const char *name = io_metrics[m].name;
+	unsigned int q;
+	int rc;
+
+	if (m == IO_OPS)
+		return print_strbuf(buf, PREFIX "%s_%s{%s} %u\n", kind, name,
+				    labels, st->iops);
+	if (m == IO_BYTES)
+		return print_strbuf(buf, PREFIX "%s_%s{%s} %llu\n", kind, name,
+				    labels, st->kbps * 1024ULL);
+	for (q = 0; q < ARRAY_SIZE(io_quantiles); q++) {
+		if ((rc = print_strbuf(buf, PREFIX "%s_%s{%s,quantile=\"0.%02u\"} %g\n",
+				       kind, name, labels, io_quantiles[q],
+				       io_stats_percentile(st, io_quantiles[q]) / 1e6)) < 0)
+			return rc;
+	}
+	return 0;
+}
+
+static int snprint_map_io_metrics(struct strbuf *buf, const struct _vector *mpvec)
+{
+	STRBUF_ON_STACK(labels);
+	struct multipath *mpp;
+	int i, m, rc;
+
+	for (m = 0; m < __IO_METRIC_NR; m++) {
+		if ((rc = print_io_family(buf, "map", m)) < 0)
+			return rc;
+		vector_foreach_slot(mpvec, mpp, i) {
+			if (!io_stats_valid(&mpp->io_stats))
+				continue;
+			reset_strbuf(&labels);
+			if ((rc = append_strbuf_str(&labels, "map=")) < 0 ||
+			    (rc = append_label_value(&labels, map_name(mpp))) < 0 ||
+			    (rc = print_io_metric(buf, "map", get_strbuf_str(&labels),
+						  &mpp->io_stats, m)) < 0)
+				return rc;
+		}
+	}
+	return 0;
+}
+
+static int snprint_path_io_metrics(struct strbuf *buf, const struct _vector *pathvec)
+{
+	STRBUF_ON_STACK(labels);
+	struct path *pp;
+	int i, m, rc;
+
+	for (m = 0; m < __IO_METRIC_NR; m++) {
+		if ((rc = print_io_family(buf, "path", m)) < 0)
+			return rc;
+		vector_foreach_slot(pathvec, pp, i) {
+			if (!io_stats_valid(&pp->io_stats))
+				continue;
+			reset_strbuf(&labels);
+			if ((rc = print_strbuf(&labels, "path=\"%s\",map=",
+					       pp->dev)) < 0 ||
+			    (rc = append_label_value(&labels, map_name(pp->mpp))) < 0 ||
+			    (rc = print_io_metric(buf, "path", get_strbuf_str(&labels),
+						  &pp->io_stats, m)) < 0)
+				return rc;
+		}
+	}
+	return 0;
+}
+
+static int snprint_path_metrics(struct strbuf *buf, const struct _vector *pathvec)
+{
+	struct path *pp;
+	struct timespec now;
+	int i, rc;
+
+	get_monotonic_time(&now);
+	if ((rc = print_family(buf, "path_failures", "counter",
+			       "Path failures.")) < 0)
+		return rc;
+	vector_foreach_slot(pathvec, pp, i) {
+		if ((rc = print_path_labels(buf, "path_failures_total", pp)) < 0 ||
+		    (rc = print_strbuf(buf, "} %d\n", pp->failcount)) < 0)
+			return rc;
+	}
+
+	if ((rc = print_family(buf, "path_checker_state_seconds", "gauge",
+			       "Time since the last change of the path checker state.")) < 0)
+		return rc;
+	vector_foreach_slot(pathvec, pp, i) {
+		/* not checked yet */
+		if (!pp->chkrstate_since)
+			continue;
+		if ((rc = print_path_labels(buf, "path_checker_state_seconds",
+					    pp)) < 0 ||
+		    (rc = print_strbuf(buf, ",state=\"%s\"} %ld\n",
+				       checker_state_name(pp->chkrstate),
+				       (long)(now.tv_sec - pp->chkrstate_since))) < 0)
+			return rc;
+	}
+
+	if ((rc = print_family(buf, "path_dm_active", "gauge",
+			       "1 if the path is active in the kernel map, 0 if it is failed.")) < 0)
+		return rc;
+	vector_foreach_slot(pathvec, pp, i) {
+		if (pp->dmstate != PSTATE_ACTIVE && pp->dmstate != PSTATE_FAILED)
+			continue;
+		if ((rc = print_path_labels(buf, "path_dm_active", pp)) < 0 ||
+		    (rc = print_strbuf(buf, "} %d\n",
+				       pp->dmstate == PSTATE_ACTIVE)) < 0)
+			return rc;
+	}
+	return 0;
+}
+
+static int snprint_daemon_metrics(struct strbuf *buf)
+{
+	struct uevent_stats st;
+	struct log_stats lst;
+	int rc;
+
+	uevent_get_stats(&st);
+	log_get_stats(&lst);
+	if ((rc = print_family(buf, "uevents", "counter",
+			       "Received uevents.")) < 0 ||
+	    (rc = print_strbuf(buf, PREFIX "uevents_total %lu\n",
+			       st.events)) < 0 ||
+	    (rc = print_family(buf, "uevents_merged", "counter",
+			       "Uevents merged with others.")) < 0 ||
+	    (rc = print_strbuf(buf, PREFIX "uevents_merged_total %lu\n",
+			       st.merged)) < 0 ||
+	    (rc = print_family(buf, "uevents_filtered", "counter",
+			       "Uevents made obsolete by later ones.")) < 0 ||
+	    (rc = print_strbuf(buf, PREFIX "uevents_filtered_total %lu\n",
+			       st.filtered)) < 0 ||
+	    (rc = print_family(buf, "uevent_queue_length", "gauge",
+			       "Uevents waiting to be processed.")) < 0 ||
+	    (rc = print_strbuf(buf, PREFIX "uevent_queue_length %u\n",
+			       st.queued)) < 0 ||
+	    (rc = print_family(buf, "uevent_overruns", "counter",
+			       "Overruns of the uevent receive buffer, which lost uevents.")) < 0 ||
+	    (rc = print_strbuf(buf, PREFIX "uevent_overruns_total %lu\n",
+			       st.overruns)) < 0 ||
+	    (rc = print_family(buf, "uevent_resyncs", "counter",
+			       "Path resyncs after lost uevents.")) < 0 ||
+	    (rc = print_strbuf(buf, PREFIX "uevent_resyncs_total %lu\n",
+			       st.resyncs)) < 0 ||
+	    (rc = print_family(buf, "log_messages_dropped", "counter",
+			       "Log messages dropped because the log area was full.")) < 0 ||
+	    (rc = print_strbuf(buf, PREFIX "log_messages_dropped_total %lu\n",
+			       lst.dropped)) < 0)
+		return rc;
+	return 0;
+}
+
+static int snprint_cpu_metrics(struct strbuf *buf)
+{
+	struct thread_cpu_stats ts[16];
+	struct cli_cpu_stats *cs;
+	int i, n, rc;
+
+	n = get_thread_cpu_stats(ts, ARRAY_SIZE(ts));
+	if ((rc = print_family(buf, "thread_cpu_seconds", "counter",
+			       "CPU time of the daemon threads.")) < 0)
+		return rc;
+	for (i = 0; i < n; i++)
+		if ((rc = print_strbuf(buf, PREFIX "thread_cpu_seconds_total{thread=\"%s\"} %llu.%06llu\n",
+				       ts[i].name, ts[i].cpu_ns / 1000000000ULL,
+				       ts[i].cpu_ns % 1000000000ULL / 1000)) < 0)
+			return rc;
+	if ((rc = print_family(buf, "thread_wakeups", "counter",
+			       "Voluntary context switches of the daemon threads.")) < 0)
+		return rc;
+	for (i = 0; i < n; i++)
+		if ((rc = print_strbuf(buf, PREFIX "thread_wakeups_total{thread=\"%s\"} %lu\n",
+				       ts[i].name, ts[i].wakeups)) < 0)
+			return rc;
+
+	n = get_cli_cpu_stats(&cs);
+	if (n < 0)
+		return 0;
+	if ((rc = print_family(buf, "cli_commands", "counter",
+			       "CLI commands run, by command.")) < 0)
+		goto out;
+	for (i = 0; i < n; i++)
+		if ((rc = append_strbuf_str(buf, PREFIX "cli_commands_total{command=")) < 0 ||
+		    (rc = append_label_value(buf, cs[i].cmd)) < 0 ||
+		    (rc = print_strbuf(buf, "} %lu\n", cs[i].calls)) < 0)
+			goto out;
+	if ((rc = print_family(buf, "cli_cpu_seconds", "counter",
+			       "CPU time of CLI commands, by command.")) < 0)
+		goto out;
+	for (i = 0; i < n; i++)
+		if ((rc = append_strbuf_str(buf, PREFIX "cli_cpu_seconds_total{command=")) < 0 ||
+		    (rc = append_label_value(buf, cs[i].cmd)) < 0 ||
+		    (rc = print_strbuf(buf, "} %llu.%06llu\n",
+				       cs[i].cpu_ns / 1000000000ULL,
+				       cs[i].cpu_ns % 1000000000ULL / 1000)) < 0)
+			goto out;
+	rc = 0;
+out:
+	free(cs);
+	return rc;
+}
+
+int snprint_metrics(struct strbuf *buf, const struct vectors *vecs)
+{
+	int rc;
+
+	if ((rc = snprint_daemon_metrics(buf)) < 0 ||
+	    (rc = snprint_cpu_metrics(buf)) < 0 ||
+	    (rc = snprint_loop_stats_metrics(buf)) < 0 ||
+	    (rc = snprint_map_metrics(buf, vecs->mpvec)) < 0 ||
+	    (rc = snprint_path_metrics(buf, vecs->pathvec)) < 0 ||
+	    (rc = snprint_map_io_metrics(buf, vecs->mpvec)) < 0 ||
+	    (rc = snprint_path_io_metrics(buf, vecs->pathvec)) < 0)
+		return rc;
+	return append_strbuf_str(buf, "# EOF\n");
+}
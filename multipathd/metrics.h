@@ -0,0 +1,19 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _METRICS_H
+#define _METRICS_H
+
+struct strbuf;
+struct vectors;
+
+/*
+ * Render the counters of multipathd in OpenMetrics text format, for
+ * "show metrics". Only uses values that multipathd keeps anyway, so that
+ * frequent scraping doesn't cause any sysfs or device-mapper access.
+ *
+ * Must be called with vecs->lock held, it may be shared.
+ */
+int snprint_metrics(struct strbuf *buf, const struct vectors *vecs);
+
+#endif /* _METRICS_H */
@@ -0,0 +1,115 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "config.h"
+#include "devmapper.h"
+#include "uevent.h"
+#include "debug.h"
+#include "util.h"
+#include "lock.h"
+#include "../kpartx/ptable.h"
+#include "partmaps.h"
+
+/* The partition delimiter kpartx.rules passes to kpartx */
+#define KPARTX_RULES_DELIM "-part"
+
+/* The conditions of kpartx.rules, but for the "skip_kpartx" flag */
+static bool uevent_wants_partmaps(const struct uevent *uev)
+{
+	return uevent_get_env_positive_int(uev, "DM_SUBSYSTEM_UDEV_FLAG1") == 1 &&
+		uevent_get_env_positive_int(uev, "MPATH_UNCHANGED") != 1 &&
+		uevent_get_env_positive_int(uev, "DM_SUSPENDED") != 1 &&
+		uevent_get_env_positive_int(uev, "DM_NOSCAN") != 1;
+}
+
+static int read_partitions(const char *alias, const char *devname,
+			   struct dm_partition *parts, int *ro)
+{
+	struct slice *slices;
+	char devnode[PATH_MAX];
+	int fd, n, i;
+
+	if (safe_sprintf(devnode, "/dev/%s", devname))
+		return -1;
+	fd = open(devnode, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		condlog(2, "%s: failed to open %s: %m", alias, devnode);
+		return -1;
+	}
+	if (ioctl(fd, BLKROGET, ro) != 0)
+		*ro = 0;
+
+	slices = calloc(MAXSLICES, sizeof(*slices));
+	if (!slices) {
+		close(fd);
+		return -1;
+	}
+	n = read_ptable(fd, NULL, slices, MAXSLICES);
+	close(fd);
+	for (i = 0; i < n; i++) {
+		parts[i].start = slices[i].start;
+		parts[i].size = slices[i].size;
+	}
+	free(slices);
+	return n;
+}
+
+int uev_map_partitions(const struct uevent *uev, struct vectors *vecs)
+{
+	struct dm_partition *parts = NULL;
+	struct multipath *mpp;
+	struct config *conf;
+	char *alias = NULL, *delim = NULL;
+	int enabled, ro = 0, n, r = 0;
+
+	conf = get_multipath_config();
+	enabled = conf->internal_kpartx;
+	if (enabled)
+		delim = strdup(conf->partition_delim ? : KPARTX_RULES_DELIM);
+	put_multipath_config(conf);
+	if (!enabled || !delim || !uevent_wants_partmaps(uev))
+		goto out;
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	mpp = find_mp_by_minor(vecs->mpvec, uevent_get_minor(uev));
+	if (mpp && mpp->alias && mpp->skip_kpartx != SKIP_KPARTX_ON)
+		alias = strdup(mpp->alias);
+	lock_cleanup_pop(vecs->lock);
+	if (!alias)
+		goto out;
+
+	/* The partition table is read without holding the lock */
+	parts = calloc(MAXSLICES, sizeof(*parts));
+	if (!parts)
+		goto out;
+	n = read_partitions(alias, uev->kernel, parts, &ro);
+	if (n <= 0) {
+		/* Like kpartx -u, keep the maps if there's no table */
+		condlog(4, "%s: no partition table found", alias);
+		goto out;
+	}
+	r = dm_update_partmaps(alias, delim, parts, n, ro);
+	if (r)
+		condlog(2, "%s: failed to update %d partition maps", alias, r);
+	else
+		condlog(3, "%s: partition maps updated", alias);
+out:
+	free(parts);
+	free(alias);
+	free(delim);
+	return r ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _PARTMAPS_H
+#define _PARTMAPS_H
+
+struct uevent;
+struct vectors;
+
+/*
+ * Partition maps of multipath maps, created by multipathd itself if
+ * internal_kpartx is set in multipath.conf(5).
+ *
+ * Maps loaded by multipathd then have the "skip_kpartx" udev flag set, so
+ * that kpartx.rules doesn't run kpartx for them. On the change uevent of
+ * such a map, this reads the partition table with the parsers of kpartx
+ * and creates, reloads or removes the partition maps like "kpartx -u"
+ * would, in the dm udev batch of the uevent. Maps with skip_kpartx set,
+ * and uevents for which kpartx.rules wouldn't run kpartx either, are
+ * ignored.
+ *
+ * Must be called without vecs->lock held. Returns 1 if some partition
+ * maps couldn't be updated.
+ */
+int uev_map_partitions(const struct uevent *uev, struct vectors *vecs);
+
+#endif /* _PARTMAPS_H */
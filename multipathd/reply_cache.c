@@ -0,0 +1,88 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <urcu/uatomic.h>
+
+#include "memory.h"
+#include "reply_cache.h"
+
+struct cached_reply {
+	char *reply;
+	int len;
+	unsigned int seq;
+	unsigned long dev_gen;
+};
+
+static struct cached_reply cache[__REPLY_CACHE_LAST];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long device_generation;
+
+unsigned long get_device_generation(void)
+{
+	return uatomic_read(&device_generation);
+}
+
+void invalidate_device_replies(void)
+{
+	uatomic_inc(&device_generation);
+}
+
+int get_cached_reply(int id, unsigned int seq, char **reply, int *len)
+{
+	struct cached_reply *cr;
+	int r = 1;
+
+	if (id < 0 || id >= __REPLY_CACHE_LAST)
+		return 1;
+	cr = &cache[id];
+	pthread_mutex_lock(&cache_lock);
+	if (cr->reply && cr->seq == seq &&
+	    (id != REPLY_CACHE_DEVICES ||
+	     cr->dev_gen == get_device_generation())) {
+		*reply = MALLOC(cr->len);
+		if (*reply) {
+			memcpy(*reply, cr->reply, cr->len);
+			*len = cr->len;
+			r = 0;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return r;
+}
+
+void drop_cached_reply(int id)
+{
+	if (id < 0 || id >= __REPLY_CACHE_LAST)
+		return;
+	pthread_mutex_lock(&cache_lock);
+	if (cache[id].reply)
+		FREE(cache[id].reply);
+	cache[id].reply = NULL;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void set_cached_reply(int id, unsigned int seq, unsigned long dev_gen,
+		      const char *reply, int len)
+{
+	struct cached_reply *cr;
+	char *copy;
+
+	if (id < 0 || id >= __REPLY_CACHE_LAST || !reply || len <= 0)
+		return;
+	copy = MALLOC(len);
+	if (!copy)
+		return;
+	memcpy(copy, reply, len);
+	cr = &cache[id];
+	pthread_mutex_lock(&cache_lock);
+	if (cr->reply)
+		FREE(cr->reply);
+	cr->reply = copy;
+	cr->len = len;
+	cr->seq = seq;
+	cr->dev_gen = dev_gen;
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,42 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _REPLY_CACHE_H
+#define _REPLY_CACHE_H
+
+/*
+ * Rendered replies of "show config", "show blacklist" and "show devices",
+ * which config management tools poll often, but which only change on
+ * reconfigure, or, for "show devices", when block devices come and go.
+ *
+ * A reply is stored with the sequence number of the config it was
+ * rendered from, and for "show devices" also with the device generation,
+ * which uevents and path additions and removals advance. A reply is only
+ * used while both still match.
+ */
+enum reply_cache_id {
+	REPLY_CACHE_CONFIG = 0,
+	REPLY_CACHE_BLACKLIST,
+	REPLY_CACHE_DEVICES,
+	__REPLY_CACHE_LAST,
+};
+
+/*
+ * Copy the cached reply for id, if it was rendered from config sequence
+ * number seq. Returns 0 on success, and 1 if there is none.
+ */
+int get_cached_reply(int id, unsigned int seq, char **reply, int *len);
+/*
+ * Store a copy of reply for id, rendered from config seq. For
+ * REPLY_CACHE_DEVICES, pass the device generation read before
+ * rendering, so that changes during rendering aren't missed.
+ */
+void set_cached_reply(int id, unsigned int seq, unsigned long dev_gen,
+		      const char *reply, int len);
+/* The config has been changed in place, without a reconfigure */
+void drop_cached_reply(int id);
+unsigned long get_device_generation(void);
+/* Block devices or paths have changed */
+void invalidate_device_replies(void);
+
+#endif /* _REPLY_CACHE_H */
@@ -0,0 +1,149 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libudev.h>
+
+#include "list.h"
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "config.h"
+#include "sysfs.h"
+#include "debug.h"
+#include "util.h"
+#include "time-util.h"
+#include "smart_wait.h"
+
+struct smart_wait {
+	struct list_head node;
+	char dev[FILE_NAME_SIZE];
+	struct timespec deadline;
+	/* the "add" uevent for the expired wait has been sent */
+	bool triggered;
+};
+
+static LIST_HEAD(waits);
+static pthread_mutex_t waits_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called with waits_lock held */
+static struct smart_wait *find_wait(const char *dev)
+{
+	struct smart_wait *sw;
+
+	list_for_each_entry(sw, &waits, node)
+		if (!strcmp(sw->dev, dev))
+			return sw;
+	return NULL;
+}
+
+/* Sets *remaining if the wait hasn't expired */
+static bool wait_expired(const struct smart_wait *sw,
+			 const struct timespec *now, struct timespec *remaining)
+{
+	struct timespec diff;
+
+	timespecsub(&sw->deadline, now, &diff);
+	if (diff.tv_sec < 0 || (diff.tv_sec == 0 && diff.tv_nsec == 0))
+		return true;
+	if (remaining)
+		*remaining = diff;
+	return false;
+}
+
+int smart_wait_check(const char *dev, long tmo, struct timespec *remaining)
+{
+	struct smart_wait *sw;
+	struct timespec now;
+	int r = SMART_WAIT_WAITING;
+
+	get_monotonic_time(&now);
+	pthread_mutex_lock(&waits_lock);
+	sw = find_wait(dev);
+	if (!sw) {
+		if (tmo <= 0 || !(sw = calloc(1, sizeof(*sw)))) {
+			r = SMART_WAIT_NEVER;
+			goto out;
+		}
+		strlcpy(sw->dev, dev, sizeof(sw->dev));
+		sw->deadline = now;
+		sw->deadline.tv_sec += tmo;
+		list_add_tail(&sw->node, &waits);
+		condlog(3, "%s: waiting %ld seconds for more paths", dev, tmo);
+	}
+	if (wait_expired(sw, &now, remaining))
+		r = SMART_WAIT_DONE;
+out:
+	pthread_mutex_unlock(&waits_lock);
+	return r;
+}
+
+bool smart_wait_forget(const char *dev)
+{
+	struct smart_wait *sw;
+	bool found = false;
+
+	pthread_mutex_lock(&waits_lock);
+	sw = find_wait(dev);
+	if (sw) {
+		list_del(&sw->node);
+		free(sw);
+		found = true;
+	}
+	pthread_mutex_unlock(&waits_lock);
+	return found;
+}
+
+static void trigger_add_uevent(const char *dev)
+{
+	struct udev_device *ud;
+
+	ud = udev_device_new_from_subsystem_sysname(udev, "block", dev);
+	if (!ud) {
+		condlog(2, "%s: failed to find device to end waiting", dev);
+		return;
+	}
+	condlog(3, "%s: timeout waiting for more paths, triggering add uevent",
+		dev);
+	sysfs_attr_set_value(ud, "uevent", "add", strlen("add"));
+	udev_device_unref(ud);
+}
+
+void smart_wait_tick(struct vectors *vecs)
+{
+	struct smart_wait *sw, *tmp;
+	struct timespec now;
+	struct path *pp;
+
+	get_monotonic_time(&now);
+	pthread_mutex_lock(&waits_lock);
+	list_for_each_entry_safe(sw, tmp, &waits, node) {
+		if (sw->triggered || !wait_expired(sw, &now, NULL))
+			continue;
+		/* the map has been created meanwhile */
+		pp = find_path_by_dev(vecs->pathvec, sw->dev);
+		if (pp && pp->mpp) {
+			list_del(&sw->node);
+			free(sw);
+			continue;
+		}
+		/* later uevents still see that waiting is done */
+		sw->triggered = true;
+		trigger_add_uevent(sw->dev);
+	}
+	pthread_mutex_unlock(&waits_lock);
+}
+
+void cleanup_smart_wait(void)
+{
+	struct smart_wait *sw, *tmp;
+
+	pthread_mutex_lock(&waits_lock);
+	list_for_each_entry_safe(sw, tmp, &waits, node) {
+		list_del(&sw->node);
+		free(sw);
+	}
+	pthread_mutex_unlock(&waits_lock);
+}
@@ -0,0 +1,39 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _SMART_WAIT_H
+#define _SMART_WAIT_H
+
+#include <stdbool.h>
+#include <time.h>
+
+struct vectors;
+
+/*
+ * Devices that "find_multipaths smart" waits for: multipath -u has seen
+ * only one path with their WWID, and asks multipathd with the
+ * "find_multipaths" command whether to claim them. multipathd keeps
+ * the deadline until which more paths are waited for. When it passes,
+ * multipathd triggers an "add" uevent for the device, so that
+ * multipath -u can release it. This replaces the timestamp files in
+ * /dev/shm and the systemd timer of the udev rules while multipathd
+ * is running.
+ */
+enum smart_wait_state {
+	SMART_WAIT_NEVER,
+	SMART_WAIT_DONE,
+	SMART_WAIT_WAITING,
+};
+
+/*
+ * Start waiting tmo seconds for dev, unless this has been done already,
+ * or tmo <= 0. Sets *remaining if SMART_WAIT_WAITING is returned.
+ */
+int smart_wait_check(const char *dev, long tmo, struct timespec *remaining);
+/* Stop waiting for dev. Returns true if it was waited for. */
+bool smart_wait_forget(const char *dev);
+/* Trigger the uevents of expired waits, needs vecs->lock */
+void smart_wait_tick(struct vectors *vecs);
+void cleanup_smart_wait(void);
+
+#endif /* _SMART_WAIT_H */
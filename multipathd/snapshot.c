@@ -0,0 +1,152 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <urcu.h>
+#include <urcu/uatomic.h>
+
+#include "list.h"
+#include "util.h"
+#include "strbuf.h"
+#include "debug.h"
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "cli_handlers.h"
+#include "snapshot.h"
+
+struct snapshot_reply {
+	struct rcu_head rcu;
+	/* topology_generation() when the reply was rendered */
+	unsigned long generation;
+	/* published by configure(), see publish_partial_snapshot() */
+	bool partial;
+	int len;
+	char str[];
+};
+
+static struct snapshot_reply *snapshot[__SNAPSHOT_LAST];
+
+static void rcu_free_reply(struct rcu_head *head)
+{
+	free(container_of(head, struct snapshot_reply, rcu));
+}
+
+static void publish_reply(int id, struct snapshot_reply *rp)
+{
+	struct snapshot_reply *old;
+
+	old = rcu_xchg_pointer(&snapshot[id], rp);
+	if (old)
+		call_rcu(&old->rcu, rcu_free_reply);
+}
+
+static struct snapshot_reply *alloc_reply(const char *str, int len,
+					  unsigned long generation,
+					  bool partial)
+{
+	struct snapshot_reply *rp;
+
+	rp = malloc(sizeof(*rp) + len);
+	if (!rp)
+		return NULL;
+	rp->generation = generation;
+	rp->partial = partial;
+	rp->len = len;
+	memcpy(rp->str, str, len);
+	return rp;
+}
+
+int get_snapshot_reply(__attribute__((unused)) struct vectors *vecs, int id,
+		       char **reply, int *len)
+{
+	struct snapshot_reply *rp;
+	int ret = 1;
+
+	if (id <= SNAPSHOT_NONE || id >= __SNAPSHOT_LAST)
+		return 1;
+
+	rcu_read_lock();
+	rp = rcu_dereference(snapshot[id]);
+	if (rp && (rp->partial || rp->generation == topology_generation())) {
+		*reply = malloc(rp->len);
+		if (*reply) {
+			memcpy(*reply, rp->str, rp->len);
+			*len = rp->len;
+			ret = 0;
+		}
+	}
+	rcu_read_unlock();
+	return ret;
+}
+
+int render_topology_snapshot(struct vectors *vecs, int id,
+			     char **reply, int *len)
+{
+	/* Can't change while we hold vecs->lock */
+	unsigned long generation = topology_generation();
+	struct snapshot_reply *rp;
+	char *str = NULL;
+	int str_len = 0;
+
+	/* another reader may have rendered it while we waited for the lock */
+	if (get_snapshot_reply(vecs, id, reply, len) == 0)
+		return 0;
+	if (render_snapshot_reply(id, &str, &str_len, vecs) != 0 || !str)
+		return 1;
+	/* If storing fails, the next command renders it again */
+	rp = alloc_reply(str, str_len, generation, false);
+	if (rp)
+		publish_reply(id, rp);
+	*reply = str;
+	*len = str_len;
+	return 0;
+}
+
+/* A copy of a rendered reply, with the partial state line prepended */
+static struct snapshot_reply *partial_reply(const char *str,
+					    unsigned long generation,
+					    const char *phase)
+{
+	STRBUF_ON_STACK(buf);
+
+	if (print_strbuf(&buf, "partial state, configure is %s\n",
+			 phase) < 0 ||
+	    append_strbuf_str(&buf, str) < 0)
+		return NULL;
+	return alloc_reply(get_strbuf_str(&buf), get_strbuf_len(&buf) + 1,
+			   generation, true);
+}
+
+void publish_partial_snapshot(struct vectors *vecs, const char *phase)
+{
+	unsigned long generation = topology_generation();
+	int i;
+
+	for (i = SNAPSHOT_NONE + 1; i < __SNAPSHOT_LAST; i++) {
+		struct snapshot_reply *rp = NULL;
+		char *str = NULL;
+		int len;
+
+		/* JSON consumers couldn't tell a partial reply */
+		if (i != SNAPSHOT_MAPS_JSON &&
+		    render_snapshot_reply(i, &str, &len, vecs) == 0 && str) {
+			rp = partial_reply(str, generation, phase);
+			free(str);
+		}
+		/* with rp == NULL, just drop the old reply */
+		if (rp || uatomic_read(&snapshot[i]))
+			publish_reply(i, rp);
+	}
+}
+
+void invalidate_topology_snapshot(void)
+{
+	int i;
+
+	for (i = SNAPSHOT_NONE + 1; i < __SNAPSHOT_LAST; i++)
+		if (uatomic_read(&snapshot[i]))
+			publish_reply(i, NULL);
+}
@@ -0,0 +1,52 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+/*
+ * Topology snapshots: rendered replies for the most common read-only
+ * CLI commands, published with RCU so that they can be served without
+ * taking vecs->lock.
+ *
+ * A reply is rendered on demand, by the first command that doesn't find
+ * a current one, with vecs->lock held shared. It's stored with the
+ * topology_generation(), and only used while that is unchanged. It
+ * advances when paths or maps are added or removed, when the table or
+ * status of a map changes, when the checker changes the state of a
+ * path, and after uevents and exclusive CLI commands, so that the
+ * commands of the client itself don't go unnoticed. Checker ticks which
+ * change nothing leave the replies current. The countdown to the next
+ * check of the paths (%C) isn't tracked, and may be stale.
+ */
+enum snapshot_reply_id {
+	SNAPSHOT_NONE = 0,
+	SNAPSHOT_PATHS,
+	SNAPSHOT_MAPS,
+	SNAPSHOT_TOPOLOGY,
+	SNAPSHOT_MAPS_JSON,
+	__SNAPSHOT_LAST,
+};
+
+struct vectors;
+
+/*
+ * Copy the current reply for id. Returns 0 on success, and 1 if there
+ * is none; the caller must then call render_topology_snapshot().
+ */
+int get_snapshot_reply(struct vectors *vecs, int id, char **reply, int *len);
+/*
+ * Like get_snapshot_reply(), but render and store the reply if there is
+ * no current one. Must be called with vecs->lock held, shared is enough.
+ */
+int render_topology_snapshot(struct vectors *vecs, int id,
+			     char **reply, int *len);
+void invalidate_topology_snapshot(void);
+
+/*
+ * Publish the state found so far by configure(), which holds vecs->lock
+ * all the time, so that the text replies can be served while it runs.
+ * Their first line says that the state is partial, and there is no
+ * JSON reply. A partial reply is used regardless of the generation,
+ * so configure() must invalidate it when it's done.
+ */
+void publish_partial_snapshot(struct vectors *vecs, const char *phase);
+
+#endif /* _SNAPSHOT_H */
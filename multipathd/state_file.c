@@ -0,0 +1,156 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mpath_cmd.h"
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "debug.h"
+#include "file.h"
+#include "strbuf.h"
+#include "cli_binary.h"
+#include "state_file.h"
+
+#define STATE_TMP_FILE MPATH_STATE_FILE ".new"
+/* Initial size of the file, it doubles when necessary */
+#define STATE_MIN_SIZE (64 * 1024)
+
+static int state_fd = -1;
+static struct mpath_state_hdr *state;
+static size_t state_size;
+
+/*
+ * The sequence lock protocol of mpath_state_read(). There's only one
+ * writer, the thread holding vecs->lock.
+ */
+static void state_write_begin(void)
+{
+	__atomic_store_n(&state->seq, state->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void state_write_end(void)
+{
+	__atomic_store_n(&state->seq, state->seq + 1, __ATOMIC_RELEASE);
+}
+
+int init_state_file(void)
+{
+	void *p;
+	int fd;
+
+	if (ensure_directories_exist(MPATH_STATE_FILE, 0755) != 0)
+		return -1;
+	fd = open(STATE_TMP_FILE, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+		  0644);
+	if (fd == -1) {
+		condlog(1, "failed to create %s: %m", STATE_TMP_FILE);
+		return -1;
+	}
+	if (ftruncate(fd, STATE_MIN_SIZE) != 0) {
+		condlog(1, "failed to size %s: %m", STATE_TMP_FILE);
+		goto fail;
+	}
+	p = mmap(NULL, STATE_MIN_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		 fd, 0);
+	if (p == MAP_FAILED) {
+		condlog(1, "failed to map %s: %m", STATE_TMP_FILE);
+		goto fail;
+	}
+	state = p;
+	state_size = STATE_MIN_SIZE;
+	state->magic = MPATH_STATE_MAGIC;
+	state->version = MPATH_STATE_VERSION;
+	state->pid = getpid();
+	state->size = state_size;
+	state->time = time(NULL);
+	/* readers can't see the file before it's complete */
+	if (rename(STATE_TMP_FILE, MPATH_STATE_FILE) != 0) {
+		condlog(1, "failed to rename %s: %m", STATE_TMP_FILE);
+		munmap(state, state_size);
+		state = NULL;
+		goto fail;
+	}
+	state_fd = fd;
+	condlog(3, "publishing state in %s", MPATH_STATE_FILE);
+	return 0;
+fail:
+	close(fd);
+	unlink(STATE_TMP_FILE);
+	return -1;
+}
+
+/* Only called outside of the sequence lock, so readers remap */
+static int grow_state_file(size_t len)
+{
+	size_t size = state_size;
+	void *p;
+
+	while (size < len)
+		size *= 2;
+	if (size > UINT32_MAX)
+		return -ERANGE;
+	if (ftruncate(state_fd, size) != 0)
+		return -errno;
+	p = mremap(state, state_size, size, MREMAP_MAYMOVE);
+	if (p == MAP_FAILED)
+		return -errno;
+	state = p;
+	state_size = size;
+	return 0;
+}
+
+void update_state_file(const struct vectors *vecs)
+{
+	STRBUF_ON_STACK(buf);
+	size_t len;
+	int r;
+
+	if (!state)
+		return;
+	if ((r = append_bin_records(&buf, MPATH_OP_LIST_MAPS, vecs)) < 0 ||
+	    (r = append_bin_records(&buf, MPATH_OP_LIST_PATHS, vecs)) < 0) {
+		condlog(2, "failed to render state: %s", strerror(-r));
+		return;
+	}
+	len = get_strbuf_len(&buf);
+	if (len == state->len && !memcmp(state + 1, get_strbuf_str(&buf), len))
+		return;
+	if (sizeof(*state) + len > state_size &&
+	    (r = grow_state_file(sizeof(*state) + len)) < 0) {
+		condlog(1, "failed to grow %s: %s", MPATH_STATE_FILE,
+			strerror(-r));
+		return;
+	}
+
+	state_write_begin();
+	state->size = state_size;
+	state->len = len;
+	state->time = time(NULL);
+	memcpy(state + 1, get_strbuf_str(&buf), len);
+	state_write_end();
+}
+
+void exit_state_file(void)
+{
+	if (!state)
+		return;
+	state_write_begin();
+	state->flags |= MPATH_STATE_STOPPED;
+	state_write_end();
+	munmap(state, state_size);
+	state = NULL;
+	close(state_fd);
+	state_fd = -1;
+	unlink(MPATH_STATE_FILE);
+}
@@ -0,0 +1,23 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef _STATE_FILE_H
+#define _STATE_FILE_H
+
+/*
+ * The shared state file, see MPATH_STATE_FILE in mpath_cmd.h and
+ * publish_state in multipath.conf(5).
+ *
+ * init_state_file() creates the file. update_state_file() renders the
+ * records of all maps and paths, and writes them to the file if they
+ * have changed. It must be called with vecs->lock held, and does nothing
+ * unless the file has been created. exit_state_file() tells readers that
+ * multipathd has stopped, and removes the file.
+ */
+struct vectors;
+
+int init_state_file(void);
+void update_state_file(const struct vectors *vecs);
+void exit_state_file(void);
+
+#endif /* _STATE_FILE_H */
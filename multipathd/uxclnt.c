@@ -5,6 +5,8 @@
  * Copyright (c) 2005 Benjamin Marzinski, Redhat
  */
 #include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdarg.h>
@@ -66,14 +68,64 @@ static int need_quit(char *str, size_t len)
 	return 0;
 }
 
+/*
+ * Send a command and print the reply, chunk by chunk if the daemon
+ * sends a chunked reply. *failed is set if the reply was "fail".
+ * Returns 0 on success, or a negative error code.
+ */
+static int run_cmd(int fd, const char *cmd, unsigned int timeout,
+		   void (*print)(char *), bool *failed)
+{
+	char *buf = NULL;
+	ssize_t len;
+	bool chunked;
+	int ret = 0;
+
+	*failed = false;
+	if (mpath_send_cmd_chunked(fd, cmd) != 0)
+		return -errno;
+	len = mpath_recv_chunk_len(fd, timeout);
+	chunked = (len == MPATH_REPLY_CHUNKED);
+	if (chunked)
+		len = mpath_recv_chunk_len(fd, timeout);
+	else if (len == 0 || len >= MAX_REPLY_LEN) {
+		errno = ERANGE;
+		len = -1;
+	}
+	while (len > 0) {
+		buf = MALLOC(len);
+		if (!buf)
+			return -ENOMEM;
+		if (mpath_recv_reply_data(fd, buf, len, timeout) != 0) {
+			ret = -errno;
+			break;
+		}
+		print(buf);
+		*failed = !strcmp(buf, "fail\n");
+		FREE(buf);
+		buf = NULL;
+		if (!chunked)
+			return 0;
+		len = mpath_recv_chunk_len(fd, timeout);
+	}
+	if (len < 0)
+		ret = -errno;
+	FREE(buf);
+	return ret;
+}
+
+static void print_raw(char *s)
+{
+	printf("%s", s);
+}
+
 /*
  * process the client
  */
 static void process(int fd, unsigned int timeout)
 {
 	char *line;
-	char *reply;
-	int ret;
+	bool failed;
 
 	cli_init();
 	rl_readline_name = "multipathd";
@@ -89,42 +141,51 @@ static void process(int fd, unsigned int timeout)
 		if (need_quit(line, llen))
 			break;
 
-		if (send_packet(fd, line) != 0) break;
-		ret = recv_packet(fd, &reply, timeout);
-		if (ret != 0) break;
-
-		print_reply(reply);
+		if (run_cmd(fd, line, timeout, print_reply, &failed) != 0)
+			break;
 
 		if (line && *line)
 			add_history(line);
 
 		free(line);
+	}
+}
+
+/*
+ * After "subscribe events", the daemon sends batches of event records
+ * until the connection is closed.
+ */
+static int follow_events(int fd)
+{
+	char *reply;
+
+	while (mpath_recv_reply(fd, &reply, (unsigned int)-1) == 0) {
+		print_raw(reply);
+		fflush(stdout);
 		FREE(reply);
 	}
+	printf("error %d receiving events\n", errno);
+	return 1;
 }
 
 static int process_req(int fd, char * inbuf, unsigned int timeout)
 {
-	char *reply;
+	bool failed;
 	int ret;
 
-	if (send_packet(fd, inbuf) != 0) {
-		printf("cannot send packet\n");
-		return 1;
-	}
-	ret = recv_packet(fd, &reply, timeout);
+	ret = run_cmd(fd, inbuf, timeout, print_raw, &failed);
 	if (ret < 0) {
 		if (ret == -ETIMEDOUT)
 			printf("timeout receiving packet\n");
 		else
 			printf("error %d receiving packet\n", ret);
 		return 1;
-	} else {
-		printf("%s", reply);
-		ret = (strcmp(reply, "fail\n") == 0);
-		FREE(reply);
-		return ret;
 	}
+	if (!failed && !strncmp(inbuf, "subscribe", strlen("subscribe"))) {
+		fflush(stdout);
+		return follow_events(fd);
+	}
+	return failed;
 }
 
 /*
@@ -18,12 +18,15 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <sys/inotify.h>
+#include <urcu.h>
 #include "checkers.h"
 #include "memory.h"
 #include "debug.h"
@@ -36,21 +39,77 @@
 #include "mpath_cmd.h"
 #include "time-util.h"
 #include "util.h"
+#include "strbuf.h"
 
 #include "main.h"
 #include "cli.h"
+#include "cli_binary.h"
+#include "feed.h"
+#include "dmevents.h"
 #include "uxlsnr.h"
+#include "thread_settings.h"
 
 struct client {
 	struct list_head node;
 	int fd;
+	/* receives the event feed, see feed.h */
+	bool subscribed;
+	/*
+	 * a command of this client has been passed to the workers, and
+	 * the fd isn't polled until it's done
+	 */
+	bool busy;
+	/*
+	 * reply to "reconfigure wait", held back until the reconfigure
+	 * serving request reconfigure_seq has completed. The fd isn't
+	 * polled meanwhile.
+	 */
+	char *reconfigure_reply;
+	unsigned long reconfigure_seq;
+	/*
+	 * the part of the replies that the socket didn't take without
+	 * blocking. While there is some, the fd is polled for EPOLLOUT
+	 * instead of EPOLLIN, so that the next command of the client is
+	 * only read when its replies have been sent.
+	 */
+	char *outbuf;
+	size_t outlen;
+	size_t outpos;
+};
+
+/*
+ * Commands that take vecs->lock are run by a small pool of worker
+ * threads, in the order they were received, so that a slow command
+ * doesn't hold up the other clients. Commands with unlocked handlers
+ * are cheap, and run right away in the listener thread.
+ * While the daemon is configuring, commands that need vecs->lock
+ * exclusively are held back until it's done. The others are served as
+ * usual, mostly from the partial snapshots published by configure().
+ */
+#define CLI_WORKERS 4
+
+/*
+ * Identical HANDLER_LOCKED_SHARED commands are coalesced: while a job is
+ * queued or running, the same command of other clients joins it as a
+ * follower, and gets a copy of its reply, rendered once under a single
+ * hold of vecs->lock. Jobs that can still be joined are on shared_jobs.
+ */
+struct cli_job {
+	struct list_head node;
+	struct client *c;
+	char *inbuf;
+	bool chunked;
+	bool is_root;
+	struct timespec start_time;
+	/* on shared_jobs while it can be joined, protected by cli_job_lock */
+	struct list_head shared_node;
+	struct list_head followers;
 };
 
 /* The number of fds we poll on, other than individual client connections */
-#define POLLFDS_BASE 2
-#define POLLFD_CHUNK (4096 / sizeof(struct pollfd))
-/* Minimum mumber of pollfds to reserve for clients */
-#define MIN_POLLS (POLLFD_CHUNK - POLLFDS_BASE)
+#define POLLFDS_BASE 4
+/* Max number of events handled per epoll_pwait() call */
+#define MAX_EVENTS 64
 /*
  * Max number of client connections allowed
  * During coldplug, there may be a large number of "multipath -u"
@@ -58,15 +117,38 @@ struct client {
  */
 #define MAX_CLIENTS (16384 - POLLFDS_BASE)
 
-/* Compile-time error if POLLFD_CHUNK is too small */
-static __attribute__((unused)) char ___a[-(MIN_POLLS <= 0)];
+/*
+ * Client fds are registered with epoll with the struct client pointer
+ * in epoll_data. These tags identify the other fds.
+ */
+static char listen_tag, notify_tag, feed_tag, dmevent_tag;
+#define LISTEN_TAG ((void *)&listen_tag)
+#define NOTIFY_TAG ((void *)&notify_tag)
+#define FEED_TAG ((void *)&feed_tag)
+#define DMEVENT_TAG ((void *)&dmevent_tag)
 
 static LIST_HEAD(clients);
 static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
-static struct pollfd *polls;
+static int num_clients;
+static int epoll_fd = -1;
 static int notify_fd = -1;
+static int feed_fd = -1;
+static int dmevent_watch_fd = -1;
 static char *watch_config_dir;
 
+/* clients waiting for a reconfigure, protected by client_lock */
+static int n_reconfigure_waiters;
+static LIST_HEAD(cli_jobs);
+static LIST_HEAD(shared_jobs);
+/* Only used by the listener thread */
+static LIST_HEAD(held_jobs);
+static pthread_mutex_t cli_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cli_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t cli_workers[CLI_WORKERS];
+static int n_cli_workers;
+static uxsock_trigger_fn *cli_trigger;
+static void *cli_trigger_data;
+
 static bool _socket_client_is_root(int fd);
 
 static bool _socket_client_is_root(int fd)
@@ -92,6 +174,7 @@ static void new_client(int ux_sock)
 	struct client *c;
 	struct sockaddr addr;
 	socklen_t len = sizeof(addr);
+	struct epoll_event ev;
 	int fd;
 
 	fd = accept(ux_sock, &addr, &len);
@@ -108,9 +191,19 @@ static void new_client(int ux_sock)
 	INIT_LIST_HEAD(&c->node);
 	c->fd = fd;
 
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		condlog(1, "%s: failed to add client fd: %m", __func__);
+		FREE(c);
+		close(fd);
+		return;
+	}
+
 	/* put it in our linked list */
 	pthread_mutex_lock(&client_lock);
 	list_add_tail(&c->node, &clients);
+	num_clients++;
 	pthread_mutex_unlock(&client_lock);
 }
 
@@ -121,8 +214,18 @@ static void _dead_client(struct client *c)
 {
 	int fd = c->fd;
 	list_del_init(&c->node);
+	num_clients--;
+	if (c->subscribed)
+		feed_unsubscribe();
+	if (c->reconfigure_reply) {
+		FREE(c->reconfigure_reply);
+		n_reconfigure_waiters--;
+	}
+	if (c->outbuf)
+		FREE(c->outbuf);
 	c->fd = -1;
 	FREE(c);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
 	close(fd);
 }
 
@@ -134,10 +237,120 @@ static void dead_client(struct client *c)
 	pthread_cleanup_pop(1);
 }
 
-static void free_polls (void)
+/*
+ * Poll c for the next command, or for sending the rest of its replies.
+ * op is EPOLL_CTL_ADD or EPOLL_CTL_MOD.
+ */
+static int watch_client(struct client *c, int op)
+{
+	struct epoll_event ev = { .events = c->outbuf ? EPOLLOUT : EPOLLIN,
+				  .data.ptr = c, };
+
+	return epoll_ctl(epoll_fd, op, c->fd, &ev);
+}
+
+/*
+ * Send a packet in length prefix format, like send_packet_len(), without
+ * blocking. What the socket doesn't take is appended to c->outbuf, and
+ * sent by flush_client(). A NULL buf with len 0 ends a chunked reply.
+ * Returns 0, or a negative error if the client is gone.
+ */
+static int queue_packet(struct client *c, const char *buf, size_t len)
 {
-	if (polls)
-		FREE(polls);
+	struct iovec iov[2] = {
+		{ .iov_base = &len, .iov_len = sizeof(len) },
+		{ .iov_base = (void *)(uintptr_t)buf, .iov_len = len },
+	};
+	struct msghdr msg = { .msg_iov = iov, .msg_iovlen = len ? 2 : 1, };
+	size_t total = sizeof(len) + len, sent = 0;
+	ssize_t n;
+	char *p;
+
+	/* Nothing is pending, the reply can go out right away */
+	if (!c->outbuf) {
+		do
+			n = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		while (n < 0 && errno == EINTR);
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return -errno;
+		if (n > 0)
+			sent = n;
+		if (sent == total)
+			return 0;
+	}
+
+	p = REALLOC(c->outbuf, c->outlen + total - sent);
+	if (!p)
+		return -ENOMEM;
+	c->outbuf = p;
+	if (sent < sizeof(len)) {
+		memcpy(p + c->outlen, (char *)&len + sent, sizeof(len) - sent);
+		c->outlen += sizeof(len) - sent;
+		sent = sizeof(len);
+	}
+	if (total > sent) {
+		memcpy(p + c->outlen, buf + sent - sizeof(len), total - sent);
+		c->outlen += total - sent;
+	}
+	return 0;
+}
+
+/* Like send_packet() */
+static int queue_reply(struct client *c, const char *reply)
+{
+	return queue_packet(c, reply, reply ? strlen(reply) + 1 : 0);
+}
+
+/*
+ * Send as much of c->outbuf as the socket takes without blocking.
+ * Returns 0 if it has all been sent, 1 if some is left, or a negative
+ * error.
+ */
+static int flush_client(struct client *c)
+{
+	ssize_t n;
+
+	while (c->outpos < c->outlen) {
+		n = send(c->fd, c->outbuf + c->outpos, c->outlen - c->outpos,
+			 MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 1;
+			return -errno;
+		}
+		if (n == 0)
+			return -EIO;
+		c->outpos += n;
+	}
+	FREE(c->outbuf);
+	c->outbuf = NULL;
+	c->outlen = c->outpos = 0;
+	return 0;
+}
+
+/* The client's socket takes more of its pending replies */
+static void handle_client_output(struct client *c)
+{
+	int r = flush_client(c);
+
+	if (r < 0) {
+		condlog(3, "cli[%d]: failed to send reply: %s", c->fd,
+			strerror(-r));
+		dead_client(c);
+		return;
+	}
+	if (r > 0)
+		return;
+	condlog(4, "cli[%d]: pending reply sent", c->fd);
+	pthread_cleanup_push(cleanup_mutex, &client_lock);
+	pthread_mutex_lock(&client_lock);
+	if (watch_client(c, EPOLL_CTL_MOD) == -1) {
+		condlog(1, "%s: failed to poll client fd: %m", __func__);
+		_dead_client(c);
+	}
+	pthread_cleanup_pop(1);
 }
 
 static void check_timeout(struct timespec start_time, char *inbuf,
@@ -159,15 +372,92 @@ static void check_timeout(struct timespec start_time, char *inbuf,
 	}
 }
 
+static void free_cli_job(void *arg)
+{
+	struct cli_job *job = arg;
+	struct cli_job *f, *tmp;
+
+	if (!list_empty(&job->shared_node)) {
+		pthread_mutex_lock(&cli_job_lock);
+		list_del_init(&job->shared_node);
+		pthread_mutex_unlock(&cli_job_lock);
+	}
+	list_for_each_entry_safe(f, tmp, &job->followers, node) {
+		list_del_init(&f->node);
+		free_cli_job(f);
+	}
+	FREE(job->inbuf);
+	FREE(job);
+}
+
+/*
+ * Take the followers off a shared job, so that no more can join, and
+ * send them its reply. Called by the worker that ran the job, before it
+ * sends the reply to its own client.
+ */
+static void share_reply(struct cli_job *job, const char *reply, int rlen)
+{
+	LIST_HEAD(followers);
+	struct cli_job *f, *tmp;
+
+	pthread_mutex_lock(&cli_job_lock);
+	list_del_init(&job->shared_node);
+	list_splice_init(&job->followers, &followers);
+	pthread_mutex_unlock(&cli_job_lock);
+
+	list_for_each_entry_safe(f, tmp, &followers, node) {
+		struct client *c = f->c;
+
+		list_del_init(&f->node);
+		pthread_cleanup_push(cleanup_mutex, &client_lock);
+		pthread_mutex_lock(&client_lock);
+		c->busy = false;
+		if ((reply && queue_reply(c, reply) != 0) ||
+		    watch_client(c, EPOLL_CTL_ADD) == -1)
+			_dead_client(c);
+		else if (reply)
+			condlog(4, "cli[%d]: Reply [%d bytes, shared]", c->fd,
+				rlen);
+		pthread_cleanup_pop(1);
+		check_timeout(f->start_time, f->inbuf, uxsock_timeout);
+		free_cli_job(f);
+	}
+}
+
+static void stop_cli_workers(void)
+{
+	struct cli_job *job, *tmp;
+	int i;
+
+	for (i = 0; i < n_cli_workers; i++)
+		pthread_cancel(cli_workers[i]);
+	for (i = 0; i < n_cli_workers; i++)
+		pthread_join(cli_workers[i], NULL);
+	count_thread(THREAD_CLI, -n_cli_workers);
+	n_cli_workers = 0;
+	list_for_each_entry_safe(job, tmp, &cli_jobs, node) {
+		list_del_init(&job->node);
+		free_cli_job(job);
+	}
+	list_for_each_entry_safe(job, tmp, &held_jobs, node) {
+		list_del_init(&job->node);
+		free_cli_job(job);
+	}
+}
+
 void uxsock_cleanup(void *arg)
 {
 	struct client *client_loop;
 	struct client *client_tmp;
 	long ux_sock = (long)arg;
 
+	/* the workers may be using clients */
+	stop_cli_workers();
 	close(ux_sock);
 	close(notify_fd);
 	free(watch_config_dir);
+	feed_exit();
+	feed_fd = -1;
 
 	pthread_mutex_lock(&client_lock);
 	list_for_each_entry_safe(client_loop, client_tmp, &clients, node) {
@@ -176,7 +466,9 @@ void uxsock_cleanup(void *arg)
 	pthread_mutex_unlock(&client_lock);
 
 	cli_exit();
-	free_polls();
+	if (epoll_fd != -1)
+		close(epoll_fd);
+	epoll_fd = -1;
 }
 
 struct watch_descriptors {
@@ -284,97 +576,506 @@ static void handle_inotify(int fd, struct watch_descriptors *wds)
 }
 
 /*
- * entry point
+ * Send the pending feed records to all subscribers. Subscribers must not
+ * stall the listener, so the packet is sent without blocking, and clients
+ * whose socket buffer is full are dropped.
  */
-void * uxsock_listen(uxsock_trigger_fn uxsock_trigger, long ux_sock,
-		     void * trigger_data)
+static void handle_feed(void)
+{
+	STRBUF_ON_STACK(buf);
+	struct client *c, *tmp;
+	char *pkt;
+	size_t len, plen;
+	ssize_t n;
+
+	if (feed_drain(feed_fd, &buf) == 0 && get_strbuf_len(&buf) == 0)
+		return;
+	len = get_strbuf_len(&buf) + 1;
+	plen = sizeof(len) + len;
+	pkt = MALLOC(plen);
+	if (!pkt)
+		return;
+	memcpy(pkt, &len, sizeof(len));
+	memcpy(pkt + sizeof(len), get_strbuf_str(&buf), len);
+
+	pthread_mutex_lock(&client_lock);
+	list_for_each_entry_safe(c, tmp, &clients, node) {
+		/*
+		 * a busy subscriber, or one whose last reply is still
+		 * pending, gets a reply now, and drops the event
+		 */
+		if (!c->subscribed || c->busy || c->outbuf)
+			continue;
+		n = send(c->fd, pkt, plen, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n != (ssize_t)plen) {
+			condlog(2, "cli[%d]: dropping event subscriber: %s",
+				c->fd, n < 0 ? strerror(errno) : "short write");
+			_dead_client(c);
+		}
+	}
+	pthread_mutex_unlock(&client_lock);
+	FREE(pkt);
+}
+
+int uxsock_watch_dmevents(int fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN,
+				  .data.ptr = DMEVENT_TAG, };
+
+	if (fd == -1 || epoll_fd == -1)
+		return 1;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		condlog(1, "failed to poll for dm events: %m");
+		return 1;
+	}
+	dmevent_watch_fd = fd;
+	condlog(3, "uxsock: handling dm events");
+	return 0;
+}
+
+/*
+ * Like wait_dmevents(), but without blocking the listener. After
+ * errors, the dm fd isn't polled for a while.
+ */
+static void handle_dmevents(struct timespec *resume)
+{
+	struct epoll_event ev = { .events = EPOLLIN,
+				  .data.ptr = DMEVENT_TAG, };
+	int delay;
+
+	if (resume->tv_sec) {
+		struct timespec now;
+
+		get_monotonic_time(&now);
+		if (now.tv_sec < resume->tv_sec)
+			return;
+		resume->tv_sec = 0;
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, dmevent_watch_fd, &ev);
+	}
+	delay = dmevent_dispatch();
+	if (delay < 0) {
+		/* like wait_dmevents() exiting */
+		condlog(0, "uxsock: stopped handling dm events");
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, dmevent_watch_fd, NULL);
+		dmevent_watch_fd = -1;
+	} else if (delay > 0) {
+		get_monotonic_time(resume);
+		resume->tv_sec += delay;
+		ev.events = 0;
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, dmevent_watch_fd, &ev);
+	}
+}
+
+/* Stop or resume polling the listening socket */
+static void set_listening(long ux_sock, bool *listening, bool on)
+{
+	struct epoll_event ev = { .events = on ? EPOLLIN : 0,
+				  .data.ptr = LISTEN_TAG, };
+
+	if (*listening == on)
+		return;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, ux_sock, &ev) == -1) {
+		condlog(1, "%s: failed to %s polling: %m", __func__,
+			on ? "resume" : "pause");
+		return;
+	}
+	*listening = on;
+}
+
+/*
+ * Run a text command and send the reply, see queue_packet(). Chunks
+ * streamed while the command runs are sent blocking. Returns false if
+ * the client has been killed.
+ */
+static bool run_cmd(struct client *c, char *inbuf, bool chunked,
+		    bool is_root, struct timespec start_time,
+		    struct cli_job *job)
 {
+	char *reply;
 	int rlen;
+	bool alive = true;
+
+	set_reply_stream(chunked ? c->fd : -1);
+	cli_trigger(inbuf, &reply, &rlen, is_root, cli_trigger_data);
+	if (job)
+		share_reply(job, reply, rlen);
+	if (reply && !reply_streamed() &&
+	    reconfigure_wait_requested(&c->reconfigure_seq)) {
+		pthread_mutex_lock(&client_lock);
+		c->reconfigure_reply = reply;
+		n_reconfigure_waiters++;
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+		pthread_mutex_unlock(&client_lock);
+		condlog(4, "cli[%d]: waiting for reconfigure", c->fd);
+		set_reply_stream(-1);
+		return true;
+	}
+	if (reply_streamed()) {
+		/* The rest of the reply is the last chunk */
+		if ((reply && *reply && queue_reply(c, reply) != 0) ||
+		    queue_reply(c, NULL) != 0)
+			alive = false;
+		else
+			condlog(4, "cli[%d]: Reply [chunked]", c->fd);
+		FREE(reply);
+	} else if (reply) {
+		if (queue_reply(c, reply) != 0)
+			alive = false;
+		else
+			condlog(4, "cli[%d]: Reply [%d bytes]", c->fd, rlen);
+		FREE(reply);
+	}
+	if (alive && subscribe_requested()) {
+		pthread_mutex_lock(&client_lock);
+		c->subscribed = true;
+		pthread_mutex_unlock(&client_lock);
+		feed_subscribe();
+		condlog(3, "cli[%d]: subscribed to events", c->fd);
+	}
+	set_reply_stream(-1);
+	check_timeout(start_time, inbuf, uxsock_timeout);
+	if (!alive)
+		dead_client(c);
+	return alive;
+}
+
+static void run_cli_job(struct cli_job *job)
+{
+	struct client *c = job->c;
+
+	if (!run_cmd(c, job->inbuf, job->chunked, job->is_root,
+		     job->start_time, job))
+		return;
+	pthread_cleanup_push(cleanup_mutex, &client_lock);
+	pthread_mutex_lock(&client_lock);
+	c->busy = false;
+	if (watch_client(c, EPOLL_CTL_ADD) == -1) {
+		condlog(1, "%s: failed to re-add client fd: %m", __func__);
+		_dead_client(c);
+	}
+	pthread_cleanup_pop(1);
+}
+
+static void rcu_unregister(__attribute__((unused)) void *param)
+{
+	rcu_unregister_thread();
+}
+
+static void *cli_worker(__attribute__((unused)) void *arg)
+{
+	struct cli_job *job;
+
+	pthread_cleanup_push(rcu_unregister, NULL);
+	rcu_register_thread();
+	while (1) {
+		pthread_cleanup_push(cleanup_mutex, &cli_job_lock);
+		pthread_mutex_lock(&cli_job_lock);
+		while (list_empty(&cli_jobs))
+			pthread_cond_wait(&cli_job_cond, &cli_job_lock);
+		job = list_entry(cli_jobs.next, struct cli_job, node);
+		list_del_init(&job->node);
+		/*
+		 * A streamed reply can't be shared. Stream it only if no
+		 * other client has joined yet, and then let none join.
+		 */
+		if (!list_empty(&job->shared_node)) {
+			if (job->chunked && list_empty(&job->followers))
+				list_del_init(&job->shared_node);
+			else
+				job->chunked = false;
+		}
+		pthread_cleanup_pop(1);
+
+		pthread_cleanup_push(free_cli_job, job);
+		run_cli_job(job);
+		pthread_cleanup_pop(1);
+	}
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+static void start_cli_workers(void)
+{
+	pthread_attr_t attr;
+
+	setup_thread_attr_for(&attr, THREAD_CLI, 0);
+	for (n_cli_workers = 0; n_cli_workers < CLI_WORKERS; n_cli_workers++)
+		if (pthread_create(&cli_workers[n_cli_workers], &attr,
+				   cli_worker, NULL) != 0)
+			break;
+	pthread_attr_destroy(&attr);
+	count_thread(THREAD_CLI, n_cli_workers);
+	if (n_cli_workers < CLI_WORKERS)
+		condlog(1, "uxsock: started only %d of %d cli workers",
+			n_cli_workers, CLI_WORKERS);
+}
+
+/*
+ * Join a queued or running job for the same command, see struct cli_job.
+ * Called with cli_job_lock held. Returns false if there is none, and
+ * job can then be joined by the next ones.
+ */
+static bool join_shared_job(struct cli_job *job)
+{
+	struct cli_job *leader;
+
+	list_for_each_entry(leader, &shared_jobs, shared_node) {
+		if (leader->is_root == job->is_root &&
+		    !strcmp(leader->inbuf, job->inbuf)) {
+			list_add_tail(&job->node, &leader->followers);
+			return true;
+		}
+	}
+	list_add_tail(&job->shared_node, &shared_jobs);
+	return false;
+}
+
+/*
+ * Pass a command to the workers, and stop polling the client until it's
+ * done, so that the commands of a client are run one at a time.
+ * With hold set, the command is only passed on by release_held_jobs().
+ * With shared set, the command may share the reply of an identical one.
+ * Returns false if the command must be run by the caller.
+ */
+static bool queue_cmd(struct client *c, char *inbuf, bool chunked,
+		      bool is_root, struct timespec start_time, bool hold,
+		      bool shared)
+{
+	struct cli_job *job;
+
+	if (n_cli_workers == 0)
+		return false;
+	job = (struct cli_job *)MALLOC(sizeof(*job));
+	if (!job)
+		return false;
+	INIT_LIST_HEAD(&job->node);
+	INIT_LIST_HEAD(&job->shared_node);
+	INIT_LIST_HEAD(&job->followers);
+	job->c = c;
+	job->inbuf = inbuf;
+	job->chunked = chunked;
+	job->is_root = is_root;
+	job->start_time = start_time;
+
+	pthread_mutex_lock(&client_lock);
+	c->busy = true;
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	pthread_mutex_unlock(&client_lock);
+
+	if (hold) {
+		list_add_tail(&job->node, &held_jobs);
+		return true;
+	}
+	pthread_mutex_lock(&cli_job_lock);
+	if (shared && join_shared_job(job))
+		condlog(4, "cli[%d]: sharing reply of [%s]", c->fd, inbuf);
+	else {
+		list_add_tail(&job->node, &cli_jobs);
+		pthread_cond_signal(&cli_job_cond);
+	}
+	pthread_mutex_unlock(&cli_job_lock);
+	return true;
+}
+
+/* Send the replies to "reconfigure wait" whose reconfigure is done */
+static void release_reconfigure_waiters(void)
+{
+	struct client *c, *tmp;
+	int done;
+
+	pthread_cleanup_push(cleanup_mutex, &client_lock);
+	pthread_mutex_lock(&client_lock);
+	list_for_each_entry_safe(c, tmp, &clients, node) {
+		if (!c->reconfigure_reply)
+			continue;
+		done = reconfigure_completed(c->reconfigure_seq);
+		if (done == 0)
+			continue;
+		if (done < 0) {
+			FREE(c->reconfigure_reply);
+			c->reconfigure_reply = strdup("fail\n");
+		}
+		if (!c->reconfigure_reply ||
+		    queue_reply(c, c->reconfigure_reply) != 0) {
+			_dead_client(c);
+			continue;
+		}
+		condlog(4, "cli[%d]: reconfigure done", c->fd);
+		FREE(c->reconfigure_reply);
+		c->reconfigure_reply = NULL;
+		n_reconfigure_waiters--;
+		if (watch_client(c, EPOLL_CTL_ADD) == -1) {
+			condlog(1, "%s: failed to re-add client fd: %m",
+				__func__);
+			_dead_client(c);
+		}
+	}
+	pthread_cleanup_pop(1);
+}
+
+static void release_held_jobs(void)
+{
+	if (list_empty(&held_jobs))
+		return;
+	pthread_mutex_lock(&cli_job_lock);
+	list_splice_tail_init(&held_jobs, &cli_jobs);
+	pthread_cond_broadcast(&cli_job_cond);
+	pthread_mutex_unlock(&cli_job_lock);
+}
+
+/*
+ * After a command run by the listener, poll c for output if some of the
+ * reply is pending. Clients waiting for a reconfigure aren't polled.
+ */
+static void watch_pending_output(struct client *c)
+{
+	if (!c->outbuf)
+		return;
+	pthread_cleanup_push(cleanup_mutex, &client_lock);
+	pthread_mutex_lock(&client_lock);
+	if (!c->reconfigure_reply && watch_client(c, EPOLL_CTL_MOD) == -1) {
+		condlog(1, "%s: failed to poll client fd: %m", __func__);
+		_dead_client(c);
+	}
+	pthread_cleanup_pop(1);
+}
+
+static void handle_client(struct client *c, void *trigger_data,
+			  bool configuring)
+{
+	int locked;
+	struct timespec start_time;
 	char *inbuf;
 	char *reply;
+	size_t inlen;
+	bool chunked, is_root;
+
+	get_monotonic_time(&start_time);
+	if (recv_cmd_from_client(c->fd, &inbuf, &inlen, &chunked,
+				 uxsock_timeout) != 0) {
+		dead_client(c);
+		return;
+	}
+	if (!inbuf) {
+		condlog(4, "recv_packet_from_client get null request");
+		return;
+	}
+	if (is_bin_request(inbuf, inlen)) {
+		size_t blen;
+
+		handle_bin_request(inbuf, inlen, &reply, &blen, trigger_data);
+		if (reply) {
+			if (queue_packet(c, reply, blen) != 0) {
+				dead_client(c);
+				c = NULL;
+			} else
+				condlog(4, "cli[%d]: Binary reply [%zu bytes]",
+					c->fd, blen);
+			FREE(reply);
+		}
+		check_timeout(start_time, "binary request", uxsock_timeout);
+		FREE(inbuf);
+		if (c)
+			watch_pending_output(c);
+		return;
+	}
+	condlog(4, "cli[%d]: Got request [%s]", c->fd, inbuf);
+	is_root = _socket_client_is_root(c->fd);
+	locked = cmd_handler_lock(inbuf);
+	if (locked != HANDLER_UNLOCKED &&
+	    queue_cmd(c, inbuf, chunked, is_root, start_time,
+		      configuring && locked == HANDLER_LOCKED,
+		      locked == HANDLER_LOCKED_SHARED))
+		return;
+	if (run_cmd(c, inbuf, chunked, is_root, start_time, NULL))
+		watch_pending_output(c);
+	FREE(inbuf);
+}
+
+/*
+ * entry point
+ */
+void * uxsock_listen(uxsock_trigger_fn uxsock_trigger, long ux_sock,
+		     void * trigger_data)
+{
 	sigset_t mask;
-	int max_pfds = MIN_POLLS + POLLFDS_BASE;
+	struct epoll_event ev, events[MAX_EVENTS];
+	bool listening = true;
 	/* conf->sequence_nr will be 1 when uxsock_listen is first called */
 	unsigned int sequence_nr = 0;
 	struct watch_descriptors wds = { .conf_wd = -1, .dir_wd = -1 };
+	struct timespec dmevent_resume = { .tv_sec = 0 };
 
 	condlog(3, "uxsock: startup listener");
-	polls = MALLOC(max_pfds * sizeof(*polls));
-	if (!polls) {
-		condlog(0, "uxsock: failed to allocate poll fds");
+	cli_trigger = uxsock_trigger;
+	cli_trigger_data = trigger_data;
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.ptr = LISTEN_TAG;
+	if (epoll_fd == -1 ||
+	    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ux_sock, &ev) == -1) {
+		condlog(0, "uxsock: failed to set up epoll: %m");
 		exit_daemon();
 	}
 	notify_fd = inotify_init1(IN_NONBLOCK);
 	if (notify_fd == -1) /* it's fine if notifications fail */
 		condlog(3, "failed to start up configuration notifications");
+	else {
+		ev.events = EPOLLIN;
+		ev.data.ptr = NOTIFY_TAG;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, notify_fd, &ev) == -1)
+			condlog(3, "failed to poll for configuration notifications: %m");
+	}
+	feed_fd = feed_init();
+	if (feed_fd != -1) {
+		ev.events = EPOLLIN;
+		ev.data.ptr = FEED_TAG;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, feed_fd, &ev) == -1) {
+			condlog(1, "failed to poll for feed events: %m");
+			feed_exit();
+			feed_fd = -1;
+		}
+	}
+	start_cli_workers();
 	sigfillset(&mask);
 	sigdelset(&mask, SIGINT);
 	sigdelset(&mask, SIGTERM);
 	sigdelset(&mask, SIGHUP);
 	sigdelset(&mask, SIGUSR1);
 	while (1) {
-		struct client *c, *tmp;
-		int i, n_pfds, poll_count, num_clients;
+		bool new_conn = false, inotify_ev = false, feed_ev = false;
+		bool dm_ev = false, configuring;
+		int i, n_events, n, n_waiters, timeout = -1;
 
-		/* setup for a poll */
 		pthread_mutex_lock(&client_lock);
-		pthread_cleanup_push(cleanup_mutex, &client_lock);
-		num_clients = 0;
-		list_for_each_entry(c, &clients, node) {
-			num_clients++;
-		}
-		if (num_clients + POLLFDS_BASE > max_pfds) {
-			struct pollfd *new;
-			int n_new = max_pfds + POLLFD_CHUNK;
-
-			new = REALLOC(polls, n_new * sizeof(*polls));
-			if (new) {
-				max_pfds = n_new;
-				polls = new;
-			} else {
-				condlog(1, "%s: realloc failure, %d clients not served",
-					__func__,
-					num_clients + POLLFDS_BASE - max_pfds);
-				num_clients = max_pfds - POLLFDS_BASE;
-			}
-		}
-		if (num_clients < MAX_CLIENTS) {
-			polls[0].fd = ux_sock;
-			polls[0].events = POLLIN;
-		} else {
-			/*
-			 * New clients can't connect, num_clients won't grow
-			 * to MAX_CLIENTS or higher
-			 */
+		n = num_clients;
+		n_waiters = n_reconfigure_waiters;
+		pthread_mutex_unlock(&client_lock);
+		/*
+		 * New clients can't connect while we're paused,
+		 * num_clients won't grow to MAX_CLIENTS or higher
+		 */
+		if (n >= MAX_CLIENTS && listening)
 			condlog(1, "%s: max client connections reached, pausing polling",
 				__func__);
-			polls[0].fd = -1;
-		}
+		set_listening(ux_sock, &listening, n < MAX_CLIENTS);
 
+		/* Inactive watches don't generate events */
 		reset_watch(notify_fd, &wds, &sequence_nr);
-		if (notify_fd == -1 || (wds.conf_wd == -1 && wds.dir_wd == -1))
-			polls[1].fd = -1;
-		else
-			polls[1].fd = notify_fd;
-		polls[1].events = POLLIN;
-
-		/* setup the clients */
-		i = POLLFDS_BASE;
-		list_for_each_entry(c, &clients, node) {
-			polls[i].fd = c->fd;
-			polls[i].events = POLLIN;
-			i++;
-			if (i >= max_pfds)
-				break;
-		}
-		n_pfds = i;
-		pthread_cleanup_pop(1);
 
+		/* dm events are paused after errors */
+		if (dmevent_resume.tv_sec)
+			timeout = 1000;
+		/* Nothing tells us when configure is done */
+		if (!list_empty(&held_jobs) || n_waiters)
+			timeout = 100;
 		/* most of our life is spent in this call */
-		poll_count = ppoll(polls, n_pfds, NULL, &mask);
+		sample_thread_cpu(THREAD_UXLSNR);
+		n_events = epoll_pwait(epoll_fd, events, MAX_EVENTS, timeout,
+				       &mask);
 
 		handle_signals(false);
-		if (poll_count == -1) {
+		if (n_events == -1) {
 			if (errno == EINTR) {
 				handle_signals(true);
 				continue;
@@ -386,87 +1087,52 @@ void * uxsock_listen(uxsock_trigger_fn uxsock_trigger, long ux_sock,
 			break;
 		}
 
-		if (poll_count == 0) {
-			handle_signals(true);
-			continue;
-		}
-
 		/*
-		 * Client connection. We shouldn't answer while we're
-		 * configuring - nothing may be configured yet.
-		 * But we can't wait forever either, because this thread
-		 * must handle signals. So wait a short while only.
+		 * While we're configuring, nothing may be configured yet.
+		 * Clients are still served, but commands that would
+		 * change the configuration are held back, see handle_client().
 		 */
-		if (wait_for_state_change_if(DAEMON_CONFIGURE, 10)
-		    == DAEMON_CONFIGURE) {
-			handle_signals(false);
-			continue;
-		}
+		configuring = wait_for_state_change_if(DAEMON_CONFIGURE, 0)
+			== DAEMON_CONFIGURE;
+		if (!configuring)
+			release_held_jobs();
+		if (n_waiters)
+			release_reconfigure_waiters();
 
 		/* see if a client wants to speak to us */
-		for (i = POLLFDS_BASE; i < n_pfds; i++) {
-			if (polls[i].revents & POLLIN) {
-				struct timespec start_time;
-
-				c = NULL;
-				pthread_mutex_lock(&client_lock);
-				list_for_each_entry(tmp, &clients, node) {
-					if (tmp->fd == polls[i].fd) {
-						c = tmp;
-						break;
-					}
-				}
-				pthread_mutex_unlock(&client_lock);
-				if (!c) {
-					condlog(4, "cli%d: new fd %d",
-						i, polls[i].fd);
-					continue;
-				}
-				get_monotonic_time(&start_time);
-				if (recv_packet_from_client(c->fd, &inbuf,
-							    uxsock_timeout)
-				    != 0) {
-					dead_client(c);
-					continue;
-				}
-				if (!inbuf) {
-					condlog(4, "recv_packet_from_client "
-						"get null request");
-					continue;
-				}
-				condlog(4, "cli[%d]: Got request [%s]",
-					i, inbuf);
-				uxsock_trigger(inbuf, &reply, &rlen,
-					       _socket_client_is_root(c->fd),
-					       trigger_data);
-				if (reply) {
-					if (send_packet(c->fd,
-							reply) != 0) {
-						dead_client(c);
-					} else {
-						condlog(4, "cli[%d]: "
-							"Reply [%d bytes]",
-							i, rlen);
-					}
-					FREE(reply);
-					reply = NULL;
-				}
-				check_timeout(start_time, inbuf,
-					      uxsock_timeout);
-				FREE(inbuf);
-			}
+		for (i = 0; i < n_events; i++) {
+			if (events[i].data.ptr == LISTEN_TAG)
+				new_conn = true;
+			else if (events[i].data.ptr == NOTIFY_TAG)
+				inotify_ev = true;
+			else if (events[i].data.ptr == FEED_TAG)
+				feed_ev = true;
+			else if (events[i].data.ptr == DMEVENT_TAG)
+				dm_ev = true;
+			else if (events[i].events & EPOLLOUT)
+				handle_client_output(events[i].data.ptr);
+			else
+				/* EPOLLHUP and EPOLLERR make recv fail */
+				handle_client(events[i].data.ptr, trigger_data,
+					      configuring);
 		}
 		/* see if we got a non-fatal signal */
 		handle_signals(true);
 
 		/* see if we got a new client */
-		if (polls[0].revents & POLLIN) {
+		if (new_conn)
 			new_client(ux_sock);
-		}
 
 		/* handle inotify events on config files */
-		if (polls[1].revents & POLLIN)
+		if (inotify_ev)
 			handle_inotify(notify_fd, &wds);
+
+		/* forward topology changes to subscribers */
+		if (feed_ev)
+			handle_feed();
+
+		if (dm_ev || dmevent_resume.tv_sec)
+			handle_dmevents(&dmevent_resume);
 	}
 
 	return NULL;
@@ -8,5 +8,10 @@ typedef int (uxsock_trigger_fn)(char *, char **, int *, bool, void *);
 void uxsock_cleanup(void *arg);
 void *uxsock_listen(uxsock_trigger_fn uxsock_trigger, long ux_sock,
 		    void * trigger_data);
+/*
+ * Handle dm events in the listener loop, see dmevent_fd(). Must be
+ * called after the listener has started. Returns 0 on success.
+ */
+int uxsock_watch_dmevents(int fd);
 
 #endif
@@ -7,6 +7,8 @@
 #include "alias.h"
 #include "test-log.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "globals.c"
 #include "../libmultipath/alias.c"
@@ -1147,6 +1149,308 @@ static int test_allocate_binding(void)
 	return cmocka_run_group_tests(tests, NULL, NULL);
 }
 
+/*
+ * The bindings cache tests use a real bindings file, because the cache
+ * is loaded with getline(), and checked with fstat().
+ */
+struct bc_state {
+	char file[32];
+};
+
+static int bc_setup(void **state)
+{
+	struct bc_state *st = calloc(1, sizeof(*st));
+	int fd;
+
+	if (!st)
+		return -1;
+	strlcpy(st->file, "/tmp/alias-test-XXXXXX", sizeof(st->file));
+	fd = mkstemp(st->file);
+	if (fd < 0) {
+		free(st);
+		return -1;
+	}
+	close(fd);
+	*state = st;
+	return 0;
+}
+
+static int bc_teardown(void **state)
+{
+	struct bc_state *st = *state;
+
+	cleanup_bindings();
+	unlink(st->file);
+	free(st);
+	return 0;
+}
+
+/* Write the bindings file, and set its mtime if sec is non-zero */
+static void bc_write(const char *file, const char *content, time_t sec)
+{
+	FILE *f = fopen(file, "w");
+
+	assert_non_null(f);
+	assert_int_not_equal(fputs(content, f), EOF);
+	assert_int_equal(fclose(f), 0);
+	if (sec) {
+		struct timespec ts[2] = { { sec, 0 }, { sec, 0 } };
+
+		assert_int_equal(utimensat(AT_FDCWD, file, ts, 0), 0);
+	}
+}
+
+/*
+ * Update the cache from the file, like use_existing_alias() does.
+ * Returns true if the cache was kept. That's told by the id scan state,
+ * which a free id lookup sets, and a reload clears.
+ */
+static bool bc_update(const char *file)
+{
+	bool had_ids = bindings_cache.have_ids;
+	int fd = open(file, O_RDONLY);
+	FILE *f;
+	int rc;
+
+	assert_true(fd >= 0);
+	f = fdopen(fd, "r");
+	assert_non_null(f);
+	pthread_mutex_lock(&bindings_cache_lock);
+	rc = update_bindings_cache(file, fd, f);
+	pthread_mutex_unlock(&bindings_cache_lock);
+	fclose(f);
+	assert_int_equal(rc, 0);
+	return had_ids && bindings_cache.have_ids;
+}
+
+static void bc_expect_alias(const char *wwid, const char *alias)
+{
+	char *found;
+	char msg[128];
+
+	snprintf(msg, sizeof(msg), "Found matching wwid [%s] in bindings file."
+		 " Setting alias to %s\n", wwid, alias);
+	expect_condlog(3, msg);
+	assert_int_equal(lookup_cached_binding(wwid, &found, "MPATH", 0), 0);
+	assert_string_equal(found, alias);
+	free(found);
+}
+
+static void bc_expect_free_id(const char *wwid, const char *prefix, int id)
+{
+	char *found;
+	char msg[128];
+
+	snprintf(msg, sizeof(msg), "No matching wwid [%s] in bindings file.\n",
+		 wwid);
+	expect_condlog(3, msg);
+	assert_int_equal(lookup_cached_binding(wwid, &found, prefix, 0), id);
+	assert_ptr_equal(found, NULL);
+}
+
+static void bc_hit(void **state)
+{
+	struct bc_state *st = *state;
+	char buf[WWID_SIZE];
+
+	bc_write(st->file, "MPATHc WWID1\nMPATHa WWID0\n", 0);
+	bc_update(st->file);
+	assert_int_equal(VECTOR_SIZE(&bindings_cache.lines), 2);
+	bc_expect_alias("WWID0", "MPATHa");
+	bc_expect_alias("WWID1", "MPATHc");
+	bc_expect_free_id("WWID2", "MPATH", 2);
+
+	/* unchanged file, the cache is kept */
+	assert_true(bc_update(st->file));
+	bc_expect_alias("WWID1", "MPATHc");
+
+	expect_condlog(3, "Found matching alias [MPATHa] in bindings file."
+		       " Setting wwid to WWID0\n");
+	assert_int_equal(rlookup_cached_binding(buf, "MPATHa"), 0);
+	assert_string_equal(buf, "WWID0");
+	expect_condlog(3, "No matching alias [MPATHb] in bindings file.\n");
+	assert_int_equal(rlookup_cached_binding(buf, "MPATHb"), -1);
+	assert_string_equal(buf, "");
+}
+
+/* Like the file lookups, the first line for a wwid or alias wins */
+static void bc_hit_first(void **state)
+{
+	struct bc_state *st = *state;
+	char buf[WWID_SIZE];
+
+	bc_write(st->file, "MPATHb WWID0\nMPATHa WWID0\nMPATHb WWID1\n", 0);
+	bc_update(st->file);
+	bc_expect_alias("WWID0", "MPATHb");
+	expect_condlog(3, "Found matching alias [MPATHb] in bindings file."
+		       " Setting wwid to WWID0\n");
+	assert_int_equal(rlookup_cached_binding(buf, "MPATHb"), 0);
+	assert_string_equal(buf, "WWID0");
+}
+
+static void bc_invalidate_size(void **state)
+{
+	struct bc_state *st = *state;
+
+	bc_write(st->file, "MPATHa WWID0\n", 1000);
+	bc_update(st->file);
+	bc_expect_free_id("WWID1", "MPATH", 2);
+
+	/* another process added a binding */
+	bc_write(st->file, "MPATHa WWID0\nMPATHb WWID1\n", 1000);
+	assert_false(bc_update(st->file));
+	assert_int_equal(VECTOR_SIZE(&bindings_cache.lines), 2);
+	bc_expect_alias("WWID1", "MPATHb");
+	bc_expect_free_id("WWID2", "MPATH", 3);
+}
+
+static void bc_invalidate_mtime(void **state)
+{
+	struct bc_state *st = *state;
+
+	bc_write(st->file, "MPATHa WWID0\n", 1000);
+	bc_update(st->file);
+	bc_expect_alias("WWID0", "MPATHa");
+	bc_expect_free_id("WWID1", "MPATH", 2);
+
+	/* same size, only the modification time tells */
+	bc_write(st->file, "MPATHb WWID0\n", 2000);
+	assert_false(bc_update(st->file));
+	bc_expect_alias("WWID0", "MPATHb");
+}
+
+static void bc_invalidate_inode(void **state)
+{
+	struct bc_state *st = *state;
+	char tmp[sizeof(st->file) + 4];
+
+	bc_write(st->file, "MPATHa WWID0\n", 1000);
+	bc_update(st->file);
+	bc_expect_alias("WWID0", "MPATHa");
+	bc_expect_free_id("WWID1", "MPATH", 2);
+
+	/* replaced by a file with the same size and mtime */
+	snprintf(tmp, sizeof(tmp), "%s.new", st->file);
+	bc_write(tmp, "MPATHc WWID0\n", 1000);
+	assert_int_equal(rename(tmp, st->file), 0);
+	assert_false(bc_update(st->file));
+	bc_expect_alias("WWID0", "MPATHc");
+}
+
+static void bc_prefix_change(void **state)
+{
+	struct bc_state *st = *state;
+
+	bc_write(st->file,
+		 "MPATHa WWID0\nFOOa WWID1\nMPATHb WWID2\nFOOc WWID3\n", 0);
+	bc_update(st->file);
+	bc_expect_free_id("WWID9", "MPATH", 3);
+	assert_string_equal(bindings_cache.prefix, "MPATH");
+
+	/* the ids are rescanned for the new prefix */
+	bc_expect_free_id("WWID9", "FOO", 2);
+	assert_string_equal(bindings_cache.prefix, "FOO");
+	bc_expect_free_id("WWID9", "MPATH", 3);
+
+	/* no alias matches a NULL prefix, the cached ids are kept */
+	bc_expect_free_id("WWID9", NULL, 1);
+	assert_true(bindings_cache.have_ids);
+	assert_string_equal(bindings_cache.prefix, "MPATH");
+}
+
+/* The ids that lookup_binding() finds in file order, from the cache */
+static void bc_free_id(void **state)
+{
+	struct bc_state *st = *state;
+
+	/* gaps are only used below the first bigger id, in file order */
+	bc_write(st->file, "MPATHa WWID0\nMPATHd WWID1\n", 1000);
+	bc_update(st->file);
+	bc_expect_free_id("WWID2", "MPATH", 2);
+
+	bc_write(st->file, "MPATHc WWID1\nMPATHa WWID0\nMPATHd WWID0\n",
+		 2000);
+	bc_update(st->file);
+	bc_expect_free_id("WWID2", "MPATH", 2);
+
+	/* same size as before */
+	bc_write(st->file, "MPATHa WWID0\nMPATHb WWID1\nMPATHc WWID2\n",
+		 3000);
+	bc_update(st->file);
+	bc_expect_free_id("WWID3", "MPATH", 4);
+}
+
+static void bc_free_id_check_taken(void **state)
+{
+	struct bc_state *st = *state;
+	char *alias;
+
+	bc_write(st->file, "MPATHa WWID0\nMPATHd WWID1\n", 0);
+	bc_update(st->file);
+	mock_used_alias("MPATHb", USED_STR("MPATHb", "WWID2"));
+	mock_unused_alias("MPATHc");
+	expect_condlog(3, "No matching wwid [WWID2] in bindings file.\n");
+	assert_int_equal(lookup_cached_binding("WWID2", &alias, "MPATH", 1), 3);
+	assert_ptr_equal(alias, NULL);
+
+	/* MPATHc is taken, too, continue after the biggest id */
+	mock_used_alias("MPATHb", USED_STR("MPATHb", "WWID2"));
+	mock_used_alias("MPATHc", USED_STR("MPATHc", "WWID2"));
+	mock_unused_alias("MPATHe");
+	expect_condlog(3, "No matching wwid [WWID2] in bindings file.\n");
+	assert_int_equal(lookup_cached_binding("WWID2", &alias, "MPATH", 1), 5);
+	assert_ptr_equal(alias, NULL);
+}
+
+/* A binding added by this process updates the cached ids */
+static void bc_new_binding(void **state)
+{
+	struct bc_state *st = *state;
+	int fd;
+
+	bc_write(st->file, "MPATHa WWID0\n", 1000);
+	bc_update(st->file);
+	bc_expect_free_id("WWID1", "MPATH", 2);
+
+	bc_write(st->file, "MPATHa WWID0\nMPATHb WWID1\n", 0);
+	fd = open(st->file, O_RDONLY);
+	assert_true(fd >= 0);
+	pthread_mutex_lock(&bindings_cache_lock);
+	cache_new_binding(fd, "MPATHb", "WWID1");
+	pthread_mutex_unlock(&bindings_cache_lock);
+	close(fd);
+
+	/* the cache matches the file now, and isn't reloaded */
+	assert_true(bc_update(st->file));
+	bc_expect_alias("WWID1", "MPATHb");
+	bc_expect_free_id("WWID2", "MPATH", 3);
+}
+
+static int test_bindings_cache(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(bc_hit, bc_setup, bc_teardown),
+		cmocka_unit_test_setup_teardown(bc_hit_first,
+						bc_setup, bc_teardown),
+		cmocka_unit_test_setup_teardown(bc_invalidate_size,
+						bc_setup, bc_teardown),
+		cmocka_unit_test_setup_teardown(bc_invalidate_mtime,
+						bc_setup, bc_teardown),
+		cmocka_unit_test_setup_teardown(bc_invalidate_inode,
+						bc_setup, bc_teardown),
+		cmocka_unit_test_setup_teardown(bc_prefix_change,
+						bc_setup, bc_teardown),
+		cmocka_unit_test_setup_teardown(bc_free_id,
+						bc_setup, bc_teardown),
+		cmocka_unit_test_setup_teardown(bc_free_id_check_taken,
+						bc_setup, bc_teardown),
+		cmocka_unit_test_setup_teardown(bc_new_binding,
+						bc_setup, bc_teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
 int main(void)
 {
 	int ret = 0;
@@ -1157,6 +1461,7 @@ int main(void)
 	ret += test_lookup_binding();
 	ret += test_rlookup_binding();
 	ret += test_allocate_binding();
+	ret += test_bindings_cache();
 
 	return ret;
 }
@@ -0,0 +1,108 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include "structs.h"
+#include "config.h"
+#include "bench-lib.h"
+
+/* Every benchmark is repeated until it has run at least this long */
+#define MIN_RUNTIME_NS (200ULL * 1000 * 1000)
+#define MAX_REPS 1000
+
+static unsigned long nr_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size)
+{
+	nr_allocs++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	nr_allocs++;
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	nr_allocs++;
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+	nr_allocs++;
+	return __real_strdup(s);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void timer_start(struct bench_timer *t)
+{
+	t->allocs_start = nr_allocs;
+	t->start = now_ns();
+}
+
+void timer_stop(struct bench_timer *t)
+{
+	t->total += now_ns() - t->start;
+	t->allocs += nr_allocs - t->allocs_start;
+	t->reps++;
+}
+
+bool timer_done(const struct bench_timer *t)
+{
+	return t->reps >= MAX_REPS ||
+		(t->reps > 0 && t->total >= MIN_RUNTIME_NS);
+}
+
+void bench_header(void)
+{
+	printf("benchmark\tscale\tops\ttotal_ns\tns_per_op\tallocs_per_op\n");
+}
+
+void bench_report(const char *name, int scale, unsigned long long ops,
+		  const struct bench_timer *t)
+{
+	printf("%s\t%d\t%llu\t%llu\t%.1f\t%.2f\n", name, scale, ops, t->total,
+	       ops ? (double)t->total / ops : 0.0,
+	       ops ? (double)t->allocs / ops : 0.0);
+	fflush(stdout);
+}
+
+struct config *bench_load_config(const char *defaults)
+{
+	char tmpdir[] = "/tmp/bench-XXXXXX";
+	char conf_file[PATH_MAX];
+	struct config *conf = NULL;
+	FILE *f;
+
+	if (!mkdtemp(tmpdir))
+		return NULL;
+	snprintf(conf_file, sizeof(conf_file), "%s/multipath.conf", tmpdir);
+	f = fopen(conf_file, "w");
+	if (f) {
+		fprintf(f, "defaults {\n\tconfig_dir \"%s\"\n%s}\n",
+			tmpdir, defaults);
+		fclose(f);
+		conf = load_config(conf_file);
+		unlink(conf_file);
+	}
+	rmdir(tmpdir);
+	return conf;
+}
@@ -0,0 +1,39 @@
+#ifndef _BENCH_LIB_H
+#define _BENCH_LIB_H
+
+#include <stdbool.h>
+
+/*
+ * Helpers for the benchmark programs.
+ *
+ * Allocations are counted by wrapping malloc() and friends, which works
+ * only for code linked into the benchmark program (see XYZ-test_OBJDEPS
+ * in the Makefile), not for calls made inside libmultipath.so.
+ */
+struct bench_timer {
+	unsigned long long start;
+	unsigned long long total;
+	unsigned long allocs_start;
+	unsigned long allocs;
+	unsigned int reps;
+};
+
+void timer_start(struct bench_timer *t);
+void timer_stop(struct bench_timer *t);
+/* true if enough repetitions of the benchmark have been timed */
+bool timer_done(const struct bench_timer *t);
+
+/* Print the header for bench_report() */
+void bench_header(void);
+/* Print the result of ops operations timed with t, as one line of TSV */
+void bench_report(const char *name, int scale, unsigned long long ops,
+		  const struct bench_timer *t);
+
+/*
+ * Write a configuration file with the given defaults section content to
+ * a temporary directory, and load it. The config_dir is set to the
+ * temporary directory, so that the system configuration isn't used.
+ */
+struct config *bench_load_config(const char *defaults);
+
+#endif
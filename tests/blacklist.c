@@ -388,9 +388,11 @@ static void test_property_missing(void **state)
 
 struct udev_device test_udev = { "sdb", { "ID_FOO", "ID_WWN", "ID_BAR", NULL } };
 
+struct path_ident foo_bar_ident = { .vendor_id = "foo", .product_id = "bar" };
+
 struct path test_pp = { .dev = "sdb", .bus = SYSFS_BUS_SCSI, .udev = &test_udev,
-			.sg_id.proto_id = SCSI_PROTOCOL_FCP, .vendor_id = "foo",
-			.product_id = "bar", .wwid = "xyzzy" };
+			.sg_id.proto_id = SCSI_PROTOCOL_FCP,
+			.ident = &foo_bar_ident, .wwid = "xyzzy" };
 
 static void test_filter_path_property(void **state)
 {
@@ -441,25 +443,27 @@ static void test_filter_path_wwid(void **state)
 
 struct udev_device miss_udev = { "sdb", { "ID_FOO", "ID_BAZ", "ID_BAR", "ID_SERIAL", NULL } };
 
+struct path_ident foo_baz_ident = { .vendor_id = "foo", .product_id = "baz" };
+
 struct path miss1_pp = { .dev = "sdc", .bus = SYSFS_BUS_SCSI,
 			.udev = &miss_udev,
 			 .uid_attribute = "ID_SERIAL",
 			.sg_id.proto_id = SCSI_PROTOCOL_ISCSI,
-			.vendor_id = "foo", .product_id = "baz",
+			.ident = &foo_baz_ident,
 			.wwid = "plugh" };
 
 struct path miss2_pp = { .dev = "sdc", .bus = SYSFS_BUS_SCSI,
 			.udev = &test_udev,
 			 .uid_attribute = "ID_SERIAL",
 			.sg_id.proto_id = SCSI_PROTOCOL_ISCSI,
-			.vendor_id = "foo", .product_id = "baz",
+			.ident = &foo_baz_ident,
 			.wwid = "plugh" };
 
 struct path miss3_pp = { .dev = "sdc", .bus = SYSFS_BUS_SCSI,
 			.udev = &miss_udev,
 			 .uid_attribute = "ID_EGGS",
 			.sg_id.proto_id = SCSI_PROTOCOL_ISCSI,
-			.vendor_id = "foo", .product_id = "baz",
+			.ident = &foo_baz_ident,
 			.wwid = "plugh" };
 
 static void test_filter_path_missing1(void **state)
@@ -0,0 +1,541 @@
+/*
+ * Checker loop simulator.
+ *
+ * This program models N paths to M targets in virtual time, and runs them
+ * through the path check scheduling of multipathd: the timer wheel of
+ * check_sched.c, the per-array rate limit of check_limit.c, and the check
+ * intervals and adaptive polling of check_policy.c. The checks themselves
+ * are modeled. Every target has a check latency, and the events of a
+ * scenario make a target fail (checks fail right away), hang (checks time
+ * out after checker_timeout), slow down, or recover.
+ *
+ * Checks are run either like the sync checkers, by checker_threads
+ * threads which the loop waits for, or like the async engine, where the
+ * check completes in the background and the path stays pending until
+ * the checker loop collects the result.
+ *
+ * Usage: checksim-test [N [M]]    (default: 1000 paths, 8 targets)
+ *
+ * Results are written to stdout as tab-separated values with a header
+ * line, one line per scenario and configuration: path checks per second,
+ * the mean and maximum time from a target failure until its paths are
+ * failed and from its recovery until they are up again, the mean and
+ * maximum time the checker loop holds vecs->lock per pass, the longest
+ * pass, and the peak number of checker threads. The simulation is
+ * deterministic, so the results only change with the code under test.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <cmocka.h>
+#include "structs.h"
+#include "config.h"
+#include "check_sched.h"
+#include "check_limit.h"
+#include "debug.h"
+#include "util.h"
+
+/* I have to do this to get at the static functions */
+#include "../multipathd/check_policy.c"
+
+#define SIM_US_PER_SEC 1000000ULL
+#define SIM_DURATION 3600
+#define CHECKINT 5
+#define MAX_CHECKINT 20
+#define CHECKER_TIMEOUT 30
+#define MAX_CHECK_RATE 0
+/* checks per second per target, for the rate limited configurations */
+#define ARRAY_CHECK_RATE 20
+/* Latency of a check through a healthy target, and of a failing check */
+#define BASE_LATENCY_US 1000
+#define FAIL_LATENCY_US 200
+/* Work of the checker loop per path check, apart from the I/O */
+#define CHECK_COST_US 20
+/* The async engine waits this long for a result before going pending */
+#define ASYNC_WAIT_US 1000
+/* Worker thread limits of the async engine, as in async_check.c */
+#define ASYNC_MIN_WORKERS 4
+#define ASYNC_MAX_WORKERS 128
+
+static struct config *_conf;
+/* The virtual clock, in us */
+static unsigned long long sim_now;
+
+struct config *get_multipath_config(void)
+{
+	return _conf;
+}
+
+void put_multipath_config(void *arg)
+{}
+
+/* check_sched.c and check_limit.c see the virtual clock */
+void __wrap_get_monotonic_time(struct timespec *res)
+{
+	res->tv_sec = sim_now / SIM_US_PER_SEC;
+	res->tv_nsec = (sim_now % SIM_US_PER_SEC) * 1000;
+}
+
+enum target_state {
+	TARGET_UP,
+	TARGET_DOWN,
+	TARGET_HUNG,
+};
+
+struct sim_target {
+	enum target_state state;
+	unsigned long long latency_us;
+	struct multipath *mpp;
+};
+
+struct sim_path {
+	struct path *pp;
+	int target;
+	/* completion time of the outstanding async check, 0 if none */
+	unsigned long long done_at;
+	int result;
+	/* time of the target event the path state hasn't followed yet */
+	unsigned long long event_at;
+	bool event_down;
+};
+
+struct sim_event {
+	unsigned int time;
+	/* -1 for the first half of the targets */
+	int target;
+	enum target_state state;
+	unsigned long long latency_us;
+};
+
+struct scenario {
+	const char *name;
+	const struct sim_event *events;
+	int nr_events;
+};
+
+struct sim_config {
+	const char *name;
+	bool async;
+	int threads;
+	int adaptive;
+	int array_check_rate;
+};
+
+struct latency_stat {
+	unsigned long n;
+	unsigned long long sum;
+	unsigned long long max;
+};
+
+struct sim_stats {
+	unsigned long checks;
+	struct latency_stat detect;
+	struct latency_stat recover;
+	struct latency_stat lock;
+	unsigned long long max_pass;
+	int max_threads;
+};
+
+struct sim {
+	int nr_paths;
+	int nr_targets;
+	const struct sim_config *cfg;
+	vector pathvec;
+	struct sim_path *paths;
+	struct sim_target *targets;
+	int outstanding;
+	struct sim_stats st;
+};
+
+static const struct sim_event fabric_down[] = {
+	{ 600, -1, TARGET_DOWN, 0 },
+	{ 1800, -1, TARGET_UP, BASE_LATENCY_US },
+};
+
+static const struct sim_event target_hang[] = {
+	{ 600, 0, TARGET_HUNG, 0 },
+	{ 1800, 0, TARGET_UP, BASE_LATENCY_US },
+};
+
+static const struct sim_event slow_target[] = {
+	{ 600, 0, TARGET_UP, 2 * SIM_US_PER_SEC },
+	{ 1800, 0, TARGET_UP, BASE_LATENCY_US },
+};
+
+static const struct scenario scenarios[] = {
+	{ "steady", NULL, 0 },
+	{ "fabric_down", fabric_down, ARRAY_SIZE(fabric_down) },
+	{ "target_hang", target_hang, ARRAY_SIZE(target_hang) },
+	{ "slow_target", slow_target, ARRAY_SIZE(slow_target) },
+};
+
+static const struct sim_config configs[] = {
+	{ "sync", false, 1, 0, 0 },
+	{ "sync_threads", false, 4, 0, 0 },
+	{ "sync_adaptive", false, 1, 1, 0 },
+	{ "async", true, 1, 0, 0 },
+	{ "async_adaptive", true, 1, 1, 0 },
+	{ "async_adaptive_limited", true, 1, 1, ARRAY_CHECK_RATE },
+};
+
+static void add_latency(struct latency_stat *l, unsigned long long us)
+{
+	l->n++;
+	l->sum += us;
+	if (us > l->max)
+		l->max = us;
+}
+
+static double mean_ms(const struct latency_stat *l)
+{
+	return l->n ? (double)l->sum / l->n / 1000 : 0.0;
+}
+
+static void free_sim(struct sim *s)
+{
+	struct path *pp;
+	int i;
+
+	if (s->pathvec) {
+		vector_foreach_slot(s->pathvec, pp, i) {
+			pp->mpp = NULL;
+			free_path(pp);
+		}
+		vector_free(s->pathvec);
+	}
+	if (s->targets)
+		for (i = 0; i < s->nr_targets; i++)
+			if (s->targets[i].mpp)
+				free_multipath(s->targets[i].mpp, KEEP_PATHS);
+	free(s->targets);
+	free(s->paths);
+}
+
+static int init_sim(struct sim *s, int nr_paths, int nr_targets,
+		    const struct sim_config *cfg)
+{
+	struct sim_target *tgt;
+	struct path *pp;
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->nr_paths = nr_paths;
+	s->nr_targets = nr_targets;
+	s->cfg = cfg;
+	s->pathvec = vector_alloc();
+	s->paths = calloc(nr_paths, sizeof(*s->paths));
+	s->targets = calloc(nr_targets, sizeof(*s->targets));
+	if (!s->pathvec || !s->paths || !s->targets)
+		goto out;
+
+	/* Every target is an array of its own */
+	for (i = 0; i < nr_targets; i++) {
+		tgt = &s->targets[i];
+		tgt->state = TARGET_UP;
+		tgt->latency_us = BASE_LATENCY_US;
+		tgt->mpp = alloc_multipath();
+		if (!tgt->mpp)
+			goto out;
+		tgt->mpp->array_check_rate = cfg->array_check_rate;
+	}
+
+	init_check_sched();
+	for (i = 0; i < nr_paths; i++) {
+		pp = alloc_path();
+		if (!pp)
+			goto out;
+		if (!vector_alloc_slot(s->pathvec)) {
+			free_path(pp);
+			goto out;
+		}
+		vector_set_slot(s->pathvec, pp);
+		s->paths[i].pp = pp;
+		s->paths[i].target = i % nr_targets;
+		snprintf(pp->dev, sizeof(pp->dev), "sd%d", i);
+		pp->bus = SYSFS_BUS_SCSI;
+		pp->sg_id.host_no = 0;
+		pp->sg_id.scsi_id = s->paths[i].target;
+		/* lets the simulation find the sim_path */
+		pp->sg_id.lun = i;
+		snprintf(pp->ident->tgt_node_name,
+			 sizeof(pp->ident->tgt_node_name), "0x500a0980%08x",
+			 s->paths[i].target);
+		pp->mpp = s->targets[s->paths[i].target].mpp;
+		pp->state = PATH_UP;
+		pp->checkint = CHECKINT;
+		schedule_path_check(pp, 1 + i % CHECKINT);
+	}
+	return 0;
+out:
+	free_sim(s);
+	return -1;
+}
+
+static void apply_event(struct sim *s, const struct sim_event *ev)
+{
+	struct sim_path *sp;
+	int i, first = ev->target, last = ev->target;
+
+	if (ev->target < 0) {
+		first = 0;
+		last = s->nr_targets / 2 - 1;
+	}
+	for (i = first; i <= last && i < s->nr_targets; i++) {
+		s->targets[i].state = ev->state;
+		if (ev->latency_us)
+			s->targets[i].latency_us = ev->latency_us;
+	}
+	/* Only failures and recoveries are detected, not slow downs */
+	for (i = 0; i < s->nr_paths; i++) {
+		bool down = ev->state != TARGET_UP;
+
+		sp = &s->paths[i];
+		if (sp->target < first || sp->target > last)
+			continue;
+		if (down == (sp->pp->state != PATH_UP))
+			sp->event_at = 0;
+		else if (!sp->event_at || sp->event_down != down) {
+			sp->event_at = sim_now;
+			sp->event_down = down;
+		}
+	}
+}
+
+/* The time a check started now takes, and its result */
+static unsigned long long check_io(const struct sim_target *tgt, int *state)
+{
+	switch (tgt->state) {
+	case TARGET_DOWN:
+		*state = PATH_DOWN;
+		return FAIL_LATENCY_US;
+	case TARGET_HUNG:
+		*state = PATH_TIMEOUT;
+		return CHECKER_TIMEOUT * SIM_US_PER_SEC;
+	default:
+		break;
+	}
+	*state = PATH_UP;
+	if (tgt->latency_us > CHECKER_TIMEOUT * SIM_US_PER_SEC) {
+		*state = PATH_TIMEOUT;
+		return CHECKER_TIMEOUT * SIM_US_PER_SEC;
+	}
+	return tgt->latency_us;
+}
+
+/*
+ * Run the check of a path like the async engine would, *offset us into
+ * the current pass. Returns the path state, and advances *offset by the
+ * time the checker loop waits.
+ */
+static int check_async(struct sim *s, struct sim_path *sp,
+		       unsigned long long *offset)
+{
+	unsigned long long lat, when = sim_now + *offset;
+	int state;
+
+	if (!sp->done_at) {
+		lat = check_io(&s->targets[sp->target], &state);
+		s->st.checks++;
+		if (lat <= ASYNC_WAIT_US) {
+			*offset += lat;
+			return state;
+		}
+		*offset += ASYNC_WAIT_US;
+		sp->done_at = when + lat;
+		sp->result = state;
+		s->outstanding++;
+		return PATH_PENDING;
+	}
+	if (sp->done_at > when)
+		return PATH_PENDING;
+	sp->done_at = 0;
+	s->outstanding--;
+	return sp->result;
+}
+
+/* What check_path() does with the checker result */
+static void update_path(struct sim *s, struct sim_path *sp, int newstate)
+{
+	struct path *pp = sp->pp;
+	int oldstate = pp->state;
+
+	if (newstate == PATH_PENDING) {
+		set_path_tick(pp, 1);
+		return;
+	}
+	if (newstate == PATH_TIMEOUT)
+		newstate = PATH_DOWN;
+	if (newstate != oldstate) {
+		pp->state = newstate;
+		pp->checkint = CHECKINT;
+		add_instability(pp, INSTABILITY_STATE_CHANGE);
+		if (newstate != PATH_UP && oldstate == PATH_UP &&
+		    s->cfg->adaptive)
+			recheck_target_paths(s->pathvec, pp, CHECKINT);
+		if (sp->event_at && sp->event_down == (newstate != PATH_UP)) {
+			add_latency(sp->event_down ? &s->st.detect :
+				    &s->st.recover, sim_now - sp->event_at);
+			sp->event_at = 0;
+		}
+		set_path_tick(pp, pp->checkint);
+	} else if (newstate == PATH_UP) {
+		pp->checkint = next_checkint(pp, CHECKINT, MAX_CHECKINT,
+					     s->cfg->adaptive, MAX_CHECK_RATE);
+		set_path_tick(pp, pp->checkint);
+	} else
+		set_path_tick(pp, CHECKINT);
+}
+
+/*
+ * One pass of the checker loop. The checks of a pass run under
+ * vecs->lock. Sync checks are spread over the checker threads, and the
+ * pass takes as long as the busiest thread. Returns the pass duration.
+ */
+static unsigned long long sim_pass(struct sim *s, unsigned int ticks,
+				   vector due)
+{
+	unsigned long long lanes[8] = { 0 }, pass = 0;
+	struct sim_path *sp;
+	struct path *pp;
+	int i, j, lane, state, n = 0, threads;
+
+	get_due_paths(ticks, due);
+	limit_due_paths(due);
+	threads = s->cfg->threads;
+	if (threads > (int)ARRAY_SIZE(lanes))
+		threads = ARRAY_SIZE(lanes);
+	for (i = 0; i < VECTOR_SIZE(due); i++) {
+		pp = VECTOR_SLOT(due, i);
+		if (!pp)
+			continue;
+		sp = &s->paths[pp->sg_id.lun];
+		lane = 0;
+		for (j = 1; j < threads; j++)
+			if (lanes[j] < lanes[lane])
+				lane = j;
+		lanes[lane] += CHECK_COST_US;
+		if (s->cfg->async)
+			state = check_async(s, sp, &lanes[lane]);
+		else {
+			lanes[lane] += check_io(&s->targets[sp->target],
+						&state);
+			s->st.checks++;
+		}
+		update_path(s, sp, state);
+		n++;
+	}
+	end_due_paths();
+	vector_reset(due);
+	update_check_rate(n, ticks);
+	for (j = 0; j < threads; j++)
+		if (lanes[j] > pass)
+			pass = lanes[j];
+	add_latency(&s->st.lock, pass);
+	if (pass > s->st.max_pass)
+		s->st.max_pass = pass;
+	if (s->cfg->async) {
+		threads = s->outstanding;
+		if (threads < ASYNC_MIN_WORKERS)
+			threads = ASYNC_MIN_WORKERS;
+		if (threads > ASYNC_MAX_WORKERS)
+			threads = ASYNC_MAX_WORKERS;
+		/* the checker loop itself */
+		threads++;
+	}
+	if (threads > s->st.max_threads)
+		s->st.max_threads = threads;
+	return pass;
+}
+
+static int run_sim(const struct scenario *sc, const struct sim_config *cfg,
+		   int nr_paths, int nr_targets)
+{
+	struct _vector _due = { .allocated = 0, .slot = NULL };
+	unsigned long long base, start, last = 0, end;
+	unsigned int ticks;
+	struct sim s;
+	int ev = 0;
+
+	/*
+	 * The clock keeps running between simulations, because the token
+	 * buckets of check_limit.c can't be reset.
+	 */
+	base = (sim_now / SIM_US_PER_SEC + 1) * SIM_US_PER_SEC;
+	end = base + SIM_DURATION * SIM_US_PER_SEC;
+	sim_now = base;
+	check_rate = 0;
+	if (init_sim(&s, nr_paths, nr_targets, cfg) != 0)
+		return -1;
+	while (sim_now < end) {
+		start = sim_now;
+		while (ev < sc->nr_events &&
+		       base + sc->events[ev].time * SIM_US_PER_SEC <= start)
+			apply_event(&s, &sc->events[ev++]);
+		/* Like checkerloop(), count ticks in full seconds */
+		ticks = last ? (start - last) / SIM_US_PER_SEC : 1;
+		last = start;
+		sim_now = start + sim_pass(&s, ticks ? ticks : 1, &_due);
+		/* The checker loop sleeps until the next second */
+		if (sim_now < start + SIM_US_PER_SEC)
+			sim_now = start + SIM_US_PER_SEC;
+		else
+			sim_now = (sim_now / SIM_US_PER_SEC + 1) *
+				SIM_US_PER_SEC;
+	}
+	vector_reset(&_due);
+
+	printf("%s\t%s\t%d\t%d\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.3f\t%.3f\t%.3f\t%d\n",
+	       sc->name, cfg->name, nr_paths, nr_targets,
+	       (double)s.st.checks / SIM_DURATION,
+	       mean_ms(&s.st.detect), (double)s.st.detect.max / 1000,
+	       mean_ms(&s.st.recover), (double)s.st.recover.max / 1000,
+	       mean_ms(&s.st.lock), (double)s.st.lock.max / 1000,
+	       (double)s.st.max_pass / 1000, s.st.max_threads);
+	fflush(stdout);
+	free_sim(&s);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int nr_paths = 1000, nr_targets = 8, ret = 0;
+	unsigned int i, j;
+	char *verb = getenv("MPATHTEST_VERBOSITY");
+
+	libmp_verbosity = verb && *verb ? atoi(verb) : 0;
+	if (argc > 1)
+		nr_paths = atoi(argv[1]);
+	if (argc > 2)
+		nr_targets = atoi(argv[2]);
+	if (nr_paths <= 0 || nr_targets <= 0 || nr_targets > nr_paths) {
+		fprintf(stderr, "usage: %s [paths [targets]]\n", argv[0]);
+		return 1;
+	}
+
+	_conf = calloc(1, sizeof(*_conf));
+	if (!_conf)
+		return 1;
+	printf("scenario\tconfig\tpaths\ttargets\tchecks_per_s\tdetect_mean_ms\tdetect_max_ms\trecover_mean_ms\trecover_max_ms\tlock_mean_ms\tlock_max_ms\tpass_max_ms\tthreads\n");
+	for (i = 0; i < ARRAY_SIZE(scenarios); i++)
+		for (j = 0; j < ARRAY_SIZE(configs); j++)
+			if (run_sim(&scenarios[i], &configs[j],
+				    nr_paths, nr_targets) != 0) {
+				fprintf(stderr, "%s/%s failed\n",
+					scenarios[i].name, configs[j].name);
+				ret++;
+			}
+	free(_conf);
+	return ret;
+}
@@ -0,0 +1,88 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <string.h>
+#include <cmocka.h>
+/* this file is only linked with "make ACCOUNTING=1" */
+#ifndef TEST_ACCOUNTING
+#define TEST_ACCOUNTING
+#endif
+#include "count-lib.h"
+
+static const char * const counter_names[__NR_COUNTERS] = {
+	[CNT_ALLOCS] = "allocs",
+	[CNT_ALLOC_BYTES] = "bytes",
+	[CNT_OPEN] = "opens",
+	[CNT_READ] = "reads",
+	[CNT_IOCTL] = "ioctls",
+};
+
+static struct test_counts counts;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size)
+{
+	count_event(CNT_ALLOCS, 1);
+	count_event(CNT_ALLOC_BYTES, size);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	count_event(CNT_ALLOCS, 1);
+	count_event(CNT_ALLOC_BYTES, nmemb * size);
+	return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	count_event(CNT_ALLOCS, 1);
+	count_event(CNT_ALLOC_BYTES, size);
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s)
+{
+	count_event(CNT_ALLOCS, 1);
+	count_event(CNT_ALLOC_BYTES, strlen(s) + 1);
+	return __real_strdup(s);
+}
+
+void count_event(enum test_counter c, unsigned long n)
+{
+	counts.n[c] += n;
+}
+
+void counts_reset(void)
+{
+	memset(&counts, 0, sizeof(counts));
+}
+
+void __assert_within_budget(const struct test_counts *budget,
+			    const char *what, const char *file, int line)
+{
+	bool over = false;
+	int i;
+
+	/* the observed counts, for recording budgets */
+	print_message("[ ACCOUNT  ] %s:", what);
+	for (i = 0; i < __NR_COUNTERS; i++)
+		print_message(" %s %lu", counter_names[i], counts.n[i]);
+	print_message("\n");
+
+	for (i = 0; i < __NR_COUNTERS; i++) {
+		if (counts.n[i] <= budget->n[i])
+			continue;
+		print_error("%s: %lu %s, budget is %lu\n", what, counts.n[i],
+			    counter_names[i], budget->n[i]);
+		over = true;
+	}
+	if (over)
+		_fail(file, line);
+}
@@ -0,0 +1,51 @@
+#ifndef _COUNT_LIB_H
+#define _COUNT_LIB_H
+
+#include <limits.h>
+
+/*
+ * Resource accounting for the unit tests, enabled with
+ * "make ACCOUNTING=1" (run "make clean" when switching).
+ *
+ * Allocations are counted by wrapping malloc() and friends, which
+ * includes MALLOC() and REALLOC() from memory.h. Like in bench-lib.c, this
+ * works only for code linked into the test program (see XYZ-test_OBJDEPS
+ * in the Makefile). Syscalls are counted by the __wrap_ functions of the
+ * tests, calling count_event().
+ *
+ * A test calls counts_reset() before the code under test, and
+ * assert_within_budget() after it. The budget is the maximum of each
+ * counter; counters that aren't set in the budget must stay 0. Without
+ * ACCOUNTING, these are no-ops.
+ */
+enum test_counter {
+	CNT_ALLOCS,
+	CNT_ALLOC_BYTES,
+	CNT_OPEN,
+	/* sysfs attribute reads */
+	CNT_READ,
+	CNT_IOCTL,
+	__NR_COUNTERS,
+};
+
+#define COUNT_UNLIMITED ULONG_MAX
+
+struct test_counts {
+	unsigned long n[__NR_COUNTERS];
+};
+
+#ifdef TEST_ACCOUNTING
+void count_event(enum test_counter c, unsigned long n);
+void counts_reset(void);
+void __assert_within_budget(const struct test_counts *budget,
+			    const char *what, const char *file, int line);
+#define assert_within_budget(budget, what) \
+	__assert_within_budget((budget), (what), __FILE__, __LINE__)
+#else
+#define count_event(c, n) do {} while (0)
+#define counts_reset() do {} while (0)
+#define assert_within_budget(budget, what) \
+	do { (void)(budget); (void)(what); } while (0)
+#endif
+
+#endif
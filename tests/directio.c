@@ -724,6 +724,75 @@ static void test_check_state_async(void **state)
 	do_libcheck_reset(1);
 }
 
+/* test submitting and reaping multiple checkers with one call */
+static void test_check_batch(void **state)
+{
+	int i;
+	struct checker c[3] = {{.cls = NULL}};
+	struct checker *cp[3] = { &c[0], &c[1], &c[2] };
+	struct async_req *reqs[3];
+	int res[3] = {0};
+	int states[3];
+
+	assert_true(list_empty(&aio_grp_list));
+	will_return(__wrap_io_setup, 0);
+	for (i = 0; i < 3; i++) {
+		do_libcheck_init(&c[i], 4096, &reqs[i]);
+		c[i].timeout = 30;
+	}
+	/* one io_submit() and one io_getevents() for all checkers */
+	will_return(__wrap_io_submit, 3);
+	return_io_getevents_nr(NULL, 2, reqs, res);
+	libcheck_check_batch(cp, states, 3);
+	assert_int_equal(ev_off, 0);
+	memset(mock_events, 0, sizeof(mock_events));
+	assert_int_equal(states[0], PATH_UP);
+	assert_int_equal(states[1], PATH_UP);
+	assert_int_equal(states[2], PATH_PENDING);
+	assert_false(is_checker_running(&c[0]));
+	assert_false(is_checker_running(&c[1]));
+	assert_true(is_checker_running(&c[2]));
+	/* nothing is submitted for the pending checker */
+	return_io_getevents_nr(NULL, 1, &reqs[2], &res[2]);
+	libcheck_check_batch(&cp[2], &states[2], 1);
+	assert_int_equal(ev_off, 0);
+	memset(mock_events, 0, sizeof(mock_events));
+	assert_int_equal(states[2], PATH_UP);
+	assert_false(is_checker_running(&c[2]));
+	for (i = 0; i < 3; i++)
+		libcheck_free(&c[i]);
+	do_libcheck_reset(1);
+}
+
+/* test a batch in which not all requests could be submitted */
+static void test_check_batch_partial_submit(void **state)
+{
+	int i;
+	struct checker c[2] = {{.cls = NULL}};
+	struct checker *cp[2] = { &c[0], &c[1] };
+	struct async_req *reqs[2];
+	int res[2] = {0};
+	int states[2];
+
+	assert_true(list_empty(&aio_grp_list));
+	will_return(__wrap_io_setup, 0);
+	for (i = 0; i < 2; i++)
+		do_libcheck_init(&c[i], 4096, &reqs[i]);
+	will_return(__wrap_io_submit, 1);
+	return_io_getevents_nr(NULL, 1, reqs, res);
+	libcheck_check_batch(cp, states, 2);
+	assert_int_equal(ev_off, 0);
+	memset(mock_events, 0, sizeof(mock_events));
+	assert_int_equal(states[0], PATH_UP);
+	assert_int_equal(states[1], PATH_UNCHECKED);
+	assert_int_equal(c[1].msgid, MSG_DIRECTIO_UNKNOWN);
+	assert_false(is_checker_running(&c[0]));
+	assert_false(is_checker_running(&c[1]));
+	for (i = 0; i < 2; i++)
+		libcheck_free(&c[i]);
+	do_libcheck_reset(1);
+}
+
 static int setup(void **state)
 {
 #ifdef DIO_TEST_DEV
@@ -761,6 +830,8 @@ int test_directio(void)
 		cmocka_unit_test(test_check_state_blksize),
 		cmocka_unit_test(test_check_state_async),
 		cmocka_unit_test(test_orphaned_aio_group),
+		cmocka_unit_test(test_check_batch),
+		cmocka_unit_test(test_check_batch_partial_submit),
 	};
 
 	return cmocka_run_group_tests(tests, setup, teardown);
@@ -868,6 +868,42 @@ static void test_dmevent_loop_good3(void **state)
 	assert_ptr_equal(find_dm_device("foo"), NULL);
 }
 
+/* without dmevents polling, the event numbers of all watched devices
+ * are queried. foo has a new event and gets updated, bar doesn't */
+static void test_dmevent_scan_good0(void **state)
+{
+	struct dev_event *dev_evt;
+	struct test_data *datap = (struct test_data *)(*state);
+	if (datap == NULL)
+		skip();
+
+	remove_all_dm_device_events();
+	unwatch_all_dmevents();
+	assert_int_equal(add_dm_device_event("foo", 1, 3), 0);
+	assert_int_equal(add_dm_device_event("bar", 1, 4), 0);
+	will_return(__wrap_dm_geteventnr, 0);
+	assert_int_equal(watch_dmevents("foo"), 0);
+	will_return(__wrap_dm_geteventnr, 0);
+	assert_int_equal(watch_dmevents("bar"), 0);
+	assert_int_equal(add_dm_device_event("foo", 1, 5), 0);
+	set_dmevent_polling(false);
+	will_return(__wrap_dm_geteventnr, 0);
+	will_return(__wrap_dm_geteventnr, 0);
+	expect_string(__wrap_update_multipath, mapname, "foo");
+	will_return(__wrap_update_multipath, 0);
+	assert_int_equal(dmevent_loop(), DMEVENT_SCAN_INTERVAL);
+	set_dmevent_polling(true);
+	assert_int_equal(VECTOR_SIZE(waiter->events), 2);
+	dev_evt = find_dmevents("foo");
+	assert_ptr_not_equal(dev_evt, NULL);
+	assert_int_equal(dev_evt->evt_nr, 5);
+	assert_int_equal(dev_evt->action, EVENT_NOTHING);
+	dev_evt = find_dmevents("bar");
+	assert_ptr_not_equal(dev_evt, NULL);
+	assert_int_equal(dev_evt->evt_nr, 4);
+	assert_int_equal(dev_evt->action, EVENT_NOTHING);
+	unwatch_all_dmevents();
+}
 
 /* verify that rearming the dmevents polling works */
 static void test_arm_poll(void **state)
@@ -914,6 +950,7 @@ int test_dmevents(void)
 		cmocka_unit_test(test_dmevent_loop_good1),
 		cmocka_unit_test(test_dmevent_loop_good2),
 		cmocka_unit_test(test_dmevent_loop_good3),
+		cmocka_unit_test(test_dmevent_scan_good0),
 		cmocka_unit_test(test_cleanup_waiter),
 	};
 	return cmocka_run_group_tests(tests, setup, teardown);
@@ -0,0 +1,96 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+#include "fail_rate.h"
+#include "globals.c"
+
+#define T0 100000
+
+static void test_fail_window_empty(void **state)
+{
+	struct fail_window w;
+
+	memset(&w, 0, sizeof(w));
+	assert_int_equal(fail_window_count(&w, 0, 60), 0);
+	assert_int_equal(fail_window_count(&w, T0, FAIL_WINDOW_SECS), 0);
+	/* early after boot */
+	fail_window_add(&w, 3);
+	assert_int_equal(fail_window_count(&w, 5, 60), 1);
+	assert_int_equal(fail_window_count(&w, 5, 0), 1);
+}
+
+static void test_fail_window_slide(void **state)
+{
+	struct fail_window w;
+
+	memset(&w, 0, sizeof(w));
+	fail_window_add(&w, T0);
+	fail_window_add(&w, T0 + 1);
+	fail_window_add(&w, T0 + 30);
+	assert_int_equal(fail_window_count(&w, T0 + 30, 60), 3);
+	assert_int_equal(fail_window_count(&w, T0 + 30, 10), 1);
+	/* the first bucket is 60s before T0 + 60 */
+	assert_int_equal(fail_window_count(&w, T0 + 60, 60), 1);
+	assert_int_equal(fail_window_count(&w, T0 + 59, 60), 3);
+	assert_int_equal(fail_window_count(&w, T0 + 30 + FAIL_WINDOW_SECS,
+					   FAIL_WINDOW_SECS), 0);
+	assert_int_equal(fail_window_count(&w, T0 + 30,
+					   2 * FAIL_WINDOW_SECS), 3);
+}
+
+static void test_fail_window_wrap(void **state)
+{
+	struct fail_window w;
+	int i;
+
+	memset(&w, 0, sizeof(w));
+	for (i = 0; i < 2 * FAIL_WINDOW_BUCKETS; i++)
+		fail_window_add(&w, T0 + i * FAIL_WINDOW_BUCKET_SECS);
+	assert_int_equal(fail_window_count(&w, T0 + (i - 1) *
+					   FAIL_WINDOW_BUCKET_SECS,
+					   FAIL_WINDOW_SECS),
+			 FAIL_WINDOW_BUCKETS);
+	/* a long gap clears the window */
+	fail_window_add(&w, T0 + 10 * FAIL_WINDOW_SECS);
+	assert_int_equal(fail_window_count(&w, T0 + 10 * FAIL_WINDOW_SECS,
+					   FAIL_WINDOW_SECS), 1);
+}
+
+static void test_fail_window_saturate(void **state)
+{
+	struct fail_window w;
+	int i;
+
+	memset(&w, 0, sizeof(w));
+	for (i = 0; i < 300; i++)
+		fail_window_add(&w, T0);
+	assert_int_equal(fail_window_count(&w, T0, 10), 255);
+}
+
+static int test_fail_rate(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_fail_window_empty),
+		cmocka_unit_test(test_fail_window_slide),
+		cmocka_unit_test(test_fail_window_wrap),
+		cmocka_unit_test(test_fail_window_saturate),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_fail_rate();
+	return ret;
+}
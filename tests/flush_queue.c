@@ -0,0 +1,187 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+#include "globals.c"
+#include "../multipathd/flush_queue.c"
+
+#define WWID "3600a098038303634722b4d59646c4436"
+#define ALIAS "mpatha"
+
+static int reloads;
+
+/* like ev_add_path(), without talking to the kernel */
+int ev_add_path(struct path *pp, struct vectors *vecs, int need_do_map)
+{
+	struct multipath *mpp = find_mp_by_wwid(vecs->mpvec, pp->wwid);
+
+	if (!mpp || mpp->flush_queued)
+		return 0;
+	/* the reload in finish_map_flush() pushes the path */
+	assert_int_equal(need_do_map, 0);
+	if (!mpp->paths)
+		mpp->paths = vector_alloc();
+	assert_non_null(mpp->paths);
+	assert_true(vector_alloc_slot(mpp->paths));
+	vector_set_slot(mpp->paths, pp);
+	pp->mpp = mpp;
+	return 0;
+}
+
+int handle_flush_result(struct multipath *mpp, struct vectors *vecs, int r)
+{
+	assert_int_not_equal(r, 0);
+	return r;
+}
+
+int reload_and_sync_map(struct multipath *mpp, struct vectors *vecs,
+			int refresh)
+{
+	struct path *pp = VECTOR_SLOT(vecs->pathvec, 0);
+
+	/* the delayed path must be adopted before the reload */
+	assert_ptr_equal(pp->mpp, mpp);
+	reloads++;
+	return 0;
+}
+
+void feed_event(const char *fmt, ...)
+{
+}
+
+int __wrap_dm_flush_map_nopaths(const char *mapname, int deferred_remove)
+{
+	assert_string_equal(mapname, ALIAS);
+	return mock_type(int);
+}
+
+void __wrap_dm_udev_batch_start(void)
+{
+}
+
+void __wrap_dm_udev_batch_end(void)
+{
+}
+
+static int setup(void **state)
+{
+	static struct vectors vecs;
+	struct multipath *mpp;
+	struct path *pp;
+
+	vecs.pathvec = vector_alloc();
+	vecs.mpvec = vector_alloc();
+	mpp = calloc(1, sizeof(*mpp));
+	pp = calloc(1, sizeof(*pp));
+	if (!vecs.pathvec || !vecs.mpvec || !mpp || !pp)
+		return -1;
+	mpp->alias = strdup(ALIAS);
+	strlcpy(mpp->wwid, WWID, sizeof(mpp->wwid));
+	strlcpy(pp->dev, "sdb", sizeof(pp->dev));
+	strlcpy(pp->wwid, WWID, sizeof(pp->wwid));
+	pp->initialized = INIT_OK;
+	if (!mpp->alias || !vector_alloc_slot(vecs.mpvec) ||
+	    !vector_alloc_slot(vecs.pathvec))
+		return -1;
+	vector_set_slot(vecs.mpvec, mpp);
+	vector_set_slot(vecs.pathvec, pp);
+	flush_thr_started = true;
+	reloads = 0;
+	*state = &vecs;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct vectors *vecs = *state;
+	struct multipath *mpp = VECTOR_SLOT(vecs->mpvec, 0);
+
+	flush_thr_started = false;
+	free_reqs(&flush_batch);
+	free_reqs(&flush_reqs);
+	vector_free(mpp->paths);
+	free(mpp->alias);
+	free(mpp);
+	free(VECTOR_SLOT(vecs->pathvec, 0));
+	vector_free(vecs->mpvec);
+	vector_free(vecs->pathvec);
+	return 0;
+}
+
+/* the flush thread, without the thread */
+static void run_flush(struct vectors *vecs)
+{
+	struct flush_req *req;
+
+	list_splice_tail_init(&flush_reqs, &flush_batch);
+	flush_maps();
+	list_for_each_entry(req, &flush_batch, node)
+		finish_map_flush(vecs, req->alias, req->wwid, req->r);
+	free_reqs(&flush_batch);
+}
+
+static void test_busy_readds_path(void **state)
+{
+	struct vectors *vecs = *state;
+	struct multipath *mpp = VECTOR_SLOT(vecs->mpvec, 0);
+	struct path *pp = VECTOR_SLOT(vecs->pathvec, 0);
+
+	assert_true(queue_map_flush(mpp));
+	assert_true(mpp->flush_queued);
+	/* the path shows up while the map is waiting for removal */
+	ev_add_path(pp, vecs, 1);
+	assert_null(pp->mpp);
+
+	will_return(__wrap_dm_flush_map_nopaths, 1);
+	run_flush(vecs);
+	assert_false(mpp->flush_queued);
+	assert_ptr_equal(pp->mpp, mpp);
+	assert_int_equal(VECTOR_SIZE(mpp->paths), 1);
+	assert_ptr_equal(VECTOR_SLOT(mpp->paths, 0), pp);
+	assert_int_equal(reloads, 1);
+}
+
+static void test_busy_wait_for_udev(void **state)
+{
+	struct vectors *vecs = *state;
+	struct multipath *mpp = VECTOR_SLOT(vecs->mpvec, 0);
+	struct path *pp = VECTOR_SLOT(vecs->pathvec, 0);
+
+	mpp->wait_for_udev = 1;
+	assert_true(queue_map_flush(mpp));
+	ev_add_path(pp, vecs, 1);
+
+	will_return(__wrap_dm_flush_map_nopaths, 1);
+	run_flush(vecs);
+	/* adopted now, pushed by the reload after the udev event */
+	assert_ptr_equal(pp->mpp, mpp);
+	assert_int_equal(mpp->wait_for_udev, 2);
+	assert_int_equal(reloads, 0);
+}
+
+static int test_flush_queue(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_busy_readds_path,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_busy_wait_for_udev,
+						setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_flush_queue();
+	return ret;
+}
@@ -119,7 +119,7 @@ static void free_hwt(struct hwt_state *hwt)
 			remove_maps(hwt->vecs);
 		if (hwt->vecs->pathvec != NULL)
 			free_pathvec(hwt->vecs->pathvec, FREE_PATHS);
-		pthread_mutex_destroy(&hwt->vecs->lock.mutex);
+		destroy_lock(&hwt->vecs->lock);
 		free(hwt->vecs);
 	}
 	free(hwt);
@@ -165,7 +165,7 @@ static int setup(void **state)
 	hwt->vecs = calloc(1, sizeof(*hwt->vecs));
 	if (hwt->vecs == NULL)
 		goto err;
-	pthread_mutex_init(&hwt->vecs->lock.mutex, NULL);
+	init_lock(&hwt->vecs->lock);
 	hwt->vecs->pathvec = vector_alloc();
 	hwt->vecs->mpvec = vector_alloc();
 	if (hwt->vecs->pathvec == NULL || hwt->vecs->mpvec == NULL)
@@ -424,6 +424,7 @@ static const struct key_value wwid_test = { _wwid, default_wwid };
 /* Regular expresssions */
 static const struct key_value vnd__oo = { _vendor, ".oo" };
 static const struct key_value vnd_t_oo = { _vendor, "^.oo" };
+static const struct key_value vnd_t_fo_ = { _vendor, "^fo+" };
 static const struct key_value prd_ba_ = { _product, "ba." };
 static const struct key_value prd_ba_s = { _product, "(bar|baz|ba\\.)$" };
 /* Pathological cases, see below */
@@ -602,6 +603,56 @@ static int setup_internal_nvme(void **state)
 	return 0;
 }
 
+/*
+ * lookup_hwe() must find the same entries as find_hwe() for the vendor
+ * strings of the built-in hwtable, also embedded in longer strings.
+ */
+static void test_lookup_builtin(const struct hwt_state *hwt)
+{
+	const char *products[] = { "LUN", "VRAID", "NetApp ONTAP Controller" };
+	char buf[80];
+	struct hwentry *hwe;
+	vector v1, v2;
+	int i, j, k;
+
+	v1 = vector_alloc();
+	v2 = vector_alloc();
+	assert_ptr_not_equal(v1, NULL);
+	assert_ptr_not_equal(v2, NULL);
+	vector_foreach_slot(_conf->hwtable, hwe, i) {
+		if (!hwe->vendor_literal)
+			continue;
+		for (j = 0; j < 2; j++) {
+			snprintf(buf, sizeof(buf), j ? "x%sy" : "%s",
+				 hwe->vendor_literal);
+			for (k = 0; k < (int)ARRAY_SIZE(products); k++) {
+				assert_int_equal(
+					lookup_hwe(_conf, buf, products[k],
+						   NULL, v1),
+					find_hwe(_conf->hwtable, buf,
+						 products[k], NULL, v2));
+				assert_int_equal(VECTOR_SIZE(v1),
+						 VECTOR_SIZE(v2));
+				assert_memory_equal(v1->slot, v2->slot,
+						    VECTOR_SIZE(v1) *
+						    sizeof(*v1->slot));
+			}
+		}
+	}
+	vector_free(v1);
+	vector_free(v2);
+}
+
+static int setup_lookup_builtin(void **state)
+{
+	struct hwt_state *hwt = CHECK_STATE(state);
+
+	WRITE_EMPTY_CONF(hwt);
+	SET_TEST_FUNC(hwt, test_lookup_builtin);
+
+	return 0;
+}
+
 /*
  * Device section with a simple entry qith double quotes ('foo:"bar"')
  */
@@ -741,6 +792,45 @@ static int setup_regex_hwe(void **state)
 	return 0;
 }
 
+/*
+ * Device section with a regex entry starting with a literal ("^fo+:bar").
+ * find_hwe() checks the literal "fo" before running the regex.
+ */
+static void test_literal_regex_hwe(const struct hwt_state *hwt)
+{
+	struct path *pp;
+
+	/* foo:bar matches */
+	pp = mock_path(vnd_foo.value, prd_bar.value);
+	TEST_PROP(prio_name(&pp->prio), prio_emc.value);
+
+	/* fo:bar matches */
+	pp = mock_path("fo", prd_bar.value);
+	TEST_PROP(prio_name(&pp->prio), prio_emc.value);
+
+	/* f:bar doesn't match */
+	pp = mock_path("f", prd_bar.value);
+	TEST_PROP(prio_name(&pp->prio), DEFAULT_PRIO);
+
+	/* bfoo:bar doesn't match */
+	pp = mock_path("bfoo", prd_bar.value);
+	TEST_PROP(prio_name(&pp->prio), DEFAULT_PRIO);
+
+	/* foo:baz doesn't match */
+	pp = mock_path(vnd_foo.value, prd_baz.value);
+	TEST_PROP(prio_name(&pp->prio), DEFAULT_PRIO);
+}
+
+static int setup_literal_regex_hwe(void **state)
+{
+	struct hwt_state *hwt = CHECK_STATE(state);
+	const struct key_value kv[] = { vnd_t_fo_, prd_bar, prio_emc };
+
+	WRITE_ONE_DEVICE(hwt, kv);
+	SET_TEST_FUNC(hwt, test_literal_regex_hwe);
+	return 0;
+}
+
 /*
  * Two device entries, kv1 is a regex match ("^.foo:(bar|baz|ba\.)$"),
  * kv2 a string match (foo:bar) which matches a subset of the regex.
@@ -1702,7 +1792,9 @@ define_test(broken_hwe)
 define_test(broken_hwe_dir)
 define_test(quoted_hwe)
 define_test(internal_nvme)
+define_test(lookup_builtin)
 define_test(regex_hwe)
+define_test(literal_regex_hwe)
 define_test(regex_string_hwe)
 define_test(regex_string_hwe_dir)
 define_test(regex_2_strings_hwe_dir)
@@ -1738,11 +1830,13 @@ static int test_hwtable(void)
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_sanity_globals),
 		test_entry(internal_nvme),
+		test_entry(lookup_builtin),
 		test_entry(string_hwe),
 		test_entry(broken_hwe),
 		test_entry(broken_hwe_dir),
 		test_entry(quoted_hwe),
 		test_entry(regex_hwe),
+		test_entry(literal_regex_hwe),
 		test_entry(regex_string_hwe),
 		test_entry(regex_string_hwe_dir),
 		test_entry(regex_2_strings_hwe_dir),
@@ -0,0 +1,223 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Tests for the I/O statistics helpers: rates, latency histogram
+ * and percentiles.
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+#include "globals.c"
+
+/* I have to do this to get at the static functions */
+#include "../libmultipath/io_stats.c"
+
+static void at(struct timespec *ts, time_t sec)
+{
+	ts->tv_sec = sec;
+	ts->tv_nsec = 0;
+}
+
+static void test_latency_bucket(void **state)
+{
+	assert_int_equal(latency_bucket(0), 0);
+	assert_int_equal(latency_bucket(99), 0);
+	assert_int_equal(latency_bucket(100), 1);
+	assert_int_equal(latency_bucket(1500), 4);
+	assert_int_equal(latency_bucket(199999), 10);
+	assert_int_equal(latency_bucket(200000), IO_STATS_BUCKETS - 1);
+	assert_int_equal(latency_bucket(~0U), IO_STATS_BUCKETS - 1);
+}
+
+static void test_percentile(void **state)
+{
+	struct io_stats st;
+
+	memset(&st, 0, sizeof(st));
+	assert_int_equal(io_stats_percentile(&st, 50), 0);
+
+	st.hist[1] = 50;
+	st.hist[3] = 40;
+	st.hist[IO_STATS_BUCKETS - 1] = 10;
+	assert_int_equal(io_stats_percentile(&st, 50), 200);
+	assert_int_equal(io_stats_percentile(&st, 51), 1000);
+	assert_int_equal(io_stats_percentile(&st, 90), 1000);
+	/* the last bucket reports its lower bound */
+	assert_int_equal(io_stats_percentile(&st, 99), 200000);
+}
+
+static void test_decay(void **state)
+{
+	struct io_stats st;
+
+	memset(&st, 0, sizeof(st));
+	st.hist[0] = IO_STATS_DECAY_IOS;
+	decay_histogram(&st);
+	assert_int_equal(st.hist[0], IO_STATS_DECAY_IOS);
+	st.hist[5] = 3;
+	decay_histogram(&st);
+	assert_int_equal(st.hist[0], IO_STATS_DECAY_IOS / 2);
+	assert_int_equal(st.hist[5], 1);
+}
+
+static void test_advance(void **state)
+{
+	struct io_stats st;
+	struct timespec now;
+
+	memset(&st, 0, sizeof(st));
+	at(&now, 100);
+	/* the first sample has nothing to compare with */
+	assert_int_equal(advance_io_stats(&st, 1000, 8000, 500000, &now), -1);
+
+	at(&now, 102);
+	assert_int_equal(advance_io_stats(&st, 3000, 12000, 1500000, &now),
+			 2000);
+	assert_int_equal(st.iops, 1000);
+	assert_int_equal(st.kbps, 1000);
+	assert_int_equal(st.latency, 500);
+
+	/* idle, the latency is kept */
+	at(&now, 103);
+	assert_int_equal(advance_io_stats(&st, 3000, 12000, 1500000, &now), 0);
+	assert_int_equal(st.iops, 0);
+	assert_int_equal(st.kbps, 0);
+	assert_int_equal(st.latency, 500);
+
+	/* too short an interval is skipped */
+	now.tv_nsec = 1000;
+	assert_int_equal(advance_io_stats(&st, 3100, 12000, 1500000, &now), 0);
+	assert_int_equal(st.ios, 3000);
+
+	/* counters going backwards start a new series */
+	at(&now, 105);
+	assert_int_equal(advance_io_stats(&st, 10, 80, 1000, &now), -1);
+	assert_int_equal(st.ios, 10);
+	assert_int_equal(st.latency, 500);
+}
+
+static void test_parse_histogram(void **state)
+{
+	unsigned long long hist[IO_STATS_BUCKETS];
+
+	assert_int_equal(parse_histogram("1:2:3:4:5:6:7:8:9:10:11:12\n", hist),
+			 0);
+	assert_int_equal(hist[0], 1);
+	assert_int_equal(hist[IO_STATS_BUCKETS - 1], 12);
+	assert_int_equal(parse_histogram("1:2:3:4:5:6:7:8:9:10:11:12", hist),
+			 0);
+	/* too few or too many buckets */
+	assert_int_not_equal(parse_histogram("1:2:3:4:5:6:7:8:9:10:11", hist),
+			     0);
+	assert_int_not_equal(parse_histogram("1:2:3:4:5:6:7:8:9:10:11:12:13",
+					     hist), 0);
+	assert_int_not_equal(parse_histogram("1:2:x", hist), 0);
+}
+
+static void set_rates(struct io_stats *st, unsigned int iops,
+		      unsigned int size_kb, unsigned int latency)
+{
+	st->iops = iops;
+	st->kbps = iops * size_kb;
+	st->latency = latency;
+}
+
+static void test_workload(void **state)
+{
+	struct io_stats st;
+
+	memset(&st, 0, sizeof(st));
+	assert_int_equal(io_stats_workload(&st), IO_WORKLOAD_UNKNOWN);
+	set_rates(&st, IO_TUNE_MIN_IOPS - 1, 256, 1000);
+	assert_int_equal(io_stats_workload(&st), IO_WORKLOAD_UNKNOWN);
+	set_rates(&st, 1000, 256, 1000);
+	assert_int_equal(io_stats_workload(&st), IO_WORKLOAD_STREAMING);
+	/* 20000 IOPS at 500us: 10 requests in flight */
+	set_rates(&st, 20000, 8, 500);
+	assert_int_equal(io_stats_workload(&st), IO_WORKLOAD_TRANSACTIONAL);
+	/* small requests, but only one in flight */
+	set_rates(&st, 2000, 8, 500);
+	assert_int_equal(io_stats_workload(&st), IO_WORKLOAD_MIXED);
+	set_rates(&st, 20000, 64, 500);
+	assert_int_equal(io_stats_workload(&st), IO_WORKLOAD_MIXED);
+}
+
+static void test_tune(void **state)
+{
+	struct io_tune t;
+	struct io_stats st;
+	int i;
+
+	memset(&t, 0, sizeof(t));
+	memset(&st, 0, sizeof(st));
+	set_rates(&st, 1000, 256, 1000);
+	for (i = 0; i < IO_TUNE_STABLE_SAMPLES - 1; i++)
+		assert_int_equal(io_stats_tune(&t, &st), 0);
+	/* not stable yet */
+	set_rates(&st, 0, 0, 0);
+	assert_int_equal(io_stats_tune(&t, &st), 0);
+	/* a quiet sample doesn't break the streak */
+	set_rates(&st, 1000, 256, 1000);
+	assert_int_equal(io_stats_tune(&t, &st), 0);
+	/* never while busy */
+	assert_int_equal(io_stats_tune(&t, &st), 0);
+	set_rates(&st, 100, 256, 1000);
+	assert_int_equal(io_stats_tune(&t, &st), 1);
+	assert_int_equal(t.applied, IO_WORKLOAD_STREAMING);
+	assert_int_equal(io_stats_tune(&t, &st), 0);
+
+	/* a different workload restarts the streak */
+	set_rates(&st, 20000, 8, 500);
+	for (i = 0; i < IO_TUNE_STABLE_SAMPLES; i++)
+		assert_int_equal(io_stats_tune(&t, &st), 0);
+	set_rates(&st, 0, 0, 0);
+	assert_int_equal(io_stats_tune(&t, &st), 1);
+	assert_int_equal(t.applied, IO_WORKLOAD_TRANSACTIONAL);
+}
+
+static void test_tune_mixed(void **state)
+{
+	struct io_tune t;
+	struct io_stats st;
+	int i;
+
+	memset(&t, 0, sizeof(t));
+	memset(&st, 0, sizeof(st));
+	/* the configured selector is used already, no reload */
+	set_rates(&st, 2000, 8, 500);
+	for (i = 0; i < IO_TUNE_STABLE_SAMPLES; i++)
+		assert_int_equal(io_stats_tune(&t, &st), 0);
+	set_rates(&st, 0, 0, 0);
+	assert_int_equal(io_stats_tune(&t, &st), 0);
+	assert_int_equal(t.applied, IO_WORKLOAD_MIXED);
+}
+
+static int test_io_stats(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_latency_bucket),
+		cmocka_unit_test(test_percentile),
+		cmocka_unit_test(test_decay),
+		cmocka_unit_test(test_advance),
+		cmocka_unit_test(test_parse_histogram),
+		cmocka_unit_test(test_workload),
+		cmocka_unit_test(test_tune),
+		cmocka_unit_test(test_tune_mixed),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_io_stats();
+	return ret;
+}
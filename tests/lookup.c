@@ -0,0 +1,311 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Tests for the find_*() lookup functions, in particular that cached
+ * lookups stay correct when vectors and elements change.
+ */
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include <libdevmapper.h>
+
+#include "globals.c"
+#include "vector.h"
+#include "structs.h"
+#include "util.h"
+
+#define N_PATHS 8
+
+struct lookup_state {
+	vector pathvec;
+	struct path paths[N_PATHS];
+};
+
+static int setup(void **state)
+{
+	struct lookup_state *s;
+	int i;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -1;
+	s->pathvec = vector_alloc();
+	if (!s->pathvec) {
+		free(s);
+		return -1;
+	}
+	for (i = 0; i < N_PATHS; i++) {
+		snprintf(s->paths[i].dev, sizeof(s->paths[i].dev),
+			 "sd%c", 'a' + i);
+		snprintf(s->paths[i].dev_t, sizeof(s->paths[i].dev_t),
+			 "8:%d", 16 * i);
+		if (store_path(s->pathvec, &s->paths[i])) {
+			vector_free(s->pathvec);
+			free(s);
+			return -1;
+		}
+	}
+	*state = s;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	struct lookup_state *s = *state;
+
+	vector_free(s->pathvec);
+	free(s);
+	return 0;
+}
+
+static void test_find_path(void **state)
+{
+	struct lookup_state *s = *state;
+	int i, j;
+
+	/* the second round is served from the cache */
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < N_PATHS; i++) {
+			assert_ptr_equal(find_path_by_dev(s->pathvec,
+							  s->paths[i].dev),
+					 &s->paths[i]);
+			assert_ptr_equal(find_path_by_devt(s->pathvec,
+							   s->paths[i].dev_t),
+					 &s->paths[i]);
+		}
+	}
+	assert_null(find_path_by_dev(s->pathvec, "sdz"));
+	assert_null(find_path_by_devt(s->pathvec, "8:255"));
+	assert_null(find_path_by_dev(NULL, "sda"));
+}
+
+static void test_find_path_moved(void **state)
+{
+	struct lookup_state *s = *state;
+
+	assert_ptr_equal(find_path_by_dev(s->pathvec, "sdd"), &s->paths[3]);
+	/* sdd moves to slot 2 */
+	vector_del_slot(s->pathvec, 0);
+	assert_ptr_equal(find_path_by_dev(s->pathvec, "sdd"), &s->paths[3]);
+	assert_null(find_path_by_dev(s->pathvec, "sda"));
+}
+
+static void test_find_path_removed(void **state)
+{
+	struct lookup_state *s = *state;
+	int i = find_slot(s->pathvec, &s->paths[5]);
+
+	assert_ptr_equal(find_path_by_devt(s->pathvec, "8:80"), &s->paths[5]);
+	vector_del_slot(s->pathvec, i);
+	assert_null(find_path_by_devt(s->pathvec, "8:80"));
+	/* slot i is now taken by the next path */
+	assert_ptr_equal(find_path_by_devt(s->pathvec, "8:96"), &s->paths[6]);
+}
+
+/* A path must be removed from the vector to change its device name */
+static void test_find_path_renamed(void **state)
+{
+	struct lookup_state *s = *state;
+	int i = find_slot(s->pathvec, &s->paths[1]);
+
+	assert_ptr_equal(find_path_by_dev(s->pathvec, "sdb"), &s->paths[1]);
+	vector_del_slot(s->pathvec, i);
+	strlcpy(s->paths[1].dev, "sdq", sizeof(s->paths[1].dev));
+	assert_int_equal(store_path(s->pathvec, &s->paths[1]), 0);
+	assert_null(find_path_by_dev(s->pathvec, "sdb"));
+	assert_ptr_equal(find_path_by_dev(s->pathvec, "sdq"), &s->paths[1]);
+}
+
+/* A path stored after a lookup missed must get past the filter */
+static void test_find_path_added(void **state)
+{
+	struct lookup_state *s = *state;
+	struct path pp = { .dev = "sdz", .dev_t = "65:160" };
+
+	assert_null(find_path_by_dev(s->pathvec, "sdz"));
+	assert_null(find_path_by_devt(s->pathvec, "65:160"));
+	assert_int_equal(store_path(s->pathvec, &pp), 0);
+	assert_ptr_equal(find_path_by_dev(s->pathvec, "sdz"), &pp);
+	assert_ptr_equal(find_path_by_devt(s->pathvec, "65:160"), &pp);
+	assert_ptr_equal(find_path_by_dev(s->pathvec, "sda"), &s->paths[0]);
+}
+
+/* Keys that are filled in after store_path() */
+static void test_find_path_key_set_late(void **state)
+{
+	struct lookup_state *s = *state;
+	struct path pp = { .dev_t = "65:176" };
+
+	assert_int_equal(store_path(s->pathvec, &pp), 0);
+	assert_null(find_path_by_dev(s->pathvec, "sdaa"));
+	strlcpy(pp.dev, "sdaa", sizeof(pp.dev));
+	assert_ptr_equal(find_path_by_dev(s->pathvec, "sdaa"), &pp);
+}
+
+/* The filter is rebuilt bigger when many paths are added */
+static void test_find_path_many(void **state)
+{
+	struct lookup_state *s = *state;
+	struct path *pps;
+	char dev[FILE_NAME_SIZE];
+	int i, n = 500;
+
+	pps = calloc(n, sizeof(*pps));
+	assert_non_null(pps);
+	assert_null(find_path_by_dev(s->pathvec, "dev0"));
+	for (i = 0; i < n; i++) {
+		snprintf(pps[i].dev, sizeof(pps[i].dev), "dev%d", i);
+		snprintf(pps[i].dev_t, sizeof(pps[i].dev_t), "253:%d", i);
+		assert_int_equal(store_path(s->pathvec, &pps[i]), 0);
+		assert_ptr_equal(find_path_by_dev(s->pathvec, pps[i].dev),
+				 &pps[i]);
+	}
+	for (i = 0; i < n; i++) {
+		snprintf(dev, sizeof(dev), "dev%d", i);
+		assert_ptr_equal(find_path_by_dev(s->pathvec, dev), &pps[i]);
+		snprintf(dev, sizeof(dev), "253:%d", i);
+		assert_ptr_equal(find_path_by_devt(s->pathvec, dev), &pps[i]);
+		snprintf(dev, sizeof(dev), "nodev%d", i);
+		assert_null(find_path_by_dev(s->pathvec, dev));
+	}
+	vector_reset(s->pathvec);
+	assert_null(find_path_by_dev(s->pathvec, "dev0"));
+	free(pps);
+}
+
+static void test_find_path_other_vector(void **state)
+{
+	struct lookup_state *s = *state;
+	vector v = vector_alloc();
+
+	assert_non_null(v);
+	assert_ptr_equal(find_path_by_dev(s->pathvec, "sdc"), &s->paths[2]);
+	assert_null(find_path_by_dev(v, "sdc"));
+	assert_int_equal(store_path(v, &s->paths[7]), 0);
+	assert_int_equal(store_path(v, &s->paths[2]), 0);
+	assert_ptr_equal(find_path_by_dev(v, "sdc"), &s->paths[2]);
+	assert_ptr_equal(find_path_by_dev(s->pathvec, "sdc"), &s->paths[2]);
+	vector_free(v);
+}
+
+static void test_find_mp(void **state)
+{
+	struct multipath mp[3];
+	struct dm_info dmi[3];
+	char alias[3][8];
+	vector mpvec = vector_alloc();
+	int i, j;
+
+	assert_non_null(mpvec);
+	memset(mp, 0, sizeof(mp));
+	memset(dmi, 0, sizeof(dmi));
+	for (i = 0; i < 3; i++) {
+		snprintf(alias[i], sizeof(alias[i]), "mpath%c", 'a' + i);
+		snprintf(mp[i].wwid, sizeof(mp[i].wwid), "360000%d", i);
+		mp[i].alias = alias[i];
+		dmi[i].minor = 10 + i;
+		mp[i].dmi = &dmi[i];
+		assert_true(vector_alloc_slot(mpvec));
+		vector_set_slot(mpvec, &mp[i]);
+	}
+
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < 3; i++) {
+			assert_ptr_equal(find_mp_by_alias(mpvec, alias[i]),
+					 &mp[i]);
+			assert_ptr_equal(find_mp_by_wwid(mpvec, mp[i].wwid),
+					 &mp[i]);
+			assert_ptr_equal(find_mp_by_minor(mpvec, 10 + i),
+					 &mp[i]);
+		}
+	}
+	assert_ptr_equal(find_mp_by_str(mpvec, "dm-11"), &mp[1]);
+	assert_ptr_equal(find_mp_by_str(mpvec, "mpathc"), &mp[2]);
+	assert_null(find_mp_by_alias(mpvec, ""));
+	assert_null(find_mp_by_alias(mpvec, "mpath"));
+
+	/* the minor changes, e.g. after the map was recreated */
+	dmi[0].minor = 20;
+	assert_null(find_mp_by_minor(mpvec, 10));
+	assert_ptr_equal(find_mp_by_minor(mpvec, 20), &mp[0]);
+	mp[0].dmi = NULL;
+	assert_null(find_mp_by_minor(mpvec, 20));
+
+	vector_del_slot(mpvec, 1);
+	assert_null(find_mp_by_alias(mpvec, "mpathb"));
+	assert_ptr_equal(find_mp_by_alias(mpvec, "mpathc"), &mp[2]);
+	vector_free(mpvec);
+}
+
+static void test_find_mp_wwid_hash(void **state)
+{
+	struct multipath mp[2];
+	vector mpvec = vector_alloc();
+	int i;
+
+	assert_non_null(mpvec);
+	memset(mp, 0, sizeof(mp));
+	for (i = 0; i < 2; i++) {
+		snprintf(mp[i].wwid, sizeof(mp[i].wwid), "360001%d", i);
+		assert_true(vector_alloc_slot(mpvec));
+		vector_set_slot(mpvec, &mp[i]);
+	}
+	/* mp[0] has no hash, and is compared by string */
+	hash_map_wwid(&mp[1]);
+	assert_int_not_equal(mp[1].wwid_hash, 0);
+	assert_ptr_equal(find_mp_by_wwid(mpvec, "3600010"), &mp[0]);
+	assert_ptr_equal(find_mp_by_wwid(mpvec, "3600011"), &mp[1]);
+	assert_null(find_mp_by_wwid(mpvec, "3600012"));
+
+	assert_true(same_wwid(mp[1].wwid, mp[1].wwid_hash,
+			      "3600011", wwid_hash("3600011")));
+	assert_true(same_wwid(mp[1].wwid, mp[1].wwid_hash, "3600011", 0));
+	assert_false(same_wwid(mp[0].wwid, 0, mp[1].wwid, mp[1].wwid_hash));
+	assert_false(same_wwid(mp[1].wwid, mp[1].wwid_hash,
+			       "3600012", wwid_hash("3600012")));
+
+	/* the hash follows the WWID */
+	strcpy(mp[1].wwid, "3600013");
+	hash_map_wwid(&mp[1]);
+	assert_null(find_mp_by_wwid(mpvec, "3600011"));
+	assert_ptr_equal(find_mp_by_wwid(mpvec, "3600013"), &mp[1]);
+	vector_free(mpvec);
+}
+
+static int test_lookup(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_find_path,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_find_path_moved,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_find_path_removed,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_find_path_renamed,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_find_path_other_vector,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_find_path_added,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_find_path_key_set_late,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_find_path_many,
+						setup, teardown),
+		cmocka_unit_test(test_find_mp),
+		cmocka_unit_test(test_find_mp_wwid_hash),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_lookup();
+	return ret;
+}
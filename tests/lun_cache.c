@@ -0,0 +1,96 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+#include "lun_cache.h"
+#include "globals.c"
+
+#define QUERY_A LUN_QUERY(0xa3, 0x0a)
+#define QUERY_B LUN_QUERY(0x12, 0xc9)
+
+static const unsigned char resp[] = { 0, 0, 0, 4, 0x80, 0, 0, 1 };
+
+static void test_lun_cache_hit(void **state)
+{
+	unsigned char buf[LUN_CACHE_BUFLEN];
+
+	lun_cache_put("wwid-hit", QUERY_A, resp, sizeof(resp));
+	assert_int_equal(lun_cache_get("wwid-hit", QUERY_A, buf, sizeof(buf),
+				       LUN_CACHE_TTL_MS), sizeof(resp));
+	assert_memory_equal(buf, resp, sizeof(resp));
+	/* another query, or another LUN */
+	assert_int_equal(lun_cache_get("wwid-hit", QUERY_B, buf, sizeof(buf),
+				       LUN_CACHE_TTL_MS), 0);
+	assert_int_equal(lun_cache_get("wwid-other", QUERY_A, buf,
+				       sizeof(buf), LUN_CACHE_TTL_MS), 0);
+	/* doesn't fit */
+	assert_int_equal(lun_cache_get("wwid-hit", QUERY_A, buf,
+				       sizeof(resp) - 1, LUN_CACHE_TTL_MS), 0);
+}
+
+static void test_lun_cache_expired(void **state)
+{
+	unsigned char buf[LUN_CACHE_BUFLEN];
+
+	lun_cache_put("wwid-expired", QUERY_A, resp, sizeof(resp));
+	assert_int_equal(lun_cache_get("wwid-expired", QUERY_A, buf,
+				       sizeof(buf), 0), 0);
+}
+
+static void test_lun_cache_invalidate(void **state)
+{
+	unsigned char buf[LUN_CACHE_BUFLEN];
+
+	lun_cache_put("wwid-inval", QUERY_A, resp, sizeof(resp));
+	lun_cache_put("wwid-inval", QUERY_B, resp, sizeof(resp));
+	lun_cache_put("wwid-keep", QUERY_A, resp, sizeof(resp));
+	lun_cache_invalidate("wwid-inval");
+	assert_int_equal(lun_cache_get("wwid-inval", QUERY_A, buf,
+				       sizeof(buf), LUN_CACHE_TTL_MS), 0);
+	assert_int_equal(lun_cache_get("wwid-inval", QUERY_B, buf,
+				       sizeof(buf), LUN_CACHE_TTL_MS), 0);
+	assert_int_equal(lun_cache_get("wwid-keep", QUERY_A, buf,
+				       sizeof(buf), LUN_CACHE_TTL_MS),
+			 sizeof(resp));
+}
+
+static void test_lun_cache_no_wwid(void **state)
+{
+	unsigned char buf[LUN_CACHE_BUFLEN];
+	static unsigned char big[LUN_CACHE_BUFLEN + 1];
+
+	/* paths without WWID don't share */
+	lun_cache_put("", QUERY_A, resp, sizeof(resp));
+	assert_int_equal(lun_cache_get("", QUERY_A, buf, sizeof(buf),
+				       LUN_CACHE_TTL_MS), 0);
+	lun_cache_put("wwid-big", QUERY_A, big, sizeof(big));
+	assert_int_equal(lun_cache_get("wwid-big", QUERY_A, big, sizeof(big),
+				       LUN_CACHE_TTL_MS), 0);
+}
+
+static int test_lun_cache(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_lun_cache_hit),
+		cmocka_unit_test(test_lun_cache_expired),
+		cmocka_unit_test(test_lun_cache_invalidate),
+		cmocka_unit_test(test_lun_cache_no_wwid),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_lun_cache();
+	return ret;
+}
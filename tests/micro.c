@@ -0,0 +1,624 @@
+/*
+ * Microbenchmarks for libmultipath primitives.
+ *
+ * Usage: micro-test
+ *
+ * Results are written to stdout in the same format as for the scale
+ * benchmark (see bench-lib.h). The "scale" column is the size of the
+ * data the operation works on, e.g. the vector size or the number of
+ * WWIDs in the wwids file.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include <scsi/sg.h>
+#include "structs.h"
+#include "config.h"
+#include "vector.h"
+#include "strbuf.h"
+#include "dmparser.h"
+#include "discovery.h"
+#include "blacklist.h"
+#include "log.h"
+#include "debug.h"
+#include "bench-lib.h"
+
+/* I have to do this to get at the static functions */
+#include "../libmultipath/wwids.c"
+#include "../multipathd/cli.c"
+
+/* number of operations per timed repetition */
+#define BATCH 10000
+#define NR_WWIDS 10000
+
+static struct config *_conf;
+
+struct config *get_multipath_config(void)
+{
+	return _conf;
+}
+
+void put_multipath_config(void *arg)
+{}
+
+/* cli.c needs these from multipathd */
+int get_snapshot_reply(struct vectors *vecs, int id, char **reply, int *len)
+{
+	return -1;
+}
+
+int render_topology_snapshot(struct vectors *vecs, int id,
+			     char **reply, int *len)
+{
+	return -1;
+}
+
+void invalidate_topology_snapshot(void)
+{}
+
+/* Fake SCSI device: all INQUIRY commands return vpd_page */
+static unsigned char vpd_page[256];
+static int vpd_page_len;
+
+int __wrap_ioctl(int fd, unsigned long request, void *param)
+{
+	struct sg_io_hdr *io_hdr = param;
+	int len = vpd_page_len;
+
+	if (len > (int)io_hdr->dxfer_len)
+		len = io_hdr->dxfer_len;
+	io_hdr->status = 0;
+	memcpy(io_hdr->dxferp, vpd_page, len);
+	return 0;
+}
+
+/* Fake udev device, like in the blacklist test */
+struct udev_device {
+	const char *sysname;
+	char *property_list[];
+};
+
+const char *
+__wrap_udev_device_get_sysname(struct udev_device *udev_device)
+{
+	return udev_device->sysname;
+}
+
+struct udev_list_entry *
+__wrap_udev_device_get_properties_list_entry(struct udev_device *udev_device)
+{
+	if (!*udev_device->property_list)
+		return NULL;
+	return (struct udev_list_entry *)udev_device->property_list;
+}
+
+struct udev_list_entry *
+__wrap_udev_list_entry_get_next(struct udev_list_entry *list_entry)
+{
+	if (!*((char **)list_entry + 1))
+		return NULL;
+	return (struct udev_list_entry *)(((char **)list_entry) + 1);
+}
+
+const char *
+__wrap_udev_list_entry_get_name(struct udev_list_entry *list_entry)
+{
+	return *(const char **)list_entry;
+}
+
+static int bench_vector_alloc_slot(void)
+{
+	struct bench_timer t = { 0 };
+	vector v;
+	long i;
+
+	while (!timer_done(&t)) {
+		v = vector_alloc();
+		if (!v)
+			return -1;
+		timer_start(&t);
+		for (i = 0; i < BATCH; i++) {
+			if (!vector_alloc_slot(v)) {
+				vector_free(v);
+				return -1;
+			}
+			vector_set_slot(v, (void *)i);
+		}
+		timer_stop(&t);
+		vector_free(v);
+	}
+	bench_report("vector_alloc_slot", BATCH,
+		     (unsigned long long)t.reps * BATCH, &t);
+	return 0;
+}
+
+/* Delete slots at random positions, like paths removed from pathvec */
+static int bench_vector_del_slot(void)
+{
+	static const int size = 1000;
+	struct bench_timer t = { 0 };
+	vector v;
+	long i, pos;
+
+	while (!timer_done(&t)) {
+		v = vector_alloc();
+		if (!v)
+			return -1;
+		for (i = 0; i < size; i++) {
+			if (!vector_alloc_slot(v)) {
+				vector_free(v);
+				return -1;
+			}
+			vector_set_slot(v, (void *)i);
+		}
+		pos = 0;
+		timer_start(&t);
+		for (i = size; i > 0; i--) {
+			pos = (pos + 7919) % i;
+			vector_del_slot(v, pos);
+		}
+		timer_stop(&t);
+		vector_free(v);
+	}
+	bench_report("vector_del_slot", size,
+		     (unsigned long long)t.reps * size, &t);
+	return 0;
+}
+
+static int bench_strbuf(void)
+{
+	struct bench_timer t = { 0 };
+	STRBUF_ON_STACK(buf);
+	int i;
+
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < BATCH; i++)
+			if (append_strbuf_str(&buf, "  |- 1:0:0:1 sdb 8:16 ") < 0)
+				return -1;
+		timer_stop(&t);
+		reset_strbuf(&buf);
+	}
+	bench_report("append_strbuf_str", BATCH,
+		     (unsigned long long)t.reps * BATCH, &t);
+
+	memset(&t, 0, sizeof(t));
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < BATCH; i++)
+			if (print_strbuf(&buf, "  |- %d:0:0:1 sd%c %d:%d ",
+					 i % 16, 'a' + i % 26, 8, i % 256) < 0)
+				return -1;
+		timer_stop(&t);
+		reset_strbuf(&buf);
+	}
+	bench_report("print_strbuf", BATCH,
+		     (unsigned long long)t.reps * BATCH, &t);
+	return 0;
+}
+
+/* 4 paths in 2 path groups, as set up for an ALUA array */
+static const char dm_table[] =
+	"1 queue_if_no_path 1 alua 2 1 "
+	"service-time 0 2 2 8:16 1 1 8:48 1 1 "
+	"service-time 0 2 2 8:32 1 1 8:64 1 1";
+static const char dm_status[] =
+	"2 0 0 0 2 1 "
+	"A 0 2 2 8:16 A 0 0 1 8:48 A 0 0 1 "
+	"E 0 2 2 8:32 A 0 0 1 8:64 A 0 0 1";
+static const char *const dm_devts[] = { "8:16", "8:32", "8:48", "8:64" };
+
+static int bench_dmparser(void)
+{
+	struct bench_timer t = { 0 };
+	struct multipath *mpp = NULL;
+	struct path *pp;
+	vector pathvec;
+	unsigned int i, j;
+	int rc = -1;
+
+	pathvec = vector_alloc();
+	if (!pathvec)
+		return -1;
+	for (i = 0; i < ARRAY_SIZE(dm_devts); i++) {
+		pp = alloc_path();
+		if (!pp)
+			goto out;
+		if (store_path(pathvec, pp) != 0) {
+			free_path(pp);
+			goto out;
+		}
+		strlcpy(pp->dev_t, dm_devts[i], sizeof(pp->dev_t));
+	}
+	mpp = alloc_multipath();
+	if (!mpp)
+		goto out;
+
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (j = 0; j < BATCH / 10; j++) {
+			if (disassemble_map(pathvec, dm_table, mpp) != 0)
+				goto out;
+			free_pgvec(mpp->pg, KEEP_PATHS);
+			mpp->pg = NULL;
+			free_multipath_attributes(mpp);
+		}
+		timer_stop(&t);
+	}
+	bench_report("disassemble_map", VECTOR_SIZE(pathvec),
+		     (unsigned long long)t.reps * (BATCH / 10), &t);
+
+	if (disassemble_map(pathvec, dm_table, mpp) != 0)
+		goto out;
+	memset(&t, 0, sizeof(t));
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (j = 0; j < BATCH / 10; j++)
+			if (disassemble_status(dm_status, mpp) != 0)
+				goto out;
+		timer_stop(&t);
+	}
+	bench_report("disassemble_status", VECTOR_SIZE(pathvec),
+		     (unsigned long long)t.reps * (BATCH / 10), &t);
+	rc = 0;
+out:
+	free_multipath(mpp, KEEP_PATHS);
+	free_pathvec(pathvec, FREE_PATHS);
+	return rc;
+}
+
+static void add_designator(unsigned char cs, unsigned char type,
+			   const void *data, unsigned char len)
+{
+	unsigned char *d = vpd_page + vpd_page_len;
+
+	d[0] = cs;
+	d[1] = type;
+	d[2] = 0;
+	d[3] = len;
+	memcpy(d + 4, data, len);
+	vpd_page_len += len + 4;
+}
+
+/* Device identification page as returned by a typical array */
+static void make_vpd_pg83(void)
+{
+	static const unsigned char naa[] = {
+		0x60, 0x0a, 0x09, 0x80, 0x38, 0x30, 0x4d, 0x68,
+		0x32, 0x24, 0x4b, 0x78, 0x2d, 0x53, 0x47, 0x31,
+	};
+	static const char t10[] = "NETAPP  LUN C-Mode      80Mh2$Kx-SG1";
+	static const unsigned char port[] = { 0, 0, 0, 1 };
+
+	memset(vpd_page, 0, sizeof(vpd_page));
+	vpd_page[1] = 0x83;
+	vpd_page_len = 4;
+	/* scsi name string, T10 vendor id, NAA, relative and group port */
+	add_designator(0x53, 0x98, "iqn.1992-08.com.netapp:sn.1", 28);
+	add_designator(0x02, 0x01, t10, sizeof(t10) - 1);
+	add_designator(0x01, 0x03, naa, sizeof(naa));
+	add_designator(0x01, 0x14, port, sizeof(port));
+	add_designator(0x01, 0x15, port, sizeof(port));
+	vpd_page[2] = (vpd_page_len - 4) >> 8;
+	vpd_page[3] = (vpd_page_len - 4) & 0xff;
+}
+
+static int bench_vpd_pg83(void)
+{
+	struct bench_timer t = { 0 };
+	char wwid[WWID_SIZE];
+	int i;
+
+	make_vpd_pg83();
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < BATCH; i++)
+			if (get_vpd_sgio(10, 0x83, 0, wwid, sizeof(wwid)) <= 0)
+				return -1;
+		timer_stop(&t);
+	}
+	bench_report("parse_vpd_pg83", vpd_page_len,
+		     (unsigned long long)t.reps * BATCH, &t);
+	return 0;
+}
+
+/* find_hwe() on a table with a single entry measures hwe_regmatch() */
+static int bench_hwe_regmatch(void)
+{
+	struct bench_timer t = { 0 };
+	struct hwentry *hwe;
+	vector hwtable, hwes;
+	int i, rc = -1;
+
+	hwtable = vector_alloc();
+	hwes = vector_alloc();
+	hwe = alloc_hwe();
+	if (!hwtable || !hwes || !hwe) {
+		free_hwe(hwe);
+		goto out;
+	}
+	hwe->vendor = strdup("NETAPP");
+	hwe->product = strdup("LUN");
+	if (!hwe->vendor || !hwe->product || store_hwe(hwtable, hwe) != 0) {
+		free_hwe(hwe);
+		goto out;
+	}
+	prepare_hwtable_regexes(hwtable);
+
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < BATCH; i++) {
+			if (find_hwe(hwtable, "NETAPP", "LUN C-Mode", "9800",
+				     hwes) != 1)
+				goto out;
+			vector_reset(hwes);
+		}
+		timer_stop(&t);
+	}
+	bench_report("hwe_regmatch", 1, (unsigned long long)t.reps * BATCH,
+		     &t);
+
+	memset(&t, 0, sizeof(t));
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < BATCH; i++)
+			if (find_hwe(hwtable, "DGC", "VRAID", "0001",
+				     hwes) != 0)
+				goto out;
+		timer_stop(&t);
+	}
+	bench_report("hwe_regmatch_nomatch", 1,
+		     (unsigned long long)t.reps * BATCH, &t);
+	rc = 0;
+out:
+	vector_free(hwes);
+	free_hwtable(hwtable);
+	return rc;
+}
+
+/* The properties udev typically sets for a SCSI disk */
+static struct udev_device udev_sd = {
+	.sysname = "sdb",
+	.property_list = {
+		"DEVPATH=/devices/pci0000:00/0000:00:02.0/host1/target1:0:0/1:0:0:1/block/sdb",
+		"DEVNAME=/dev/sdb",
+		"DEVTYPE=disk",
+		"MAJOR=8",
+		"MINOR=16",
+		"SUBSYSTEM=block",
+		"USEC_INITIALIZED=4012418",
+		"ID_SCSI=1",
+		"ID_VENDOR=NETAPP",
+		"ID_VENDOR_ENC=NETAPP\\x20\\x20",
+		"ID_MODEL=LUN_C-Mode",
+		"ID_MODEL_ENC=LUN\\x20C-Mode\\x20\\x20\\x20\\x20\\x20\\x20",
+		"ID_REVISION=9800",
+		"ID_TYPE=disk",
+		"ID_SERIAL=3600a098038304d6832244b782d534731",
+		"ID_SERIAL_SHORT=600a098038304d6832244b782d534731",
+		"ID_BUS=scsi",
+		"ID_PATH=pci-0000:00:02.0-scsi-0:0:0:1",
+		"ID_PATH_TAG=pci-0000_00_02_0-scsi-0_0_0_1",
+		"DM_MULTIPATH_DEVICE_PATH=1",
+		"SYSTEMD_READY=0",
+		"TAGS=:systemd:",
+		"SCSI_TPGS=1",
+		"SCSI_TYPE=disk",
+		"SCSI_VENDOR=NETAPP",
+		"SCSI_MODEL=LUN_C-Mode",
+		"SCSI_REVISION=9800",
+		"SCSI_IDENT_SERIAL=80Mh2$Kx-SG1",
+		"SCSI_IDENT_LUN_NAA_REGEXT=600a098038304d6832244b782d534731",
+		NULL,
+	},
+};
+
+static int bench_filter_property(void)
+{
+	struct bench_timer t = { 0 };
+	int i, n = 0;
+
+	while (udev_sd.property_list[n])
+		n++;
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < BATCH; i++)
+			if (filter_property(_conf, &udev_sd, 3, "ID_SERIAL")
+			    != MATCH_PROPERTY_BLIST_EXCEPT)
+				return -1;
+		timer_stop(&t);
+	}
+	bench_report("filter_property", n,
+		     (unsigned long long)t.reps * BATCH, &t);
+	return 0;
+}
+
+static int bench_get_cmdvec(void)
+{
+	static const char *const cmds[] = {
+		"show paths",
+		"show maps topology",
+		"show map mpatha format \"%n %w %d\"",
+		"reinstate path sdb",
+		"del map 3600a098038304d6832244b782d534731",
+	};
+	struct bench_timer t = { 0 };
+	char cmd[128];
+	vector v;
+	int i, r, nr_keys;
+
+	if (cli_init() != 0)
+		return -1;
+	nr_keys = VECTOR_SIZE(keys);
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < BATCH; i++) {
+			/* released at the end of each iteration */
+			ARENA_ON_STACK(arena, 1024);
+
+			strlcpy(cmd, cmds[i % ARRAY_SIZE(cmds)], sizeof(cmd));
+			r = get_cmdvec(cmd, &v, &arena);
+			if (r != 0) {
+				cli_exit();
+				return -1;
+			}
+		}
+		timer_stop(&t);
+	}
+	cli_exit();
+	bench_report("get_cmdvec", nr_keys,
+		     (unsigned long long)t.reps * BATCH, &t);
+	return 0;
+}
+
+static void wwid_nr(char *buf, size_t len, int n)
+{
+	snprintf(buf, len, "36001405%024x", n);
+}
+
+static int bench_lookup_wwid(void)
+{
+	char tmpdir[] = "/tmp/micro-test-XXXXXX";
+	char wwids_file[PATH_MAX], index_file[PATH_MAX];
+	struct wwids_index_hdr hdr;
+	struct bench_timer t = { 0 };
+	char wwid[WWID_SIZE];
+	int fd = -1, i, n, rc = -1;
+	FILE *f = NULL;
+
+	if (!mkdtemp(tmpdir))
+		return -1;
+	snprintf(wwids_file, sizeof(wwids_file), "%s/wwids", tmpdir);
+	wwids_index_name(index_file, sizeof(index_file), wwids_file);
+	f = fopen(wwids_file, "w+");
+	if (!f)
+		goto out;
+	fd = fileno(f);
+	fprintf(f, "%s", WWIDS_FILE_HEADER);
+	for (i = 0; i < NR_WWIDS; i++) {
+		wwid_nr(wwid, sizeof(wwid), i);
+		fprintf(f, "/%s/\n", wwid);
+	}
+	if (fflush(f) != 0)
+		goto out;
+
+	/* lookup_wwid() reads the file up to the wwid, do fewer lookups */
+	n = BATCH / 100;
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < n; i++) {
+			wwid_nr(wwid, sizeof(wwid), (i * 7919) % NR_WWIDS);
+			rewind(f);
+			if (lookup_wwid(f, wwid) != 1)
+				goto out;
+		}
+		timer_stop(&t);
+	}
+	bench_report("lookup_wwid", NR_WWIDS, (unsigned long long)t.reps * n,
+		     &t);
+
+	build_wwids_index(index_file, fd, f);
+	memset(&t, 0, sizeof(t));
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < BATCH; i++) {
+			wwid_nr(wwid, sizeof(wwid), (i * 7919) % NR_WWIDS);
+			if (lookup_wwid_index(index_file, fd, f, wwid,
+					      &hdr) != 1)
+				goto out;
+		}
+		timer_stop(&t);
+	}
+	bench_report("lookup_wwid_index", NR_WWIDS,
+		     (unsigned long long)t.reps * BATCH, &t);
+	rc = 0;
+out:
+	if (f)
+		fclose(f);
+	unlink(index_file);
+	unlink(wwids_file);
+	rmdir(tmpdir);
+	return rc;
+}
+
+static void enqueue(int prio, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	log_enqueue(prio, fmt, ap);
+	va_end(ap);
+}
+
+static int bench_log_enqueue(void)
+{
+	struct bench_timer t = { 0 };
+	struct logmsg msg;
+	int i, n;
+
+	if (log_init("micro-test", DEFAULT_AREA_SIZE) != 0)
+		return -1;
+	/* Don't fill the log area, dropping messages is cheaper */
+	n = la->nr_slots < BATCH ? la->nr_slots : BATCH;
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < n; i++)
+			enqueue(3, "%s: path state = %s", "sdb", "running");
+		timer_stop(&t);
+		while (log_dequeue(&msg) == 0)
+			;
+	}
+	log_close();
+	bench_report("log_enqueue", n, (unsigned long long)t.reps * n, &t);
+	return 0;
+}
+
+static int (*const benchmarks[])(void) = {
+	bench_vector_alloc_slot,
+	bench_vector_del_slot,
+	bench_strbuf,
+	bench_dmparser,
+	bench_vpd_pg83,
+	bench_hwe_regmatch,
+	bench_filter_property,
+	bench_get_cmdvec,
+	bench_lookup_wwid,
+	bench_log_enqueue,
+};
+
+int main(void)
+{
+	unsigned int i;
+	int ret = 0;
+	char *verb = getenv("MPATHTEST_VERBOSITY");
+
+	libmp_verbosity = verb && *verb ? atoi(verb) : 0;
+
+	_conf = bench_load_config("");
+	if (!_conf) {
+		fprintf(stderr, "failed to load configuration\n");
+		return 1;
+	}
+
+	bench_header();
+	for (i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+		if (benchmarks[i]() != 0) {
+			fprintf(stderr, "benchmark %u failed\n", i);
+			ret++;
+		}
+	}
+
+	free_config(_conf);
+	return ret;
+}
@@ -29,6 +29,7 @@
 
 struct multipath mp8, mp4, mp1, mp0, mp_null;
 struct path p8[8], p4[4], p1[1];
+struct path_ident id8[8], id4[4], id1[1];
 
 
 static void set_priority(struct path *pp, int *prio, int size)
@@ -54,7 +55,7 @@ static void set_tgt_node_name(struct path *pp, char **tgt_node_name, int size)
 	int i;
 
 	for (i = 0; i < size; i++) {
-		strcpy(pp[i].tgt_node_name, tgt_node_name[i]);
+		strcpy(pp[i].ident->tgt_node_name, tgt_node_name[i]);
 	}
 }
 
@@ -63,7 +64,7 @@ static void set_serial(struct path *pp, char **serial, int size)
 	int i;
 
 	for (i = 0; i < size; i++) {
-		strcpy(pp[i].serial, serial[i]);
+		strcpy(pp[i].ident->serial, serial[i]);
 	}
 }
 
@@ -74,15 +75,18 @@ static int setup(void **state)
 	for (i = 0; i < 8; i++) {
 		sprintf(p8[i].dev, "p8_%d", i);
 		sprintf(p8[i].dev_t, "8:%d", i);
+		p8[i].ident = &id8[i];
 		p8[i].state = PATH_UP;
 	}
 	for (i = 0; i < 4; i++) {
 		sprintf(p4[i].dev, "p4_%d", i);
 		sprintf(p4[i].dev_t, "4:%d", i);
+		p4[i].ident = &id4[i];
 		p4[i].state = PATH_UP;
 	}
 	sprintf(p1[0].dev, "p1_0");
 	sprintf(p1[0].dev_t, "4:0");
+	p1[0].ident = &id1[0];
 	p1[0].state = PATH_UP;
 	return 0;
 }
@@ -0,0 +1,208 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Tests for the prkeys file cache: keys set, cleared and compacted by
+ * this process, and changes of the file by others.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include "globals.c"
+
+/* I have to do this to get at the static functions */
+#include "../libmultipath/prkey.c"
+
+static char tmpdir[] = "/tmp/prkey-test.XXXXXX";
+static char prkeys_file[PATH_MAX];
+
+/* Like propsel.c, take the key from the prkeys file */
+int __wrap_select_reservation_key(struct config *conf, struct multipath *mp)
+{
+	uint64_t prkey = 0;
+	uint8_t sa_flags;
+
+	if (get_prkey(conf, mp, &prkey, &sa_flags) != 0)
+		prkey = 0;
+	put_be64(mp->reservation_key, prkey);
+	return 0;
+}
+
+static int count_lines(const char *prefix)
+{
+	char line[256];
+	FILE *f = fopen(prkeys_file, "r");
+	int n = 0;
+
+	assert_non_null(f);
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, prefix, strlen(prefix)))
+			n++;
+	fclose(f);
+	return n;
+}
+
+static void set_wwid(struct multipath *mpp, int i)
+{
+	snprintf(mpp->wwid, sizeof(mpp->wwid), "3600a0b800%06d", i);
+}
+
+static int setup(void **state)
+{
+	if (!mkdtemp(tmpdir))
+		return -1;
+	snprintf(prkeys_file, sizeof(prkeys_file), "%s/prkeys", tmpdir);
+	conf.prkeys_file = prkeys_file;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	cleanup_prkeys();
+	unlink(prkeys_file);
+	rmdir(tmpdir);
+	conf.prkeys_file = NULL;
+	return 0;
+}
+
+static int reset(void **state)
+{
+	cleanup_prkeys();
+	unlink(prkeys_file);
+	return 0;
+}
+
+static void test_set_get(void **state)
+{
+	struct multipath mpp = { .wwid = "" };
+	uint64_t prkey;
+	uint8_t sa_flags;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		set_wwid(&mpp, i);
+		assert_int_equal(set_prkey(&conf, &mpp, 0x1000 + i, i & 1), 0);
+	}
+	for (i = 0; i < 100; i++) {
+		set_wwid(&mpp, i);
+		assert_int_equal(get_prkey(&conf, &mpp, &prkey, &sa_flags), 0);
+		assert_int_equal(prkey, 0x1000 + i);
+		assert_int_equal(sa_flags, i & 1 ? MPATH_F_APTPL_MASK : 0);
+	}
+	set_wwid(&mpp, 100);
+	assert_int_not_equal(get_prkey(&conf, &mpp, &prkey, &sa_flags), 0);
+
+	/* changing a key rewrites its line */
+	set_wwid(&mpp, 7);
+	assert_int_equal(set_prkey(&conf, &mpp, 0xabc, 0), 0);
+	assert_int_equal(count_lines("0x"), 51);
+	assert_int_equal(count_lines("0X"), 49);
+
+	/* the file is read again, not the cache */
+	cleanup_prkeys();
+	assert_int_equal(get_prkey(&conf, &mpp, &prkey, &sa_flags), 0);
+	assert_int_equal(prkey, 0xabc);
+}
+
+static void test_clear(void **state)
+{
+	struct multipath mpp = { .wwid = "" };
+	uint64_t prkey;
+	uint8_t sa_flags;
+
+	set_wwid(&mpp, 1);
+	assert_int_equal(set_prkey(&conf, &mpp, 0x42, 0), 0);
+	assert_int_equal(set_prkey(&conf, &mpp, 0, 0), 0);
+	assert_int_not_equal(get_prkey(&conf, &mpp, &prkey, &sa_flags), 0);
+	assert_int_equal(count_lines("#x0000000000000042 "), 1);
+
+	/* setting it again reuses the line */
+	assert_int_equal(set_prkey(&conf, &mpp, 0x43, 0), 0);
+	assert_int_equal(get_prkey(&conf, &mpp, &prkey, &sa_flags), 0);
+	assert_int_equal(prkey, 0x43);
+	assert_int_equal(count_lines("0x"), 1);
+	assert_int_equal(count_lines("#x"), 0);
+}
+
+static void test_compaction(void **state)
+{
+	struct multipath mpp = { .wwid = "" };
+	uint64_t prkey;
+	uint8_t sa_flags;
+	int i;
+
+	for (i = 0; i < 2 * PRKEYS_COMPACT_MIN; i++) {
+		set_wwid(&mpp, i);
+		assert_int_equal(set_prkey(&conf, &mpp, 0x1000 + i, 0), 0);
+	}
+	for (i = 0; i < PRKEYS_COMPACT_MIN + 1; i++) {
+		set_wwid(&mpp, i);
+		assert_int_equal(set_prkey(&conf, &mpp, 0, 0), 0);
+	}
+	/* the cleared keys have been dropped */
+	assert_int_equal(count_lines("#x"), 0);
+	assert_int_equal(count_lines("0x"), PRKEYS_COMPACT_MIN - 1);
+	for (i = 0; i < 2 * PRKEYS_COMPACT_MIN; i++) {
+		set_wwid(&mpp, i);
+		if (i <= PRKEYS_COMPACT_MIN)
+			assert_int_not_equal(get_prkey(&conf, &mpp, &prkey,
+						       &sa_flags), 0);
+		else {
+			assert_int_equal(get_prkey(&conf, &mpp, &prkey,
+						   &sa_flags), 0);
+			assert_int_equal(prkey, 0x1000 + i);
+		}
+	}
+}
+
+static void test_external_change(void **state)
+{
+	struct multipath mpp = { .wwid = "" };
+	uint64_t prkey;
+	uint8_t sa_flags;
+	FILE *f;
+
+	set_wwid(&mpp, 1);
+	assert_int_equal(set_prkey(&conf, &mpp, 0x42, 0), 0);
+
+	/* another process adds lines, only the first one for a WWID counts */
+	f = fopen(prkeys_file, "a");
+	assert_non_null(f);
+	fprintf(f, "0x0000000000000099 3600a0b800000002\n");
+	fprintf(f, "0x0000000000000098 3600a0b800000002\n");
+	fprintf(f, "garbage\n");
+	fclose(f);
+
+	set_wwid(&mpp, 2);
+	assert_int_equal(get_prkey(&conf, &mpp, &prkey, &sa_flags), 0);
+	assert_int_equal(prkey, 0x99);
+	set_wwid(&mpp, 1);
+	assert_int_equal(get_prkey(&conf, &mpp, &prkey, &sa_flags), 0);
+	assert_int_equal(prkey, 0x42);
+}
+
+static int test_prkey(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_teardown(test_set_get, reset),
+		cmocka_unit_test_teardown(test_clear, reset),
+		cmocka_unit_test_teardown(test_compaction, reset),
+		cmocka_unit_test_teardown(test_external_change, reset),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_prkey();
+	return ret;
+}
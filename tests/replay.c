@@ -0,0 +1,476 @@
+/*
+ * Replay benchmark for the uevent pipeline.
+ *
+ * This program replays uevents recorded by multipathd (see "record uevents
+ * file" in multipathd(8)) through the batching of uevent_listen() and the
+ * merging and dispatching of uevent_dispatch(), without udev or devices.
+ * The batches are formed from the recorded times of receipt, the way
+ * uevent_listen() forms them with the configured uev_batch_* settings.
+ * The uevent trigger does the uevent lookups of multipathd's
+ * uev_trigger(), but not the path and map handling, which needs the
+ * daemon.
+ *
+ * Usage: replay-test [FILE ...]
+ *
+ * Without arguments, synthetic storms for 1000 and 10000 paths are
+ * generated and replayed: add uevents for all paths, change uevents for
+ * all paths, change uevents for all maps, and remove uevents for all
+ * paths.
+ *
+ * Results are written to stdout like those of the scale benchmark, with
+ * the number of uevents as the scale, followed by a comment line per
+ * recording with the merge statistics of the last repetition and the
+ * peak memory use of the process.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <cmocka.h>
+#include "structs.h"
+#include "config.h"
+#include "debug.h"
+#include "bench-lib.h"
+
+/* I have to do this to get at the static functions */
+#include "../libmultipath/uevent.c"
+
+#define PATHS_PER_MAP 4
+/* interval between synthetic uevents of a storm, in us */
+#define STORM_GAP_US 20
+
+static struct config *_conf;
+
+struct config *get_multipath_config(void)
+{
+	return _conf;
+}
+
+void put_multipath_config(void *arg)
+{}
+
+struct record {
+	struct timespec received;
+	unsigned long seqnum;
+	int nr_env;
+	/* "KEY=VALUE" strings */
+	char **env;
+};
+
+struct recording {
+	struct record *rec;
+	int nr;
+	/* records with too many or too long properties for a uevent */
+	int skipped;
+};
+
+struct replay_counts {
+	unsigned long maps;
+	unsigned long transports;
+	unsigned long paths;
+	unsigned long merged_paths;
+	unsigned long batches;
+	unsigned int max_batch;
+};
+
+static void free_recording(struct recording *r)
+{
+	int i, j;
+
+	for (i = 0; i < r->nr; i++) {
+		for (j = 0; j < r->rec[i].nr_env; j++)
+			free(r->rec[i].env[j]);
+		free(r->rec[i].env);
+	}
+	free(r->rec);
+	r->rec = NULL;
+	r->nr = 0;
+}
+
+static struct record *new_record(struct recording *r, const char *line)
+{
+	struct record *rec;
+	long sec, nsec;
+	unsigned long seqnum;
+
+	if (sscanf(line, "UEVENT %ld.%ld %lu", &sec, &nsec, &seqnum) != 3)
+		return NULL;
+	rec = realloc(r->rec, (r->nr + 1) * sizeof(*rec));
+	if (!rec)
+		return NULL;
+	r->rec = rec;
+	rec = &r->rec[r->nr++];
+	rec->received.tv_sec = sec;
+	rec->received.tv_nsec = nsec;
+	rec->seqnum = seqnum;
+	rec->nr_env = 0;
+	rec->env = NULL;
+	return rec;
+}
+
+static int add_env(struct record *rec, const char *line)
+{
+	char **env;
+
+	env = realloc(rec->env, (rec->nr_env + 1) * sizeof(*env));
+	if (!env)
+		return -1;
+	rec->env = env;
+	env[rec->nr_env] = strdup(line);
+	if (!env[rec->nr_env])
+		return -1;
+	rec->nr_env++;
+	return 0;
+}
+
+static int load_recording(const char *file, struct recording *r)
+{
+	struct record *rec = NULL;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int ret = -1;
+	FILE *f;
+
+	memset(r, 0, sizeof(*r));
+	f = fopen(file, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %m\n", file);
+		return -1;
+	}
+	len = getline(&line, &size, f);
+	if (len <= 0 ||
+	    strncmp(line, UEVENT_RECORD_HEADER, strlen(UEVENT_RECORD_HEADER))) {
+		fprintf(stderr, "%s: not a uevent record\n", file);
+		goto out;
+	}
+	while ((len = getline(&line, &size, f)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len == 0)
+			rec = NULL;
+		else if (!strncmp(line, "UEVENT ", 7)) {
+			rec = new_record(r, line);
+			if (!rec) {
+				fprintf(stderr, "%s: bad record \"%s\"\n",
+					file, line);
+				goto out;
+			}
+		} else if (rec && add_env(rec, line) != 0)
+			goto out;
+	}
+	ret = 0;
+out:
+	free(line);
+	fclose(f);
+	if (ret != 0)
+		free_recording(r);
+	return ret;
+}
+
+/* A synthetic storm, written as a recording to test the parser as well */
+static int write_storm(FILE *f, int nr_paths)
+{
+	struct timespec t = { .tv_sec = 1000, };
+	unsigned long seqnum = 1;
+	int phase, i, n;
+
+	fprintf(f, "%s\n", UEVENT_RECORD_HEADER);
+	for (phase = 0; phase < 4; phase++) {
+		n = phase == 2 ? nr_paths / PATHS_PER_MAP : nr_paths;
+		for (i = 0; i < n; i++) {
+			fprintf(f, "UEVENT %ld.%09ld %lu\n",
+				(long)t.tv_sec, t.tv_nsec, seqnum++);
+			if (phase == 2) {
+				fprintf(f, "ACTION=change\n"
+					"DEVPATH=/devices/virtual/block/dm-%d\n"
+					"SUBSYSTEM=block\nDEVTYPE=disk\n"
+					"MAJOR=253\nMINOR=%d\n"
+					"DM_NAME=mpath%d\n"
+					"DM_UUID=mpath-3600a098000000000%08d\n"
+					"DM_ACTION=PATH_FAILED\n\n",
+					i, i, i, i);
+			} else {
+				fprintf(f, "ACTION=%s\n"
+					"DEVPATH=/devices/platform/host0/target0:0:%d/0:0:%d:0/block/sd%d\n"
+					"SUBSYSTEM=block\nDEVTYPE=disk\n"
+					"MAJOR=%d\nMINOR=%d\n"
+					"ID_SERIAL=3600a098000000000%08d\n\n",
+					phase == 0 ? "add" :
+					phase == 1 ? "change" : "remove",
+					i, i, i, 8 + i / 4096, (i % 4096) * 16,
+					i / PATHS_PER_MAP);
+			}
+			t.tv_nsec += STORM_GAP_US * 1000;
+			normalize_timespec(&t);
+		}
+		t.tv_sec++;
+	}
+	return ferror(f) ? -1 : 0;
+}
+
+static int storm_recording(int nr_paths, struct recording *r)
+{
+	char file[] = "/tmp/replay-XXXXXX";
+	FILE *f;
+	int fd, ret = -1;
+
+	fd = mkstemp(file);
+	if (fd == -1)
+		return -1;
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		goto out;
+	}
+	ret = write_storm(f, nr_paths);
+	if (fclose(f) != 0)
+		ret = -1;
+	if (ret == 0)
+		ret = load_recording(file, r);
+out:
+	unlink(file);
+	return ret;
+}
+
+/* Like uevent_from_device(), with the environment in uev->envp */
+static struct uevent *make_uevent(const struct record *rec)
+{
+	struct uevent *uev;
+	size_t room = HOTPLUG_BUFFER_SIZE + OBJECT_SIZE, len;
+	char *p;
+	int i;
+
+	if (rec->nr_env >= HOTPLUG_NUM_ENVP)
+		return NULL;
+	uev = alloc_uevent();
+	if (!uev)
+		return NULL;
+	uev->udev = NULL;
+	uev->wwid = NULL;
+	uev->action = NULL;
+	uev->devpath = NULL;
+	uev->seqnum = rec->seqnum;
+	p = uev->buffer;
+	for (i = 0; i < rec->nr_env; i++) {
+		len = strlen(rec->env[i]) + 1;
+		if (len > room) {
+			free_uevent(uev);
+			return NULL;
+		}
+		memcpy(p, rec->env[i], len);
+		uev->envp[i] = p;
+		if (!strncmp(p, "ACTION=", 7))
+			uev->action = p + 7;
+		else if (!strncmp(p, "DEVPATH=", 8))
+			uev->devpath = p + 8;
+		p += len;
+		room -= len;
+	}
+	uev->envp[i] = NULL;
+	if (!uev->action || !uev->devpath) {
+		free_uevent(uev);
+		return NULL;
+	}
+	uev->kernel = strrchr(uev->devpath, '/');
+	uev->kernel = uev->kernel ? uev->kernel + 1 : uev->devpath;
+	return uev;
+}
+
+/* The uevent lookups of uev_trigger() in multipathd */
+static int replay_trigger(struct uevent *uev, void *arg)
+{
+	struct replay_counts *cnt = arg;
+	struct uevent *merged;
+	char *name, *action;
+
+	if (!strncmp(uev->kernel, "dm-", 3)) {
+		if (uevent_is_mpath(uev)) {
+			name = uevent_get_dm_name(uev);
+			action = uevent_get_dm_action(uev);
+			free(name);
+			free(action);
+			cnt->maps++;
+		}
+		return 0;
+	}
+	if (uevent_is_transport(uev)) {
+		cnt->transports++;
+		return 0;
+	}
+	list_for_each_entry(merged, &uev->merge_node, node) {
+		(void)uevent_get_major(merged);
+		(void)uevent_get_minor(merged);
+		cnt->merged_paths++;
+	}
+	(void)uevent_get_major(uev);
+	(void)uevent_get_minor(uev);
+	if (!strncmp(uev->action, "change", 6))
+		(void)uevent_path_digest(uev, "ID_SERIAL");
+	cnt->paths++;
+	return 0;
+}
+
+/* What uevent_dispatch() does with a batch from uevent_listen() */
+static void dispatch_batch(struct list_head *batch, unsigned int events,
+			   struct replay_counts *cnt)
+{
+	struct timespec start, end;
+	struct uev_lag lag = { .sum_us = 0, };
+	/* uevent_threads 1, dispatch in this thread */
+	struct uev_dispatcher d = { .threads = 1, };
+	unsigned int merged, filtered, discarded;
+	struct uevent *uev;
+
+	get_monotonic_time(&start);
+	list_for_each_entry(uev, batch, node)
+		uev->received = start;
+	merge_uevq(batch, &merged, &filtered, &discarded);
+	service_uevq(batch, &lag, &d);
+	get_monotonic_time(&end);
+	update_service_stats(events, merged, filtered, discarded, &lag,
+			     us_between(&start, &end));
+	cnt->batches++;
+	if (events > cnt->max_batch)
+		cnt->max_batch = events;
+}
+
+static void replay(const struct recording *r, struct replay_counts *cnt)
+{
+	const struct record *rec;
+	struct uev_burst burst;
+	struct uevent *uev;
+	LIST_HEAD(batch);
+	int i, wait;
+
+	memset(cnt, 0, sizeof(*cnt));
+	pthread_mutex_lock(&uev_stats_lock);
+	memset(&uev_stats, 0, sizeof(uev_stats));
+	pthread_mutex_unlock(&uev_stats_lock);
+	uevent_burst_init(&burst);
+	for (i = 0; i < r->nr; i++) {
+		rec = &r->rec[i];
+		uev = make_uevent(rec);
+		if (!uev)
+			continue;
+		list_add_tail(&uev->node, &batch);
+		wait = uevent_burst(&burst, &rec->received);
+		/* uevent_listen() polls for the next uevent for wait ms */
+		if (wait >= 0 && i + 1 < r->nr &&
+		    us_between(&rec->received, &r->rec[i + 1].received) <=
+		    (unsigned long)wait * 1000)
+			continue;
+		if (!list_empty(&batch))
+			dispatch_batch(&batch, burst.events, cnt);
+		uevent_burst_init(&burst);
+	}
+	if (!list_empty(&batch))
+		dispatch_batch(&batch, burst.events, cnt);
+}
+
+static int count_valid(struct recording *r)
+{
+	struct uevent *uev;
+	int i, n = 0;
+
+	r->skipped = 0;
+	for (i = 0; i < r->nr; i++) {
+		uev = make_uevent(&r->rec[i]);
+		if (uev) {
+			n++;
+			free_uevent(uev);
+		} else
+			r->skipped++;
+	}
+	return n;
+}
+
+static int run_replay(const char *name, struct recording *r)
+{
+	struct bench_timer t = { 0 };
+	struct replay_counts cnt;
+	struct uevent_stats st;
+	struct rusage ru;
+	int n = count_valid(r);
+
+	if (n == 0) {
+		fprintf(stderr, "%s: no uevents to replay\n", name);
+		return 1;
+	}
+	my_uev_trigger = replay_trigger;
+	my_trigger_data = &cnt;
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		replay(r, &cnt);
+		timer_stop(&t);
+	}
+	bench_report(name, n, (unsigned long long)t.reps * n, &t);
+
+	uevent_get_stats(&st);
+	getrusage(RUSAGE_SELF, &ru);
+	printf("# %s: uevents %d skipped %d batches %lu max_batch %u merged %lu filtered %lu discarded %lu max_lag_us %lu max_rss_kb %ld\n",
+	       name, n, r->skipped, cnt.batches, cnt.max_batch, st.merged,
+	       st.filtered, st.discarded, st.lag_max_us, ru.ru_maxrss);
+	fflush(stdout);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int default_storms[] = { 1000, 10000 };
+	struct recording r;
+	char name[64];
+	int i, ret = 0;
+	char *verb = getenv("MPATHTEST_VERBOSITY");
+
+	/* The code under test logs at level 3 for every uevent */
+	libmp_verbosity = verb && *verb ? atoi(verb) : 0;
+
+	_conf = bench_load_config("\tuid_attrs \"sd:ID_SERIAL\"\n");
+	if (!_conf) {
+		fprintf(stderr, "failed to load configuration\n");
+		return 1;
+	}
+
+	bench_header();
+	if (argc > 1) {
+		for (i = 1; i < argc; i++) {
+			if (load_recording(argv[i], &r) != 0) {
+				ret++;
+				continue;
+			}
+			ret += run_replay(basename(argv[i]), &r);
+			free_recording(&r);
+		}
+	} else {
+		for (i = 0; i < (int)ARRAY_SIZE(default_storms); i++) {
+			if (storm_recording(default_storms[i], &r) != 0) {
+				fprintf(stderr, "failed to generate storm\n");
+				ret++;
+				continue;
+			}
+			snprintf(name, sizeof(name), "replay_storm_%d",
+				 default_storms[i]);
+			ret += run_replay(name, &r);
+			free_recording(&r);
+		}
+	}
+
+	cleanup_uevent_pool();
+	free_config(_conf);
+	return ret;
+}
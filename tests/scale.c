@@ -0,0 +1,594 @@
+/*
+ * Scale benchmarks for the multipathd hot paths.
+ *
+ * This program fabricates N paths and N / PATHS_PER_MAP maps in memory,
+ * without any devices, and measures how long the code that multipathd
+ * runs per path or per map takes at different scales. dm and sysfs
+ * access is mocked, like in the unit tests.
+ *
+ * Usage: scale-test [N ...]    (default: 1000 10000 50000)
+ *
+ * Results are written to stdout, one line per benchmark and scale, as
+ * tab-separated values: benchmark, scale (number of paths), number of
+ * operations, total time in ns, ns per operation, and allocations per
+ * operation.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <cmocka.h>
+#include "structs.h"
+#include "structs_vec.h"
+#include "config.h"
+#include "pgpolicies.h"
+#include "print.h"
+#include "check_sched.h"
+#include "strbuf.h"
+#include "util.h"
+#include "debug.h"
+#include "bench-lib.h"
+
+/* I have to do this to get at the static functions */
+#include "../libmultipath/alias.c"
+#include "../libmultipath/uevent.c"
+
+#define PATHS_PER_MAP 4
+/* checker interval, in ticks */
+#define CHECKINT 5
+/* lookup_binding() reads the whole file, limit the number of lookups */
+#define MAX_FILE_LOOKUPS 100
+
+static struct config *_conf;
+
+struct config *get_multipath_config(void)
+{
+	return _conf;
+}
+
+void put_multipath_config(void *arg)
+{}
+
+/* The maps don't exist in dm, so every alias is free */
+int __wrap_dm_map_present(const char *str)
+{
+	return 0;
+}
+
+static const struct hw_id {
+	const char *vendor;
+	const char *product;
+} hw_ids[] = {
+	{ "NETAPP", "LUN C-Mode" },
+	{ "DGC", "VRAID" },
+	{ "EMC", "SYMMETRIX" },
+	{ "IBM", "2145" },
+	{ "HITACHI", "OPEN-V" },
+	{ "3PARdata", "VV" },
+	{ "PURE", "FlashArray" },
+	/* no hwtable entry */
+	{ "LIO-ORG", "scale-test" },
+};
+
+struct scale_env {
+	int scale;
+	int nr_maps;
+	vector pathvec;
+	vector mpvec;
+	/* the paths of every map, in mpvec order */
+	vector *map_paths;
+	struct vectors vecs;
+};
+
+static void report(const char *name, const struct scale_env *env,
+		   unsigned long long ops, const struct bench_timer *t)
+{
+	bench_report(name, env->scale, ops, t);
+}
+
+static void map_wwid(char *buf, size_t len, int map)
+{
+	snprintf(buf, len, "36001405%024x", map);
+}
+
+static void free_env(struct scale_env *env)
+{
+	struct multipath *mpp;
+	int i;
+
+	if (env->map_paths) {
+		for (i = 0; i < env->nr_maps; i++)
+			vector_free(env->map_paths[i]);
+		free(env->map_paths);
+	}
+	vector_foreach_slot(env->mpvec, mpp, i)
+		free_multipath(mpp, KEEP_PATHS);
+	vector_free(env->mpvec);
+	free_pathvec(env->pathvec, FREE_PATHS);
+}
+
+/* Give every map the paths it had before group_paths() */
+static int reset_map_paths(struct scale_env *env)
+{
+	struct multipath *mpp;
+	struct path *pp;
+	int i, j;
+
+	vector_foreach_slot(env->mpvec, mpp, i) {
+		free_pgvec(mpp->pg, KEEP_PATHS);
+		mpp->pg = NULL;
+		vector_free(mpp->paths);
+		mpp->paths = vector_alloc();
+		if (!mpp->paths)
+			return -1;
+		vector_foreach_slot(env->map_paths[i], pp, j) {
+			if (!vector_alloc_slot(mpp->paths))
+				return -1;
+			vector_set_slot(mpp->paths, pp);
+		}
+	}
+	return 0;
+}
+
+static int init_env(struct scale_env *env, int scale)
+{
+	struct multipath *mpp;
+	struct path *pp;
+	char alias[32];
+	int i;
+
+	memset(env, 0, sizeof(*env));
+	env->scale = scale;
+	env->nr_maps = (scale + PATHS_PER_MAP - 1) / PATHS_PER_MAP;
+	env->pathvec = vector_alloc();
+	env->mpvec = vector_alloc();
+	env->map_paths = calloc(env->nr_maps, sizeof(*env->map_paths));
+	if (!env->pathvec || !env->mpvec || !env->map_paths)
+		goto out;
+	env->vecs.pathvec = env->pathvec;
+	env->vecs.mpvec = env->mpvec;
+
+	for (i = 0; i < env->nr_maps; i++) {
+		mpp = alloc_multipath();
+		if (!mpp)
+			goto out;
+		if (!vector_alloc_slot(env->mpvec)) {
+			free_multipath(mpp, KEEP_PATHS);
+			goto out;
+		}
+		vector_set_slot(env->mpvec, mpp);
+		map_wwid(mpp->wwid, sizeof(mpp->wwid), i);
+		snprintf(alias, sizeof(alias), "mpath%d", i);
+		mpp->alias = strdup(alias);
+		if (!mpp->alias)
+			goto out;
+		mpp->pgpolicy = GROUP_BY_PRIO;
+		mpp->pgpolicyfn = group_by_prio;
+		env->map_paths[i] = vector_alloc();
+		if (!env->map_paths[i])
+			goto out;
+	}
+
+	for (i = 0; i < scale; i++) {
+		const struct hw_id *hw = &hw_ids[i % ARRAY_SIZE(hw_ids)];
+		vector mp_paths;
+
+		pp = alloc_path();
+		if (!pp)
+			goto out;
+		if (!vector_alloc_slot(env->pathvec)) {
+			free_path(pp);
+			goto out;
+		}
+		vector_set_slot(env->pathvec, pp);
+		snprintf(pp->dev, sizeof(pp->dev), "sd%d", i);
+		snprintf(pp->dev_t, sizeof(pp->dev_t), "%d:%d",
+			 8 + i / 256, i % 256);
+		map_wwid(pp->wwid, sizeof(pp->wwid), i / PATHS_PER_MAP);
+		strlcpy(pp->ident->vendor_id, hw->vendor,
+			sizeof(pp->ident->vendor_id));
+		strlcpy(pp->ident->product_id, hw->product,
+			sizeof(pp->ident->product_id));
+		strlcpy(pp->ident->rev, "0001", sizeof(pp->ident->rev));
+		pp->state = PATH_UP;
+		pp->chkrstate = PATH_UP;
+		pp->priority = i % PATHS_PER_MAP < PATHS_PER_MAP / 2 ? 50 : 10;
+
+		mpp = VECTOR_SLOT(env->mpvec, i / PATHS_PER_MAP);
+		pp->mpp = mpp;
+		mp_paths = env->map_paths[i / PATHS_PER_MAP];
+		if (!vector_alloc_slot(mp_paths))
+			goto out;
+		vector_set_slot(mp_paths, pp);
+	}
+
+	if (reset_map_paths(env) != 0)
+		goto out;
+	vector_foreach_slot(env->mpvec, mpp, i)
+		if (group_paths(mpp, 0) != 0)
+			goto out;
+	return 0;
+out:
+	free_env(env);
+	return -1;
+}
+
+/*
+ * check_path() lives in multipathd and can't be linked here. Measure the
+ * per-tick cost of the checker loop instead: finding the paths that are
+ * due, and rescheduling them.
+ */
+static int bench_checker_tick(struct scale_env *env)
+{
+	struct bench_timer t = { 0 };
+	struct path *pp;
+	vector due;
+	int i;
+
+	due = vector_alloc();
+	if (!due)
+		return -1;
+	init_check_sched();
+	vector_foreach_slot(env->pathvec, pp, i)
+		schedule_path_check(pp, 1 + i % CHECKINT);
+
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		if (get_due_paths(1, due) < 0) {
+			end_due_paths();
+			vector_free(due);
+			return -1;
+		}
+		for (i = 0; i < VECTOR_SIZE(due); i++) {
+			pp = VECTOR_SLOT(due, i);
+			if (pp)
+				schedule_path_check(pp, CHECKINT);
+		}
+		end_due_paths();
+		timer_stop(&t);
+		vector_reset(due);
+	}
+	vector_free(due);
+	vector_foreach_slot(env->pathvec, pp, i)
+		unschedule_path_check(pp);
+	report("checker_tick", env, t.reps, &t);
+	return 0;
+}
+
+/*
+ * coalesce_paths() needs a running device-mapper. Measure the path
+ * grouping it does for every map.
+ */
+static int bench_group_paths(struct scale_env *env)
+{
+	struct bench_timer t = { 0 };
+	struct multipath *mpp;
+	int i;
+
+	while (!timer_done(&t)) {
+		if (reset_map_paths(env) != 0)
+			return -1;
+		timer_start(&t);
+		vector_foreach_slot(env->mpvec, mpp, i)
+			if (group_paths(mpp, 0) != 0)
+				return -1;
+		timer_stop(&t);
+	}
+	report("group_paths", env, (unsigned long long)t.reps * env->nr_maps,
+	       &t);
+	return 0;
+}
+
+static void free_uevents(struct list_head *tmpq)
+{
+	struct uevent *uev, *tmp, *merged, *mtmp;
+
+	list_for_each_entry_safe(uev, tmp, tmpq, node) {
+		list_for_each_entry_safe(merged, mtmp, &uev->merge_node, node) {
+			list_del_init(&merged->node);
+			free_uevent(merged);
+		}
+		list_del_init(&uev->node);
+		free_uevent(uev);
+	}
+}
+
+/* An "add" uevent for every path, like after a storage rescan */
+static int queue_uevents(const struct scale_env *env, struct list_head *tmpq)
+{
+	struct uevent *uev;
+	struct path *pp;
+	char *p;
+	size_t len;
+	int i;
+
+	vector_foreach_slot(env->pathvec, pp, i) {
+		uev = alloc_uevent();
+		if (!uev)
+			return -1;
+		uev->udev = NULL;
+		uev->devpath = NULL;
+		uev->wwid = NULL;
+		uev->seqnum = i;
+
+		p = uev->buffer;
+		len = HOTPLUG_BUFFER_SIZE + OBJECT_SIZE;
+		uev->action = p;
+		p += snprintf(p, len, "add") + 1;
+		uev->kernel = p;
+		p += snprintf(p, len - (p - uev->buffer), "%s", pp->dev) + 1;
+		uev->envp[0] = p;
+		snprintf(p, len - (p - uev->buffer), "ID_SERIAL=%s", pp->wwid);
+		list_add_tail(&uev->node, tmpq);
+	}
+	return 0;
+}
+
+static int bench_uevent_merge(struct scale_env *env)
+{
+	struct bench_timer t = { 0 };
+	unsigned int merged, filtered, discarded;
+	LIST_HEAD(tmpq);
+
+	while (!timer_done(&t)) {
+		if (queue_uevents(env, &tmpq) != 0) {
+			free_uevents(&tmpq);
+			return -1;
+		}
+		timer_start(&t);
+		merge_uevq(&tmpq, &merged, &filtered, &discarded);
+		timer_stop(&t);
+		free_uevents(&tmpq);
+	}
+	report("uevent_merge", env, (unsigned long long)t.reps * env->scale,
+	       &t);
+	return 0;
+}
+
+static int bench_find_hwe(struct scale_env *env)
+{
+	struct bench_timer t = { 0 };
+	struct path *pp;
+	vector hwes;
+	int i;
+
+	hwes = vector_alloc();
+	if (!hwes)
+		return -1;
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		vector_foreach_slot(env->pathvec, pp, i) {
+			find_hwe(_conf->hwtable, pp->ident->vendor_id,
+				 pp->ident->product_id, pp->ident->rev, hwes);
+			vector_reset(hwes);
+		}
+		timer_stop(&t);
+	}
+	vector_free(hwes);
+	report("find_hwe", env, (unsigned long long)t.reps * env->scale, &t);
+	return 0;
+}
+
+static FILE *write_bindings(const struct scale_env *env)
+{
+	STRBUF_ON_STACK(buf);
+	struct multipath *mpp;
+	FILE *f;
+	int i;
+
+	f = tmpfile();
+	if (!f)
+		return NULL;
+	vector_foreach_slot(env->mpvec, mpp, i) {
+		reset_strbuf(&buf);
+		if (format_devname(&buf, i + 1) < 0 ||
+		    fprintf(f, "mpath%s %s\n", get_strbuf_str(&buf),
+			    mpp->wwid) < 0) {
+			fclose(f);
+			return NULL;
+		}
+	}
+	if (fflush(f) != 0) {
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/* Look up the bindings of maps spread over the whole file */
+static const char *lookup_wwid(const struct scale_env *env, int n)
+{
+	struct multipath *mpp;
+
+	mpp = VECTOR_SLOT(env->mpvec, (n * 7919L) % env->nr_maps);
+	return mpp->wwid;
+}
+
+static int bench_lookup_binding(struct scale_env *env)
+{
+	struct bench_timer t = { 0 };
+	int i, n, rc = -1;
+	char *alias;
+	FILE *f;
+
+	f = write_bindings(env);
+	if (!f)
+		return -1;
+
+	n = env->nr_maps < MAX_FILE_LOOKUPS ? env->nr_maps : MAX_FILE_LOOKUPS;
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < n; i++) {
+			if (lookup_binding(f, lookup_wwid(env, i), &alias,
+					   "mpath", 1) != 0)
+				goto out;
+			free(alias);
+		}
+		timer_stop(&t);
+	}
+	report("lookup_binding", env, (unsigned long long)t.reps * n, &t);
+
+	memset(&t, 0, sizeof(t));
+	n = env->nr_maps;
+	if (update_bindings_cache("scale-test-bindings", fileno(f), f) != 0)
+		goto out;
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		for (i = 0; i < n; i++) {
+			if (lookup_cached_binding(lookup_wwid(env, i), &alias,
+						  "mpath", 1) != 0)
+				goto out;
+			free(alias);
+		}
+		timer_stop(&t);
+	}
+	report("lookup_cached_binding", env, (unsigned long long)t.reps * n,
+	       &t);
+	rc = 0;
+out:
+	clear_bindings_cache(&bindings_cache);
+	fclose(f);
+	return rc;
+}
+
+/* Like "multipathd show topology" */
+static int bench_print_topology(struct scale_env *env)
+{
+	struct bench_timer t = { 0 };
+	STRBUF_ON_STACK(buf);
+	struct multipath *mpp;
+	fieldwidth_t *width __attribute__((cleanup(cleanup_free_ptr))) = NULL;
+	int i;
+
+	if (!(width = alloc_path_layout()))
+		return -1;
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		get_path_layout_fmt(env->pathvec, 0, PRINT_PATH_INDENT, width);
+		if (reserve_topology_strbuf(&buf, &env->vecs, false) < 0)
+			return -1;
+		vector_foreach_slot(env->mpvec, mpp, i)
+			if (snprint_multipath_topology(&buf, mpp, 2,
+						       width) < 0)
+				return -1;
+		timer_stop(&t);
+		reset_strbuf(&buf);
+	}
+	report("print_topology", env, (unsigned long long)t.reps * env->nr_maps,
+	       &t);
+
+	memset(&t, 0, sizeof(t));
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		if (snprint_multipath_topology_json(&buf, &env->vecs) < 0)
+			return -1;
+		timer_stop(&t);
+		reset_strbuf(&buf);
+	}
+	report("print_topology_json", env,
+	       (unsigned long long)t.reps * env->nr_maps, &t);
+	return 0;
+}
+
+/* Like "multipathd show paths" */
+static int bench_print_paths(struct scale_env *env)
+{
+	struct bench_timer t = { 0 };
+	STRBUF_ON_STACK(buf);
+	struct path *pp;
+	fieldwidth_t *width __attribute__((cleanup(cleanup_free_ptr))) = NULL;
+	int i;
+
+	if (!(width = alloc_path_layout()))
+		return -1;
+	while (!timer_done(&t)) {
+		timer_start(&t);
+		get_path_layout_fmt(env->pathvec, 1, PRINT_PATH_CHECKER, width);
+		if (snprint_path_header(&buf, PRINT_PATH_CHECKER, width) < 0)
+			return -1;
+		vector_foreach_slot(env->pathvec, pp, i)
+			if (snprint_path(&buf, PRINT_PATH_CHECKER, pp,
+					 width) < 0)
+				return -1;
+		timer_stop(&t);
+		reset_strbuf(&buf);
+	}
+	report("print_paths", env, (unsigned long long)t.reps * env->scale, &t);
+	return 0;
+}
+
+static int (*const benchmarks[])(struct scale_env *) = {
+	bench_checker_tick,
+	bench_group_paths,
+	bench_uevent_merge,
+	bench_find_hwe,
+	bench_lookup_binding,
+	bench_print_topology,
+	bench_print_paths,
+};
+
+static int run_scale(int scale)
+{
+	struct scale_env env;
+	unsigned int i;
+	int ret = 0;
+
+	if (init_env(&env, scale) != 0) {
+		fprintf(stderr, "failed to set up %d paths\n", scale);
+		return 1;
+	}
+	for (i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+		if (benchmarks[i](&env) != 0) {
+			fprintf(stderr, "benchmark %u failed for %d paths\n",
+				i, scale);
+			ret++;
+		}
+	}
+	free_env(&env);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int default_scales[] = { 1000, 10000, 50000 };
+	int i, scale, ret = 0;
+	char *verb = getenv("MPATHTEST_VERBOSITY");
+
+	/* The code under test logs at level 3 for every path */
+	libmp_verbosity = verb && *verb ? atoi(verb) : 0;
+
+	_conf = bench_load_config("\tuid_attrs \"sd:ID_SERIAL\"\n");
+	if (!_conf) {
+		fprintf(stderr, "failed to load configuration\n");
+		return 1;
+	}
+
+	bench_header();
+	if (argc > 1) {
+		for (i = 1; i < argc; i++) {
+			scale = atoi(argv[i]);
+			if (scale <= 0) {
+				fprintf(stderr, "invalid scale: %s\n", argv[i]);
+				ret++;
+				continue;
+			}
+			ret += run_scale(scale);
+		}
+	} else {
+		for (i = 0; i < (int)ARRAY_SIZE(default_scales); i++)
+			ret += run_scale(default_scales[i]);
+	}
+
+	free_config(_conf);
+	return ret;
+}
@@ -0,0 +1,178 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+#include "globals.c"
+#include "../multipathd/snapshot.c"
+
+static int renders;
+
+int render_snapshot_reply(int id, char **reply, int *len,
+			  struct vectors *vecs)
+{
+	renders++;
+	*reply = strdup("reply");
+	if (!*reply)
+		return 1;
+	*len = sizeof("reply");
+	return 0;
+}
+
+static void vecs_lock_released(void *arg)
+{
+	note_topology_vectors(arg);
+}
+
+static struct vectors vecs;
+static struct path path;
+
+static int setup(void **state)
+{
+	rcu_register_thread();
+	init_lock(&vecs.lock);
+	set_release_hook(&vecs.lock, vecs_lock_released, &vecs);
+	vecs.pathvec = vector_alloc();
+	vecs.mpvec = vector_alloc();
+	if (!vecs.pathvec || !vecs.mpvec)
+		return -1;
+	/* multipathd has set up the vectors */
+	lock(&vecs.lock);
+	unlock(&vecs.lock);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	invalidate_topology_snapshot();
+	rcu_barrier();
+	vector_free(vecs.pathvec);
+	vector_free(vecs.mpvec);
+	destroy_lock(&vecs.lock);
+	rcu_unregister_thread();
+	return 0;
+}
+
+/* Render the reply like a CLI command that doesn't find a current one */
+static void render(void)
+{
+	char *reply = NULL;
+	int len = 0;
+
+	renders = 0;
+	lock_shared(&vecs.lock);
+	assert_int_equal(render_topology_snapshot(&vecs, SNAPSHOT_PATHS,
+						  &reply, &len), 0);
+	unlock(&vecs.lock);
+	assert_int_equal(renders, 1);
+	assert_string_equal(reply, "reply");
+	free(reply);
+}
+
+static bool snapshot_current(void)
+{
+	char *reply = NULL;
+	int len = 0;
+
+	if (get_snapshot_reply(&vecs, SNAPSHOT_PATHS, &reply, &len) != 0)
+		return false;
+	assert_int_equal(len, sizeof("reply"));
+	assert_string_equal(reply, "reply");
+	free(reply);
+	return true;
+}
+
+/* A checker tick takes the lock exclusively, but changes nothing */
+static void test_unchanged_tick(void **state)
+{
+	render();
+	assert_true(snapshot_current());
+
+	lock(&vecs.lock);
+	unlock(&vecs.lock);
+	lock_shared(&vecs.lock);
+	unlock(&vecs.lock);
+	lock(&vecs.lock);
+	unlock(&vecs.lock);
+
+	assert_true(snapshot_current());
+	/* not rendered again */
+	assert_int_equal(renders, 1);
+}
+
+static void test_path_added(void **state)
+{
+	render();
+	lock(&vecs.lock);
+	assert_true(vector_alloc_slot(vecs.pathvec));
+	vector_set_slot(vecs.pathvec, &path);
+	unlock(&vecs.lock);
+	assert_false(snapshot_current());
+
+	render();
+	lock(&vecs.lock);
+	vector_del_slot(vecs.pathvec, 0);
+	unlock(&vecs.lock);
+	assert_false(snapshot_current());
+}
+
+static void test_state_changed(void **state)
+{
+	render();
+	lock(&vecs.lock);
+	topology_changed();
+	unlock(&vecs.lock);
+	assert_false(snapshot_current());
+
+	/* rendered again, and current until the next change */
+	render();
+	assert_true(snapshot_current());
+}
+
+static void test_partial(void **state)
+{
+	char *reply = NULL;
+	int len = 0;
+
+	lock(&vecs.lock);
+	publish_partial_snapshot(&vecs, "discovering paths");
+	assert_true(vector_alloc_slot(vecs.pathvec));
+	vector_set_slot(vecs.pathvec, &path);
+	unlock(&vecs.lock);
+	/* used regardless of the generation, until invalidated */
+	assert_int_equal(get_snapshot_reply(&vecs, SNAPSHOT_PATHS,
+					    &reply, &len), 0);
+	assert_string_equal(reply,
+			    "partial state, configure is discovering paths\n"
+			    "reply");
+	free(reply);
+	invalidate_topology_snapshot();
+	assert_false(snapshot_current());
+	vector_del_slot(vecs.pathvec, 0);
+}
+
+static int test_snapshot(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_unchanged_tick),
+		cmocka_unit_test(test_path_added),
+		cmocka_unit_test(test_state_changed),
+		cmocka_unit_test(test_partial),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_snapshot();
+	return ret;
+}
@@ -384,6 +384,29 @@ static void test_fill_strbuf(void **state)
 	free(p);
 }
 
+static void test_reserve_strbuf(void **state)
+{
+	STRBUF_ON_STACK(buf);
+	const char str[] = "hello my dear!\n";
+	size_t sz;
+	int i;
+
+	assert_int_equal(reserve_strbuf(&buf, -1), -EINVAL);
+	assert_int_equal(reserve_strbuf(&buf, 1000), 0);
+	sz = buf.size;
+	assert_in_range(sz, 1001, SIZE_MAX);
+	assert_int_equal(get_strbuf_len(&buf), 0);
+	assert_string_equal(get_strbuf_str(&buf), "");
+
+	for (i = 0; (i + 1) * (sizeof(str) - 1) < 1000; i++)
+		assert_int_equal(append_strbuf_str(&buf, str), sizeof(str) - 1);
+	assert_int_equal(buf.size, sz);
+
+	/* reserving less than available space is a no-op */
+	assert_int_equal(reserve_strbuf(&buf, 1), 0);
+	assert_int_equal(buf.size, sz);
+}
+
 static int test_strbuf(void)
 {
 	const struct CMUnitTest tests[] = {
@@ -397,6 +420,7 @@ static int test_strbuf(void)
 		cmocka_unit_test(test_print_strbuf),
 		cmocka_unit_test(test_truncate_strbuf),
 		cmocka_unit_test(test_fill_strbuf),
+		cmocka_unit_test(test_reserve_strbuf),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
@@ -0,0 +1,87 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+#include "strpool.h"
+#include "globals.c"
+
+static void test_strpool_equal(void **state)
+{
+	char buf[] = "service-time 0";
+	const char *a, *b, *c;
+
+	a = strpool_get("service-time 0");
+	b = strpool_get(buf);
+	c = strpool_get("round-robin 0");
+	assert_ptr_not_equal(a, NULL);
+	assert_ptr_not_equal(c, NULL);
+	assert_ptr_equal(a, b);
+	assert_ptr_not_equal(a, c);
+	assert_ptr_not_equal(a, buf);
+	assert_string_equal(a, buf);
+	strpool_put(a);
+	strpool_put(b);
+	strpool_put(c);
+}
+
+static void test_strpool_getn(void **state)
+{
+	const char *a, *b;
+
+	a = strpool_getn("queue-length 0 1", 14);
+	b = strpool_get("queue-length 0");
+	assert_string_equal(a, "queue-length 0");
+	assert_ptr_equal(a, b);
+	strpool_put(a);
+	strpool_put(b);
+	/* a prefix is a different string */
+	a = strpool_getn("queue-length 0", 12);
+	b = strpool_get("queue-length 0");
+	assert_string_equal(a, "queue-length");
+	assert_ptr_not_equal(a, b);
+	strpool_put(a);
+	strpool_put(b);
+}
+
+static void test_strpool_ref(void **state)
+{
+	const char *a, *b;
+
+	a = strpool_get("1 alua");
+	b = strpool_ref(a);
+	assert_ptr_equal(a, b);
+	strpool_put(a);
+	/* still referenced by b */
+	assert_string_equal(b, "1 alua");
+	assert_ptr_equal(strpool_get("1 alua"), b);
+	strpool_put(b);
+	strpool_put(b);
+	assert_ptr_equal(strpool_get(NULL), NULL);
+	strpool_put(NULL);
+}
+
+static int test_strpool(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_strpool_equal),
+		cmocka_unit_test(test_strpool_getn),
+		cmocka_unit_test(test_strpool_ref),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_strpool();
+	return ret;
+}
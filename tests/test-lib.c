@@ -13,6 +13,7 @@
 #include "discovery.h"
 #include "propsel.h"
 #include "test-lib.h"
+#include "count-lib.h"
 
 const int default_mask = (DI_SYSFS|DI_BLACKLIST|DI_WWID|DI_CHECKER|DI_PRIO);
 const char default_devnode[] = "sdxTEST";
@@ -41,6 +42,7 @@ static const char _mocked_filename[] = "mocked_path";
 int __wrap_open(const char *path, int flags, int mode)
 {
 	condlog(4, "%s: %s", __func__, path);
+	count_event(CNT_OPEN, 1);
 
 	if (!strcmp(path, _mocked_filename))
 		return 111;
@@ -137,6 +139,7 @@ char *__wrap_udev_device_get_sysattr_value(struct udev_device *ud,
 	char *val  = mock_ptr_type(char *);
 
 	condlog(5, "%s: %s->%s", __func__, attr, val);
+	count_event(CNT_READ, 1);
 	return val;
 }
 
@@ -177,6 +180,20 @@ ssize_t __wrap_sysfs_attr_get_value(struct udev_device *dev,
 	char *val  = mock_ptr_type(char *);
 
 	condlog(5, "%s: %s", __func__, val);
+	count_event(CNT_READ, 1);
+	strlcpy(value, val, sz);
+	return strlen(value);
+}
+
+ssize_t __wrap_sysfs_attr_fd_get_value(struct sysfs_attr_fd *attr,
+				       struct udev_device *dev,
+				       const char *attr_name,
+				       char *value, size_t sz)
+{
+	char *val  = mock_ptr_type(char *);
+
+	condlog(5, "%s: %s", __func__, val);
+	count_event(CNT_READ, 1);
 	strlcpy(value, val, sz);
 	return strlen(value);
 }
@@ -212,9 +229,9 @@ struct mocked_path *fill_mocked_path(struct mocked_path *mp,
 struct mocked_path *mocked_path_from_path(struct mocked_path *mp,
 					  const struct path *pp)
 {
-	mp->vendor = pp->vendor_id;
-	mp->product = pp->product_id;
-	mp->rev = pp->rev;
+	mp->vendor = pp->ident->vendor_id;
+	mp->product = pp->ident->product_id;
+	mp->rev = pp->ident->rev;
 	mp->wwid = pp->wwid;
 	mp->devnode = pp->dev;
 	mp->flags = (prio_selected(&pp->prio) ? 0 : NEED_SELECT_PRIO) |
@@ -276,7 +293,7 @@ void mock_pathinfo(int mask, const struct mocked_path *mp)
 
 	/* path_offline */
 	will_return(__wrap_udev_device_get_subsystem, "scsi");
-	will_return(__wrap_sysfs_attr_get_value, "running");
+	will_return(__wrap_sysfs_attr_fd_get_value, "running");
 
 	if (mask & DI_NOIO)
 		return;
@@ -317,6 +334,21 @@ void mock_store_pathinfo(int mask,  const struct mocked_path *mp)
 	mock_pathinfo(mask, mp);
 }
 
+/*
+ * pathinfo() of a SCSI device opens it once, and reads the hidden,
+ * vendor, product, rev and state attributes, the tgt_nodename, and the
+ * timeout for the checker and the prioritizer. Allocations aren't
+ * limited yet.
+ */
+static const struct test_counts pathinfo_budget = {
+	.n = {
+		[CNT_ALLOCS] = COUNT_UNLIMITED,
+		[CNT_ALLOC_BYTES] = COUNT_UNLIMITED,
+		[CNT_OPEN] = 1,
+		[CNT_READ] = 8,
+	},
+};
+
 struct path *__mock_path(vector pathvec,
 			 const char *vnd, const char *prd,
 			 const char *rev, const char *wwid,
@@ -332,7 +364,9 @@ struct path *__mock_path(vector pathvec,
 	mock_store_pathinfo(mask, &mop);
 
 	conf = get_multipath_config();
+	counts_reset();
 	r = store_pathinfo(pathvec, conf, (void *)&mop, mask, &pp);
+	assert_within_budget(&pathinfo_budget, "store_pathinfo");
 	put_multipath_config(conf);
 
 	if (flags & BL_MASK) {
@@ -286,6 +286,54 @@ static void test_dm_uuid_false_5(void **state)
 	assert_false(uevent_is_mpath(uev));
 }
 
+static void test_digest_stable(void **state)
+{
+	struct uevent *uev = *state;
+	unsigned long long digest = uevent_path_digest(uev, "ID_BOGUS");
+
+	assert_int_not_equal(digest, 0);
+	/* properties that uev_update_path() doesn't use */
+	uev->envp[5] = "ID_PATH=pci-0000:00:1f.2-ata-1";
+	uev->envp[6] = NULL;
+	assert_true(uevent_path_digest(uev, "ID_BOGUS") == digest);
+	uev->envp[5] = NULL;
+}
+
+static void test_digest_changed(void **state)
+{
+	struct uevent *uev = *state;
+	unsigned long long digest = uevent_path_digest(uev, "ID_BOGUS");
+
+	uev->envp[5] = "DM_MULTIPATH_DEVICE_PATH=1";
+	uev->envp[6] = NULL;
+	assert_true(uevent_path_digest(uev, "ID_BOGUS") != digest);
+	uev->envp[5] = NULL;
+
+	uev->kernel = "sdp";
+	assert_true(uevent_path_digest(uev, "ID_BOGUS") != digest);
+	uev->kernel = "sdo";
+
+	/* the WWID the path got from its uid_attribute */
+	uev->envp[1] = "ID_BOGUS=" WWID "0";
+	assert_true(uevent_path_digest(uev, "ID_BOGUS") != digest);
+	uev->envp[1] = "ID_BOGUS=" WWID;
+}
+
+static void test_digest_forced(void **state)
+{
+	struct uevent *uev = *state;
+
+	uev->envp[5] = "RESIZE=1";
+	uev->envp[6] = NULL;
+	assert_int_equal(uevent_path_digest(uev, "ID_BOGUS"), 0);
+	uev->envp[5] = NULL;
+
+	/* WWID from sysfs or VPD, or missing in the uevent */
+	assert_int_equal(uevent_path_digest(uev, NULL), 0);
+	assert_int_equal(uevent_path_digest(uev, ""), 0);
+	assert_int_equal(uevent_path_digest(uev, "ID_SPAM"), 0);
+}
+
 int test_uevent_get_XXX(void)
 {
 	const struct CMUnitTest tests[] = {
@@ -295,6 +343,9 @@ int test_uevent_get_XXX(void)
 		cmocka_unit_test(test_dm_name_good),
 		cmocka_unit_test(test_uid_attrs),
 		cmocka_unit_test(test_wwid),
+		cmocka_unit_test(test_digest_stable),
+		cmocka_unit_test(test_digest_changed),
+		cmocka_unit_test(test_digest_forced),
 		cmocka_unit_test(test_major_bad_0),
 		cmocka_unit_test(test_major_bad_1),
 		cmocka_unit_test(test_major_bad_2),
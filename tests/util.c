@@ -942,6 +942,75 @@ static int test_strchop(void)
 	return cmocka_run_group_tests(tests, NULL, NULL);
 }
 
+static void check_regex_literal(const char *re, const char *literal,
+				bool anchored)
+{
+	bool anch = !anchored;
+	char *lit = get_regex_literal(re, &anch);
+
+	if (literal) {
+		assert_non_null(lit);
+		assert_string_equal(lit, literal);
+	} else
+		assert_null(lit);
+	assert_int_equal(anch, anchored);
+	free(lit);
+}
+
+static void test_regex_literal_plain(void **state)
+{
+	check_regex_literal("foo", "foo", false);
+	check_regex_literal("^foo", "foo", true);
+	check_regex_literal("foo$", "foo", false);
+	check_regex_literal("^foo$", "foo", true);
+}
+
+static void test_regex_literal_partial(void **state)
+{
+	check_regex_literal("^foo.*", "foo", true);
+	check_regex_literal("foo[0-9]", "foo", false);
+	check_regex_literal("^fo+", "fo", true);
+	check_regex_literal("^foo*", "fo", true);
+	check_regex_literal("^foo?", "fo", true);
+	check_regex_literal("foo{0,1}", "fo", false);
+	check_regex_literal("foo(bar)?", "foo", false);
+	check_regex_literal("foo\\.bar", "foo", false);
+}
+
+static void test_regex_literal_none(void **state)
+{
+	check_regex_literal(NULL, NULL, false);
+	check_regex_literal("", NULL, false);
+	check_regex_literal("^", NULL, false);
+	check_regex_literal("^.oo", NULL, false);
+	check_regex_literal("f*oo", NULL, false);
+	check_regex_literal("^(SCSI_IDENT_|ID_WWN)", NULL, false);
+	check_regex_literal("foo|bar", NULL, false);
+	check_regex_literal("[a-z]foo", NULL, false);
+}
+
+static void test_regex_literal_match(void **state)
+{
+	assert_true(regex_literal_match(NULL, false, "any"));
+	assert_true(regex_literal_match("foo", false, "xfoox"));
+	assert_false(regex_literal_match("foo", false, "xfox"));
+	assert_true(regex_literal_match("foo", true, "foox"));
+	assert_false(regex_literal_match("foo", true, "xfoo"));
+	assert_false(regex_literal_match("foo", true, "fo"));
+}
+
+static int test_regex_literal(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_regex_literal_plain),
+		cmocka_unit_test(test_regex_literal_partial),
+		cmocka_unit_test(test_regex_literal_none),
+		cmocka_unit_test(test_regex_literal_match),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
 int main(void)
 {
 	int ret = 0;
@@ -952,5 +1021,6 @@ int main(void)
 	ret += test_strlcpy();
 	ret += test_strlcat();
 	ret += test_strchop();
+	ret += test_regex_literal();
 	return ret;
 }
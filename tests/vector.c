@@ -0,0 +1,134 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <cmocka.h>
+#include "vector.h"
+#include "globals.c"
+
+static vector fill_vector(int n)
+{
+	vector v = vector_alloc();
+	long i;
+
+	assert_ptr_not_equal(v, NULL);
+	for (i = 0; i < n; i++) {
+		assert_true(vector_alloc_slot(v));
+		vector_set_slot(v, (void *)(i + 1));
+	}
+	return v;
+}
+
+static void check_vector(const struct _vector *v, int n)
+{
+	long i;
+
+	assert_int_equal(VECTOR_SIZE(v), n);
+	assert_true(v->capacity >= n);
+	for (i = 0; i < n; i++)
+		assert_ptr_equal(VECTOR_SLOT(v, i), (void *)(i + 1));
+}
+
+/* capacity grows geometrically, not with every slot */
+static void test_vector_grow(void **state)
+{
+	vector v = fill_vector(1000);
+
+	check_vector(v, 1000);
+	assert_true(v->capacity < 2000);
+	assert_true(v->capacity >= 1000);
+	vector_free(v);
+}
+
+static void test_vector_reserve(void **state)
+{
+	vector v = fill_vector(3);
+	void **slot;
+	long i;
+
+	assert_true(vector_reserve(v, 100));
+	assert_int_equal(v->capacity, 100);
+	check_vector(v, 3);
+	slot = v->slot;
+	for (i = 3; i < 100; i++) {
+		assert_true(vector_alloc_slot(v));
+		vector_set_slot(v, (void *)(i + 1));
+	}
+	/* no reallocation */
+	assert_ptr_equal(v->slot, slot);
+	check_vector(v, 100);
+	/* reserving less than the capacity is a no-op */
+	assert_true(vector_reserve(v, 10));
+	assert_int_equal(v->capacity, 100);
+	vector_free(v);
+}
+
+static void test_vector_shrink(void **state)
+{
+	vector v = fill_vector(5);
+
+	assert_true(vector_reserve(v, 64));
+	vector_shrink_to_fit(v);
+	assert_int_equal(v->capacity, 5);
+	check_vector(v, 5);
+	vector_free(v);
+}
+
+/* deleting slots shrinks the capacity only when it's mostly unused */
+static void test_vector_del(void **state)
+{
+	vector v = fill_vector(64);
+	int cap = v->capacity;
+
+	vector_del_slot(v, 63);
+	assert_int_equal(v->capacity, cap);
+	check_vector(v, 63);
+	while (VECTOR_SIZE(v) > cap / 4)
+		vector_del_slot(v, VECTOR_SIZE(v) - 1);
+	assert_int_equal(v->capacity, cap / 2);
+	check_vector(v, cap / 4);
+	while (VECTOR_SIZE(v) > 0)
+		vector_del_slot(v, 0);
+	assert_int_equal(v->capacity, 0);
+	assert_ptr_equal(v->slot, NULL);
+	vector_free(v);
+}
+
+static void test_vector_insert(void **state)
+{
+	vector v = fill_vector(4);
+
+	assert_ptr_equal(vector_insert_slot(v, 0, (void *)5L), (void *)5L);
+	assert_int_equal(VECTOR_SIZE(v), 5);
+	assert_ptr_equal(VECTOR_SLOT(v, 0), (void *)5L);
+	assert_ptr_equal(VECTOR_SLOT(v, 1), (void *)1L);
+	assert_ptr_equal(VECTOR_SLOT(v, 4), (void *)4L);
+	vector_free(v);
+}
+
+static int test_vector(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_vector_grow),
+		cmocka_unit_test(test_vector_reserve),
+		cmocka_unit_test(test_vector_shrink),
+		cmocka_unit_test(test_vector_del),
+		cmocka_unit_test(test_vector_insert),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_vector();
+	return ret;
+}
@@ -19,6 +19,7 @@
 #include "vector.h"
 #include "structs.h"
 #include "discovery.h"
+#include "count-lib.h"
 #include "globals.c"
 
 #define VPD_BUFSIZ 4096
@@ -57,12 +58,23 @@ static const char vendor_id[] = "Linux";
 static const char test_id[] =
 	"A123456789AbcDefB123456789AbcDefC123456789AbcDefD123456789AbcDef";
 
+/* get_vpd_sgio() sends one SG_IO INQUIRY, and doesn't allocate memory */
+static const struct test_counts vpd_budget = {
+	.n = { [CNT_IOCTL] = 1, },
+};
+
+/* a second one if the page is longer than DEFAULT_SGIO_LEN */
+static const struct test_counts vpd_retry_budget = {
+	.n = { [CNT_IOCTL] = 2, },
+};
+
 int __wrap_ioctl(int fd, unsigned long request, void *param)
 {
 	int len;
 	struct sg_io_hdr *io_hdr;
 	unsigned char *val;
 
+	count_event(CNT_IOCTL, 1);
 	len = mock();
 	io_hdr = (struct sg_io_hdr *)param;
 	assert_in_range(len, 0, io_hdr->dxfer_len);
@@ -427,7 +439,9 @@ static void test_vpd_vnd_ ## len ## _ ## wlen(void **state)             \
 	free(exp_wwid);							\
 	will_return(__wrap_ioctl, n);					\
 	will_return(__wrap_ioctl, vt->vpdbuf);				\
+	counts_reset();						\
 	ret = get_vpd_sgio(10, 0x83, 0, vt->wwid, wlen);		\
+	assert_within_budget(&vpd_budget, __func__);		\
 	assert_correct_wwid("test_vpd_vnd_" #len "_" #wlen,		\
 			    exp_len, ret, '1', 0, false,		\
 			    exp_subst, vt->wwid);			\
@@ -457,7 +471,9 @@ static void test_vpd_str_ ## typ ## _ ## len ## _ ## wlen(void **state) \
 		exp_len = wlen - 1;					\
 	will_return(__wrap_ioctl, n);					\
 	will_return(__wrap_ioctl, vt->vpdbuf);				\
+	counts_reset();						\
 	ret = get_vpd_sgio(10, 0x83, 0, vt->wwid, wlen);		\
+	assert_within_budget(&vpd_budget, __func__);		\
 	assert_correct_wwid("test_vpd_str_" #typ "_" #len "_" #wlen,	\
 			    exp_len, ret, byte0[type], 0,		\
 			    type != STR_IQN,				\
@@ -494,7 +510,9 @@ static void test_vpd_naa_ ## naa ## _ ## wlen(void **state)             \
 			 3, naa, 0);					\
 	will_return(__wrap_ioctl, n);					\
 	will_return(__wrap_ioctl, vt->vpdbuf);				\
+	counts_reset();						\
 	ret = get_vpd_sgio(10, 0x83, 0, vt->wwid, wlen);		\
+	assert_within_budget(&vpd_budget, __func__);		\
 	assert_correct_wwid("test_vpd_naa_" #naa "_" #wlen,		\
 			    exp_len, ret, '3', '0' + naa, true,		\
 			    test_id, vt->wwid);				\
@@ -526,7 +544,10 @@ static void test_vpd_eui_ ## len ## _ ## wlen ## _ ## sml(void **state)	\
 	}								\
 	will_return(__wrap_ioctl, n);					\
 	will_return(__wrap_ioctl, vt->vpdbuf);				\
+	counts_reset();						\
 	ret = get_vpd_sgio(10, 0x83, 0, vt->wwid, wlen);		\
+	assert_within_budget(sml ? &vpd_retry_budget : &vpd_budget,	\
+			     __func__);					\
 	assert_correct_wwid("test_vpd_eui_" #len "_" #wlen "_" #sml,	\
 			    exp_len, ret, '2', 0, true,			\
 			    test_id, vt->wwid);				\
@@ -553,7 +574,9 @@ static void test_vpd80_ ## size ## _ ## len ## _ ## wlen(void **state)  \
 			 size, len);					\
 	will_return(__wrap_ioctl, n);					\
 	will_return(__wrap_ioctl, vt->vpdbuf);				\
+	counts_reset();						\
 	ret = get_vpd_sgio(10, 0x80, 0, vt->wwid, wlen);		\
+	assert_within_budget(&vpd_budget, __func__);		\
 	assert_correct_wwid("test_vpd80_" #size "_" #len "_" #wlen,	\
 			    exp_len, ret, 0, 0, false,			\
 			    input, vt->wwid);				\
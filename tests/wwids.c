@@ -0,0 +1,197 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Tests for batched updates of the wwids file: wwids added between
+ * wwids_batch_start() and wwids_batch_end(), with and without index.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include "globals.c"
+
+/* I have to do this to get at the static functions */
+#include "../libmultipath/wwids.c"
+
+static char tmpdir[] = "/tmp/wwids-test.XXXXXX";
+static char wwids_file[PATH_MAX];
+static char index_file[PATH_MAX];
+
+static int count_lines(void)
+{
+	char line[256];
+	FILE *f = fopen(wwids_file, "r");
+	int n = 0;
+
+	assert_non_null(f);
+	while (fgets(line, sizeof(line), f))
+		if (line[0] == '/')
+			n++;
+	fclose(f);
+	return n;
+}
+
+static void set_wwid(char *wwid, int i)
+{
+	snprintf(wwid, WWID_SIZE, "3600a0b800%06d", i);
+}
+
+static int setup(void **state)
+{
+	if (!mkdtemp(tmpdir))
+		return -1;
+	snprintf(wwids_file, sizeof(wwids_file), "%s/wwids", tmpdir);
+	snprintf(index_file, sizeof(index_file), "%s/wwids.index", tmpdir);
+	conf.wwids_file = wwids_file;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	unlink(wwids_file);
+	unlink(index_file);
+	rmdir(tmpdir);
+	conf.wwids_file = NULL;
+	return 0;
+}
+
+static int reset(void **state)
+{
+	unlink(wwids_file);
+	unlink(index_file);
+	conf.wwids_index = 0;
+	return 0;
+}
+
+static void test_batch(void **state)
+{
+	char wwid[WWID_SIZE];
+	int i;
+
+	set_wwid(wwid, 0);
+	assert_int_equal(remember_wwid(wwid), 1);
+
+	wwids_batch_start();
+	for (i = 0; i < 100; i++) {
+		set_wwid(wwid, i);
+		assert_int_equal(remember_wwid(wwid), i == 0 ? 0 : 1);
+	}
+	/* the batch is seen by this thread, but not written yet */
+	set_wwid(wwid, 50);
+	assert_int_equal(remember_wwid(wwid), 0);
+	assert_int_equal(check_wwids_file(wwid, 0), 0);
+	set_wwid(wwid, 100);
+	assert_int_equal(check_wwids_file(wwid, 0), -1);
+	assert_int_equal(count_lines(), 1);
+	assert_int_equal(wwids_batch_end(), 1);
+
+	assert_int_equal(count_lines(), 100);
+	for (i = 0; i < 100; i++) {
+		set_wwid(wwid, i);
+		assert_int_equal(check_wwids_file(wwid, 0), 0);
+	}
+}
+
+static void test_nested(void **state)
+{
+	char wwid[WWID_SIZE];
+
+	wwids_batch_start();
+	wwids_batch_start();
+	set_wwid(wwid, 1);
+	assert_int_equal(remember_wwid(wwid), 1);
+	assert_int_equal(wwids_batch_end(), 0);
+	assert_int_equal(count_lines(), 0);
+	assert_int_equal(wwids_batch_end(), 1);
+	assert_int_equal(count_lines(), 1);
+	/* unbalanced calls are ignored */
+	assert_int_equal(wwids_batch_end(), 0);
+}
+
+static void test_external_change(void **state)
+{
+	char wwid[WWID_SIZE];
+	FILE *f;
+
+	wwids_batch_start();
+	set_wwid(wwid, 1);
+	assert_int_equal(remember_wwid(wwid), 1);
+	set_wwid(wwid, 2);
+	assert_int_equal(remember_wwid(wwid), 1);
+
+	/* another process adds one of the batch first */
+	f = fopen(wwids_file, "a");
+	assert_non_null(f);
+	fprintf(f, "/3600a0b800000002/\n");
+	fclose(f);
+
+	assert_int_equal(wwids_batch_end(), 1);
+	assert_int_equal(count_lines(), 2);
+}
+
+static void test_remove(void **state)
+{
+	char wwid[WWID_SIZE];
+
+	wwids_batch_start();
+	set_wwid(wwid, 1);
+	assert_int_equal(remember_wwid(wwid), 1);
+	assert_int_equal(remove_wwid(wwid), 1);
+	assert_int_equal(check_wwids_file(wwid, 0), -1);
+	assert_int_equal(wwids_batch_end(), 0);
+	assert_int_equal(count_lines(), 0);
+}
+
+static void test_index(void **state)
+{
+	char wwid[WWID_SIZE];
+	int i;
+
+	conf.wwids_index = 1;
+	set_wwid(wwid, 0);
+	assert_int_equal(remember_wwid(wwid), 1);
+	assert_int_equal(access(index_file, F_OK), 0);
+
+	wwids_batch_start();
+	for (i = 1; i < 10; i++) {
+		set_wwid(wwid, i);
+		assert_int_equal(remember_wwid(wwid), 1);
+	}
+	assert_int_equal(wwids_batch_end(), 1);
+
+	/* the index still matches, and finds all wwids */
+	for (i = 0; i < 10; i++) {
+		set_wwid(wwid, i);
+		assert_int_equal(check_wwids_file(wwid, 0), 0);
+	}
+	set_wwid(wwid, 10);
+	assert_int_equal(check_wwids_file(wwid, 0), -1);
+	assert_int_equal(count_lines(), 10);
+}
+
+static int test_wwids(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_teardown(test_batch, reset),
+		cmocka_unit_test_teardown(test_nested, reset),
+		cmocka_unit_test_teardown(test_external_change, reset),
+		cmocka_unit_test_teardown(test_remove, reset),
+		cmocka_unit_test_teardown(test_index, reset),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	init_test_verbosity(-1);
+	ret += test_wwids();
+	return ret;
+}